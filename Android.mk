@@ -37,6 +37,7 @@ libweaveSharedLibraries := \
 	libchrome \
 	libexpat \
 	libcrypto \
+	libz \
 
 # libweave-external
 # ========================================================
@@ -7,8 +7,8 @@
 
 #include <base/bind.h>
 
+#include "examples/provider/async_log_sink.h"
 #include "examples/provider/avahi_client.h"
-#include "examples/provider/bluez_client.h"
 #include "examples/provider/curl_http_client.h"
 #include "examples/provider/event_http_server.h"
 #include "examples/provider/event_network.h"
@@ -76,8 +76,7 @@ class Daemon {
         config_store_{new weave::examples::FileConfigStore(opts.model_id,
                                                            task_runner_.get())},
         http_client_{new weave::examples::CurlHttpClient(task_runner_.get())},
-        network_{new weave::examples::EventNetworkImpl(task_runner_.get())},
-        bluetooth_{new weave::examples::BluetoothImpl} {
+        network_{new weave::examples::EventNetworkImpl(task_runner_.get())} {
     if (!opts.disable_privet) {
       network_->SetSimulateOffline(opts.force_bootstrapping);
 
@@ -91,7 +90,7 @@ class Daemon {
     device_ = weave::Device::Create(config_store_.get(), task_runner_.get(),
                                     http_client_.get(), network_.get(),
                                     dns_sd_.get(), http_server_.get(),
-                                    wifi_.get(), bluetooth_.get());
+                                    wifi_.get(), nullptr);
     if (!opts.registration_ticket.empty()) {
       registration_data_.ticket_id = opts.registration_ticket;
       registration_data_.service_url = opts.service_url;
@@ -118,11 +117,12 @@ class Daemon {
     LOG(INFO) << "Device registered: " << device->GetSettings().cloud_id;
   }
 
+  // First, so the messages logged while the device shuts down are written.
+  weave::examples::AsyncLogSink log_sink_;
   std::unique_ptr<weave::examples::EventTaskRunner> task_runner_;
   std::unique_ptr<weave::examples::FileConfigStore> config_store_;
   std::unique_ptr<weave::examples::CurlHttpClient> http_client_;
   std::unique_ptr<weave::examples::EventNetworkImpl> network_;
-  std::unique_ptr<weave::examples::BluetoothImpl> bluetooth_;
   std::unique_ptr<weave::examples::AvahiClient> dns_sd_;
   std::unique_ptr<weave::examples::HttpServerImpl> http_server_;
   std::unique_ptr<weave::examples::WifiImpl> wifi_;
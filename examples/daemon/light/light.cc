@@ -281,15 +281,15 @@ class LightHandler {
   }
 
   void UpdateLightState() {
-    base::DictionaryValue state;
-    state.SetString("onOff.state", light_status_ ? "on" : "off");
-    state.SetInteger("brightness.brightness", brightness_state_);
+    std::unique_ptr<base::DictionaryValue> state(new base::DictionaryValue());
+    state->SetString("onOff.state", light_status_ ? "on" : "off");
+    state->SetInteger("brightness.brightness", brightness_state_);
 
     std::unique_ptr<base::DictionaryValue> colorXy(new base::DictionaryValue());
     colorXy->SetDouble("colorX", color_X_);
     colorXy->SetDouble("colorY", color_Y_);
-    state.Set("colorXy.colorSetting", std::move(colorXy));
-    device_->SetStateProperties(kComponent, state, nullptr);
+    state->Set("colorXy.colorSetting", std::move(colorXy));
+    device_->SetStateProperties(kComponent, std::move(state), nullptr);
   }
 
   weave::Device* device_{nullptr};
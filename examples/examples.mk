@@ -52,16 +52,16 @@ example_daemon_common_flags += -levhtp
 endif
 
 out/$(BUILD_MODE)/weave_daemon_ledflasher : out/$(BUILD_MODE)/examples/daemon/ledflasher/ledflasher.o $(example_daemon_deps)
-	$(CXX) -o $@ $^ $(CFLAGS) $(example_daemon_common_flags)
+	$(CXX) -o $@ $^ $(CFLAGS) $(LDFLAGS_$(BUILD_MODE)) $(example_daemon_common_flags)
 
 out/$(BUILD_MODE)/weave_daemon_light : out/$(BUILD_MODE)/examples/daemon/light/light.o $(example_daemon_deps)
-	$(CXX) -o $@ $^ $(CFLAGS) $(example_daemon_common_flags)
+	$(CXX) -o $@ $^ $(CFLAGS) $(LDFLAGS_$(BUILD_MODE)) $(example_daemon_common_flags)
 
 out/$(BUILD_MODE)/weave_daemon_lock : out/$(BUILD_MODE)/examples/daemon/lock/lock.o $(example_daemon_deps)
-	$(CXX) -o $@ $^ $(CFLAGS) $(example_daemon_common_flags)
+	$(CXX) -o $@ $^ $(CFLAGS) $(LDFLAGS_$(BUILD_MODE)) $(example_daemon_common_flags)
 
 out/$(BUILD_MODE)/weave_daemon_sample : out/$(BUILD_MODE)/examples/daemon/sample/sample.o $(example_daemon_deps)
-	$(CXX) -o $@ $^ $(CFLAGS) $(example_daemon_common_flags)
+	$(CXX) -o $@ $^ $(CFLAGS) $(LDFLAGS_$(BUILD_MODE)) $(example_daemon_common_flags)
 
 all-examples : out/$(BUILD_MODE)/weave_daemon_ledflasher out/$(BUILD_MODE)/weave_daemon_light out/$(BUILD_MODE)/weave_daemon_lock out/$(BUILD_MODE)/weave_daemon_sample
 
@@ -0,0 +1,110 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "examples/provider/async_log_sink.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+
+namespace weave {
+namespace examples {
+
+namespace {
+
+AsyncLogSink* g_sink = nullptr;
+
+}  // namespace
+
+AsyncLogSink::AsyncLogSink(size_t capacity)
+    : buffer_(capacity), write_buffer_(capacity) {
+  CHECK_GT(capacity, 0u);
+  CHECK(!g_sink);
+  writer_ = std::thread{&AsyncLogSink::RunWriter, this};
+  g_sink = this;
+  logging::SetLogMessageHandler(&AsyncLogSink::HandleMessage);
+}
+
+AsyncLogSink::~AsyncLogSink() {
+  logging::SetLogMessageHandler(nullptr);
+  g_sink = nullptr;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stop_ = true;
+  }
+  ready_.notify_one();
+  writer_.join();
+}
+
+void AsyncLogSink::Flush() {
+  std::unique_lock<std::mutex> lock{mutex_};
+  written_.wait(lock, [this] { return size_ == 0 && !writing_; });
+}
+
+bool AsyncLogSink::HandleMessage(int severity,
+                                 const char* file,
+                                 int line,
+                                 size_t message_start,
+                                 const std::string& message) {
+  if (!g_sink)
+    return false;
+  if (severity >= logging::LOG_FATAL) {
+    // Keep the order, then let LogMessage write it and crash.
+    g_sink->Flush();
+    return false;
+  }
+  g_sink->Push(message);
+  return true;
+}
+
+void AsyncLogSink::Push(const std::string& message) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (buffer_.size() - size_ < message.size()) {
+      ++dropped_;
+      return;
+    }
+    size_t end = (begin_ + size_) % buffer_.size();
+    size_t first = std::min(message.size(), buffer_.size() - end);
+    memcpy(&buffer_[end], message.data(), first);
+    memcpy(&buffer_[0], message.data() + first, message.size() - first);
+    size_ += message.size();
+  }
+  ready_.notify_one();
+}
+
+void AsyncLogSink::RunWriter() {
+  std::unique_lock<std::mutex> lock{mutex_};
+  while (true) {
+    ready_.wait(lock, [this] { return size_ > 0 || dropped_ > 0 || stop_; });
+    if (size_ == 0 && dropped_ == 0)
+      return;
+
+    size_t size = size_;
+    size_t first = std::min(size, buffer_.size() - begin_);
+    memcpy(&write_buffer_[0], &buffer_[begin_], first);
+    memcpy(&write_buffer_[first], &buffer_[0], size - first);
+    begin_ = (begin_ + size) % buffer_.size();
+    size_ = 0;
+    size_t dropped = dropped_;
+    dropped_ = 0;
+    writing_ = true;
+
+    lock.unlock();
+    fwrite(write_buffer_.data(), 1, size, stderr);
+    if (dropped)
+      fprintf(stderr, "[%zu log messages dropped]\n", dropped);
+    fflush(stderr);
+    lock.lock();
+
+    writing_ = false;
+    written_.notify_all();
+  }
+}
+
+}  // namespace examples
+}  // namespace weave
@@ -0,0 +1,65 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_EXAMPLES_PROVIDER_ASYNC_LOG_SINK_H_
+#define LIBWEAVE_EXAMPLES_PROVIDER_ASYNC_LOG_SINK_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <base/macros.h>
+
+namespace weave {
+namespace examples {
+
+// Takes the writing of log messages off the main loop. Messages are copied
+// into a ring buffer of fixed size and written to stderr by a background
+// thread, so a slow console or pipe doesn't stall the device. When the writer
+// falls behind, new messages are dropped and counted rather than buffered
+// without bound. Fatal messages are written synchronously, after the buffer.
+// Only one sink can be installed at a time.
+class AsyncLogSink final {
+ public:
+  explicit AsyncLogSink(size_t capacity = 64 * 1024);
+  // Writes the buffered messages and uninstalls the sink.
+  ~AsyncLogSink();
+
+  // Blocks until the buffered messages are written.
+  void Flush();
+
+ private:
+  static bool HandleMessage(int severity,
+                            const char* file,
+                            int line,
+                            size_t message_start,
+                            const std::string& message);
+
+  void Push(const std::string& message);
+  void RunWriter();
+
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable written_;
+  // Ring buffer of message bytes, |size_| of them starting at |begin_|.
+  std::vector<char> buffer_;
+  size_t begin_{0};
+  size_t size_{0};
+  // Taken by the writer, so it writes without holding the lock.
+  std::vector<char> write_buffer_;
+  // Set while the writer writes what it took out of |buffer_|.
+  bool writing_{false};
+  size_t dropped_{0};
+  bool stop_{false};
+  std::thread writer_;
+
+  DISALLOW_COPY_AND_ASSIGN(AsyncLogSink);
+};
+
+}  // namespace examples
+}  // namespace weave
+
+#endif  // LIBWEAVE_EXAMPLES_PROVIDER_ASYNC_LOG_SINK_H_
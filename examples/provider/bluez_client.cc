@@ -1,14 +0,0 @@
-// Copyright 2015 The Weave Authors. All rights reserved.
-// Use of this source code is governed by a BSD-style license that can be
-// found in the LICENSE file.
-
-#include "examples/provider/bluez_client.h"
-
-namespace weave {
-namespace examples {
-
-BluetoothImpl::BluetoothImpl() {}
-BluetoothImpl::~BluetoothImpl() {}
-
-}  // namespace examples
-}  // namespace weave
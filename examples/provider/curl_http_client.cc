@@ -4,15 +4,16 @@
 
 #include "examples/provider/curl_http_client.h"
 
+#include <string.h>
+
 #include <algorithm>
-#include <future>
-#include <thread>
 
 #include <base/bind.h>
 #include <base/logging.h>
-#include <curl/curl.h>
+#include <base/strings/string_util.h>
 #include <weave/enum_to_string.h>
-#include <weave/provider/task_runner.h>
+
+#include "examples/provider/event_task_runner.h"
 
 namespace weave {
 namespace examples {
@@ -22,10 +23,19 @@ namespace {
 struct ResponseImpl : public provider::HttpClient::Response {
   int GetStatusCode() const override { return status; }
   std::string GetContentType() const override { return content_type; }
-  std::string GetData() const override { return data; }
+  std::string GetHeader(const std::string& name) const override {
+    for (const auto& header : headers) {
+      // Header names are case insensitive, and lower case in HTTP/2.
+      if (base::EqualsCaseInsensitiveASCII(header.first, name))
+        return header.second;
+    }
+    return {};
+  }
+  const std::string& GetData() const override { return data; }
 
   long status{0};
   std::string content_type;
+  provider::HttpClient::Headers headers;
   std::string data;
 };
 
@@ -56,123 +66,305 @@ size_t HeaderFunction(void* contents, size_t size, size_t nmemb, void* userp) {
   return size * nmemb;
 }
 
-std::pair<std::unique_ptr<CurlHttpClient::Response>, ErrorPtr>
-SendRequestBlocking(CurlHttpClient::Method method,
-                    const std::string& url,
-                    const CurlHttpClient::Headers& headers,
-                    const std::string& data) {
+// Limit of connections kept open to a single host. Requests above the limit
+// wait for a connection to be free, or share it if HTTP/2 is negotiated.
+const long kMaxHostConnections = 4;
+
+}  // namespace
+
+struct CurlHttpClient::Request {
   std::unique_ptr<CURL, decltype(&curl_easy_cleanup)> curl{curl_easy_init(),
                                                            &curl_easy_cleanup};
-  CHECK(curl);
+  std::unique_ptr<curl_slist, decltype(&curl_slist_free_all)> headers{
+      nullptr, &curl_slist_free_all};
+  // Request body, it must outlive the transfer.
+  std::string data;
+  // Streamed request body, and the data read from it but not taken by curl.
+  std::unique_ptr<InputStream> upload;
+  std::vector<char> upload_buffer;
+  size_t upload_size{0};
+  size_t upload_offset{0};
+  bool upload_pending{false};
+  bool upload_done{false};
+  bool upload_failed{false};
+  CurlHttpClient* client{nullptr};
+  std::unique_ptr<ResponseImpl> response{new ResponseImpl};
+  Headers response_headers;
+  SendRequestCallback callback;
+};
+
+CurlHttpClient::CurlHttpClient(EventTaskRunner* task_runner)
+    : multi_{curl_multi_init(), &curl_multi_cleanup},
+      task_runner_{task_runner} {
+  CHECK(multi_);
+  CHECK_EQ(CURLM_OK, curl_multi_setopt(multi_.get(), CURLMOPT_SOCKETFUNCTION,
+                                       &SocketFunction));
+  CHECK_EQ(CURLM_OK,
+           curl_multi_setopt(multi_.get(), CURLMOPT_SOCKETDATA, this));
+  CHECK_EQ(CURLM_OK, curl_multi_setopt(multi_.get(), CURLMOPT_TIMERFUNCTION,
+                                       &TimerFunction));
+  CHECK_EQ(CURLM_OK, curl_multi_setopt(multi_.get(), CURLMOPT_TIMERDATA, this));
+  CHECK_EQ(CURLM_OK, curl_multi_setopt(multi_.get(),
+                                       CURLMOPT_MAX_HOST_CONNECTIONS,
+                                       kMaxHostConnections));
+#ifdef CURLPIPE_MULTIPLEX
+  CHECK_EQ(CURLM_OK, curl_multi_setopt(multi_.get(), CURLMOPT_PIPELINING,
+                                       CURLPIPE_MULTIPLEX));
+#endif
+}
+
+CurlHttpClient::~CurlHttpClient() {
+  for (const auto& pair : pending_requests_)
+    curl_multi_remove_handle(multi_.get(), pair.first);
+  pending_requests_.clear();
+  multi_.reset();
+  for (curl_socket_t socket : sockets_)
+    task_runner_->RemoveIoCompletionTask(socket);
+}
+
+void CurlHttpClient::SendRequest(Method method,
+                                 const std::string& url,
+                                 const Headers& headers,
+                                 const std::string& data,
+                                 const SendRequestCallback& callback) {
+  std::unique_ptr<Request> request = CreateRequest(url, headers, callback);
+  CURL* curl = request->curl.get();
+  request->data = data;
 
   switch (method) {
-    case CurlHttpClient::Method::kGet:
-      CHECK_EQ(CURLE_OK, curl_easy_setopt(curl.get(), CURLOPT_HTTPGET, 1L));
+    case Method::kGet:
+      CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L));
       break;
-    case CurlHttpClient::Method::kPost:
-      CHECK_EQ(CURLE_OK, curl_easy_setopt(curl.get(), CURLOPT_HTTPPOST, 1L));
+    case Method::kPost:
+      CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_POST, 1L));
       break;
-    case CurlHttpClient::Method::kPatch:
-    case CurlHttpClient::Method::kPut:
-      CHECK_EQ(CURLE_OK, curl_easy_setopt(curl.get(), CURLOPT_CUSTOMREQUEST,
+    case Method::kPatch:
+    case Method::kPut:
+      CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST,
                                           weave::EnumToString(method).c_str()));
       break;
   }
 
-  CHECK_EQ(CURLE_OK, curl_easy_setopt(curl.get(), CURLOPT_URL, url.c_str()));
+  if (!data.empty() || method == Method::kPost) {
+    CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
+                                        static_cast<long>(data.size())));
+    CHECK_EQ(CURLE_OK,
+             curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->data.c_str()));
+  }
+
+  StartRequest(std::move(request));
+}
+
+void CurlHttpClient::SendRequest(Method method,
+                                 const std::string& url,
+                                 const Headers& headers,
+                                 std::unique_ptr<InputStream> data,
+                                 const SendRequestCallback& callback) {
+  CHECK(method != Method::kGet);
+  CHECK(data);
+  std::unique_ptr<Request> request = CreateRequest(url, headers, callback);
+  CURL* curl = request->curl.get();
+  request->upload = std::move(data);
+  request->upload_buffer.resize(CURL_MAX_WRITE_SIZE);
+
+  // An upload of unknown size is sent with chunked encoding over HTTP/1.1.
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST,
+                                      weave::EnumToString(method).c_str()));
+  CHECK_EQ(CURLE_OK,
+           curl_easy_setopt(curl, CURLOPT_READFUNCTION, &ReadFunction));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_READDATA, request.get()));
+
+  StartRequest(std::move(request));
+}
+
+std::unique_ptr<CurlHttpClient::Request> CurlHttpClient::CreateRequest(
+    const std::string& url,
+    const Headers& headers,
+    const SendRequestCallback& callback) {
+  std::unique_ptr<Request> request{new Request};
+  CURL* curl = request->curl.get();
+  CHECK(curl);
+  request->callback = callback;
+  request->client = this;
+
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_URL, url.c_str()));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L));
+#ifdef CURL_HTTP_VERSION_2TLS
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+                                      CURL_HTTP_VERSION_2TLS));
+#endif
+#ifdef CURLPIPE_MULTIPLEX
+  // Prefer waiting for a connection which can be multiplexed to opening a
+  // new one.
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L));
+#endif
 
   curl_slist* chunk = nullptr;
   for (const auto& h : headers)
     chunk = curl_slist_append(chunk, (h.first + ": " + h.second).c_str());
+  request->headers.reset(chunk);
 
-  CHECK_EQ(CURLE_OK, curl_easy_setopt(curl.get(), CURLOPT_HTTPHEADER, chunk));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk));
 
-  if (!data.empty() || method == CurlHttpClient::Method::kPost) {
-    CHECK_EQ(CURLE_OK,
-             curl_easy_setopt(curl.get(), CURLOPT_POSTFIELDS, data.c_str()));
-  }
-
-  std::unique_ptr<ResponseImpl> response{new ResponseImpl};
   CHECK_EQ(CURLE_OK,
-           curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, &WriteFunction));
+           curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &WriteFunction));
   CHECK_EQ(CURLE_OK,
-           curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &response->data));
-  CHECK_EQ(CURLE_OK, curl_easy_setopt(curl.get(), CURLOPT_HEADERFUNCTION,
-                                      &HeaderFunction));
-  provider::HttpClient::Headers response_headers;
+           curl_easy_setopt(curl, CURLOPT_WRITEDATA, &request->response->data));
   CHECK_EQ(CURLE_OK,
-           curl_easy_setopt(curl.get(), CURLOPT_HEADERDATA, &response_headers));
+           curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &HeaderFunction));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(curl, CURLOPT_HEADERDATA,
+                                      &request->response_headers));
+  return request;
+}
 
-  CURLcode res = curl_easy_perform(curl.get());
-  if (chunk)
-    curl_slist_free_all(chunk);
+void CurlHttpClient::StartRequest(std::unique_ptr<Request> request) {
+  CURL* curl = request->curl.get();
+  // Curl asks for the first timeout to start the transfer from there.
+  CHECK_EQ(CURLM_OK, curl_multi_add_handle(multi_.get(), curl));
+  pending_requests_.emplace(curl, std::move(request));
+}
 
-  ErrorPtr error;
-  if (res != CURLE_OK) {
-    Error::AddTo(&error, FROM_HERE, "curl_easy_perform_error",
-                 curl_easy_strerror(res));
-    return {nullptr, std::move(error)};
+size_t CurlHttpClient::ReadFunction(char* buffer,
+                                    size_t size,
+                                    size_t nitems,
+                                    void* userp) {
+  Request* request = static_cast<Request*>(userp);
+  if (request->upload_failed)
+    return CURL_READFUNC_ABORT;
+
+  if (request->upload_offset < request->upload_size) {
+    size_t copy_size = std::min(size * nitems,
+                                request->upload_size - request->upload_offset);
+    memcpy(buffer, request->upload_buffer.data() + request->upload_offset,
+           copy_size);
+    request->upload_offset += copy_size;
+    return copy_size;
   }
 
-  for (const auto& header : response_headers) {
-    if (header.first == "Content-Type")
-      response->content_type = header.second;
+  if (request->upload_done)
+    return 0;
+
+  // InputStream is asynchronous, so pause the transfer until data is read.
+  if (!request->upload_pending) {
+    request->upload_pending = true;
+    request->upload->Read(
+        request->upload_buffer.data(), request->upload_buffer.size(),
+        base::Bind(&CurlHttpClient::OnUploadRead,
+                   request->client->weak_ptr_factory_.GetWeakPtr(),
+                   request->curl.get()));
   }
+  return CURL_READFUNC_PAUSE;
+}
+
+void CurlHttpClient::OnUploadRead(CURL* curl, size_t size, ErrorPtr error) {
+  auto it = pending_requests_.find(curl);
+  if (it == pending_requests_.end())
+    return;
+  Request* request = it->second.get();
+  request->upload_pending = false;
+  request->upload_offset = 0;
+  request->upload_size = size;
+  if (error) {
+    LOG(ERROR) << "Failed to read request data: " << error->GetMessage();
+    request->upload_failed = true;
+  } else if (size == 0) {
+    request->upload_done = true;
+  }
+  curl_easy_pause(curl, CURLPAUSE_CONT);
+}
 
-  CHECK_EQ(CURLE_OK, curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE,
-                                       &response->status));
+int CurlHttpClient::SocketFunction(CURL* curl,
+                                   curl_socket_t socket,
+                                   int what,
+                                   void* userp,
+                                   void* socketp) {
+  CurlHttpClient* self = static_cast<CurlHttpClient*>(userp);
+  self->task_runner_->RemoveIoCompletionTask(socket);
+  if (what == CURL_POLL_REMOVE) {
+    self->sockets_.erase(socket);
+    return 0;
+  }
 
-  return {std::move(response), nullptr};
+  int16_t events = 0;
+  if (what & CURL_POLL_IN)
+    events |= EventTaskRunner::kReadable;
+  if (what & CURL_POLL_OUT)
+    events |= EventTaskRunner::kWriteable;
+  self->sockets_.insert(socket);
+  self->task_runner_->AddIoCompletionTask(
+      socket, events, base::Bind(&CurlHttpClient::OnSocketEvent,
+                                 self->weak_ptr_factory_.GetWeakPtr()));
+  return 0;
 }
 
-}  // namespace
+int CurlHttpClient::TimerFunction(CURLM* multi, long timeout_ms, void* userp) {
+  CurlHttpClient* self = static_cast<CurlHttpClient*>(userp);
+  self->timer_ptr_factory_.InvalidateWeakPtrs();
+  if (timeout_ms < 0)
+    return 0;
+  // Curl must not be called back from inside of this function.
+  self->task_runner_->PostDelayedTask(
+      FROM_HERE, base::Bind(&CurlHttpClient::OnTimeout,
+                            self->timer_ptr_factory_.GetWeakPtr()),
+      base::TimeDelta::FromMilliseconds(timeout_ms));
+  return 0;
+}
 
-CurlHttpClient::CurlHttpClient(provider::TaskRunner* task_runner)
-    : task_runner_{task_runner} {}
+void CurlHttpClient::OnSocketEvent(int fd,
+                                   int16_t what,
+                                   EventTaskRunner* sender) {
+  int action = 0;
+  if (what & EventTaskRunner::kReadable)
+    action |= CURL_CSELECT_IN;
+  if (what & EventTaskRunner::kWriteable)
+    action |= CURL_CSELECT_OUT;
+  int running = 0;
+  CHECK_EQ(CURLM_OK,
+           curl_multi_socket_action(multi_.get(), fd, action, &running));
+  CheckDone();
+}
 
-void CurlHttpClient::SendRequest(Method method,
-                                 const std::string& url,
-                                 const Headers& headers,
-                                 const std::string& data,
-                                 const SendRequestCallback& callback) {
-  pending_tasks_.emplace_back(
-      std::async(std::launch::async, SendRequestBlocking, method, url, headers,
-                 data),
-      callback);
-  if (pending_tasks_.size() == 1)  // More means check is scheduled.
-    CheckTasks();
+void CurlHttpClient::OnTimeout() {
+  int running = 0;
+  CHECK_EQ(CURLM_OK, curl_multi_socket_action(multi_.get(), CURL_SOCKET_TIMEOUT,
+                                              0, &running));
+  CheckDone();
 }
 
-void CurlHttpClient::CheckTasks() {
-  VLOG(4) << "CurlHttpClient::CheckTasks, size=" << pending_tasks_.size();
-  auto ready_begin =
-      std::partition(pending_tasks_.begin(), pending_tasks_.end(),
-                     [](const decltype(pending_tasks_)::value_type& value) {
-                       return value.first.wait_for(std::chrono::seconds(0)) !=
-                              std::future_status::ready;
-                     });
-
-  for (auto it = ready_begin; it != pending_tasks_.end(); ++it) {
-    CHECK(it->first.valid());
-    auto result = it->first.get();
-    VLOG(2) << "CurlHttpClient::CheckTasks done";
+void CurlHttpClient::CheckDone() {
+  int messages_left = 0;
+  CURLMsg* message = nullptr;
+  while ((message = curl_multi_info_read(multi_.get(), &messages_left))) {
+    if (message->msg != CURLMSG_DONE)
+      continue;
+    auto it = pending_requests_.find(message->easy_handle);
+    CHECK(it != pending_requests_.end());
+    std::unique_ptr<Request> request = std::move(it->second);
+    pending_requests_.erase(it);
+    CURLcode res = message->data.result;
+    curl_multi_remove_handle(multi_.get(), request->curl.get());
+
+    std::unique_ptr<ResponseImpl> response;
+    ErrorPtr error;
+    if (res != CURLE_OK) {
+      Error::AddTo(&error, FROM_HERE, "curl_easy_perform_error",
+                   curl_easy_strerror(res));
+    } else {
+      response = std::move(request->response);
+      response->headers = std::move(request->response_headers);
+      response->content_type = response->GetHeader("Content-Type");
+      CHECK_EQ(CURLE_OK, curl_easy_getinfo(request->curl.get(),
+                                           CURLINFO_RESPONSE_CODE,
+                                           &response->status));
+    }
+    VLOG(2) << "CurlHttpClient request done";
+    std::unique_ptr<Response> result{std::move(response)};
     task_runner_->PostDelayedTask(
-        FROM_HERE, base::Bind(it->second, base::Passed(&result.first),
-                              base::Passed(&result.second)),
+        FROM_HERE, base::Bind(request->callback, base::Passed(&result),
+                              base::Passed(&error)),
         {});
   }
-
-  pending_tasks_.erase(ready_begin, pending_tasks_.end());
-
-  if (pending_tasks_.empty()) {
-    VLOG(2) << "No more CurlHttpClient tasks";
-    return;
-  }
-
-  task_runner_->PostDelayedTask(
-      FROM_HERE,
-      base::Bind(&CurlHttpClient::CheckTasks, weak_ptr_factory_.GetWeakPtr()),
-      base::TimeDelta::FromMilliseconds(100));
 }
 
 }  // namespace examples
@@ -5,42 +5,78 @@
 #ifndef LIBWEAVE_EXAMPLES_PROVIDER_CURL_HTTP_CLIENT_H_
 #define LIBWEAVE_EXAMPLES_PROVIDER_CURL_HTTP_CLIENT_H_
 
-#include <future>
+#include <map>
+#include <memory>
+#include <set>
 #include <string>
-#include <utility>
 
 #include <base/memory/weak_ptr.h>
+#include <curl/curl.h>
 #include <weave/provider/http_client.h>
 
 namespace weave {
 
-namespace provider {
-class TaskRunner;
-}
-
 namespace examples {
 
-// Basic implementation of weave::HttpClient using libcurl. Should be used in
-// production code as it's blocking and does not validate server certificates.
+class EventTaskRunner;
+
+// Basic implementation of weave::HttpClient using libcurl. Should not be used
+// in production code as it does not validate server certificates.
+// All requests share one curl multi handle, so connections to the same host
+// are kept alive and reused, and multiplexed over HTTP/2 when the server
+// supports it. Transfers are driven by socket events of |task_runner|.
 class CurlHttpClient : public provider::HttpClient {
  public:
-  explicit CurlHttpClient(provider::TaskRunner* task_runner);
+  explicit CurlHttpClient(EventTaskRunner* task_runner);
+  ~CurlHttpClient() override;
 
   void SendRequest(Method method,
                    const std::string& url,
                    const Headers& headers,
                    const std::string& data,
                    const SendRequestCallback& callback) override;
+  void SendRequest(Method method,
+                   const std::string& url,
+                   const Headers& headers,
+                   std::unique_ptr<InputStream> data,
+                   const SendRequestCallback& callback) override;
 
  private:
-  void CheckTasks();
+  struct Request;
+
+  // Sets up options shared by all requests, except for the method and body.
+  std::unique_ptr<Request> CreateRequest(const std::string& url,
+                                         const Headers& headers,
+                                         const SendRequestCallback& callback);
+  void StartRequest(std::unique_ptr<Request> request);
+
+  // Feeds curl with the body read from the request InputStream.
+  static size_t ReadFunction(char* buffer,
+                             size_t size,
+                             size_t nitems,
+                             void* userp);
+  void OnUploadRead(CURL* curl, size_t size, ErrorPtr error);
+
+  // Callbacks of the curl multi interface.
+  static int SocketFunction(CURL* curl,
+                            curl_socket_t socket,
+                            int what,
+                            void* userp,
+                            void* socketp);
+  static int TimerFunction(CURLM* multi, long timeout_ms, void* userp);
+
+  void OnSocketEvent(int fd, int16_t what, EventTaskRunner* sender);
+  void OnTimeout();
+  // Completes the requests curl has finished with.
+  void CheckDone();
 
-  std::vector<
-      std::pair<std::future<std::pair<std::unique_ptr<Response>, ErrorPtr>>,
-                SendRequestCallback>>
-      pending_tasks_;
-  provider::TaskRunner* task_runner_{nullptr};
+  std::unique_ptr<CURLM, decltype(&curl_multi_cleanup)> multi_;
+  std::map<CURL*, std::unique_ptr<Request>> pending_requests_;
+  // Sockets watched for curl.
+  std::set<curl_socket_t> sockets_;
+  EventTaskRunner* task_runner_{nullptr};
 
+  base::WeakPtrFactory<CurlHttpClient> timer_ptr_factory_{this};
   base::WeakPtrFactory<CurlHttpClient> weak_ptr_factory_{this};
 };
 
@@ -19,6 +19,34 @@ namespace examples {
 
 namespace {
 
+// Idle keep-alive connections are closed after this time. Privet answers
+// long-polling requests a bit earlier, see GetRequestTimeout().
+const int kIdleTimeoutSeconds = 120;
+// Limits the number of open HTTP and HTTPS connections, including idle ones.
+const size_t kMaxConnections = 32;
+// Cached TLS sessions, so reconnecting clients skip the full handshake.
+const long kTlsSessionCacheSize = 64;
+const long kTlsSessionTimeoutSeconds = 3600;
+const unsigned char kTlsSessionIdContext[] = "weave-privet";
+// Events not sent to a slow client yet, beyond which its stream is dropped.
+const size_t kMaxStreamingBacklog = 64 * 1024;
+
+// Sends the reply with Content-Length, so the client can keep the connection
+// open for the next request.
+void SendReplyBuffer(evhtp_request_t* req,
+                     int status_code,
+                     EventPtr<evbuffer> buf,
+                     const std::string& mime_type) {
+  evhtp_header_key_add(req->headers_out, "Content-Type", 0);
+  evhtp_header_val_add(req->headers_out, mime_type.c_str(), 1);
+  evhtp_header_key_add(req->headers_out, "Content-Length", 0);
+  std::string content_length = std::to_string(evbuffer_get_length(buf.get()));
+  evhtp_header_val_add(req->headers_out, content_length.c_str(), 1);
+  evhtp_send_reply_start(req, status_code);
+  evhtp_send_reply_body(req, buf.get());
+  evhtp_send_reply_end(req);
+}
+
 std::string GetSslError() {
   char error[1000] = {};
   ERR_error_string_n(ERR_get_error(), error, sizeof(error));
@@ -35,7 +63,13 @@ class HttpServerImpl::RequestImpl : public Request {
     evbuffer_remove(input_buffer, &data_[0], data_.size());
   }
 
-  ~RequestImpl() {}
+  ~RequestImpl() {
+    if (streaming_) {
+      evhtp_unset_hook(&req_->hooks, evhtp_hook_on_error);
+      if (!closed_)
+        evhtp_send_reply_chunk_end(req_.get());
+    }
+  }
 
   std::string GetPath() const override { return req_->uri->path->full; }
 
@@ -46,26 +80,83 @@ class HttpServerImpl::RequestImpl : public Request {
     return header;
   }
 
-  std::string GetData() { return data_; }
+  std::string GetData() override { return data_; }
+  std::string TakeData() override { return std::move(data_); }
 
   void SendReply(int status_code,
                  const std::string& data,
                  const std::string& mime_type) override {
     EventPtr<evbuffer> buf{evbuffer_new()};
     evbuffer_add(buf.get(), data.data(), data.size());
+    SendReplyBuffer(req_.get(), status_code, std::move(buf), mime_type);
+  }
+
+  void SendOwnedReply(int status_code,
+                      std::string data,
+                      const std::string& mime_type) override {
+    EventPtr<evbuffer> buf{evbuffer_new()};
+    if (!data.empty()) {
+      // Let the buffer reference the string until it's sent.
+      std::string* body = new std::string{std::move(data)};
+      evbuffer_add_reference(buf.get(), body->data(), body->size(),
+                             &DeleteString, body);
+    }
+    SendReplyBuffer(req_.get(), status_code, std::move(buf), mime_type);
+  }
+
+  bool SendEncodedReply(int status_code,
+                        std::string data,
+                        const std::string& mime_type,
+                        const std::string& content_encoding) override {
+    evhtp_header_key_add(req_->headers_out, "Content-Encoding", 0);
+    evhtp_header_val_add(req_->headers_out, content_encoding.c_str(), 1);
+    SendOwnedReply(status_code, std::move(data), mime_type);
+    return true;
+  }
+
+  bool BeginStreamingReply(int status_code,
+                           const std::string& mime_type) override {
     evhtp_header_key_add(req_->headers_out, "Content-Type", 0);
     evhtp_header_val_add(req_->headers_out, mime_type.c_str(), 1);
-    evhtp_header_key_add(req_->headers_out, "Content-Length", 0);
-    std::string content_length = std::to_string(evbuffer_get_length(buf.get()));
-    evhtp_header_val_add(req_->headers_out, content_length.c_str(), 1);
-    evhtp_send_reply_start(req_.get(), status_code);
-    evhtp_send_reply_body(req_.get(), buf.get());
-    evhtp_send_reply_end(req_.get());
+    evhtp_set_hook(&req_->hooks, evhtp_hook_on_error,
+                   reinterpret_cast<evhtp_hook>(&OnStreamError), this);
+    evhtp_send_reply_chunk_start(req_.get(), status_code);
+    streaming_ = true;
+    return true;
+  }
+
+  bool SendReplyChunk(const std::string& data) override {
+    if (closed_)
+      return false;
+    evhtp_connection_t* conn = evhtp_request_get_connection(req_.get());
+    bufferevent* bev = conn ? evhtp_connection_get_bev(conn) : nullptr;
+    if (!bev ||
+        evbuffer_get_length(bufferevent_get_output(bev)) >
+            kMaxStreamingBacklog) {
+      return false;
+    }
+    EventPtr<evbuffer> buf{evbuffer_new()};
+    evbuffer_add(buf.get(), data.data(), data.size());
+    evhtp_send_reply_chunk(req_.get(), buf.get());
+    return true;
   }
 
  private:
+  static void DeleteString(const void* data, size_t size, void* str) {
+    delete static_cast<std::string*>(str);
+  }
+
+  // Called when the connection of a streaming reply fails or is closed.
+  static void OnStreamError(evhtp_request_t* req,
+                            evhtp_error_flags errtype,
+                            void* arg) {
+    static_cast<RequestImpl*>(arg)->closed_ = true;
+  }
+
   EventPtr<evhtp_request_t> req_;
   std::string data_;
+  bool streaming_{false};
+  bool closed_{false};
 };
 
 HttpServerImpl::HttpServerImpl(EventTaskRunner* task_runner)
@@ -95,6 +186,13 @@ HttpServerImpl::HttpServerImpl(EventTaskRunner* task_runner)
 
   CHECK_EQ(1, SSL_CTX_check_private_key(ctx.get())) << GetSslError();
 
+  SSL_CTX_set_session_cache_mode(ctx.get(), SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(ctx.get(), kTlsSessionCacheSize);
+  SSL_CTX_set_timeout(ctx.get(), kTlsSessionTimeoutSeconds);
+  CHECK_EQ(1, SSL_CTX_set_session_id_context(ctx.get(), kTlsSessionIdContext,
+                                             sizeof(kTlsSessionIdContext) - 1))
+      << GetSslError();
+
   httpd_.reset(evhtp_new(task_runner_->GetEventBase(), nullptr));
   CHECK(httpd_);
   httpsd_.reset(evhtp_new(task_runner_->GetEventBase(), nullptr));
@@ -102,6 +200,12 @@ HttpServerImpl::HttpServerImpl(EventTaskRunner* task_runner)
 
   httpsd_.get()->ssl_ctx = ctx.release();
 
+  timeval idle_timeout = {kIdleTimeoutSeconds, 0};
+  for (evhtp_t* htp : {httpd_.get(), httpsd_.get()}) {
+    evhtp_set_timeouts(htp, &idle_timeout, &idle_timeout);
+    evhtp_set_post_accept_cb(htp, &OnConnectionAccepted, this);
+  }
+
   CHECK_EQ(0, evhtp_bind_socket(httpd_.get(), "0.0.0.0", GetHttpPort(), -1));
   CHECK_EQ(0, evhtp_bind_socket(httpsd_.get(), "0.0.0.0", GetHttpsPort(), -1));
 }
@@ -135,9 +239,28 @@ void HttpServerImpl::GenerateX509(X509* x509, EVP_PKEY* pkey) {
 void HttpServerImpl::NotFound(evhtp_request_t* req) {
   EventPtr<evbuffer> buf{evbuffer_new()};
   evbuffer_add_printf(buf.get(), "404 Not Found: %s\n", req->uri->path->full);
-  evhtp_send_reply_start(req, 404);
-  evhtp_send_reply_body(req, buf.get());
-  evhtp_send_reply_end(req);
+  SendReplyBuffer(req, 404, std::move(buf), "text/plain");
+}
+
+evhtp_res HttpServerImpl::OnConnectionAccepted(evhtp_connection_t* conn,
+                                               void* arg) {
+  HttpServerImpl* server = static_cast<HttpServerImpl*>(arg);
+  if (server->connection_count_ >= kMaxConnections) {
+    LOG(WARNING) << "Too many HTTP connections, dropping the new one";
+    return EVHTP_RES_ERROR;
+  }
+  ++server->connection_count_;
+  evhtp_set_hook(&conn->hooks, evhtp_hook_on_connection_fini,
+                 reinterpret_cast<evhtp_hook>(&OnConnectionClosed), arg);
+  return EVHTP_RES_OK;
+}
+
+evhtp_res HttpServerImpl::OnConnectionClosed(evhtp_connection_t* conn,
+                                             void* arg) {
+  HttpServerImpl* server = static_cast<HttpServerImpl*>(arg);
+  CHECK_GT(server->connection_count_, 0u);
+  --server->connection_count_;
+  return EVHTP_RES_OK;
 }
 
 void HttpServerImpl::ProcessRequest(evhtp_request_t* req) {
@@ -192,7 +315,7 @@ uint16_t HttpServerImpl::GetHttpsPort() const {
 }
 
 base::TimeDelta HttpServerImpl::GetRequestTimeout() const {
-  return base::TimeDelta::Max();
+  return base::TimeDelta::FromSeconds(kIdleTimeoutSeconds);
 }
 
 std::vector<uint8_t> HttpServerImpl::GetHttpsCertificateFingerprint() const {
@@ -49,6 +49,9 @@ class HttpServerImpl : public provider::HttpServer {
                     const std::string& data,
                     const std::string& mime_type);
   void NotFound(evhtp_request_t* req);
+  // Counts open connections and limits their number.
+  static evhtp_res OnConnectionAccepted(evhtp_connection_t* conn, void* arg);
+  static evhtp_res OnConnectionClosed(evhtp_connection_t* conn, void* arg);
 
   std::map<std::pair<std::string, const evhtp_t*>, RequestHandlerCallback>
       handlers_;
@@ -57,6 +60,7 @@ class HttpServerImpl : public provider::HttpServer {
   EventTaskRunner* task_runner_{nullptr};
   EventPtr<evhtp_t> httpd_;
   EventPtr<evhtp_t> httpsd_;
+  size_t connection_count_{0};
 
   base::WeakPtrFactory<HttpServerImpl> weak_ptr_factory_{this};
 };
@@ -12,6 +12,7 @@
 
 #include "examples/provider/event_task_runner.h"
 #include "examples/provider/ssl_stream.h"
+#include "examples/provider/tcp_connector.h"
 
 namespace weave {
 namespace examples {
@@ -20,6 +21,18 @@ namespace {
 const char kNetworkProbeHostname[] = "talk.google.com";
 const int kNetworkProbePort = 5223;
 const int kNetworkProbeTimeoutS = 2;
+
+void OnSocketConnected(EventTaskRunner* task_runner,
+                       const std::string& host,
+                       uint16_t port,
+                       const provider::Network::OpenSslSocketCallback& callback,
+                       int socket,
+                       ErrorPtr error) {
+  if (socket < 0)
+    return callback.Run(nullptr, std::move(error));
+  SSLStream::Connect(task_runner, host, port, socket, callback);
+}
+
 }  // namespace
 
 void EventNetworkImpl::Deleter::operator()(evdns_base* dns_base) {
@@ -31,10 +44,15 @@ void EventNetworkImpl::Deleter::operator()(bufferevent* bev) {
 }
 
 EventNetworkImpl::EventNetworkImpl(EventTaskRunner* task_runner)
-    : task_runner_(task_runner) {
+    : task_runner_(task_runner),
+      dns_base_(evdns_base_new(task_runner->GetEventBase(),
+                               EVDNS_BASE_INITIALIZE_NAMESERVERS)),
+      connector_(new TcpConnector{task_runner, dns_base_.get()}) {
   UpdateNetworkState();
 }
 
+EventNetworkImpl::~EventNetworkImpl() {}
+
 void EventNetworkImpl::AddConnectionChangedCallback(
     const ConnectionChangedCallback& callback) {
   callbacks_.push_back(callback);
@@ -110,7 +128,9 @@ weave::provider::Network::State EventNetworkImpl::GetConnectionState() const {
 void EventNetworkImpl::OpenSslSocket(const std::string& host,
                                      uint16_t port,
                                      const OpenSslSocketCallback& callback) {
-  SSLStream::Connect(task_runner_, host, port, callback);
+  connector_->Connect(
+      host, port, base::Bind(&OnSocketConnected, task_runner_, host, port,
+                             callback));
 }
 
 }  // namespace examples
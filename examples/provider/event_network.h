@@ -5,6 +5,7 @@
 #ifndef LIBWEAVE_EXAMPLES_UBUNTU_EVENT_NETWORK_H_
 #define LIBWEAVE_EXAMPLES_UBUNTU_EVENT_NETWORK_H_
 
+#include <memory>
 #include <vector>
 
 #include <weave/provider/network.h>
@@ -18,6 +19,7 @@ namespace weave {
 namespace examples {
 
 class EventTaskRunner;
+class TcpConnector;
 
 class EventNetworkImpl : public weave::provider::Network {
   class Deleter {
@@ -28,6 +30,7 @@ class EventNetworkImpl : public weave::provider::Network {
 
  public:
   explicit EventNetworkImpl(EventTaskRunner* task_runner_);
+  ~EventNetworkImpl() override;
   void AddConnectionChangedCallback(
       const ConnectionChangedCallback& callback) override;
   State GetConnectionState() const override;
@@ -46,6 +49,8 @@ class EventNetworkImpl : public weave::provider::Network {
   bool simulate_offline_{false};
   EventTaskRunner* task_runner_{nullptr};
   std::unique_ptr<evdns_base, Deleter> dns_base_;
+  // Destroyed before |dns_base_|, it cancels its requests.
+  std::unique_ptr<TcpConnector> connector_;
   std::vector<ConnectionChangedCallback> callbacks_;
   provider::Network::State network_state_{provider::Network::State::kOffline};
   std::unique_ptr<bufferevent, Deleter> connectivity_probe_;
@@ -6,22 +6,63 @@
 
 #include <signal.h>
 
+#include <algorithm>
+#include <iterator>
+
 namespace weave {
 namespace examples {
 
 namespace {
 event_base* g_event_base = nullptr;
+
+const size_t kMaxTasksPerWakeup = 256;
 }
 
 void EventTaskRunner::PostDelayedTask(
     const tracked_objects::Location& from_here,
     const base::Closure& task,
     base::TimeDelta delay) {
+  PostTaskWithPriority(from_here, task, delay, Priority::kNormal);
+}
+
+provider::TaskRunner::TaskId EventTaskRunner::PostTaskWithPriority(
+    const tracked_objects::Location& from_here,
+    const base::Closure& task,
+    base::TimeDelta delay,
+    Priority priority) {
+  TaskId id = ++counter_;
+  if (delay <= base::TimeDelta()) {
+    // Fast path, the task just waits for the next wakeup in the run queue.
+    AddReadyTask(id, priority, task);
+    if (!processing_ && ready_ids_.size() == 1)
+      ReScheduleEvent({});
+    return id;
+  }
+
   base::Time new_time = base::Time::Now() + delay;
-  if (queue_.empty() || new_time < queue_.top().first.first) {
+  if (!processing_ && (wakeup_time_.is_null() || new_time < wakeup_time_))
     ReScheduleEvent(delay);
-  }
-  queue_.emplace(std::make_pair(new_time, ++counter_), task);
+  timers_.emplace(std::make_pair(new_time, id), std::make_pair(priority, task));
+  timer_times_.emplace(id, new_time);
+  return id;
+}
+
+void EventTaskRunner::CancelTask(TaskId id) {
+  // Cancelled tasks in the run queue are dropped when they come up.
+  if (ready_ids_.erase(id))
+    return;
+  auto p = timer_times_.find(id);
+  if (p == timer_times_.end())
+    return;
+  timers_.erase(std::make_pair(p->second, id));
+  timer_times_.erase(p);
+}
+
+void EventTaskRunner::AddReadyTask(TaskId id,
+                                   Priority priority,
+                                   const base::Closure& task) {
+  ready_[static_cast<size_t>(priority)].emplace_back(id, task);
+  ready_ids_.insert(id);
 }
 
 void EventTaskRunner::AddIoCompletionTask(
@@ -36,8 +77,7 @@ void EventTaskRunner::AddIoCompletionTask(
 #endif
   event* ioevent = event_new(base_.get(), fd, flags, FdEventHandler, this);
   EventPtr<event> ioeventPtr{ioevent};
-  fd_task_map_.insert(
-      std::make_pair(fd, std::make_pair(std::move(ioeventPtr), task)));
+  fd_task_map_[fd] = std::make_pair(std::move(ioeventPtr), task);
   event_add(ioevent, nullptr);
 }
 
@@ -62,6 +102,7 @@ void EventTaskRunner::Run() {
 }
 
 void EventTaskRunner::ReScheduleEvent(base::TimeDelta delay) {
+  wakeup_time_ = base::Time::Now() + delay;
   timespec ts = delay.ToTimeSpec();
   timeval tv = {ts.tv_sec, ts.tv_nsec / 1000};
   event_add(task_event_.get(), &tv);
@@ -79,15 +120,40 @@ void EventTaskRunner::FreeEvent(event* evnt) {
 }
 
 void EventTaskRunner::Process() {
-  while (!queue_.empty() && queue_.top().first.first <= base::Time::Now()) {
-    auto cb = queue_.top().second;
-    queue_.pop();
-    cb.Run();
+  wakeup_time_ = base::Time{};
+  processing_ = true;
+
+  base::Time now = base::Time::Now();
+  while (!timers_.empty() && timers_.begin()->first.first <= now) {
+    auto top = timers_.begin();
+    AddReadyTask(top->first.second, top->second.first, top->second.second);
+    timer_times_.erase(top->first.second);
+    timers_.erase(top);
+  }
+
+  // Run the tasks which are ready, the most important first. Tasks posted
+  // meanwhile run in the same batch, but the batch is limited, so I/O events
+  // are not starved.
+  for (size_t i = 0; i < kMaxTasksPerWakeup && !ready_ids_.empty(); ++i) {
+    std::deque<ReadyTask>* queue = std::end(ready_);
+    while ((--queue)->empty()) {
+    }
+    ReadyTask task = std::move(queue->front());
+    queue->pop_front();
+    if (ready_ids_.erase(task.first))
+      task.second.Run();
   }
-  if (!queue_.empty()) {
-    base::TimeDelta delta = std::max(
-        base::TimeDelta(), queue_.top().first.first - base::Time::Now());
-    ReScheduleEvent(delta);
+  if (ready_ids_.empty()) {
+    for (auto& queue : ready_)
+      queue.clear();
+  }
+
+  processing_ = false;
+  if (!ready_ids_.empty()) {
+    ReScheduleEvent({});
+  } else if (!timers_.empty()) {
+    ReScheduleEvent(std::max(base::TimeDelta(),
+                             timers_.begin()->first.first - base::Time::Now()));
   }
 }
 
@@ -98,8 +164,15 @@ void EventTaskRunner::FdEventHandler(int fd, int16_t what, void* runner) {
 void EventTaskRunner::ProcessFd(int fd, int16_t what) {
   auto it = fd_task_map_.find(fd);
   if (it != fd_task_map_.end()) {
-    const IoCompletionCallback& callback = it->second.second;
-    callback.Run(fd, what, this);
+    // Copy, the callback may remove or replace itself.
+    IoCompletionCallback callback = it->second.second;
+    int16_t events = 0;
+    events |= (what & EV_READ) ? kReadable : 0;
+    events |= (what & EV_WRITE) ? kWriteable : 0;
+#if LIBEVENT_VERSION_NUMBER >= 0x02010400
+    events |= (what & EV_CLOSED) ? kClosed : 0;
+#endif
+    callback.Run(fd, events, this);
   }
 }
 
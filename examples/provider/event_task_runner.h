@@ -5,10 +5,10 @@
 #ifndef LIBWEAVE_EXAMPLES_PROVIDER_EVENT_TASK_RUNNER_H_
 #define LIBWEAVE_EXAMPLES_PROVIDER_EVENT_TASK_RUNNER_H_
 
-#include <queue>
+#include <deque>
 #include <map>
+#include <unordered_set>
 #include <utility>
-#include <vector>
 
 #include <event2/event.h>
 #include <weave/provider/task_runner.h>
@@ -24,6 +24,11 @@ class EventTaskRunner : public provider::TaskRunner {
   void PostDelayedTask(const tracked_objects::Location& from_here,
                        const base::Closure& task,
                        base::TimeDelta delay) override;
+  TaskId PostTaskWithPriority(const tracked_objects::Location& from_here,
+                              const base::Closure& task,
+                              base::TimeDelta delay,
+                              Priority priority) override;
+  void CancelTask(TaskId id) override;
 
   // Defines the types of I/O completion events that the
   // application can register to receive on a file descriptor.
@@ -72,20 +77,27 @@ class EventTaskRunner : public provider::TaskRunner {
   static void FdEventHandler(int fd, int16_t what, void* runner);
   void ProcessFd(int fd, int16_t what);
 
-  using QueueItem = std::pair<std::pair<base::Time, size_t>, base::Closure>;
+  void AddReadyTask(TaskId id, Priority priority, const base::Closure& task);
 
-  struct Greater {
-    bool operator()(const QueueItem& a, const QueueItem& b) const {
-      return a.first > b.first;
-    }
-  };
+  // Tasks with a delay wait in |timers_|, keyed by time and id, which keeps
+  // order of tasks with the same time. Once they are due, they move to the
+  // run queue of their priority in |ready_|, which is also where tasks
+  // without a delay go directly. Ids of the tasks in |ready_| which aren't
+  // cancelled are in |ready_ids_|.
+  using TimerKey = std::pair<base::Time, TaskId>;
+  using ReadyTask = std::pair<TaskId, base::Closure>;
+
+  TaskId counter_{0};
 
-  size_t counter_{0};  // Keeps order of tasks with the same time.
+  std::map<TimerKey, std::pair<Priority, base::Closure>> timers_;
+  std::map<TaskId, base::Time> timer_times_;
+  std::deque<ReadyTask>
+      ready_[static_cast<size_t>(Priority::kUserVisible) + 1];
+  std::unordered_set<TaskId> ready_ids_;
 
-  std::priority_queue<QueueItem,
-                      std::vector<QueueItem>,
-                      EventTaskRunner::Greater>
-      queue_;
+  // Time |task_event_| is scheduled for, if any.
+  base::Time wakeup_time_;
+  bool processing_{false};
 
   EventPtr<event_base> base_{event_base_new()};
 
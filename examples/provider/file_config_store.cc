@@ -4,8 +4,11 @@
 
 #include "examples/provider/file_config_store.h"
 
+#include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
+#include <unistd.h>
 
 #include <fstream>
 #include <map>
@@ -79,11 +82,67 @@ void FileConfigStore::SaveSettings(const std::string& name,
                                    const std::string& settings,
                                    const DoneCallback& callback) {
   CHECK(mkdir(kSettingsDir, S_IRWXU) == 0 || errno == EEXIST);
-  LOG(INFO) << "Saving settings to " << GetPath(name);
-  std::ofstream str(GetPath(name));
-  str << settings;
-  if (!callback.is_null())
-    task_runner_->PostDelayedTask(FROM_HERE, base::Bind(callback, nullptr), {});
+  const std::string path = GetPath(name);
+  LOG(INFO) << "Saving settings to " << path;
+
+  // Write a new file and rename it over the old one, so a crash leaves either
+  // the old or the new settings, but never a partially written file.
+  const std::string tmp_path = path + ".tmp";
+  int fd =
+      open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  bool success = fd >= 0;
+  for (size_t offset = 0; success && offset < settings.size();) {
+    ssize_t written =
+        write(fd, settings.data() + offset, settings.size() - offset);
+    if (written < 0 && errno == EINTR)
+      continue;
+    success = written > 0;
+    offset += success ? written : 0;
+  }
+  success = success && fsync(fd) == 0;
+  if (fd >= 0)
+    success = close(fd) == 0 && success;
+  success = success && rename(tmp_path.c_str(), path.c_str()) == 0;
+
+  if (!success) {
+    LOG(ERROR) << "Failed to save settings to " << path << ": "
+               << strerror(errno);
+    unlink(tmp_path.c_str());
+    ErrorPtr error;
+    Error::AddTo(&error, FROM_HERE, "save_failed",
+                 "Failed to save settings");
+    if (!callback.is_null()) {
+      task_runner_->PostDelayedTask(
+          FROM_HERE, base::Bind(callback, base::Passed(&error)), {});
+    }
+    return;
+  }
+
+  // The rename is durable after the directory is synced. Saves made before
+  // the posted sync runs share it.
+  pending_callbacks_.push_back(callback);
+  if (pending_callbacks_.size() == 1) {
+    task_runner_->PostDelayedTask(
+        FROM_HERE, base::Bind(&FileConfigStore::SyncSettingsDir,
+                              weak_ptr_factory_.GetWeakPtr()),
+        {});
+  }
+}
+
+void FileConfigStore::SyncSettingsDir() {
+  int fd = open(kSettingsDir, O_RDONLY | O_DIRECTORY);
+  if (fd < 0 || fsync(fd) != 0)
+    LOG(WARNING) << "Failed to sync " << kSettingsDir << ": "
+                 << strerror(errno);
+  if (fd >= 0)
+    close(fd);
+
+  std::vector<DoneCallback> callbacks;
+  callbacks.swap(pending_callbacks_);
+  for (const auto& callback : callbacks) {
+    if (!callback.is_null())
+      callback.Run(nullptr);
+  }
 }
 
 }  // namespace examples
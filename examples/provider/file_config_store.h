@@ -9,12 +9,14 @@
 #include <string>
 #include <vector>
 
+#include <base/memory/weak_ptr.h>
 #include <weave/provider/config_store.h>
 #include <weave/provider/task_runner.h>
 
 namespace weave {
 namespace examples {
 
+// Saves each settings blob atomically to a file in /var/lib/weave/.
 class FileConfigStore : public provider::ConfigStore {
  public:
   FileConfigStore(const std::string& model_id,
@@ -30,8 +32,14 @@ class FileConfigStore : public provider::ConfigStore {
 
  private:
   std::string GetPath(const std::string& name) const;
+  void SyncSettingsDir();
+
   const std::string model_id_;
   provider::TaskRunner* task_runner_{nullptr};
+  // Callbacks of saves waiting for the directory sync.
+  std::vector<DoneCallback> pending_callbacks_;
+
+  base::WeakPtrFactory<FileConfigStore> weak_ptr_factory_{this};
 };
 
 }  // namespace examples
@@ -6,9 +6,13 @@
 
 #include <openssl/err.h>
 
+#include <algorithm>
+#include <cstring>
+
 #include <base/bind.h>
 #include <base/bind_helpers.h>
-#include <weave/provider/task_runner.h>
+
+#include "examples/provider/event_task_runner.h"
 
 namespace weave {
 namespace examples {
@@ -26,12 +30,10 @@ void AddSslError(ErrorPtr* error,
                      ERR_reason_error_string(ssl_error_code));
 }
 
-void RetryAsyncTask(provider::TaskRunner* task_runner,
-                    const tracked_objects::Location& location,
-                    const base::Closure& task) {
-  task_runner->PostDelayedTask(FROM_HERE, task,
-                               base::TimeDelta::FromMilliseconds(100));
-}
+// The largest TLS record.
+const size_t kReadChunkSize = 16 * 1024;
+// Records are not read ahead beyond this until the reader catches up.
+const size_t kMaxReadAhead = 4 * kReadChunkSize;
 
 }  // namespace
 
@@ -43,16 +45,53 @@ void SSLStream::SslDeleter::operator()(SSL* ssl) const {
   SSL_free(ssl);
 }
 
-void SSLStream::SslDeleter::operator()(SSL_CTX* ctx) const {
-  SSL_CTX_free(ctx);
+void SSLStream::SslDeleter::operator()(SSL_SESSION* session) const {
+  SSL_SESSION_free(session);
+}
+
+SSL_CTX* SSLStream::GetContext() {
+  static SSL_CTX* ctx = [] {
+    // TLS 1.2 or later, including TLS 1.3 if OpenSSL supports it.
+    SSL_CTX* ctx = SSL_CTX_new(SSLv23_client_method());
+    CHECK(ctx);
+    SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 |
+                                 SSL_OP_NO_TLSv1 | SSL_OP_NO_TLSv1_1);
+    // Sessions are kept by GetSessionCache(), as the internal cache of
+    // OpenSSL is only used by servers.
+    SSL_CTX_set_session_cache_mode(
+        ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &SSLStream::OnNewSession);
+    return ctx;
+  }();
+  return ctx;
+}
+
+SSLStream::SessionCache* SSLStream::GetSessionCache() {
+  static SessionCache* cache = new SessionCache;
+  return cache;
+}
+
+int SSLStream::OnNewSession(SSL* ssl, SSL_SESSION* session) {
+  SSLStream* stream = static_cast<SSLStream*>(SSL_get_app_data(ssl));
+  CHECK(stream);
+  (*GetSessionCache())[stream->end_point_].reset(session);
+  return 1;  // We took the reference.
 }
 
-SSLStream::SSLStream(provider::TaskRunner* task_runner,
+SSLStream::SSLStream(EventTaskRunner* task_runner,
+                     const std::string& host,
+                     const std::string& end_point,
                      std::unique_ptr<BIO, SslDeleter> stream_bio)
-    : task_runner_{task_runner} {
-  ctx_.reset(SSL_CTX_new(TLSv1_2_client_method()));
-  CHECK(ctx_);
-  ssl_.reset(SSL_new(ctx_.get()));
+    : task_runner_{task_runner}, end_point_{end_point} {
+  ssl_.reset(SSL_new(GetContext()));
+  CHECK(ssl_);
+  SSL_set_app_data(ssl_.get(), this);
+  // Servers may only issue resumable sessions to clients which sent the name.
+  SSL_set_tlsext_host_name(ssl_.get(), host.c_str());
+
+  auto session = GetSessionCache()->find(end_point_);
+  if (session != GetSessionCache()->end())
+    SSL_set_session(ssl_.get(), session->second.get());
 
   SSL_set_bio(ssl_.get(), stream_bio.get(), stream_bio.get());
   stream_bio.release();  // Owned by ssl now.
@@ -61,146 +100,197 @@ SSLStream::SSLStream(provider::TaskRunner* task_runner,
 
 SSLStream::~SSLStream() {
   CancelPendingOperations();
+  if (fd_ >= 0)
+    task_runner_->RemoveIoCompletionTask(fd_);
 }
 
 void SSLStream::RunTask(const base::Closure& task) {
   task.Run();
 }
 
+void SSLStream::PostTask(const base::Closure& task) {
+  task_runner_->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&SSLStream::RunTask, weak_ptr_factory_.GetWeakPtr(), task),
+      {});
+}
+
 void SSLStream::Read(void* buffer,
                      size_t size_to_read,
                      const ReadCallback& callback) {
-  int res = SSL_read(ssl_.get(), buffer, size_to_read);
-  if (res > 0) {
-    task_runner_->PostDelayedTask(
-        FROM_HERE,
-        base::Bind(&SSLStream::RunTask, weak_ptr_factory_.GetWeakPtr(),
-                   base::Bind(callback, res, nullptr)),
-        {});
-    return;
-  }
-
-  int err = SSL_get_error(ssl_.get(), res);
-
-  if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
-    return RetryAsyncTask(
-        task_runner_, FROM_HERE,
-        base::Bind(&SSLStream::Read, weak_ptr_factory_.GetWeakPtr(), buffer,
-                   size_to_read, callback));
-  }
-
-  ErrorPtr weave_error;
-  AddSslError(&weave_error, FROM_HERE, "read_failed", err);
-  return task_runner_->PostDelayedTask(
-      FROM_HERE,
-      base::Bind(&SSLStream::RunTask, weak_ptr_factory_.GetWeakPtr(),
-                 base::Bind(callback, 0, base::Passed(&weave_error))),
-      {});
+  CHECK(read_callback_.is_null());
+  read_buffer_ = buffer;
+  read_size_ = size_to_read;
+  read_callback_ = callback;
+  CompleteRead();
+  if (state_ == State::kOpen)
+    ContinueRead();
 }
 
 void SSLStream::Write(const void* buffer,
                       size_t size_to_write,
                       const WriteCallback& callback) {
-  int res = SSL_write(ssl_.get(), buffer, size_to_write);
-  if (res > 0) {
-    buffer = static_cast<const char*>(buffer) + res;
-    size_to_write -= res;
-    if (size_to_write == 0) {
-      return task_runner_->PostDelayedTask(
-          FROM_HERE,
-          base::Bind(&SSLStream::RunTask, weak_ptr_factory_.GetWeakPtr(),
-                     base::Bind(callback, nullptr)),
-          {});
-    }
-
-    return RetryAsyncTask(
-        task_runner_, FROM_HERE,
-        base::Bind(&SSLStream::Write, weak_ptr_factory_.GetWeakPtr(), buffer,
-                   size_to_write, callback));
-  }
-
-  int err = SSL_get_error(ssl_.get(), res);
-
-  if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
-    return RetryAsyncTask(
-        task_runner_, FROM_HERE,
-        base::Bind(&SSLStream::Write, weak_ptr_factory_.GetWeakPtr(), buffer,
-                   size_to_write, callback));
-  }
-
-  ErrorPtr weave_error;
-  AddSslError(&weave_error, FROM_HERE, "write_failed", err);
-  task_runner_->PostDelayedTask(
-      FROM_HERE, base::Bind(&SSLStream::RunTask, weak_ptr_factory_.GetWeakPtr(),
-                            base::Bind(callback, base::Passed(&weave_error))),
-      {});
+  CHECK(write_callback_.is_null());
+  write_buffer_ = buffer;
+  write_size_ = size_to_write;
+  write_callback_ = callback;
+  if (state_ == State::kOpen)
+    ContinueWrite();
 }
 
 void SSLStream::CancelPendingOperations() {
   weak_ptr_factory_.InvalidateWeakPtrs();
+  read_callback_.Reset();
+  write_callback_.Reset();
 }
 
 void SSLStream::Connect(
-    provider::TaskRunner* task_runner,
+    EventTaskRunner* task_runner,
     const std::string& host,
     uint16_t port,
+    int socket,
     const provider::Network::OpenSslSocketCallback& callback) {
   SSL_library_init();
 
   char end_point[255];
   snprintf(end_point, sizeof(end_point), "%s:%u", host.c_str(), port);
 
-  std::unique_ptr<BIO, SslDeleter> stream_bio(BIO_new_connect(end_point));
+  std::unique_ptr<BIO, SslDeleter> stream_bio(
+      BIO_new_socket(socket, BIO_CLOSE));
   CHECK(stream_bio);
-  BIO_set_nbio(stream_bio.get(), 1);
 
-  std::unique_ptr<SSLStream> stream{
-      new SSLStream{task_runner, std::move(stream_bio)}};
-  ConnectBio(std::move(stream), callback);
+  SSLStream* stream =
+      new SSLStream{task_runner, host, end_point, std::move(stream_bio)};
+  stream->connecting_self_.reset(stream);
+  stream->connect_callback_ = callback;
+  stream->ContinueHandshake();
 }
 
-void SSLStream::ConnectBio(
-    std::unique_ptr<SSLStream> stream,
-    const provider::Network::OpenSslSocketCallback& callback) {
-  BIO* bio = SSL_get_rbio(stream->ssl_.get());
-  if (BIO_do_connect(bio) == 1)
-    return DoHandshake(std::move(stream), callback);
-
-  auto task_runner = stream->task_runner_;
-  if (BIO_should_retry(bio)) {
-    return RetryAsyncTask(
-        task_runner, FROM_HERE,
-        base::Bind(&SSLStream::ConnectBio, base::Passed(&stream), callback));
+void SSLStream::OnIoReady(int fd, int16_t what, EventTaskRunner* sender) {
+  if (state_ != State::kOpen)
+    return ContinueHandshake();
+  // Events are edge-triggered, so both directions have to make all the
+  // progress they can before the next event.
+  ContinueRead();
+  ContinueWrite();
+}
+
+void SSLStream::ContinueHandshake() {
+  WatchSocket();
+  int res = SSL_do_handshake(ssl_.get());
+  if (res == 1) {
+    state_ = State::kOpen;
+    return FinishConnect(nullptr);
   }
 
+  res = SSL_get_error(ssl_.get(), res);
+  if (res == SSL_ERROR_WANT_READ || res == SSL_ERROR_WANT_WRITE)
+    return;
+
+  // Don't try to resume the session again, the server may have dropped it.
+  GetSessionCache()->erase(end_point_);
+
   ErrorPtr error;
-  AddSslError(&error, FROM_HERE, "connect_failed", ERR_get_error());
-  task_runner->PostDelayedTask(
-      FROM_HERE, base::Bind(callback, nullptr, base::Passed(&error)), {});
+  AddSslError(&error, FROM_HERE, "handshake_failed", res);
+  FinishConnect(std::move(error));
 }
 
-void SSLStream::DoHandshake(
-    std::unique_ptr<SSLStream> stream,
-    const provider::Network::OpenSslSocketCallback& callback) {
-  int res = SSL_do_handshake(stream->ssl_.get());
-  auto task_runner = stream->task_runner_;
-  if (res == 1) {
-    return task_runner->PostDelayedTask(
-        FROM_HERE, base::Bind(callback, base::Passed(&stream), nullptr), {});
+void SSLStream::WatchSocket() {
+  if (fd_ >= 0)
+    return;
+  int fd = BIO_get_fd(SSL_get_rbio(ssl_.get()), nullptr);
+  if (fd < 0)
+    return;
+  fd_ = fd;
+  task_runner_->AddIoCompletionTask(
+      fd_, EventTaskRunner::kAll,
+      base::Bind(&SSLStream::OnIoReady, base::Unretained(this)));
+}
+
+void SSLStream::FinishConnect(ErrorPtr error) {
+  // May destroy this stream.
+  std::unique_ptr<SSLStream> stream{std::move(connecting_self_)};
+  provider::Network::OpenSslSocketCallback callback;
+  std::swap(callback, connect_callback_);
+  if (error) {
+    state_ = State::kFailed;
+    task_runner_->PostDelayedTask(
+        FROM_HERE, base::Bind(callback, nullptr, base::Passed(&error)), {});
+    return;
   }
+  task_runner_->PostDelayedTask(
+      FROM_HERE, base::Bind(callback, base::Passed(&stream), nullptr), {});
+}
 
-  res = SSL_get_error(stream->ssl_.get(), res);
+void SSLStream::ContinueRead() {
+  while (!read_error_ && read_ahead_.size() < kMaxReadAhead) {
+    size_t size = read_ahead_.size();
+    read_ahead_.resize(size + kReadChunkSize);
+    int res = SSL_read(ssl_.get(), read_ahead_.data() + size, kReadChunkSize);
+    read_ahead_.resize(size + std::max(res, 0));
+    if (res > 0)
+      continue;
+
+    int err = SSL_get_error(ssl_.get(), res);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+      break;
+    AddSslError(&read_error_, FROM_HERE, "read_failed", err);
+  }
+  CompleteRead();
+}
+
+void SSLStream::CompleteRead() {
+  if (read_callback_.is_null())
+    return;
+  size_t available = read_ahead_.size() - read_ahead_offset_;
+  if (available == 0 && !read_error_)
+    return;
 
-  if (res == SSL_ERROR_WANT_READ || res == SSL_ERROR_WANT_WRITE) {
-    return RetryAsyncTask(
-        task_runner, FROM_HERE,
-        base::Bind(&SSLStream::DoHandshake, base::Passed(&stream), callback));
+  ReadCallback callback;
+  std::swap(callback, read_callback_);
+  if (available == 0) {
+    // Every following read fails the same way.
+    ErrorPtr error = read_error_->Clone();
+    return PostTask(base::Bind(callback, 0, base::Passed(&error)));
   }
 
-  ErrorPtr error;
-  AddSslError(&error, FROM_HERE, "handshake_failed", res);
-  task_runner->PostDelayedTask(
-      FROM_HERE, base::Bind(callback, nullptr, base::Passed(&error)), {});
+  size_t size = std::min(available, read_size_);
+  memcpy(read_buffer_, read_ahead_.data() + read_ahead_offset_, size);
+  read_ahead_offset_ += size;
+  if (read_ahead_offset_ == read_ahead_.size()) {
+    read_ahead_.clear();
+    read_ahead_offset_ = 0;
+  }
+  PostTask(base::Bind(callback, size, nullptr));
+}
+
+void SSLStream::ContinueWrite() {
+  while (!write_callback_.is_null()) {
+    if (write_size_ == 0) {
+      WriteCallback callback;
+      std::swap(callback, write_callback_);
+      return PostTask(base::Bind(callback, nullptr));
+    }
+
+    // Retries after SSL_ERROR_WANT_* pass the same arguments, as OpenSSL
+    // requires.
+    int res = SSL_write(ssl_.get(), write_buffer_, write_size_);
+    if (res > 0) {
+      write_buffer_ = static_cast<const char*>(write_buffer_) + res;
+      write_size_ -= res;
+      continue;
+    }
+
+    int err = SSL_get_error(ssl_.get(), res);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+      return;
+
+    ErrorPtr weave_error;
+    AddSslError(&weave_error, FROM_HERE, "write_failed", err);
+    WriteCallback callback;
+    std::swap(callback, write_callback_);
+    return PostTask(base::Bind(callback, base::Passed(&weave_error)));
+  }
 }
 
 }  // namespace examples
@@ -7,18 +7,25 @@
 
 #include <openssl/ssl.h>
 
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <base/memory/weak_ptr.h>
 #include <weave/provider/network.h>
 #include <weave/stream.h>
 
 namespace weave {
 
-namespace provider {
-class TaskRunner;
-}
-
 namespace examples {
 
+class EventTaskRunner;
+
+// TLS client stream over a non-blocking socket. I/O is driven by readiness
+// events of the socket from EventTaskRunner. Records are read ahead into a
+// buffer while the socket is readable, so a single wakeup serves all the
+// reads it can.
 class SSLStream : public Stream {
  public:
   ~SSLStream() override;
@@ -33,35 +40,79 @@ class SSLStream : public Stream {
 
   void CancelPendingOperations() override;
 
-  static void Connect(provider::TaskRunner* task_runner,
+  // Starts the TLS handshake with |host| over the connected non-blocking
+  // |socket|, which the stream takes.
+  static void Connect(EventTaskRunner* task_runner,
                       const std::string& host,
                       uint16_t port,
+                      int socket,
                       const provider::Network::OpenSslSocketCallback& callback);
 
  private:
   struct SslDeleter {
     void operator()(BIO* bio) const;
     void operator()(SSL* ssl) const;
-    void operator()(SSL_CTX* ctx) const;
+    void operator()(SSL_SESSION* session) const;
+  };
+
+  enum class State {
+    kHandshake,
+    kOpen,
+    kFailed,
   };
 
-  SSLStream(provider::TaskRunner* task_runner,
+  SSLStream(EventTaskRunner* task_runner,
+            const std::string& host,
+            const std::string& end_point,
             std::unique_ptr<BIO, SslDeleter> stream_bio);
 
-  static void ConnectBio(
-      std::unique_ptr<SSLStream> stream,
-      const provider::Network::OpenSslSocketCallback& callback);
-  static void DoHandshake(
-      std::unique_ptr<SSLStream> stream,
-      const provider::Network::OpenSslSocketCallback& callback);
+  // All the streams share one client context, which hands new sessions to
+  // OnNewSession(). The last session of every end point is kept, so the next
+  // connection to it can resume the session instead of a full handshake.
+  using SessionCache =
+      std::map<std::string, std::unique_ptr<SSL_SESSION, SslDeleter>>;
+  static SSL_CTX* GetContext();
+  static SessionCache* GetSessionCache();
+  static int OnNewSession(SSL* ssl, SSL_SESSION* session);
+
+  // Runs all operations which can make progress. Called on every readiness
+  // event of the socket and whenever a new operation is started.
+  void OnIoReady(int fd, int16_t what, EventTaskRunner* sender);
+  void ContinueHandshake();
+  void WatchSocket();
+  void FinishConnect(ErrorPtr error);
+  // Reads ahead while records are available and completes the pending read.
+  void ContinueRead();
+  void CompleteRead();
+  void ContinueWrite();
 
   // Send task to this method with WeakPtr if callback should not be executed
   // after SSLStream is destroyed.
   void RunTask(const base::Closure& task);
+  void PostTask(const base::Closure& task);
 
-  provider::TaskRunner* task_runner_{nullptr};
-  std::unique_ptr<SSL_CTX, SslDeleter> ctx_;
+  EventTaskRunner* task_runner_{nullptr};
+  // "host:port" the stream is connected to, the key of the session cache.
+  std::string end_point_;
   std::unique_ptr<SSL, SslDeleter> ssl_;
+  State state_{State::kHandshake};
+  int fd_{-1};
+
+  // Owns the stream until the connection is established.
+  std::unique_ptr<SSLStream> connecting_self_;
+  provider::Network::OpenSslSocketCallback connect_callback_;
+
+  // Decrypted data which has not been read yet.
+  std::vector<char> read_ahead_;
+  size_t read_ahead_offset_{0};
+  ErrorPtr read_error_;
+  void* read_buffer_{nullptr};
+  size_t read_size_{0};
+  ReadCallback read_callback_;
+
+  const void* write_buffer_{nullptr};
+  size_t write_size_{0};
+  WriteCallback write_callback_;
 
   base::WeakPtrFactory<SSLStream> weak_ptr_factory_{this};
 };
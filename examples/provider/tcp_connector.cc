@@ -0,0 +1,343 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "examples/provider/tcp_connector.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/bind.h>
+#include <base/memory/weak_ptr.h>
+#include <event2/dns.h>
+#include <event2/util.h>
+
+#include "examples/provider/event_task_runner.h"
+
+namespace weave {
+namespace examples {
+
+namespace {
+
+// evdns_getaddrinfo() doesn't return the TTLs of the records, so all the
+// addresses are kept for the same time.
+const int kAddressCacheTtlMinutes = 5;
+// Recommended by RFC 8305.
+const int kConnectAttemptDelayMs = 250;
+
+void AddSystemError(ErrorPtr* error,
+                    const tracked_objects::Location& location,
+                    const char* what,
+                    int error_number) {
+  Error::AddToPrintf(error, location, "connect_failed", "%s: %s", what,
+                     strerror(error_number));
+}
+
+}  // namespace
+
+// Resolves and connects to one end point, and deletes itself through the
+// connector once done.
+class TcpConnector::Attempt final {
+ public:
+  Attempt(TcpConnector* connector,
+          const std::string& host,
+          uint16_t port,
+          const ConnectCallback& callback)
+      : connector_{connector},
+        host_{host},
+        port_{std::to_string(port)},
+        end_point_{host + ":" + port_},
+        callback_{callback} {}
+
+  ~Attempt() {
+    if (dns_request_)
+      evdns_getaddrinfo_cancel(dns_request_);
+    for (const auto& pair : sockets_) {
+      connector_->task_runner_->RemoveIoCompletionTask(pair.first);
+      close(pair.first);
+    }
+  }
+
+  void Start() {
+    std::vector<Address> addresses =
+        connector_->GetCachedAddresses(end_point_);
+    if (!addresses.empty())
+      return Race(std::move(addresses));
+
+    evutil_addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = EVUTIL_AI_ADDRCONFIG;
+    resolving_ = true;
+    evdns_getaddrinfo_request* request =
+        evdns_getaddrinfo(connector_->dns_base_, host_.c_str(), port_.c_str(),
+                          &hints, &Attempt::OnResolved, this);
+    // The callback may have been called already.
+    if (resolving_)
+      dns_request_ = request;
+  }
+
+ private:
+  static void OnResolved(int result, evutil_addrinfo* info, void* arg) {
+    Attempt* attempt = static_cast<Attempt*>(arg);
+    attempt->resolving_ = false;
+    attempt->dns_request_ = nullptr;
+    if (result == EVUTIL_EAI_CANCEL)
+      return;
+
+    std::vector<Address> addresses;
+    for (evutil_addrinfo* it = info; it; it = it->ai_next) {
+      Address address = {};
+      if (it->ai_addrlen > sizeof(address.storage))
+        continue;
+      memcpy(&address.storage, it->ai_addr, it->ai_addrlen);
+      address.length = it->ai_addrlen;
+      addresses.push_back(address);
+    }
+    if (info)
+      evutil_freeaddrinfo(info);
+    if (result != 0) {
+      Error::AddToPrintf(&attempt->error_, FROM_HERE, "dns_failed",
+                         "Failed to resolve '%s': %s", attempt->host_.c_str(),
+                         evutil_gai_strerror(result));
+    }
+
+    // Continue from the event loop, as the callback may be called from
+    // within evdns_getaddrinfo().
+    attempt->connector_->task_runner_->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&Attempt::OnAddressesResolved,
+                   attempt->weak_ptr_factory_.GetWeakPtr(), addresses),
+        {});
+  }
+
+  void OnAddressesResolved(const std::vector<Address>& addresses) {
+    Race(addresses.empty()
+             ? connector_->GetFallbackAddresses(end_point_)
+             : connector_->AddAddresses(end_point_, addresses));
+  }
+
+  void Race(std::vector<Address> addresses) {
+    addresses_ = std::move(addresses);
+    next_address_ = 0;
+    ConnectNext();
+  }
+
+  // Starts connecting to the next address, keeping the attempts in progress.
+  void ConnectNext() {
+    ++connect_generation_;
+    while (next_address_ < addresses_.size()) {
+      size_t index = next_address_++;
+      const Address& address = addresses_[index];
+      int fd = socket(address.storage.ss_family,
+                      SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (fd < 0) {
+        AddSystemError(&error_, FROM_HERE, "socket", errno);
+        continue;
+      }
+      if (connect(fd, reinterpret_cast<const sockaddr*>(&address.storage),
+                  address.length) == 0) {
+        return Finish(fd, index);
+      }
+      if (errno != EINPROGRESS) {
+        AddSystemError(&error_, FROM_HERE, "connect", errno);
+        close(fd);
+        continue;
+      }
+
+      sockets_[fd] = index;
+      connector_->task_runner_->AddIoCompletionTask(
+          fd, EventTaskRunner::kWriteable,
+          base::Bind(&Attempt::OnSocketReady, base::Unretained(this)));
+      if (next_address_ < addresses_.size()) {
+        connector_->task_runner_->PostDelayedTask(
+            FROM_HERE,
+            base::Bind(&Attempt::OnConnectDelayElapsed,
+                       weak_ptr_factory_.GetWeakPtr(), connect_generation_),
+            base::TimeDelta::FromMilliseconds(kConnectAttemptDelayMs));
+      }
+      return;
+    }
+    if (sockets_.empty())
+      Finish(-1, 0);
+  }
+
+  void OnConnectDelayElapsed(int generation) {
+    // A failed attempt may have started the next one already.
+    if (generation == connect_generation_)
+      ConnectNext();
+  }
+
+  void OnSocketReady(int fd, int16_t what, EventTaskRunner* sender) {
+    auto socket = sockets_.find(fd);
+    if (socket == sockets_.end())
+      return;
+    int socket_error = 0;
+    socklen_t length = sizeof(socket_error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &socket_error, &length) != 0)
+      socket_error = errno;
+    if (socket_error == EINPROGRESS)
+      return;
+
+    size_t index = socket->second;
+    sockets_.erase(socket);
+    connector_->task_runner_->RemoveIoCompletionTask(fd);
+    if (socket_error == 0)
+      return Finish(fd, index);
+
+    AddSystemError(&error_, FROM_HERE, "connect", socket_error);
+    close(fd);
+    // The next address doesn't wait for the delay after a failure.
+    ConnectNext();
+  }
+
+  // Passes |fd| connected to the address at |index|, or the error if |fd| is
+  // negative, to the callback. Deletes this attempt.
+  void Finish(int fd, size_t index) {
+    if (fd >= 0) {
+      error_.reset();
+      connector_->OnConnected(end_point_, addresses_[index]);
+    } else {
+      if (!error_) {
+        Error::AddToPrintf(&error_, FROM_HERE, "connect_failed",
+                           "No addresses of '%s'", host_.c_str());
+      }
+      connector_->OnConnectFailed(end_point_);
+    }
+    connector_->task_runner_->PostDelayedTask(
+        FROM_HERE, base::Bind(callback_, fd, base::Passed(&error_)), {});
+    connector_->OnAttemptDone(this);
+  }
+
+  TcpConnector* connector_{nullptr};
+  const std::string host_;
+  const std::string port_;
+  const std::string end_point_;
+  const ConnectCallback callback_;
+
+  evdns_getaddrinfo_request* dns_request_{nullptr};
+  bool resolving_{false};
+
+  std::vector<Address> addresses_;
+  size_t next_address_{0};
+  // Invalidates the delayed ConnectNext() once the next attempt is started.
+  int connect_generation_{0};
+  // Sockets being connected, and the indexes of their addresses.
+  std::map<int, size_t> sockets_;
+  // The last error, reported if no address connects.
+  ErrorPtr error_;
+
+  base::WeakPtrFactory<Attempt> weak_ptr_factory_{this};
+
+  DISALLOW_COPY_AND_ASSIGN(Attempt);
+};
+
+bool TcpConnector::Address::operator==(const Address& other) const {
+  return length == other.length &&
+         memcmp(&storage, &other.storage, length) == 0;
+}
+
+TcpConnector::TcpConnector(EventTaskRunner* task_runner, evdns_base* dns_base)
+    : task_runner_{task_runner}, dns_base_{dns_base} {}
+
+TcpConnector::~TcpConnector() {
+  attempts_.clear();
+}
+
+void TcpConnector::Connect(const std::string& host,
+                           uint16_t port,
+                           const ConnectCallback& callback) {
+  Attempt* attempt = new Attempt{this, host, port, callback};
+  attempts_[attempt].reset(attempt);
+  // May finish and delete the attempt.
+  attempt->Start();
+}
+
+void TcpConnector::ExpireAddresses() {
+  for (auto& pair : cache_)
+    pair.second.expiration = base::Time{};
+}
+
+// static
+std::vector<TcpConnector::Address> TcpConnector::OrderAddresses(
+    const std::vector<Address>& addresses,
+    const Address* first) {
+  std::vector<Address> result;
+  result.reserve(addresses.size());
+  if (first &&
+      std::find(addresses.begin(), addresses.end(), *first) !=
+          addresses.end()) {
+    result.push_back(*first);
+  }
+
+  std::vector<Address> preferred;
+  std::vector<Address> other;
+  for (const Address& address : addresses) {
+    if (first && address == *first)
+      continue;
+    if (address.storage.ss_family == addresses.front().storage.ss_family)
+      preferred.push_back(address);
+    else
+      other.push_back(address);
+  }
+  for (size_t i = 0; i < std::max(preferred.size(), other.size()); ++i) {
+    if (i < preferred.size())
+      result.push_back(preferred[i]);
+    if (i < other.size())
+      result.push_back(other[i]);
+  }
+  return result;
+}
+
+std::vector<TcpConnector::Address> TcpConnector::GetCachedAddresses(
+    const std::string& end_point) const {
+  auto entry = cache_.find(end_point);
+  if (entry == cache_.end() || entry->second.addresses.empty() ||
+      entry->second.expiration <= base::Time::Now()) {
+    return {};
+  }
+  return OrderAddresses(entry->second.addresses,
+                        entry->second.last_connected.get());
+}
+
+std::vector<TcpConnector::Address> TcpConnector::AddAddresses(
+    const std::string& end_point,
+    std::vector<Address> addresses) {
+  CacheEntry& entry = cache_[end_point];
+  entry.addresses = std::move(addresses);
+  entry.expiration =
+      base::Time::Now() + base::TimeDelta::FromMinutes(kAddressCacheTtlMinutes);
+  return OrderAddresses(entry.addresses, entry.last_connected.get());
+}
+
+std::vector<TcpConnector::Address> TcpConnector::GetFallbackAddresses(
+    const std::string& end_point) const {
+  auto entry = cache_.find(end_point);
+  if (entry == cache_.end() || !entry->second.last_connected)
+    return {};
+  return {*entry->second.last_connected};
+}
+
+void TcpConnector::OnConnected(const std::string& end_point,
+                               const Address& address) {
+  cache_[end_point].last_connected.reset(new Address(address));
+}
+
+void TcpConnector::OnConnectFailed(const std::string& end_point) {
+  // The addresses may have changed, so they are resolved again next time.
+  auto entry = cache_.find(end_point);
+  if (entry != cache_.end())
+    entry->second.expiration = base::Time{};
+}
+
+void TcpConnector::OnAttemptDone(Attempt* attempt) {
+  attempts_.erase(attempt);
+}
+
+}  // namespace examples
+}  // namespace weave
@@ -0,0 +1,100 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_EXAMPLES_PROVIDER_TCP_CONNECTOR_H_
+#define LIBWEAVE_EXAMPLES_PROVIDER_TCP_CONNECTOR_H_
+
+#include <sys/socket.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/time/time.h>
+#include <weave/error.h>
+
+struct evdns_base;
+
+namespace weave {
+namespace examples {
+
+class EventTaskRunner;
+
+// Opens TCP connections to host names without blocking the event loop.
+// Resolved addresses are cached for kAddressCacheTtl, and the address of the
+// last connection to an end point is tried first, even once its addresses
+// have expired. The other addresses are raced in the "Happy Eyeballs" way
+// (RFC 8305): the address families alternate, and the next address is tried
+// when the previous one hasn't connected within kConnectAttemptDelay, without
+// giving up on it. The first connection established wins.
+class TcpConnector final {
+ public:
+  // Receives the connected non-blocking socket, which the callee owns, or -1
+  // and the error.
+  using ConnectCallback = base::Callback<void(int socket, ErrorPtr error)>;
+
+  TcpConnector(EventTaskRunner* task_runner, evdns_base* dns_base);
+  // Cancels the connections in progress, without calling their callbacks.
+  ~TcpConnector();
+
+  void Connect(const std::string& host,
+               uint16_t port,
+               const ConnectCallback& callback);
+
+  // Expires the cached addresses, so the next connections resolve the host
+  // names again. The last connected addresses are kept.
+  void ExpireAddresses();
+
+ private:
+  class Attempt;
+
+  struct Address {
+    sockaddr_storage storage;
+    socklen_t length;
+
+    bool operator==(const Address& other) const;
+  };
+
+  // Addresses of an end point, "host:port".
+  struct CacheEntry {
+    std::vector<Address> addresses;
+    base::Time expiration;
+    std::unique_ptr<Address> last_connected;
+  };
+
+  // Orders |addresses| for racing: |first| if it is among them, then the
+  // address families alternating, each in the order of the resolver.
+  static std::vector<Address> OrderAddresses(
+      const std::vector<Address>& addresses,
+      const Address* first);
+
+  // Returns the cached addresses of |end_point| in the order to try them,
+  // or an empty list if they have to be resolved.
+  std::vector<Address> GetCachedAddresses(const std::string& end_point) const;
+  // Caches the resolved |addresses| of |end_point|, and returns them in the
+  // order to try them.
+  std::vector<Address> AddAddresses(const std::string& end_point,
+                                    std::vector<Address> addresses);
+  // Returns the last connected address of |end_point|, if any, so it's
+  // tried when the host name can't be resolved.
+  std::vector<Address> GetFallbackAddresses(const std::string& end_point) const;
+  void OnConnected(const std::string& end_point, const Address& address);
+  void OnConnectFailed(const std::string& end_point);
+  void OnAttemptDone(Attempt* attempt);
+
+  EventTaskRunner* task_runner_{nullptr};
+  evdns_base* dns_base_{nullptr};
+  std::map<std::string, CacheEntry> cache_;
+  std::map<Attempt*, std::unique_ptr<Attempt>> attempts_;
+
+  DISALLOW_COPY_AND_ASSIGN(TcpConnector);
+};
+
+}  // namespace examples
+}  // namespace weave
+
+#endif  // LIBWEAVE_EXAMPLES_PROVIDER_TCP_CONNECTOR_H_
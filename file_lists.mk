@@ -11,21 +11,33 @@ WEAVE_SRC_FILES := \
 	src/commands/command_instance.cc \
 	src/commands/command_queue.cc \
 	src/commands/schema_constants.cc \
+	src/commands/schema_validator.cc \
 	src/component_manager_impl.cc \
 	src/config.cc \
 	src/data_encoding.cc \
 	src/device_manager.cc \
 	src/device_registration_info.cc \
+	src/device_runtime.cc \
+	src/diagnostics_api_handler.cc \
 	src/error.cc \
 	src/http_constants.cc \
 	src/json_error_codes.cc \
+	src/json_stream_reader.cc \
+	src/json_stream_writer.cc \
+	src/memory_budget.cc \
+	src/memory_usage.cc \
+	src/metrics.cc \
 	src/notification/notification_parser.cc \
 	src/notification/pull_channel.cc \
+	src/notification/recent_command_ids.cc \
 	src/notification/xml_node.cc \
 	src/notification/xmpp_channel.cc \
 	src/notification/xmpp_iq_stanza_handler.cc \
 	src/notification/xmpp_stream_parser.cc \
+	src/object_pool.cc \
 	src/privet/auth_manager.cc \
+	src/privet/ble_transport.cc \
+	src/privet/cbor_encoding.cc \
 	src/privet/cloud_delegate.cc \
 	src/privet/constants.cc \
 	src/privet/device_delegate.cc \
@@ -38,15 +50,28 @@ WEAVE_SRC_FILES := \
 	src/privet/security_manager.cc \
 	src/privet/wifi_bootstrap_manager.cc \
 	src/privet/wifi_ssid_generator.cc \
+	src/profiling_task_runner.cc \
 	src/registration_status.cc \
+	src/request_slots.cc \
+	src/rules_engine.cc \
+	src/sharded_json_writer.cc \
 	src/states/state_change_queue.cc \
+	src/states/state_slot.cc \
+	src/states/state_spool.cc \
 	src/streams.cc \
+	src/string_atom.cc \
 	src/string_utils.cc \
-	src/utils.cc
+	src/thread_safe_device.cc \
+	src/timer.cc \
+	src/traffic_stats.cc \
+	src/utils.cc \
+	src/wake_window_scheduler.cc \
+	src/worker_task.cc
 
 WEAVE_TEST_SRC_FILES := \
 	src/test/fake_stream.cc \
 	src/test/fake_task_runner.cc \
+	src/test/traffic_trace.cc \
 	src/test/unittest_utils.cc
 
 WEAVE_UNITTEST_SRC_FILES := \
@@ -57,37 +82,90 @@ WEAVE_UNITTEST_SRC_FILES := \
 	src/commands/cloud_command_proxy_unittest.cc \
 	src/commands/command_instance_unittest.cc \
 	src/commands/command_queue_unittest.cc \
+	src/commands/schema_validator_unittest.cc \
 	src/component_manager_unittest.cc \
 	src/config_unittest.cc \
 	src/data_encoding_unittest.cc \
 	src/device_registration_info_unittest.cc \
+	src/diagnostics_api_handler_unittest.cc \
+	src/enum_to_string_unittest.cc \
 	src/error_unittest.cc \
+	src/json_stream_reader_unittest.cc \
+	src/json_stream_writer_unittest.cc \
+	src/memory_budget_unittest.cc \
+	src/memory_usage_unittest.cc \
+	src/metrics_unittest.cc \
 	src/notification/notification_parser_unittest.cc \
+	src/notification/pull_channel_unittest.cc \
+	src/notification/recent_command_ids_unittest.cc \
 	src/notification/xml_node_unittest.cc \
 	src/notification/xmpp_channel_unittest.cc \
 	src/notification/xmpp_iq_stanza_handler_unittest.cc \
 	src/notification/xmpp_stream_parser_unittest.cc \
+	src/object_pool_unittest.cc \
 	src/privet/auth_manager_unittest.cc \
+	src/privet/ble_transport_unittest.cc \
+	src/privet/cbor_encoding_unittest.cc \
+	src/privet/cloud_delegate_unittest.cc \
+	src/privet/openssl_utils_unittest.cc \
 	src/privet/privet_handler_unittest.cc \
+	src/privet/publisher_unittest.cc \
 	src/privet/security_manager_unittest.cc \
 	src/privet/wifi_ssid_generator_unittest.cc \
+	src/profiling_task_runner_unittest.cc \
+	src/request_slots_unittest.cc \
+	src/rules_engine_unittest.cc \
+	src/sharded_json_writer_unittest.cc \
 	src/states/state_change_queue_unittest.cc \
+	src/states/state_slot_unittest.cc \
+	src/states/state_spool_unittest.cc \
 	src/streams_unittest.cc \
+	src/string_atom_unittest.cc \
 	src/string_utils_unittest.cc \
-	src/test/weave_testrunner.cc
+	src/test/fake_task_runner_unittest.cc \
+	src/test/traffic_trace_unittest.cc \
+	src/test/weave_testrunner.cc \
+	src/thread_safe_device_unittest.cc \
+	src/timer_unittest.cc \
+	src/traffic_stats_unittest.cc \
+	src/wake_window_scheduler_unittest.cc \
+	src/worker_task_unittest.cc
 
 WEAVE_EXPORTS_UNITTEST_SRC_FILES := \
 	src/weave_unittest.cc
 
+WEAVE_BENCHMARK_SRC_FILES := \
+	src/component_manager_benchmark.cc \
+	src/data_encoding_benchmark.cc \
+	src/json_stream_writer_benchmark.cc \
+	src/notification/xmpp_stream_parser_benchmark.cc \
+	src/privet/auth_manager_benchmark.cc \
+	src/states/state_change_queue_benchmark.cc \
+	src/test/benchmark.cc \
+	src/test/weave_benchmark_runner.cc
+
+WEAVE_LOAD_GENERATOR_SRC_FILES := \
+	src/test/weave_load_generator.cc
+
+WEAVE_SOAK_TEST_SRC_FILES := \
+	src/test/weave_soak_test.cc
+
+WEAVE_TRAFFIC_REPLAY_SRC_FILES := \
+	src/test/weave_traffic_replay.cc
+
+WEAVE_JSON_COMPILER_SRC_FILES := \
+	src/tools/weave_json_compiler.cc
+
 EXAMPLES_PROVIDER_SRC_FILES := \
+	examples/provider/async_log_sink.cc \
 	examples/provider/avahi_client.cc \
-	examples/provider/bluez_client.cc \
 	examples/provider/curl_http_client.cc \
 	examples/provider/event_http_server.cc \
 	examples/provider/event_network.cc \
 	examples/provider/event_task_runner.cc \
 	examples/provider/file_config_store.cc \
 	examples/provider/ssl_stream.cc \
+	examples/provider/tcp_connector.cc \
 	examples/provider/wifi_manager.cc
 
 THIRD_PARTY_CHROMIUM_BASE_SRC_FILES := \
@@ -164,3 +242,6 @@ THIRD_PARTY_LIBUWEAVE_SRC_FILES := \
 	third_party/libuweave/src/macaroon_caveat.c \
 	third_party/libuweave/src/macaroon_context.c \
 	third_party/libuweave/src/macaroon_encoding.c
+
+THIRD_PARTY_LIBUWEAVE_BENCHMARK_SRC_FILES := \
+	third_party/libuweave/macaroon_benchmark.cc
@@ -5,7 +5,9 @@
 #ifndef LIBWEAVE_INCLUDE_WEAVE_COMMAND_H_
 #define LIBWEAVE_INCLUDE_WEAVE_COMMAND_H_
 
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <base/values.h>
 #include <weave/error.h>
@@ -59,6 +61,19 @@ class Command {
   virtual bool SetProgress(const base::DictionaryValue& progress,
                            ErrorPtr* error) = 0;
 
+  // Attaches the binary |data| to the command, e.g. a diagnostic dump or a
+  // thumbnail, so it is uploaded to the server on its own instead of inside
+  // the JSON of the results. Returns the ID of the blob, which the results
+  // should refer to in place of the data, e.g. {"thumbnail": "<blob ID>"}.
+  // The blob is uploaded before the following updates of the command. |data|
+  // is shared with the upload, not copied, and should not change.
+  // The blobs of cloud commands are PUT to commands/<command ID>/blobs/<blob
+  // ID>, which the server must support. A blob the server rejects is dropped
+  // and the results then refer to a missing blob.
+  virtual std::string AttachBlob(
+      const std::string& content_type,
+      std::shared_ptr<const std::vector<uint8_t>> data) = 0;
+
   // Sets command into terminal "done" state.
   // Updates the command results. The |results| should match the schema.
   // Returns false if |results| value is incorrect.
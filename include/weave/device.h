@@ -11,6 +11,7 @@
 #include <vector>
 
 #include <weave/command.h>
+#include <weave/embedded_value.h>
 #include <weave/export.h>
 #include <weave/provider/bluetooth.h>
 #include <weave/provider/config_store.h>
@@ -20,6 +21,7 @@
 #include <weave/provider/network.h>
 #include <weave/provider/task_runner.h>
 #include <weave/provider/wifi.h>
+#include <weave/provider/worker_pool.h>
 
 namespace weave {
 
@@ -75,6 +77,94 @@ inline bool operator!=(const RegistrationData& l, const RegistrationData& r) {
   return !(l == r);
 }
 
+// Controls how state changes of a component are recorded until they are
+// published to the cloud.
+struct StateHistoryPolicy {
+  enum class Overflow {
+    // Merges the oldest recorded changes together when |capacity| records are
+    // exceeded.
+    kMergeOldest,
+    // Merges the newest recorded changes together when |capacity| records are
+    // exceeded, so the oldest transitions are preserved.
+    kDropIntermediate,
+    // Starts a new record on every |sample_interval|-th change only, merging
+    // other changes into the latest record. Oldest records are merged when
+    // |capacity| is exceeded.
+    kSampleEveryN,
+    // Keeps only the latest value of every property, with no history.
+    kCoalesce,
+  };
+
+  // Maximum number of recorded state changes, must not be zero. 100 state
+  // update events should be enough for most components.
+  size_t capacity{100};
+  Overflow overflow{Overflow::kMergeOldest};
+  // Used by Overflow::kSampleEveryN, must not be zero.
+  size_t sample_interval{1};
+};
+
+// Controls which changes of a numeric state property are published to the
+// cloud. The state read locally always has the latest value.
+struct StatePublishFilter {
+  // A change is not published if it differs from the last published value by
+  // less than |deadband|, or by less than |deadband_percent| of that value.
+  double deadband{0};
+  double deadband_percent{0};
+  // A change is published no sooner than |min_interval| after the last one
+  // published. The latest value is published once the interval is over.
+  base::TimeDelta min_interval;
+  // If set, no change is published, e.g. for high-rate properties only read
+  // by local clients. Applies to properties of any type.
+  bool local_only{false};
+};
+
+// Controls how the state changes waiting for the cloud are spooled to the
+// config store during long outages, see Device::EnableStateSpool().
+struct StateSpoolPolicy {
+  // Number of state updates waiting for the cloud after which the recorded
+  // changes are written to the config store as a new segment.
+  size_t segment_size{100};
+  // Maximum number of segments stored, must not be zero. Beyond it the two
+  // oldest segments are merged, keeping the latest value of every property.
+  size_t max_segments{64};
+};
+
+// Controls how often the "diagnostics" component reports the performance of
+// the device, see Device::EnableDiagnostics().
+struct DiagnosticsPolicy {
+  // Period of sampling the metrics, queues and traffic of the device.
+  base::TimeDelta update_interval{base::TimeDelta::FromMinutes(5)};
+  // A value is only updated once it changes by more than this fraction of the
+  // value last published, so the noise doesn't cost state updates.
+  double deadband{0.1};
+};
+
+// Controls how many commands a command handler gets at a time.
+struct CommandHandlerPolicy {
+  // Maximum number of commands passed to the handler and not yet done,
+  // cancelled or aborted. Zero means no limit. Commands over the limit wait
+  // in the queue until one of the handler's commands is finished.
+  size_t max_in_flight{0};
+  // If set, a newly added command replaces a waiting command of the same
+  // component and name, which is cancelled. Only for commands whose latest
+  // parameters make the older ones moot, e.g. "brightness.set".
+  bool supersede_pending{false};
+};
+
+// Limits of the JSON and XML documents the device receives: Privet requests,
+// cloud replies and XMPP stanzas and notifications. A document over them is
+// rejected as soon as the parser gets there, so deeply nested or huge input
+// doesn't build values which are expensive to copy and merge. Zero means no
+// limit.
+struct InputLimits {
+  // Nesting of dictionaries and lists, or of XML elements.
+  size_t max_depth{32};
+  // Values, or XML elements, of a document.
+  size_t max_nodes{100000};
+  // Bytes of a document. XMPP stanzas are also limited to 512 KiB.
+  size_t max_size{4 * 1024 * 1024};
+};
+
 class Device {
  public:
   virtual ~Device() {}
@@ -93,6 +183,14 @@ class Device {
   // Adds new trait definitions to device.
   virtual void AddTraitDefinitionsFromJson(const std::string& json) = 0;
   virtual void AddTraitDefinitions(const base::DictionaryValue& dict) = 0;
+  // Adds the trait definitions compiled at build time, see EmbeddedValue.
+  virtual void AddTraitDefinitionsFromTable(const EmbeddedValue& table) = 0;
+  // Keeps the trait definitions added afterwards unparsed until a component
+  // or a command handler uses them, so a large trait bundle only costs the
+  // memory and the cloud traffic of the traits in use. Definitions are only
+  // validated when they are first used. Tables passed to
+  // AddTraitDefinitionsFromTable() must stay valid, as the compiled ones do.
+  virtual void EnableLazyTraits() = 0;
 
   // Returns the full JSON dictionary containing trait definitions.
   virtual const base::DictionaryValue& GetTraits() const = 0;
@@ -117,6 +215,48 @@ class Device {
   // Returns the full JSON dictionary containing component instances.
   virtual const base::DictionaryValue& GetComponents() const = 0;
 
+  // Starts publishing a read-only copy of GetComponents() for other threads,
+  // updated once per task in which the components or their state changed.
+  virtual void EnableComponentsView() = 0;
+  // Returns the copy of the components last published, or nullptr if
+  // EnableComponentsView() wasn't called. Unlike the other methods, this may
+  // be called on any thread. It neither locks against the thread of the
+  // TaskRunner nor posts to it. The copy never changes, so it stays
+  // consistent for as long as it is held.
+  virtual std::shared_ptr<const base::DictionaryValue> GetComponentsView()
+      const = 0;
+
+  // Saves the trait definitions and components, including their state, to the
+  // config store whenever they change, and restores the ones saved by the
+  // previous run with the same |version|. Returns true if they were restored,
+  // in which case the traits and components don't need to be added again;
+  // command handlers still need to be set. Should be called before the
+  // daemon adds any traits. Change |version| whenever the daemon changes its
+  // traits or components, so that a stale snapshot is ignored.
+  virtual bool EnableComponentsSnapshot(const std::string& version) = 0;
+
+  // Writes the state changes which can't be sent to the cloud to the config
+  // store, so the memory they take stays flat during long outages. The spooled
+  // changes are sent before the newer ones once the device is connected,
+  // including the ones left by the previous run. Should be called before the
+  // daemon sets any state.
+  virtual void EnableStateSpool(const StateSpoolPolicy& policy) = 0;
+
+  // Adds the "automation" component, whose automation.setRules command
+  // deploys rules which send commands to the device when its state changes,
+  // without a round trip through the cloud. The rules are kept in the config
+  // store and run again after a restart.
+  virtual void EnableLocalRules() = 0;
+
+  // Adds the "diagnostics" component, whose state reports the latencies of
+  // command dispatch, patchState requests, state propagation and the task
+  // runner, the depths of the queues, the XMPP reconnects and the bytes
+  // exchanged with each cloud endpoint in the last hour, so the devices can
+  // be monitored like any other state. Only the latencies and counters
+  // recorded by GetMetrics() are reported, see DiagnosticsPolicy for the
+  // rate of the updates.
+  virtual void EnableDiagnostics(const DiagnosticsPolicy& policy) = 0;
+
   // Sets value of multiple properties of the state.
   // It's recommended to call this to initialize component state defined.
   // Example:
@@ -130,6 +270,11 @@ class Device {
   virtual bool SetStateProperties(const std::string& component,
                                   const base::DictionaryValue& dict,
                                   ErrorPtr* error) = 0;
+  // Same as above, but takes the values of |dict| into the state instead of
+  // copying them.
+  virtual bool SetStateProperties(const std::string& component,
+                                  std::unique_ptr<base::DictionaryValue> dict,
+                                  ErrorPtr* error) = 0;
 
   // Returns value of the single property.
   // |name| is full property name, including trait name. e.g. "base.network".
@@ -137,6 +282,14 @@ class Device {
                                               const std::string& name,
                                               ErrorPtr* error) const = 0;
 
+  // Returns the state of |component| by trait, e.g.
+  // {'base': {'firmwareVersion': '123'}}, so several properties can be read
+  // while the component is looked up once. The dictionary is owned by the
+  // device and is valid until its state or components change.
+  virtual const base::DictionaryValue* GetComponentState(
+      const std::string& component,
+      ErrorPtr* error) const = 0;
+
   // Sets value of the single property.
   // |name| is full property name, including trait name. e.g. "base.network".
   virtual bool SetStateProperty(const std::string& component,
@@ -144,6 +297,51 @@ class Device {
                                 const base::Value& value,
                                 ErrorPtr* error) = 0;
 
+  // Opaque handle of a component state property returned by
+  // ResolveStateProperty(). Zero is never a valid handle.
+  using StatePropertyHandle = uint64_t;
+
+  // Resolves the property |name| of |component| once, so it can be updated
+  // repeatedly with SetStatePropertyByHandle() without looking up the
+  // component on every call. Returns 0 on failure.
+  // The handle becomes invalid when the component is removed from the device.
+  virtual StatePropertyHandle ResolveStateProperty(const std::string& component,
+                                                   const std::string& name,
+                                                   ErrorPtr* error) = 0;
+
+  // Sets value of the single property referred by |handle|. Boolean, integer,
+  // number and string properties declared in the trait are kept natively, so
+  // repeated updates of components using the coalescing StateHistoryPolicy
+  // don't build JSON values until the state is read or published.
+  virtual bool SetStatePropertyByHandle(StatePropertyHandle handle,
+                                        const base::Value& value,
+                                        ErrorPtr* error) = 0;
+
+  // Updates the state of several components as a single change. |states| maps
+  // component paths to the properties in the format SetStateProperties()
+  // takes, e.g. {"lamp1": {"onOff": {"state": "on"}}, "lamp2": {...}}.
+  // Either all components are updated or, if any of them is not found, none.
+  // Use DictionaryValue::SetWithoutPathExpansion() for nested component paths.
+  virtual bool SetComponentsState(const base::DictionaryValue& states,
+                                  ErrorPtr* error) = 0;
+
+  // Sets how state changes of |component| are recorded until they are
+  // published to the cloud. Components use the default StateHistoryPolicy
+  // otherwise. Use a larger capacity for components whose every state
+  // transition matters (e.g. locks) and coalescing for noisy sensors.
+  virtual bool SetStateHistoryPolicy(const std::string& component,
+                                     const StateHistoryPolicy& policy,
+                                     ErrorPtr* error) = 0;
+
+  // Sets the filter of the changes of the numeric state property |name| of
+  // |component| published to the cloud, e.g. for noisy analog sensors. A
+  // default-constructed |filter| removes the filter. Properties declared with
+  // "localOnly": true in the trait definition are never published.
+  virtual bool SetStatePublishFilter(const std::string& component,
+                                     const std::string& name,
+                                     const StatePublishFilter& filter,
+                                     ErrorPtr* error) = 0;
+
   // Callback type for AddCommandHandler.
   using CommandHandlerCallback =
       base::Callback<void(const std::weak_ptr<Command>& command)>;
@@ -153,6 +351,8 @@ class Device {
   // handled.
   // |command_name| is the full command name of the command to handle. e.g.
   // "device.setConfig". Each command can have no more than one handler.
+  // |command_name| of the form "<trait>.*" handles all commands of the trait
+  // on |component| which have no handler of their own.
   // Empty |component| and |command_name| sets default handler for all unhanded
   // commands.
   // No new command handlers can be set after default handler was set.
@@ -160,11 +360,31 @@ class Device {
                                  const std::string& command_name,
                                  const CommandHandlerCallback& callback) = 0;
 
+  // Sets the policy of the handler of |command_name| of |component|, which
+  // are selected as by AddCommandHandler(). The policy may be set before or
+  // after the handler, and applies to the commands passed to the handler
+  // afterwards.
+  virtual bool SetCommandHandlerPolicy(const std::string& component,
+                                       const std::string& command_name,
+                                       const CommandHandlerPolicy& policy,
+                                       ErrorPtr* error) = 0;
+
   // Adds a new command to the command queue.
   virtual bool AddCommand(const base::DictionaryValue& command,
                           std::string* id,
                           ErrorPtr* error) = 0;
 
+  // Adds the command |name| for |component| sent by another device hosted in
+  // the same process, on behalf of a user with |scope|. The command is checked
+  // for |scope| as a local command from Privet would be, but skips the HTTP
+  // request, its JSON and the token check.
+  virtual bool AddLocalCommand(const std::string& component,
+                               const std::string& name,
+                               const base::DictionaryValue& parameters,
+                               AuthScope scope,
+                               std::string* id,
+                               ErrorPtr* error) = 0;
+
   // Finds a command by the command |id|. Returns nullptr if the command with
   // the given |id| is not found. The returned pointer should not be persisted
   // for a long period of time.
@@ -203,6 +423,49 @@ class Device {
       const PairingBeginCallback& begin_callback,
       const PairingEndCallback& end_callback) = 0;
 
+  // Returns latency histograms and counters of the hot paths, e.g.
+  // "command_queue_dispatch", "cloud_request <method> <path>",
+  // "state_propagation", "xmpp_connect" and "privet_request <api>", as
+  // {"counters": {...}, "histograms": {<name>: {"count", "p50Ms", "p99Ms",
+  // ...}}}. Nothing is recorded by release builds unless they are compiled
+  // with WEAVE_METRICS defined.
+  virtual std::unique_ptr<base::DictionaryValue> GetMetrics() const = 0;
+
+  // Returns the approximate heap memory used by the subsystems of the device,
+  // as {"<subsystem>": {"count": <elements>, "bytes": <bytes>}} for the
+  // "components", "traits", "componentCaches", "stateChangeQueues",
+  // "commandQueue", "cloudCommandUpdates", "statePublishQueue",
+  // "accessRevocation" and "privet" (if local access is supported),
+  // "strings", the names shared by the commands and state changes of all the
+  // devices, and "objectPools", the blocks in use and the memory of the pools
+  // of commands, command proxies and XML nodes, also shared by all the
+  // devices. The sum of the "bytes" is checked against
+  // Settings::memory_budget.
+  virtual std::unique_ptr<base::DictionaryValue> GetMemoryStats() const = 0;
+
+  // Drops caches and expired entries, and releases the spare capacity of the
+  // queues, e.g. after a burst of commands or when memory is low.
+  virtual void CompactMemory() = 0;
+
+  // Returns the messages and bytes exchanged with the cloud since the device
+  // started, as {"<endpoint>": {"total": {...}, "lastHour": {...},
+  // "lastDay": {...}}}, each with the "count", "bytesSent" and
+  // "bytesReceived". Endpoints are the cloud APIs, e.g.
+  // "POST devices/*/patchState", "POST oauth2/token" and "xmpp". The
+  // "xmpp ping" keepalives are also included in "xmpp". The sizes of the
+  // HTTP requests are approximate.
+  virtual std::unique_ptr<base::DictionaryValue> GetTrafficStats() const = 0;
+
+  // Caps how late the deferrable network activity, i.e. XMPP keepalive pings,
+  // polls, retries and access token refreshes, may run to share a wake-up of
+  // the radio with the other activity. Each kind only waits for a part of its
+  // own delay. Zero disables the alignment. The default is one minute.
+  virtual void SetMaxWakeSlack(base::TimeDelta max_slack) = 0;
+
+  // Replaces the limits of the documents received, see InputLimits. They
+  // apply to the documents received afterwards.
+  virtual void SetInputLimits(const InputLimits& limits) = 0;
+
   LIBWEAVE_EXPORT static std::unique_ptr<Device> Create(
       provider::ConfigStore* config_store,
       provider::TaskRunner* task_runner,
@@ -211,7 +474,8 @@ class Device {
       provider::DnsServiceDiscovery* dns_sd,
       provider::HttpServer* http_server,
       provider::Wifi* wifi,
-      provider::Bluetooth* bluetooth_provider);
+      provider::Bluetooth* bluetooth_provider,
+      provider::WorkerPool* worker_pool = nullptr);
 };
 
 }  // namespace weave
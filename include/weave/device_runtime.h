@@ -0,0 +1,47 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_INCLUDE_WEAVE_DEVICE_RUNTIME_H_
+#define LIBWEAVE_INCLUDE_WEAVE_DEVICE_RUNTIME_H_
+
+#include <memory>
+
+#include <weave/device.h>
+#include <weave/export.h>
+
+namespace weave {
+
+// Hosts many devices on one task runner, HTTP client, network provider and
+// worker pool, e.g. for a bridge exposing each of its downstream devices as a
+// device of its own. The cloud requests of all the devices share one limit of
+// requests in flight and one retry budget, so the HTTP connections and the
+// retries after an outage don't grow with the number of devices. Requests of
+// the devices waiting for a free slot take turns.
+//
+// Each device still keeps its own XMPP connection, since an XMPP session is
+// authenticated as the robot account of a single device.
+class DeviceRuntime {
+ public:
+  virtual ~DeviceRuntime() {}
+
+  // Same as Device::Create(), with the providers of the runtime. The devices
+  // must be destroyed before the runtime. Bridges usually pass no local
+  // access providers, as the downstream devices are not reachable locally.
+  virtual std::unique_ptr<Device> CreateDevice(
+      provider::ConfigStore* config_store,
+      provider::DnsServiceDiscovery* dns_sd,
+      provider::HttpServer* http_server,
+      provider::Wifi* wifi,
+      provider::Bluetooth* bluetooth_provider) = 0;
+
+  LIBWEAVE_EXPORT static std::unique_ptr<DeviceRuntime> Create(
+      provider::TaskRunner* task_runner,
+      provider::HttpClient* http_client,
+      provider::Network* network,
+      provider::WorkerPool* worker_pool = nullptr);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_INCLUDE_WEAVE_DEVICE_RUNTIME_H_
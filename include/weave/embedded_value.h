@@ -0,0 +1,44 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_INCLUDE_WEAVE_EMBEDDED_VALUE_H_
+#define LIBWEAVE_INCLUDE_WEAVE_EMBEDDED_VALUE_H_
+
+#include <stddef.h>
+
+namespace weave {
+
+// A JSON value compiled into a tree of constant tables, which is kept in
+// read-only memory and read without parsing. Trait definitions are compiled
+// from JSON files with the weave_json_compiler tool at build time, e.g.
+//   weave_json_compiler my_traits.json my_traits kTraits > my_traits.h
+// and added with Device::AddTraitDefinitionsFromTable(my_traits::kTraits).
+struct EmbeddedValue {
+  enum class Type {
+    kNull,
+    kBoolean,
+    kInteger,
+    kDouble,
+    kString,
+    kList,
+    kDictionary,
+  };
+
+  Type type;
+  // Name of the member of a dictionary, nullptr for list items and the root.
+  const char* key;
+  // Value of kBoolean and kInteger.
+  int integer;
+  // Value of kDouble.
+  double number;
+  // Value of kString.
+  const char* string;
+  // Items of kList or members of kDictionary.
+  const EmbeddedValue* children;
+  size_t child_count;
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_INCLUDE_WEAVE_EMBEDDED_VALUE_H_
@@ -5,9 +5,15 @@
 #ifndef LIBWEAVE_INCLUDE_WEAVE_ENUM_TO_STRING_H_
 #define LIBWEAVE_INCLUDE_WEAVE_ENUM_TO_STRING_H_
 
+#include <string.h>
+
+#include <algorithm>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include <base/logging.h>
+#include <base/macros.h>
 
 namespace weave {
 
@@ -44,13 +50,118 @@ class EnumToStringMap final {
   const Map* end_;
 };
 
+namespace internal {
+
+// Lookup tables of EnumToStringMap<T>, built on first use. Enumerators are
+// found by indexing a table with their value, names with open addressing on
+// their hash. Like the linear search they replace, the first entry of the map
+// wins when an enumerator or a name is listed twice.
 template <typename T>
-std::string EnumToString(T id) {
-  for (const auto& m : EnumToStringMap<T>()) {
-    if (m.id == id) {
-      CHECK(m.name);
-      return m.name;
+class EnumLookup final {
+ public:
+  using Map = typename EnumToStringMap<T>::Map;
+
+  static const EnumLookup& Get() {
+    static const EnumLookup lookup;
+    return lookup;
+  }
+
+  const Map* Find(T id) const {
+    if (by_id_.empty()) {
+      for (const auto& m : map_) {
+        if (m.id == id)
+          return &m;
+      }
+      return nullptr;
+    }
+    Integer index = static_cast<Integer>(id) - min_;
+    if (index < 0 || static_cast<size_t>(index) >= by_id_.size())
+      return nullptr;
+    return by_id_[index];
+  }
+
+  const Map* Find(const std::string& name) const {
+    size_t mask = by_name_.size() - 1;
+    for (size_t i = Hash(name.c_str()) & mask; by_name_[i];
+         i = (i + 1) & mask) {
+      if (name == by_name_[i]->name)
+        return by_name_[i];
+    }
+    return nullptr;
+  }
+
+ private:
+  using Integer = typename std::conditional<
+      std::is_signed<typename std::underlying_type<T>::type>::value,
+      long long,
+      unsigned long long>::type;
+
+  // Enumerations spanning more values than this are searched linearly.
+  static const size_t kMaxDenseSize = 256;
+
+  EnumLookup() {
+    size_t size = map_.end() - map_.begin();
+    if (size == 0) {
+      by_name_.resize(1);
+      return;
     }
+    min_ = static_cast<Integer>(map_.begin()->id);
+    Integer max = min_;
+    for (const auto& m : map_) {
+      min_ = std::min(min_, static_cast<Integer>(m.id));
+      max = std::max(max, static_cast<Integer>(m.id));
+    }
+    if (static_cast<unsigned long long>(max - min_) < kMaxDenseSize) {
+      by_id_.resize(max - min_ + 1);
+      for (const auto& m : map_) {
+        const Map*& slot = by_id_[static_cast<Integer>(m.id) - min_];
+        if (!slot)
+          slot = &m;
+      }
+    }
+
+    // At most half full, so probe sequences stay short.
+    size_t capacity = 2;
+    while (capacity < 2 * size)
+      capacity *= 2;
+    by_name_.resize(capacity);
+    for (const auto& m : map_) {
+      if (!m.name)
+        continue;
+      size_t i = Hash(m.name) & (capacity - 1);
+      while (by_name_[i] && strcmp(by_name_[i]->name, m.name) != 0)
+        i = (i + 1) & (capacity - 1);
+      if (!by_name_[i])
+        by_name_[i] = &m;
+    }
+  }
+
+  // FNV-1a.
+  static size_t Hash(const char* name) {
+    size_t hash = 2166136261u;
+    for (; *name; ++name)
+      hash = (hash ^ static_cast<unsigned char>(*name)) * 16777619u;
+    return hash;
+  }
+
+  const EnumToStringMap<T> map_;
+  Integer min_{0};
+  // Entries by enumerator value minus |min_|, empty if the values are sparse.
+  std::vector<const Map*> by_id_;
+  // Hash table of the named entries, its size is a power of two.
+  std::vector<const Map*> by_name_;
+
+  DISALLOW_COPY_AND_ASSIGN(EnumLookup);
+};
+
+}  // namespace internal
+
+template <typename T>
+std::string EnumToString(T id) {
+  const auto* m = internal::EnumLookup<T>::Get().Find(id);
+  if (m) {
+    CHECK(m->name);
+    return m->name;
   }
   NOTREACHED() << static_cast<int>(id);
   return std::string();
@@ -58,13 +169,11 @@ std::string EnumToString(T id) {
 
 template <typename T>
 bool StringToEnum(const std::string& name, T* id) {
-  for (const auto& m : EnumToStringMap<T>()) {
-    if (m.name && m.name == name) {
-      *id = m.id;
-      return true;
-    }
-  }
-  return false;
+  const auto* m = internal::EnumLookup<T>::Get().Find(name);
+  if (!m)
+    return false;
+  *id = m->id;
+  return true;
 }
 
 }  // namespace weave
@@ -0,0 +1,51 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_INCLUDE_WEAVE_PROVIDER_ALLOCATOR_H_
+#define LIBWEAVE_INCLUDE_WEAVE_PROVIDER_ALLOCATOR_H_
+
+#include <stddef.h>
+
+#include <weave/export.h>
+
+namespace weave {
+namespace provider {
+
+// This interface may be implemented by the user of libweave on targets which
+// need deterministic memory use, and installed with SetAllocator(). It is
+// optional, libweave uses the global operator new without it.
+//
+// libweave takes the memory of its high-churn objects from the allocator:
+// commands, their cloud proxies, the XML nodes of the XMPP stream and the
+// base::Value nodes not allocated from a request-scoped arena. Commands,
+// proxies and XML nodes are kept in pools of fixed size blocks. The pools take
+// the blocks from the allocator in chunks and never return them, so their
+// memory stays at its peak use and freed objects don't fragment the heap.
+//
+// Allocate() and Free() may be called on any thread, including the threads of
+// the WorkerPool, so they must be thread safe.
+class Allocator {
+ public:
+  // Returns |size| bytes aligned for any object. libweave aborts if it returns
+  // nullptr.
+  virtual void* Allocate(size_t size) = 0;
+
+  // Releases |ptr| returned by Allocate(|size|).
+  virtual void Free(void* ptr, size_t size) = 0;
+
+ protected:
+  virtual ~Allocator() {}
+};
+
+}  // namespace provider
+
+// Installs |allocator| for the whole process. Must be called before any
+// device is created, since the memory libweave takes is returned to the
+// allocator installed when it is freed. |allocator| must stay valid for the
+// rest of the process, the pools keep its memory.
+LIBWEAVE_EXPORT void SetAllocator(provider::Allocator* allocator);
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_INCLUDE_WEAVE_PROVIDER_ALLOCATOR_H_
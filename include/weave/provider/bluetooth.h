@@ -5,13 +5,55 @@
 #ifndef LIBWEAVE_INCLUDE_WEAVE_PROVIDER_BLUETOOTH_H_
 #define LIBWEAVE_INCLUDE_WEAVE_PROVIDER_BLUETOOTH_H_
 
+#include <string>
+
+#include <base/callback.h>
+
 namespace weave {
 namespace provider {
 
+// This interface should be implemented by the user of libweave and
+// provided during device creation in Device::Create(...)
+// libweave will use this interface to serve Privet requests over Bluetooth
+// Low Energy, e.g. to avoid keeping WiFi up on battery powered devices.
+//
+// Implementation of StartPrivetService(...) should publish a GATT service
+// with a single characteristic supporting writes and notifications, and
+// advertise it. Values written into the characteristic by a connected central
+// should be passed to the data callback in the same order. The closed
+// callback should be called when the central disconnects.
+//
+// Implementation of SendPrivetData(...) should send a notification of the
+// characteristic with the given value to the central. Data for connections
+// which are already closed should be dropped.
+//
+// Implementation of GetMaxDataSize(...) should return the largest value which
+// fits into a single write or notification on the connection, i.e. ATT MTU
+// minus 3 bytes.
+//
+// Implementation of IsEncrypted(...) should return true if the central is
+// bonded and the link is encrypted. Only such centrals may use the APIs which
+// are served over HTTPS only.
+
 // Interface with methods to control bluetooth capability of the device.
 class Bluetooth {
  public:
-  // TODO(rginda): Add bluetooth interface methods here.
+  using DataCallback =
+      base::Callback<void(int connection_id, const std::string& data)>;
+  using ClosedCallback = base::Callback<void(int connection_id)>;
+
+  // Starts the Privet GATT service.
+  virtual void StartPrivetService(const DataCallback& data_callback,
+                                  const ClosedCallback& closed_callback) = 0;
+
+  // Stops the Privet GATT service and disconnects the centrals.
+  virtual void StopPrivetService() = 0;
+
+  // Sends the notification with |data| to the central.
+  virtual void SendPrivetData(int connection_id, const std::string& data) = 0;
+
+  virtual size_t GetMaxDataSize(int connection_id) const = 0;
+  virtual bool IsEncrypted(int connection_id) const = 0;
 
  protected:
   virtual ~Bluetooth() {}
@@ -51,8 +51,9 @@ namespace provider {
 //   void FileConfigStore::SaveSettings(const std::string& name,
 //                                      const std::string& settings,
 //                                      const DoneCallback& callback) {
-//     std::ofstream str("/var/lib/weave/weave_" + name + ".json");
+//     std::ofstream str("/var/lib/weave/weave_" + name + ".json.tmp");
 //     str << settings;
+//     ...  // Flush the file and rename it to weave_<name>.json.
 //     if (!callback.is_null())
 //       task_runner_->PostDelayedTask(FROM_HERE, base::Bind(callback, nullptr),
 //                                     {});
@@ -80,7 +81,11 @@ class ConfigStore {
   // modifications. Data stored in settings can be sensitive, so it's highly
   // recommended to protect data, e.g. using encryption.
   // |name| is the name of settings blob. Could be used as filename.
-  // Implementation must call or post callback
+  // Saving must be atomic: after a crash LoadSettings(name) should return
+  // either the old or the new data, e.g. by writing a new file and renaming
+  // it over the old one. Implementation may delay the callback to make one
+  // flush of the storage device for several saves, and must call or post
+  // callback once data is persistent.
   virtual void SaveSettings(const std::string& name,
                             const std::string& settings,
                             const DoneCallback& callback) = 0;
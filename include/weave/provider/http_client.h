@@ -5,12 +5,14 @@
 #ifndef LIBWEAVE_INCLUDE_WEAVE_PROVIDER_HTTP_CLIENT_H_
 #define LIBWEAVE_INCLUDE_WEAVE_PROVIDER_HTTP_CLIENT_H_
 
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <base/callback.h>
 #include <weave/error.h>
+#include <weave/stream.h>
 
 namespace weave {
 namespace provider {
@@ -20,7 +22,7 @@ namespace provider {
 // libweave will use this interface to make HTTP/HTTPS calls to external
 // services.
 //
-// HttpClient interface has only one method SendRequest(...) to implement.
+// HttpClient interface has only SendRequest(...) methods to implement.
 // However, user code should also implement Response interface, that will be
 // passed into callback.
 //
@@ -39,7 +41,8 @@ namespace provider {
 //   data - binary data that should be sent within HTTP request body. Empty
 //     string means no data. Implementation needs to check for that. For
 //     example, kGet method should never have data. It is also possible to have
-//     no data for other methods as well.
+//     no data for other methods as well. An overload of SendRequest(...)
+//     streams the data from InputStream instead.
 //   callback - standard callback to notify libweave when request is complete
 //     and provide results and response data.
 //
@@ -48,15 +51,29 @@ namespace provider {
 // request is complete), callback should be invokes on the same thread.
 // Callback should never be called before SendRequest(...) returns.
 //
+// libweave sends most requests to the same few hosts, and often has several
+// of them in flight at a time. Implementations should keep connections alive
+// and reuse them for later requests to the same host, preferably multiplexing
+// concurrent requests with HTTP/2, since setting up a new TLS connection
+// usually takes longer than the request itself.
+//
 // When invoking callback function, user should provide implementation
 // of the Response interface. For example, the following could be used as a
 // simple implementation:
 //   struct ResponseImpl : public provider::HttpClient::Response {
 //     int GetStatusCode() const override { return status; }
 //     std::string GetContentType() const override { return content_type; }
-//     std::string GetData() const override { return data; }
+//     std::string GetHeader(const std::string& name) const override {
+//       for (const auto& header : headers) {
+//         if (base::EqualsCaseInsensitiveASCII(header.first, name))
+//           return header.second;
+//       }
+//       return {};
+//     }
+//     const std::string& GetData() const override { return data; }
 //     int status{0};
 //     std::string content_type;
+//     provider::HttpClient::Headers headers;
 //     std::string data;
 //   };
 //
@@ -76,7 +93,14 @@ class HttpClient {
    public:
     virtual int GetStatusCode() const = 0;
     virtual std::string GetContentType() const = 0;
-    virtual std::string GetData() const = 0;
+    // Returns the value of the response header |name|, matched case
+    // insensitively, or an empty string if there was none. libweave asks for
+    // compressed responses itself and decodes them according to
+    // Content-Encoding, so GetData() should return the body as received.
+    virtual std::string GetHeader(const std::string& name) const = 0;
+    // Returns the response body. libweave parses it in place, so the
+    // reference should stay valid for the lifetime of the Response.
+    virtual const std::string& GetData() const = 0;
 
     virtual ~Response() {}
   };
@@ -91,6 +115,16 @@ class HttpClient {
                            const std::string& data,
                            const SendRequestCallback& callback) = 0;
 
+  // Same as above, but the request body is read from |data| until it returns
+  // zero bytes. The size of the body is not known in advance, so HTTP/1.1
+  // requests should use chunked transfer encoding. Implementation keeps
+  // |data| until the request is complete.
+  virtual void SendRequest(Method method,
+                           const std::string& url,
+                           const Headers& headers,
+                           std::unique_ptr<InputStream> data,
+                           const SendRequestCallback& callback) = 0;
+
  protected:
   virtual ~HttpClient() {}
 };
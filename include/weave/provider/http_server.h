@@ -89,6 +89,29 @@ namespace provider {
 // HTTP headers, like "Content-Length" or "Transfer-Encoding" depending on
 // capabilities of the server and client which made this request.
 //
+// TakeData() and SendOwnedReply(...) are the same as GetData() and
+// SendReply(...), except that ownership of the data is passed along, so
+// implementation may avoid copying it. libweave calls TakeData() at most once
+// for each request. Default implementations just call the other methods.
+//
+// SendEncodedReply(...) is optional, it is the same as SendOwnedReply(...)
+// for a body compressed with the HTTP |content_encoding|, "gzip" or
+// "deflate", which should be sent in the "Content-Encoding" header. libweave
+// only calls it if the request accepts the encoding. The default
+// implementation returns false without sending anything, and libweave then
+// sends the uncompressed reply.
+//
+// BeginStreamingReply(...) and SendReplyChunk(...) are optional, they are
+// used to push server-sent events to local clients. BeginStreamingReply(...)
+// should send the status and headers, and keep the connection open without
+// Content-Length, e.g. with "Transfer-Encoding: chunked". SendReplyChunk(...)
+// sends the next part of the body, and should return false once the client
+// has gone away, or when the data not yet sent to it is over a limit of the
+// implementation, so a client which stopped reading doesn't hold the memory
+// of the device. libweave then drops the stream. The reply ends when the
+// Request is destroyed. Default
+// implementations return false, and libweave then replies with an error.
+//
 // In case a device has multiple networking interfaces, the device developer
 // needs to make a decision where local APIs (Privet) are necessary and where
 // they are not needed. For example, it may not make sense to expose local
@@ -118,6 +141,26 @@ class HttpServer {
     virtual void SendReply(int status_code,
                            const std::string& data,
                            const std::string& mime_type) = 0;
+
+    virtual std::string TakeData() { return GetData(); }
+    virtual void SendOwnedReply(int status_code,
+                                std::string data,
+                                const std::string& mime_type) {
+      SendReply(status_code, data, mime_type);
+    }
+
+    virtual bool SendEncodedReply(int status_code,
+                                  std::string data,
+                                  const std::string& mime_type,
+                                  const std::string& content_encoding) {
+      return false;
+    }
+
+    virtual bool BeginStreamingReply(int status_code,
+                                     const std::string& mime_type) {
+      return false;
+    }
+    virtual bool SendReplyChunk(const std::string& data) { return false; }
   };
 
   // Callback type for AddRequestHandler.
@@ -5,6 +5,8 @@
 #ifndef LIBWEAVE_INCLUDE_WEAVE_PROVIDER_TASK_RUNNER_H_
 #define LIBWEAVE_INCLUDE_WEAVE_PROVIDER_TASK_RUNNER_H_
 
+#include <stdint.h>
+
 #include <string>
 #include <utility>
 #include <vector>
@@ -36,11 +38,28 @@ namespace provider {
 //
 // If delay is specified, task should be invoked no sooner then timeout is
 // reached (it might be delayed due to other tasks in the queue).
+//
+// Implementation may also override PostTaskWithPriority(...) and
+// CancelTask(...). Among the tasks which are due, ones with higher priority
+// should run first, so the above ordering holds only for tasks of the same
+// priority. Cancelled tasks should be removed from the queue.
 
 // Interface with methods to post tasks into platform-specific message loop of
 // the current thread.
 class TaskRunner {
  public:
+  // Relative importance of a task. Background tasks are maintenance work,
+  // e.g. cleanups and keep-alive pings, which may wait for anything else.
+  enum class Priority {
+    kBackground,
+    kNormal,
+    kUserVisible,
+  };
+
+  // Identifies a task posted with PostTaskWithPriority(...). Zero means the
+  // task can't be cancelled.
+  using TaskId = uint64_t;
+
   // Posts tasks to be executed with the given delay.
   // |from_here| argument is used for debugging and usually just provided by
   // FROM_HERE macro. Implementation may ignore this argument.
@@ -48,6 +67,23 @@ class TaskRunner {
                                const base::Closure& task,
                                base::TimeDelta delay) = 0;
 
+  // Same as PostDelayedTask(...), but with |priority| and returns an id which
+  // can be passed into CancelTask(...). The default implementation ignores
+  // |priority| and returns 0.
+  virtual TaskId PostTaskWithPriority(
+      const tracked_objects::Location& from_here,
+      const base::Closure& task,
+      base::TimeDelta delay,
+      Priority priority) {
+    PostDelayedTask(from_here, task, delay);
+    return 0;
+  }
+
+  // Removes the task with the |id| from the queue if it hasn't run yet.
+  // It's only an optimization, and callers still need to make sure a task
+  // does nothing if it's not needed anymore, e.g. with weak pointers.
+  virtual void CancelTask(TaskId id) {}
+
  protected:
   virtual ~TaskRunner() {}
 };
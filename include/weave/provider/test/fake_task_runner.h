@@ -8,10 +8,9 @@
 #include <weave/provider/task_runner.h>
 
 #include <algorithm>
-#include <queue>
+#include <map>
 #include <memory>
-#include <utility>
-#include <vector>
+#include <tuple>
 
 #include <base/time/clock.h>
 
@@ -27,32 +26,33 @@ class FakeTaskRunner : public TaskRunner {
   void PostDelayedTask(const tracked_objects::Location& from_here,
                        const base::Closure& task,
                        base::TimeDelta delay) override;
+  TaskId PostTaskWithPriority(const tracked_objects::Location& from_here,
+                              const base::Closure& task,
+                              base::TimeDelta delay,
+                              Priority priority) override;
+  void CancelTask(TaskId id) override;
 
   bool RunOnce();
   void Run(size_t number_of_iterations = 1000);
+  // Runs the tasks which are due now, without advancing the clock.
+  void RunPendingTasks();
   void Break();
   base::Clock* GetClock();
   size_t GetTaskQueueSize() const;
 
  private:
-  using QueueItem = std::pair<std::pair<base::Time, size_t>, base::Closure>;
-
-  struct Greater {
-    bool operator()(const QueueItem& a, const QueueItem& b) const {
-      return a.first > b.first;
-    }
-  };
+  // Tasks run by time, then by priority (negated, so higher priority tasks go
+  // first) and then in posting order. The last element is also the task id.
+  using QueueKey = std::tuple<base::Time, int, TaskId>;
 
   bool break_{false};
-  size_t counter_{0};  // Keeps order of tasks with the same time.
+  TaskId counter_{0};  // Keeps order of tasks with the same time.
 
   class TestClock;
   std::unique_ptr<TestClock> test_clock_;
 
-  std::priority_queue<QueueItem,
-                      std::vector<QueueItem>,
-                      FakeTaskRunner::Greater>
-      queue_;
+  std::map<QueueKey, base::Closure> queue_;
+  std::map<TaskId, QueueKey> task_keys_;
 };
 
 }  // namespace test
@@ -7,12 +7,22 @@
 
 #include <weave/provider/bluetooth.h>
 
+#include <string>
+
+#include <gmock/gmock.h>
+
 namespace weave {
 namespace provider {
 namespace test {
 
 class MockBluetooth : public Bluetooth {
  public:
+  MOCK_METHOD2(StartPrivetService,
+               void(const DataCallback&, const ClosedCallback&));
+  MOCK_METHOD0(StopPrivetService, void());
+  MOCK_METHOD2(SendPrivetData, void(int, const std::string&));
+  MOCK_CONST_METHOD1(GetMaxDataSize, size_t(int));
+  MOCK_CONST_METHOD1(IsEncrypted, bool(int));
 };
 
 }  // namespace test
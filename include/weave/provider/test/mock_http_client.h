@@ -20,7 +20,8 @@ class MockHttpClientResponse : public HttpClient::Response {
  public:
   MOCK_CONST_METHOD0(GetStatusCode, int());
   MOCK_CONST_METHOD0(GetContentType, std::string());
-  MOCK_CONST_METHOD0(GetData, std::string());
+  MOCK_CONST_METHOD1(GetHeader, std::string(const std::string&));
+  MOCK_CONST_METHOD0(GetData, const std::string&());
 };
 
 class MockHttpClient : public HttpClient {
@@ -33,6 +34,26 @@ class MockHttpClient : public HttpClient {
                     const Headers&,
                     const std::string&,
                     const SendRequestCallback&));
+
+  // Mocks can't take move-only arguments, so streamed requests are forwarded
+  // to SendStreamRequest(). |data| is kept until the next streamed request.
+  void SendRequest(Method method,
+                   const std::string& url,
+                   const Headers& headers,
+                   std::unique_ptr<InputStream> data,
+                   const SendRequestCallback& callback) override {
+    stream_data_ = std::move(data);
+    SendStreamRequest(method, url, headers, stream_data_.get(), callback);
+  }
+  MOCK_METHOD5(SendStreamRequest,
+               void(Method,
+                    const std::string&,
+                    const Headers&,
+                    InputStream*,
+                    const SendRequestCallback&));
+
+ private:
+  std::unique_ptr<InputStream> stream_data_;
 };
 
 }  // namespace test
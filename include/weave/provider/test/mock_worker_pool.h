@@ -0,0 +1,28 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_INCLUDE_WEAVE_PROVIDER_TEST_MOCK_WORKER_POOL_H_
+#define LIBWEAVE_INCLUDE_WEAVE_PROVIDER_TEST_MOCK_WORKER_POOL_H_
+
+#include <weave/provider/worker_pool.h>
+
+#include <gmock/gmock.h>
+
+namespace weave {
+namespace provider {
+namespace test {
+
+class MockWorkerPool : public WorkerPool {
+ public:
+  MOCK_METHOD3(PostTaskAndReply,
+               void(const tracked_objects::Location&,
+                    const base::Closure&,
+                    const base::Closure&));
+};
+
+}  // namespace test
+}  // namespace provider
+}  // namespace weave
+
+#endif  // LIBWEAVE_INCLUDE_WEAVE_PROVIDER_TEST_MOCK_WORKER_POOL_H_
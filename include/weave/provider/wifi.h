@@ -44,12 +44,28 @@ namespace provider {
 // Interface with methods to control WiFi capability of the device.
 class Wifi {
  public:
+  // Access point of a network. Empty |bssid| and zero |channel| if unknown.
+  struct AccessPoint {
+    std::string bssid;
+    int channel{0};
+  };
+
   // Connects to the given network with the given pass-phrase. Implementation
   // should post either of callbacks.
   virtual void Connect(const std::string& ssid,
                        const std::string& passphrase,
                        const DoneCallback& callback) = 0;
 
+  // Same as Connect(...), but |hint| is the access point of the last
+  // successful connection to the network. Implementations may try it before
+  // scanning all the channels.
+  virtual void ConnectWithHint(const std::string& ssid,
+                               const std::string& passphrase,
+                               const AccessPoint& hint,
+                               const DoneCallback& callback) {
+    Connect(ssid, passphrase, callback);
+  }
+
   // Starts WiFi access point for wifi setup.
   virtual void StartAccessPoint(const std::string& ssid) = 0;
 
@@ -62,6 +78,9 @@ class Wifi {
   // Get SSID of the network device is connected.
   virtual std::string GetConnectedSsid() const = 0;
 
+  // Get the access point the device is connected to, if known.
+  virtual AccessPoint GetConnectedAccessPoint() const { return {}; }
+
  protected:
   virtual ~Wifi() {}
 };
@@ -0,0 +1,42 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_INCLUDE_WEAVE_PROVIDER_WORKER_POOL_H_
+#define LIBWEAVE_INCLUDE_WEAVE_PROVIDER_WORKER_POOL_H_
+
+#include <base/callback.h>
+#include <base/location.h>
+
+namespace weave {
+namespace provider {
+
+// This interface may be implemented by the user of libweave and provided
+// during device creation in Device::Create(...). It is optional, and nullptr
+// can be supplied if the device has a single core or no threads.
+//
+// libweave posts CPU heavy work to it, e.g. parsing large cloud responses,
+// so the thread of the TaskRunner stays responsive to local requests and XMPP
+// messages. The tasks don't touch any state of libweave but their own.
+//
+// Implementation of PostTaskAndReply(...) should run |task| on one of its
+// threads, possibly concurrently with other tasks and with the thread of the
+// TaskRunner, and once |task| has finished, run |reply| on the thread of the
+// TaskRunner. libweave doesn't require the TaskRunner to be thread-safe, so
+// the hop back is up to the implementation, e.g. through the message loop the
+// TaskRunner is built on. Both |task| and |reply| must run, as libweave waits
+// for the results. The closures may be destroyed on any thread.
+class WorkerPool {
+ public:
+  virtual void PostTaskAndReply(const tracked_objects::Location& from_here,
+                                const base::Closure& task,
+                                const base::Closure& reply) = 0;
+
+ protected:
+  virtual ~WorkerPool() {}
+};
+
+}  // namespace provider
+}  // namespace weave
+
+#endif  // LIBWEAVE_INCLUDE_WEAVE_PROVIDER_WORKER_POOL_H_
@@ -27,6 +27,27 @@ enum class PairingType {
   kEmbeddedCode,
 };
 
+// Budget of the heap memory used by a device, as estimated by
+// Device::GetMemoryStats(), checked periodically. As the usage reaches the
+// percentages of |bytes| below, the device degrades in this order:
+//  1. merges the state changes recorded for every component into one;
+//  2. drops the expired entries and spare capacity of the access revocation
+//     list;
+//  3. drops cached serializations: the component trees of the roles, the
+//     trait definitions JSON and the cached Privet replies;
+//  4. rejects new Privet long polls with "deviceBusy" until the usage falls
+//     below the threshold again.
+// The usage is measured again after every step, so the later steps are only
+// taken if the earlier ones didn't free enough.
+struct MemoryBudget {
+  // Zero for no budget.
+  size_t bytes{0};
+  int merge_state_history_percent{70};
+  int shrink_revocation_list_percent{80};
+  int drop_cached_serializations_percent{90};
+  int reject_long_polls_percent{100};
+};
+
 struct Settings {
   // Model specific information. Must be set by ConfigStore::LoadDefaults.
   std::string firmware_version;
@@ -62,6 +83,13 @@ struct Settings {
   std::string service_url;
   std::string xmpp_endpoint;
 
+  // If true, cloud requests ask for compressed responses, and large request
+  // bodies are sent gzip encoded. The server must accept encoded requests.
+  bool cloud_compression_enabled{false};
+
+  // Memory budget of the device. No budget is enforced by default.
+  MemoryBudget memory_budget;
+
   // Cloud ID of the registered device. Empty if device is not registered.
   std::string cloud_id;
 
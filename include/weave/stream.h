@@ -12,6 +12,8 @@
 
 namespace weave {
 
+class OutputStream;
+
 // Interface for async input streaming.
 class InputStream {
  public:
@@ -26,6 +28,14 @@ class InputStream {
   virtual void Read(void* buffer,
                     size_t size_to_read,
                     const ReadCallback& callback) = 0;
+
+  // Optional fast path for copying the rest of the stream into |destination|
+  // without passing the data through the buffers of the caller, e.g. with
+  // splice() between two sockets. Returns false if not supported. Otherwise
+  // |callback| is called with the size copied, as for Read(), once done.
+  virtual bool CopyTo(OutputStream* destination, const ReadCallback& callback) {
+    return false;
+  }
 };
 
 // Interface for async input streaming.
@@ -30,6 +30,9 @@ class MockCommand : public Command {
   MOCK_CONST_METHOD0(GetResults, const base::DictionaryValue&());
   MOCK_CONST_METHOD0(GetError, const Error*());
   MOCK_METHOD2(SetProgress, bool(const base::DictionaryValue&, ErrorPtr*));
+  MOCK_METHOD2(AttachBlob,
+               std::string(const std::string&,
+                           std::shared_ptr<const std::vector<uint8_t>>));
   MOCK_METHOD2(Complete, bool(const base::DictionaryValue&, ErrorPtr*));
   MOCK_METHOD1(Pause, bool(ErrorPtr*));
   MOCK_METHOD2(SetError, bool(const Error*, ErrorPtr*));
@@ -23,6 +23,8 @@ class MockDevice : public Device {
                void(const SettingsChangedCallback& callback));
   MOCK_METHOD1(AddTraitDefinitionsFromJson, void(const std::string& json));
   MOCK_METHOD1(AddTraitDefinitions, void(const base::DictionaryValue& dict));
+  MOCK_METHOD1(AddTraitDefinitionsFromTable, void(const EmbeddedValue& table));
+  MOCK_METHOD0(EnableLazyTraits, void());
   MOCK_CONST_METHOD0(GetTraits, const base::DictionaryValue&());
   MOCK_METHOD1(AddTraitDefsChangedCallback,
                void(const base::Closure& callback));
@@ -34,6 +36,13 @@ class MockDevice : public Device {
   MOCK_METHOD1(AddComponentTreeChangedCallback,
                void(const base::Closure& callback));
   MOCK_CONST_METHOD0(GetComponents, const base::DictionaryValue&());
+  MOCK_METHOD0(EnableComponentsView, void());
+  MOCK_CONST_METHOD0(GetComponentsView,
+                     std::shared_ptr<const base::DictionaryValue>());
+  MOCK_METHOD1(EnableComponentsSnapshot, bool(const std::string& version));
+  MOCK_METHOD1(EnableStateSpool, void(const StateSpoolPolicy& policy));
+  MOCK_METHOD0(EnableLocalRules, void());
+  MOCK_METHOD1(EnableDiagnostics, void(const DiagnosticsPolicy& policy));
   MOCK_METHOD3(SetStatePropertiesFromJson,
                bool(const std::string& component,
                     const std::string& json,
@@ -46,17 +55,51 @@ class MockDevice : public Device {
                      const base::Value*(const std::string& component,
                                         const std::string& name,
                                         ErrorPtr* error));
+  MOCK_CONST_METHOD2(GetComponentState,
+                     const base::DictionaryValue*(const std::string& component,
+                                                  ErrorPtr* error));
   MOCK_METHOD4(SetStateProperty,
                bool(const std::string& component,
                     const std::string& name,
                     const base::Value& value,
                     ErrorPtr* error));
+  MOCK_METHOD3(ResolveStateProperty,
+               StatePropertyHandle(const std::string& component,
+                                   const std::string& name,
+                                   ErrorPtr* error));
+  MOCK_METHOD3(SetStatePropertyByHandle,
+               bool(StatePropertyHandle handle,
+                    const base::Value& value,
+                    ErrorPtr* error));
+  MOCK_METHOD2(SetComponentsState,
+               bool(const base::DictionaryValue& states, ErrorPtr* error));
+  MOCK_METHOD3(SetStateHistoryPolicy,
+               bool(const std::string& component,
+                    const StateHistoryPolicy& policy,
+                    ErrorPtr* error));
+  MOCK_METHOD4(SetStatePublishFilter,
+               bool(const std::string& component,
+                    const std::string& name,
+                    const StatePublishFilter& filter,
+                    ErrorPtr* error));
   MOCK_METHOD3(AddCommandHandler,
                void(const std::string& component,
                     const std::string& command_name,
                     const CommandHandlerCallback& callback));
+  MOCK_METHOD4(SetCommandHandlerPolicy,
+               bool(const std::string& component,
+                    const std::string& command_name,
+                    const CommandHandlerPolicy& policy,
+                    ErrorPtr* error));
   MOCK_METHOD3(AddCommand,
                bool(const base::DictionaryValue&, std::string*, ErrorPtr*));
+  MOCK_METHOD6(AddLocalCommand,
+               bool(const std::string&,
+                    const std::string&,
+                    const base::DictionaryValue&,
+                    AuthScope,
+                    std::string*,
+                    ErrorPtr*));
   MOCK_METHOD1(FindCommand, Command*(const std::string&));
   MOCK_METHOD1(AddStateChangedCallback, void(const base::Closure& callback));
   MOCK_CONST_METHOD0(GetGcdState, GcdState());
@@ -68,6 +111,27 @@ class MockDevice : public Device {
   MOCK_METHOD2(AddPairingChangedCallbacks,
                void(const PairingBeginCallback& begin_callback,
                     const PairingEndCallback& end_callback));
+  MOCK_CONST_METHOD0(MockGetMetrics, base::DictionaryValue*());
+  MOCK_CONST_METHOD0(MockGetMemoryStats, base::DictionaryValue*());
+  MOCK_METHOD0(CompactMemory, void());
+  MOCK_METHOD1(SetMaxWakeSlack, void(base::TimeDelta max_slack));
+  MOCK_METHOD1(SetInputLimits, void(const InputLimits& limits));
+  MOCK_CONST_METHOD0(MockGetTrafficStats, base::DictionaryValue*());
+
+  bool SetStateProperties(const std::string& component,
+                          std::unique_ptr<base::DictionaryValue> dict,
+                          ErrorPtr* error) override {
+    return SetStateProperties(component, *dict, error);
+  }
+  std::unique_ptr<base::DictionaryValue> GetMetrics() const override {
+    return std::unique_ptr<base::DictionaryValue>{MockGetMetrics()};
+  }
+  std::unique_ptr<base::DictionaryValue> GetMemoryStats() const override {
+    return std::unique_ptr<base::DictionaryValue>{MockGetMemoryStats()};
+  }
+  std::unique_ptr<base::DictionaryValue> GetTrafficStats() const override {
+    return std::unique_ptr<base::DictionaryValue>{MockGetTrafficStats()};
+  }
 
   // Deprecated methods.
   MOCK_METHOD1(AddCommandDefinitionsFromJson, void(const std::string&));
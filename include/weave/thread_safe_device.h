@@ -0,0 +1,62 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_INCLUDE_WEAVE_THREAD_SAFE_DEVICE_H_
+#define LIBWEAVE_INCLUDE_WEAVE_THREAD_SAFE_DEVICE_H_
+
+#include <memory>
+#include <string>
+
+#include <base/values.h>
+#include <weave/device.h>
+#include <weave/export.h>
+#include <weave/provider/task_runner.h>
+
+namespace weave {
+
+// Front end of a Device for the threads other than the one running its
+// TaskRunner, e.g. the threads reading sensors. The methods may be called
+// from any thread. They put the update into a lock-free queue and return
+// without waiting for it. The queue is drained by a single task, posted by
+// the call finding the queue empty, so a burst of updates costs one task.
+//
+// Updates are applied in the order they were queued, except that the updates
+// of the state queued in the same task runner tick are merged per component
+// and applied as one change. Updates failing on the device are logged and
+// dropped, without affecting the others.
+class ThreadSafeDevice {
+ public:
+  virtual ~ThreadSafeDevice() {}
+
+  // Sets the property |name| of |component|, e.g. "base.firmwareVersion".
+  virtual void SetStateProperty(const std::string& component,
+                                const std::string& name,
+                                std::unique_ptr<base::Value> value) = 0;
+
+  // Sets the properties in |dict|, as Device::SetStateProperties() does.
+  virtual void SetStateProperties(
+      const std::string& component,
+      std::unique_ptr<base::DictionaryValue> dict) = 0;
+
+  // Adds a new command to the command queue.
+  virtual void AddCommand(std::unique_ptr<base::DictionaryValue> command) = 0;
+
+  // Returns the components with their state as last published by the device,
+  // see Device::GetComponentsView(). Updates queued above show up once the
+  // device applied them and published the next copy.
+  virtual std::shared_ptr<const base::DictionaryValue> GetComponents()
+      const = 0;
+
+  // |task_runner| must be the one of |device| and must accept tasks posted
+  // from any thread. Both must outlive the returned object, which must be
+  // destroyed on the thread of |task_runner| once no other thread uses it. The
+  // updates still queued then are dropped.
+  LIBWEAVE_EXPORT static std::unique_ptr<ThreadSafeDevice> Create(
+      Device* device,
+      provider::TaskRunner* task_runner);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_INCLUDE_WEAVE_THREAD_SAFE_DEVICE_H_
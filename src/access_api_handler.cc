@@ -11,6 +11,7 @@
 #include "src/commands/schema_constants.h"
 #include "src/data_encoding.h"
 #include "src/json_error_codes.h"
+#include "src/string_utils.h"
 #include "src/utils.h"
 
 namespace weave {
@@ -25,6 +26,13 @@ const char kApplicationId[] = "applicationId";
 const char kExpirationTime[] = "expirationTime";
 const char kRevocationTimestamp[] = "revocationTimestamp";
 const char kBlacklistEntries[] = "blacklistEntries";
+const char kEntries[] = "entries";
+const char kMaxResults[] = "maxResults";
+const char kPageToken[] = "pageToken";
+const char kNextPageToken[] = "nextPageToken";
+// Separates the IDs of the last listed entry in the page token. Not used by
+// base64.
+const char kPageTokenSeparator[] = ".";
 
 bool GetIds(const base::DictionaryValue& parameters,
             std::vector<uint8_t>* user_id_decoded,
@@ -49,6 +57,47 @@ bool GetIds(const base::DictionaryValue& parameters,
   return true;
 }
 
+bool ParseEntry(const base::DictionaryValue& parameters,
+                AccessRevocationManager::Entry* entry,
+                ErrorPtr* error) {
+  if (!GetIds(parameters, &entry->user_id, &entry->app_id, error))
+    return false;
+
+  int expiration_j2k = 0;
+  if (!parameters.GetInteger(kExpirationTime, &expiration_j2k)) {
+    return Error::AddTo(error, FROM_HERE, errors::commands::kInvalidPropValue,
+                        "Expiration time is missing");
+  }
+
+  int revocation_j2k = 0;
+  if (!parameters.GetInteger(kRevocationTimestamp, &revocation_j2k)) {
+    return Error::AddTo(error, FROM_HERE, errors::commands::kInvalidPropValue,
+                        "Revocation timestamp is missing");
+  }
+
+  entry->revocation = FromJ2000Time(revocation_j2k);
+  entry->expiration = FromJ2000Time(expiration_j2k);
+  return true;
+}
+
+std::string CreatePageToken(const AccessRevocationManager::Entry& entry) {
+  return Base64Encode(entry.user_id) + kPageTokenSeparator +
+         Base64Encode(entry.app_id);
+}
+
+bool ParsePageToken(const std::string& token,
+                    AccessRevocationManager::Entry* entry,
+                    ErrorPtr* error) {
+  auto ids = SplitAtFirst(token, kPageTokenSeparator, false);
+  if (!Base64Decode(ids.first, &entry->user_id) ||
+      !Base64Decode(ids.second, &entry->app_id)) {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::commands::kInvalidPropValue,
+                              "Invalid page token '%s'", token.c_str());
+  }
+  return true;
+}
+
 }  // namespace
 
 AccessApiHandler::AccessApiHandler(Device* device,
@@ -74,10 +123,47 @@ AccessApiHandler::AccessApiHandler(Device* device,
             }
           }
         },
+        "addEntries": {
+          "minimalRole": "owner",
+          "parameters": {
+            "entries": {
+              "type": "array",
+              "items": {
+                "type": "object",
+                "properties": {
+                  "userId": {
+                    "type": "string"
+                  },
+                  "applicationId": {
+                    "type": "string"
+                  },
+                  "revocationTimestamp": {
+                    "type": "integer"
+                  },
+                  "expirationTime": {
+                    "type": "integer"
+                  }
+                },
+                "additionalProperties": false
+              }
+            }
+          }
+        },
         "list": {
           "minimalRole": "owner",
-          "parameters": {},
+          "parameters": {
+            "maxResults": {
+              "type": "integer",
+              "minimum": 1
+            },
+            "pageToken": {
+              "type": "string"
+            }
+          },
           "results": {
+            "nextPageToken": {
+              "type": "string"
+            },
             "blacklistEntries": {
               "type": "array",
               "items": {
@@ -116,6 +202,9 @@ AccessApiHandler::AccessApiHandler(Device* device,
   device_->AddCommandHandler(
       kComponent, "blacklist.add",
       base::Bind(&AccessApiHandler::Block, weak_ptr_factory_.GetWeakPtr()));
+  device_->AddCommandHandler(kComponent, "blacklist.addEntries",
+                             base::Bind(&AccessApiHandler::BlockEntries,
+                                        weak_ptr_factory_.GetWeakPtr()));
   device_->AddCommandHandler(
       kComponent, "blacklist.list",
       base::Bind(&AccessApiHandler::List, weak_ptr_factory_.GetWeakPtr()));
@@ -130,36 +219,53 @@ void AccessApiHandler::Block(const std::weak_ptr<Command>& cmd) {
       << EnumToString(command->GetState());
   command->SetProgress(base::DictionaryValue{}, nullptr);
 
-  const auto& parameters = command->GetParameters();
-  std::vector<uint8_t> user_id;
-  std::vector<uint8_t> app_id;
+  AccessRevocationManager::Entry entry;
   ErrorPtr error;
-  if (!GetIds(parameters, &user_id, &app_id, &error)) {
+  if (!ParseEntry(command->GetParameters(), &entry, &error)) {
     command->Abort(error.get(), nullptr);
     return;
   }
 
-  int expiration_j2k = 0;
-  if (!parameters.GetInteger(kExpirationTime, &expiration_j2k)) {
-    Error::AddToPrintf(&error, FROM_HERE, errors::commands::kInvalidPropValue,
-                       "Expiration time is missing");
-    command->Abort(error.get(), nullptr);
+  manager_->Block(entry, base::Bind(&AccessApiHandler::OnCommandDone,
+                                    weak_ptr_factory_.GetWeakPtr(), cmd));
+}
+
+void AccessApiHandler::BlockEntries(const std::weak_ptr<Command>& cmd) {
+  auto command = cmd.lock();
+  if (!command)
     return;
-  }
 
-  int revocation_j2k = 0;
-  if (!parameters.GetInteger(kRevocationTimestamp, &revocation_j2k)) {
-    Error::AddToPrintf(&error, FROM_HERE, errors::commands::kInvalidPropValue,
-                       "Revocation timestamp is missing");
+  CHECK(command->GetState() == Command::State::kQueued)
+      << EnumToString(command->GetState());
+  command->SetProgress(base::DictionaryValue{}, nullptr);
+
+  const base::ListValue* list = nullptr;
+  ErrorPtr error;
+  if (!command->GetParameters().GetList(kEntries, &list)) {
+    Error::AddTo(&error, FROM_HERE, errors::commands::kPropertyMissing,
+                 "Entries are missing");
     command->Abort(error.get(), nullptr);
     return;
   }
 
-  manager_->Block(AccessRevocationManager::Entry{user_id, app_id,
-                                                 FromJ2000Time(revocation_j2k),
-                                                 FromJ2000Time(expiration_j2k)},
-                  base::Bind(&AccessApiHandler::OnCommandDone,
-                             weak_ptr_factory_.GetWeakPtr(), cmd));
+  // All the entries are checked before any is added, so the list is written
+  // and the state updated once for the whole batch.
+  std::vector<AccessRevocationManager::Entry> entries(list->GetSize());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const base::DictionaryValue* item = nullptr;
+    if (!list->GetDictionary(i, &item) ||
+        !ParseEntry(*item, &entries[i], &error)) {
+      Error::AddToPrintf(&error, FROM_HERE,
+                         errors::commands::kInvalidPropValue,
+                         "Invalid entry %zu", i);
+      command->Abort(error.get(), nullptr);
+      return;
+    }
+  }
+
+  manager_->BlockEntries(entries,
+                         base::Bind(&AccessApiHandler::OnCommandDone,
+                                    weak_ptr_factory_.GetWeakPtr(), cmd));
 }
 
 void AccessApiHandler::List(const std::weak_ptr<Command>& cmd) {
@@ -171,8 +277,30 @@ void AccessApiHandler::List(const std::weak_ptr<Command>& cmd) {
       << EnumToString(command->GetState());
   command->SetProgress(base::DictionaryValue{}, nullptr);
 
+  const auto& parameters = command->GetParameters();
+  int max_results = 0;
+  std::string page_token;
+  parameters.GetInteger(kMaxResults, &max_results);
+  parameters.GetString(kPageToken, &page_token);
+  std::vector<AccessRevocationManager::Entry> page;
+  if (max_results > 0 || !page_token.empty()) {
+    // Pages continue after the IDs of the last listed entry, so they stay
+    // consistent while entries are added or expire between the calls.
+    AccessRevocationManager::Entry after;
+    ErrorPtr error;
+    if (!page_token.empty() && !ParsePageToken(page_token, &after, &error)) {
+      command->Abort(error.get(), nullptr);
+      return;
+    }
+    page = manager_->GetEntriesAfter(
+        page_token.empty() ? nullptr : &after,
+        max_results > 0 ? max_results : manager_->GetCapacity());
+  } else {
+    page = manager_->GetEntries();
+  }
+
   std::unique_ptr<base::ListValue> entries{new base::ListValue};
-  for (const auto& e : manager_->GetEntries()) {
+  for (const auto& e : page) {
     std::unique_ptr<base::DictionaryValue> entry{new base::DictionaryValue};
     entry->SetString(kUserId, Base64Encode(e.user_id));
     entry->SetString(kApplicationId, Base64Encode(e.app_id));
@@ -181,6 +309,8 @@ void AccessApiHandler::List(const std::weak_ptr<Command>& cmd) {
 
   base::DictionaryValue result;
   result.Set(kBlacklistEntries, std::move(entries));
+  if (max_results > 0 && page.size() == static_cast<size_t>(max_results))
+    result.SetString(kNextPageToken, CreatePageToken(page.back()));
 
   command->Complete(result, nullptr);
 }
@@ -199,9 +329,9 @@ void AccessApiHandler::OnCommandDone(const std::weak_ptr<Command>& cmd,
 }
 
 void AccessApiHandler::UpdateState() {
-  base::DictionaryValue state;
-  state.SetInteger(kStateCapacity, manager_->GetCapacity());
-  device_->SetStateProperties(kComponent, state, nullptr);
+  std::unique_ptr<base::DictionaryValue> state{new base::DictionaryValue};
+  state->SetInteger(kStateCapacity, manager_->GetCapacity());
+  device_->SetStateProperties(kComponent, std::move(state), nullptr);
 }
 
 }  // namespace weave
@@ -21,6 +21,7 @@ class Device;
 // execute incoming commands.
 // Handled commands:
 //  blacklist.add
+//  blacklist.addEntries
 //  blacklist.list
 class AccessApiHandler final {
  public:
@@ -28,6 +29,7 @@ class AccessApiHandler final {
 
  private:
   void Block(const std::weak_ptr<Command>& command);
+  void BlockEntries(const std::weak_ptr<Command>& command);
   void List(const std::weak_ptr<Command>& command);
   void UpdateState();
 
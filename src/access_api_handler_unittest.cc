@@ -31,8 +31,11 @@ class AccessApiHandlerTest : public ::testing::Test {
           EXPECT_TRUE(component_manager_.LoadTraits(json, nullptr));
         }));
     EXPECT_CALL(device_, SetStateProperties(_, _, _))
-        .WillRepeatedly(
-            Invoke(&component_manager_, &ComponentManager::SetStateProperties));
+        .WillRepeatedly(Invoke([this](const std::string& component,
+                                      const base::DictionaryValue& dict,
+                                      ErrorPtr* error) {
+          return component_manager_.SetStateProperties(component, dict, error);
+        }));
     EXPECT_CALL(device_, SetStateProperty(_, _, _, _))
         .WillRepeatedly(
             Invoke(&component_manager_, &ComponentManager::SetStateProperty));
@@ -44,8 +47,10 @@ class AccessApiHandlerTest : public ::testing::Test {
         }));
 
     EXPECT_CALL(device_,
-                AddCommandHandler(_, AnyOf("blacklist.add", "blacklist.list"),
-                                  _))
+                AddCommandHandler(
+                    _, AnyOf("blacklist.add", "blacklist.addEntries",
+                             "blacklist.list"),
+                    _))
         .WillRepeatedly(
             Invoke(&component_manager_, &ComponentManager::AddCommandHandler));
 
@@ -111,10 +116,47 @@ TEST_F(AccessApiHandlerTest, Initialization) {
           }
         }
       },
+      "addEntries": {
+        "minimalRole": "owner",
+        "parameters": {
+          "entries": {
+            "type": "array",
+            "items": {
+              "type": "object",
+              "properties": {
+                "userId": {
+                  "type": "string"
+                },
+                "applicationId": {
+                  "type": "string"
+                },
+                "revocationTimestamp": {
+                  "type": "integer"
+                },
+                "expirationTime": {
+                  "type": "integer"
+                }
+              },
+              "additionalProperties": false
+            }
+          }
+        }
+      },
       "list": {
         "minimalRole": "owner",
-        "parameters": {},
+        "parameters": {
+          "maxResults": {
+            "type": "integer",
+            "minimum": 1
+          },
+          "pageToken": {
+            "type": "string"
+          }
+        },
         "results": {
+          "nextPageToken": {
+            "type": "string"
+          },
           "blacklistEntries": {
             "type": "array",
             "items": {
@@ -216,4 +258,84 @@ TEST_F(AccessApiHandlerTest, List) {
 
   EXPECT_JSON_EQ(expected, results);
 }
+
+TEST_F(AccessApiHandlerTest, RevokeEntries) {
+  EXPECT_CALL(
+      access_manager_,
+      BlockEntries(
+          std::vector<AccessRevocationManager::Entry>{
+              {{1, 2, 3},
+               {3, 4, 5},
+               base::Time::FromTimeT(946686034),
+               base::Time::FromTimeT(946692690)},
+              {{11, 12, 13},
+               {21, 22, 23},
+               base::Time::FromTimeT(946686035),
+               base::Time::FromTimeT(946692691)}},
+          _))
+      .WillOnce(WithArgs<1>(
+          Invoke([](const DoneCallback& callback) { callback.Run(nullptr); })));
+
+  AddCommand(R"({
+    'name' : 'blacklist.addEntries',
+    'component': 'accessControl',
+    'parameters': {
+      'entries': [{
+        'userId': 'AQID',
+        'applicationId': 'AwQF',
+        'expirationTime': 7890,
+        'revocationTimestamp': 1234
+      }, {
+        'userId': 'CwwN',
+        'applicationId': 'FRYX',
+        'expirationTime': 7891,
+        'revocationTimestamp': 1235
+      }]
+    }
+  })");
+}
+
+TEST_F(AccessApiHandlerTest, ListPages) {
+  std::vector<AccessRevocationManager::Entry> entries{
+      {{11, 12, 13},
+       {21, 22, 23},
+       base::Time::FromTimeT(1310000000),
+       base::Time::FromTimeT(1410000000)},
+  };
+  EXPECT_CALL(access_manager_, GetEntriesAfter(nullptr, 1))
+      .WillOnce(Return(entries));
+
+  const auto& first = AddCommand(R"({
+    'name' : 'blacklist.list',
+    'component': 'accessControl',
+    'parameters': {
+      'maxResults': 1
+    }
+  })");
+  EXPECT_JSON_EQ((R"({
+    "blacklistEntries": [ {
+      "applicationId": "FRYX",
+      "userId": "CwwN"
+    } ],
+    "nextPageToken": "CwwN.FRYX"
+  })"), first);
+
+  EXPECT_CALL(access_manager_, GetEntriesAfter(testing::NotNull(), 1))
+      .WillOnce(testing::Invoke(
+          [&entries](const AccessRevocationManager::Entry* after, size_t) {
+            EXPECT_EQ(entries[0].user_id, after->user_id);
+            EXPECT_EQ(entries[0].app_id, after->app_id);
+            return std::vector<AccessRevocationManager::Entry>{};
+          }));
+  const auto& last = AddCommand(R"({
+    'name' : 'blacklist.list',
+    'component': 'accessControl',
+    'parameters': {
+      'maxResults': 1,
+      'pageToken': 'CwwN.FRYX'
+    }
+  })");
+  EXPECT_JSON_EQ(R"({"blacklistEntries": []})", last);
+}
+
 }  // namespace weave
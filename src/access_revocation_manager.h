@@ -9,6 +9,8 @@
 
 #include <base/time/time.h>
 
+#include "src/memory_usage.h"
+
 namespace weave {
 
 class AccessRevocationManager {
@@ -42,12 +44,25 @@ class AccessRevocationManager {
 
   virtual void AddEntryAddedCallback(const base::Closure& callback) = 0;
   virtual void Block(const Entry& entry, const DoneCallback& callback) = 0;
+  // Same as Block(), but adds all the |entries| with a single write of the
+  // list. Nothing is added if any of them has expired.
+  virtual void BlockEntries(const std::vector<Entry>& entries,
+                            const DoneCallback& callback) = 0;
   virtual bool IsBlocked(const std::vector<uint8_t>& user_id,
                          const std::vector<uint8_t>& app_id,
                          base::Time timestamp) const = 0;
   virtual std::vector<Entry> GetEntries() const = 0;
+  // Returns up to |max_count| entries in the order of their IDs, starting
+  // after the IDs of |after|, or from the first entry if it is null.
+  virtual std::vector<Entry> GetEntriesAfter(const Entry* after,
+                                             size_t max_count) const = 0;
   virtual size_t GetSize() const = 0;
   virtual size_t GetCapacity() const = 0;
+
+  // Returns the number of entries and their approximate memory usage.
+  virtual MemoryUsage GetMemoryUsage() const = 0;
+  // Drops the expired entries and releases spare capacity.
+  virtual void CompactMemory() = 0;
 };
 
 inline bool operator==(const AccessRevocationManager::Entry& l,
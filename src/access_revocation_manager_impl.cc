@@ -6,6 +6,7 @@
 
 #include <memory>
 
+#include <base/bind.h>
 #include <base/json/json_reader.h>
 #include <base/json/json_writer.h>
 #include <base/memory/ptr_util.h>
@@ -24,8 +25,43 @@ const char kUser[] = "user";
 const char kApp[] = "app";
 const char kExpiration[] = "expiration";
 const char kRevocation[] = "revocation";
+
+// Bloom filter sizing, about 1% false positives.
+const size_t kIdFilterBitsPerEntry = 10;
+const size_t kIdFilterProbes = 4;
+
+uint64_t HashIds(const std::vector<uint8_t>& user_id,
+                 const std::vector<uint8_t>& app_id) {
+  // FNV-1a. The user ID length keeps ("ab", "") and ("a", "b") apart.
+  uint64_t hash = 14695981039346656037ull;
+  auto add = [&hash](uint8_t byte) {
+    hash ^= byte;
+    hash *= 1099511628211ull;
+  };
+  for (uint8_t byte : user_id)
+    add(byte);
+  for (size_t size = user_id.size(); size; size >>= 8)
+    add(size & 0xFF);
+  add(0);
+  for (uint8_t byte : app_id)
+    add(byte);
+  return hash;
 }
 
+// Calls |probe| with each filter bit of the hash until it returns false.
+template <typename Probe>
+bool ProbeIdFilter(uint64_t hash, size_t num_bits, const Probe& probe) {
+  // Double hashing, see Kirsch and Mitzenmacher.
+  const uint64_t step = (hash >> 32) | 1;
+  for (size_t i = 0; i < kIdFilterProbes; ++i, hash += step) {
+    if (!probe(hash % num_bits))
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
 AccessRevocationManagerImpl::AccessRevocationManagerImpl(
     provider::ConfigStore* store,
     size_t capacity,
@@ -40,21 +76,32 @@ void AccessRevocationManagerImpl::Load() {
   if (auto list = base::ListValue::From(
           base::JSONReader::Read(store_->LoadSettings(kConfigFileName)))) {
     for (const auto& value : *list) {
+      const base::ListValue* fields{nullptr};
       const base::DictionaryValue* entry{nullptr};
       std::string user;
       std::string app;
       Entry e;
       int revocation = 0;
       int expiration = 0;
-      if (value->GetAsDictionary(&entry) && entry->GetString(kUser, &user) &&
-          Base64Decode(user, &e.user_id) && entry->GetString(kApp, &app) &&
-          Base64Decode(app, &e.app_id) &&
-          entry->GetInteger(kRevocation, &revocation) &&
-          entry->GetInteger(kExpiration, &expiration)) {
+      bool parsed = false;
+      if (value->GetAsList(&fields)) {
+        parsed = fields->GetSize() == 4 && fields->GetString(0, &user) &&
+                 fields->GetString(1, &app) &&
+                 fields->GetInteger(2, &revocation) &&
+                 fields->GetInteger(3, &expiration);
+      } else if (value->GetAsDictionary(&entry)) {
+        // Format used before entries were saved as lists.
+        parsed = entry->GetString(kUser, &user) &&
+                 entry->GetString(kApp, &app) &&
+                 entry->GetInteger(kRevocation, &revocation) &&
+                 entry->GetInteger(kExpiration, &expiration);
+      }
+      if (parsed && Base64Decode(user, &e.user_id) &&
+          Base64Decode(app, &e.app_id)) {
         e.revocation = FromJ2000Time(revocation);
         e.expiration = FromJ2000Time(expiration);
         if (e.expiration > clock_->Now())
-          entries_.insert(e);
+          AddEntry(e);
       }
     }
     if (entries_.size() < list->GetSize()) {
@@ -62,6 +109,7 @@ void AccessRevocationManagerImpl::Load() {
       Save({});
     }
   }
+  UpdateIdFilter();
 }
 
 void AccessRevocationManagerImpl::Save(const DoneCallback& callback) {
@@ -71,54 +119,122 @@ void AccessRevocationManagerImpl::Save(const DoneCallback& callback) {
     return;
   }
 
+  if (!callback.is_null())
+    pending_write_callbacks_.push_back(callback);
+  write_pending_ = true;
+  if (!write_in_progress_)
+    WriteEntries();
+}
+
+void AccessRevocationManagerImpl::WriteEntries() {
+  write_pending_ = false;
+  write_in_progress_ = true;
+  std::vector<DoneCallback> callbacks;
+  callbacks.swap(pending_write_callbacks_);
+
+  // Each entry is saved as [user, app, revocation, expiration], which takes
+  // half the space of a dictionary with the same values.
   base::ListValue list;
   for (const auto& e : entries_) {
-    std::unique_ptr<base::DictionaryValue> entry =
-        base::MakeUnique<base::DictionaryValue>();
-    entry->SetString(kUser, Base64Encode(e.user_id));
-    entry->SetString(kApp, Base64Encode(e.app_id));
-    entry->SetInteger(kRevocation, ToJ2000Time(e.revocation));
-    entry->SetInteger(kExpiration, ToJ2000Time(e.expiration));
+    std::unique_ptr<base::ListValue> entry =
+        base::MakeUnique<base::ListValue>();
+    entry->AppendString(Base64Encode(e.user_id));
+    entry->AppendString(Base64Encode(e.app_id));
+    entry->AppendInteger(ToJ2000Time(e.revocation));
+    entry->AppendInteger(ToJ2000Time(e.expiration));
     list.Append(std::move(entry));
   }
 
   std::string json;
   base::JSONWriter::Write(list, &json);
-  store_->SaveSettings(kConfigFileName, json, callback);
+  store_->SaveSettings(
+      kConfigFileName, json,
+      base::Bind(&AccessRevocationManagerImpl::OnEntriesWritten,
+                 weak_ptr_factory_.GetWeakPtr(), callbacks));
 }
 
-void AccessRevocationManagerImpl::Shrink() {
-  base::Time oldest[2] = {base::Time::Max(), base::Time::Max()};
-  for (auto i = begin(entries_); i != end(entries_);) {
-    if (i->expiration <= clock_->Now())
-      i = entries_.erase(i);
-    else {
-      // Non-strict comparison to ensure counting same timestamps as different.
-      if (i->revocation <= oldest[0]) {
-        oldest[1] = oldest[0];
-        oldest[0] = i->revocation;
-      } else {
-        oldest[1] = std::min(oldest[1], i->revocation);
+void AccessRevocationManagerImpl::OnEntriesWritten(
+    const std::vector<DoneCallback>& callbacks,
+    ErrorPtr error) {
+  write_in_progress_ = false;
+  for (const auto& callback : callbacks)
+    callback.Run(error ? error->Clone() : nullptr);
+  if (write_pending_)
+    WriteEntries();
+}
+
+void AccessRevocationManagerImpl::AddEntry(const Entry& entry) {
+  auto inserted = entries_.insert(entry);
+  if (!inserted.second)
+    return;
+  by_expiration_.emplace(entry.expiration, inserted.first);
+  by_revocation_.emplace(entry.revocation, inserted.first);
+}
+
+void AccessRevocationManagerImpl::RemoveEntry(Entries::const_iterator entry) {
+  auto remove_from_index = [entry](base::Time time, EntryIndex* index) {
+    auto range = index->equal_range(time);
+    for (auto i = range.first; i != range.second; ++i) {
+      if (i->second == entry) {
+        index->erase(i);
+        return;
       }
-      ++i;
     }
-  }
+    NOTREACHED();
+  };
+  remove_from_index(entry->expiration, &by_expiration_);
+  remove_from_index(entry->revocation, &by_revocation_);
+  entries_.erase(entry);
+}
+
+void AccessRevocationManagerImpl::Shrink() {
+  RemoveExpiredEntries();
+
   CHECK_GT(capacity_, 1u);
   if (entries_.size() >= capacity_) {
-    // List is full so we are going to remove oldest entries from the list.
-    for (auto i = begin(entries_); i != end(entries_);) {
-      if (i->revocation <= oldest[1])
-        i = entries_.erase(i);
-      else {
-        ++i;
-      }
-    }
+    // List is full so we are going to remove the two oldest entries, and any
+    // revoked at the same time, from the list.
+    const base::Time oldest = std::next(by_revocation_.begin())->first;
+    while (!by_revocation_.empty() && by_revocation_.begin()->first <= oldest)
+      RemoveEntry(by_revocation_.begin()->second);
     // And replace with a single rule to block everything older.
     Entry all_blocking_entry;
     all_blocking_entry.expiration = base::Time::Max();
-    all_blocking_entry.revocation = oldest[1];
-    entries_.insert(all_blocking_entry);
+    all_blocking_entry.revocation = oldest;
+    AddEntry(all_blocking_entry);
+  }
+}
+
+bool AccessRevocationManagerImpl::RemoveExpiredEntries() {
+  const base::Time now = clock_->Now();
+  bool removed = false;
+  while (!by_expiration_.empty() && by_expiration_.begin()->first <= now) {
+    RemoveEntry(by_expiration_.begin()->second);
+    removed = true;
   }
+  return removed;
+}
+
+void AccessRevocationManagerImpl::UpdateIdFilter() {
+  id_filter_.assign((entries_.size() * kIdFilterBitsPerEntry + 63) / 64, 0);
+  const size_t num_bits = id_filter_.size() * 64;
+  for (const auto& e : entries_) {
+    ProbeIdFilter(HashIds(e.user_id, e.app_id), num_bits, [this](size_t bit) {
+      id_filter_[bit / 64] |= 1ull << (bit % 64);
+      return true;
+    });
+  }
+}
+
+bool AccessRevocationManagerImpl::MayContainIds(
+    const std::vector<uint8_t>& user_id,
+    const std::vector<uint8_t>& app_id) const {
+  if (id_filter_.empty())
+    return false;
+  return ProbeIdFilter(HashIds(user_id, app_id), id_filter_.size() * 64,
+                       [this](size_t bit) {
+                         return (id_filter_[bit / 64] >> (bit % 64)) & 1;
+                       });
 }
 
 void AccessRevocationManagerImpl::AddEntryAddedCallback(
@@ -128,30 +244,47 @@ void AccessRevocationManagerImpl::AddEntryAddedCallback(
 
 void AccessRevocationManagerImpl::Block(const Entry& entry,
                                         const DoneCallback& callback) {
-  if (entry.expiration <= clock_->Now()) {
-    if (!callback.is_null()) {
-      ErrorPtr error;
-      Error::AddTo(&error, FROM_HERE, "aleady_expired",
-                   "Entry already expired");
-      callback.Run(std::move(error));
+  BlockEntries({entry}, callback);
+}
+
+void AccessRevocationManagerImpl::BlockEntries(
+    const std::vector<Entry>& entries,
+    const DoneCallback& callback) {
+  const base::Time now = clock_->Now();
+  for (const auto& entry : entries) {
+    if (entry.expiration <= now) {
+      if (!callback.is_null()) {
+        ErrorPtr error;
+        Error::AddTo(&error, FROM_HERE, "aleady_expired",
+                     "Entry already expired");
+        callback.Run(std::move(error));
+      }
+      return;
     }
+  }
+  if (entries.empty()) {
+    if (!callback.is_null())
+      callback.Run(nullptr);
     return;
   }
 
-  // Iterating is OK as Save below is more expensive.
-  Shrink();
-  CHECK_LT(entries_.size(), capacity_);
-
-  auto existing = entries_.find(entry);
-  if (existing != entries_.end()) {
-    Entry new_entry = entry;
-    new_entry.expiration = std::max(entry.expiration, existing->expiration);
-    new_entry.revocation = std::max(entry.revocation, existing->revocation);
-    entries_.erase(existing);
-    entries_.insert(new_entry);
-  } else {
-    entries_.insert(entry);
+  for (const auto& entry : entries) {
+    // Iterating is OK as Save below is more expensive.
+    Shrink();
+    CHECK_LT(entries_.size(), capacity_);
+
+    auto existing = entries_.find(entry);
+    if (existing != entries_.end()) {
+      Entry new_entry = entry;
+      new_entry.expiration = std::max(entry.expiration, existing->expiration);
+      new_entry.revocation = std::max(entry.revocation, existing->revocation);
+      RemoveEntry(existing);
+      AddEntry(new_entry);
+    } else {
+      AddEntry(entry);
+    }
   }
+  UpdateIdFilter();
 
   for (const auto& cb : on_entry_added_callbacks_)
     cb.Run();
@@ -164,10 +297,12 @@ bool AccessRevocationManagerImpl::IsBlocked(const std::vector<uint8_t>& user_id,
                                             base::Time timestamp) const {
   Entry entry_to_find;
   const std::vector<uint8_t> no_id;
-  for (const auto& user : {no_id, user_id}) {
-    for (const auto& app : {no_id, app_id}) {
-      entry_to_find.user_id = user;
-      entry_to_find.app_id = app;
+  for (const auto* user : {&no_id, &user_id}) {
+    for (const auto* app : {&no_id, &app_id}) {
+      if (!MayContainIds(*user, *app))
+        continue;
+      entry_to_find.user_id = *user;
+      entry_to_find.app_id = *app;
       auto match = entries_.find(entry_to_find);
       if (match != end(entries_) && match->expiration > clock_->Now() &&
           match->revocation >= timestamp) {
@@ -183,6 +318,17 @@ AccessRevocationManagerImpl::GetEntries() const {
   return {begin(entries_), end(entries_)};
 }
 
+std::vector<AccessRevocationManager::Entry>
+AccessRevocationManagerImpl::GetEntriesAfter(const Entry* after,
+                                             size_t max_count) const {
+  std::vector<Entry> result;
+  for (auto it = after ? entries_.upper_bound(*after) : entries_.begin();
+       it != entries_.end() && result.size() < max_count; ++it) {
+    result.push_back(*it);
+  }
+  return result;
+}
+
 size_t AccessRevocationManagerImpl::GetSize() const {
   return entries_.size();
 }
@@ -191,4 +337,25 @@ size_t AccessRevocationManagerImpl::GetCapacity() const {
   return capacity_;
 }
 
+MemoryUsage AccessRevocationManagerImpl::GetMemoryUsage() const {
+  MemoryUsage usage;
+  usage.count = entries_.size();
+  usage.bytes = id_filter_.capacity() * sizeof(uint64_t);
+  for (const auto& entry : entries_) {
+    // Each entry is also referred to by |by_expiration_| and |by_revocation_|.
+    usage.bytes += 3 * kTreeNodeOverhead + sizeof(entry) +
+                   2 * sizeof(EntryIndex::value_type) +
+                   entry.user_id.capacity() + entry.app_id.capacity();
+  }
+  return usage;
+}
+
+void AccessRevocationManagerImpl::CompactMemory() {
+  if (RemoveExpiredEntries()) {
+    UpdateIdFilter();
+    Save({});
+  }
+  ShrinkToFit(&id_filter_);
+}
+
 }  // namespace weave
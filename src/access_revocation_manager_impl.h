@@ -5,9 +5,12 @@
 #ifndef LIBWEAVE_SRC_ACCESS_REVOCATION_MANAGER_IMPL_H_
 #define LIBWEAVE_SRC_ACCESS_REVOCATION_MANAGER_IMPL_H_
 
+#include <map>
 #include <set>
 #include <utility>
+#include <vector>
 
+#include <base/memory/weak_ptr.h>
 #include <base/time/default_clock.h>
 #include <base/time/time.h>
 #include <weave/error.h>
@@ -26,17 +29,33 @@ class AccessRevocationManagerImpl : public AccessRevocationManager {
   // AccessRevocationManager implementation.
   void AddEntryAddedCallback(const base::Closure& callback) override;
   void Block(const Entry& entry, const DoneCallback& callback) override;
+  void BlockEntries(const std::vector<Entry>& entries,
+                    const DoneCallback& callback) override;
   bool IsBlocked(const std::vector<uint8_t>& user_id,
                  const std::vector<uint8_t>& app_id,
                  base::Time timestamp) const override;
   std::vector<Entry> GetEntries() const override;
+  std::vector<Entry> GetEntriesAfter(const Entry* after,
+                                     size_t max_count) const override;
   size_t GetSize() const override;
   size_t GetCapacity() const override;
+  MemoryUsage GetMemoryUsage() const override;
+  void CompactMemory() override;
 
  private:
   void Load();
   void Save(const DoneCallback& callback);
+  void WriteEntries();
+  void OnEntriesWritten(const std::vector<DoneCallback>& callbacks,
+                        ErrorPtr error);
   void Shrink();
+  // Returns false if no entry has expired.
+  bool RemoveExpiredEntries();
+  // Rebuilds |id_filter_| from |entries_|.
+  void UpdateIdFilter();
+  // Returns false if no entry has the given IDs.
+  bool MayContainIds(const std::vector<uint8_t>& user_id,
+                     const std::vector<uint8_t>& app_id) const;
 
   struct EntryIdsLess {
     bool operator()(const Entry& l, const Entry& r) const {
@@ -46,15 +65,37 @@ class AccessRevocationManagerImpl : public AccessRevocationManager {
       return make_tuple(l) < make_tuple(r);
     }
   };
+  using Entries = std::set<Entry, EntryIdsLess>;
+  using EntryIndex = std::multimap<base::Time, Entries::const_iterator>;
+
+  // Adds or removes the entry along with its |by_expiration_| and
+  // |by_revocation_| records.
+  void AddEntry(const Entry& entry);
+  void RemoveEntry(Entries::const_iterator entry);
 
   const size_t capacity_{0};
   base::DefaultClock default_clock_;
   base::Clock* clock_{&default_clock_};
 
   provider::ConfigStore* store_{nullptr};
-  std::set<Entry, EntryIdsLess> entries_;
+  Entries entries_;
+  // |entries_| ordered by time, so the expired and the oldest entries can be
+  // dropped without a scan.
+  EntryIndex by_expiration_;
+  EntryIndex by_revocation_;
+  // Bloom filter of the IDs of |entries_|. Most tokens are not revoked, so
+  // this answers most IsBlocked() calls without any ID comparisons.
+  std::vector<uint64_t> id_filter_;
   std::vector<base::Closure> on_entry_added_callbacks_;
 
+  // Writes are not started while one is in progress. The entries changed in
+  // the meantime are written once, when it completes.
+  bool write_in_progress_{false};
+  bool write_pending_{false};
+  std::vector<DoneCallback> pending_write_callbacks_;
+
+  base::WeakPtrFactory<AccessRevocationManagerImpl> weak_ptr_factory_{this};
+
   DISALLOW_COPY_AND_ASSIGN(AccessRevocationManagerImpl);
 };
 
@@ -39,12 +39,8 @@ class AccessRevocationManagerImplTest : public testing::Test {
     EXPECT_CALL(config_store_, SaveSettings("black_list", _, _))
         .WillOnce(testing::WithArgs<1, 2>(testing::Invoke(
             [](const std::string& json, const DoneCallback& callback) {
-              std::string to_save = R"([{
-                "user": "AQID",
-                "app": "AwQF",
-                "expiration": 473315199,
-                "revocation": 473313199
-              }])";
+              std::string to_save =
+                  R"([["AQID", "AwQF", 473313199, 473315199]])";
               EXPECT_JSON_EQ(to_save, *test::CreateValue(json));
               if (!callback.is_null())
                 callback.Run(nullptr);
@@ -72,6 +68,19 @@ TEST_F(AccessRevocationManagerImplTest, Init) {
             manager_->GetEntries());
 }
 
+TEST_F(AccessRevocationManagerImplTest, LoadLists) {
+  EXPECT_CALL(config_store_, LoadSettings("black_list"))
+      .WillOnce(Return(R"([["AQID", "AwQF", 473313199, 473315199]])"));
+  manager_.reset(new AccessRevocationManagerImpl{&config_store_, 10, &clock_});
+  EXPECT_EQ((std::vector<AccessRevocationManagerImpl::Entry>{{
+                {1, 2, 3},
+                {3, 4, 5},
+                base::Time::FromTimeT(1419997999),
+                base::Time::FromTimeT(1419999999),
+            }}),
+            manager_->GetEntries());
+}
+
 TEST_F(AccessRevocationManagerImplTest, Block) {
   bool callback_called = false;
   manager_->AddEntryAddedCallback(
@@ -80,17 +89,10 @@ TEST_F(AccessRevocationManagerImplTest, Block) {
   EXPECT_CALL(config_store_, SaveSettings("black_list", _, _))
       .WillOnce(testing::WithArgs<1, 2>(testing::Invoke(
           [](const std::string& json, const DoneCallback& callback) {
-            std::string to_save = R"([{
-                "user": "AQID",
-                "app": "AwQF",
-                "expiration": 473315199,
-                "revocation": 473313199
-              }, {
-                "app": "CAgI",
-                "user": "BwcH",
-                "expiration": 473305200,
-                "revocation": 473295200
-              }])";
+            std::string to_save = R"([
+                ["AQID", "AwQF", 473313199, 473315199],
+                ["BwcH", "CAgI", 473295200, 473305200]
+              ])";
             EXPECT_JSON_EQ(to_save, *test::CreateValue(json));
             if (!callback.is_null())
               callback.Run(nullptr);
@@ -165,6 +167,142 @@ TEST_F(AccessRevocationManagerImplTest, IsBlockedRevocationIsOld) {
                                    base::Time::FromTimeT(1429997999)));
 }
 
+TEST_F(AccessRevocationManagerImplTest, IsBlockedManyEntries) {
+  EXPECT_CALL(config_store_, SaveSettings("black_list", _, _))
+      .WillRepeatedly(testing::Return());
+  for (uint8_t i = 0; i < 8; ++i) {
+    manager_->Block({{i}, {i, i}, {}, base::Time::FromTimeT(1419990000)}, {});
+  }
+  for (uint8_t i = 0; i < 8; ++i) {
+    EXPECT_TRUE(manager_->IsBlocked({i}, {i, i}, {}));
+    EXPECT_FALSE(manager_->IsBlocked({i}, {i}, {}));
+    EXPECT_FALSE(manager_->IsBlocked({i, i}, {}, {}));
+  }
+  EXPECT_TRUE(manager_->IsBlocked({1, 2, 3}, {3, 4, 5}, {}));
+}
+
+TEST_F(AccessRevocationManagerImplTest, CoalesceWrites) {
+  std::vector<DoneCallback> store_callbacks;
+  std::string saved;
+  EXPECT_CALL(config_store_, SaveSettings("black_list", _, _))
+      .Times(2)
+      .WillRepeatedly(testing::WithArgs<1, 2>(testing::Invoke(
+          [&store_callbacks, &saved](const std::string& json,
+                                     const DoneCallback& callback) {
+            saved = json;
+            store_callbacks.push_back(callback);
+          })));
+
+  int done = 0;
+  for (uint8_t i = 0; i < 3; ++i) {
+    manager_->Block({{i}, {i}, {}, base::Time::FromTimeT(1419990000)},
+                    base::Bind(
+                        [](int* done, ErrorPtr error) {
+                          EXPECT_FALSE(error);
+                          ++*done;
+                        },
+                        &done));
+  }
+  // The first write is in progress, the rest waits for it.
+  ASSERT_EQ(1u, store_callbacks.size());
+  store_callbacks[0].Run(nullptr);
+  EXPECT_EQ(1, done);
+
+  ASSERT_EQ(2u, store_callbacks.size());
+  // All new entries go into the second write.
+  auto value = test::CreateValue(saved);
+  const base::ListValue* list = nullptr;
+  ASSERT_TRUE(value->GetAsList(&list));
+  EXPECT_EQ(4u, list->GetSize());
+  store_callbacks[1].Run(nullptr);
+  EXPECT_EQ(3, done);
+}
+
+TEST_F(AccessRevocationManagerImplTest, BlockEntries) {
+  int added = 0;
+  manager_->AddEntryAddedCallback(
+      base::Bind([](int* added) { ++*added; }, base::Unretained(&added)));
+
+  // Nothing is added if any entry is expired.
+  const base::Time expiration = base::Time::FromTimeT(1419990000);
+  manager_->BlockEntries(
+      {{{1}, {1}, {}, expiration},
+       {{2}, {2}, {}, base::Time::FromTimeT(1400000000)}},
+      base::Bind([](ErrorPtr error) {
+        EXPECT_TRUE(error->HasError("aleady_expired"));
+      }));
+  EXPECT_EQ(1u, manager_->GetSize());
+
+  // The whole batch is written once.
+  EXPECT_CALL(config_store_, SaveSettings("black_list", _, _))
+      .WillOnce(testing::WithArgs<1, 2>(testing::Invoke(
+          [](const std::string& json, const DoneCallback& callback) {
+            auto value = test::CreateValue(json);
+            const base::ListValue* list = nullptr;
+            ASSERT_TRUE(value->GetAsList(&list));
+            EXPECT_EQ(4u, list->GetSize());
+            callback.Run(nullptr);
+          })));
+  bool done = false;
+  manager_->BlockEntries({{{1}, {1}, {}, expiration},
+                          {{2}, {2}, {}, expiration},
+                          {{3}, {3}, {}, expiration}},
+                         base::Bind(
+                             [](bool* done, ErrorPtr error) {
+                               EXPECT_FALSE(error);
+                               *done = true;
+                             },
+                             &done));
+  EXPECT_TRUE(done);
+  EXPECT_EQ(1, added);
+  EXPECT_EQ(4u, manager_->GetSize());
+  EXPECT_TRUE(manager_->IsBlocked({2}, {2}, {}));
+}
+
+TEST_F(AccessRevocationManagerImplTest, GetEntriesAfter) {
+  EXPECT_CALL(config_store_, SaveSettings("black_list", _, _));
+  const base::Time expiration = base::Time::FromTimeT(1419990000);
+  manager_->BlockEntries({{{1}, {1}, {}, expiration},
+                          {{1}, {2}, {}, expiration},
+                          {{2}, {1}, {}, expiration}},
+                         {});
+
+  auto page = manager_->GetEntriesAfter(nullptr, 2);
+  ASSERT_EQ(2u, page.size());
+  EXPECT_EQ((std::vector<uint8_t>{1}), page[0].user_id);
+  EXPECT_EQ((std::vector<uint8_t>{2}), page[1].app_id);
+
+  page = manager_->GetEntriesAfter(&page[1], 2);
+  ASSERT_EQ(2u, page.size());
+  EXPECT_EQ((std::vector<uint8_t>{1, 2, 3}), page[0].user_id);
+  EXPECT_EQ((std::vector<uint8_t>{2}), page[1].user_id);
+
+  // Entries are listed after the IDs, even if there is no such entry.
+  AccessRevocationManager::Entry after{{1, 5}, {}, {}, {}};
+  page = manager_->GetEntriesAfter(&after, 10);
+  ASSERT_EQ(1u, page.size());
+  EXPECT_EQ((std::vector<uint8_t>{2}), page[0].user_id);
+  EXPECT_TRUE(manager_->GetEntriesAfter(&page[0], 10).empty());
+}
+
+TEST_F(AccessRevocationManagerImplTest, CompactMemory) {
+  MemoryUsage usage = manager_->GetMemoryUsage();
+  EXPECT_EQ(1u, usage.count);
+  EXPECT_LT(0u, usage.bytes);
+
+  // Nothing to drop yet.
+  manager_->CompactMemory();
+  EXPECT_EQ(1u, manager_->GetSize());
+
+  EXPECT_CALL(clock_, Now())
+      .WillRepeatedly(Return(base::Time::FromTimeT(1420000000)));
+  EXPECT_CALL(config_store_, SaveSettings("black_list", "[]", _));
+  manager_->CompactMemory();
+  EXPECT_EQ(0u, manager_->GetSize());
+  EXPECT_EQ(0u, manager_->GetMemoryUsage().count);
+  EXPECT_GT(usage.bytes, manager_->GetMemoryUsage().bytes);
+}
+
 class AccessRevocationManagerImplIsBlockedTest
     : public AccessRevocationManagerImplTest,
       public testing::WithParamInterface<
@@ -13,8 +13,26 @@
 
 namespace weave {
 
-BackoffEntry::BackoffEntry(const BackoffEntry::Policy* const policy)
-    : policy_(policy) {
+RetryBudget::RetryBudget(size_t max_retries, base::TimeDelta window)
+    : max_retries_{max_retries}, window_{window} {
+  CHECK_GT(max_retries_, 0u);
+}
+
+base::TimeTicks RetryBudget::Acquire(base::TimeTicks time) {
+  if (!retry_times_.empty())
+    time = std::max(time, retry_times_.back());
+  if (retry_times_.size() == max_retries_) {
+    // The oldest retry must leave the window first.
+    time = std::max(time, retry_times_.front() + window_);
+    retry_times_.pop_front();
+  }
+  retry_times_.push_back(time);
+  return time;
+}
+
+BackoffEntry::BackoffEntry(const BackoffEntry::Policy* const policy,
+                           base::Clock* clock)
+    : policy_(policy), clock_{clock} {
   DCHECK(policy_);
   Reset();
 }
@@ -23,6 +41,10 @@ void BackoffEntry::InformOfRequest(bool succeeded) {
   if (!succeeded) {
     ++failure_count_;
     exponential_backoff_release_time_ = CalculateReleaseTime();
+    if (retry_budget_) {
+      exponential_backoff_release_time_ =
+          retry_budget_->Acquire(exponential_backoff_release_time_);
+    }
   } else {
     // We slowly decay the number of times delayed instead of
     // resetting it to 0 in order to stay stable if we receive
@@ -31,6 +53,8 @@ void BackoffEntry::InformOfRequest(bool succeeded) {
     // statement) will be in the past once the method returns.
     if (failure_count_ > 0)
       --failure_count_;
+    if (failure_count_ == 0)
+      last_delay_ms_ = 0;
 
     // The reason why we are not just cutting the release time to
     // ImplGetTimeNow() is on the one hand, it would unset a release
@@ -95,6 +119,7 @@ bool BackoffEntry::CanDiscard() const {
 
 void BackoffEntry::Reset() {
   failure_count_ = 0;
+  last_delay_ms_ = 0;
 
   // We leave exponential_backoff_release_time_ unset, meaning 0. We could
   // initialize to ImplGetTimeNow() but because it's a virtual method it's
@@ -105,10 +130,12 @@ void BackoffEntry::Reset() {
 }
 
 base::TimeTicks BackoffEntry::ImplGetTimeNow() const {
+  if (clock_)
+    return base::TimeTicks::FromInternalValue(clock_->Now().ToInternalValue());
   return base::TimeTicks::Now();
 }
 
-base::TimeTicks BackoffEntry::CalculateReleaseTime() const {
+base::TimeTicks BackoffEntry::CalculateReleaseTime() {
   int effective_failure_count =
       std::max(0, failure_count_ - policy_->num_errors_to_ignore);
 
@@ -131,8 +158,19 @@ base::TimeTicks BackoffEntry::CalculateReleaseTime() const {
   // accounted for. Both cases are handled by using CheckedNumeric<int64_t> to
   // perform the conversion to integers.
   double delay_ms = policy_->initial_delay_ms;
-  delay_ms *= pow(policy_->multiply_factor, effective_failure_count - 1);
-  delay_ms -= base::RandDouble() * policy_->jitter_factor * delay_ms;
+  if (policy_->use_decorrelated_jitter) {
+    // delay = Uniform(initial_backoff, previous_delay * multiply_factor)
+    double max_delay_ms =
+        std::max(delay_ms, last_delay_ms_ * policy_->multiply_factor);
+    double maximum_backoff_ms = policy_->maximum_backoff_ms;
+    if (maximum_backoff_ms >= 0)
+      max_delay_ms = std::min(max_delay_ms, maximum_backoff_ms);
+    delay_ms += base::RandDouble() * (max_delay_ms - delay_ms);
+    last_delay_ms_ = delay_ms;
+  } else {
+    delay_ms *= pow(policy_->multiply_factor, effective_failure_count - 1);
+    delay_ms -= base::RandDouble() * policy_->jitter_factor * delay_ms;
+  }
 
   // Do overflow checking in microseconds, the internal unit of TimeTicks.
   const int64_t kTimeTicksNowUs =
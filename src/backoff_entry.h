@@ -5,10 +5,34 @@
 #ifndef LIBWEAVE_SRC_BACKOFF_ENTRY_H_
 #define LIBWEAVE_SRC_BACKOFF_ENTRY_H_
 
+#include <deque>
+
+#include <base/time/clock.h>
 #include <base/time/time.h>
 
 namespace weave {
 
+// Limits the rate of retries of all the BackoffEntry objects which share it,
+// so that many failing requests of different kinds don't add up to a retry
+// storm, e.g. when the server comes back after an outage.
+class RetryBudget {
+ public:
+  // Allows at most |max_retries| retries in any |window|.
+  RetryBudget(size_t max_retries, base::TimeDelta window);
+
+  // Returns the earliest time not before |time| at which a retry fits into
+  // the budget, and accounts the retry at that time.
+  base::TimeTicks Acquire(base::TimeTicks time);
+
+ private:
+  const size_t max_retries_;
+  const base::TimeDelta window_;
+  // Times of the last |max_retries_| retries, in ascending order.
+  std::deque<base::TimeTicks> retry_times_;
+
+  DISALLOW_COPY_AND_ASSIGN(RetryBudget);
+};
+
 // Provides the core logic needed for randomized exponential back-off
 // on requests to a given resource, given a back-off policy.
 //
@@ -52,11 +76,20 @@ class BackoffEntry {
     // and (0, 0, N, Nm, ...) when false, where N is initial_backoff_ms and
     // m is multiply_factor, assuming we've already seen one success.
     bool always_use_initial_delay;
+
+    // If true, each delay is picked at random between initial_delay_ms and
+    // multiply_factor times the previous delay ("decorrelated jitter"),
+    // instead of shrinking the exponential delay by jitter_factor. Clients
+    // which started to fail at the same time drift apart much quicker.
+    bool use_decorrelated_jitter;
   };
 
   // Lifetime of policy must enclose lifetime of BackoffEntry. The
   // pointer must be valid but is not dereferenced during construction.
-  explicit BackoffEntry(const Policy* const policy);
+  // |clock|, if not null, is the source of the current time instead of
+  // TimeTicks::Now() and must outlive this object.
+  explicit BackoffEntry(const Policy* const policy,
+                        base::Clock* clock = nullptr);
   virtual ~BackoffEntry() {}
 
   // Inform this item that a request for the network resource it is
@@ -78,6 +111,12 @@ class BackoffEntry {
   // This can be used to e.g. implement support for a Retry-After header.
   void SetCustomReleaseTime(const base::TimeTicks& release_time);
 
+  // Makes retries after failures also wait for |retry_budget|, which is not
+  // owned and must outlive this object.
+  void SetRetryBudget(RetryBudget* retry_budget) {
+    retry_budget_ = retry_budget;
+  }
+
   // Returns true if this object has no significant state (i.e. you could
   // just as well start with a fresh BackoffEntry object), and hasn't
   // had for Policy::entry_lifetime_ms.
@@ -89,13 +128,17 @@ class BackoffEntry {
   // Returns the failure count for this entry.
   int failure_count() const { return failure_count_; }
 
+  // Returns the current time in the time base of the release times.
+  base::TimeTicks GetTimeTicksNow() const { return ImplGetTimeNow(); }
+
  protected:
   // Equivalent to TimeTicks::Now(), virtual so unit tests can override.
   virtual base::TimeTicks ImplGetTimeNow() const;
 
  private:
-  // Calculates when requests should again be allowed through.
-  base::TimeTicks CalculateReleaseTime() const;
+  // Calculates when requests should again be allowed through, and keeps the
+  // delay used for the next decorrelated jitter calculation.
+  base::TimeTicks CalculateReleaseTime();
 
   // Timestamp calculated by the exponential back-off algorithm at which we are
   // allowed to start sending requests again.
@@ -104,7 +147,12 @@ class BackoffEntry {
   // Counts request errors; decremented on success.
   int failure_count_;
 
+  // The last delay picked with decorrelated jitter.
+  double last_delay_ms_;
+
   const Policy* const policy_;
+  base::Clock* clock_{nullptr};
+  RetryBudget* retry_budget_{nullptr};
 
   DISALLOW_COPY_AND_ASSIGN(BackoffEntry);
 };
@@ -4,6 +4,8 @@
 
 #include "src/backoff_entry.h"
 
+#include <algorithm>
+
 #include <gtest/gtest.h>
 
 using base::TimeDelta;
@@ -211,6 +213,58 @@ TEST(BackoffEntryTest, ReleaseTimeCalculationWithJitter) {
   }
 }
 
+TEST(BackoffEntryTest, ReleaseTimeCalculationWithDecorrelatedJitter) {
+  BackoffEntry::Policy jittery_policy = base_policy;
+  jittery_policy.multiply_factor = 3.0;
+  jittery_policy.use_decorrelated_jitter = true;
+  for (int i = 0; i < 10; ++i) {
+    TestBackoffEntry entry(&jittery_policy);
+    TimeDelta max_delay = TimeDelta::FromMilliseconds(1000);
+    for (int j = 0; j < 8; ++j) {
+      entry.InformOfRequest(false);
+      TimeDelta delay = entry.GetTimeUntilRelease();
+      EXPECT_LE(TimeDelta::FromMilliseconds(1000), delay);
+      EXPECT_GE(max_delay, delay);
+      // Allow for rounding of the delays to milliseconds.
+      max_delay = std::min(delay * 3 + TimeDelta::FromMilliseconds(2),
+                           TimeDelta::FromMilliseconds(20000));
+      entry.set_now(entry.GetReleaseTime());
+    }
+  }
+}
+
+TEST(BackoffEntryTest, RetryBudget) {
+  RetryBudget budget{2, TimeDelta::FromSeconds(10)};
+  TimeTicks start;
+  EXPECT_EQ(start, budget.Acquire(start));
+  EXPECT_EQ(start + TimeDelta::FromSeconds(1),
+            budget.Acquire(start + TimeDelta::FromSeconds(1)));
+  // The third retry waits for the first one to leave the window.
+  EXPECT_EQ(start + TimeDelta::FromSeconds(10),
+            budget.Acquire(start + TimeDelta::FromSeconds(2)));
+  EXPECT_EQ(start + TimeDelta::FromSeconds(11), budget.Acquire(start));
+  EXPECT_EQ(start + TimeDelta::FromSeconds(40),
+            budget.Acquire(start + TimeDelta::FromSeconds(40)));
+}
+
+TEST(BackoffEntryTest, SharedRetryBudget) {
+  RetryBudget budget{3, TimeDelta::FromSeconds(60)};
+  TestBackoffEntry entry1(&base_policy);
+  TestBackoffEntry entry2(&base_policy);
+  entry1.SetRetryBudget(&budget);
+  entry2.SetRetryBudget(&budget);
+
+  entry1.InformOfRequest(false);
+  entry2.InformOfRequest(false);
+  entry1.InformOfRequest(false);
+  EXPECT_EQ(TimeDelta::FromMilliseconds(2000), entry1.GetTimeUntilRelease());
+  EXPECT_EQ(TimeDelta::FromMilliseconds(1000), entry2.GetTimeUntilRelease());
+
+  // The budget is exhausted until the first retry leaves the window.
+  entry2.InformOfRequest(false);
+  EXPECT_EQ(TimeDelta::FromSeconds(61), entry2.GetTimeUntilRelease());
+}
+
 TEST(BackoffEntryTest, FailureThenSuccess) {
   TestBackoffEntry entry(&base_policy);
 
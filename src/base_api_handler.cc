@@ -102,12 +102,13 @@ BaseApiHandler::BaseApiHandler(DeviceRegistrationInfo* device_info,
   OnConfigChanged(device_->GetSettings());
 
   const auto& settings = device_info_->GetSettings();
-  base::DictionaryValue state;
-  state.SetString("device.firmwareVersion", settings.firmware_version);
-  state.SetString("device.hardwareId", settings.device_id);
-  state.SetString("device.serialNumber", settings.serial_number);
-  state.SetString("privet.apiVersion", "3");  // Presently Privet v3.
-  CHECK(device_->SetStateProperties(kDeviceComponent, state, nullptr));
+  std::unique_ptr<base::DictionaryValue> state{new base::DictionaryValue};
+  state->SetString("device.firmwareVersion", settings.firmware_version);
+  state->SetString("device.hardwareId", settings.device_id);
+  state->SetString("device.serialNumber", settings.serial_number);
+  state->SetString("privet.apiVersion", "3");  // Presently Privet v3.
+  CHECK(device_->SetStateProperties(kDeviceComponent, std::move(state),
+                                    nullptr));
 
   device_->AddCommandHandler(
       kDeviceComponent, "device.setConfig",
@@ -155,15 +156,15 @@ void BaseApiHandler::PrivetSetConfig(const std::weak_ptr<Command>& cmd) {
 }
 
 void BaseApiHandler::OnConfigChanged(const Settings& settings) {
-  base::DictionaryValue state;
-  state.SetString("privet.maxRoleForAnonymousAccess",
-                  EnumToString(settings.local_anonymous_access_role));
-  state.SetBoolean("privet.isLocalAccessEnabled",
-                   settings.local_access_enabled);
-  state.SetString("device.name", settings.name);
-  state.SetString("device.location", settings.location);
-  state.SetString("device.description", settings.description);
-  device_->SetStateProperties(kDeviceComponent, state, nullptr);
+  std::unique_ptr<base::DictionaryValue> state{new base::DictionaryValue};
+  state->SetString("privet.maxRoleForAnonymousAccess",
+                   EnumToString(settings.local_anonymous_access_role));
+  state->SetBoolean("privet.isLocalAccessEnabled",
+                    settings.local_access_enabled);
+  state->SetString("device.name", settings.name);
+  state->SetString("device.location", settings.location);
+  state->SetString("device.description", settings.description);
+  device_->SetStateProperties(kDeviceComponent, std::move(state), nullptr);
 }
 
 void BaseApiHandler::DeviceSetConfig(const std::weak_ptr<Command>& cmd) {
@@ -36,8 +36,11 @@ class BaseApiHandlerTest : public ::testing::Test {
           EXPECT_TRUE(component_manager_.LoadTraits(json, nullptr));
         }));
     EXPECT_CALL(device_, SetStateProperties(_, _, _))
-        .WillRepeatedly(
-            Invoke(&component_manager_, &ComponentManager::SetStateProperties));
+        .WillRepeatedly(Invoke([this](const std::string& component,
+                                      const base::DictionaryValue& dict,
+                                      ErrorPtr* error) {
+          return component_manager_.SetStateProperties(component, dict, error);
+        }));
     EXPECT_CALL(device_, SetStateProperty(_, _, _, _))
         .WillRepeatedly(
             Invoke(&component_manager_, &ComponentManager::SetStateProperty));
@@ -4,6 +4,9 @@
 
 #include "src/commands/cloud_command_proxy.h"
 
+#include <algorithm>
+#include <iterator>
+
 #include <base/bind.h>
 #include <weave/enum_to_string.h>
 #include <weave/provider/task_runner.h>
@@ -14,51 +17,112 @@
 
 namespace weave {
 
+namespace {
+
+// Command patch members which only matter to the server with their latest
+// value.
+const char* const kSupersededMembers[] = {
+    commands::attributes::kCommand_Progress,
+    commands::attributes::kCommand_Results,
+};
+
+// Maximum number of updates of a command waiting for the server, besides the
+// one in flight. The older ones are merged beyond that.
+const size_t kMaxQueuedUpdates = 8;
+
+// Adds members of |patch| to |target|. Each member holds the whole value of a
+// command field, so a newer one replaces the older one instead of being merged
+// into it.
+void MergePatch(const base::DictionaryValue& patch,
+                base::DictionaryValue* target) {
+  for (base::DictionaryValue::Iterator it(patch); !it.IsAtEnd(); it.Advance())
+    target->SetWithoutPathExpansion(it.key(), it.value().CreateDeepCopy());
+}
+
+}  // namespace
+
 CloudCommandProxy::CloudCommandProxy(
     CommandInstance* command_instance,
     CloudCommandUpdateInterface* cloud_command_updater,
     ComponentManager* component_manager,
-    std::unique_ptr<BackoffEntry> backoff_entry,
-    provider::TaskRunner* task_runner)
+    std::shared_ptr<BackoffEntry> backoff_entry,
+    provider::TaskRunner* task_runner,
+    std::shared_ptr<ProxySet> proxies)
     : command_instance_{command_instance},
       cloud_command_updater_{cloud_command_updater},
       component_manager_{component_manager},
       task_runner_{task_runner},
-      cloud_backoff_entry_{std::move(backoff_entry)} {
+      cloud_backoff_entry_{std::move(backoff_entry)},
+      proxies_{std::move(proxies)} {
   callback_token_ = component_manager_->AddServerStateUpdatedCallback(
       base::Bind(&CloudCommandProxy::OnDeviceStateUpdated,
                  weak_ptr_factory_.GetWeakPtr()));
   observer_.Add(command_instance);
+  if (proxies_)
+    proxies_->insert(this);
+}
+
+CloudCommandProxy::~CloudCommandProxy() {
+  if (proxies_)
+    proxies_->erase(this);
 }
 
-void CloudCommandProxy::OnErrorChanged() {
+MemoryUsage CloudCommandProxy::GetMemoryUsage() const {
+  MemoryUsage usage;
+  usage.count = update_queue_.size();
+  usage.bytes = sizeof(*this);
+  for (const auto& entry : update_queue_)
+    usage.bytes += sizeof(entry) + EstimateMemoryUsage(*entry.second);
+  return usage;
+}
+
+void CloudCommandProxy::Compact() {
+  ShrinkToFit(&update_queue_);
+}
+
+void CloudCommandProxy::OnErrorChanged(const Error* error) {
+  QueueProgressUpdate();
   std::unique_ptr<base::DictionaryValue> patch{new base::DictionaryValue};
   patch->Set(commands::attributes::kCommand_Error,
-             command_instance_->GetError()
-                 ? ErrorInfoToJson(*command_instance_->GetError())
-                 : base::Value::CreateNullValue());
+             error ? ErrorInfoToJson(*error) : base::Value::CreateNullValue());
   QueueCommandUpdate(std::move(patch));
 }
 
-void CloudCommandProxy::OnResultsChanged() {
+void CloudCommandProxy::OnResultsChanged(const base::DictionaryValue& results) {
+  QueueProgressUpdate();
   std::unique_ptr<base::DictionaryValue> patch{new base::DictionaryValue};
-  patch->Set(commands::attributes::kCommand_Results,
-             command_instance_->GetResults().CreateDeepCopy());
+  patch->Set(commands::attributes::kCommand_Results, results.CreateDeepCopy());
   QueueCommandUpdate(std::move(patch));
 }
 
-void CloudCommandProxy::OnStateChanged() {
+void CloudCommandProxy::OnStateChanged(Command::State state) {
+  QueueProgressUpdate();
   std::unique_ptr<base::DictionaryValue> patch{new base::DictionaryValue};
-  patch->SetString(commands::attributes::kCommand_State,
-                   EnumToString(command_instance_->GetState()));
+  patch->SetString(commands::attributes::kCommand_State, EnumToString(state));
   QueueCommandUpdate(std::move(patch));
 }
 
-void CloudCommandProxy::OnProgressChanged() {
+void CloudCommandProxy::OnProgressChanged(
+    const base::DictionaryValue& progress) {
+  // The latest progress may depend on the latest device state.
+  progress_update_id_ = component_manager_->GetLastStateChangeId();
+  if (progress_update_pending_)
+    return;
+  progress_update_pending_ = true;
+  task_runner_->PostDelayedTask(
+      FROM_HERE, base::Bind(&CloudCommandProxy::QueueProgressUpdate,
+                            weak_ptr_factory_.GetWeakPtr()),
+      {});
+}
+
+void CloudCommandProxy::QueueProgressUpdate() {
+  if (!progress_update_pending_)
+    return;
+  progress_update_pending_ = false;
   std::unique_ptr<base::DictionaryValue> patch{new base::DictionaryValue};
   patch->Set(commands::attributes::kCommand_Progress,
              command_instance_->GetProgress().CreateDeepCopy());
-  QueueCommandUpdate(std::move(patch));
+  QueueCommandUpdate(std::move(patch), progress_update_id_);
 }
 
 void CloudCommandProxy::OnCommandDestroyed() {
@@ -67,7 +131,30 @@ void CloudCommandProxy::OnCommandDestroyed() {
 
 void CloudCommandProxy::QueueCommandUpdate(
     std::unique_ptr<base::DictionaryValue> patch) {
-  ComponentManager::UpdateID id = component_manager_->GetLastStateChangeId();
+  QueueCommandUpdate(std::move(patch),
+                     component_manager_->GetLastStateChangeId());
+}
+
+void CloudCommandProxy::QueueCommandUpdate(
+    std::unique_ptr<base::DictionaryValue> patch,
+    ComponentManager::UpdateID id) {
+  // Drop the older progress and results from the updates which are not sent
+  // yet, the server needs only the latest values. State and error transitions
+  // are kept, so the server still sees each of them.
+  auto pending = update_queue_.begin();
+  if (command_update_in_progress_ && pending != update_queue_.end())
+    ++pending;
+  while (pending != update_queue_.end()) {
+    for (const char* member : kSupersededMembers) {
+      if (patch->HasKey(member))
+        pending->second->RemoveWithoutPathExpansion(member, nullptr);
+    }
+    if (pending->second->empty())
+      pending = update_queue_.erase(pending);
+    else
+      ++pending;
+  }
+
   if (update_queue_.empty() || update_queue_.back().first != id) {
     // If queue is currently empty or the device state has changed since the
     // last patch request queued, add a new request to the queue.
@@ -82,9 +169,20 @@ void CloudCommandProxy::QueueCommandUpdate(
       update_queue_.push_back(std::make_pair(id, std::move(patch)));
     } else {
       // Coalesce the patches.
-      update_queue_.back().second->MergeDictionary(patch.get());
+      MergePatch(*patch, update_queue_.back().second.get());
     }
   }
+  // While the server can't be reached the device state keeps changing, so
+  // bound the memory by merging the two oldest updates not in flight. The
+  // merged update waits for the newer device state of the two.
+  size_t first = command_update_in_progress_ ? 1 : 0;
+  while (update_queue_.size() > first + kMaxQueuedUpdates) {
+    auto oldest = update_queue_.begin() + first;
+    auto next = std::next(oldest);
+    oldest->first = next->first;
+    MergePatch(*next->second, oldest->second.get());
+    update_queue_.erase(next);
+  }
   // Send out an update request to the server, if needed.
 
   // Post to accumulate more changes during the current message loop task run.
@@ -95,8 +193,12 @@ void CloudCommandProxy::QueueCommandUpdate(
 }
 
 void CloudCommandProxy::SendCommandUpdate() {
-  if (command_update_in_progress_ || update_queue_.empty())
+  // The progress waiting for the end of the tick goes with the other changes.
+  QueueProgressUpdate();
+  if (command_update_in_progress_ || blob_upload_in_progress_ ||
+      update_queue_.empty()) {
     return;
+  }
 
   // Check if we have any pending updates ready to be sent to the server.
   // We can only send updates for which the device state at the time the
@@ -120,6 +222,16 @@ void CloudCommandProxy::SendCommandUpdate() {
     return;
   }
 
+  const auto& blobs = command_instance_->GetBlobs();
+  if (blobs_uploaded_ < blobs.size()) {
+    blob_upload_in_progress_ = true;
+    cloud_command_updater_->UploadCommandBlob(
+        command_instance_->GetID(), blobs[blobs_uploaded_],
+        base::Bind(&CloudCommandProxy::OnUploadBlobDone,
+                   weak_ptr_factory_.GetWeakPtr()));
+    return;
+  }
+
   // Coalesce any pending updates that were queued prior to the current device
   // state known to be propagated to the server successfully.
   auto iter = update_queue_.begin();
@@ -128,7 +240,7 @@ void CloudCommandProxy::SendCommandUpdate() {
     if (iter->first > last_state_update_id_)
       break;
     update_queue_.front().first = iter->first;
-    update_queue_.front().second->MergeDictionary(iter->second.get());
+    MergePatch(*iter->second, update_queue_.front().second.get());
     ++iter;
   }
   // Remove all the intermediate items that have been merged into the first
@@ -158,9 +270,26 @@ void CloudCommandProxy::OnUpdateCommandDone(ErrorPtr error) {
   SendCommandUpdate();
 }
 
+void CloudCommandProxy::OnUploadBlobDone(ErrorPtr error) {
+  blob_upload_in_progress_ = false;
+  cloud_backoff_entry_->InformOfRequest(!error);
+  if (error) {
+    // Network and server errors are retried by the cloud requests, so the
+    // server rejected the blob, e.g. it doesn't accept blobs at all. Retrying
+    // it would hold back the updates of the command forever.
+    LOG(WARNING) << "Dropping blob "
+                 << command_instance_->GetBlobs()[blobs_uploaded_].id
+                 << " of command " << command_instance_->GetID() << ": "
+                 << error->GetMessage();
+  }
+  ++blobs_uploaded_;
+  SendCommandUpdate();
+}
+
 void CloudCommandProxy::OnDeviceStateUpdated(
     ComponentManager::UpdateID update_id) {
-  last_state_update_id_ = update_id;
+  // Never move back if the notifications arrive out of order.
+  last_state_update_id_ = std::max(last_state_update_id_, update_id);
   // Try to send out any queued command updates that could be performed after
   // a device state is updated.
   SendCommandUpdate();
@@ -7,6 +7,7 @@
 
 #include <deque>
 #include <memory>
+#include <set>
 #include <string>
 #include <utility>
 
@@ -19,6 +20,8 @@
 #include "src/commands/cloud_command_update_interface.h"
 #include "src/commands/command_instance.h"
 #include "src/component_manager.h"
+#include "src/memory_usage.h"
+#include "src/object_pool.h"
 
 namespace weave {
 
@@ -29,21 +32,34 @@ class TaskRunner;
 }
 
 // Command proxy which publishes command updates to the cloud.
-class CloudCommandProxy : public CommandInstance::Observer {
+class CloudCommandProxy : public CommandInstance::Observer,
+                          public PoolAllocated<CloudCommandProxy> {
  public:
+  // Live proxies, for accounting their memory. Shared with the proxies, which
+  // may outlive the object creating them.
+  using ProxySet = std::set<CloudCommandProxy*>;
+
+  // The proxy adds itself to |proxies|, if not null, until destroyed.
   CloudCommandProxy(CommandInstance* command_instance,
                     CloudCommandUpdateInterface* cloud_command_updater,
                     ComponentManager* component_manager,
-                    std::unique_ptr<BackoffEntry> backoff_entry,
-                    provider::TaskRunner* task_runner);
-  ~CloudCommandProxy() override = default;
+                    std::shared_ptr<BackoffEntry> backoff_entry,
+                    provider::TaskRunner* task_runner,
+                    std::shared_ptr<ProxySet> proxies = nullptr);
+  ~CloudCommandProxy() override;
+
+  // Returns the number of command updates not sent yet and their approximate
+  // memory usage.
+  MemoryUsage GetMemoryUsage() const;
+  // Releases the spare capacity of the update queue.
+  void Compact();
 
   // CommandProxyInterface implementation/overloads.
   void OnCommandDestroyed() override;
-  void OnErrorChanged() override;
-  void OnProgressChanged() override;
-  void OnResultsChanged() override;
-  void OnStateChanged() override;
+  void OnErrorChanged(const Error* error) override;
+  void OnProgressChanged(const base::DictionaryValue& progress) override;
+  void OnResultsChanged(const base::DictionaryValue& results) override;
+  void OnStateChanged(Command::State state) override;
 
  private:
   using UpdateQueueEntry = std::pair<ComponentManager::UpdateID,
@@ -51,8 +67,14 @@ class CloudCommandProxy : public CommandInstance::Observer {
   // Puts a command update data into the update queue, and optionally sends an
   // asynchronous request to GCD server to update the command resource, if there
   // are no pending device status updates.
+  void QueueCommandUpdate(std::unique_ptr<base::DictionaryValue> patch,
+                          ComponentManager::UpdateID id);
   void QueueCommandUpdate(std::unique_ptr<base::DictionaryValue> patch);
 
+  // Queues the progress changed since the last one queued, if any. Called
+  // before the other changes are queued or sent, so they stay in order.
+  void QueueProgressUpdate();
+
   // Sends an asynchronous request to GCD server to update the command resource,
   // if there are no pending device status updates.
   void SendCommandUpdate();
@@ -62,6 +84,7 @@ class CloudCommandProxy : public CommandInstance::Observer {
 
   // Callback invoked by the asynchronous PATCH request to the server.
   void OnUpdateCommandDone(ErrorPtr error);
+  void OnUploadBlobDone(ErrorPtr error);
 
   // Callback invoked by the device state change queue to notify of the
   // successful device state update. |update_id| is the ID of the state that
@@ -73,11 +96,23 @@ class CloudCommandProxy : public CommandInstance::Observer {
   ComponentManager* component_manager_;
   provider::TaskRunner* task_runner_{nullptr};
 
-  // Backoff for SendCommandUpdate() method.
-  std::unique_ptr<BackoffEntry> cloud_backoff_entry_;
+  // Backoff for SendCommandUpdate() method. It may be shared with the proxies
+  // of other commands.
+  std::shared_ptr<BackoffEntry> cloud_backoff_entry_;
+  std::shared_ptr<ProxySet> proxies_;
 
   // Set to true while a pending PATCH request is in flight to the server.
   bool command_update_in_progress_{false};
+  // Set while a blob of the command is uploaded. Blobs are uploaded in order,
+  // before the updates, which may refer to them.
+  bool blob_upload_in_progress_{false};
+  // The blobs uploaded or dropped after the server rejected them.
+  size_t blobs_uploaded_{0};
+  // Set while a progress change waits for the end of the task runner tick, so
+  // consecutive changes of the progress are copied once. |progress_update_id_|
+  // is the device state at the last of them.
+  bool progress_update_pending_{false};
+  ComponentManager::UpdateID progress_update_id_{0};
   // Update queue with all the command update requests ready to be sent to
   // the server.
   std::deque<UpdateQueueEntry> update_queue_;
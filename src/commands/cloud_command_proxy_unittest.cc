@@ -43,6 +43,10 @@ class MockCloudCommandUpdateInterface : public CloudCommandUpdateInterface {
                void(const std::string&,
                     const base::DictionaryValue&,
                     const DoneCallback&));
+  MOCK_METHOD3(UploadCommandBlob,
+               void(const std::string&,
+                    const CommandInstance::Blob&,
+                    const DoneCallback&));
 };
 
 // Test back-off entry that uses the test clock.
@@ -162,6 +166,55 @@ TEST_F(CloudCommandProxyTest, ImmediateUpdate) {
   task_runner_.RunOnce();
 }
 
+TEST_F(CloudCommandProxyTest, BlobUploadedBeforeResults) {
+  auto data = std::make_shared<const std::vector<uint8_t>>(1000, 7);
+  std::string blob_id = command_instance_->AttachBlob("image/jpeg", data);
+
+  DoneCallback upload_callback;
+  EXPECT_CALL(cloud_updater_, UploadCommandBlob(kCmdID, _, _))
+      .WillOnce(Invoke([&upload_callback, &data](
+          const std::string&, const CommandInstance::Blob& blob,
+          const DoneCallback& callback) {
+        EXPECT_EQ("image/jpeg", blob.content_type);
+        // The data is shared, not copied.
+        EXPECT_EQ(data, blob.data);
+        upload_callback = callback;
+      }));
+  base::DictionaryValue results;
+  results.SetString("thumbnail", blob_id);
+  command_instance_->Complete(results, nullptr);
+  task_runner_.RunOnce();
+
+  const std::string expected =
+      R"({"state": "done", "results": {"thumbnail": ")" + blob_id + R"("}})";
+  EXPECT_CALL(cloud_updater_,
+              UpdateCommand(kCmdID, MatchJson(expected.c_str()), _));
+  upload_callback.Run(nullptr);
+}
+
+TEST_F(CloudCommandProxyTest, RejectedBlobDropped) {
+  auto data = std::make_shared<const std::vector<uint8_t>>(1000, 7);
+  std::string blob_id = command_instance_->AttachBlob("image/jpeg", data);
+
+  DoneCallback upload_callback;
+  EXPECT_CALL(cloud_updater_, UploadCommandBlob(kCmdID, _, _))
+      .WillOnce(SaveArg<2>(&upload_callback));
+  base::DictionaryValue results;
+  results.SetString("thumbnail", blob_id);
+  command_instance_->Complete(results, nullptr);
+  task_runner_.RunOnce();
+
+  // The upload isn't retried, the results are sent after the back-off.
+  const std::string expected =
+      R"({"state": "done", "results": {"thumbnail": ")" + blob_id + R"("}})";
+  EXPECT_CALL(cloud_updater_,
+              UpdateCommand(kCmdID, MatchJson(expected.c_str()), _));
+  ErrorPtr error;
+  Error::AddTo(&error, FROM_HERE, "notFound", "No such resource");
+  upload_callback.Run(std::move(error));
+  task_runner_.Run();
+}
+
 TEST_F(CloudCommandProxyTest, DelayedUpdate) {
   // Simulate that the current device state has changed.
   current_state_update_id_ = 20;
@@ -175,6 +228,17 @@ TEST_F(CloudCommandProxyTest, DelayedUpdate) {
   callbacks_.Notify(20);
 }
 
+TEST_F(CloudCommandProxyTest, OutOfOrderStateUpdates) {
+  current_state_update_id_ = 20;
+  callbacks_.Notify(20);
+  // An older reply arriving late doesn't hold back the command updates.
+  callbacks_.Notify(19);
+  const char expected[] = "{'state':'done'}";
+  EXPECT_CALL(cloud_updater_, UpdateCommand(kCmdID, MatchJson(expected), _));
+  command_instance_->Complete({}, nullptr);
+  task_runner_.RunOnce();
+}
+
 TEST_F(CloudCommandProxyTest, InFlightRequest) {
   // SetProgress causes two consecutive updates:
   //    state=inProgress
@@ -254,12 +318,10 @@ TEST_F(CloudCommandProxyTest, GateOnStateUpdates) {
   current_state_update_id_ = 22;
   command_instance_->Complete({}, nullptr);
 
-  // Device state #20 updated.
+  // Device state #20 updated. The progress of that time is superseded and
+  // isn't sent.
   DoneCallback callback;
-  const char expect1[] = R"({
-    'progress': {'status':'ready'},
-    'state':'inProgress'
-  })";
+  const char expect1[] = "{'state':'inProgress'}";
   EXPECT_CALL(cloud_updater_, UpdateCommand(kCmdID, MatchJson(expect1), _))
       .WillOnce(SaveArg<2>(&callback));
   callbacks_.Notify(20);
@@ -351,6 +413,98 @@ TEST_F(CloudCommandProxyTest, CoalesceUpdates) {
   callbacks_.Notify(30);
 }
 
+TEST_F(CloudCommandProxyTest, ReplaceProgress) {
+  current_state_update_id_ = 20;
+  EXPECT_TRUE(command_instance_->SetProgress(
+      *CreateDictionaryValue("{'status': 'ready', 'percent': 0}"), nullptr));
+  EXPECT_TRUE(command_instance_->SetProgress(
+      *CreateDictionaryValue("{'status': 'busy'}"), nullptr));
+
+  const char expected[] = R"({
+    'progress': {'status':'busy'},
+    'state':'inProgress'
+  })";
+  EXPECT_CALL(cloud_updater_, UpdateCommand(kCmdID, MatchJson(expected), _));
+  callbacks_.Notify(20);
+}
+
+TEST_F(CloudCommandProxyTest, ProgressCoalescedPerTick) {
+  DoneCallback callback;
+  const char expect1[] =
+      "{'state':'inProgress', 'progress': {'status': '99'}}";
+  EXPECT_CALL(cloud_updater_, UpdateCommand(kCmdID, MatchJson(expect1), _))
+      .WillOnce(SaveArg<2>(&callback));
+  // The progress set within the same task runner tick is queued once, when
+  // the tick ends.
+  for (int i = 0; i < 100; i++) {
+    EXPECT_TRUE(command_instance_->SetProgress(
+        *CreateDictionaryValue("{'status': '" + std::to_string(i) + "'}"),
+        nullptr));
+  }
+  task_runner_.RunOnce();
+
+  EXPECT_TRUE(command_instance_->SetProgress(
+      *CreateDictionaryValue("{'status': 'busy'}"), nullptr));
+  const char expect2[] = "{'progress': {'status': 'busy'}}";
+  EXPECT_CALL(cloud_updater_, UpdateCommand(kCmdID, MatchJson(expect2), _))
+      .WillOnce(SaveArg<2>(&callback));
+  callback.Run(nullptr);
+}
+
+TEST_F(CloudCommandProxyTest, KeepLatestProgressWhileInFlight) {
+  DoneCallback callback;
+  const char expect1[] =
+      "{'state':'inProgress', 'progress': {'status': 'ready'}}";
+  EXPECT_CALL(cloud_updater_, UpdateCommand(kCmdID, MatchJson(expect1), _))
+      .WillOnce(SaveArg<2>(&callback));
+  EXPECT_TRUE(command_instance_->SetProgress(
+      *CreateDictionaryValue("{'status': 'ready'}"), nullptr));
+  task_runner_.RunOnce();
+
+  // Progress updates for different device states pile up while the request
+  // is in flight, only the latest one is sent.
+  for (int i = 0; i < 10; i++) {
+    current_state_update_id_ = 20 + i;
+    EXPECT_TRUE(command_instance_->SetProgress(
+        *CreateDictionaryValue("{'status': '" + std::to_string(i) + "'}"),
+        nullptr));
+  }
+  current_state_update_id_ = 30;
+  EXPECT_TRUE(command_instance_->Complete({}, nullptr));
+  callbacks_.Notify(30);
+
+  const char expect2[] = "{'state':'done', 'progress': {'status': '9'}}";
+  EXPECT_CALL(cloud_updater_, UpdateCommand(kCmdID, MatchJson(expect2), _))
+      .WillOnce(SaveArg<2>(&callback));
+  callback.Run(nullptr);
+  task_runner_.RunOnce();
+}
+
+TEST_F(CloudCommandProxyTest, BoundedUpdateQueue) {
+  for (int i = 1; i <= 20; i++) {
+    current_state_update_id_ = i;
+    ErrorPtr error;
+    Error::AddTo(&error, FROM_HERE, "busy", std::to_string(i));
+    EXPECT_TRUE(command_instance_->SetError(error.get(), nullptr));
+  }
+
+  // The updates of the states #1-#13 were merged to keep 8 updates, so none
+  // is sent until the state #13 is updated.
+  callbacks_.Notify(1);
+  std::string message;
+  DoneCallback callback;
+  EXPECT_CALL(cloud_updater_, UpdateCommand(kCmdID, _, _))
+      .WillOnce(DoAll(Invoke([&message](const std::string& id,
+                                        const base::DictionaryValue& patch,
+                                        const DoneCallback& callback) {
+                        EXPECT_TRUE(patch.GetString("error.message", &message));
+                        EXPECT_TRUE(patch.HasKey("state"));
+                      }),
+                      SaveArg<2>(&callback)));
+  callbacks_.Notify(13);
+  EXPECT_EQ("13", message);
+}
+
 TEST_F(CloudCommandProxyTest, EmptyStateChangeQueue) {
   // Assume the device state update queue was empty and was at update ID 20.
   current_state_update_id_ = 20;
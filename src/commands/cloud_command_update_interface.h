@@ -10,6 +10,8 @@
 #include <base/callback_forward.h>
 #include <base/values.h>
 
+#include "src/commands/command_instance.h"
+
 namespace weave {
 
 // An abstract interface to allow for sending command update requests to the
@@ -19,6 +21,11 @@ class CloudCommandUpdateInterface {
   virtual void UpdateCommand(const std::string& command_id,
                              const base::DictionaryValue& command_patch,
                              const DoneCallback& callback) = 0;
+  // Uploads the binary data attached to a command. The request body is read
+  // from |blob| as is, without copying it into the JSON of an update.
+  virtual void UploadCommandBlob(const std::string& command_id,
+                                 const CommandInstance::Blob& blob,
+                                 const DoneCallback& callback) = 0;
 
  protected:
   virtual ~CloudCommandUpdateInterface() {}
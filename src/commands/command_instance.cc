@@ -4,6 +4,7 @@
 
 #include "src/commands/command_instance.h"
 
+#include <base/strings/string_number_conversions.h>
 #include <base/values.h>
 #include <weave/enum_to_string.h>
 #include <weave/error.h>
@@ -12,6 +13,7 @@
 #include "src/commands/command_queue.h"
 #include "src/commands/schema_constants.h"
 #include "src/json_error_codes.h"
+#include "src/memory_usage.h"
 #include "src/utils.h"
 
 namespace weave {
@@ -56,7 +58,7 @@ LIBWEAVE_EXPORT EnumToStringMap<Command::Origin>::EnumToStringMap()
 CommandInstance::CommandInstance(const std::string& name,
                                  Command::Origin origin,
                                  const base::DictionaryValue& parameters)
-    : name_{name}, origin_{origin} {
+    : name_{StringAtom{name}}, origin_{origin} {
   parameters_.MergeDictionary(&parameters);
 }
 
@@ -65,15 +67,15 @@ CommandInstance::~CommandInstance() {
 }
 
 const std::string& CommandInstance::GetID() const {
-  return id_;
+  return id_.str();
 }
 
 const std::string& CommandInstance::GetName() const {
-  return name_;
+  return name_.str();
 }
 
 const std::string& CommandInstance::GetComponent() const {
-  return component_;
+  return component_.str();
 }
 
 Command::State CommandInstance::GetState() const {
@@ -109,18 +111,30 @@ bool CommandInstance::SetProgress(const base::DictionaryValue& progress,
   if (!progress_.Equals(&progress)) {
     progress_.Clear();
     progress_.MergeDictionary(&progress);
-    FOR_EACH_OBSERVER(Observer, observers_, OnProgressChanged());
+    json_dirty_fields_ |= kJsonProgress;
+    FOR_EACH_OBSERVER(Observer, observers_, OnProgressChanged(progress_));
   }
 
   return true;
 }
 
+std::string CommandInstance::AttachBlob(
+    const std::string& content_type,
+    std::shared_ptr<const std::vector<uint8_t>> data) {
+  CHECK(data);
+  Blob blob{"blob" + std::to_string(blobs_.size()), content_type,
+            std::move(data)};
+  blobs_.push_back(std::move(blob));
+  return blobs_.back().id;
+}
+
 bool CommandInstance::Complete(const base::DictionaryValue& results,
                                ErrorPtr* error) {
   if (!results_.Equals(&results)) {
     results_.Clear();
     results_.MergeDictionary(&results);
-    FOR_EACH_OBSERVER(Observer, observers_, OnResultsChanged());
+    json_dirty_fields_ |= kJsonResults;
+    FOR_EACH_OBSERVER(Observer, observers_, OnResultsChanged(results_));
   }
   // Change status even if result is unchanged.
   bool result = SetStatus(State::kDone, error);
@@ -131,7 +145,8 @@ bool CommandInstance::Complete(const base::DictionaryValue& results,
 
 bool CommandInstance::SetError(const Error* command_error, ErrorPtr* error) {
   error_ = command_error ? command_error->Clone() : nullptr;
-  FOR_EACH_OBSERVER(Observer, observers_, OnErrorChanged());
+  json_dirty_fields_ |= kJsonError;
+  FOR_EACH_OBSERVER(Observer, observers_, OnErrorChanged(error_.get()));
   return SetStatus(State::kError, error);
 }
 
@@ -142,26 +157,22 @@ namespace {
 // On success, returns |true| and the validated parameters and values through
 // |parameters|. Otherwise returns |false| and additional error information in
 // |error|.
-std::unique_ptr<base::DictionaryValue> GetCommandParameters(
-    const base::DictionaryValue* json,
-    ErrorPtr* error) {
-  // Get the command parameters from 'parameters' property.
-  std::unique_ptr<base::DictionaryValue> params;
+// Sets |params| to the 'parameters' property of |json|, or to null if it's
+// not specified. They are copied only once, by the CommandInstance.
+bool GetCommandParameters(const base::DictionaryValue* json,
+                          const base::DictionaryValue** params,
+                          ErrorPtr* error) {
+  *params = nullptr;
   const base::Value* params_value = nullptr;
-  if (json->Get(commands::attributes::kCommand_Parameters, &params_value)) {
-    // Make sure the "parameters" property is actually an object.
-    const base::DictionaryValue* params_dict = nullptr;
-    if (!params_value->GetAsDictionary(&params_dict)) {
-      return Error::AddToPrintf(error, FROM_HERE, errors::json::kObjectExpected,
-                                "Property '%s' must be a JSON object",
-                                commands::attributes::kCommand_Parameters);
-    }
-    params = params_dict->CreateDeepCopy();
-  } else {
-    // "parameters" are not specified. Assume empty param list.
-    params.reset(new base::DictionaryValue);
+  if (!json->Get(commands::attributes::kCommand_Parameters, &params_value))
+    return true;
+  // Make sure the "parameters" property is actually an object.
+  if (!params_value->GetAsDictionary(params)) {
+    return Error::AddToPrintf(error, FROM_HERE, errors::json::kObjectExpected,
+                              "Property '%s' must be a JSON object",
+                              commands::attributes::kCommand_Parameters);
   }
-  return params;
+  return true;
 }
 
 }  // anonymous namespace
@@ -195,14 +206,17 @@ std::unique_ptr<CommandInstance> CommandInstance::FromJson(
                         "Command name is missing");
   }
 
-  auto parameters = GetCommandParameters(json, error);
-  if (!parameters) {
+  const base::DictionaryValue* parameters = nullptr;
+  if (!GetCommandParameters(json, &parameters, error)) {
     return Error::AddToPrintf(
         error, FROM_HERE, errors::commands::kCommandFailed,
         "Failed to validate command '%s'", command_name.c_str());
   }
 
-  instance.reset(new CommandInstance{command_name, origin, *parameters});
+  // "parameters" are not specified. Assume empty param list.
+  const base::DictionaryValue no_parameters;
+  instance.reset(new CommandInstance{
+      command_name, origin, parameters ? *parameters : no_parameters});
 
   if (!command_id->empty())
     instance->SetID(*command_id);
@@ -212,25 +226,67 @@ std::unique_ptr<CommandInstance> CommandInstance::FromJson(
   if (json->GetString(commands::attributes::kCommand_Component, &component))
     instance->SetComponent(component);
 
+  GetDeadlineFromJson(*json, &instance->deadline_);
+
   return instance;
 }
 
+bool CommandInstance::GetDeadlineFromJson(const base::DictionaryValue& json,
+                                          base::Time* deadline) {
+  // The cloud sends 64-bit times as strings.
+  std::string time_str;
+  int64_t time_ms = 0;
+  if (!json.GetString(commands::attributes::kCommand_ExpirationTimeMs,
+                      &time_str) ||
+      !base::StringToInt64(time_str, &time_ms) || time_ms <= 0) {
+    return false;
+  }
+  *deadline = base::Time::UnixEpoch() +
+              base::TimeDelta::FromMilliseconds(time_ms);
+  return true;
+}
+
 std::unique_ptr<base::DictionaryValue> CommandInstance::ToJson() const {
-  std::unique_ptr<base::DictionaryValue> json{new base::DictionaryValue};
-
-  json->SetString(commands::attributes::kCommand_Id, id_);
-  json->SetString(commands::attributes::kCommand_Name, name_);
-  json->SetString(commands::attributes::kCommand_Component, component_);
-  json->Set(commands::attributes::kCommand_Parameters,
-            parameters_.CreateDeepCopy());
-  json->Set(commands::attributes::kCommand_Progress,
-            progress_.CreateDeepCopy());
-  json->Set(commands::attributes::kCommand_Results, results_.CreateDeepCopy());
-  json->SetString(commands::attributes::kCommand_State, EnumToString(state_));
-  if (error_)
-    json->Set(commands::attributes::kCommand_Error, ErrorInfoToJson(*error_));
-
-  return json;
+  return GetJson().CreateDeepCopy();
+}
+
+const base::DictionaryValue& CommandInstance::GetJson() const {
+  if (!json_) {
+    // The name and the parameters never change.
+    json_.reset(new base::DictionaryValue);
+    json_->SetString(commands::attributes::kCommand_Name, name_.str());
+    json_->Set(commands::attributes::kCommand_Parameters,
+               parameters_.CreateDeepCopy());
+    json_dirty_fields_ = kJsonId | kJsonComponent | kJsonProgress |
+                         kJsonResults | kJsonState | kJsonError;
+  }
+  if (json_dirty_fields_ & kJsonId)
+    json_->SetString(commands::attributes::kCommand_Id, id_.str());
+  if (json_dirty_fields_ & kJsonComponent)
+    json_->SetString(commands::attributes::kCommand_Component,
+                     component_.str());
+  if (json_dirty_fields_ & kJsonProgress) {
+    json_->Set(commands::attributes::kCommand_Progress,
+               progress_.CreateDeepCopy());
+  }
+  if (json_dirty_fields_ & kJsonResults) {
+    json_->Set(commands::attributes::kCommand_Results,
+               results_.CreateDeepCopy());
+  }
+  if (json_dirty_fields_ & kJsonState) {
+    json_->SetString(commands::attributes::kCommand_State,
+                     EnumToString(state_));
+  }
+  if (json_dirty_fields_ & kJsonError) {
+    if (error_) {
+      json_->Set(commands::attributes::kCommand_Error,
+                 ErrorInfoToJson(*error_));
+    } else {
+      json_->Remove(commands::attributes::kCommand_Error, nullptr);
+    }
+  }
+  json_dirty_fields_ = 0;
+  return *json_;
 }
 
 void CommandInstance::AddObserver(Observer* observer) {
@@ -247,7 +303,8 @@ bool CommandInstance::Pause(ErrorPtr* error) {
 
 bool CommandInstance::Abort(const Error* command_error, ErrorPtr* error) {
   error_ = command_error ? command_error->Clone() : nullptr;
-  FOR_EACH_OBSERVER(Observer, observers_, OnErrorChanged());
+  json_dirty_fields_ |= kJsonError;
+  FOR_EACH_OBSERVER(Observer, observers_, OnErrorChanged(error_.get()));
   bool result = SetStatus(State::kAborted, error);
   RemoveFromQueue();
   // The command will be destroyed after that, so do not access any members.
@@ -261,6 +318,13 @@ bool CommandInstance::Cancel(ErrorPtr* error) {
   return result;
 }
 
+bool CommandInstance::Expire(ErrorPtr* error) {
+  bool result = SetStatus(State::kExpired, error);
+  RemoveFromQueue();
+  // The command will be destroyed after that, so do not access any members.
+  return result;
+}
+
 bool CommandInstance::SetStatus(Command::State status, ErrorPtr* error) {
   if (status == state_)
     return true;
@@ -279,13 +343,29 @@ bool CommandInstance::SetStatus(Command::State status, ErrorPtr* error) {
       break;
   }
   state_ = status;
-  FOR_EACH_OBSERVER(Observer, observers_, OnStateChanged());
+  json_dirty_fields_ |= kJsonState;
+  FOR_EACH_OBSERVER(Observer, observers_, OnStateChanged(state_));
   return true;
 }
 
+size_t CommandInstance::GetMemoryUsage() const {
+  // The dictionaries are members, only their contents are on the heap.
+  // The ID and the names are counted once, in the atom table.
+  size_t usage = sizeof(*this) + EstimateMemoryUsage(parameters_) +
+                 EstimateMemoryUsage(progress_) +
+                 EstimateMemoryUsage(results_) -
+                 3 * sizeof(base::DictionaryValue) +
+                 (json_ ? EstimateMemoryUsage(*json_) : 0);
+  for (const auto& blob : blobs_) {
+    usage += sizeof(blob) + EstimateMemoryUsage(blob.id) +
+             EstimateMemoryUsage(blob.content_type) + blob.data->capacity();
+  }
+  return usage;
+}
+
 void CommandInstance::RemoveFromQueue() {
   if (queue_)
-    queue_->RemoveLater(GetID());
+    queue_->RemoveLater(id_);
 }
 
 }  // namespace weave
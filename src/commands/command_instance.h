@@ -12,9 +12,13 @@
 
 #include <base/macros.h>
 #include <base/observer_list.h>
+#include <base/time/time.h>
 #include <weave/command.h>
 #include <weave/error.h>
 
+#include "src/object_pool.h"
+#include "src/string_atom.h"
+
 namespace base {
 class Value;
 }  // namespace base
@@ -25,20 +29,30 @@ class CommandDictionary;
 class CommandObserver;
 class CommandQueue;
 
-class CommandInstance final : public Command {
+class CommandInstance final : public Command,
+                              public PoolAllocated<CommandInstance> {
  public:
+  // The changes are passed by reference to the fields of the command, valid
+  // until the next change.
   class Observer {
    public:
     virtual void OnCommandDestroyed() = 0;
-    virtual void OnErrorChanged() = 0;
-    virtual void OnProgressChanged() = 0;
-    virtual void OnResultsChanged() = 0;
-    virtual void OnStateChanged() = 0;
+    virtual void OnErrorChanged(const Error* error) = 0;
+    virtual void OnProgressChanged(const base::DictionaryValue& progress) = 0;
+    virtual void OnResultsChanged(const base::DictionaryValue& results) = 0;
+    virtual void OnStateChanged(Command::State state) = 0;
 
    protected:
     virtual ~Observer() {}
   };
 
+  // Data attached with AttachBlob().
+  struct Blob {
+    std::string id;
+    std::string content_type;
+    std::shared_ptr<const std::vector<uint8_t>> data;
+  };
+
   // Construct a command instance given the full command |name| which must
   // be in format "<package_name>.<command_name>" and a list of parameters and
   // their values specified in |parameters|.
@@ -59,12 +73,18 @@ class CommandInstance final : public Command {
   const Error* GetError() const override;
   bool SetProgress(const base::DictionaryValue& progress,
                    ErrorPtr* error) override;
+  std::string AttachBlob(
+      const std::string& content_type,
+      std::shared_ptr<const std::vector<uint8_t>> data) override;
   bool Complete(const base::DictionaryValue& results, ErrorPtr* error) override;
   bool Pause(ErrorPtr* error) override;
   bool SetError(const Error* command_error, ErrorPtr* error) override;
   bool Abort(const Error* command_error, ErrorPtr* error) override;
   bool Cancel(ErrorPtr* error) override;
 
+  // Sets the command expired and removes it from the queue, as Cancel() does.
+  bool Expire(ErrorPtr* error);
+
   // Parses a command instance JSON definition and constructs a CommandInstance
   // object.
   // On error, returns null unique_ptr and fills in error details in |error|.
@@ -77,12 +97,47 @@ class CommandInstance final : public Command {
                                                    std::string* command_id,
                                                    ErrorPtr* error);
 
+  // Reads the "expirationTimeMs" the cloud sets on commands into |deadline|.
+  // Returns false if there is none.
+  static bool GetDeadlineFromJson(const base::DictionaryValue& json,
+                                  base::Time* deadline);
+
   std::unique_ptr<base::DictionaryValue> ToJson() const;
 
+  // Returns the same JSON as ToJson(), without copying it. The JSON is kept
+  // from call to call, only the fields changed in between are updated.
+  const base::DictionaryValue& GetJson() const;
+
+  // Returns the blobs in the order they were attached.
+  const std::vector<Blob>& GetBlobs() const { return blobs_; }
+
+  // Returns the approximate heap memory held by the command instance.
+  size_t GetMemoryUsage() const;
+
+  // Returns the interned ID the command queue is keyed by.
+  const StringAtom& GetIDAtom() const { return id_; }
+
   // Sets the command ID (normally done by CommandQueue when the command
   // instance is added to it).
-  void SetID(const std::string& id) { id_ = id; }
-  void SetComponent(const std::string& component) { component_ = component; }
+  void SetID(const std::string& id) {
+    id_ = StringAtom{id};
+    json_dirty_fields_ |= kJsonId;
+  }
+  void SetComponent(const std::string& component) {
+    component_ = StringAtom{component};
+    json_dirty_fields_ |= kJsonComponent;
+  }
+
+  // The command is expired instead of being passed to its handler after
+  // |deadline|. Null if the command never expires.
+  base::Time GetDeadline() const { return deadline_; }
+  void SetDeadline(base::Time deadline) { deadline_ = deadline; }
+
+  // A newer superseding command of the same component and name cancels this
+  // one while it waits in the queue, as only the latest one matters, e.g.
+  // "brightness.set" sent while a slider is dragged.
+  bool IsSuperseding() const { return superseding_; }
+  void SetSuperseding(bool superseding) { superseding_ = superseding; }
 
   void AddObserver(Observer* observer);
   void RemoveObserver(Observer* observer);
@@ -92,6 +147,16 @@ class CommandInstance final : public Command {
   void DetachFromQueue() { queue_ = nullptr; }
 
  private:
+  // Fields of |json_| which need to be updated.
+  enum JsonField : uint8_t {
+    kJsonId = 1 << 0,
+    kJsonComponent = 1 << 1,
+    kJsonProgress = 1 << 2,
+    kJsonResults = 1 << 3,
+    kJsonState = 1 << 4,
+    kJsonError = 1 << 5,
+  };
+
   // Helper function to update the command status.
   // Used by Abort(), Cancel(), Done() methods.
   bool SetStatus(Command::State status, ErrorPtr* error);
@@ -100,12 +165,14 @@ class CommandInstance final : public Command {
   // object, removing a command from the queue will also destroy it.
   void RemoveFromQueue();
 
-  // Unique command ID within a command queue.
-  std::string id_;
-  // Full command name as "<trait_name>.<command_name>".
-  std::string name_;
+  // Unique command ID within a command queue. Interned, so that the queue
+  // hashes and compares it by pointer.
+  StringAtom id_;
+  // Full command name as "<trait_name>.<command_name>". The names and paths
+  // are shared by all the commands with them.
+  StringAtom name_;
   // Full path to the component this command is intended for.
-  std::string component_;
+  StringAtom component_;
   // The origin of the command, either "local" or "cloud".
   Command::Origin origin_ = Command::Origin::kLocal;
   // Command parameters and their values.
@@ -114,15 +181,25 @@ class CommandInstance final : public Command {
   base::DictionaryValue progress_;
   // Command results.
   base::DictionaryValue results_;
+  // Binary data the results refer to. Counted in the memory usage of the
+  // command, although the data may be shared with uploads in flight.
+  std::vector<Blob> blobs_;
   // Current command state.
   Command::State state_ = Command::State::kQueued;
   // Error encountered during execution of the command.
   ErrorPtr error_;
+  // See GetDeadline().
+  base::Time deadline_;
+  // See IsSuperseding().
+  bool superseding_{false};
   // Command observers.
   base::ObserverList<Observer> observers_;
   // Pointer to the command queue this command instance is added to.
   // The queue owns the command instance, so it outlives this object.
   CommandQueue* queue_ = nullptr;
+  // JSON returned by GetJson(), built on the first call.
+  mutable std::unique_ptr<base::DictionaryValue> json_;
+  mutable uint8_t json_dirty_fields_ = 0;
 
   DISALLOW_COPY_AND_ASSIGN(CommandInstance);
 };
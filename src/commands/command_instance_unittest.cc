@@ -164,4 +164,48 @@ TEST(CommandInstanceTest, ToJsonError) {
                *json, *converted);
 }
 
+TEST(CommandInstanceTest, GetJsonUpdated) {
+  auto instance = CommandInstance::FromJson(
+      CreateDictionaryValue("{'name': 'robot.jump', 'component': 'robot'}")
+          .get(),
+      Command::Origin::kLocal, nullptr, nullptr);
+  instance->SetID("1");
+  const base::DictionaryValue& json = instance->GetJson();
+  EXPECT_JSON_EQ(R"({
+    'id': '1',
+    'name': 'robot.jump',
+    'component': 'robot',
+    'parameters': {},
+    'progress': {},
+    'results': {},
+    'state': 'queued'
+  })",
+                 json);
+
+  // The same JSON is updated.
+  EXPECT_TRUE(instance->SetProgress(*CreateDictionaryValue("{'progress': 15}"),
+                                    nullptr));
+  EXPECT_EQ(&json, &instance->GetJson());
+  EXPECT_JSON_EQ(R"({
+    'id': '1',
+    'name': 'robot.jump',
+    'component': 'robot',
+    'parameters': {},
+    'progress': {'progress': 15},
+    'results': {},
+    'state': 'inProgress'
+  })",
+                 json);
+
+  ErrorPtr error;
+  Error::AddTo(&error, FROM_HERE, "CODE", "MESSAGE");
+  EXPECT_TRUE(instance->SetError(error.get(), nullptr));
+  const base::DictionaryValue* error_json = nullptr;
+  ASSERT_TRUE(instance->GetJson().GetDictionary("error", &error_json));
+  EXPECT_JSON_EQ("{'code': 'CODE', 'message': 'MESSAGE'}", *error_json);
+  EXPECT_TRUE(instance->SetError(nullptr, nullptr));
+  EXPECT_FALSE(instance->GetJson().HasKey("error"));
+  EXPECT_TRUE(json.Equals(instance->ToJson().get()));
+}
+
 }  // namespace weave
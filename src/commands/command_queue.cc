@@ -4,29 +4,52 @@
 
 #include "src/commands/command_queue.h"
 
+#include <algorithm>
+
 #include <base/bind.h>
 #include <base/time/time.h>
+#include <weave/enum_to_string.h>
 
 namespace weave {
 
 namespace {
 const int kRemoveCommandDelayMin = 5;
 
-std::string GetCommandHandlerKey(const std::string& component_path,
-                                 const std::string& command_name) {
-  return component_path + ":" + command_name;
+// Done commands only take memory, so their removal may wait for any wake-up.
+const double kCleanupTolerance = 1.0;
+
+// Number of local commands passed ahead of a waiting cloud command, so that a
+// stream of local commands doesn't starve the cloud ones.
+const size_t kMaxLocalStreak = 4;
+
+// Returns true and sets |trait| if |command_name| is "<trait>.*".
+bool ParseTraitWildcard(const std::string& command_name, std::string* trait) {
+  const size_t size = command_name.size();
+  if (size < 3 || command_name.compare(size - 2, 2, ".*") != 0)
+    return false;
+  *trait = command_name.substr(0, size - 2);
+  return true;
+}
+
+// Returns true if |command_name| is "<trait>.<command>".
+bool IsCommandOfTrait(const std::string& command_name,
+                      const std::string& trait) {
+  return command_name.size() > trait.size() + 1 &&
+         command_name[trait.size()] == '.' &&
+         command_name.compare(0, trait.size(), trait) == 0;
 }
 }
 
 CommandQueue::CommandQueue(provider::TaskRunner* task_runner,
-                           base::Clock* clock)
-    : task_runner_{task_runner}, clock_{clock} {}
+                           base::Clock* clock,
+                           Metrics* metrics)
+    : task_runner_{task_runner}, clock_{clock}, metrics_{metrics} {}
 
 void CommandQueue::AddCommandAddedCallback(const CommandCallback& callback) {
   on_command_added_.push_back(callback);
   // Send all pre-existed commands.
-  for (const auto& command : map_)
-    callback.Run(command.second.get());
+  for (const auto& command : commands_)
+    callback.Run(command.second.instance.get());
 }
 
 void CommandQueue::AddCommandRemovedCallback(const CommandCallback& callback) {
@@ -37,65 +60,143 @@ void CommandQueue::AddCommandHandler(
     const std::string& component_path,
     const std::string& command_name,
     const Device::CommandHandlerCallback& callback) {
+  // Sequence numbers and IDs of the queued commands to pass to the new
+  // handler.
+  std::vector<std::pair<uint64_t, StringAtom>> ids;
   if (!command_name.empty()) {
-    CHECK(default_command_callback_.is_null())
+    CHECK(default_command_handler_.callback.is_null())
         << "Commands specific handler are not allowed after default one";
 
-    for (const auto& command : map_) {
-      if (command.second->GetState() == Command::State::kQueued &&
-          command.second->GetName() == command_name &&
-          command.second->GetComponent() == component_path) {
-        callback.Run(command.second);
+    std::string trait;
+    ParseTraitWildcard(command_name, &trait);
+    for (const auto& command : commands_) {
+      const CommandInstance& instance = *command.second.instance;
+      if (instance.GetState() != Command::State::kQueued ||
+          instance.GetComponent() != component_path) {
+        continue;
       }
+      // Commands already passed to a trait handler are not passed again.
+      const std::string& name = instance.GetName();
+      bool matches = trait.empty() ? name == command_name
+                                   : IsCommandOfTrait(name, trait);
+      if (matches && !FindCommandHandler(instance))
+        ids.push_back(std::make_pair(command.second.sequence, command.first));
     }
-
-    std::string key = GetCommandHandlerKey(component_path, command_name);
-    CHECK(command_callbacks_.insert(std::make_pair(key, callback)).second)
-        << command_name << " already has handler";
-
   } else {
     CHECK(component_path.empty())
         << "Default handler must not be component-specific";
-    for (const auto& command : map_) {
-      std::string key = GetCommandHandlerKey(command.second->GetComponent(),
-                                             command.second->GetName());
-      if (command.second->GetState() == Command::State::kQueued &&
-          command_callbacks_.find(key) == command_callbacks_.end()) {
-        callback.Run(command.second);
+    CHECK(default_command_handler_.callback.is_null())
+        << "Already has default handler";
+    for (const auto& command : commands_) {
+      if (command.second.instance->GetState() == Command::State::kQueued &&
+          !FindCommandHandler(*command.second.instance)) {
+        ids.push_back(std::make_pair(command.second.sequence, command.first));
       }
     }
-
-    CHECK(default_command_callback_.is_null()) << "Already has default handler";
-    default_command_callback_ = callback;
   }
+
+  CommandHandler* handler = GetCommandHandler(component_path, command_name);
+  CHECK(handler->callback.is_null()) << command_name << " already has handler";
+  handler->callback = callback;
+  // Commands are passed in the order they were added.
+  std::sort(ids.begin(), ids.end());
+  for (const auto& pair : ids)
+    Dispatch(pair.second, handler);
+}
+
+void CommandQueue::SetCommandHandlerPolicy(const std::string& component_path,
+                                           const std::string& command_name,
+                                           const CommandHandlerPolicy& policy) {
+  CommandHandler* handler = GetCommandHandler(component_path, command_name);
+  handler->policy = policy;
+  if (handler->HasPending())
+    ScheduleDispatchPending(handler);
 }
 
 void CommandQueue::Add(std::unique_ptr<CommandInstance> instance) {
-  std::string id = instance->GetID();
-  LOG_IF(FATAL, id.empty()) << "Command has no ID";
-  instance->AttachToQueue(this);
-  auto pair = map_.insert(std::make_pair(id, std::move(instance)));
-  LOG_IF(FATAL, !pair.second) << "Command with ID '" << id
-                              << "' is already in the queue";
-  for (const auto& cb : on_command_added_)
-    cb.Run(pair.first->second.get());
+  std::vector<std::unique_ptr<CommandInstance>> instances;
+  instances.push_back(std::move(instance));
+  Add(std::move(instances));
+}
 
-  std::string key = GetCommandHandlerKey(pair.first->second->GetComponent(),
-                                         pair.first->second->GetName());
-  auto it_handler = command_callbacks_.find(key);
+void CommandQueue::Add(
+    std::vector<std::unique_ptr<CommandInstance>> instances) {
+  commands_.reserve(commands_.size() + instances.size());
+  base::Time now;
+  if (kMetricsEnabled && metrics_)
+    now = clock_->Now();
+  // Keep references, callbacks may modify the queue.
+  std::vector<std::pair<StringAtom, std::shared_ptr<CommandInstance>>> added;
+  added.reserve(instances.size());
+  for (auto& instance : instances) {
+    const StringAtom& id = instance->GetIDAtom();
+    LOG_IF(FATAL, id.empty()) << "Command has no ID";
+    instance->AttachToQueue(this);
+    CommandRecord record;
+    record.instance = std::move(instance);
+    record.sequence = ++last_sequence_;
+    record.added_time = now;
+    added.push_back(std::make_pair(id, record.instance));
+    auto pair = commands_.insert(std::make_pair(id, std::move(record)));
+    LOG_IF(FATAL, !pair.second) << "Command with ID '" << id.str()
+                                << "' is already in the queue";
+  }
+
+  for (const auto& command : added) {
+    for (const auto& cb : on_command_added_)
+      cb.Run(command.second.get());
+  }
+
+  // A superseding command followed by a newer one in the same batch is
+  // cancelled without taking handler time, e.g. in a backlog of the cloud.
+  std::map<std::pair<std::string, std::string>, size_t> latest;
+  for (size_t i = 0; i < added.size(); ++i) {
+    const CommandInstance& instance = *added[i].second;
+    if (instance.IsSuperseding())
+      latest[std::make_pair(instance.GetComponent(), instance.GetName())] = i;
+  }
 
-  if (it_handler != command_callbacks_.end())
-    it_handler->second.Run(pair.first->second);
-  else if (!default_command_callback_.is_null())
-    default_command_callback_.Run(pair.first->second);
+  for (size_t i = 0; i < added.size(); ++i) {
+    const auto& command = added[i];
+    const CommandInstance& instance = *command.second;
+    if (instance.IsSuperseding() &&
+        latest[std::make_pair(instance.GetComponent(), instance.GetName())] !=
+            i) {
+      CancelSuperseded(command.second);
+      continue;
+    }
+    CommandHandler* handler = SelectCommandHandler(instance);
+    if (handler) {
+      Dispatch(command.first, handler);
+    } else if (instance.IsSuperseding()) {
+      std::shared_ptr<CommandInstance> superseded =
+          TakeSupersededUnhandled(command.first, instance);
+      if (superseded)
+        CancelSuperseded(std::move(superseded));
+    }
+  }
 }
 
 void CommandQueue::RemoveLater(const std::string& id) {
-  auto p = map_.find(id);
-  if (p == map_.end())
+  StringAtom atom = StringAtom::Find(id);
+  if (!atom.empty())
+    RemoveLater(atom);
+}
+
+void CommandQueue::RemoveLater(const StringAtom& id) {
+  auto p = commands_.find(id);
+  if (p == commands_.end() || p->second.removal_scheduled)
     return;
+  p->second.removal_scheduled = true;
+  ReleaseCommandHandler(id, &p->second);
+  WEAVE_RECORD_LATENCY(metrics_, "command_queue_dwell",
+                       clock_->Now() - p->second.added_time);
+  WEAVE_RECORD_LATENCY(
+      metrics_, std::string{"command_queue_dwell "} +
+                    EnumToString(p->second.instance->GetOrigin()),
+      clock_->Now() - p->second.added_time);
   auto remove_delay = base::TimeDelta::FromMinutes(kRemoveCommandDelayMin);
-  remove_queue_.push(std::make_pair(clock_->Now() + remove_delay, id));
+  remove_queue_.push_back(std::make_pair(clock_->Now() + remove_delay, id));
   if (remove_queue_.size() == 1) {
     // The queue was empty, this is the first command to be removed, schedule
     // a clean-up task.
@@ -103,42 +204,253 @@ void CommandQueue::RemoveLater(const std::string& id) {
   }
 }
 
-bool CommandQueue::Remove(const std::string& id) {
-  auto p = map_.find(id);
-  if (p == map_.end())
+bool CommandQueue::Remove(const StringAtom& id) {
+  auto p = commands_.find(id);
+  if (p == commands_.end())
     return false;
-  std::shared_ptr<CommandInstance> instance = p->second;
+  ReleaseCommandHandler(id, &p->second);
+  std::shared_ptr<CommandInstance> instance = std::move(p->second.instance);
   instance->DetachFromQueue();
-  map_.erase(p);
+  commands_.erase(p);
   for (const auto& cb : on_command_removed_)
     cb.Run(instance.get());
   return true;
 }
 
 void CommandQueue::Cleanup(const base::Time& cutoff_time) {
-  while (!remove_queue_.empty() && remove_queue_.top().first <= cutoff_time) {
-    Remove(remove_queue_.top().second);
-    remove_queue_.pop();
+  while (!remove_queue_.empty() && remove_queue_.front().first <= cutoff_time) {
+    StringAtom id = std::move(remove_queue_.front().second);
+    remove_queue_.pop_front();
+    Remove(id);
   }
 }
 
+void CommandQueue::SetWakeWindowScheduler(WakeWindowScheduler* scheduler) {
+  cleanup_timer_.SetWakeWindow(scheduler, kCleanupTolerance);
+}
+
 void CommandQueue::ScheduleCleanup(base::TimeDelta delay) {
-  task_runner_->PostDelayedTask(
-      FROM_HERE, base::Bind(&CommandQueue::PerformScheduledCleanup,
-                            weak_ptr_factory_.GetWeakPtr()),
-      delay);
+  cleanup_timer_.Start(FROM_HERE, delay,
+                       base::Bind(&CommandQueue::PerformScheduledCleanup,
+                                  base::Unretained(this)));
 }
 
 void CommandQueue::PerformScheduledCleanup() {
   base::Time now = clock_->Now();
   Cleanup(now);
   if (!remove_queue_.empty())
-    ScheduleCleanup(remove_queue_.top().first - now);
+    ScheduleCleanup(remove_queue_.front().first - now);
+}
+
+void CommandQueue::RecordDispatch(const CommandRecord& record) {
+  WEAVE_RECORD_LATENCY(metrics_, "command_queue_dispatch",
+                       clock_->Now() - record.added_time);
+  WEAVE_RECORD_LATENCY(metrics_,
+                       std::string{"command_queue_dispatch "} +
+                           EnumToString(record.instance->GetOrigin()),
+                       clock_->Now() - record.added_time);
+}
+
+CommandQueue::CommandHandler* CommandQueue::GetCommandHandler(
+    const std::string& component_path,
+    const std::string& command_name) {
+  if (command_name.empty())
+    return &default_command_handler_;
+  ComponentHandlers& handlers = command_handlers_[component_path];
+  std::string trait;
+  if (!ParseTraitWildcard(command_name, &trait)) {
+    std::unique_ptr<CommandHandler>& handler = handlers.commands[command_name];
+    if (!handler)
+      handler.reset(new CommandHandler);
+    return handler.get();
+  }
+  for (const auto& pair : handlers.traits) {
+    if (pair.first == trait)
+      return pair.second.get();
+  }
+  std::unique_ptr<CommandHandler> handler{new CommandHandler};
+  handlers.traits.push_back(std::make_pair(trait, std::move(handler)));
+  return handlers.traits.back().second.get();
+}
+
+CommandQueue::CommandHandler* CommandQueue::FindCommandHandler(
+    const CommandInstance& command) {
+  auto component = command_handlers_.find(command.GetComponent());
+  if (component == command_handlers_.end())
+    return nullptr;
+  const ComponentHandlers& handlers = component->second;
+  auto handler = handlers.commands.find(command.GetName());
+  if (handler != handlers.commands.end() &&
+      !handler->second->callback.is_null()) {
+    return handler->second.get();
+  }
+  for (const auto& pair : handlers.traits) {
+    if (!pair.second->callback.is_null() &&
+        IsCommandOfTrait(command.GetName(), pair.first)) {
+      return pair.second.get();
+    }
+  }
+  return nullptr;
+}
+
+CommandQueue::CommandHandler* CommandQueue::SelectCommandHandler(
+    const CommandInstance& command) {
+  CommandHandler* handler = FindCommandHandler(command);
+  if (!handler && !default_command_handler_.callback.is_null())
+    handler = &default_command_handler_;
+  return handler;
+}
+
+void CommandQueue::Dispatch(const StringAtom& id, CommandHandler* handler) {
+  auto p = commands_.find(id);
+  if (p == commands_.end())
+    return;
+  CommandRecord& record = p->second;
+  const base::Time deadline = record.instance->GetDeadline();
+  if (!deadline.is_null() && clock_->Now() > deadline) {
+    // Stale commands are dropped without taking handler time, their proxies
+    // report them expired.
+    record.handler = nullptr;
+    WEAVE_RECORD_COUNT(metrics_, "command_queue_expired");
+    std::shared_ptr<CommandInstance> instance = record.instance;
+    instance->Expire(nullptr);
+    return;
+  }
+  record.handler = handler;
+  const CommandHandlerPolicy& policy = handler->policy;
+  if (policy.max_in_flight != 0 && handler->in_flight >= policy.max_in_flight) {
+    std::shared_ptr<CommandInstance> superseded;
+    if (policy.supersede_pending || record.instance->IsSuperseding())
+      superseded = TakeSuperseded(*record.instance, handler);
+    record.pending = true;
+    handler->GetPendingLane(record.instance->GetOrigin())->push_back(id);
+    ++pending_count_;
+    WEAVE_RECORD_COUNT(metrics_, "command_queue_deferred");
+    if (superseded)
+      CancelSuperseded(std::move(superseded));
+    return;
+  }
+
+  ++handler->in_flight;
+  RecordDispatch(record);
+  // Keep a reference, the callback may modify the queue.
+  std::shared_ptr<CommandInstance> instance = record.instance;
+  handler->callback.Run(instance);
+}
+
+void CommandQueue::DispatchPending(CommandHandler* handler) {
+  while (handler->HasPending() &&
+         (handler->policy.max_in_flight == 0 ||
+          handler->in_flight < handler->policy.max_in_flight)) {
+    std::deque<StringAtom>* lane = &handler->pending_cloud;
+    if (handler->pending_cloud.empty()) {
+      lane = &handler->pending_local;
+      handler->local_streak = 0;
+    } else if (!handler->pending_local.empty() &&
+               handler->local_streak < kMaxLocalStreak) {
+      lane = &handler->pending_local;
+      ++handler->local_streak;
+    } else {
+      handler->local_streak = 0;
+    }
+    StringAtom id = std::move(lane->front());
+    lane->pop_front();
+    --pending_count_;
+    commands_.find(id)->second.pending = false;
+    Dispatch(id, handler);
+  }
+}
+
+std::shared_ptr<CommandInstance> CommandQueue::TakeSuperseded(
+    const CommandInstance& command,
+    CommandHandler* handler) {
+  for (auto* lane : {&handler->pending_local, &handler->pending_cloud}) {
+    for (auto it = lane->begin(); it != lane->end(); ++it) {
+      CommandRecord& older = commands_.find(*it)->second;
+      if (older.instance->GetName() == command.GetName() &&
+          older.instance->GetComponent() == command.GetComponent()) {
+        older.handler = nullptr;
+        older.pending = false;
+        lane->erase(it);
+        --pending_count_;
+        return older.instance;
+      }
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<CommandInstance> CommandQueue::TakeSupersededUnhandled(
+    const StringAtom& id,
+    const CommandInstance& command) {
+  StringAtom& last = unhandled_superseding_[std::make_pair(
+      command.GetComponent(), command.GetName())];
+  auto older = commands_.find(last);
+  last = id;
+  if (older == commands_.end() || older->second.handler ||
+      older->second.removal_scheduled ||
+      older->second.instance->GetState() != Command::State::kQueued) {
+    return nullptr;
+  }
+  return older->second.instance;
+}
+
+void CommandQueue::CancelSuperseded(std::shared_ptr<CommandInstance> instance) {
+  WEAVE_RECORD_COUNT(metrics_, "command_queue_superseded");
+  instance->Cancel(nullptr);
+}
+
+void CommandQueue::ScheduleDispatchPending(CommandHandler* handler) {
+  task_runner_->PostDelayedTask(
+      FROM_HERE, base::Bind(&CommandQueue::DispatchPending,
+                            weak_ptr_factory_.GetWeakPtr(), handler),
+      {});
+}
+
+void CommandQueue::ReleaseCommandHandler(const StringAtom& id,
+                                         CommandRecord* record) {
+  CommandHandler* handler = record->handler;
+  if (!handler)
+    return;
+  record->handler = nullptr;
+  if (record->pending) {
+    record->pending = false;
+    std::deque<StringAtom>* lane =
+        handler->GetPendingLane(record->instance->GetOrigin());
+    lane->erase(std::find(lane->begin(), lane->end(), id));
+    --pending_count_;
+    return;
+  }
+  --handler->in_flight;
+  if (handler->HasPending())
+    ScheduleDispatchPending(handler);
 }
 
 CommandInstance* CommandQueue::Find(const std::string& id) const {
-  auto p = map_.find(id);
-  return (p != map_.end()) ? p->second.get() : nullptr;
+  StringAtom atom = StringAtom::Find(id);
+  if (atom.empty())
+    return nullptr;
+  auto p = commands_.find(atom);
+  return (p != commands_.end()) ? p->second.instance.get() : nullptr;
+}
+
+MemoryUsage CommandQueue::GetMemoryUsage() const {
+  MemoryUsage usage;
+  usage.count = commands_.size();
+  usage.bytes = commands_.bucket_count() * sizeof(void*) +
+                remove_queue_.size() * sizeof(remove_queue_.front());
+  // The IDs are counted in the atom table.
+  for (const auto& pair : commands_) {
+    usage.bytes += kHashNodeOverhead + sizeof(pair) +
+                   pair.second.instance->GetMemoryUsage();
+  }
+  return usage;
+}
+
+void CommandQueue::Compact() {
+  // Tables grown by a burst of commands keep their buckets otherwise.
+  commands_.rehash(0);
+  ShrinkToFit(&remove_queue_);
 }
 
 }  // namespace weave
@@ -5,27 +5,37 @@
 #ifndef LIBWEAVE_SRC_COMMANDS_COMMAND_QUEUE_H_
 #define LIBWEAVE_SRC_COMMANDS_COMMAND_QUEUE_H_
 
+#include <deque>
 #include <map>
 #include <memory>
-#include <queue>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include <base/callback.h>
 #include <base/macros.h>
+#include <base/memory/weak_ptr.h>
 #include <base/time/default_clock.h>
 #include <base/time/time.h>
 #include <weave/device.h>
 #include <weave/provider/task_runner.h>
 
 #include "src/commands/command_instance.h"
+#include "src/memory_usage.h"
+#include "src/metrics.h"
+#include "src/string_atom.h"
+#include "src/timer.h"
 
 namespace weave {
 
 class CommandQueue final {
  public:
-  CommandQueue(provider::TaskRunner* task_runner, base::Clock* clock);
+  // |metrics| records how long commands wait for a handler and until they are
+  // done, it may be null.
+  CommandQueue(provider::TaskRunner* task_runner,
+               base::Clock* clock,
+               Metrics* metrics = nullptr);
 
   // TODO: Remove AddCommandAddedCallback and AddCommandRemovedCallback.
   using CommandCallback = base::Callback<void(Command* command)>;
@@ -36,35 +46,68 @@ class CommandQueue final {
   // Adds notifications callback for a command is removed from the queue.
   void AddCommandRemovedCallback(const CommandCallback& callback);
 
+  // Sets handler for commands of |component_path| named |command_name|.
+  // |command_name| of the form "<trait>.*" selects all commands of the trait
+  // which have no handler of their own. Empty |component_path| and
+  // |command_name| set the default handler.
   void AddCommandHandler(const std::string& component_path,
                          const std::string& command_name,
                          const Device::CommandHandlerCallback& callback);
 
+  // Sets the policy of the handler selected by |component_path| and
+  // |command_name| as in AddCommandHandler(). The handler may be added later.
+  // Raising the limit passes the waiting commands to the handler.
+  void SetCommandHandlerPolicy(const std::string& component_path,
+                               const std::string& command_name,
+                               const CommandHandlerPolicy& policy);
+
+  // Lets the removal of done commands share wake-ups with the deferrable
+  // network activity. Should be called before any command is added.
+  void SetWakeWindowScheduler(WakeWindowScheduler* scheduler);
+
+  // Returns the number of commands waiting for their handler to finish some
+  // of its other commands.
+  size_t GetPendingCount() const { return pending_count_; }
+
   // Checks if the command queue is empty.
-  bool IsEmpty() const { return map_.empty(); }
+  bool IsEmpty() const { return commands_.empty(); }
 
   // Returns the number of commands in the queue.
-  size_t GetCount() const { return map_.size(); }
+  size_t GetCount() const { return commands_.size(); }
 
   // Adds a new command to the queue. Each command in the queue has a unique
   // ID that identifies that command instance in this queue.
   // One shouldn't attempt to add a command with the same ID.
   void Add(std::unique_ptr<CommandInstance> instance);
 
+  // Adds a batch of new commands to the queue. Notifications callbacks and
+  // command handlers are called once all the commands are in the queue.
+  void Add(std::vector<std::unique_ptr<CommandInstance>> instances);
+
   // Selects command identified by |id| ready for removal. Command will actually
   // be removed after some time.
   void RemoveLater(const std::string& id);
+  void RemoveLater(const StringAtom& id);
 
   // Finds a command instance in the queue by the instance |id|. Returns
   // nullptr if the command with the given |id| is not found. The returned
   // pointer should not be persisted for a long period of time.
+  // Commands are kept by their interned IDs, |id| is only looked up in the
+  // atom table here.
   CommandInstance* Find(const std::string& id) const;
 
+  // Returns the number of commands in the queue and the approximate memory
+  // they and the queue tables use.
+  MemoryUsage GetMemoryUsage() const;
+
+  // Releases the spare capacity of the queue tables.
+  void Compact();
+
  private:
   friend class CommandQueueTest;
 
   // Removes a command identified by |id| from the queue.
-  bool Remove(const std::string& id);
+  bool Remove(const StringAtom& id);
 
   // Removes old commands scheduled by RemoveLater() to be deleted after
   // |cutoff_time|.
@@ -79,25 +122,134 @@ class CommandQueue final {
 
   provider::TaskRunner* task_runner_{nullptr};
   base::Clock* clock_{nullptr};
+  Metrics* metrics_{nullptr};
+
+  // A command handler and the commands it has been passed. Handlers are never
+  // removed, so commands refer to them by pointers. An entry may exist for its
+  // policy only, with a null |callback|.
+  struct CommandHandler {
+    Device::CommandHandlerCallback callback;
+    CommandHandlerPolicy policy;
+    // Commands passed to |callback| and not finished yet.
+    size_t in_flight{0};
+    // Commands waiting for |in_flight| to go below the limit, by origin.
+    // Local commands, of a user next to the device, go ahead of the cloud
+    // ones, which may be a backlog fetched after a reconnect.
+    std::deque<StringAtom> pending_local;
+    std::deque<StringAtom> pending_cloud;
+    // Local commands passed in a row while cloud commands were waiting.
+    size_t local_streak{0};
+
+    bool HasPending() const {
+      return !pending_local.empty() || !pending_cloud.empty();
+    }
+    std::deque<StringAtom>* GetPendingLane(Command::Origin origin) {
+      return origin == Command::Origin::kLocal ? &pending_local
+                                               : &pending_cloud;
+    }
+  };
+
+  // Returns the entry of the handler selected by |component_path| and
+  // |command_name|, adding it if needed.
+  CommandHandler* GetCommandHandler(const std::string& component_path,
+                                    const std::string& command_name);
+
+  // Returns the handler selected for |command| by its component and name,
+  // not counting the default handler, or nullptr if there is none.
+  CommandHandler* FindCommandHandler(const CommandInstance& command);
 
-  // ID-to-CommandInstance map.
-  std::map<std::string, std::shared_ptr<CommandInstance>> map_;
+  // Returns the handler of |command|, which may be the default one, or nullptr
+  // if there is none.
+  CommandHandler* SelectCommandHandler(const CommandInstance& command);
 
-  // Queue of commands to be removed, keeps them sorted by the timestamp
-  // (earliest first). This is done to tolerate system clock changes.
-  template <typename T>
-  using InversePriorityQueue =
-      std::priority_queue<T, std::vector<T>, std::greater<T>>;
-  InversePriorityQueue<std::pair<base::Time, std::string>> remove_queue_;
+  // Passes the command identified by |id| to |handler|, or makes it wait if
+  // the handler is at its limit. Commands past their deadline are expired
+  // instead.
+  void Dispatch(const StringAtom& id, CommandHandler* handler);
+
+  // Passes the waiting commands of |handler| while it is under its limit.
+  void DispatchPending(CommandHandler* handler);
+
+  // Removes the waiting command of |handler| which |command| replaces, and
+  // returns it, or nullptr if there is none.
+  std::shared_ptr<CommandInstance> TakeSuperseded(
+      const CommandInstance& command,
+      CommandHandler* handler);
+
+  // Keeps the superseding command identified by |id|, which has no handler,
+  // in the queue for the handler added later, and returns the older one it
+  // replaces, if any.
+  std::shared_ptr<CommandInstance> TakeSupersededUnhandled(
+      const StringAtom& id,
+      const CommandInstance& command);
+
+  // Cancels |instance| replaced by a newer command before being passed to its
+  // handler.
+  void CancelSuperseded(std::shared_ptr<CommandInstance> instance);
+
+  // Posts DispatchPending(), so the handler isn't called back from within
+  // finishing its other command.
+  void ScheduleDispatchPending(CommandHandler* handler);
+
+  // A command in the queue. |removal_scheduled| is set by RemoveLater().
+  // |sequence| orders the commands by the time they were added.
+  // |added_time| is only set when recording metrics. |handler| is set once the
+  // command is passed to the handler, or is waiting for it if |pending|.
+  struct CommandRecord {
+    std::shared_ptr<CommandInstance> instance;
+    bool removal_scheduled{false};
+    uint64_t sequence{0};
+    base::Time added_time;
+    CommandHandler* handler{nullptr};
+    bool pending{false};
+  };
+
+  // Stops counting the command identified by |id| against its handler, once
+  // the command is finished or removed.
+  void ReleaseCommandHandler(const StringAtom& id, CommandRecord* record);
+
+  // Records the time |record| waited for a handler, in total and for its
+  // origin.
+  void RecordDispatch(const CommandRecord& record);
+  // ID-to-CommandRecord map.
+  std::unordered_map<StringAtom, CommandRecord, StringAtomHash> commands_;
+  // Sequence number of the last added command.
+  uint64_t last_sequence_{0};
+
+  // Queue of commands to be removed. All commands are kept for the same
+  // period, so the queue is sorted by the removal time (earliest first) and
+  // only one cleanup task is needed for its head. If the system clock goes
+  // back, the later commands are removed no earlier than the head.
+  std::deque<std::pair<base::Time, StringAtom>> remove_queue_;
 
   using CallbackList = std::vector<CommandCallback>;
   CallbackList on_command_added_;
   CallbackList on_command_removed_;
-  std::map<std::string, Device::CommandHandlerCallback> command_callbacks_;
-  Device::CommandHandlerCallback default_command_callback_;
 
-  // WeakPtr factory for controlling the lifetime of command queue cleanup
-  // tasks.
+  // Command handlers of a single component.
+  struct ComponentHandlers {
+    // Full command name to handler.
+    std::unordered_map<std::string, std::unique_ptr<CommandHandler>> commands;
+    // Trait name to handler of all commands of the trait. Components have
+    // few traits, so they are searched linearly by the command name prefix.
+    std::vector<std::pair<std::string, std::unique_ptr<CommandHandler>>>
+        traits;
+  };
+  // Command handlers indexed by component path, so that a command is routed
+  // by the strings it already holds.
+  std::unordered_map<std::string, ComponentHandlers> command_handlers_;
+  CommandHandler default_command_handler_;
+  // Total number of the commands waiting in the CommandHandler lanes.
+  size_t pending_count_{0};
+  // The last superseding command without a handler, by component and name.
+  // Entries are checked when used, as the command may have been passed to a
+  // handler or finished since.
+  std::map<std::pair<std::string, std::string>, StringAtom>
+      unhandled_superseding_;
+
+  // Removes the commands at the head of |remove_queue_| when they are due.
+  OneShotTimer cleanup_timer_{task_runner_,
+                              provider::TaskRunner::Priority::kBackground};
   base::WeakPtrFactory<CommandQueue> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(CommandQueue);
 };
@@ -9,6 +9,7 @@
 #include <vector>
 
 #include <base/bind.h>
+#include <base/bind_helpers.h>
 #include <base/memory/weak_ptr.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -16,6 +17,7 @@
 
 #include "src/bind_lambda.h"
 #include "src/string_utils.h"
+#include "src/test/allocation_counter.h"
 
 namespace weave {
 
@@ -26,21 +28,23 @@ class CommandQueueTest : public testing::Test {
  public:
   std::unique_ptr<CommandInstance> CreateDummyCommandInstance(
       const std::string& name,
-      const std::string& id) {
-    std::unique_ptr<CommandInstance> cmd{
-        new CommandInstance{name, Command::Origin::kLocal, {}}};
+      const std::string& id,
+      Command::Origin origin = Command::Origin::kLocal) {
+    std::unique_ptr<CommandInstance> cmd{new CommandInstance{name, origin, {}}};
     cmd->SetID(id);
     return cmd;
   }
 
-  bool Remove(const std::string& id) { return queue_.Remove(id); }
+  bool Remove(const std::string& id) {
+    return queue_.Remove(StringAtom::Find(id));
+  }
 
   void Cleanup(const base::TimeDelta& interval) {
     return queue_.Cleanup(task_runner_.GetClock()->Now() + interval);
   }
 
   std::string GetFirstCommandToBeRemoved() const {
-    return queue_.remove_queue_.top().second;
+    return queue_.remove_queue_.front().second.str();
   }
 
   StrictMock<provider::test::FakeTaskRunner> task_runner_;
@@ -96,6 +100,47 @@ TEST_F(CommandQueueTest, Add) {
   EXPECT_FALSE(queue_.IsEmpty());
 }
 
+TEST_F(CommandQueueTest, AddAllocations) {
+  queue_.Add(CreateDummyCommandInstance("base.reboot", "id1"));
+  auto command = CreateDummyCommandInstance("base.reboot", "id2");
+  test::AllocationCounter counter;
+  queue_.Add(std::move(command));
+  EXPECT_LE(counter.GetCount(), 5u);
+}
+
+TEST_F(CommandQueueTest, AddBatch) {
+  std::vector<std::unique_ptr<CommandInstance>> commands;
+  commands.push_back(CreateDummyCommandInstance("base.reboot", "id1"));
+  commands.push_back(CreateDummyCommandInstance("base.reboot", "id2"));
+  std::vector<size_t> counts;
+  queue_.AddCommandAddedCallback(base::Bind(
+      [](CommandQueue* queue, std::vector<size_t>* counts, Command* command) {
+        counts->push_back(queue->GetCount());
+      },
+      base::Unretained(&queue_), base::Unretained(&counts)));
+  queue_.AddCommandHandler(
+      "", "base.reboot",
+      base::Bind(
+          [](std::vector<size_t>* counts,
+             const std::weak_ptr<Command>& command) { counts->push_back(0); },
+          base::Unretained(&counts)));
+  queue_.Add(std::move(commands));
+  // Callbacks are called when the whole batch is in the queue.
+  EXPECT_EQ((std::vector<size_t>{2, 2, 0, 0}), counts);
+  EXPECT_NE(nullptr, queue_.Find("id1"));
+  EXPECT_NE(nullptr, queue_.Find("id2"));
+}
+
+TEST_F(CommandQueueTest, FindUnknown) {
+  queue_.Add(CreateDummyCommandInstance("base.reboot", "id1"));
+  size_t count = StringAtom::GetTableMemoryUsage().count;
+  // Unknown IDs, e.g. of a Privet request, are not interned by the lookup.
+  EXPECT_EQ(nullptr, queue_.Find("unknown"));
+  queue_.RemoveLater("unknown");
+  EXPECT_EQ(count, StringAtom::GetTableMemoryUsage().count);
+  EXPECT_EQ(1u, queue_.GetCount());
+}
+
 TEST_F(CommandQueueTest, Remove) {
   const std::string id1 = "id1";
   const std::string id2 = "id2";
@@ -145,6 +190,35 @@ TEST_F(CommandQueueTest, RemoveLaterOnCleanupTask) {
   EXPECT_EQ(0u, task_runner_.GetTaskQueueSize());
 }
 
+TEST_F(CommandQueueTest, ReAddAfterRemove) {
+  const std::string id1 = "id1";
+  queue_.Add(CreateDummyCommandInstance("base.reboot", id1));
+  EXPECT_TRUE(Remove(id1));
+  EXPECT_EQ(nullptr, queue_.Find(id1));
+  queue_.Add(CreateDummyCommandInstance("base.shutdown", id1));
+  ASSERT_NE(nullptr, queue_.Find(id1));
+  EXPECT_EQ("base.shutdown", queue_.Find(id1)->GetName());
+  queue_.Find(id1)->Cancel(nullptr);
+  EXPECT_EQ(id1, GetFirstCommandToBeRemoved());
+}
+
+TEST_F(CommandQueueTest, RemoveLaterTwice) {
+  const std::string id1 = "id1";
+  queue_.Add(CreateDummyCommandInstance("base.reboot", id1));
+  queue_.RemoveLater(id1);
+  void (CommandQueue::*remove_later)(const std::string&) =
+      &CommandQueue::RemoveLater;
+  task_runner_.PostDelayedTask(
+      FROM_HERE, base::Bind(remove_later, base::Unretained(&queue_), id1),
+      base::TimeDelta::FromMinutes(1));
+  task_runner_.RunOnce();
+  // The removal time isn't pushed back.
+  ASSERT_EQ(1u, task_runner_.GetTaskQueueSize());
+  task_runner_.RunOnce();
+  EXPECT_EQ(0u, queue_.GetCount());
+  EXPECT_EQ(0u, task_runner_.GetTaskQueueSize());
+}
+
 TEST_F(CommandQueueTest, CleanupMultipleCommands) {
   const std::string id1 = "id1";
   const std::string id2 = "id2";
@@ -189,6 +263,182 @@ TEST_F(CommandQueueTest, Dispatch) {
   EXPECT_EQ("", dispatch.GetIDs());
 }
 
+TEST_F(CommandQueueTest, HandlerConcurrencyLimit) {
+  std::vector<std::weak_ptr<Command>> dispatched;
+  queue_.SetCommandHandlerPolicy("", "base.reboot", {2, false});
+  for (int i = 0; i < 3; ++i)
+    queue_.Add(CreateDummyCommandInstance("base.reboot", std::to_string(i)));
+  queue_.AddCommandHandler(
+      "", "base.reboot",
+      base::Bind(
+          [](std::vector<std::weak_ptr<Command>>* dispatched,
+             const std::weak_ptr<Command>& command) {
+            dispatched->push_back(command);
+          },
+          &dispatched));
+  queue_.Add(CreateDummyCommandInstance("base.reboot", "3"));
+  ASSERT_EQ(2u, dispatched.size());
+  EXPECT_EQ("0", dispatched[0].lock()->GetID());
+  EXPECT_EQ("1", dispatched[1].lock()->GetID());
+  EXPECT_EQ(2u, queue_.GetPendingCount());
+
+  // The next command is passed once a command of the handler is finished, but
+  // not from within finishing it.
+  EXPECT_TRUE(dispatched[1].lock()->Complete({}, nullptr));
+  EXPECT_EQ(2u, dispatched.size());
+  task_runner_.RunOnce();
+  ASSERT_EQ(3u, dispatched.size());
+  EXPECT_EQ("2", dispatched[2].lock()->GetID());
+
+  // A waiting command cancelled meanwhile is not passed.
+  EXPECT_TRUE(queue_.Find("3")->Cancel(nullptr));
+  EXPECT_EQ(0u, queue_.GetPendingCount());
+  EXPECT_TRUE(dispatched[0].lock()->Abort(nullptr, nullptr));
+  task_runner_.RunOnce();
+  EXPECT_EQ(3u, dispatched.size());
+}
+
+TEST_F(CommandQueueTest, ExpiredCommandsNotDispatched) {
+  std::vector<std::weak_ptr<Command>> dispatched;
+  queue_.SetCommandHandlerPolicy("", "base.reboot", {1, false});
+  queue_.AddCommandHandler(
+      "", "base.reboot",
+      base::Bind(
+          [](std::vector<std::weak_ptr<Command>>* dispatched,
+             const std::weak_ptr<Command>& command) {
+            dispatched->push_back(command);
+          },
+          &dispatched));
+  const base::Time now = task_runner_.GetClock()->Now();
+  auto stale = CreateDummyCommandInstance("base.reboot", "stale");
+  stale->SetDeadline(now - base::TimeDelta::FromSeconds(1));
+  queue_.Add(std::move(stale));
+  EXPECT_EQ(Command::State::kExpired, queue_.Find("stale")->GetState());
+  EXPECT_TRUE(dispatched.empty());
+
+  // Commands waiting for the handler may expire meanwhile.
+  queue_.Add(CreateDummyCommandInstance("base.reboot", "1"));
+  auto waiting = CreateDummyCommandInstance("base.reboot", "2");
+  waiting->SetDeadline(now + base::TimeDelta::FromSeconds(5));
+  queue_.Add(std::move(waiting));
+  queue_.Add(CreateDummyCommandInstance("base.reboot", "3"));
+  ASSERT_EQ(1u, dispatched.size());
+  EXPECT_EQ(2u, queue_.GetPendingCount());
+
+  task_runner_.PostDelayedTask(FROM_HERE, base::Bind(&base::DoNothing),
+                               base::TimeDelta::FromSeconds(10));
+  task_runner_.RunOnce();
+  EXPECT_TRUE(dispatched[0].lock()->Complete({}, nullptr));
+  task_runner_.RunOnce();
+  EXPECT_EQ(Command::State::kExpired, queue_.Find("2")->GetState());
+  ASSERT_EQ(2u, dispatched.size());
+  EXPECT_EQ("3", dispatched[1].lock()->GetID());
+  EXPECT_EQ(0u, queue_.GetPendingCount());
+}
+
+TEST_F(CommandQueueTest, SupersedePendingCommands) {
+  std::vector<std::string> dispatched;
+  queue_.AddCommandHandler(
+      "", "brightness.*",
+      base::Bind(
+          [](std::vector<std::string>* dispatched,
+             const std::weak_ptr<Command>& command) {
+            dispatched->push_back(command.lock()->GetID());
+          },
+          &dispatched));
+  queue_.SetCommandHandlerPolicy("", "brightness.*", {1, true});
+  queue_.Add(CreateDummyCommandInstance("brightness.set", "set1"));
+  queue_.Add(CreateDummyCommandInstance("brightness.set", "set2"));
+  queue_.Add(CreateDummyCommandInstance("brightness.fade", "fade"));
+  queue_.Add(CreateDummyCommandInstance("brightness.set", "set3"));
+  EXPECT_EQ(std::vector<std::string>{"set1"}, dispatched);
+  EXPECT_EQ(Command::State::kCancelled, queue_.Find("set2")->GetState());
+  EXPECT_EQ(2u, queue_.GetPendingCount());
+
+  // Raising the limit passes the waiting commands in their order.
+  queue_.SetCommandHandlerPolicy("", "brightness.*", {0, false});
+  task_runner_.RunOnce();
+  EXPECT_EQ((std::vector<std::string>{"set1", "fade", "set3"}), dispatched);
+  EXPECT_EQ(0u, queue_.GetPendingCount());
+}
+
+TEST_F(CommandQueueTest, SupersedingCommands) {
+  auto create_set = [this](const std::string& id) {
+    auto command = CreateDummyCommandInstance("brightness.set", id);
+    command->SetSuperseding(true);
+    return command;
+  };
+
+  // Without a handler, only the latest command is kept.
+  queue_.Add(create_set("set1"));
+  queue_.Add(CreateDummyCommandInstance("brightness.fade", "fade"));
+  queue_.Add(create_set("set2"));
+  EXPECT_EQ(Command::State::kCancelled, queue_.Find("set1")->GetState());
+
+  std::vector<std::string> dispatched;
+  queue_.AddCommandHandler(
+      "", "brightness.*",
+      base::Bind(
+          [](std::vector<std::string>* dispatched,
+             const std::weak_ptr<Command>& command) {
+            dispatched->push_back(command.lock()->GetID());
+          },
+          &dispatched));
+  EXPECT_EQ((std::vector<std::string>{"fade", "set2"}), dispatched);
+
+  // Nor in a batch.
+  std::vector<std::unique_ptr<CommandInstance>> batch;
+  batch.push_back(create_set("set3"));
+  batch.push_back(create_set("set4"));
+  batch.push_back(CreateDummyCommandInstance("brightness.fade", "fade2"));
+  queue_.Add(std::move(batch));
+  EXPECT_EQ(Command::State::kCancelled, queue_.Find("set3")->GetState());
+  EXPECT_EQ((std::vector<std::string>{"fade", "set2", "set4", "fade2"}),
+            dispatched);
+
+  // Nor while waiting for a busy handler, without a policy to supersede.
+  queue_.SetCommandHandlerPolicy("", "brightness.*", {1, false});
+  queue_.Add(create_set("set5"));
+  queue_.Add(create_set("set6"));
+  EXPECT_EQ(Command::State::kCancelled, queue_.Find("set5")->GetState());
+  EXPECT_EQ(1u, queue_.GetPendingCount());
+}
+
+TEST_F(CommandQueueTest, LocalCommandsGoFirst) {
+  std::vector<std::weak_ptr<Command>> dispatched;
+  queue_.AddCommandHandler(
+      "", "base.reboot",
+      base::Bind(
+          [](std::vector<std::weak_ptr<Command>>* dispatched,
+             const std::weak_ptr<Command>& command) {
+            dispatched->push_back(command);
+          },
+          &dispatched));
+  queue_.SetCommandHandlerPolicy("", "base.reboot", {1, false});
+  for (int i = 0; i < 4; ++i) {
+    queue_.Add(CreateDummyCommandInstance(
+        "base.reboot", "c" + std::to_string(i), Command::Origin::kCloud));
+  }
+  for (int i = 0; i < 6; ++i) {
+    queue_.Add(CreateDummyCommandInstance(
+        "base.reboot", "l" + std::to_string(i), Command::Origin::kLocal));
+  }
+
+  // Waiting local commands go ahead of the cloud ones, but no more than four
+  // in a row.
+  std::vector<std::string> ids;
+  while (!dispatched.empty()) {
+    std::shared_ptr<Command> command = dispatched.back().lock();
+    ids.push_back(command->GetID());
+    dispatched.clear();
+    EXPECT_TRUE(command->Complete({}, nullptr));
+    task_runner_.RunOnce();
+  }
+  EXPECT_EQ((std::vector<std::string>{"c0", "l0", "l1", "l2", "l3", "c1", "l4",
+                                      "l5", "c2", "c3"}),
+            ids);
+}
+
 TEST_F(CommandQueueTest, Find) {
   const std::string id1 = "id1";
   const std::string id2 = "id2";
@@ -205,4 +455,54 @@ TEST_F(CommandQueueTest, Find) {
   EXPECT_EQ(id2, cmd2->GetID());
 }
 
+TEST_F(CommandQueueTest, MemoryUsage) {
+  EXPECT_EQ(0u, queue_.GetMemoryUsage().count);
+  for (int i = 0; i < 100; ++i) {
+    queue_.Add(
+        CreateDummyCommandInstance("base.reboot", "id" + std::to_string(i)));
+  }
+  MemoryUsage usage = queue_.GetMemoryUsage();
+  EXPECT_EQ(100u, usage.count);
+  EXPECT_LT(100 * sizeof(CommandInstance), usage.bytes);
+
+  for (int i = 0; i < 100; ++i)
+    EXPECT_TRUE(Remove("id" + std::to_string(i)));
+  size_t bytes = queue_.GetMemoryUsage().bytes;
+  queue_.Compact();
+  usage = queue_.GetMemoryUsage();
+  EXPECT_EQ(0u, usage.count);
+  EXPECT_GT(bytes, usage.bytes);
+}
+
+TEST_F(CommandQueueTest, RecordsMetrics) {
+  if (!kMetricsEnabled)
+    return;
+  Metrics metrics;
+  CommandQueue queue{&task_runner_, task_runner_.GetClock(), &metrics};
+  queue.Add(CreateDummyCommandInstance("base.reboot", "id1"));
+
+  task_runner_.PostDelayedTask(FROM_HERE, base::Bind(&base::DoNothing),
+                               base::TimeDelta::FromMilliseconds(30));
+  task_runner_.RunOnce();
+  queue.AddCommandHandler(
+      "", "base.reboot",
+      base::Bind([](const std::weak_ptr<Command>& command) {}));
+
+  task_runner_.PostDelayedTask(FROM_HERE, base::Bind(&base::DoNothing),
+                               base::TimeDelta::FromMilliseconds(400));
+  task_runner_.RunOnce();
+  queue.RemoveLater("id1");
+
+  auto json = metrics.ToJson();
+  double value = 0;
+  EXPECT_TRUE(
+      json->GetDouble("histograms.command_queue_dispatch.maxMs", &value));
+  EXPECT_DOUBLE_EQ(30, value);
+  EXPECT_TRUE(json->GetDouble("histograms.command_queue_dwell.maxMs", &value));
+  EXPECT_DOUBLE_EQ(430, value);
+  EXPECT_TRUE(
+      json->GetDouble("histograms.command_queue_dwell local.maxMs", &value));
+  EXPECT_DOUBLE_EQ(430, value);
+}
+
 }  // namespace weave
@@ -31,6 +31,7 @@ const char kCommand_Progress[] = "progress";
 const char kCommand_Results[] = "results";
 const char kCommand_State[] = "state";
 const char kCommand_Error[] = "error";
+const char kCommand_ExpirationTimeMs[] = "expirationTimeMs";
 
 }  // namespace attributes
 }  // namespace commands
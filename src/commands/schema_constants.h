@@ -33,6 +33,7 @@ extern const char kCommand_Progress[];
 extern const char kCommand_Results[];
 extern const char kCommand_State[];
 extern const char kCommand_Error[];
+extern const char kCommand_ExpirationTimeMs[];
 
 }  // namespace attributes
 }  // namespace commands
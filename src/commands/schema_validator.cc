@@ -0,0 +1,398 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/commands/schema_validator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <base/logging.h>
+#include <base/values.h>
+
+#include "src/commands/schema_constants.h"
+
+namespace weave {
+
+namespace {
+
+const size_t kNoNode = std::numeric_limits<size_t>::max();
+
+const char kType[] = "type";
+const char kMinimum[] = "minimum";
+const char kMaximum[] = "maximum";
+const char kMinLength[] = "minLength";
+const char kMaxLength[] = "maxLength";
+const char kMinItems[] = "minItems";
+const char kMaxItems[] = "maxItems";
+const char kEnum[] = "enum";
+const char kProperties[] = "properties";
+const char kAdditionalProperties[] = "additionalProperties";
+const char kRequired[] = "required";
+const char kItems[] = "items";
+
+bool GetLength(const base::DictionaryValue& schema,
+               const char* key,
+               size_t* length,
+               ErrorPtr* error) {
+  const base::Value* value = nullptr;
+  if (!schema.GetWithoutPathExpansion(key, &value))
+    return true;
+  int int_value = 0;
+  if (!value->GetAsInteger(&int_value) || int_value < 0) {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::commands::kInvalidPropValue,
+                              "'%s' must be a non-negative integer", key);
+  }
+  *length = static_cast<size_t>(int_value);
+  return true;
+}
+
+bool GetLimit(const base::DictionaryValue& schema,
+              const char* key,
+              bool* has_limit,
+              double* limit,
+              ErrorPtr* error) {
+  const base::Value* value = nullptr;
+  if (!schema.GetWithoutPathExpansion(key, &value))
+    return true;
+  if (!value->GetAsDouble(limit)) {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::commands::kInvalidPropValue,
+                              "'%s' must be a number", key);
+  }
+  *has_limit = true;
+  return true;
+}
+
+}  // namespace
+
+SchemaValidator::Node::Node()
+    : max_length{std::numeric_limits<size_t>::max()}, items{kNoNode} {}
+
+SchemaValidator::Node::~Node() {}
+
+SchemaValidator::SchemaValidator() {}
+
+SchemaValidator::~SchemaValidator() {}
+
+std::unique_ptr<SchemaValidator> SchemaValidator::Create(
+    const base::DictionaryValue& schema,
+    ErrorPtr* error) {
+  std::unique_ptr<SchemaValidator> validator{new SchemaValidator};
+  if (!validator->CompileNode(validator->AddNode(), schema, error))
+    return nullptr;
+  return validator;
+}
+
+std::unique_ptr<SchemaValidator> SchemaValidator::CreateForProperties(
+    const base::DictionaryValue& properties,
+    ErrorPtr* error) {
+  std::unique_ptr<SchemaValidator> validator{new SchemaValidator};
+  size_t root = validator->AddNode();
+  validator->nodes_[root].type = Type::kObject;
+  if (!validator->CompileProperties(root, properties, error))
+    return nullptr;
+  return validator;
+}
+
+bool SchemaValidator::Validate(const base::Value& value,
+                               ErrorPtr* error) const {
+  return ValidateNode(0, value, error);
+}
+
+bool SchemaValidator::ParseType(const std::string& name,
+                                Type* type,
+                                ErrorPtr* error) {
+  if (name == "boolean") {
+    *type = Type::kBoolean;
+  } else if (name == "integer") {
+    *type = Type::kInteger;
+  } else if (name == "number") {
+    *type = Type::kNumber;
+  } else if (name == "string") {
+    *type = Type::kString;
+  } else if (name == "object") {
+    *type = Type::kObject;
+  } else if (name == "array") {
+    *type = Type::kArray;
+  } else {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::commands::kInvalidPropValue,
+                              "Unknown type '%s'", name.c_str());
+  }
+  return true;
+}
+
+size_t SchemaValidator::AddNode() {
+  nodes_.emplace_back();
+  return nodes_.size() - 1;
+}
+
+bool SchemaValidator::CompileNode(size_t index,
+                                  const base::DictionaryValue& schema,
+                                  ErrorPtr* error) {
+  // Children are appended to |nodes_| below, so |node| is looked up again
+  // after each of them is compiled.
+  Node* node = &nodes_[index];
+  std::string type;
+  if (schema.GetStringWithoutPathExpansion(kType, &type)) {
+    if (!ParseType(type, &node->type, error))
+      return false;
+  } else if (schema.HasKey(kType)) {
+    return Error::AddTo(error, FROM_HERE, errors::commands::kInvalidPropValue,
+                        "'type' must be a string");
+  }
+
+  if (!GetLimit(schema, kMinimum, &node->has_minimum, &node->minimum, error) ||
+      !GetLimit(schema, kMaximum, &node->has_maximum, &node->maximum, error) ||
+      !GetLength(schema, kMinLength, &node->min_length, error) ||
+      !GetLength(schema, kMaxLength, &node->max_length, error) ||
+      !GetLength(schema, kMinItems, &node->min_length, error) ||
+      !GetLength(schema, kMaxItems, &node->max_length, error)) {
+    return false;
+  }
+
+  const base::ListValue* enum_list = nullptr;
+  if (schema.GetListWithoutPathExpansion(kEnum, &enum_list)) {
+    for (const auto& item : *enum_list) {
+      std::string string_value;
+      double double_value = 0;
+      if (item->GetAsString(&string_value)) {
+        node->string_enum.push_back(string_value);
+      } else if (item->GetAsDouble(&double_value)) {
+        node->number_enum.push_back(double_value);
+      } else {
+        return Error::AddTo(error, FROM_HERE,
+                            errors::commands::kInvalidPropValue,
+                            "Only strings and numbers are supported in 'enum'");
+      }
+    }
+    if (!node->string_enum.empty() && !node->number_enum.empty()) {
+      return Error::AddTo(error, FROM_HERE, errors::commands::kInvalidPropValue,
+                          "Values of 'enum' must be of the same type");
+    }
+    if (node->type == Type::kAny) {
+      node->type =
+          node->string_enum.empty() ? Type::kNumber : Type::kString;
+    }
+    std::sort(node->string_enum.begin(), node->string_enum.end());
+    std::sort(node->number_enum.begin(), node->number_enum.end());
+  }
+
+  schema.GetBooleanWithoutPathExpansion(kAdditionalProperties,
+                                        &node->additional_properties);
+
+  const base::DictionaryValue* properties = nullptr;
+  if (schema.GetDictionaryWithoutPathExpansion(kProperties, &properties)) {
+    if (node->type == Type::kAny)
+      node->type = Type::kObject;
+    if (!CompileProperties(index, *properties, error))
+      return false;
+    node = &nodes_[index];
+  }
+
+  const base::ListValue* required = nullptr;
+  if (schema.GetListWithoutPathExpansion(kRequired, &required)) {
+    for (const auto& item : *required) {
+      std::string name;
+      auto it = node->properties.end();
+      if (item->GetAsString(&name)) {
+        it = std::lower_bound(
+            node->properties.begin(), node->properties.end(), name,
+            [](const Property& a, const std::string& b) { return a.name < b; });
+      }
+      if (it == node->properties.end() || it->name != name) {
+        return Error::AddTo(error, FROM_HERE,
+                            errors::commands::kInvalidPropValue,
+                            "'required' must list names of defined properties");
+      }
+      if (!it->required) {
+        it->required = true;
+        node->required_count++;
+      }
+    }
+  }
+
+  const base::DictionaryValue* items = nullptr;
+  if (schema.GetDictionaryWithoutPathExpansion(kItems, &items)) {
+    if (node->type == Type::kAny)
+      node->type = Type::kArray;
+    size_t items_index = AddNode();
+    nodes_[index].items = items_index;
+    if (!CompileNode(items_index, *items, error)) {
+      return Error::AddTo(error, FROM_HERE, errors::commands::kInvalidPropValue,
+                          "Invalid schema of array items");
+    }
+  }
+  return true;
+}
+
+bool SchemaValidator::CompileProperties(size_t index,
+                                        const base::DictionaryValue& properties,
+                                        ErrorPtr* error) {
+  std::vector<Property> compiled;
+  for (base::DictionaryValue::Iterator it(properties); !it.IsAtEnd();
+       it.Advance()) {
+    size_t child = AddNode();
+    // Besides a full schema, just a type name is allowed: {"height": "integer"}.
+    const base::DictionaryValue* schema = nullptr;
+    std::string type;
+    bool valid =
+        it.value().GetAsDictionary(&schema)
+            ? CompileNode(child, *schema, error)
+            : it.value().GetAsString(&type) &&
+                  ParseType(type, &nodes_[child].type, error);
+    if (!valid) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kInvalidPropValue,
+                                "Invalid schema of property '%s'",
+                                it.key().c_str());
+    }
+    compiled.push_back({it.key(), child, false});
+  }
+  // DictionaryValue iterates keys in order already, but don't rely on it.
+  std::sort(compiled.begin(), compiled.end(),
+            [](const Property& a, const Property& b) { return a.name < b.name; });
+  nodes_[index].properties = std::move(compiled);
+  return true;
+}
+
+bool SchemaValidator::ValidateNode(size_t index,
+                                   const base::Value& value,
+                                   ErrorPtr* error) const {
+  const Node& node = nodes_[index];
+  switch (node.type) {
+    case Type::kAny:
+      return true;
+
+    case Type::kBoolean:
+      if (value.GetType() != base::Value::TYPE_BOOLEAN)
+        break;
+      return true;
+
+    case Type::kInteger:
+    case Type::kNumber: {
+      double number = 0;
+      if (!value.GetAsDouble(&number))
+        break;
+      if (node.type == Type::kInteger &&
+          value.GetType() != base::Value::TYPE_INTEGER &&
+          number != std::floor(number)) {
+        break;
+      }
+      if ((node.has_minimum && number < node.minimum) ||
+          (node.has_maximum && number > node.maximum)) {
+        return Error::AddToPrintf(error, FROM_HERE,
+                                  errors::commands::kInvalidPropValue,
+                                  "Value %g is out of range", number);
+      }
+      if (!node.number_enum.empty() &&
+          !std::binary_search(node.number_enum.begin(), node.number_enum.end(),
+                              number)) {
+        return Error::AddToPrintf(error, FROM_HERE,
+                                  errors::commands::kInvalidPropValue,
+                                  "Value %g is not one of allowed", number);
+      }
+      return true;
+    }
+
+    case Type::kString: {
+      std::string string_value;
+      if (!value.GetAsString(&string_value))
+        break;
+      if (string_value.size() < node.min_length ||
+          string_value.size() > node.max_length) {
+        return Error::AddToPrintf(
+            error, FROM_HERE, errors::commands::kInvalidPropValue,
+            "Length of string '%s' is out of range", string_value.c_str());
+      }
+      if (!node.string_enum.empty() &&
+          !std::binary_search(node.string_enum.begin(), node.string_enum.end(),
+                              string_value)) {
+        return Error::AddToPrintf(error, FROM_HERE,
+                                  errors::commands::kInvalidPropValue,
+                                  "Value '%s' is not one of allowed",
+                                  string_value.c_str());
+      }
+      return true;
+    }
+
+    case Type::kObject: {
+      const base::DictionaryValue* dict = nullptr;
+      if (!value.GetAsDictionary(&dict))
+        break;
+      return ValidateObject(node, *dict, error);
+    }
+
+    case Type::kArray: {
+      const base::ListValue* list = nullptr;
+      if (!value.GetAsList(&list))
+        break;
+      if (list->GetSize() < node.min_length ||
+          list->GetSize() > node.max_length) {
+        return Error::AddToPrintf(error, FROM_HERE,
+                                  errors::commands::kInvalidPropValue,
+                                  "Array size %zu is out of range",
+                                  list->GetSize());
+      }
+      if (node.items == kNoNode)
+        return true;
+      size_t i = 0;
+      for (const auto& item : *list) {
+        if (!ValidateNode(node.items, *item, error)) {
+          return Error::AddToPrintf(error, FROM_HERE,
+                                    errors::commands::kInvalidPropValue,
+                                    "Invalid array item %zu", i);
+        }
+        i++;
+      }
+      return true;
+    }
+  }
+
+  return Error::AddToPrintf(error, FROM_HERE, errors::commands::kTypeMismatch,
+                            "Unexpected value type %d", value.GetType());
+}
+
+bool SchemaValidator::ValidateObject(const Node& node,
+                                     const base::DictionaryValue& value,
+                                     ErrorPtr* error) const {
+  size_t required_found = 0;
+  for (base::DictionaryValue::Iterator it(value); !it.IsAtEnd();
+       it.Advance()) {
+    auto property = std::lower_bound(
+        node.properties.begin(), node.properties.end(), it.key(),
+        [](const Property& a, const std::string& b) { return a.name < b; });
+    if (property == node.properties.end() || property->name != it.key()) {
+      if (node.additional_properties)
+        continue;
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kInvalidPropValue,
+                                "Unexpected property '%s'", it.key().c_str());
+    }
+    if (!ValidateNode(property->node, it.value(), error)) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kInvalidPropValue,
+                                "Invalid value of property '%s'",
+                                it.key().c_str());
+    }
+    if (property->required)
+      required_found++;
+  }
+  if (required_found == node.required_count)
+    return true;
+  for (const auto& property : node.properties) {
+    if (property.required && !value.HasKey(property.name)) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kPropertyMissing,
+                                "Required property '%s' is missing",
+                                property.name.c_str());
+    }
+  }
+  NOTREACHED();
+  return false;
+}
+
+}  // namespace weave
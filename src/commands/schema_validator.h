@@ -0,0 +1,113 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_COMMANDS_SCHEMA_VALIDATOR_H_
+#define LIBWEAVE_SRC_COMMANDS_SCHEMA_VALIDATOR_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <weave/error.h>
+
+namespace base {
+class DictionaryValue;
+class Value;
+}  // namespace base
+
+namespace weave {
+
+// Checks JSON values against a schema from a trait definition, e.g.
+//   {"type": "integer", "minimum": 0, "maximum": 100}
+//   {"type": "string", "enum": ["on", "off"]}
+//   {"type": "object", "properties": {...}, "required": ["name"]}
+//   {"type": "array", "items": {...}, "minItems": 1}
+// The schema is compiled once into a flat list of nodes, so validation does
+// not need to look up keywords in the schema JSON. Unknown keywords are
+// ignored.
+class SchemaValidator final {
+ public:
+  ~SchemaValidator();
+
+  // Compiles the |schema| of a single value.
+  static std::unique_ptr<SchemaValidator> Create(
+      const base::DictionaryValue& schema,
+      ErrorPtr* error);
+  // Compiles the schema of an object with the given |properties|, which is
+  // how "parameters" of trait commands are defined.
+  static std::unique_ptr<SchemaValidator> CreateForProperties(
+      const base::DictionaryValue& properties,
+      ErrorPtr* error);
+
+  bool Validate(const base::Value& value, ErrorPtr* error) const;
+
+  enum class Type {
+    kAny,
+    kBoolean,
+    kInteger,
+    kNumber,
+    kString,
+    kObject,
+    kArray,
+  };
+  // Returns the type of the validated value.
+  Type GetType() const { return nodes_[0].type; }
+
+ private:
+  struct Property {
+    std::string name;
+    size_t node;
+    bool required;
+  };
+
+  struct Node {
+    Node();
+    ~Node();
+
+    Type type{Type::kAny};
+    bool has_minimum{false};
+    bool has_maximum{false};
+    double minimum{0};
+    double maximum{0};
+    // Length limits of strings and arrays.
+    size_t min_length{0};
+    size_t max_length;
+    // Allowed values, sorted. Only one of them is used, depending on |type|.
+    std::vector<std::string> string_enum;
+    std::vector<double> number_enum;
+    // Object members, sorted by name.
+    std::vector<Property> properties;
+    size_t required_count{0};
+    bool additional_properties{true};
+    // Node of array items, if any.
+    size_t items;
+  };
+
+  SchemaValidator();
+
+  static bool ParseType(const std::string& name, Type* type, ErrorPtr* error);
+  size_t AddNode();
+  bool CompileNode(size_t index,
+                   const base::DictionaryValue& schema,
+                   ErrorPtr* error);
+  bool CompileProperties(size_t index,
+                         const base::DictionaryValue& properties,
+                         ErrorPtr* error);
+  bool ValidateNode(size_t index,
+                    const base::Value& value,
+                    ErrorPtr* error) const;
+  bool ValidateObject(const Node& node,
+                      const base::DictionaryValue& value,
+                      ErrorPtr* error) const;
+
+  // |nodes_[0]| is the root value.
+  std::vector<Node> nodes_;
+
+  DISALLOW_COPY_AND_ASSIGN(SchemaValidator);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_COMMANDS_SCHEMA_VALIDATOR_H_
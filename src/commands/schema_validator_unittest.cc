@@ -0,0 +1,163 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/commands/schema_validator.h"
+
+#include <base/values.h>
+#include <gtest/gtest.h>
+#include <weave/test/unittest_utils.h>
+
+namespace weave {
+
+using test::CreateDictionaryValue;
+using test::CreateValue;
+
+namespace {
+
+std::unique_ptr<SchemaValidator> Compile(const char* schema) {
+  ErrorPtr error;
+  auto validator =
+      SchemaValidator::Create(*CreateDictionaryValue(schema), &error);
+  EXPECT_NE(nullptr, validator.get()) << error->GetMessage();
+  return validator;
+}
+
+bool Validate(const SchemaValidator& validator, const char* json) {
+  return validator.Validate(*CreateValue(json), nullptr);
+}
+
+}  // namespace
+
+TEST(SchemaValidator, InvalidSchema) {
+  const char* const kSchemas[] = {
+      "{'type': 'float'}",
+      "{'type': 5}",
+      "{'minimum': 'zero'}",
+      "{'maxLength': -1}",
+      "{'enum': [true]}",
+      "{'enum': ['a', 1]}",
+      "{'properties': {'a': 5}}",
+      "{'properties': {'a': 'int'}}",
+      "{'properties': {'a': {'type': 'blob'}}}",
+      "{'properties': {'a': {}}, 'required': ['b']}",
+      "{'items': {'type': 'blob'}}",
+  };
+  for (const char* schema : kSchemas) {
+    ErrorPtr error;
+    EXPECT_EQ(nullptr,
+              SchemaValidator::Create(*CreateDictionaryValue(schema), &error))
+        << schema;
+    EXPECT_NE(nullptr, error.get());
+  }
+}
+
+TEST(SchemaValidator, Types) {
+  auto any = Compile("{}");
+  EXPECT_TRUE(Validate(*any, "null"));
+  EXPECT_TRUE(Validate(*any, "{'a': [1]}"));
+
+  auto boolean = Compile("{'type': 'boolean'}");
+  EXPECT_TRUE(Validate(*boolean, "true"));
+  EXPECT_FALSE(Validate(*boolean, "1"));
+
+  auto integer = Compile("{'type': 'integer'}");
+  EXPECT_TRUE(Validate(*integer, "-3"));
+  EXPECT_TRUE(Validate(*integer, "2.0"));
+  EXPECT_FALSE(Validate(*integer, "2.5"));
+  EXPECT_FALSE(Validate(*integer, "'2'"));
+
+  auto number = Compile("{'type': 'number'}");
+  EXPECT_TRUE(Validate(*number, "2"));
+  EXPECT_TRUE(Validate(*number, "2.5"));
+  EXPECT_FALSE(Validate(*number, "false"));
+
+  auto string = Compile("{'type': 'string'}");
+  EXPECT_TRUE(Validate(*string, "''"));
+  EXPECT_FALSE(Validate(*string, "[]"));
+
+  auto object = Compile("{'type': 'object'}");
+  EXPECT_TRUE(Validate(*object, "{'a': 1}"));
+  EXPECT_FALSE(Validate(*object, "[]"));
+
+  auto array = Compile("{'type': 'array'}");
+  EXPECT_TRUE(Validate(*array, "[1, 'a']"));
+  EXPECT_FALSE(Validate(*array, "{}"));
+}
+
+TEST(SchemaValidator, Limits) {
+  auto number = Compile("{'type': 'number', 'minimum': -1, 'maximum': 2.5}");
+  EXPECT_TRUE(Validate(*number, "-1"));
+  EXPECT_TRUE(Validate(*number, "2.5"));
+  EXPECT_FALSE(Validate(*number, "-1.5"));
+  EXPECT_FALSE(Validate(*number, "3"));
+
+  auto string = Compile("{'type': 'string', 'minLength': 1, 'maxLength': 3}");
+  EXPECT_TRUE(Validate(*string, "'abc'"));
+  EXPECT_FALSE(Validate(*string, "''"));
+  EXPECT_FALSE(Validate(*string, "'abcd'"));
+
+  auto array = Compile(
+      "{'items': {'type': 'integer', 'maximum': 5}, 'minItems': 1, "
+      "'maxItems': 2}");
+  EXPECT_TRUE(Validate(*array, "[1, 5]"));
+  EXPECT_FALSE(Validate(*array, "[]"));
+  EXPECT_FALSE(Validate(*array, "[1, 2, 3]"));
+  EXPECT_FALSE(Validate(*array, "[1, 6]"));
+  EXPECT_FALSE(Validate(*array, "{}"));
+}
+
+TEST(SchemaValidator, Enum) {
+  auto string = Compile("{'enum': ['on', 'off', 'standby']}");
+  EXPECT_TRUE(Validate(*string, "'off'"));
+  EXPECT_FALSE(Validate(*string, "'dim'"));
+  EXPECT_FALSE(Validate(*string, "1"));
+
+  auto number = Compile("{'type': 'integer', 'enum': [10, 1, 5]}");
+  EXPECT_TRUE(Validate(*number, "5"));
+  EXPECT_FALSE(Validate(*number, "2"));
+}
+
+TEST(SchemaValidator, Object) {
+  auto object = Compile(R"({
+    'properties': {
+      'name': {'type': 'string'},
+      'size': {'type': 'integer', 'minimum': 0},
+      'tags': {'items': {'type': 'string'}}
+    },
+    'required': ['name'],
+    'additionalProperties': false
+  })");
+  EXPECT_TRUE(Validate(*object, "{'name': 'a'}"));
+  EXPECT_TRUE(Validate(*object, "{'name': 'a', 'size': 1, 'tags': ['x']}"));
+  EXPECT_FALSE(Validate(*object, "{'size': 1}"));
+  EXPECT_FALSE(Validate(*object, "{'name': 'a', 'size': -1}"));
+  EXPECT_FALSE(Validate(*object, "{'name': 'a', 'tags': [1]}"));
+  EXPECT_FALSE(Validate(*object, "{'name': 'a', 'color': 'red'}"));
+
+  ErrorPtr error;
+  EXPECT_FALSE(object->Validate(*CreateValue("{'name': 'a', 'size': -1}"),
+                                &error));
+  EXPECT_EQ("invalid_parameter_value", error->GetCode());
+  EXPECT_EQ("Invalid value of property 'size'", error->GetMessage());
+}
+
+TEST(SchemaValidator, CreateForProperties) {
+  ErrorPtr error;
+  auto parameters = SchemaValidator::CreateForProperties(
+      *CreateDictionaryValue(
+          "{'height': {'type': 'integer'}, 'name': 'string'}"),
+      &error);
+  ASSERT_NE(nullptr, parameters.get());
+  EXPECT_TRUE(Validate(*parameters, "{}"));
+  EXPECT_TRUE(Validate(*parameters, "{'height': 1, 'extra': true}"));
+  EXPECT_FALSE(Validate(*parameters, "{'height': 'tall'}"));
+  EXPECT_FALSE(Validate(*parameters, "{'name': 1}"));
+  EXPECT_FALSE(Validate(*parameters, "[]"));
+
+  EXPECT_EQ(nullptr, SchemaValidator::CreateForProperties(
+                         *CreateDictionaryValue("{'height': 'int'}"),
+                         &error));
+}
+
+}  // namespace weave
@@ -7,10 +7,13 @@
 
 #include <map>
 #include <memory>
+#include <set>
+#include <vector>
 
 #include <base/callback_list.h>
 #include <base/time/clock.h>
 #include <base/values.h>
+#include <weave/embedded_value.h>
 #include <weave/error.h>
 
 #include "src/commands/command_queue.h"
@@ -18,6 +21,7 @@
 namespace weave {
 
 class CommandInstance;
+class JsonStreamWriter;
 
 enum class UserRole {
   kViewer,
@@ -44,6 +48,7 @@ struct ComponentStateChange {
 
 class ComponentManager {
  public:
+  using StatePropertyHandle = Device::StatePropertyHandle;
   using UpdateID = uint64_t;
   using Token =
       std::unique_ptr<base::CallbackList<void(UpdateID)>::Subscription>;
@@ -63,7 +68,20 @@ class ComponentManager {
   // definitions from.
   virtual bool LoadTraits(const std::string& json, ErrorPtr* error) = 0;
 
+  // Same as the overload above, but reads the trait definitions from a table
+  // compiled at build time, skipping the JSON parsing.
+  virtual bool LoadTraits(const EmbeddedValue& table, ErrorPtr* error) = 0;
+
+  // Keeps the trait definitions loaded afterwards in a compact, unparsed form
+  // until a component or a command handler references them. Until then they
+  // are not validated and not returned by GetTraits(), so only the traits in
+  // use are uploaded and served. Tables passed to LoadTraits() must outlive
+  // the manager, as the compiled ones do.
+  virtual void EnableLazyTraits() = 0;
+
   // Sets callback which is called when new trait definitions are added.
+  // Changes made within one task are reported with a single call from a
+  // following task.
   virtual void AddTraitDefChangedCallback(const base::Closure& callback) = 0;
 
   // Adds a new component instance to device.
@@ -101,7 +119,9 @@ class ComponentManager {
                                         size_t index,
                                         ErrorPtr* error) = 0;
 
-  // Sets callback which is called when new components are added.
+  // Sets callback which is called when new components are added. Changes made
+  // within one task, e.g. adding many components at startup, are reported with
+  // a single call from a following task.
   virtual void AddComponentTreeChangedCallback(
       const base::Closure& callback) = 0;
 
@@ -111,6 +131,12 @@ class ComponentManager {
   virtual void
   AddCommand(std::unique_ptr<CommandInstance> command_instance) = 0;
 
+  // Adds all |command_instances| to the command queue at once. The command
+  // added callbacks and the command handlers are run only after the whole
+  // batch is queued.
+  virtual void AddCommands(
+      std::vector<std::unique_ptr<CommandInstance>> command_instances) = 0;
+
   // Parses the command definition from a json dictionary. The resulting command
   // instance is populated with all the required fields and partially validated
   // against syntax/schema.
@@ -122,6 +148,18 @@ class ComponentManager {
       std::string* id,
       ErrorPtr* error) = 0;
 
+  // Creates the command |name| for |component| with |parameters| directly,
+  // with the same checks as ParseCommandInstance(), for the callers which
+  // already have the parts of the command.
+  virtual std::unique_ptr<CommandInstance> CreateCommandInstance(
+      const std::string& component,
+      const std::string& name,
+      const base::DictionaryValue& parameters,
+      Command::Origin command_origin,
+      UserRole role,
+      std::string* id,
+      ErrorPtr* error) = 0;
+
   // Find a command instance with the given ID in the command queue.
   virtual CommandInstance* FindCommand(const std::string& id) = 0;
 
@@ -141,6 +179,13 @@ class ComponentManager {
       const std::string& command_name,
       const Device::CommandHandlerCallback& callback) = 0;
 
+  // Sets the policy of the handler of |command_name| of |component_path|,
+  // which are the arguments the handler is or will be added with.
+  virtual bool SetCommandHandlerPolicy(const std::string& component_path,
+                                       const std::string& command_name,
+                                       const CommandHandlerPolicy& policy,
+                                       ErrorPtr* error) = 0;
+
   // Finds a component instance by its full path.
   virtual const base::DictionaryValue* FindComponent(const std::string& path,
                                                      ErrorPtr* error) const = 0;
@@ -165,30 +210,114 @@ class ComponentManager {
 
   // Returns the full JSON dictionary containing trait definitions.
   virtual const base::DictionaryValue& GetTraits() const = 0;
+  // Returns GetTraits() written as compact JSON. The text is kept until the
+  // trait definitions change, so repeated calls don't serialize them again.
+  virtual const std::string& GetTraitsJson() const = 0;
 
   // Returns the full JSON dictionary containing component instances.
   virtual const base::DictionaryValue& GetComponents() const = 0;
 
+  // Return hashes of the trait definitions, of the state of all the
+  // components and of the whole component tree. They depend on the content
+  // only, so they stay the same across restarts until the content changes.
+  // Each is computed when it's first asked for after a change.
+  virtual uint64_t GetTraitsFingerprint() const = 0;
+  virtual uint64_t GetStateFingerprint() const = 0;
+  virtual uint64_t GetComponentsFingerprint() const = 0;
+
+  // Writes the trait definitions and the component tree, including the state,
+  // as a JSON object which RestoreSnapshot() accepts after a restart.
+  virtual void WriteSnapshot(JsonStreamWriter* writer) const = 0;
+  // Restores the trait definitions and components from a snapshot written by
+  // WriteSnapshot(). Traits which are already defined must be identical, and
+  // root level components which already exist are kept as they are.
+  virtual bool RestoreSnapshot(const base::DictionaryValue& snapshot,
+                               ErrorPtr* error) = 0;
+
   // Returns a JSON dictionary containing component instances with state
-  // properties visible to a user of the given |role|.
-  virtual std::unique_ptr<base::DictionaryValue> GetComponentsForUserRole(
-      UserRole role) const = 0;
+  // properties visible to a user of the given |role|. The snapshot is
+  // immutable and may be shared with other callers until the components
+  // change.
+  virtual std::shared_ptr<const base::DictionaryValue>
+  GetComponentsForUserRole(UserRole role) const = 0;
+  // Returns an immutable snapshot of GetComponents(), shared with other
+  // callers until the components change. Unlike GetComponents(), it may be
+  // read on other threads while the components change.
+  virtual std::shared_ptr<const base::DictionaryValue> GetComponentsSnapshot()
+      const = 0;
+
+  // Starts publishing GetComponentsSnapshot() for GetComponentsView(), once
+  // per task in which the components or their state changed.
+  virtual void EnableComponentsView() = 0;
+  // Returns the snapshot last published, or nullptr if EnableComponentsView()
+  // wasn't called. May be called on any thread, without waiting for the task
+  // runner.
+  virtual std::shared_ptr<const base::DictionaryValue> GetComponentsView()
+      const = 0;
+  // Returns a copy of the component at |component_path| with state properties
+  // visible to a user of the given |role|. If |fields| is not empty, only
+  // these members ("traits", "state", "components") of the component and its
+  // sub-components are copied, and the parts of the tree left out are not
+  // visited. Returns nullptr if the component is not found.
+  virtual std::unique_ptr<base::DictionaryValue> GetComponentForUserRole(
+      const std::string& component_path,
+      UserRole role,
+      const std::set<std::string>& fields,
+      ErrorPtr* error) const = 0;
 
   // Component state manipulation methods.
   virtual bool SetStateProperties(const std::string& component_path,
                                   const base::DictionaryValue& dict,
                                   ErrorPtr* error) = 0;
+  virtual bool SetStateProperties(const std::string& component_path,
+                                  std::unique_ptr<base::DictionaryValue> dict,
+                                  ErrorPtr* error) = 0;
   virtual bool SetStatePropertiesFromJson(const std::string& component_path,
                                           const std::string& json,
                                           ErrorPtr* error) = 0;
   virtual const base::Value* GetStateProperty(const std::string& component_path,
                                               const std::string& name,
                                               ErrorPtr* error) const = 0;
+  // Returns the 'state' dictionary of the component at |component_path|.
+  // Valid until the state or the component tree changes.
+  virtual const base::DictionaryValue* GetComponentState(
+      const std::string& component_path,
+      ErrorPtr* error) const = 0;
   virtual bool SetStateProperty(const std::string& component_path,
                                 const std::string& name,
                                 const base::Value& value,
                                 ErrorPtr* error) = 0;
 
+  // Resolves the state property |name| of component at |component_path| into
+  // a handle which can be used with SetStatePropertyByHandle() to skip the
+  // component lookup. Returns 0 on failure. The handle is invalidated when
+  // the component is removed from the tree.
+  virtual StatePropertyHandle ResolveStateProperty(
+      const std::string& component_path,
+      const std::string& name,
+      ErrorPtr* error) = 0;
+  virtual bool SetStatePropertyByHandle(StatePropertyHandle handle,
+                                        const base::Value& value,
+                                        ErrorPtr* error) = 0;
+  // Updates the state of all components listed in |states| under a single
+  // update ID. Nothing is changed if any of the components is not found.
+  virtual bool SetComponentsState(const base::DictionaryValue& states,
+                                  ErrorPtr* error) = 0;
+
+  // Sets the policy of recording state changes of component at
+  // |component_path|. The policy is dropped when the component is removed.
+  virtual bool SetStateHistoryPolicy(const std::string& component_path,
+                                     const StateHistoryPolicy& policy,
+                                     ErrorPtr* error) = 0;
+
+  // Sets the filter of the recorded changes of the state property |name| of
+  // the component at |component_path|. The filter is dropped when the
+  // component is removed.
+  virtual bool SetStatePublishFilter(const std::string& component_path,
+                                     const std::string& name,
+                                     const StatePublishFilter& filter,
+                                     ErrorPtr* error) = 0;
+
   virtual void AddStateChangedCallback(const base::Closure& callback) = 0;
 
   // Returns the recorded state changes since last time this method was called.
@@ -215,10 +344,23 @@ class ComponentManager {
   // path specified.
   // Returns empty string if no components are found.
   // This method only searches for component on the top level of components
-  // tree. No sub-components are searched.
+  // tree. No sub-components are searched. Looked up in an index kept by trait.
   virtual std::string FindComponentWithTrait(
       const std::string& trait) const = 0;
 
+  // Adds the approximate memory usage of the "components", "traits",
+  // "componentCaches", "stateChangeQueues" and "commandQueue" to |stats| as
+  // {"<subsystem>": {"count": <elements>, "bytes": <bytes>}}.
+  virtual void GetMemoryStats(base::DictionaryValue* stats) const = 0;
+
+  // Drops the cached copies of the component tree and releases the spare
+  // capacity of the queues.
+  virtual void CompactMemory() = 0;
+
+  // Merges the recorded state changes of every component into a single
+  // change, giving up their history to save memory.
+  virtual void MergeStateHistory() = 0;
+
   DISALLOW_COPY_AND_ASSIGN(ComponentManager);
 };
 
@@ -0,0 +1,105 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/component_manager_impl.h"
+
+#include <string>
+
+#include <base/logging.h>
+#include <base/values.h>
+#include <weave/provider/test/fake_task_runner.h>
+
+#include "src/test/benchmark.h"
+
+namespace weave {
+
+namespace {
+
+const char kTraits[] = R"({
+  "onOff": {
+    "state": {
+      "state": {"type": "string", "enum": ["on", "off"]}
+    }
+  },
+  "brightness": {
+    "state": {
+      "brightness": {"type": "integer", "minimum": 0, "maximum": 100},
+      "calibration": {"type": "number", "minimalRole": "owner"}
+    }
+  }
+})";
+
+const size_t kLightCount = 16;
+
+// A hub with an array of lights, the way a typical bridge device looks.
+class Device {
+ public:
+  Device() : manager_{&task_runner_, task_runner_.GetClock()} {
+    CHECK(manager_.LoadTraits(kTraits, nullptr));
+    CHECK(manager_.AddComponent("", "hub", {"onOff"}, nullptr));
+    for (size_t i = 0; i < kLightCount; ++i) {
+      CHECK(manager_.AddComponentArrayItem(
+          "hub", "lights", {"onOff", "brightness"}, nullptr));
+      std::string path = "hub.lights[" + std::to_string(i) + "]";
+      CHECK(manager_.SetStatePropertiesFromJson(
+          path,
+          R"({"onOff": {"state": "on"},
+              "brightness": {"brightness": 50, "calibration": 0.5}})",
+          nullptr));
+    }
+    task_runner_.RunPendingTasks();
+  }
+
+  ComponentManagerImpl* manager() { return &manager_; }
+
+ private:
+  provider::test::FakeTaskRunner task_runner_;
+  ComponentManagerImpl manager_;
+};
+
+void BM_ComponentManagerSetStateProperty(test::BenchmarkState* state) {
+  Device device;
+  base::FundamentalValue values[] = {base::FundamentalValue{10},
+                                     base::FundamentalValue{90}};
+  size_t i = 0;
+  while (state->KeepRunning()) {
+    device.manager()->SetStateProperty("hub.lights[7]", "brightness.brightness",
+                                       values[++i % 2], nullptr);
+  }
+}
+WEAVE_BENCHMARK(BM_ComponentManagerSetStateProperty);
+
+void BM_ComponentManagerFindComponent(test::BenchmarkState* state) {
+  Device device;
+  while (state->KeepRunning())
+    CHECK(device.manager()->FindComponent("hub.lights[11]", nullptr));
+}
+WEAVE_BENCHMARK(BM_ComponentManagerFindComponent);
+
+void BM_ComponentManagerGetComponentsForUserRole(test::BenchmarkState* state) {
+  Device device;
+  while (state->KeepRunning())
+    CHECK(device.manager()->GetComponentsForUserRole(UserRole::kViewer));
+}
+WEAVE_BENCHMARK(BM_ComponentManagerGetComponentsForUserRole);
+
+// Each state change invalidates the cached trees, as when a client polls a
+// device with frequently changing state.
+void BM_ComponentManagerGetComponentsForUserRoleAfterChange(
+    test::BenchmarkState* state) {
+  Device device;
+  base::FundamentalValue values[] = {base::FundamentalValue{10},
+                                     base::FundamentalValue{90}};
+  size_t i = 0;
+  while (state->KeepRunning()) {
+    device.manager()->SetStateProperty("hub.lights[7]", "brightness.brightness",
+                                       values[++i % 2], nullptr);
+    CHECK(device.manager()->GetComponentsForUserRole(UserRole::kViewer));
+  }
+}
+WEAVE_BENCHMARK(BM_ComponentManagerGetComponentsForUserRoleAfterChange);
+
+}  // namespace
+
+}  // namespace weave
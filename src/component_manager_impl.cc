@@ -4,22 +4,35 @@
 
 #include "src/component_manager_impl.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <tuple>
+#include <utility>
+
+#include <base/bind.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 
 #include "src/commands/schema_constants.h"
 #include "src/json_error_codes.h"
+#include "src/json_stream_reader.h"
+#include "src/json_stream_writer.h"
+#include "src/memory_usage.h"
 #include "src/string_utils.h"
 #include "src/utils.h"
 
 namespace weave {
 
 namespace {
-// Max of 100 state update events should be enough in the queue.
-const size_t kMaxStateChangeQueueSize = 100;
-
 const char kMinimalRole[] = "minimalRole";
+const char kLocalOnly[] = "localOnly";
+const char kExpirationTimeoutMs[] = "expirationTimeoutMs";
+const char kSuperseding[] = "superseding";
+// Characters having special meaning in component paths.
+const char kPathSpecialChars[] = ".[]";
 
 const EnumToStringMap<UserRole>::Map kMap[] = {
     {UserRole::kViewer, "viewer"},
@@ -28,56 +41,223 @@ const EnumToStringMap<UserRole>::Map kMap[] = {
     {UserRole::kManager, "manager"},
 };
 
-void RemoveInaccessibleState(const ComponentManagerImpl* manager,
-                             base::DictionaryValue* component,
-                             UserRole role) {
-  std::vector<std::string> state_props_to_remove;
-  base::DictionaryValue* state = nullptr;
-  if (component->GetDictionary("state", &state)) {
-    for (base::DictionaryValue::Iterator it_trait(*state); !it_trait.IsAtEnd();
-         it_trait.Advance()) {
-      const base::DictionaryValue* trait = nullptr;
-      CHECK(it_trait.value().GetAsDictionary(&trait));
-      for (base::DictionaryValue::Iterator it_prop(*trait); !it_prop.IsAtEnd();
-           it_prop.Advance()) {
-        std::string prop_name = base::StringPrintf(
-            "%s.%s", it_trait.key().c_str(), it_prop.key().c_str());
-        UserRole minimal_role;
-        if (manager->GetStateMinimalRole(prop_name, &minimal_role, nullptr) &&
-            minimal_role > role) {
-          state_props_to_remove.push_back(prop_name);
-        }
+// Returns true if |name| is a non-empty name without surrounding whitespace
+// and |special_chars|, that is it can be addressed as an element of a path.
+bool IsSimpleName(const std::string& name, const char* special_chars) {
+  if (name.empty() || name.find_first_of(special_chars) != std::string::npos)
+    return false;
+  std::string trimmed;
+  base::TrimWhitespaceASCII(name, base::TrimPositions::TRIM_ALL, &trimmed);
+  return trimmed == name;
+}
+
+// Removes from |changes| the members equal to those of |current|. Nested
+// objects are compared member by member and removed once nothing is left of
+// them.
+void RemoveUnchangedMembers(const base::DictionaryValue& current,
+                            base::DictionaryValue* changes) {
+  std::vector<std::string> unchanged;
+  for (base::DictionaryValue::Iterator it(*changes); !it.IsAtEnd();
+       it.Advance()) {
+    const base::Value* value = nullptr;
+    if (!current.GetWithoutPathExpansion(it.key(), &value))
+      continue;
+    const base::DictionaryValue* current_member = nullptr;
+    base::DictionaryValue* changed_member = nullptr;
+    if (value->GetAsDictionary(&current_member) &&
+        changes->GetDictionaryWithoutPathExpansion(it.key(), &changed_member)) {
+      RemoveUnchangedMembers(*current_member, changed_member);
+      if (changed_member->empty())
+        unchanged.push_back(it.key());
+    } else if (value->Equals(&it.value())) {
+      unchanged.push_back(it.key());
+    }
+  }
+  for (const std::string& key : unchanged)
+    changes->RemoveWithoutPathExpansion(key, nullptr);
+}
+
+// Returns a copy of the state change |dict| in which the object properties
+// present in |state| keep only the members which differ from it, or null if
+// |dict| changes no such property. Objects are merged into the state member
+// by member, so the changed members make an equivalent patch.
+std::unique_ptr<base::DictionaryValue> DiffObjectProperties(
+    const base::DictionaryValue& state,
+    const base::DictionaryValue& dict) {
+  std::unique_ptr<base::DictionaryValue> diff;
+  for (base::DictionaryValue::Iterator trait(dict); !trait.IsAtEnd();
+       trait.Advance()) {
+    const base::DictionaryValue* properties = nullptr;
+    const base::DictionaryValue* current_properties = nullptr;
+    if (!trait.value().GetAsDictionary(&properties) ||
+        !state.GetDictionaryWithoutPathExpansion(trait.key(),
+                                                 &current_properties)) {
+      continue;
+    }
+    for (base::DictionaryValue::Iterator it(*properties); !it.IsAtEnd();
+         it.Advance()) {
+      const base::DictionaryValue* current = nullptr;
+      if (!it.value().IsType(base::Value::TYPE_DICTIONARY) ||
+          !current_properties->GetDictionaryWithoutPathExpansion(it.key(),
+                                                                 &current)) {
+        continue;
       }
+      if (!diff)
+        diff = dict.CreateDeepCopy();
+      base::DictionaryValue* diff_properties = nullptr;
+      base::DictionaryValue* changes = nullptr;
+      CHECK(diff->GetDictionaryWithoutPathExpansion(trait.key(),
+                                                    &diff_properties));
+      CHECK(diff_properties->GetDictionaryWithoutPathExpansion(it.key(),
+                                                               &changes));
+      RemoveUnchangedMembers(*current, changes);
+      if (changes->empty())
+        diff_properties->RemoveWithoutPathExpansion(it.key(), nullptr);
+    }
+    base::DictionaryValue* diff_properties = nullptr;
+    if (diff &&
+        diff->GetDictionaryWithoutPathExpansion(trait.key(),
+                                                &diff_properties) &&
+        diff_properties->empty() && !properties->empty()) {
+      diff->RemoveWithoutPathExpansion(trait.key(), nullptr);
     }
   }
-  // Now remove any inaccessible properties from the state collection.
-  for (const std::string& path : state_props_to_remove) {
-    // Remove starting from component level in order for "state" to be removed
-    // if no sub-properties remain.
-    CHECK(component->RemovePath(base::StringPrintf("state.%s", path.c_str()),
-                                nullptr));
+  return diff;
+}
+
+// 64-bit FNV-1a, so the fingerprints don't depend on the process.
+const uint64_t kFnvOffsetBasis = 14695981039346656037ull;
+const uint64_t kFnvPrime = 1099511628211ull;
+
+void HashBytes(const void* data, size_t size, uint64_t* hash) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    *hash ^= bytes[i];
+    *hash *= kFnvPrime;
   }
+}
 
-  // If this component has any sub-components, filter them too.
-  base::DictionaryValue* sub_components = nullptr;
-  if (component->GetDictionary("components", &sub_components)) {
-    for (base::DictionaryValue::Iterator it_component(*sub_components);
-         !it_component.IsAtEnd(); it_component.Advance()) {
-      base::Value* sub_component = nullptr;
-      CHECK(sub_components->Get(it_component.key(), &sub_component));
-      if (sub_component->GetType() == base::Value::TYPE_LIST) {
-        base::ListValue* component_array = nullptr;
-        CHECK(sub_component->GetAsList(&component_array));
-        for (const auto& item : *component_array) {
-          CHECK(item->GetAsDictionary(&component));
-          RemoveInaccessibleState(manager, component, role);
-        }
-      } else if (sub_component->GetType() == base::Value::TYPE_DICTIONARY) {
-        CHECK(sub_component->GetAsDictionary(&component));
-        RemoveInaccessibleState(manager, component, role);
+void HashUint64(uint64_t value, uint64_t* hash) {
+  uint8_t bytes[8];
+  for (size_t i = 0; i < sizeof(bytes); ++i)
+    bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+  HashBytes(bytes, sizeof(bytes), hash);
+}
+
+void HashString(const std::string& str, uint64_t* hash) {
+  HashUint64(str.size(), hash);
+  HashBytes(str.data(), str.size(), hash);
+}
+
+// Integers are hashed as doubles, so that a number keeps its hash when it's
+// read back from JSON as the other type.
+void HashValue(const base::Value& value, uint64_t* hash) {
+  base::Value::Type type = value.GetType();
+  if (type == base::Value::TYPE_INTEGER)
+    type = base::Value::TYPE_DOUBLE;
+  HashUint64(type, hash);
+  switch (type) {
+    case base::Value::TYPE_BOOLEAN: {
+      bool bool_value = false;
+      CHECK(value.GetAsBoolean(&bool_value));
+      HashUint64(bool_value, hash);
+      break;
+    }
+    case base::Value::TYPE_DOUBLE: {
+      double double_value = 0;
+      CHECK(value.GetAsDouble(&double_value));
+      // Both zeros are equal in JSON.
+      if (double_value == 0)
+        double_value = 0;
+      uint64_t bits = 0;
+      static_assert(sizeof(bits) == sizeof(double_value), "Unexpected size");
+      memcpy(&bits, &double_value, sizeof(bits));
+      HashUint64(bits, hash);
+      break;
+    }
+    case base::Value::TYPE_STRING: {
+      std::string string_value;
+      CHECK(value.GetAsString(&string_value));
+      HashString(string_value, hash);
+      break;
+    }
+    case base::Value::TYPE_BINARY: {
+      const auto& binary = static_cast<const base::BinaryValue&>(value);
+      HashUint64(binary.GetSize(), hash);
+      HashBytes(binary.GetBuffer(), binary.GetSize(), hash);
+      break;
+    }
+    case base::Value::TYPE_DICTIONARY: {
+      const base::DictionaryValue* dict = nullptr;
+      CHECK(value.GetAsDictionary(&dict));
+      // The keys are sorted, so the order they were set in doesn't matter.
+      HashUint64(dict->size(), hash);
+      for (base::DictionaryValue::Iterator it{*dict}; !it.IsAtEnd();
+           it.Advance()) {
+        HashString(it.key(), hash);
+        HashValue(it.value(), hash);
       }
+      break;
+    }
+    case base::Value::TYPE_LIST: {
+      const base::ListValue* list = nullptr;
+      CHECK(value.GetAsList(&list));
+      HashUint64(list->GetSize(), hash);
+      for (const auto& item : *list)
+        HashValue(*item, hash);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void HashComponentState(const base::Value& value,
+                        const std::string& path,
+                        uint64_t* hash);
+
+// Hashes the state of the components in |components|, the "components" of
+// the root or of the component at |prefix|, and of their sub-components.
+void HashComponentStates(const base::DictionaryValue& components,
+                         const std::string& prefix,
+                         uint64_t* hash) {
+  for (base::DictionaryValue::Iterator it{components}; !it.IsAtEnd();
+       it.Advance()) {
+    std::string path = prefix + it.key();
+    const base::ListValue* array = nullptr;
+    if (!it.value().GetAsList(&array)) {
+      HashComponentState(it.value(), path, hash);
+      continue;
     }
+    for (size_t i = 0; i < array->GetSize(); ++i) {
+      const base::Value* item = nullptr;
+      CHECK(array->Get(i, &item));
+      HashComponentState(
+          *item, base::StringPrintf("%s[%zu]", path.c_str(), i), hash);
+    }
+  }
+}
+
+// Hashes the state of the component at |path| together with the path, so
+// components without state don't change the hash.
+void HashComponentState(const base::Value& value,
+                        const std::string& path,
+                        uint64_t* hash) {
+  const base::DictionaryValue* component = nullptr;
+  if (!value.GetAsDictionary(&component))
+    return;
+  const base::DictionaryValue* dict = nullptr;
+  if (component->GetDictionaryWithoutPathExpansion("state", &dict)) {
+    HashString(path, hash);
+    HashValue(*dict, hash);
   }
+  if (component->GetDictionaryWithoutPathExpansion("components", &dict))
+    HashComponentStates(*dict, path + ".", hash);
+}
+
+// Zero means a fingerprint is not computed, so it's never returned.
+uint64_t FinishFingerprint(uint64_t hash) {
+  return hash ? hash : 1;
 }
 
 }  // anonymous namespace
@@ -87,12 +267,25 @@ LIBWEAVE_EXPORT EnumToStringMap<UserRole>::EnumToStringMap()
     : EnumToStringMap(kMap) {}
 
 ComponentManagerImpl::ComponentManagerImpl(provider::TaskRunner* task_runner,
-                                           base::Clock* clock)
-    : clock_{clock ? clock : &default_clock_},
-      command_queue_{task_runner, clock_} {}
+                                           base::Clock* clock,
+                                           Metrics* metrics,
+                                           WakeWindowScheduler* wake_scheduler)
+    : task_runner_{task_runner},
+      clock_{clock ? clock : &default_clock_},
+      command_queue_{task_runner, clock_, metrics} {
+  command_queue_.SetWakeWindowScheduler(wake_scheduler);
+}
 
 ComponentManagerImpl::~ComponentManagerImpl() {}
 
+ComponentManagerImpl::StatePropertyRef::StatePropertyRef(
+    ComponentNode* node,
+    const std::string& name,
+    const SchemaValidator* validator)
+    : node{node}, name{name}, validator{validator} {}
+
+ComponentManagerImpl::StatePropertyRef::~StatePropertyRef() {}
+
 bool ComponentManagerImpl::AddComponent(const std::string& path,
                                         const std::string& name,
                                         const std::vector<std::string>& traits,
@@ -111,6 +304,8 @@ bool ComponentManagerImpl::AddComponent(const std::string& path,
 
   // Check to make sure the declared traits are already defined.
   for (const std::string& trait : traits) {
+    if (!MaterializeTrait(trait, error))
+      return false;
     if (!FindTraitDefinition(trait)) {
       return Error::AddToPrintf(error, FROM_HERE,
                                 errors::commands::kInvalidPropValue,
@@ -121,9 +316,20 @@ bool ComponentManagerImpl::AddComponent(const std::string& path,
   std::unique_ptr<base::ListValue> traits_list{new base::ListValue};
   traits_list->AppendStrings(traits);
   dict->Set("traits", std::move(traits_list));
+  base::DictionaryValue* component = dict.get();
   root->SetWithoutPathExpansion(name, std::move(dict));
-  for (const auto& cb : on_componet_tree_changed_)
-    cb.Run();
+  const ComponentNode* parent = FindComponentNode(path);
+  if (!IsSimpleName(name, kPathSpecialChars)) {
+    // The component can't be addressed by a path, so it is not indexed.
+  } else if (path.empty()) {
+    IndexComponentTree(name, component, nullptr);
+  } else if (parent) {
+    IndexComponentTree(parent->path + '.' + name, component, nullptr);
+  } else {
+    // |path| is not in its canonical form.
+    RebuildComponentIndex();
+  }
+  NotifyComponentTreeChanged();
   return true;
 }
 
@@ -132,14 +338,20 @@ bool ComponentManagerImpl::AddComponentArrayItem(
     const std::string& name,
     const std::vector<std::string>& traits,
     ErrorPtr* error) {
+  for (const std::string& trait : traits) {
+    if (!MaterializeTrait(trait, error))
+      return false;
+  }
   base::DictionaryValue* root = &components_;
   if (!path.empty()) {
     root = FindComponentGraftNode(path, error);
     if (!root)
       return false;
   }
+  bool replaced = false;
   base::ListValue* array_value = nullptr;
   if (!root->GetListWithoutPathExpansion(name, &array_value)) {
+    replaced = root->GetWithoutPathExpansion(name, nullptr);
     array_value = new base::ListValue;
     root->SetWithoutPathExpansion(name, array_value);
   }
@@ -147,15 +359,29 @@ bool ComponentManagerImpl::AddComponentArrayItem(
   std::unique_ptr<base::ListValue> traits_list{new base::ListValue};
   traits_list->AppendStrings(traits);
   dict->Set("traits", std::move(traits_list));
+  base::DictionaryValue* component = dict.get();
   array_value->Append(std::move(dict));
-  for (const auto& cb : on_componet_tree_changed_)
-    cb.Run();
+  const ComponentNode* parent = FindComponentNode(path);
+  if (!IsSimpleName(name, kPathSpecialChars)) {
+    // The component can't be addressed by a path, so it is not indexed.
+  } else if (!replaced && (path.empty() || parent)) {
+    std::string item_path = base::StringPrintf(
+        "%s[%zu]", name.c_str(), array_value->GetSize() - 1);
+    if (parent)
+      item_path = parent->path + '.' + item_path;
+    IndexComponentTree(item_path, component, nullptr);
+  } else {
+    RebuildComponentIndex();
+  }
+  NotifyComponentTreeChanged();
   return true;
 }
 
 bool ComponentManagerImpl::RemoveComponent(const std::string& path,
                                            const std::string& name,
                                            ErrorPtr* error) {
+  // Record the pending state changes of the components being removed.
+  FlushStateSlots();
   base::DictionaryValue* root = &components_;
   if (!path.empty()) {
     root = FindComponentGraftNode(path, error);
@@ -163,14 +389,35 @@ bool ComponentManagerImpl::RemoveComponent(const std::string& path,
       return false;
   }
 
-  if (!root->RemoveWithoutPathExpansion(name, nullptr)) {
+  std::unique_ptr<base::Value> removed;
+  if (!root->RemoveWithoutPathExpansion(name, &removed)) {
     return Error::AddToPrintf(error, FROM_HERE, errors::commands::kInvalidState,
                               "Component '%s' does not exist at path '%s'",
                               name.c_str(), path.c_str());
   }
 
-  for (const auto& cb : on_componet_tree_changed_)
-    cb.Run();
+  const ComponentNode* parent = FindComponentNode(path);
+  if (!IsSimpleName(name, kPathSpecialChars)) {
+    // The component can't be addressed by a path, so it is not indexed.
+  } else if (path.empty() || parent) {
+    std::string component_path = parent ? parent->path + '.' + name : name;
+    base::DictionaryValue* component = nullptr;
+    base::ListValue* component_array = nullptr;
+    if (removed->GetAsDictionary(&component)) {
+      MoveComponentTree(component_path, {}, *component);
+    } else if (removed->GetAsList(&component_array)) {
+      for (size_t i = 0; i < component_array->GetSize(); i++) {
+        if (component_array->GetDictionary(i, &component)) {
+          MoveComponentTree(
+              base::StringPrintf("%s[%zu]", component_path.c_str(), i), {},
+              *component);
+        }
+      }
+    }
+  } else {
+    RebuildComponentIndex();
+  }
+  NotifyComponentTreeChanged();
   return true;
 }
 
@@ -178,6 +425,7 @@ bool ComponentManagerImpl::RemoveComponentArrayItem(const std::string& path,
                                                     const std::string& name,
                                                     size_t index,
                                                     ErrorPtr* error) {
+  FlushStateSlots();
   base::DictionaryValue* root = &components_;
   if (!path.empty()) {
     root = FindComponentGraftNode(path, error);
@@ -193,15 +441,38 @@ bool ComponentManagerImpl::RemoveComponentArrayItem(const std::string& path,
         path.c_str());
   }
 
-  if (!array_value->Remove(index, nullptr)) {
+  std::unique_ptr<base::Value> removed;
+  if (!array_value->Remove(index, &removed)) {
     return Error::AddToPrintf(
         error, FROM_HERE, errors::commands::kInvalidState,
         "Component array '%s' at path '%s' does not have an element %zu",
         name.c_str(), path.c_str(), index);
   }
 
-  for (const auto& cb : on_componet_tree_changed_)
-    cb.Run();
+  const ComponentNode* parent = FindComponentNode(path);
+  if (!IsSimpleName(name, kPathSpecialChars)) {
+    // The components can't be addressed by a path, so they are not indexed.
+  } else if (path.empty() || parent) {
+    // Only the items after the removed one are moved in the index, keeping
+    // their nodes, so the handles of their state properties stay valid.
+    std::string array_path = parent ? parent->path + '.' + name : name;
+    base::DictionaryValue* component = nullptr;
+    if (removed->GetAsDictionary(&component)) {
+      MoveComponentTree(
+          base::StringPrintf("%s[%zu]", array_path.c_str(), index), {},
+          *component);
+    }
+    for (size_t i = index; i < array_value->GetSize(); i++) {
+      if (array_value->GetDictionary(i, &component)) {
+        MoveComponentTree(
+            base::StringPrintf("%s[%zu]", array_path.c_str(), i + 1),
+            base::StringPrintf("%s[%zu]", array_path.c_str(), i), *component);
+      }
+    }
+  } else {
+    RebuildComponentIndex();
+  }
+  NotifyComponentTreeChanged();
   return true;
 }
 
@@ -211,6 +482,56 @@ void ComponentManagerImpl::AddComponentTreeChangedCallback(
   callback.Run();
 }
 
+void ComponentManagerImpl::NotifyComponentTreeChanged() {
+  components_for_role_.clear();
+  components_snapshot_.reset();
+  components_fingerprint_ = 0;
+  SchedulePublishComponentsView();
+  if (component_tree_changed_pending_)
+    return;
+  component_tree_changed_pending_ = true;
+  task_runner_->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&ComponentManagerImpl::RunComponentTreeChangedCallbacks,
+                 weak_ptr_factory_.GetWeakPtr()),
+      {});
+}
+
+void ComponentManagerImpl::RunComponentTreeChangedCallbacks() {
+  component_tree_changed_pending_ = false;
+  for (const auto& cb : on_componet_tree_changed_)
+    cb.Run();
+}
+
+void ComponentManagerImpl::EnableComponentsView() {
+  if (components_view_enabled_)
+    return;
+  components_view_enabled_ = true;
+  PublishComponentsView();
+}
+
+std::shared_ptr<const base::DictionaryValue>
+ComponentManagerImpl::GetComponentsView() const {
+  return std::atomic_load(&components_view_);
+}
+
+void ComponentManagerImpl::SchedulePublishComponentsView() {
+  if (!components_view_enabled_ || components_view_pending_)
+    return;
+  components_view_pending_ = true;
+  task_runner_->PostDelayedTask(
+      FROM_HERE, base::Bind(&ComponentManagerImpl::PublishComponentsView,
+                            weak_ptr_factory_.GetWeakPtr()),
+      {});
+}
+
+void ComponentManagerImpl::PublishComponentsView() {
+  components_view_pending_ = false;
+  // The snapshot is shared with the other users of GetComponentsSnapshot(),
+  // so an unchanged tree isn't copied again.
+  std::atomic_store(&components_view_, GetComponentsSnapshot());
+}
+
 bool ComponentManagerImpl::LoadTraits(const base::DictionaryValue& dict,
                                       ErrorPtr* error) {
   bool modified = false;
@@ -225,26 +546,79 @@ bool ComponentManagerImpl::LoadTraits(const base::DictionaryValue& dict,
       break;
     }
     const base::DictionaryValue* existing_def = nullptr;
-    if (traits_.GetDictionary(it.key(), &existing_def)) {
+    std::unique_ptr<base::Value> pending_def;
+    auto pending = pending_traits_.find(it.key());
+    if (pending != pending_traits_.end()) {
+      pending_def = CreatePendingTraitValue(pending->second);
+      pending_def->GetAsDictionary(&existing_def);
+    } else {
+      traits_.GetDictionary(it.key(), &existing_def);
+    }
+    if (existing_def) {
       if (!existing_def->Equals(&it.value())) {
         Error::AddToPrintf(error, FROM_HERE, errors::commands::kTypeMismatch,
                            "Trait '%s' cannot be redefined", it.key().c_str());
         result = false;
         break;
       }
+    } else if (lazy_traits_) {
+      JsonStreamWriter writer{&pending_traits_[it.key()].json};
+      writer.WriteValue(it.value());
     } else {
+      const base::DictionaryValue* definition = nullptr;
+      CHECK(it.value().GetAsDictionary(&definition));
+      TraitSchemas schemas;
+      if (!CompileTraitSchemas(it.key(), *definition, &schemas, error)) {
+        result = false;
+        break;
+      }
       traits_.Set(it.key(), it.value().CreateDeepCopy());
+      CHECK(traits_.GetDictionary(it.key(), &definition));
+      AddTraitDefinitionTables(it.key(), *definition, &schemas);
       modified = true;
     }
   }
 
-  if (modified) {
-    for (const auto& cb : on_trait_changed_)
-      cb.Run();
-  }
+  if (modified)
+    NotifyTraitDefsChanged();
   return result;
 }
 
+const std::string& ComponentManagerImpl::GetTraitsJson() const {
+  if (traits_json_.empty()) {
+    JsonStreamWriter writer{&traits_json_};
+    writer.WriteValue(traits_);
+  }
+  return traits_json_;
+}
+
+uint64_t ComponentManagerImpl::GetTraitsFingerprint() const {
+  if (!traits_fingerprint_) {
+    uint64_t hash = kFnvOffsetBasis;
+    HashValue(traits_, &hash);
+    traits_fingerprint_ = FinishFingerprint(hash);
+  }
+  return traits_fingerprint_;
+}
+
+uint64_t ComponentManagerImpl::GetStateFingerprint() const {
+  if (!state_fingerprint_) {
+    uint64_t hash = kFnvOffsetBasis;
+    HashComponentStates(GetComponents(), "", &hash);
+    state_fingerprint_ = FinishFingerprint(hash);
+  }
+  return state_fingerprint_;
+}
+
+uint64_t ComponentManagerImpl::GetComponentsFingerprint() const {
+  if (!components_fingerprint_) {
+    uint64_t hash = kFnvOffsetBasis;
+    HashValue(GetComponents(), &hash);
+    components_fingerprint_ = FinishFingerprint(hash);
+  }
+  return components_fingerprint_;
+}
+
 bool ComponentManagerImpl::LoadTraits(const std::string& json,
                                       ErrorPtr* error) {
   std::unique_ptr<const base::DictionaryValue> dict = LoadJsonDict(json, error);
@@ -253,17 +627,217 @@ bool ComponentManagerImpl::LoadTraits(const std::string& json,
   return LoadTraits(*dict, error);
 }
 
+bool ComponentManagerImpl::LoadTraits(const EmbeddedValue& table,
+                                      ErrorPtr* error) {
+  if (lazy_traits_ && table.type == EmbeddedValue::Type::kDictionary) {
+    // New traits only keep a pointer into the table. The rest is checked by
+    // the overload above, as usual.
+    base::DictionaryValue checked;
+    const base::DictionaryValue* existing_def = nullptr;
+    for (size_t i = 0; i < table.child_count; ++i) {
+      const EmbeddedValue& trait = table.children[i];
+      if (trait.type == EmbeddedValue::Type::kDictionary &&
+          !pending_traits_.count(trait.key) &&
+          !traits_.GetDictionary(trait.key, &existing_def)) {
+        pending_traits_[trait.key].table = &trait;
+      } else {
+        checked.Set(trait.key, CreateValueFromEmbedded(trait));
+      }
+    }
+    return LoadTraits(checked, error);
+  }
+  std::unique_ptr<const base::DictionaryValue> dict =
+      LoadEmbeddedDict(table, error);
+  if (!dict)
+    return false;
+  return LoadTraits(*dict, error);
+}
+
+std::unique_ptr<base::Value> ComponentManagerImpl::CreatePendingTraitValue(
+    const PendingTrait& trait) {
+  if (trait.table)
+    return CreateValueFromEmbedded(*trait.table);
+  JsonStreamReader reader{trait.json};
+  reader.Next();
+  return reader.ReadValue();
+}
+
+bool ComponentManagerImpl::MaterializeTrait(const std::string& name,
+                                            ErrorPtr* error) {
+  auto pending = pending_traits_.find(name);
+  if (pending == pending_traits_.end())
+    return true;
+  std::unique_ptr<base::Value> value = CreatePendingTraitValue(pending->second);
+  const base::DictionaryValue* definition = nullptr;
+  TraitSchemas schemas;
+  CHECK(value->GetAsDictionary(&definition));
+  if (!CompileTraitSchemas(name, *definition, &schemas, error))
+    return false;
+  pending_traits_.erase(pending);
+  traits_.Set(name, std::move(value));
+  CHECK(traits_.GetDictionary(name, &definition));
+  AddTraitDefinitionTables(name, *definition, &schemas);
+  NotifyTraitDefsChanged();
+  return true;
+}
+
+void ComponentManagerImpl::WriteSnapshot(JsonStreamWriter* writer) const {
+  writer->BeginDictionary();
+  writer->WriteKey("traits");
+  writer->WriteJson(GetTraitsJson());
+  writer->WriteKey("components");
+  writer->WriteValue(GetComponents());
+  writer->EndDictionary();
+}
+
+bool ComponentManagerImpl::RestoreSnapshot(
+    const base::DictionaryValue& snapshot,
+    ErrorPtr* error) {
+  const base::DictionaryValue* traits = nullptr;
+  const base::DictionaryValue* components = nullptr;
+  if (!snapshot.GetDictionary("traits", &traits) ||
+      !snapshot.GetDictionary("components", &components)) {
+    return Error::AddTo(error, FROM_HERE, errors::commands::kTypeMismatch,
+                        "Snapshot must have traits and components");
+  }
+  // Nothing is changed unless the whole snapshot is valid.
+  if (!ValidateSnapshotComponents(*traits, *components, error))
+    return false;
+  for (base::DictionaryValue::Iterator it(*traits); !it.IsAtEnd();
+       it.Advance()) {
+    const base::DictionaryValue* definition = nullptr;
+    const base::DictionaryValue* existing_def = nullptr;
+    TraitSchemas schemas;
+    if (!it.value().GetAsDictionary(&definition) ||
+        (traits_.GetDictionary(it.key(), &existing_def)
+             ? !existing_def->Equals(definition)
+             : !CompileTraitSchemas(it.key(), *definition, &schemas, error))) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kTypeMismatch,
+                                "Invalid definition of trait '%s'",
+                                it.key().c_str());
+    }
+  }
+
+  CHECK(LoadTraits(*traits, error));
+  // The snapshot only has the traits which are in use.
+  for (base::DictionaryValue::Iterator it(*traits); !it.IsAtEnd();
+       it.Advance()) {
+    CHECK(MaterializeTrait(it.key(), error));
+  }
+  bool modified = false;
+  for (base::DictionaryValue::Iterator it(*components); !it.IsAtEnd();
+       it.Advance()) {
+    if (components_.GetWithoutPathExpansion(it.key(), nullptr))
+      continue;
+    components_.SetWithoutPathExpansion(it.key(), it.value().CreateDeepCopy());
+    modified = true;
+  }
+  if (modified) {
+    RebuildComponentIndex();
+    NotifyComponentTreeChanged();
+  }
+  return true;
+}
+
+bool ComponentManagerImpl::ValidateSnapshotComponents(
+    const base::DictionaryValue& traits,
+    const base::DictionaryValue& components,
+    ErrorPtr* error) {
+  for (base::DictionaryValue::Iterator it(components); !it.IsAtEnd();
+       it.Advance()) {
+    std::vector<const base::DictionaryValue*> items;
+    const base::DictionaryValue* component = nullptr;
+    const base::ListValue* component_array = nullptr;
+    if (it.value().GetAsDictionary(&component)) {
+      items.push_back(component);
+    } else if (it.value().GetAsList(&component_array)) {
+      for (const auto& item : *component_array) {
+        if (!item->GetAsDictionary(&component))
+          break;
+        items.push_back(component);
+      }
+    }
+    if (items.empty() && !component_array) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kTypeMismatch,
+                                "Invalid component '%s'", it.key().c_str());
+    }
+    if (component_array && items.size() != component_array->GetSize()) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kTypeMismatch,
+                                "Invalid component array '%s'",
+                                it.key().c_str());
+    }
+    for (const base::DictionaryValue* item : items) {
+      const base::ListValue* trait_list = nullptr;
+      if (!item->GetList("traits", &trait_list)) {
+        return Error::AddToPrintf(error, FROM_HERE,
+                                  errors::commands::kTypeMismatch,
+                                  "Component '%s' has no traits",
+                                  it.key().c_str());
+      }
+      for (const auto& trait : *trait_list) {
+        std::string name;
+        if (!trait->GetAsString(&name) ||
+            !traits.GetDictionaryWithoutPathExpansion(name, nullptr)) {
+          return Error::AddToPrintf(error, FROM_HERE,
+                                    errors::commands::kInvalidPropValue,
+                                    "Component '%s' has an undefined trait",
+                                    it.key().c_str());
+        }
+      }
+      const base::Value* sub_components = nullptr;
+      const base::DictionaryValue* sub_components_dict = nullptr;
+      if (item->Get("components", &sub_components) &&
+          (!sub_components->GetAsDictionary(&sub_components_dict) ||
+           !ValidateSnapshotComponents(traits, *sub_components_dict, error))) {
+        return Error::AddToPrintf(error, FROM_HERE,
+                                  errors::commands::kTypeMismatch,
+                                  "Invalid sub-components of '%s'",
+                                  it.key().c_str());
+      }
+    }
+  }
+  return true;
+}
+
 void ComponentManagerImpl::AddTraitDefChangedCallback(
     const base::Closure& callback) {
   on_trait_changed_.push_back(callback);
   callback.Run();
 }
 
+void ComponentManagerImpl::NotifyTraitDefsChanged() {
+  traits_json_.clear();
+  traits_fingerprint_ = 0;
+  // Visibility of state properties depends on the trait definitions.
+  components_for_role_.clear();
+  if (trait_defs_changed_pending_)
+    return;
+  trait_defs_changed_pending_ = true;
+  task_runner_->PostDelayedTask(
+      FROM_HERE, base::Bind(&ComponentManagerImpl::RunTraitDefChangedCallbacks,
+                            weak_ptr_factory_.GetWeakPtr()),
+      {});
+}
+
+void ComponentManagerImpl::RunTraitDefChangedCallbacks() {
+  trait_defs_changed_pending_ = false;
+  for (const auto& cb : on_trait_changed_)
+    cb.Run();
+}
+
 void ComponentManagerImpl::AddCommand(
     std::unique_ptr<CommandInstance> command_instance) {
   command_queue_.Add(std::move(command_instance));
 }
 
+void ComponentManagerImpl::AddCommands(
+    std::vector<std::unique_ptr<CommandInstance>> command_instances) {
+  command_queue_.Add(std::move(command_instances));
+}
+
 std::unique_ptr<CommandInstance> ComponentManagerImpl::ParseCommandInstance(
     const base::DictionaryValue& command,
     Command::Origin command_origin,
@@ -281,7 +855,28 @@ std::unique_ptr<CommandInstance> ComponentManagerImpl::ParseCommandInstance(
 
   if (!command_instance)
     return nullptr;
+  return CheckCommandInstance(std::move(command_instance), role, id, error);
+}
+
+std::unique_ptr<CommandInstance> ComponentManagerImpl::CreateCommandInstance(
+    const std::string& component,
+    const std::string& name,
+    const base::DictionaryValue& parameters,
+    Command::Origin command_origin,
+    UserRole role,
+    std::string* id,
+    ErrorPtr* error) {
+  std::unique_ptr<CommandInstance> command_instance{
+      new CommandInstance{name, command_origin, parameters}};
+  command_instance->SetComponent(component);
+  return CheckCommandInstance(std::move(command_instance), role, id, error);
+}
 
+std::unique_ptr<CommandInstance> ComponentManagerImpl::CheckCommandInstance(
+    std::unique_ptr<CommandInstance> command_instance,
+    UserRole role,
+    std::string* id,
+    ErrorPtr* error) {
   UserRole minimal_role;
   if (!GetCommandMinimalRole(command_instance->GetName(), &minimal_role, error))
     return nullptr;
@@ -297,8 +892,9 @@ std::unique_ptr<CommandInstance> ComponentManagerImpl::ParseCommandInstance(
   if (component_path.empty()) {
     // Find the component to which to route this command. Get the trait name
     // from the command name and find the first component that has this trait.
-    auto trait_name =
-        SplitAtFirst(command_instance->GetName(), ".", true).first;
+    std::string trait_name =
+        SplitPieceAtFirst(command_instance->GetName(), ".", true)
+            .first.as_string();
     component_path = FindComponentWithTrait(trait_name);
     if (component_path.empty()) {
       return Error::AddToPrintf(
@@ -315,33 +911,40 @@ std::unique_ptr<CommandInstance> ComponentManagerImpl::ParseCommandInstance(
     return nullptr;
 
   // Check that the command's trait is supported by the given component.
-  auto pair = SplitAtFirst(command_instance->GetName(), ".", true);
-
-  bool trait_supported = false;
-  const base::ListValue* supported_traits = nullptr;
-  if (component->GetList("traits", &supported_traits)) {
-    for (const auto& value : *supported_traits) {
-      std::string trait;
-      CHECK(value->GetAsString(&trait));
-      if (trait == pair.first) {
-        trait_supported = true;
-        break;
-      }
-    }
-  }
+  auto pair = SplitPieceAtFirst(command_instance->GetName(), ".", true);
 
-  if (!trait_supported) {
+  if (!ComponentHasTrait(component_path, *component,
+                         pair.first.as_string())) {
     return Error::AddToPrintf(error, FROM_HERE, "trait_not_supported",
                               "Component '%s' doesn't support trait '%s'",
-                              component_path.c_str(), pair.first.c_str());
+                              component_path.c_str(),
+                              pair.first.as_string().c_str());
+  }
+
+  const TraitMemberDefinition* definition =
+      FindTraitMember(command_definitions_, command_instance->GetName());
+  CHECK(definition);
+  if (definition->validator &&
+      !definition->validator->Validate(command_instance->GetParameters(),
+                                       error)) {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::commands::kInvalidPropValue,
+                              "Invalid parameters of command '%s'",
+                              command_instance->GetName().c_str());
   }
 
-  if (command_id.empty()) {
-    command_id = std::to_string(++next_command_id_);
-    command_instance->SetID(command_id);
-    if (id)
-      *id = command_id;
+  // The deadline set by the cloud goes first.
+  if (command_instance->GetDeadline().is_null() &&
+      !definition->expiration_timeout.is_zero()) {
+    command_instance->SetDeadline(clock_->Now() +
+                                  definition->expiration_timeout);
   }
+  command_instance->SetSuperseding(definition->superseding);
+
+  if (command_instance->GetID().empty())
+    command_instance->SetID(std::to_string(++next_command_id_));
+  if (id)
+    *id = command_instance->GetID();
 
   return command_instance;
 }
@@ -366,16 +969,58 @@ void ComponentManagerImpl::AddCommandHandler(
     const Device::CommandHandlerCallback& callback) {
   // If both component_path and command_name are empty, we are adding the
   // default handler for all commands.
-  if (!component_path.empty() || !command_name.empty()) {
+  const size_t size = command_name.size();
+  CHECK(MaterializeTrait(command_name.substr(0, command_name.find('.')),
+                         nullptr))
+      << "Invalid trait: " << command_name;
+  if (size > 2 && command_name.compare(size - 2, 2, ".*") == 0) {
+    CHECK(FindTraitDefinition(command_name.substr(0, size - 2)))
+        << "Trait undefined: " << command_name;
+  } else if (!component_path.empty() || !command_name.empty()) {
     CHECK(FindCommandDefinition(command_name)) << "Command undefined: "
                                                << command_name;
   }
   command_queue_.AddCommandHandler(component_path, command_name, callback);
 }
 
+bool ComponentManagerImpl::SetCommandHandlerPolicy(
+    const std::string& component_path,
+    const std::string& command_name,
+    const CommandHandlerPolicy& policy,
+    ErrorPtr* error) {
+  const size_t size = command_name.size();
+  if (!MaterializeTrait(command_name.substr(0, command_name.find('.')),
+                        error)) {
+    return false;
+  }
+  if (size > 2 && command_name.compare(size - 2, 2, ".*") == 0) {
+    if (!FindTraitDefinition(command_name.substr(0, size - 2))) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kInvalidCommandName,
+                                "Trait undefined: '%s'", command_name.c_str());
+    }
+  } else if (!command_name.empty()) {
+    if (!FindCommandDefinition(command_name)) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kInvalidCommandName,
+                                "Command undefined: '%s'",
+                                command_name.c_str());
+    }
+  } else if (!component_path.empty()) {
+    return Error::AddTo(error, FROM_HERE, errors::commands::kInvalidCommandName,
+                        "Default handler must not be component-specific");
+  }
+  command_queue_.SetCommandHandlerPolicy(component_path, command_name, policy);
+  return true;
+}
+
 const base::DictionaryValue* ComponentManagerImpl::FindComponent(
     const std::string& path,
     ErrorPtr* error) const {
+  FlushStateSlots();
+  const ComponentNode* node = FindComponentNode(path);
+  if (node)
+    return node->component;
   return FindComponentAt(&components_, path, error);
 }
 
@@ -388,46 +1033,34 @@ const base::DictionaryValue* ComponentManagerImpl::FindTraitDefinition(
 
 const base::DictionaryValue* ComponentManagerImpl::FindCommandDefinition(
     const std::string& command_name) const {
-  const base::DictionaryValue* definition = nullptr;
-  std::vector<std::string> components = Split(command_name, ".", true, false);
-  // Make sure the |command_name| came in form of trait_name.command_name.
-  if (components.size() != 2)
-    return definition;
-  std::string key = base::StringPrintf("%s.commands.%s", components[0].c_str(),
-                                       components[1].c_str());
-  traits_.GetDictionary(key, &definition);
-  return definition;
+  const TraitMemberDefinition* command =
+      FindTraitMember(command_definitions_, command_name);
+  return command ? command->definition : nullptr;
 }
 
 const base::DictionaryValue* ComponentManagerImpl::FindStateDefinition(
     const std::string& state_property_name) const {
-  const base::DictionaryValue* definition = nullptr;
-  std::vector<std::string> components =
-      Split(state_property_name, ".", true, false);
-  // Make sure the |state_property_name| came in form of trait_name.state_name.
-  if (components.size() != 2)
-    return definition;
-  std::string key = base::StringPrintf("%s.state.%s", components[0].c_str(),
-                                       components[1].c_str());
-  traits_.GetDictionary(key, &definition);
-  return definition;
+  const TraitMemberDefinition* state =
+      FindTraitMember(state_definitions_, state_property_name);
+  return state ? state->definition : nullptr;
 }
 
 bool ComponentManagerImpl::GetCommandMinimalRole(
     const std::string& command_name,
     UserRole* minimal_role,
     ErrorPtr* error) const {
-  const base::DictionaryValue* command = FindCommandDefinition(command_name);
+  const TraitMemberDefinition* command =
+      FindTraitMember(command_definitions_, command_name);
   if (!command) {
     return Error::AddToPrintf(
         error, FROM_HERE, errors::commands::kInvalidCommandName,
         "Command definition for '%s' not found", command_name.c_str());
   }
-  std::string value;
   // The JSON definition has been pre-validated already in LoadCommands, so
   // just using CHECKs here.
-  CHECK(command->GetString(kMinimalRole, &value));
-  CHECK(StringToEnum(value, minimal_role));
+  CHECK(command->has_minimal_role) << "Invalid minimal role of command "
+                                   << command_name;
+  *minimal_role = command->minimal_role;
   return true;
 }
 
@@ -435,84 +1068,575 @@ bool ComponentManagerImpl::GetStateMinimalRole(
     const std::string& state_property_name,
     UserRole* minimal_role,
     ErrorPtr* error) const {
-  const base::DictionaryValue* state = FindStateDefinition(state_property_name);
+  const TraitMemberDefinition* state =
+      FindTraitMember(state_definitions_, state_property_name);
   if (!state) {
     return Error::AddToPrintf(error, FROM_HERE, errors::commands::kInvalidState,
                               "State definition for '%s' not found",
                               state_property_name.c_str());
   }
-  std::string value;
-  if (state->GetString(kMinimalRole, &value)) {
-    CHECK(StringToEnum(value, minimal_role));
-  } else {
-    *minimal_role = UserRole::kUser;
-  }
+  CHECK(state->has_minimal_role) << "Invalid minimal role of state property "
+                                 << state_property_name;
+  *minimal_role = state->minimal_role;
   return true;
 }
 
+const ComponentManagerImpl::TraitMemberDefinition*
+ComponentManagerImpl::FindTraitMember(const TraitMemberTable& table,
+                                      const std::string& name) {
+  auto p = table.find(name);
+  if (p != table.end())
+    return &p->second;
+  // Make sure the |name| came in form of trait_name.member_name.
+  if (std::count(name.begin(), name.end(), '.') != 1)
+    return nullptr;
+  // Whitespaces around the trait and member names are allowed.
+  auto parts = SplitPieceAtFirst(name, ".", true);
+  std::string trimmed_name;
+  trimmed_name.reserve(parts.first.size() + 1 + parts.second.size());
+  parts.first.AppendToString(&trimmed_name);
+  trimmed_name.push_back('.');
+  parts.second.AppendToString(&trimmed_name);
+  p = table.find(trimmed_name);
+  return p != table.end() ? &p->second : nullptr;
+}
+
 void ComponentManagerImpl::AddStateChangedCallback(
     const base::Closure& callback) {
   on_state_changed_.push_back(callback);
   callback.Run();  // Force to read current state.
 }
 
-std::unique_ptr<base::DictionaryValue>
+std::shared_ptr<const base::DictionaryValue>
 ComponentManagerImpl::GetComponentsForUserRole(UserRole role) const {
-  auto components = components_.CreateDeepCopy();
-  // Build a list of all state properties that are inaccessible to the given
-  // user. These properties will be removed from the components collection
-  // returned from this method.
-  for (base::DictionaryValue::Iterator it_component(components_);
-       !it_component.IsAtEnd(); it_component.Advance()) {
-    base::DictionaryValue* component = nullptr;
-    CHECK(components->GetDictionary(it_component.key(), &component));
-    RemoveInaccessibleState(this, component, role);
+  FlushStateSlots();
+  auto& snapshot = components_for_role_[role];
+  if (snapshot)
+    return snapshot;
+
+  std::unique_ptr<base::DictionaryValue> components{new base::DictionaryValue};
+  for (base::DictionaryValue::Iterator it(components_); !it.IsAtEnd();
+       it.Advance()) {
+    const base::DictionaryValue* component = nullptr;
+    CHECK(it.value().GetAsDictionary(&component));
+    components->SetWithoutPathExpansion(
+        it.key(), CopyComponentForUserRole(*component, role, {}));
   }
+  snapshot = std::move(components);
+  return snapshot;
+}
 
-  return components;
+std::shared_ptr<const base::DictionaryValue>
+ComponentManagerImpl::GetComponentsSnapshot() const {
+  FlushStateSlots();
+  if (!components_snapshot_)
+    components_snapshot_ = components_.CreateDeepCopy();
+  return components_snapshot_;
 }
 
-bool ComponentManagerImpl::SetStateProperties(const std::string& component_path,
-                                              const base::DictionaryValue& dict,
-                                              ErrorPtr* error) {
-  base::DictionaryValue* component =
-      FindMutableComponent(component_path, error);
+std::unique_ptr<base::DictionaryValue>
+ComponentManagerImpl::GetComponentForUserRole(
+    const std::string& component_path,
+    UserRole role,
+    const std::set<std::string>& fields,
+    ErrorPtr* error) const {
+  const base::DictionaryValue* component = FindComponent(component_path, error);
   if (!component)
-    return false;
-
-  base::DictionaryValue* state = nullptr;
-  if (!component->GetDictionary("state", &state)) {
-    state = new base::DictionaryValue;
-    component->Set("state", state);
-  }
-  state->MergeDictionary(&dict);
-  last_state_change_id_++;
-  auto& queue = state_change_queues_[component_path];
-  if (!queue)
-    queue.reset(new StateChangeQueue{kMaxStateChangeQueueSize});
-  base::Time timestamp = clock_->Now();
-  queue->NotifyPropertiesUpdated(timestamp, dict);
-  for (const auto& cb : on_state_changed_)
-    cb.Run();
-  return true;
+    return nullptr;
+  return CopyComponentForUserRole(*component, role, fields);
 }
 
-bool ComponentManagerImpl::SetStatePropertiesFromJson(
+bool ComponentManagerImpl::CompileTraitSchemas(
+    const std::string& name,
+    const base::DictionaryValue& definition,
+    TraitSchemas* schemas,
+    ErrorPtr* error) {
+  const base::DictionaryValue* commands = nullptr;
+  if (definition.GetDictionary("commands", &commands)) {
+    for (base::DictionaryValue::Iterator it(*commands); !it.IsAtEnd();
+         it.Advance()) {
+      const base::DictionaryValue* command = nullptr;
+      const base::DictionaryValue* parameters = nullptr;
+      if (!it.value().GetAsDictionary(&command) ||
+          !command->GetDictionary("parameters", &parameters)) {
+        continue;
+      }
+      auto validator = SchemaValidator::CreateForProperties(*parameters, error);
+      if (!validator) {
+        return Error::AddToPrintf(
+            error, FROM_HERE, errors::commands::kInvalidPropValue,
+            "Invalid parameters of command '%s.%s'", name.c_str(),
+            it.key().c_str());
+      }
+      schemas->commands[it.key()] = std::move(validator);
+    }
+  }
+
+  const base::DictionaryValue* state = nullptr;
+  if (!definition.GetDictionary("state", &state))
+    return true;
+  for (base::DictionaryValue::Iterator it(*state); !it.IsAtEnd();
+       it.Advance()) {
+    const base::DictionaryValue* property = nullptr;
+    if (!it.value().GetAsDictionary(&property))
+      continue;
+    auto validator = SchemaValidator::Create(*property, error);
+    if (!validator) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kInvalidPropValue,
+                                "Invalid schema of state property '%s.%s'",
+                                name.c_str(), it.key().c_str());
+    }
+    schemas->state[it.key()] = std::move(validator);
+  }
+  return true;
+}
+
+void ComponentManagerImpl::AddTraitDefinitionTables(
+    const std::string& name,
+    const base::DictionaryValue& definition,
+    TraitSchemas* schemas) {
+  TraitStateRoles& roles = state_roles_[name];
+  const bool simple_name = IsSimpleName(name, ".");
+
+  const base::DictionaryValue* commands = nullptr;
+  if (simple_name && definition.GetDictionary("commands", &commands)) {
+    for (base::DictionaryValue::Iterator it(*commands); !it.IsAtEnd();
+         it.Advance()) {
+      TraitMemberDefinition command;
+      if (!IsSimpleName(it.key(), ".") ||
+          !it.value().GetAsDictionary(&command.definition)) {
+        continue;
+      }
+      std::string value;
+      command.has_minimal_role =
+          command.definition->GetString(kMinimalRole, &value) &&
+          StringToEnum(value, &command.minimal_role);
+      int timeout_ms = 0;
+      if (command.definition->GetInteger(kExpirationTimeoutMs, &timeout_ms) &&
+          timeout_ms > 0) {
+        command.expiration_timeout =
+            base::TimeDelta::FromMilliseconds(timeout_ms);
+      }
+      command.definition->GetBoolean(kSuperseding, &command.superseding);
+      command.validator = std::move(schemas->commands[it.key()]);
+      command_definitions_[Join(".", name, it.key())] = std::move(command);
+    }
+  }
+
+  const base::DictionaryValue* state = nullptr;
+  if (!definition.GetDictionary("state", &state))
+    return;
+  for (base::DictionaryValue::Iterator it(*state); !it.IsAtEnd();
+       it.Advance()) {
+    TraitMemberDefinition property;
+    if (!it.value().GetAsDictionary(&property.definition))
+      continue;
+    std::string value;
+    property.has_minimal_role =
+        !property.definition->GetString(kMinimalRole, &value) ||
+        StringToEnum(value, &property.minimal_role);
+    if (!property.has_minimal_role) {
+      // Leave invalid definitions to IsStatePropertyVisible() and make sure the
+      // trait state is always filtered property by property.
+      roles.max_role = UserRole::kOwner;
+    } else {
+      roles.properties[it.key()] = property.minimal_role;
+      roles.max_role = std::max(roles.max_role, property.minimal_role);
+    }
+    property.validator = std::move(schemas->state[it.key()]);
+    bool local_only = false;
+    if (property.definition->GetBoolean(kLocalOnly, &local_only) && local_only)
+      local_only_state_.insert(Join(".", name, it.key()));
+    if (simple_name && IsSimpleName(it.key(), "."))
+      state_definitions_[Join(".", name, it.key())] = std::move(property);
+  }
+}
+
+std::unique_ptr<base::DictionaryValue>
+ComponentManagerImpl::CopyComponentForUserRole(
+    const base::DictionaryValue& component,
+    UserRole role,
+    const std::set<std::string>& fields) const {
+  std::unique_ptr<base::DictionaryValue> copy{new base::DictionaryValue};
+  for (base::DictionaryValue::Iterator it(component); !it.IsAtEnd();
+       it.Advance()) {
+    if (!fields.empty() && fields.find(it.key()) == fields.end())
+      continue;
+    const base::DictionaryValue* dict = nullptr;
+    if (it.key() == "state" && it.value().GetAsDictionary(&dict)) {
+      auto state = CopyStateForUserRole(*dict, role);
+      if (state)
+        copy->SetWithoutPathExpansion(it.key(), std::move(state));
+    } else if (it.key() == "components" && it.value().GetAsDictionary(&dict)) {
+      std::unique_ptr<base::DictionaryValue> sub_components{
+          new base::DictionaryValue};
+      for (base::DictionaryValue::Iterator it_sub(*dict); !it_sub.IsAtEnd();
+           it_sub.Advance()) {
+        const base::DictionaryValue* sub_component = nullptr;
+        const base::ListValue* component_array = nullptr;
+        if (it_sub.value().GetAsDictionary(&sub_component)) {
+          sub_components->SetWithoutPathExpansion(
+              it_sub.key(),
+              CopyComponentForUserRole(*sub_component, role, fields));
+        } else if (it_sub.value().GetAsList(&component_array)) {
+          std::unique_ptr<base::ListValue> array_copy{new base::ListValue};
+          for (const auto& item : *component_array) {
+            CHECK(item->GetAsDictionary(&sub_component));
+            array_copy->Append(
+                CopyComponentForUserRole(*sub_component, role, fields));
+          }
+          sub_components->SetWithoutPathExpansion(it_sub.key(),
+                                                  std::move(array_copy));
+        } else {
+          sub_components->SetWithoutPathExpansion(
+              it_sub.key(), it_sub.value().CreateDeepCopy());
+        }
+      }
+      copy->SetWithoutPathExpansion(it.key(), std::move(sub_components));
+    } else {
+      copy->SetWithoutPathExpansion(it.key(), it.value().CreateDeepCopy());
+    }
+  }
+  return copy;
+}
+
+std::unique_ptr<base::DictionaryValue>
+ComponentManagerImpl::CopyStateForUserRole(const base::DictionaryValue& state,
+                                           UserRole role) const {
+  std::unique_ptr<base::DictionaryValue> copy{new base::DictionaryValue};
+  bool removed = false;
+  for (base::DictionaryValue::Iterator it_trait(state); !it_trait.IsAtEnd();
+       it_trait.Advance()) {
+    const base::DictionaryValue* trait = nullptr;
+    CHECK(it_trait.value().GetAsDictionary(&trait));
+    auto p = state_roles_.find(it_trait.key());
+    const TraitStateRoles* roles =
+        p != state_roles_.end() ? &p->second : nullptr;
+    if (roles && role >= roles->max_role) {
+      // Everything is visible, no need to look at individual properties.
+      copy->SetWithoutPathExpansion(it_trait.key(), trait->CreateDeepCopy());
+      continue;
+    }
+    std::unique_ptr<base::DictionaryValue> trait_copy{
+        new base::DictionaryValue};
+    for (base::DictionaryValue::Iterator it_prop(*trait); !it_prop.IsAtEnd();
+         it_prop.Advance()) {
+      if (IsStatePropertyVisible(it_trait.key(), roles, it_prop.key(), role)) {
+        trait_copy->SetWithoutPathExpansion(it_prop.key(),
+                                            it_prop.value().CreateDeepCopy());
+      } else {
+        removed = true;
+      }
+    }
+    // Drop traits that became empty after filtering, but keep empty ones.
+    if (!trait_copy->empty() || trait->empty())
+      copy->SetWithoutPathExpansion(it_trait.key(), std::move(trait_copy));
+  }
+  if (removed && copy->empty())
+    return nullptr;
+  return copy;
+}
+
+bool ComponentManagerImpl::IsStatePropertyVisible(
+    const std::string& trait,
+    const TraitStateRoles* roles,
+    const std::string& property,
+    UserRole role) const {
+  if (roles) {
+    auto p = roles->properties.find(property);
+    if (p != roles->properties.end())
+      return p->second <= role;
+  }
+  // Undefined properties are not filtered out. Look the definition up
+  // directly, this runs for every property of every state snapshot.
+  const TraitMemberDefinition* state =
+      FindTraitMember(state_definitions_, trait + '.' + property);
+  if (!state)
+    return true;
+  CHECK(state->has_minimal_role) << "Invalid minimal role of state property "
+                                 << trait << '.' << property;
+  return state->minimal_role <= role;
+}
+
+bool ComponentManagerImpl::SetStateProperties(const std::string& component_path,
+                                              const base::DictionaryValue& dict,
+                                              ErrorPtr* error) {
+  return SetStateProperties(component_path, dict.CreateDeepCopy(), error);
+}
+
+bool ComponentManagerImpl::SetStateProperties(
+    const std::string& component_path,
+    std::unique_ptr<base::DictionaryValue> dict,
+    ErrorPtr* error) {
+  base::DictionaryValue* component =
+      FindMutableComponent(component_path, error);
+  if (!component || !ValidateState(*dict, error))
+    return false;
+
+  UpdateComponentState(component_path, component, std::move(dict));
+  return true;
+}
+
+bool ComponentManagerImpl::ValidateState(const base::DictionaryValue& state,
+                                         ErrorPtr* error) const {
+  for (base::DictionaryValue::Iterator trait(state); !trait.IsAtEnd();
+       trait.Advance()) {
+    const base::DictionaryValue* properties = nullptr;
+    if (!trait.value().GetAsDictionary(&properties))
+      continue;
+    for (base::DictionaryValue::Iterator it(*properties); !it.IsAtEnd();
+         it.Advance()) {
+      // Undefined properties are accepted as they always were.
+      const TraitMemberDefinition* property = FindTraitMember(
+          state_definitions_, Join(".", trait.key(), it.key()));
+      if (!property || !property->validator)
+        continue;
+      if (!property->validator->Validate(it.value(), error)) {
+        return Error::AddToPrintf(error, FROM_HERE,
+                                  errors::commands::kInvalidPropValue,
+                                  "Invalid value of state property '%s.%s'",
+                                  trait.key().c_str(), it.key().c_str());
+      }
+    }
+  }
+  return true;
+}
+
+void ComponentManagerImpl::UpdateComponentState(
+    const std::string& component_path,
+    base::DictionaryValue* component,
+    std::unique_ptr<base::DictionaryValue> dict) {
+  MergeComponentState(component_path, component, std::move(dict),
+                      clock_->Now());
+  OnStateChanged();
+}
+
+void ComponentManagerImpl::MergeComponentState(
+    const std::string& component_path,
+    base::DictionaryValue* component,
+    std::unique_ptr<base::DictionaryValue> dict,
+    base::Time timestamp) {
+  FlushStateSlots();
+  ComponentNode* node = FindComponentNodeFor(component_path, component);
+  base::DictionaryValue* state = nullptr;
+  if (!component->GetDictionary("state", &state)) {
+    RecordStateChange(node, component_path, component, timestamp, *dict);
+    component->Set("state", std::move(dict));
+    return;
+  }
+  // The queue keeps its own copy, the values of |dict| move into the state.
+  // Only the changed members of the object properties are recorded, so the
+  // patch of a large object is as small as the change.
+  std::unique_ptr<base::DictionaryValue> diff =
+      DiffObjectProperties(*state, *dict);
+  if (!diff)
+    RecordStateChange(node, component_path, component, timestamp, *dict);
+  else if (!diff->empty())
+    RecordStateChange(node, component_path, component, timestamp, *diff);
+  state->MergeDictionary(std::move(dict));
+}
+
+bool ComponentManagerImpl::RecordStateChange(
+    ComponentNode* node,
+    const std::string& component_path,
+    base::DictionaryValue* component,
+    base::Time timestamp,
+    const base::DictionaryValue& dict) {
+  StateChangeQueue* queue = GetStateChangeQueue(component_path, component);
+  if ((!node || node->publish_filters.empty()) && local_only_state_.empty())
+    return queue->NotifyPropertiesUpdated(timestamp, dict);
+
+  std::vector<std::string> filtered_out;
+  for (base::DictionaryValue::Iterator trait(dict); !trait.IsAtEnd();
+       trait.Advance()) {
+    const base::DictionaryValue* properties = nullptr;
+    if (!trait.value().GetAsDictionary(&properties))
+      continue;
+    for (base::DictionaryValue::Iterator it(*properties); !it.IsAtEnd();
+         it.Advance()) {
+      std::string name = Join(".", trait.key(), it.key());
+      if (local_only_state_.count(name) ||
+          (node && !ApplyPublishFilter(node, name, it.value(), timestamp))) {
+        filtered_out.push_back(std::move(name));
+      }
+    }
+  }
+  if (filtered_out.empty())
+    return queue->NotifyPropertiesUpdated(timestamp, dict);
+
+  std::unique_ptr<base::DictionaryValue> changes = dict.CreateDeepCopy();
+  for (const std::string& name : filtered_out) {
+    auto pair = SplitAtFirst(name, ".", true);
+    base::DictionaryValue* properties = nullptr;
+    CHECK(changes->GetDictionaryWithoutPathExpansion(pair.first, &properties));
+    properties->RemoveWithoutPathExpansion(pair.second, nullptr);
+    if (properties->empty())
+      changes->RemoveWithoutPathExpansion(pair.first, nullptr);
+  }
+  return !changes->empty() &&
+         queue->NotifyPropertiesUpdated(timestamp, *changes);
+}
+
+bool ComponentManagerImpl::ApplyPublishFilter(ComponentNode* node,
+                                              const std::string& name,
+                                              const base::Value& value,
+                                              base::Time timestamp) {
+  auto p = node->publish_filters.find(name);
+  if (p == node->publish_filters.end())
+    return true;
+  PublishFilter& filter = p->second;
+  if (filter.filter.local_only)
+    return false;
+  double number = 0;
+  if (!value.GetAsDouble(&number))
+    return true;
+  if (filter.published) {
+    double delta = std::abs(number - filter.value);
+    if (delta < filter.filter.deadband ||
+        delta < std::abs(filter.value) * filter.filter.deadband_percent / 100) {
+      return false;
+    }
+    base::TimeDelta wait = filter.time + filter.filter.min_interval - timestamp;
+    if (wait > base::TimeDelta{}) {
+      if (!filter.held) {
+        filter.held = true;
+        task_runner_->PostDelayedTask(
+            FROM_HERE, base::Bind(&ComponentManagerImpl::RecordHeldStateChange,
+                                  weak_ptr_factory_.GetWeakPtr(), node->path,
+                                  name),
+            wait);
+      }
+      return false;
+    }
+  }
+  filter.published = true;
+  filter.value = number;
+  filter.time = timestamp;
+  filter.held = false;
+  return true;
+}
+
+void ComponentManagerImpl::RecordHeldStateChange(
+    const std::string& component_path,
+    const std::string& name) {
+  FlushStateSlots();
+  ComponentNode* node = FindMutableComponentNode(component_path, nullptr);
+  if (!node)
+    return;
+  auto p = node->publish_filters.find(name);
+  const base::DictionaryValue* state = nullptr;
+  const base::Value* value = nullptr;
+  if (p == node->publish_filters.end() || !p->second.held ||
+      !node->component->GetDictionaryWithoutPathExpansion("state", &state) ||
+      !state->Get(name, &value)) {
+    return;
+  }
+  p->second.held = false;
+  base::DictionaryValue dict;
+  dict.Set(name, value->CreateDeepCopy());
+  if (RecordStateChange(node, node->path, node->component, clock_->Now(),
+                        dict)) {
+    OnStateChanged();
+  }
+}
+
+StateChangeQueue* ComponentManagerImpl::GetStateChangeQueue(
+    const std::string& component_path,
+    base::DictionaryValue* component) {
+  auto& queue = state_change_queues_[component_path];
+  if (!queue) {
+    const ComponentNode* node = FindComponentNodeFor(component_path, component);
+    queue.reset(new StateChangeQueue{node ? node->history_policy
+                                          : StateHistoryPolicy{}});
+  }
+  return queue.get();
+}
+
+void ComponentManagerImpl::FlushStateSlots() {
+  for (StatePropertyHandle handle : dirty_state_slots_) {
+    auto p = state_property_handles_.find(handle);
+    if (p == state_property_handles_.end())
+      continue;
+    StatePropertyRef& ref = p->second;
+    ref.slot_dirty = false;
+    base::DictionaryValue* component = ref.node->component;
+    component->Set("state." + ref.name, ref.slot->ToValue());
+    StateChangeQueue* queue = GetStateChangeQueue(ref.node->path, component);
+    if (queue->IsCoalescing()) {
+      base::DictionaryValue dict;
+      dict.Set(ref.name, ref.slot->ToValue());
+      RecordStateChange(ref.node, ref.node->path, component, ref.slot_timestamp,
+                        dict);
+    }
+  }
+  dirty_state_slots_.clear();
+}
+
+void ComponentManagerImpl::FlushStateSlots() const {
+  if (!dirty_state_slots_.empty())
+    const_cast<ComponentManagerImpl*>(this)->FlushStateSlots();
+}
+
+void ComponentManagerImpl::OnStateChanged() {
+  components_for_role_.clear();
+  components_snapshot_.reset();
+  state_fingerprint_ = 0;
+  components_fingerprint_ = 0;
+  SchedulePublishComponentsView();
+  last_state_change_id_++;
+  for (const auto& cb : on_state_changed_)
+    cb.Run();
+}
+
+bool ComponentManagerImpl::SetComponentsState(
+    const base::DictionaryValue& states,
+    ErrorPtr* error) {
+  // Check all components first, so a bad path or value changes nothing.
+  struct Update {
+    const std::string& path;
+    base::DictionaryValue* component;
+    const base::DictionaryValue* dict;
+  };
+  std::vector<Update> updates;
+  for (base::DictionaryValue::Iterator it(states); !it.IsAtEnd();
+       it.Advance()) {
+    const base::DictionaryValue* dict = nullptr;
+    if (!it.value().GetAsDictionary(&dict)) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kTypeMismatch,
+                                "State of component '%s' must be an object",
+                                it.key().c_str());
+    }
+    base::DictionaryValue* component = FindMutableComponent(it.key(), error);
+    if (!component || !ValidateState(*dict, error))
+      return false;
+    updates.push_back({it.key(), component, dict});
+  }
+  if (updates.empty())
+    return true;
+
+  base::Time timestamp = clock_->Now();
+  for (const auto& update : updates)
+    MergeComponentState(update.path, update.component,
+                        update.dict->CreateDeepCopy(), timestamp);
+  OnStateChanged();
+  return true;
+}
+
+bool ComponentManagerImpl::SetStatePropertiesFromJson(
     const std::string& component_path,
     const std::string& json,
     ErrorPtr* error) {
-  std::unique_ptr<const base::DictionaryValue> dict = LoadJsonDict(json, error);
-  return dict && SetStateProperties(component_path, *dict, error);
+  std::unique_ptr<base::DictionaryValue> dict = LoadJsonDict(json, error);
+  return dict && SetStateProperties(component_path, std::move(dict), error);
 }
 
 const base::Value* ComponentManagerImpl::GetStateProperty(
     const std::string& component_path,
     const std::string& name,
     ErrorPtr* error) const {
-  const base::DictionaryValue* component = FindComponent(component_path, error);
-  if (!component)
-    return nullptr;
-  auto pair = SplitAtFirst(name, ".", true);
+  auto pair = SplitPieceAtFirst(name, ".", true);
   if (pair.first.empty()) {
     return Error::AddToPrintf(error, FROM_HERE,
                               errors::commands::kPropertyMissing,
@@ -523,9 +1647,12 @@ const base::Value* ComponentManagerImpl::GetStateProperty(
         error, FROM_HERE, errors::commands::kPropertyMissing,
         "State property name not specified in '%s'", name.c_str());
   }
-  std::string key = base::StringPrintf("state.%s", name.c_str());
+  const base::DictionaryValue* state =
+      GetComponentState(component_path, error);
+  if (!state)
+    return nullptr;
   const base::Value* value = nullptr;
-  if (!component->Get(key, &value)) {
+  if (!state->Get(name, &value)) {
     return Error::AddToPrintf(error, FROM_HERE,
                               errors::commands::kPropertyMissing,
                               "State property '%s' not found in component '%s'",
@@ -534,12 +1661,27 @@ const base::Value* ComponentManagerImpl::GetStateProperty(
   return value;
 }
 
+const base::DictionaryValue* ComponentManagerImpl::GetComponentState(
+    const std::string& component_path,
+    ErrorPtr* error) const {
+  const base::DictionaryValue* component = FindComponent(component_path, error);
+  if (!component)
+    return nullptr;
+  const base::DictionaryValue* state = nullptr;
+  if (!component->GetDictionaryWithoutPathExpansion("state", &state)) {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::commands::kPropertyMissing,
+                              "Component '%s' has no state",
+                              component_path.c_str());
+  }
+  return state;
+}
+
 bool ComponentManagerImpl::SetStateProperty(const std::string& component_path,
                                             const std::string& name,
                                             const base::Value& value,
                                             ErrorPtr* error) {
-  base::DictionaryValue dict;
-  auto pair = SplitAtFirst(name, ".", true);
+  auto pair = SplitPieceAtFirst(name, ".", true);
   if (pair.first.empty()) {
     return Error::AddToPrintf(error, FROM_HERE,
                               errors::commands::kPropertyMissing,
@@ -550,12 +1692,169 @@ bool ComponentManagerImpl::SetStateProperty(const std::string& component_path,
         error, FROM_HERE, errors::commands::kPropertyMissing,
         "State property name not specified in '%s'", name.c_str());
   }
-  dict.Set(name, value.CreateDeepCopy());
-  return SetStateProperties(component_path, dict, error);
+  std::unique_ptr<base::DictionaryValue> dict{new base::DictionaryValue};
+  dict->Set(name, value.CreateDeepCopy());
+  return SetStateProperties(component_path, std::move(dict), error);
+}
+
+ComponentManager::StatePropertyHandle
+ComponentManagerImpl::ResolveStateProperty(const std::string& component_path,
+                                           const std::string& name,
+                                           ErrorPtr* error) {
+  auto pair = SplitPieceAtFirst(name, ".", true);
+  if (pair.first.empty()) {
+    Error::AddToPrintf(error, FROM_HERE, errors::commands::kPropertyMissing,
+                       "Empty state package in '%s'", name.c_str());
+    return 0;
+  }
+  if (pair.second.empty()) {
+    Error::AddToPrintf(error, FROM_HERE, errors::commands::kPropertyMissing,
+                       "State property name not specified in '%s'",
+                       name.c_str());
+    return 0;
+  }
+
+  ComponentNode* node = FindMutableComponentNode(component_path, error);
+  if (!node)
+    return 0;
+
+  StatePropertyHandle& handle = node->state_handles[name];
+  if (handle)
+    return handle;
+
+  handle = ++last_state_property_handle_;
+  const TraitMemberDefinition* property =
+      FindTraitMember(state_definitions_, name);
+  const SchemaValidator* validator =
+      property ? property->validator.get() : nullptr;
+  auto p = state_property_handles_.emplace(
+      std::piecewise_construct, std::forward_as_tuple(handle),
+      std::forward_as_tuple(node, name, validator));
+  if (validator) {
+    std::unique_ptr<StateSlot>& slot = p.first->second.slot;
+    switch (validator->GetType()) {
+      case SchemaValidator::Type::kBoolean:
+        slot.reset(new StateSlot{StateSlot::Type::kBoolean});
+        break;
+      case SchemaValidator::Type::kInteger:
+        slot.reset(new StateSlot{StateSlot::Type::kInteger});
+        break;
+      case SchemaValidator::Type::kNumber:
+        slot.reset(new StateSlot{StateSlot::Type::kDouble});
+        break;
+      case SchemaValidator::Type::kString:
+        slot.reset(new StateSlot{StateSlot::Type::kString});
+        break;
+      case SchemaValidator::Type::kAny:
+      case SchemaValidator::Type::kObject:
+      case SchemaValidator::Type::kArray:
+        break;
+    }
+  }
+  return handle;
+}
+
+bool ComponentManagerImpl::SetStatePropertyByHandle(StatePropertyHandle handle,
+                                                    const base::Value& value,
+                                                    ErrorPtr* error) {
+  auto p = state_property_handles_.find(handle);
+  if (p == state_property_handles_.end()) {
+    return Error::AddToPrintf(error, FROM_HERE, errors::commands::kInvalidState,
+                              "Invalid state property handle %llu",
+                              static_cast<unsigned long long>(handle));
+  }
+  StatePropertyRef& ref = p->second;
+  if (ref.validator && !ref.validator->Validate(value, error)) {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::commands::kInvalidPropValue,
+                              "Invalid value of state property '%s'",
+                              ref.name.c_str());
+  }
+  if (!ref.slot || !ref.slot->Assign(value)) {
+    std::unique_ptr<base::DictionaryValue> dict{new base::DictionaryValue};
+    dict->Set(ref.name, value.CreateDeepCopy());
+    UpdateComponentState(ref.node->path, ref.node->component, std::move(dict));
+    return true;
+  }
+
+  // The value is kept in the slot. Coalescing queues only need the latest
+  // value, which is recorded when the slot is flushed.
+  ref.slot_timestamp = clock_->Now();
+  if (!ref.slot_dirty) {
+    ref.slot_dirty = true;
+    dirty_state_slots_.push_back(handle);
+  }
+  StateChangeQueue* queue =
+      GetStateChangeQueue(ref.node->path, ref.node->component);
+  if (!queue->IsCoalescing()) {
+    base::DictionaryValue dict;
+    dict.Set(ref.name, value.CreateDeepCopy());
+    RecordStateChange(ref.node, ref.node->path, ref.node->component,
+                      ref.slot_timestamp, dict);
+  }
+  OnStateChanged();
+  return true;
+}
+
+bool ComponentManagerImpl::SetStateHistoryPolicy(
+    const std::string& component_path,
+    const StateHistoryPolicy& policy,
+    ErrorPtr* error) {
+  if (policy.capacity == 0) {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::commands::kInvalidPropValue,
+                              "State history capacity must not be zero");
+  }
+  if (policy.sample_interval == 0) {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::commands::kInvalidPropValue,
+                              "State history sample interval must not be zero");
+  }
+  ComponentNode* node = FindMutableComponentNode(component_path, error);
+  if (!node)
+    return false;
+
+  // Changes recorded already stay in the current queue, the new policy applies
+  // to the changes recorded after the next state snapshot.
+  node->history_policy = policy;
+  return true;
+}
+
+bool ComponentManagerImpl::SetStatePublishFilter(
+    const std::string& component_path,
+    const std::string& name,
+    const StatePublishFilter& filter,
+    ErrorPtr* error) {
+  auto pair = SplitPieceAtFirst(name, ".", true);
+  if (pair.first.empty() || pair.second.empty()) {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::commands::kPropertyMissing,
+                              "Invalid state property name '%s'", name.c_str());
+  }
+  if (filter.deadband < 0 || filter.deadband_percent < 0 ||
+      filter.min_interval < base::TimeDelta{}) {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::commands::kInvalidPropValue,
+                              "Invalid publish filter of '%s'", name.c_str());
+  }
+  ComponentNode* node = FindMutableComponentNode(component_path, error);
+  if (!node)
+    return false;
+
+  if (filter.deadband == 0 && filter.deadband_percent == 0 &&
+      filter.min_interval.is_zero() && !filter.local_only) {
+    node->publish_filters.erase(name);
+    return true;
+  }
+  // The last published value is kept, the new filter applies to the changes
+  // made from now on.
+  node->publish_filters[name].filter = filter;
+  return true;
 }
 
 ComponentManager::StateSnapshot
 ComponentManagerImpl::GetAndClearRecordedStateChanges() {
+  FlushStateSlots();
   StateSnapshot snapshot;
   snapshot.update_id = GetLastStateChangeId();
   for (auto& pair : state_change_queues_) {
@@ -575,7 +1874,17 @@ ComponentManagerImpl::GetAndClearRecordedStateChanges() {
     return lhs.timestamp < rhs.timestamp;
   };
   std::sort(snapshot.state_changes.begin(), snapshot.state_changes.end(), pred);
-  state_change_queues_.clear();
+
+  // The queues are kept with their buffers, unless the component is gone or
+  // its history policy changed since the queue was created.
+  for (auto it = state_change_queues_.begin();
+       it != state_change_queues_.end();) {
+    const ComponentNode* node = FindComponentNode(it->first);
+    if (node && it->second->HasPolicy(node->history_policy))
+      ++it;
+    else
+      it = state_change_queues_.erase(it);
+  }
   return snapshot;
 }
 
@@ -585,30 +1894,122 @@ void ComponentManagerImpl::NotifyStateUpdatedOnServer(UpdateID id) {
 
 ComponentManager::Token ComponentManagerImpl::AddServerStateUpdatedCallback(
     const base::Callback<void(UpdateID)>& callback) {
-  if (state_change_queues_.empty())
+  bool has_changes = std::any_of(
+      state_change_queues_.begin(), state_change_queues_.end(),
+      [](const std::pair<const std::string,
+                         std::unique_ptr<StateChangeQueue>>& pair) {
+        return !pair.second->IsEmpty();
+      });
+  if (!has_changes)
     callback.Run(GetLastStateChangeId());
   return Token{on_server_state_updated_.Add(callback)};
 }
 
 std::string ComponentManagerImpl::FindComponentWithTrait(
     const std::string& trait) const {
-  for (base::DictionaryValue::Iterator it(components_); !it.IsAtEnd();
-       it.Advance()) {
-    const base::ListValue* supported_traits = nullptr;
-    const base::DictionaryValue* component = nullptr;
-    CHECK(it.value().GetAsDictionary(&component));
-    if (component->GetList("traits", &supported_traits)) {
-      for (const auto& value : *supported_traits) {
-        std::string supported_trait;
-        CHECK(value->GetAsString(&supported_trait));
-        if (trait == supported_trait)
-          return it.key();
-      }
-    }
+  auto p = trait_index_.find(trait);
+  if (p == trait_index_.end())
+    return std::string{};
+  // The paths are sorted like the components, so the first top level one is
+  // the first component with the trait.
+  for (const auto& path : p->second) {
+    if (path.find_first_of(".[") == std::string::npos)
+      return path;
   }
   return std::string{};
 }
 
+void ComponentManagerImpl::GetMemoryStats(
+    base::DictionaryValue* stats) const {
+  MemoryUsage components;
+  components.count = component_index_.size();
+  components.bytes = EstimateMemoryUsage(components_) +
+                     component_index_.bucket_count() * sizeof(void*);
+  for (const auto& pair : component_index_) {
+    const ComponentNode& node = *pair.second;
+    components.bytes += kHashNodeOverhead + sizeof(pair) + sizeof(node) +
+                        EstimateMemoryUsage(pair.first) +
+                        EstimateMemoryUsage(node.path) +
+                        node.traits.capacity() * sizeof(StringAtom);
+    for (const auto& handle : node.state_handles) {
+      components.bytes += kTreeNodeOverhead + sizeof(handle) +
+                          EstimateMemoryUsage(handle.first);
+    }
+  }
+  components.bytes += trait_index_.bucket_count() * sizeof(void*);
+  for (const auto& pair : trait_index_) {
+    components.bytes += kHashNodeOverhead + sizeof(pair) +
+                        EstimateMemoryUsage(pair.first);
+    for (const auto& path : pair.second)
+      components.bytes +=
+          kTreeNodeOverhead + sizeof(path) + EstimateMemoryUsage(path);
+  }
+  for (const auto& pair : state_property_handles_) {
+    components.bytes += kTreeNodeOverhead + sizeof(pair) +
+                        EstimateMemoryUsage(pair.second.name) +
+                        (pair.second.slot ? sizeof(StateSlot) : 0);
+  }
+
+  // Compiled schemas are not counted.
+  MemoryUsage traits;
+  traits.count = traits_.size();
+  traits.bytes = EstimateMemoryUsage(traits_);
+  // Traits loaded lazily are counted in their compact form.
+  for (const auto& pair : pending_traits_) {
+    traits.bytes += kTreeNodeOverhead + sizeof(pair) +
+                    EstimateMemoryUsage(pair.first) +
+                    EstimateMemoryUsage(pair.second.json);
+  }
+  for (const TraitMemberTable* table :
+       {&command_definitions_, &state_definitions_}) {
+    for (const auto& pair : *table) {
+      traits.bytes += kHashNodeOverhead + sizeof(pair) +
+                      EstimateMemoryUsage(pair.first);
+    }
+  }
+
+  MemoryUsage caches;
+  caches.count = components_for_role_.size();
+  caches.bytes = EstimateMemoryUsage(traits_json_);
+  for (const auto& pair : components_for_role_) {
+    caches.bytes += kTreeNodeOverhead + sizeof(pair) +
+                    (pair.second ? EstimateMemoryUsage(*pair.second) : 0);
+  }
+  if (components_snapshot_) {
+    caches.count++;
+    caches.bytes += EstimateMemoryUsage(*components_snapshot_);
+  }
+
+  MemoryUsage state_changes;
+  for (const auto& pair : state_change_queues_) {
+    state_changes += pair.second->GetMemoryUsage();
+    state_changes.bytes += kTreeNodeOverhead + sizeof(pair) +
+                           sizeof(StateChangeQueue) +
+                           EstimateMemoryUsage(pair.first);
+  }
+
+  stats->Set("components", components.ToJson());
+  stats->Set("traits", traits.ToJson());
+  stats->Set("componentCaches", caches.ToJson());
+  stats->Set("stateChangeQueues", state_changes.ToJson());
+  stats->Set("commandQueue", command_queue_.GetMemoryUsage().ToJson());
+}
+
+void ComponentManagerImpl::CompactMemory() {
+  components_for_role_.clear();
+  components_snapshot_.reset();
+  std::string{}.swap(traits_json_);
+  ShrinkToFit(&dirty_state_slots_);
+  for (const auto& pair : state_change_queues_)
+    pair.second->Compact();
+  command_queue_.Compact();
+}
+
+void ComponentManagerImpl::MergeStateHistory() {
+  for (const auto& pair : state_change_queues_)
+    pair.second->MergeHistory();
+}
+
 base::DictionaryValue* ComponentManagerImpl::FindComponentGraftNode(
     const std::string& path,
     ErrorPtr* error) {
@@ -617,6 +2018,8 @@ base::DictionaryValue* ComponentManagerImpl::FindComponentGraftNode(
   if (component && !component->GetDictionary("components", &root)) {
     root = new base::DictionaryValue;
     component->Set("components", root);
+    components_for_role_.clear();
+    components_snapshot_.reset();
   }
   return root;
 }
@@ -624,38 +2027,246 @@ base::DictionaryValue* ComponentManagerImpl::FindComponentGraftNode(
 base::DictionaryValue* ComponentManagerImpl::FindMutableComponent(
     const std::string& path,
     ErrorPtr* error) {
-  return const_cast<base::DictionaryValue*>(
-      FindComponentAt(&components_, path, error));
+  return const_cast<base::DictionaryValue*>(FindComponent(path, error));
+}
+
+void ComponentManagerImpl::IndexComponentTree(const std::string& path,
+                                              base::DictionaryValue* component,
+                                              ComponentNodes* old_nodes) {
+  std::unique_ptr<ComponentNode> node;
+  if (old_nodes) {
+    auto p = old_nodes->find(component);
+    if (p != old_nodes->end()) {
+      node = std::move(p->second);
+      old_nodes->erase(p);
+    }
+  }
+  if (!node) {
+    node.reset(new ComponentNode);
+    node->component = component;
+  }
+  node->path = path;
+  node->traits.clear();
+  const base::ListValue* traits = nullptr;
+  if (component->GetList("traits", &traits)) {
+    for (const auto& value : *traits) {
+      std::string trait;
+      if (value->GetAsString(&trait))
+        node->traits.emplace_back(trait);
+    }
+  }
+  auto& slot = component_index_[path];
+  if (slot) {
+    ReleaseStatePropertyHandles(*slot);
+    RemoveFromTraitIndex(*slot);
+  }
+  AddToTraitIndex(*node);
+  slot = std::move(node);
+
+  base::DictionaryValue* sub_components = nullptr;
+  if (component->GetDictionary("components", &sub_components))
+    IndexSubComponents(path, sub_components, old_nodes);
+}
+
+void ComponentManagerImpl::IndexSubComponents(
+    const std::string& parent_path,
+    base::DictionaryValue* components,
+    ComponentNodes* old_nodes) {
+  for (base::DictionaryValue::Iterator it(*components); !it.IsAtEnd();
+       it.Advance()) {
+    if (!IsSimpleName(it.key(), kPathSpecialChars))
+      continue;
+    base::Value* value = nullptr;
+    CHECK(components->GetWithoutPathExpansion(it.key(), &value));
+    std::string path =
+        parent_path.empty() ? it.key() : parent_path + '.' + it.key();
+    base::DictionaryValue* component = nullptr;
+    base::ListValue* component_array = nullptr;
+    if (value->GetAsDictionary(&component)) {
+      IndexComponentTree(path, component, old_nodes);
+    } else if (value->GetAsList(&component_array)) {
+      for (size_t i = 0; i < component_array->GetSize(); i++) {
+        if (component_array->GetDictionary(i, &component)) {
+          IndexComponentTree(base::StringPrintf("%s[%zu]", path.c_str(), i),
+                             component, old_nodes);
+        }
+      }
+    }
+  }
+}
+
+void ComponentManagerImpl::MoveComponentTree(
+    const std::string& old_path,
+    const std::string& new_path,
+    const base::DictionaryValue& component) {
+  auto p = component_index_.find(old_path);
+  if (p != component_index_.end() && p->second->component == &component) {
+    std::unique_ptr<ComponentNode> node = std::move(p->second);
+    component_index_.erase(p);
+    RemoveFromTraitIndex(*node);
+    if (new_path.empty()) {
+      ReleaseStatePropertyHandles(*node);
+    } else {
+      node->path = new_path;
+      AddToTraitIndex(*node);
+      component_index_[new_path] = std::move(node);
+    }
+  }
+
+  const base::DictionaryValue* components = nullptr;
+  if (!component.GetDictionary("components", &components))
+    return;
+  for (base::DictionaryValue::Iterator it(*components); !it.IsAtEnd();
+       it.Advance()) {
+    if (!IsSimpleName(it.key(), kPathSpecialChars))
+      continue;
+    std::string old_sub_path = old_path + '.' + it.key();
+    std::string new_sub_path =
+        new_path.empty() ? new_path : new_path + '.' + it.key();
+    const base::DictionaryValue* sub_component = nullptr;
+    const base::ListValue* component_array = nullptr;
+    if (it.value().GetAsDictionary(&sub_component)) {
+      MoveComponentTree(old_sub_path, new_sub_path, *sub_component);
+    } else if (it.value().GetAsList(&component_array)) {
+      for (size_t i = 0; i < component_array->GetSize(); i++) {
+        if (!component_array->GetDictionary(i, &sub_component))
+          continue;
+        MoveComponentTree(
+            base::StringPrintf("%s[%zu]", old_sub_path.c_str(), i),
+            new_path.empty()
+                ? new_path
+                : base::StringPrintf("%s[%zu]", new_sub_path.c_str(), i),
+            *sub_component);
+      }
+    }
+  }
+}
+
+void ComponentManagerImpl::RebuildComponentIndex() {
+  // The nodes are matched by the component objects, which stay the same when
+  // a component moves, e.g. after an item before it is removed from an array.
+  ComponentNodes old_nodes;
+  for (auto& pair : component_index_)
+    old_nodes[pair.second->component] = std::move(pair.second);
+  component_index_.clear();
+  trait_index_.clear();
+  IndexSubComponents("", &components_, &old_nodes);
+  // Whatever is left in |old_nodes| refers to removed components.
+  for (const auto& pair : old_nodes)
+    ReleaseStatePropertyHandles(*pair.second);
+}
+
+void ComponentManagerImpl::ReleaseStatePropertyHandles(
+    const ComponentNode& node) {
+  for (const auto& pair : node.state_handles)
+    state_property_handles_.erase(pair.second);
+}
+
+void ComponentManagerImpl::AddToTraitIndex(const ComponentNode& node) {
+  for (const auto& trait : node.traits)
+    trait_index_[trait.str()].insert(node.path);
+}
+
+void ComponentManagerImpl::RemoveFromTraitIndex(const ComponentNode& node) {
+  for (const auto& trait : node.traits) {
+    auto p = trait_index_.find(trait.str());
+    if (p == trait_index_.end())
+      continue;
+    p->second.erase(node.path);
+    if (p->second.empty())
+      trait_index_.erase(p);
+  }
+}
+
+bool ComponentManagerImpl::ComponentHasTrait(
+    const std::string& path,
+    const base::DictionaryValue& component,
+    const std::string& trait) const {
+  const ComponentNode* node = FindComponentNode(path);
+  if (node && node->component == &component) {
+    auto p = trait_index_.find(trait);
+    return p != trait_index_.end() && p->second.count(path) > 0;
+  }
+  // Not a canonical path, look through the traits of the component.
+  const base::ListValue* traits = nullptr;
+  if (component.GetList("traits", &traits)) {
+    for (const auto& value : *traits) {
+      std::string supported_trait;
+      if (value->GetAsString(&supported_trait) && supported_trait == trait)
+        return true;
+    }
+  }
+  return false;
+}
+
+const ComponentManagerImpl::ComponentNode*
+ComponentManagerImpl::FindComponentNode(const std::string& path) const {
+  auto p = component_index_.find(path);
+  return p != component_index_.end() ? p->second.get() : nullptr;
+}
+
+ComponentManagerImpl::ComponentNode* ComponentManagerImpl::FindComponentNodeFor(
+    const std::string& path,
+    const base::DictionaryValue* component) const {
+  auto p = component_index_.find(path);
+  if (p != component_index_.end() && p->second->component == component)
+    return p->second.get();
+  // The path might be in a non-canonical form, so look the node up by the
+  // component object.
+  for (const auto& entry : component_index_) {
+    if (entry.second->component == component)
+      return entry.second.get();
+  }
+  return nullptr;
+}
+
+ComponentManagerImpl::ComponentNode*
+ComponentManagerImpl::FindMutableComponentNode(const std::string& path,
+                                               ErrorPtr* error) {
+  auto p = component_index_.find(path);
+  if (p != component_index_.end())
+    return p->second.get();
+  const base::DictionaryValue* component = FindComponent(path, error);
+  if (!component)
+    return nullptr;
+  ComponentNode* node = FindComponentNodeFor(path, component);
+  if (!node) {
+    Error::AddToPrintf(error, FROM_HERE, errors::commands::kPropertyMissing,
+                       "Component '%s' is not addressable", path.c_str());
+  }
+  return node;
 }
 
 const base::DictionaryValue* ComponentManagerImpl::FindComponentAt(
     const base::DictionaryValue* root,
     const std::string& path,
     ErrorPtr* error) {
-  auto parts = Split(path, ".", true, false);
   std::string root_path;
-  for (size_t i = 0; i < parts.size(); i++) {
-    auto element = SplitAtFirst(parts[i], "[", true);
+  for (StringTokenizer it{path, "."}; !it.IsAtEnd(); it.Advance()) {
+    auto element = SplitPieceAtFirst(it.token(), "[", true);
+    // The name is needed as a string to look the component up.
+    std::string name = element.first.as_string();
     int array_index = -1;
-    if (element.first.empty()) {
+    if (name.empty()) {
       return Error::AddToPrintf(
           error, FROM_HERE, errors::commands::kPropertyMissing,
           "Empty path element at '%s'", root_path.c_str());
     }
     if (!element.second.empty()) {
-      if (element.second.back() != ']') {
+      if (!element.second.ends_with("]")) {
         return Error::AddToPrintf(
             error, FROM_HERE, errors::commands::kPropertyMissing,
-            "Invalid array element syntax '%s'", parts[i].c_str());
+            "Invalid array element syntax '%s'",
+            it.token().as_string().c_str());
       }
-      element.second.pop_back();
-      std::string index_str;
-      base::TrimWhitespaceASCII(element.second, base::TrimPositions::TRIM_ALL,
-                                &index_str);
+      element.second.remove_suffix(1);
+      base::StringPiece index_str =
+          base::TrimString(element.second, base::kWhitespaceASCII,
+                           base::TrimPositions::TRIM_ALL);
       if (!base::StringToInt(index_str, &array_index) || array_index < 0) {
         return Error::AddToPrintf(
             error, FROM_HERE, errors::commands::kInvalidPropValue,
-            "Invalid array index '%s'", element.second.c_str());
+            "Invalid array index '%s'", element.second.as_string().c_str());
       }
     }
 
@@ -667,15 +2278,15 @@ const base::DictionaryValue* ComponentManagerImpl::FindComponentAt(
         return Error::AddToPrintf(error, FROM_HERE,
                                   errors::commands::kPropertyMissing,
                                   "Component '%s' does not exist at '%s'",
-                                  element.first.c_str(), root_path.c_str());
+                                  name.c_str(), root_path.c_str());
       }
     }
 
     const base::Value* value = nullptr;
-    if (!root->GetWithoutPathExpansion(element.first, &value)) {
+    if (!root->GetWithoutPathExpansion(name, &value)) {
       Error::AddToPrintf(error, FROM_HERE, errors::commands::kPropertyMissing,
                          "Component '%s' does not exist at '%s'",
-                         element.first.c_str(), root_path.c_str());
+                         name.c_str(), root_path.c_str());
       return nullptr;
     }
 
@@ -683,13 +2294,13 @@ const base::DictionaryValue* ComponentManagerImpl::FindComponentAt(
       return Error::AddToPrintf(error, FROM_HERE,
                                 errors::commands::kTypeMismatch,
                                 "Element '%s.%s' is an array",
-                                root_path.c_str(), element.first.c_str());
+                                root_path.c_str(), name.c_str());
     }
     if (value->GetType() == base::Value::TYPE_DICTIONARY && array_index >= 0) {
       return Error::AddToPrintf(error, FROM_HERE,
                                 errors::commands::kTypeMismatch,
                                 "Element '%s.%s' is not an array",
-                                root_path.c_str(), element.first.c_str());
+                                root_path.c_str(), name.c_str());
     }
 
     if (value->GetType() == base::Value::TYPE_DICTIONARY) {
@@ -703,12 +2314,12 @@ const base::DictionaryValue* ComponentManagerImpl::FindComponentAt(
         return Error::AddToPrintf(
             error, FROM_HERE, errors::commands::kPropertyMissing,
             "Element '%s.%s' does not contain item #%d", root_path.c_str(),
-            element.first.c_str(), array_index);
+            name.c_str(), array_index);
       }
     }
     if (!root_path.empty())
       root_path += '.';
-    root_path += parts[i];
+    root_path.append(it.token().data(), it.token().size());
   }
   return root;
 }
@@ -5,10 +5,16 @@
 #ifndef LIBWEAVE_SRC_COMPONENT_MANAGER_IMPL_H_
 #define LIBWEAVE_SRC_COMPONENT_MANAGER_IMPL_H_
 
+#include <unordered_map>
+
+#include <base/memory/weak_ptr.h>
 #include <base/time/default_clock.h>
 
 #include "src/commands/command_queue.h"
+#include "src/commands/schema_validator.h"
+#include "src/states/state_slot.h"
 #include "src/component_manager.h"
+#include "src/metrics.h"
 #include "src/states/state_change_queue.h"
 
 namespace weave {
@@ -16,7 +22,9 @@ namespace weave {
 class ComponentManagerImpl final : public ComponentManager {
  public:
   explicit ComponentManagerImpl(provider::TaskRunner* task_runner,
-                                base::Clock* clock = nullptr);
+                                base::Clock* clock = nullptr,
+                                Metrics* metrics = nullptr,
+                                WakeWindowScheduler* wake_scheduler = nullptr);
   ~ComponentManagerImpl() override;
 
   // Loads trait definition schema.
@@ -25,6 +33,8 @@ class ComponentManagerImpl final : public ComponentManager {
   // Same as the overload above, but takes a json string to read the trait
   // definitions from.
   bool LoadTraits(const std::string& json, ErrorPtr* error) override;
+  bool LoadTraits(const EmbeddedValue& table, ErrorPtr* error) override;
+  void EnableLazyTraits() override { lazy_traits_ = true; }
 
   // Sets callback which is called when new trait definitions are added.
   void AddTraitDefChangedCallback(const base::Closure& callback) override;
@@ -72,6 +82,8 @@ class ComponentManagerImpl final : public ComponentManager {
   // |command_instance| must be fully initialized and have its name, component,
   // id populated.
   void AddCommand(std::unique_ptr<CommandInstance> command_instance) override;
+  void AddCommands(std::vector<std::unique_ptr<CommandInstance>>
+                       command_instances) override;
 
   // Parses the command definition from a json dictionary. The resulting command
   // instance is populated with all the required fields and partially validated
@@ -83,6 +95,14 @@ class ComponentManagerImpl final : public ComponentManager {
       UserRole role,
       std::string* id,
       ErrorPtr* error) override;
+  std::unique_ptr<CommandInstance> CreateCommandInstance(
+      const std::string& component,
+      const std::string& name,
+      const base::DictionaryValue& parameters,
+      Command::Origin command_origin,
+      UserRole role,
+      std::string* id,
+      ErrorPtr* error) override;
 
   // Find a command instance with the given ID in the command queue.
   CommandInstance* FindCommand(const std::string& id) override;
@@ -103,6 +123,11 @@ class ComponentManagerImpl final : public ComponentManager {
       const std::string& command_name,
       const Device::CommandHandlerCallback& callback) override;
 
+  bool SetCommandHandlerPolicy(const std::string& component_path,
+                               const std::string& command_name,
+                               const CommandHandlerPolicy& policy,
+                               ErrorPtr* error) override;
+
   // Finds a component instance by its full path.
   const base::DictionaryValue* FindComponent(const std::string& path,
                                              ErrorPtr* error) const override;
@@ -132,31 +157,72 @@ class ComponentManagerImpl final : public ComponentManager {
 
   // Returns the full JSON dictionary containing trait definitions.
   const base::DictionaryValue& GetTraits() const override { return traits_; }
+  const std::string& GetTraitsJson() const override;
 
   // Returns the full JSON dictionary containing component instances.
   const base::DictionaryValue& GetComponents() const override {
+    FlushStateSlots();
     return components_;
   }
 
+  uint64_t GetTraitsFingerprint() const override;
+  uint64_t GetStateFingerprint() const override;
+  uint64_t GetComponentsFingerprint() const override;
+
+  void WriteSnapshot(JsonStreamWriter* writer) const override;
+  bool RestoreSnapshot(const base::DictionaryValue& snapshot,
+                       ErrorPtr* error) override;
+
   // Returns a JSON dictionary containing component instances with state
   // properties visible to a user of the given |role|.
-  std::unique_ptr<base::DictionaryValue> GetComponentsForUserRole(
+  std::shared_ptr<const base::DictionaryValue> GetComponentsForUserRole(
       UserRole role) const override;
+  std::shared_ptr<const base::DictionaryValue> GetComponentsSnapshot()
+      const override;
+  void EnableComponentsView() override;
+  std::shared_ptr<const base::DictionaryValue> GetComponentsView()
+      const override;
+  std::unique_ptr<base::DictionaryValue> GetComponentForUserRole(
+      const std::string& component_path,
+      UserRole role,
+      const std::set<std::string>& fields,
+      ErrorPtr* error) const override;
 
   // Component state manipulation methods.
   bool SetStateProperties(const std::string& component_path,
                           const base::DictionaryValue& dict,
                           ErrorPtr* error) override;
+  bool SetStateProperties(const std::string& component_path,
+                          std::unique_ptr<base::DictionaryValue> dict,
+                          ErrorPtr* error) override;
   bool SetStatePropertiesFromJson(const std::string& component_path,
                                   const std::string& json,
                                   ErrorPtr* error) override;
   const base::Value* GetStateProperty(const std::string& component_path,
                                       const std::string& name,
                                       ErrorPtr* error) const override;
+  const base::DictionaryValue* GetComponentState(
+      const std::string& component_path,
+      ErrorPtr* error) const override;
   bool SetStateProperty(const std::string& component_path,
                         const std::string& name,
                         const base::Value& value,
                         ErrorPtr* error) override;
+  StatePropertyHandle ResolveStateProperty(const std::string& component_path,
+                                           const std::string& name,
+                                           ErrorPtr* error) override;
+  bool SetStatePropertyByHandle(StatePropertyHandle handle,
+                                const base::Value& value,
+                                ErrorPtr* error) override;
+  bool SetComponentsState(const base::DictionaryValue& states,
+                          ErrorPtr* error) override;
+  bool SetStateHistoryPolicy(const std::string& component_path,
+                             const StateHistoryPolicy& policy,
+                             ErrorPtr* error) override;
+  bool SetStatePublishFilter(const std::string& component_path,
+                             const std::string& name,
+                             const StatePublishFilter& filter,
+                             ErrorPtr* error) override;
 
   void AddStateChangedCallback(const base::Closure& callback) override;
 
@@ -189,7 +255,242 @@ class ComponentManagerImpl final : public ComponentManager {
   // tree. No sub-components are searched.
   std::string FindComponentWithTrait(const std::string& trait) const override;
 
+  void GetMemoryStats(base::DictionaryValue* stats) const override;
+  void CompactMemory() override;
+  void MergeStateHistory() override;
+
  private:
+  // A StatePublishFilter and the last value of the property it let through.
+  // |held| is set while a change waits for |min_interval| to pass.
+  struct PublishFilter {
+    StatePublishFilter filter;
+    bool published{false};
+    double value{0};
+    base::Time time;
+    bool held{false};
+  };
+  // An entry of the component index. |path| is the canonical full path of the
+  // component (e.g. "stove.burners[2]") and |component| points to the JSON
+  // object of the component instance inside |components_|.
+  // |state_handles| lists the state property handles resolved for this
+  // component, keyed by the property name. |history_policy| controls how the
+  // state changes of the component are recorded, and |publish_filters| which
+  // changes of its properties are, keyed by the property name.
+  struct ComponentNode {
+    std::string path;
+    base::DictionaryValue* component{nullptr};
+    // The "traits" of |component|, as entered into |trait_index_|.
+    std::vector<StringAtom> traits;
+    std::map<std::string, StatePropertyHandle> state_handles;
+    StateHistoryPolicy history_policy;
+    std::map<std::string, PublishFilter> publish_filters;
+  };
+  // A state property referred to by a StatePropertyHandle.
+  // Scalar properties declared in trait schemas get a |slot|, which keeps the
+  // value set with SetStatePropertyByHandle() until FlushStateSlots() writes
+  // it to the component JSON.
+  struct StatePropertyRef {
+    StatePropertyRef(ComponentNode* node,
+                     const std::string& name,
+                     const SchemaValidator* validator);
+    ~StatePropertyRef();
+
+    ComponentNode* node;
+    std::string name;
+    const SchemaValidator* validator;
+    std::unique_ptr<StateSlot> slot;
+    base::Time slot_timestamp;
+    bool slot_dirty{false};
+  };
+  using ComponentIndex =
+      std::unordered_map<std::string, std::unique_ptr<ComponentNode>>;
+  // Index entries keyed by the component object they refer to.
+  using ComponentNodes =
+      std::unordered_map<const base::DictionaryValue*,
+                         std::unique_ptr<ComponentNode>>;
+
+  // Adds the component at canonical |path| and all its sub-components to
+  // |component_index_|. Nodes found in |old_nodes| for the same component
+  // object are moved over to the new path instead of being re-created, so
+  // array items which only moved keep their policies and handles.
+  void IndexComponentTree(const std::string& path,
+                          base::DictionaryValue* component,
+                          ComponentNodes* old_nodes);
+  // Indexes all component instances found in |components| collection of a
+  // component at |parent_path| (or at root level if |parent_path| is empty).
+  void IndexSubComponents(const std::string& parent_path,
+                          base::DictionaryValue* components,
+                          ComponentNodes* old_nodes);
+  // Moves the index entries of the |component| tree from |old_path| to
+  // |new_path|, keeping the nodes, or drops them if |new_path| is empty.
+  void MoveComponentTree(const std::string& old_path,
+                         const std::string& new_path,
+                         const base::DictionaryValue& component);
+  // Re-creates |component_index_| from |components_|. Called when components
+  // are replaced or changed at a path not in its canonical form.
+  void RebuildComponentIndex();
+  // Returns the index entry for a component at canonical |path| or nullptr if
+  // the path is not in its canonical form or doesn't exist.
+  const ComponentNode* FindComponentNode(const std::string& path) const;
+  // Returns the index entry for the |component| object found at |path|, which
+  // doesn't have to be canonical. Returns nullptr if the component is not
+  // indexed.
+  ComponentNode* FindComponentNodeFor(
+      const std::string& path,
+      const base::DictionaryValue* component) const;
+  // Same as FindComponentNodeFor() but looks the component up by |path| first.
+  // Fills |error| if the component is not found or not indexed.
+  ComponentNode* FindMutableComponentNode(const std::string& path,
+                                          ErrorPtr* error);
+  // Invalidates all state property handles referring to the component |node|.
+  void ReleaseStatePropertyHandles(const ComponentNode& node);
+  // Adds or removes the traits of |node| in |trait_index_|.
+  void AddToTraitIndex(const ComponentNode& node);
+  void RemoveFromTraitIndex(const ComponentNode& node);
+  // Returns true if the |component| found at |path| has the |trait|.
+  bool ComponentHasTrait(const std::string& path,
+                         const base::DictionaryValue& component,
+                         const std::string& trait) const;
+
+  // Routes |command_instance| to a component if it has none and checks it
+  // for |role|. Assigns a new ID to it if it has none and returns the ID
+  // through optional |id|.
+  std::unique_ptr<CommandInstance> CheckCommandInstance(
+      std::unique_ptr<CommandInstance> command_instance,
+      UserRole role,
+      std::string* id,
+      ErrorPtr* error);
+
+  // Merges |dict| into the state of the |component| at |component_path| and
+  // records the state change.
+  void UpdateComponentState(const std::string& component_path,
+                            base::DictionaryValue* component,
+                            std::unique_ptr<base::DictionaryValue> dict);
+  // Same as UpdateComponentState() but leaves the update ID and the state
+  // changed callbacks to the caller.
+  void MergeComponentState(const std::string& component_path,
+                           base::DictionaryValue* component,
+                           std::unique_ptr<base::DictionaryValue> dict,
+                           base::Time timestamp);
+  void OnStateChanged();
+  // Records the state change |dict| of the |component| at |component_path| in
+  // its queue, without the local-only properties and the ones filtered out by
+  // the publish filters of |node|, which may be null. Returns false if nothing
+  // was recorded.
+  bool RecordStateChange(ComponentNode* node,
+                         const std::string& component_path,
+                         base::DictionaryValue* component,
+                         base::Time timestamp,
+                         const base::DictionaryValue& dict);
+  // Returns true if the change of the property |name| of |node| to |value| is
+  // to be recorded, or holds it back until the minimal interval passes.
+  bool ApplyPublishFilter(ComponentNode* node,
+                          const std::string& name,
+                          const base::Value& value,
+                          base::Time timestamp);
+  // Records the latest value of the property |name| of the component at
+  // |component_path|, held back by its publish filter.
+  void RecordHeldStateChange(const std::string& component_path,
+                             const std::string& name);
+  // Returns the state change queue of the component, creating it if needed.
+  StateChangeQueue* GetStateChangeQueue(const std::string& component_path,
+                                        base::DictionaryValue* component);
+  // Writes values of dirty state slots to |components_|, and to the state
+  // change queues which were not updated by SetStatePropertyByHandle().
+  // Called before the component tree is read or otherwise modified.
+  void FlushStateSlots();
+  // Const accessors use this one. Flushing doesn't change the observable
+  // state of the manager.
+  void FlushStateSlots() const;
+
+  // Minimal roles of the state properties of a trait, built in LoadTraits().
+  // |max_role| is the highest role among |properties|, so the whole state of
+  // the trait is visible to a user with at least this role.
+  struct TraitStateRoles {
+    UserRole max_role{UserRole::kViewer};
+    std::map<std::string, UserRole> properties;
+  };
+
+  // Pre-parsed definition of a trait command or state property.
+  // |definition| points to the JSON definition inside |traits_|.
+  // |validator| checks command parameters or the state property value, and
+  // is null if the definition has no schema.
+  struct TraitMemberDefinition {
+    const base::DictionaryValue* definition{nullptr};
+    bool has_minimal_role{false};
+    UserRole minimal_role{UserRole::kUser};
+    std::unique_ptr<SchemaValidator> validator;
+    // Time to live of the commands, from "expirationTimeoutMs". Zero if they
+    // don't expire.
+    base::TimeDelta expiration_timeout;
+    // Whether the commands replace the older ones waiting in the queue, from
+    // "superseding".
+    bool superseding{false};
+  };
+  // Trait member definitions keyed by full name ("trait.member").
+  using TraitMemberTable =
+      std::unordered_map<std::string, TraitMemberDefinition>;
+
+  // Schemas of a trait compiled by CompileTraitSchemas(), keyed by command or
+  // state property name.
+  using SchemaValidators =
+      std::map<std::string, std::unique_ptr<SchemaValidator>>;
+  struct TraitSchemas {
+    SchemaValidators commands;
+    SchemaValidators state;
+  };
+
+  // Compiles command parameters and state property schemas of the trait
+  // |name|. Fails if any of them is invalid.
+  static bool CompileTraitSchemas(const std::string& name,
+                                  const base::DictionaryValue& definition,
+                                  TraitSchemas* schemas,
+                                  ErrorPtr* error);
+  // Adds commands and state properties of the trait |name| to the
+  // |command_definitions_|, |state_definitions_| and |state_roles_| tables.
+  // The validators are moved from |schemas|.
+  void AddTraitDefinitionTables(const std::string& name,
+                                const base::DictionaryValue& definition,
+                                TraitSchemas* schemas);
+  // Trait definition loaded with |lazy_traits_| set and not referenced yet.
+  // Points to the compiled table, or keeps the definition as compact JSON.
+  struct PendingTrait {
+    const EmbeddedValue* table{nullptr};
+    std::string json;
+  };
+  static std::unique_ptr<base::Value> CreatePendingTraitValue(
+      const PendingTrait& trait);
+  // Validates the pending trait |name| and moves it to |traits_|. Does
+  // nothing if the trait is not pending.
+  bool MaterializeTrait(const std::string& name, ErrorPtr* error);
+
+  // Checks |state| of a component, in the {"trait": {"property": value}}
+  // form, against schemas of the defined state properties.
+  bool ValidateState(const base::DictionaryValue& state, ErrorPtr* error) const;
+  // Looks up a trait member by its full |name| in the given |table|.
+  static const TraitMemberDefinition* FindTraitMember(
+      const TraitMemberTable& table,
+      const std::string& name);
+  // Returns a copy of |component| and its sub-components having only those
+  // state properties which are visible to a user with the given |role|.
+  // If |fields| is not empty, only these members of every component are
+  // copied.
+  std::unique_ptr<base::DictionaryValue> CopyComponentForUserRole(
+      const base::DictionaryValue& component,
+      UserRole role,
+      const std::set<std::string>& fields) const;
+  // Returns a copy of component |state| without properties hidden from a user
+  // with the given |role|, or nullptr if nothing is left of the state.
+  std::unique_ptr<base::DictionaryValue> CopyStateForUserRole(
+      const base::DictionaryValue& state,
+      UserRole role) const;
+  // Checks if state |property| of |trait| is visible to a user with |role|.
+  // |roles| is the |state_roles_| entry of the trait, if any.
+  bool IsStatePropertyVisible(const std::string& trait,
+                              const TraitStateRoles* roles,
+                              const std::string& property,
+                              UserRole role) const;
+
   // A helper method to find a JSON element of component at |path| to add new
   // sub-components to.
   base::DictionaryValue* FindComponentGraftNode(const std::string& path,
@@ -204,6 +505,24 @@ class ComponentManagerImpl final : public ComponentManager {
       const std::string& path,
       ErrorPtr* error);
 
+  // Checks that |components| of a snapshot are well-formed and only use the
+  // trait definitions from |traits|.
+  static bool ValidateSnapshotComponents(
+      const base::DictionaryValue& traits,
+      const base::DictionaryValue& components,
+      ErrorPtr* error);
+
+  // Post a task to run the corresponding callbacks, unless one is pending.
+  void NotifyTraitDefsChanged();
+  void RunTraitDefChangedCallbacks();
+  void NotifyComponentTreeChanged();
+  void RunComponentTreeChangedCallbacks();
+  // Posts PublishComponentsView() if the view is enabled and it isn't
+  // posted yet.
+  void SchedulePublishComponentsView();
+  void PublishComponentsView();
+
+  provider::TaskRunner* task_runner_{nullptr};
   base::DefaultClock default_clock_;
   base::Clock* clock_{nullptr};
 
@@ -215,14 +534,62 @@ class ComponentManagerImpl final : public ComponentManager {
   base::CallbackList<void(UpdateID)> on_server_state_updated_;
 
   base::DictionaryValue traits_;      // Trait definitions.
+  // Set by EnableLazyTraits().
+  bool lazy_traits_{false};
+  // Trait definitions not in |traits_| until they are referenced.
+  std::map<std::string, PendingTrait> pending_traits_;
+  // Serialized |traits_|, empty until GetTraitsJson() is called.
+  mutable std::string traits_json_;
+  // Results of the Get*Fingerprint() methods, zero until they are called
+  // after a change.
+  mutable uint64_t traits_fingerprint_{0};
+  mutable uint64_t state_fingerprint_{0};
+  mutable uint64_t components_fingerprint_{0};
+  // Command and state property definitions, built in LoadTraits().
+  TraitMemberTable command_definitions_;
+  TraitMemberTable state_definitions_;
+  // Minimal roles of state properties keyed by trait name.
+  std::map<std::string, TraitStateRoles> state_roles_;
+  // Full names of the state properties declared "localOnly", whose changes
+  // are not recorded for publishing.
+  std::set<std::string> local_only_state_;
   base::DictionaryValue components_;  // Component instances.
   CommandQueue command_queue_;  // Command queue containing command instances.
   std::vector<base::Closure> on_trait_changed_;
   std::vector<base::Closure> on_componet_tree_changed_;
   std::vector<base::Closure> on_state_changed_;
+  // Set while a task to run the callbacks above is posted.
+  bool trait_defs_changed_pending_{false};
+  bool component_tree_changed_pending_{false};
   uint32_t next_command_id_{0};
   std::map<std::string, std::unique_ptr<StateChangeQueue>> state_change_queues_;
-
+  // Index of all component instances in |components_| by their canonical
+  // paths. Lets FindComponent() skip path parsing and tree walking.
+  ComponentIndex component_index_;
+  // Canonical paths of the indexed components, including the sub-components,
+  // by the traits they have.
+  std::unordered_map<std::string, std::set<std::string>> trait_index_;
+  // State properties resolved with ResolveStateProperty().
+  std::map<StatePropertyHandle, StatePropertyRef> state_property_handles_;
+  // Handles of state properties with values not written to |components_|.
+  std::vector<StatePropertyHandle> dirty_state_slots_;
+  // Snapshots returned by GetComponentsForUserRole(), dropped whenever the
+  // components, their state or the trait definitions change.
+  mutable std::map<UserRole, std::shared_ptr<const base::DictionaryValue>>
+      components_for_role_;
+  // Snapshot returned by GetComponentsSnapshot(), dropped whenever the
+  // components or their state change.
+  mutable std::shared_ptr<const base::DictionaryValue> components_snapshot_;
+  // Set by EnableComponentsView().
+  bool components_view_enabled_{false};
+  // Set while a task to publish the view is posted.
+  bool components_view_pending_{false};
+  // Read by other threads, only with std::atomic_load(). Readers hold their
+  // own reference, so publishing the next snapshot doesn't wait for them.
+  std::shared_ptr<const base::DictionaryValue> components_view_;
+  StatePropertyHandle last_state_property_handle_{0};
+
+  base::WeakPtrFactory<ComponentManagerImpl> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(ComponentManagerImpl);
 };
 
@@ -4,14 +4,20 @@
 
 #include "src/component_manager_impl.h"
 
+#include <atomic>
 #include <map>
+#include <thread>
 
+#include <base/json/json_writer.h>
+#include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <weave/provider/test/fake_task_runner.h>
 #include <weave/test/unittest_utils.h>
 
 #include "src/bind_lambda.h"
 #include "src/commands/schema_constants.h"
+#include "src/json_stream_writer.h"
+#include "src/test/allocation_counter.h"
 #include "src/test/mock_component_manager.h"
 #include "src/test/mock_clock.h"
 
@@ -19,6 +25,7 @@ namespace weave {
 
 using test::CreateDictionaryValue;
 using testing::Return;
+using testing::ReturnPointee;
 using testing::StrictMock;
 
 namespace {
@@ -128,6 +135,74 @@ TEST_F(ComponentManagerTest, LoadTraits) {
   EXPECT_TRUE(manager_.GetComponents().empty());
 }
 
+TEST_F(ComponentManagerTest, LoadTraitsFromTable) {
+  using Type = EmbeddedValue::Type;
+  // What weave_json_compiler generates for the traits of the LoadTraits test.
+  static constexpr EmbeddedValue kHeight[] = {
+      {Type::kString, "type", 0, 0, "integer", nullptr, 0},
+  };
+  static constexpr EmbeddedValue kParameters[] = {
+      {Type::kDictionary, "height", 0, 0, nullptr, kHeight, 1},
+  };
+  static constexpr EmbeddedValue kCommand1[] = {
+      {Type::kString, "minimalRole", 0, 0, "user", nullptr, 0},
+      {Type::kDictionary, "parameters", 0, 0, nullptr, kParameters, 1},
+  };
+  static constexpr EmbeddedValue kCommands[] = {
+      {Type::kDictionary, "command1", 0, 0, nullptr, kCommand1, 2},
+  };
+  static constexpr EmbeddedValue kProperty1[] = {
+      {Type::kString, "type", 0, 0, "boolean", nullptr, 0},
+  };
+  static constexpr EmbeddedValue kState1[] = {
+      {Type::kDictionary, "property1", 0, 0, nullptr, kProperty1, 1},
+  };
+  static constexpr EmbeddedValue kTrait1[] = {
+      {Type::kDictionary, "commands", 0, 0, nullptr, kCommands, 1},
+      {Type::kDictionary, "state", 0, 0, nullptr, kState1, 1},
+  };
+  static constexpr EmbeddedValue kProperty2[] = {
+      {Type::kString, "type", 0, 0, "string", nullptr, 0},
+  };
+  static constexpr EmbeddedValue kState2[] = {
+      {Type::kDictionary, "property2", 0, 0, nullptr, kProperty2, 1},
+  };
+  static constexpr EmbeddedValue kTrait2[] = {
+      {Type::kDictionary, "state", 0, 0, nullptr, kState2, 1},
+  };
+  static constexpr EmbeddedValue kTraits[] = {
+      {Type::kDictionary, "trait1", 0, 0, nullptr, kTrait1, 2},
+      {Type::kDictionary, "trait2", 0, 0, nullptr, kTrait2, 1},
+  };
+  EXPECT_TRUE(manager_.LoadTraits(
+      EmbeddedValue{Type::kDictionary, nullptr, 0, 0, nullptr, kTraits, 2},
+      nullptr));
+  const char kExpected[] = R"({
+    "trait1": {
+      "commands": {
+        "command1": {
+          "minimalRole": "user",
+          "parameters": {"height": {"type": "integer"}}
+        }
+      },
+      "state": {
+        "property1": {"type": "boolean"}
+      }
+    },
+    "trait2": {
+      "state": {
+        "property2": {"type": "string"}
+      }
+    }
+  })";
+  EXPECT_JSON_EQ(kExpected, manager_.GetTraits());
+
+  ErrorPtr error;
+  EXPECT_FALSE(manager_.LoadTraits(
+      EmbeddedValue{Type::kList, nullptr, 0, 0, nullptr, nullptr, 0}, &error));
+  EXPECT_TRUE(error->HasError("json_object_expected"));
+}
+
 TEST_F(ComponentManagerTest, LoadTraitsDuplicateIdentical) {
   const char kTraits1[] = R"({
     "trait1": {
@@ -263,6 +338,7 @@ TEST_F(ComponentManagerTest, AddTraitDefChangedCallback) {
   })";
   auto json = CreateDictionaryValue(kTraits1);
   EXPECT_TRUE(manager_.LoadTraits(*json, nullptr));
+  task_runner_.RunPendingTasks();
   EXPECT_EQ(2, count);
   // Duplicate definition, shouldn't call the callback.
   const char kTraits2[] = R"({
@@ -274,6 +350,7 @@ TEST_F(ComponentManagerTest, AddTraitDefChangedCallback) {
   })";
   json = CreateDictionaryValue(kTraits2);
   EXPECT_TRUE(manager_.LoadTraits(*json, nullptr));
+  task_runner_.RunPendingTasks();
   EXPECT_EQ(2, count);
   // New definition, should call the callback now.
   const char kTraits3[] = R"({
@@ -285,6 +362,7 @@ TEST_F(ComponentManagerTest, AddTraitDefChangedCallback) {
   })";
   json = CreateDictionaryValue(kTraits3);
   EXPECT_TRUE(manager_.LoadTraits(*json, nullptr));
+  task_runner_.RunPendingTasks();
   EXPECT_EQ(3, count);
   // Wrong definition, shouldn't call the callback.
   const char kTraits4[] = R"({
@@ -292,6 +370,7 @@ TEST_F(ComponentManagerTest, AddTraitDefChangedCallback) {
   })";
   json = CreateDictionaryValue(kTraits4);
   EXPECT_FALSE(manager_.LoadTraits(*json, nullptr));
+  task_runner_.RunPendingTasks();
   EXPECT_EQ(3, count);
   // Make sure both callbacks were called the same number of times.
   EXPECT_EQ(count2, count);
@@ -305,6 +384,127 @@ TEST_F(ComponentManagerTest, LoadTraitsNotAnObject) {
   EXPECT_EQ(errors::commands::kTypeMismatch, error->GetCode());
 }
 
+TEST_F(ComponentManagerTest, GetTraitsJson) {
+  EXPECT_EQ("{}", manager_.GetTraitsJson());
+  ASSERT_TRUE(manager_.LoadTraits(R"({"t1": {"state": {}}})", nullptr));
+  const std::string& json = manager_.GetTraitsJson();
+  EXPECT_EQ(R"({"t1":{"state":{}}})", json);
+  // Loading identical definitions keeps the serialized text.
+  const char* data = json.data();
+  ASSERT_TRUE(manager_.LoadTraits(R"({"t1": {"state": {}}})", nullptr));
+  EXPECT_EQ(data, manager_.GetTraitsJson().data());
+  ASSERT_TRUE(manager_.LoadTraits(R"({"t2": {}})", nullptr));
+  EXPECT_EQ(R"({"t1":{"state":{}},"t2":{}})", manager_.GetTraitsJson());
+}
+
+TEST_F(ComponentManagerTest, Fingerprints) {
+  // Managers with the same content have the same fingerprints, as a device
+  // has after a restart.
+  CreateTestComponentTree(&manager_);
+  ComponentManagerImpl other{&task_runner_, &clock_};
+  CreateTestComponentTree(&other);
+  EXPECT_EQ(manager_.GetTraitsFingerprint(), other.GetTraitsFingerprint());
+  EXPECT_EQ(manager_.GetStateFingerprint(), other.GetStateFingerprint());
+  EXPECT_EQ(manager_.GetComponentsFingerprint(),
+            other.GetComponentsFingerprint());
+  const uint64_t traits = manager_.GetTraitsFingerprint();
+  const uint64_t state = manager_.GetStateFingerprint();
+  const uint64_t components = manager_.GetComponentsFingerprint();
+
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1.comp2[1].comp3", R"({"t4": {"p": 1, "q": "a"}})", nullptr));
+  EXPECT_EQ(traits, manager_.GetTraitsFingerprint());
+  EXPECT_NE(state, manager_.GetStateFingerprint());
+  EXPECT_NE(components, manager_.GetComponentsFingerprint());
+
+  // Properties set in another order, and integers set as doubles, don't
+  // change the fingerprints.
+  ASSERT_TRUE(other.SetStatePropertiesFromJson(
+      "comp1.comp2[1].comp3", R"({"t4": {"q": "a"}})", nullptr));
+  EXPECT_NE(manager_.GetStateFingerprint(), other.GetStateFingerprint());
+  ASSERT_TRUE(other.SetStatePropertiesFromJson(
+      "comp1.comp2[1].comp3", R"({"t4": {"p": 1.0}})", nullptr));
+  EXPECT_EQ(manager_.GetStateFingerprint(), other.GetStateFingerprint());
+  EXPECT_EQ(manager_.GetComponentsFingerprint(),
+            other.GetComponentsFingerprint());
+
+  // Setting the same value again keeps the fingerprints.
+  const uint64_t new_state = manager_.GetStateFingerprint();
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1.comp2[1].comp3", R"({"t4": {"p": 1}})", nullptr));
+  EXPECT_EQ(new_state, manager_.GetStateFingerprint());
+
+  // Components without state don't change the state fingerprint.
+  const uint64_t new_components = manager_.GetComponentsFingerprint();
+  ASSERT_TRUE(manager_.AddComponent("", "comp5", {"t1"}, nullptr));
+  EXPECT_NE(new_components, manager_.GetComponentsFingerprint());
+  EXPECT_EQ(new_state, manager_.GetStateFingerprint());
+  EXPECT_EQ(traits, manager_.GetTraitsFingerprint());
+
+  ASSERT_TRUE(manager_.LoadTraits(R"({"t7": {}})", nullptr));
+  EXPECT_NE(traits, manager_.GetTraitsFingerprint());
+}
+
+TEST_F(ComponentManagerTest, RestoreSnapshot) {
+  CreateTestComponentTree(&manager_);
+  ASSERT_TRUE(manager_.LoadTraits(
+      R"({"t7": {"state": {"p": {"type": "integer"}}}})", nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp5", {"t7"}, nullptr));
+  ASSERT_TRUE(
+      manager_.SetStatePropertiesFromJson("comp5", R"({"t7": {"p": 5}})",
+                                          nullptr));
+  std::string json;
+  {
+    JsonStreamWriter writer{&json};
+    manager_.WriteSnapshot(&writer);
+  }
+  auto snapshot = CreateDictionaryValue(json);
+
+  ComponentManagerImpl restored{&task_runner_, &clock_};
+  ASSERT_TRUE(restored.RestoreSnapshot(*snapshot, nullptr));
+  EXPECT_TRUE(manager_.GetTraits().Equals(&restored.GetTraits()));
+  EXPECT_TRUE(manager_.GetComponents().Equals(&restored.GetComponents()));
+  EXPECT_NE(nullptr,
+            restored.FindComponent("comp1.comp2[1].comp3.comp4", nullptr));
+  const base::Value* value =
+      restored.GetStateProperty("comp5", "t7.p", nullptr);
+  ASSERT_NE(nullptr, value);
+  EXPECT_JSON_EQ("5", *value);
+  EXPECT_FALSE(restored.SetStatePropertiesFromJson(
+      "comp5", R"({"t7": {"p": "five"}})", nullptr));
+
+  // Existing components are kept, and traits must not be redefined.
+  ASSERT_TRUE(restored.SetStatePropertiesFromJson(
+      "comp5", R"({"t7": {"p": 6}})", nullptr));
+  EXPECT_TRUE(restored.RestoreSnapshot(*snapshot, nullptr));
+  EXPECT_JSON_EQ("6", *restored.GetStateProperty("comp5", "t7.p", nullptr));
+  snapshot->Set("traits.t1", CreateDictionaryValue("{'commands': {}}"));
+  EXPECT_FALSE(restored.RestoreSnapshot(*snapshot, nullptr));
+}
+
+TEST_F(ComponentManagerTest, RestoreInvalidSnapshot) {
+  const char* const kSnapshots[] = {
+      R"({"traits": {"t1": {}}})",
+      R"({"traits": {"t1": {}}, "components": {"comp1": 1}})",
+      R"({"traits": {"t1": {}}, "components": {"comp1": {}}})",
+      R"({"traits": {"t1": {}}, "components": {"comp1": {"traits": ["t2"]}}})",
+      R"({"traits": {"t1": {}}, "components": {"comp1": {"traits": ["t1"],
+          "components": {"comp2": [{"traits": ["t1"]}, 1]}}}})",
+      R"({"traits": {"t1": {"state": {"p": {"type": "blob"}}}},
+          "components": {}})",
+  };
+  for (const char* json : kSnapshots) {
+    ErrorPtr error;
+    EXPECT_FALSE(
+        manager_.RestoreSnapshot(*CreateDictionaryValue(json), &error))
+        << json;
+    EXPECT_NE(nullptr, error.get());
+    // Nothing is restored from an invalid snapshot.
+    EXPECT_TRUE(manager_.GetTraits().empty());
+    EXPECT_TRUE(manager_.GetComponents().empty());
+  }
+}
+
 TEST_F(ComponentManagerTest, FindTraitDefinition) {
   const char kTraits[] = R"({
     "trait1": {
@@ -399,7 +599,11 @@ TEST_F(ComponentManagerTest, FindCommandDefinition) {
     "minimalRole": "owner"
   })";
   EXPECT_JSON_EQ(kExpected3, *cmd_def);
+  EXPECT_EQ(cmd_def, manager_.FindCommandDefinition(" trait2 . command2 "));
 
+  EXPECT_EQ(nullptr, manager_.FindCommandDefinition("trait1.command2"));
+  EXPECT_EQ(nullptr, manager_.FindCommandDefinition("trait1"));
+  EXPECT_EQ(nullptr, manager_.FindCommandDefinition("trait1.command1.x"));
   EXPECT_EQ(nullptr, manager_.FindTraitDefinition("trait1.command2"));
   EXPECT_EQ(nullptr, manager_.FindTraitDefinition("trait3.command1"));
   EXPECT_EQ(nullptr, manager_.FindTraitDefinition("trait"));
@@ -481,6 +685,10 @@ TEST_F(ComponentManagerTest, GetStateMinimalRole) {
   ASSERT_TRUE(manager_.GetStateMinimalRole("trait2.property2", &role, nullptr));
   EXPECT_EQ(UserRole::kOwner, role);
 
+  ASSERT_TRUE(
+      manager_.GetStateMinimalRole(" trait2.property2 ", &role, nullptr));
+  EXPECT_EQ(UserRole::kOwner, role);
+
   ASSERT_FALSE(
       manager_.GetStateMinimalRole("trait2.property3", &role, nullptr));
 }
@@ -637,21 +845,37 @@ TEST_F(ComponentManagerTest, AddComponentTreeChangedCallback) {
   EXPECT_EQ(1, count);
   EXPECT_EQ(1, count2);
   EXPECT_TRUE(manager_.AddComponent("", "comp1", {}, nullptr));
+  task_runner_.RunPendingTasks();
   EXPECT_EQ(2, count);
   EXPECT_TRUE(manager_.AddComponent("comp1", "comp2", {}, nullptr));
+  task_runner_.RunPendingTasks();
   EXPECT_EQ(3, count);
   EXPECT_TRUE(manager_.AddComponent("comp1.comp2", "comp4", {}, nullptr));
+  task_runner_.RunPendingTasks();
   EXPECT_EQ(4, count);
   EXPECT_TRUE(manager_.AddComponentArrayItem("comp1", "comp3", {}, nullptr));
+  task_runner_.RunPendingTasks();
   EXPECT_EQ(5, count);
   EXPECT_TRUE(manager_.AddComponentArrayItem("comp1", "comp3", {}, nullptr));
+  task_runner_.RunPendingTasks();
   EXPECT_EQ(6, count);
   EXPECT_TRUE(manager_.RemoveComponentArrayItem("comp1", "comp3", 1, nullptr));
+  task_runner_.RunPendingTasks();
   EXPECT_EQ(7, count);
   EXPECT_TRUE(manager_.RemoveComponent("", "comp1", nullptr));
+  task_runner_.RunPendingTasks();
   EXPECT_EQ(8, count);
   // Make sure both callbacks were called the same number of times.
   EXPECT_EQ(count2, count);
+
+  // A burst of changes is reported once.
+  EXPECT_TRUE(manager_.AddComponent("", "comp1", {}, nullptr));
+  EXPECT_TRUE(manager_.AddComponent("comp1", "comp2", {}, nullptr));
+  EXPECT_TRUE(manager_.RemoveComponent("comp1", "comp2", nullptr));
+  EXPECT_EQ(8, count);
+  task_runner_.RunPendingTasks();
+  EXPECT_EQ(9, count);
+  EXPECT_EQ(count2, count);
 }
 
 TEST_F(ComponentManagerTest, FindComponent) {
@@ -702,6 +926,34 @@ TEST_F(ComponentManagerTest, FindComponent) {
   EXPECT_EQ(nullptr, manager_.FindComponent("comp1.comp2[1", nullptr));
 }
 
+TEST_F(ComponentManagerTest, FindComponentAfterTreeChanges) {
+  CreateTestComponentTree(&manager_);
+  const base::DictionaryValue* comp1 = manager_.FindComponent("comp1", nullptr);
+  ASSERT_NE(nullptr, comp1);
+
+  EXPECT_TRUE(manager_.RemoveComponentArrayItem("comp1", "comp2", 0, nullptr));
+  EXPECT_EQ(comp1, manager_.FindComponent("comp1", nullptr));
+  EXPECT_EQ(nullptr, manager_.FindComponent("comp1.comp2[1]", nullptr));
+
+  const base::DictionaryValue* comp =
+      manager_.FindComponent("comp1.comp2[0]", nullptr);
+  ASSERT_NE(nullptr, comp);
+  EXPECT_TRUE(HasTrait(*comp, "t3"));
+  comp = manager_.FindComponent("comp1.comp2[0].comp3.comp4", nullptr);
+  ASSERT_NE(nullptr, comp);
+  EXPECT_TRUE(HasTrait(*comp, "t5"));
+
+  EXPECT_TRUE(manager_.AddComponent(" comp1 . comp2[0] ", "comp5", {"t6"},
+                                    nullptr));
+  comp = manager_.FindComponent("comp1.comp2[0].comp5", nullptr);
+  ASSERT_NE(nullptr, comp);
+  EXPECT_TRUE(HasTrait(*comp, "t6"));
+
+  EXPECT_TRUE(manager_.RemoveComponent("", "comp1", nullptr));
+  EXPECT_EQ(nullptr, manager_.FindComponent("comp1", nullptr));
+  EXPECT_EQ(nullptr, manager_.FindComponent("comp1.comp2[0]", nullptr));
+}
+
 TEST_F(ComponentManagerTest, ParseCommandInstance) {
   const char kTraits[] = R"({
     "trait1": {
@@ -805,6 +1057,233 @@ TEST_F(ComponentManagerTest, ParseCommandInstance) {
                 .get());
 }
 
+TEST_F(ComponentManagerTest, ParseCommandInstanceDeadline) {
+  const char kTraits[] = R"({
+    "trait1": {
+      "commands": {
+        "command1": {"minimalRole": "user", "expirationTimeoutMs": 30000},
+        "command2": {"minimalRole": "user"}
+      }
+    }
+  })";
+  auto traits = CreateDictionaryValue(kTraits);
+  ASSERT_TRUE(manager_.LoadTraits(*traits, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp1", {"trait1"}, nullptr));
+
+  const base::Time now = base::Time::FromTimeT(1450000000);
+  EXPECT_CALL(clock_, Now()).WillRepeatedly(Return(now));
+  auto command = CreateDictionaryValue(R"({"name": "trait1.command1"})");
+  auto instance = manager_.ParseCommandInstance(
+      *command, Command::Origin::kLocal, UserRole::kUser, nullptr, nullptr);
+  ASSERT_NE(nullptr, instance.get());
+  EXPECT_EQ(now + base::TimeDelta::FromSeconds(30), instance->GetDeadline());
+
+  // The deadline of the cloud goes first.
+  command->SetString("expirationTimeMs", "1450000005000");
+  instance = manager_.ParseCommandInstance(*command, Command::Origin::kCloud,
+                                           UserRole::kUser, nullptr, nullptr);
+  ASSERT_NE(nullptr, instance.get());
+  EXPECT_EQ(now + base::TimeDelta::FromSeconds(5), instance->GetDeadline());
+
+  command = CreateDictionaryValue(R"({"name": "trait1.command2"})");
+  instance = manager_.ParseCommandInstance(*command, Command::Origin::kLocal,
+                                           UserRole::kUser, nullptr, nullptr);
+  ASSERT_NE(nullptr, instance.get());
+  EXPECT_TRUE(instance->GetDeadline().is_null());
+}
+
+TEST_F(ComponentManagerTest, ParseCommandInstanceSuperseding) {
+  const char kTraits[] = R"({
+    "trait1": {
+      "commands": {
+        "command1": {"minimalRole": "user", "superseding": true},
+        "command2": {"minimalRole": "user"}
+      }
+    }
+  })";
+  auto traits = CreateDictionaryValue(kTraits);
+  ASSERT_TRUE(manager_.LoadTraits(*traits, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp1", {"trait1"}, nullptr));
+
+  auto command = CreateDictionaryValue(R"({"name": "trait1.command1"})");
+  auto instance = manager_.ParseCommandInstance(
+      *command, Command::Origin::kLocal, UserRole::kUser, nullptr, nullptr);
+  ASSERT_NE(nullptr, instance.get());
+  EXPECT_TRUE(instance->IsSuperseding());
+
+  command = CreateDictionaryValue(R"({"name": "trait1.command2"})");
+  instance = manager_.ParseCommandInstance(*command, Command::Origin::kLocal,
+                                           UserRole::kUser, nullptr, nullptr);
+  ASSERT_NE(nullptr, instance.get());
+  EXPECT_FALSE(instance->IsSuperseding());
+}
+
+TEST_F(ComponentManagerTest, ParseCommandInstanceValidatesParameters) {
+  const char kTraits[] = R"({
+    "trait1": {
+      "commands": {
+        "command1": {
+          "minimalRole": "user",
+          "parameters": {
+            "height": {"type": "integer", "minimum": 0, "maximum": 10},
+            "mode": {"type": "string", "enum": ["fast", "slow"]}
+          }
+        }
+      }
+    }
+  })";
+  auto traits = CreateDictionaryValue(kTraits);
+  ASSERT_TRUE(manager_.LoadTraits(*traits, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp1", {"trait1"}, nullptr));
+
+  auto command = CreateDictionaryValue(R"({
+    "name": "trait1.command1",
+    "parameters": {"height": 5, "mode": "slow"}
+  })");
+  EXPECT_NE(nullptr,
+            manager_.ParseCommandInstance(*command, Command::Origin::kLocal,
+                                          UserRole::kUser, nullptr, nullptr)
+                .get());
+
+  const char* const kInvalidParameters[] = {
+      "{'height': 11}", "{'height': 'high'}", "{'mode': 'medium'}",
+  };
+  for (const char* parameters : kInvalidParameters) {
+    command->Set("parameters", CreateDictionaryValue(parameters).release());
+    ErrorPtr error;
+    EXPECT_EQ(nullptr,
+              manager_.ParseCommandInstance(*command, Command::Origin::kLocal,
+                                            UserRole::kUser, nullptr, &error)
+                  .get())
+        << parameters;
+    EXPECT_TRUE(error->HasError("invalid_parameter_value"));
+  }
+}
+
+TEST_F(ComponentManagerTest, LoadTraitsInvalidSchema) {
+  auto traits = CreateDictionaryValue(R"({
+    "trait1": {"state": {"p": {"type": "int"}}}
+  })");
+  ErrorPtr error;
+  EXPECT_FALSE(manager_.LoadTraits(*traits, &error));
+  EXPECT_TRUE(error->HasError("invalid_parameter_value"));
+  EXPECT_EQ(nullptr, manager_.FindTraitDefinition("trait1"));
+}
+
+TEST_F(ComponentManagerTest, LazyTraits) {
+  using Type = EmbeddedValue::Type;
+  static constexpr EmbeddedValue kProperty3[] = {
+      {Type::kString, "type", 0, 0, "integer", nullptr, 0},
+  };
+  static constexpr EmbeddedValue kState3[] = {
+      {Type::kDictionary, "property3", 0, 0, nullptr, kProperty3, 1},
+  };
+  static constexpr EmbeddedValue kTrait3[] = {
+      {Type::kDictionary, "state", 0, 0, nullptr, kState3, 1},
+  };
+  static constexpr EmbeddedValue kTraits[] = {
+      {Type::kDictionary, "trait3", 0, 0, nullptr, kTrait3, 1},
+  };
+  const char kTraits12[] = R"({
+    "trait1": {
+      "commands": {"command1": {"minimalRole": "user"}},
+      "state": {"property1": {"type": "boolean"}}
+    },
+    "trait2": {"state": {"property2": {"type": "int"}}}
+  })";
+  manager_.EnableLazyTraits();
+  EXPECT_TRUE(manager_.LoadTraits(kTraits12, nullptr));
+  EXPECT_TRUE(manager_.LoadTraits(
+      EmbeddedValue{Type::kDictionary, nullptr, 0, 0, nullptr, kTraits, 1},
+      nullptr));
+  // Nothing is parsed until used.
+  EXPECT_TRUE(manager_.GetTraits().empty());
+  EXPECT_EQ(nullptr, manager_.FindCommandDefinition("trait1.command1"));
+  task_runner_.RunPendingTasks();
+
+  int trait_changes = 0;
+  manager_.AddTraitDefChangedCallback(
+      base::Bind([](int* changes) { ++*changes; }, &trait_changes));
+  ASSERT_TRUE(manager_.AddComponent("", "comp1", {"trait1"}, nullptr));
+  ASSERT_TRUE(manager_.AddComponentArrayItem("", "comp2", {"trait3"}, nullptr));
+  EXPECT_JSON_EQ(R"({
+    "trait1": {
+      "commands": {"command1": {"minimalRole": "user"}},
+      "state": {"property1": {"type": "boolean"}}
+    },
+    "trait3": {"state": {"property3": {"type": "integer"}}}
+  })",
+                 manager_.GetTraits());
+  EXPECT_NE(nullptr, manager_.FindCommandDefinition("trait1.command1"));
+  EXPECT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp2[0]", R"({"trait3": {"property3": 3}})", nullptr));
+  task_runner_.RunPendingTasks();
+  EXPECT_EQ(2, trait_changes);
+
+  // Pending traits can't be redefined either.
+  ErrorPtr error;
+  EXPECT_FALSE(manager_.LoadTraits(R"({"trait2": {}})", &error));
+  EXPECT_TRUE(error->HasError("type_mismatch"));
+  EXPECT_TRUE(manager_.LoadTraits(
+      R"({"trait2": {"state": {"property2": {"type": "int"}}}})", nullptr));
+
+  // Invalid definitions are only found when used.
+  error.reset();
+  EXPECT_FALSE(manager_.AddComponent("", "comp3", {"trait2"}, &error));
+  EXPECT_TRUE(error->HasError("invalid_parameter_value"));
+  EXPECT_EQ(nullptr, manager_.FindComponent("comp3", nullptr));
+  EXPECT_EQ(nullptr, manager_.FindTraitDefinition("trait2"));
+}
+
+TEST_F(ComponentManagerTest, CreateCommandInstance) {
+  const char kTraits[] = R"({
+    "trait1": {
+      "commands": {
+        "command1": {
+          "minimalRole": "manager",
+          "parameters": {"height": {"type": "integer", "maximum": 10}}
+        }
+      }
+    }
+  })";
+  ASSERT_TRUE(manager_.LoadTraits(kTraits, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp1", {"trait1"}, nullptr));
+
+  auto parameters = CreateDictionaryValue(R"({"height": 5})");
+  std::string id;
+  auto command = manager_.CreateCommandInstance(
+      "comp1", "trait1.command1", *parameters, Command::Origin::kLocal,
+      UserRole::kManager, &id, nullptr);
+  ASSERT_NE(nullptr, command);
+  EXPECT_FALSE(id.empty());
+  EXPECT_EQ(id, command->GetID());
+  EXPECT_EQ("comp1", command->GetComponent());
+  EXPECT_EQ(Command::Origin::kLocal, command->GetOrigin());
+  EXPECT_JSON_EQ(R"({"height": 5})", command->GetParameters());
+
+  // Routed to the component with the trait.
+  command = manager_.CreateCommandInstance("", "trait1.command1", *parameters,
+                                           Command::Origin::kLocal,
+                                           UserRole::kOwner, nullptr, nullptr);
+  ASSERT_NE(nullptr, command);
+  EXPECT_EQ("comp1", command->GetComponent());
+
+  ErrorPtr error;
+  EXPECT_EQ(nullptr, manager_.CreateCommandInstance(
+                         "comp1", "trait1.command1", *parameters,
+                         Command::Origin::kLocal, UserRole::kUser, nullptr,
+                         &error));
+  EXPECT_TRUE(error->HasError("access_denied"));
+
+  error.reset();
+  parameters = CreateDictionaryValue(R"({"height": 11})");
+  EXPECT_EQ(nullptr, manager_.CreateCommandInstance(
+                         "comp1", "trait1.command1", *parameters,
+                         Command::Origin::kLocal, UserRole::kOwner, nullptr,
+                         &error));
+  EXPECT_TRUE(error->HasError("invalid_parameter_value"));
+}
+
 TEST_F(ComponentManagerTest, AddCommand) {
   const char kTraits[] = R"({
     "trait1": {
@@ -910,6 +1389,61 @@ TEST_F(ComponentManagerTest, AddCommandHandler) {
   last_tags.clear();
 }
 
+TEST_F(ComponentManagerTest, AddTraitCommandHandler) {
+  const char kTraits[] = R"({
+    "trait1": {
+      "commands": {
+        "command1": { "minimalRole": "user" },
+        "command2": { "minimalRole": "user" }
+      }
+    },
+    "trait2": {
+      "commands": {
+        "command1": { "minimalRole": "user" }
+      }
+    }
+  })";
+  auto traits = CreateDictionaryValue(kTraits);
+  ASSERT_TRUE(manager_.LoadTraits(*traits, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp", {"trait1", "trait2"}, nullptr));
+
+  std::string last_tags;
+  auto handler = [](std::string* last_tags, int tag,
+                    const std::weak_ptr<Command>& command) {
+    if (!last_tags->empty())
+      *last_tags += ',';
+    *last_tags += std::to_string(tag);
+  };
+  auto add_command = [this](const std::string& name) {
+    base::DictionaryValue command;
+    command.SetString("name", name);
+    command.SetString("component", "comp");
+    auto command_instance = manager_.ParseCommandInstance(
+        command, Command::Origin::kCloud, UserRole::kUser, nullptr, nullptr);
+    ASSERT_NE(nullptr, command_instance.get());
+    manager_.AddCommand(std::move(command_instance));
+  };
+
+  // Queued commands are passed to the handlers as they are added.
+  add_command("trait1.command1");
+  manager_.AddCommandHandler(
+      "comp", "trait1.*", base::Bind(handler, base::Unretained(&last_tags), 1));
+  EXPECT_EQ("1", last_tags);
+  manager_.AddCommandHandler(
+      "comp", "trait1.command1",
+      base::Bind(handler, base::Unretained(&last_tags), 2));
+  manager_.AddCommandHandler(
+      "", "", base::Bind(handler, base::Unretained(&last_tags), 3));
+  EXPECT_EQ("1", last_tags);
+  last_tags.clear();
+
+  // The command handler takes precedence over the trait one.
+  add_command("trait1.command1");
+  add_command("trait1.command2");
+  add_command("trait2.command1");
+  EXPECT_EQ("2,1,3", last_tags);
+}
+
 TEST_F(ComponentManagerTest, AddDefaultCommandHandler) {
   const char kTraits[] = R"({
     "trait1": {
@@ -958,6 +1492,53 @@ TEST_F(ComponentManagerTest, AddDefaultCommandHandler) {
   EXPECT_EQ(2, count);
 }
 
+TEST_F(ComponentManagerTest, SetCommandHandlerPolicy) {
+  const char kTraits[] = R"({
+    "trait1": {
+      "commands": {
+        "command1": { "minimalRole": "user" }
+      }
+    }
+  })";
+  auto traits = CreateDictionaryValue(kTraits);
+  ASSERT_TRUE(manager_.LoadTraits(*traits, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp", {"trait1"}, nullptr));
+
+  CommandHandlerPolicy policy;
+  policy.max_in_flight = 1;
+  ErrorPtr error;
+  EXPECT_FALSE(
+      manager_.SetCommandHandlerPolicy("comp", "trait1.foo", policy, &error));
+  EXPECT_EQ(errors::commands::kInvalidCommandName, error->GetCode());
+  error.reset();
+  EXPECT_FALSE(
+      manager_.SetCommandHandlerPolicy("comp", "trait2.*", policy, &error));
+  EXPECT_EQ(errors::commands::kInvalidCommandName, error->GetCode());
+  error.reset();
+  EXPECT_FALSE(manager_.SetCommandHandlerPolicy("comp", "", policy, &error));
+  EXPECT_EQ(errors::commands::kInvalidCommandName, error->GetCode());
+  EXPECT_TRUE(
+      manager_.SetCommandHandlerPolicy("comp", "trait1.*", policy, nullptr));
+
+  int count = 0;
+  auto handler = [](int* count, const std::weak_ptr<Command>& command) {
+    (*count)++;
+  };
+  manager_.AddCommandHandler("comp", "trait1.*",
+                             base::Bind(handler, base::Unretained(&count)));
+  for (int i = 0; i < 2; ++i) {
+    base::DictionaryValue command;
+    command.SetString("name", "trait1.command1");
+    command.SetString("component", "comp");
+    auto command_instance = manager_.ParseCommandInstance(
+        command, Command::Origin::kCloud, UserRole::kUser, nullptr, nullptr);
+    ASSERT_NE(nullptr, command_instance.get());
+    manager_.AddCommand(std::move(command_instance));
+  }
+  // The second command waits for the first one.
+  EXPECT_EQ(1, count);
+}
+
 TEST_F(ComponentManagerTest, SetStateProperties) {
   CreateTestComponentTree(&manager_);
 
@@ -1059,6 +1640,33 @@ TEST_F(ComponentManagerTest, SetStateProperties) {
   EXPECT_JSON_EQ(kExpected3, manager_.GetComponents());
 }
 
+TEST_F(ComponentManagerTest, SetStatePropertiesMovesValues) {
+  CreateTestComponentTree(&manager_);
+
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1", R"({"t1": {"p1": 0, "p2": "foo"}})", nullptr));
+  std::unique_ptr<base::DictionaryValue> state{new base::DictionaryValue};
+  std::unique_ptr<base::ListValue> list{new base::ListValue};
+  const base::ListValue* original_list = list.get();
+  state->Set("t1.p2", std::move(list));
+  state->SetInteger("t2.p3", 3);
+  ASSERT_TRUE(manager_.SetStateProperties("comp1", std::move(state), nullptr));
+
+  const base::ListValue* p2 = nullptr;
+  ASSERT_TRUE(manager_.GetComponents().GetList("comp1.state.t1.p2", &p2));
+  EXPECT_EQ(original_list, p2);
+  const char kExpected[] = R"({"t1": {"p1": 0, "p2": []}, "t2": {"p3": 3}})";
+  const base::DictionaryValue* comp1_state = nullptr;
+  ASSERT_TRUE(manager_.GetComponents().GetDictionary("comp1.state",
+                                                     &comp1_state));
+  EXPECT_JSON_EQ(kExpected, *comp1_state);
+
+  // The recorded state change keeps a separate copy.
+  auto snapshot = manager_.GetAndClearRecordedStateChanges();
+  ASSERT_EQ(1u, snapshot.state_changes.size());
+  EXPECT_JSON_EQ(kExpected, *snapshot.state_changes[0].changed_properties);
+}
+
 TEST_F(ComponentManagerTest, SetStatePropertiesFromJson) {
   CreateTestComponentTree(&manager_);
 
@@ -1108,7 +1716,7 @@ TEST_F(ComponentManagerTest, SetGetStateProperty) {
     },
     "trait2": {
       "state": {
-        "prop3": { "type": "string" },
+        "prop3": { "type": "integer" },
         "prop4": { "type": "string" }
       }
     }
@@ -1131,6 +1739,9 @@ TEST_F(ComponentManagerTest, SetGetStateProperty) {
   })";
   EXPECT_JSON_EQ(kExpected1, manager_.GetComponents());
 
+  // Value not matching the property schema:
+  EXPECT_FALSE(manager_.SetStateProperty("comp1", "trait2.prop3", p1, nullptr));
+
   base::FundamentalValue p2(2);
   ASSERT_TRUE(manager_.SetStateProperty("comp1", "trait2.prop3", p2, nullptr));
 
@@ -1161,6 +1772,490 @@ TEST_F(ComponentManagerTest, SetGetStateProperty) {
   EXPECT_EQ(nullptr, manager_.GetStateProperty("comp2", "trait.prop", nullptr));
   // Just the package name without property:
   EXPECT_EQ(nullptr, manager_.GetStateProperty("comp1", "trait2", nullptr));
+
+  const base::DictionaryValue* state =
+      manager_.GetComponentState("comp1", nullptr);
+  ASSERT_NE(nullptr, state);
+  EXPECT_JSON_EQ(R"({
+    "trait1": { "prop1": "foo" },
+    "trait2": { "prop3": 2 }
+  })", *state);
+  EXPECT_EQ(nullptr, manager_.GetComponentState("comp2", nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp3", {"trait1"}, nullptr));
+  EXPECT_EQ(nullptr, manager_.GetComponentState("comp3", nullptr));
+}
+
+TEST_F(ComponentManagerTest, SetStatePropertyAllocations) {
+  const char kTraits[] = R"({
+    "trait1": {
+      "state": {
+        "prop1": { "type": "integer" }
+      }
+    }
+  })";
+  ASSERT_TRUE(manager_.LoadTraits(*CreateDictionaryValue(kTraits), nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp1", {"trait1"}, nullptr));
+  ASSERT_TRUE(manager_.SetStateProperty(
+      "comp1", "trait1.prop1", base::FundamentalValue{1}, nullptr));
+
+  base::FundamentalValue value{2};
+  test::AllocationCounter counter;
+  ASSERT_TRUE(
+      manager_.SetStateProperty("comp1", "trait1.prop1", value, nullptr));
+  EXPECT_LE(counter.GetCount(), 11u);
+}
+
+TEST_F(ComponentManagerTest, SetStatePropertyByHandle) {
+  CreateTestComponentTree(&manager_);
+  ErrorPtr error;
+  EXPECT_EQ(0u, manager_.ResolveStateProperty("comp1", "t1", &error));
+  EXPECT_NE(nullptr, error.get());
+  error.reset();
+  EXPECT_EQ(0u, manager_.ResolveStateProperty("comp5", "t1.p", &error));
+  EXPECT_NE(nullptr, error.get());
+
+  auto handle1 = manager_.ResolveStateProperty("comp1", "t1.p", nullptr);
+  EXPECT_NE(0u, handle1);
+  EXPECT_EQ(handle1, manager_.ResolveStateProperty("comp1", "t1.p", nullptr));
+  auto handle2 =
+      manager_.ResolveStateProperty(" comp1.comp2[ 1 ]", "t3.p", nullptr);
+  EXPECT_NE(0u, handle2);
+  EXPECT_EQ(handle2,
+            manager_.ResolveStateProperty("comp1.comp2[1]", "t3.p", nullptr));
+  auto handle3 = manager_.ResolveStateProperty("comp1.comp2[1].comp3.comp4",
+                                               "t5.p", nullptr);
+  EXPECT_NE(0u, handle3);
+
+  auto last_id = manager_.GetLastStateChangeId();
+  EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+      handle1, base::FundamentalValue{1}, nullptr));
+  EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+      handle3, base::FundamentalValue{3}, nullptr));
+  EXPECT_EQ(last_id + 2, manager_.GetLastStateChangeId());
+  auto snapshot = manager_.GetAndClearRecordedStateChanges();
+  ASSERT_EQ(2u, snapshot.state_changes.size());
+  EXPECT_EQ("comp1", snapshot.state_changes[0].component);
+  EXPECT_EQ("comp1.comp2[1].comp3.comp4",
+            snapshot.state_changes[1].component);
+
+  const base::Value* value =
+      manager_.GetStateProperty("comp1.comp2[1].comp3.comp4", "t5.p", nullptr);
+  ASSERT_NE(nullptr, value);
+  EXPECT_TRUE(base::FundamentalValue{3}.Equals(value));
+
+  // Removing a component invalidates handles for it and its sub-components.
+  EXPECT_TRUE(manager_.RemoveComponentArrayItem("comp1", "comp2", 1, nullptr));
+  EXPECT_FALSE(manager_.SetStatePropertyByHandle(
+      handle2, base::FundamentalValue{2}, &error));
+  EXPECT_NE(nullptr, error.get());
+  EXPECT_FALSE(manager_.SetStatePropertyByHandle(
+      handle3, base::FundamentalValue{3}, nullptr));
+  EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+      handle1, base::FundamentalValue{4}, nullptr));
+}
+
+TEST_F(ComponentManagerTest, RemoveComponentArrayItemKeepsLaterItems) {
+  auto traits = CreateDictionaryValue(R"({
+    "t1": {"state": {"p": {"type": "integer"}}},
+    "t2": {}
+  })");
+  ASSERT_TRUE(manager_.LoadTraits(*traits, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "bridge", {}, nullptr));
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(
+        manager_.AddComponentArrayItem("bridge", "items", {"t1"}, nullptr));
+  }
+  ASSERT_TRUE(manager_.AddComponent("bridge.items[2]", "sub", {"t1", "t2"},
+                                    nullptr));
+  auto item = manager_.ResolveStateProperty("bridge.items[2]", "t1.p", nullptr);
+  auto sub =
+      manager_.ResolveStateProperty("bridge.items[2].sub", "t1.p", nullptr);
+  auto removed =
+      manager_.ResolveStateProperty("bridge.items[0]", "t1.p", nullptr);
+
+  EXPECT_TRUE(manager_.RemoveComponentArrayItem("bridge", "items", 0, nullptr));
+  EXPECT_FALSE(manager_.SetStatePropertyByHandle(
+      removed, base::FundamentalValue{0}, nullptr));
+  // The handles of the later items follow them to their new paths.
+  EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+      item, base::FundamentalValue{1}, nullptr));
+  EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+      sub, base::FundamentalValue{2}, nullptr));
+  EXPECT_EQ(item,
+            manager_.ResolveStateProperty("bridge.items[1]", "t1.p", nullptr));
+  EXPECT_EQ(nullptr, manager_.FindComponent("bridge.items[2]", nullptr));
+  const base::Value* value =
+      manager_.GetStateProperty("bridge.items[1].sub", "t1.p", nullptr);
+  ASSERT_NE(nullptr, value);
+  EXPECT_TRUE(base::FundamentalValue{2}.Equals(value));
+
+  EXPECT_TRUE(manager_.RemoveComponent("bridge", "items", nullptr));
+  EXPECT_FALSE(manager_.SetStatePropertyByHandle(
+      sub, base::FundamentalValue{3}, nullptr));
+  EXPECT_EQ("", manager_.FindComponentWithTrait("t2"));
+  ASSERT_TRUE(manager_.AddComponent("", "top", {"t2"}, nullptr));
+  EXPECT_EQ("top", manager_.FindComponentWithTrait("t2"));
+}
+
+TEST_F(ComponentManagerTest, RebuildIndexKeepsMovedItems) {
+  auto traits = CreateDictionaryValue(R"({
+    "t1": {"state": {"p": {"type": "integer"}}}
+  })");
+  ASSERT_TRUE(manager_.LoadTraits(*traits, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "bridge", {}, nullptr));
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(
+        manager_.AddComponentArrayItem("bridge", "items", {"t1"}, nullptr));
+  }
+  StateHistoryPolicy policy;
+  policy.overflow = StateHistoryPolicy::Overflow::kCoalesce;
+  ASSERT_TRUE(
+      manager_.SetStateHistoryPolicy("bridge.items[2]", policy, nullptr));
+  auto last = manager_.ResolveStateProperty("bridge.items[2]", "t1.p", nullptr);
+  auto middle =
+      manager_.ResolveStateProperty("bridge.items[1]", "t1.p", nullptr);
+
+  // A path not in its canonical form rebuilds the whole index.
+  EXPECT_TRUE(
+      manager_.RemoveComponentArrayItem(" bridge ", "items", 1, nullptr));
+  EXPECT_FALSE(manager_.SetStatePropertyByHandle(
+      middle, base::FundamentalValue{0}, nullptr));
+  EXPECT_EQ(last,
+            manager_.ResolveStateProperty("bridge.items[1]", "t1.p", nullptr));
+  manager_.GetAndClearRecordedStateChanges();
+
+  // The moved item keeps its handle and its history policy.
+  base::Time time1 = base::Time::Now();
+  EXPECT_CALL(clock_, Now()).WillRepeatedly(Return(time1));
+  EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+      last, base::FundamentalValue{1}, nullptr));
+  EXPECT_CALL(clock_, Now())
+      .WillRepeatedly(Return(time1 + base::TimeDelta::FromSeconds(1)));
+  EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+      last, base::FundamentalValue{2}, nullptr));
+  auto snapshot = manager_.GetAndClearRecordedStateChanges();
+  ASSERT_EQ(1u, snapshot.state_changes.size());
+  EXPECT_EQ("bridge.items[1]", snapshot.state_changes[0].component);
+  EXPECT_JSON_EQ("{'t1': {'p': 2}}",
+                 *snapshot.state_changes[0].changed_properties);
+}
+
+TEST_F(ComponentManagerTest, SetStatePropertyByHandleTypedSlot) {
+  auto traits = CreateDictionaryValue(R"({
+    "t": {"state": {
+      "level": {"type": "integer"},
+      "temperature": {"type": "number"},
+      "mode": {"type": "string", "enum": ["on", "off"]}
+    }}
+  })");
+  ASSERT_TRUE(manager_.LoadTraits(*traits, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp1", {"t"}, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp2", {"t"}, nullptr));
+  StateHistoryPolicy policy;
+  policy.overflow = StateHistoryPolicy::Overflow::kCoalesce;
+  ASSERT_TRUE(manager_.SetStateHistoryPolicy("comp1", policy, nullptr));
+
+  auto level1 = manager_.ResolveStateProperty("comp1", "t.level", nullptr);
+  auto temperature1 =
+      manager_.ResolveStateProperty("comp1", "t.temperature", nullptr);
+  auto mode2 = manager_.ResolveStateProperty("comp2", "t.mode", nullptr);
+  auto last_id = manager_.GetLastStateChangeId();
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+        level1, base::FundamentalValue{i}, nullptr));
+  }
+  // Not of the slot type, but still a number.
+  EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+      temperature1, base::FundamentalValue{20}, nullptr));
+  EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+      temperature1, base::FundamentalValue{20.5}, nullptr));
+  base::Time time1 = base::Time::Now();
+  EXPECT_CALL(clock_, Now()).WillRepeatedly(Return(time1));
+  EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+      mode2, base::StringValue{"on"}, nullptr));
+  EXPECT_CALL(clock_, Now())
+      .WillRepeatedly(Return(time1 + base::TimeDelta::FromSeconds(1)));
+  EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+      mode2, base::StringValue{"off"}, nullptr));
+  EXPECT_FALSE(manager_.SetStatePropertyByHandle(
+      mode2, base::StringValue{"dim"}, nullptr));
+  EXPECT_EQ(last_id + 14, manager_.GetLastStateChangeId());
+
+  const char kExpected[] = R"({
+    "comp1": {
+      "traits": ["t"],
+      "state": {"t": {"level": 9, "temperature": 20.5}}
+    },
+    "comp2": {
+      "traits": ["t"],
+      "state": {"t": {"mode": "off"}}
+    }
+  })";
+  EXPECT_JSON_EQ(kExpected, manager_.GetComponents());
+
+  // The coalescing component reports the latest values only, the other one
+  // every change.
+  auto snapshot = manager_.GetAndClearRecordedStateChanges();
+  std::vector<std::string> changes;
+  for (const auto& change : snapshot.state_changes) {
+    std::string json;
+    base::JSONWriter::Write(*change.changed_properties, &json);
+    changes.push_back(change.component + ":" + json);
+  }
+  EXPECT_THAT(changes, testing::UnorderedElementsAre(
+                           R"(comp1:{"t":{"level":9,"temperature":20.5}})",
+                           R"(comp2:{"t":{"mode":"on"}})",
+                           R"(comp2:{"t":{"mode":"off"}})"));
+
+  // Changes made with other methods see and override slot values.
+  EXPECT_TRUE(manager_.SetStatePropertyByHandle(
+      level1, base::FundamentalValue{10}, nullptr));
+  EXPECT_TRUE(manager_.SetStateProperty("comp1", "t.temperature",
+                                        base::FundamentalValue{1.5}, nullptr));
+  const base::Value* value =
+      manager_.GetStateProperty("comp1", "t.level", nullptr);
+  ASSERT_NE(nullptr, value);
+  EXPECT_JSON_EQ("10", *value);
+  EXPECT_TRUE(manager_.SetStateProperty("comp1", "t.level",
+                                        base::FundamentalValue{11}, nullptr));
+  auto components = manager_.GetComponentsForUserRole(UserRole::kOwner);
+  const base::DictionaryValue* state = nullptr;
+  ASSERT_TRUE(components->GetDictionary("comp1.state", &state));
+  EXPECT_JSON_EQ("{'t': {'level': 11, 'temperature': 1.5}}", *state);
+}
+
+TEST_F(ComponentManagerTest, SetComponentsState) {
+  CreateTestComponentTree(&manager_);
+  int count = 0;
+  manager_.AddStateChangedCallback(
+      base::Bind([](int* count) { (*count)++; }, base::Unretained(&count)));
+  count = 0;
+  auto last_id = manager_.GetLastStateChangeId();
+
+  // A missing component fails the whole update.
+  auto states = CreateDictionaryValue(R"({
+    'comp1': {'t1': {'p': 1}},
+    'comp5': {'t1': {'p': 2}}
+  })");
+  ErrorPtr error;
+  EXPECT_FALSE(manager_.SetComponentsState(*states, &error));
+  EXPECT_NE(nullptr, error.get());
+  EXPECT_EQ(nullptr, manager_.GetStateProperty("comp1", "t1.p", nullptr));
+  EXPECT_EQ(0, count);
+  EXPECT_EQ(last_id, manager_.GetLastStateChangeId());
+
+  states = CreateDictionaryValue("{'comp1': {'t1': {'p': 1}}}");
+  auto comp4_state = CreateDictionaryValue("{'t5': {'p': 3}}");
+  states->SetWithoutPathExpansion("comp1.comp2[1].comp3.comp4",
+                                  comp4_state.release());
+  EXPECT_TRUE(manager_.SetComponentsState(*states, nullptr));
+  EXPECT_EQ(1, count);
+  EXPECT_EQ(last_id + 1, manager_.GetLastStateChangeId());
+  const base::Value* value =
+      manager_.GetStateProperty("comp1.comp2[1].comp3.comp4", "t5.p", nullptr);
+  ASSERT_NE(nullptr, value);
+  EXPECT_TRUE(base::FundamentalValue{3}.Equals(value));
+  auto snapshot = manager_.GetAndClearRecordedStateChanges();
+  EXPECT_EQ(last_id + 1, snapshot.update_id);
+  ASSERT_EQ(2u, snapshot.state_changes.size());
+  EXPECT_EQ(snapshot.state_changes[0].timestamp,
+            snapshot.state_changes[1].timestamp);
+}
+
+TEST_F(ComponentManagerTest, SetStateHistoryPolicy) {
+  CreateTestComponentTree(&manager_);
+  StateHistoryPolicy policy;
+  policy.overflow = StateHistoryPolicy::Overflow::kCoalesce;
+  ErrorPtr error;
+  EXPECT_FALSE(manager_.SetStateHistoryPolicy("comp5", policy, &error));
+  EXPECT_NE(nullptr, error.get());
+  error.reset();
+  StateHistoryPolicy invalid_policy;
+  invalid_policy.capacity = 0;
+  EXPECT_FALSE(manager_.SetStateHistoryPolicy("comp1", invalid_policy, &error));
+  EXPECT_EQ(errors::commands::kInvalidPropValue, error->GetCode());
+  error.reset();
+  EXPECT_TRUE(manager_.SetStateHistoryPolicy(" comp1 ", policy, nullptr));
+
+  base::Time time1 = base::Time::Now();
+  base::Time time2 = time1 + base::TimeDelta::FromSeconds(1);
+  // The coalescing component keeps the latest value only, while the default
+  // policy records every state transition.
+  for (const auto& path : {"comp1", "comp1.comp2[0]"}) {
+    EXPECT_CALL(clock_, Now()).WillRepeatedly(Return(time1));
+    ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+        path, R"({"t1": {"p": 1}})", nullptr));
+    EXPECT_CALL(clock_, Now()).WillRepeatedly(Return(time2));
+    ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+        path, R"({"t1": {"p": 2}})", nullptr));
+  }
+  auto snapshot = manager_.GetAndClearRecordedStateChanges();
+  ASSERT_EQ(3u, snapshot.state_changes.size());
+  EXPECT_EQ(time1, snapshot.state_changes[0].timestamp);
+  EXPECT_EQ("comp1.comp2[0]", snapshot.state_changes[0].component);
+  EXPECT_EQ(time2, snapshot.state_changes[1].timestamp);
+  EXPECT_EQ(time2, snapshot.state_changes[2].timestamp);
+  EXPECT_JSON_EQ("{'t1': {'p': 2}}",
+                 *snapshot.state_changes[1].changed_properties);
+  EXPECT_JSON_EQ("{'t1': {'p': 2}}",
+                 *snapshot.state_changes[2].changed_properties);
+
+  // A new policy applies to the changes recorded after the next snapshot.
+  EXPECT_CALL(clock_, Now()).WillRepeatedly(Return(time1));
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1", R"({"t1": {"p": 3}})", nullptr));
+  ASSERT_TRUE(
+      manager_.SetStateHistoryPolicy("comp1", StateHistoryPolicy{}, nullptr));
+  EXPECT_CALL(clock_, Now()).WillRepeatedly(Return(time2));
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1", R"({"t1": {"p": 4}})", nullptr));
+  snapshot = manager_.GetAndClearRecordedStateChanges();
+  EXPECT_EQ(1u, snapshot.state_changes.size());
+
+  EXPECT_CALL(clock_, Now()).WillRepeatedly(Return(time1));
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1", R"({"t1": {"p": 5}})", nullptr));
+  EXPECT_CALL(clock_, Now()).WillRepeatedly(Return(time2));
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1", R"({"t1": {"p": 6}})", nullptr));
+  snapshot = manager_.GetAndClearRecordedStateChanges();
+  EXPECT_EQ(2u, snapshot.state_changes.size());
+}
+
+TEST_F(ComponentManagerTest, SetStatePublishFilter) {
+  CreateTestComponentTree(&manager_);
+  StatePublishFilter filter;
+  filter.deadband = 1;
+  filter.min_interval = base::TimeDelta::FromSeconds(10);
+  ErrorPtr error;
+  EXPECT_FALSE(manager_.SetStatePublishFilter("comp5", "t1.p", filter, &error));
+  EXPECT_NE(nullptr, error.get());
+  error.reset();
+  EXPECT_FALSE(manager_.SetStatePublishFilter("comp1", "p", filter, &error));
+  EXPECT_EQ(errors::commands::kPropertyMissing, error->GetCode());
+  error.reset();
+  StatePublishFilter invalid_filter;
+  invalid_filter.deadband_percent = -1;
+  EXPECT_FALSE(
+      manager_.SetStatePublishFilter("comp1", "t1.p", invalid_filter, &error));
+  EXPECT_EQ(errors::commands::kInvalidPropValue, error->GetCode());
+  EXPECT_TRUE(manager_.SetStatePublishFilter("comp1", "t1.p", filter, nullptr));
+
+  base::Time start = base::Time::Now();
+  base::Time now = start;
+  EXPECT_CALL(clock_, Now()).WillRepeatedly(ReturnPointee(&now));
+  auto set_state = [this, &now, start](int seconds, const char* json) {
+    now = start + base::TimeDelta::FromSeconds(seconds);
+    ASSERT_TRUE(manager_.SetStatePropertiesFromJson("comp1", json, nullptr));
+  };
+  set_state(0, R"({"t1": {"p": 20}})");
+  // Within the deadband.
+  set_state(1, R"({"t1": {"p": 20.5, "q": 1}})");
+  // Out of the deadband, but within the minimal interval.
+  set_state(2, R"({"t1": {"p": 22}})");
+  set_state(3, R"({"t1": {"p": 23}})");
+
+  // The state read locally is exact.
+  const base::Value* value =
+      manager_.GetStateProperty("comp1", "t1.p", nullptr);
+  ASSERT_NE(nullptr, value);
+  EXPECT_TRUE(base::FundamentalValue{23}.Equals(value));
+  auto snapshot = manager_.GetAndClearRecordedStateChanges();
+  ASSERT_EQ(2u, snapshot.state_changes.size());
+  EXPECT_JSON_EQ("{'t1': {'p': 20}}",
+                 *snapshot.state_changes[0].changed_properties);
+  EXPECT_JSON_EQ("{'t1': {'q': 1}}",
+                 *snapshot.state_changes[1].changed_properties);
+
+  // The latest value held back is recorded once the interval is over.
+  auto last_id = manager_.GetLastStateChangeId();
+  now = start + base::TimeDelta::FromSeconds(10);
+  task_runner_.Run();
+  EXPECT_EQ(last_id + 1, manager_.GetLastStateChangeId());
+  snapshot = manager_.GetAndClearRecordedStateChanges();
+  ASSERT_EQ(1u, snapshot.state_changes.size());
+  EXPECT_EQ(now, snapshot.state_changes[0].timestamp);
+  EXPECT_JSON_EQ("{'t1': {'p': 23}}",
+                 *snapshot.state_changes[0].changed_properties);
+}
+
+TEST_F(ComponentManagerTest, LocalOnlyStateProperties) {
+  const char kTraits[] = R"({
+    "trait1": {
+      "state": {
+        "power": { "type": "number", "localOnly": true },
+        "mode": { "type": "string" },
+        "level": { "type": "integer" }
+      }
+    }
+  })";
+  auto traits = CreateDictionaryValue(kTraits);
+  ASSERT_TRUE(manager_.LoadTraits(*traits, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp1", {"trait1"}, nullptr));
+  StatePublishFilter filter;
+  filter.local_only = true;
+  EXPECT_TRUE(
+      manager_.SetStatePublishFilter("comp1", "trait1.mode", filter, nullptr));
+
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1", R"({"trait1": {"power": 1.5, "mode": "eco", "level": 1}})",
+      nullptr));
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1", R"({"trait1": {"power": 2.5}})", nullptr));
+
+  // Local clients see every property.
+  auto components = manager_.GetComponentsForUserRole(UserRole::kOwner);
+  const base::Value* value = nullptr;
+  ASSERT_TRUE(components->Get("comp1.state.trait1.power", &value));
+  EXPECT_TRUE(base::FundamentalValue{2.5}.Equals(value));
+  EXPECT_TRUE(components->Get("comp1.state.trait1.mode", &value));
+
+  auto snapshot = manager_.GetAndClearRecordedStateChanges();
+  ASSERT_EQ(1u, snapshot.state_changes.size());
+  EXPECT_JSON_EQ("{'trait1': {'level': 1}}",
+                 *snapshot.state_changes[0].changed_properties);
+
+  // Removing the filter publishes the property again.
+  EXPECT_TRUE(manager_.SetStatePublishFilter("comp1", "trait1.mode", {},
+                                             nullptr));
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1", R"({"trait1": {"mode": "boost"}})", nullptr));
+  snapshot = manager_.GetAndClearRecordedStateChanges();
+  ASSERT_EQ(1u, snapshot.state_changes.size());
+  EXPECT_JSON_EQ("{'trait1': {'mode': 'boost'}}",
+                 *snapshot.state_changes[0].changed_properties);
+}
+
+TEST_F(ComponentManagerTest, SetStatePropertiesRecordsObjectDiffs) {
+  CreateTestComponentTree(&manager_);
+  base::Time now = base::Time::Now();
+  EXPECT_CALL(clock_, Now()).WillRepeatedly(ReturnPointee(&now));
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1",
+      R"({"t1": {"schedule": {"mon": {"on": 8, "off": 17}, "tue": 9}}})",
+      nullptr));
+  now += base::TimeDelta::FromSeconds(1);
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1",
+      R"({"t1": {"schedule": {"mon": {"on": 8, "off": 18}, "tue": 9},
+                 "p": 1}})",
+      nullptr));
+  // Nothing changed.
+  now += base::TimeDelta::FromSeconds(1);
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1", R"({"t1": {"schedule": {"mon": {"on": 8}}}})", nullptr));
+
+  auto snapshot = manager_.GetAndClearRecordedStateChanges();
+  ASSERT_EQ(2u, snapshot.state_changes.size());
+  EXPECT_JSON_EQ("{'t1': {'schedule': {'mon': {'on': 8, 'off': 17}, 'tue': 9}}}",
+                 *snapshot.state_changes[0].changed_properties);
+  EXPECT_JSON_EQ("{'t1': {'schedule': {'mon': {'off': 18}}, 'p': 1}}",
+                 *snapshot.state_changes[1].changed_properties);
+
+  const base::Value* value =
+      manager_.GetStateProperty("comp1", "t1.schedule", nullptr);
+  ASSERT_NE(nullptr, value);
+  EXPECT_JSON_EQ("{'mon': {'on': 8, 'off': 18}, 'tue': 9}", *value);
 }
 
 TEST_F(ComponentManagerTest, AddStateChangedCallback) {
@@ -1318,6 +2413,33 @@ TEST_F(ComponentManagerTest, FindComponentWithTrait) {
   EXPECT_EQ("", manager_.FindComponentWithTrait("trait4"));
 }
 
+TEST_F(ComponentManagerTest, FindComponentWithTraitIndex) {
+  const char kTraits[] = R"({
+    "trait1": {},
+    "trait2": {}
+  })";
+  auto traits = CreateDictionaryValue(kTraits);
+  ASSERT_TRUE(manager_.LoadTraits(*traits, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "a", {"trait1"}, nullptr));
+  // Sub-components are indexed too, but only the top level ones are found.
+  ASSERT_TRUE(manager_.AddComponent("a", "sub", {"trait2"}, nullptr));
+  ASSERT_TRUE(manager_.AddComponentArrayItem("a", "items", {"trait2"},
+                                             nullptr));
+  EXPECT_EQ("", manager_.FindComponentWithTrait("trait2"));
+  ASSERT_TRUE(manager_.AddComponent("", "b", {"trait2"}, nullptr));
+  EXPECT_EQ("b", manager_.FindComponentWithTrait("trait2"));
+  ASSERT_TRUE(manager_.AddComponent("", "c", {"trait1", "trait2"}, nullptr));
+  EXPECT_EQ("a", manager_.FindComponentWithTrait("trait1"));
+
+  ASSERT_TRUE(manager_.RemoveComponent("", "a", nullptr));
+  EXPECT_EQ("c", manager_.FindComponentWithTrait("trait1"));
+  ASSERT_TRUE(manager_.RemoveComponent("", "b", nullptr));
+  EXPECT_EQ("c", manager_.FindComponentWithTrait("trait2"));
+  ASSERT_TRUE(manager_.RemoveComponent("", "c", nullptr));
+  EXPECT_EQ("", manager_.FindComponentWithTrait("trait1"));
+  EXPECT_EQ("", manager_.FindComponentWithTrait("trait2"));
+}
+
 TEST_F(ComponentManagerTest, TestMockComponentManager) {
   // Check that all the virtual methods are mocked out.
   test::MockComponentManager mock;
@@ -1535,4 +2657,177 @@ TEST_F(ComponentManagerTest, GetComponentsForUserRole) {
                  *manager_.GetComponentsForUserRole(UserRole::kViewer));
 }
 
+TEST_F(ComponentManagerTest, GetComponentForUserRole) {
+  const char kTraits[] = R"({
+    "t1": {
+      "state": {
+        "p1": { "type": "integer", "minimalRole": "manager" },
+        "p2": { "type": "integer" }
+      }
+    },
+    "t2": {}
+  })";
+  ASSERT_TRUE(manager_.LoadTraits(*CreateDictionaryValue(kTraits), nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp1", {"t2"}, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("comp1", "comp2", {"t1"}, nullptr));
+  ASSERT_TRUE(
+      manager_.AddComponentArrayItem("comp1.comp2", "comp3", {"t2"}, nullptr));
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1.comp2", R"({"t1": {"p1": 1, "p2": 2}})", nullptr));
+
+  const char kExpectedUser[] = R"({
+    "traits": ["t1"],
+    "state": {"t1": {"p2": 2}},
+    "components": {"comp3": [{"traits": ["t2"]}]}
+  })";
+  EXPECT_JSON_EQ(kExpectedUser,
+                 *manager_.GetComponentForUserRole("comp1.comp2",
+                                                   UserRole::kUser, {},
+                                                   nullptr));
+
+  const char kExpectedFields[] = R"({
+    "state": {"t1": {"p1": 1, "p2": 2}},
+    "components": {"comp3": [{}]}
+  })";
+  EXPECT_JSON_EQ(kExpectedFields,
+                 *manager_.GetComponentForUserRole(
+                     "comp1.comp2", UserRole::kOwner, {"state", "components"},
+                     nullptr));
+
+  ErrorPtr error;
+  EXPECT_EQ(nullptr, manager_.GetComponentForUserRole(
+                         "comp1.comp7", UserRole::kOwner, {}, &error));
+  EXPECT_NE(nullptr, error.get());
+}
+
+TEST_F(ComponentManagerTest, MemoryStats) {
+  CreateTestComponentTree(&manager_);
+  manager_.GetTraitsJson();
+  manager_.GetComponentsForUserRole(UserRole::kUser);
+
+  base::DictionaryValue stats;
+  manager_.GetMemoryStats(&stats);
+  int count = 0;
+  int bytes = 0;
+  EXPECT_TRUE(stats.GetInteger("components.count", &count));
+  EXPECT_EQ(5, count);
+  EXPECT_TRUE(stats.GetInteger("components.bytes", &bytes));
+  EXPECT_LT(0, bytes);
+  EXPECT_TRUE(stats.GetInteger("traits.count", &count));
+  EXPECT_EQ(6, count);
+  EXPECT_TRUE(stats.GetInteger("componentCaches.count", &count));
+  EXPECT_EQ(1, count);
+  EXPECT_TRUE(stats.GetInteger("componentCaches.bytes", &bytes));
+  EXPECT_LT(0, bytes);
+  EXPECT_TRUE(stats.GetInteger("stateChangeQueues.count", &count));
+  EXPECT_TRUE(stats.GetInteger("commandQueue.count", &count));
+  EXPECT_EQ(0, count);
+
+  // Compaction drops the caches, which come back when needed.
+  auto user = manager_.GetComponentsForUserRole(UserRole::kUser);
+  manager_.CompactMemory();
+  manager_.GetMemoryStats(&stats);
+  EXPECT_TRUE(stats.GetInteger("componentCaches.count", &count));
+  EXPECT_EQ(0, count);
+  EXPECT_TRUE(stats.GetInteger("componentCaches.bytes", &bytes));
+  EXPECT_EQ(0, bytes);
+  EXPECT_TRUE(user->Equals(
+      manager_.GetComponentsForUserRole(UserRole::kUser).get()));
+  EXPECT_FALSE(manager_.GetTraitsJson().empty());
+}
+
+TEST_F(ComponentManagerTest, GetComponentsForUserRoleSharesSnapshot) {
+  const char kTraits[] = R"({
+    "t1": {
+      "state": {
+        "p1": { "type": "integer", "minimalRole": "manager" },
+        "p2": { "type": "integer" }
+      }
+    }
+  })";
+  ASSERT_TRUE(manager_.LoadTraits(*CreateDictionaryValue(kTraits), nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp1", {"t1"}, nullptr));
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1", R"({"t1": {"p1": 1, "p2": 2}})", nullptr));
+
+  auto user1 = manager_.GetComponentsForUserRole(UserRole::kUser);
+  auto user2 = manager_.GetComponentsForUserRole(UserRole::kUser);
+  auto owner = manager_.GetComponentsForUserRole(UserRole::kOwner);
+  EXPECT_EQ(user1.get(), user2.get());
+  EXPECT_NE(user1.get(), owner.get());
+  EXPECT_JSON_EQ(R"({"comp1": {"traits": ["t1"], "state": {"t1": {"p2": 2}}}})",
+                 *user1);
+
+  // Any change makes a new snapshot, the old one stays as it was.
+  auto handle = manager_.ResolveStateProperty("comp1", "t1.p2", nullptr);
+  ASSERT_NE(0u, handle);
+  ASSERT_TRUE(manager_.SetStatePropertyByHandle(
+      handle, base::FundamentalValue{3}, nullptr));
+  auto user3 = manager_.GetComponentsForUserRole(UserRole::kUser);
+  EXPECT_NE(user1.get(), user3.get());
+  EXPECT_JSON_EQ(R"({"comp1": {"traits": ["t1"], "state": {"t1": {"p2": 3}}}})",
+                 *user3);
+  EXPECT_JSON_EQ(R"({"comp1": {"traits": ["t1"], "state": {"t1": {"p2": 2}}}})",
+                 *user1);
+
+  ASSERT_TRUE(manager_.AddComponent("", "comp2", {"t1"}, nullptr));
+  auto user4 = manager_.GetComponentsForUserRole(UserRole::kUser);
+  EXPECT_NE(user3.get(), user4.get());
+  EXPECT_TRUE(user4->HasKey("comp2"));
+}
+
+TEST_F(ComponentManagerTest, ComponentsView) {
+  const char kTraits[] = R"({
+    "t1": {"state": {"p1": {"type": "integer"}, "p2": {"type": "integer"}}}
+  })";
+  ASSERT_TRUE(manager_.LoadTraits(kTraits, nullptr));
+  ASSERT_TRUE(manager_.AddComponent("", "comp1", {"t1"}, nullptr));
+  EXPECT_EQ(nullptr, manager_.GetComponentsView());
+
+  manager_.EnableComponentsView();
+  auto view1 = manager_.GetComponentsView();
+  ASSERT_NE(nullptr, view1);
+  EXPECT_JSON_EQ(R"({"comp1": {"traits": ["t1"]}})", *view1);
+
+  // Changes made in one task are published together, after it.
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1", R"({"t1": {"p1": 1}})", nullptr));
+  ASSERT_TRUE(manager_.SetStatePropertiesFromJson(
+      "comp1", R"({"t1": {"p2": 1}})", nullptr));
+  EXPECT_EQ(view1, manager_.GetComponentsView());
+  task_runner_.RunPendingTasks();
+  auto view2 = manager_.GetComponentsView();
+  EXPECT_JSON_EQ(
+      R"({"comp1": {"traits": ["t1"], "state": {"t1": {"p1": 1, "p2": 1}}}})",
+      *view2);
+  EXPECT_JSON_EQ(R"({"comp1": {"traits": ["t1"]}})", *view1);
+
+  // Other threads see whole updates only.
+  std::atomic<bool> done{false};
+  std::thread reader{[this, &done]() {
+    while (!done) {
+      auto view = manager_.GetComponentsView();
+      int p1 = 0;
+      int p2 = 0;
+      EXPECT_TRUE(view->GetInteger("comp1.state.t1.p1", &p1));
+      EXPECT_TRUE(view->GetInteger("comp1.state.t1.p2", &p2));
+      EXPECT_EQ(p1, p2);
+    }
+  }};
+  for (int i = 2; i < 200; i++) {
+    auto handle = manager_.ResolveStateProperty("comp1", "t1.p1", nullptr);
+    ASSERT_TRUE(manager_.SetStatePropertyByHandle(
+        handle, base::FundamentalValue{i}, nullptr));
+    ASSERT_TRUE(manager_.SetStateProperty("comp1", "t1.p2",
+                                          base::FundamentalValue{i}, nullptr));
+    task_runner_.RunPendingTasks();
+  }
+  done = true;
+  reader.join();
+  int p1 = 0;
+  EXPECT_TRUE(manager_.GetComponentsView()->GetInteger("comp1.state.t1.p1",
+                                                       &p1));
+  EXPECT_EQ(199, p1);
+}
+
 }  // namespace weave
@@ -16,6 +16,7 @@
 #include <base/strings/string_number_conversions.h>
 #include <base/values.h>
 #include <weave/enum_to_string.h>
+#include <weave/provider/task_runner.h>
 
 #include "src/data_encoding.h"
 #include "src/privet/privet_types.h"
@@ -46,8 +47,12 @@ const char kCloudId[] = "cloud_id";
 const char kDeviceId[] = "device_id";
 const char kRobotAccount[] = "robot_account";
 const char kLastConfiguredSsid[] = "last_configured_ssid";
+const char kLastConfiguredBssid[] = "last_configured_bssid";
+const char kLastConfiguredChannel[] = "last_configured_channel";
 const char kSecret[] = "secret";
 const char kRootClientTokenOwner[] = "root_client_token_owner";
+const char kXmppKeepAliveInterval[] = "xmpp_keepalive_interval";
+const char kDeviceResourceTimestamp[] = "device_resource_timestamp";
 
 }  // namespace config_keys
 
@@ -114,8 +119,12 @@ Config::Settings CreateDefaultSettings(provider::ConfigStore* config_store) {
   CHECK(result.refresh_token.empty());
   CHECK(result.robot_account.empty());
   CHECK(result.last_configured_ssid.empty());
+  CHECK(result.last_configured_bssid.empty());
+  CHECK_EQ(0, result.last_configured_channel);
   CHECK(result.secret.empty());
   CHECK(result.root_client_token_owner == RootClientTokenOwner::kNone);
+  CHECK(result.xmpp_keepalive_interval.is_zero());
+  CHECK(result.device_resource_timestamp.empty());
 
   return result;
 }
@@ -141,6 +150,27 @@ Config::Config(provider::ConfigStore* config_store)
   change.LoadState();
 }
 
+Config::~Config() {
+  Flush();
+}
+
+void Config::EnableWriteBehind(provider::TaskRunner* task_runner,
+                               base::TimeDelta delay) {
+  CHECK(task_runner);
+  task_runner_ = task_runner;
+  save_delay_ = delay;
+}
+
+void Config::Flush() {
+  if (save_pending_)
+    Save(true);
+}
+
+void Config::OnSaveTimeout() {
+  save_pending_ = false;
+  Save(true);
+}
+
 void Config::AddOnChangedCallback(const OnChangedCallback& callback) {
   on_changed_.push_back(callback);
   // Force to read current state.
@@ -248,6 +278,9 @@ void Config::Transaction::LoadState() {
   if (dict->GetString(config_keys::kLastConfiguredSsid, &tmp))
     set_last_configured_ssid(tmp);
 
+  if (dict->GetString(config_keys::kLastConfiguredBssid, &tmp))
+    set_last_configured_bssid(tmp);
+
   std::vector<uint8_t> secret;
   if (dict->GetString(config_keys::kSecret, &tmp) && Base64Decode(tmp, &secret))
     set_secret(secret);
@@ -257,12 +290,42 @@ void Config::Transaction::LoadState() {
       StringToEnum(tmp, &token_owner)) {
     set_root_client_token_owner(token_owner);
   }
+
+  int tmp_int{0};
+  if (dict->GetInteger(config_keys::kLastConfiguredChannel, &tmp_int) &&
+      tmp_int >= 0) {
+    set_last_configured_channel(tmp_int);
+  }
+
+  if (dict->GetInteger(config_keys::kXmppKeepAliveInterval, &tmp_int) &&
+      tmp_int >= 0) {
+    set_xmpp_keepalive_interval(base::TimeDelta::FromSeconds(tmp_int));
+  }
+
+  if (dict->GetString(config_keys::kDeviceResourceTimestamp, &tmp))
+    set_device_resource_timestamp(tmp);
 }
 
-void Config::Save() {
+void Config::Save(bool flush) {
   if (!config_store_)
     return;
 
+  if (!flush && task_runner_) {
+    if (!save_pending_) {
+      save_pending_ = true;
+      task_runner_->PostDelayedTask(
+          FROM_HERE, base::Bind(&Config::OnSaveTimeout,
+                                weak_ptr_factory_.GetWeakPtr()),
+          save_delay_);
+    }
+    return;
+  }
+  if (save_pending_) {
+    // This save includes the delayed changes.
+    weak_ptr_factory_.InvalidateWeakPtrs();
+    save_pending_ = false;
+  }
+
   base::DictionaryValue dict;
   dict.SetInteger(config_keys::kVersion, kCurrentConfigVersion);
 
@@ -278,9 +341,17 @@ void Config::Save() {
   dict.SetString(config_keys::kRobotAccount, settings_.robot_account);
   dict.SetString(config_keys::kLastConfiguredSsid,
                  settings_.last_configured_ssid);
+  dict.SetString(config_keys::kLastConfiguredBssid,
+                 settings_.last_configured_bssid);
+  dict.SetInteger(config_keys::kLastConfiguredChannel,
+                  settings_.last_configured_channel);
   dict.SetString(config_keys::kSecret, Base64Encode(settings_.secret));
   dict.SetString(config_keys::kRootClientTokenOwner,
                  EnumToString(settings_.root_client_token_owner));
+  dict.SetInteger(config_keys::kXmppKeepAliveInterval,
+                  settings_.xmpp_keepalive_interval.InSeconds());
+  dict.SetString(config_keys::kDeviceResourceTimestamp,
+                 settings_.device_resource_timestamp);
   dict.SetString(config_keys::kName, settings_.name);
   dict.SetString(config_keys::kDescription, settings_.description);
   dict.SetString(config_keys::kLocation, settings_.location);
@@ -306,7 +377,7 @@ void Config::Transaction::Commit() {
   if (!config_)
     return;
   if (save_)
-    config_->Save();
+    config_->Save(flush_);
   for (const auto& cb : config_->on_changed_)
     cb.Run(*settings_);
   config_ = nullptr;
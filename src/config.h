@@ -11,6 +11,8 @@
 
 #include <base/callback.h>
 #include <base/gtest_prod_util.h>
+#include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
 #include <weave/error.h>
 #include <weave/provider/config_store.h>
 
@@ -20,6 +22,10 @@ namespace weave {
 
 class StorageInterface;
 
+namespace provider {
+class TaskRunner;
+}
+
 enum class RootClientTokenOwner {
   // Keep order as it's used with order comparison operators.
   kNone,
@@ -34,15 +40,32 @@ class Config final {
     std::string refresh_token;
     std::string robot_account;
     std::string last_configured_ssid;
+    // Access point of the last successful connection to
+    // |last_configured_ssid|, if the WiFi provider reported it.
+    std::string last_configured_bssid;
+    int last_configured_channel{0};
     std::vector<uint8_t> secret;
     RootClientTokenOwner root_client_token_owner{RootClientTokenOwner::kNone};
+    // XMPP keepalive interval learned on the current network, zero if none.
+    base::TimeDelta xmpp_keepalive_interval;
+    // "lastUpdateTimeMs" of the device resource on the server, which makes
+    // its updates conditional. Empty if unknown.
+    std::string device_resource_timestamp;
   };
 
   using OnChangedCallback = base::Callback<void(const weave::Settings&)>;
-  ~Config() = default;
+  ~Config();
 
   explicit Config(provider::ConfigStore* config_store);
 
+  // Delays saving of committed changes by |delay|, so a burst of transactions
+  // results in a single write. Changes of credentials and access settings are
+  // still saved immediately.
+  void EnableWriteBehind(provider::TaskRunner* task_runner,
+                         base::TimeDelta delay);
+  // Saves delayed changes now.
+  void Flush();
+
   void AddOnChangedCallback(const OnChangedCallback& callback);
   const Config::Settings& GetSettings() const;
   const Config::Settings& GetDefaults() const;
@@ -81,26 +104,47 @@ class Config final {
     }
     void set_local_anonymous_access_role(AuthScope role) {
       settings_->local_anonymous_access_role = role;
+      flush_ = true;
     }
     void set_local_access_enabled(bool enabled) {
       settings_->local_access_enabled = enabled;
+      flush_ = true;
+    }
+    void set_cloud_id(const std::string& id) {
+      settings_->cloud_id = id;
+      flush_ = true;
     }
-    void set_cloud_id(const std::string& id) { settings_->cloud_id = id; }
     void set_refresh_token(const std::string& token) {
       settings_->refresh_token = token;
+      flush_ = true;
     }
     void set_robot_account(const std::string& account) {
       settings_->robot_account = account;
+      flush_ = true;
     }
     void set_last_configured_ssid(const std::string& ssid) {
       settings_->last_configured_ssid = ssid;
     }
+    void set_last_configured_bssid(const std::string& bssid) {
+      settings_->last_configured_bssid = bssid;
+    }
+    void set_last_configured_channel(int channel) {
+      settings_->last_configured_channel = channel;
+    }
     void set_secret(const std::vector<uint8_t>& secret) {
       settings_->secret = secret;
+      flush_ = true;
     }
     void set_root_client_token_owner(
         RootClientTokenOwner root_client_token_owner) {
       settings_->root_client_token_owner = root_client_token_owner;
+      flush_ = true;
+    }
+    void set_xmpp_keepalive_interval(base::TimeDelta interval) {
+      settings_->xmpp_keepalive_interval = interval;
+    }
+    void set_device_resource_timestamp(const std::string& timestamp) {
+      settings_->device_resource_timestamp = timestamp;
     }
 
     void Commit();
@@ -109,6 +153,7 @@ class Config final {
     FRIEND_TEST_ALL_PREFIXES(ConfigTest, Setters);
     void set_device_id(const std::string& id) {
       config_->settings_.device_id = id;
+      flush_ = true;
     }
 
     friend class Config;
@@ -116,16 +161,25 @@ class Config final {
     Config* config_;
     Settings* settings_;
     bool save_{true};
+    // Set by changes which must not be lost, even with write-behind.
+    bool flush_{false};
   };
 
  private:
-  void Save();
+  void Save(bool flush);
+  void OnSaveTimeout();
 
   const Settings defaults_;
   Settings settings_;
   provider::ConfigStore* config_store_{nullptr};
   std::vector<OnChangedCallback> on_changed_;
 
+  provider::TaskRunner* task_runner_{nullptr};
+  base::TimeDelta save_delay_;
+  bool save_pending_{false};
+
+  base::WeakPtrFactory<Config> weak_ptr_factory_{this};
+
   DISALLOW_COPY_AND_ASSIGN(Config);
 };
 
@@ -9,6 +9,7 @@
 #include <base/bind.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
 #include <weave/provider/test/mock_config_store.h>
 #include <weave/test/unittest_utils.h>
 
@@ -81,8 +82,12 @@ TEST_F(ConfigTest, Defaults) {
   EXPECT_EQ("", GetSettings().refresh_token);
   EXPECT_EQ("", GetSettings().robot_account);
   EXPECT_EQ("", GetSettings().last_configured_ssid);
+  EXPECT_EQ("", GetSettings().last_configured_bssid);
+  EXPECT_EQ(0, GetSettings().last_configured_channel);
   EXPECT_EQ(std::vector<uint8_t>(), GetSettings().secret);
   EXPECT_EQ(RootClientTokenOwner::kNone, GetSettings().root_client_token_owner);
+  EXPECT_TRUE(GetSettings().xmpp_keepalive_interval.is_zero());
+  EXPECT_TRUE(GetSettings().device_resource_timestamp.empty());
 }
 
 TEST_F(ConfigTest, LoadStateV0) {
@@ -135,6 +140,8 @@ TEST_F(ConfigTest, LoadState) {
     "description": "state_description",
     "device_id": "state_device_id",
     "last_configured_ssid": "state_last_configured_ssid",
+    "last_configured_bssid": "00:11:22:33:44:55",
+    "last_configured_channel": 11,
     "local_anonymous_access_role": "user",
     "root_client_token_owner": "client",
     "local_access_enabled": false,
@@ -145,7 +152,9 @@ TEST_F(ConfigTest, LoadState) {
     "robot_account": "state_robot_account",
     "secret": "c3RhdGVfc2VjcmV0",
     "service_url": "state_service_url",
-    "xmpp_endpoint": "state_xmpp_endpoint"
+    "xmpp_endpoint": "state_xmpp_endpoint",
+    "xmpp_keepalive_interval": 240,
+    "device_resource_timestamp": "1440087183738"
   })";
   EXPECT_CALL(config_store_, LoadSettings(kConfigName)).WillOnce(Return(state));
 
@@ -176,9 +185,14 @@ TEST_F(ConfigTest, LoadState) {
   EXPECT_EQ("state_refresh_token", GetSettings().refresh_token);
   EXPECT_EQ("state_robot_account", GetSettings().robot_account);
   EXPECT_EQ("state_last_configured_ssid", GetSettings().last_configured_ssid);
+  EXPECT_EQ("00:11:22:33:44:55", GetSettings().last_configured_bssid);
+  EXPECT_EQ(11, GetSettings().last_configured_channel);
   EXPECT_EQ("c3RhdGVfc2VjcmV0", Base64Encode(GetSettings().secret));
   EXPECT_EQ(RootClientTokenOwner::kClient,
             GetSettings().root_client_token_owner);
+  EXPECT_EQ(base::TimeDelta::FromMinutes(4),
+            GetSettings().xmpp_keepalive_interval);
+  EXPECT_EQ("1440087183738", GetSettings().device_resource_timestamp);
 }
 
 TEST_F(ConfigTest, LoadStateV1) {
@@ -279,6 +293,12 @@ TEST_F(ConfigTest, Setters) {
   change.set_last_configured_ssid("set_last_configured_ssid");
   EXPECT_EQ("set_last_configured_ssid", GetSettings().last_configured_ssid);
 
+  change.set_last_configured_bssid("66:77:88:99:aa:bb");
+  EXPECT_EQ("66:77:88:99:aa:bb", GetSettings().last_configured_bssid);
+
+  change.set_last_configured_channel(36);
+  EXPECT_EQ(36, GetSettings().last_configured_channel);
+
   const std::vector<uint8_t> secret{1, 2, 3, 4, 5};
   change.set_secret(secret);
   EXPECT_EQ(secret, GetSettings().secret);
@@ -287,6 +307,13 @@ TEST_F(ConfigTest, Setters) {
   EXPECT_EQ(RootClientTokenOwner::kCloud,
             GetSettings().root_client_token_owner);
 
+  change.set_xmpp_keepalive_interval(base::TimeDelta::FromSeconds(90));
+  EXPECT_EQ(base::TimeDelta::FromSeconds(90),
+            GetSettings().xmpp_keepalive_interval);
+
+  change.set_device_resource_timestamp("1440087183738");
+  EXPECT_EQ("1440087183738", GetSettings().device_resource_timestamp);
+
   EXPECT_CALL(*this, OnConfigChanged(_)).Times(1);
 
   EXPECT_CALL(config_store_, SaveSettings(kConfigName, _, _))
@@ -301,6 +328,8 @@ TEST_F(ConfigTest, Setters) {
               'description': 'set_description',
               'device_id': 'set_device_id',
               'last_configured_ssid': 'set_last_configured_ssid',
+              'last_configured_bssid': '66:77:88:99:aa:bb',
+              'last_configured_channel': 36,
               'local_anonymous_access_role': 'user',
               'root_client_token_owner': 'cloud',
               'local_access_enabled': true,
@@ -311,7 +340,9 @@ TEST_F(ConfigTest, Setters) {
               'robot_account': 'set_account',
               'secret': 'AQIDBAU=',
               'service_url': 'set_service_url',
-              'xmpp_endpoint': 'set_xmpp_endpoint'
+              'xmpp_endpoint': 'set_xmpp_endpoint',
+              'xmpp_keepalive_interval': 90,
+              'device_resource_timestamp': '1440087183738'
             })";
             EXPECT_JSON_EQ(expected, *test::CreateValue(json));
             callback.Run(nullptr);
@@ -320,4 +351,43 @@ TEST_F(ConfigTest, Setters) {
   change.Commit();
 }
 
+TEST_F(ConfigTest, WriteBehind) {
+  provider::test::FakeTaskRunner task_runner;
+  config_->EnableWriteBehind(&task_runner, base::TimeDelta::FromSeconds(1));
+  EXPECT_CALL(*this, OnConfigChanged(_)).Times(5);
+
+  auto expect_save = [this](const std::string& name) {
+    EXPECT_CALL(config_store_, SaveSettings(kConfigName, _, _))
+        .WillOnce(WithArgs<1>(Invoke([name](const std::string& json) {
+          std::string saved_name;
+          EXPECT_TRUE(test::CreateDictionaryValue(json)->GetString(
+              "name", &saved_name));
+          EXPECT_EQ(name, saved_name);
+        })));
+  };
+
+  // Changes are coalesced into a single save.
+  EXPECT_CALL(config_store_, SaveSettings(_, _, _)).Times(0);
+  Config::Transaction{config_.get()}.set_name("name1");
+  Config::Transaction{config_.get()}.set_name("name2");
+  testing::Mock::VerifyAndClearExpectations(&config_store_);
+  expect_save("name2");
+  task_runner.Run();
+  testing::Mock::VerifyAndClearExpectations(&config_store_);
+
+  // Credentials are saved immediately, along with the delayed changes.
+  Config::Transaction{config_.get()}.set_name("name3");
+  expect_save("name3");
+  Config::Transaction{config_.get()}.set_refresh_token("token");
+  testing::Mock::VerifyAndClearExpectations(&config_store_);
+  EXPECT_CALL(config_store_, SaveSettings(_, _, _)).Times(0);
+  task_runner.Run();
+
+  // Pending changes are saved on destruction.
+  Config::Transaction{config_.get()}.set_name("name4");
+  testing::Mock::VerifyAndClearExpectations(&config_store_);
+  expect_save("name4");
+  config_.reset();
+}
+
 }  // namespace weave
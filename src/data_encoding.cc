@@ -4,11 +4,13 @@
 
 #include "src/data_encoding.h"
 
+#include <string.h>
+#include <zlib.h>
+
+#include <algorithm>
 #include <memory>
 
 #include <base/logging.h>
-#include <base/strings/string_util.h>
-#include <base/strings/stringprintf.h>
 
 #include "src/string_utils.h"
 #include "third_party/modp_b64/modp_b64/modp_b64.h"
@@ -29,43 +31,123 @@ inline int HexToDec(int hex) {
   return dec;
 }
 
-// Helper for Base64Encode() and Base64EncodeWrapLines().
-std::string Base64EncodeHelper(const void* data, size_t size) {
-  std::vector<char> buffer;
-  buffer.resize(modp_b64_encode_len(size));
-  size_t out_size =
-      modp_b64_encode(buffer.data(), static_cast<const char*>(data), size);
-  return std::string{buffer.begin(), buffer.begin() + out_size};
-}
+// Characters which UrlEncode() copies as-is. According to RFC3986
+// (http://www.faqs.org/rfcs/rfc3986.html), section 2.3. - Unreserved
+// Characters.
+class UnreservedChars {
+ public:
+  UnreservedChars() {
+    for (int c = 0; c < 256; ++c) {
+      table_[c] = (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+                  (c >= 'a' && c <= 'z') || c == '-' || c == '.' || c == '_' ||
+                  c == '~';
+    }
+  }
 
-}  // namespace
+  bool Contains(char c) const {
+    return table_[static_cast<unsigned char>(c)];
+  }
 
-std::string UrlEncode(const char* data, bool encodeSpaceAsPlus) {
-  std::string result;
+ private:
+  bool table_[256];
+};
 
-  while (*data) {
-    char c = *data++;
-    // According to RFC3986 (http://www.faqs.org/rfcs/rfc3986.html),
-    // section 2.3. - Unreserved Characters
-    if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
-        (c >= 'a' && c <= 'z') || c == '-' || c == '.' || c == '_' ||
-        c == '~') {
-      result += c;
-    } else if (c == ' ' && encodeSpaceAsPlus) {
+const UnreservedChars& GetUnreservedChars() {
+  static const UnreservedChars unreserved;
+  return unreserved;
+}
+
+// Appends UrlEncode() of |data| to |result|. Runs of unreserved characters
+// are copied at once, and the result is grown at most once, at least
+// doubling its capacity, so appending many values to it stays linear.
+void AppendUrlEncoded(const char* data,
+                      size_t size,
+                      bool encodeSpaceAsPlus,
+                      std::string* result) {
+  const UnreservedChars& unreserved = GetUnreservedChars();
+  const char* end = data + size;
+  size_t encoded_size = size;
+  for (const char* p = data; p != end; ++p) {
+    if (!unreserved.Contains(*p) && !(*p == ' ' && encodeSpaceAsPlus))
+      encoded_size += 2;  // Encoded as %NN.
+  }
+  encoded_size += result->size();
+  if (encoded_size > result->capacity())
+    result->reserve(std::max(encoded_size, 2 * result->capacity()));
+
+  const char kHexDigits[] = "0123456789ABCDEF";
+  const char* run = data;
+  for (const char* p = run; p != end; ++p) {
+    if (unreserved.Contains(*p))
+      continue;
+    result->append(run, p);
+    run = p + 1;
+    if (*p == ' ' && encodeSpaceAsPlus) {
       // For historical reasons, some URLs have spaces encoded as '+',
       // this also applies to form data encoded as
       // 'application/x-www-form-urlencoded'
-      result += '+';
+      result->push_back('+');
     } else {
-      base::StringAppendF(&result, "%%%02X",
-                          static_cast<unsigned char>(c));  // Encode as %NN
+      unsigned char c = static_cast<unsigned char>(*p);
+      const char encoded[] = {'%', kHexDigits[c >> 4], kHexDigits[c & 0xF]};
+      result->append(encoded, sizeof(encoded));
     }
   }
+  result->append(run, end);
+}
+
+// Helper for Base64Encode() and Base64EncodeWrapLines().
+std::string Base64EncodeHelper(const void* data, size_t size) {
+  // modp_b64_encode_len() includes the terminating null character.
+  std::string result(modp_b64_encode_len(size), '\0');
+  size_t out_size =
+      modp_b64_encode(&result[0], static_cast<const char*>(data), size);
+  result.resize(out_size);
+  return result;
+}
+
+// Decodes |input| into |output|, a vector of bytes or a string, without an
+// intermediate buffer.
+template <typename Container>
+bool Base64DecodeInto(const std::string& input, Container* output) {
+  std::string temp_buffer;
+  const std::string* data = &input;
+  if (input.find_first_of("\r\n") != std::string::npos) {
+    temp_buffer.reserve(input.size());
+    for (char c : input) {
+      if (c != '\r' && c != '\n')
+        temp_buffer.push_back(c);
+    }
+    data = &temp_buffer;
+  }
+  // base64 decoded data has 25% fewer bytes than the original (since every
+  // 3 source octets are encoded as 4 characters in base64).
+  // modp_b64_decode_len provides an upper estimate of the size of the output
+  // data.
+  output->resize(modp_b64_decode_len(data->size()));
+
+  size_t size_read = modp_b64_decode(reinterpret_cast<char*>(&(*output)[0]),
+                                     data->data(), data->size());
+  if (size_read == MODP_B64_ERROR) {
+    output->resize(0);
+    return false;
+  }
+  output->resize(size_read);
+
+  return true;
+}
+
+}  // namespace
+
+std::string UrlEncode(const char* data, bool encodeSpaceAsPlus) {
+  std::string result;
+  AppendUrlEncoded(data, strlen(data), encodeSpaceAsPlus, &result);
   return result;
 }
 
 std::string UrlDecode(const char* data) {
   std::string result;
+  result.reserve(strlen(data));
   while (*data) {
     char c = *data++;
     int part1 = 0, part2 = 0;
@@ -85,15 +167,17 @@ std::string UrlDecode(const char* data) {
 
 std::string WebParamsEncode(const WebParamList& params,
                             bool encodeSpaceAsPlus) {
-  std::vector<std::string> pairs;
-  pairs.reserve(params.size());
+  std::string result;
   for (const auto& p : params) {
-    std::string key = UrlEncode(p.first.c_str(), encodeSpaceAsPlus);
-    std::string value = UrlEncode(p.second.c_str(), encodeSpaceAsPlus);
-    pairs.push_back(Join("=", key, value));
+    if (!result.empty())
+      result.push_back('&');
+    AppendUrlEncoded(p.first.data(), p.first.size(), encodeSpaceAsPlus,
+                     &result);
+    result.push_back('=');
+    AppendUrlEncoded(p.second.data(), p.second.size(), encodeSpaceAsPlus,
+                     &result);
   }
-
-  return Join("&", pairs);
+  return result;
 }
 
 WebParamList WebParamsDecode(const std::string& data) {
@@ -113,6 +197,7 @@ std::string Base64Encode(const void* data, size_t size) {
 std::string Base64EncodeWrapLines(const void* data, size_t size) {
   std::string unwrapped = Base64EncodeHelper(data, size);
   std::string wrapped;
+  wrapped.reserve(unwrapped.size() + (unwrapped.size() + 63) / 64);
 
   for (size_t i = 0; i < unwrapped.size(); i += 64) {
     wrapped.append(unwrapped, i, 64);
@@ -122,27 +207,77 @@ std::string Base64EncodeWrapLines(const void* data, size_t size) {
 }
 
 bool Base64Decode(const std::string& input, std::vector<uint8_t>* output) {
-  std::string temp_buffer;
-  const std::string* data = &input;
-  if (input.find_first_of("\r\n") != std::string::npos) {
-    base::ReplaceChars(input, "\n", "", &temp_buffer);
-    base::ReplaceChars(temp_buffer, "\r", "", &temp_buffer);
-    data = &temp_buffer;
-  }
-  // base64 decoded data has 25% fewer bytes than the original (since every
-  // 3 source octets are encoded as 4 characters in base64).
-  // modp_b64_decode_len provides an upper estimate of the size of the output
-  // data.
-  output->resize(modp_b64_decode_len(data->size()));
+  return Base64DecodeInto(input, output);
+}
 
-  size_t size_read = modp_b64_decode(reinterpret_cast<char*>(output->data()),
-                                     data->data(), data->size());
-  if (size_read == MODP_B64_ERROR) {
-    output->resize(0);
+bool Base64Decode(const std::string& input, std::string* output) {
+  return Base64DecodeInto(input, output);
+}
+
+namespace {
+
+bool ZlibEncode(const std::string& input,
+                int window_bits,
+                std::string* output) {
+  output->clear();
+  z_stream stream{};
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
     return false;
   }
-  output->resize(size_read);
+  output->resize(deflateBound(&stream, input.size()));
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream.avail_in = input.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&(*output)[0]);
+  stream.avail_out = output->size();
+  int result = deflate(&stream, Z_FINISH);
+  output->resize(stream.total_out);
+  deflateEnd(&stream);
+  if (result != Z_STREAM_END) {
+    output->clear();
+    return false;
+  }
+  return true;
+}
 
+}  // namespace
+
+bool GzipEncode(const std::string& input, std::string* output) {
+  // 16 added to the window bits selects the gzip wrapper instead of zlib.
+  return ZlibEncode(input, MAX_WBITS + 16, output);
+}
+
+bool DeflateEncode(const std::string& input, std::string* output) {
+  return ZlibEncode(input, MAX_WBITS, output);
+}
+
+bool GzipDecode(const std::string& input,
+                size_t max_size,
+                std::string* output) {
+  output->clear();
+  z_stream stream{};
+  // 32 added to the window bits enables detection of gzip and zlib headers.
+  if (inflateInit2(&stream, MAX_WBITS + 32) != Z_OK)
+    return false;
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream.avail_in = input.size();
+  char buffer[16 * 1024];
+  int result = Z_OK;
+  while (result == Z_OK) {
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    result = inflate(&stream, Z_NO_FLUSH);
+    output->append(buffer, sizeof(buffer) - stream.avail_out);
+    if (max_size && output->size() > max_size)
+      break;
+  }
+  inflateEnd(&stream);
+  if (result != Z_STREAM_END || (max_size && output->size() > max_size)) {
+    output->clear();
+    return false;
+  }
   return true;
 }
 
@@ -48,6 +48,21 @@ std::string Base64EncodeWrapLines(const void* data, size_t size);
 
 // Decodes the input string from Base64.
 bool Base64Decode(const std::string& input, std::vector<uint8_t>* output);
+// Same, decoding straight into the string, e.g. for text payloads.
+bool Base64Decode(const std::string& input, std::string* output);
+
+// Compresses |input| into the gzip format.
+bool GzipEncode(const std::string& input, std::string* output);
+// Same, into the zlib format of the "deflate" HTTP content coding.
+bool DeflateEncode(const std::string& input, std::string* output);
+
+// Decompresses |input| in the gzip or zlib format, which are used by "gzip"
+// and "deflate" HTTP content codings respectively. Fails as soon as the
+// output is over |max_size| bytes, so small input can't expand without
+// bound. Zero means no limit.
+bool GzipDecode(const std::string& input,
+                size_t max_size,
+                std::string* output);
 
 // Helper wrappers to use std::string and std::vector<uint8_t> as binary data
 // containers.
@@ -63,13 +78,6 @@ inline std::string Base64Encode(const std::string& input) {
 inline std::string Base64EncodeWrapLines(const std::string& input) {
   return Base64EncodeWrapLines(input.data(), input.size());
 }
-inline bool Base64Decode(const std::string& input, std::string* output) {
-  std::vector<uint8_t> blob;
-  if (!Base64Decode(input, &blob))
-    return false;
-  *output = std::string{blob.begin(), blob.end()};
-  return true;
-}
 
 }  // namespace weave
 
@@ -0,0 +1,47 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/data_encoding.h"
+
+#include <string>
+#include <vector>
+
+#include <base/logging.h>
+
+#include "src/test/benchmark.h"
+
+namespace weave {
+
+namespace {
+
+// About the size of the access tokens and XMPP payloads.
+const size_t kDataSize = 256;
+
+std::vector<uint8_t> CreateData() {
+  std::vector<uint8_t> data(kDataSize);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<uint8_t>(i * 7);
+  return data;
+}
+
+void BM_Base64Encode(test::BenchmarkState* state) {
+  std::vector<uint8_t> data = CreateData();
+  while (state->KeepRunning())
+    CHECK(!Base64Encode(data).empty());
+  state->SetBytesProcessed(state->iterations() * data.size());
+}
+WEAVE_BENCHMARK(BM_Base64Encode);
+
+void BM_Base64Decode(test::BenchmarkState* state) {
+  std::string encoded = Base64Encode(CreateData());
+  std::vector<uint8_t> data;
+  while (state->KeepRunning())
+    CHECK(Base64Decode(encoded, &data));
+  state->SetBytesProcessed(state->iterations() * encoded.size());
+}
+WEAVE_BENCHMARK(BM_Base64Decode);
+
+}  // namespace
+
+}  // namespace weave
@@ -24,6 +24,22 @@ TEST(data_encoding, UrlEncoding) {
   EXPECT_EQ(test, UrlDecode(encoded.c_str()));
 }
 
+TEST(data_encoding, UrlEncodingAllChars) {
+  std::string test;
+  for (int c = 1; c < 256; ++c)
+    test.push_back(static_cast<char>(c));
+  std::string encoded = UrlEncode(test.c_str());
+  EXPECT_EQ(
+      "%01%02%03%04%05%06%07%08%09%0A%0B%0C%0D%0E%0F%10%11%12%13%14%15%16%17"
+      "%18%19%1A%1B%1C%1D%1E%1F+%21%22%23%24%25%26%27%28%29%2A%2B%2C-.%2F"
+      "0123456789%3A%3B%3C%3D%3E%3F%40ABCDEFGHIJKLMNOPQRSTUVWXYZ%5B%5C%5D%5E_"
+      "%60abcdefghijklmnopqrstuvwxyz%7B%7C%7D~%7F",
+      encoded.substr(0, encoded.find("%80")));
+  // 66 unreserved characters, the space and 188 characters encoded as %NN.
+  EXPECT_EQ(66u + 1u + 188u * 3, encoded.size());
+  EXPECT_EQ(test, UrlDecode(encoded.c_str()));
+}
+
 TEST(data_encoding, WebParamsEncoding) {
   std::string encoded =
       WebParamsEncode({{"q", "test"}, {"path", "/usr/bin"}, {"#", "%"}});
@@ -143,4 +159,53 @@ TEST(data_encoding, Base64Decode) {
   EXPECT_TRUE(decoded_blob.empty());
 }
 
+TEST(DataEncoding, Gzip) {
+  std::string data = "test string ";
+  for (int i = 0; i < 8; i++)
+    data += data;
+
+  std::string encoded;
+  EXPECT_TRUE(GzipEncode(data, &encoded));
+  EXPECT_LT(encoded.size(), data.size());
+  // Gzip magic number.
+  EXPECT_EQ("\x1f\x8b", encoded.substr(0, 2));
+
+  std::string decoded;
+  EXPECT_TRUE(GzipDecode(encoded, 0, &decoded));
+  EXPECT_EQ(data, decoded);
+
+  EXPECT_TRUE(GzipEncode("", &encoded));
+  EXPECT_TRUE(GzipDecode(encoded, 0, &decoded));
+  EXPECT_TRUE(decoded.empty());
+
+  // Zlib format, as used by the "deflate" content coding.
+  const char kZlibData[] =
+      "\x78\x9c\x2b\x49\x2d\x2e\x01\x00\x04\x5d\x01\xc1";
+  EXPECT_TRUE(GzipDecode(std::string{kZlibData, sizeof(kZlibData) - 1}, 0,
+                         &decoded));
+  EXPECT_EQ("test", decoded);
+
+  EXPECT_FALSE(GzipDecode("test", 0, &decoded));
+  EXPECT_TRUE(decoded.empty());
+  EXPECT_TRUE(GzipEncode(data, &encoded));
+  EXPECT_FALSE(
+      GzipDecode(encoded.substr(0, encoded.size() / 2), 0, &decoded));
+  EXPECT_TRUE(decoded.empty());
+
+  EXPECT_TRUE(DeflateEncode(data, &encoded));
+  EXPECT_LT(encoded.size(), data.size());
+  EXPECT_EQ('\x78', encoded[0]);
+  EXPECT_TRUE(GzipDecode(encoded, 0, &decoded));
+  EXPECT_EQ(data, decoded);
+
+  // Output over the limit fails, however small the input is.
+  std::string large(1024 * 1024, 'a');
+  EXPECT_TRUE(GzipEncode(large, &encoded));
+  EXPECT_LT(encoded.size(), 2048u);
+  EXPECT_FALSE(GzipDecode(encoded, large.size() - 1, &decoded));
+  EXPECT_TRUE(decoded.empty());
+  EXPECT_TRUE(GzipDecode(encoded, large.size(), &decoded));
+  EXPECT_EQ(large, decoded);
+}
+
 }  // namespace weave
@@ -7,6 +7,9 @@
 #include <string>
 
 #include <base/bind.h>
+#include <base/values.h>
+#include <weave/provider/config_store.h>
+#include <weave/provider/task_runner.h>
 
 #include "src/access_api_handler.h"
 #include "src/access_revocation_manager_impl.h"
@@ -15,13 +18,32 @@
 #include "src/component_manager_impl.h"
 #include "src/config.h"
 #include "src/device_registration_info.h"
+#include "src/diagnostics_api_handler.h"
+#include "src/json_stream_writer.h"
+#include "src/memory_budget.h"
+#include "src/metrics.h"
+#include "src/object_pool.h"
 #include "src/privet/auth_manager.h"
 #include "src/privet/privet_manager.h"
+#include "src/profiling_task_runner.h"
+#include "src/rules_engine.h"
+#include "src/string_atom.h"
 #include "src/string_utils.h"
 #include "src/utils.h"
+#include "src/wake_window_scheduler.h"
 
 namespace weave {
 
+namespace {
+
+// Settings changed within this time are saved together.
+const int kConfigSaveDelayMs = 500;
+// Components and their state are saved at most this often.
+const int kSnapshotSaveDelayMs = 5000;
+const char kSnapshotName[] = "snapshot";
+
+}  // namespace
+
 DeviceManager::DeviceManager(provider::ConfigStore* config_store,
                              provider::TaskRunner* task_runner,
                              provider::HttpClient* http_client,
@@ -29,14 +51,30 @@ DeviceManager::DeviceManager(provider::ConfigStore* config_store,
                              provider::DnsServiceDiscovery* dns_sd,
                              provider::HttpServer* http_server,
                              provider::Wifi* wifi,
-                             provider::Bluetooth* bluetooth)
-    : task_runner_{task_runner},
+                             provider::Bluetooth* bluetooth,
+                             provider::WorkerPool* worker_pool,
+                             RequestSlots* shared_request_slots,
+                             RetryBudget* shared_retry_budget,
+                             base::Clock* clock)
+    : config_store_{config_store},
       network_{network},
       dns_sd_{dns_sd},
       http_server_{http_server},
       wifi_{wifi},
+      bluetooth_{bluetooth},
+      metrics_{new Metrics},
+      profiling_task_runner_{
+          kMetricsEnabled
+              ? new ProfilingTaskRunner{task_runner, metrics_.get(), clock}
+              : nullptr},
+      task_runner_{profiling_task_runner_ ? profiling_task_runner_.get()
+                                          : task_runner},
       config_{new Config{config_store}},
-      component_manager_{new ComponentManagerImpl{task_runner}} {
+      wake_scheduler_{new WakeWindowScheduler{task_runner_, clock}},
+      component_manager_{new ComponentManagerImpl{
+          task_runner_, clock, metrics_.get(), wake_scheduler_.get()}} {
+  config_->EnableWriteBehind(
+      task_runner_, base::TimeDelta::FromMilliseconds(kConfigSaveDelayMs));
   if (http_server) {
     access_revocation_manager_.reset(
         new AccessRevocationManagerImpl{config_store});
@@ -48,22 +86,52 @@ DeviceManager::DeviceManager(provider::ConfigStore* config_store,
   }
 
   device_info_.reset(new DeviceRegistrationInfo(
-      config_.get(), component_manager_.get(), task_runner, http_client,
-      network, auth_manager_.get()));
+      config_.get(), component_manager_.get(), task_runner_, http_client,
+      network, auth_manager_.get(), metrics_.get(), shared_request_slots,
+      shared_retry_budget, worker_pool, clock));
+  device_info_->SetWakeWindowScheduler(wake_scheduler_.get());
   base_api_handler_.reset(new BaseApiHandler{device_info_.get(), this});
 
-  device_info_->Start();
-
-  if (http_server) {
+  auto snapshot = LoadSnapshot();
+  const base::DictionaryValue* resource = nullptr;
+  if (snapshot && snapshot->GetDictionary("resource", &resource))
+    device_info_->RestoreResourceSnapshot(*resource);
+  device_info_->AddResourceUploadedCallback(base::Bind(
+      &DeviceManager::ScheduleSnapshotSave, weak_ptr_factory_.GetWeakPtr()));
+
+  MemoryBudgetMonitor::Hooks hooks;
+  hooks.measure = base::Bind(&DeviceManager::MeasureMemoryUsage,
+                             base::Unretained(this));
+  hooks.merge_state_history =
+      base::Bind(&ComponentManager::MergeStateHistory,
+                 base::Unretained(component_manager_.get()));
+  hooks.shrink_revocation_list = base::Bind(
+      &DeviceManager::ShrinkRevocationList, base::Unretained(this));
+  hooks.drop_cached_serializations = base::Bind(
+      &DeviceManager::DropCachedSerializations, base::Unretained(this));
+  hooks.set_reject_long_polls =
+      base::Bind(&DeviceManager::SetRejectLongPolls, base::Unretained(this));
+  memory_budget_.reset(new MemoryBudgetMonitor{task_runner_, hooks});
+
+  if (http_server)
     StartPrivet();
-    AddSettingsChangedCallback(base::Bind(&DeviceManager::OnSettingsChanged,
-                                          weak_ptr_factory_.GetWeakPtr()));
-  } else {
+  else
     CHECK(!dns_sd);
-  }
+  AddSettingsChangedCallback(base::Bind(&DeviceManager::OnSettingsChanged,
+                                        weak_ptr_factory_.GetWeakPtr()));
+
+  // Local access works with the cached settings, so let Privet serve requests
+  // before the notification channel and cloud connection are started.
+  task_runner_->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&DeviceManager::StartCloud, weak_ptr_factory_.GetWeakPtr()),
+      {});
 }
 
-DeviceManager::~DeviceManager() {}
+DeviceManager::~DeviceManager() {
+  if (snapshot_save_pending_)
+    SaveSnapshot();
+}
 
 const Settings& DeviceManager::GetSettings() const {
   return device_info_->GetSettings();
@@ -78,12 +146,65 @@ Config* DeviceManager::GetConfig() {
   return device_info_->GetMutableConfig();
 }
 
+std::unique_ptr<base::DictionaryValue> DeviceManager::LoadSnapshot() const {
+  if (!config_store_)
+    return nullptr;
+  std::string json = config_store_->LoadSettings(kSnapshotName);
+  if (json.empty())
+    return nullptr;
+  ErrorPtr error;
+  auto snapshot = LoadJsonDict(json, &error);
+  if (!snapshot)
+    LOG(WARNING) << "Failed to load snapshot: " << error->GetMessage();
+  return snapshot;
+}
+
+void DeviceManager::ScheduleSnapshotSave() {
+  if (!config_store_ || snapshot_save_pending_)
+    return;
+  snapshot_save_pending_ = true;
+  task_runner_->PostTaskWithPriority(
+      FROM_HERE,
+      base::Bind(&DeviceManager::SaveSnapshot, weak_ptr_factory_.GetWeakPtr()),
+      base::TimeDelta::FromMilliseconds(kSnapshotSaveDelayMs),
+      provider::TaskRunner::Priority::kBackground);
+}
+
+void DeviceManager::SaveSnapshot() {
+  snapshot_save_pending_ = false;
+  std::string json;
+  {
+    JsonStreamWriter writer{&json};
+    writer.BeginDictionary();
+    auto resource = device_info_->SaveResourceSnapshot();
+    if (resource) {
+      writer.WriteKey("resource");
+      writer.WriteValue(*resource);
+    }
+    if (!components_snapshot_version_.empty()) {
+      writer.WriteKey("version");
+      writer.WriteString(components_snapshot_version_);
+      writer.WriteKey("components");
+      component_manager_->WriteSnapshot(&writer);
+    }
+    writer.EndDictionary();
+  }
+  config_store_->SaveSettings(kSnapshotName, json, {});
+}
+
+void DeviceManager::StartCloud() {
+  device_info_->Start();
+}
+
 void DeviceManager::StartPrivet() {
   if (privet_)
     return;
-  privet_.reset(new privet::Manager{task_runner_});
-  privet_->Start(network_, dns_sd_, http_server_, wifi_, auth_manager_.get(),
-                 device_info_.get(), component_manager_.get());
+  privet_.reset(new privet::Manager{task_runner_, metrics_.get()});
+  privet_->Start(network_, dns_sd_, http_server_, wifi_, bluetooth_,
+                 auth_manager_.get(), device_info_.get(),
+                 component_manager_.get());
+  privet_->SetRejectLongPolls(reject_long_polls_);
+  privet_->SetInputLimits(input_limits_);
 }
 
 void DeviceManager::StopPrivet() {
@@ -107,6 +228,14 @@ void DeviceManager::AddTraitDefinitions(const base::DictionaryValue& dict) {
   CHECK(component_manager_->LoadTraits(dict, nullptr));
 }
 
+void DeviceManager::AddTraitDefinitionsFromTable(const EmbeddedValue& table) {
+  CHECK(component_manager_->LoadTraits(table, nullptr));
+}
+
+void DeviceManager::EnableLazyTraits() {
+  component_manager_->EnableLazyTraits();
+}
+
 const base::DictionaryValue& DeviceManager::GetTraits() const {
   return component_manager_->GetTraits();
 }
@@ -134,6 +263,60 @@ const base::DictionaryValue& DeviceManager::GetComponents() const {
   return component_manager_->GetComponents();
 }
 
+void DeviceManager::EnableComponentsView() {
+  component_manager_->EnableComponentsView();
+}
+
+std::shared_ptr<const base::DictionaryValue>
+DeviceManager::GetComponentsView() const {
+  return component_manager_->GetComponentsView();
+}
+
+bool DeviceManager::EnableComponentsSnapshot(const std::string& version) {
+  CHECK(!version.empty());
+  CHECK(components_snapshot_version_.empty());
+  components_snapshot_version_ = version;
+
+  bool restored = false;
+  auto snapshot = LoadSnapshot();
+  std::string saved_version;
+  const base::DictionaryValue* components = nullptr;
+  if (snapshot && snapshot->GetString("version", &saved_version) &&
+      saved_version == version &&
+      snapshot->GetDictionary("components", &components)) {
+    ErrorPtr error;
+    restored = component_manager_->RestoreSnapshot(*components, &error);
+    if (!restored)
+      LOG(WARNING) << "Failed to restore components: " << error->GetMessage();
+  }
+
+  auto save = base::Bind(&DeviceManager::ScheduleSnapshotSave,
+                         weak_ptr_factory_.GetWeakPtr());
+  component_manager_->AddTraitDefChangedCallback(save);
+  component_manager_->AddComponentTreeChangedCallback(save);
+  component_manager_->AddStateChangedCallback(save);
+  return restored;
+}
+
+void DeviceManager::EnableStateSpool(const StateSpoolPolicy& policy) {
+  if (config_store_)
+    device_info_->EnableStateSpool(config_store_, policy);
+}
+
+void DeviceManager::EnableLocalRules() {
+  if (!rules_engine_) {
+    rules_engine_.reset(
+        new RulesEngine{component_manager_.get(), config_store_});
+  }
+}
+
+void DeviceManager::EnableDiagnostics(const DiagnosticsPolicy& policy) {
+  if (!diagnostics_api_handler_) {
+    diagnostics_api_handler_.reset(new DiagnosticsApiHandler{
+        this, task_runner_, wake_scheduler_.get(), policy});
+  }
+}
+
 bool DeviceManager::SetStatePropertiesFromJson(const std::string& component,
                                                const std::string& json,
                                                ErrorPtr* error) {
@@ -146,12 +329,26 @@ bool DeviceManager::SetStateProperties(const std::string& component,
   return component_manager_->SetStateProperties(component, dict, error);
 }
 
+bool DeviceManager::SetStateProperties(
+    const std::string& component,
+    std::unique_ptr<base::DictionaryValue> dict,
+    ErrorPtr* error) {
+  return component_manager_->SetStateProperties(component, std::move(dict),
+                                                error);
+}
+
 const base::Value* DeviceManager::GetStateProperty(const std::string& component,
                                                    const std::string& name,
                                                    ErrorPtr* error) const {
   return component_manager_->GetStateProperty(component, name, error);
 }
 
+const base::DictionaryValue* DeviceManager::GetComponentState(
+    const std::string& component,
+    ErrorPtr* error) const {
+  return component_manager_->GetComponentState(component, error);
+}
+
 bool DeviceManager::SetStateProperty(const std::string& component,
                                      const std::string& name,
                                      const base::Value& value,
@@ -159,12 +356,52 @@ bool DeviceManager::SetStateProperty(const std::string& component,
   return component_manager_->SetStateProperty(component, name, value, error);
 }
 
+Device::StatePropertyHandle DeviceManager::ResolveStateProperty(
+    const std::string& component,
+    const std::string& name,
+    ErrorPtr* error) {
+  return component_manager_->ResolveStateProperty(component, name, error);
+}
+
+bool DeviceManager::SetStatePropertyByHandle(StatePropertyHandle handle,
+                                             const base::Value& value,
+                                             ErrorPtr* error) {
+  return component_manager_->SetStatePropertyByHandle(handle, value, error);
+}
+
+bool DeviceManager::SetComponentsState(const base::DictionaryValue& states,
+                                       ErrorPtr* error) {
+  return component_manager_->SetComponentsState(states, error);
+}
+
+bool DeviceManager::SetStateHistoryPolicy(const std::string& component,
+                                          const StateHistoryPolicy& policy,
+                                          ErrorPtr* error) {
+  return component_manager_->SetStateHistoryPolicy(component, policy, error);
+}
+
+bool DeviceManager::SetStatePublishFilter(const std::string& component,
+                                          const std::string& name,
+                                          const StatePublishFilter& filter,
+                                          ErrorPtr* error) {
+  return component_manager_->SetStatePublishFilter(component, name, filter,
+                                                   error);
+}
+
 void DeviceManager::AddCommandHandler(const std::string& component,
                                       const std::string& command_name,
                                       const CommandHandlerCallback& callback) {
   component_manager_->AddCommandHandler(component, command_name, callback);
 }
 
+bool DeviceManager::SetCommandHandlerPolicy(const std::string& component,
+                                            const std::string& command_name,
+                                            const CommandHandlerPolicy& policy,
+                                            ErrorPtr* error) {
+  return component_manager_->SetCommandHandlerPolicy(component, command_name,
+                                                     policy, error);
+}
+
 bool DeviceManager::AddCommand(const base::DictionaryValue& command,
                                std::string* id,
                                ErrorPtr* error) {
@@ -176,6 +413,26 @@ bool DeviceManager::AddCommand(const base::DictionaryValue& command,
   return true;
 }
 
+bool DeviceManager::AddLocalCommand(const std::string& component,
+                                    const std::string& name,
+                                    const base::DictionaryValue& parameters,
+                                    AuthScope scope,
+                                    std::string* id,
+                                    ErrorPtr* error) {
+  if (scope == AuthScope::kNone) {
+    return Error::AddTo(error, FROM_HERE, "access_denied",
+                        "Command sent without a user");
+  }
+  UserRole role;
+  CHECK(StringToEnum(EnumToString(scope), &role));
+  auto command_instance = component_manager_->CreateCommandInstance(
+      component, name, parameters, Command::Origin::kLocal, role, id, error);
+  if (!command_instance)
+    return false;
+  component_manager_->AddCommand(std::move(command_instance));
+  return true;
+}
+
 Command* DeviceManager::FindCommand(const std::string& id) {
   return component_manager_->FindCommand(id);
 }
@@ -196,7 +453,82 @@ void DeviceManager::AddPairingChangedCallbacks(
     privet_->AddOnPairingChangedCallbacks(begin_callback, end_callback);
 }
 
+std::unique_ptr<base::DictionaryValue> DeviceManager::GetMetrics() const {
+  return metrics_->ToJson();
+}
+
+std::unique_ptr<base::DictionaryValue> DeviceManager::GetMemoryStats() const {
+  std::unique_ptr<base::DictionaryValue> stats{new base::DictionaryValue};
+  component_manager_->GetMemoryStats(stats.get());
+  device_info_->GetMemoryStats(stats.get());
+  stats->Set("strings", StringAtom::GetTableMemoryUsage().ToJson());
+  stats->Set("objectPools", ObjectPool::GetTotalMemoryUsage().ToJson());
+  if (access_revocation_manager_) {
+    stats->Set("accessRevocation",
+               access_revocation_manager_->GetMemoryUsage().ToJson());
+  }
+  if (privet_)
+    stats->Set("privet", privet_->GetMemoryUsage().ToJson());
+  return stats;
+}
+
+size_t DeviceManager::MeasureMemoryUsage() const {
+  size_t bytes = 0;
+  auto stats = GetMemoryStats();
+  for (base::DictionaryValue::Iterator it{*stats}; !it.IsAtEnd();
+       it.Advance()) {
+    const base::DictionaryValue* usage = nullptr;
+    int usage_bytes = 0;
+    if (it.value().GetAsDictionary(&usage) &&
+        usage->GetInteger("bytes", &usage_bytes)) {
+      bytes += usage_bytes;
+    }
+  }
+  return bytes;
+}
+
+void DeviceManager::ShrinkRevocationList() {
+  if (access_revocation_manager_)
+    access_revocation_manager_->CompactMemory();
+}
+
+void DeviceManager::DropCachedSerializations() {
+  component_manager_->CompactMemory();
+  device_info_->CompactMemory();
+  if (privet_)
+    privet_->DropCaches();
+}
+
+void DeviceManager::SetRejectLongPolls(bool reject) {
+  reject_long_polls_ = reject;
+  if (privet_)
+    privet_->SetRejectLongPolls(reject);
+}
+
+void DeviceManager::CompactMemory() {
+  component_manager_->CompactMemory();
+  device_info_->CompactMemory();
+  if (access_revocation_manager_)
+    access_revocation_manager_->CompactMemory();
+}
+
+std::unique_ptr<base::DictionaryValue> DeviceManager::GetTrafficStats() const {
+  return device_info_->GetTrafficStats();
+}
+
+void DeviceManager::SetMaxWakeSlack(base::TimeDelta max_slack) {
+  wake_scheduler_->SetMaxSlack(max_slack);
+}
+
+void DeviceManager::SetInputLimits(const InputLimits& limits) {
+  input_limits_ = limits;
+  device_info_->SetInputLimits(limits);
+  if (privet_)
+    privet_->SetInputLimits(limits);
+}
+
 void DeviceManager::OnSettingsChanged(const Settings& settings) {
+  memory_budget_->SetBudget(settings.memory_budget);
   if (settings.local_access_enabled && http_server_) {
     StartPrivet();
   } else {
@@ -211,10 +543,11 @@ std::unique_ptr<Device> Device::Create(provider::ConfigStore* config_store,
                                        provider::DnsServiceDiscovery* dns_sd,
                                        provider::HttpServer* http_server,
                                        provider::Wifi* wifi,
-                                       provider::Bluetooth* bluetooth) {
+                                       provider::Bluetooth* bluetooth,
+                                       provider::WorkerPool* worker_pool) {
   return std::unique_ptr<Device>{
       new DeviceManager{config_store, task_runner, http_client, network, dns_sd,
-                        http_server, wifi, bluetooth}};
+                        http_server, wifi, bluetooth, worker_pool}};
 }
 
 }  // namespace weave
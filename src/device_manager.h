@@ -8,14 +8,26 @@
 #include <base/memory/weak_ptr.h>
 #include <weave/device.h>
 
+namespace base {
+class Clock;
+}  // namespace base
+
 namespace weave {
 
 class AccessApiHandler;
 class AccessRevocationManager;
 class BaseApiHandler;
+class DiagnosticsApiHandler;
 class Config;
 class ComponentManager;
 class DeviceRegistrationInfo;
+class MemoryBudgetMonitor;
+class Metrics;
+class ProfilingTaskRunner;
+class RequestSlots;
+class RetryBudget;
+class RulesEngine;
+class WakeWindowScheduler;
 
 namespace privet {
 class AuthManager;
@@ -24,6 +36,9 @@ class Manager;
 
 class DeviceManager final : public Device {
  public:
+  // |clock| defaults to the system clock. Simulations running on a fake task
+  // runner pass its clock, so that the commands and state changes age with
+  // the simulated time.
   DeviceManager(provider::ConfigStore* config_store,
                 provider::TaskRunner* task_runner,
                 provider::HttpClient* http_client,
@@ -31,7 +46,11 @@ class DeviceManager final : public Device {
                 provider::DnsServiceDiscovery* dns_sd,
                 provider::HttpServer* http_server,
                 provider::Wifi* wifi,
-                provider::Bluetooth* bluetooth);
+                provider::Bluetooth* bluetooth,
+                provider::WorkerPool* worker_pool = nullptr,
+                RequestSlots* shared_request_slots = nullptr,
+                RetryBudget* shared_retry_budget = nullptr,
+                base::Clock* clock = nullptr);
   ~DeviceManager() override;
 
   // Device implementation.
@@ -40,6 +59,8 @@ class DeviceManager final : public Device {
       const SettingsChangedCallback& callback) override;
   void AddTraitDefinitionsFromJson(const std::string& json) override;
   void AddTraitDefinitions(const base::DictionaryValue& dict) override;
+  void AddTraitDefinitionsFromTable(const EmbeddedValue& table) override;
+  void EnableLazyTraits() override;
   const base::DictionaryValue& GetTraits() const override;
   void AddTraitDefsChangedCallback(const base::Closure& callback) override;
   bool AddComponent(const std::string& name,
@@ -48,25 +69,63 @@ class DeviceManager final : public Device {
   bool RemoveComponent(const std::string& name, ErrorPtr* error) override;
   void AddComponentTreeChangedCallback(const base::Closure& callback) override;
   const base::DictionaryValue& GetComponents() const override;
+  void EnableComponentsView() override;
+  std::shared_ptr<const base::DictionaryValue> GetComponentsView()
+      const override;
+  bool EnableComponentsSnapshot(const std::string& version) override;
+  void EnableStateSpool(const StateSpoolPolicy& policy) override;
+  void EnableLocalRules() override;
+  void EnableDiagnostics(const DiagnosticsPolicy& policy) override;
   bool SetStatePropertiesFromJson(const std::string& component,
                                   const std::string& json,
                                   ErrorPtr* error) override;
   bool SetStateProperties(const std::string& component,
                           const base::DictionaryValue& dict,
                           ErrorPtr* error) override;
+  bool SetStateProperties(const std::string& component,
+                          std::unique_ptr<base::DictionaryValue> dict,
+                          ErrorPtr* error) override;
   const base::Value* GetStateProperty(const std::string& component,
                                       const std::string& name,
                                       ErrorPtr* error) const override;
+  const base::DictionaryValue* GetComponentState(
+      const std::string& component,
+      ErrorPtr* error) const override;
   bool SetStateProperty(const std::string& component,
                         const std::string& name,
                         const base::Value& value,
                         ErrorPtr* error) override;
+  StatePropertyHandle ResolveStateProperty(const std::string& component,
+                                           const std::string& name,
+                                           ErrorPtr* error) override;
+  bool SetStatePropertyByHandle(StatePropertyHandle handle,
+                                const base::Value& value,
+                                ErrorPtr* error) override;
+  bool SetComponentsState(const base::DictionaryValue& states,
+                          ErrorPtr* error) override;
+  bool SetStateHistoryPolicy(const std::string& component,
+                             const StateHistoryPolicy& policy,
+                             ErrorPtr* error) override;
+  bool SetStatePublishFilter(const std::string& component,
+                             const std::string& name,
+                             const StatePublishFilter& filter,
+                             ErrorPtr* error) override;
   void AddCommandHandler(const std::string& component,
                          const std::string& command_name,
                          const CommandHandlerCallback& callback) override;
+  bool SetCommandHandlerPolicy(const std::string& component,
+                               const std::string& command_name,
+                               const CommandHandlerPolicy& policy,
+                               ErrorPtr* error) override;
   bool AddCommand(const base::DictionaryValue& command,
                   std::string* id,
                   ErrorPtr* error) override;
+  bool AddLocalCommand(const std::string& component,
+                       const std::string& name,
+                       const base::DictionaryValue& parameters,
+                       AuthScope scope,
+                       std::string* id,
+                       ErrorPtr* error) override;
   Command* FindCommand(const std::string& id) override;
   void AddStateChangedCallback(const base::Closure& callback) override;
   void Register(const RegistrationData& registration_data,
@@ -77,28 +136,67 @@ class DeviceManager final : public Device {
   void AddPairingChangedCallbacks(
       const PairingBeginCallback& begin_callback,
       const PairingEndCallback& end_callback) override;
+  std::unique_ptr<base::DictionaryValue> GetMetrics() const override;
+  std::unique_ptr<base::DictionaryValue> GetMemoryStats() const override;
+  void CompactMemory() override;
+  std::unique_ptr<base::DictionaryValue> GetTrafficStats() const override;
+  void SetMaxWakeSlack(base::TimeDelta max_slack) override;
+  void SetInputLimits(const InputLimits& limits) override;
 
   Config* GetConfig();
 
  private:
+  void StartCloud();
   void StartPrivet();
   void StopPrivet();
   void OnSettingsChanged(const Settings& settings);
 
-  provider::TaskRunner* task_runner_{nullptr};
+  // Hooks of |memory_budget_|.
+  size_t MeasureMemoryUsage() const;
+  void ShrinkRevocationList();
+  void DropCachedSerializations();
+  void SetRejectLongPolls(bool reject);
+
+  // Loads the snapshot saved by the previous run, nullptr if there is none.
+  std::unique_ptr<base::DictionaryValue> LoadSnapshot() const;
+  // Saves the resource snapshot of DeviceRegistrationInfo and, if enabled,
+  // the components snapshot, after a delay so several changes are saved
+  // together.
+  void ScheduleSnapshotSave();
+  void SaveSnapshot();
+
+  provider::ConfigStore* config_store_{nullptr};
   provider::Network* network_{nullptr};
   provider::DnsServiceDiscovery* dns_sd_{nullptr};
   provider::HttpServer* http_server_{nullptr};
   provider::Wifi* wifi_{nullptr};
+  provider::Bluetooth* bluetooth_{nullptr};
 
+  // Outlives the objects recording to it.
+  std::unique_ptr<Metrics> metrics_;
+  // Wraps the provider's task runner when metrics are enabled.
+  std::unique_ptr<ProfilingTaskRunner> profiling_task_runner_;
+  // The runner used by everything else, the profiling one if there is one.
+  provider::TaskRunner* task_runner_{nullptr};
   std::unique_ptr<Config> config_;
+  std::unique_ptr<WakeWindowScheduler> wake_scheduler_;
   std::unique_ptr<privet::AuthManager> auth_manager_;
   std::unique_ptr<ComponentManager> component_manager_;
   std::unique_ptr<DeviceRegistrationInfo> device_info_;
   std::unique_ptr<BaseApiHandler> base_api_handler_;
   std::unique_ptr<AccessRevocationManager> access_revocation_manager_;
   std::unique_ptr<AccessApiHandler> access_api_handler_;
+  std::unique_ptr<RulesEngine> rules_engine_;
+  std::unique_ptr<DiagnosticsApiHandler> diagnostics_api_handler_;
   std::unique_ptr<privet::Manager> privet_;
+  bool reject_long_polls_{false};
+  InputLimits input_limits_;
+  // Calls the objects above, so it's destroyed first.
+  std::unique_ptr<MemoryBudgetMonitor> memory_budget_;
+
+  // Version passed to EnableComponentsSnapshot(), empty if not enabled.
+  std::string components_snapshot_version_;
+  bool snapshot_save_pending_{false};
 
   base::WeakPtrFactory<DeviceManager> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(DeviceManager);
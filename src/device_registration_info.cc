@@ -14,23 +14,33 @@
 #include <base/json/json_reader.h>
 #include <base/json/json_writer.h>
 #include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 #include <base/values.h>
 #include <weave/provider/http_client.h>
 #include <weave/provider/network.h>
 #include <weave/provider/task_runner.h>
+#include <weave/provider/worker_pool.h>
 
 #include "src/bind_lambda.h"
 #include "src/commands/cloud_command_proxy.h"
 #include "src/commands/schema_constants.h"
 #include "src/data_encoding.h"
 #include "src/http_constants.h"
+#include "src/json_stream_reader.h"
+#include "src/json_stream_writer.h"
 #include "src/json_error_codes.h"
+#include "src/memory_usage.h"
 #include "src/notification/xmpp_channel.h"
 #include "src/privet/auth_manager.h"
 #include "src/privet/constants.h"
+#include "src/sharded_json_writer.h"
+#include "src/streams.h"
 #include "src/string_utils.h"
 #include "src/utils.h"
+#include "src/wake_window_scheduler.h"
+#include "src/worker_task.h"
+#include "third_party/chromium/crypto/sha2.h"
 
 namespace weave {
 
@@ -39,12 +49,182 @@ const char kErrorAlreayRegistered[] = "already_registered";
 namespace {
 
 const int kPollingPeriodSeconds = 7;
+// Polling slows down to this period while no commands arrive.
+const int kMaxPollingPeriodSeconds = 2 * 60;
+// Polling period after XMPP connects, until its first ping is answered.
+const int kUnconfirmedPollingPeriodSeconds = 30;
+
+// Default limits of patchState requests.
+const int kStatePublishMinIntervalMs = 1000;
+const int kStatePublishMaxIntervalMs = 10000;
+const size_t kStatePublishMaxBatchSize = 100;
+const size_t kStatePublishMaxRequestsInFlight = 4;
+
+// Maximal number of command PATCH requests sent to the server at once. The
+// others wait for their turn, so many active commands don't flood the
+// connection.
+const size_t kMaxCommandUpdatesInFlight = 2;
+
+// All cloud, OAuth and command update retries together are limited to this
+// many per minute.
+const size_t kMaxRetriesPerMinute = 20;
+
+// Longest server requested Retry-After delay that is honored.
+const int kMaxRetryAfterSeconds = 60 * 60;
+
+// Pushed commands are queued without fetching the command queue, so it's
+// fetched after this long without any fetch, in case a push was lost.
+// The resync may be late by this part of the period, to share a wake-up.
+const int kCommandResyncPeriodMinutes = 15;
+const double kCommandResyncTolerance = 0.5;
+
+// Access tokens are refreshed this long before they expire.
+const int kAccessTokenRefreshMarginSeconds = 5 * 60;
+
+// Retries delayed by a backoff policy may be late by this part of their delay.
+const double kRetryTolerance = 0.25;
+
+// Maximal number of cloud requests sent to the server at once. Further ones
+// are queued by priority.
+const size_t kMaxCloudRequestsInFlight = 4;
+
+// After this many cloud request failures in a row the cloud is considered
+// unreachable. Until one retried request gets through again, the others are
+// held back and the new work is only recorded.
+const int kMaxCloudFailuresOnline = 3;
+
+// Request bodies smaller than this are not worth compressing.
+const size_t kMinCompressedBodySize = 1024;
+
+// Smaller cloud responses are parsed faster than a task is posted to the
+// worker pool and back.
+const size_t kMinWorkerPoolJsonSize = 16 * 1024;
+
+// The components of larger device resources are serialized on the worker
+// pool, split by the top-level components into this many shards.
+const size_t kMaxComponentsJsonShards = 4;
+
+// Endpoint of the OAuth token requests in the traffic stats.
+const char kOAuthTokenEndpoint[] = "POST oauth2/token";
+
+// Sections of the device resource updated separately by delta updates.
+const char kResourceHeaderSection[] = "device";
+const char kResourceTraitsSection[] = "traits";
+const char kResourceComponentsSection[] = "components";
+
+// Device resource member with the fingerprint of the trait definitions. A
+// server which supports trait references returns it once it keeps the traits,
+// and accepts it in place of them afterwards.
+const char kTraitsFingerprint[] = "traitsFingerprint";
+// Error of the server which lost the traits of a fingerprint.
+const char kErrorUnknownTraitsFingerprint[] = "unknown_traits_fingerprint";
+
+// Escapes |key| for a path of the resource digests, as a JSON pointer does,
+// so '/' only separates the keys.
+std::string EscapeDigestKey(const std::string& key) {
+  std::string escaped;
+  for (char c : key) {
+    if (c == '~')
+      escaped += "~0";
+    else if (c == '/')
+      escaped += "~1";
+    else
+      escaped.push_back(c);
+  }
+  return escaped;
+}
+
+std::string UnescapeDigestKey(const std::string& escaped) {
+  std::string key;
+  for (size_t i = 0; i < escaped.size(); ++i) {
+    if (escaped[i] == '~' && i + 1 < escaped.size()) {
+      key.push_back(escaped[++i] == '1' ? '/' : '~');
+      continue;
+    }
+    key.push_back(escaped[i]);
+  }
+  return key;
+}
+
+// Adds the SHA-256 digests of |value| and of all the members nested in it to
+// |digests|, keyed by |path| and "<path>/<key>/...". The digest of a
+// dictionary covers the digests of its members, so every value is serialized
+// only once. Returns the digest of |value|.
+std::string AddResourceDigests(const std::string& path,
+                               const base::Value& value,
+                               std::map<std::string, std::string>* digests) {
+  std::string data;
+  const base::DictionaryValue* dict = nullptr;
+  if (value.GetAsDictionary(&dict)) {
+    data.push_back('{');
+    for (base::DictionaryValue::Iterator it(*dict); !it.IsAtEnd();
+         it.Advance()) {
+      std::string key = EscapeDigestKey(it.key());
+      data += key;
+      data.push_back('\0');
+      data += AddResourceDigests(path + '/' + key, it.value(), digests);
+    }
+  } else {
+    JsonStreamWriter writer{&data};
+    writer.WriteValue(value);
+  }
+  std::string digest = crypto::SHA256HashString(data);
+  (*digests)[path] = digest;
+  return digest;
+}
+
+// Writes the members of |dict| at |path| whose |digests| differ from the
+// |uploaded| ones, and nulls for the members removed since. Changed
+// dictionaries which were uploaded before are written the same way, member
+// by member, so merging the patch into the resource on the server removes
+// the nested members too.
+void WriteResourceMembersPatch(
+    const std::string& path,
+    const base::DictionaryValue& dict,
+    const std::map<std::string, std::string>& digests,
+    const std::map<std::string, std::string>& uploaded,
+    JsonStreamWriter* writer) {
+  for (base::DictionaryValue::Iterator it(dict); !it.IsAtEnd(); it.Advance()) {
+    std::string member_path = path + '/' + EscapeDigestKey(it.key());
+    auto p = uploaded.find(member_path);
+    auto c = digests.find(member_path);
+    if (p != uploaded.end() && c != digests.end() && p->second == c->second)
+      continue;
+    writer->WriteKey(it.key());
+    const base::DictionaryValue* member = nullptr;
+    if (p != uploaded.end() && it.value().GetAsDictionary(&member)) {
+      writer->BeginDictionary();
+      WriteResourceMembersPatch(member_path, *member, digests, uploaded,
+                                writer);
+      writer->EndDictionary();
+    } else {
+      writer->WriteValue(it.value());
+    }
+  }
+
+  std::string prefix = path + '/';
+  for (auto p = uploaded.lower_bound(prefix);
+       p != uploaded.end() && p->first.compare(0, prefix.size(), prefix) == 0;
+       ++p) {
+    std::string key = p->first.substr(prefix.size());
+    if (key.find('/') != std::string::npos)
+      continue;  // Nested deeper.
+    key = UnescapeDigestKey(key);
+    const base::Value* member = nullptr;
+    if (!dict.GetWithoutPathExpansion(key, &member)) {
+      writer->WriteKey(key);
+      writer->WriteNull();  // Removed since the last upload.
+    }
+  }
+}
 
 namespace fetch_reason {
 
 const char kDeviceStart[] = "device_start";  // Initial queue fetch at startup.
 const char kRegularPull[] = "regular_pull";  // Regular fetch before XMPP is up.
 const char kNewCommand[] = "new_command";    // A new command is available.
+const char kChannelLost[] = "channel_lost";  // Pushes may have been missed.
+const char kResync[] = "resync";             // Periodic check for lost pushes.
 
 }  // namespace fetch_reason
 
@@ -54,11 +234,30 @@ inline void SetUnexpectedError(ErrorPtr* error) {
   Error::AddTo(error, FROM_HERE, "unexpected_response", "Unexpected GCD error");
 }
 
+// Returns the label of a cloud request in the metrics and the traffic stats,
+// e.g. "PATCH commands/*", with the IDs in the URL replaced, so requests are
+// grouped by the API they use.
+std::string GetCloudRequestLabel(HttpClient::Method method,
+                                 const std::string& service_url,
+                                 const std::string& url) {
+  std::string path = SplitAtFirst(url, "?", false).first;
+  if (path.compare(0, service_url.size(), service_url) == 0)
+    path.erase(0, service_url.size());
+  std::vector<std::string> parts = Split(path, "/", false, false);
+  for (size_t i = 1; i < parts.size(); ++i) {
+    if ((parts[i - 1] == "devices" || parts[i - 1] == "commands" ||
+         parts[i - 1] == "blobs" || parts[i - 1] == "registrationTickets") &&
+        !parts[i].empty() && parts[i] != "queue") {
+      parts[i] = "*";
+    }
+  }
+  return EnumToString(method) + " " + Join("/", parts);
+}
+
 void ParseGCDError(const base::DictionaryValue* json, ErrorPtr* error) {
-  const base::Value* list_value = nullptr;
+  static const base::ValuePath kErrorsPath{"error.errors"};
   const base::ListValue* error_list = nullptr;
-  if (!json->Get("error.errors", &list_value) ||
-      !list_value->GetAsList(&error_list)) {
+  if (!json->GetList(kErrorsPath, &error_list)) {
     SetUnexpectedError(error);
     return;
   }
@@ -81,24 +280,95 @@ void ParseGCDError(const base::DictionaryValue* json, ErrorPtr* error) {
   }
 }
 
-std::string AppendQueryParams(const std::string& url,
-                              const WebParamList& params) {
-  CHECK_EQ(std::string::npos, url.find_first_of("?#"));
+void AppendQueryParams(std::string* url, const WebParamList& params) {
+  CHECK_EQ(std::string::npos, url->find_first_of("?#"));
   if (params.empty())
-    return url;
-  return url + '?' + WebParamsEncode(params);
+    return;
+  *url += '?';
+  *url += WebParamsEncode(params);
 }
 
 std::string BuildUrl(const std::string& url,
                      const std::string& subpath,
                      const WebParamList& params) {
-  std::string result = url;
+  std::string result;
+  result.reserve(url.size() + subpath.size() + 1);
+  result = url;
   if (!result.empty() && result.back() != '/' && !subpath.empty()) {
     CHECK_NE('/', subpath.front());
     result += '/';
   }
   result += subpath;
-  return AppendQueryParams(result, params);
+  AppendQueryParams(&result, params);
+  return result;
+}
+
+HttpClient::Headers BuildRequestHeaders(const std::string& access_token,
+                                        const std::string& mime_type,
+                                        const std::string& content_encoding,
+                                        bool accept_compressed_response) {
+  HttpClient::Headers headers;
+  if (!access_token.empty())
+    headers.emplace_back(http::kAuthorization, "Bearer " + access_token);
+  if (!mime_type.empty())
+    headers.emplace_back(http::kContentType, mime_type);
+  if (!content_encoding.empty())
+    headers.emplace_back(http::kContentEncoding, content_encoding);
+  if (accept_compressed_response) {
+    headers.emplace_back(http::kAcceptEncoding,
+                         std::string{http::kGzip} + ", " + http::kDeflate);
+  }
+  return headers;
+}
+
+// Response with the body decoded according to its Content-Encoding.
+class DecodedResponse final : public HttpClient::Response {
+ public:
+  DecodedResponse(std::unique_ptr<HttpClient::Response> response,
+                  std::string data)
+      : response_{std::move(response)}, data_{std::move(data)} {}
+
+  int GetStatusCode() const override { return response_->GetStatusCode(); }
+  std::string GetContentType() const override {
+    return response_->GetContentType();
+  }
+  std::string GetHeader(const std::string& name) const override {
+    // The body is not encoded anymore.
+    if (base::EqualsCaseInsensitiveASCII(name, http::kContentEncoding))
+      return {};
+    return response_->GetHeader(name);
+  }
+  const std::string& GetData() const override { return data_; }
+
+ private:
+  std::unique_ptr<HttpClient::Response> response_;
+  std::string data_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecodedResponse);
+};
+
+std::unique_ptr<HttpClient::Response> DecodeResponse(
+    std::unique_ptr<HttpClient::Response> response,
+    size_t max_size,
+    ErrorPtr* error) {
+  std::string encoding =
+      base::ToLowerASCII(response->GetHeader(http::kContentEncoding));
+  if (encoding.empty() || encoding == "identity")
+    return response;
+
+  if (encoding != http::kGzip && encoding != http::kDeflate) {
+    return Error::AddTo(error, FROM_HERE, "unsupported_content_encoding",
+                        "Unexpected content encoding: '" + encoding + "'");
+  }
+
+  std::string data;
+  if (!GzipDecode(response->GetData(), max_size, &data)) {
+    return Error::AddTo(error, FROM_HERE, "invalid_content_encoding",
+                        "Failed to decode " + encoding +
+                            " response, or it is over the size limit");
+  }
+  return std::unique_ptr<HttpClient::Response>{
+      new DecodedResponse{std::move(response), std::move(data)}};
 }
 
 void IgnoreCloudErrorWithCallback(const base::Closure& cb, ErrorPtr) {
@@ -109,28 +379,49 @@ void IgnoreCloudError(ErrorPtr) {}
 
 void IgnoreCloudResult(const base::DictionaryValue&, ErrorPtr error) {}
 
-void IgnoreCloudResultWithCallback(const DoneCallback& cb,
-                                   const base::DictionaryValue&,
-                                   ErrorPtr error) {
-  cb.Run(std::move(error));
-}
-
 class RequestSender final {
  public:
   RequestSender(HttpClient::Method method,
-                const std::string& url,
+                std::string url,
                 HttpClient* transport)
-      : method_{method}, url_{url}, transport_{transport} {}
+      : method_{method}, url_{std::move(url)}, transport_{transport} {}
 
   void Send(const HttpClient::SendRequestCallback& callback) {
     static int debug_id = 0;
     ++debug_id;
     VLOG(1) << "Sending request. id:" << debug_id
             << " method:" << EnumToString(method_) << " url:" << url_;
-    VLOG(2) << "Request data: " << data_;
+    if (!data_stream_)
+      VLOG(2) << "Request data: " << GetData();
+    HttpClient::Headers full_headers;
+    if (!headers_reference_)
+      full_headers = GetFullHeaders();
+    const HttpClient::Headers& headers =
+        headers_reference_ ? *headers_reference_ : full_headers;
+    size_t request_size = 0;
+    if (traffic_stats_) {
+      // The request line and headers are counted, the TLS overhead is not.
+      request_size = EnumToString(method_).size() + url_.size() +
+                     (data_stream_ ? data_stream_size_ : GetData().size()) +
+                     sizeof("  HTTP/1.1\r\n\r\n") - 1;
+      for (const auto& header : headers)
+        request_size += header.first.size() + header.second.size() + 4;
+    }
     auto on_done = [](
-        int debug_id, const HttpClient::SendRequestCallback& callback,
+        int debug_id, bool decode, size_t max_decoded_size,
+        std::shared_ptr<TrafficStats> traffic_stats,
+        const std::string& endpoint, size_t request_size,
+        const HttpClient::SendRequestCallback& callback,
         std::unique_ptr<HttpClient::Response> response, ErrorPtr error) {
+      if (traffic_stats) {
+        // The response body as received, before it is decoded. The response
+        // headers are not available.
+        traffic_stats->Record(endpoint, request_size,
+                              response ? response->GetData().size() : 0);
+      }
+      if (!error && decode)
+        response =
+            DecodeResponse(std::move(response), max_decoded_size, &error);
       if (error) {
         VLOG(1) << "Request failed, id=" << debug_id
                 << ", reason: " << error->GetCode()
@@ -142,16 +433,69 @@ class RequestSender final {
       VLOG(2) << "Response data: " << response->GetData();
       callback.Run(std::move(response), nullptr);
     };
-    transport_->SendRequest(method_, url_, GetFullHeaders(), data_,
-                            base::Bind(on_done, debug_id, callback));
+    auto done_callback =
+        base::Bind(on_done, debug_id, accept_compressed_response_,
+                   max_decoded_size_, traffic_stats_, traffic_endpoint_,
+                   request_size, callback);
+    if (data_stream_) {
+      transport_->SendRequest(method_, url_, headers, std::move(data_stream_),
+                              done_callback);
+      return;
+    }
+    transport_->SendRequest(method_, url_, headers, GetData(), done_callback);
+  }
+
+  // Counts the request and its response in |traffic_stats| as |endpoint|.
+  void SetTrafficStats(std::shared_ptr<TrafficStats> traffic_stats,
+                       const std::string& endpoint) {
+    traffic_stats_ = std::move(traffic_stats);
+    traffic_endpoint_ = endpoint;
   }
 
   void SetAccessToken(const std::string& access_token) {
     access_token_ = access_token;
   }
 
+  // Sends |headers|, which must outlive Send(), instead of the ones built
+  // from the access token, the data type and the encodings.
+  void SetHeadersReference(const HttpClient::Headers* headers) {
+    headers_reference_ = headers;
+  }
+
+  // Asks for a gzip or deflate encoded response and decodes it before it is
+  // passed to the callback. The decoded response fails if it's over
+  // |max_size| bytes, zero meaning no limit.
+  void AcceptCompressedResponse(size_t max_size) {
+    accept_compressed_response_ = true;
+    max_decoded_size_ = max_size;
+  }
+
+  // Sets the Content-Encoding of the data, which must be encoded already.
+  void SetContentEncoding(const std::string& encoding) {
+    content_encoding_ = encoding;
+  }
+
   void SetData(const std::string& data, const std::string& mime_type) {
     data_ = data;
+    data_reference_ = nullptr;
+    mime_type_ = mime_type;
+  }
+
+  // Same as SetData() but doesn't copy |data|, which must outlive Send().
+  void SetDataReference(const std::string* data, const std::string& mime_type) {
+    data_.clear();
+    data_reference_ = data;
+    mime_type_ = mime_type;
+  }
+
+  // Same as SetData() but the body of |size| bytes is read from |stream|.
+  void SetDataStream(std::unique_ptr<InputStream> stream,
+                     size_t size,
+                     const std::string& mime_type) {
+    data_.clear();
+    data_reference_ = nullptr;
+    data_stream_ = std::move(stream);
+    data_stream_size_ = size;
     mime_type_ = mime_type;
   }
 
@@ -167,43 +511,62 @@ class RequestSender final {
   }
 
  private:
+  const std::string& GetData() const {
+    return data_reference_ ? *data_reference_ : data_;
+  }
+
   HttpClient::Headers GetFullHeaders() const {
-    HttpClient::Headers headers;
-    if (!access_token_.empty())
-      headers.emplace_back(http::kAuthorization, "Bearer " + access_token_);
-    if (!mime_type_.empty())
-      headers.emplace_back(http::kContentType, mime_type_);
-    return headers;
+    return BuildRequestHeaders(access_token_, mime_type_, content_encoding_,
+                               accept_compressed_response_);
   }
 
   HttpClient::Method method_;
   std::string url_;
   std::string data_;
+  const std::string* data_reference_{nullptr};
+  std::unique_ptr<InputStream> data_stream_;
+  size_t data_stream_size_{0};
   std::string mime_type_;
+  std::string content_encoding_;
   std::string access_token_;
+  const HttpClient::Headers* headers_reference_{nullptr};
+  bool accept_compressed_response_{false};
+  size_t max_decoded_size_{0};
   HttpClient* transport_{nullptr};
+  std::shared_ptr<TrafficStats> traffic_stats_;
+  std::string traffic_endpoint_;
 
   DISALLOW_COPY_AND_ASSIGN(RequestSender);
 };
 
-std::unique_ptr<base::DictionaryValue> ParseJsonResponse(
-    const HttpClient::Response& response,
-    ErrorPtr* error) {
+bool CheckJsonContentType(const HttpClient::Response& response,
+                          ErrorPtr* error) {
   // Make sure we have a correct content type. Do not try to parse
   // binary files, or HTML output. Limit to application/json and text/plain.
-  std::string content_type =
-      SplitAtFirst(response.GetContentType(), ";", true).first;
+  std::string content_type_header = response.GetContentType();
+  base::StringPiece content_type =
+      SplitPieceAtFirst(content_type_header, ";", true).first;
 
   if (content_type != http::kJson && content_type != http::kPlain) {
     return Error::AddTo(
         error, FROM_HERE, "non_json_content_type",
-        "Unexpected content type: \'" + response.GetContentType() + "\'");
+        "Unexpected content type: \'" + content_type_header + "\'");
   }
+  return true;
+}
+
+std::unique_ptr<base::DictionaryValue> ParseJsonResponse(
+    const HttpClient::Response& response,
+    const InputLimits& limits,
+    ErrorPtr* error) {
+  if (!CheckJsonContentType(response, error))
+    return nullptr;
 
   const std::string& json = response.GetData();
   std::string error_message;
-  auto value = base::JSONReader::ReadAndReturnError(json, base::JSON_PARSE_RFC,
-                                                    nullptr, &error_message);
+  auto value = base::JSONReader::ReadWithLimits(
+      json, base::JSON_PARSE_RFC, GetJsonReaderLimits(limits), nullptr,
+      &error_message);
   if (!value) {
     Error::AddToPrintf(error, FROM_HERE, errors::json::kParseError,
                        "Error '%s' occurred parsing JSON string '%s'",
@@ -232,13 +595,29 @@ DeviceRegistrationInfo::DeviceRegistrationInfo(
     provider::TaskRunner* task_runner,
     provider::HttpClient* http_client,
     provider::Network* network,
-    privet::AuthManager* auth_manager)
+    privet::AuthManager* auth_manager,
+    Metrics* metrics,
+    RequestSlots* shared_request_slots,
+    RetryBudget* shared_retry_budget,
+    provider::WorkerPool* worker_pool,
+    base::Clock* clock)
     : http_client_{http_client},
       task_runner_{task_runner},
+      worker_pool_{worker_pool},
       config_{config},
       component_manager_{component_manager},
+      own_retry_budget_{kMaxRetriesPerMinute, base::TimeDelta::FromMinutes(1)},
+      retry_budget_{shared_retry_budget ? shared_retry_budget
+                                        : &own_retry_budget_},
+      request_slots_{shared_request_slots},
       network_{network},
-      auth_manager_{auth_manager} {
+      auth_manager_{auth_manager},
+      metrics_{metrics} {
+  if (!request_slots_) {
+    own_request_slots_.reset(
+        new RequestSlots{task_runner, kMaxCloudRequestsInFlight});
+    request_slots_ = own_request_slots_.get();
+  }
   cloud_backoff_policy_.reset(new BackoffEntry::Policy{});
   cloud_backoff_policy_->num_errors_to_ignore = 0;
   cloud_backoff_policy_->initial_delay_ms = 1000;
@@ -247,8 +626,21 @@ DeviceRegistrationInfo::DeviceRegistrationInfo(
   cloud_backoff_policy_->maximum_backoff_ms = 30000;
   cloud_backoff_policy_->entry_lifetime_ms = -1;
   cloud_backoff_policy_->always_use_initial_delay = false;
-  cloud_backoff_entry_.reset(new BackoffEntry{cloud_backoff_policy_.get()});
-  oauth2_backoff_entry_.reset(new BackoffEntry{cloud_backoff_policy_.get()});
+  cloud_backoff_policy_->use_decorrelated_jitter = true;
+  cloud_backoff_entry_.reset(
+      new BackoffEntry{cloud_backoff_policy_.get(), clock});
+  cloud_backoff_entry_->SetRetryBudget(retry_budget_);
+  oauth2_backoff_entry_.reset(
+      new BackoffEntry{cloud_backoff_policy_.get(), clock});
+  oauth2_backoff_entry_->SetRetryBudget(retry_budget_);
+  command_update_backoff_entry_ =
+      std::make_shared<BackoffEntry>(cloud_backoff_policy_.get(), clock);
+  command_update_backoff_entry_->SetRetryBudget(retry_budget_);
+
+  SetStatePublishLimits(
+      {base::TimeDelta::FromMilliseconds(kStatePublishMinIntervalMs),
+       base::TimeDelta::FromMilliseconds(kStatePublishMaxIntervalMs),
+       kStatePublishMaxBatchSize, kStatePublishMaxRequestsInFlight});
 
   bool revoked =
       !GetSettings().cloud_id.empty() && !HaveRegistrationCredentials();
@@ -264,7 +656,13 @@ DeviceRegistrationInfo::DeviceRegistrationInfo(
       &DeviceRegistrationInfo::OnStateChanged, weak_factory_.GetWeakPtr()));
 }
 
-DeviceRegistrationInfo::~DeviceRegistrationInfo() = default;
+DeviceRegistrationInfo::~DeviceRegistrationInfo() {
+  // The responses of the requests in flight are dropped, so their slots are
+  // free for the other devices.
+  request_slots_->RemoveClient(this);
+  for (; cloud_requests_in_flight_ > 0; --cloud_requests_in_flight_)
+    request_slots_->Release();
+}
 
 std::string DeviceRegistrationInfo::GetServiceUrl(
     const std::string& subpath,
@@ -275,9 +673,22 @@ std::string DeviceRegistrationInfo::GetServiceUrl(
 std::string DeviceRegistrationInfo::GetDeviceUrl(
     const std::string& subpath,
     const WebParamList& params) const {
-  CHECK(!GetSettings().cloud_id.empty()) << "Must have a valid device ID";
-  return GetServiceUrl("devices/" + GetSettings().cloud_id + "/" + subpath,
-                       params);
+  const Config::Settings& settings = GetSettings();
+  CHECK(!settings.cloud_id.empty()) << "Must have a valid device ID";
+  if (device_url_prefix_.prefix.empty() ||
+      device_url_prefix_.service_url != settings.service_url ||
+      device_url_prefix_.cloud_id != settings.cloud_id) {
+    device_url_prefix_.service_url = settings.service_url;
+    device_url_prefix_.cloud_id = settings.cloud_id;
+    device_url_prefix_.prefix = BuildUrl(
+        settings.service_url, "devices/" + settings.cloud_id + "/", {});
+  }
+  std::string url;
+  url.reserve(device_url_prefix_.prefix.size() + subpath.size());
+  url = device_url_prefix_.prefix;
+  url += subpath;
+  AppendQueryParams(&url, params);
+  return url;
 }
 
 std::string DeviceRegistrationInfo::GetOAuthUrl(
@@ -310,6 +721,19 @@ void DeviceRegistrationInfo::ScheduleCloudConnection(
       delay);
 }
 
+void DeviceRegistrationInfo::PostDeferrableTask(
+    const tracked_objects::Location& from_here,
+    const base::Closure& task,
+    base::TimeDelta delay,
+    base::TimeDelta slack) {
+  if (wake_scheduler_) {
+    wake_scheduler_->Schedule(from_here, delay, slack,
+                              provider::TaskRunner::Priority::kNormal, task);
+  } else {
+    task_runner_->PostDelayedTask(from_here, task, delay);
+  }
+}
+
 bool DeviceRegistrationInfo::HaveRegistrationCredentials() const {
   return !GetSettings().refresh_token.empty() &&
          !GetSettings().cloud_id.empty() &&
@@ -333,7 +757,7 @@ std::unique_ptr<base::DictionaryValue>
 DeviceRegistrationInfo::ParseOAuthResponse(const HttpClient::Response& response,
                                            ErrorPtr* error) {
   int code = response.GetStatusCode();
-  auto resp = ParseJsonResponse(response, error);
+  auto resp = ParseJsonResponse(response, input_limits_, error);
   if (resp && code >= http::kBadRequest) {
     std::string error_code, error_message;
     if (!resp->GetString("error", &error_code)) {
@@ -353,25 +777,38 @@ DeviceRegistrationInfo::ParseOAuthResponse(const HttpClient::Response& response,
 }
 
 void DeviceRegistrationInfo::RefreshAccessToken(const DoneCallback& callback) {
+  access_token_refresh_callbacks_.push_back(callback);
+  if (access_token_refresh_callbacks_.size() > 1) {
+    VLOG(1) << "Waiting for the access token refresh in progress";
+    return;
+  }
+  SendRefreshAccessTokenRequest();
+}
+
+void DeviceRegistrationInfo::SendRefreshAccessTokenRequest() {
   LOG(INFO) << "Refreshing access token.";
 
   ErrorPtr error;
   if (!VerifyRegistrationCredentials(&error))
-    return callback.Run(std::move(error));
+    return OnRefreshAccessTokenFinished(std::move(error));
 
   if (oauth2_backoff_entry_->ShouldRejectRequest()) {
     VLOG(1) << "RefreshToken request delayed for "
             << oauth2_backoff_entry_->GetTimeUntilRelease()
             << " due to backoff policy";
-    task_runner_->PostDelayedTask(
-        FROM_HERE, base::Bind(&DeviceRegistrationInfo::RefreshAccessToken,
-                              AsWeakPtr(), callback),
-        oauth2_backoff_entry_->GetTimeUntilRelease());
+    base::TimeDelta delay = oauth2_backoff_entry_->GetTimeUntilRelease();
+    PostDeferrableTask(
+        FROM_HERE,
+        base::Bind(&DeviceRegistrationInfo::SendRefreshAccessTokenRequest,
+                   AsWeakPtr()),
+        delay, base::TimeDelta::FromMicroseconds(delay.InMicroseconds() *
+                                                 kRetryTolerance));
     return;
   }
 
   RequestSender sender{HttpClient::Method::kPost, GetOAuthUrl("token"),
                        http_client_};
+  sender.SetTrafficStats(traffic_stats_, kOAuthTokenEndpoint);
   sender.SetFormData({
       {"refresh_token", GetSettings().refresh_token},
       {"client_id", GetSettings().client_id},
@@ -379,24 +816,23 @@ void DeviceRegistrationInfo::RefreshAccessToken(const DoneCallback& callback) {
       {"grant_type", "refresh_token"},
   });
   sender.Send(base::Bind(&DeviceRegistrationInfo::OnRefreshAccessTokenDone,
-                         weak_factory_.GetWeakPtr(), callback));
+                         weak_factory_.GetWeakPtr()));
   VLOG(1) << "Refresh access token request dispatched";
 }
 
 void DeviceRegistrationInfo::OnRefreshAccessTokenDone(
-    const DoneCallback& callback,
     std::unique_ptr<HttpClient::Response> response,
     ErrorPtr error) {
   if (error) {
     VLOG(1) << "Refresh access token failed";
     oauth2_backoff_entry_->InformOfRequest(false);
-    return RefreshAccessToken(callback);
+    return SendRefreshAccessTokenRequest();
   }
   VLOG(1) << "Refresh access token request completed";
   oauth2_backoff_entry_->InformOfRequest(true);
   auto json = ParseOAuthResponse(*response, &error);
   if (!json)
-    return callback.Run(std::move(error));
+    return OnRefreshAccessTokenFinished(std::move(error));
 
   int expires_in = 0;
   if (!json->GetString("access_token", &access_token_) ||
@@ -405,10 +841,9 @@ void DeviceRegistrationInfo::OnRefreshAccessTokenDone(
     LOG(ERROR) << "Access token unavailable.";
     Error::AddTo(&error, FROM_HERE, "unexpected_server_response",
                  "Access token unavailable");
-    return callback.Run(std::move(error));
+    return OnRefreshAccessTokenFinished(std::move(error));
   }
-  access_token_expiration_ =
-      base::Time::Now() + base::TimeDelta::FromSeconds(expires_in);
+  SetAccessTokenExpiration(base::TimeDelta::FromSeconds(expires_in));
   LOG(INFO) << "Access token is refreshed for additional " << expires_in
             << " seconds.";
 
@@ -426,7 +861,43 @@ void DeviceRegistrationInfo::OnRefreshAccessTokenDone(
     SendAuthInfo();
   }
 
-  callback.Run(nullptr);
+  OnRefreshAccessTokenFinished(nullptr);
+}
+
+void DeviceRegistrationInfo::OnRefreshAccessTokenFinished(ErrorPtr error) {
+  std::vector<DoneCallback> callbacks;
+  std::swap(callbacks, access_token_refresh_callbacks_);
+  for (size_t i = 0; i + 1 < callbacks.size(); ++i)
+    callbacks[i].Run(error ? error->Clone() : nullptr);
+  callbacks.back().Run(std::move(error));
+}
+
+void DeviceRegistrationInfo::SetAccessTokenExpiration(
+    base::TimeDelta expires_in) {
+  access_token_expiration_ = base::Time::Now() + expires_in;
+  // Leave time for the refresh to complete, but don't refresh short lived
+  // tokens too often.
+  base::TimeDelta margin =
+      base::TimeDelta::FromSeconds(kAccessTokenRefreshMarginSeconds);
+  base::TimeDelta delay = std::max(expires_in - margin, expires_in / 2);
+  // Up to half of the time left before the expiration may be spent waiting
+  // for other network activity.
+  PostDeferrableTask(
+      FROM_HERE, base::Bind(&DeviceRegistrationInfo::OnAccessTokenAboutToExpire,
+                            AsWeakPtr(), access_token_expiration_),
+      delay, (expires_in - delay) / 2);
+}
+
+void DeviceRegistrationInfo::OnAccessTokenAboutToExpire(
+    base::Time expiration) {
+  // Skip if the token has been refreshed already, or credentials are gone.
+  if (expiration != access_token_expiration_ ||
+      !VerifyRegistrationCredentials(nullptr)) {
+    return;
+  }
+  // Requests keep using the current token until the new one arrives.
+  RefreshAccessToken(
+      base::Bind(&DeviceRegistrationInfo::CheckAccessTokenError, AsWeakPtr()));
 }
 
 void DeviceRegistrationInfo::StartNotificationChannel() {
@@ -450,13 +921,22 @@ void DeviceRegistrationInfo::StartNotificationChannel() {
   // Start with just regular polling at the pre-configured polling interval.
   // Once the primary notification channel is connected successfully, it will
   // call back to OnConnected() and at that time we'll switch to use the
-  // primary channel and turn off the periodic polling.
+  // primary channel and slow the periodic polling down. Polling is turned off
+  // in OnConnectionConfirmed(), once the primary channel has proven to work.
   StartPullChannel();
 
   notification_channel_starting_ = true;
-  primary_notification_channel_.reset(
+  XmppChannel* xmpp_channel =
       new XmppChannel{GetSettings().robot_account, access_token_,
-                      GetSettings().xmpp_endpoint, task_runner_, network_});
+                      GetSettings().xmpp_endpoint, task_runner_, network_,
+                      metrics_, traffic_stats_.get()};
+  xmpp_channel->SetWakeWindowScheduler(wake_scheduler_);
+  xmpp_channel->SetInputLimits(input_limits_);
+  xmpp_channel->EnableAdaptiveKeepAlive(
+      GetSettings().xmpp_keepalive_interval,
+      base::Bind(&DeviceRegistrationInfo::OnXmppKeepAliveChanged,
+                 weak_factory_.GetWeakPtr()));
+  primary_notification_channel_.reset(xmpp_channel);
   primary_notification_channel_->Start(this);
 }
 
@@ -465,6 +945,9 @@ void DeviceRegistrationInfo::StartPullChannel() {
       base::TimeDelta::FromSeconds(kPollingPeriodSeconds);
   if (!pull_channel_) {
     pull_channel_.reset(new PullChannel{pull_interval, task_runner_});
+    pull_channel_->SetWakeWindowScheduler(wake_scheduler_);
+    pull_channel_->SetMaxPullInterval(
+        base::TimeDelta::FromSeconds(kMaxPollingPeriodSeconds));
     pull_channel_->Start(this);
   } else {
     pull_channel_->UpdatePullInterval(pull_interval);
@@ -473,9 +956,12 @@ void DeviceRegistrationInfo::StartPullChannel() {
 }
 
 void DeviceRegistrationInfo::StopPullChannel() {
+  if (!pull_channel_)
+    return;
+  if (current_notification_channel_ == pull_channel_.get())
+    current_notification_channel_ = nullptr;
   pull_channel_->Stop();
   pull_channel_.reset();
-  current_notification_channel_ = nullptr;
 }
 
 void DeviceRegistrationInfo::AddGcdStateChangedCallback(
@@ -485,11 +971,11 @@ void DeviceRegistrationInfo::AddGcdStateChangedCallback(
 }
 
 std::unique_ptr<base::DictionaryValue>
-DeviceRegistrationInfo::BuildDeviceResource() const {
-  std::unique_ptr<base::DictionaryValue> resource{new base::DictionaryValue};
+DeviceRegistrationInfo::BuildDeviceResourceHeader() const {
+  std::unique_ptr<base::DictionaryValue> header{new base::DictionaryValue};
   if (!GetSettings().cloud_id.empty())
-    resource->SetString("id", GetSettings().cloud_id);
-  resource->SetString("modelManifestId", GetSettings().model_id);
+    header->SetString("id", GetSettings().cloud_id);
+  header->SetString("modelManifestId", GetSettings().model_id);
   std::unique_ptr<base::DictionaryValue> channel{new base::DictionaryValue};
   if (current_notification_channel_) {
     channel->SetString("supportedType",
@@ -498,12 +984,189 @@ DeviceRegistrationInfo::BuildDeviceResource() const {
   } else {
     channel->SetString("supportedType", "pull");
   }
-  resource->Set("channel", std::move(channel));
-  resource->Set("traits", component_manager_->GetTraits().CreateDeepCopy());
-  resource->Set("components",
-                component_manager_->GetComponents().CreateDeepCopy());
+  header->Set("channel", std::move(channel));
+  return header;
+}
+
+void DeviceRegistrationInfo::WriteDeviceResource(
+    JsonStreamWriter* writer,
+    bool trait_reference,
+    const std::string& components_json) const {
+  writer->BeginDictionary();
+  auto header = BuildDeviceResourceHeader();
+  for (base::DictionaryValue::Iterator it(*header); !it.IsAtEnd();
+       it.Advance()) {
+    writer->WriteKey(it.key());
+    writer->WriteValue(it.value());
+  }
+  if (trait_reference) {
+    UpdateTraitDigests();
+    writer->WriteKey(kTraitsFingerprint);
+    writer->WriteString(traits_fingerprint_);
+  }
+  // Traits and components are written in place, without a copy of the trees.
+  if (!trait_reference ||
+      traits_fingerprint_ != acknowledged_traits_fingerprint_) {
+    writer->WriteKey("traits");
+    writer->WriteJson(component_manager_->GetTraitsJson());
+  }
+  writer->WriteKey("components");
+  if (components_json.empty())
+    writer->WriteValue(component_manager_->GetComponents());
+  else
+    writer->WriteJson(components_json);
+  writer->EndDictionary();
+}
+
+DeviceRegistrationInfo::ResourceDigests
+DeviceRegistrationInfo::GetDeviceResourceDigests() const {
+  UpdateTraitDigests();
+  ResourceDigests digests = trait_digests_;
+  AddResourceDigests(kResourceHeaderSection, *BuildDeviceResourceHeader(),
+                     &digests);
+  AddResourceDigests(kResourceComponentsSection,
+                     component_manager_->GetComponents(), &digests);
+  return digests;
+}
+
+void DeviceRegistrationInfo::UpdateTraitDigests() const {
+  // Trait definitions rarely change, so their digests are only recomputed
+  // when the serialized traits differ from the ones last digested.
+  const std::string& traits_json = component_manager_->GetTraitsJson();
+  if (traits_json == digested_traits_json_ && !traits_fingerprint_.empty())
+    return;
+  trait_digests_.clear();
+  AddResourceDigests(kResourceTraitsSection, component_manager_->GetTraits(),
+                     &trait_digests_);
+  digested_traits_json_ = traits_json;
+  traits_fingerprint_ = Base64Encode(crypto::SHA256HashString(traits_json));
+}
+
+bool DeviceRegistrationInfo::WriteDeviceResourcePatch(
+    const ResourceDigests& digests,
+    JsonStreamWriter* writer) const {
+  auto is_changed = [this, &digests](const std::string& section) {
+    auto p = uploaded_resource_digests_.find(section);
+    auto c = digests.find(section);
+    return p == uploaded_resource_digests_.end() || c == digests.end() ||
+           p->second != c->second;
+  };
+  bool header = is_changed(kResourceHeaderSection);
+  bool traits = is_changed(kResourceTraitsSection);
+  bool components = is_changed(kResourceComponentsSection);
+  if (!header && !traits && !components)
+    return false;
+
+  writer->BeginDictionary();
+  if (header) {
+    WriteResourceMembersPatch(kResourceHeaderSection,
+                              *BuildDeviceResourceHeader(), digests,
+                              uploaded_resource_digests_, writer);
+  }
+  if (traits) {
+    writer->WriteKey(kResourceTraitsSection);
+    writer->BeginDictionary();
+    WriteResourceMembersPatch(kResourceTraitsSection,
+                              component_manager_->GetTraits(), digests,
+                              uploaded_resource_digests_, writer);
+    writer->EndDictionary();
+    UpdateTraitDigests();
+    writer->WriteKey(kTraitsFingerprint);
+    writer->WriteString(traits_fingerprint_);
+  }
+  if (components) {
+    writer->WriteKey(kResourceComponentsSection);
+    writer->BeginDictionary();
+    WriteResourceMembersPatch(kResourceComponentsSection,
+                              component_manager_->GetComponents(), digests,
+                              uploaded_resource_digests_, writer);
+    writer->EndDictionary();
+  }
+  writer->EndDictionary();
+  return true;
+}
+
+void DeviceRegistrationInfo::SetDeviceResourceDeltaUpdatesEnabled(
+    bool enabled) {
+  device_resource_delta_updates_enabled_ = enabled;
+  uploaded_resource_digests_.clear();
+}
+
+std::unique_ptr<base::DictionaryValue>
+DeviceRegistrationInfo::SaveResourceSnapshot() const {
+  bool have_digests = !uploaded_resource_digests_.empty() &&
+                      !GetSettings().device_resource_timestamp.empty();
+  if (!have_digests && acknowledged_traits_fingerprint_.empty())
+    return nullptr;
+  std::unique_ptr<base::DictionaryValue> snapshot{new base::DictionaryValue};
+  snapshot->SetString("cloudId", GetSettings().cloud_id);
+  if (!acknowledged_traits_fingerprint_.empty())
+    snapshot->SetString(kTraitsFingerprint, acknowledged_traits_fingerprint_);
+  if (!have_digests)
+    return snapshot;
+  snapshot->SetString("lastUpdateTimeMs",
+                      GetSettings().device_resource_timestamp);
+  std::unique_ptr<base::DictionaryValue> digests{new base::DictionaryValue};
+  for (const auto& digest : uploaded_resource_digests_) {
+    digests->SetStringWithoutPathExpansion(digest.first,
+                                           Base64Encode(digest.second));
+  }
+  snapshot->Set("digests", std::move(digests));
+  return snapshot;
+}
+
+void DeviceRegistrationInfo::RestoreResourceSnapshot(
+    const base::DictionaryValue& snapshot) {
+  std::string cloud_id;
+  std::string timestamp;
+  const base::DictionaryValue* digests = nullptr;
+  if (!snapshot.GetString("cloudId", &cloud_id) ||
+      cloud_id != GetSettings().cloud_id || cloud_id.empty()) {
+    return;
+  }
+  // The server keeps the traits of the fingerprint regardless of later
+  // changes of the resource.
+  snapshot.GetString(kTraitsFingerprint, &acknowledged_traits_fingerprint_);
+  if (!device_resource_delta_updates_enabled_ ||
+      !snapshot.GetString("lastUpdateTimeMs", &timestamp) ||
+      !snapshot.GetDictionary("digests", &digests)) {
+    return;
+  }
+  ResourceDigests restored;
+  for (base::DictionaryValue::Iterator it(*digests); !it.IsAtEnd();
+       it.Advance()) {
+    std::string value;
+    std::string& digest = restored[it.key()];
+    // Digests of older versions are not SHA-256 ones.
+    if (!it.value().GetAsString(&value) || !Base64Decode(value, &digest) ||
+        digest.size() != crypto::kSHA256Length) {
+      return;
+    }
+  }
+  // If the resource was changed on the server since then, the server rejects
+  // the timestamp and the next update is a full one.
+  SetDeviceResourceTimestamp(timestamp);
+  uploaded_resource_digests_ = std::move(restored);
+}
 
-  return resource;
+void DeviceRegistrationInfo::AddResourceUploadedCallback(
+    const base::Closure& callback) {
+  resource_uploaded_callbacks_.push_back(callback);
+}
+
+void DeviceRegistrationInfo::EnableStateSpool(
+    provider::ConfigStore* config_store,
+    const StateSpoolPolicy& policy) {
+  state_spool_.reset(new StateSpool{config_store, policy});
+}
+
+void DeviceRegistrationInfo::SetWakeWindowScheduler(
+    WakeWindowScheduler* scheduler) {
+  wake_scheduler_ = scheduler;
+}
+
+void DeviceRegistrationInfo::SetInputLimits(const InputLimits& limits) {
+  input_limits_ = limits;
 }
 
 void DeviceRegistrationInfo::GetDeviceInfo(
@@ -511,7 +1174,8 @@ void DeviceRegistrationInfo::GetDeviceInfo(
   ErrorPtr error;
   if (!VerifyRegistrationCredentials(&error))
     return callback.Run({}, std::move(error));
-  DoCloudRequest(HttpClient::Method::kGet, GetDeviceUrl(), nullptr, callback);
+  DoCloudRequest(CloudRequestPriority::kResource, HttpClient::Method::kGet,
+                 GetDeviceUrl(), nullptr, callback);
 }
 
 void DeviceRegistrationInfo::RegisterDeviceError(const DoneCallback& callback,
@@ -568,20 +1232,40 @@ void DeviceRegistrationInfo::RegisterDevice(RegistrationData registration_data,
     return RegisterDeviceError(callback, std::move(error));
   }
 
-  std::unique_ptr<base::DictionaryValue> device_draft = BuildDeviceResource();
-  CHECK(device_draft);
-
-  base::DictionaryValue req_json;
-  req_json.SetString("id", registration_data.ticket_id);
-  req_json.SetString("oauthClientId", registration_data.client_id);
-  req_json.Set("deviceDraft", std::move(device_draft));
+  // The draft carries the current state, so the state changes recorded so far
+  // are uploaded with it, instead of a patchState request after the
+  // registration.
+  registration_state_update_id_ =
+      component_manager_->GetAndClearRecordedStateChanges().update_id;
+
+  std::string body;
+  {
+    JsonStreamWriter writer{&body};
+    writer.BeginDictionary();
+    writer.WriteKey("id");
+    writer.WriteString(registration_data.ticket_id);
+    writer.WriteKey("oauthClientId");
+    writer.WriteString(registration_data.client_id);
+    writer.WriteKey("deviceDraft");
+    WriteDeviceResource(&writer);
+    writer.EndDictionary();
+  }
+  // The device is created from the draft, so the connection after the
+  // registration only has to upload the changes made since this point.
+  registration_resource_digests_.clear();
+  if (device_resource_delta_updates_enabled_)
+    registration_resource_digests_ = GetDeviceResourceDigests();
 
   auto url = BuildUrl(registration_data.service_url,
                       "registrationTickets/" + registration_data.ticket_id,
                       {{"key", registration_data.api_key}});
 
   RequestSender sender{HttpClient::Method::kPatch, url, http_client_};
-  sender.SetJsonData(req_json);
+  sender.SetDataReference(&body, http::kJsonUtf8);
+  sender.SetTrafficStats(
+      traffic_stats_,
+      GetCloudRequestLabel(HttpClient::Method::kPatch,
+                           registration_data.service_url, url));
   sender.Send(base::Bind(&DeviceRegistrationInfo::RegisterDeviceOnTicketSent,
                          weak_factory_.GetWeakPtr(), registration_data,
                          callback));
@@ -594,7 +1278,7 @@ void DeviceRegistrationInfo::RegisterDeviceOnTicketSent(
     ErrorPtr error) {
   if (error)
     return RegisterDeviceError(callback, std::move(error));
-  auto json_resp = ParseJsonResponse(*response, &error);
+  auto json_resp = ParseJsonResponse(*response, input_limits_, &error);
   if (!json_resp)
     return RegisterDeviceError(callback, std::move(error));
 
@@ -607,7 +1291,11 @@ void DeviceRegistrationInfo::RegisterDeviceOnTicketSent(
       registration_data.service_url,
       "registrationTickets/" + registration_data.ticket_id + "/finalize",
       {{"key", registration_data.api_key}});
-  RequestSender{HttpClient::Method::kPost, url, http_client_}.Send(
+  RequestSender sender{HttpClient::Method::kPost, url, http_client_};
+  sender.SetTrafficStats(
+      traffic_stats_, GetCloudRequestLabel(HttpClient::Method::kPost,
+                                           registration_data.service_url, url));
+  sender.Send(
       base::Bind(&DeviceRegistrationInfo::RegisterDeviceOnTicketFinalized,
                  weak_factory_.GetWeakPtr(), registration_data, callback));
 }
@@ -619,7 +1307,7 @@ void DeviceRegistrationInfo::RegisterDeviceOnTicketFinalized(
     ErrorPtr error) {
   if (error)
     return RegisterDeviceError(callback, std::move(error));
-  auto json_resp = ParseJsonResponse(*response, &error);
+  auto json_resp = ParseJsonResponse(*response, input_limits_, &error);
   if (!json_resp)
     return RegisterDeviceError(callback, std::move(error));
   if (!IsSuccessful(*response)) {
@@ -646,6 +1334,7 @@ void DeviceRegistrationInfo::RegisterDeviceOnTicketFinalized(
   RequestSender sender2{HttpClient::Method::kPost,
                         BuildUrl(registration_data.oauth_url, "token", {}),
                         http_client_};
+  sender2.SetTrafficStats(traffic_stats_, kOAuthTokenEndpoint);
   sender2.SetFormData({{"code", auth_code},
                        {"client_id", registration_data.client_id},
                        {"client_secret", registration_data.client_secret},
@@ -677,8 +1366,7 @@ void DeviceRegistrationInfo::RegisterDeviceOnAuthCodeSent(
     return RegisterDeviceError(callback, std::move(error));
   }
 
-  access_token_expiration_ =
-      base::Time::Now() + base::TimeDelta::FromSeconds(expires_in);
+  SetAccessTokenExpiration(base::TimeDelta::FromSeconds(expires_in));
 
   Config::Transaction change{config_};
 
@@ -695,6 +1383,36 @@ void DeviceRegistrationInfo::RegisterDeviceOnAuthCodeSent(
 
   change.Commit();
 
+  component_manager_->NotifyStateUpdatedOnServer(registration_state_update_id_);
+  // The traits of an earlier registration are kept with that device.
+  acknowledged_traits_fingerprint_.clear();
+  if (!registration_resource_digests_.empty()) {
+    // The header of the draft had no ID, which the server assigned and is
+    // known now, so it's taken as uploaded too.
+    uploaded_resource_digests_ = std::move(registration_resource_digests_);
+    registration_resource_digests_.clear();
+    std::string prefix = std::string{kResourceHeaderSection} + '/';
+    auto is_header = [&prefix](const std::string& path) {
+      return path == kResourceHeaderSection ||
+             path.compare(0, prefix.size(), prefix) == 0;
+    };
+    for (auto it = uploaded_resource_digests_.begin();
+         it != uploaded_resource_digests_.end();) {
+      if (is_header(it->first))
+        it = uploaded_resource_digests_.erase(it);
+      else
+        ++it;
+    }
+    for (const auto& digest : GetDeviceResourceDigests()) {
+      if (is_header(digest.first))
+        uploaded_resource_digests_[digest.first] = digest.second;
+    }
+  }
+
+  // Changes spooled for an earlier registration don't belong to this one.
+  if (state_spool_)
+    state_spool_->Clear();
+
   task_runner_->PostDelayedTask(FROM_HERE, base::Bind(callback, nullptr), {});
 
   StartNotificationChannel();
@@ -706,6 +1424,7 @@ void DeviceRegistrationInfo::RegisterDeviceOnAuthCodeSent(
 }
 
 void DeviceRegistrationInfo::DoCloudRequest(
+    CloudRequestPriority priority,
     HttpClient::Method method,
     const std::string& url,
     const base::DictionaryValue* body,
@@ -714,13 +1433,163 @@ void DeviceRegistrationInfo::DoCloudRequest(
   // there is only one instance of callback and error_calback since
   // those may have move-only types and making a copy of the callback with
   // move-only types curried-in will invalidate the source callback.
+  std::string json;
+  if (body)
+    base::JSONWriter::Write(*body, &json);
+  DoCloudRequest(priority, method, url, std::move(json), callback);
+}
+
+void DeviceRegistrationInfo::DoCloudRequest(
+    CloudRequestPriority priority,
+    HttpClient::Method method,
+    const std::string& url,
+    std::string body,
+    const CloudRequestDoneCallback& callback) {
   auto data = std::make_shared<CloudRequestData>();
+  if (method == HttpClient::Method::kGet) {
+    auto& callbacks = cloud_get_callbacks_[url];
+    callbacks.push_back(callback);
+    if (callbacks.size() > 1) {
+      VLOG(1) << "Joining cloud request in progress: " << url;
+      return;
+    }
+  } else {
+    data->callback = callback;
+  }
   data->method = method;
   data->url = url;
-  if (body)
-    base::JSONWriter::Write(*body, &data->body);
-  data->callback = callback;
-  SendCloudRequest(data);
+  data->body = std::move(body);
+  QueueCloudRequest(priority, data);
+}
+
+void DeviceRegistrationInfo::DoStreamedCloudRequest(
+    CloudRequestPriority priority,
+    HttpClient::Method method,
+    const std::string& url,
+    std::string body,
+    const CloudStreamDoneCallback& callback) {
+  auto data = std::make_shared<CloudRequestData>();
+  data->method = method;
+  data->url = url;
+  data->body = std::move(body);
+  data->stream_callback = callback;
+  QueueCloudRequest(priority, data);
+}
+
+void DeviceRegistrationInfo::QueueCloudRequest(
+    CloudRequestPriority priority,
+    const std::shared_ptr<CloudRequestData>& data) {
+  if (kMetricsEnabled && metrics_)
+    data->start_time = base::TimeTicks::Now();
+  data->label =
+      GetCloudRequestLabel(data->method, GetSettings().service_url, data->url);
+
+  // Compress once here, so retries send the same data.
+  if (config_->GetSettings().cloud_compression_enabled &&
+      data->body.size() >= kMinCompressedBodySize) {
+    std::string compressed;
+    if (GzipEncode(data->body, &compressed) &&
+        compressed.size() < data->body.size()) {
+      data->body = std::move(compressed);
+      data->content_encoding = http::kGzip;
+    }
+  }
+  cloud_request_queues_[priority].push_back(data);
+  SendQueuedCloudRequests();
+}
+
+void DeviceRegistrationInfo::SendQueuedCloudRequests() {
+  if (cloud_offline_)
+    return;
+  for (auto& pair : cloud_request_queues_) {
+    auto& queue = pair.second;
+    while (!queue.empty() && request_slots_->Acquire(this)) {
+      auto data = queue.front();
+      queue.pop_front();
+      ++cloud_requests_in_flight_;
+      SendCloudRequest(data);
+    }
+  }
+}
+
+void DeviceRegistrationInfo::OnRequestSlotAvailable() {
+  SendQueuedCloudRequests();
+}
+
+void DeviceRegistrationInfo::ReleaseCloudRequest(const CloudRequestData& data,
+                                                 bool failed) {
+  CHECK_GT(cloud_requests_in_flight_, 0u);
+  --cloud_requests_in_flight_;
+  request_slots_->Release();
+  // The request wasn't retried, so it got through or failed for good.
+  cloud_failures_ = 0;
+  if (cloud_offline_ && &data == cloud_probe_.get())
+    SetCloudOnline();
+  if (kMetricsEnabled && metrics_) {
+    // Includes the time the request was queued and retried.
+    metrics_->RecordLatency("cloud_request " + data.label,
+                            base::TimeTicks::Now() - data.start_time);
+    if (failed)
+      metrics_->IncrementCounter("cloud_request_error " + data.label);
+  }
+}
+
+void DeviceRegistrationInfo::FinishCloudRequest(
+    const std::shared_ptr<const CloudRequestData>& data,
+    const base::DictionaryValue& response,
+    ErrorPtr error) {
+  ReleaseCloudRequest(*data, error != nullptr);
+  // Dispatch here instead of wrapping the callback of every request into more
+  // bound callbacks.
+  if (!data->stream_callback.is_null()) {
+    // Errors and responses with no body, the others are read in
+    // FinishStreamedCloudRequest().
+    JsonStreamReader reader{"{}"};
+    data->stream_callback.Run(error ? nullptr : &reader, std::move(error));
+  } else if (data->method == HttpClient::Method::kGet) {
+    OnCloudGetRequestDone(data->url, response, std::move(error));
+  } else {
+    data->callback.Run(response, std::move(error));
+  }
+  SendQueuedCloudRequests();
+}
+
+void DeviceRegistrationInfo::FinishStreamedCloudRequest(
+    const std::shared_ptr<const CloudRequestData>& data,
+    const HttpClient::Response& response) {
+  ReleaseCloudRequest(*data, false);
+  JsonStreamReader reader{response.GetData()};
+  data->stream_callback.Run(&reader, nullptr);
+  SendQueuedCloudRequests();
+}
+
+void DeviceRegistrationInfo::OnCloudGetRequestDone(
+    const std::string& url,
+    const base::DictionaryValue& response,
+    ErrorPtr error) {
+  auto it = cloud_get_callbacks_.find(url);
+  CHECK(it != cloud_get_callbacks_.end());
+  std::vector<CloudRequestDoneCallback> callbacks = std::move(it->second);
+  cloud_get_callbacks_.erase(it);
+  for (size_t i = 0; i + 1 < callbacks.size(); ++i)
+    callbacks[i].Run(response, error ? error->Clone() : nullptr);
+  callbacks.back().Run(response, std::move(error));
+}
+
+const HttpClient::Headers& DeviceRegistrationInfo::GetCloudRequestHeaders(
+    bool gzip_body) {
+  bool accept_compressed = GetSettings().cloud_compression_enabled;
+  CloudRequestHeaders& cache = cloud_request_headers_;
+  if (cache.plain.empty() || cache.access_token != access_token_ ||
+      cache.accept_compressed != accept_compressed) {
+    cache.access_token = access_token_;
+    cache.accept_compressed = accept_compressed;
+    cache.plain = BuildRequestHeaders(access_token_, http::kJsonUtf8, {},
+                                      accept_compressed);
+    cache.gzip = BuildRequestHeaders(access_token_, http::kJsonUtf8,
+                                     http::kGzip, accept_compressed);
+  }
+  return gzip_body ? cache.gzip : cache.plain;
 }
 
 void DeviceRegistrationInfo::SendCloudRequest(
@@ -731,21 +1600,34 @@ void DeviceRegistrationInfo::SendCloudRequest(
 
   ErrorPtr error;
   if (!VerifyRegistrationCredentials(&error))
-    return data->callback.Run({}, std::move(error));
+    return FinishCloudRequest(data, {}, std::move(error));
 
   if (cloud_backoff_entry_->ShouldRejectRequest()) {
     VLOG(1) << "Cloud request delayed for "
             << cloud_backoff_entry_->GetTimeUntilRelease()
             << " due to backoff policy";
-    return task_runner_->PostDelayedTask(
+    base::TimeDelta delay = cloud_backoff_entry_->GetTimeUntilRelease();
+    return PostDeferrableTask(
         FROM_HERE, base::Bind(&DeviceRegistrationInfo::SendCloudRequest,
                               AsWeakPtr(), data),
-        cloud_backoff_entry_->GetTimeUntilRelease());
+        delay, base::TimeDelta::FromMicroseconds(delay.InMicroseconds() *
+                                                 kRetryTolerance));
   }
 
   RequestSender sender{data->method, data->url, http_client_};
-  sender.SetData(data->body, http::kJsonUtf8);
-  sender.SetAccessToken(access_token_);
+  sender.SetTrafficStats(traffic_stats_, data->label);
+  if (data->blob) {
+    sender.SetDataStream(std::unique_ptr<InputStream>{new SharedBufferStream{
+                             data->blob, task_runner_}},
+                         data->blob->size(), data->blob_content_type);
+    sender.SetAccessToken(access_token_);
+  } else {
+    sender.SetDataReference(&data->body, http::kJsonUtf8);
+    sender.SetHeadersReference(
+        &GetCloudRequestHeaders(!data->content_encoding.empty()));
+  }
+  if (config_->GetSettings().cloud_compression_enabled)
+    sender.AcceptCompressedResponse(input_limits_.max_size);
   sender.Send(base::Bind(&DeviceRegistrationInfo::OnCloudRequestDone,
                          AsWeakPtr(), data));
 }
@@ -768,7 +1650,7 @@ void DeviceRegistrationInfo::OnCloudRequestDone(
     // Request was valid, but server failed, retry.
     // TODO(antonm): Reconsider status codes, maybe only some require
     // retry.
-    // TODO(antonm): Support Retry-After header.
+    HonorRetryAfter(*response);
     RetryCloudRequest(data);
     return;
   }
@@ -776,30 +1658,83 @@ void DeviceRegistrationInfo::OnCloudRequestDone(
   if (response->GetContentType().empty()) {
     // Assume no body if no content type.
     cloud_backoff_entry_->InformOfRequest(true);
-    return data->callback.Run({}, nullptr);
+    return FinishCloudRequest(data, {}, nullptr);
+  }
+
+  // Errors are still parsed below, their bodies are small.
+  if (!data->stream_callback.is_null() && IsSuccessful(*response)) {
+    if (!CheckJsonContentType(*response, &error)) {
+      cloud_backoff_entry_->InformOfRequest(false);
+      return FinishCloudRequest(data, {}, std::move(error));
+    }
+    cloud_backoff_entry_->InformOfRequest(true);
+    SetGcdState(GcdState::kConnected);
+    return FinishStreamedCloudRequest(data, *response);
   }
 
-  auto json_resp = ParseJsonResponse(*response, &error);
-  if (!json_resp) {
+  std::shared_ptr<const HttpClient::Response> shared_response{
+      std::move(response)};
+  bool offload = shared_response->GetData().size() >= kMinWorkerPoolJsonSize;
+  PostWorkerTaskAndReply(
+      offload ? worker_pool_ : nullptr, &cloud_response_sequence_, FROM_HERE,
+      base::Bind(&DeviceRegistrationInfo::ParseCloudResponse, shared_response,
+                 input_limits_),
+      base::Bind(&DeviceRegistrationInfo::OnCloudResponseParsed, AsWeakPtr(),
+                 data, shared_response));
+}
+
+DeviceRegistrationInfo::ParsedResponse
+DeviceRegistrationInfo::ParseCloudResponse(
+    const std::shared_ptr<const HttpClient::Response>& response,
+    const InputLimits& limits) {
+  ParsedResponse parsed;
+  base::ScopedValueArena arena;
+  parsed.json = ParseJsonResponse(*response, limits, &parsed.error);
+  return parsed;
+}
+
+void DeviceRegistrationInfo::OnCloudResponseParsed(
+    const std::shared_ptr<const CloudRequestData>& data,
+    const std::shared_ptr<const HttpClient::Response>& response,
+    ParsedResponse parsed) {
+  int status_code = response->GetStatusCode();
+  if (!parsed.json) {
     cloud_backoff_entry_->InformOfRequest(false);
-    return data->callback.Run({}, std::move(error));
+    return FinishCloudRequest(data, {}, std::move(parsed.error));
   }
 
   if (!IsSuccessful(*response)) {
-    ParseGCDError(json_resp.get(), &error);
+    ParseGCDError(parsed.json.get(), &parsed.error);
     if (status_code == http::kForbidden &&
-        error->HasError("rateLimitExceeded")) {
+        parsed.error->HasError("rateLimitExceeded")) {
       // If we exceeded server quota, retry the request later.
+      HonorRetryAfter(*response);
       return RetryCloudRequest(data);
     }
 
     cloud_backoff_entry_->InformOfRequest(false);
-    return data->callback.Run({}, std::move(error));
+    return FinishCloudRequest(data, {}, std::move(parsed.error));
   }
 
   cloud_backoff_entry_->InformOfRequest(true);
   SetGcdState(GcdState::kConnected);
-  data->callback.Run(*json_resp, nullptr);
+  FinishCloudRequest(data, *parsed.json, nullptr);
+}
+
+void DeviceRegistrationInfo::HonorRetryAfter(
+    const HttpClient::Response& response) {
+  // Only the delay-seconds form is used by the server.
+  int seconds = 0;
+  if (!base::StringToInt(response.GetHeader(http::kRetryAfter), &seconds) ||
+      seconds <= 0) {
+    return;
+  }
+  seconds = std::min(seconds, kMaxRetryAfterSeconds);
+  VLOG(1) << "Server asked to retry after " << seconds << " seconds";
+  base::TimeTicks release_time = cloud_backoff_entry_->GetTimeTicksNow() +
+                                 base::TimeDelta::FromSeconds(seconds);
+  cloud_backoff_entry_->SetCustomReleaseTime(
+      std::max(release_time, cloud_backoff_entry_->GetReleaseTime()));
 }
 
 void DeviceRegistrationInfo::RetryCloudRequest(
@@ -807,7 +1742,52 @@ void DeviceRegistrationInfo::RetryCloudRequest(
   // TODO(avakulenko): Tie connecting/connected status to XMPP channel instead.
   SetGcdState(GcdState::kConnecting);
   cloud_backoff_entry_->InformOfRequest(false);
-  SendCloudRequest(data);
+  if (!cloud_offline_ && ++cloud_failures_ < kMaxCloudFailuresOnline)
+    return SendCloudRequest(data);
+
+  if (!cloud_offline_) {
+    LOG(WARNING) << "Cloud is unreachable, holding back cloud requests";
+    cloud_offline_ = true;
+  }
+  // Only the probe is retried, the other requests wait for it.
+  if (data == cloud_probe_)
+    cloud_probe_.reset();
+  offline_cloud_requests_.push_back(data);
+  if (!cloud_probe_) {
+    cloud_probe_ = offline_cloud_requests_.front();
+    offline_cloud_requests_.pop_front();
+    SendCloudRequest(cloud_probe_);
+  }
+}
+
+void DeviceRegistrationInfo::SetCloudOnline() {
+  LOG(INFO) << "Cloud is reachable again";
+  cloud_offline_ = false;
+  cloud_probe_.reset();
+  // Let the probe finish before the work held back starts.
+  task_runner_->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&DeviceRegistrationInfo::ResumeCloudWork, AsWeakPtr()), {});
+}
+
+void DeviceRegistrationInfo::ResumeCloudWork() {
+  if (cloud_offline_)
+    return;
+  // These still hold their request slots.
+  auto requests = std::move(offline_cloud_requests_);
+  offline_cloud_requests_.clear();
+  for (const auto& data : requests)
+    SendCloudRequest(data);
+  SendQueuedCloudRequests();
+
+  // The work recorded while offline.
+  SendCommandUpdates();
+  if (in_progress_resource_update_callbacks_.empty())
+    StartQueuedUpdateDeviceResource();
+  if (fetch_commands_request_queued_ && !fetch_commands_request_sent_)
+    FetchAndPublishCommands(queued_fetch_reason_);
+  if (connected_to_cloud_)
+    PublishStateUpdates();
 }
 
 void DeviceRegistrationInfo::OnAccessTokenRefreshed(
@@ -815,7 +1795,7 @@ void DeviceRegistrationInfo::OnAccessTokenRefreshed(
     ErrorPtr error) {
   if (error) {
     CheckAccessTokenError(error->Clone());
-    return data->callback.Run({}, std::move(error));
+    return FinishCloudRequest(data, {}, std::move(error));
   }
   SendCloudRequest(data);
 }
@@ -856,7 +1836,7 @@ void DeviceRegistrationInfo::OnConnectedToCloud(ErrorPtr error) {
     return;
   LOG(INFO) << "Device connected to cloud server";
   connected_to_cloud_ = true;
-  FetchCommands(base::Bind(&DeviceRegistrationInfo::ProcessInitialCommandList,
+  FetchCommands(base::Bind(&DeviceRegistrationInfo::ProcessInitialCommand,
                            AsWeakPtr()),
                 fetch_reason::kDeviceStart);
   // In case there are any pending state updates since we sent off the initial
@@ -886,21 +1866,85 @@ void DeviceRegistrationInfo::UpdateCommand(
     const std::string& command_id,
     const base::DictionaryValue& command_patch,
     const DoneCallback& callback) {
-  DoCloudRequest(HttpClient::Method::kPatch,
-                 GetServiceUrl("commands/" + command_id), &command_patch,
-                 base::Bind(&IgnoreCloudResultWithCallback, callback));
+  PendingCommandUpdate update;
+  update.url = GetServiceUrl("commands/" + command_id);
+  JsonStreamWriter writer{&update.body};
+  writer.WriteValue(command_patch);
+  update.callback = callback;
+  pending_command_updates_.push_back(std::move(update));
+  SendCommandUpdates();
 }
 
-void DeviceRegistrationInfo::NotifyCommandAborted(const std::string& command_id,
-                                                  ErrorPtr error) {
-  base::DictionaryValue command_patch;
-  command_patch.SetString(commands::attributes::kCommand_State,
-                          EnumToString(Command::State::kAborted));
-  if (error) {
-    command_patch.Set(commands::attributes::kCommand_Error,
-                      ErrorInfoToJson(*error));
+void DeviceRegistrationInfo::UploadCommandBlob(
+    const std::string& command_id,
+    const CommandInstance::Blob& blob,
+    const DoneCallback& callback) {
+  auto data = std::make_shared<CloudRequestData>();
+  data->method = HttpClient::Method::kPut;
+  data->url = GetServiceUrl("commands/" + command_id + "/blobs/" + blob.id);
+  data->blob = blob.data;
+  data->blob_content_type = blob.content_type;
+  data->callback = base::Bind(
+      [](const DoneCallback& callback, const base::DictionaryValue&,
+         ErrorPtr error) { callback.Run(std::move(error)); },
+      callback);
+  QueueCloudRequest(CloudRequestPriority::kCommand, data);
+}
+
+void DeviceRegistrationInfo::SendCommandUpdates() {
+  while (!cloud_offline_ &&
+         command_updates_in_flight_ < kMaxCommandUpdatesInFlight &&
+         !pending_command_updates_.empty()) {
+    PendingCommandUpdate update = std::move(pending_command_updates_.front());
+    pending_command_updates_.pop_front();
+    ++command_updates_in_flight_;
+    DoCloudRequest(CloudRequestPriority::kCommand, HttpClient::Method::kPatch,
+                   update.url, std::move(update.body),
+                   base::Bind(&DeviceRegistrationInfo::OnCommandUpdateDone,
+                              AsWeakPtr(), update.callback));
   }
-  UpdateCommand(command_id, command_patch, base::Bind(&IgnoreCloudError));
+}
+
+void DeviceRegistrationInfo::OnCommandUpdateDone(
+    const DoneCallback& callback,
+    const base::DictionaryValue& reply,
+    ErrorPtr error) {
+  CHECK_GT(command_updates_in_flight_, 0u);
+  --command_updates_in_flight_;
+  SendCommandUpdates();
+  callback.Run(std::move(error));
+}
+
+void DeviceRegistrationInfo::NotifyCommandsAborted(
+    Command::State state,
+    std::vector<std::pair<std::string, ErrorPtr>> commands) {
+  if (commands.empty())
+    return;
+  for (const auto& command : commands) {
+    if (!aborting_command_ids_.insert(command.first).second)
+      continue;
+    base::DictionaryValue command_patch;
+    command_patch.SetString(commands::attributes::kCommand_State,
+                            EnumToString(state));
+    if (command.second) {
+      command_patch.Set(commands::attributes::kCommand_Error,
+                        ErrorInfoToJson(*command.second));
+    }
+    PendingCommandUpdate update;
+    update.url = GetServiceUrl("commands/" + command.first);
+    JsonStreamWriter writer{&update.body};
+    writer.WriteValue(command_patch);
+    update.callback = base::Bind(&DeviceRegistrationInfo::OnCommandAbortDone,
+                                 AsWeakPtr(), command.first);
+    pending_command_updates_.push_back(std::move(update));
+  }
+  SendCommandUpdates();
+}
+
+void DeviceRegistrationInfo::OnCommandAbortDone(const std::string& command_id,
+                                                ErrorPtr error) {
+  // A failed abort is sent again if the command is fetched again.
+  aborting_command_ids_.erase(command_id);
 }
 
 void DeviceRegistrationInfo::UpdateDeviceResource(
@@ -918,12 +1962,18 @@ void DeviceRegistrationInfo::StartQueuedUpdateDeviceResource() {
   if (in_progress_resource_update_callbacks_.empty() &&
       queued_resource_update_callbacks_.empty())
     return;
+  // The queued callbacks are kept until the cloud is reachable, the resource
+  // is only written then.
+  if (cloud_offline_ && in_progress_resource_update_callbacks_.empty())
+    return;
 
-  if (last_device_resource_updated_timestamp_.empty()) {
+  const std::string& timestamp = GetSettings().device_resource_timestamp;
+  if (timestamp.empty()) {
     // We don't know the current time stamp of the device resource from the
     // server side. We need to provide the time stamp to the server as part of
     // the request to guard against out-of-order requests overwriting settings
-    // specified by later requests.
+    // specified by later requests. It's kept in the config, so this is only
+    // needed after the registration is lost or the server rejects it.
     VLOG(1) << "Getting the last device resource timestamp from server...";
     GetDeviceInfo(base::Bind(&DeviceRegistrationInfo::OnDeviceInfoRetrieved,
                              AsWeakPtr()));
@@ -936,15 +1986,63 @@ void DeviceRegistrationInfo::StartQueuedUpdateDeviceResource() {
       queued_resource_update_callbacks_.end());
   queued_resource_update_callbacks_.clear();
 
-  VLOG(1) << "Updating GCD server with CDD...";
-  std::unique_ptr<base::DictionaryValue> device_resource =
-      BuildDeviceResource();
-  CHECK(device_resource);
+  // The server only applies the update if the resource wasn't changed since
+  // |timestamp|, so a single request both checks and writes it.
+  std::string url = GetDeviceUrl({}, {{"lastUpdateTimeMs", timestamp}});
+  ResourceDigests digests;
+  if (device_resource_delta_updates_enabled_)
+    digests = GetDeviceResourceDigests();
+
+  if (!uploaded_resource_digests_.empty()) {
+    std::string patch;
+    bool changed = false;
+    {
+      JsonStreamWriter writer{&patch};
+      changed = WriteDeviceResourcePatch(digests, &writer);
+    }
+    if (!changed) {
+      VLOG(1) << "Device resource is up to date";
+      auto callback_list = std::move(in_progress_resource_update_callbacks_);
+      for (const auto& callback : callback_list)
+        callback.Run(nullptr);
+      return StartQueuedUpdateDeviceResource();
+    }
+    VLOG(1) << "Patching GCD server CDD...";
+    in_progress_resource_digests_ = std::move(digests);
+    DoCloudRequest(
+        CloudRequestPriority::kResource, HttpClient::Method::kPatch, url,
+        std::move(patch),
+        base::Bind(&DeviceRegistrationInfo::OnUpdateDeviceResourceDone,
+                   AsWeakPtr()));
+    return;
+  }
 
-  std::string url = GetDeviceUrl(
-      {}, {{"lastUpdateTimeMs", last_device_resource_updated_timestamp_}});
+  VLOG(1) << "Updating GCD server with CDD...";
+  in_progress_resource_digests_ = std::move(digests);
+  if (worker_pool_ && device_resource_size_ >= kMinWorkerPoolJsonSize) {
+    // Only the snapshot is taken here, the task runner isn't blocked while
+    // the components are serialized. The digests above are of the same tree.
+    WriteJsonInShards(
+        worker_pool_, FROM_HERE, component_manager_->GetComponentsSnapshot(),
+        kMaxComponentsJsonShards,
+        base::Bind(&DeviceRegistrationInfo::PutDeviceResource, AsWeakPtr(),
+                   url));
+    return;
+  }
+  PutDeviceResource(url, {});
+}
 
-  DoCloudRequest(HttpClient::Method::kPut, url, device_resource.get(),
+void DeviceRegistrationInfo::PutDeviceResource(const std::string& url,
+                                               std::string components_json) {
+  std::string device_resource;
+  device_resource.reserve(device_resource_size_);
+  {
+    JsonStreamWriter writer{&device_resource};
+    WriteDeviceResource(&writer, true, components_json);
+  }
+  device_resource_size_ = device_resource.size();
+  DoCloudRequest(CloudRequestPriority::kResource, HttpClient::Method::kPut, url,
+                 std::move(device_resource),
                  base::Bind(&DeviceRegistrationInfo::OnUpdateDeviceResourceDone,
                             AsWeakPtr()));
 }
@@ -973,7 +2071,8 @@ void DeviceRegistrationInfo::SendAuthInfo() {
   root->Set("localAuthInfo", std::move(auth));
 
   std::string url = GetDeviceUrl("upsertLocalAuthInfo", {});
-  DoCloudRequest(HttpClient::Method::kPost, url, root.get(),
+  DoCloudRequest(CloudRequestPriority::kAuthInfo, HttpClient::Method::kPost,
+                 url, root.get(),
                  base::Bind(&DeviceRegistrationInfo::OnSendAuthInfoDone,
                             AsWeakPtr(), token));
 }
@@ -1006,22 +2105,38 @@ bool DeviceRegistrationInfo::UpdateDeviceInfoTimestamp(
     const base::DictionaryValue& device_info) {
   // For newly created devices, "lastUpdateTimeMs" may not be present, but
   // "creationTimeMs" should be there at least.
-  if (!device_info.GetString("lastUpdateTimeMs",
-                             &last_device_resource_updated_timestamp_) &&
-      !device_info.GetString("creationTimeMs",
-                             &last_device_resource_updated_timestamp_)) {
+  std::string timestamp;
+  if (!device_info.GetString("lastUpdateTimeMs", &timestamp) &&
+      !device_info.GetString("creationTimeMs", &timestamp)) {
     LOG(WARNING) << "Device resource timestamp is missing";
     return false;
   }
+  SetDeviceResourceTimestamp(timestamp);
   return true;
 }
 
+void DeviceRegistrationInfo::SetDeviceResourceTimestamp(
+    const std::string& timestamp) {
+  if (GetSettings().device_resource_timestamp == timestamp)
+    return;
+  // Not flushed, losing it only costs a GetDeviceInfo() request.
+  Config::Transaction change{config_};
+  change.set_device_resource_timestamp(timestamp);
+}
+
 void DeviceRegistrationInfo::OnUpdateDeviceResourceDone(
     const base::DictionaryValue& device_info,
     ErrorPtr error) {
   if (error)
     return OnUpdateDeviceResourceError(std::move(error));
   UpdateDeviceInfoTimestamp(device_info);
+  uploaded_resource_digests_ = std::move(in_progress_resource_digests_);
+  // Servers which don't support trait references don't return the
+  // fingerprint, so the traits keep being uploaded in full.
+  acknowledged_traits_fingerprint_.clear();
+  device_info.GetString(kTraitsFingerprint, &acknowledged_traits_fingerprint_);
+  for (const auto& cb : resource_uploaded_callbacks_)
+    cb.Run();
 
   if (auth_manager_) {
     std::string fingerprint_base64;
@@ -1044,6 +2159,12 @@ void DeviceRegistrationInfo::OnUpdateDeviceResourceDone(
 }
 
 void DeviceRegistrationInfo::OnUpdateDeviceResourceError(ErrorPtr error) {
+  // The server copy of the resource is unknown now, so the next update is a
+  // full one.
+  uploaded_resource_digests_.clear();
+  in_progress_resource_digests_.clear();
+  if (error->HasError(kErrorUnknownTraitsFingerprint))
+    acknowledged_traits_fingerprint_.clear();
   if (error->HasError("invalid_last_update_time_ms")) {
     // If the server rejected our previous request, retrieve the latest
     // timestamp from the server and retry.
@@ -1064,87 +2185,167 @@ void DeviceRegistrationInfo::OnUpdateDeviceResourceError(ErrorPtr error) {
 }
 
 void DeviceRegistrationInfo::OnFetchCommandsDone(
-    const base::Callback<void(const base::ListValue&, ErrorPtr)>& callback,
-    const base::DictionaryValue& json,
+    const FetchedCommandCallback& callback,
+    JsonStreamReader* response,
     ErrorPtr error) {
   OnFetchCommandsReturned();
   if (error)
-    return callback.Run({}, std::move(error));
-  const base::ListValue* commands{nullptr};
-  if (!json.GetList("commands", &commands))
+    return;
+  CommandBatch batch;
+  int64_t last_command_time_ms = last_command_time_ms_;
+  if (!ReadCommandQueue(response, callback, &batch, &last_command_time_ms,
+                        &error)) {
+    // Commands already read are dropped too, as if the whole response was
+    // parsed first.
+    LOG(WARNING) << "Failed to read the command queue: "
+                 << error->GetMessage();
+    return;
+  }
+  last_command_time_ms_ = last_command_time_ms;
+  PublishCommandBatch(std::move(batch));
+}
+
+bool DeviceRegistrationInfo::ReadCommandQueue(
+    JsonStreamReader* response,
+    const FetchedCommandCallback& callback,
+    CommandBatch* batch,
+    int64_t* last_command_time_ms,
+    ErrorPtr* error) {
+  using Token = JsonStreamReader::Token;
+  if (response->Next() != Token::kBeginDictionary) {
+    response->AddError(error);
+    return Error::AddTo(error, FROM_HERE, errors::json::kObjectExpected,
+                        "Response is not a valid JSON object");
+  }
+  bool has_commands = false;
+  while (response->Next() == Token::kKey) {
+    bool is_commands = response->GetString() == "commands";
+    if (response->Next() != Token::kBeginList || !is_commands) {
+      if (!response->SkipValue())
+        break;
+      continue;
+    }
+    has_commands = true;
+    while (response->Next() != Token::kEndList) {
+      std::unique_ptr<base::Value> command = response->ReadValue();
+      if (!command)
+        break;
+      const base::DictionaryValue* command_dict{nullptr};
+      if (!command->GetAsDictionary(&command_dict)) {
+        LOG(WARNING) << "Not a command dictionary: " << *command;
+        continue;
+      }
+      std::string time_str;
+      int64_t time_ms{0};
+      if (command_dict->GetString("creationTimeMs", &time_str) &&
+          base::StringToInt64(time_str, &time_ms)) {
+        *last_command_time_ms = std::max(*last_command_time_ms, time_ms);
+      }
+      callback.Run(*command_dict, batch);
+    }
+  }
+  if (response->GetToken() != Token::kEndDictionary ||
+      response->Next() != Token::kEnd) {
+    response->AddError(error);
+    return Error::AddTo(error, FROM_HERE, errors::json::kParseError,
+                        "Malformed command queue");
+  }
+  if (!has_commands)
     VLOG(2) << "No commands in the response.";
-  const base::ListValue empty;
-  callback.Run(commands ? *commands : empty, nullptr);
+  return true;
 }
 
 void DeviceRegistrationInfo::OnFetchCommandsReturned() {
   fetch_commands_request_sent_ = false;
+  commands_fetched_since_resync_ = true;
+  ScheduleCommandResync();
   // If we have additional requests queued, send them out now.
   if (fetch_commands_request_queued_)
     FetchAndPublishCommands(queued_fetch_reason_);
 }
 
 void DeviceRegistrationInfo::FetchCommands(
-    const base::Callback<void(const base::ListValue&, ErrorPtr)>& callback,
+    const FetchedCommandCallback& callback,
     const std::string& reason) {
   fetch_commands_request_sent_ = true;
   fetch_commands_request_queued_ = false;
-  DoCloudRequest(
-      HttpClient::Method::kGet,
-      GetServiceUrl("commands/queue",
-                    {{"deviceId", GetSettings().cloud_id}, {"reason", reason}}),
-      nullptr, base::Bind(&DeviceRegistrationInfo::OnFetchCommandsDone,
-                          AsWeakPtr(), callback));
+  WebParamList params{{"deviceId", GetSettings().cloud_id},
+                      {"reason", reason}};
+  // The initial fetch needs the whole queue to abort stale commands. Later
+  // ones only transfer commands created since the newest one seen, which
+  // is included again in case others share its timestamp.
+  if (reason != fetch_reason::kDeviceStart && last_command_time_ms_ > 0) {
+    params.emplace_back("lastCommandTimeMs",
+                        base::Int64ToString(last_command_time_ms_));
+  }
+  DoStreamedCloudRequest(
+      CloudRequestPriority::kCommand, HttpClient::Method::kGet,
+      GetServiceUrl("commands/queue", params), {},
+      base::Bind(&DeviceRegistrationInfo::OnFetchCommandsDone, AsWeakPtr(),
+                 callback));
 }
 
 void DeviceRegistrationInfo::FetchAndPublishCommands(
     const std::string& reason) {
-  if (fetch_commands_request_sent_) {
+  if (fetch_commands_request_sent_ || cloud_offline_) {
     fetch_commands_request_queued_ = true;
     queued_fetch_reason_ = reason;
     return;
   }
 
-  FetchCommands(base::Bind(&DeviceRegistrationInfo::PublishCommands,
+  FetchCommands(base::Bind(&DeviceRegistrationInfo::AddCommandToBatch,
                            weak_factory_.GetWeakPtr()),
                 reason);
 }
 
-void DeviceRegistrationInfo::ProcessInitialCommandList(
-    const base::ListValue& commands,
-    ErrorPtr error) {
-  if (error)
+void DeviceRegistrationInfo::ScheduleCommandResync() {
+  if (command_resync_scheduled_)
     return;
-  for (const auto& command : commands) {
-    const base::DictionaryValue* command_dict{nullptr};
-    if (!command->GetAsDictionary(&command_dict)) {
-      LOG(WARNING) << "Not a command dictionary: " << *command;
-      continue;
-    }
-    std::string command_state;
-    if (!command_dict->GetString("state", &command_state)) {
-      LOG(WARNING) << "Command with no state at " << *command;
-      continue;
-    }
-    if (command_state == "error" && command_state == "inProgress" &&
-        command_state == "paused") {
-      // It's a limbo command, abort it.
-      std::string command_id;
-      if (!command_dict->GetString("id", &command_id)) {
-        LOG(WARNING) << "Command with no ID at " << *command;
-        continue;
-      }
+  command_resync_scheduled_ = true;
+  commands_fetched_since_resync_ = false;
+  base::TimeDelta period =
+      base::TimeDelta::FromMinutes(kCommandResyncPeriodMinutes);
+  PostDeferrableTask(
+      FROM_HERE,
+      base::Bind(&DeviceRegistrationInfo::ResyncCommands, AsWeakPtr()),
+      period, period * kCommandResyncTolerance);
+}
 
-      auto cmd_copy = command_dict->CreateDeepCopy();
-      cmd_copy->SetString("state", "aborted");
-      // TODO(wiley) We could consider handling this error case more gracefully.
-      DoCloudRequest(HttpClient::Method::kPut,
-                     GetServiceUrl("commands/" + command_id), cmd_copy.get(),
-                     base::Bind(&IgnoreCloudResult));
-    } else {
-      // Normal command, publish it to local clients.
-      PublishCommand(*command_dict);
+void DeviceRegistrationInfo::ResyncCommands() {
+  command_resync_scheduled_ = false;
+  if (!connected_to_cloud_)
+    return;  // Fetches start again once connected.
+  if (commands_fetched_since_resync_)
+    return ScheduleCommandResync();
+  FetchAndPublishCommands(fetch_reason::kResync);
+}
+
+void DeviceRegistrationInfo::ProcessInitialCommand(
+    const base::DictionaryValue& command,
+    CommandBatch* batch) {
+  std::string command_state;
+  if (!command.GetString("state", &command_state)) {
+    LOG(WARNING) << "Command with no state at " << command;
+    return;
+  }
+  if (command_state == "error" && command_state == "inProgress" &&
+      command_state == "paused") {
+    // It's a limbo command, abort it.
+    std::string command_id;
+    if (!command.GetString("id", &command_id)) {
+      LOG(WARNING) << "Command with no ID at " << command;
+      return;
     }
+
+    auto cmd_copy = command.CreateDeepCopy();
+    cmd_copy->SetString("state", "aborted");
+    // TODO(wiley) We could consider handling this error case more gracefully.
+    DoCloudRequest(CloudRequestPriority::kCommand, HttpClient::Method::kPut,
+                   GetServiceUrl("commands/" + command_id), cmd_copy.get(),
+                   base::Bind(&IgnoreCloudResult));
+  } else {
+    // Normal command, publish it to local clients.
+    AddCommandToBatch(command, batch);
   }
 }
 
@@ -1152,86 +2353,265 @@ void DeviceRegistrationInfo::PublishCommands(const base::ListValue& commands,
                                              ErrorPtr error) {
   if (error)
     return;
+  CommandBatch batch;
   for (const auto& command : commands) {
     const base::DictionaryValue* command_dict{nullptr};
     if (!command->GetAsDictionary(&command_dict)) {
       LOG(WARNING) << "Not a command dictionary: " << *command;
       continue;
     }
-    PublishCommand(*command_dict);
+    AddCommandToBatch(*command_dict, &batch);
   }
+  PublishCommandBatch(std::move(batch));
 }
 
-void DeviceRegistrationInfo::PublishCommand(
-    const base::DictionaryValue& command) {
+void DeviceRegistrationInfo::AddCommandToBatch(
+    const base::DictionaryValue& command,
+    CommandBatch* batch) {
   std::string command_id;
+  // After a reconnect most of the queue is usually known already, so skip
+  // those commands before copying and validating their parameters.
+  // TODO(antonm): Properly process cancellation of commands.
+  if (command.GetString(commands::attributes::kCommand_Id, &command_id) &&
+      (IsCommandKnown(command_id) || !batch->ids.insert(command_id).second)) {
+    return;
+  }
+  // Commands left in the queue through a long outage are not worth parsing.
+  base::Time deadline;
+  if (!command_id.empty() &&
+      CommandInstance::GetDeadlineFromJson(command, &deadline) &&
+      deadline < base::Time::Now()) {
+    VLOG(1) << "Command " << command_id << " has expired";
+    batch->expired.emplace_back(command_id, nullptr);
+    return;
+  }
   ErrorPtr error;
   auto command_instance = component_manager_->ParseCommandInstance(
       command, Command::Origin::kCloud, UserRole::kOwner, &command_id, &error);
   if (!command_instance) {
     LOG(WARNING) << "Failed to parse a command instance: " << command;
     if (!command_id.empty())
-      NotifyCommandAborted(command_id, std::move(error));
+      batch->aborted.emplace_back(command_id, std::move(error));
     return;
   }
+  // Invalid commands are not remembered, they are aborted again if the
+  // server keeps sending them.
+  recent_command_ids_.Add(command_instance->GetID());
+
+  LOG(INFO) << "New command '" << command_instance->GetName()
+            << "' arrived, ID: " << command_instance->GetID();
+  std::unique_ptr<CloudCommandProxy> cloud_proxy{new CloudCommandProxy{
+      command_instance.get(), this, component_manager_,
+      command_update_backoff_entry_, task_runner_, cloud_command_proxies_}};
+  // CloudCommandProxy::CloudCommandProxy() subscribe itself to Command
+  // notifications. When Command is being destroyed it sends
+  // ::OnCommandDestroyed() and CloudCommandProxy deletes itself.
+  cloud_proxy.release();
+  batch->commands.push_back(std::move(command_instance));
+}
+
+void DeviceRegistrationInfo::PublishCommandBatch(CommandBatch batch) {
+  if (!batch.commands.empty()) {
+    if (pull_channel_)
+      pull_channel_->OnCommandsReceived();
+    // Queue all commands at once, so handlers see the whole batch.
+    component_manager_->AddCommands(std::move(batch.commands));
+  }
+  // The valid commands go first, their updates are more urgent.
+  NotifyCommandsAborted(Command::State::kAborted, std::move(batch.aborted));
+  NotifyCommandsAborted(Command::State::kExpired, std::move(batch.expired));
+}
+
+void DeviceRegistrationInfo::GetMemoryStats(
+    base::DictionaryValue* stats) const {
+  MemoryUsage command_updates;
+  for (const CloudCommandProxy* proxy : *cloud_command_proxies_)
+    command_updates += proxy->GetMemoryUsage();
+  command_updates.count += pending_command_updates_.size();
+  for (const auto& update : pending_command_updates_) {
+    command_updates.bytes += sizeof(update) + EstimateMemoryUsage(update.url) +
+                             EstimateMemoryUsage(update.body);
+  }
 
-  // TODO(antonm): Properly process cancellation of commands.
-  if (!component_manager_->FindCommand(command_instance->GetID())) {
-    LOG(INFO) << "New command '" << command_instance->GetName()
-              << "' arrived, ID: " << command_instance->GetID();
-    std::unique_ptr<BackoffEntry> backoff_entry{
-        new BackoffEntry{cloud_backoff_policy_.get()}};
-    std::unique_ptr<CloudCommandProxy> cloud_proxy{
-        new CloudCommandProxy{command_instance.get(), this, component_manager_,
-                              std::move(backoff_entry), task_runner_}};
-    // CloudCommandProxy::CloudCommandProxy() subscribe itself to Command
-    // notifications. When Command is being destroyed it sends
-    // ::OnCommandDestroyed() and CloudCommandProxy deletes itself.
-    cloud_proxy.release();
-    component_manager_->AddCommand(std::move(command_instance));
+  MemoryUsage state_changes;
+  state_changes.count = pending_state_changes_.size();
+  for (const auto& change : pending_state_changes_) {
+    state_changes.bytes += sizeof(change) +
+                           EstimateMemoryUsage(change.component) +
+                           EstimateMemoryUsage(*change.changed_properties);
   }
+
+  stats->Set("cloudCommandUpdates", command_updates.ToJson());
+  stats->Set("statePublishQueue", state_changes.ToJson());
+}
+
+void DeviceRegistrationInfo::CompactMemory() {
+  for (CloudCommandProxy* proxy : *cloud_command_proxies_)
+    proxy->Compact();
+  ShrinkToFit(&pending_command_updates_);
+  ShrinkToFit(&pending_state_changes_);
+}
+
+std::unique_ptr<base::DictionaryValue> DeviceRegistrationInfo::GetTrafficStats()
+    const {
+  return traffic_stats_->ToJson();
+}
+
+void DeviceRegistrationInfo::SetStatePublishLimits(
+    const StatePublishLimits& limits) {
+  CHECK_GT(limits.max_batch_size, 0u);
+  CHECK_GT(limits.max_requests_in_flight, 0u);
+  CHECK(limits.min_interval <= limits.max_interval);
+  state_publish_limits_ = limits;
+  // Spread the requests over the round-trip time, so the window of requests
+  // in flight is kept full.
+  base::TimeDelta window = state_publish_rtt_ / limits.max_requests_in_flight;
+  state_publish_window_ = std::max(limits.min_interval,
+                                   std::min(limits.max_interval, window));
+}
+
+size_t DeviceRegistrationInfo::GetStatePublishRequestsInFlight() const {
+  return std::count_if(
+      state_publish_requests_.begin(), state_publish_requests_.end(),
+      [](const StatePublishRequest& request) { return !request.done; });
 }
 
 void DeviceRegistrationInfo::PublishStateUpdates() {
-  // If we have pending state update requests, don't send any more for now.
-  if (device_state_update_pending_)
+  // If the window of requests in flight is full, don't send any more for now.
+  // While the cloud is unreachable, the changes are only recorded.
+  if (state_publish_scheduled_ || cloud_offline_ ||
+      GetStatePublishRequestsInFlight() >=
+          state_publish_limits_.max_requests_in_flight) {
     return;
+  }
 
-  auto snapshot = component_manager_->GetAndClearRecordedStateChanges();
-  if (snapshot.state_changes.empty())
+  base::TimeDelta delay =
+      last_state_publish_time_ + state_publish_window_ - base::Time::Now();
+  if (delay > base::TimeDelta{}) {
+    // Let more changes accumulate, to send them in a single request.
+    state_publish_scheduled_ = true;
+    task_runner_->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&DeviceRegistrationInfo::OnStatePublishWindowElapsed,
+                   AsWeakPtr()),
+        delay);
     return;
+  }
+  SendStateUpdates();
+}
 
-  std::unique_ptr<base::ListValue> patches{new base::ListValue};
-  for (auto& state_change : snapshot.state_changes) {
-    std::unique_ptr<base::DictionaryValue> patch{new base::DictionaryValue};
-    patch->SetString("timeMs",
-                     std::to_string(state_change.timestamp.ToJavaTime()));
-    patch->SetString("component", state_change.component);
-    patch->Set("patch", std::move(state_change.changed_properties));
-    patches->Append(std::move(patch));
+void DeviceRegistrationInfo::OnStatePublishWindowElapsed() {
+  state_publish_scheduled_ = false;
+  if (GetStatePublishRequestsInFlight() >=
+          state_publish_limits_.max_requests_in_flight ||
+      !HaveRegistrationCredentials() || !connected_to_cloud_ ||
+      cloud_offline_) {
+    return;
   }
+  SendStateUpdates();
+}
 
-  base::DictionaryValue body;
-  body.SetString("requestTimeMs",
-                 std::to_string(base::Time::Now().ToJavaTime()));
-  body.Set("patches", std::move(patches));
+void DeviceRegistrationInfo::SendStateUpdates() {
+  if (pending_state_changes_.empty() && state_spool_ &&
+      !state_spool_->IsEmpty()) {
+    // The spooled changes are older than the recorded ones.
+    pending_state_update_id_ =
+        state_spool_->TakeOldest(&pending_state_changes_);
+  }
+  if (pending_state_changes_.empty()) {
+    auto snapshot = component_manager_->GetAndClearRecordedStateChanges();
+    for (auto& state_change : snapshot.state_changes)
+      pending_state_changes_.push_back(std::move(state_change));
+    pending_state_update_id_ = snapshot.update_id;
+    state_updates_since_spool_ = 0;
+  }
+  if (pending_state_changes_.empty())
+    return;
 
-  device_state_update_pending_ = true;
-  DoCloudRequest(HttpClient::Method::kPost, GetDeviceUrl("patchState"), &body,
+  last_state_publish_time_ = base::Time::Now();
+  base::Time oldest_change_time = pending_state_changes_.front().timestamp;
+  std::string body;
+  JsonStreamWriter writer{&body};
+  writer.BeginDictionary();
+  writer.WriteKey("requestTimeMs");
+  writer.WriteString(std::to_string(last_state_publish_time_.ToJavaTime()));
+  writer.WriteKey("patches");
+  writer.BeginList();
+  for (size_t i = 0; !pending_state_changes_.empty() &&
+                     i < state_publish_limits_.max_batch_size;
+       i++) {
+    const auto& state_change = pending_state_changes_.front();
+    writer.BeginDictionary();
+    writer.WriteKey("timeMs");
+    writer.WriteString(std::to_string(state_change.timestamp.ToJavaTime()));
+    writer.WriteKey("component");
+    writer.WriteString(state_change.component);
+    writer.WriteKey("patch");
+    writer.WriteValue(*state_change.changed_properties);
+    writer.EndDictionary();
+    pending_state_changes_.pop_front();
+  }
+  writer.EndList();
+  writer.EndDictionary();
+
+  StatePublishRequest request;
+  request.id = ++last_state_publish_request_id_;
+  // The update ID is reported to the server with the last batch of the
+  // snapshot only. Zero is never a valid ID of a snapshot with changes.
+  request.update_id =
+      pending_state_changes_.empty() ? pending_state_update_id_ : 0;
+  request.start_time = last_state_publish_time_;
+  request.oldest_change_time = oldest_change_time;
+  state_publish_requests_.push_back(request);
+
+  DoCloudRequest(CloudRequestPriority::kState, HttpClient::Method::kPost,
+                 GetDeviceUrl("patchState"), std::move(body),
                  base::Bind(&DeviceRegistrationInfo::OnPublishStateDone,
-                            AsWeakPtr(), snapshot.update_id));
+                            AsWeakPtr(), request.id));
+  // Keep filling the window of requests with the rest of the snapshot.
+  if (!pending_state_changes_.empty())
+    PublishStateUpdates();
 }
 
 void DeviceRegistrationInfo::OnPublishStateDone(
-    ComponentManager::UpdateID update_id,
+    uint64_t request_id,
     const base::DictionaryValue& reply,
     ErrorPtr error) {
-  device_state_update_pending_ = false;
+  auto request = std::find_if(
+      state_publish_requests_.begin(), state_publish_requests_.end(),
+      [request_id](const StatePublishRequest& request) {
+        return request.id == request_id;
+      });
+  CHECK(request != state_publish_requests_.end());
+  request->done = true;
+
+  // Adapt the flush window to the smoothed round-trip time.
+  base::TimeDelta rtt = base::Time::Now() - request->start_time;
+  state_publish_rtt_ = state_publish_rtt_.is_zero()
+                           ? rtt
+                           : (state_publish_rtt_ * 7 + rtt) / 8;
+  SetStatePublishLimits(state_publish_limits_);
   if (error) {
     LOG(ERROR) << "Permanent failure while trying to update device state";
-    return;
+    request->update_id = 0;
+    pending_state_changes_.clear();
+  } else {
+    WEAVE_RECORD_LATENCY(metrics_, "state_propagation",
+                         base::Time::Now() - request->oldest_change_time);
   }
-  component_manager_->NotifyStateUpdatedOnServer(update_id);
+
+  // Replies may arrive out of order, but the update IDs are acknowledged in
+  // the order the requests were sent.
+  while (!state_publish_requests_.empty() &&
+         state_publish_requests_.front().done) {
+    ComponentManager::UpdateID update_id =
+        state_publish_requests_.front().update_id;
+    state_publish_requests_.pop_front();
+    if (update_id)
+      component_manager_->NotifyStateUpdatedOnServer(update_id);
+  }
+  if (error)
+    return;
   // See if there were more pending state updates since the previous request
   // had been sent out.
   PublishStateUpdates();
@@ -1253,9 +2633,27 @@ void DeviceRegistrationInfo::OnTraitDefsChanged() {
   UpdateDeviceResource(base::Bind(&IgnoreCloudError));
 }
 
+void DeviceRegistrationInfo::SpoolStateUpdates() {
+  // The changes are spooled only while they can't be sent.
+  if (!state_spool_ ||
+      (connected_to_cloud_ && !cloud_offline_ &&
+       GetStatePublishRequestsInFlight() <
+           state_publish_limits_.max_requests_in_flight)) {
+    return;
+  }
+  if (++state_updates_since_spool_ < state_spool_->policy().segment_size)
+    return;
+  state_updates_since_spool_ = 0;
+  auto snapshot = component_manager_->GetAndClearRecordedStateChanges();
+  state_spool_->Append(std::move(snapshot.state_changes), snapshot.update_id);
+}
+
 void DeviceRegistrationInfo::OnStateChanged() {
   VLOG(1) << "StateChanged notification received";
-  if (!HaveRegistrationCredentials() || !connected_to_cloud_)
+  if (!HaveRegistrationCredentials())
+    return;
+  SpoolStateUpdates();
+  if (!connected_to_cloud_)
     return;
 
   // TODO(vitalybuka): Integrate BackoffEntry.
@@ -1275,7 +2673,12 @@ void DeviceRegistrationInfo::OnConnected(const std::string& channel_name) {
             << channel_name;
   CHECK_EQ(primary_notification_channel_->GetName(), channel_name);
   notification_channel_starting_ = false;
-  StopPullChannel();
+  // Keep polling, at a low rate, until the channel is confirmed to work, so
+  // commands aren't missed if it breaks right away.
+  if (pull_channel_) {
+    pull_channel_->UpdatePullInterval(
+        base::TimeDelta::FromSeconds(kUnconfirmedPollingPeriodSeconds));
+  }
   current_notification_channel_ = primary_notification_channel_.get();
 
   // If we have not successfully connected to the cloud server and we have not
@@ -1295,13 +2698,25 @@ void DeviceRegistrationInfo::OnConnected(const std::string& channel_name) {
                             AsWeakPtr(), fetch_reason::kRegularPull)));
 }
 
+void DeviceRegistrationInfo::OnConnectionConfirmed(
+    const std::string& channel_name) {
+  VLOG(1) << "Notification channel " << channel_name << " confirmed";
+  if (!primary_notification_channel_ ||
+      primary_notification_channel_->GetName() != channel_name) {
+    return;
+  }
+  StopPullChannel();
+}
+
 void DeviceRegistrationInfo::OnDisconnected() {
   LOG(INFO) << "Notification channel disconnected";
   if (!HaveRegistrationCredentials() || !connected_to_cloud_)
     return;
 
-  // Restart polling.
+  // Restart polling, and pull right away rather than waiting for the first
+  // poll, since the commands pushed while the channel was dying are lost.
   StartPullChannel();
+  FetchAndPublishCommands(fetch_reason::kChannelLost);
   UpdateDeviceResource(base::Bind(&IgnoreCloudError));
 }
 
@@ -1312,6 +2727,12 @@ void DeviceRegistrationInfo::OnPermanentFailure() {
       base::Bind(&DeviceRegistrationInfo::CheckAccessTokenError, AsWeakPtr()));
 }
 
+bool DeviceRegistrationInfo::IsCommandKnown(
+    const std::string& command_id) const {
+  return recent_command_ids_.Contains(command_id) ||
+         component_manager_->FindCommand(command_id);
+}
+
 void DeviceRegistrationInfo::OnCommandCreated(
     const base::DictionaryValue& command,
     const std::string& /* channel_name */) {
@@ -1320,7 +2741,20 @@ void DeviceRegistrationInfo::OnCommandCreated(
 
   VLOG(1) << "Command notification received: " << command;
 
-  // Manually fetch the command queue whenever a new command is received.
+  if (!command.empty()) {
+    // Queue the pushed command right away, without listing the queue. The
+    // commands pushed while the notification channel was down are fetched
+    // once it's back, in OnConnected(), and other lost pushes by the
+    // periodic resync. |last_command_time_ms_| is left alone, so those
+    // fetches also list them.
+    CommandBatch batch;
+    AddCommandToBatch(command, &batch);
+    PublishCommandBatch(std::move(batch));
+    return;
+  }
+
+  // The command was too big for the notification channel, or the
+  // notification came from the pull channel, so fetch the command queue.
   FetchAndPublishCommands(fetch_reason::kNewCommand);
 }
 
@@ -1333,11 +2767,17 @@ void DeviceRegistrationInfo::OnDeviceDeleted(const std::string& cloud_id) {
   RemoveCredentials();
 }
 
+void DeviceRegistrationInfo::OnXmppKeepAliveChanged(base::TimeDelta interval) {
+  Config::Transaction change{config_};
+  change.set_xmpp_keepalive_interval(interval);
+}
+
 void DeviceRegistrationInfo::RemoveCredentials() {
   if (!HaveRegistrationCredentials())
     return;
 
   connected_to_cloud_ = false;
+  last_command_time_ms_ = 0;
 
   LOG(INFO) << "Device is unregistered from the cloud. Deleting credentials";
   if (auth_manager_)
@@ -1347,6 +2787,7 @@ void DeviceRegistrationInfo::RemoveCredentials() {
   // Keep cloud_id to switch to detect kInvalidCredentials after restart.
   change.set_robot_account("");
   change.set_refresh_token("");
+  change.set_device_resource_timestamp("");
   change.Commit();
 
   current_notification_channel_ = nullptr;
@@ -5,8 +5,10 @@
 #ifndef LIBWEAVE_SRC_DEVICE_REGISTRATION_INFO_H_
 #define LIBWEAVE_SRC_DEVICE_REGISTRATION_INFO_H_
 
+#include <deque>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
@@ -20,13 +22,20 @@
 #include <weave/provider/http_client.h>
 
 #include "src/backoff_entry.h"
+#include "src/commands/cloud_command_proxy.h"
 #include "src/commands/cloud_command_update_interface.h"
 #include "src/component_manager.h"
 #include "src/config.h"
 #include "src/data_encoding.h"
+#include "src/metrics.h"
 #include "src/notification/notification_channel.h"
 #include "src/notification/notification_delegate.h"
 #include "src/notification/pull_channel.h"
+#include "src/notification/recent_command_ids.h"
+#include "src/request_slots.h"
+#include "src/states/state_spool.h"
+#include "src/traffic_stats.h"
+#include "src/worker_task.h"
 
 namespace base {
 class DictionaryValue;
@@ -34,11 +43,15 @@ class DictionaryValue;
 
 namespace weave {
 
+class JsonStreamReader;
+class JsonStreamWriter;
 class StateManager;
 
 namespace provider {
+class ConfigStore;
 class Network;
 class TaskRunner;
+class WorkerPool;
 }
 
 namespace privet {
@@ -47,18 +60,27 @@ class AuthManager;
 
 // The DeviceRegistrationInfo class represents device registration information.
 class DeviceRegistrationInfo : public NotificationDelegate,
-                               public CloudCommandUpdateInterface {
+                               public CloudCommandUpdateInterface,
+                               private RequestSlots::Client {
  public:
   using CloudRequestDoneCallback =
       base::Callback<void(const base::DictionaryValue& response,
                           ErrorPtr error)>;
+  // |response| is null if |error| is set.
+  using CloudStreamDoneCallback =
+      base::Callback<void(JsonStreamReader* response, ErrorPtr error)>;
 
   DeviceRegistrationInfo(Config* config,
                          ComponentManager* component_manager,
                          provider::TaskRunner* task_runner,
                          provider::HttpClient* http_client,
                          provider::Network* network,
-                         privet::AuthManager* auth_manager);
+                         privet::AuthManager* auth_manager,
+                         Metrics* metrics = nullptr,
+                         RequestSlots* shared_request_slots = nullptr,
+                         RetryBudget* shared_retry_budget = nullptr,
+                         provider::WorkerPool* worker_pool = nullptr,
+                         base::Clock* clock = nullptr);
 
   ~DeviceRegistrationInfo() override;
 
@@ -107,6 +129,10 @@ class DeviceRegistrationInfo : public NotificationDelegate,
   void UpdateCommand(const std::string& command_id,
                      const base::DictionaryValue& command_patch,
                      const DoneCallback& callback) override;
+  // Uploads a blob of a command (override from CloudCommandUpdateInterface).
+  void UploadCommandBlob(const std::string& command_id,
+                         const CommandInstance::Blob& blob,
+                         const DoneCallback& callback) override;
 
   // TODO(vitalybuka): remove getters and pass config to dependent code.
   const Config::Settings& GetSettings() const { return config_->GetSettings(); }
@@ -117,6 +143,64 @@ class DeviceRegistrationInfo : public NotificationDelegate,
   // Checks whether we have credentials generated during registration.
   bool HaveRegistrationCredentials() const;
 
+  // Limits the rate and the size of the patchState requests.
+  struct StatePublishLimits {
+    // Minimal time between the starts of two consecutive requests. The actual
+    // flush window follows the observed request round-trip time divided by
+    // |max_requests_in_flight|, within [min_interval, max_interval], so
+    // changes keep accumulating into fewer requests while the server is slow
+    // to respond.
+    base::TimeDelta min_interval;
+    base::TimeDelta max_interval;
+    // Maximal number of state patches sent in a single request.
+    size_t max_batch_size;
+    // Maximal number of requests waiting for the server reply.
+    size_t max_requests_in_flight;
+  };
+  void SetStatePublishLimits(const StatePublishLimits& limits);
+
+  // Enables sending only the changed parts of the device resource, when the
+  // server copy of the resource is known from a previous update. Enabled by
+  // default.
+  void SetDeviceResourceDeltaUpdatesEnabled(bool enabled);
+
+  // Returns what is known about the server copy of the device resource: the
+  // cloud ID, the resource timestamp, digests of the uploaded parts and the
+  // fingerprint of the trait definitions, or nullptr if it is unknown.
+  // Passing it to RestoreResourceSnapshot() after a restart lets the first
+  // update send only the parts changed meanwhile.
+  std::unique_ptr<base::DictionaryValue> SaveResourceSnapshot() const;
+  // Ignored if |snapshot| is from another registration. Only the trait
+  // fingerprint is restored if the delta updates are disabled.
+  void RestoreResourceSnapshot(const base::DictionaryValue& snapshot);
+  // Sets callback which is called after the device resource is updated on
+  // the server, so the new snapshot can be saved.
+  void AddResourceUploadedCallback(const base::Closure& callback);
+
+  // Spools the state changes which can't be sent to the server to
+  // |config_store|, see Device::EnableStateSpool().
+  void EnableStateSpool(provider::ConfigStore* config_store,
+                        const StateSpoolPolicy& policy);
+
+  // Lets the notification channels, retries and token refreshes share
+  // wake-ups. Should be called before the cloud connection is started.
+  void SetWakeWindowScheduler(WakeWindowScheduler* scheduler);
+
+  // Limits of the cloud replies and of the XMPP stanzas and notifications,
+  // see Device::SetInputLimits(). The XMPP channel gets them when it's
+  // started.
+  void SetInputLimits(const InputLimits& limits);
+
+  // Adds the approximate memory usage of the "cloudCommandUpdates" not sent
+  // yet and of the "statePublishQueue" to |stats|.
+  void GetMemoryStats(base::DictionaryValue* stats) const;
+  // Releases the spare capacity of the queues.
+  void CompactMemory();
+
+  // Returns the requests and bytes exchanged with the cloud, see
+  // Device::GetTrafficStats().
+  std::unique_ptr<base::DictionaryValue> GetTrafficStats() const;
+
  private:
   friend class DeviceRegistrationInfoTest;
 
@@ -134,6 +218,13 @@ class DeviceRegistrationInfo : public NotificationDelegate,
   // its own later.
   void ScheduleCloudConnection(const base::TimeDelta& delay);
 
+  // Posts |task| which may be late by up to |slack| to share a wake-up with
+  // other network activity.
+  void PostDeferrableTask(const tracked_objects::Location& from_here,
+                          const base::Closure& task,
+                          base::TimeDelta delay,
+                          base::TimeDelta slack);
+
   // Initiates the connection to the cloud server.
   // Device will do required start up chores and then start to listen
   // to new commands.
@@ -141,14 +232,21 @@ class DeviceRegistrationInfo : public NotificationDelegate,
   // Notification called when ConnectToCloud() succeeds.
   void OnConnectedToCloud(ErrorPtr error);
 
-  // Forcibly refreshes the access token.
+  // Forcibly refreshes the access token. Only one refresh request is sent at
+  // a time, callers which come while it is in progress wait for its result.
   void RefreshAccessToken(const DoneCallback& callback);
 
-  // Callbacks for RefreshAccessToken().
+  // Helpers for RefreshAccessToken().
+  void SendRefreshAccessTokenRequest();
   void OnRefreshAccessTokenDone(
-      const DoneCallback& callback,
       std::unique_ptr<provider::HttpClient::Response> response,
       ErrorPtr error);
+  void OnRefreshAccessTokenFinished(ErrorPtr error);
+
+  // Sets the access token expiration and schedules a refresh shortly before
+  // it, so requests don't have to fail with 401 first.
+  void SetAccessTokenExpiration(base::TimeDelta expires_in);
+  void OnAccessTokenAboutToExpire(base::Time expiration);
 
   // Parse the OAuth response, and sets registration status to
   // kInvalidCredentials if our registration is no longer valid.
@@ -164,29 +262,112 @@ class DeviceRegistrationInfo : public NotificationDelegate,
   void StartPullChannel();
   void StopPullChannel();
 
+  // Priorities of cloud requests, from the most urgent one. When too many
+  // requests are in flight, the queued ones are sent in this order.
+  enum class CloudRequestPriority {
+    kCommand,   // Command queue fetches and command updates.
+    kState,     // State patches.
+    kResource,  // Device resource reads and updates.
+    kAuthInfo,  // Local auth info uploads.
+  };
+
   // Do a HTTPS request to cloud services.
   // Handles many cases like reauthorization, 5xx HTTP response codes
   // and device removal.  It is a recommended way to do cloud API
   // requests.
+  // A GET request for the URL of another GET which has not completed yet is
+  // not sent, |callback| gets the result of the earlier request instead.
   // TODO(antonm): Consider moving into some other class.
-  void DoCloudRequest(provider::HttpClient::Method method,
+  void DoCloudRequest(CloudRequestPriority priority,
+                      provider::HttpClient::Method method,
                       const std::string& url,
                       const base::DictionaryValue* body,
                       const CloudRequestDoneCallback& callback);
+  // Same as above, with the request |body| already serialized to JSON, e.g.
+  // with JsonStreamWriter.
+  void DoCloudRequest(CloudRequestPriority priority,
+                      provider::HttpClient::Method method,
+                      const std::string& url,
+                      std::string body,
+                      const CloudRequestDoneCallback& callback);
+  // Same as above, but the JSON body of a successful response isn't parsed
+  // up front, |callback| reads it with JsonStreamReader. These requests are
+  // never joined with other GETs.
+  void DoStreamedCloudRequest(CloudRequestPriority priority,
+                              provider::HttpClient::Method method,
+                              const std::string& url,
+                              std::string body,
+                              const CloudStreamDoneCallback& callback);
 
   // Helper for DoCloudRequest().
   struct CloudRequestData {
     provider::HttpClient::Method method;
     std::string url;
     std::string body;
+    // Content-Encoding of |body|, empty if it is not compressed.
+    std::string content_encoding;
+    // Set instead of |body| for binary uploads, which are streamed from the
+    // shared data on every attempt.
+    std::shared_ptr<const std::vector<uint8_t>> blob;
+    std::string blob_content_type;
+    // Not set for GET requests, their callers wait in |cloud_get_callbacks_|.
     CloudRequestDoneCallback callback;
+    // Set instead of |callback| by DoStreamedCloudRequest().
+    CloudStreamDoneCallback stream_callback;
+    // Only set when recording metrics.
+    base::TimeTicks start_time;
+    // Name of the request in the metrics and the traffic stats.
+    std::string label;
   };
+  void QueueCloudRequest(CloudRequestPriority priority,
+                         const std::shared_ptr<CloudRequestData>& data);
+  // Sends queued requests, by priority, while there are free slots.
+  void SendQueuedCloudRequests();
+  // Releases the slot of the request and records its metrics.
+  void ReleaseCloudRequest(const CloudRequestData& data, bool failed);
+  // Releases the slot of the request and passes its result to the caller.
+  void FinishCloudRequest(const std::shared_ptr<const CloudRequestData>& data,
+                          const base::DictionaryValue& response,
+                          ErrorPtr error);
+  // Same as above, for the successful response of a streamed request.
+  void FinishStreamedCloudRequest(
+      const std::shared_ptr<const CloudRequestData>& data,
+      const provider::HttpClient::Response& response);
+  // Passes the result of a GET request to all the callers waiting for it.
+  void OnCloudGetRequestDone(const std::string& url,
+                             const base::DictionaryValue& response,
+                             ErrorPtr error);
+  // Returns the headers of a cloud request with a plain or a gzip body.
+  const provider::HttpClient::Headers& GetCloudRequestHeaders(bool gzip_body);
   void SendCloudRequest(const std::shared_ptr<const CloudRequestData>& data);
   void OnCloudRequestDone(
       const std::shared_ptr<const CloudRequestData>& data,
       std::unique_ptr<provider::HttpClient::Response> response,
       ErrorPtr error);
+  // The JSON body of a cloud response, parsed on the worker pool if it's
+  // large.
+  struct ParsedResponse {
+    std::unique_ptr<base::DictionaryValue> json;
+    ErrorPtr error;
+  };
+  // Runs on the worker pool, if any.
+  static ParsedResponse ParseCloudResponse(
+      const std::shared_ptr<const provider::HttpClient::Response>& response,
+      const InputLimits& limits);
+  void OnCloudResponseParsed(
+      const std::shared_ptr<const CloudRequestData>& data,
+      const std::shared_ptr<const provider::HttpClient::Response>& response,
+      ParsedResponse parsed);
+  // Holds back cloud requests for as long as the Retry-After header of
+  // |response| asks.
+  void HonorRetryAfter(const provider::HttpClient::Response& response);
+  // Retries a failed request. Too many failures in a row switch to the
+  // offline mode, where only one of the failed requests is retried, as a
+  // probe, and the rest of the cloud work waits for it to get through.
   void RetryCloudRequest(const std::shared_ptr<const CloudRequestData>& data);
+  void SetCloudOnline();
+  // Sends the requests and the work held back while offline.
+  void ResumeCloudWork();
   void OnAccessTokenRefreshed(
       const std::shared_ptr<const CloudRequestData>& data,
       ErrorPtr error);
@@ -194,6 +375,9 @@ class DeviceRegistrationInfo : public NotificationDelegate,
 
   void UpdateDeviceResource(const DoneCallback& callback);
   void StartQueuedUpdateDeviceResource();
+  // Sends the whole device resource to |url|. |components_json| is the
+  // serialized components, if they were written ahead on the worker pool.
+  void PutDeviceResource(const std::string& url, std::string components_json);
   void OnUpdateDeviceResourceDone(const base::DictionaryValue& device_info,
                                   ErrorPtr error);
   void OnUpdateDeviceResourceError(ErrorPtr error);
@@ -208,52 +392,133 @@ class DeviceRegistrationInfo : public NotificationDelegate,
   void OnDeviceInfoRetrieved(const base::DictionaryValue& device_info,
                              ErrorPtr error);
 
-  // Extracts the timestamp from the device resource and sets it to
-  // |last_device_resource_updated_timestamp_|.
+  // Extracts the timestamp from the device resource and saves it in the
+  // config.
   // Returns false if the "lastUpdateTimeMs" field is not found in the device
   // resource or it is invalid.
   bool UpdateDeviceInfoTimestamp(const base::DictionaryValue& device_info);
-
-  void FetchCommands(
-      const base::Callback<void(const base::ListValue&, ErrorPtr)>& callback,
-      const std::string& reason);
-  void OnFetchCommandsDone(
-      const base::Callback<void(const base::ListValue&, ErrorPtr)>& callback,
-      const base::DictionaryValue& json,
-      ErrorPtr);
+  void SetDeviceResourceTimestamp(const std::string& timestamp);
+
+  // The new commands of a fetched queue, which is read one command at a time
+  // so the whole response is never kept as base::Value.
+  struct CommandBatch {
+    std::vector<std::unique_ptr<CommandInstance>> commands;
+    std::set<std::string> ids;
+    // IDs of the commands which failed to parse, with the errors. They are
+    // aborted together once the valid commands are queued.
+    std::vector<std::pair<std::string, ErrorPtr>> aborted;
+    // IDs of the commands past their "expirationTimeMs", which are reported
+    // expired together without being parsed.
+    std::vector<std::pair<std::string, ErrorPtr>> expired;
+  };
+  using FetchedCommandCallback =
+      base::Callback<void(const base::DictionaryValue& command,
+                          CommandBatch* batch)>;
+
+  // Fetches the command queue and passes every command in it to |callback|
+  // as soon as it is read.
+  void FetchCommands(const FetchedCommandCallback& callback,
+                     const std::string& reason);
+  void OnFetchCommandsDone(const FetchedCommandCallback& callback,
+                           JsonStreamReader* response,
+                           ErrorPtr error);
+  // Reads the "commands" list of |response|. Updates |last_command_time_ms|
+  // with the creation times of the commands.
+  bool ReadCommandQueue(JsonStreamReader* response,
+                        const FetchedCommandCallback& callback,
+                        CommandBatch* batch,
+                        int64_t* last_command_time_ms,
+                        ErrorPtr* error);
   // Called when FetchCommands completes (with either success or error).
   // This method reschedules any pending/queued fetch requests.
   void OnFetchCommandsReturned();
 
-  // Processes the command list that is fetched from the server on connection.
-  // Aborts commands which are in transitional states and publishes queued
-  // commands which are queued.
-  void ProcessInitialCommandList(const base::ListValue& commands,
-                                 ErrorPtr error);
+  // Processes a command of the list that is fetched from the server on
+  // connection. Aborts commands which are in transitional states and adds
+  // the queued ones to |batch|.
+  void ProcessInitialCommand(const base::DictionaryValue& command,
+                             CommandBatch* batch);
 
   void PublishCommands(const base::ListValue& commands, ErrorPtr error);
-  void PublishCommand(const base::DictionaryValue& command);
+  // Parses |command| fetched from the server and adds it to |batch| if it is
+  // new.
+  void AddCommandToBatch(const base::DictionaryValue& command,
+                         CommandBatch* batch);
+  // Adds the commands of |batch| to the command queue at once.
+  void PublishCommandBatch(CommandBatch batch);
 
   // Helper function to pull the pending command list from the server using
   // FetchCommands() and make them available on D-Bus with PublishCommands().
   // |backup_fetch| is set to true when performing backup ("just-in-case")
   // command fetch while XMPP channel is up and running.
   void FetchAndPublishCommands(const std::string& reason);
-
+  // Schedules a fetch of the command queue after a long period without any,
+  // unless one is scheduled already.
+  void ScheduleCommandResync();
+  // Fetches the command queue if it hasn't been fetched since the resync was
+  // scheduled, or schedules the next resync otherwise.
+  void ResyncCommands();
+
+  // Sends the recorded state changes to the server, unless a request is in
+  // flight or the flush window since the last request hasn't passed yet.
   void PublishStateUpdates();
-  void OnPublishStateDone(ComponentManager::UpdateID update_id,
+  void OnStatePublishWindowElapsed();
+  // Sends the next batch of the state changes in a patchState request.
+  void SendStateUpdates();
+  // Moves the recorded state changes to |state_spool_| once enough state
+  // updates are waiting for the server.
+  void SpoolStateUpdates();
+  void OnPublishStateDone(uint64_t request_id,
                           const base::DictionaryValue& reply,
                           ErrorPtr error);
+  // Returns the number of patchState requests waiting for the server reply.
+  size_t GetStatePublishRequestsInFlight() const;
   void OnPublishStateError(ErrorPtr error);
 
-  // If unrecoverable error occurred (e.g. error parsing command instance),
-  // notify the server that the command is aborted by the device.
-  void NotifyCommandAborted(const std::string& command_id, ErrorPtr error);
+  // Sends the queued command updates, while fewer than the allowed number of
+  // them are in flight.
+  void SendCommandUpdates();
+  void OnCommandUpdateDone(const DoneCallback& callback,
+                           const base::DictionaryValue& reply,
+                           ErrorPtr error);
 
-  // Builds Cloud API devices collection REST resource which matches
+  // If unrecoverable error occurred (e.g. error parsing command instance),
+  // notify the server that the |commands| are aborted by the device, or
+  // expired, as given by |state|. The updates are queued at once, skipping
+  // the commands already being aborted.
+  void NotifyCommandsAborted(
+      Command::State state,
+      std::vector<std::pair<std::string, ErrorPtr>> commands);
+  void OnCommandAbortDone(const std::string& command_id, ErrorPtr error);
+
+  // Writes Cloud API devices collection REST resource which matches
   // current state of the device including command definitions
-  // for all supported commands and current device state.
-  std::unique_ptr<base::DictionaryValue> BuildDeviceResource() const;
+  // for all supported commands and current device state. If
+  // |trait_reference| is set and the server already has the current trait
+  // definitions, only their fingerprint is written instead. The components
+  // are written from |components_json| if it isn't empty.
+  void WriteDeviceResource(JsonStreamWriter* writer,
+                           bool trait_reference = false,
+                           const std::string& components_json = {}) const;
+  // Returns the device resource members other than traits and components.
+  std::unique_ptr<base::DictionaryValue> BuildDeviceResourceHeader() const;
+
+  // SHA-256 digests of the device resource parts, keyed by their path, e.g.
+  // "components" for all the components, "components/lamp" for the root level
+  // component "lamp", "components/lamp/state" for its state or
+  // "device/channel" for the "channel" member. Keys are escaped as in JSON
+  // pointers.
+  using ResourceDigests = std::map<std::string, std::string>;
+  ResourceDigests GetDeviceResourceDigests() const;
+  // Recomputes |trait_digests_| and |traits_fingerprint_| if the trait
+  // definitions changed since the last call.
+  void UpdateTraitDigests() const;
+  // Writes a JSON merge patch with the parts of the device resource which
+  // differ from |uploaded_resource_digests_|, where |digests| are the current
+  // ones. Removed parts are set to null, at any depth. Returns false and
+  // writes nothing if there are no changes.
+  bool WriteDeviceResourcePatch(const ResourceDigests& digests,
+                                JsonStreamWriter* writer) const;
 
   void SetGcdState(GcdState new_state);
   void SetDeviceId(const std::string& cloud_id);
@@ -265,12 +530,20 @@ class DeviceRegistrationInfo : public NotificationDelegate,
 
   // Overrides from NotificationDelegate.
   void OnConnected(const std::string& channel_name) override;
+  void OnConnectionConfirmed(const std::string& channel_name) override;
   void OnDisconnected() override;
   void OnPermanentFailure() override;
+  bool IsCommandKnown(const std::string& command_id) const override;
   void OnCommandCreated(const base::DictionaryValue& command,
                         const std::string& channel_name) override;
   void OnDeviceDeleted(const std::string& cloud_id) override;
 
+  // Overrides from RequestSlots::Client.
+  void OnRequestSlotAvailable() override;
+
+  // Remembers the XMPP keepalive interval learned for the current network.
+  void OnXmppKeepAliveChanged(base::TimeDelta interval);
+
   // Wipes out the device registration information and stops server connections.
   void RemoveCredentials();
 
@@ -296,8 +569,51 @@ class DeviceRegistrationInfo : public NotificationDelegate,
   // Transient data
   std::string access_token_;
   base::Time access_token_expiration_;
-  // The time stamp of last device resource update on the server.
-  std::string last_device_resource_updated_timestamp_;
+  // Callers waiting for the access token refresh in progress.
+  std::vector<DoneCallback> access_token_refresh_callbacks_;
+
+  // "<service_url>/devices/<cloud_id>/", rebuilt when either setting changes,
+  // so the device URLs are built with a single append.
+  struct DeviceUrlPrefix {
+    std::string service_url;
+    std::string cloud_id;
+    std::string prefix;
+  };
+  mutable DeviceUrlPrefix device_url_prefix_;
+
+  // The headers of the cloud requests, rebuilt when the access token or the
+  // compression setting changes.
+  struct CloudRequestHeaders {
+    std::string access_token;
+    bool accept_compressed{false};
+    provider::HttpClient::Headers plain;
+    provider::HttpClient::Headers gzip;
+  };
+  CloudRequestHeaders cloud_request_headers_;
+
+  // If set, the device resource is updated with a PATCH of the parts changed
+  // since the last successful update, instead of a PUT of the whole resource.
+  bool device_resource_delta_updates_enabled_{true};
+  // Digests of the device resource as the server has it, empty if unknown.
+  ResourceDigests uploaded_resource_digests_;
+  // Digests and the last state change of the device draft of the
+  // registration in progress.
+  ResourceDigests registration_resource_digests_;
+  ComponentManager::UpdateID registration_state_update_id_{0};
+  // Digests of the device resource update in flight.
+  ResourceDigests in_progress_resource_digests_;
+  // Size of the last full device resource, to reserve the next one at once.
+  size_t device_resource_size_{0};
+  // Digests of the traits section and the serialized traits they were
+  // computed from.
+  mutable ResourceDigests trait_digests_;
+  mutable std::string digested_traits_json_;
+  // Base64 SHA-256 of the serialized traits, which is exchanged with the
+  // server, unlike the digests.
+  mutable std::string traits_fingerprint_;
+  // Fingerprint of the trait definitions the server confirmed to keep, empty
+  // if unknown or if the server doesn't support trait references.
+  std::string acknowledged_traits_fingerprint_;
   // Set to true if the device has connected to the cloud server correctly.
   // At this point, normal state and command updates can be dispatched to the
   // server.
@@ -307,20 +623,107 @@ class DeviceRegistrationInfo : public NotificationDelegate,
   provider::HttpClient* http_client_{nullptr};
 
   provider::TaskRunner* task_runner_{nullptr};
+  // Optional, aligns the deferrable tasks.
+  WakeWindowScheduler* wake_scheduler_{nullptr};
+  InputLimits input_limits_;
+  // Optional, parses the large cloud responses off the task runner thread.
+  provider::WorkerPool* worker_pool_{nullptr};
+  // Keeps the cloud responses in order, whether parsed on |worker_pool_| or
+  // not.
+  WorkerReplySequence cloud_response_sequence_;
 
   Config* config_{nullptr};
 
   // Global component manager.
   ComponentManager* component_manager_{nullptr};
 
+  // Retry budget shared by all the backoff entries below, and by the other
+  // devices of a DeviceRuntime.
+  RetryBudget own_retry_budget_;
+  RetryBudget* retry_budget_{nullptr};
   // Backoff manager for DoCloudRequest() method.
   std::unique_ptr<BackoffEntry::Policy> cloud_backoff_policy_;
   std::unique_ptr<BackoffEntry> cloud_backoff_entry_;
   std::unique_ptr<BackoffEntry> oauth2_backoff_entry_;
-
-  // Flag set to true while a device state update patch request is in flight
-  // to the cloud server.
-  bool device_state_update_pending_{false};
+  // Cloud requests waiting for a free slot, the most urgent ones first.
+  std::map<CloudRequestPriority,
+           std::deque<std::shared_ptr<const CloudRequestData>>>
+      cloud_request_queues_;
+  // Limits the requests sent and not finished yet, including retries. Shared
+  // by the devices of a DeviceRuntime.
+  std::unique_ptr<RequestSlots> own_request_slots_;
+  RequestSlots* request_slots_{nullptr};
+  // Slots of |request_slots_| taken by this device.
+  size_t cloud_requests_in_flight_{0};
+  // Cloud requests failed in a row, each of them retried.
+  int cloud_failures_{0};
+  // Set while the cloud is unreachable. Queued requests, command updates,
+  // command fetches, state patches and device resource updates aren't sent
+  // then. They stay in their queues, |fetch_commands_request_queued_| and
+  // the state changes recorded by the component manager.
+  bool cloud_offline_{false};
+  // The failed request retried while offline, and the ones waiting for it.
+  // The latter still hold their slots.
+  std::shared_ptr<const CloudRequestData> cloud_probe_;
+  std::deque<std::shared_ptr<const CloudRequestData>> offline_cloud_requests_;
+  // Callers of GET requests which have not completed yet, by URL.
+  std::map<std::string, std::vector<CloudRequestDoneCallback>>
+      cloud_get_callbacks_;
+  // Backoff shared by the CloudCommandProxy objects, so a failing server
+  // holds back updates of all the commands.
+  std::shared_ptr<BackoffEntry> command_update_backoff_entry_;
+  // Proxies of the cloud commands, which own themselves.
+  std::shared_ptr<CloudCommandProxy::ProxySet> cloud_command_proxies_{
+      std::make_shared<CloudCommandProxy::ProxySet>()};
+
+  // A command PATCH request waiting to be sent.
+  struct PendingCommandUpdate {
+    std::string url;
+    std::string body;
+    DoneCallback callback;
+  };
+  // Command updates in the order they were requested.
+  std::deque<PendingCommandUpdate> pending_command_updates_;
+  size_t command_updates_in_flight_{0};
+  // Commands with an abort or expiry queued or in flight, so the fetches done
+  // until the server knows don't abort them again.
+  std::set<std::string> aborting_command_ids_;
+  // Commands received lately, including the ones already removed from the
+  // queue, so another delivery of them is dropped.
+  RecentCommandIds recent_command_ids_{256};
+
+  // A patchState request sent to the cloud server. |done| is set once the
+  // server replies, and |update_id| is acknowledged after all the requests
+  // sent before are done too.
+  struct StatePublishRequest {
+    uint64_t id{0};
+    ComponentManager::UpdateID update_id{0};
+    base::Time start_time;
+    // Timestamp of the oldest state change in the request.
+    base::Time oldest_change_time;
+    bool done{false};
+  };
+  // patchState requests in the order they were sent.
+  std::deque<StatePublishRequest> state_publish_requests_;
+  uint64_t last_state_publish_request_id_{0};
+  // Set to true while waiting for the flush window to pass.
+  bool state_publish_scheduled_{false};
+  StatePublishLimits state_publish_limits_;
+  // Start time of the last patchState request.
+  base::Time last_state_publish_time_;
+  // Smoothed round-trip time of patchState requests.
+  base::TimeDelta state_publish_rtt_;
+  // Current minimal time between the starts of the patchState requests.
+  base::TimeDelta state_publish_window_;
+  // State changes not sent yet because of |state_publish_limits_|, and the
+  // update ID the server is notified about once all of them are sent.
+  std::deque<ComponentStateChange> pending_state_changes_;
+  ComponentManager::UpdateID pending_state_update_id_{0};
+  // Keeps the older state changes in the config store while they can't be
+  // sent, if enabled. They are sent before the ones recorded since.
+  std::unique_ptr<StateSpool> state_spool_;
+  // Number of state updates recorded since the last spooling.
+  size_t state_updates_since_spool_{0};
 
   // Set to true when command queue fetch request is in flight to the server.
   bool fetch_commands_request_sent_{false};
@@ -329,6 +732,14 @@ class DeviceRegistrationInfo : public NotificationDelegate,
   bool fetch_commands_request_queued_{false};
   // Specifies the reason for queued command fetch request.
   std::string queued_fetch_reason_;
+  // Set to true while a resync of the command queue is scheduled.
+  bool command_resync_scheduled_{false};
+  // Set to true when the command queue is fetched while a resync is
+  // scheduled, which then postpones it.
+  bool commands_fetched_since_resync_{false};
+  // Creation time of the newest command fetched from the server. Regular
+  // fetches only ask for commands that are not older than that.
+  int64_t last_command_time_ms_{0};
 
   using ResourceUpdateCallbackList = std::vector<DoneCallback>;
   // Callbacks for device resource update request currently in flight to the
@@ -347,11 +758,16 @@ class DeviceRegistrationInfo : public NotificationDelegate,
 
   provider::Network* network_{nullptr};
   privet::AuthManager* auth_manager_{nullptr};
+  Metrics* metrics_{nullptr};
+  // Shared with the requests in flight, which may outlive this object.
+  std::shared_ptr<TrafficStats> traffic_stats_{
+      std::make_shared<TrafficStats>()};
 
   // Tracks our GCD state.
   GcdState gcd_state_{GcdState::kUnconfigured};
 
   std::vector<Device::GcdStateChangedCallback> gcd_state_changed_callbacks_;
+  std::vector<base::Closure> resource_uploaded_callbacks_;
 
   base::WeakPtrFactory<DeviceRegistrationInfo> weak_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(DeviceRegistrationInfo);
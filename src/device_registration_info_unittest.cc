@@ -11,20 +11,27 @@
 #include <weave/provider/test/fake_task_runner.h>
 #include <weave/provider/test/mock_config_store.h>
 #include <weave/provider/test/mock_http_client.h>
+#include <weave/provider/test/mock_worker_pool.h>
 #include <weave/test/unittest_utils.h>
 
 #include "src/bind_lambda.h"
 #include "src/component_manager_impl.h"
+#include "src/data_encoding.h"
 #include "src/http_constants.h"
 #include "src/privet/auth_manager.h"
 #include "src/test/mock_clock.h"
 
 using testing::_;
+using testing::AllOf;
+using testing::AnyNumber;
 using testing::AtLeast;
+using testing::Contains;
+using testing::DoAll;
 using testing::HasSubstr;
 using testing::Invoke;
 using testing::InvokeWithoutArgs;
 using testing::Mock;
+using testing::Not;
 using testing::Return;
 using testing::ReturnRef;
 using testing::ReturnRefOfCopy;
@@ -38,6 +45,7 @@ using test::CreateDictionaryValue;
 using test::CreateValue;
 using provider::test::MockHttpClient;
 using provider::test::MockHttpClientResponse;
+using provider::test::MockWorkerPool;
 using provider::HttpClient;
 
 namespace {
@@ -87,12 +95,8 @@ std::string GetFormField(const std::string& data, const std::string& name) {
   return {};
 }
 
-std::unique_ptr<HttpClient::Response> ReplyWithJson(int status_code,
-                                                    const base::Value& json) {
-  std::string text;
-  base::JSONWriter::WriteWithOptions(
-      json, base::JSONWriter::OPTIONS_PRETTY_PRINT, &text);
-
+std::unique_ptr<HttpClient::Response> ReplyWithText(int status_code,
+                                                    const std::string& text) {
   std::unique_ptr<MockHttpClientResponse> response{
       new StrictMock<MockHttpClientResponse>};
   EXPECT_CALL(*response, GetStatusCode())
@@ -103,10 +107,18 @@ std::unique_ptr<HttpClient::Response> ReplyWithJson(int status_code,
       .WillRepeatedly(Return(http::kJsonUtf8));
   EXPECT_CALL(*response, GetData())
       .Times(AtLeast(1))
-      .WillRepeatedly(Return(text));
+      .WillRepeatedly(ReturnRefOfCopy(text));
   return std::move(response);
 }
 
+std::unique_ptr<HttpClient::Response> ReplyWithJson(int status_code,
+                                                    const base::Value& json) {
+  std::string text;
+  base::JSONWriter::WriteWithOptions(
+      json, base::JSONWriter::OPTIONS_PRETTY_PRINT, &text);
+  return ReplyWithText(status_code, text);
+}
+
 std::pair<std::string, std::string> GetAuthHeader() {
   return {http::kAuthorization,
           std::string("Bearer ") + test_data::kAccessToken};
@@ -124,6 +136,8 @@ std::pair<std::string, std::string> GetFormHeader() {
 
 class DeviceRegistrationInfoTest : public ::testing::Test {
  protected:
+  using CloudRequestPriority = DeviceRegistrationInfo::CloudRequestPriority;
+
   void SetUp() override {
     EXPECT_CALL(clock_, Now())
         .WillRepeatedly(Return(base::Time::FromTimeT(1450000000)));
@@ -132,7 +146,7 @@ class DeviceRegistrationInfoTest : public ::testing::Test {
 
   void ReloadDefaults(bool allow_endpoints_override) {
     EXPECT_CALL(config_store_, LoadDefaults(_))
-        .WillOnce(Invoke([allow_endpoints_override](Settings* settings) {
+        .WillOnce(Invoke([this, allow_endpoints_override](Settings* settings) {
           settings->client_id = test_data::kClientId;
           settings->client_secret = test_data::kClientSecret;
           settings->api_key = test_data::kApiKey;
@@ -147,12 +161,14 @@ class DeviceRegistrationInfoTest : public ::testing::Test {
           settings->service_url = test_data::kServiceUrl;
           settings->xmpp_endpoint = test_data::kXmppEndpoint;
           settings->allow_endpoints_override = allow_endpoints_override;
+          settings->cloud_compression_enabled = cloud_compression_enabled_;
           return true;
         }));
     config_.reset(new Config{&config_store_});
     dev_reg_.reset(new DeviceRegistrationInfo{
         config_.get(), &component_manager_, &task_runner_, &http_client_,
-        nullptr, &auth_});
+        nullptr, &auth_, nullptr, nullptr, nullptr,
+        use_worker_pool_ ? &worker_pool_ : nullptr});
     dev_reg_->Start();
   }
 
@@ -176,6 +192,47 @@ class DeviceRegistrationInfoTest : public ::testing::Test {
     dev_reg_->PublishCommands(commands, nullptr);
   }
 
+  void OnCommandCreated(const base::DictionaryValue& command) {
+    dev_reg_->connected_to_cloud_ = true;
+    dev_reg_->OnCommandCreated(command, "xmpp");
+  }
+
+  void FetchAndPublishCommands(const std::string& reason) {
+    dev_reg_->FetchAndPublishCommands(reason);
+  }
+
+  void UpdateDeviceResource(bool expect_success = true) {
+    if (dev_reg_->GetSettings().device_resource_timestamp.empty())
+      Config::Transaction{config_.get()}.set_device_resource_timestamp("123");
+    dev_reg_->UpdateDeviceResource(base::Bind(
+        [](bool expect_success, ErrorPtr error) {
+          EXPECT_EQ(expect_success, !error);
+        },
+        expect_success));
+  }
+
+  void DoCloudRequest(
+      CloudRequestPriority priority,
+      HttpClient::Method method,
+      const std::string& url,
+      std::string body,
+      const DeviceRegistrationInfo::CloudRequestDoneCallback& callback) {
+    dev_reg_->DoCloudRequest(priority, method, url, std::move(body), callback);
+  }
+
+  base::TimeDelta GetCloudBackoffDelay() const {
+    return dev_reg_->cloud_backoff_entry_->GetTimeUntilRelease();
+  }
+
+  void ResetCloudBackoff() { dev_reg_->cloud_backoff_entry_->Reset(); }
+
+  bool IsCloudOffline() const { return dev_reg_->cloud_offline_; }
+
+  void PublishStateUpdates() {
+    dev_reg_->connected_to_cloud_ = true;
+    dev_reg_->PublishStateUpdates();
+  }
+
   bool RefreshAccessToken(ErrorPtr* error) const {
     bool succeeded = false;
     auto callback = [](bool* succeeded, ErrorPtr* error, ErrorPtr in_error) {
@@ -204,6 +261,9 @@ class DeviceRegistrationInfoTest : public ::testing::Test {
   provider::test::FakeTaskRunner task_runner_;
   provider::test::MockConfigStore config_store_;
   StrictMock<MockHttpClient> http_client_;
+  bool cloud_compression_enabled_{false};
+  StrictMock<MockWorkerPool> worker_pool_;
+  bool use_worker_pool_{false};
   base::DictionaryValue data_;
   std::unique_ptr<Config> config_;
   test::MockClock clock_;
@@ -235,6 +295,32 @@ TEST_F(DeviceRegistrationInfoTest, GetServiceUrl) {
                      }));
 }
 
+TEST_F(DeviceRegistrationInfoTest, GetDeviceUrl) {
+  ReloadSettings(true, false);
+  std::string url = test_data::kServiceUrl;
+  url += "devices/";
+  url += test_data::kCloudId;
+  url += "/";
+  EXPECT_EQ(url, dev_reg_->GetDeviceUrl());
+  EXPECT_EQ(url + "patchState", dev_reg_->GetDeviceUrl("patchState"));
+  EXPECT_EQ(url + "commands?deviceId=1",
+            dev_reg_->GetDeviceUrl("commands", {{"deviceId", "1"}}));
+
+  // The cached prefix follows the settings.
+  {
+    Config::Transaction change{config_.get()};
+    change.set_cloud_id("new_id");
+  }
+  EXPECT_EQ(std::string{test_data::kServiceUrl} + "devices/new_id/patchState",
+            dev_reg_->GetDeviceUrl("patchState"));
+  {
+    Config::Transaction change{config_.get()};
+    change.set_service_url("https://example.com/weave");
+  }
+  EXPECT_EQ("https://example.com/weave/devices/new_id/patchState",
+            dev_reg_->GetDeviceUrl("patchState"));
+}
+
 TEST_F(DeviceRegistrationInfoTest, GetOAuthUrl) {
   EXPECT_EQ(test_data::kOAuthUrl, dev_reg_->GetOAuthUrl());
   std::string url = test_data::kOAuthUrl;
@@ -291,6 +377,105 @@ TEST_F(DeviceRegistrationInfoTest, HaveRegistrationCredentials) {
   EXPECT_TRUE(HaveRegistrationCredentials());
 }
 
+TEST_F(DeviceRegistrationInfoTest, RefreshAccessTokenBeforeExpiration) {
+  ReloadSettings(true, false);
+
+  // Leave other cloud requests, e.g. of the cloud connection, unanswered.
+  EXPECT_CALL(http_client_, SendRequest(_, _, _, _, _)).Times(AnyNumber());
+
+  std::vector<base::Time> refresh_times;
+  EXPECT_CALL(
+      http_client_,
+      SendRequest(HttpClient::Method::kPost, dev_reg_->GetOAuthUrl("token"),
+                  HttpClient::Headers{GetFormHeader()}, _, _))
+      .Times(2)
+      .WillRepeatedly(WithArgs<4>(
+          Invoke([this, &refresh_times](
+              const HttpClient::SendRequestCallback& callback) {
+            refresh_times.push_back(task_runner_.GetClock()->Now());
+            base::DictionaryValue json;
+            json.SetString("access_token", test_data::kAccessToken);
+            json.SetInteger("expires_in", 3600);
+            callback.Run(ReplyWithJson(200, json), nullptr);
+          })));
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPost,
+                                        HasSubstr("upsertLocalAuthInfo"), _,
+                                        _, _))
+      .WillRepeatedly(WithArgs<4>(
+          Invoke([](const HttpClient::SendRequestCallback& callback) {
+            base::DictionaryValue json;
+            callback.Run(ReplyWithJson(200, json), nullptr);
+          })));
+
+  EXPECT_TRUE(RefreshAccessToken(nullptr));
+  while (refresh_times.size() < 2 && task_runner_.GetTaskQueueSize() > 0)
+    task_runner_.RunOnce();
+  ASSERT_EQ(2u, refresh_times.size());
+  EXPECT_EQ(base::TimeDelta::FromMinutes(55),
+            refresh_times[1] - refresh_times[0]);
+}
+
+TEST_F(DeviceRegistrationInfoTest, SingleAccessTokenRefresh) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPost,
+                                        HasSubstr("upsertLocalAuthInfo"), _,
+                                        _, _))
+      .WillRepeatedly(WithArgs<4>(
+          Invoke([](const HttpClient::SendRequestCallback& callback) {
+            base::DictionaryValue json;
+            callback.Run(ReplyWithJson(200, json), nullptr);
+          })));
+  // Both requests are denied with the old token, and succeed with the new one.
+  for (const char* url : {"a", "b"}) {
+    EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPost, url,
+                                          Contains(GetAuthHeader()), _, _))
+        .WillOnce(WithArgs<4>(
+            Invoke([](const HttpClient::SendRequestCallback& callback) {
+              std::unique_ptr<MockHttpClientResponse> response{
+                  new StrictMock<MockHttpClientResponse>};
+              EXPECT_CALL(*response, GetStatusCode())
+                  .WillRepeatedly(Return(http::kDenied));
+              EXPECT_CALL(*response, GetData())
+                  .WillRepeatedly(ReturnRefOfCopy(std::string{}));
+              callback.Run(std::move(response), nullptr);
+            })));
+    EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPost, url,
+                                          Not(Contains(GetAuthHeader())), _, _))
+        .WillOnce(WithArgs<4>(
+            Invoke([](const HttpClient::SendRequestCallback& callback) {
+              base::DictionaryValue json;
+              callback.Run(ReplyWithJson(200, json), nullptr);
+            })));
+  }
+
+  HttpClient::SendRequestCallback refresh_callback;
+  EXPECT_CALL(
+      http_client_,
+      SendRequest(HttpClient::Method::kPost, dev_reg_->GetOAuthUrl("token"),
+                  HttpClient::Headers{GetFormHeader()}, _, _))
+      .WillOnce(SaveArg<4>(&refresh_callback));
+
+  int done_count = 0;
+  auto callback = [](int* done_count, const base::DictionaryValue& json,
+                     ErrorPtr error) {
+    EXPECT_FALSE(error);
+    ++*done_count;
+  };
+  DoCloudRequest(CloudRequestPriority::kState, HttpClient::Method::kPost, "a",
+                 "{}", base::Bind(callback, base::Unretained(&done_count)));
+  DoCloudRequest(CloudRequestPriority::kState, HttpClient::Method::kPost, "b",
+                 "{}", base::Bind(callback, base::Unretained(&done_count)));
+  EXPECT_EQ(0, done_count);
+
+  base::DictionaryValue json;
+  json.SetString("access_token", "new_token");
+  json.SetInteger("expires_in", 3600);
+  refresh_callback.Run(ReplyWithJson(200, json), nullptr);
+  EXPECT_EQ(2, done_count);
+}
+
 TEST_F(DeviceRegistrationInfoTest, CheckAuthenticationFailure) {
   ReloadSettings(true, false);
   EXPECT_EQ(GcdState::kConnecting, GetGcdState());
@@ -382,6 +567,847 @@ TEST_F(DeviceRegistrationInfoTest, GetDeviceInfo) {
   EXPECT_TRUE(succeeded);
 }
 
+TEST_F(DeviceRegistrationInfoTest, LargeResponseParsedOnWorkerPool) {
+  use_worker_pool_ = true;
+  ReloadSettings(true, false);
+  SetAccessToken();
+
+  std::string description(20000, 'a');
+  EXPECT_CALL(
+      http_client_,
+      SendRequest(HttpClient::Method::kGet, dev_reg_->GetDeviceUrl(), _, _, _))
+      .WillOnce(WithArgs<4>(Invoke(
+          [&description](const HttpClient::SendRequestCallback& callback) {
+            base::DictionaryValue json;
+            json.SetString("description", description);
+            callback.Run(ReplyWithJson(200, json), nullptr);
+          })));
+  std::string small_url = dev_reg_->GetDeviceUrl("small");
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet, small_url, _, _, _))
+      .WillOnce(WithArgs<4>(
+          Invoke([](const HttpClient::SendRequestCallback& callback) {
+            base::DictionaryValue json;
+            json.SetString("description", "small");
+            callback.Run(ReplyWithJson(200, json), nullptr);
+          })));
+  base::Closure worker_task;
+  base::Closure worker_reply;
+  EXPECT_CALL(worker_pool_, PostTaskAndReply(_, _, _))
+      .WillOnce(DoAll(SaveArg<1>(&worker_task), SaveArg<2>(&worker_reply)));
+
+  std::vector<std::string> results;
+  auto callback = [](std::vector<std::string>* results,
+                     const base::DictionaryValue& info, ErrorPtr error) {
+    EXPECT_FALSE(error);
+    std::string description;
+    EXPECT_TRUE(info.GetString("description", &description));
+    results->push_back(description);
+  };
+  dev_reg_->GetDeviceInfo(base::Bind(callback, base::Unretained(&results)));
+  EXPECT_TRUE(results.empty());
+
+  // Small responses are parsed right away, but don't overtake the large one.
+  DoCloudRequest(CloudRequestPriority::kResource, HttpClient::Method::kGet,
+                 small_url, {},
+                 base::Bind(callback, base::Unretained(&results)));
+  EXPECT_TRUE(results.empty());
+
+  // The provider runs the reply on the task runner thread.
+  worker_task.Run();
+  EXPECT_TRUE(results.empty());
+  worker_reply.Run();
+  EXPECT_EQ((std::vector<std::string>{description, "small"}), results);
+}
+
+TEST_F(DeviceRegistrationInfoTest, CompressedCloudRequest) {
+  cloud_compression_enabled_ = true;
+  ReloadSettings(true, false);
+  SetAccessToken();
+
+  std::string body = "{\"data\": \"" + std::string(2000, 'a') + "\"}";
+  std::string url = dev_reg_->GetDeviceUrl("patchState");
+  EXPECT_CALL(
+      http_client_,
+      SendRequest(HttpClient::Method::kPost, url,
+                  HttpClient::Headers{GetAuthHeader(), GetJsonHeader(),
+                                      {http::kContentEncoding, "gzip"},
+                                      {http::kAcceptEncoding, "gzip, deflate"}},
+                  _, _))
+      .WillOnce(WithArgs<3, 4>(
+          Invoke([&body](const std::string& data,
+                         const HttpClient::SendRequestCallback& callback) {
+            EXPECT_LT(data.size(), body.size());
+            std::string decoded;
+            EXPECT_TRUE(GzipDecode(data, 0, &decoded));
+            EXPECT_EQ(body, decoded);
+
+            std::string reply;
+            EXPECT_TRUE(GzipEncode(R"({"id": "1"})", &reply));
+            std::unique_ptr<MockHttpClientResponse> response{
+                new StrictMock<MockHttpClientResponse>};
+            EXPECT_CALL(*response, GetStatusCode())
+                .WillRepeatedly(Return(200));
+            EXPECT_CALL(*response, GetContentType())
+                .WillRepeatedly(Return(http::kJsonUtf8));
+            EXPECT_CALL(*response, GetHeader(http::kContentEncoding))
+                .WillRepeatedly(Return("gzip"));
+            EXPECT_CALL(*response, GetData())
+                .WillRepeatedly(ReturnRefOfCopy(reply));
+            callback.Run(std::move(response), nullptr);
+          })));
+
+  bool succeeded = false;
+  auto callback = [](bool* succeeded, const base::DictionaryValue& json,
+                     ErrorPtr error) {
+    EXPECT_FALSE(error);
+    std::string id;
+    EXPECT_TRUE(json.GetString("id", &id));
+    EXPECT_EQ("1", id);
+    *succeeded = true;
+  };
+  DoCloudRequest(CloudRequestPriority::kState, HttpClient::Method::kPost, url,
+                 body, base::Bind(callback, base::Unretained(&succeeded)));
+  EXPECT_TRUE(succeeded);
+}
+
+TEST_F(DeviceRegistrationInfoTest, CompressedCloudResponseOverLimit) {
+  cloud_compression_enabled_ = true;
+  ReloadSettings(true, false);
+  SetAccessToken();
+  InputLimits limits;
+  limits.max_size = 64 * 1024;
+  dev_reg_->SetInputLimits(limits);
+
+  // A small response which expands over the limit isn't decoded.
+  std::string url = dev_reg_->GetDeviceUrl("patchState");
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPost, url, _, _, _))
+      .WillOnce(WithArgs<4>(
+          Invoke([](const HttpClient::SendRequestCallback& callback) {
+            std::string reply;
+            EXPECT_TRUE(GzipEncode(
+                "{\"data\": \"" + std::string(1024 * 1024, 'a') + "\"}",
+                &reply));
+            EXPECT_LT(reply.size(), 64u * 1024);
+            std::unique_ptr<MockHttpClientResponse> response{
+                new StrictMock<MockHttpClientResponse>};
+            EXPECT_CALL(*response, GetHeader(http::kContentEncoding))
+                .WillRepeatedly(Return("gzip"));
+            EXPECT_CALL(*response, GetData())
+                .WillRepeatedly(ReturnRefOfCopy(reply));
+            callback.Run(std::move(response), nullptr);
+          })));
+
+  bool done = false;
+  auto callback = [](bool* done, const base::DictionaryValue& json,
+                     ErrorPtr error) { *done = true; };
+  DoCloudRequest(CloudRequestPriority::kState, HttpClient::Method::kPost, url,
+                 "{}", base::Bind(callback, base::Unretained(&done)));
+  EXPECT_FALSE(done);
+}
+
+TEST_F(DeviceRegistrationInfoTest, CloudRequestPriorities) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+
+  std::vector<std::string> sent_urls;
+  std::vector<HttpClient::SendRequestCallback> callbacks;
+  EXPECT_CALL(http_client_, SendRequest(_, _, _, _, _))
+      .WillRepeatedly(WithArgs<1, 4>(
+          Invoke([&sent_urls, &callbacks](
+              const std::string& url,
+              const HttpClient::SendRequestCallback& callback) {
+            sent_urls.push_back(url);
+            callbacks.push_back(callback);
+          })));
+
+  int done_count = 0;
+  auto callback = [](int* done_count, const base::DictionaryValue& json,
+                     ErrorPtr error) {
+    EXPECT_FALSE(error);
+    ++*done_count;
+  };
+  const std::pair<CloudRequestPriority, const char*> kRequests[] = {
+      {CloudRequestPriority::kAuthInfo, "a0"},
+      {CloudRequestPriority::kAuthInfo, "a1"},
+      {CloudRequestPriority::kAuthInfo, "a2"},
+      {CloudRequestPriority::kAuthInfo, "a3"},
+      {CloudRequestPriority::kAuthInfo, "auth"},
+      {CloudRequestPriority::kResource, "resource"},
+      {CloudRequestPriority::kCommand, "command"},
+  };
+  for (const auto& request : kRequests) {
+    DoCloudRequest(request.first, HttpClient::Method::kPost, request.second,
+                   "{}", base::Bind(callback, base::Unretained(&done_count)));
+  }
+  EXPECT_EQ((std::vector<std::string>{"a0", "a1", "a2", "a3"}), sent_urls);
+
+  // Each finished request lets the most urgent queued one go.
+  base::DictionaryValue reply;
+  for (size_t i = 0; i < callbacks.size(); ++i) {
+    // Copied, since later requests are added to |callbacks| while it runs.
+    auto send_callback = callbacks[i];
+    send_callback.Run(ReplyWithJson(200, reply), nullptr);
+  }
+  EXPECT_EQ((std::vector<std::string>{"a0", "a1", "a2", "a3", "command",
+                                      "resource", "auth"}),
+            sent_urls);
+  EXPECT_EQ(7, done_count);
+}
+
+TEST_F(DeviceRegistrationInfoTest, JoinCloudGetRequests) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+
+  HttpClient::SendRequestCallback send_callback;
+  EXPECT_CALL(
+      http_client_,
+      SendRequest(HttpClient::Method::kGet, dev_reg_->GetDeviceUrl(), _, _, _))
+      .WillOnce(SaveArg<4>(&send_callback));
+
+  std::vector<std::string> ids;
+  auto callback = [](std::vector<std::string>* ids,
+                     const base::DictionaryValue& info, ErrorPtr error) {
+    EXPECT_FALSE(error);
+    std::string id;
+    EXPECT_TRUE(info.GetString("id", &id));
+    ids->push_back(id);
+  };
+  dev_reg_->GetDeviceInfo(base::Bind(callback, base::Unretained(&ids)));
+  dev_reg_->GetDeviceInfo(base::Bind(callback, base::Unretained(&ids)));
+  EXPECT_TRUE(ids.empty());
+
+  base::DictionaryValue json;
+  json.SetString("id", test_data::kCloudId);
+  send_callback.Run(ReplyWithJson(200, json), nullptr);
+  EXPECT_EQ((std::vector<std::string>{test_data::kCloudId,
+                                      test_data::kCloudId}),
+            ids);
+  Mock::VerifyAndClearExpectations(&http_client_);
+
+  // A new request is sent once the earlier one is done.
+  EXPECT_CALL(
+      http_client_,
+      SendRequest(HttpClient::Method::kGet, dev_reg_->GetDeviceUrl(), _, _, _))
+      .WillOnce(WithArgs<4>(
+          Invoke([&json](const HttpClient::SendRequestCallback& callback) {
+            callback.Run(ReplyWithJson(200, json), nullptr);
+          })));
+  dev_reg_->GetDeviceInfo(base::Bind(callback, base::Unretained(&ids)));
+  EXPECT_EQ(3u, ids.size());
+}
+
+TEST_F(DeviceRegistrationInfoTest, TrafficStats) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+
+  base::DictionaryValue json;
+  json.SetString("id", test_data::kCloudId);
+  std::string reply;
+  base::JSONWriter::WriteWithOptions(
+      json, base::JSONWriter::OPTIONS_PRETTY_PRINT, &reply);
+  EXPECT_CALL(
+      http_client_,
+      SendRequest(HttpClient::Method::kGet, dev_reg_->GetDeviceUrl(), _, _, _))
+      .WillOnce(WithArgs<4>(
+          Invoke([&json](const HttpClient::SendRequestCallback& callback) {
+            callback.Run(ReplyWithJson(200, json), nullptr);
+          })));
+  dev_reg_->GetDeviceInfo(
+      base::Bind([](const base::DictionaryValue&, ErrorPtr) {}));
+
+  auto stats = dev_reg_->GetTrafficStats();
+  const base::DictionaryValue* total = nullptr;
+  ASSERT_TRUE(
+      stats->GetDictionaryWithoutPathExpansion("GET devices/*/", &total));
+  ASSERT_TRUE(total->GetDictionary("total", &total));
+  double value = 0;
+  EXPECT_TRUE(total->GetDouble("count", &value));
+  EXPECT_EQ(1, value);
+  EXPECT_TRUE(total->GetDouble("bytesSent", &value));
+  EXPECT_LT(dev_reg_->GetDeviceUrl().size(), value);
+  EXPECT_TRUE(total->GetDouble("bytesReceived", &value));
+  EXPECT_EQ(reply.size(), value);
+}
+
+TEST_F(DeviceRegistrationInfoTest, CloudRequestRetryAfter) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPost, "url", _,
+                                        _, _))
+      .WillOnce(WithArgs<4>(
+          Invoke([](const HttpClient::SendRequestCallback& callback) {
+            std::unique_ptr<MockHttpClientResponse> response{
+                new StrictMock<MockHttpClientResponse>};
+            EXPECT_CALL(*response, GetStatusCode())
+                .WillRepeatedly(Return(http::kServiceUnavailable));
+            EXPECT_CALL(*response, GetHeader(http::kRetryAfter))
+                .WillOnce(Return("120"));
+            EXPECT_CALL(*response, GetData())
+                .WillRepeatedly(ReturnRefOfCopy(std::string{}));
+            callback.Run(std::move(response), nullptr);
+          })));
+
+  DoCloudRequest(CloudRequestPriority::kState, HttpClient::Method::kPost,
+                 "url", "{}",
+                 base::Bind([](const base::DictionaryValue&, ErrorPtr) {}));
+  // Allow for the real time passed, which backoff is based on.
+  EXPECT_LE(base::TimeDelta::FromSeconds(119), GetCloudBackoffDelay());
+  EXPECT_GE(base::TimeDelta::FromSeconds(120), GetCloudBackoffDelay());
+}
+
+TEST_F(DeviceRegistrationInfoTest, CloudOfflineMode) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+
+  std::vector<std::string> sent_urls;
+  bool reachable = false;
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPost, _, _, _, _))
+      .WillRepeatedly(WithArgs<1, 4>(Invoke([&sent_urls, &reachable](
+          const std::string& url,
+          const HttpClient::SendRequestCallback& callback) {
+        sent_urls.push_back(url);
+        if (!reachable) {
+          ErrorPtr error;
+          Error::AddTo(&error, FROM_HERE, "network_error", "Unreachable");
+          callback.Run(nullptr, std::move(error));
+          return;
+        }
+        base::DictionaryValue reply;
+        callback.Run(ReplyWithJson(200, reply), nullptr);
+      })));
+
+  int done_count = 0;
+  auto callback = [](int* done_count, const base::DictionaryValue& json,
+                     ErrorPtr error) {
+    EXPECT_FALSE(error);
+    ++*done_count;
+  };
+  DoCloudRequest(CloudRequestPriority::kState, HttpClient::Method::kPost,
+                 "probe", "{}",
+                 base::Bind(callback, base::Unretained(&done_count)));
+  for (int i = 0; i < 3; ++i) {
+    ResetCloudBackoff();
+    task_runner_.RunOnce();
+  }
+  EXPECT_TRUE(IsCloudOffline());
+  EXPECT_EQ(4u, sent_urls.size());
+
+  // Only the probe is retried while offline.
+  sent_urls.clear();
+  DoCloudRequest(CloudRequestPriority::kState, HttpClient::Method::kPost,
+                 "held", "{}",
+                 base::Bind(callback, base::Unretained(&done_count)));
+  EXPECT_TRUE(sent_urls.empty());
+  ResetCloudBackoff();
+  task_runner_.RunOnce();
+  EXPECT_EQ(std::vector<std::string>{"probe"}, sent_urls);
+
+  reachable = true;
+  ResetCloudBackoff();
+  task_runner_.RunOnce();
+  EXPECT_FALSE(IsCloudOffline());
+  EXPECT_EQ((std::vector<std::string>{"probe", "probe", "held"}), sent_urls);
+  EXPECT_EQ(2, done_count);
+}
+
+TEST_F(DeviceRegistrationInfoTest, FetchCommandsIncrementally) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+
+  auto reply_with_commands =
+      [](const std::string& data,
+         const HttpClient::SendRequestCallback& callback) {
+        auto json = CreateDictionaryValue(R"({
+          'commands': [{'creationTimeMs': '2000'}, {'creationTimeMs': '1000'}]
+        })");
+        callback.Run(ReplyWithJson(200, *json), nullptr);
+      };
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet,
+                          AllOf(HasSubstr("commands/queue"),
+                                Not(HasSubstr("lastCommandTimeMs"))),
+                          _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply_with_commands)));
+  FetchAndPublishCommands("regular_pull");
+
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet,
+                          AllOf(HasSubstr("commands/queue"),
+                                HasSubstr("lastCommandTimeMs=2000")),
+                          _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply_with_commands)));
+  FetchAndPublishCommands("regular_pull");
+
+  // The initial fetch always lists the whole queue.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet,
+                          AllOf(HasSubstr("reason=device_start"),
+                                Not(HasSubstr("lastCommandTimeMs"))),
+                          _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply_with_commands)));
+  FetchAndPublishCommands("device_start");
+}
+
+TEST_F(DeviceRegistrationInfoTest, FetchCommandsMalformedQueue) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+
+  // The commands read before the error are dropped.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet,
+                          HasSubstr("commands/queue"), _, _, _))
+      .WillOnce(WithArgs<3, 4>(
+          Invoke([](const std::string& data,
+                    const HttpClient::SendRequestCallback& callback) {
+            callback.Run(ReplyWithText(200, R"({"commands": [
+              {"creationTimeMs": "2000"}, {"creationTimeMs": )"),
+                         nullptr);
+          })));
+  FetchAndPublishCommands("regular_pull");
+
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet,
+                          AllOf(HasSubstr("commands/queue"),
+                                Not(HasSubstr("lastCommandTimeMs"))),
+                          _, _, _))
+      .WillOnce(WithArgs<3, 4>(
+          Invoke([](const std::string& data,
+                    const HttpClient::SendRequestCallback& callback) {
+            callback.Run(ReplyWithText(200, "{}"), nullptr);
+          })));
+  FetchAndPublishCommands("regular_pull");
+}
+
+TEST_F(DeviceRegistrationInfoTest, PublishStateUpdatesInBatches) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+  dev_reg_->SetStatePublishLimits({base::TimeDelta::FromSeconds(1),
+                                   base::TimeDelta::FromSeconds(5), 2, 1});
+
+  auto json_traits = CreateDictionaryValue(R"({"t": {}})");
+  EXPECT_TRUE(component_manager_.LoadTraits(*json_traits, nullptr));
+  for (const char* name : {"comp1", "comp2", "comp3"}) {
+    EXPECT_TRUE(component_manager_.AddComponent("", name, {"t"}, nullptr));
+    EXPECT_TRUE(component_manager_.SetStateProperty(
+        name, "t.p", base::FundamentalValue{1}, nullptr));
+  }
+  task_runner_.RunPendingTasks();
+  std::vector<ComponentManager::UpdateID> updated_ids;
+  auto token = component_manager_.AddServerStateUpdatedCallback(
+      base::Bind([](std::vector<ComponentManager::UpdateID>* ids,
+                    ComponentManager::UpdateID id) { ids->push_back(id); },
+                 base::Unretained(&updated_ids)));
+
+  std::vector<size_t> batch_sizes;
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPost,
+                          dev_reg_->GetDeviceUrl("patchState"),
+                          HttpClient::Headers{GetAuthHeader(), GetJsonHeader()},
+                          _, _))
+      .Times(2)
+      .WillRepeatedly(WithArgs<3, 4>(Invoke([&batch_sizes](
+          const std::string& data,
+          const HttpClient::SendRequestCallback& callback) {
+        auto json = CreateDictionaryValue(data);
+        const base::ListValue* patches = nullptr;
+        EXPECT_TRUE(json->GetList("patches", &patches));
+        batch_sizes.push_back(patches->GetSize());
+        base::DictionaryValue reply;
+        callback.Run(ReplyWithJson(200, reply), nullptr);
+      })));
+
+  PublishStateUpdates();
+  // The second batch waits for the flush window.
+  EXPECT_EQ(std::vector<size_t>{2}, batch_sizes);
+  EXPECT_TRUE(updated_ids.empty());
+  task_runner_.RunOnce();
+  EXPECT_EQ((std::vector<size_t>{2, 1}), batch_sizes);
+  EXPECT_EQ(std::vector<ComponentManager::UpdateID>{
+                component_manager_.GetLastStateChangeId()},
+            updated_ids);
+}
+
+TEST_F(DeviceRegistrationInfoTest, PipelineStateUpdates) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+  dev_reg_->SetStatePublishLimits({base::TimeDelta::FromSeconds(1),
+                                   base::TimeDelta::FromSeconds(5), 100, 2});
+
+  auto json_traits = CreateDictionaryValue(R"({"t": {}})");
+  EXPECT_TRUE(component_manager_.LoadTraits(*json_traits, nullptr));
+  EXPECT_TRUE(component_manager_.AddComponent("", "comp", {"t"}, nullptr));
+  task_runner_.RunPendingTasks();
+  std::vector<ComponentManager::UpdateID> updated_ids;
+  auto token = component_manager_.AddServerStateUpdatedCallback(
+      base::Bind([](std::vector<ComponentManager::UpdateID>* ids,
+                    ComponentManager::UpdateID id) { ids->push_back(id); },
+                 base::Unretained(&updated_ids)));
+  updated_ids.clear();
+
+  std::vector<HttpClient::SendRequestCallback> replies;
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPost,
+                          dev_reg_->GetDeviceUrl("patchState"),
+                          HttpClient::Headers{GetAuthHeader(), GetJsonHeader()},
+                          _, _))
+      .Times(2)
+      .WillRepeatedly(WithArgs<4>(Invoke(
+          [&replies](const HttpClient::SendRequestCallback& callback) {
+            replies.push_back(callback);
+          })));
+
+  EXPECT_TRUE(component_manager_.SetStateProperty(
+      "comp", "t.p", base::FundamentalValue{1}, nullptr));
+  PublishStateUpdates();
+  auto update_id1 = component_manager_.GetLastStateChangeId();
+  EXPECT_TRUE(component_manager_.SetStateProperty(
+      "comp", "t.p", base::FundamentalValue{2}, nullptr));
+  auto update_id2 = component_manager_.GetLastStateChangeId();
+  // The second request is sent without waiting for the first reply.
+  task_runner_.RunOnce();
+  ASSERT_EQ(2u, replies.size());
+
+  // Out of order replies are acknowledged in order.
+  base::DictionaryValue json;
+  replies[1].Run(ReplyWithJson(200, json), nullptr);
+  EXPECT_TRUE(updated_ids.empty());
+  replies[0].Run(ReplyWithJson(200, json), nullptr);
+  EXPECT_EQ((std::vector<ComponentManager::UpdateID>{update_id1, update_id2}),
+            updated_ids);
+}
+
+TEST_F(DeviceRegistrationInfoTest, UpdateDeviceResourceDelta) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+  auto json_traits = CreateDictionaryValue(R"({"t1": {}, "t2": {}})");
+  EXPECT_TRUE(component_manager_.LoadTraits(*json_traits, nullptr));
+  EXPECT_TRUE(component_manager_.AddComponent("", "comp1", {"t1"}, nullptr));
+  EXPECT_TRUE(component_manager_.AddComponent("", "comp2", {"t2"}, nullptr));
+
+  std::string url = dev_reg_->GetDeviceUrl({}, {{"lastUpdateTimeMs", "123"}});
+  auto reply = [](const std::string& data,
+                  const HttpClient::SendRequestCallback& callback) {
+    base::DictionaryValue json;
+    json.SetString("lastUpdateTimeMs", "123");
+    json.SetString("certFingerprint",
+                   "FQY6BEINDjw3FgsmYChRWgMzMhc4TC8uG0UUUFhdDz0=");
+    callback.Run(ReplyWithJson(200, json), nullptr);
+  };
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPut, url,
+                          HttpClient::Headers{GetAuthHeader(), GetJsonHeader()},
+                          _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply)));
+  UpdateDeviceResource();
+  Mock::VerifyAndClearExpectations(&http_client_);
+
+  // No changes, no request.
+  UpdateDeviceResource();
+
+  EXPECT_TRUE(component_manager_.AddComponent("", "comp3", {"t1"}, nullptr));
+  EXPECT_TRUE(component_manager_.RemoveComponent("", "comp2", nullptr));
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPatch, url,
+                          HttpClient::Headers{GetAuthHeader(), GetJsonHeader()},
+                          _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(
+          [reply](const std::string& data,
+                  const HttpClient::SendRequestCallback& callback) {
+            EXPECT_JSON_EQ(R"({"components": {
+                                "comp2": null,
+                                "comp3": {"traits": ["t1"]}
+                              }})",
+                           *CreateDictionaryValue(data));
+            reply(data, callback);
+          })));
+  UpdateDeviceResource();
+  Mock::VerifyAndClearExpectations(&http_client_);
+
+  // Members removed deeper down are set to null too, or the server would
+  // keep them when merging the patch.
+  EXPECT_TRUE(component_manager_.AddComponent("comp1", "sub1", {"t1"},
+                                              nullptr));
+  EXPECT_TRUE(component_manager_.AddComponent("comp1", "sub2", {"t2"},
+                                              nullptr));
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPatch, url, _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply)));
+  UpdateDeviceResource();
+  Mock::VerifyAndClearExpectations(&http_client_);
+  EXPECT_TRUE(component_manager_.RemoveComponent("comp1", "sub1", nullptr));
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPatch, url, _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(
+          [reply](const std::string& data,
+                  const HttpClient::SendRequestCallback& callback) {
+            EXPECT_JSON_EQ(R"({"components": {
+                                "comp1": {"components": {"sub1": null}}
+                              }})",
+                           *CreateDictionaryValue(data));
+            reply(data, callback);
+          })));
+  UpdateDeviceResource();
+  Mock::VerifyAndClearExpectations(&http_client_);
+
+  // Falls back to a full update after a failure.
+  EXPECT_TRUE(component_manager_.AddComponent("", "comp4", {"t2"}, nullptr));
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPatch, url, _, _, _))
+      .WillOnce(WithArgs<4>(
+          Invoke([](const HttpClient::SendRequestCallback& callback) {
+            base::DictionaryValue json;
+            callback.Run(ReplyWithJson(400, json), nullptr);
+          })));
+  UpdateDeviceResource(false);
+  Mock::VerifyAndClearExpectations(&http_client_);
+  ResetCloudBackoff();
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPut, url, _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply)));
+  UpdateDeviceResource();
+}
+
+TEST_F(DeviceRegistrationInfoTest, UpdateDeviceResourceSavesTimestamp) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+  dev_reg_->SetDeviceResourceDeltaUpdatesEnabled(false);
+  auto reply = [](const std::string& timestamp) {
+    return [timestamp](const std::string& data,
+                       const HttpClient::SendRequestCallback& callback) {
+      base::DictionaryValue json;
+      json.SetString("lastUpdateTimeMs", timestamp);
+      json.SetString("certFingerprint",
+                     "FQY6BEINDjw3FgsmYChRWgMzMhc4TC8uG0UUUFhdDz0=");
+      callback.Run(ReplyWithJson(200, json), nullptr);
+    };
+  };
+
+  // The timestamp saved in the config is used without asking the server.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPut,
+                          dev_reg_->GetDeviceUrl({}, {{"lastUpdateTimeMs",
+                                                       "123"}}),
+                          _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply("456"))));
+  UpdateDeviceResource();
+  Mock::VerifyAndClearExpectations(&http_client_);
+  EXPECT_EQ("456", dev_reg_->GetSettings().device_resource_timestamp);
+
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPut,
+                          dev_reg_->GetDeviceUrl({}, {{"lastUpdateTimeMs",
+                                                       "456"}}),
+                          _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply("789"))));
+  UpdateDeviceResource();
+  EXPECT_EQ("789", dev_reg_->GetSettings().device_resource_timestamp);
+}
+
+TEST_F(DeviceRegistrationInfoTest, RestoreResourceSnapshot) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+  auto json_traits = CreateDictionaryValue(R"({"t1": {}})");
+  EXPECT_TRUE(component_manager_.LoadTraits(*json_traits, nullptr));
+  EXPECT_TRUE(component_manager_.AddComponent("", "comp1", {"t1"}, nullptr));
+  EXPECT_EQ(nullptr, dev_reg_->SaveResourceSnapshot());
+
+  std::string url = dev_reg_->GetDeviceUrl({}, {{"lastUpdateTimeMs", "123"}});
+  auto reply = [](const std::string& data,
+                  const HttpClient::SendRequestCallback& callback) {
+    base::DictionaryValue json;
+    json.SetString("lastUpdateTimeMs", "123");
+    json.SetString("certFingerprint",
+                   "FQY6BEINDjw3FgsmYChRWgMzMhc4TC8uG0UUUFhdDz0=");
+    callback.Run(ReplyWithJson(200, json), nullptr);
+  };
+  int uploaded = 0;
+  dev_reg_->AddResourceUploadedCallback(
+      base::Bind([](int* uploaded) { ++*uploaded; }, &uploaded));
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPut, url, _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply)));
+  UpdateDeviceResource();
+  Mock::VerifyAndClearExpectations(&http_client_);
+  EXPECT_EQ(1, uploaded);
+
+  auto snapshot = dev_reg_->SaveResourceSnapshot();
+  ASSERT_NE(nullptr, snapshot);
+  std::string value;
+  EXPECT_TRUE(snapshot->GetString("cloudId", &value));
+  EXPECT_EQ(test_data::kCloudId, value);
+  EXPECT_TRUE(snapshot->GetString("lastUpdateTimeMs", &value));
+  EXPECT_EQ("123", value);
+
+  // A restarted device only sends the changes made since the snapshot.
+  ReloadSettings(true, false);
+  SetAccessToken();
+  dev_reg_->RestoreResourceSnapshot(*snapshot);
+  EXPECT_TRUE(component_manager_.AddComponent("", "comp2", {"t1"}, nullptr));
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPatch, url, _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(
+          [reply](const std::string& data,
+                  const HttpClient::SendRequestCallback& callback) {
+            EXPECT_JSON_EQ(R"({"components": {"comp2": {"traits": ["t1"]}}})",
+                           *CreateDictionaryValue(data));
+            reply(data, callback);
+          })));
+  UpdateDeviceResource();
+  Mock::VerifyAndClearExpectations(&http_client_);
+
+  // A snapshot of another registration is ignored.
+  ReloadSettings(true, false);
+  SetAccessToken();
+  snapshot->SetString("cloudId", "OTHER_CLOUD_ID");
+  dev_reg_->RestoreResourceSnapshot(*snapshot);
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPut, url, _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply)));
+  UpdateDeviceResource();
+}
+
+TEST_F(DeviceRegistrationInfoTest, UpdateDeviceResourceTraitReference) {
+  ReloadSettings(true, false);
+  SetAccessToken();
+  dev_reg_->SetDeviceResourceDeltaUpdatesEnabled(false);
+  auto json_traits = CreateDictionaryValue(R"({"t1": {}})");
+  EXPECT_TRUE(component_manager_.LoadTraits(*json_traits, nullptr));
+  EXPECT_TRUE(component_manager_.AddComponent("", "comp1", {"t1"}, nullptr));
+
+  std::string url = dev_reg_->GetDeviceUrl({}, {{"lastUpdateTimeMs", "123"}});
+  // Replies like a server which keeps the traits, echoing their fingerprint.
+  std::string fingerprint;
+  bool has_traits = false;
+  auto reply = [&fingerprint, &has_traits](
+      const std::string& data,
+      const HttpClient::SendRequestCallback& callback) {
+    auto resource = CreateDictionaryValue(data);
+    EXPECT_TRUE(resource->GetString("traitsFingerprint", &fingerprint));
+    has_traits = resource->HasKey("traits");
+    base::DictionaryValue json;
+    json.SetString("lastUpdateTimeMs", "123");
+    json.SetString("certFingerprint",
+                   "FQY6BEINDjw3FgsmYChRWgMzMhc4TC8uG0UUUFhdDz0=");
+    json.SetString("traitsFingerprint", fingerprint);
+    callback.Run(ReplyWithJson(200, json), nullptr);
+  };
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPut, url, _, _, _))
+      .Times(2)
+      .WillRepeatedly(WithArgs<3, 4>(Invoke(reply)));
+  UpdateDeviceResource();
+  EXPECT_TRUE(has_traits);
+  std::string first_fingerprint = fingerprint;
+
+  // The server has the traits, so they are only referenced.
+  UpdateDeviceResource();
+  EXPECT_FALSE(has_traits);
+  EXPECT_EQ(first_fingerprint, fingerprint);
+  Mock::VerifyAndClearExpectations(&http_client_);
+
+  // The reference survives a restart.
+  auto snapshot = dev_reg_->SaveResourceSnapshot();
+  ASSERT_NE(nullptr, snapshot);
+  ReloadSettings(true, false);
+  SetAccessToken();
+  dev_reg_->SetDeviceResourceDeltaUpdatesEnabled(false);
+  dev_reg_->RestoreResourceSnapshot(*snapshot);
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPut, url, _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply)));
+  UpdateDeviceResource();
+  EXPECT_FALSE(has_traits);
+  Mock::VerifyAndClearExpectations(&http_client_);
+
+  // Changed traits are uploaded in full again.
+  json_traits = CreateDictionaryValue(R"({"t2": {}})");
+  EXPECT_TRUE(component_manager_.LoadTraits(*json_traits, nullptr));
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPut, url, _, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply)));
+  UpdateDeviceResource();
+  EXPECT_TRUE(has_traits);
+  EXPECT_NE(first_fingerprint, fingerprint);
+  Mock::VerifyAndClearExpectations(&http_client_);
+
+  // Falls back to the full traits if the server lost them.
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPut, url, _, _, _))
+      .WillOnce(WithArgs<3, 4>(
+          Invoke([&has_traits](
+              const std::string& data,
+              const HttpClient::SendRequestCallback& callback) {
+            has_traits = CreateDictionaryValue(data)->HasKey("traits");
+            auto json = CreateDictionaryValue(R"({"error": {"errors": [{
+              "reason": "unknown_traits_fingerprint",
+              "message": "Unknown fingerprint"
+            }]}})");
+            callback.Run(ReplyWithJson(400, *json), nullptr);
+          })))
+      .WillOnce(WithArgs<3, 4>(Invoke(reply)));
+  UpdateDeviceResource(false);
+  EXPECT_FALSE(has_traits);
+  ResetCloudBackoff();
+  UpdateDeviceResource();
+  EXPECT_TRUE(has_traits);
+}
+
+TEST_F(DeviceRegistrationInfoTest, LargeDeviceResourceWrittenOnWorkerPool) {
+  use_worker_pool_ = true;
+  ReloadSettings(true, false);
+  SetAccessToken();
+  dev_reg_->SetDeviceResourceDeltaUpdatesEnabled(false);
+  EXPECT_TRUE(component_manager_.LoadTraits(
+      R"({"t1": {"state": {"p": {"type": "string"}}}})", nullptr));
+  for (int i = 0; i < 10; i++) {
+    std::string name = "comp" + std::to_string(i);
+    EXPECT_TRUE(component_manager_.AddComponent("", name, {"t1"}, nullptr));
+    EXPECT_TRUE(component_manager_.SetStateProperty(
+        name, "t1.p", base::StringValue{std::string(2000, 'a' + i)}, nullptr));
+  }
+
+  std::string url = dev_reg_->GetDeviceUrl({}, {{"lastUpdateTimeMs", "123"}});
+  std::vector<std::string> resources;
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPut, url, _, _, _))
+      .Times(2)
+      .WillRepeatedly(WithArgs<3, 4>(Invoke(
+          [&resources](const std::string& data,
+                       const HttpClient::SendRequestCallback& callback) {
+            resources.push_back(data);
+            base::DictionaryValue json;
+            json.SetString("lastUpdateTimeMs", "123");
+            json.SetString("certFingerprint",
+                           "FQY6BEINDjw3FgsmYChRWgMzMhc4TC8uG0UUUFhdDz0=");
+            callback.Run(ReplyWithJson(200, json), nullptr);
+          })));
+  // The size of the resource isn't known yet, so it's written right away.
+  UpdateDeviceResource();
+  ASSERT_EQ(1u, resources.size());
+
+  // The components of the large resource are written on the worker pool.
+  std::vector<base::Closure> worker_tasks;
+  std::vector<base::Closure> worker_replies;
+  EXPECT_CALL(worker_pool_, PostTaskAndReply(_, _, _))
+      .WillRepeatedly(WithArgs<1, 2>(
+          Invoke([&worker_tasks, &worker_replies](const base::Closure& task,
+                                                  const base::Closure& reply) {
+            worker_tasks.push_back(task);
+            worker_replies.push_back(reply);
+          })));
+  UpdateDeviceResource();
+  EXPECT_EQ(4u, worker_tasks.size());
+  EXPECT_EQ(1u, resources.size());
+  // Changes made meanwhile are not in the snapshot.
+  EXPECT_TRUE(component_manager_.SetStateProperty(
+      "comp0", "t1.p", base::StringValue{"changed"}, nullptr));
+  for (const auto& task : worker_tasks)
+    task.Run();
+  EXPECT_EQ(1u, resources.size());
+  for (const auto& reply : worker_replies)
+    reply.Run();
+  ASSERT_EQ(2u, resources.size());
+  EXPECT_EQ(resources[0], resources[1]);
+}
+
 TEST_F(DeviceRegistrationInfoTest, ReRegisterDevice) {
   ReloadSettings(true, false);
 
@@ -529,6 +1555,7 @@ void DeviceRegistrationInfoTest::RegisterDevice(
             json.SetString("userEmail", "user@email.com");
             json.SetString("deviceDraft.id", test_data::kCloudId);
             json.SetString("deviceDraft.kind", "weave#device");
+            json.SetString("deviceDraft.creationTimeMs", "1440087183738");
             json.SetString("deviceDraft.channel.supportedType", "xmpp");
             json.SetString("robotAccountEmail", test_data::kRobotAccountEmail);
             json.SetString("robotAccountAuthorizationCode",
@@ -623,6 +1650,34 @@ TEST_F(DeviceRegistrationInfoTest, RegisterDevice) {
   RegisterDevice(registration_data, registration_data);
 }
 
+TEST_F(DeviceRegistrationInfoTest, RegisterDeviceSkipsResourceUpload) {
+  ReloadSettings(false, true);
+  RegistrationData registration_data;
+  registration_data.ticket_id = "test_ticked_id";
+  RegistrationData expected_data = registration_data;
+  expected_data.oauth_url = test_data::kOAuthUrl;
+  expected_data.client_id = test_data::kClientId;
+  expected_data.client_secret = test_data::kClientSecret;
+  expected_data.api_key = test_data::kApiKey;
+  expected_data.service_url = test_data::kServiceUrl;
+  expected_data.xmpp_endpoint = test_data::kXmppEndpoint;
+  RegisterDevice(registration_data, expected_data);
+  Mock::VerifyAndClearExpectations(&http_client_);
+
+  // The device was created from the draft, so the connection goes straight
+  // to the commands, without a PUT of the same resource or a patchState of
+  // the state it carried.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet, HasSubstr("commands/queue"),
+                          _, _, _))
+      .WillOnce(WithArgs<4>(
+          Invoke([](const HttpClient::SendRequestCallback& callback) {
+            callback.Run(ReplyWithJson(200, base::DictionaryValue{}), nullptr);
+          })));
+  task_runner_.RunPendingTasks();
+  EXPECT_EQ(GcdState::kConnected, GetGcdState());
+}
+
 TEST_F(DeviceRegistrationInfoTest, RegisterDeviceWithDefaultEndpoints) {
   ReloadSettings(false, true);
 
@@ -694,6 +1749,7 @@ class DeviceRegistrationInfoUpdateCommandTest
     EXPECT_TRUE(component_manager_.LoadTraits(*json_traits, nullptr));
     EXPECT_TRUE(
         component_manager_.AddComponent("", "comp", {"robot"}, nullptr));
+    task_runner_.RunPendingTasks();
 
     command_url_ = dev_reg_->GetServiceUrl("commands/1234");
 
@@ -755,6 +1811,44 @@ TEST_F(DeviceRegistrationInfoUpdateCommandTest, Complete) {
       command_->Complete(*CreateDictionaryValue("{'status': 'Ok'}"), nullptr));
 }
 
+TEST_F(DeviceRegistrationInfoUpdateCommandTest, CompleteWithBlob) {
+  auto blob = std::make_shared<const std::vector<uint8_t>>(100000, 0xAB);
+  std::string blob_id = command_->AttachBlob("image/jpeg", blob);
+
+  bool blob_uploaded = false;
+  EXPECT_CALL(http_client_,
+              SendStreamRequest(
+                  HttpClient::Method::kPut, command_url_ + "/blobs/" + blob_id,
+                  HttpClient::Headers{GetAuthHeader(),
+                                      {http::kContentType, "image/jpeg"}},
+                  testing::NotNull(), _))
+      .WillOnce(WithArgs<4>(Invoke(
+          [&blob_uploaded](const HttpClient::SendRequestCallback& callback) {
+            blob_uploaded = true;
+            callback.Run(ReplyWithJson(200, base::DictionaryValue{}), nullptr);
+          })));
+  EXPECT_CALL(
+      http_client_,
+      SendRequest(HttpClient::Method::kPatch, command_url_,
+                  HttpClient::Headers{GetAuthHeader(), GetJsonHeader()}, _, _))
+      .WillOnce(WithArgs<3, 4>(Invoke([&blob_id, &blob_uploaded](
+          const std::string& data,
+          const HttpClient::SendRequestCallback& callback) {
+        EXPECT_TRUE(blob_uploaded);
+        // The results only refer to the blob.
+        EXPECT_GT(200u, data.size());
+        EXPECT_JSON_EQ(R"({"state":"done", "results":{"status":")" + blob_id +
+                           R"("}})",
+                       *CreateDictionaryValue(data));
+        callback.Run(ReplyWithJson(200, base::DictionaryValue{}), nullptr);
+      })));
+
+  base::DictionaryValue results;
+  results.SetString("status", blob_id);
+  EXPECT_TRUE(command_->Complete(results, nullptr));
+  task_runner_.RunOnce();
+}
+
 TEST_F(DeviceRegistrationInfoUpdateCommandTest, Cancel) {
   EXPECT_CALL(
       http_client_,
@@ -771,4 +1865,277 @@ TEST_F(DeviceRegistrationInfoUpdateCommandTest, Cancel) {
   EXPECT_TRUE(command_->Cancel(nullptr));
 }
 
+TEST_F(DeviceRegistrationInfoUpdateCommandTest, KnownCommandsNotParsedAgain) {
+  // Parsing the invalid parameters would abort the command on the server.
+  auto commands_json = CreateValue(R"([{
+    'name':'robot._jump',
+    'component': 'comp',
+    'id':'1234',
+    'parameters': {'_height': 'high'}
+  }, {
+    'name':'robot._jump',
+    'component': 'comp',
+    'id':'1235',
+    'parameters': {'_height': 50}
+  }, {
+    'name':'robot._jump',
+    'component': 'comp',
+    'id':'1235',
+    'parameters': {'_height': 'high'}
+  }])");
+  const base::ListValue* command_list = nullptr;
+  ASSERT_TRUE(commands_json->GetAsList(&command_list));
+  PublishCommands(*command_list);
+
+  EXPECT_EQ(command_, component_manager_.FindCommand("1234"));
+  EXPECT_JSON_EQ("{'_height': 100}", command_->GetParameters());
+  Command* command = component_manager_.FindCommand("1235");
+  ASSERT_NE(nullptr, command);
+  EXPECT_JSON_EQ("{'_height': 50}", command->GetParameters());
+
+  // Nothing is aborted. TearDown() runs the unrelated device info fetch.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet, dev_reg_->GetDeviceUrl(),
+                          _, _, _));
+}
+
+TEST_F(DeviceRegistrationInfoUpdateCommandTest, InvalidCommandsAbortedOnce) {
+  auto commands_json = CreateValue(R"([{
+    'name':'robot._jump',
+    'component': 'comp',
+    'id':'2001',
+    'parameters': {'_height': 'high'}
+  }, {
+    'name':'robot._fly',
+    'component': 'comp',
+    'id':'2002'
+  }, {
+    'name':'robot._jump',
+    'component': 'comp',
+    'id':'1235',
+    'parameters': {'_height': 50}
+  }])");
+  const base::ListValue* command_list = nullptr;
+  ASSERT_TRUE(commands_json->GetAsList(&command_list));
+
+  std::vector<HttpClient::SendRequestCallback> replies;
+  auto expect_abort = [this, &replies](const std::string& id) {
+    EXPECT_CALL(http_client_,
+                SendRequest(HttpClient::Method::kPatch,
+                            dev_reg_->GetServiceUrl("commands/" + id), _, _, _))
+        .WillOnce(WithArgs<3, 4>(
+            Invoke([this, &replies](
+                const std::string& data,
+                const HttpClient::SendRequestCallback& callback) {
+              // The valid command of the batch is queued first.
+              EXPECT_NE(nullptr, component_manager_.FindCommand("1235"));
+              EXPECT_THAT(data, testing::HasSubstr(R"("state":"aborted")"));
+              replies.push_back(callback);
+            })))
+        .RetiresOnSaturation();
+  };
+  expect_abort("2001");
+  expect_abort("2002");
+  PublishCommands(*command_list);
+  EXPECT_EQ(2u, replies.size());
+  Mock::VerifyAndClearExpectations(&http_client_);
+
+  // The commands aren't aborted again while the server doesn't know yet.
+  PublishCommands(*command_list);
+  for (const auto& callback : replies)
+    callback.Run(ReplyWithJson(200, base::DictionaryValue{}), nullptr);
+  replies.clear();
+
+  // A command still queued on the server is aborted again.
+  expect_abort("2001");
+  expect_abort("2002");
+  PublishCommands(*command_list);
+  EXPECT_EQ(2u, replies.size());
+  for (const auto& callback : replies)
+    callback.Run(ReplyWithJson(200, base::DictionaryValue{}), nullptr);
+
+  // TearDown() runs the unrelated device info fetch.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet, dev_reg_->GetDeviceUrl(),
+                          _, _, _));
+}
+
+TEST_F(DeviceRegistrationInfoUpdateCommandTest, ExpiredCommandsSkipped) {
+  auto commands_json = CreateValue(R"([{
+    'name':'robot._jump',
+    'component': 'comp',
+    'id':'2001',
+    'expirationTimeMs': '1000',
+    'parameters': {'_height': 'high'}
+  }, {
+    'name':'robot._jump',
+    'component': 'comp',
+    'id':'1235',
+    'expirationTimeMs': '9999999999999',
+    'parameters': {'_height': 50}
+  }])");
+  const base::ListValue* command_list = nullptr;
+  ASSERT_TRUE(commands_json->GetAsList(&command_list));
+
+  // The stale command is reported expired without being parsed.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPatch,
+                          dev_reg_->GetServiceUrl("commands/2001"), _, _, _))
+      .WillOnce(WithArgs<3, 4>(
+          Invoke([](const std::string& data,
+                    const HttpClient::SendRequestCallback& callback) {
+            EXPECT_THAT(data, testing::HasSubstr(R"("state":"expired")"));
+            callback.Run(ReplyWithJson(200, base::DictionaryValue{}), nullptr);
+          })));
+  PublishCommands(*command_list);
+  EXPECT_EQ(nullptr, component_manager_.FindCommand("2001"));
+  Command* command = component_manager_.FindCommand("1235");
+  ASSERT_NE(nullptr, command);
+  EXPECT_EQ(Command::State::kQueued, command->GetState());
+
+  // TearDown() runs the unrelated device info fetch.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet, dev_reg_->GetDeviceUrl(),
+                          _, _, _));
+}
+
+TEST_F(DeviceRegistrationInfoUpdateCommandTest, PushedCommand) {
+  auto command_json = CreateDictionaryValue(R"({
+    'name':'robot._jump',
+    'component': 'comp',
+    'id':'1235',
+    'parameters': {'_height': 50}
+  })");
+  OnCommandCreated(*command_json);
+  Command* command = component_manager_.FindCommand("1235");
+  ASSERT_NE(nullptr, command);
+  EXPECT_JSON_EQ("{'_height': 50}", command->GetParameters());
+
+  // Pushed again, e.g. after the resync on reconnect.
+  OnCommandCreated(*command_json);
+  EXPECT_EQ(command, component_manager_.FindCommand("1235"));
+
+  // Commands too big for the notification channel are not included.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet,
+                          HasSubstr("commands/queue?deviceId=" +
+                                    std::string{test_data::kCloudId} +
+                                    "&reason=new_command"),
+                          _, _, _))
+      .WillOnce(WithArgs<4>(
+          Invoke([](const HttpClient::SendRequestCallback& callback) {
+            callback.Run(ReplyWithJson(200, base::DictionaryValue{}), nullptr);
+          })));
+  OnCommandCreated(base::DictionaryValue{});
+
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet, dev_reg_->GetDeviceUrl(),
+                          _, _, _));
+}
+
+TEST_F(DeviceRegistrationInfoUpdateCommandTest, LostPushResynced) {
+  // The connection started by SetUp() goes first, so it doesn't interfere.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet, dev_reg_->GetDeviceUrl(),
+                          _, _, _));
+  task_runner_.RunOnce();
+  Mock::VerifyAndClearExpectations(&http_client_);
+
+  const std::string queue_url = "commands/queue?deviceId=" +
+                                std::string{test_data::kCloudId} + "&reason=";
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet,
+                          HasSubstr(queue_url + "new_command"), _, _, _))
+      .WillOnce(WithArgs<4>(
+          Invoke([](const HttpClient::SendRequestCallback& callback) {
+            callback.Run(ReplyWithJson(200, base::DictionaryValue{}), nullptr);
+          })));
+  OnCommandCreated(base::DictionaryValue{});
+  const base::Time fetch_time = task_runner_.GetClock()->Now();
+
+  // The push of 1235 is lost, so the periodic resync finds it.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet,
+                          HasSubstr(queue_url + "resync"), _, _, _))
+      .WillOnce(WithArgs<4>(
+          Invoke([this](const HttpClient::SendRequestCallback& callback) {
+            task_runner_.Break();
+            auto json = CreateDictionaryValue(R"({'commands': [{
+              'name':'robot._jump',
+              'component': 'comp',
+              'id':'1235',
+              'parameters': {'_height': 50}
+            }]})");
+            callback.Run(ReplyWithJson(200, *json), nullptr);
+          })));
+  task_runner_.Run();
+  EXPECT_NE(nullptr, component_manager_.FindCommand("1235"));
+  EXPECT_LE(fetch_time + base::TimeDelta::FromMinutes(15),
+            task_runner_.GetClock()->Now());
+
+  // TearDown() runs the next resync.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet,
+                          HasSubstr(queue_url + "resync"), _, _, _));
+}
+
+TEST_F(DeviceRegistrationInfoUpdateCommandTest, KnownCommands) {
+  const NotificationDelegate* delegate = dev_reg_.get();
+  EXPECT_TRUE(delegate->IsCommandKnown("1234"));
+  EXPECT_FALSE(delegate->IsCommandKnown("1235"));
+
+  // TearDown() runs the unrelated device info fetch.
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kGet, dev_reg_->GetDeviceUrl(),
+                          _, _, _));
+}
+
+TEST_F(DeviceRegistrationInfoUpdateCommandTest, LimitUpdatesInFlight) {
+  auto commands_json = CreateValue(R"([{
+    'name':'robot._jump',
+    'component': 'comp',
+    'id':'1235',
+    'parameters': {'_height': 100}
+  }, {
+    'name':'robot._jump',
+    'component': 'comp',
+    'id':'1236',
+    'parameters': {'_height': 100}
+  }])");
+  const base::ListValue* command_list = nullptr;
+  ASSERT_TRUE(commands_json->GetAsList(&command_list));
+  PublishCommands(*command_list);
+
+  std::vector<std::string> urls;
+  std::vector<HttpClient::SendRequestCallback> callbacks;
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPatch, _, _, _, _))
+      .Times(3)
+      .WillRepeatedly(WithArgs<1, 4>(
+          Invoke([&urls, &callbacks](
+              const std::string& url,
+              const HttpClient::SendRequestCallback& callback) {
+            urls.push_back(url);
+            callbacks.push_back(callback);
+          })));
+  for (const char* id : {"1234", "1235", "1236"})
+    EXPECT_TRUE(component_manager_.FindCommand(id)->Cancel(nullptr));
+  // Let the proxies send their updates.
+  for (int i = 0; i < 3; i++)
+    task_runner_.RunOnce();
+  ASSERT_EQ(2u, urls.size());
+  EXPECT_EQ(command_url_, urls.front());
+
+  // The third update is sent once one of the others is done.
+  callbacks.front().Run(ReplyWithJson(200, base::DictionaryValue{}), nullptr);
+  ASSERT_EQ(3u, urls.size());
+  EXPECT_EQ(dev_reg_->GetServiceUrl("commands/1236"), urls.back());
+  callbacks[1].Run(ReplyWithJson(200, base::DictionaryValue{}), nullptr);
+  callbacks[2].Run(ReplyWithJson(200, base::DictionaryValue{}), nullptr);
+
+  // Ignore the device connection started by TearDown().
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kGet, _, _, _, _))
+      .Times(AnyNumber());
+}
+
 }  // namespace weave
@@ -0,0 +1,76 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <weave/device_runtime.h>
+
+#include <base/logging.h>
+#include <base/macros.h>
+
+#include "src/backoff_entry.h"
+#include "src/device_manager.h"
+#include "src/request_slots.h"
+
+namespace weave {
+
+namespace {
+
+// Cloud requests of all the devices sent at once. A single device sends up to
+// 4, so a few devices keep the connection busy.
+const size_t kMaxCloudRequestsInFlight = 16;
+
+// Retries of all the devices per minute, so a server outage doesn't turn into
+// a retry storm when it's over.
+const size_t kMaxRetriesPerMinute = 60;
+
+class DeviceRuntimeImpl final : public DeviceRuntime {
+ public:
+  DeviceRuntimeImpl(provider::TaskRunner* task_runner,
+                    provider::HttpClient* http_client,
+                    provider::Network* network,
+                    provider::WorkerPool* worker_pool)
+      : task_runner_{task_runner},
+        http_client_{http_client},
+        network_{network},
+        worker_pool_{worker_pool},
+        request_slots_{task_runner, kMaxCloudRequestsInFlight},
+        retry_budget_{kMaxRetriesPerMinute, base::TimeDelta::FromMinutes(1)} {
+    CHECK(task_runner);
+    CHECK(http_client);
+  }
+
+  std::unique_ptr<Device> CreateDevice(
+      provider::ConfigStore* config_store,
+      provider::DnsServiceDiscovery* dns_sd,
+      provider::HttpServer* http_server,
+      provider::Wifi* wifi,
+      provider::Bluetooth* bluetooth) override {
+    return std::unique_ptr<Device>{new DeviceManager{
+        config_store, task_runner_, http_client_, network_, dns_sd,
+        http_server, wifi, bluetooth, worker_pool_, &request_slots_,
+        &retry_budget_}};
+  }
+
+ private:
+  provider::TaskRunner* task_runner_{nullptr};
+  provider::HttpClient* http_client_{nullptr};
+  provider::Network* network_{nullptr};
+  provider::WorkerPool* worker_pool_{nullptr};
+  RequestSlots request_slots_;
+  RetryBudget retry_budget_;
+
+  DISALLOW_COPY_AND_ASSIGN(DeviceRuntimeImpl);
+};
+
+}  // namespace
+
+std::unique_ptr<DeviceRuntime> DeviceRuntime::Create(
+    provider::TaskRunner* task_runner,
+    provider::HttpClient* http_client,
+    provider::Network* network,
+    provider::WorkerPool* worker_pool) {
+  return std::unique_ptr<DeviceRuntime>{
+      new DeviceRuntimeImpl{task_runner, http_client, network, worker_pool}};
+}
+
+}  // namespace weave
@@ -0,0 +1,218 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/diagnostics_api_handler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <base/bind.h>
+#include <base/values.h>
+
+namespace weave {
+
+namespace {
+
+const char kComponent[] = "diagnostics";
+const char kTrait[] = "diagnostics";
+const char kTraffic[] = "traffic";
+const char kEndpoint[] = "endpoint";
+const char kBytesSent[] = "bytesSent";
+const char kBytesReceived[] = "bytesReceived";
+
+// Samples are taken when the device wakes up anyway, up to half the interval
+// late.
+const double kUpdateTolerance = 0.5;
+
+// Percentiles of the latency histograms of Device::GetMetrics().
+const struct {
+  const char* property;
+  const char* histogram;
+  const char* field;
+} kHistogramProperties[] = {
+    {"commandDispatchP50Ms", "command_queue_dispatch", "p50Ms"},
+    {"commandDispatchP99Ms", "command_queue_dispatch", "p99Ms"},
+    {"patchStateP50Ms", "cloud_request POST devices/*/patchState", "p50Ms"},
+    {"patchStateP99Ms", "cloud_request POST devices/*/patchState", "p99Ms"},
+    {"statePropagationP99Ms", "state_propagation", "p99Ms"},
+    {"taskDelayP99Ms", "task_delay", "p99Ms"},
+    {"taskDelayMaxMs", "task_delay", "maxMs"},
+};
+
+// Counters of Device::GetMetrics().
+const struct {
+  const char* property;
+  const char* counter;
+} kCounterProperties[] = {
+    {"xmppReconnects", "xmpp_restart"},
+    {"xmppStanzasDropped", "xmpp_stanza_dropped"},
+    {"commandsExpired", "command_queue_expired"},
+};
+
+// Element counts of the queues in Device::GetMemoryStats().
+const struct {
+  const char* property;
+  const char* subsystem;
+} kQueueProperties[] = {
+    {"commandQueueDepth", "commandQueue"},
+    {"stateChangeQueueDepth", "stateChangeQueues"},
+    {"statePublishQueueDepth", "statePublishQueue"},
+    {"cloudCommandUpdatesDepth", "cloudCommandUpdates"},
+};
+
+int ToStateInt(double value) {
+  return static_cast<int>(std::min<double>(
+      std::round(value), std::numeric_limits<int>::max()));
+}
+
+}  // namespace
+
+DiagnosticsApiHandler::DiagnosticsApiHandler(Device* device,
+                                             provider::TaskRunner* task_runner,
+                                             WakeWindowScheduler* scheduler,
+                                             const DiagnosticsPolicy& policy)
+    : device_{device},
+      policy_(policy),
+      update_timer_{task_runner, provider::TaskRunner::Priority::kBackground} {
+  CHECK(!policy_.update_interval.is_zero());
+  if (scheduler)
+    update_timer_.SetWakeWindow(scheduler, kUpdateTolerance);
+
+  device_->AddTraitDefinitionsFromJson(R"({
+    "diagnostics": {
+      "state": {
+        "commandDispatchP50Ms": {"type": "integer"},
+        "commandDispatchP99Ms": {"type": "integer"},
+        "patchStateP50Ms": {"type": "integer"},
+        "patchStateP99Ms": {"type": "integer"},
+        "statePropagationP99Ms": {"type": "integer"},
+        "taskDelayP99Ms": {"type": "integer"},
+        "taskDelayMaxMs": {"type": "integer"},
+        "xmppReconnects": {"type": "integer"},
+        "xmppStanzasDropped": {"type": "integer"},
+        "commandsExpired": {"type": "integer"},
+        "commandQueueDepth": {"type": "integer"},
+        "stateChangeQueueDepth": {"type": "integer"},
+        "statePublishQueueDepth": {"type": "integer"},
+        "cloudCommandUpdatesDepth": {"type": "integer"},
+        "traffic": {
+          "type": "array",
+          "items": {
+            "type": "object",
+            "properties": {
+              "endpoint": {"type": "string"},
+              "bytesSent": {"type": "integer"},
+              "bytesReceived": {"type": "integer"}
+            },
+            "additionalProperties": false
+          }
+        }
+      }
+    }
+  })");
+  CHECK(device_->AddComponent(kComponent, {kTrait}, nullptr));
+  UpdateState();
+}
+
+void DiagnosticsApiHandler::UpdateState() {
+  base::DictionaryValue changes;
+
+  auto metrics = device_->GetMetrics();
+  const base::DictionaryValue* histograms = nullptr;
+  const base::DictionaryValue* counters = nullptr;
+  metrics->GetDictionary("histograms", &histograms);
+  metrics->GetDictionary("counters", &counters);
+  for (const auto& p : kHistogramProperties) {
+    const base::DictionaryValue* histogram = nullptr;
+    double value = 0;
+    if (histograms &&
+        histograms->GetDictionaryWithoutPathExpansion(p.histogram,
+                                                      &histogram) &&
+        histogram->GetDouble(p.field, &value)) {
+      UpdateProperty(p.property, value, &changes);
+    }
+  }
+  for (const auto& p : kCounterProperties) {
+    int value = 0;
+    if (counters && counters->GetIntegerWithoutPathExpansion(p.counter, &value))
+      UpdateProperty(p.property, value, &changes);
+  }
+
+  auto memory_stats = device_->GetMemoryStats();
+  for (const auto& p : kQueueProperties) {
+    const base::DictionaryValue* usage = nullptr;
+    int count = 0;
+    if (memory_stats->GetDictionaryWithoutPathExpansion(p.subsystem,
+                                                        &usage) &&
+        usage->GetInteger("count", &count)) {
+      UpdateProperty(p.property, count, &changes);
+    }
+  }
+
+  // The traffic of the last hour is published as a whole, once any endpoint
+  // is out of the deadband.
+  auto traffic_stats = device_->GetTrafficStats();
+  std::unique_ptr<base::ListValue> traffic{new base::ListValue};
+  std::map<std::string, double> traffic_totals;
+  bool traffic_changed = false;
+  for (base::DictionaryValue::Iterator it{*traffic_stats}; !it.IsAtEnd();
+       it.Advance()) {
+    const base::DictionaryValue* stats = nullptr;
+    const base::DictionaryValue* last_hour = nullptr;
+    if (!it.value().GetAsDictionary(&stats) ||
+        !stats->GetDictionary("lastHour", &last_hour)) {
+      continue;
+    }
+    double sent = 0;
+    double received = 0;
+    last_hour->GetDouble(kBytesSent, &sent);
+    last_hour->GetDouble(kBytesReceived, &received);
+    std::unique_ptr<base::DictionaryValue> endpoint{new base::DictionaryValue};
+    endpoint->SetString(kEndpoint, it.key());
+    endpoint->SetInteger(kBytesSent, ToStateInt(sent));
+    endpoint->SetInteger(kBytesReceived, ToStateInt(received));
+    traffic->Append(std::move(endpoint));
+
+    std::string key = std::string{kTraffic} + " " + it.key();
+    traffic_totals[key] = sent + received;
+    traffic_changed |= IsOutsideDeadband(key, sent + received);
+  }
+  if (traffic_changed) {
+    for (const auto& pair : traffic_totals)
+      published_[pair.first] = pair.second;
+    changes.SetWithoutPathExpansion(kTraffic, std::move(traffic));
+  }
+
+  if (!changes.empty()) {
+    base::DictionaryValue state;
+    state.SetWithoutPathExpansion(kTrait, changes.CreateDeepCopy());
+    CHECK(device_->SetStateProperties(kComponent, state, nullptr));
+  }
+
+  update_timer_.Start(FROM_HERE, policy_.update_interval,
+                      base::Bind(&DiagnosticsApiHandler::UpdateState,
+                                 base::Unretained(this)));
+}
+
+bool DiagnosticsApiHandler::IsOutsideDeadband(const std::string& key,
+                                              double value) const {
+  auto it = published_.find(key);
+  if (it == published_.end())
+    return true;
+  return std::abs(value - it->second) > policy_.deadband * std::abs(it->second);
+}
+
+void DiagnosticsApiHandler::UpdateProperty(const std::string& property,
+                                           double value,
+                                           base::DictionaryValue* changes) {
+  // Sub-millisecond changes of the latencies aren't published.
+  value = ToStateInt(value);
+  if (!IsOutsideDeadband(property, value))
+    return;
+  published_[property] = value;
+  changes->SetInteger(property, static_cast<int>(value));
+}
+
+}  // namespace weave
@@ -0,0 +1,60 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_DIAGNOSTICS_API_HANDLER_H_
+#define LIBWEAVE_SRC_DIAGNOSTICS_API_HANDLER_H_
+
+#include <map>
+#include <string>
+
+#include <base/macros.h>
+#include <weave/device.h>
+
+#include "src/timer.h"
+
+namespace weave {
+
+class WakeWindowScheduler;
+
+// Publishes the performance of the device as the state of the 'diagnostics'
+// trait, so it can be monitored remotely like any other state. Every
+// |policy.update_interval| it samples Device::GetMetrics(), GetMemoryStats()
+// and GetTrafficStats(), and updates the values which changed by more than
+// |policy.deadband| since they were last published. Latencies are the
+// percentiles since the device started.
+class DiagnosticsApiHandler final {
+ public:
+  // |scheduler| may be null. Otherwise the samples share the wake-ups of the
+  // other deferrable activity.
+  DiagnosticsApiHandler(Device* device,
+                        provider::TaskRunner* task_runner,
+                        WakeWindowScheduler* scheduler,
+                        const DiagnosticsPolicy& policy);
+
+ private:
+  // Samples the values, publishes the changed ones and schedules the next
+  // update.
+  void UpdateState();
+
+  // Returns true if |value| of |key| is to be published, i.e. it hasn't been
+  // yet or it's out of the deadband around the last published value.
+  bool IsOutsideDeadband(const std::string& key, double value) const;
+  // Sets |property| of the trait in |changes| to |value| if it's out of the
+  // deadband.
+  void UpdateProperty(const std::string& property,
+                      double value,
+                      base::DictionaryValue* changes);
+
+  Device* device_{nullptr};
+  const DiagnosticsPolicy policy_;
+  // Last published values, by property. Traffic is tracked by endpoint.
+  std::map<std::string, double> published_;
+  OneShotTimer update_timer_;
+
+  DISALLOW_COPY_AND_ASSIGN(DiagnosticsApiHandler);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_DIAGNOSTICS_API_HANDLER_H_
@@ -0,0 +1,156 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/diagnostics_api_handler.h"
+
+#include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
+#include <weave/test/mock_device.h>
+#include <weave/test/unittest_utils.h>
+
+#include "src/component_manager_impl.h"
+
+using testing::_;
+using testing::Invoke;
+using testing::StrictMock;
+
+namespace weave {
+
+using test::CreateDictionaryValue;
+
+class DiagnosticsApiHandlerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    EXPECT_CALL(device_, AddTraitDefinitionsFromJson(_))
+        .WillRepeatedly(Invoke([this](const std::string& json) {
+          EXPECT_TRUE(component_manager_.LoadTraits(json, nullptr));
+        }));
+    EXPECT_CALL(device_, SetStateProperties(_, _, _))
+        .WillRepeatedly(Invoke([this](const std::string& component,
+                                      const base::DictionaryValue& dict,
+                                      ErrorPtr* error) {
+          ++state_updates_;
+          return component_manager_.SetStateProperties(component, dict, error);
+        }));
+    EXPECT_CALL(device_, AddComponent(_, _, _))
+        .WillRepeatedly(Invoke([this](const std::string& name,
+                                      const std::vector<std::string>& traits,
+                                      ErrorPtr* error) {
+          return component_manager_.AddComponent("", name, traits, error);
+        }));
+    EXPECT_CALL(device_, MockGetMetrics())
+        .WillRepeatedly(Invoke([this]() { return metrics_->DeepCopy(); }));
+    EXPECT_CALL(device_, MockGetMemoryStats())
+        .WillRepeatedly(Invoke([this]() { return memory_stats_->DeepCopy(); }));
+    EXPECT_CALL(device_, MockGetTrafficStats())
+        .WillRepeatedly(
+            Invoke([this]() { return traffic_stats_->DeepCopy(); }));
+  }
+
+  void CreateHandler() {
+    handler_.reset(
+        new DiagnosticsApiHandler{&device_, &task_runner_, nullptr, policy_});
+  }
+
+  // Runs the tasks due now, then the next update.
+  void RunUpdate() {
+    task_runner_.RunPendingTasks();
+    task_runner_.RunOnce();
+  }
+
+  std::unique_ptr<base::DictionaryValue> GetState() {
+    const base::DictionaryValue* state = nullptr;
+    EXPECT_TRUE(component_manager_.GetComponents().GetDictionary(
+        "diagnostics.state.diagnostics", &state));
+    return state->CreateDeepCopy();
+  }
+
+  provider::test::FakeTaskRunner task_runner_;
+  ComponentManagerImpl component_manager_{&task_runner_};
+  StrictMock<test::MockDevice> device_;
+  DiagnosticsPolicy policy_;
+  std::unique_ptr<base::DictionaryValue> metrics_{CreateDictionaryValue(R"({
+    "counters": {"xmpp_restart": 2},
+    "histograms": {
+      "command_queue_dispatch": {"p50Ms": 1.2, "p99Ms": 40.0},
+      "cloud_request POST devices/*/patchState": {"p50Ms": 150.0,
+                                                  "p99Ms": 900.0},
+      "task_delay": {"p99Ms": 12.0, "maxMs": 80.0}
+    }
+  })")};
+  std::unique_ptr<base::DictionaryValue> memory_stats_{CreateDictionaryValue(
+      R"({
+    "commandQueue": {"count": 3, "bytes": 3000},
+    "statePublishQueue": {"count": 0, "bytes": 0}
+  })")};
+  std::unique_ptr<base::DictionaryValue> traffic_stats_{CreateDictionaryValue(
+      R"({
+    "xmpp": {"lastHour": {"count": 10, "bytesSent": 1000,
+                          "bytesReceived": 2000}}
+  })")};
+  int state_updates_{0};
+  std::unique_ptr<DiagnosticsApiHandler> handler_;
+};
+
+TEST_F(DiagnosticsApiHandlerTest, Initialization) {
+  CreateHandler();
+  auto expected = R"({
+    "commandDispatchP50Ms": 1,
+    "commandDispatchP99Ms": 40,
+    "patchStateP50Ms": 150,
+    "patchStateP99Ms": 900,
+    "taskDelayP99Ms": 12,
+    "taskDelayMaxMs": 80,
+    "xmppReconnects": 2,
+    "commandQueueDepth": 3,
+    "statePublishQueueDepth": 0,
+    "traffic": [
+      {"endpoint": "xmpp", "bytesSent": 1000, "bytesReceived": 2000}
+    ]
+  })";
+  EXPECT_JSON_EQ(expected, *GetState());
+  EXPECT_EQ(1, state_updates_);
+}
+
+TEST_F(DiagnosticsApiHandlerTest, Deadband) {
+  const base::Time start = task_runner_.GetClock()->Now();
+  CreateHandler();
+
+  // Within 10% of the published values, nothing is updated.
+  metrics_->SetDouble("histograms.command_queue_dispatch.p99Ms", 43.0);
+  traffic_stats_->SetDouble("xmpp.lastHour.bytesReceived", 2200);
+  RunUpdate();
+  EXPECT_EQ(1, state_updates_);
+  EXPECT_EQ(start + base::TimeDelta::FromMinutes(5),
+            task_runner_.GetClock()->Now());
+
+  // Only the values out of it are.
+  metrics_->SetDouble("histograms.command_queue_dispatch.p99Ms", 45.0);
+  metrics_->SetInteger("counters.xmpp_restart", 3);
+  traffic_stats_->SetDouble("xmpp.lastHour.bytesReceived", 2400);
+  RunUpdate();
+  EXPECT_EQ(2, state_updates_);
+  auto state = GetState();
+  int value = 0;
+  EXPECT_TRUE(state->GetInteger("commandDispatchP99Ms", &value));
+  EXPECT_EQ(45, value);
+  EXPECT_TRUE(state->GetInteger("xmppReconnects", &value));
+  EXPECT_EQ(3, value);
+  const base::ListValue* traffic = nullptr;
+  const base::DictionaryValue* endpoint = nullptr;
+  EXPECT_TRUE(state->GetList("traffic", &traffic));
+  EXPECT_TRUE(traffic->GetDictionary(0, &endpoint));
+  EXPECT_TRUE(endpoint->GetInteger("bytesReceived", &value));
+  EXPECT_EQ(2400, value);
+
+  // The deadband is around the published value, not the last sample.
+  metrics_->SetDouble("histograms.command_queue_dispatch.p99Ms", 49.0);
+  RunUpdate();
+  EXPECT_EQ(2, state_updates_);
+  metrics_->SetDouble("histograms.command_queue_dispatch.p99Ms", 50.0);
+  RunUpdate();
+  EXPECT_EQ(3, state_updates_);
+}
+
+}  // namespace weave
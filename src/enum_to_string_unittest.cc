@@ -0,0 +1,68 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <weave/enum_to_string.h>
+
+#include <gtest/gtest.h>
+
+namespace weave {
+
+namespace {
+
+enum class Dense { kA, kB, kC, kUnnamed };
+enum class Sparse { kLow = -1000000, kHigh = 1000000 };
+
+const EnumToStringMap<Dense>::Map kDenseMap[] = {
+    {Dense::kA, "a"},
+    {Dense::kB, "b"},
+    {Dense::kC, "c"},
+    // Duplicates resolve to the first entry.
+    {Dense::kA, "alias"},
+    {Dense::kB, "a"},
+    {Dense::kUnnamed, nullptr},
+};
+
+const EnumToStringMap<Sparse>::Map kSparseMap[] = {
+    {Sparse::kLow, "low"},
+    {Sparse::kHigh, "high"},
+};
+
+}  // namespace
+
+template <>
+EnumToStringMap<Dense>::EnumToStringMap() : EnumToStringMap(kDenseMap) {}
+
+template <>
+EnumToStringMap<Sparse>::EnumToStringMap() : EnumToStringMap(kSparseMap) {}
+
+TEST(EnumToStringTest, Dense) {
+  EXPECT_EQ("a", EnumToString(Dense::kA));
+  EXPECT_EQ("b", EnumToString(Dense::kB));
+  EXPECT_EQ("c", EnumToString(Dense::kC));
+
+  Dense value = Dense::kC;
+  EXPECT_TRUE(StringToEnum("a", &value));
+  EXPECT_EQ(Dense::kA, value);
+  EXPECT_TRUE(StringToEnum("alias", &value));
+  EXPECT_EQ(Dense::kA, value);
+  EXPECT_TRUE(StringToEnum("c", &value));
+  EXPECT_EQ(Dense::kC, value);
+
+  EXPECT_FALSE(StringToEnum("", &value));
+  EXPECT_FALSE(StringToEnum("d", &value));
+  EXPECT_FALSE(StringToEnum(std::string{"a\0", 2}, &value));
+  EXPECT_EQ(Dense::kC, value);
+}
+
+TEST(EnumToStringTest, Sparse) {
+  EXPECT_EQ("low", EnumToString(Sparse::kLow));
+  EXPECT_EQ("high", EnumToString(Sparse::kHigh));
+
+  Sparse value = Sparse::kLow;
+  EXPECT_TRUE(StringToEnum("high", &value));
+  EXPECT_EQ(Sparse::kHigh, value);
+  EXPECT_FALSE(StringToEnum("medium", &value));
+}
+
+}  // namespace weave
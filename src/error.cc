@@ -35,7 +35,8 @@ ErrorPtr Error::Create(const tracked_objects::Location& location,
                        const std::string& code,
                        const std::string& message,
                        ErrorPtr inner_error) {
-  LogError(location, code, message);
+  if (LOG_IS_ON(ERROR))
+    LogError(location, code, message);
   return ErrorPtr(new Error(location, code, message, std::move(inner_error)));
 }
 
@@ -45,7 +46,7 @@ Error::AddToTypeProxy Error::AddTo(ErrorPtr* error,
                                    const std::string& message) {
   if (error) {
     *error = Create(location, code, message, std::move(*error));
-  } else {
+  } else if (LOG_IS_ON(ERROR)) {
     // Create already logs the error, but if |error| is nullptr,
     // we still want to log the error...
     LogError(location, code, message);
@@ -59,6 +60,10 @@ Error::AddToTypeProxy Error::AddToPrintf(
     const std::string& code,
     const char* format,
     ...) {
+  // Callers probing for a result pass nullptr; don't format a message nobody
+  // is going to see.
+  if (!error && !LOG_IS_ON(ERROR))
+    return {};
   va_list ap;
   va_start(ap, format);
   std::string message = base::StringPrintV(format, ap);
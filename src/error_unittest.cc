@@ -4,6 +4,7 @@
 
 #include <weave/error.h>
 
+#include <base/logging.h>
 #include <gtest/gtest.h>
 
 namespace weave {
@@ -66,4 +67,16 @@ TEST(Error, Clone) {
   EXPECT_EQ(error1, error2);
 }
 
+TEST(Error, AddToPrintf) {
+  ErrorPtr err;
+  EXPECT_FALSE(Error::AddToPrintf(&err, FROM_HERE, "404", "%s %d", "a", 1));
+  EXPECT_EQ("a 1", err->GetMessage());
+
+  int min_log_level = logging::GetMinLogLevel();
+  logging::SetMinLogLevel(logging::LOG_FATAL);
+  EXPECT_FALSE(Error::AddToPrintf(nullptr, FROM_HERE, "404", "%s", "a"));
+  EXPECT_FALSE(Error::AddTo(nullptr, FROM_HERE, "404", "a"));
+  logging::SetMinLogLevel(min_log_level);
+}
+
 }  // namespace weave
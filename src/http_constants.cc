@@ -10,9 +10,18 @@
 namespace weave {
 namespace http {
 
+const char kAccept[] = "Accept";
+const char kAcceptEncoding[] = "Accept-Encoding";
 const char kAuthorization[] = "Authorization";
+const char kContentEncoding[] = "Content-Encoding";
 const char kContentType[] = "Content-Type";
+const char kRetryAfter[] = "Retry-After";
 
+const char kDeflate[] = "deflate";
+const char kGzip[] = "gzip";
+
+const char kCbor[] = "application/cbor";
+const char kEventStream[] = "text/event-stream";
 const char kJson[] = "application/json";
 const char kJsonUtf8[] = "application/json; charset=utf-8";
 const char kPlain[] = "text/plain";
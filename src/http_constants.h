@@ -18,9 +18,18 @@ const int kInternalServerError = 500;
 const int kServiceUnavailable = 503;
 const int kNotSupported = 501;
 
+extern const char kAccept[];
+extern const char kAcceptEncoding[];
 extern const char kAuthorization[];
+extern const char kContentEncoding[];
 extern const char kContentType[];
+extern const char kRetryAfter[];
 
+extern const char kDeflate[];
+extern const char kGzip[];
+
+extern const char kCbor[];
+extern const char kEventStream[];
 extern const char kJson[];
 extern const char kJsonUtf8[];
 extern const char kPlain[];
@@ -0,0 +1,396 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/json_stream_reader.h"
+
+#include <cmath>
+#include <cstring>
+
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
+#include <base/strings/utf_string_conversion_utils.h>
+#include <base/values.h>
+
+#include "src/json_error_codes.h"
+
+namespace weave {
+
+namespace {
+
+// Same as base::JSONReader.
+const size_t kMaxDepth = 100;
+
+bool IsDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+}  // namespace
+
+JsonStreamReader::JsonStreamReader(base::StringPiece json) : json_{json} {}
+
+JsonStreamReader::~JsonStreamReader() {}
+
+JsonStreamReader::Token JsonStreamReader::Next() {
+  if (token_ == Token::kEnd || token_ == Token::kError)
+    return token_;
+  SkipWhitespace();
+  switch (expect_) {
+    case Expect::kValue:
+      return ReadValueToken();
+    case Expect::kFirstItem:
+      if (pos_ < json_.size() && json_[pos_] == ']') {
+        ++pos_;
+        return EndScope(Token::kEndList);
+      }
+      return ReadValueToken();
+    case Expect::kFirstKey:
+      if (pos_ < json_.size() && json_[pos_] == '}') {
+        ++pos_;
+        return EndScope(Token::kEndDictionary);
+      }
+      return ReadKey();
+    case Expect::kKey:
+      return ReadKey();
+    case Expect::kAfterValue:
+      break;
+  }
+
+  if (scopes_.empty()) {
+    if (pos_ != json_.size())
+      return Fail("Unexpected data after the value");
+    return token_ = Token::kEnd;
+  }
+  if (pos_ == json_.size())
+    return Fail("Unexpected end of data");
+  char c = json_[pos_++];
+  if (scopes_.back() == Scope::kDictionary) {
+    if (c == '}')
+      return EndScope(Token::kEndDictionary);
+    if (c != ',')
+      return Fail("Expected ',' or '}'");
+    SkipWhitespace();
+    return ReadKey();
+  }
+  if (c == ']')
+    return EndScope(Token::kEndList);
+  if (c != ',')
+    return Fail("Expected ',' or ']'");
+  SkipWhitespace();
+  return ReadValueToken();
+}
+
+std::unique_ptr<base::Value> JsonStreamReader::ReadValue() {
+  switch (token_) {
+    case Token::kBeginDictionary: {
+      std::unique_ptr<base::DictionaryValue> dict{new base::DictionaryValue};
+      while (Next() == Token::kKey) {
+        std::string key = string_;
+        Next();
+        std::unique_ptr<base::Value> value = ReadValue();
+        if (!value)
+          return nullptr;
+        dict->SetWithoutPathExpansion(key, std::move(value));
+      }
+      if (token_ != Token::kEndDictionary)
+        return nullptr;
+      return std::move(dict);
+    }
+    case Token::kBeginList: {
+      std::unique_ptr<base::ListValue> list{new base::ListValue};
+      while (Next() != Token::kEndList) {
+        std::unique_ptr<base::Value> value = ReadValue();
+        if (!value)
+          return nullptr;
+        list->Append(std::move(value));
+      }
+      return std::move(list);
+    }
+    case Token::kString:
+      return std::unique_ptr<base::Value>{new base::StringValue{string_}};
+    case Token::kInteger:
+      return std::unique_ptr<base::Value>{new base::FundamentalValue{integer_}};
+    case Token::kDouble:
+      return std::unique_ptr<base::Value>{new base::FundamentalValue{number_}};
+    case Token::kBoolean:
+      return std::unique_ptr<base::Value>{
+          new base::FundamentalValue{GetBoolean()}};
+    case Token::kNull:
+      return base::Value::CreateNullValue();
+    case Token::kEndDictionary:
+    case Token::kEndList:
+    case Token::kKey:
+    case Token::kEnd:
+    case Token::kError:
+      break;
+  }
+  return nullptr;
+}
+
+bool JsonStreamReader::SkipValue() {
+  switch (token_) {
+    case Token::kBeginDictionary:
+    case Token::kBeginList: {
+      size_t depth = scopes_.size();
+      while (scopes_.size() >= depth) {
+        if (Next() == Token::kError)
+          return false;
+      }
+      return true;
+    }
+    case Token::kString:
+    case Token::kInteger:
+    case Token::kDouble:
+    case Token::kBoolean:
+    case Token::kNull:
+      return true;
+    case Token::kEndDictionary:
+    case Token::kEndList:
+    case Token::kKey:
+    case Token::kEnd:
+    case Token::kError:
+      break;
+  }
+  return false;
+}
+
+void JsonStreamReader::AddError(ErrorPtr* error) const {
+  if (token_ != Token::kError)
+    return;
+  Error::AddToPrintf(error, FROM_HERE, errors::json::kParseError,
+                     "Error '%s' occurred parsing JSON at offset %zu",
+                     error_message_, pos_);
+}
+
+JsonStreamReader::Token JsonStreamReader::ReadValueToken() {
+  if (pos_ == json_.size())
+    return Fail("Unexpected end of data");
+  expect_ = Expect::kAfterValue;
+  switch (json_[pos_]) {
+    case '{':
+    case '[': {
+      if (scopes_.size() >= kMaxDepth)
+        return Fail("Too much nesting");
+      bool dict = json_[pos_++] == '{';
+      scopes_.push_back(dict ? Scope::kDictionary : Scope::kList);
+      expect_ = dict ? Expect::kFirstKey : Expect::kFirstItem;
+      return token_ = dict ? Token::kBeginDictionary : Token::kBeginList;
+    }
+    case '"':
+      if (!ReadString())
+        return Token::kError;
+      return token_ = Token::kString;
+    case 't':
+      return ReadLiteral("true", Token::kBoolean, 1);
+    case 'f':
+      return ReadLiteral("false", Token::kBoolean, 0);
+    case 'n':
+      return ReadLiteral("null", Token::kNull, 0);
+    default:
+      return ReadNumber();
+  }
+}
+
+JsonStreamReader::Token JsonStreamReader::ReadKey() {
+  if (pos_ == json_.size() || json_[pos_] != '"')
+    return Fail("Expected a dictionary key");
+  if (!ReadString())
+    return Token::kError;
+  SkipWhitespace();
+  if (pos_ == json_.size() || json_[pos_] != ':')
+    return Fail("Expected ':'");
+  ++pos_;
+  expect_ = Expect::kValue;
+  return token_ = Token::kKey;
+}
+
+JsonStreamReader::Token JsonStreamReader::EndScope(Token token) {
+  scopes_.pop_back();
+  expect_ = Expect::kAfterValue;
+  return token_ = token;
+}
+
+bool JsonStreamReader::ReadString() {
+  DCHECK_EQ('"', json_[pos_]);
+  ++pos_;
+  string_.clear();
+  while (true) {
+    // Copy the runs of plain characters at once.
+    size_t start = pos_;
+    while (pos_ < json_.size() && json_[pos_] != '"' && json_[pos_] != '\\' &&
+           static_cast<unsigned char>(json_[pos_]) >= 0x20) {
+      ++pos_;
+    }
+    string_.append(json_.data() + start, pos_ - start);
+    if (pos_ == json_.size()) {
+      Fail("Unterminated string");
+      return false;
+    }
+    char c = json_[pos_++];
+    if (c == '"')
+      break;
+    if (c != '\\') {
+      Fail("Control character in a string");
+      return false;
+    }
+    if (pos_ == json_.size()) {
+      Fail("Unterminated string");
+      return false;
+    }
+    switch (json_[pos_++]) {
+      case '"':
+        string_.push_back('"');
+        break;
+      case '\\':
+        string_.push_back('\\');
+        break;
+      case '/':
+        string_.push_back('/');
+        break;
+      case 'b':
+        string_.push_back('\b');
+        break;
+      case 'f':
+        string_.push_back('\f');
+        break;
+      case 'n':
+        string_.push_back('\n');
+        break;
+      case 'r':
+        string_.push_back('\r');
+        break;
+      case 't':
+        string_.push_back('\t');
+        break;
+      case 'u': {
+        uint32_t code_point = 0;
+        if (!ReadHex4(&code_point))
+          return false;
+        if (code_point >= 0xDC00 && code_point <= 0xDFFF) {
+          Fail("Unpaired surrogate");
+          return false;
+        }
+        if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+          uint32_t low = 0;
+          if (json_.substr(pos_, 2) != "\\u") {
+            Fail("Unpaired surrogate");
+            return false;
+          }
+          pos_ += 2;
+          if (!ReadHex4(&low))
+            return false;
+          if (low < 0xDC00 || low > 0xDFFF) {
+            Fail("Unpaired surrogate");
+            return false;
+          }
+          code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+        }
+        base::WriteUnicodeCharacter(code_point, &string_);
+        break;
+      }
+      default:
+        Fail("Invalid escape sequence");
+        return false;
+    }
+  }
+  if (!base::IsStringUTF8(string_)) {
+    Fail("Invalid UTF-8 in a string");
+    return false;
+  }
+  return true;
+}
+
+bool JsonStreamReader::ReadHex4(uint32_t* code_unit) {
+  if (json_.size() - pos_ < 4) {
+    Fail("Unterminated string");
+    return false;
+  }
+  *code_unit = 0;
+  for (size_t i = 0; i < 4; i++) {
+    char c = json_[pos_++];
+    uint32_t digit = 0;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      Fail("Invalid escape sequence");
+      return false;
+    }
+    *code_unit = (*code_unit << 4) | digit;
+  }
+  return true;
+}
+
+JsonStreamReader::Token JsonStreamReader::ReadNumber() {
+  size_t start = pos_;
+  auto skip_digits = [this]() {
+    size_t digits_start = pos_;
+    while (pos_ < json_.size() && IsDigit(json_[pos_]))
+      ++pos_;
+    return pos_ - digits_start;
+  };
+  if (json_[pos_] == '-')
+    ++pos_;
+  if (pos_ < json_.size() && json_[pos_] == '0') {
+    ++pos_;
+  } else if (skip_digits() == 0) {
+    return Fail("Unexpected character");
+  }
+  bool integral = true;
+  if (pos_ < json_.size() && json_[pos_] == '.') {
+    ++pos_;
+    integral = false;
+    if (skip_digits() == 0)
+      return Fail("Invalid number");
+  }
+  if (pos_ < json_.size() && (json_[pos_] == 'e' || json_[pos_] == 'E')) {
+    ++pos_;
+    integral = false;
+    if (pos_ < json_.size() && (json_[pos_] == '+' || json_[pos_] == '-'))
+      ++pos_;
+    if (skip_digits() == 0)
+      return Fail("Invalid number");
+  }
+
+  base::StringPiece number = json_.substr(start, pos_ - start);
+  if (integral && base::StringToInt(number, &integer_)) {
+    number_ = integer_;
+    return token_ = Token::kInteger;
+  }
+  if (!base::StringToDouble(number.as_string(), &number_) ||
+      !std::isfinite(number_)) {
+    return Fail("Invalid number");
+  }
+  return token_ = Token::kDouble;
+}
+
+JsonStreamReader::Token JsonStreamReader::ReadLiteral(const char* literal,
+                                                      Token token,
+                                                      int value) {
+  size_t length = strlen(literal);
+  if (json_.substr(pos_, length) != literal)
+    return Fail("Unexpected character");
+  pos_ += length;
+  integer_ = value;
+  return token_ = token;
+}
+
+void JsonStreamReader::SkipWhitespace() {
+  while (pos_ < json_.size()) {
+    char c = json_[pos_];
+    if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+      break;
+    ++pos_;
+  }
+}
+
+JsonStreamReader::Token JsonStreamReader::Fail(const char* message) {
+  error_message_ = message;
+  return token_ = Token::kError;
+}
+
+}  // namespace weave
@@ -0,0 +1,123 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_JSON_STREAM_READER_H_
+#define LIBWEAVE_SRC_JSON_STREAM_READER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/strings/string_piece.h>
+#include <weave/error.h>
+
+namespace base {
+class Value;
+}  // namespace base
+
+namespace weave {
+
+// Reads JSON text one token at a time, without building a base::Value tree
+// for the whole document, so the items of a large list can be handled one by
+// one. Subtrees which are needed as base::Value can be built in place with
+// ReadValue(). Only RFC 8259 JSON is accepted, so unlike base::JSONReader
+// the reader rejects comments.
+//
+// E.g. to visit the items of the "commands" list of a dictionary:
+//   JsonStreamReader reader{json};
+//   if (reader.Next() != JsonStreamReader::Token::kBeginDictionary) ...
+//   while (reader.Next() == JsonStreamReader::Token::kKey) {
+//     if (reader.GetString() != "commands") {
+//       reader.Next();
+//       reader.SkipValue();
+//       continue;
+//     }
+//     ...
+//   }
+class JsonStreamReader final {
+ public:
+  enum class Token {
+    kBeginDictionary,
+    kEndDictionary,
+    kBeginList,
+    kEndList,
+    // A key of a dictionary member, the next token starts its value.
+    kKey,
+    kString,
+    kInteger,
+    kDouble,
+    kBoolean,
+    kNull,
+    // After the top-level value.
+    kEnd,
+    // The text is malformed, see AddError().
+    kError,
+  };
+
+  // |json| must outlive the reader.
+  explicit JsonStreamReader(base::StringPiece json);
+  ~JsonStreamReader();
+
+  // Reads the next token. Once kEnd or kError is returned, it is returned by
+  // all the later calls.
+  Token Next();
+  // Returns the last token read.
+  Token GetToken() const { return token_; }
+
+  // The contents of the last kKey or kString token.
+  const std::string& GetString() const { return string_; }
+  // The value of the last kInteger token.
+  int GetInteger() const { return integer_; }
+  // The value of the last kDouble or kInteger token.
+  double GetDouble() const { return number_; }
+  // The value of the last kBoolean token.
+  bool GetBoolean() const { return integer_ != 0; }
+
+  // Reads the rest of the value which starts with the last token read and
+  // builds it. Returns nullptr if the text is malformed or the last token
+  // doesn't start a value.
+  std::unique_ptr<base::Value> ReadValue();
+  // Same as ReadValue(), but doesn't build the value.
+  bool SkipValue();
+
+  // Returns the number of dictionaries and lists the reader is in.
+  size_t GetDepth() const { return scopes_.size(); }
+
+  // Adds the description of the syntax error to |error|, if the text is
+  // malformed.
+  void AddError(ErrorPtr* error) const;
+
+ private:
+  enum class Scope { kDictionary, kList };
+  enum class Expect { kValue, kFirstItem, kFirstKey, kKey, kAfterValue };
+
+  Token ReadValueToken();
+  Token ReadKey();
+  Token EndScope(Token token);
+  bool ReadString();
+  bool ReadHex4(uint32_t* code_unit);
+  Token ReadNumber();
+  Token ReadLiteral(const char* literal, Token token, int value);
+  void SkipWhitespace();
+  Token Fail(const char* message);
+
+  base::StringPiece json_;
+  size_t pos_{0};
+  std::vector<Scope> scopes_;
+  Expect expect_{Expect::kValue};
+  Token token_{Token::kNull};
+
+  std::string string_;
+  int integer_{0};
+  double number_{0};
+
+  const char* error_message_{nullptr};
+
+  DISALLOW_COPY_AND_ASSIGN(JsonStreamReader);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_JSON_STREAM_READER_H_
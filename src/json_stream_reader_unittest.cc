@@ -0,0 +1,138 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/json_stream_reader.h"
+
+#include <vector>
+
+#include <base/json/json_reader.h>
+#include <base/values.h>
+#include <gtest/gtest.h>
+
+namespace weave {
+
+namespace {
+
+using Token = JsonStreamReader::Token;
+
+std::vector<Token> ReadTokens(const std::string& json) {
+  JsonStreamReader reader{json};
+  std::vector<Token> tokens;
+  do {
+    tokens.push_back(reader.Next());
+  } while (tokens.back() != Token::kEnd && tokens.back() != Token::kError);
+  return tokens;
+}
+
+std::unique_ptr<base::Value> ReadValue(const std::string& json) {
+  JsonStreamReader reader{json};
+  reader.Next();
+  std::unique_ptr<base::Value> value = reader.ReadValue();
+  if (value && reader.Next() != Token::kEnd)
+    return nullptr;
+  return value;
+}
+
+}  // namespace
+
+TEST(JsonStreamReaderTest, Tokens) {
+  JsonStreamReader reader{
+      R"( {"a": [1, -2.5e1, "x\ny", true, false, null], "b": {}} )"};
+  EXPECT_EQ(Token::kBeginDictionary, reader.Next());
+  EXPECT_EQ(Token::kKey, reader.Next());
+  EXPECT_EQ("a", reader.GetString());
+  EXPECT_EQ(Token::kBeginList, reader.Next());
+  EXPECT_EQ(2u, reader.GetDepth());
+  EXPECT_EQ(Token::kInteger, reader.Next());
+  EXPECT_EQ(1, reader.GetInteger());
+  EXPECT_EQ(Token::kDouble, reader.Next());
+  EXPECT_EQ(-25.0, reader.GetDouble());
+  EXPECT_EQ(Token::kString, reader.Next());
+  EXPECT_EQ("x\ny", reader.GetString());
+  EXPECT_EQ(Token::kBoolean, reader.Next());
+  EXPECT_TRUE(reader.GetBoolean());
+  EXPECT_EQ(Token::kBoolean, reader.Next());
+  EXPECT_FALSE(reader.GetBoolean());
+  EXPECT_EQ(Token::kNull, reader.Next());
+  EXPECT_EQ(Token::kEndList, reader.Next());
+  EXPECT_EQ(Token::kKey, reader.Next());
+  EXPECT_EQ("b", reader.GetString());
+  EXPECT_EQ(Token::kBeginDictionary, reader.Next());
+  EXPECT_EQ(Token::kEndDictionary, reader.Next());
+  EXPECT_EQ(Token::kEndDictionary, reader.Next());
+  EXPECT_EQ(0u, reader.GetDepth());
+  EXPECT_EQ(Token::kEnd, reader.Next());
+  EXPECT_EQ(Token::kEnd, reader.Next());
+}
+
+TEST(JsonStreamReaderTest, ReadValue) {
+  const char kJson[] = R"({
+    "commands": [
+      {"id": "1", "parameters": {"x": 1, "y": [0.5, "\u00e9\ud83d\ude00"]}},
+      {"id": "2", "parameters": {}, "state": null, "flag": false}
+    ],
+    "count": 2147483648
+  })";
+  std::unique_ptr<base::Value> value = ReadValue(kJson);
+  ASSERT_TRUE(value);
+  EXPECT_TRUE(base::JSONReader::Read(kJson)->Equals(value.get()));
+}
+
+TEST(JsonStreamReaderTest, SkipValue) {
+  JsonStreamReader reader{R"([{"a": [1, {"b": []}]}, "c"])"};
+  EXPECT_EQ(Token::kBeginList, reader.Next());
+  EXPECT_EQ(Token::kBeginDictionary, reader.Next());
+  EXPECT_TRUE(reader.SkipValue());
+  EXPECT_EQ(Token::kString, reader.Next());
+  EXPECT_TRUE(reader.SkipValue());
+  EXPECT_EQ(Token::kEndList, reader.Next());
+  EXPECT_FALSE(reader.SkipValue());
+  EXPECT_EQ(Token::kEnd, reader.Next());
+}
+
+TEST(JsonStreamReaderTest, Errors) {
+  const char* kMalformed[] = {
+      "",
+      "{",
+      "[1,]",
+      "{\"a\" 1}",
+      "{\"a\": 1,}",
+      "{1: 2}",
+      "[1 2]",
+      "01",
+      "1.",
+      "-",
+      "1e999",
+      "tru",
+      "\"abc",
+      "\"\\x\"",
+      "\"\\ud83d\"",
+      "\"\\ude00\"",
+      "\"\t\"",
+      "\"\xff\"",
+      "// comment\n{}",
+      "{} {}",
+      "[]]",
+  };
+  for (const char* json : kMalformed) {
+    EXPECT_EQ(Token::kError, ReadTokens(json).back()) << json;
+    EXPECT_FALSE(ReadValue(json)) << json;
+  }
+
+  JsonStreamReader reader{"[1, x]"};
+  reader.Next();
+  reader.Next();
+  EXPECT_EQ(Token::kError, reader.Next());
+  EXPECT_EQ(Token::kError, reader.Next());
+  ErrorPtr error;
+  reader.AddError(&error);
+  EXPECT_TRUE(error->HasError("json_parse_error"));
+}
+
+TEST(JsonStreamReaderTest, MaxDepth) {
+  EXPECT_TRUE(ReadValue(std::string(100, '[') + std::string(100, ']')));
+  EXPECT_FALSE(ReadValue(std::string(101, '[') + std::string(101, ']')));
+}
+
+}  // namespace weave
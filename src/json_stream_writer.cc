@@ -0,0 +1,167 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/json_stream_writer.h"
+
+#include <base/json/string_escape.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/values.h>
+
+namespace weave {
+
+JsonStreamWriter::JsonStreamWriter(std::string* output) : output_{output} {
+  CHECK(output_);
+}
+
+JsonStreamWriter::~JsonStreamWriter() {
+  DCHECK(IsComplete());
+}
+
+void JsonStreamWriter::BeginDictionary() {
+  BeginElement();
+  output_->push_back('{');
+  scopes_.push_back(Scope::kDictionary);
+  first_element_ = true;
+}
+
+void JsonStreamWriter::EndDictionary() {
+  CHECK(!scopes_.empty() && scopes_.back() == Scope::kDictionary);
+  CHECK(!after_key_) << "Dictionary member value is missing";
+  output_->push_back('}');
+  scopes_.pop_back();
+  first_element_ = false;
+}
+
+void JsonStreamWriter::BeginList() {
+  BeginElement();
+  output_->push_back('[');
+  scopes_.push_back(Scope::kList);
+  first_element_ = true;
+}
+
+void JsonStreamWriter::EndList() {
+  CHECK(!scopes_.empty() && scopes_.back() == Scope::kList);
+  output_->push_back(']');
+  scopes_.pop_back();
+  first_element_ = false;
+}
+
+void JsonStreamWriter::WriteKey(const std::string& key) {
+  CHECK(!scopes_.empty() && scopes_.back() == Scope::kDictionary);
+  CHECK(!after_key_) << "Dictionary member value is missing";
+  if (!first_element_)
+    output_->push_back(',');
+  first_element_ = false;
+  base::EscapeJSONString(key, true, output_);
+  output_->push_back(':');
+  after_key_ = true;
+}
+
+void JsonStreamWriter::WriteString(const std::string& value) {
+  BeginElement();
+  base::EscapeJSONString(value, true, output_);
+}
+
+void JsonStreamWriter::WriteInteger(int value) {
+  BeginElement();
+  output_->append(base::IntToString(value));
+}
+
+void JsonStreamWriter::WriteDouble(double value) {
+  BeginElement();
+  std::string real = base::DoubleToString(value);
+  // Keep the value a real number when it is read back, same as
+  // base::JSONWriter does.
+  if (real.find_first_of(".eE") == std::string::npos)
+    real.append(".0");
+  if (real[0] == '.')
+    real.insert(0, 1, '0');
+  else if (real.length() > 1 && real[0] == '-' && real[1] == '.')
+    real.insert(1, 1, '0');
+  output_->append(real);
+}
+
+void JsonStreamWriter::WriteBool(bool value) {
+  BeginElement();
+  output_->append(value ? "true" : "false");
+}
+
+void JsonStreamWriter::WriteNull() {
+  BeginElement();
+  output_->append("null");
+}
+
+void JsonStreamWriter::WriteValue(const base::Value& value) {
+  switch (value.GetType()) {
+    case base::Value::TYPE_NULL:
+      return WriteNull();
+    case base::Value::TYPE_BOOLEAN: {
+      bool bool_value = false;
+      CHECK(value.GetAsBoolean(&bool_value));
+      return WriteBool(bool_value);
+    }
+    case base::Value::TYPE_INTEGER: {
+      int int_value = 0;
+      CHECK(value.GetAsInteger(&int_value));
+      return WriteInteger(int_value);
+    }
+    case base::Value::TYPE_DOUBLE: {
+      double double_value = 0;
+      CHECK(value.GetAsDouble(&double_value));
+      return WriteDouble(double_value);
+    }
+    case base::Value::TYPE_STRING: {
+      std::string string_value;
+      CHECK(value.GetAsString(&string_value));
+      return WriteString(string_value);
+    }
+    case base::Value::TYPE_LIST: {
+      const base::ListValue* list = nullptr;
+      CHECK(value.GetAsList(&list));
+      BeginList();
+      for (const auto& item : *list)
+        WriteValue(*item);
+      return EndList();
+    }
+    case base::Value::TYPE_DICTIONARY: {
+      const base::DictionaryValue* dict = nullptr;
+      CHECK(value.GetAsDictionary(&dict));
+      BeginDictionary();
+      for (base::DictionaryValue::Iterator it(*dict); !it.IsAtEnd();
+           it.Advance()) {
+        WriteKey(it.key());
+        WriteValue(it.value());
+      }
+      return EndDictionary();
+    }
+    case base::Value::TYPE_BINARY:
+      break;
+  }
+  LOG(FATAL) << "Unsupported value type: " << value.GetType();
+}
+
+void JsonStreamWriter::WriteJson(const std::string& json) {
+  DCHECK(!json.empty());
+  BeginElement();
+  output_->append(json);
+}
+
+void JsonStreamWriter::BeginElement() {
+  if (after_key_) {
+    after_key_ = false;
+    return;
+  }
+  if (scopes_.empty()) {
+    CHECK(first_element_) << "Only one top level value is allowed";
+    first_element_ = false;
+    return;
+  }
+  CHECK(scopes_.back() == Scope::kList) << "Dictionary member key is missing";
+  if (!first_element_)
+    output_->push_back(',');
+  first_element_ = false;
+}
+
+}  // namespace weave
@@ -0,0 +1,70 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_JSON_STREAM_WRITER_H_
+#define LIBWEAVE_SRC_JSON_STREAM_WRITER_H_
+
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+
+namespace base {
+class Value;
+}  // namespace base
+
+namespace weave {
+
+// Emits compact JSON text directly into |output|, without building an
+// intermediate base::Value tree for the whole document. Subtrees which are
+// already kept as base::Value can be written in place with WriteValue().
+// The produced text is the same base::JSONWriter generates, except that keys
+// of dictionaries started with BeginDictionary() keep the order they are
+// written in.
+class JsonStreamWriter final {
+ public:
+  explicit JsonStreamWriter(std::string* output);
+  ~JsonStreamWriter();
+
+  void BeginDictionary();
+  void EndDictionary();
+  void BeginList();
+  void EndList();
+
+  // Writes a key of the next dictionary member.
+  void WriteKey(const std::string& key);
+
+  void WriteString(const std::string& value);
+  void WriteInteger(int value);
+  void WriteDouble(double value);
+  void WriteBool(bool value);
+  void WriteNull();
+  // Writes |value| and all its children. Binary values are not supported.
+  void WriteValue(const base::Value& value);
+  // Writes |json|, the text of a single value serialized earlier by this
+  // class or base::JSONWriter, as is.
+  void WriteJson(const std::string& json);
+
+  // Returns true if all dictionaries and lists started have been ended.
+  bool IsComplete() const { return scopes_.empty(); }
+
+ private:
+  enum class Scope { kDictionary, kList };
+
+  // Emits a separator if a value is written after another one in a list.
+  void BeginElement();
+
+  std::string* output_;
+  std::vector<Scope> scopes_;
+  // Set when the current dictionary or list has no elements yet.
+  bool first_element_{true};
+  // Set between WriteKey() and the member value.
+  bool after_key_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(JsonStreamWriter);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_JSON_STREAM_WRITER_H_
@@ -0,0 +1,69 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/json_stream_writer.h"
+
+#include <string>
+
+#include <base/json/json_reader.h>
+#include <base/json/json_writer.h>
+#include <base/logging.h>
+#include <base/values.h>
+
+#include "src/test/benchmark.h"
+
+namespace weave {
+
+namespace {
+
+// A component tree like the ones returned by /privet/v3/components.
+std::string CreateComponentsJson() {
+  std::string json = "{\"hub\": {\"traits\": [\"onOff\"], \"components\": {";
+  json += "\"lights\": [";
+  for (int i = 0; i < 16; ++i) {
+    if (i)
+      json += ",";
+    json +=
+        "{\"traits\": [\"onOff\", \"brightness\", \"colorXy\"],"
+        " \"state\": {\"onOff\": {\"state\": \"on\"},"
+        " \"brightness\": {\"brightness\": " + std::to_string(i * 5) + "},"
+        " \"colorXy\": {\"colorSetting\": {\"colorX\": 0.25,"
+        " \"colorY\": 0.75}}}}";
+  }
+  json += "]}, \"state\": {\"onOff\": {\"state\": \"off\"}}}}";
+  return json;
+}
+
+void BM_JsonRead(test::BenchmarkState* state) {
+  std::string json = CreateComponentsJson();
+  while (state->KeepRunning())
+    CHECK(base::JSONReader::Read(json));
+  state->SetBytesProcessed(state->iterations() * json.size());
+}
+WEAVE_BENCHMARK(BM_JsonRead);
+
+void BM_JsonWrite(test::BenchmarkState* state) {
+  auto value = base::JSONReader::Read(CreateComponentsJson());
+  std::string json;
+  while (state->KeepRunning())
+    CHECK(base::JSONWriter::Write(*value, &json));
+  state->SetBytesProcessed(state->iterations() * json.size());
+}
+WEAVE_BENCHMARK(BM_JsonWrite);
+
+void BM_JsonStreamWriterWriteValue(test::BenchmarkState* state) {
+  auto value = base::JSONReader::Read(CreateComponentsJson());
+  std::string json;
+  while (state->KeepRunning()) {
+    json.clear();
+    JsonStreamWriter writer{&json};
+    writer.WriteValue(*value);
+  }
+  state->SetBytesProcessed(state->iterations() * json.size());
+}
+WEAVE_BENCHMARK(BM_JsonStreamWriterWriteValue);
+
+}  // namespace
+
+}  // namespace weave
@@ -0,0 +1,85 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/json_stream_writer.h"
+
+#include <base/json/json_writer.h>
+#include <base/values.h>
+#include <gtest/gtest.h>
+#include <weave/test/unittest_utils.h>
+
+namespace weave {
+
+using test::CreateValue;
+
+TEST(JsonStreamWriter, Primitives) {
+  std::string json;
+  JsonStreamWriter writer{&json};
+  writer.BeginList();
+  writer.WriteString("a\"b");
+  writer.WriteInteger(-5);
+  writer.WriteDouble(2);
+  writer.WriteDouble(-0.5);
+  writer.WriteBool(true);
+  writer.WriteNull();
+  writer.BeginList();
+  writer.EndList();
+  writer.BeginDictionary();
+  writer.EndDictionary();
+  writer.EndList();
+  EXPECT_TRUE(writer.IsComplete());
+  EXPECT_EQ(R"(["a\"b",-5,2.0,-0.5,true,null,[],{}])", json);
+}
+
+TEST(JsonStreamWriter, KeepsMemberOrder) {
+  std::string json;
+  JsonStreamWriter writer{&json};
+  writer.BeginDictionary();
+  writer.WriteKey("z");
+  writer.BeginList();
+  writer.BeginDictionary();
+  writer.WriteKey("b");
+  writer.WriteInteger(1);
+  writer.WriteKey("a");
+  writer.WriteInteger(2);
+  writer.EndDictionary();
+  writer.EndList();
+  EXPECT_FALSE(writer.IsComplete());
+  writer.WriteKey("y");
+  writer.WriteString("");
+  writer.EndDictionary();
+  EXPECT_TRUE(writer.IsComplete());
+  EXPECT_EQ(R"({"z":[{"b":1,"a":2}],"y":""})", json);
+}
+
+TEST(JsonStreamWriter, WriteValueMatchesJsonWriter) {
+  auto value = CreateValue(R"({
+    'traits': {'t': {'state': {'p': {'type': 'number', 'minimum': 0.25}}}},
+    'components': {'c': {'traits': ['t'], 'state': {'t': {'p': 1.0}}}},
+    'list': [1, 'two', [], {}, null, false, -3.5e20]
+  })");
+  std::string expected;
+  ASSERT_TRUE(base::JSONWriter::Write(*value, &expected));
+
+  std::string json;
+  JsonStreamWriter writer{&json};
+  writer.WriteValue(*value);
+  EXPECT_EQ(expected, json);
+}
+
+TEST(JsonStreamWriter, WriteJson) {
+  std::string json;
+  JsonStreamWriter writer{&json};
+  writer.BeginList();
+  writer.WriteJson(R"({"a":[1,2]})");
+  writer.WriteJson("null");
+  writer.BeginDictionary();
+  writer.WriteKey("b");
+  writer.WriteJson("true");
+  writer.EndDictionary();
+  writer.EndList();
+  EXPECT_EQ(R"([{"a":[1,2]},null,{"b":true}])", json);
+}
+
+}  // namespace weave
@@ -0,0 +1,73 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/memory_budget.h"
+
+#include <base/bind.h>
+#include <base/logging.h>
+
+namespace weave {
+
+namespace {
+
+const int kCheckIntervalSeconds = 10;
+
+}  // namespace
+
+MemoryBudgetMonitor::MemoryBudgetMonitor(provider::TaskRunner* task_runner,
+                                         const Hooks& hooks)
+    : hooks_{hooks},
+      timer_{task_runner, provider::TaskRunner::Priority::kBackground} {}
+
+void MemoryBudgetMonitor::SetBudget(const MemoryBudget& budget) {
+  budget_ = budget;
+  if (budget_.bytes > 0)
+    return Check();
+  timer_.Stop();
+  SetRejectLongPolls(false);
+}
+
+void MemoryBudgetMonitor::Check() {
+  timer_.Start(FROM_HERE, base::TimeDelta::FromSeconds(kCheckIntervalSeconds),
+               base::Bind(&MemoryBudgetMonitor::Check, base::Unretained(this)));
+
+  const struct {
+    int percent;
+    const base::Closure& step;
+    const char* name;
+  } steps[] = {
+      {budget_.merge_state_history_percent, hooks_.merge_state_history,
+       "merged state history"},
+      {budget_.shrink_revocation_list_percent, hooks_.shrink_revocation_list,
+       "shrank revocation list"},
+      {budget_.drop_cached_serializations_percent,
+       hooks_.drop_cached_serializations, "dropped cached serializations"},
+  };
+
+  size_t usage = hooks_.measure.Run();
+  for (const auto& step : steps) {
+    if (usage < GetThreshold(step.percent))
+      continue;
+    step.step.Run();
+    size_t freed_usage = hooks_.measure.Run();
+    VLOG(1) << "Memory usage " << usage << " of " << budget_.bytes
+            << " bytes, " << step.name << ", now " << freed_usage;
+    usage = freed_usage;
+  }
+  SetRejectLongPolls(usage >= GetThreshold(budget_.reject_long_polls_percent));
+}
+
+size_t MemoryBudgetMonitor::GetThreshold(int percent) const {
+  return budget_.bytes / 100 * percent + budget_.bytes % 100 * percent / 100;
+}
+
+void MemoryBudgetMonitor::SetRejectLongPolls(bool reject) {
+  if (rejecting_long_polls_ == reject)
+    return;
+  rejecting_long_polls_ = reject;
+  LOG_IF(WARNING, reject) << "Memory usage over budget, rejecting long polls";
+  hooks_.set_reject_long_polls.Run(reject);
+}
+
+}  // namespace weave
@@ -0,0 +1,59 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_MEMORY_BUDGET_H_
+#define LIBWEAVE_SRC_MEMORY_BUDGET_H_
+
+#include <stddef.h>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/time/time.h>
+#include <weave/settings.h>
+
+#include "src/timer.h"
+
+namespace weave {
+
+// Keeps the memory usage of a device within a MemoryBudget. Measures the
+// usage periodically and runs the degradation steps of the budget in order,
+// measuring again after each step.
+class MemoryBudgetMonitor final {
+ public:
+  // Hooks of the degradation steps, see MemoryBudget.
+  struct Hooks {
+    // Returns the estimated memory usage of the device.
+    base::Callback<size_t()> measure;
+    base::Closure merge_state_history;
+    base::Closure shrink_revocation_list;
+    base::Closure drop_cached_serializations;
+    base::Callback<void(bool)> set_reject_long_polls;
+  };
+
+  MemoryBudgetMonitor(provider::TaskRunner* task_runner, const Hooks& hooks);
+
+  // Replaces the budget and checks it right away. A budget of zero bytes
+  // stops the checks and lets long polls in again.
+  void SetBudget(const MemoryBudget& budget);
+
+  // Measures the usage and takes the steps it calls for.
+  void Check();
+
+  bool IsRejectingLongPolls() const { return rejecting_long_polls_; }
+
+ private:
+  size_t GetThreshold(int percent) const;
+  void SetRejectLongPolls(bool reject);
+
+  const Hooks hooks_;
+  MemoryBudget budget_;
+  bool rejecting_long_polls_{false};
+  OneShotTimer timer_;
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryBudgetMonitor);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_MEMORY_BUDGET_H_
@@ -0,0 +1,106 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/memory_budget.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
+
+namespace weave {
+
+class MemoryBudgetMonitorTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    MemoryBudgetMonitor::Hooks hooks;
+    hooks.measure = base::Bind(&MemoryBudgetMonitorTest::Measure,
+                               base::Unretained(this));
+    hooks.merge_state_history =
+        base::Bind(&MemoryBudgetMonitorTest::RunStep, base::Unretained(this),
+                   "merge", 100);
+    hooks.shrink_revocation_list =
+        base::Bind(&MemoryBudgetMonitorTest::RunStep, base::Unretained(this),
+                   "shrink", 50);
+    hooks.drop_cached_serializations =
+        base::Bind(&MemoryBudgetMonitorTest::RunStep, base::Unretained(this),
+                   "drop", 50);
+    hooks.set_reject_long_polls = base::Bind(
+        &MemoryBudgetMonitorTest::SetReject, base::Unretained(this));
+    monitor_.reset(new MemoryBudgetMonitor{&task_runner_, hooks});
+    budget_.bytes = 1000;
+  }
+
+  size_t Measure() { return usage_; }
+
+  void RunStep(const char* name, size_t freed) {
+    steps_.push_back(name);
+    usage_ -= std::min(usage_, freed);
+  }
+
+  void SetReject(bool reject) { steps_.push_back(reject ? "reject" : "allow"); }
+
+  provider::test::FakeTaskRunner task_runner_;
+  std::unique_ptr<MemoryBudgetMonitor> monitor_;
+  MemoryBudget budget_;
+  size_t usage_{0};
+  std::vector<std::string> steps_;
+};
+
+TEST_F(MemoryBudgetMonitorTest, NoBudget) {
+  usage_ = 10000;
+  monitor_->SetBudget(MemoryBudget{});
+  EXPECT_TRUE(steps_.empty());
+  EXPECT_EQ(0u, task_runner_.GetTaskQueueSize());
+}
+
+TEST_F(MemoryBudgetMonitorTest, StepsInOrder) {
+  usage_ = 500;
+  monitor_->SetBudget(budget_);
+  EXPECT_TRUE(steps_.empty());
+  EXPECT_EQ(1u, task_runner_.GetTaskQueueSize());
+
+  // The first step frees enough.
+  usage_ = 750;
+  monitor_->Check();
+  EXPECT_EQ((std::vector<std::string>{"merge"}), steps_);
+  EXPECT_EQ(650u, usage_);
+
+  // The steps free too little, so long polls are rejected.
+  steps_.clear();
+  usage_ = 1250;
+  monitor_->Check();
+  EXPECT_EQ((std::vector<std::string>{"merge", "shrink", "drop", "reject"}),
+            steps_);
+  EXPECT_EQ(1050u, usage_);
+  EXPECT_TRUE(monitor_->IsRejectingLongPolls());
+
+  // Each step is only taken while the usage is over its threshold.
+  steps_.clear();
+  usage_ = 1000;
+  monitor_->Check();
+  EXPECT_EQ((std::vector<std::string>{"merge", "shrink", "allow"}), steps_);
+  EXPECT_FALSE(monitor_->IsRejectingLongPolls());
+}
+
+TEST_F(MemoryBudgetMonitorTest, PeriodicCheck) {
+  usage_ = 100;
+  monitor_->SetBudget(budget_);
+  usage_ = 2000;
+  task_runner_.RunOnce();
+  EXPECT_TRUE(monitor_->IsRejectingLongPolls());
+  EXPECT_EQ(1u, task_runner_.GetTaskQueueSize());
+
+  // Removing the budget stops the checks and lets long polls in.
+  steps_.clear();
+  monitor_->SetBudget(MemoryBudget{});
+  EXPECT_EQ((std::vector<std::string>{"allow"}), steps_);
+  EXPECT_EQ(0u, task_runner_.GetTaskQueueSize());
+}
+
+}  // namespace weave
@@ -0,0 +1,87 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/memory_usage.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include <base/logging.h>
+
+namespace weave {
+
+namespace {
+
+int ToJsonInt(size_t value) {
+  return static_cast<int>(std::min<size_t>(
+      value, static_cast<size_t>(std::numeric_limits<int>::max())));
+}
+
+}  // namespace
+
+std::unique_ptr<base::DictionaryValue> MemoryUsage::ToJson() const {
+  std::unique_ptr<base::DictionaryValue> result{new base::DictionaryValue};
+  result->SetInteger("count", ToJsonInt(count));
+  result->SetInteger("bytes", ToJsonInt(bytes));
+  return result;
+}
+
+size_t EstimateMemoryUsage(const std::string& str) {
+  // Strings shorter than the string object itself are usually kept inline.
+  if (str.capacity() < sizeof(std::string))
+    return 0;
+  return str.capacity() + 1;
+}
+
+size_t EstimateMemoryUsage(const base::Value& value) {
+  switch (value.GetType()) {
+    case base::Value::TYPE_NULL:
+      return sizeof(base::Value);
+    case base::Value::TYPE_BOOLEAN:
+    case base::Value::TYPE_INTEGER:
+    case base::Value::TYPE_DOUBLE:
+      return sizeof(base::FundamentalValue);
+    case base::Value::TYPE_STRING: {
+      // Strings parsed by base::JSONReader may refer to the parsed input,
+      // instead of being StringValue.
+      const base::StringValue* string_value = nullptr;
+      if (!value.GetAsString(&string_value))
+        return sizeof(base::StringValue);
+      return sizeof(base::StringValue) +
+             EstimateMemoryUsage(string_value->GetString());
+    }
+    case base::Value::TYPE_BINARY: {
+      const base::BinaryValue* binary_value = nullptr;
+      CHECK(value.GetAsBinary(&binary_value));
+      return sizeof(base::BinaryValue) + binary_value->GetSize();
+    }
+    case base::Value::TYPE_DICTIONARY: {
+      const base::DictionaryValue* dict = nullptr;
+      CHECK(value.GetAsDictionary(&dict));
+      size_t bytes = sizeof(base::DictionaryValue);
+      for (base::DictionaryValue::Iterator it{*dict}; !it.IsAtEnd();
+           it.Advance()) {
+        bytes += sizeof(std::pair<std::string, std::unique_ptr<base::Value>>) +
+                 EstimateMemoryUsage(it.key()) +
+                 EstimateMemoryUsage(it.value());
+      }
+      return bytes;
+    }
+    case base::Value::TYPE_LIST: {
+      const base::ListValue* list = nullptr;
+      CHECK(value.GetAsList(&list));
+      size_t bytes = sizeof(base::ListValue);
+      for (const auto& item : *list) {
+        bytes +=
+            sizeof(std::unique_ptr<base::Value>) + EstimateMemoryUsage(*item);
+      }
+      return bytes;
+    }
+  }
+  NOTREACHED();
+  return 0;
+}
+
+}  // namespace weave
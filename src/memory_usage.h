@@ -0,0 +1,57 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_MEMORY_USAGE_H_
+#define LIBWEAVE_SRC_MEMORY_USAGE_H_
+
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include <base/values.h>
+
+namespace weave {
+
+// Approximate heap memory held by a subsystem, reported by
+// Device::GetMemoryStats(). |count| is the number of elements, e.g. commands
+// in a queue, and |bytes| their estimated size. Estimates ignore allocator
+// overhead and spare container capacity they can't see.
+struct MemoryUsage {
+  size_t count{0};
+  size_t bytes{0};
+
+  MemoryUsage& operator+=(const MemoryUsage& other) {
+    count += other.count;
+    bytes += other.bytes;
+    return *this;
+  }
+
+  // Returns {"count": <count>, "bytes": <bytes>}.
+  std::unique_ptr<base::DictionaryValue> ToJson() const;
+};
+
+// Overhead of a node of std::map and std::set, and of an element of the
+// unordered containers, besides the value itself.
+const size_t kTreeNodeOverhead = 4 * sizeof(void*);
+const size_t kHashNodeOverhead = 3 * sizeof(void*);
+
+// Releases the spare capacity of a vector or deque. Unlike shrink_to_fit(),
+// which libstdc++ ignores with exceptions disabled.
+template <typename Container>
+void ShrinkToFit(Container* container) {
+  Container{std::make_move_iterator(container->begin()),
+            std::make_move_iterator(container->end())}
+      .swap(*container);
+}
+
+// Returns the heap memory held by |str|, zero for short strings stored inline.
+size_t EstimateMemoryUsage(const std::string& str);
+
+// Returns the heap memory held by |value| and its children, including |value|
+// itself.
+size_t EstimateMemoryUsage(const base::Value& value);
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_MEMORY_USAGE_H_
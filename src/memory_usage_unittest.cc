@@ -0,0 +1,39 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/memory_usage.h"
+
+#include <gtest/gtest.h>
+#include <weave/test/unittest_utils.h>
+
+namespace weave {
+
+using test::CreateDictionaryValue;
+
+TEST(MemoryUsage, ToJson) {
+  MemoryUsage usage;
+  usage.count = 2;
+  usage.bytes = 100;
+  usage += usage;
+  EXPECT_JSON_EQ(R"({"count": 4, "bytes": 200})", *usage.ToJson());
+}
+
+TEST(MemoryUsage, String) {
+  EXPECT_EQ(0u, EstimateMemoryUsage(std::string{}));
+  std::string str(1000, 'a');
+  EXPECT_LE(1001u, EstimateMemoryUsage(str));
+}
+
+TEST(MemoryUsage, Value) {
+  auto small = CreateDictionaryValue(R"({"a": 1})");
+  auto large = CreateDictionaryValue(R"({
+    "a": 1,
+    "b": "a string which does not fit into the string object",
+    "c": [1, 2, {"d": true}]
+  })");
+  EXPECT_LT(sizeof(base::DictionaryValue), EstimateMemoryUsage(*small));
+  EXPECT_LT(EstimateMemoryUsage(*small) + 50, EstimateMemoryUsage(*large));
+}
+
+}  // namespace weave
@@ -0,0 +1,114 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/metrics.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+namespace weave {
+
+namespace {
+
+// Upper bounds of the histogram buckets, from the Privet handlers running
+// within a fraction of a millisecond to reconnects taking minutes.
+const double kBucketUpperBoundsMs[] = {
+    0.1, 0.2,  0.5,  1,    2,    5,     10,    20,    50,    100,
+    200, 500,  1000, 2000, 5000, 10000, 20000, 50000, 100000};
+
+const size_t kBucketCount = arraysize(kBucketUpperBoundsMs) + 1;
+
+int ToJsonInt(uint64_t count) {
+  return static_cast<int>(std::min<uint64_t>(
+      count, static_cast<uint64_t>(std::numeric_limits<int>::max())));
+}
+
+}  // namespace
+
+struct Metrics::Histogram {
+  uint64_t count{0};
+  base::TimeDelta sum;
+  base::TimeDelta min{base::TimeDelta::Max()};
+  base::TimeDelta max;
+  uint64_t buckets[kBucketCount]{};
+
+  // Returns the upper bound of the bucket of the |percentile|-th sample, but
+  // no more than the maximum.
+  double GetPercentileMs(double percentile) const {
+    uint64_t rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(percentile / 100 * count + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i + 1 < kBucketCount; ++i) {
+      seen += buckets[i];
+      if (seen >= rank)
+        return std::min(kBucketUpperBoundsMs[i], max.InMillisecondsF());
+    }
+    return max.InMillisecondsF();
+  }
+};
+
+Metrics::Metrics() {}
+
+Metrics::~Metrics() {}
+
+void Metrics::RecordLatency(const std::string& name, base::TimeDelta latency) {
+  std::unique_ptr<Histogram>& histogram = histograms_[name];
+  if (!histogram)
+    histogram.reset(new Histogram);
+  latency = std::max(latency, base::TimeDelta{});
+  ++histogram->count;
+  histogram->sum += latency;
+  histogram->min = std::min(histogram->min, latency);
+  histogram->max = std::max(histogram->max, latency);
+  size_t bucket =
+      std::lower_bound(std::begin(kBucketUpperBoundsMs),
+                       std::end(kBucketUpperBoundsMs),
+                       latency.InMillisecondsF()) -
+      std::begin(kBucketUpperBoundsMs);
+  ++histogram->buckets[bucket];
+}
+
+void Metrics::IncrementCounter(const std::string& name) {
+  ++counters_[name];
+}
+
+std::unique_ptr<base::DictionaryValue> Metrics::ToJson() const {
+  std::unique_ptr<base::DictionaryValue> counters{new base::DictionaryValue};
+  for (const auto& pair : counters_) {
+    counters->SetWithoutPathExpansion(
+        pair.first, new base::FundamentalValue{ToJsonInt(pair.second)});
+  }
+
+  std::unique_ptr<base::DictionaryValue> histograms{new base::DictionaryValue};
+  for (const auto& pair : histograms_) {
+    const Histogram& histogram = *pair.second;
+    std::unique_ptr<base::DictionaryValue> value{new base::DictionaryValue};
+    value->SetInteger("count", ToJsonInt(histogram.count));
+    value->SetDouble("sumMs", histogram.sum.InMillisecondsF());
+    value->SetDouble("minMs", histogram.min.InMillisecondsF());
+    value->SetDouble("maxMs", histogram.max.InMillisecondsF());
+    value->SetDouble("p50Ms", histogram.GetPercentileMs(50));
+    value->SetDouble("p99Ms", histogram.GetPercentileMs(99));
+    std::unique_ptr<base::ListValue> buckets{new base::ListValue};
+    for (size_t i = 0; i < kBucketCount; ++i) {
+      if (!histogram.buckets[i])
+        continue;
+      std::unique_ptr<base::DictionaryValue> bucket{new base::DictionaryValue};
+      if (i + 1 < kBucketCount)
+        bucket->SetDouble("upperBoundMs", kBucketUpperBoundsMs[i]);
+      bucket->SetInteger("count", ToJsonInt(histogram.buckets[i]));
+      buckets->Append(std::move(bucket));
+    }
+    value->Set("buckets", std::move(buckets));
+    histograms->SetWithoutPathExpansion(pair.first, std::move(value));
+  }
+
+  std::unique_ptr<base::DictionaryValue> result{new base::DictionaryValue};
+  result->Set("counters", std::move(counters));
+  result->Set("histograms", std::move(histograms));
+  return result;
+}
+
+}  // namespace weave
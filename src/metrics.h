@@ -0,0 +1,73 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_METRICS_H_
+#define LIBWEAVE_SRC_METRICS_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+#include <base/values.h>
+
+namespace weave {
+
+// Metrics are recorded in debug builds, and in release builds compiled with
+// WEAVE_METRICS defined (make METRICS=1). Otherwise the WEAVE_RECORD_* macros
+// below don't even evaluate their arguments. Code doing more work to record
+// a metric should check kMetricsEnabled itself.
+#if !defined(NDEBUG) || defined(WEAVE_METRICS)
+const bool kMetricsEnabled = true;
+#else
+const bool kMetricsEnabled = false;
+#endif
+
+// Latency histograms and counters of the hot paths of a device, exposed by
+// Device::GetMetrics(). Names are a metric, optionally followed by a space and
+// a label, e.g. "cloud_request POST devices/*/patchState".
+class Metrics final {
+ public:
+  Metrics();
+  ~Metrics();
+
+  void RecordLatency(const std::string& name, base::TimeDelta latency);
+  void IncrementCounter(const std::string& name);
+
+  // Returns {"counters": {<name>: <count>}, "histograms": {<name>: {...}}},
+  // where histograms have the "count", the "sumMs", "minMs", "maxMs", the
+  // "p50Ms" and "p99Ms" estimated from the buckets, and the non-empty
+  // "buckets" as [{"upperBoundMs": <ms>, "count": <count>}]. The last bucket
+  // has no upper bound.
+  std::unique_ptr<base::DictionaryValue> ToJson() const;
+
+ private:
+  struct Histogram;
+
+  std::map<std::string, std::unique_ptr<Histogram>> histograms_;
+  std::map<std::string, uint64_t> counters_;
+
+  DISALLOW_COPY_AND_ASSIGN(Metrics);
+};
+
+}  // namespace weave
+
+// |metrics| may be null, if the owner of the instrumented object has no
+// Metrics.
+#define WEAVE_RECORD_LATENCY(metrics, name, latency) \
+  do {                                               \
+    if (::weave::kMetricsEnabled && (metrics))       \
+      (metrics)->RecordLatency((name), (latency));   \
+  } while (false)
+
+#define WEAVE_RECORD_COUNT(metrics, name)      \
+  do {                                         \
+    if (::weave::kMetricsEnabled && (metrics)) \
+      (metrics)->IncrementCounter((name));     \
+  } while (false)
+
+#endif  // LIBWEAVE_SRC_METRICS_H_
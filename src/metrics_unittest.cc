@@ -0,0 +1,111 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/metrics.h"
+
+#include <gtest/gtest.h>
+#include <weave/test/unittest_utils.h>
+
+namespace weave {
+
+namespace {
+
+base::TimeDelta Ms(double ms) {
+  return base::TimeDelta::FromMicroseconds(static_cast<int64_t>(ms * 1000));
+}
+
+}  // namespace
+
+TEST(Metrics, Empty) {
+  Metrics metrics;
+  EXPECT_JSON_EQ(R"({"counters": {}, "histograms": {}})", *metrics.ToJson());
+}
+
+TEST(Metrics, Counters) {
+  Metrics metrics;
+  metrics.IncrementCounter("xmpp_restart");
+  metrics.IncrementCounter("cloud_request_error GET commands/queue");
+  metrics.IncrementCounter("xmpp_restart");
+  EXPECT_JSON_EQ(R"({
+    "counters": {
+      "cloud_request_error GET commands/queue": 1,
+      "xmpp_restart": 2
+    },
+    "histograms": {}
+  })",
+                 *metrics.ToJson());
+}
+
+TEST(Metrics, Histogram) {
+  Metrics metrics;
+  metrics.RecordLatency("privet_request /privet/info", Ms(0.3));
+  metrics.RecordLatency("privet_request /privet/info", Ms(0.5));
+  metrics.RecordLatency("privet_request /privet/info", Ms(3));
+  metrics.RecordLatency("privet_request /privet/info", Ms(1.2));
+  EXPECT_JSON_EQ(R"({
+    "counters": {},
+    "histograms": {
+      "privet_request /privet/info": {
+        "count": 4,
+        "sumMs": 5.0,
+        "minMs": 0.3,
+        "maxMs": 3.0,
+        "p50Ms": 0.5,
+        "p99Ms": 3.0,
+        "buckets": [
+          {"upperBoundMs": 0.5, "count": 2},
+          {"upperBoundMs": 2.0, "count": 1},
+          {"upperBoundMs": 5.0, "count": 1}
+        ]
+      }
+    }
+  })",
+                 *metrics.ToJson());
+}
+
+TEST(Metrics, Percentiles) {
+  Metrics metrics;
+  for (int i = 0; i < 98; ++i)
+    metrics.RecordLatency("latency", Ms(15));
+  metrics.RecordLatency("latency", Ms(150));
+  metrics.RecordLatency("latency", Ms(150));
+  auto json = metrics.ToJson();
+  double value = 0;
+  EXPECT_TRUE(json->GetDouble("histograms.latency.p50Ms", &value));
+  EXPECT_DOUBLE_EQ(20, value);
+  EXPECT_TRUE(json->GetDouble("histograms.latency.p99Ms", &value));
+  EXPECT_DOUBLE_EQ(150, value);
+}
+
+TEST(Metrics, Overflow) {
+  Metrics metrics;
+  metrics.RecordLatency("xmpp_connect", base::TimeDelta::FromMinutes(5));
+  metrics.RecordLatency("xmpp_connect", -base::TimeDelta::FromSeconds(1));
+  EXPECT_JSON_EQ(R"({
+    "counters": {},
+    "histograms": {
+      "xmpp_connect": {
+        "count": 2,
+        "sumMs": 300000.0,
+        "minMs": 0.0,
+        "maxMs": 300000.0,
+        "p50Ms": 0.1,
+        "p99Ms": 300000.0,
+        "buckets": [
+          {"upperBoundMs": 0.1, "count": 1},
+          {"count": 1}
+        ]
+      }
+    }
+  })",
+                 *metrics.ToJson());
+}
+
+TEST(Metrics, NullMetrics) {
+  Metrics* metrics = nullptr;
+  WEAVE_RECORD_LATENCY(metrics, "latency", base::TimeDelta{});
+  WEAVE_RECORD_COUNT(metrics, "count");
+}
+
+}  // namespace weave
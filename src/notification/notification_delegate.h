@@ -15,8 +15,14 @@ namespace weave {
 class NotificationDelegate {
  public:
   virtual void OnConnected(const std::string& channel_name) = 0;
+  // Called once the connected channel has proven to work, e.g. when the server
+  // answers the first keepalive ping.
+  virtual void OnConnectionConfirmed(const std::string& channel_name) = 0;
   virtual void OnDisconnected() = 0;
   virtual void OnPermanentFailure() = 0;
+  // Returns true if the command |command_id| was received already, through
+  // any of the channels, so its notification can be dropped unparsed.
+  virtual bool IsCommandKnown(const std::string& command_id) const = 0;
   // Called when a new command is sent via the notification channel.
   virtual void OnCommandCreated(const base::DictionaryValue& command,
                                 const std::string& channel_name) = 0;
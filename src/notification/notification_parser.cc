@@ -6,6 +6,8 @@
 
 #include <base/logging.h>
 
+#include "src/json_stream_reader.h"
+
 namespace weave {
 
 namespace {
@@ -68,4 +70,28 @@ bool ParseNotificationJson(const base::DictionaryValue& notification,
   return true;
 }
 
+bool IsHandledNotificationType(const std::string& json) {
+  // The types handled by ParseNotificationJson(), in quotes (a JSON string).
+  for (const char* type : {"\"COMMAND_CREATED\"", "\"DEVICE_DELETED\""}) {
+    if (json.find(type) != std::string::npos)
+      return true;
+  }
+  return false;
+}
+
+std::string GetNotificationCommandId(const std::string& json) {
+  using Token = JsonStreamReader::Token;
+  JsonStreamReader reader{json};
+  if (reader.Next() != Token::kBeginDictionary)
+    return {};
+  while (reader.Next() == Token::kKey) {
+    bool is_command_id = reader.GetString() == "commandId";
+    if (reader.Next() == Token::kString && is_command_id)
+      return reader.GetString();
+    if (!reader.SkipValue())
+      break;
+  }
+  return {};
+}
+
 }  // namespace weave
@@ -20,6 +20,16 @@ bool ParseNotificationJson(const base::DictionaryValue& notification,
                            NotificationDelegate* delegate,
                            const std::string& channel_name);
 
+// Returns whether the notification JSON |json| may be of a type handled by
+// ParseNotificationJson(), without parsing it, so the other notifications are
+// dropped before building their tree. It looks for the quoted type names,
+// which GCD writes without escapes.
+bool IsHandledNotificationType(const std::string& json);
+
+// Returns the top-level "commandId" of the notification JSON |json|, or an
+// empty string if there is none. The JSON is scanned, not built.
+std::string GetNotificationCommandId(const std::string& json);
+
 }  // namespace weave
 
 #endif  // LIBWEAVE_SRC_NOTIFICATION_NOTIFICATION_PARSER_H_
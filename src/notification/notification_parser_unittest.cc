@@ -23,12 +23,14 @@ MATCHER_P(MatchDict, str, "") {
 class MockNotificationDelegate : public NotificationDelegate {
  public:
   MOCK_METHOD1(OnConnected, void(const std::string&));
+  MOCK_METHOD1(OnConnectionConfirmed, void(const std::string&));
   MOCK_METHOD0(OnDisconnected, void());
   MOCK_METHOD0(OnPermanentFailure, void());
   MOCK_METHOD2(OnCommandCreated,
                void(const base::DictionaryValue& command,
                     const std::string& channel_name));
   MOCK_METHOD1(OnDeviceDeleted, void(const std::string&));
+  MOCK_CONST_METHOD1(IsCommandKnown, bool(const std::string&));
 };
 
 class NotificationParserTest : public ::testing::Test {
@@ -154,4 +156,26 @@ TEST_F(NotificationParserTest, IgnoredNotificationType) {
   EXPECT_TRUE(ParseNotificationJson(*json, &delegate_, "quux"));
 }
 
+TEST(NotificationParser, IsHandledNotificationType) {
+  EXPECT_TRUE(IsHandledNotificationType(
+      R"({"kind": "weave#notification", "type": "COMMAND_CREATED"})"));
+  EXPECT_TRUE(IsHandledNotificationType(R"({"type":"DEVICE_DELETED"})"));
+  EXPECT_FALSE(IsHandledNotificationType(
+      R"({"kind": "weave#notification", "type": "COMMAND_EXPIRED"})"));
+  EXPECT_FALSE(IsHandledNotificationType(R"({"type": "COMMAND_CREATED_2"})"));
+}
+
+TEST_F(NotificationParserTest, GetNotificationCommandId) {
+  EXPECT_EQ("command_id", GetNotificationCommandId(R"({
+    "kind": "weave#notification",
+    "type": "COMMAND_CREATED",
+    "command": {"id": "other", "parameters": {"commandId": "nested"}},
+    "commandId": "command_id"
+  })"));
+  EXPECT_EQ("", GetNotificationCommandId(R"({"type": "DEVICE_DELETED"})"));
+  EXPECT_EQ("", GetNotificationCommandId(R"({"commandId": 5})"));
+  EXPECT_EQ("", GetNotificationCommandId(R"({"command": )"));
+  EXPECT_EQ("", GetNotificationCommandId("[]"));
+}
+
 }  // namespace weave
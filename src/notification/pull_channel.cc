@@ -4,6 +4,8 @@
 
 #include "src/notification/pull_channel.h"
 
+#include <algorithm>
+
 #include <base/bind.h>
 #include <base/location.h>
 #include <weave/provider/task_runner.h>
@@ -14,9 +16,19 @@ namespace weave {
 
 const char kPullChannelName[] = "pull";
 
+namespace {
+
+// Polls only look for the commands XMPP hasn't delivered, so they may be late.
+const double kPollTolerance = 0.25;
+
+}  // namespace
+
 PullChannel::PullChannel(base::TimeDelta pull_interval,
                          provider::TaskRunner* task_runner)
-    : pull_interval_{pull_interval}, task_runner_{task_runner} {}
+    : pull_interval_{pull_interval},
+      max_pull_interval_{pull_interval},
+      current_pull_interval_{pull_interval},
+      task_runner_{task_runner} {}
 
 std::string PullChannel::GetName() const {
   return kPullChannelName;
@@ -38,25 +50,45 @@ void PullChannel::Start(NotificationDelegate* delegate) {
 
 void PullChannel::RePost() {
   CHECK(delegate_);
-  weak_ptr_factory_.InvalidateWeakPtrs();
-  task_runner_->PostDelayedTask(
-      FROM_HERE,
-      base::Bind(&PullChannel::OnTimer, weak_ptr_factory_.GetWeakPtr()),
-      pull_interval_);
+  poll_timer_.Start(FROM_HERE, current_pull_interval_,
+                    base::Bind(&PullChannel::OnTimer, base::Unretained(this)));
 }
 
 void PullChannel::Stop() {
-  weak_ptr_factory_.InvalidateWeakPtrs();
+  poll_timer_.Stop();
   delegate_ = nullptr;
 }
 
 void PullChannel::UpdatePullInterval(base::TimeDelta pull_interval) {
   pull_interval_ = pull_interval;
+  max_pull_interval_ = std::max(max_pull_interval_, pull_interval);
+  current_pull_interval_ = pull_interval;
+  if (delegate_)
+    RePost();
+}
+
+void PullChannel::SetMaxPullInterval(base::TimeDelta max_pull_interval) {
+  max_pull_interval_ = std::max(max_pull_interval, pull_interval_);
+  current_pull_interval_ =
+      std::min(current_pull_interval_, max_pull_interval_);
+}
+
+void PullChannel::OnCommandsReceived() {
+  if (current_pull_interval_ == pull_interval_)
+    return;
+  current_pull_interval_ = pull_interval_;
   if (delegate_)
     RePost();
 }
 
+void PullChannel::SetWakeWindowScheduler(WakeWindowScheduler* scheduler) {
+  poll_timer_.SetWakeWindow(scheduler, kPollTolerance);
+}
+
 void PullChannel::OnTimer() {
+  // Nothing is known to be pending, so back off until commands show up.
+  current_pull_interval_ =
+      std::min(current_pull_interval_ * 2, max_pull_interval_);
   // Repost before delegate notification to give it a chance to stop channel.
   RePost();
   base::DictionaryValue empty_dict;
@@ -9,10 +9,10 @@
 #include <string>
 
 #include <base/macros.h>
-#include <base/memory/weak_ptr.h>
 #include <base/time/time.h>
 
 #include "src/notification/notification_channel.h"
+#include "src/timer.h"
 
 namespace weave {
 
@@ -36,15 +36,28 @@ class PullChannel : public NotificationChannel {
 
   void UpdatePullInterval(base::TimeDelta pull_interval);
 
+  // Enables adaptive polling. While idle, the interval doubles after every
+  // poll until it reaches |max_pull_interval|.
+  void SetMaxPullInterval(base::TimeDelta max_pull_interval);
+
+  // Should be called when a poll has brought new commands. Returns to the
+  // regular pull interval, since more commands are likely to follow.
+  void OnCommandsReceived();
+
+  // Lets the polls share wake-ups with the other deferrable network activity.
+  void SetWakeWindowScheduler(WakeWindowScheduler* scheduler);
+
  private:
   void OnTimer();
   void RePost();
 
   base::TimeDelta pull_interval_;
+  base::TimeDelta max_pull_interval_;
+  base::TimeDelta current_pull_interval_;
   provider::TaskRunner* task_runner_{nullptr};
   NotificationDelegate* delegate_{nullptr};
+  OneShotTimer poll_timer_{task_runner_};
 
-  base::WeakPtrFactory<PullChannel> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(PullChannel);
 };
 
@@ -0,0 +1,83 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/notification/pull_channel.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
+
+#include "src/notification/notification_delegate.h"
+
+namespace weave {
+
+using testing::_;
+using testing::Invoke;
+
+namespace {
+
+class MockNotificationDelegate : public NotificationDelegate {
+ public:
+  MOCK_METHOD1(OnConnected, void(const std::string&));
+  MOCK_METHOD1(OnConnectionConfirmed, void(const std::string&));
+  MOCK_METHOD0(OnDisconnected, void());
+  MOCK_METHOD0(OnPermanentFailure, void());
+  MOCK_METHOD2(OnCommandCreated,
+               void(const base::DictionaryValue& command,
+                    const std::string& channel_name));
+  MOCK_METHOD1(OnDeviceDeleted, void(const std::string&));
+  MOCK_CONST_METHOD1(IsCommandKnown, bool(const std::string&));
+};
+
+}  // namespace
+
+class PullChannelTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    EXPECT_CALL(delegate_, OnCommandCreated(_, kPullChannelName))
+        .WillRepeatedly(Invoke([this](const base::DictionaryValue&,
+                                      const std::string&) {
+          poll_times_.push_back(task_runner_.GetClock()->Now() - start_);
+        }));
+    start_ = task_runner_.GetClock()->Now();
+  }
+
+  // Returns the time the next poll happens at.
+  base::TimeDelta RunUntilPoll() {
+    size_t polls = poll_times_.size();
+    while (poll_times_.size() == polls)
+      task_runner_.RunOnce();
+    return poll_times_.back();
+  }
+
+  provider::test::FakeTaskRunner task_runner_;
+  testing::StrictMock<MockNotificationDelegate> delegate_;
+  PullChannel channel_{base::TimeDelta::FromSeconds(1), &task_runner_};
+  base::Time start_;
+  std::vector<base::TimeDelta> poll_times_;
+};
+
+TEST_F(PullChannelTest, FixedInterval) {
+  channel_.Start(&delegate_);
+  EXPECT_EQ(base::TimeDelta::FromSeconds(1), RunUntilPoll());
+  EXPECT_EQ(base::TimeDelta::FromSeconds(2), RunUntilPoll());
+  EXPECT_EQ(base::TimeDelta::FromSeconds(3), RunUntilPoll());
+  EXPECT_EQ(1u, task_runner_.GetTaskQueueSize());
+}
+
+TEST_F(PullChannelTest, AdaptiveInterval) {
+  channel_.SetMaxPullInterval(base::TimeDelta::FromSeconds(4));
+  channel_.Start(&delegate_);
+  EXPECT_EQ(base::TimeDelta::FromSeconds(1), RunUntilPoll());
+  EXPECT_EQ(base::TimeDelta::FromSeconds(3), RunUntilPoll());
+  EXPECT_EQ(base::TimeDelta::FromSeconds(7), RunUntilPoll());
+  EXPECT_EQ(base::TimeDelta::FromSeconds(11), RunUntilPoll());
+
+  // New commands bring the interval back right away.
+  channel_.OnCommandsReceived();
+  EXPECT_EQ(base::TimeDelta::FromSeconds(12), RunUntilPoll());
+  EXPECT_EQ(base::TimeDelta::FromSeconds(14), RunUntilPoll());
+}
+
+}  // namespace weave
@@ -0,0 +1,32 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/notification/recent_command_ids.h"
+
+#include <base/logging.h>
+
+namespace weave {
+
+RecentCommandIds::RecentCommandIds(size_t capacity) : capacity_{capacity} {
+  CHECK_GT(capacity_, 0u);
+  ids_.reserve(capacity_);
+}
+
+bool RecentCommandIds::Add(const std::string& id) {
+  auto inserted = ids_.insert(id);
+  if (!inserted.second)
+    return false;
+  order_.push_back(&*inserted.first);
+  if (order_.size() > capacity_) {
+    ids_.erase(*order_.front());
+    order_.pop_front();
+  }
+  return true;
+}
+
+bool RecentCommandIds::Contains(const std::string& id) const {
+  return ids_.find(id) != ids_.end();
+}
+
+}  // namespace weave
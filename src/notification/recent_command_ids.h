@@ -0,0 +1,40 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_NOTIFICATION_RECENT_COMMAND_IDS_H_
+#define LIBWEAVE_SRC_NOTIFICATION_RECENT_COMMAND_IDS_H_
+
+#include <deque>
+#include <string>
+#include <unordered_set>
+
+#include <base/macros.h>
+
+namespace weave {
+
+// Remembers the IDs of the last |capacity| commands received from the cloud,
+// so a command delivered again, e.g. by both the XMPP and the pull channel
+// while they overlap, is dropped before it is parsed. The oldest IDs are
+// forgotten first.
+class RecentCommandIds final {
+ public:
+  explicit RecentCommandIds(size_t capacity);
+
+  // Returns false if |id| is known already.
+  bool Add(const std::string& id);
+  bool Contains(const std::string& id) const;
+  size_t size() const { return order_.size(); }
+
+ private:
+  size_t capacity_{0};
+  std::unordered_set<std::string> ids_;
+  // Elements of |ids_| from the oldest. They keep their address on rehash.
+  std::deque<const std::string*> order_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecentCommandIds);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_NOTIFICATION_RECENT_COMMAND_IDS_H_
@@ -0,0 +1,35 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/notification/recent_command_ids.h"
+
+#include <gtest/gtest.h>
+
+namespace weave {
+
+TEST(RecentCommandIdsTest, ForgetsOldest) {
+  RecentCommandIds ids{3};
+  EXPECT_TRUE(ids.Add("1"));
+  EXPECT_TRUE(ids.Add("2"));
+  EXPECT_FALSE(ids.Add("1"));
+  EXPECT_TRUE(ids.Add("3"));
+  EXPECT_EQ(3u, ids.size());
+
+  EXPECT_TRUE(ids.Add("4"));
+  EXPECT_EQ(3u, ids.size());
+  EXPECT_FALSE(ids.Contains("1"));
+  EXPECT_TRUE(ids.Contains("2"));
+  EXPECT_TRUE(ids.Contains("4"));
+
+  // Many more, so the set is rehashed.
+  for (int i = 5; i < 100; ++i)
+    EXPECT_TRUE(ids.Add(std::to_string(i)));
+  EXPECT_EQ(3u, ids.size());
+  EXPECT_TRUE(ids.Contains("97"));
+  EXPECT_TRUE(ids.Contains("99"));
+  EXPECT_FALSE(ids.Contains("96"));
+  EXPECT_TRUE(ids.Add("2"));
+}
+
+}  // namespace weave
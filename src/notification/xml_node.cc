@@ -4,15 +4,35 @@
 
 #include "src/notification/xml_node.h"
 
+#include <base/logging.h>
 #include <base/strings/stringprintf.h>
 
-#include "src/string_utils.h"
-
 namespace weave {
 
-XmlNode::XmlNode(const std::string& name,
+const size_t XmlNodePath::kMaxNames;
+
+XmlNodePath::XmlNodePath(base::StringPiece name_path) {
+  while (!name_path.empty()) {
+    size_t pos = name_path.find('/');
+    base::StringPiece name = name_path.substr(0, pos);
+    if (!name.empty()) {
+      if (size_ == kMaxNames) {
+        LOG(ERROR) << "Node path is too long: " << name_path;
+        size_ = 0;
+        valid_ = false;
+        return;
+      }
+      names_[size_++] = name;
+    }
+    if (pos == base::StringPiece::npos)
+      break;
+    name_path.remove_prefix(pos + 1);
+  }
+}
+
+XmlNode::XmlNode(std::string name,
                  std::map<std::string, std::string> attributes)
-    : name_{name}, attributes_{std::move(attributes)} {}
+    : name_{std::move(name)}, attributes_{std::move(attributes)} {}
 
 const std::string& XmlNode::name() const {
   return name_;
@@ -47,33 +67,45 @@ std::string XmlNode::GetAttributeOrEmpty(const std::string& name) const {
 
 const XmlNode* XmlNode::FindFirstChild(const std::string& name_path,
                                        bool recursive) const {
-  return FindChildHelper(name_path, recursive, nullptr);
+  return FindFirstChild(XmlNodePath{name_path}, recursive);
+}
+
+const XmlNode* XmlNode::FindFirstChild(const XmlNodePath& path,
+                                       bool recursive) const {
+  return FindChildHelper(path, 0, recursive, nullptr);
 }
 
 std::vector<const XmlNode*> XmlNode::FindChildren(const std::string& name_path,
                                                   bool recursive) const {
+  return FindChildren(XmlNodePath{name_path}, recursive);
+}
+
+std::vector<const XmlNode*> XmlNode::FindChildren(const XmlNodePath& path,
+                                                  bool recursive) const {
   std::vector<const XmlNode*> children;
-  FindChildHelper(name_path, recursive, &children);
+  FindChildHelper(path, 0, recursive, &children);
   return children;
 }
 
 const XmlNode* XmlNode::FindChildHelper(
-    const std::string& name_path,
+    const XmlNodePath& path,
+    size_t index,
     bool recursive,
     std::vector<const XmlNode*>* children) const {
-  auto parts = SplitAtFirst(name_path, "/", false);
-  const std::string& name = parts.first;
-  const std::string& rest_of_path = parts.second;
+  if (index >= path.size())
+    return nullptr;
+  const base::StringPiece& name = path[index];
+  const bool last_name = (index + 1 == path.size());
   for (const auto& child : children_) {
     const XmlNode* found_node = nullptr;
     if (child->name() == name) {
-      if (rest_of_path.empty()) {
+      if (last_name) {
         found_node = child.get();
       } else {
-        found_node = child->FindChildHelper(rest_of_path, false, children);
+        found_node = child->FindChildHelper(path, index + 1, false, children);
       }
     } else if (recursive) {
-      found_node = child->FindChildHelper(name_path, true, children);
+      found_node = child->FindChildHelper(path, index, true, children);
     }
 
     if (found_node) {
@@ -93,6 +125,10 @@ void XmlNode::AppendText(const std::string& text) {
   text_ += text;
 }
 
+void XmlNode::AppendText(const char* text, size_t size) {
+  text_.append(text, size);
+}
+
 void XmlNode::AddChild(std::unique_ptr<XmlNode> child) {
   child->parent_ = this;
   children_.push_back(std::move(child));
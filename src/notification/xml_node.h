@@ -11,19 +11,43 @@
 #include <vector>
 
 #include <base/macros.h>
+#include <base/strings/string_piece.h>
+
+#include "src/object_pool.h"
 
 namespace weave {
 
 class XmlNodeTest;
 class XmppStreamParser;
 
+// A "/"-separated list of node names, e.g. "bind/jid", split once so that it
+// can be matched against node trees without allocations. |name_path| is
+// referenced, not copied, so it must outlive the object. A path of more
+// than |kMaxNames| names is invalid and matches no node.
+class XmlNodePath final {
+ public:
+  static const size_t kMaxNames = 8;
+
+  explicit XmlNodePath(base::StringPiece name_path);
+
+  bool is_valid() const { return valid_; }
+  size_t size() const { return size_; }
+  const base::StringPiece& operator[](size_t index) const {
+    return names_[index];
+  }
+
+ private:
+  base::StringPiece names_[kMaxNames];
+  size_t size_{0};
+  bool valid_{true};
+};
+
 // XmlNode is a very simple class to represent the XML document element tree.
 // It is used in conjunction with expat XML parser to implement XmppStreamParser
 // class used to parse Xmpp data stream into individual stanzas.
-class XmlNode final {
+class XmlNode final : public PoolAllocated<XmlNode> {
  public:
-  XmlNode(const std::string& name,
-          std::map<std::string, std::string> attributes);
+  XmlNode(std::string name, std::map<std::string, std::string> attributes);
 
   // The node's name. E.g. in <foo bar="baz">quux</foo> this will return "foo".
   const std::string& name() const;
@@ -53,6 +77,7 @@ class XmlNode final {
   // otherwise a nullptr is returned.
   const XmlNode* FindFirstChild(const std::string& name_path,
                                 bool recursive) const;
+  const XmlNode* FindFirstChild(const XmlNodePath& path, bool recursive) const;
 
   // Finds all the child nodes matching the |name_path|. This returns the list
   // of pointers to the child nodes matching the criteria. If |recursive| is
@@ -75,6 +100,8 @@ class XmlNode final {
   //    FindChildren("node3", true) -> {"3", "5", "6", "9"}.
   std::vector<const XmlNode*> FindChildren(const std::string& name_path,
                                            bool recursive) const;
+  std::vector<const XmlNode*> FindChildren(const XmlNodePath& path,
+                                           bool recursive) const;
 
   // Adds a new child to the bottom of the child list of this node.
   void AddChild(std::unique_ptr<XmlNode> child);
@@ -95,16 +122,18 @@ class XmlNode final {
   void SetText(const std::string& text);
   // Appends the |text| to the node's text string.
   void AppendText(const std::string& text);
+  void AppendText(const char* text, size_t size);
 
   // Helper method used by FindFirstChild() and FindChildren(). Searches for
-  // child node(s) matching |name_path|.
+  // child node(s) matching |path| starting from the name at |index|.
   // If |children| is not specified (nullptr), this function find the first
   // matching node and returns it via return value of the function. If no match
   // is found, this function will return nullptr.
   // If |children| parameter is not nullptr, found nodes are added to the
   // vector pointed to by |children| and search continues until the whole tree
   // is inspected. In this mode, the function always returns nullptr.
-  const XmlNode* FindChildHelper(const std::string& name_path,
+  const XmlNode* FindChildHelper(const XmlNodePath& path,
+                                 size_t index,
                                  bool recursive,
                                  std::vector<const XmlNode*>* children) const;
 
@@ -33,6 +33,8 @@ class XmlParser : public XmppStreamParser::Delegate {
     node_->AddChild(std::move(stanza));
   }
 
+  void OnStanzaDropped(const std::string& node_name) override {}
+
   std::unique_ptr<XmlNode> node_;
   XmppStreamParser parser_{this};
 };
@@ -204,4 +206,28 @@ TEST_F(XmlNodeTest, FindChildren_Path) {
   ASSERT_EQ(0u, children.size());
 }
 
+TEST_F(XmlNodeTest, NodePath) {
+  XmlNodePath path{"/node2//node3/"};
+  ASSERT_EQ(2u, path.size());
+  EXPECT_EQ("node2", path[0]);
+  EXPECT_EQ("node3", path[1]);
+
+  CreateNodeTree();
+  const XmlNode* node = node_->FindFirstChild(path, false);
+  ASSERT_NE(nullptr, node);
+  EXPECT_EQ("5", node->GetAttributeOrEmpty("id"));
+  EXPECT_EQ(2u, node_->FindChildren(path, true).size());
+  EXPECT_EQ(nullptr, node_->FindFirstChild(XmlNodePath{""}, true));
+}
+
+TEST_F(XmlNodeTest, XmlNodePathTooLong) {
+  XmlNodePath path{"a/b/c/d/e/f/g/h/i"};
+  EXPECT_FALSE(path.is_valid());
+  EXPECT_EQ(0u, path.size());
+
+  CreateNodeTree();
+  EXPECT_EQ(nullptr, node_->FindFirstChild("a/b/c/d/e/f/g/h/node3", true));
+  EXPECT_TRUE(node_->FindChildren("a/b/c/d/e/f/g/h/node3", true).empty());
+}
+
 }  // namespace weave
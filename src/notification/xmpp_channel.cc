@@ -4,10 +4,14 @@
 
 #include "src/notification/xmpp_channel.h"
 
+#include <algorithm>
+#include <limits>
 #include <string>
 
 #include <base/bind.h>
 #include <base/strings/string_number_conversions.h>
+#include <base/strings/string_piece.h>
+#include <base/values.h>
 #include <weave/provider/network.h>
 #include <weave/provider/task_runner.h>
 
@@ -86,21 +90,50 @@ const int kAgressivePingTimeoutSeconds = 10;
 
 const int kConnectingTimeoutAfterNetChangeSeconds = 30;
 
+// Used by the adaptive keepalive mode. Every successful regular ping allows
+// the next one to be sent kKeepAliveProbeStepSeconds later.
+const int kMinKeepAliveIntervalSeconds = 15;
+const int kMaxKeepAliveIntervalSeconds = 10 * 60;
+const int kKeepAliveProbeStepSeconds = 30;
+
+// Pings may be late by this part of their interval to share a wake-up with
+// other network activity. Keepalive intervals leave enough margin for that.
+const double kPingTolerance = 0.125;
+
+// Maximal size of the messages waiting for the pending write. The server
+// isn't reading the stream if that much accumulates, so it is reconnected.
+const size_t kMaxQueuedWriteSize = 64 * 1024;
+
+// Endpoints of the XMPP traffic in the traffic stats.
+const char kTrafficEndpoint[] = "xmpp";
+const char kPingTrafficEndpoint[] = "xmpp ping";
+
+// Bounds the memory a server can make the parser hold for a single stanza,
+// well above the size of the push notifications of commands.
+const size_t kMaxStanzaSize = 512 * 1024;
+
 }  // namespace
 
 XmppChannel::XmppChannel(const std::string& account,
                          const std::string& access_token,
                          const std::string& xmpp_endpoint,
                          provider::TaskRunner* task_runner,
-                         provider::Network* network)
+                         provider::Network* network,
+                         Metrics* metrics,
+                         TrafficStats* traffic_stats)
     : account_{account},
       access_token_{access_token},
       xmpp_endpoint_{xmpp_endpoint},
       network_{network},
       backoff_entry_{&kDefaultBackoffPolicy},
       task_runner_{task_runner},
-      iq_stanza_handler_{new IqStanzaHandler{this, task_runner}} {
+      iq_stanza_handler_{new IqStanzaHandler{this, task_runner}},
+      metrics_{metrics},
+      traffic_stats_{traffic_stats} {
   read_socket_data_.resize(4096);
+  // Only the payload of push notifications is used from message stanzas.
+  stream_parser_.AddStanzaFilter("message", {"push:push/push:data"});
+  SetInputLimits(input_limits_);
   if (network) {
     network->AddConnectionChangedCallback(base::Bind(
         &XmppChannel::OnConnectivityChanged, weak_ptr_factory_.GetWeakPtr()));
@@ -111,13 +144,16 @@ void XmppChannel::OnMessageRead(size_t size, ErrorPtr error) {
   read_pending_ = false;
   if (error)
     return Restart();
-  std::string msg(read_socket_data_.data(), size);
-  VLOG(2) << "Received XMPP packet: '" << msg << "'";
+  VLOG(2) << "Received XMPP packet: '"
+          << base::StringPiece(read_socket_data_.data(), size) << "'";
 
   if (!size)
     return Restart();
 
-  stream_parser_.ParseData(msg);
+  if (traffic_stats_)
+    traffic_stats_->Record(kTrafficEndpoint, 0, size);
+  // Parse straight from the read buffer, which is reused for the next read.
+  stream_parser_.ParseData(read_socket_data_.data(), size);
   WaitForMessage();
 }
 
@@ -154,13 +190,35 @@ void XmppChannel::OnStanza(std::unique_ptr<XmlNode> stanza) {
       {});
 }
 
+void XmppChannel::OnStanzaDropped(const std::string& node_name) {
+  LOG(WARNING) << "Dropped XMPP stanza '" << node_name
+               << "' over the input limits";
+  WEAVE_RECORD_COUNT(metrics_, "xmpp_stanza_dropped");
+  // The message may have been a command notification, which is then fetched
+  // instead. Handled asynchronously, as OnStanza() is.
+  if (node_name == "message") {
+    task_runner_->PostDelayedTask(
+        FROM_HERE, base::Bind(&XmppChannel::HandleDroppedMessage,
+                              task_ptr_factory_.GetWeakPtr()),
+        {});
+  }
+}
+
+void XmppChannel::HandleDroppedMessage() {
+  if (!delegate_ || !IsConnected())
+    return;
+  base::DictionaryValue empty_dict;
+  delegate_->OnCommandCreated(empty_dict, GetName());
+}
+
 void XmppChannel::HandleStanza(std::unique_ptr<XmlNode> stanza) {
   VLOG(2) << "XMPP stanza received: " << stanza->ToString();
 
   switch (state_) {
     case XmppState::kConnected:
       if (stanza->name() == "stream:features") {
-        auto children = stanza->FindChildren("mechanisms/mechanism", false);
+        auto children =
+            stanza->FindChildren(XmlNodePath{"mechanisms/mechanism"}, false);
         for (const auto& child : children) {
           if (child->text() == "X-OAUTH2") {
             state_ = XmppState::kAuthenticationStarted;
@@ -176,7 +234,7 @@ void XmppChannel::HandleStanza(std::unique_ptr<XmlNode> stanza) {
         RestartXmppStream();
         return;
       } else if (stanza->name() == "failure") {
-        if (stanza->FindFirstChild("not-authorized", false)) {
+        if (stanza->FindFirstChild(XmlNodePath{"not-authorized"}, false)) {
           state_ = XmppState::kAuthenticationFailed;
           return;
         }
@@ -184,7 +242,12 @@ void XmppChannel::HandleStanza(std::unique_ptr<XmlNode> stanza) {
       break;
     case XmppState::kStreamRestartedPostAuthentication:
       if (stanza->name() == "stream:features" &&
-          stanza->FindFirstChild("bind", false)) {
+          stanza->FindFirstChild(XmlNodePath{"bind"}, false)) {
+        // RFC 6121 makes the session request a no-op; it is only sent to
+        // servers that still advertise it as mandatory.
+        session_required_ =
+            stanza->FindFirstChild(XmlNodePath{"session"}, false) &&
+            !stanza->FindFirstChild(XmlNodePath{"session/optional"}, false);
         state_ = XmppState::kBindSent;
         iq_stanza_handler_->SendRequest(
             "set", "", "", "<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/>",
@@ -223,7 +286,8 @@ void XmppChannel::OnBindCompleted(std::unique_ptr<XmlNode> reply) {
     CloseStream();
     return;
   }
-  const XmlNode* jid_node = reply->FindFirstChild("bind/jid", false);
+  const XmlNode* jid_node =
+      reply->FindFirstChild(XmlNodePath{"bind/jid"}, false);
   if (!jid_node) {
     LOG(ERROR) << "XMPP Bind response is missing JID";
     CloseStream();
@@ -231,6 +295,8 @@ void XmppChannel::OnBindCompleted(std::unique_ptr<XmlNode> reply) {
   }
 
   jid_ = jid_node->text();
+  if (!session_required_)
+    return Subscribe();
   state_ = XmppState::kSessionStarted;
   iq_stanza_handler_->SendRequest(
       "set", "", "", "<session xmlns='urn:ietf:params:xml:ns:xmpp-session'/>",
@@ -244,6 +310,10 @@ void XmppChannel::OnSessionEstablished(std::unique_ptr<XmlNode> reply) {
     CloseStream();
     return;
   }
+  Subscribe();
+}
+
+void XmppChannel::Subscribe() {
   state_ = XmppState::kSubscribeStarted;
   std::string body =
       "<subscribe xmlns='google:push'>"
@@ -260,17 +330,20 @@ void XmppChannel::OnSubscribed(std::unique_ptr<XmlNode> reply) {
     return;
   }
   state_ = XmppState::kSubscribed;
+  WEAVE_RECORD_LATENCY(metrics_, "xmpp_connect",
+                       base::TimeTicks::Now() - connect_start_time_);
   if (delegate_)
     delegate_->OnConnected(GetName());
 }
 
 void XmppChannel::HandleMessageStanza(std::unique_ptr<XmlNode> stanza) {
-  const XmlNode* node = stanza->FindFirstChild("push:push/push:data", true);
+  const XmlNode* node =
+      stanza->FindFirstChild(XmlNodePath{"push:push/push:data"}, true);
   if (!node) {
     LOG(WARNING) << "XMPP message stanza is missing <push:data> element";
     return;
   }
-  std::string data = node->text();
+  const std::string& data = node->text();
   std::string json_data;
   if (!Base64Decode(data, &json_data)) {
     LOG(WARNING) << "Failed to decode base64-encoded message payload: " << data;
@@ -278,7 +351,21 @@ void XmppChannel::HandleMessageStanza(std::unique_ptr<XmlNode> stanza) {
   }
 
   VLOG(2) << "XMPP push notification data: " << json_data;
-  auto json_dict = LoadJsonDict(json_data, nullptr);
+  if (!IsHandledNotificationType(json_data)) {
+    VLOG(1) << "Ignoring push notification of unhandled type";
+    return;
+  }
+  std::string command_id = GetNotificationCommandId(json_data);
+  if (!command_id.empty() && delegate_ &&
+      delegate_->IsCommandKnown(command_id)) {
+    VLOG(1) << "Ignoring push notification of known command " << command_id;
+    return;
+  }
+  std::unique_ptr<base::DictionaryValue> json_dict;
+  {
+    base::ScopedValueArena arena;
+    json_dict = LoadJsonDict(json_data, input_limits_, nullptr);
+  }
   if (json_dict && delegate_)
     ParseNotificationJson(*json_dict, delegate_, GetName());
 }
@@ -323,13 +410,29 @@ void XmppChannel::OnSslSocketReady(std::unique_ptr<Stream> stream,
 
 void XmppChannel::SendMessage(const std::string& message) {
   CHECK(stream_) << "No XMPP socket stream available";
-  if (write_pending_) {
-    queued_write_data_ += message;
+  if (write_pending_ &&
+      queued_write_data_.size() + message.size() > kMaxQueuedWriteSize) {
+    LOG(WARNING) << "XMPP write backlog is over " << kMaxQueuedWriteSize
+                 << " bytes, reconnecting";
+    queued_write_data_.clear();
+    // Don't restart the stream under the caller.
+    task_runner_->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&XmppChannel::Restart, task_ptr_factory_.GetWeakPtr()), {});
     return;
   }
-  write_socket_data_ = queued_write_data_ + message;
-  queued_write_data_.clear();
-  VLOG(2) << "Sending XMPP message: " << message;
+  if (traffic_stats_ && !message.empty()) {
+    traffic_stats_->Record(kTrafficEndpoint, message.size(), 0);
+    if (sending_ping_)
+      traffic_stats_->Record(kPingTrafficEndpoint, message.size(), 0);
+  }
+  // All the messages queued while a write is pending go in the next write.
+  queued_write_data_ += message;
+  if (write_pending_)
+    return;
+  write_socket_data_.clear();
+  write_socket_data_.swap(queued_write_data_);
+  VLOG(2) << "Sending XMPP message: " << write_socket_data_;
 
   write_pending_ = true;
   stream_->Write(
@@ -372,13 +475,20 @@ void XmppChannel::AddChannelParameters(base::DictionaryValue* channel_json) {
 
 void XmppChannel::Restart() {
   LOG(INFO) << "Restarting XMPP";
+  WEAVE_RECORD_COUNT(metrics_, "xmpp_restart");
+  // Reconnects are timed from the first attempt, if it has not succeeded.
+  base::TimeTicks connect_start_time = state_ == XmppState::kSubscribed
+                                           ? base::TimeTicks::Now()
+                                           : connect_start_time_;
   Stop();
   Start(delegate_);
+  connect_start_time_ = connect_start_time;
 }
 
 void XmppChannel::Start(NotificationDelegate* delegate) {
   CHECK(state_ == XmppState::kNotStarted);
   delegate_ = delegate;
+  connect_start_time_ = base::TimeTicks::Now();
 
   CreateSslSocket();
 }
@@ -388,9 +498,13 @@ void XmppChannel::Stop() {
     delegate_->OnDisconnected();
 
   task_ptr_factory_.InvalidateWeakPtrs();
-  ping_ptr_factory_.InvalidateWeakPtrs();
+  ping_timer_.Stop();
 
   stream_.reset();
+  queued_write_data_.clear();
+  read_pending_ = false;
+  write_pending_ = false;
+  connection_confirmed_ = false;
   state_ = XmppState::kNotStarted;
 }
 
@@ -399,21 +513,54 @@ void XmppChannel::RestartXmppStream() {
   stream_->CancelPendingOperations();
   read_pending_ = false;
   write_pending_ = false;
+  queued_write_data_.clear();
   SendMessage(BuildXmppStartStreamCommand());
 }
 
+void XmppChannel::SetWakeWindowScheduler(WakeWindowScheduler* scheduler) {
+  ping_timer_.SetWakeWindow(scheduler, kPingTolerance);
+}
+
+void XmppChannel::SetInputLimits(const InputLimits& limits) {
+  input_limits_ = limits;
+  auto or_max = [](size_t limit) {
+    return limit ? limit : std::numeric_limits<size_t>::max();
+  };
+  stream_parser_.SetMaxStanzaSize(std::min(or_max(limits.max_size),
+                                           kMaxStanzaSize));
+  stream_parser_.SetMaxStanzaDepth(or_max(limits.max_depth));
+  stream_parser_.SetMaxStanzaNodes(or_max(limits.max_nodes));
+}
+
+void XmppChannel::EnableAdaptiveKeepAlive(
+    base::TimeDelta interval,
+    const KeepAliveChangedCallback& callback) {
+  adaptive_keepalive_ = true;
+  keepalive_changed_callback_ = callback;
+  keepalive_ceiling_ = base::TimeDelta::Max();
+  if (interval.is_zero()) {
+    keepalive_interval_ =
+        base::TimeDelta::FromSeconds(kRegularPingIntervalSeconds);
+  } else {
+    keepalive_interval_ = std::min(
+        std::max(interval,
+                 base::TimeDelta::FromSeconds(kMinKeepAliveIntervalSeconds)),
+        base::TimeDelta::FromSeconds(kMaxKeepAliveIntervalSeconds));
+  }
+}
+
 void XmppChannel::SchedulePing(base::TimeDelta interval,
                                base::TimeDelta timeout) {
   VLOG(1) << "Next XMPP ping in " << interval << " with timeout " << timeout;
-  ping_ptr_factory_.InvalidateWeakPtrs();
-  task_runner_->PostDelayedTask(
-      FROM_HERE, base::Bind(&XmppChannel::PingServer,
-                            ping_ptr_factory_.GetWeakPtr(), timeout),
-      interval);
+  ping_timer_.Start(FROM_HERE, interval,
+                    base::Bind(&XmppChannel::PingServer, base::Unretained(this),
+                               interval, timeout));
 }
 
 void XmppChannel::ScheduleRegularPing() {
-  SchedulePing(base::TimeDelta::FromSeconds(kRegularPingIntervalSeconds),
+  SchedulePing(adaptive_keepalive_
+                   ? GetKeepAliveProbeInterval()
+                   : base::TimeDelta::FromSeconds(kRegularPingIntervalSeconds),
                base::TimeDelta::FromSeconds(kRegularPingTimeoutSeconds));
 }
 
@@ -422,7 +569,8 @@ void XmppChannel::ScheduleFastPing() {
                base::TimeDelta::FromSeconds(kAgressivePingTimeoutSeconds));
 }
 
-void XmppChannel::PingServer(base::TimeDelta timeout) {
+void XmppChannel::PingServer(base::TimeDelta interval,
+                             base::TimeDelta timeout) {
   VLOG(1) << "Sending XMPP ping";
   if (!IsConnected()) {
     LOG(WARNING) << "XMPP channel is not connected";
@@ -432,29 +580,99 @@ void XmppChannel::PingServer(base::TimeDelta timeout) {
 
   // Send an XMPP Ping request as defined in XEP-0199 extension:
   // http://xmpp.org/extensions/xep-0199.html
+  sending_ping_ = true;
   iq_stanza_handler_->SendRequestWithCustomTimeout(
       "get", jid_, account_, "<ping xmlns='urn:xmpp:ping'/>", timeout,
       base::Bind(&XmppChannel::OnPingResponse, task_ptr_factory_.GetWeakPtr(),
-                 base::Time::Now()),
+                 interval, base::Time::Now()),
       base::Bind(&XmppChannel::OnPingTimeout, task_ptr_factory_.GetWeakPtr(),
-                 base::Time::Now()));
+                 interval, base::Time::Now()));
+  sending_ping_ = false;
 }
 
-void XmppChannel::OnPingResponse(base::Time sent_time,
+void XmppChannel::OnPingResponse(base::TimeDelta interval,
+                                 base::Time sent_time,
                                  std::unique_ptr<XmlNode> reply) {
   VLOG(1) << "XMPP response received after " << (base::Time::Now() - sent_time);
+  // The response was already counted as "xmpp" when read, its size is only
+  // approximated by the parsed stanza.
+  if (traffic_stats_ && reply)
+    traffic_stats_->Record(kPingTrafficEndpoint, 0, reply->ToString().size());
+  if (IsKeepAliveProbe(interval) && interval > keepalive_interval_ &&
+      interval < keepalive_ceiling_) {
+    SetKeepAliveInterval(interval);
+  }
   // Ping response received from server. Everything seems to be in order.
   // Reschedule with default intervals.
   ScheduleRegularPing();
+  if (!connection_confirmed_ && IsConnected()) {
+    connection_confirmed_ = true;
+    if (delegate_)
+      delegate_->OnConnectionConfirmed(GetName());
+  }
 }
 
-void XmppChannel::OnPingTimeout(base::Time sent_time) {
+void XmppChannel::OnPingTimeout(base::TimeDelta interval,
+                                base::Time sent_time) {
   LOG(WARNING) << "XMPP channel seems to be disconnected. Ping timed out after "
                << (base::Time::Now() - sent_time);
+  if (IsKeepAliveProbe(interval))
+    OnKeepAliveLost(interval);
   Restart();
 }
 
+bool XmppChannel::IsKeepAliveProbe(base::TimeDelta interval) const {
+  // Fast pings are checking the connection, not how long it survives idle.
+  return adaptive_keepalive_ &&
+         interval >= base::TimeDelta::FromSeconds(kMinKeepAliveIntervalSeconds);
+}
+
+base::TimeDelta XmppChannel::GetKeepAliveProbeInterval() const {
+  base::TimeDelta probe =
+      keepalive_interval_ +
+      base::TimeDelta::FromSeconds(kKeepAliveProbeStepSeconds);
+  if (probe < keepalive_ceiling_ &&
+      probe <= base::TimeDelta::FromSeconds(kMaxKeepAliveIntervalSeconds)) {
+    return probe;
+  }
+  return keepalive_interval_;
+}
+
+void XmppChannel::OnKeepAliveLost(base::TimeDelta interval) {
+  keepalive_ceiling_ = std::min(keepalive_ceiling_, interval);
+  // The interval that used to work does not anymore, back off quickly.
+  if (interval <= keepalive_interval_) {
+    SetKeepAliveInterval(std::max(
+        interval / 2,
+        base::TimeDelta::FromSeconds(kMinKeepAliveIntervalSeconds)));
+  }
+}
+
+void XmppChannel::SetKeepAliveInterval(base::TimeDelta interval) {
+  if (interval == keepalive_interval_)
+    return;
+  VLOG(1) << "XMPP keepalive interval changed to " << interval;
+  keepalive_interval_ = interval;
+  if (!keepalive_changed_callback_.is_null())
+    keepalive_changed_callback_.Run(keepalive_interval_);
+}
+
+void XmppChannel::ResetKeepAlive() {
+  const base::TimeDelta regular_interval =
+      base::TimeDelta::FromSeconds(kRegularPingIntervalSeconds);
+  keepalive_ceiling_ = base::TimeDelta::Max();
+  if (keepalive_interval_ == regular_interval)
+    return;
+  keepalive_interval_ = regular_interval;
+  if (!keepalive_changed_callback_.is_null())
+    keepalive_changed_callback_.Run({});
+}
+
 void XmppChannel::OnConnectivityChanged() {
+  // What has been learned about the previous network doesn't apply anymore.
+  if (adaptive_keepalive_)
+    ResetKeepAlive();
+
   if (state_ == XmppState::kNotStarted)
     return;
 
@@ -10,21 +10,26 @@
 #include <string>
 #include <vector>
 
-#include <base/callback_forward.h>
+#include <base/callback.h>
 #include <base/macros.h>
 #include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
+#include <weave/device.h>
+#include <weave/provider/task_runner.h>
 #include <weave/stream.h>
 
 #include "src/backoff_entry.h"
+#include "src/metrics.h"
 #include "src/notification/notification_channel.h"
 #include "src/notification/xmpp_iq_stanza_handler.h"
 #include "src/notification/xmpp_stream_parser.h"
+#include "src/timer.h"
+#include "src/traffic_stats.h"
 
 namespace weave {
 
 namespace provider {
 class Network;
-class TaskRunner;
 }
 
 // Simple interface to abstract XmppChannel's SendMessage() method.
@@ -40,14 +45,23 @@ class XmppChannel : public NotificationChannel,
                     public XmppStreamParser::Delegate,
                     public XmppChannelInterface {
  public:
+  // Called with the keepalive interval learned by the adaptive mode. Zero
+  // interval means that nothing is known about the current network.
+  using KeepAliveChangedCallback = base::Callback<void(base::TimeDelta)>;
+
   // |account| is the robot account for buffet and |access_token|
   // it the OAuth token. Note that the OAuth token expires fairly frequently
   // so you will need to reset the XmppClient every time this happens.
+  // |metrics| records the time it takes to (re)connect, |traffic_stats| the
+  // bytes exchanged as "xmpp", and the pings also as "xmpp ping". Both may be
+  // null.
   XmppChannel(const std::string& account,
               const std::string& access_token,
               const std::string& xmpp_endpoint,
               provider::TaskRunner* task_runner,
-              provider::Network* network);
+              provider::Network* network,
+              Metrics* metrics = nullptr,
+              TrafficStats* traffic_stats = nullptr);
   ~XmppChannel() override = default;
 
   // Overrides from NotificationChannel.
@@ -57,6 +71,22 @@ class XmppChannel : public NotificationChannel,
   void Start(NotificationDelegate* delegate) override;
   void Stop() override;
 
+  // Switches regular pings into the adaptive keepalive mode. Starting from
+  // |interval|, or from the regular one if |interval| is zero, longer
+  // intervals are probed while pings succeed. The longest one that kept the
+  // connection alive is reported to |callback| and used until connectivity
+  // changes.
+  void EnableAdaptiveKeepAlive(base::TimeDelta interval,
+                               const KeepAliveChangedCallback& callback);
+
+  // Lets the pings share wake-ups with the other deferrable network activity.
+  // Should be called before Start().
+  void SetWakeWindowScheduler(WakeWindowScheduler* scheduler);
+
+  // Limits the stanzas and the JSON of the push notifications, see
+  // Device::SetInputLimits().
+  void SetInputLimits(const InputLimits& limits);
+
   const std::string& jid() const { return jid_; }
 
   // Internal states for the XMPP stream.
@@ -89,12 +119,14 @@ class XmppChannel : public NotificationChannel,
                      std::map<std::string, std::string> attributes) override;
   void OnStreamEnd(const std::string& node_name) override;
   void OnStanza(std::unique_ptr<XmlNode> stanza) override;
+  void OnStanzaDropped(const std::string& node_name) override;
 
   // Overrides from XmppChannelInterface.
   void SendMessage(const std::string& message) override;
 
   void HandleStanza(std::unique_ptr<XmlNode> stanza);
   void HandleMessageStanza(std::unique_ptr<XmlNode> stanza);
+  void HandleDroppedMessage();
   void RestartXmppStream();
 
   void CreateSslSocket();
@@ -110,13 +142,24 @@ class XmppChannel : public NotificationChannel,
   // XMPP connection state machine's state handlers.
   void OnBindCompleted(std::unique_ptr<XmlNode> reply);
   void OnSessionEstablished(std::unique_ptr<XmlNode> reply);
+  void Subscribe();
   void OnSubscribed(std::unique_ptr<XmlNode> reply);
 
   // Sends a ping request to the server to check if the connection is still
   // valid.
-  void PingServer(base::TimeDelta timeout);
-  void OnPingResponse(base::Time sent_time, std::unique_ptr<XmlNode> reply);
-  void OnPingTimeout(base::Time sent_time);
+  // |interval| is the time the ping has been scheduled after.
+  void PingServer(base::TimeDelta interval, base::TimeDelta timeout);
+  void OnPingResponse(base::TimeDelta interval,
+                      base::Time sent_time,
+                      std::unique_ptr<XmlNode> reply);
+  void OnPingTimeout(base::TimeDelta interval, base::Time sent_time);
+
+  // Adaptive keepalive helpers.
+  bool IsKeepAliveProbe(base::TimeDelta interval) const;
+  base::TimeDelta GetKeepAliveProbeInterval() const;
+  void OnKeepAliveLost(base::TimeDelta interval);
+  void SetKeepAliveInterval(base::TimeDelta interval);
+  void ResetKeepAlive();
 
   void OnConnectivityChanged();
 
@@ -134,12 +177,16 @@ class XmppChannel : public NotificationChannel,
   // Full JID of this device.
   std::string jid_;
 
+  // Whether the server advertised a mandatory session establishment.
+  bool session_required_{true};
+
   provider::Network* network_{nullptr};
   std::unique_ptr<Stream> stream_;
 
   // Read buffer for incoming message packets.
   std::vector<char> read_socket_data_;
-  // Write buffer for outgoing message packets.
+  // Write buffer for outgoing message packets, and the messages sent while
+  // it is being written.
   std::string write_socket_data_;
   std::string queued_write_data_;
 
@@ -151,11 +198,31 @@ class XmppChannel : public NotificationChannel,
   NotificationDelegate* delegate_{nullptr};
   provider::TaskRunner* task_runner_{nullptr};
   XmppStreamParser stream_parser_{this};
+  InputLimits input_limits_;
   bool read_pending_{false};
   bool write_pending_{false};
   std::unique_ptr<IqStanzaHandler> iq_stanza_handler_;
 
-  base::WeakPtrFactory<XmppChannel> ping_ptr_factory_{this};
+  Metrics* metrics_{nullptr};
+  TrafficStats* traffic_stats_{nullptr};
+  // Whether a ping was answered since the channel connected.
+  bool connection_confirmed_{false};
+  // Set while a ping is sent, so it is also counted as "xmpp ping".
+  bool sending_ping_{false};
+  // When the channel started connecting, kept over restarts until it is
+  // subscribed.
+  base::TimeTicks connect_start_time_;
+
+  // Adaptive keepalive state. |keepalive_interval_| is the longest ping
+  // interval known to keep the connection alive on the current network, and
+  // |keepalive_ceiling_| is the shortest one known to lose it.
+  bool adaptive_keepalive_{false};
+  base::TimeDelta keepalive_interval_;
+  base::TimeDelta keepalive_ceiling_{base::TimeDelta::Max()};
+  KeepAliveChangedCallback keepalive_changed_callback_;
+  OneShotTimer ping_timer_{task_runner_,
+                           provider::TaskRunner::Priority::kBackground};
+
   base::WeakPtrFactory<XmppChannel> task_ptr_factory_{this};
   base::WeakPtrFactory<XmppChannel> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(XmppChannel);
@@ -13,6 +13,8 @@
 #include <weave/test/fake_stream.h>
 
 #include "src/bind_lambda.h"
+#include "src/notification/notification_delegate.h"
+#include "src/notification/xml_node.h"
 
 using testing::_;
 using testing::Invoke;
@@ -56,6 +58,13 @@ constexpr char kRestartStreamResponse[] =
     "<stream:features><bind xmlns=\"urn:ietf:params:xml:ns:xmpp-bind\"/>"
     "<session xmlns=\"urn:ietf:params:xml:ns:xmpp-session\"/>"
     "</stream:features>";
+constexpr char kRestartStreamNoSessionResponse[] =
+    "<stream:features><bind xmlns=\"urn:ietf:params:xml:ns:xmpp-bind\"/>"
+    "</stream:features>";
+constexpr char kRestartStreamOptionalSessionResponse[] =
+    "<stream:features><bind xmlns=\"urn:ietf:params:xml:ns:xmpp-bind\"/>"
+    "<session xmlns=\"urn:ietf:params:xml:ns:xmpp-session\"><optional/>"
+    "</session></stream:features>";
 constexpr char kBindResponse[] =
     "<iq id=\"1\" type=\"result\">"
     "<bind xmlns=\"urn:ietf:params:xml:ns:xmpp-bind\">"
@@ -79,6 +88,26 @@ constexpr char kSubscribeMessage[] =
     "<subscribe xmlns='google:push'><item channel='cloud_devices' from=''/>"
     "</subscribe></iq>";
 
+constexpr char kSubscribeWithoutSessionMessage[] =
+    "<iq id='2' type='set' to='Account@Name'>"
+    "<subscribe xmlns='google:push'><item channel='cloud_devices' from=''/>"
+    "</subscribe></iq>";
+constexpr char kSubscribedWithoutSessionResponse[] =
+    "<iq id=\"2\" type=\"result\"/>";
+
+class MockNotificationDelegate : public NotificationDelegate {
+ public:
+  MOCK_METHOD1(OnConnected, void(const std::string&));
+  MOCK_METHOD1(OnConnectionConfirmed, void(const std::string&));
+  MOCK_METHOD0(OnDisconnected, void());
+  MOCK_METHOD0(OnPermanentFailure, void());
+  MOCK_METHOD2(OnCommandCreated,
+               void(const base::DictionaryValue& command,
+                    const std::string& channel_name));
+  MOCK_METHOD1(OnDeviceDeleted, void(const std::string&));
+  MOCK_CONST_METHOD1(IsCommandKnown, bool(const std::string&));
+};
+
 }  // namespace
 
 class FakeXmppChannel : public XmppChannel {
@@ -97,9 +126,12 @@ class FakeXmppChannel : public XmppChannel {
 
   XmppState state() const { return state_; }
   void set_state(XmppState state) { state_ = state; }
+  void set_delegate(NotificationDelegate* delegate) { delegate_ = delegate; }
 
   void SchedulePing(base::TimeDelta interval,
-                    base::TimeDelta timeout) override {}
+                    base::TimeDelta timeout) override {
+    ping_interval_ = interval;
+  }
 
   void ExpectWritePacketString(base::TimeDelta delta, const std::string& data) {
     fake_stream_->ExpectWritePacketString(delta, data);
@@ -109,6 +141,15 @@ class FakeXmppChannel : public XmppChannel {
     fake_stream_->AddReadPacketString(delta, data);
   }
 
+  void Send(const std::string& message) { SendMessage(message); }
+
+  void PingSucceeded(base::TimeDelta interval) {
+    OnPingResponse(interval, base::Time::Now(), nullptr);
+  }
+  void KeepAliveLost(base::TimeDelta interval) { OnKeepAliveLost(interval); }
+  void ConnectivityChanged() { OnConnectivityChanged(); }
+
+  base::TimeDelta ping_interval_;
   std::unique_ptr<test::FakeStream> stream_;
   test::FakeStream* fake_stream_{nullptr};
 };
@@ -206,4 +247,104 @@ TEST_F(XmppChannelTest, HandleStreamRestartedResponse) {
   RunUntil(XmppChannel::XmppState::kSubscribed);
 }
 
+TEST_F(XmppChannelTest, SkipsSessionWhenNotAdvertised) {
+  StartWithState(XmppChannel::XmppState::kStreamRestartedPostAuthentication);
+  xmpp_client_.AddReadPacketString({}, kRestartStreamNoSessionResponse);
+  xmpp_client_.ExpectWritePacketString({}, kBindMessage);
+  RunUntil(XmppChannel::XmppState::kBindSent);
+
+  // The subscription is requested right after the bind.
+  xmpp_client_.AddReadPacketString({}, kBindResponse);
+  xmpp_client_.ExpectWritePacketString({}, kSubscribeWithoutSessionMessage);
+  RunUntil(XmppChannel::XmppState::kSubscribeStarted);
+
+  xmpp_client_.AddReadPacketString({}, kSubscribedWithoutSessionResponse);
+  RunUntil(XmppChannel::XmppState::kSubscribed);
+}
+
+TEST_F(XmppChannelTest, SkipsOptionalSession) {
+  StartWithState(XmppChannel::XmppState::kStreamRestartedPostAuthentication);
+  xmpp_client_.AddReadPacketString({}, kRestartStreamOptionalSessionResponse);
+  xmpp_client_.ExpectWritePacketString({}, kBindMessage);
+  RunUntil(XmppChannel::XmppState::kBindSent);
+
+  xmpp_client_.AddReadPacketString({}, kBindResponse);
+  xmpp_client_.ExpectWritePacketString({}, kSubscribeWithoutSessionMessage);
+  RunUntil(XmppChannel::XmppState::kSubscribeStarted);
+
+  xmpp_client_.AddReadPacketString({}, kSubscribedWithoutSessionResponse);
+  RunUntil(XmppChannel::XmppState::kSubscribed);
+}
+
+TEST_F(XmppChannelTest, WriteBacklogOverflow) {
+  StartStream();
+  // The messages sent while a write is pending go in one write.
+  xmpp_client_.ExpectWritePacketString({}, "<a/>");
+  xmpp_client_.ExpectWritePacketString({}, "<b/><c/>");
+  xmpp_client_.Send("<a/>");
+  xmpp_client_.Send("<b/>");
+  xmpp_client_.Send("<c/>");
+  task_runner_.RunOnce();
+
+  // The channel reconnects if the server doesn't take the data.
+  EXPECT_CALL(network_, OpenSslSocket("endpoint", 456, _)).WillOnce(Return());
+  xmpp_client_.Send(std::string(100 * 1024, ' '));
+  RunUntil(XmppChannel::XmppState::kConnecting);
+}
+
+TEST_F(XmppChannelTest, AdaptiveKeepAlive) {
+  StartStream();
+  EXPECT_EQ(base::TimeDelta::FromSeconds(60), xmpp_client_.ping_interval_);
+
+  std::vector<base::TimeDelta> learned;
+  xmpp_client_.EnableAdaptiveKeepAlive(
+      {}, base::Bind([](std::vector<base::TimeDelta>* learned,
+                        base::TimeDelta interval) {
+        learned->push_back(interval);
+      }, &learned));
+
+  // Longer intervals are probed while pings succeed.
+  xmpp_client_.PingSucceeded(base::TimeDelta::FromSeconds(60));
+  EXPECT_EQ(base::TimeDelta::FromSeconds(90), xmpp_client_.ping_interval_);
+  xmpp_client_.PingSucceeded(base::TimeDelta::FromSeconds(90));
+  EXPECT_EQ(base::TimeDelta::FromSeconds(120), xmpp_client_.ping_interval_);
+  EXPECT_EQ(std::vector<base::TimeDelta>{base::TimeDelta::FromSeconds(90)},
+            learned);
+
+  // Probing stops below the interval which lost the connection.
+  xmpp_client_.KeepAliveLost(base::TimeDelta::FromSeconds(120));
+  xmpp_client_.PingSucceeded(base::TimeDelta::FromSeconds(90));
+  EXPECT_EQ(base::TimeDelta::FromSeconds(90), xmpp_client_.ping_interval_);
+
+  // Losing the learned interval backs off.
+  xmpp_client_.KeepAliveLost(base::TimeDelta::FromSeconds(90));
+  xmpp_client_.PingSucceeded(base::TimeDelta::FromSeconds(45));
+  EXPECT_EQ(base::TimeDelta::FromSeconds(75), xmpp_client_.ping_interval_);
+
+  // Everything is forgotten when the network changes.
+  learned.clear();
+  xmpp_client_.ConnectivityChanged();
+  EXPECT_EQ(std::vector<base::TimeDelta>{base::TimeDelta{}}, learned);
+  xmpp_client_.PingSucceeded(base::TimeDelta::FromSeconds(5));
+  EXPECT_EQ(base::TimeDelta::FromSeconds(90), xmpp_client_.ping_interval_);
+}
+
+TEST_F(XmppChannelTest, ConnectionConfirmedByFirstPing) {
+  StrictMock<MockNotificationDelegate> delegate;
+  StartWithState(XmppChannel::XmppState::kSubscribed);
+  xmpp_client_.set_delegate(&delegate);
+
+  EXPECT_CALL(delegate, OnConnectionConfirmed("xmpp")).Times(1);
+  xmpp_client_.PingSucceeded(base::TimeDelta::FromSeconds(60));
+  xmpp_client_.PingSucceeded(base::TimeDelta::FromSeconds(60));
+  testing::Mock::VerifyAndClearExpectations(&delegate);
+
+  // A new connection has to be confirmed again.
+  EXPECT_CALL(delegate, OnDisconnected());
+  xmpp_client_.Stop();
+  xmpp_client_.set_state(XmppChannel::XmppState::kSubscribed);
+  EXPECT_CALL(delegate, OnConnectionConfirmed("xmpp"));
+  xmpp_client_.PingSucceeded(base::TimeDelta::FromSeconds(60));
+}
+
 }  // namespace weave
@@ -4,6 +4,9 @@
 
 #include "src/notification/xmpp_iq_stanza_handler.h"
 
+#include <algorithm>
+#include <vector>
+
 #include <base/bind.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/stringprintf.h>
@@ -20,6 +23,9 @@ namespace {
 // received within this time interval, the request is considered as failed.
 const int kTimeoutIntervalSeconds = 30;
 
+// Interval between two sweeps over pending requests looking for timeouts.
+const int kTimeoutSweepIntervalSeconds = 1;
+
 // Builds an XML stanza that looks like this:
 //  <iq id='${id}' type='${type}' from='${from}' to='${to}'>$body</iq>
 // where 'to' and 'from' are optional attributes.
@@ -71,15 +77,20 @@ void IqStanzaHandler::SendRequestWithCustomTimeout(
     base::TimeDelta timeout,
     const ResponseCallback& response_callback,
     const TimeoutCallback& timeout_callback) {
-  // Remember the response callback to call later.
-  requests_.insert(std::make_pair(++last_request_id_, response_callback));
-  // Schedule a time-out callback for this request.
+  // Remember the callbacks to call later.
+  Request& request = requests_[++last_request_id_];
+  request.response_callback = response_callback;
+  request.timeout_callback = timeout_callback;
   if (timeout < base::TimeDelta::Max()) {
-    task_runner_->PostDelayedTask(
-        FROM_HERE,
-        base::Bind(&IqStanzaHandler::OnTimeOut, weak_ptr_factory_.GetWeakPtr(),
-                   last_request_id_, timeout_callback),
-        timeout);
+    // Round up, and add one more tick since the current one is partially
+    // over already.
+    const int64_t sweep_interval_us =
+        base::TimeDelta::FromSeconds(kTimeoutSweepIntervalSeconds)
+            .InMicroseconds();
+    int64_t ticks =
+        (timeout.InMicroseconds() + sweep_interval_us - 1) / sweep_interval_us;
+    request.timeout_tick = current_tick_ + 1 + std::max<int64_t>(ticks, 0);
+    ScheduleTimeoutSweep();
   }
 
   std::string message =
@@ -111,7 +122,8 @@ bool IqStanzaHandler::HandleIqStanza(std::unique_ptr<XmlNode> stanza) {
     auto p = requests_.find(id);
     if (p != requests_.end()) {
       task_runner_->PostDelayedTask(
-          FROM_HERE, base::Bind(p->second, base::Passed(std::move(stanza))),
+          FROM_HERE, base::Bind(p->second.response_callback,
+                                base::Passed(std::move(stanza))),
           {});
       requests_.erase(p);
     }
@@ -130,11 +142,42 @@ bool IqStanzaHandler::HandleIqStanza(std::unique_ptr<XmlNode> stanza) {
   return true;
 }
 
-void IqStanzaHandler::OnTimeOut(RequestId id,
-                                const TimeoutCallback& timeout_callback) {
-  // Request has not been processed yes, so a real timeout occurred.
-  if (requests_.erase(id) > 0)
-    timeout_callback.Run();
+void IqStanzaHandler::ScheduleTimeoutSweep() {
+  if (sweep_scheduled_)
+    return;
+  sweep_scheduled_ = true;
+  task_runner_->PostDelayedTask(
+      FROM_HERE, base::Bind(&IqStanzaHandler::OnTimeoutSweep,
+                            weak_ptr_factory_.GetWeakPtr()),
+      base::TimeDelta::FromSeconds(kTimeoutSweepIntervalSeconds));
+}
+
+void IqStanzaHandler::OnTimeoutSweep() {
+  sweep_scheduled_ = false;
+  ++current_tick_;
+
+  std::vector<TimeoutCallback> expired;
+  bool has_timeouts = false;
+  for (auto p = requests_.begin(); p != requests_.end();) {
+    if (p->second.timeout_tick == 0) {
+      ++p;
+    } else if (p->second.timeout_tick <= current_tick_) {
+      // Request has not been processed yet, so a real timeout occurred.
+      expired.push_back(p->second.timeout_callback);
+      p = requests_.erase(p);
+    } else {
+      has_timeouts = true;
+      ++p;
+    }
+  }
+  if (has_timeouts)
+    ScheduleTimeoutSweep();
+
+  // Callbacks may send new requests, so call them after the table is updated.
+  for (const auto& callback : expired) {
+    if (!callback.is_null())
+      callback.Run();
+  }
 }
 
 }  // namespace weave
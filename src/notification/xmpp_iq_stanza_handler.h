@@ -9,7 +9,7 @@
 #include <memory>
 #include <string>
 
-#include <base/callback_forward.h>
+#include <base/callback.h>
 #include <base/macros.h>
 #include <base/memory/weak_ptr.h>
 #include <base/time/time.h>
@@ -48,7 +48,8 @@ class IqStanzaHandler {
                    const TimeoutCallback& timeout_callback);
 
   // |timeout| is the custom time interval after which requests should be
-  // considered failed.
+  // considered failed. Timeouts are checked by a single periodic sweep, so
+  // |timeout_callback| may be called up to one sweep interval late.
   void SendRequestWithCustomTimeout(const std::string& type,
                                     const std::string& from,
                                     const std::string& to,
@@ -67,12 +68,27 @@ class IqStanzaHandler {
 
  private:
   using RequestId = int;
-  void OnTimeOut(RequestId id, const TimeoutCallback& timeout_callback);
+
+  struct Request {
+    ResponseCallback response_callback;
+    TimeoutCallback timeout_callback;
+    // Sweep tick on which the request times out, or 0 if it never does.
+    uint64_t timeout_tick{0};
+  };
+
+  // Posts the next timeout sweep, unless one is already pending.
+  void ScheduleTimeoutSweep();
+  // Advances the sweep tick and times out all expired requests.
+  void OnTimeoutSweep();
 
   XmppChannelInterface* xmpp_channel_;
   provider::TaskRunner* task_runner_{nullptr};
-  std::map<RequestId, ResponseCallback> requests_;
+  // Pending requests. One sweep task is posted while any of them can time
+  // out, instead of a delayed task per request.
+  std::map<RequestId, Request> requests_;
   RequestId last_request_id_{0};
+  uint64_t current_tick_{0};
+  bool sweep_scheduled_{false};
 
   base::WeakPtrFactory<IqStanzaHandler> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(IqStanzaHandler);
@@ -52,6 +52,8 @@ class XmlParser : public XmppStreamParser::Delegate {
     node_->AddChild(std::move(stanza));
   }
 
+  void OnStanzaDropped(const std::string& node_name) override {}
+
   std::unique_ptr<XmlNode> node_;
   XmppStreamParser parser_{this};
 };
@@ -170,4 +172,31 @@ TEST_F(IqStanzaHandlerTest, RequestTimeout) {
   EXPECT_TRUE(called);
 }
 
+TEST_F(IqStanzaHandlerTest, SingleTimeoutSweep) {
+  int timeouts = 0;
+  auto on_timeout = [](int* timeouts) { ++*timeouts; };
+
+  EXPECT_CALL(mock_xmpp_channel_, SendMessage(_)).Times(3);
+  base::Time start = task_runner_.GetClock()->Now();
+  for (int seconds : {5, 5, 10}) {
+    iq_stanza_handler_.SendRequestWithCustomTimeout(
+        "set", "", "", "<body/>", base::TimeDelta::FromSeconds(seconds), {},
+        base::Bind(on_timeout, base::Unretained(&timeouts)));
+  }
+  EXPECT_EQ(1u, task_runner_.GetTaskQueueSize());
+
+  while (timeouts < 2)
+    task_runner_.RunOnce();
+  EXPECT_EQ(2, timeouts);
+  EXPECT_GE(task_runner_.GetClock()->Now() - start,
+            base::TimeDelta::FromSeconds(5));
+  EXPECT_EQ(1u, task_runner_.GetTaskQueueSize());
+
+  task_runner_.Run();
+  EXPECT_EQ(3, timeouts);
+  EXPECT_GE(task_runner_.GetClock()->Now() - start,
+            base::TimeDelta::FromSeconds(10));
+  EXPECT_EQ(0u, task_runner_.GetTaskQueueSize());
+}
+
 }  // namespace weave
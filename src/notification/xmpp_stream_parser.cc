@@ -4,7 +4,12 @@
 
 #include "src/notification/xmpp_stream_parser.h"
 
+#include <algorithm>
+
+#include <base/logging.h>
+
 #include "src/notification/xml_node.h"
+#include "src/string_utils.h"
 
 namespace weave {
 
@@ -20,19 +25,104 @@ XmppStreamParser::~XmppStreamParser() {
   XML_ParserFree(parser_);
 }
 
-void XmppStreamParser::ParseData(const std::string& data) {
-  XML_Parse(parser_, data.data(), data.size(), 0);
+void XmppStreamParser::ParseData(const char* data, size_t size) {
+  XML_Parse(parser_, data, size, 0);
 }
 
 void XmppStreamParser::Reset() {
   std::stack<std::unique_ptr<XmlNode>>{}.swap(node_stack_);
   started_ = false;
+  stanza_filter_ = nullptr;
+  element_path_.clear();
+  skip_depth_ = 0;
+  stanza_name_.clear();
+  stanza_size_ = 0;
+  stanza_nodes_ = 0;
+}
+
+bool XmppStreamParser::AddStanzaFilter(const std::string& stanza_name,
+                                       const std::vector<std::string>& paths) {
+  std::vector<ElementPath> new_paths;
+  for (const auto& path : paths) {
+    new_paths.push_back(Split(path, "/", false, true));
+    if (new_paths.back().size() > XmlNodePath::kMaxNames) {
+      LOG(ERROR) << "Stanza filter path is too long: " << path;
+      return false;
+    }
+  }
+  std::vector<ElementPath>& filter = stanza_filters_[stanza_name];
+  for (auto& path : new_paths)
+    filter.push_back(std::move(path));
+  return true;
+}
+
+void XmppStreamParser::SetMaxStanzaSize(size_t max_size) {
+  max_stanza_size_ = max_size;
+}
+
+void XmppStreamParser::SetMaxStanzaDepth(size_t max_depth) {
+  max_stanza_depth_ = max_depth;
+}
+
+void XmppStreamParser::SetMaxStanzaNodes(size_t max_nodes) {
+  max_stanza_nodes_ = max_nodes;
+}
+
+bool XmppStreamParser::AddStanzaSize(size_t size) {
+  if (size <= max_stanza_size_ - stanza_size_) {
+    stanza_size_ += size;
+    return true;
+  }
+  DropStanza();
+  return false;
+}
+
+void XmppStreamParser::DropStanza() {
+  // Skip the rest of the stanza, up to the closing of its element.
+  skip_depth_ = node_stack_.size();
+  std::stack<std::unique_ptr<XmlNode>>{}.swap(node_stack_);
+  stanza_filter_ = nullptr;
+  element_path_.clear();
+  if (delegate_)
+    delegate_->OnStanzaDropped(stanza_name_);
+}
+
+bool XmppStreamParser::KeepElement(const char* name) {
+  if (skip_depth_ > 0) {
+    ++skip_depth_;
+    return false;
+  }
+  if (!started_)
+    return true;
+  if (node_stack_.empty()) {
+    auto p = stanza_filters_.find(name);
+    stanza_filter_ = (p != stanza_filters_.end()) ? &p->second : nullptr;
+    return true;
+  }
+  if (!stanza_filter_)
+    return true;
+  const size_t depth = element_path_.size();
+  for (const ElementPath& path : *stanza_filter_) {
+    // The element is either on the path, or below its last element.
+    if (!std::equal(path.begin(), path.begin() + std::min(depth, path.size()),
+                    element_path_.begin())) {
+      continue;
+    }
+    if (depth >= path.size() || path[depth] == name) {
+      element_path_.push_back(name);
+      return true;
+    }
+  }
+  skip_depth_ = 1;
+  return false;
 }
 
 void XmppStreamParser::HandleElementStart(void* user_data,
                                           const XML_Char* element,
                                           const XML_Char** attr) {
   auto self = static_cast<XmppStreamParser*>(user_data);
+  if (!self->KeepElement(element))
+    return;
   std::map<std::string, std::string> attributes;
   if (attr != nullptr) {
     for (size_t n = 0; attr[n] != nullptr && attr[n + 1] != nullptr; n += 2) {
@@ -45,6 +135,10 @@ void XmppStreamParser::HandleElementStart(void* user_data,
 void XmppStreamParser::HandleElementEnd(void* user_data,
                                         const XML_Char* element) {
   auto self = static_cast<XmppStreamParser*>(user_data);
+  if (self->skip_depth_ > 0) {
+    --self->skip_depth_;
+    return;
+  }
   self->OnCloseElement(element);
 }
 
@@ -52,7 +146,9 @@ void XmppStreamParser::HandleCharData(void* user_data,
                                       const char* content,
                                       int length) {
   auto self = static_cast<XmppStreamParser*>(user_data);
-  self->OnCharData(std::string{content, static_cast<size_t>(length)});
+  if (self->skip_depth_ > 0)
+    return;
+  self->OnCharData(content, static_cast<size_t>(length));
 }
 
 void XmppStreamParser::OnOpenElement(
@@ -64,7 +160,20 @@ void XmppStreamParser::OnOpenElement(
       delegate_->OnStreamStart(node_name, std::move(attributes));
     return;
   }
+  size_t size = node_name.size();
+  for (const auto& pair : attributes)
+    size += pair.first.size() + pair.second.size();
+  if (node_stack_.empty()) {
+    stanza_name_ = node_name;
+    stanza_size_ = 0;
+    stanza_nodes_ = 0;
+  }
   node_stack_.emplace(new XmlNode{node_name, std::move(attributes)});
+  if (node_stack_.size() > max_stanza_depth_ ||
+      ++stanza_nodes_ > max_stanza_nodes_) {
+    return DropStanza();
+  }
+  AddStanzaSize(size);
 }
 
 void XmppStreamParser::OnCloseElement(const std::string& node_name) {
@@ -79,6 +188,8 @@ void XmppStreamParser::OnCloseElement(const std::string& node_name) {
 
   auto node = std::move(node_stack_.top());
   node_stack_.pop();
+  if (stanza_filter_ && !node_stack_.empty())
+    element_path_.pop_back();
   if (!node_stack_.empty()) {
     XmlNode* parent = node_stack_.top().get();
     parent->AddChild(std::move(node));
@@ -87,10 +198,12 @@ void XmppStreamParser::OnCloseElement(const std::string& node_name) {
   }
 }
 
-void XmppStreamParser::OnCharData(const std::string& text) {
-  if (!node_stack_.empty()) {
+void XmppStreamParser::OnCharData(const char* text, size_t size) {
+  // Expat reports the text in many small chunks (e.g. each line separately),
+  // append them in place instead of making a string of each.
+  if (!node_stack_.empty() && AddStanzaSize(size)) {
     XmlNode* node = node_stack_.top().get();
-    node->AppendText(text);
+    node->AppendText(text, size);
   }
 }
 
@@ -7,10 +7,12 @@
 
 #include <expat.h>
 
+#include <limits>
 #include <map>
 #include <memory>
 #include <stack>
 #include <string>
+#include <vector>
 
 #include <base/macros.h>
 
@@ -47,6 +49,8 @@ class XmppStreamParser final {
         std::map<std::string, std::string> attributes) = 0;
     virtual void OnStreamEnd(const std::string& node_name) = 0;
     virtual void OnStanza(std::unique_ptr<XmlNode> stanza) = 0;
+    // Called instead of OnStanza() for the stanzas over the size limit.
+    virtual void OnStanzaDropped(const std::string& node_name) = 0;
 
    protected:
     virtual ~Delegate() {}
@@ -55,12 +59,34 @@ class XmppStreamParser final {
   explicit XmppStreamParser(Delegate* delegate);
   ~XmppStreamParser();
 
-  // Parses additional XML data received from an input stream.
-  void ParseData(const std::string& data);
+  // Parses additional XML data received from an input stream. The data is
+  // not referenced after the call, expat keeps what it needs of incomplete
+  // tokens.
+  void ParseData(const char* data, size_t size);
+  void ParseData(const std::string& data) {
+    ParseData(data.data(), data.size());
+  }
 
   // Resets the parser to expect the top-level stream node again.
   void Reset();
 
+  // Limits the stanzas named |stanza_name| to the elements on the |paths|,
+  // e.g. "push:push/push:data", with all their children. Other elements of
+  // such stanzas are skipped while parsing, without building their nodes.
+  // Stanzas which have no filter are kept whole. Returns false and adds no
+  // filter if a path has more names than XmlNodePath can match.
+  bool AddStanzaFilter(const std::string& stanza_name,
+                       const std::vector<std::string>& paths);
+
+  // Limits the element names, attributes and text kept of a stanza to
+  // |max_size| bytes. A stanza is dropped as soon as it goes over, and the
+  // rest of it is skipped while parsing. Stanzas are not limited by default.
+  void SetMaxStanzaSize(size_t max_size);
+  // Same, for the nesting of the elements kept of a stanza, the stanza
+  // element being at depth 1, and for the number of the elements.
+  void SetMaxStanzaDepth(size_t max_depth);
+  void SetMaxStanzaNodes(size_t max_nodes);
+
  private:
   // Raw expat callbacks.
   static void HandleElementStart(void* user_data,
@@ -73,13 +99,41 @@ class XmppStreamParser final {
   void OnOpenElement(const std::string& node_name,
                      std::map<std::string, std::string> attributes);
   void OnCloseElement(const std::string& node_name);
-  void OnCharData(const std::string& text);
+  void OnCharData(const char* text, size_t size);
+
+  // Returns false if the element |name| which is being opened is filtered out.
+  // Its children are then skipped up to the matching closing element.
+  bool KeepElement(const char* name);
+
+  // Adds |size| bytes to the current stanza, and drops it if it gets over the
+  // limit. Returns false if the stanza was dropped.
+  bool AddStanzaSize(size_t size);
+  // Drops the current stanza and skips the rest of it.
+  void DropStanza();
 
   Delegate* delegate_;
   XML_Parser parser_{nullptr};
   bool started_{false};
   std::stack<std::unique_ptr<XmlNode>> node_stack_;
 
+  using ElementPath = std::vector<std::string>;
+  // Stanza name to the paths of elements which are kept.
+  std::map<std::string, std::vector<ElementPath>> stanza_filters_;
+  // Filter of the current stanza, if any, and the names of the elements
+  // opened below the stanza element.
+  const std::vector<ElementPath>* stanza_filter_{nullptr};
+  ElementPath element_path_;
+  // Nesting level inside the element being skipped.
+  size_t skip_depth_{0};
+
+  size_t max_stanza_size_{std::numeric_limits<size_t>::max()};
+  size_t max_stanza_depth_{std::numeric_limits<size_t>::max()};
+  size_t max_stanza_nodes_{std::numeric_limits<size_t>::max()};
+  // Name, size and number of elements kept of the current stanza.
+  std::string stanza_name_;
+  size_t stanza_size_{0};
+  size_t stanza_nodes_{0};
+
   DISALLOW_COPY_AND_ASSIGN(XmppStreamParser);
 };
 
@@ -0,0 +1,71 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/notification/xmpp_stream_parser.h"
+
+#include <string>
+
+#include <base/logging.h>
+
+#include "src/notification/xml_node.h"
+#include "src/test/benchmark.h"
+
+namespace weave {
+
+namespace {
+
+const char kStreamStart[] =
+    "<stream:stream from=\"clouddevices.gserviceaccount.com\" id=\"76EEB8FDB4"
+    "495558\" version=\"1.0\" xmlns:stream=\"http://etherx.jabber.org/streams"
+    "\" xmlns=\"jabber:client\">";
+
+// A push notification as the cloud sends it, with a base64-encoded payload.
+const char kPushStanza[] =
+    "<message from=\"cloud-devices@clouddevices.google.com/srvenc-xgbCfg9hX6t"
+    "CpxoMYsExqg==\" to=\"4783f652b387449fc52a76f9a16e616f@clouddevices.gserv"
+    "iceaccount.com/5A85ED9C\"><push:push channel=\"cloud_devices\" xmlns:pus"
+    "h=\"google:push\"><push:recipient to=\"4783f652b387449fc52a76f9a16e616f@"
+    "clouddevices.gserviceaccount.com\"></push:recipient><push:data>eyJraW5kI"
+    "joiY2xvdWRkZXZpY2VzI25vdGlmaWNhdGlvbiIsInR5cGUiOiJDT01NQU5EX0NSRUFURUQiL"
+    "CJjb21tYW5kSWQiOiIwNWE3MTA5MC1hZWE4LWMzNzQtOTYwNS0xZTRhY2JhNDRmM2Y4OTAzZ"
+    "mM3Yy01NjExLWI5ODAtOTkyMy0yNjc2YjYwYzkxMGMiLCJkZXZpY2VJZCI6IjA1YTcxMDkwL"
+    "WFlYTgtYzM3NC05NjA1LTFlNGFjYmE0NGYzZiJ9</push:data></push:push></message>";
+
+class Delegate : public XmppStreamParser::Delegate {
+ public:
+  void OnStreamStart(const std::string& node_name,
+                     std::map<std::string, std::string> attributes) override {}
+  void OnStreamEnd(const std::string& node_name) override {}
+  void OnStanza(std::unique_ptr<XmlNode> stanza) override { ++stanza_count; }
+  void OnStanzaDropped(const std::string& node_name) override {}
+
+  size_t stanza_count{0};
+};
+
+void RunParseData(bool filter, test::BenchmarkState* state) {
+  Delegate delegate;
+  XmppStreamParser parser{&delegate};
+  if (filter)
+    parser.AddStanzaFilter("message", {"push:push/push:data"});
+  parser.ParseData(kStreamStart);
+  const std::string stanza = kPushStanza;
+  while (state->KeepRunning())
+    parser.ParseData(stanza);
+  CHECK_EQ(state->iterations(), delegate.stanza_count);
+  state->SetBytesProcessed(state->iterations() * stanza.size());
+}
+
+void BM_XmppStreamParserParseData(test::BenchmarkState* state) {
+  RunParseData(false, state);
+}
+WEAVE_BENCHMARK(BM_XmppStreamParserParseData);
+
+void BM_XmppStreamParserParseDataFiltered(test::BenchmarkState* state) {
+  RunParseData(true, state);
+}
+WEAVE_BENCHMARK(BM_XmppStreamParserParseDataFiltered);
+
+}  // namespace
+
+}  // namespace weave
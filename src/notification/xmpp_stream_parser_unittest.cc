@@ -9,6 +9,7 @@
 #include <vector>
 
 #include "src/notification/xml_node.h"
+#include "src/test/allocation_counter.h"
 
 namespace weave {
 namespace {
@@ -63,6 +64,10 @@ class XmppStreamParserTest : public testing::Test,
     stanzas_.push_back(std::move(stanza));
   }
 
+  void OnStanzaDropped(const std::string& node_name) override {
+    dropped_stanzas_.push_back(node_name);
+  }
+
   void Reset() {
     parser_.reset(new XmppStreamParser{this});
     stream_started_ = false;
@@ -76,6 +81,7 @@ class XmppStreamParserTest : public testing::Test,
   std::string stream_start_node_name_;
   std::map<std::string, std::string> stream_start_node_attributes_;
   std::vector<std::unique_ptr<XmlNode>> stanzas_;
+  std::vector<std::string> dropped_stanzas_;
 };
 
 TEST_F(XmppStreamParserTest, InitialState) {
@@ -94,6 +100,109 @@ TEST_F(XmppStreamParserTest, FullStartElement) {
   EXPECT_EQ(expected_attrs, stream_start_node_attributes_);
 }
 
+TEST_F(XmppStreamParserTest, ReuseBuffer) {
+  char buffer[32];
+  const std::string start = "<foo bar=\"baz\">";
+  start.copy(buffer, start.size());
+  parser_->ParseData(buffer, start.size());
+  EXPECT_TRUE(stream_started_);
+  const std::string stanza = "<iq id=\"1\"/>";
+  stanza.copy(buffer, stanza.size());
+  parser_->ParseData(buffer, stanza.size());
+  ASSERT_EQ(1u, stanzas_.size());
+  EXPECT_EQ("iq", stanzas_.front()->name());
+}
+
+TEST_F(XmppStreamParserTest, ParseDataAllocations) {
+  const std::string stanza = R"(<iq id="1" type="result"><bind/></iq>)";
+  parser_->ParseData("<stream:stream>" + stanza);
+  test::AllocationCounter counter;
+  parser_->ParseData(stanza);
+  EXPECT_LE(counter.GetCount(), 6u);
+  EXPECT_EQ(2u, stanzas_.size());
+}
+
+TEST_F(XmppStreamParserTest, StanzaFilter) {
+  parser_->AddStanzaFilter("message", {"push:push/push:data", "body"});
+  parser_->ParseData(
+      R"(<stream:stream><message from="a">)"
+      R"(<push:push channel="c"><push:recipient to="b">x</push:recipient>)"
+      R"(<push:data>Zm9v<b>bar</b></push:data></push:push>)"
+      R"(<body>text</body>)"
+      R"(<extra><push:push><push:data>no</push:data></push:push></extra>)"
+      R"(</message><iq id="1"><bind><jid>j</jid></bind></iq>)");
+  ASSERT_EQ(2u, stanzas_.size());
+  EXPECT_EQ(
+      R"(<message from="a">)"
+      R"(<push:push channel="c"><push:data>Zm9v<b>bar</b></push:data>)"
+      R"(</push:push><body>text</body></message>)",
+      stanzas_[0]->ToString());
+  EXPECT_EQ("Zm9v",
+            stanzas_[0]->FindFirstChild("push:push/push:data", false)->text());
+  EXPECT_EQ(R"(<iq id="1"><bind><jid>j</jid></bind></iq>)",
+            stanzas_[1]->ToString());
+}
+
+TEST_F(XmppStreamParserTest, StanzaFilterTooLong) {
+  EXPECT_FALSE(
+      parser_->AddStanzaFilter("message", {"body", "a/b/c/d/e/f/g/h/i"}));
+  // No part of the rejected filter is applied.
+  parser_->ParseData(R"(<stream:stream><message><extra/><body>t</body>)"
+                     R"(</message>)");
+  ASSERT_EQ(1u, stanzas_.size());
+  EXPECT_EQ(R"(<message><extra/><body>t</body></message>)",
+            stanzas_[0]->ToString());
+}
+
+TEST_F(XmppStreamParserTest, MaxStanzaSize) {
+  parser_->AddStanzaFilter("message", {"push:push/push:data"});
+  // "message", "push:push", "push:data" and 16 bytes of text.
+  parser_->SetMaxStanzaSize(7 + 9 + 9 + 16);
+  parser_->ParseData("<stream:stream><message><push:push><push:data>");
+  parser_->ParseData("Zm9vYmFyYmF6cXV4");
+  parser_->ParseData("</push:data></push:push><skipped/></message>");
+  ASSERT_EQ(1u, stanzas_.size());
+  EXPECT_EQ("Zm9vYmFyYmF6cXV4",
+            stanzas_[0]->FindFirstChild("push:push/push:data", false)->text());
+
+  // The stanza over the limit is dropped as soon as it is, while the text is
+  // still arriving, and the rest of it is skipped.
+  parser_->ParseData("<message><push:push><push:data>Zm9vYmFyYmF6cXV4");
+  EXPECT_EQ(std::vector<std::string>{}, dropped_stanzas_);
+  parser_->ParseData("Zm9v");
+  EXPECT_EQ(std::vector<std::string>{"message"}, dropped_stanzas_);
+  parser_->ParseData("<b>bar</b></push:data></push:push></message>");
+  parser_->ParseData(R"(<iq id="1"><bind><jid>j</jid></bind></iq>)");
+  ASSERT_EQ(2u, stanzas_.size());
+  EXPECT_EQ(R"(<iq id="1"><bind><jid>j</jid></bind></iq>)",
+            stanzas_[1]->ToString());
+  EXPECT_EQ(1u, dropped_stanzas_.size());
+
+  // Attributes count too.
+  parser_->ParseData(R"(<iq id=")" + std::string(40, 'x') + R"("/>)");
+  EXPECT_EQ(2u, stanzas_.size());
+  EXPECT_EQ((std::vector<std::string>{"message", "iq"}), dropped_stanzas_);
+  EXPECT_TRUE(stream_started_);
+}
+
+TEST_F(XmppStreamParserTest, MaxStanzaDepthAndNodes) {
+  parser_->SetMaxStanzaDepth(3);
+  parser_->SetMaxStanzaNodes(4);
+  parser_->ParseData("<stream:stream><iq><a><b/></a><c/></iq>");
+  ASSERT_EQ(1u, stanzas_.size());
+  EXPECT_EQ(std::vector<std::string>{}, dropped_stanzas_);
+
+  parser_->ParseData("<iq><a><b><c/></b></a></iq>");
+  EXPECT_EQ(std::vector<std::string>{"iq"}, dropped_stanzas_);
+  parser_->ParseData("<message><a/><b/><c/><d/></message>");
+  EXPECT_EQ((std::vector<std::string>{"iq", "message"}), dropped_stanzas_);
+
+  parser_->ParseData("<iq><a/></iq>");
+  ASSERT_EQ(2u, stanzas_.size());
+  EXPECT_EQ("<iq><a/></iq>", stanzas_[1]->ToString());
+  EXPECT_TRUE(stream_started_);
+}
+
 TEST_F(XmppStreamParserTest, PartialStartElement) {
   parser_->ParseData("<foo bar=\"baz");
   EXPECT_FALSE(stream_started_);
@@ -0,0 +1,136 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/object_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <set>
+
+#include <base/logging.h>
+#include <base/values.h>
+#include <weave/provider/allocator.h>
+
+namespace weave {
+
+namespace {
+
+// Blocks and chunk headers keep the alignment of the chunks.
+const size_t kBlockAlignment = alignof(std::max_align_t);
+
+provider::Allocator* g_allocator = nullptr;
+
+// Never destroyed, like the pools of classes.
+std::mutex& GetPoolsLock() {
+  static std::mutex* lock = new std::mutex;
+  return *lock;
+}
+
+std::set<const ObjectPool*>& GetPools() {
+  static std::set<const ObjectPool*>* pools = new std::set<const ObjectPool*>;
+  return *pools;
+}
+
+size_t AlignBlockSize(size_t size) {
+  return (size + kBlockAlignment - 1) & ~(kBlockAlignment - 1);
+}
+
+}  // namespace
+
+void SetAllocator(provider::Allocator* allocator) {
+  g_allocator = allocator;
+  if (allocator)
+    base::SetValueAllocator(&AllocateMemory, &FreeMemory);
+  else
+    base::SetValueAllocator(nullptr, nullptr);
+}
+
+void* AllocateMemory(size_t size) {
+  if (!g_allocator)
+    return ::operator new(size);
+  void* ptr = g_allocator->Allocate(size);
+  CHECK(ptr) << "Out of memory allocating " << size << " bytes";
+  return ptr;
+}
+
+void FreeMemory(void* ptr, size_t size) {
+  if (g_allocator)
+    g_allocator->Free(ptr, size);
+  else
+    ::operator delete(ptr);
+}
+
+ObjectPool::ObjectPool(size_t object_size, size_t blocks_per_chunk)
+    : block_size_{AlignBlockSize(std::max(object_size, sizeof(Link)))},
+      blocks_per_chunk_{blocks_per_chunk} {
+  CHECK_GT(blocks_per_chunk_, 0u);
+  std::lock_guard<std::mutex> lock{GetPoolsLock()};
+  GetPools().insert(this);
+}
+
+ObjectPool::~ObjectPool() {
+  {
+    std::lock_guard<std::mutex> lock{GetPoolsLock()};
+    GetPools().erase(this);
+  }
+  CHECK_EQ(0u, used_blocks_);
+  while (chunks_) {
+    Link* chunk = chunks_;
+    chunks_ = chunk->next;
+    FreeMemory(chunk, GetChunkSize());
+  }
+}
+
+size_t ObjectPool::GetChunkSize() const {
+  return AlignBlockSize(sizeof(Link)) + block_size_ * blocks_per_chunk_;
+}
+
+void* ObjectPool::Allocate() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!free_blocks_) {
+    char* chunk = static_cast<char*>(AllocateMemory(GetChunkSize()));
+    reinterpret_cast<Link*>(chunk)->next = chunks_;
+    chunks_ = reinterpret_cast<Link*>(chunk);
+    ++chunk_count_;
+    // Thread the blocks in their order, so they are handed out that way.
+    char* block = chunk + AlignBlockSize(sizeof(Link));
+    for (size_t i = blocks_per_chunk_; i > 0; --i) {
+      Link* link = reinterpret_cast<Link*>(block + (i - 1) * block_size_);
+      link->next = free_blocks_;
+      free_blocks_ = link;
+    }
+  }
+  Link* block = free_blocks_;
+  free_blocks_ = block->next;
+  ++used_blocks_;
+  return block;
+}
+
+void ObjectPool::Free(void* ptr) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  CHECK_GT(used_blocks_, 0u);
+  --used_blocks_;
+  Link* block = static_cast<Link*>(ptr);
+  block->next = free_blocks_;
+  free_blocks_ = block;
+}
+
+MemoryUsage ObjectPool::GetMemoryUsage() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  MemoryUsage usage;
+  usage.count = used_blocks_;
+  usage.bytes = chunk_count_ * GetChunkSize();
+  return usage;
+}
+
+// static
+MemoryUsage ObjectPool::GetTotalMemoryUsage() {
+  std::lock_guard<std::mutex> lock{GetPoolsLock()};
+  MemoryUsage usage;
+  for (const ObjectPool* pool : GetPools())
+    usage += pool->GetMemoryUsage();
+  return usage;
+}
+
+}  // namespace weave
@@ -0,0 +1,101 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_OBJECT_POOL_H_
+#define LIBWEAVE_SRC_OBJECT_POOL_H_
+
+#include <stddef.h>
+
+#include <mutex>
+
+#include <base/macros.h>
+
+#include "src/memory_usage.h"
+
+namespace weave {
+
+// Returns memory from the provider::Allocator installed with SetAllocator(),
+// or from the global operator new.
+void* AllocateMemory(size_t size);
+void FreeMemory(void* ptr, size_t size);
+
+// Free list of blocks of one size, taken from AllocateMemory() in chunks.
+// Chunks are kept until the pool is destroyed, so the memory of a pool stays
+// at its peak use and freed blocks are reused before the heap is touched
+// again. Guarded by a lock, so blocks can be allocated and freed on any
+// thread.
+class ObjectPool final {
+ public:
+  ObjectPool(size_t object_size, size_t blocks_per_chunk);
+  // Releases the chunks. All the blocks must be free. The pools of classes
+  // are never destroyed.
+  ~ObjectPool();
+
+  void* Allocate();
+  void Free(void* ptr);
+
+  // Objects of |object_size| fit into the blocks.
+  size_t block_size() const { return block_size_; }
+
+  // Returns the number of the blocks in use and the memory of the chunks.
+  MemoryUsage GetMemoryUsage() const;
+
+  // Same as above, for all the existing pools together.
+  static MemoryUsage GetTotalMemoryUsage();
+
+ private:
+  // Header of a free block, and of a chunk before its blocks.
+  struct Link {
+    Link* next;
+  };
+
+  size_t GetChunkSize() const;
+
+  const size_t block_size_;
+  const size_t blocks_per_chunk_;
+  mutable std::mutex mutex_;
+  Link* chunks_{nullptr};
+  Link* free_blocks_{nullptr};
+  size_t chunk_count_{0};
+  size_t used_blocks_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(ObjectPool);
+};
+
+// Base of the classes whose objects are allocated from a pool of their own:
+//   class Foo final : public PoolAllocated<Foo> { ... };
+// Objects of larger subclasses, e.g. test doubles, come from AllocateMemory()
+// directly. Classes with subclasses need a virtual destructor, as the size of
+// the deleted object picks the pool.
+template <typename T, size_t kBlocksPerChunk = 16>
+class PoolAllocated {
+ public:
+  static void* operator new(size_t size) {
+    ObjectPool& pool = GetPool();
+    return size <= pool.block_size() ? pool.Allocate() : AllocateMemory(size);
+  }
+
+  static void operator delete(void* ptr, size_t size) {
+    if (!ptr)
+      return;
+    ObjectPool& pool = GetPool();
+    if (size <= pool.block_size())
+      pool.Free(ptr);
+    else
+      FreeMemory(ptr, size);
+  }
+
+  static ObjectPool& GetPool() {
+    static ObjectPool* pool = new ObjectPool{sizeof(T), kBlocksPerChunk};
+    return *pool;
+  }
+
+ protected:
+  PoolAllocated() = default;
+  ~PoolAllocated() = default;
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_OBJECT_POOL_H_
@@ -0,0 +1,111 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/object_pool.h"
+
+#include <memory>
+#include <set>
+
+#include <base/values.h>
+#include <gtest/gtest.h>
+#include <weave/provider/allocator.h>
+
+namespace weave {
+
+namespace {
+
+struct Pooled : public PoolAllocated<Pooled, 2> {
+  virtual ~Pooled() {}
+  int value{0};
+};
+
+struct LargerPooled : public Pooled {
+  char data[256];
+};
+
+// Forwards to the global operator new, and counts the memory taken.
+class CountingAllocator final : public provider::Allocator {
+ public:
+  void* Allocate(size_t size) override {
+    ++allocations_;
+    bytes_ += size;
+    return ::operator new(size);
+  }
+
+  void Free(void* ptr, size_t size) override {
+    bytes_ -= size;
+    ::operator delete(ptr);
+  }
+
+  size_t allocations_{0};
+  size_t bytes_{0};
+};
+
+}  // namespace
+
+TEST(ObjectPoolTest, ReusesFreedBlocks) {
+  ObjectPool pool{24, 4};
+  EXPECT_LE(24u, pool.block_size());
+
+  std::set<void*> blocks;
+  for (int i = 0; i < 4; ++i)
+    EXPECT_TRUE(blocks.insert(pool.Allocate()).second);
+  EXPECT_EQ(4u, pool.GetMemoryUsage().count);
+  size_t chunk_bytes = pool.GetMemoryUsage().bytes;
+  EXPECT_LE(4 * pool.block_size(), chunk_bytes);
+
+  void* block = *blocks.begin();
+  pool.Free(block);
+  EXPECT_EQ(block, pool.Allocate());
+  EXPECT_EQ(chunk_bytes, pool.GetMemoryUsage().bytes);
+
+  // The next chunk is only taken once all the blocks are in use.
+  blocks.insert(pool.Allocate());
+  EXPECT_EQ(5u, pool.GetMemoryUsage().count);
+  EXPECT_EQ(2 * chunk_bytes, pool.GetMemoryUsage().bytes);
+
+  for (void* ptr : blocks)
+    pool.Free(ptr);
+  EXPECT_EQ(0u, pool.GetMemoryUsage().count);
+  EXPECT_EQ(2 * chunk_bytes, pool.GetMemoryUsage().bytes);
+}
+
+TEST(ObjectPoolTest, PoolAllocatedClass) {
+  ObjectPool& pool = Pooled::GetPool();
+  size_t used = pool.GetMemoryUsage().count;
+  std::unique_ptr<Pooled> first{new Pooled};
+  std::unique_ptr<Pooled> second{new Pooled};
+  EXPECT_EQ(used + 2, pool.GetMemoryUsage().count);
+
+  // Larger subclasses don't fit into the blocks.
+  std::unique_ptr<Pooled> larger{new LargerPooled};
+  EXPECT_EQ(used + 2, pool.GetMemoryUsage().count);
+  larger.reset();
+
+  Pooled* freed = first.get();
+  first.reset();
+  EXPECT_EQ(used + 1, pool.GetMemoryUsage().count);
+  first.reset(new Pooled);
+  EXPECT_EQ(freed, first.get());
+}
+
+TEST(ObjectPoolTest, SetAllocator) {
+  CountingAllocator allocator;
+  SetAllocator(&allocator);
+  {
+    ObjectPool pool{16, 8};
+    void* block = pool.Allocate();
+    EXPECT_EQ(1u, allocator.allocations_);
+    EXPECT_EQ(pool.GetMemoryUsage().bytes, allocator.bytes_);
+    pool.Free(block);
+
+    base::DictionaryValue dict;
+    dict.SetInteger("a.b", 1);
+    EXPECT_EQ(3u, allocator.allocations_);
+  }
+  EXPECT_EQ(0u, allocator.bytes_);
+  SetAllocator(nullptr);
+}
+
+}  // namespace weave
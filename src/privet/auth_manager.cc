@@ -5,6 +5,7 @@
 #include "src/privet/auth_manager.h"
 
 #include <algorithm>
+#include <array>
 
 #include <base/bind.h>
 #include <base/guid.h>
@@ -31,8 +32,17 @@ namespace {
 
 const size_t kMaxMacaroonSize = 1024;
 const size_t kMaxPendingClaims = 10;
+const size_t kMaxParsedAccessTokens = 16;
+// Resumes are refused over this many used tickets which haven't expired yet,
+// as forgetting one would let it be replayed.
+const size_t kMaxUsedResumeTickets = 64;
 const char kInvalidTokenError[] = "invalid_token";
 const int kSessionIdTtlMinutes = 1;
+const char kResumeSecretLabel[] = "resume ticket";
+
+// Scratch space for macaroons, kept on the stack. |UwMacaroon| points into
+// the buffer it was deserialized or extended into.
+using MacaroonBuffer = std::array<uint8_t, kMaxMacaroonSize>;
 
 template <class T>
 void AppendToArray(T value, std::vector<uint8_t>* array) {
@@ -169,49 +179,46 @@ std::vector<uint8_t> CreateMacaroonToken(
                                           secret.size(), &context,
                                           caveats.data(), caveats.size()));
 
-  std::vector<uint8_t> serialized_token(kMaxMacaroonSize);
+  MacaroonBuffer serialized_token;
   size_t len = 0;
   CHECK(uw_macaroon_serialize_(&macaroon, serialized_token.data(),
                                serialized_token.size(), &len));
-  serialized_token.resize(len);
-
-  return serialized_token;
+  return {serialized_token.begin(), serialized_token.begin() + len};
 }
 
-std::vector<uint8_t> ExtendMacaroonToken(
-    const UwMacaroon& macaroon,
-    const base::Time& time,
-    const std::vector<const UwMacaroonCaveat*>& caveats) {
-  UwMacaroonContext context{};
-  CHECK(uw_macaroon_context_create_(ToJ2000Time(time), nullptr, 0, nullptr, 0,
-                                    &context));
-
+// Appends |caveats| to |macaroon|. The result points into |buffers|, which
+// must not hold |macaroon| itself.
+UwMacaroon ExtendMacaroon(const UwMacaroon& macaroon,
+                          const UwMacaroonContext& context,
+                          const std::vector<const UwMacaroonCaveat*>& caveats,
+                          MacaroonBuffer (*buffers)[2]) {
   UwMacaroon prev_macaroon = macaroon;
-  std::vector<uint8_t> prev_buffer(kMaxMacaroonSize);
-  std::vector<uint8_t> new_buffer(kMaxMacaroonSize);
+  // Each step reads the previous macaroon, so alternate between two buffers.
+  size_t next_buffer = 0;
 
   for (auto caveat : caveats) {
     UwMacaroon new_macaroon{};
+    MacaroonBuffer& buffer = (*buffers)[next_buffer];
     CHECK(uw_macaroon_extend_(&prev_macaroon, &new_macaroon, &context, caveat,
-                              new_buffer.data(), new_buffer.size()));
-    new_buffer.swap(prev_buffer);
+                              buffer.data(), buffer.size()));
+    next_buffer ^= 1;
     prev_macaroon = new_macaroon;
   }
+  return prev_macaroon;
+}
 
-  std::vector<uint8_t> serialized_token(kMaxMacaroonSize);
+std::vector<uint8_t> SerializeMacaroon(const UwMacaroon& macaroon) {
+  MacaroonBuffer serialized_token;
   size_t len = 0;
-  CHECK(uw_macaroon_serialize_(&prev_macaroon, serialized_token.data(),
+  CHECK(uw_macaroon_serialize_(&macaroon, serialized_token.data(),
                                serialized_token.size(), &len));
-  serialized_token.resize(len);
-
-  return serialized_token;
+  return {serialized_token.begin(), serialized_token.begin() + len};
 }
 
 bool LoadMacaroon(const std::vector<uint8_t>& token,
-                  std::vector<uint8_t>* buffer,
+                  MacaroonBuffer* buffer,
                   UwMacaroon* macaroon,
                   ErrorPtr* error) {
-  buffer->resize(kMaxMacaroonSize);
   if (!uw_macaroon_deserialize_(token.data(), token.size(), buffer->data(),
                                 buffer->size(), macaroon)) {
     return Error::AddTo(error, FROM_HERE, kInvalidTokenError,
@@ -223,12 +230,14 @@ bool LoadMacaroon(const std::vector<uint8_t>& token,
 bool VerifyMacaroon(const std::vector<uint8_t>& secret,
                     const UwMacaroon& macaroon,
                     const base::Time& time,
+                    const UwMacaroonSignCache* sign_cache,
                     UwMacaroonValidationResult* result,
                     ErrorPtr* error) {
   CHECK_EQ(kSha256OutputSize, secret.size());
   UwMacaroonContext context = {};
   CHECK(uw_macaroon_context_create_(ToJ2000Time(time), nullptr, 0, nullptr, 0,
                                     &context));
+  context.sign_cache = sign_cache;
 
   if (!uw_macaroon_validate_(&macaroon, secret.data(), secret.size(), &context,
                              result)) {
@@ -309,6 +318,15 @@ void AuthManager::SetAuthSecret(const std::vector<uint8_t>& secret,
     owner = RootClientTokenOwner::kNone;
   }
 
+  // All root client tokens start with this caveat, see
+  // GetRootClientAuthToken.
+  ClientAuthTokenCaveat auth_token;
+  const UwMacaroonCaveat* prefix[] = {&auth_token.GetCaveat()};
+  auth_sign_cache_.reset(new UwMacaroonSignCache{});
+  CHECK(uw_macaroon_sign_cache_add_(auth_sign_cache_.get(),
+                                    auth_secret_.data(), auth_secret_.size(),
+                                    prefix, arraysize(prefix)));
+
   if (!config_ || (config_->GetSettings().secret == auth_secret_ &&
                    config_->GetSettings().root_client_token_owner == owner)) {
     return;
@@ -324,6 +342,60 @@ AuthManager::~AuthManager() {}
 
 std::vector<uint8_t> AuthManager::CreateAccessToken(const UserInfo& user_info,
                                                     base::TimeDelta ttl) const {
+  return CreateUserToken(access_secret_, user_info, ttl);
+}
+
+bool AuthManager::ParseAccessToken(const std::vector<uint8_t>& token,
+                                   UserInfo* user_info,
+                                   ErrorPtr* error) const {
+  return ParseUserToken(access_secret_, token, user_info, error);
+}
+
+std::vector<uint8_t> AuthManager::CreateResumeTicket(
+    const UserInfo& user_info,
+    base::TimeDelta ttl) const {
+  return CreateUserToken(GetResumeSecret(), user_info, ttl);
+}
+
+bool AuthManager::ParseResumeTicket(const std::vector<uint8_t>& ticket,
+                                    UserInfo* user_info,
+                                    ErrorPtr* error) {
+  const std::vector<uint8_t> secret = GetResumeSecret();
+  base::Time expiration;
+  if (!ParseUserToken(secret, ticket, user_info, error, &expiration))
+    return false;
+
+  const base::Time now = Now();
+  for (auto it = used_resume_tickets_.begin();
+       it != used_resume_tickets_.end();) {
+    if (it->second < now)
+      it = used_resume_tickets_.erase(it);
+    else
+      ++it;
+  }
+  std::vector<uint8_t> digest = HmacSha256(secret, ticket);
+  if (used_resume_tickets_.find(digest) != used_resume_tickets_.end()) {
+    return Error::AddTo(error, FROM_HERE, errors::kInvalidAuthorization,
+                        "Resume ticket already used");
+  }
+  if (used_resume_tickets_.size() >= kMaxUsedResumeTickets) {
+    return Error::AddTo(error, FROM_HERE, errors::kInvalidAuthorization,
+                        "Too many resumed sessions");
+  }
+  used_resume_tickets_.emplace(std::move(digest), expiration);
+  return true;
+}
+
+std::vector<uint8_t> AuthManager::GetResumeSecret() const {
+  const std::vector<uint8_t> label(
+      kResumeSecretLabel, kResumeSecretLabel + sizeof(kResumeSecretLabel) - 1);
+  return HmacSha256(access_secret_, label);
+}
+
+std::vector<uint8_t> AuthManager::CreateUserToken(
+    const std::vector<uint8_t>& secret,
+    const UserInfo& user_info,
+    base::TimeDelta ttl) const {
   const base::Time now = Now();
   TimestampCaveat issued{now};
   ScopeCaveat scope{ToMacaroonScope(user_info.scope())};
@@ -335,7 +407,7 @@ std::vector<uint8_t> AuthManager::CreateAccessToken(const UserInfo& user_info,
   AppIdCaveat app{user_info.id().app};
   ExpirationCaveat expiration{now + ttl};
   return CreateMacaroonToken(
-      access_secret_, now,
+      secret, now,
       {
 
           &issued.GetCaveat(), &scope.GetCaveat(), &user.GetCaveat(),
@@ -343,17 +415,35 @@ std::vector<uint8_t> AuthManager::CreateAccessToken(const UserInfo& user_info,
       });
 }
 
-bool AuthManager::ParseAccessToken(const std::vector<uint8_t>& token,
-                                   UserInfo* user_info,
-                                   ErrorPtr* error) const {
-  std::vector<uint8_t> buffer;
+bool AuthManager::ParseUserToken(const std::vector<uint8_t>& secret,
+                                 const std::vector<uint8_t>& token,
+                                 UserInfo* user_info,
+                                 ErrorPtr* error,
+                                 base::Time* expiration) const {
+  const base::Time now = Now();
+  // A fixed size key, which is also bound to the current |access_secret_|.
+  const std::vector<uint8_t> digest = HmacSha256(secret, token);
+  auto cached = parsed_access_tokens_.find(digest);
+  if (cached != parsed_access_tokens_.end()) {
+    // Verify again if the clock went back, as the token may not be valid yet.
+    if (cached->second.verified <= now && now <= cached->second.expiration) {
+      if (user_info)
+        *user_info = cached->second.user_info;
+      if (expiration)
+        *expiration = cached->second.expiration;
+      return true;
+    }
+    parsed_access_tokens_.erase(cached);
+  }
+
+  MacaroonBuffer buffer;
   UwMacaroon macaroon{};
 
   UwMacaroonValidationResult result{};
-  const base::Time now = Now();
   if (!LoadMacaroon(token, &buffer, &macaroon, error) ||
       macaroon.num_caveats != 5 ||
-      !VerifyMacaroon(access_secret_, macaroon, now, &result, error)) {
+      !VerifyMacaroon(secret, macaroon, now, nullptr, &result,
+                      error)) {
     return Error::AddTo(error, FROM_HERE, errors::kInvalidAuthorization,
                         "Invalid token");
   }
@@ -381,9 +471,23 @@ bool AuthManager::ParseAccessToken(const std::vector<uint8_t>& token,
   std::vector<uint8_t> app_id{
       result.delegatees[1].id,
       result.delegatees[1].id + result.delegatees[1].id_len};
+  UserInfo parsed{auth_scope, UserAppId{type, user_id, app_id}};
   if (user_info)
-    *user_info = UserInfo{auth_scope, UserAppId{type, user_id, app_id}};
-
+    *user_info = parsed;
+  if (expiration)
+    *expiration = FromJ2000Time(result.expiration_time);
+
+  if (parsed_access_tokens_.size() >= kMaxParsedAccessTokens) {
+    // Evict the token which expires first.
+    parsed_access_tokens_.erase(std::min_element(
+        parsed_access_tokens_.begin(), parsed_access_tokens_.end(),
+        [](const decltype(parsed_access_tokens_)::value_type& a,
+           const decltype(parsed_access_tokens_)::value_type& b) {
+          return a.second.expiration < b.second.expiration;
+        }));
+  }
+  parsed_access_tokens_[digest] = {parsed, now,
+                                   FromJ2000Time(result.expiration_time)};
   return true;
 }
 
@@ -459,11 +563,12 @@ base::Time AuthManager::Now() const {
 
 bool AuthManager::IsValidAuthToken(const std::vector<uint8_t>& token,
                                    ErrorPtr* error) const {
-  std::vector<uint8_t> buffer;
+  MacaroonBuffer buffer;
   UwMacaroon macaroon{};
   UwMacaroonValidationResult result{};
   if (!LoadMacaroon(token, &buffer, &macaroon, error) ||
-      !VerifyMacaroon(auth_secret_, macaroon, Now(), &result, error)) {
+      !VerifyMacaroon(auth_secret_, macaroon, Now(), auth_sign_cache_.get(),
+                      &result, error)) {
     return Error::AddTo(error, FROM_HERE, errors::kInvalidAuthCode,
                         "Invalid token");
   }
@@ -477,12 +582,13 @@ bool AuthManager::CreateAccessTokenFromAuth(
     AuthScope* access_token_scope,
     base::TimeDelta* access_token_ttl,
     ErrorPtr* error) const {
-  std::vector<uint8_t> buffer;
+  MacaroonBuffer buffer;
   UwMacaroon macaroon{};
   UwMacaroonValidationResult result{};
   const base::Time now = Now();
   if (!LoadMacaroon(auth_token, &buffer, &macaroon, error) ||
-      !VerifyMacaroon(auth_secret_, macaroon, now, &result, error)) {
+      !VerifyMacaroon(auth_secret_, macaroon, now, auth_sign_cache_.get(),
+                      &result, error)) {
     return Error::AddTo(error, FROM_HERE, errors::kInvalidAuthCode,
                         "Invalid token");
   }
@@ -582,35 +688,61 @@ void AuthManager::ResetAccessSecret() {
   auto new_secret = CreateSecret();
   CHECK(new_secret != access_secret_);
   access_secret_.swap(new_secret);
+  parsed_access_tokens_.clear();
+  used_resume_tickets_.clear();
 }
 
 std::vector<uint8_t> AuthManager::DelegateToUser(
     const std::vector<uint8_t>& token,
     base::TimeDelta ttl,
     const UserInfo& user_info) const {
-  std::vector<uint8_t> buffer;
+  return DelegateToUsers(token, ttl, {user_info}).front();
+}
+
+std::vector<std::vector<uint8_t>> AuthManager::DelegateToUsers(
+    const std::vector<uint8_t>& token,
+    base::TimeDelta ttl,
+    const std::vector<UserInfo>& users) const {
+  MacaroonBuffer buffer;
   UwMacaroon macaroon{};
   CHECK(LoadMacaroon(token, &buffer, &macaroon, nullptr));
 
   const base::Time now = Now();
+  UwMacaroonContext context{};
+  CHECK(uw_macaroon_context_create_(ToJ2000Time(now), nullptr, 0, nullptr, 0,
+                                    &context));
+
+  // Caveats which are the same for all users are signed only once.
   TimestampCaveat issued{now};
   ExpirationCaveat expiration{now + ttl};
-  ScopeCaveat scope{ToMacaroonScope(user_info.scope())};
-  UserIdCaveat user{user_info.id().user};
-  AppIdCaveat app{user_info.id().app};
-  SessionIdCaveat session{CreateSessionId()};
-
-  std::vector<const UwMacaroonCaveat*> caveats{
-      &issued.GetCaveat(), &expiration.GetCaveat(), &scope.GetCaveat(),
-      &user.GetCaveat(),
-  };
-
-  if (!user_info.id().app.empty())
-    caveats.push_back(&app.GetCaveat());
-
-  caveats.push_back(&session.GetCaveat());
-
-  return ExtendMacaroonToken(macaroon, now, caveats);
+  MacaroonBuffer prefix_buffers[2];
+  const UwMacaroon prefix =
+      ExtendMacaroon(macaroon, context,
+                     {&issued.GetCaveat(), &expiration.GetCaveat()},
+                     &prefix_buffers);
+
+  MacaroonBuffer buffers[2];
+  std::vector<std::vector<uint8_t>> tokens;
+  tokens.reserve(users.size());
+  for (const auto& user_info : users) {
+    ScopeCaveat scope{ToMacaroonScope(user_info.scope())};
+    UserIdCaveat user{user_info.id().user};
+    AppIdCaveat app{user_info.id().app};
+    SessionIdCaveat session{CreateSessionId()};
+
+    std::vector<const UwMacaroonCaveat*> caveats{
+        &scope.GetCaveat(), &user.GetCaveat(),
+    };
+
+    if (!user_info.id().app.empty())
+      caveats.push_back(&app.GetCaveat());
+
+    caveats.push_back(&session.GetCaveat());
+
+    tokens.push_back(SerializeMacaroon(
+        ExtendMacaroon(prefix, context, caveats, &buffers)));
+  }
+  return tokens;
 }
 
 }  // namespace privet
@@ -6,6 +6,8 @@
 #define LIBWEAVE_SRC_PRIVET_AUTH_MANAGER_H_
 
 #include <deque>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -17,6 +19,8 @@
 
 #include "src/privet/privet_types.h"
 
+struct UwMacaroonSignCache;
+
 namespace weave {
 
 class AccessRevocationManager;
@@ -46,6 +50,16 @@ class AuthManager {
                         UserInfo* user_info,
                         ErrorPtr* error) const;
 
+  // Resume tickets let a client get a new access token for the same user
+  // without pairing or authenticating again. They are signed with a key
+  // derived from |access_secret_|, so they can't be used as access tokens and
+  // become invalid when it's reset. A ticket is accepted only once.
+  std::vector<uint8_t> CreateResumeTicket(const UserInfo& user_info,
+                                          base::TimeDelta ttl) const;
+  bool ParseResumeTicket(const std::vector<uint8_t>& ticket,
+                         UserInfo* user_info,
+                         ErrorPtr* error);
+
   const std::vector<uint8_t>& GetAuthSecret() const { return auth_secret_; }
   const std::vector<uint8_t>& GetAccessSecret() const { return access_secret_; }
   const std::vector<uint8_t>& GetCertificateFingerprint() const {
@@ -79,11 +93,27 @@ class AuthManager {
   friend class AuthManagerTest;
 
   void ResetAccessSecret();
+  std::vector<uint8_t> GetResumeSecret() const;
+
+  std::vector<uint8_t> CreateUserToken(const std::vector<uint8_t>& secret,
+                                       const UserInfo& user_info,
+                                       base::TimeDelta ttl) const;
+  // Also returns the |expiration| of the token, if not null.
+  bool ParseUserToken(const std::vector<uint8_t>& secret,
+                      const std::vector<uint8_t>& token,
+                      UserInfo* user_info,
+                      ErrorPtr* error,
+                      base::Time* expiration = nullptr) const;
 
   // Test helpers. Device does not need to implement delegation.
   std::vector<uint8_t> DelegateToUser(const std::vector<uint8_t>& token,
                                       base::TimeDelta ttl,
                                       const UserInfo& user_info) const;
+  // Same as DelegateToUser, for many users at once.
+  std::vector<std::vector<uint8_t>> DelegateToUsers(
+      const std::vector<uint8_t>& token,
+      base::TimeDelta ttl,
+      const std::vector<UserInfo>& users) const;
 
   Config* config_{nullptr};  // Can be nullptr for tests.
   AccessRevocationManager* black_list_{nullptr};
@@ -92,9 +122,26 @@ class AuthManager {
   mutable uint32_t session_counter_{0};
 
   std::vector<uint8_t> auth_secret_;  // Persistent.
+  // Precomputed start of the MAC chain of tokens derived from |auth_secret_|.
+  std::unique_ptr<UwMacaroonSignCache> auth_sign_cache_;
   std::vector<uint8_t> certificate_fingerprint_;
   std::vector<uint8_t> access_secret_;  // New on every reboot.
 
+  // Recently verified access tokens and resume tickets by their HMAC digest
+  // with the signing key, so clients reusing a token don't pay for the
+  // macaroon checks on every request. Cleared with |access_secret_|, which is
+  // also reset when access is revoked.
+  struct ParsedAccessToken {
+    UserInfo user_info;
+    base::Time verified;
+    base::Time expiration;
+  };
+  mutable std::map<std::vector<uint8_t>, ParsedAccessToken>
+      parsed_access_tokens_;
+  // Expiration of the used resume tickets which are still valid, by their
+  // digest as above.
+  std::map<std::vector<uint8_t>, base::Time> used_resume_tickets_;
+
   std::deque<std::pair<std::unique_ptr<AuthManager>, RootClientTokenOwner>>
       pending_claims_;
 
@@ -0,0 +1,35 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/privet/auth_manager.h"
+
+#include <vector>
+
+#include <base/logging.h>
+
+#include "src/test/benchmark.h"
+
+namespace weave {
+namespace privet {
+
+namespace {
+
+void BM_AuthManagerParseAccessToken(test::BenchmarkState* state) {
+  const std::vector<uint8_t> kSecret(32, 0x5a);
+  const std::vector<uint8_t> kFingerprint(32, 0xa5);
+  AuthManager auth{kSecret, kFingerprint, kSecret};
+  const std::vector<uint8_t> kUser{'u', 's', 'e', 'r'};
+  std::vector<uint8_t> token = auth.CreateAccessToken(
+      UserInfo{AuthScope::kUser, UserAppId{AuthType::kLocal, kUser, {}}},
+      base::TimeDelta::FromHours(1));
+  UserInfo user_info;
+  while (state->KeepRunning())
+    CHECK(auth.ParseAccessToken(token, &user_info, nullptr));
+}
+WEAVE_BENCHMARK(BM_AuthManagerParseAccessToken);
+
+}  // namespace
+
+}  // namespace privet
+}  // namespace weave
@@ -11,6 +11,7 @@
 #include "src/config.h"
 #include "src/data_encoding.h"
 #include "src/privet/mock_delegates.h"
+#include "src/test/allocation_counter.h"
 #include "src/test/mock_access_revocation_manager.h"
 #include "src/test/mock_clock.h"
 
@@ -50,6 +51,12 @@ class AuthManagerTest : public testing::Test {
                                       const UserInfo& user_info) const {
     return auth_.DelegateToUser(token, ttl, user_info);
   }
+  std::vector<std::vector<uint8_t>> DelegateToUsers(
+      const std::vector<uint8_t>& token,
+      base::TimeDelta ttl,
+      const std::vector<UserInfo>& users) const {
+    return auth_.DelegateToUsers(token, ttl, users);
+  }
   const std::vector<uint8_t> kSecret1{
       78, 40, 39, 68, 29, 19, 70, 86, 38, 61, 13, 55, 33, 32, 51, 52,
       34, 43, 97, 48, 8,  56, 11, 99, 50, 59, 24, 26, 31, 71, 76, 28};
@@ -206,6 +213,16 @@ TEST_F(AuthManagerTest, ParseAccessToken) {
   }
 }
 
+TEST_F(AuthManagerTest, ParseAccessTokenAllocations) {
+  auto token = auth_.CreateAccessToken(
+      UserInfo{AuthScope::kUser, TestUserId{"5"}}, {});
+  UserInfo user_info;
+  EXPECT_TRUE(auth_.ParseAccessToken(token, &user_info, nullptr));
+  test::AllocationCounter counter;
+  EXPECT_TRUE(auth_.ParseAccessToken(token, &user_info, nullptr));
+  EXPECT_LE(counter.GetCount(), 6u);
+}
+
 TEST_F(AuthManagerTest, AccessTokenAfterReset) {
   UserInfo user_info;
   auto token1 = auth_.CreateAccessToken(
@@ -222,6 +239,63 @@ TEST_F(AuthManagerTest, AccessTokenAfterReset) {
   EXPECT_TRUE(auth_.ParseAccessToken(token2, &user_info, nullptr));
 }
 
+TEST_F(AuthManagerTest, ParseAccessTokenCache) {
+  // More tokens than the cache holds, with different expiration times.
+  std::vector<std::vector<uint8_t>> tokens;
+  for (size_t i = 0; i < 20; ++i) {
+    tokens.push_back(auth_.CreateAccessToken(
+        UserInfo{AuthScope::kUser, TestUserId{std::to_string(i)}},
+        base::TimeDelta::FromSeconds(100 + i)));
+  }
+  for (size_t n = 0; n < 2; ++n) {
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      UserInfo user_info;
+      EXPECT_TRUE(auth_.ParseAccessToken(tokens[i], &user_info, nullptr));
+      EXPECT_EQ(AuthScope::kUser, user_info.scope());
+      EXPECT_EQ(TestUserId{std::to_string(i)}, user_info.id());
+    }
+  }
+
+  // Cached tokens expire as usual.
+  const base::Time later = clock_.Now() + base::TimeDelta::FromSeconds(110);
+  EXPECT_CALL(clock_, Now()).WillRepeatedly(Return(later));
+  EXPECT_FALSE(auth_.ParseAccessToken(tokens[0], nullptr, nullptr));
+  EXPECT_TRUE(auth_.ParseAccessToken(tokens[19], nullptr, nullptr));
+
+  // And are rejected after revocation.
+  black_list_.changed_callback_.Run();
+  EXPECT_FALSE(auth_.ParseAccessToken(tokens[19], nullptr, nullptr));
+}
+
+TEST_F(AuthManagerTest, ResumeTicket) {
+  const UserInfo kUser{AuthScope::kUser, TestUserId{"234"}};
+  auto ticket = auth_.CreateResumeTicket(kUser, base::TimeDelta::FromHours(1));
+  auto token = auth_.CreateAccessToken(kUser, base::TimeDelta::FromHours(1));
+
+  UserInfo user_info;
+  EXPECT_TRUE(auth_.ParseResumeTicket(ticket, &user_info, nullptr));
+  EXPECT_EQ(AuthScope::kUser, user_info.scope());
+  EXPECT_EQ(TestUserId{"234"}, user_info.id());
+
+  // Tickets are single use.
+  ErrorPtr error;
+  EXPECT_FALSE(auth_.ParseResumeTicket(ticket, nullptr, &error));
+  EXPECT_TRUE(error->HasError("invalidAuthorization"));
+
+  // Tickets and access tokens are not interchangeable.
+  ticket = auth_.CreateResumeTicket(kUser, base::TimeDelta::FromHours(1));
+  EXPECT_FALSE(auth_.ParseAccessToken(ticket, nullptr, nullptr));
+  EXPECT_FALSE(auth_.ParseResumeTicket(token, nullptr, nullptr));
+
+  const base::Time later = clock_.Now() + base::TimeDelta::FromHours(2);
+  EXPECT_CALL(clock_, Now()).WillRepeatedly(Return(later));
+  EXPECT_FALSE(auth_.ParseResumeTicket(ticket, nullptr, nullptr));
+
+  ticket = auth_.CreateResumeTicket(kUser, base::TimeDelta::FromHours(1));
+  black_list_.changed_callback_.Run();
+  EXPECT_FALSE(auth_.ParseResumeTicket(ticket, nullptr, nullptr));
+}
+
 TEST_F(AuthManagerTest, AccessTokenBeforeJ2000) {
   EXPECT_CALL(clock_, Now())
       .WillRepeatedly(Return(base::Time::FromTimeT(5678)));
@@ -309,6 +383,29 @@ TEST_F(AuthManagerTest, CreateAccessTokenFromAuth) {
   EXPECT_EQ(TestUserId{"234"}, user_info.id());
 }
 
+TEST_F(AuthManagerTest, CreateAccessTokenFromAuthBatch) {
+  auto root = auth_.GetRootClientAuthToken(RootClientTokenOwner::kCloud);
+  const std::vector<UserInfo> users{
+      UserInfo{AuthScope::kUser, TestUserId{"234"}},
+      UserInfo{AuthScope::kManager, TestUserId{"235"}},
+      UserInfo{AuthScope::kViewer, TestUserId{"236"}},
+  };
+  auto tokens =
+      DelegateToUsers(root, base::TimeDelta::FromSeconds(1000), users);
+  ASSERT_EQ(users.size(), tokens.size());
+  for (size_t i = 0; i < users.size(); ++i) {
+    std::vector<uint8_t> access_token;
+    AuthScope scope;
+    EXPECT_TRUE(auth_.CreateAccessTokenFromAuth(
+        tokens[i], base::TimeDelta::FromDays(1), &access_token, &scope,
+        nullptr, nullptr));
+    UserInfo user_info;
+    EXPECT_TRUE(auth_.ParseAccessToken(access_token, &user_info, nullptr));
+    EXPECT_EQ(users[i].scope(), user_info.scope());
+    EXPECT_EQ(users[i].id(), user_info.id());
+  }
+}
+
 TEST_F(AuthManagerTest, CreateAccessTokenFromAuthNotMinted) {
   std::vector<uint8_t> access_token;
   auto root = auth_.GetRootClientAuthToken(RootClientTokenOwner::kClient);
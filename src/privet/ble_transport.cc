@@ -0,0 +1,168 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/privet/ble_transport.h"
+
+#include <algorithm>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/values.h>
+#include <weave/provider/bluetooth.h>
+
+#include "src/http_constants.h"
+#include "src/privet/cbor_encoding.h"
+#include "src/privet/privet_handler.h"
+
+namespace weave {
+namespace privet {
+
+namespace {
+
+const uint8_t kFirstPacket = 0x80;
+const uint8_t kSequenceMask = 0x7f;
+const size_t kSizeBytes = 4;
+const size_t kFirstHeaderSize = 1 + kSizeBytes;
+
+// Requests are small, the limit keeps a central from exhausting memory.
+const size_t kMaxRequestSize = 64 * 1024;
+
+}  // namespace
+
+BleTransport::BleTransport(provider::Bluetooth* bluetooth,
+                           PrivetHandler* handler)
+    : bluetooth_{bluetooth}, handler_{handler} {
+  CHECK(bluetooth_);
+  CHECK(handler_);
+  for (const auto& api : handler_->GetHttpPaths())
+    unencrypted_apis_.insert(api);
+  bluetooth_->StartPrivetService(
+      base::Bind(&BleTransport::OnData, weak_ptr_factory_.GetWeakPtr()),
+      base::Bind(&BleTransport::OnClosed, weak_ptr_factory_.GetWeakPtr()));
+}
+
+BleTransport::~BleTransport() {
+  bluetooth_->StopPrivetService();
+}
+
+void BleTransport::OnData(int connection_id, const std::string& data) {
+  if (data.empty())
+    return;
+
+  uint8_t header = static_cast<uint8_t>(data[0]);
+  uint8_t sequence = header & kSequenceMask;
+  size_t offset = 1;
+  if (header & kFirstPacket) {
+    LOG_IF(WARNING, incoming_.count(connection_id))
+        << "Incomplete BLE message dropped";
+    incoming_.erase(connection_id);
+    if (sequence != 0 || data.size() < kFirstHeaderSize) {
+      LOG(WARNING) << "Invalid first BLE packet";
+      return;
+    }
+    size_t size = 0;
+    for (; offset < kFirstHeaderSize; ++offset)
+      size = size << 8 | static_cast<uint8_t>(data[offset]);
+    if (size > kMaxRequestSize) {
+      LOG(WARNING) << "BLE request is too large: " << size;
+      return;
+    }
+    incoming_[connection_id].size = size;
+  }
+
+  auto it = incoming_.find(connection_id);
+  if (it == incoming_.end())
+    return;  // Rest of a dropped message.
+
+  IncomingMessage& message = it->second;
+  if (sequence != message.next_sequence ||
+      data.size() - offset > message.size - message.data.size()) {
+    LOG(WARNING) << "Unexpected BLE packet, message dropped";
+    incoming_.erase(it);
+    return;
+  }
+  message.next_sequence = (sequence + 1) & kSequenceMask;
+  message.data.append(data, offset, std::string::npos);
+  if (message.data.size() < message.size)
+    return;
+
+  std::string complete;
+  std::swap(complete, message.data);
+  incoming_.erase(it);
+  HandleMessage(connection_id, complete);
+}
+
+void BleTransport::OnClosed(int connection_id) {
+  incoming_.erase(connection_id);
+}
+
+void BleTransport::HandleMessage(int connection_id,
+                                 const std::string& message) {
+  ErrorPtr error;
+  auto value = DecodeCbor(message, &error);
+  const base::ListValue* request = nullptr;
+  int request_id = 0;
+  std::string api;
+  std::string auth_header;
+  if (!value || !value->GetAsList(&request) || request->GetSize() != 4 ||
+      !request->GetInteger(0, &request_id) || !request->GetString(1, &api) ||
+      !request->GetString(2, &auth_header)) {
+    LOG(WARNING) << "Invalid BLE request"
+                 << (error ? ": " + error->GetMessage() : "");
+    return;
+  }
+
+  // Same as an invalid JSON body of HTTP requests.
+  const base::DictionaryValue* input = nullptr;
+  request->GetDictionary(3, &input);
+
+  if (!unencrypted_apis_.count(api) &&
+      !bluetooth_->IsEncrypted(connection_id)) {
+    // As HTTPS only APIs on the HTTP server.
+    return OnRequestDone(connection_id, request_id, http::kNotFound,
+                         base::DictionaryValue{});
+  }
+
+  handler_->HandleRequest(
+      api, auth_header, input,
+      base::Bind(&BleTransport::OnRequestDone, weak_ptr_factory_.GetWeakPtr(),
+                 connection_id, request_id));
+}
+
+void BleTransport::OnRequestDone(int connection_id,
+                                 int request_id,
+                                 int status,
+                                 const base::DictionaryValue& output) {
+  base::ListValue reply;
+  reply.AppendInteger(request_id);
+  reply.AppendInteger(status);
+  reply.Append(output.CreateDeepCopy());
+  SendMessage(connection_id, EncodeCbor(reply));
+}
+
+void BleTransport::SendMessage(int connection_id, const std::string& message) {
+  size_t max_size = bluetooth_->GetMaxDataSize(connection_id);
+  CHECK_GT(max_size, kFirstHeaderSize);
+
+  size_t offset = 0;
+  uint8_t sequence = 0;
+  do {
+    std::string packet;
+    if (offset == 0) {
+      packet.push_back(static_cast<char>(kFirstPacket));
+      for (size_t i = kSizeBytes; i > 0; --i)
+        packet.push_back(static_cast<char>(message.size() >> (8 * (i - 1))));
+    } else {
+      packet.push_back(static_cast<char>(sequence));
+    }
+    size_t size = std::min(max_size - packet.size(), message.size() - offset);
+    packet.append(message, offset, size);
+    offset += size;
+    sequence = (sequence + 1) & kSequenceMask;
+    bluetooth_->SendPrivetData(connection_id, packet);
+  } while (offset < message.size());
+}
+
+}  // namespace privet
+}  // namespace weave
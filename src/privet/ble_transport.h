@@ -0,0 +1,78 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_PRIVET_BLE_TRANSPORT_H_
+#define LIBWEAVE_SRC_PRIVET_BLE_TRANSPORT_H_
+
+#include <map>
+#include <set>
+#include <string>
+
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+
+namespace base {
+class DictionaryValue;
+}  // namespace base
+
+namespace weave {
+
+namespace provider {
+class Bluetooth;
+}
+
+namespace privet {
+
+class PrivetHandler;
+
+// Serves Privet requests over the GATT service of provider::Bluetooth.
+//
+// Messages are split into packets which fit into a single write or
+// notification. Every packet starts with a header byte: bit 7 is set on the
+// first packet of a message and the other bits are the sequence number of the
+// packet in the message, modulo 128. The first packet continues with the
+// 32-bit big-endian size of the message.
+//
+// Messages are CBOR (see cbor_encoding.h). Requests are arrays
+//   [id, api, auth_header, input]
+// and replies are arrays
+//   [id, status, output]
+// where |id| is an integer chosen by the central to match replies to
+// requests, and the rest is the same as in HTTP requests.
+class BleTransport final {
+ public:
+  BleTransport(provider::Bluetooth* bluetooth, PrivetHandler* handler);
+  ~BleTransport();
+
+ private:
+  // Message being received on a connection.
+  struct IncomingMessage {
+    std::string data;
+    size_t size{0};
+    uint8_t next_sequence{0};
+  };
+
+  void OnData(int connection_id, const std::string& data);
+  void OnClosed(int connection_id);
+  void HandleMessage(int connection_id, const std::string& message);
+  void OnRequestDone(int connection_id,
+                     int request_id,
+                     int status,
+                     const base::DictionaryValue& output);
+  void SendMessage(int connection_id, const std::string& message);
+
+  provider::Bluetooth* bluetooth_{nullptr};
+  PrivetHandler* handler_{nullptr};
+  // APIs available without an encrypted link, as over HTTP.
+  std::set<std::string> unencrypted_apis_;
+  std::map<int, IncomingMessage> incoming_;
+
+  base::WeakPtrFactory<BleTransport> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(BleTransport);
+};
+
+}  // namespace privet
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_PRIVET_BLE_TRANSPORT_H_
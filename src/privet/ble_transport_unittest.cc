@@ -0,0 +1,174 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/privet/ble_transport.h"
+
+#include <base/values.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <weave/provider/test/mock_bluetooth.h>
+#include <weave/test/unittest_utils.h>
+
+#include "src/privet/cbor_encoding.h"
+#include "src/privet/mock_delegates.h"
+#include "src/privet/privet_handler.h"
+#include "src/test/mock_clock.h"
+
+using testing::_;
+using testing::DoAll;
+using testing::Invoke;
+using testing::Return;
+using testing::SaveArg;
+
+namespace weave {
+namespace privet {
+
+class BleTransportTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    EXPECT_CALL(clock_, Now())
+        .WillRepeatedly(Return(base::Time::FromTimeT(1410000001)));
+    EXPECT_CALL(bluetooth_, GetMaxDataSize(_)).WillRepeatedly(Return(20));
+    EXPECT_CALL(bluetooth_, IsEncrypted(_)).WillRepeatedly(Return(false));
+    EXPECT_CALL(bluetooth_, SendPrivetData(_, _))
+        .WillRepeatedly(Invoke([this](int id, const std::string& data) {
+          EXPECT_LE(data.size(), 20u);
+          sent_[id].push_back(data);
+        }));
+    EXPECT_CALL(bluetooth_, StartPrivetService(_, _))
+        .WillOnce(DoAll(SaveArg<0>(&on_data_), SaveArg<1>(&on_closed_)));
+    EXPECT_CALL(bluetooth_, StopPrivetService());
+
+    handler_.reset(
+        new PrivetHandler(&cloud_, &device_, &security_, &wifi_, &clock_));
+    transport_.reset(new BleTransport{&bluetooth_, handler_.get()});
+  }
+
+  // Sends the request in packets of |packet_size| bytes.
+  void SendRequest(int connection_id,
+                   const std::string& api,
+                   const std::string& input,
+                   size_t packet_size = 20) {
+    base::ListValue request;
+    request.AppendInteger(7);
+    request.AppendString(api);
+    request.AppendString("Privet anonymous");
+    request.Append(test::CreateValue(input));
+    std::string message = EncodeCbor(request);
+
+    std::string first{'\x80', '\0', '\0',
+                      static_cast<char>(message.size() >> 8),
+                      static_cast<char>(message.size())};
+    size_t size = std::min(packet_size - first.size(), message.size());
+    on_data_.Run(connection_id, first + message.substr(0, size));
+    for (char sequence = 1; size < message.size(); ++sequence) {
+      std::string packet{sequence};
+      packet += message.substr(size, packet_size - 1);
+      size += packet_size - 1;
+      on_data_.Run(connection_id, packet);
+    }
+  }
+
+  // Returns the reply received on the connection, after checking framing.
+  std::unique_ptr<base::Value> GetReply(int connection_id) {
+    const std::vector<std::string>& packets = sent_[connection_id];
+    EXPECT_FALSE(packets.empty());
+    if (packets.empty())
+      return nullptr;
+    EXPECT_EQ('\x80', packets[0][0]);
+    size_t size = 0;
+    for (size_t i = 1; i < 5; ++i)
+      size = size << 8 | static_cast<uint8_t>(packets[0][i]);
+    std::string message = packets[0].substr(5);
+    for (size_t i = 1; i < packets.size(); ++i) {
+      EXPECT_EQ(static_cast<char>(i), packets[i][0]);
+      message += packets[i].substr(1);
+    }
+    EXPECT_EQ(size, message.size());
+    return DecodeCbor(message, nullptr);
+  }
+
+  test::MockClock clock_;
+  testing::StrictMock<provider::test::MockBluetooth> bluetooth_;
+  MockCloudDelegate cloud_;
+  MockDeviceDelegate device_;
+  MockSecurityDelegate security_;
+  MockWifiDelegate wifi_;
+  std::unique_ptr<PrivetHandler> handler_;
+  std::unique_ptr<BleTransport> transport_;
+
+  provider::Bluetooth::DataCallback on_data_;
+  provider::Bluetooth::ClosedCallback on_closed_;
+  std::map<int, std::vector<std::string>> sent_;
+};
+
+TEST_F(BleTransportTest, Info) {
+  SendRequest(1, "/privet/info", "{}");
+  auto reply = GetReply(1);
+  ASSERT_NE(nullptr, reply.get());
+  const base::ListValue* list = nullptr;
+  ASSERT_TRUE(reply->GetAsList(&list));
+  int id = 0;
+  int status = 0;
+  const base::DictionaryValue* output = nullptr;
+  ASSERT_TRUE(list->GetInteger(0, &id));
+  ASSERT_TRUE(list->GetInteger(1, &status));
+  ASSERT_TRUE(list->GetDictionary(2, &output));
+  EXPECT_EQ(7, id);
+  EXPECT_EQ(200, status);
+  std::string name;
+  EXPECT_TRUE(output->GetString("name", &name));
+  EXPECT_EQ("TestDevice", name);
+  EXPECT_GT(sent_[1].size(), 1u);
+}
+
+TEST_F(BleTransportTest, SecureApiNeedsEncryption) {
+  SendRequest(1, "/privet/v3/commands/list", "{}");
+  EXPECT_JSON_EQ("[7, 404, {}]", *GetReply(1));
+
+  EXPECT_CALL(bluetooth_, IsEncrypted(2)).WillRepeatedly(Return(true));
+  SendRequest(2, "/privet/v3/commands/list", "{}");
+  auto reply = GetReply(2);
+  ASSERT_NE(nullptr, reply.get());
+  int status = 0;
+  const base::ListValue* list = nullptr;
+  ASSERT_TRUE(reply->GetAsList(&list));
+  ASSERT_TRUE(list->GetInteger(1, &status));
+  EXPECT_NE(404, status);
+}
+
+TEST_F(BleTransportTest, PacketSizes) {
+  std::string large_input = "{'data': '" + std::string(100, 'x') + "'}";
+  SendRequest(1, "/privet/v3/pairing/cancel", large_input, 8);
+  SendRequest(2, "/privet/v3/pairing/cancel", large_input, 20);
+  EXPECT_NE(nullptr, GetReply(1).get());
+  EXPECT_NE(nullptr, GetReply(2).get());
+}
+
+TEST_F(BleTransportTest, DropsBrokenMessages) {
+  // Packet out of sequence.
+  on_data_.Run(1, std::string("\x80\0\0\0\x30", 5) + "abc");
+  on_data_.Run(1, "\x02" "def");
+  // Not a request.
+  std::string message = EncodeCbor(*test::CreateValue("[1, 2]"));
+  on_data_.Run(1, std::string("\x80\0\0\0", 4) +
+                      static_cast<char>(message.size()) + message);
+  // Continuation of nothing.
+  on_data_.Run(1, "\x01" "ghi");
+  EXPECT_TRUE(sent_.empty());
+
+  // Connection still works.
+  SendRequest(1, "/privet/info", "{}");
+  EXPECT_NE(nullptr, GetReply(1).get());
+}
+
+TEST_F(BleTransportTest, Closed) {
+  on_data_.Run(1, std::string("\x80\0\0\0\x30", 5) + "abc");
+  on_closed_.Run(1);
+  on_data_.Run(1, "\x01" "def");
+  EXPECT_TRUE(sent_.empty());
+}
+
+}  // namespace privet
+}  // namespace weave
@@ -0,0 +1,333 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/privet/cbor_encoding.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <base/logging.h>
+#include <base/values.h>
+
+#include "src/privet/constants.h"
+
+namespace weave {
+namespace privet {
+
+namespace {
+
+enum MajorType : uint8_t {
+  kUnsigned = 0,
+  kNegative = 1,
+  kByteString = 2,
+  kTextString = 3,
+  kArray = 4,
+  kMap = 5,
+  kTag = 6,
+  kSimple = 7,
+};
+
+const uint8_t kFalse = 20;
+const uint8_t kTrue = 21;
+const uint8_t kNull = 22;
+const uint8_t kHalfFloat = 25;
+const uint8_t kFloat = 26;
+const uint8_t kDouble = 27;
+
+// Keeps recursion of malformed input bounded.
+const int kMaxDepth = 32;
+
+void AppendBigEndian(uint64_t value, size_t size, std::string* out) {
+  for (size_t i = size; i > 0; --i)
+    out->push_back(static_cast<char>(value >> (8 * (i - 1))));
+}
+
+void AppendHeader(MajorType type, uint64_t argument, std::string* out) {
+  uint8_t initial = type << 5;
+  if (argument < 24) {
+    out->push_back(static_cast<char>(initial | argument));
+  } else if (argument <= std::numeric_limits<uint8_t>::max()) {
+    out->push_back(static_cast<char>(initial | 24));
+    AppendBigEndian(argument, 1, out);
+  } else if (argument <= std::numeric_limits<uint16_t>::max()) {
+    out->push_back(static_cast<char>(initial | 25));
+    AppendBigEndian(argument, 2, out);
+  } else if (argument <= std::numeric_limits<uint32_t>::max()) {
+    out->push_back(static_cast<char>(initial | 26));
+    AppendBigEndian(argument, 4, out);
+  } else {
+    out->push_back(static_cast<char>(initial | 27));
+    AppendBigEndian(argument, 8, out);
+  }
+}
+
+void AppendDouble(double value, std::string* out) {
+  float short_value = static_cast<float>(value);
+  if (short_value == value) {
+    uint32_t bits = 0;
+    memcpy(&bits, &short_value, sizeof(bits));
+    out->push_back(static_cast<char>(kSimple << 5 | kFloat));
+    AppendBigEndian(bits, sizeof(bits), out);
+    return;
+  }
+  uint64_t bits = 0;
+  memcpy(&bits, &value, sizeof(bits));
+  out->push_back(static_cast<char>(kSimple << 5 | kDouble));
+  AppendBigEndian(bits, sizeof(bits), out);
+}
+
+void AppendValue(const base::Value& value, std::string* out) {
+  switch (value.GetType()) {
+    case base::Value::TYPE_NULL:
+      out->push_back(static_cast<char>(kSimple << 5 | kNull));
+      return;
+    case base::Value::TYPE_BOOLEAN: {
+      bool result = false;
+      CHECK(value.GetAsBoolean(&result));
+      uint8_t simple = result ? kTrue : kFalse;
+      out->push_back(static_cast<char>(kSimple << 5 | simple));
+      return;
+    }
+    case base::Value::TYPE_INTEGER: {
+      int result = 0;
+      CHECK(value.GetAsInteger(&result));
+      if (result >= 0)
+        return AppendHeader(kUnsigned, result, out);
+      return AppendHeader(kNegative, -1 - static_cast<int64_t>(result), out);
+    }
+    case base::Value::TYPE_DOUBLE: {
+      double result = 0;
+      CHECK(value.GetAsDouble(&result));
+      return AppendDouble(result, out);
+    }
+    case base::Value::TYPE_STRING: {
+      std::string result;
+      CHECK(value.GetAsString(&result));
+      AppendHeader(kTextString, result.size(), out);
+      out->append(result);
+      return;
+    }
+    case base::Value::TYPE_LIST: {
+      const base::ListValue* list = nullptr;
+      CHECK(value.GetAsList(&list));
+      AppendHeader(kArray, list->GetSize(), out);
+      for (const auto& item : *list)
+        AppendValue(*item, out);
+      return;
+    }
+    case base::Value::TYPE_DICTIONARY: {
+      const base::DictionaryValue* dict = nullptr;
+      CHECK(value.GetAsDictionary(&dict));
+      AppendHeader(kMap, dict->size(), out);
+      for (base::DictionaryValue::Iterator it(*dict); !it.IsAtEnd();
+           it.Advance()) {
+        AppendHeader(kTextString, it.key().size(), out);
+        out->append(it.key());
+        AppendValue(it.value(), out);
+      }
+      return;
+    }
+    case base::Value::TYPE_BINARY:
+      break;
+  }
+  NOTREACHED() << "Unsupported value type: " << value.GetType();
+  out->push_back(static_cast<char>(kSimple << 5 | kNull));
+}
+
+class Decoder {
+ public:
+  Decoder(const std::string& data, ErrorPtr* error)
+      : data_{data}, error_{error} {}
+
+  std::unique_ptr<base::Value> Decode() {
+    auto value = ReadValue(0);
+    if (value && offset_ != data_.size())
+      return Fail("Unexpected data after CBOR item");
+    return value;
+  }
+
+ private:
+  std::unique_ptr<base::Value> Fail(const std::string& message) {
+    Error::AddToPrintf(error_, FROM_HERE, errors::kInvalidFormat,
+                       "%s at offset %zu", message.c_str(), offset_);
+    return nullptr;
+  }
+
+  bool ReadBigEndian(size_t size, uint64_t* value) {
+    if (data_.size() - offset_ < size)
+      return false;
+    *value = 0;
+    for (size_t i = 0; i < size; ++i)
+      *value = *value << 8 | static_cast<uint8_t>(data_[offset_++]);
+    return true;
+  }
+
+  bool ReadHeader(MajorType* type, uint8_t* info, uint64_t* argument) {
+    if (offset_ == data_.size())
+      return false;
+    uint8_t initial = static_cast<uint8_t>(data_[offset_++]);
+    *type = static_cast<MajorType>(initial >> 5);
+    *info = initial & 0x1f;
+    if (*info < 24) {
+      *argument = *info;
+      return true;
+    }
+    if (*info > 27)
+      return false;  // Reserved or indefinite length.
+    return ReadBigEndian(1 << (*info - 24), argument);
+  }
+
+  // Every item takes at least a byte, so larger counts are malformed and
+  // must not be used to reserve memory.
+  bool CheckCount(uint64_t count) const {
+    return count <= data_.size() - offset_;
+  }
+
+  std::unique_ptr<base::Value> ReadInteger(uint64_t magnitude, bool negative) {
+    // Values out of range of base::Value integers become doubles, as in JSON.
+    if (!negative) {
+      if (magnitude <= std::numeric_limits<int>::max())
+        return std::unique_ptr<base::Value>{
+            new base::FundamentalValue{static_cast<int>(magnitude)}};
+      return std::unique_ptr<base::Value>{
+          new base::FundamentalValue{static_cast<double>(magnitude)}};
+    }
+    if (magnitude <= static_cast<uint64_t>(std::numeric_limits<int>::max())) {
+      return std::unique_ptr<base::Value>{
+          new base::FundamentalValue{-1 - static_cast<int>(magnitude)}};
+    }
+    return std::unique_ptr<base::Value>{
+        new base::FundamentalValue{-1 - static_cast<double>(magnitude)}};
+  }
+
+  std::unique_ptr<base::Value> ReadSimple(uint8_t info, uint64_t argument) {
+    switch (info) {
+      case kFalse:
+        return std::unique_ptr<base::Value>{new base::FundamentalValue{false}};
+      case kTrue:
+        return std::unique_ptr<base::Value>{new base::FundamentalValue{true}};
+      case kNull:
+        return base::Value::CreateNullValue();
+      case kHalfFloat: {
+        int exponent = (argument >> 10) & 0x1f;
+        int mantissa = argument & 0x3ff;
+        double result = 0;
+        if (exponent == 0)
+          result = std::ldexp(mantissa, -24);
+        else if (exponent != 31)
+          result = std::ldexp(mantissa + 1024, exponent - 25);
+        else
+          return Fail("Non-finite number");
+        return std::unique_ptr<base::Value>{new base::FundamentalValue{
+            (argument & 0x8000) ? -result : result}};
+      }
+      case kFloat: {
+        uint32_t bits = static_cast<uint32_t>(argument);
+        float result = 0;
+        memcpy(&result, &bits, sizeof(result));
+        if (!std::isfinite(result))
+          return Fail("Non-finite number");
+        return std::unique_ptr<base::Value>{
+            new base::FundamentalValue{static_cast<double>(result)}};
+      }
+      case kDouble: {
+        double result = 0;
+        memcpy(&result, &argument, sizeof(result));
+        if (!std::isfinite(result))
+          return Fail("Non-finite number");
+        return std::unique_ptr<base::Value>{new base::FundamentalValue{result}};
+      }
+    }
+    return Fail("Unsupported simple value");
+  }
+
+  bool ReadString(uint64_t size, std::string* value) {
+    if (data_.size() - offset_ < size)
+      return false;
+    value->assign(data_, offset_, size);
+    offset_ += size;
+    return true;
+  }
+
+  std::unique_ptr<base::Value> ReadValue(int depth) {
+    if (depth > kMaxDepth)
+      return Fail("CBOR nesting is too deep");
+
+    MajorType type = kUnsigned;
+    uint8_t info = 0;
+    uint64_t argument = 0;
+    if (!ReadHeader(&type, &info, &argument))
+      return Fail("Malformed CBOR item");
+
+    switch (type) {
+      case kUnsigned:
+        return ReadInteger(argument, false);
+      case kNegative:
+        return ReadInteger(argument, true);
+      case kTextString: {
+        std::string value;
+        if (!ReadString(argument, &value))
+          return Fail("Truncated string");
+        return std::unique_ptr<base::Value>{new base::StringValue{value}};
+      }
+      case kArray: {
+        if (!CheckCount(argument))
+          return Fail("Truncated array");
+        std::unique_ptr<base::ListValue> list{new base::ListValue};
+        for (uint64_t i = 0; i < argument; ++i) {
+          auto item = ReadValue(depth + 1);
+          if (!item)
+            return nullptr;
+          list->Append(std::move(item));
+        }
+        return std::move(list);
+      }
+      case kMap: {
+        if (!CheckCount(argument))
+          return Fail("Truncated map");
+        std::unique_ptr<base::DictionaryValue> dict{new base::DictionaryValue};
+        for (uint64_t i = 0; i < argument; ++i) {
+          uint64_t size = 0;
+          std::string key;
+          if (!ReadHeader(&type, &info, &size) || type != kTextString ||
+              !ReadString(size, &key)) {
+            return Fail("Map key is not a string");
+          }
+          auto item = ReadValue(depth + 1);
+          if (!item)
+            return nullptr;
+          dict->SetWithoutPathExpansion(key, std::move(item));
+        }
+        return std::move(dict);
+      }
+      case kSimple:
+        return ReadSimple(info, argument);
+      case kByteString:
+      case kTag:
+        break;
+    }
+    return Fail("Unsupported CBOR type");
+  }
+
+  const std::string& data_;
+  ErrorPtr* error_{nullptr};
+  size_t offset_{0};
+};
+
+}  // namespace
+
+std::string EncodeCbor(const base::Value& value) {
+  std::string result;
+  AppendValue(value, &result);
+  return result;
+}
+
+std::unique_ptr<base::Value> DecodeCbor(const std::string& data,
+                                        ErrorPtr* error) {
+  return Decoder{data, error}.Decode();
+}
+
+}  // namespace privet
+}  // namespace weave
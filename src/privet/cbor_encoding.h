@@ -0,0 +1,34 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_PRIVET_CBOR_ENCODING_H_
+#define LIBWEAVE_SRC_PRIVET_CBOR_ENCODING_H_
+
+#include <memory>
+#include <string>
+
+#include <weave/error.h>
+
+namespace base {
+class Value;
+}  // namespace base
+
+namespace weave {
+namespace privet {
+
+// Compact binary encoding of JSON values for transports with small packets,
+// a subset of CBOR (RFC 7049). Null, booleans, integers, doubles, strings,
+// lists and dictionaries map to the corresponding CBOR items. Doubles which
+// are exact as floats take 4 bytes. Binary values are not supported.
+std::string EncodeCbor(const base::Value& value);
+
+// Decodes the single CBOR item which takes all of |data|. Byte strings,
+// tags, indefinite lengths and non-string keys are rejected.
+std::unique_ptr<base::Value> DecodeCbor(const std::string& data,
+                                        ErrorPtr* error);
+
+}  // namespace privet
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_PRIVET_CBOR_ENCODING_H_
@@ -0,0 +1,80 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/privet/cbor_encoding.h"
+
+#include <base/values.h>
+#include <gtest/gtest.h>
+#include <weave/test/unittest_utils.h>
+
+namespace weave {
+namespace privet {
+
+using test::CreateValue;
+
+TEST(CborEncoding, Encode) {
+  EXPECT_EQ(std::string("\xf6", 1), EncodeCbor(*CreateValue("null")));
+  EXPECT_EQ(std::string("\xf5", 1), EncodeCbor(*CreateValue("true")));
+  EXPECT_EQ(std::string("\x0a", 1), EncodeCbor(*CreateValue("10")));
+  EXPECT_EQ(std::string("\x18\x64", 2), EncodeCbor(*CreateValue("100")));
+  EXPECT_EQ(std::string("\x39\x01\xf3", 3), EncodeCbor(*CreateValue("-500")));
+  EXPECT_EQ(std::string("\xfa\x3f\xc0\x00\x00", 5),
+            EncodeCbor(*CreateValue("1.5")));
+  EXPECT_EQ(std::string("\xfb\x3f\xb9\x99\x99\x99\x99\x99\x9a", 9),
+            EncodeCbor(*CreateValue("0.1")));
+  EXPECT_EQ(std::string("\x62on", 3), EncodeCbor(*CreateValue("'on'")));
+  EXPECT_EQ(std::string("\x82\x01\x80", 3),
+            EncodeCbor(*CreateValue("[1, []]")));
+  EXPECT_EQ(std::string("\xa1\x63\x61.b\xf4", 6),
+            EncodeCbor(*CreateValue("{'a.b': false}")));
+}
+
+TEST(CborEncoding, RoundTrip) {
+  const char kJson[] = R"({
+    'name': 'lamp',
+    'state': {'on': true, 'brightness': 0.25, 'level': -70000},
+    'list': [null, 1e100, 'two', [], {}, 2147483647, -2147483648]
+  })";
+  auto value = CreateValue(kJson);
+  ErrorPtr error;
+  auto decoded = DecodeCbor(EncodeCbor(*value), &error);
+  ASSERT_NE(nullptr, decoded.get()) << error->GetMessage();
+  EXPECT_JSON_EQ(kJson, *decoded);
+}
+
+TEST(CborEncoding, DecodeOtherEncodings) {
+  // Half floats and integers out of range of base::Value.
+  auto value = DecodeCbor(std::string("\x83\xf9\x3c\x00\x1a\x80\x00\x00\x00"
+                                      "\x3b\x00\x00\x00\x00\xff\xff\xff\xff",
+                                      18),
+                          nullptr);
+  ASSERT_NE(nullptr, value.get());
+  EXPECT_JSON_EQ("[1.0, 2147483648.0, -4294967296.0]", *value);
+}
+
+TEST(CborEncoding, DecodeInvalid) {
+  const std::string kInvalid[] = {
+      std::string(),
+      std::string("\x01\x01", 2),              // Trailing data.
+      std::string("\x19\x01", 2),              // Truncated integer.
+      std::string("\x63\x61\x62", 3),          // Truncated string.
+      std::string("\x42\x61\x62", 3),          // Byte string.
+      std::string("\xc1\x01", 2),              // Tag.
+      std::string("\xbf\xff", 2),              // Indefinite length map.
+      std::string("\xa1\x01\x01", 3),          // Integer key.
+      std::string("\x9a\xff\xff\xff\xff", 5),  // Too many items.
+      std::string("\xfa\x7f\x80\x00\x00", 5),  // Infinity.
+      std::string("\xf7", 1),                  // Undefined.
+      std::string(40, '\x81') + '\x01',        // Too deep.
+  };
+  for (const auto& data : kInvalid) {
+    ErrorPtr error;
+    EXPECT_EQ(nullptr, DecodeCbor(data, &error).get());
+    ASSERT_NE(nullptr, error.get());
+    EXPECT_EQ("invalidFormat", error->GetCode());
+  }
+}
+
+}  // namespace privet
+}  // namespace weave
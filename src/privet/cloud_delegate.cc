@@ -10,12 +10,15 @@
 #include <base/bind.h>
 #include <base/logging.h>
 #include <base/memory/weak_ptr.h>
+#include <base/scoped_observer.h>
 #include <base/values.h>
 #include <weave/error.h>
 #include <weave/device.h>
+#include <weave/provider/network.h>
 #include <weave/provider/task_runner.h>
 
 #include "src/backoff_entry.h"
+#include "src/commands/command_instance.h"
 #include "src/component_manager.h"
 #include "src/config.h"
 #include "src/device_registration_info.h"
@@ -40,16 +43,81 @@ CommandInstance* ReturnNotFound(const std::string& command_id,
   return nullptr;
 }
 
+// Orders numeric IDs of local commands by value, so listing since an ID
+// returns the commands added after it. Other IDs are ordered by length first.
+struct CommandIdLess {
+  bool operator()(const std::string& a, const std::string& b) const {
+    return a.size() < b.size() || (a.size() == b.size() && a < b);
+  }
+};
+
+bool IsCommandFinished(Command::State state) {
+  switch (state) {
+    case Command::State::kDone:
+    case Command::State::kCancelled:
+    case Command::State::kAborted:
+    case Command::State::kExpired:
+      return true;
+    case Command::State::kQueued:
+    case Command::State::kInProgress:
+    case Command::State::kPaused:
+    case Command::State::kError:
+      break;
+  }
+  return false;
+}
+
+// Runs |on_finished| when the observed command reaches a final state or is
+// destroyed.
+class CommandWaiter : public CommandInstance::Observer {
+ public:
+  CommandWaiter(CommandInstance* command, const base::Closure& on_finished)
+      : on_finished_{on_finished} {
+    observer_.Add(command);
+  }
+
+  void OnCommandDestroyed() override {
+    observer_.RemoveAll();
+    Finish();
+  }
+  void OnErrorChanged(const Error* error) override {}
+  void OnProgressChanged(const base::DictionaryValue& progress) override {}
+  void OnResultsChanged(const base::DictionaryValue& results) override {}
+  void OnStateChanged(Command::State state) override {
+    if (IsCommandFinished(state))
+      Finish();
+  }
+
+ private:
+  void Finish() {
+    // |on_finished_| may destroy |this|.
+    base::Closure on_finished = on_finished_;
+    on_finished.Run();
+  }
+
+  base::Closure on_finished_;
+  ScopedObserver<CommandInstance, CommandInstance::Observer> observer_{this};
+
+  DISALLOW_COPY_AND_ASSIGN(CommandWaiter);
+};
+
 class CloudDelegateImpl : public CloudDelegate {
  public:
   CloudDelegateImpl(provider::TaskRunner* task_runner,
                     DeviceRegistrationInfo* device,
-                    ComponentManager* component_manager)
+                    ComponentManager* component_manager,
+                    provider::Network* network)
       : task_runner_{task_runner},
         device_{device},
-        component_manager_{component_manager} {
+        component_manager_{component_manager},
+        network_{network} {
     device_->AddGcdStateChangedCallback(base::Bind(
         &CloudDelegateImpl::OnRegistrationChanged, weak_factory_.GetWeakPtr()));
+    if (network_) {
+      network_->AddConnectionChangedCallback(
+          base::Bind(&CloudDelegateImpl::OnConnectivityChanged,
+                     weak_factory_.GetWeakPtr()));
+    }
 
     component_manager_->AddCommandAddedCallback(base::Bind(
         &CloudDelegateImpl::OnCommandAdded, weak_factory_.GetWeakPtr()));
@@ -123,6 +191,7 @@ class CloudDelegateImpl : public CloudDelegate {
     setup_state_ = SetupState(SetupState::kInProgress);
     setup_weak_factory_.InvalidateWeakPtrs();
     backoff_entry_.Reset();
+    waiting_for_network_ = false;
     task_runner_->PostDelayedTask(
         FROM_HERE, base::Bind(&CloudDelegateImpl::CallManagerRegisterDevice,
                               setup_weak_factory_.GetWeakPtr()),
@@ -149,7 +218,7 @@ class CloudDelegateImpl : public CloudDelegate {
     return device_->GetSettings().xmpp_endpoint;
   }
 
-  std::unique_ptr<base::DictionaryValue> GetComponentsForUser(
+  std::shared_ptr<const base::DictionaryValue> GetComponentsForUser(
       const UserInfo& user_info) const override {
     UserRole role;
     std::string str_scope = EnumToString(user_info.scope());
@@ -157,15 +226,34 @@ class CloudDelegateImpl : public CloudDelegate {
     return component_manager_->GetComponentsForUserRole(role);
   }
 
-  const base::DictionaryValue* FindComponent(const std::string& path,
-                                             ErrorPtr* error) const override {
-    return component_manager_->FindComponent(path, error);
+  std::unique_ptr<base::DictionaryValue> GetComponentForUser(
+      const UserInfo& user_info,
+      const std::string& path,
+      const std::set<std::string>& fields,
+      ErrorPtr* error) const override {
+    UserRole role;
+    std::string str_scope = EnumToString(user_info.scope());
+    CHECK(StringToEnum(str_scope, &role));
+    return component_manager_->GetComponentForUserRole(path, role, fields,
+                                                       error);
   }
 
   const base::DictionaryValue& GetTraits() const override {
     return component_manager_->GetTraits();
   }
 
+  uint64_t GetTraitsFingerprint() const override {
+    return component_manager_->GetTraitsFingerprint();
+  }
+
+  uint64_t GetStateFingerprint() const override {
+    return component_manager_->GetStateFingerprint();
+  }
+
+  uint64_t GetComponentsFingerprint() const override {
+    return component_manager_->GetComponentsFingerprint();
+  }
+
   void AddCommand(const base::DictionaryValue& command,
                   const UserInfo& user_info,
                   const CommandDoneCallback& callback) override {
@@ -188,7 +276,7 @@ class CloudDelegateImpl : public CloudDelegate {
       return callback.Run({}, std::move(error));
     component_manager_->AddCommand(std::move(command_instance));
     command_owners_[id] = user_info.id();
-    callback.Run(*component_manager_->FindCommand(id)->ToJson(), nullptr);
+    callback.Run(component_manager_->FindCommand(id)->GetJson(), nullptr);
   }
 
   void GetCommand(const std::string& id,
@@ -199,7 +287,31 @@ class CloudDelegateImpl : public CloudDelegate {
     auto command = GetCommandInternal(id, user_info, &error);
     if (!command)
       return callback.Run({}, std::move(error));
-    callback.Run(*command->ToJson(), nullptr);
+    callback.Run(command->GetJson(), nullptr);
+  }
+
+  void WaitForCommand(const std::string& id,
+                      const UserInfo& user_info,
+                      base::TimeDelta timeout,
+                      const CommandDoneCallback& callback) override {
+    CHECK(user_info.scope() != AuthScope::kNone);
+    ErrorPtr error;
+    auto command = GetCommandInternal(id, user_info, &error);
+    if (!command)
+      return callback.Run({}, std::move(error));
+    if (IsCommandFinished(command->GetState()) || timeout == base::TimeDelta{})
+      return callback.Run(command->GetJson(), nullptr);
+
+    const int wait_id = ++last_command_wait_id_;
+    base::Closure on_finished =
+        base::Bind(&CloudDelegateImpl::OnCommandWaitFinished,
+                   weak_factory_.GetWeakPtr(), wait_id);
+    CommandWait& wait = command_waits_[wait_id];
+    wait.id = id;
+    wait.callback = callback;
+    wait.waiter.reset(new CommandWaiter{command, on_finished});
+    if (timeout != base::TimeDelta::Max())
+      task_runner_->PostDelayedTask(FROM_HERE, on_finished, timeout);
   }
 
   void CancelCommand(const std::string& id,
@@ -210,22 +322,32 @@ class CloudDelegateImpl : public CloudDelegate {
     auto command = GetCommandInternal(id, user_info, &error);
     if (!command || !command->Cancel(&error))
       return callback.Run({}, std::move(error));
-    callback.Run(*command->ToJson(), nullptr);
+    callback.Run(command->GetJson(), nullptr);
   }
 
   void ListCommands(const UserInfo& user_info,
+                    const std::string& since_id,
+                    size_t max_results,
                     const CommandDoneCallback& callback) override {
     CHECK(user_info.scope() != AuthScope::kNone);
 
-    base::ListValue list_value;
+    std::unique_ptr<base::ListValue> list_value{new base::ListValue};
+    base::DictionaryValue commands_json;
 
-    for (const auto& it : command_owners_) {
-      if (CanAccessCommand(it.second, user_info, nullptr))
-        list_value.Append(component_manager_->FindCommand(it.first)->ToJson());
+    std::string last_listed_id;
+    auto it = since_id.empty() ? command_owners_.begin()
+                               : command_owners_.upper_bound(since_id);
+    for (; it != command_owners_.end(); ++it) {
+      if (!IsCommandOwner(it->second, user_info))
+        continue;
+      if (max_results && list_value->GetSize() == max_results) {
+        commands_json.SetString("nextSinceId", last_listed_id);
+        break;
+      }
+      list_value->Append(component_manager_->FindCommand(it->first)->ToJson());
+      last_listed_id = it->first;
     }
-
-    base::DictionaryValue commands_json;
-    commands_json.Set("commands", list_value.CreateDeepCopy());
+    commands_json.Set("commands", std::move(list_value));
 
     callback.Run(commands_json, nullptr);
   }
@@ -252,6 +374,23 @@ class CloudDelegateImpl : public CloudDelegate {
     CHECK(command_owners_.erase(command->GetID()));
   }
 
+  void OnCommandWaitFinished(int wait_id) {
+    auto it = command_waits_.find(wait_id);
+    if (it == command_waits_.end())
+      return;  // Already replied.
+    std::string id = it->second.id;
+    CommandDoneCallback callback = it->second.callback;
+    command_waits_.erase(it);
+
+    ErrorPtr error;
+    auto command = component_manager_->FindCommand(id);
+    if (!command) {
+      ReturnNotFound(id, &error);
+      return callback.Run({}, std::move(error));
+    }
+    callback.Run(command->GetJson(), nullptr);
+  }
+
   void OnRegistrationChanged(GcdState status) {
     if (status == GcdState::kUnconfigured ||
         status == GcdState::kInvalidCredentials) {
@@ -275,7 +414,33 @@ class CloudDelegateImpl : public CloudDelegate {
     setup_state_ = SetupState(SetupState::kSuccess);
   }
 
+  bool IsOnline() const {
+    return !network_ ||
+           network_->GetConnectionState() == provider::Network::State::kOnline;
+  }
+
+  void OnConnectivityChanged() {
+    if (!waiting_for_network_ || !IsOnline())
+      return;
+    VLOG(1) << "Network is online, resuming device registration";
+    waiting_for_network_ = false;
+    backoff_entry_.Reset();
+    task_runner_->PostDelayedTask(
+        FROM_HERE, base::Bind(&CloudDelegateImpl::CallManagerRegisterDevice,
+                              setup_weak_factory_.GetWeakPtr()),
+        {});
+  }
+
   void CallManagerRegisterDevice() {
+    if (!IsOnline()) {
+      // E.g. WiFi is still being connected by the same setup request. The
+      // attempt is made by OnConnectivityChanged() as soon as the network is
+      // up, without using up the retries.
+      VLOG(1) << "Waiting for the network to register device";
+      waiting_for_network_ = true;
+      return;
+    }
+
     ErrorPtr error;
     CHECK_GE(registation_retry_count_, 0);
     if (registation_retry_count_-- == 0) {
@@ -292,8 +457,11 @@ class CloudDelegateImpl : public CloudDelegate {
 
   void RegisterDeviceDone(ErrorPtr error) {
     if (error) {
-      // Registration failed. Retry with backoff.
+      // Registration failed. Retry with backoff, or once the network is back
+      // if it was lost.
       backoff_entry_.InformOfRequest(false);
+      if (!IsOnline())
+        return CallManagerRegisterDevice();
       return task_runner_->PostDelayedTask(
           FROM_HERE, base::Bind(&CloudDelegateImpl::CallManagerRegisterDevice,
                                 setup_weak_factory_.GetWeakPtr()),
@@ -321,19 +489,25 @@ class CloudDelegateImpl : public CloudDelegate {
     return command;
   }
 
-  bool CanAccessCommand(const UserAppId& owner,
-                        const UserInfo& user_info,
-                        ErrorPtr* error) const {
+  // Filtering out commands of other users is not an error, so ListCommands
+  // uses this instead of CanAccessCommand.
+  static bool IsCommandOwner(const UserAppId& owner,
+                             const UserInfo& user_info) {
     CHECK(user_info.scope() != AuthScope::kNone);
     CHECK(!user_info.id().IsEmpty());
 
-    if (user_info.scope() == AuthScope::kManager ||
-        (owner.type == user_info.id().type &&
-         owner.user == user_info.id().user &&
-         (user_info.id().app.empty() ||  // Token is not restricted to the app.
-          owner.app == user_info.id().app))) {
+    return user_info.scope() == AuthScope::kManager ||
+           (owner.type == user_info.id().type &&
+            owner.user == user_info.id().user &&
+            (user_info.id().app.empty() ||  // Token is not restricted to app.
+             owner.app == user_info.id().app));
+  }
+
+  bool CanAccessCommand(const UserAppId& owner,
+                        const UserInfo& user_info,
+                        ErrorPtr* error) const {
+    if (IsCommandOwner(owner, user_info))
       return true;
-    }
 
     return Error::AddTo(error, FROM_HERE, errors::kAccessDenied,
                         "Need to be owner of the command.");
@@ -342,6 +516,7 @@ class CloudDelegateImpl : public CloudDelegate {
   provider::TaskRunner* task_runner_{nullptr};
   DeviceRegistrationInfo* device_{nullptr};
   ComponentManager* component_manager_{nullptr};
+  provider::Network* network_{nullptr};
 
   // Primary state of GCD.
   ConnectionState connection_state_{ConnectionState::kDisabled};
@@ -355,8 +530,20 @@ class CloudDelegateImpl : public CloudDelegate {
   // Number of remaining retries for device registration process.
   int registation_retry_count_{0};
 
+  // Set while the registration waits for the network to be online.
+  bool waiting_for_network_{false};
+
   // Map of command IDs to user IDs.
-  std::map<std::string, UserAppId> command_owners_;
+  std::map<std::string, UserAppId, CommandIdLess> command_owners_;
+
+  // Pending WaitForCommand() calls.
+  struct CommandWait {
+    std::string id;
+    CommandDoneCallback callback;
+    std::unique_ptr<CommandWaiter> waiter;
+  };
+  std::map<int, CommandWait> command_waits_;
+  int last_command_wait_id_{0};
 
   // Backoff entry for retrying device registration.
   BackoffEntry backoff_entry_{&register_backoff_policy};
@@ -378,9 +565,10 @@ CloudDelegate::~CloudDelegate() {}
 std::unique_ptr<CloudDelegate> CloudDelegate::CreateDefault(
     provider::TaskRunner* task_runner,
     DeviceRegistrationInfo* device,
-    ComponentManager* component_manager) {
+    ComponentManager* component_manager,
+    provider::Network* network) {
   return std::unique_ptr<CloudDelegateImpl>{
-      new CloudDelegateImpl{task_runner, device, component_manager}};
+      new CloudDelegateImpl{task_runner, device, component_manager, network}};
 }
 
 }  // namespace privet
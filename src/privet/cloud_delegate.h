@@ -11,6 +11,7 @@
 
 #include <base/callback.h>
 #include <base/memory/ref_counted.h>
+#include <base/time/time.h>
 #include <weave/device.h>
 
 #include "src/privet/privet_types.h"
@@ -26,6 +27,7 @@ class ComponentManager;
 class DeviceRegistrationInfo;
 
 namespace provider {
+class Network;
 class TaskRunner;
 }
 
@@ -90,17 +92,28 @@ class CloudDelegate {
   virtual std::string GetXmppEndpoint() const = 0;
 
   // Returns dictionary with component tree. The components contain only the
-  // state visible to the given user.
-  virtual std::unique_ptr<base::DictionaryValue> GetComponentsForUser(
+  // state visible to the given user. The returned tree must not be modified.
+  virtual std::shared_ptr<const base::DictionaryValue> GetComponentsForUser(
       const UserInfo& user_info) const = 0;
 
-  // Finds a component at the given path. Return nullptr in case of an error.
-  virtual const base::DictionaryValue* FindComponent(const std::string& path,
-                                                     ErrorPtr* error) const = 0;
+  // Returns a copy of the component at the given path with the state visible
+  // to the given user, limited to |fields| of it and its sub-components if
+  // not empty. Return nullptr in case of an error.
+  virtual std::unique_ptr<base::DictionaryValue> GetComponentForUser(
+      const UserInfo& user_info,
+      const std::string& path,
+      const std::set<std::string>& fields,
+      ErrorPtr* error) const = 0;
 
   // Returns dictionary with trait definitions.
   virtual const base::DictionaryValue& GetTraits() const = 0;
 
+  // Returns the fingerprints of the trait definitions, the state and the
+  // component tree, which stay the same across restarts until they change.
+  virtual uint64_t GetTraitsFingerprint() const = 0;
+  virtual uint64_t GetStateFingerprint() const = 0;
+  virtual uint64_t GetComponentsFingerprint() const = 0;
+
   // Adds command created from the given JSON representation.
   virtual void AddCommand(const base::DictionaryValue& command,
                           const UserInfo& user_info,
@@ -111,24 +124,38 @@ class CloudDelegate {
                           const UserInfo& user_info,
                           const CommandDoneCallback& callback) = 0;
 
+  // Runs |callback| with the command with the given ID once it is done,
+  // cancelled, aborted or expired, or after |timeout| with its status then.
+  virtual void WaitForCommand(const std::string& id,
+                              const UserInfo& user_info,
+                              base::TimeDelta timeout,
+                              const CommandDoneCallback& callback) = 0;
+
   // Cancels command with the given ID.
   virtual void CancelCommand(const std::string& id,
                              const UserInfo& user_info,
                              const CommandDoneCallback& callback) = 0;
 
-  // Lists commands.
+  // Lists commands in ID order, starting after |since_id| if it is not empty.
+  // If |max_results| is not zero and more commands follow, the result has
+  // the ID to continue from in "nextSinceId".
   virtual void ListCommands(const UserInfo& user_info,
+                            const std::string& since_id,
+                            size_t max_results,
                             const CommandDoneCallback& callback) = 0;
 
   virtual void AddOnTraitsChangedCallback(const base::Closure& callback) = 0;
   virtual void AddOnStateChangedCallback(const base::Closure& callback) = 0;
   virtual void AddOnComponentsChangeCallback(const base::Closure& callback) = 0;
 
-  // Create default instance.
+  // Create default instance. If |network| is set, the registration started by
+  // Setup() waits for the network to be online instead of retrying on a
+  // timer.
   static std::unique_ptr<CloudDelegate> CreateDefault(
       provider::TaskRunner* task_runner,
       DeviceRegistrationInfo* device,
-      ComponentManager* component_manager);
+      ComponentManager* component_manager,
+      provider::Network* network);
 };
 
 }  // namespace privet
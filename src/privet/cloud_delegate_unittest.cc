@@ -0,0 +1,103 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/privet/cloud_delegate.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
+#include <weave/provider/test/mock_config_store.h>
+#include <weave/provider/test/mock_http_client.h>
+#include <weave/provider/test/mock_network.h>
+
+#include "src/component_manager_impl.h"
+#include "src/config.h"
+#include "src/device_registration_info.h"
+
+using testing::_;
+using testing::HasSubstr;
+using testing::ReturnPointee;
+using testing::SaveArg;
+using testing::StrictMock;
+
+namespace weave {
+namespace privet {
+
+using provider::HttpClient;
+using provider::Network;
+
+class CloudDelegateTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    EXPECT_CALL(network_, AddConnectionChangedCallback(_))
+        .WillOnce(SaveArg<0>(&network_callback_));
+    EXPECT_CALL(network_, GetConnectionState())
+        .WillRepeatedly(ReturnPointee(&network_state_));
+    cloud_ = CloudDelegate::CreateDefault(&task_runner_, &device_,
+                                          &component_manager_, &network_);
+  }
+
+  void SetNetworkState(Network::State state) {
+    network_state_ = state;
+    network_callback_.Run();
+  }
+
+  provider::test::FakeTaskRunner task_runner_;
+  provider::test::MockConfigStore config_store_;
+  StrictMock<provider::test::MockHttpClient> http_client_;
+  StrictMock<provider::test::MockNetwork> network_;
+  Network::State network_state_{Network::State::kOffline};
+  Network::ConnectionChangedCallback network_callback_;
+  Config config_{&config_store_};
+  ComponentManagerImpl component_manager_{&task_runner_};
+  DeviceRegistrationInfo device_{&config_, &component_manager_, &task_runner_,
+                                 &http_client_, nullptr, nullptr};
+  std::unique_ptr<CloudDelegate> cloud_;
+};
+
+TEST_F(CloudDelegateTest, SetupWaitsForNetwork) {
+  RegistrationData registration_data;
+  registration_data.ticket_id = "test_ticket_id";
+  EXPECT_TRUE(cloud_->Setup(registration_data, nullptr));
+  EXPECT_TRUE(cloud_->GetSetupState().IsStatusEqual(SetupState::kInProgress));
+
+  // No attempts while offline, however long it takes.
+  SetNetworkState(Network::State::kConnecting);
+  task_runner_.Run();
+
+  EXPECT_CALL(http_client_,
+              SendRequest(HttpClient::Method::kPatch,
+                          HasSubstr("registrationTickets/test_ticket_id"), _,
+                          _, _));
+  SetNetworkState(Network::State::kOnline);
+  task_runner_.RunPendingTasks();
+  EXPECT_TRUE(cloud_->GetSetupState().IsStatusEqual(SetupState::kInProgress));
+}
+
+TEST_F(CloudDelegateTest, SetupRetriesWhenNetworkIsBack) {
+  network_state_ = Network::State::kOnline;
+  HttpClient::SendRequestCallback request_callback;
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPatch, _, _, _, _))
+      .WillOnce(SaveArg<4>(&request_callback));
+  RegistrationData registration_data;
+  registration_data.ticket_id = "test_ticket_id";
+  EXPECT_TRUE(cloud_->Setup(registration_data, nullptr));
+  task_runner_.RunPendingTasks();
+  testing::Mock::VerifyAndClearExpectations(&http_client_);
+
+  // The request failed because the network was lost, so there is no retry
+  // until it's back.
+  network_state_ = Network::State::kOffline;
+  ErrorPtr error;
+  Error::AddTo(&error, FROM_HERE, "network_error", "Network is unreachable");
+  request_callback.Run(nullptr, std::move(error));
+  task_runner_.Run();
+
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPatch, _, _, _, _));
+  SetNetworkState(Network::State::kOnline);
+  task_runner_.RunPendingTasks();
+}
+
+}  // namespace privet
+}  // namespace weave
@@ -22,6 +22,7 @@
 using testing::_;
 using testing::AtLeast;
 using testing::Return;
+using testing::ReturnPointee;
 using testing::ReturnRef;
 using testing::SaveArg;
 using testing::SetArgPointee;
@@ -79,6 +80,8 @@ class MockSecurityDelegate : public SecurityDelegate {
                     ErrorPtr*));
   MOCK_CONST_METHOD3(ParseAccessToken,
                      bool(const std::string&, UserInfo*, ErrorPtr*));
+  MOCK_CONST_METHOD2(CreateResumeTicket,
+                     std::string(const std::string&, ErrorPtr*));
   MOCK_CONST_METHOD0(GetPairingTypes, std::set<PairingType>());
   MOCK_CONST_METHOD0(GetCryptoTypes, std::set<CryptoType>());
   MOCK_CONST_METHOD0(GetAuthTypes, std::set<AuthType>());
@@ -117,6 +120,9 @@ class MockSecurityDelegate : public SecurityDelegate {
                                             {}}}),
                               Return(true)));
 
+    EXPECT_CALL(*this, CreateResumeTicket(_, _))
+        .WillRepeatedly(Return(""));
+
     EXPECT_CALL(*this, GetPairingTypes())
         .WillRepeatedly(Return(std::set<PairingType>{
             PairingType::kPinCode, PairingType::kEmbeddedCode,
@@ -192,10 +198,15 @@ class MockCloudDelegate : public CloudDelegate {
   MOCK_CONST_METHOD0(GetXmppEndpoint, std::string());
   MOCK_CONST_METHOD1(MockGetComponentsForUser,
                      const base::DictionaryValue&(const UserInfo&));
-  MOCK_CONST_METHOD2(FindComponent,
-                     const base::DictionaryValue*(const std::string& path,
-                                                  ErrorPtr* error));
+  MOCK_CONST_METHOD4(MockGetComponentForUser,
+                     base::DictionaryValue*(const UserInfo& user_info,
+                                            const std::string& path,
+                                            const std::set<std::string>& fields,
+                                            ErrorPtr* error));
   MOCK_CONST_METHOD0(GetTraits, const base::DictionaryValue&());
+  MOCK_CONST_METHOD0(GetTraitsFingerprint, uint64_t());
+  MOCK_CONST_METHOD0(GetStateFingerprint, uint64_t());
+  MOCK_CONST_METHOD0(GetComponentsFingerprint, uint64_t());
   MOCK_METHOD3(AddCommand,
                void(const base::DictionaryValue&,
                     const UserInfo&,
@@ -204,11 +215,20 @@ class MockCloudDelegate : public CloudDelegate {
                void(const std::string&,
                     const UserInfo&,
                     const CommandDoneCallback&));
+  MOCK_METHOD4(WaitForCommand,
+               void(const std::string&,
+                    const UserInfo&,
+                    base::TimeDelta,
+                    const CommandDoneCallback&));
   MOCK_METHOD3(CancelCommand,
                void(const std::string&,
                     const UserInfo&,
                     const CommandDoneCallback&));
-  MOCK_METHOD2(ListCommands, void(const UserInfo&, const CommandDoneCallback&));
+  MOCK_METHOD4(ListCommands,
+               void(const UserInfo&,
+                    const std::string&,
+                    size_t,
+                    const CommandDoneCallback&));
   MOCK_METHOD1(AddOnTraitsChangedCallback, void(const base::Closure&));
   MOCK_METHOD1(AddOnStateChangedCallback, void(const base::Closure&));
   MOCK_METHOD1(AddOnComponentsChangeCallback, void(const base::Closure&));
@@ -236,7 +256,13 @@ class MockCloudDelegate : public CloudDelegate {
     EXPECT_CALL(*this, GetTraits()).WillRepeatedly(ReturnRef(test_dict_));
     EXPECT_CALL(*this, MockGetComponentsForUser(_))
         .WillRepeatedly(ReturnRef(test_dict_));
-    EXPECT_CALL(*this, FindComponent(_, _)).Times(0);
+    EXPECT_CALL(*this, MockGetComponentForUser(_, _, _, _)).Times(0);
+    EXPECT_CALL(*this, GetTraitsFingerprint())
+        .WillRepeatedly(ReturnPointee(&traits_fingerprint_));
+    EXPECT_CALL(*this, GetStateFingerprint())
+        .WillRepeatedly(ReturnPointee(&state_fingerprint_));
+    EXPECT_CALL(*this, GetComponentsFingerprint())
+        .WillRepeatedly(ReturnPointee(&components_fingerprint_));
 
     EXPECT_CALL(*this, AddOnTraitsChangedCallback(_))
         .WillRepeatedly(SaveArg<0>(&on_traits_changed_));
@@ -246,25 +272,48 @@ class MockCloudDelegate : public CloudDelegate {
         .WillRepeatedly(SaveArg<0>(&on_components_changed_));
   }
 
-  void NotifyOnTraitDefsChanged() { on_traits_changed_.Run(); }
+  // The fingerprints are changed along with the notifications, as if the
+  // content has changed. State changes also change the component tree.
+  void NotifyOnTraitDefsChanged() {
+    ++traits_fingerprint_;
+    on_traits_changed_.Run();
+  }
 
-  void NotifyOnComponentTreeChanged() { on_components_changed_.Run(); }
+  void NotifyOnComponentTreeChanged() {
+    ++components_fingerprint_;
+    on_components_changed_.Run();
+  }
 
-  void NotifyOnStateChanged() { on_state_changed_.Run(); }
+  void NotifyOnStateChanged() {
+    ++state_fingerprint_;
+    ++components_fingerprint_;
+    on_state_changed_.Run();
+  }
 
   ConnectionState connection_state_{ConnectionState::kOnline};
   SetupState setup_state_{SetupState::kNone};
   base::DictionaryValue test_dict_;
+  uint64_t traits_fingerprint_{1};
+  uint64_t state_fingerprint_{1};
+  uint64_t components_fingerprint_{1};
 
   base::Closure on_traits_changed_;
   base::Closure on_state_changed_;
   base::Closure on_components_changed_;
 
  private:
-  std::unique_ptr<base::DictionaryValue> GetComponentsForUser(
+  std::shared_ptr<const base::DictionaryValue> GetComponentsForUser(
       const UserInfo& user_info) const override {
     return MockGetComponentsForUser(user_info).CreateDeepCopy();
   }
+  std::unique_ptr<base::DictionaryValue> GetComponentForUser(
+      const UserInfo& user_info,
+      const std::string& path,
+      const std::set<std::string>& fields,
+      ErrorPtr* error) const override {
+    return std::unique_ptr<base::DictionaryValue>{
+        MockGetComponentForUser(user_info, path, fields, error)};
+  }
 };
 
 }  // namespace privet
@@ -0,0 +1,57 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/privet/openssl_utils.h"
+
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "src/data_encoding.h"
+
+extern "C" {
+#include "third_party/libuweave/src/crypto_hmac.h"
+}
+
+namespace weave {
+namespace privet {
+
+namespace {
+
+bool FakeHmac(const uint8_t* key,
+              size_t key_len,
+              const UwCryptoHmacMsg messages[],
+              size_t num_messages,
+              uint8_t* truncated_digest,
+              size_t truncated_digest_len) {
+  std::fill(truncated_digest, truncated_digest + truncated_digest_len, 7);
+  return true;
+}
+
+}  // namespace
+
+TEST(OpensslUtilsTest, HmacSha256) {
+  // RFC 4231, test case 2.
+  const std::string kKey = "Jefe";
+  const std::string kData = "what do ya want for nothing?";
+  EXPECT_EQ("W9zBRr9gdU5qBCQmCJV1x1oAPwidJzmDnexYuWTsOEM=",
+            Base64Encode(HmacSha256({kKey.begin(), kKey.end()},
+                                    {kData.begin(), kData.end()})));
+}
+
+TEST(OpensslUtilsTest, HmacFunction) {
+  const std::vector<uint8_t> kKey{1, 2, 3};
+  const std::vector<uint8_t> kData{4, 5};
+  const std::vector<uint8_t> expected = HmacSha256(kKey, kData);
+
+  uw_crypto_hmac_set_function_(&FakeHmac);
+  EXPECT_EQ(std::vector<uint8_t>(kSha256OutputSize, 7),
+            HmacSha256(kKey, kData));
+
+  uw_crypto_hmac_set_function_(nullptr);
+  EXPECT_EQ(expected, HmacSha256(kKey, kData));
+}
+
+}  // namespace privet
+}  // namespace weave
@@ -9,6 +9,7 @@
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <base/bind.h>
 #include <base/location.h>
@@ -90,6 +91,7 @@ const char kAuthTokenTypeKey[] = "tokenType";
 const char kAuthExpiresInKey[] = "expiresIn";
 const char kAuthScopeKey[] = "scope";
 const char kAuthClientTokenKey[] = "clientToken";
+const char kAuthResumeTicketKey[] = "resumeTicket";
 
 const char kAuthorizationHeaderPrefix[] = "Privet";
 
@@ -117,17 +119,83 @@ const char kFingerprintKey[] = "fingerprint";
 const char kTraitsKey[] = "traits";
 const char kComponentsKey[] = "components";
 const char kCommandsIdKey[] = "id";
+const char kCommandsIdsKey[] = "ids";
+const char kCommandsKey[] = "commands";
 const char kPathKey[] = "path";
 const char kFilterKey[] = "filter";
+const char kComponentsPatchKey[] = "componentsPatch";
 
 const char kStateFingerprintKey[] = "stateFingerprint";
 const char kCommandsFingerprintKey[] = "commandsFingerprint";
 const char kTraitsFingerprintKey[] = "traitsFingerprint";
 const char kComponentsFingerprintKey[] = "componentsFingerprint";
 const char kWaitTimeoutKey[] = "waitTimeout";
+const char kWaitForCompletionKey[] = "waitForCompletion";
+const char kSinceIdKey[] = "sinceId";
+const char kMaxResultsKey[] = "maxResults";
+
+const char kBatchApi[] = "/privet/v3/batch";
+const char kBatchCallsKey[] = "calls";
+const char kBatchApiKey[] = "api";
+const char kBatchInputKey[] = "input";
+const char kBatchResultsKey[] = "results";
+const char kBatchOutputKey[] = "output";
 
 const char kInvalidParamValueFormat[] = "Invalid parameter: '%s'='%s'";
 
+// Limit of the calls in one /privet/v3/batch request. The whole batch takes
+// one token of the client's request rate.
+const size_t kMaxBatchCalls = 16;
+
+// Limit of the IDs in one commands/status or commands/cancel request.
+const size_t kMaxCommandIds = 64;
+
+// Number of component trees kept for replying with changes only.
+const size_t kMaxComponentsSnapshots = 4;
+
+// Limits for clients subscribed to pushed events. New subscribers are
+// rejected over them, and pings let the transport notice closed clients.
+const size_t kMaxEventSubscribers = 8;
+const size_t kMaxEventSubscribersPerUser = 2;
+const int kEventPingIntervalSeconds = 30;
+const char kPingEvent[] = "ping";
+
+// Limits for local clients, so a misbehaving one can't starve the cloud and
+// command processing. Each verified user may send bursts of kRequestBurst
+// requests, refilled at kRequestsPerSecond. The anonymous requests and those
+// failing authorization share a single such budget, so a client can't get a
+// new one by changing its Authorization header. Only kMaxRateLimitedClients
+// users are tracked, the one idle the longest is forgotten first. A request is
+// in flight until its reply callback is gone.
+const double kRequestBurst = 20;
+const double kRequestsPerSecond = 10;
+const size_t kMaxRateLimitedClients = 32;
+const size_t kMaxRequestsInFlight = 32;
+
+// Counts a request as in flight for as long as it exists.
+class RequestSlot {
+ public:
+  explicit RequestSlot(const std::shared_ptr<size_t>& counter)
+      : counter_{counter} {
+    ++*counter_;
+  }
+  ~RequestSlot() { --*counter_; }
+
+ private:
+  std::shared_ptr<size_t> counter_;
+
+  DISALLOW_COPY_AND_ASSIGN(RequestSlot);
+};
+
+// Passes the reply on to |callback|. |slot| is bound only to be released
+// with the callback.
+void ReplyFromSlot(const std::shared_ptr<RequestSlot>& slot,
+                   const PrivetHandler::RequestCallback& callback,
+                   int status,
+                   const base::DictionaryValue& output) {
+  callback.Run(status, output);
+}
+
 template <class Container>
 std::unique_ptr<base::ListValue> ToValue(const Container& list) {
   std::unique_ptr<base::ListValue> value_list(new base::ListValue());
@@ -162,7 +230,7 @@ struct {
 };
 
 std::string GetAuthTokenFromAuthHeader(const std::string& auth_header) {
-  return SplitAtFirst(auth_header, " ", true).second;
+  return SplitPieceAtFirst(auth_header, " ", true).second.as_string();
 }
 
 // Creates JSON similar to GCD server error format.
@@ -207,6 +275,117 @@ void ReturnError(const Error& error,
   callback.Run(code, *output);
 }
 
+// Label of the requests to paths without a handler in the metrics.
+const char kUnknownApiLabel[] = "unknown";
+
+// Records the latency of a request to |api| started at |start_time|, before
+// passing the reply on to |callback|.
+void RecordRequestLatency(Metrics* metrics,
+                          const std::string& api,
+                          base::TimeTicks start_time,
+                          const PrivetHandler::RequestCallback& callback,
+                          int status,
+                          const base::DictionaryValue& output) {
+  metrics->RecordLatency("privet_request " + api,
+                         base::TimeTicks::Now() - start_time);
+  if (status >= http::kBadRequest)
+    metrics->IncrementCounter("privet_request_error " + api);
+  callback.Run(status, output);
+}
+
+// Items of a reply which are completed separately, e.g. the calls of a
+// /privet/v3/batch request, and sent together in order as the list |key| once
+// the last one is in.
+struct ListReply {
+  ListReply(const char* key,
+            size_t size,
+            const PrivetHandler::RequestCallback& callback)
+      : key{key}, items(size), pending{size}, callback{callback} {}
+
+  const char* key;
+  std::vector<std::unique_ptr<base::DictionaryValue>> items;
+  size_t pending;
+  PrivetHandler::RequestCallback callback;
+};
+
+void SetListReplyItem(const std::shared_ptr<ListReply>& reply,
+                      size_t index,
+                      std::unique_ptr<base::DictionaryValue> item) {
+  CHECK(!reply->items[index]);
+  reply->items[index] = std::move(item);
+  if (--reply->pending > 0)
+    return;
+
+  std::unique_ptr<base::ListValue> items{new base::ListValue};
+  for (auto& item : reply->items)
+    items->Append(std::move(item));
+  base::DictionaryValue output;
+  output.Set(reply->key, std::move(items));
+  reply->callback.Run(http::kOk, output);
+}
+
+void OnBatchCallDone(const std::shared_ptr<ListReply>& batch,
+                     size_t index,
+                     int status,
+                     const base::DictionaryValue& output) {
+  std::unique_ptr<base::DictionaryValue> result{new base::DictionaryValue};
+  result->SetInteger(kStatusKey, status);
+  result->Set(kBatchOutputKey, output.CreateDeepCopy());
+  SetListReplyItem(batch, index, std::move(result));
+}
+
+void OnCommandsRequestDone(const std::shared_ptr<ListReply>& reply,
+                           size_t index,
+                           const std::string& id,
+                           const base::DictionaryValue& command,
+                           ErrorPtr error) {
+  std::unique_ptr<base::DictionaryValue> result;
+  if (error) {
+    result.reset(new base::DictionaryValue);
+    result->SetString(kCommandsIdKey, id);
+    result->Set(kErrorKey, ErrorToJson(*error));
+  } else {
+    result = command.CreateDeepCopy();
+  }
+  SetListReplyItem(reply, index, std::move(result));
+}
+
+using CommandRequest =
+    void (CloudDelegate::*)(const std::string& id,
+                            const UserInfo& user_info,
+                            const CloudDelegate::CommandDoneCallback& callback);
+
+// Runs |request| for each of the command |ids|, and replies with the
+// commands, or with the errors for the IDs which failed, in order.
+void RequestCommands(CloudDelegate* cloud,
+                     CommandRequest request,
+                     const base::ListValue& ids,
+                     const UserInfo& user_info,
+                     const PrivetHandler::RequestCallback& callback) {
+  std::vector<std::string> id_list(ids.GetSize());
+  for (size_t i = 0; i < ids.GetSize(); ++i) {
+    if (!ids.GetString(i, &id_list[i])) {
+      id_list.clear();
+      break;
+    }
+  }
+  if (id_list.empty() || id_list.size() > kMaxCommandIds) {
+    ErrorPtr error;
+    Error::AddToPrintf(&error, FROM_HERE, errors::kInvalidParams,
+                       "Expected 1 to %zu command IDs in '%s'", kMaxCommandIds,
+                       kCommandsIdsKey);
+    return ReturnError(*error, callback);
+  }
+
+  auto reply =
+      std::make_shared<ListReply>(kCommandsKey, id_list.size(), callback);
+  for (size_t i = 0; i < id_list.size(); ++i) {
+    (cloud->*request)(
+        id_list[i], user_info,
+        base::Bind(&OnCommandsRequestDone, reply, i, id_list[i]));
+  }
+}
+
 void OnCommandRequestSucceeded(const PrivetHandler::RequestCallback& callback,
                                const base::DictionaryValue& output,
                                ErrorPtr error) {
@@ -366,6 +545,36 @@ std::unique_ptr<base::DictionaryValue> CloneComponentTree(
   return clone;
 }
 
+// Returns a JSON merge patch (RFC 7386) which turns |from| into |to|.
+// Removed members are set to null, lists are replaced as a whole.
+std::unique_ptr<base::DictionaryValue> CreateMergePatch(
+    const base::DictionaryValue& from,
+    const base::DictionaryValue& to) {
+  std::unique_ptr<base::DictionaryValue> patch{new base::DictionaryValue};
+  for (base::DictionaryValue::Iterator it(to); !it.IsAtEnd(); it.Advance()) {
+    const base::Value* old_value = nullptr;
+    if (!from.GetWithoutPathExpansion(it.key(), &old_value)) {
+      patch->SetWithoutPathExpansion(it.key(), it.value().CreateDeepCopy());
+      continue;
+    }
+    const base::DictionaryValue* old_dict = nullptr;
+    const base::DictionaryValue* new_dict = nullptr;
+    if (old_value->GetAsDictionary(&old_dict) &&
+        it.value().GetAsDictionary(&new_dict)) {
+      auto sub_patch = CreateMergePatch(*old_dict, *new_dict);
+      if (!sub_patch->empty())
+        patch->SetWithoutPathExpansion(it.key(), std::move(sub_patch));
+    } else if (!old_value->Equals(&it.value())) {
+      patch->SetWithoutPathExpansion(it.key(), it.value().CreateDeepCopy());
+    }
+  }
+  for (base::DictionaryValue::Iterator it(from); !it.IsAtEnd(); it.Advance()) {
+    if (!to.HasKey(it.key()))
+      patch->SetWithoutPathExpansion(it.key(), base::Value::CreateNullValue());
+  }
+  return patch;
+}
+
 }  // namespace
 
 std::vector<std::string> PrivetHandler::GetHttpPaths() const {
@@ -374,6 +583,7 @@ std::vector<std::string> PrivetHandler::GetHttpPaths() const {
     if (!pair.second.https_only)
       result.push_back(pair.first);
   }
+  std::sort(result.begin(), result.end());
   return result;
 }
 
@@ -381,6 +591,7 @@ std::vector<std::string> PrivetHandler::GetHttpsPaths() const {
   std::vector<std::string> result;
   for (const auto& pair : handlers_)
     result.push_back(pair.first);
+  std::sort(result.begin(), result.end());
   return result;
 }
 
@@ -388,12 +599,15 @@ PrivetHandler::PrivetHandler(CloudDelegate* cloud,
                              DeviceDelegate* device,
                              SecurityDelegate* security,
                              WifiDelegate* wifi,
-                             base::Clock* clock)
+                             base::Clock* clock,
+                             Metrics* metrics)
     : cloud_(cloud),
       device_(device),
       security_(security),
       wifi_(wifi),
-      clock_(clock ? clock : &default_clock_) {
+      clock_(clock ? clock : &default_clock_),
+      metrics_(metrics),
+      unverified_requests_{kRequestBurst, {}} {
   CHECK(cloud_);
   CHECK(device_);
   CHECK(security_);
@@ -439,89 +653,212 @@ PrivetHandler::PrivetHandler(CloudDelegate* cloud,
                    AuthScope::kViewer);
   AddSecureHandler("/privet/v3/components", &PrivetHandler::HandleComponents,
                    AuthScope::kViewer);
+  // Each call is checked against the scope of its own API.
+  AddSecureHandler(kBatchApi, &PrivetHandler::HandleBatch, AuthScope::kNone);
 }
 
 PrivetHandler::~PrivetHandler() {
   for (const auto& req : update_requests_)
-    ReplyToUpdateRequest(req.callback);
+    ReplyToUpdateRequest(req.second);
 }
 
 void PrivetHandler::OnTraitDefsChanged() {
-  ++traits_fingerprint_;
-  auto pred = [](const UpdateRequestParameters& params) {
-    return params.traits_fingerprint == 0;
-  };
-  auto last =
-      std::partition(update_requests_.begin(), update_requests_.end(), pred);
-  for (auto p = last; p != update_requests_.end(); ++p)
-    ReplyToUpdateRequest(p->callback);
-  update_requests_.erase(last, update_requests_.end());
+  if (!traits_waiters_.empty() &&
+      cloud_->GetTraitsFingerprint() != waited_traits_fingerprint_) {
+    ReplyToUpdateRequests(&traits_waiters_);
+  }
 }
 
 void PrivetHandler::OnStateChanged() {
-  // State updates also change the component tree, so update both fingerprints.
-  ++state_fingerprint_;
-  ++components_fingerprint_;
-  auto pred = [](const UpdateRequestParameters& params) {
-    return params.state_fingerprint == 0 && params.components_fingerprint == 0;
-  };
-  auto last =
-      std::partition(update_requests_.begin(), update_requests_.end(), pred);
-  for (auto p = last; p != update_requests_.end(); ++p)
-    ReplyToUpdateRequest(p->callback);
-  update_requests_.erase(last, update_requests_.end());
+  // State updates also change the component tree, so check both fingerprints.
+  if (!state_waiters_.empty() &&
+      cloud_->GetStateFingerprint() != waited_state_fingerprint_) {
+    ReplyToUpdateRequests(&state_waiters_);
+  }
+  OnComponentTreeChanged();
 }
 
 void PrivetHandler::OnComponentTreeChanged() {
-  ++components_fingerprint_;
-  auto pred = [](const UpdateRequestParameters& params) {
-    return params.components_fingerprint == 0;
-  };
-  auto last =
-      std::partition(update_requests_.begin(), update_requests_.end(), pred);
-  for (auto p = last; p != update_requests_.end(); ++p)
-    ReplyToUpdateRequest(p->callback);
-  update_requests_.erase(last, update_requests_.end());
+  if (!components_waiters_.empty() &&
+      cloud_->GetComponentsFingerprint() != waited_components_fingerprint_) {
+    ReplyToUpdateRequests(&components_waiters_);
+  }
+  SchedulePushComponentsPatches();
 }
 
 void PrivetHandler::HandleRequest(const std::string& api,
                                   const std::string& auth_header,
                                   const base::DictionaryValue* input,
-                                  const RequestCallback& callback) {
+                                  const RequestCallback& request_callback) {
+  auto handler = handlers_.find(api);
+  RequestCallback callback = request_callback;
+  if (kMetricsEnabled && metrics_) {
+    // Unknown paths share a label, so clients can't grow the metrics.
+    callback = base::Bind(&RecordRequestLatency, metrics_,
+                          handler != handlers_.end() ? api : kUnknownApiLabel,
+                          base::TimeTicks::Now(), request_callback);
+  }
   ErrorPtr error;
+  if (*requests_in_flight_ >= kMaxRequestsInFlight) {
+    Error::AddTo(&error, FROM_HERE, errors::kDeviceBusy,
+                 "Too many requests in progress");
+    return ReturnError(*error, callback);
+  }
+  // The request is charged to its user once the header is verified.
+  UserInfo user_info;
+  ErrorPtr auth_error;
+  bool authorized =
+      handler != handlers_.end() &&
+      Authorize(api, handler->second.scope, auth_header, &user_info,
+                &auth_error);
+  if (!AdmitRequest(authorized ? user_info.id() : UserAppId{}, &error))
+    return ReturnError(*error, callback);
+  callback = base::Bind(&ReplyFromSlot,
+                        std::make_shared<RequestSlot>(requests_in_flight_),
+                        callback);
   if (!input) {
     Error::AddTo(&error, FROM_HERE, errors::kInvalidFormat, "Malformed JSON");
     return ReturnError(*error, callback);
   }
-  auto handler = handlers_.find(api);
   if (handler == handlers_.end()) {
     Error::AddTo(&error, FROM_HERE, errors::kNotFound, "Path not found");
     return ReturnError(*error, callback);
   }
+  if (!authorized)
+    return ReturnError(*auth_error, callback);
+  (this->*handler->second.handler)(*input, user_info, callback);
+}
+
+bool PrivetHandler::CanAcceptRequest(const std::string& auth_header) const {
+  if (*requests_in_flight_ >= kMaxRequestsInFlight)
+    return false;
+  UserInfo user_info;
+  std::string token = GetAuthTokenFromAuthHeader(auth_header);
+  if (token.empty() || token == EnumToString(AuthType::kAnonymous) ||
+      !security_->ParseAccessToken(token, &user_info, nullptr)) {
+    user_info = UserInfo{};
+  }
+  const RequestBucket* bucket = FindRequestBucket(user_info.id());
+  return !bucket || GetRequestTokens(*bucket) >= 1;
+}
+
+bool PrivetHandler::AdmitRequest(const UserAppId& user, ErrorPtr* error) {
+  RequestBucket* bucket = &unverified_requests_;
+  if (!user.IsEmpty()) {
+    RequestBucketKey key{user.user, user.app};
+    auto it = request_buckets_.find(key);
+    if (it == request_buckets_.end()) {
+      if (request_buckets_.size() >= kMaxRateLimitedClients) {
+        request_buckets_.erase(std::min_element(
+            request_buckets_.begin(), request_buckets_.end(),
+            [](const std::pair<const RequestBucketKey, RequestBucket>& a,
+               const std::pair<const RequestBucketKey, RequestBucket>& b) {
+              return a.second.updated < b.second.updated;
+            }));
+      }
+      it = request_buckets_.emplace(std::move(key),
+                                    RequestBucket{kRequestBurst, {}})
+               .first;
+    }
+    bucket = &it->second;
+  }
+
+  bucket->tokens = GetRequestTokens(*bucket);
+  bucket->updated = clock_->Now();
+  if (bucket->tokens < 1) {
+    return Error::AddTo(error, FROM_HERE, errors::kDeviceBusy,
+                        "Too many requests");
+  }
+  bucket->tokens -= 1;
+  return true;
+}
+
+const PrivetHandler::RequestBucket* PrivetHandler::FindRequestBucket(
+    const UserAppId& user) const {
+  if (user.IsEmpty())
+    return &unverified_requests_;
+  auto it = request_buckets_.find(RequestBucketKey{user.user, user.app});
+  return it != request_buckets_.end() ? &it->second : nullptr;
+}
+
+double PrivetHandler::GetRequestTokens(const RequestBucket& bucket) const {
+  if (bucket.updated.is_null())
+    return bucket.tokens;
+  // The wall clock may go back, then the tokens are just not refilled.
+  double elapsed = (clock_->Now() - bucket.updated).InSecondsF();
+  return std::min(kRequestBurst,
+                  bucket.tokens + std::max(0.0, elapsed) * kRequestsPerSecond);
+}
+
+void PrivetHandler::SubscribeToEvents(const std::string& api,
+                                      const std::string& auth_header,
+                                      const EventCallback& event_callback,
+                                      const RequestCallback& error_callback) {
+  ErrorPtr error;
+  UserInfo user_info;
+  if (!Authorize(api, AuthScope::kViewer, auth_header, &user_info, &error))
+    return ReturnError(*error, error_callback);
+
+  DropUnauthorizedEventSubscribers();
+  size_t user_subscribers = std::count_if(
+      event_subscribers_.begin(), event_subscribers_.end(),
+      [&user_info](const std::pair<const int, EventSubscriber>& pair) {
+        return pair.second.user_info.id() == user_info.id();
+      });
+  if (event_subscribers_.size() >= kMaxEventSubscribers ||
+      user_subscribers >= kMaxEventSubscribersPerUser) {
+    Error::AddTo(&error, FROM_HERE, errors::kDeviceBusy,
+                 "Too many event subscribers");
+    return ReturnError(*error, error_callback);
+  }
+
+  // The new subscriber starts from the current tree, so the changes not
+  // pushed yet are sent to the others first.
+  PushComponentsPatches();
+  auto components = cloud_->GetComponentsForUser(user_info);
+  base::DictionaryValue data;
+  data.Set(kComponentsKey, components->CreateDeepCopy());
+  data.SetString(kFingerprintKey,
+                 std::to_string(cloud_->GetComponentsFingerprint()));
+  if (!event_callback.Run(kComponentsKey, data))
+    return;
+
+  pushed_components_[user_info.scope()] = std::move(components);
+  event_subscribers_.emplace(
+      ++last_event_subscriber_id_,
+      EventSubscriber{user_info, api, auth_header, event_callback});
+  ScheduleEventPing();
+}
+
+bool PrivetHandler::Authorize(const std::string& api,
+                              AuthScope scope,
+                              const std::string& auth_header,
+                              UserInfo* user_info,
+                              ErrorPtr* error) const {
   if (auth_header.empty()) {
-    Error::AddTo(&error, FROM_HERE, errors::kMissingAuthorization,
-                 "Authorization header must not be empty");
-    return ReturnError(*error, callback);
+    return Error::AddTo(error, FROM_HERE, errors::kMissingAuthorization,
+                        "Authorization header must not be empty");
   }
   std::string token = GetAuthTokenFromAuthHeader(auth_header);
   if (token.empty()) {
-    Error::AddToPrintf(&error, FROM_HERE, errors::kInvalidAuthorization,
-                       "Invalid authorization header: %s", auth_header.c_str());
-    return ReturnError(*error, callback);
+    return Error::AddToPrintf(error, FROM_HERE, errors::kInvalidAuthorization,
+                              "Invalid authorization header: %s",
+                              auth_header.c_str());
   }
-  UserInfo user_info;
+  *user_info = UserInfo{};
   if (token != EnumToString(AuthType::kAnonymous)) {
-    if (!security_->ParseAccessToken(token, &user_info, &error))
-      return ReturnError(*error, callback);
+    if (!security_->ParseAccessToken(token, user_info, error))
+      return false;
   }
 
-  if (handler->second.scope > user_info.scope()) {
-    Error::AddToPrintf(&error, FROM_HERE, errors::kInvalidAuthorizationScope,
-                       "Scope '%s' does not allow '%s'",
-                       EnumToString(user_info.scope()).c_str(), api.c_str());
-    return ReturnError(*error, callback);
+  if (scope > user_info->scope()) {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::kInvalidAuthorizationScope,
+                              "Scope '%s' does not allow '%s'",
+                              EnumToString(user_info->scope()).c_str(),
+                              api.c_str());
   }
-  (this->*handler->second.handler)(*input, user_info, callback);
+  return true;
 }
 
 void PrivetHandler::AddHandler(const std::string& path,
@@ -544,47 +881,96 @@ void PrivetHandler::AddSecureHandler(const std::string& path,
   CHECK(handlers_.insert(std::make_pair(path, params)).second);
 }
 
+void PrivetHandler::InvalidateInfo() {
+  info_.reset();
+}
+
+MemoryUsage PrivetHandler::GetMemoryUsage() const {
+  MemoryUsage usage;
+  usage.count = update_requests_.size();
+  usage.bytes = update_requests_.size() *
+                    (kTreeNodeOverhead + sizeof(RequestCallback)) +
+                (traits_waiters_.size() + state_waiters_.size() +
+                 components_waiters_.size()) *
+                    (kTreeNodeOverhead + sizeof(int)) +
+                request_buckets_.size() *
+                    (kTreeNodeOverhead + sizeof(RequestBucket));
+  for (const auto& pair : request_buckets_)
+    usage.bytes += pair.first.first.capacity() + pair.first.second.capacity();
+  for (const auto& pair : update_timeouts_) {
+    usage.bytes += kTreeNodeOverhead + sizeof(pair) +
+                   pair.second.capacity() * sizeof(int);
+  }
+  if (info_)
+    usage.bytes += EstimateMemoryUsage(*info_);
+  for (const auto& snapshot : components_snapshots_) {
+    usage.bytes += sizeof(snapshot);
+    if (snapshot.components.use_count() == 1)
+      usage.bytes += EstimateMemoryUsage(*snapshot.components);
+  }
+  return usage;
+}
+
+void PrivetHandler::DropCaches() {
+  info_.reset();
+  components_snapshots_.clear();
+  components_snapshots_.shrink_to_fit();
+}
+
+void PrivetHandler::SetRejectLongPolls(bool reject) {
+  reject_long_polls_ = reject;
+}
+
 void PrivetHandler::HandleInfo(const base::DictionaryValue&,
                                const UserInfo& user_info,
                                const RequestCallback& callback) {
-  base::DictionaryValue output;
+  AuthScope anonymous_max_scope = GetAnonymousMaxScope(*cloud_, wifi_);
+  if (!info_ || info_anonymous_max_scope_ != anonymous_max_scope) {
+    info_ = CreateInfo(anonymous_max_scope);
+    info_anonymous_max_scope_ = anonymous_max_scope;
+  }
+
+  // Connection states change without notifications, so these sections are
+  // rebuilt for every request.
+  if (wifi_)
+    info_->Set(kWifiKey, CreateWifiSection(*wifi_));
+  info_->Set(kGcdKey, CreateGcdSection(*cloud_));
+
+  info_->SetDouble(kInfoTimeKey, clock_->Now().ToJsTime());
+  info_->SetString(kInfoSessionIdKey, security_->CreateSessionId());
+
+  callback.Run(http::kOk, *info_);
+}
+
+std::unique_ptr<base::DictionaryValue> PrivetHandler::CreateInfo(
+    AuthScope anonymous_max_scope) const {
+  std::unique_ptr<base::DictionaryValue> output{new base::DictionaryValue};
 
-  std::string name = cloud_->GetName();
   std::string model_id = cloud_->GetModelId();
 
-  output.SetString(kInfoVersionKey, kInfoVersionValue);
-  output.SetString(kInfoIdKey, cloud_->GetDeviceId());
-  output.SetString(kNameKey, name);
+  output->SetString(kInfoVersionKey, kInfoVersionValue);
+  output->SetString(kInfoIdKey, cloud_->GetDeviceId());
+  output->SetString(kNameKey, cloud_->GetName());
 
   std::string description{cloud_->GetDescription()};
   if (!description.empty())
-    output.SetString(kDescrptionKey, description);
+    output->SetString(kDescrptionKey, description);
 
   std::string location{cloud_->GetLocation()};
   if (!location.empty())
-    output.SetString(kLocationKey, location);
+    output->SetString(kLocationKey, location);
 
-  output.SetString(kInfoModelIdKey, model_id);
-  output.Set(kInfoModelManifestKey, CreateManifestSection(*cloud_));
-  output.Set(
-      kInfoServicesKey,
-      ToValue(std::vector<std::string>{GetDeviceUiKind(cloud_->GetModelId())}));
+  output->SetString(kInfoModelIdKey, model_id);
+  output->Set(kInfoModelManifestKey, CreateManifestSection(*cloud_));
+  output->Set(kInfoServicesKey,
+              ToValue(std::vector<std::string>{GetDeviceUiKind(model_id)}));
 
-  output.Set(
-      kInfoAuthenticationKey,
-      CreateInfoAuthSection(*security_, GetAnonymousMaxScope(*cloud_, wifi_)));
+  output->Set(kInfoAuthenticationKey,
+              CreateInfoAuthSection(*security_, anonymous_max_scope));
 
-  output.Set(kInfoEndpointsKey, CreateEndpointsSection(*device_));
+  output->Set(kInfoEndpointsKey, CreateEndpointsSection(*device_));
 
-  if (wifi_)
-    output.Set(kWifiKey, CreateWifiSection(*wifi_));
-
-  output.Set(kGcdKey, CreateGcdSection(*cloud_));
-
-  output.SetDouble(kInfoTimeKey, clock_->Now().ToJsTime());
-  output.SetString(kInfoSessionIdKey, security_->CreateSessionId());
-
-  callback.Run(http::kOk, output);
+  return output;
 }
 
 void PrivetHandler::HandlePairingStart(const base::DictionaryValue& input,
@@ -727,6 +1113,14 @@ void PrivetHandler::HandleAuth(const base::DictionaryValue& input,
   output.SetInteger(kAuthExpiresInKey, access_token_ttl.InSeconds());
   output.SetString(kAuthScopeKey, EnumToString(access_token_scope));
 
+  // A ticket is accepted once, so a new one comes with every resumed token.
+  if (auth_type == AuthType::kPairing || auth_type == AuthType::kLocal ||
+      auth_type == AuthType::kResume) {
+    std::string ticket = security_->CreateResumeTicket(access_token, nullptr);
+    if (!ticket.empty())
+      output.SetString(kAuthResumeTicketKey, ticket);
+  }
+
   callback.Run(http::kOk, output);
 }
 
@@ -882,7 +1276,8 @@ void PrivetHandler::HandleTraits(const base::DictionaryValue& input,
                                  const RequestCallback& callback) {
   base::DictionaryValue output;
   output.Set(kTraitsKey, cloud_->GetTraits().CreateDeepCopy());
-  output.SetString(kFingerprintKey, std::to_string(traits_fingerprint_));
+  output.SetString(kFingerprintKey,
+                   std::to_string(cloud_->GetTraitsFingerprint()));
 
   callback.Run(http::kOk, output);
 }
@@ -892,9 +1287,12 @@ void PrivetHandler::HandleComponents(const base::DictionaryValue& input,
                                      const RequestCallback& callback) {
   std::string path;
   std::set<std::string> filter;
+  std::string fingerprint;
   std::unique_ptr<base::DictionaryValue> components;
+  const uint64_t components_fingerprint = cloud_->GetComponentsFingerprint();
 
   input.GetString(kPathKey, &path);
+  input.GetString(kFingerprintKey, &fingerprint);
   const base::ListValue* filter_items = nullptr;
   if (input.GetList(kFilterKey, &filter_items)) {
     for (const auto& value : *filter_items) {
@@ -903,37 +1301,155 @@ void PrivetHandler::HandleComponents(const base::DictionaryValue& input,
         filter.insert(filter_item);
     }
   }
-  const base::DictionaryValue* component = nullptr;
   if (!path.empty()) {
+    // Only the requested part of the component is visited.
     ErrorPtr error;
-    component = cloud_->FindComponent(path, &error);
+    auto component =
+        cloud_->GetComponentForUser(user_info, path, filter, &error);
     if (!component)
       return ReturnError(*error, callback);
     components.reset(new base::DictionaryValue);
     // Get the last element of the path and use it as a dictionary key here.
-    auto parts = Split(path, ".", true, false);
-    components->Set(parts.back(), CloneComponent(*component, filter));
+    base::StringPiece name;
+    for (StringTokenizer it{path, "."}; !it.IsAtEnd(); it.Advance())
+      name = it.token();
+    components->Set(name.as_string(), std::move(component));
   } else {
-    components =
-        CloneComponentTree(*cloud_->GetComponentsForUser(user_info), filter);
+    auto snapshot = cloud_->GetComponentsForUser(user_info);
+    components = CloneComponentTree(*snapshot, filter);
+    // If the tree the client has seen is still known, reply with the changes
+    // since then only.
+    auto previous = std::find_if(
+        components_snapshots_.begin(), components_snapshots_.end(),
+        [&fingerprint, &user_info](const ComponentsSnapshot& snapshot) {
+          return snapshot.scope == user_info.scope() &&
+                 std::to_string(snapshot.fingerprint) == fingerprint;
+        });
+    if (previous != components_snapshots_.end()) {
+      auto patch = CreateMergePatch(
+          *CloneComponentTree(*previous->components, filter), *components);
+      base::DictionaryValue output;
+      output.Set(kComponentsPatchKey, std::move(patch));
+      output.SetString(kFingerprintKey,
+                       std::to_string(components_fingerprint));
+      return callback.Run(http::kOk, output);
+    }
+    if (components_snapshots_.empty() ||
+        components_snapshots_.back().fingerprint != components_fingerprint ||
+        components_snapshots_.back().scope != user_info.scope()) {
+      components_snapshots_.push_back(
+          {components_fingerprint, user_info.scope(), std::move(snapshot)});
+      if (components_snapshots_.size() > kMaxComponentsSnapshots)
+        components_snapshots_.pop_front();
+    }
   }
   base::DictionaryValue output;
   output.Set(kComponentsKey, std::move(components));
-  output.SetString(kFingerprintKey, std::to_string(components_fingerprint_));
+  output.SetString(kFingerprintKey, std::to_string(components_fingerprint));
 
   callback.Run(http::kOk, output);
 }
 
+void PrivetHandler::HandleBatch(const base::DictionaryValue& input,
+                                const UserInfo& user_info,
+                                const RequestCallback& callback) {
+  ErrorPtr error;
+  const base::ListValue* calls = nullptr;
+  if (!input.GetList(kBatchCallsKey, &calls) || calls->empty() ||
+      calls->GetSize() > kMaxBatchCalls) {
+    Error::AddToPrintf(&error, FROM_HERE, errors::kInvalidParams,
+                       "Expected 1 to %zu calls in '%s'", kMaxBatchCalls,
+                       kBatchCallsKey);
+    return ReturnError(*error, callback);
+  }
+
+  auto batch =
+      std::make_shared<ListReply>(kBatchResultsKey, calls->GetSize(), callback);
+  for (size_t i = 0; i < calls->GetSize(); ++i) {
+    RequestCallback call_callback = base::Bind(&OnBatchCallDone, batch, i);
+    ErrorPtr call_error;
+    // Each call is in flight on its own, like a separate request, so the
+    // long polls in a batch count against the limit too.
+    if (*requests_in_flight_ >= kMaxRequestsInFlight) {
+      Error::AddTo(&call_error, FROM_HERE, errors::kDeviceBusy,
+                   "Too many requests in progress");
+      ReturnError(*call_error, call_callback);
+      continue;
+    }
+    call_callback = base::Bind(
+        &ReplyFromSlot, std::make_shared<RequestSlot>(requests_in_flight_),
+        call_callback);
+    const base::DictionaryValue* call = nullptr;
+    std::string api;
+    const base::DictionaryValue* call_input = nullptr;
+    base::DictionaryValue empty_input;
+    if (!calls->GetDictionary(i, &call) ||
+        !call->GetString(kBatchApiKey, &api)) {
+      Error::AddToPrintf(&call_error, FROM_HERE, errors::kInvalidParams,
+                         "Call %zu has no '%s'", i, kBatchApiKey);
+      ReturnError(*call_error, call_callback);
+      continue;
+    }
+    if (!call->GetDictionary(kBatchInputKey, &call_input))
+      call_input = &empty_input;
+
+    auto handler = handlers_.find(api);
+    if (handler == handlers_.end() || api == kBatchApi) {
+      Error::AddTo(&call_error, FROM_HERE, errors::kNotFound, "Path not found");
+      ReturnError(*call_error, call_callback);
+      continue;
+    }
+    if (handler->second.scope > user_info.scope()) {
+      Error::AddToPrintf(&call_error, FROM_HERE,
+                         errors::kInvalidAuthorizationScope,
+                         "Scope '%s' does not allow '%s'",
+                         EnumToString(user_info.scope()).c_str(), api.c_str());
+      ReturnError(*call_error, call_callback);
+      continue;
+    }
+    (this->*handler->second.handler)(*call_input, user_info, call_callback);
+  }
+}
+
 void PrivetHandler::HandleCommandsExecute(const base::DictionaryValue& input,
                                           const UserInfo& user_info,
                                           const RequestCallback& callback) {
-  cloud_->AddCommand(input, user_info,
-                     base::Bind(&OnCommandRequestSucceeded, callback));
+  bool wait_for_completion = false;
+  input.GetBoolean(kWaitForCompletionKey, &wait_for_completion);
+  if (!wait_for_completion) {
+    return cloud_->AddCommand(input, user_info,
+                              base::Bind(&OnCommandRequestSucceeded, callback));
+  }
+
+  auto command = input.CreateDeepCopy();
+  command->RemoveWithoutPathExpansion(kWaitForCompletionKey, nullptr);
+  command->RemoveWithoutPathExpansion(kWaitTimeoutKey, nullptr);
+  cloud_->AddCommand(*command, user_info,
+                     base::Bind(&PrivetHandler::OnCommandAdded,
+                                weak_ptr_factory_.GetWeakPtr(), user_info,
+                                GetWaitTimeout(input), callback));
+}
+
+void PrivetHandler::OnCommandAdded(const UserInfo& user_info,
+                                   base::TimeDelta timeout,
+                                   const RequestCallback& callback,
+                                   const base::DictionaryValue& command,
+                                   ErrorPtr error) {
+  std::string id;
+  if (error || !command.GetString(kCommandsIdKey, &id))
+    return OnCommandRequestSucceeded(callback, command, std::move(error));
+  cloud_->WaitForCommand(id, user_info, timeout,
+                         base::Bind(&OnCommandRequestSucceeded, callback));
 }
 
 void PrivetHandler::HandleCommandsStatus(const base::DictionaryValue& input,
                                          const UserInfo& user_info,
                                          const RequestCallback& callback) {
+  const base::ListValue* ids = nullptr;
+  if (input.GetList(kCommandsIdsKey, &ids)) {
+    return RequestCommands(cloud_, &CloudDelegate::GetCommand, *ids,
+                           user_info, callback);
+  }
   std::string id;
   if (!input.GetString(kCommandsIdKey, &id)) {
     ErrorPtr error;
@@ -948,13 +1464,29 @@ void PrivetHandler::HandleCommandsStatus(const base::DictionaryValue& input,
 void PrivetHandler::HandleCommandsList(const base::DictionaryValue& input,
                                        const UserInfo& user_info,
                                        const RequestCallback& callback) {
-  cloud_->ListCommands(user_info,
+  std::string since_id;
+  int max_results = 0;
+  input.GetString(kSinceIdKey, &since_id);
+  input.GetInteger(kMaxResultsKey, &max_results);
+  if (max_results < 0) {
+    ErrorPtr error;
+    Error::AddToPrintf(&error, FROM_HERE, errors::kInvalidParams,
+                       kInvalidParamValueFormat, kMaxResultsKey,
+                       std::to_string(max_results).c_str());
+    return ReturnError(*error, callback);
+  }
+  cloud_->ListCommands(user_info, since_id, max_results,
                        base::Bind(&OnCommandRequestSucceeded, callback));
 }
 
 void PrivetHandler::HandleCommandsCancel(const base::DictionaryValue& input,
                                          const UserInfo& user_info,
                                          const RequestCallback& callback) {
+  const base::ListValue* ids = nullptr;
+  if (input.GetList(kCommandsIdsKey, &ids)) {
+    return RequestCommands(cloud_, &CloudDelegate::CancelCommand, *ids,
+                           user_info, callback);
+  }
   std::string id;
   if (!input.GetString(kCommandsIdKey, &id)) {
     ErrorPtr error;
@@ -969,21 +1501,7 @@ void PrivetHandler::HandleCommandsCancel(const base::DictionaryValue& input,
 void PrivetHandler::HandleCheckForUpdates(const base::DictionaryValue& input,
                                           const UserInfo& user_info,
                                           const RequestCallback& callback) {
-  int timeout_seconds = -1;
-  input.GetInteger(kWaitTimeoutKey, &timeout_seconds);
-  base::TimeDelta timeout = device_->GetHttpRequestTimeout();
-  // Allow 10 seconds to cut the timeout short to make sure HTTP server doesn't
-  // kill the connection before we have a chance to respond. 10 seconds chosen
-  // at random here without any scientific basis for the value.
-  const base::TimeDelta safety_gap = base::TimeDelta::FromSeconds(10);
-  if (timeout != base::TimeDelta::Max()) {
-    if (timeout > safety_gap)
-      timeout -= safety_gap;
-    else
-      timeout = base::TimeDelta::FromSeconds(0);
-  }
-  if (timeout_seconds >= 0)
-    timeout = std::min(timeout, base::TimeDelta::FromSeconds(timeout_seconds));
+  base::TimeDelta timeout = GetWaitTimeout(input);
   if (timeout == base::TimeDelta{})
     return ReplyToUpdateRequest(callback);
 
@@ -1004,67 +1522,221 @@ void PrivetHandler::HandleCheckForUpdates(const base::DictionaryValue& input,
     return ReplyToUpdateRequest(callback);
   // If the current state fingerprint is different from the requested one,
   // return new fingerprints.
-  if (!ignore_state && state_fingerprint != std::to_string(state_fingerprint_))
+  if (!ignore_state &&
+      state_fingerprint != std::to_string(cloud_->GetStateFingerprint())) {
     return ReplyToUpdateRequest(callback);
+  }
   // If the current commands fingerprint is different from the requested one,
   // return new fingerprints.
   // NOTE: We are using traits fingerprint for command fingerprint as well.
   if (!ignore_commands &&
-      commands_fingerprint != std::to_string(traits_fingerprint_)) {
+      commands_fingerprint != std::to_string(cloud_->GetTraitsFingerprint())) {
     return ReplyToUpdateRequest(callback);
   }
   // If the current traits fingerprint is different from the requested one,
   // return new fingerprints.
   if (!ignore_traits &&
-      traits_fingerprint != std::to_string(traits_fingerprint_)) {
+      traits_fingerprint != std::to_string(cloud_->GetTraitsFingerprint())) {
     return ReplyToUpdateRequest(callback);
   }
   // If the current components fingerprint is different from the requested one,
   // return new fingerprints.
   if (!ignore_components &&
-      components_fingerprint != std::to_string(components_fingerprint_)) {
+      components_fingerprint !=
+          std::to_string(cloud_->GetComponentsFingerprint())) {
     return ReplyToUpdateRequest(callback);
   }
 
-  UpdateRequestParameters params;
-  params.request_id = ++last_update_request_id_;
-  params.callback = callback;
-  params.traits_fingerprint =
-      (ignore_traits && ignore_commands) ? 0 : traits_fingerprint_;
-  params.state_fingerprint = ignore_state ? 0 : state_fingerprint_;
-  params.components_fingerprint =
-      ignore_components ? 0 : components_fingerprint_;
-  update_requests_.push_back(params);
+  if (reject_long_polls_) {
+    ErrorPtr error;
+    Error::AddTo(&error, FROM_HERE, errors::kDeviceBusy,
+                 "Device is low on memory");
+    return ReturnError(*error, callback);
+  }
+
+  const int request_id = ++last_update_request_id_;
+  update_requests_.emplace(request_id, callback);
+  if (!ignore_traits || !ignore_commands) {
+    traits_waiters_.insert(request_id);
+    waited_traits_fingerprint_ = cloud_->GetTraitsFingerprint();
+  }
+  if (!ignore_state) {
+    state_waiters_.insert(request_id);
+    waited_state_fingerprint_ = cloud_->GetStateFingerprint();
+  }
+  if (!ignore_components) {
+    components_waiters_.insert(request_id);
+    waited_components_fingerprint_ = cloud_->GetComponentsFingerprint();
+  }
+  if (timeout != base::TimeDelta::Max()) {
+    // Round the deadline down to a whole second, so the request may be
+    // answered a bit early but never after the HTTP timeout.
+    base::Time slot =
+        base::Time::FromTimeT((clock_->Now() + timeout).ToTimeT());
+    auto& slot_requests = update_timeouts_[slot];
+    if (slot_requests.empty()) {
+      device_->PostDelayedTask(
+          FROM_HERE, base::Bind(&PrivetHandler::OnUpdateRequestTimeout,
+                                weak_ptr_factory_.GetWeakPtr(), slot),
+          timeout);
+    }
+    slot_requests.push_back(request_id);
+  }
+}
+
+base::TimeDelta PrivetHandler::GetWaitTimeout(
+    const base::DictionaryValue& input) const {
+  int timeout_seconds = -1;
+  input.GetInteger(kWaitTimeoutKey, &timeout_seconds);
+  base::TimeDelta timeout = device_->GetHttpRequestTimeout();
+  // Allow 10 seconds to cut the timeout short to make sure HTTP server doesn't
+  // kill the connection before we have a chance to respond. 10 seconds chosen
+  // at random here without any scientific basis for the value.
+  const base::TimeDelta safety_gap = base::TimeDelta::FromSeconds(10);
   if (timeout != base::TimeDelta::Max()) {
-    device_->PostDelayedTask(
-        FROM_HERE,
-        base::Bind(&PrivetHandler::OnUpdateRequestTimeout,
-                   weak_ptr_factory_.GetWeakPtr(), last_update_request_id_),
-        timeout);
+    if (timeout > safety_gap)
+      timeout -= safety_gap;
+    else
+      timeout = base::TimeDelta::FromSeconds(0);
   }
+  if (timeout_seconds >= 0)
+    timeout = std::min(timeout, base::TimeDelta::FromSeconds(timeout_seconds));
+  return timeout;
 }
 
 void PrivetHandler::ReplyToUpdateRequest(
     const RequestCallback& callback) const {
   base::DictionaryValue output;
-  output.SetString(kStateFingerprintKey, std::to_string(state_fingerprint_));
-  output.SetString(kCommandsFingerprintKey,
-                   std::to_string(traits_fingerprint_));
-  output.SetString(kTraitsFingerprintKey, std::to_string(traits_fingerprint_));
+  const std::string traits_fingerprint =
+      std::to_string(cloud_->GetTraitsFingerprint());
+  output.SetString(kStateFingerprintKey,
+                   std::to_string(cloud_->GetStateFingerprint()));
+  output.SetString(kCommandsFingerprintKey, traits_fingerprint);
+  output.SetString(kTraitsFingerprintKey, traits_fingerprint);
   output.SetString(kComponentsFingerprintKey,
-                   std::to_string(components_fingerprint_));
+                   std::to_string(cloud_->GetComponentsFingerprint()));
   callback.Run(http::kOk, output);
 }
 
-void PrivetHandler::OnUpdateRequestTimeout(int update_request_id) {
-  auto pred = [update_request_id](const UpdateRequestParameters& params) {
-    return params.request_id != update_request_id;
-  };
-  auto last =
-      std::partition(update_requests_.begin(), update_requests_.end(), pred);
-  for (auto p = last; p != update_requests_.end(); ++p)
-    ReplyToUpdateRequest(p->callback);
-  update_requests_.erase(last, update_requests_.end());
+void PrivetHandler::ReplyToUpdateRequests(std::set<int>* waiters) {
+  // Callbacks may issue new requests, so detach the current waiters first.
+  std::set<int> update_request_ids;
+  update_request_ids.swap(*waiters);
+  for (int id : update_request_ids)
+    FinishUpdateRequest(id);
+}
+
+void PrivetHandler::FinishUpdateRequest(int update_request_id) {
+  auto it = update_requests_.find(update_request_id);
+  if (it == update_requests_.end())
+    return;
+  RequestCallback callback = it->second;
+  update_requests_.erase(it);
+  traits_waiters_.erase(update_request_id);
+  state_waiters_.erase(update_request_id);
+  components_waiters_.erase(update_request_id);
+  ReplyToUpdateRequest(callback);
+}
+
+void PrivetHandler::SchedulePushComponentsPatches() {
+  if (event_subscribers_.empty() || push_pending_)
+    return;
+  // Bursts of changes are pushed as a single patch.
+  push_pending_ = true;
+  device_->PostDelayedTask(FROM_HERE,
+                           base::Bind(&PrivetHandler::PushComponentsPatches,
+                                      weak_ptr_factory_.GetWeakPtr()),
+                           {});
+}
+
+void PrivetHandler::PushComponentsPatches() {
+  if (!push_pending_)
+    return;
+  push_pending_ = false;
+  DropUnauthorizedEventSubscribers();
+
+  // The tree and the patch are computed once for all subscribers with the
+  // same scope.
+  std::map<AuthScope, std::set<int>> subscribers_by_scope;
+  for (const auto& pair : event_subscribers_)
+    subscribers_by_scope[pair.second.user_info.scope()].insert(pair.first);
+  for (const auto& pair : subscribers_by_scope) {
+    auto components = cloud_->GetComponentsForUser(UserInfo{pair.first});
+    auto& pushed = pushed_components_[pair.first];
+    auto patch = CreateMergePatch(*pushed, *components);
+    pushed = std::move(components);
+    if (patch->empty())
+      continue;
+    base::DictionaryValue data;
+    data.Set(kComponentsPatchKey, std::move(patch));
+    data.SetString(kFingerprintKey,
+                   std::to_string(cloud_->GetComponentsFingerprint()));
+    SendEvents(pair.second, kComponentsPatchKey, data);
+  }
+}
+
+void PrivetHandler::ScheduleEventPing() {
+  if (event_subscribers_.empty() || ping_scheduled_)
+    return;
+  ping_scheduled_ = true;
+  device_->PostDelayedTask(
+      FROM_HERE, base::Bind(&PrivetHandler::PingEventSubscribers,
+                            weak_ptr_factory_.GetWeakPtr()),
+      base::TimeDelta::FromSeconds(kEventPingIntervalSeconds));
+}
+
+void PrivetHandler::PingEventSubscribers() {
+  ping_scheduled_ = false;
+  DropUnauthorizedEventSubscribers();
+  std::set<int> subscribers;
+  for (const auto& pair : event_subscribers_)
+    subscribers.insert(pair.first);
+  SendEvents(subscribers, kPingEvent, base::DictionaryValue{});
+  ScheduleEventPing();
+}
+
+void PrivetHandler::DropUnauthorizedEventSubscribers() {
+  for (auto it = event_subscribers_.begin(); it != event_subscribers_.end();) {
+    // The token may have expired or been revoked since the subscription.
+    UserInfo user_info;
+    ErrorPtr error;
+    if (Authorize(it->second.api, AuthScope::kViewer, it->second.auth_header,
+                  &user_info, &error) &&
+        user_info == it->second.user_info) {
+      ++it;
+      continue;
+    }
+    VLOG(1) << "Ending the event stream of an expired authorization";
+    it = event_subscribers_.erase(it);
+  }
+  if (event_subscribers_.empty())
+    pushed_components_.clear();
+}
+
+void PrivetHandler::SendEvents(const std::set<int>& subscribers,
+                               const std::string& event,
+                               const base::DictionaryValue& data) {
+  for (int id : subscribers) {
+    auto it = event_subscribers_.find(id);
+    if (it == event_subscribers_.end())
+      continue;
+    // Copy, the callback may subscribe again.
+    EventCallback callback = it->second.callback;
+    if (!callback.Run(event, data))
+      event_subscribers_.erase(id);
+  }
+  if (event_subscribers_.empty())
+    pushed_components_.clear();
+}
+
+void PrivetHandler::OnUpdateRequestTimeout(base::Time slot) {
+  auto it = update_timeouts_.find(slot);
+  if (it == update_timeouts_.end())
+    return;
+  std::vector<int> update_request_ids = std::move(it->second);
+  update_timeouts_.erase(it);
+  for (int id : update_request_ids)
+    FinishUpdateRequest(id);
 }
 
 }  // namespace privet
@@ -5,15 +5,22 @@
 #ifndef LIBWEAVE_SRC_PRIVET_PRIVET_HANDLER_H_
 #define LIBWEAVE_SRC_PRIVET_PRIVET_HANDLER_H_
 
+#include <deque>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <base/macros.h>
 #include <base/memory/weak_ptr.h>
 #include <base/time/default_clock.h>
 #include <weave/settings.h>
 
+#include "src/memory_usage.h"
+#include "src/metrics.h"
 #include "src/privet/cloud_delegate.h"
 
 namespace base {
@@ -40,11 +47,17 @@ class PrivetHandler {
   using RequestCallback =
       base::Callback<void(int status, const base::DictionaryValue& output)>;
 
+  // Callback receiving events pushed to a subscriber of SubscribeToEvents.
+  // Returns false once the subscriber has gone away, so it's dropped.
+  using EventCallback = base::Callback<bool(const std::string& event,
+                                            const base::DictionaryValue& data)>;
+
   PrivetHandler(CloudDelegate* cloud,
                 DeviceDelegate* device,
                 SecurityDelegate* pairing,
                 WifiDelegate* wifi,
-                base::Clock* clock = nullptr);
+                base::Clock* clock = nullptr,
+                Metrics* metrics = nullptr);
   ~PrivetHandler();
 
   std::vector<std::string> GetHttpPaths() const;
@@ -57,16 +70,76 @@ class PrivetHandler {
   // not valid JSON.
   // |callback| will be called exactly once during or after |HandleRequest|
   // call.
+  // Requests over the per-user rate or the limit of requests in flight are
+  // rejected with "deviceBusy" before being handled.
   void HandleRequest(const std::string& api,
                      const std::string& auth_header,
                      const base::DictionaryValue* input,
                      const RequestCallback& callback);
 
+  // Returns false if HandleRequest would reject a request with |auth_header|
+  // for the request limits, so the caller may skip decoding its payload.
+  bool CanAcceptRequest(const std::string& auth_header) const;
+
+  // Subscribes to changes of the component tree, with |auth_header| checked
+  // the same way as for /privet/v3/components. The subscriber first receives
+  // a "components" event with the tree visible for its role, then
+  // "componentsPatch" events with the changes, and periodic "ping" events.
+  // Event data is the same as the replies of /privet/v3/components. |api| is
+  // the path of the request, as in HandleRequest. Errors are reported to
+  // |error_callback| and no events are sent then.
+  void SubscribeToEvents(const std::string& api,
+                         const std::string& auth_header,
+                         const EventCallback& event_callback,
+                         const RequestCallback& error_callback);
+
+  // Drops the cached /privet/info reply. Must be called when the device
+  // settings or the endpoints change.
+  void InvalidateInfo();
+
+  // Returns the number of the pending checkForUpdates requests and the
+  // approximate memory usage of the requests, the cached replies and the rate
+  // limits.
+  MemoryUsage GetMemoryUsage() const;
+
+  // Drops the cached /privet/info reply and the components snapshots, so
+  // clients asking for the changes since a snapshot get the whole tree.
+  void DropCaches();
+
+  // While |reject| is set, checkForUpdates requests which would have to wait
+  // for a change are rejected with "deviceBusy". The pending ones are kept.
+  void SetRejectLongPolls(bool reject);
+
  private:
   using ApiHandler = void (PrivetHandler::*)(const base::DictionaryValue&,
                                              const UserInfo&,
                                              const RequestCallback&);
 
+  // Token bucket of a user, see kRequestBurst.
+  struct RequestBucket {
+    double tokens;
+    base::Time updated;
+  };
+  // User and app IDs of a verified user.
+  using RequestBucketKey =
+      std::pair<std::vector<uint8_t>, std::vector<uint8_t>>;
+
+  // Takes a token from the bucket of |user|, or from the one shared by the
+  // anonymous and unverified requests if |user| is empty.
+  bool AdmitRequest(const UserAppId& user, ErrorPtr* error);
+  // Returns the bucket of |user| as in AdmitRequest(), or nullptr if it
+  // isn't tracked yet.
+  const RequestBucket* FindRequestBucket(const UserAppId& user) const;
+  // Returns the tokens in |bucket|, refilled up to now.
+  double GetRequestTokens(const RequestBucket& bucket) const;
+
+  // Checks that |auth_header| grants |scope| for |api|.
+  bool Authorize(const std::string& api,
+                 AuthScope scope,
+                 const std::string& auth_header,
+                 UserInfo* user_info,
+                 ErrorPtr* error) const;
+
   // Adds a handler for both HTTP and HTTPS interfaces.
   void AddHandler(const std::string& path, ApiHandler handler, AuthScope scope);
 
@@ -78,6 +151,10 @@ class PrivetHandler {
   void HandleInfo(const base::DictionaryValue&,
                   const UserInfo& user_info,
                   const RequestCallback& callback);
+  // Builds the parts of the /privet/info reply which change only with the
+  // settings.
+  std::unique_ptr<base::DictionaryValue> CreateInfo(
+      AuthScope anonymous_max_scope) const;
   void HandlePairingStart(const base::DictionaryValue& input,
                           const UserInfo& user_info,
                           const RequestCallback& callback);
@@ -123,10 +200,39 @@ class PrivetHandler {
   void HandleComponents(const base::DictionaryValue& input,
                         const UserInfo& user_info,
                         const RequestCallback& callback);
+  // Runs the "calls" in |input| through |handlers_| with |user_info|, and
+  // replies with their statuses and outputs, in order, once all of them have
+  // replied.
+  void HandleBatch(const base::DictionaryValue& input,
+                   const UserInfo& user_info,
+                   const RequestCallback& callback);
 
+  void OnCommandAdded(const UserInfo& user_info,
+                      base::TimeDelta timeout,
+                      const RequestCallback& callback,
+                      const base::DictionaryValue& command,
+                      ErrorPtr error);
+
+  // Returns how long to hold the reply, limited by "waitTimeout" in |input|
+  // and by the HTTP request timeout.
+  base::TimeDelta GetWaitTimeout(const base::DictionaryValue& input) const;
   void ReplyWithSetupStatus(const RequestCallback& callback) const;
   void ReplyToUpdateRequest(const RequestCallback& callback) const;
-  void OnUpdateRequestTimeout(int update_request_id);
+  void ReplyToUpdateRequests(std::set<int>* waiters);
+  void FinishUpdateRequest(int update_request_id);
+  void OnUpdateRequestTimeout(base::Time slot);
+
+  void SchedulePushComponentsPatches();
+  void PushComponentsPatches();
+  void ScheduleEventPing();
+  void PingEventSubscribers();
+  // Ends the streams of the subscribers whose authorization is no longer
+  // valid, which is checked before every event.
+  void DropUnauthorizedEventSubscribers();
+  // Sends |event| to |subscribers| and drops the ones which have gone away.
+  void SendEvents(const std::set<int>& subscribers,
+                  const std::string& event,
+                  const base::DictionaryValue& data);
 
   void OnTraitDefsChanged();
   void OnStateChanged();
@@ -138,27 +244,72 @@ class PrivetHandler {
   WifiDelegate* wifi_{nullptr};
   base::DefaultClock default_clock_;
   base::Clock* clock_{nullptr};
+  Metrics* metrics_{nullptr};
 
   struct HandlerParameters {
     ApiHandler handler;
     AuthScope scope;
     bool https_only = true;
   };
-  std::map<std::string, HandlerParameters> handlers_;
-
-  struct UpdateRequestParameters {
-    RequestCallback callback;
-    int request_id{0};
-    uint64_t state_fingerprint{0};
-    uint64_t traits_fingerprint{0};
-    uint64_t components_fingerprint{0};
-  };
-  std::vector<UpdateRequestParameters> update_requests_;
+  // Hashed, so a request is routed with one hash of its path.
+  std::unordered_map<std::string, HandlerParameters> handlers_;
+
+  // Buckets of the verified users. Only Authorize() adds users, so clients
+  // can't evict the buckets of others with made-up headers.
+  std::map<RequestBucketKey, RequestBucket> request_buckets_;
+  RequestBucket unverified_requests_;
+  // Shared with the pending replies, which may outlive the handler.
+  std::shared_ptr<size_t> requests_in_flight_{std::make_shared<size_t>(0)};
+
+  // Cached /privet/info reply, see InvalidateInfo(). The anonymous scope
+  // depends on the hosted SSID, which changes without notifications.
+  std::unique_ptr<base::DictionaryValue> info_;
+  AuthScope info_anonymous_max_scope_{AuthScope::kNone};
+
+  // Pending checkForUpdates requests by ID, and the IDs of the requests
+  // waiting for each fingerprint, so a change wakes up only those.
+  std::map<int, RequestCallback> update_requests_;
+  std::set<int> traits_waiters_;
+  std::set<int> state_waiters_;
+  std::set<int> components_waiters_;
+  // Requests timing out within the same second share one delayed task. Slots
+  // may still list requests that have been answered already.
+  std::map<base::Time, std::vector<int>> update_timeouts_;
   int last_update_request_id_{0};
+  bool reject_long_polls_{false};
+
+  // Fingerprints the pending checkForUpdates requests are waiting on, so
+  // notifications which didn't change the content don't wake them up.
+  uint64_t waited_state_fingerprint_{0};
+  uint64_t waited_traits_fingerprint_{0};
+  uint64_t waited_components_fingerprint_{0};
 
-  uint64_t state_fingerprint_{1};
-  uint64_t traits_fingerprint_{1};
-  uint64_t components_fingerprint_{1};
+  // Component trees recently returned by /privet/v3/components, so clients
+  // can ask for the changes since the fingerprint they have seen. Bounded
+  // by kMaxComponentsSnapshots.
+  struct ComponentsSnapshot {
+    uint64_t fingerprint{0};
+    AuthScope scope{AuthScope::kNone};
+    std::shared_ptr<const base::DictionaryValue> components;
+  };
+  std::deque<ComponentsSnapshot> components_snapshots_;
+
+  // Subscribers of pushed events by ID, the oldest first. Bounded by
+  // kMaxEventSubscribers.
+  struct EventSubscriber {
+    UserInfo user_info;
+    // The request of the subscription, to check its authorization again.
+    std::string api;
+    std::string auth_header;
+    EventCallback callback;
+  };
+  std::map<int, EventSubscriber> event_subscribers_;
+  int last_event_subscriber_id_{0};
+  // Component trees last pushed to the subscribers, for each scope.
+  std::map<AuthScope, std::shared_ptr<const base::DictionaryValue>>
+      pushed_components_;
+  bool push_pending_{false};
+  bool ping_scheduled_{false};
 
   base::WeakPtrFactory<PrivetHandler> weak_ptr_factory_{this};
 
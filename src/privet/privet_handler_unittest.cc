@@ -18,8 +18,10 @@
 #include <weave/device.h>
 #include <weave/test/unittest_utils.h>
 
+#include "src/metrics.h"
 #include "src/privet/constants.h"
 #include "src/privet/mock_delegates.h"
+#include "src/test/allocation_counter.h"
 #include "src/test/mock_clock.h"
 
 using testing::_;
@@ -82,6 +84,40 @@ std::unique_ptr<base::DictionaryValue> StripDebugErrorDetails(
   return result;
 }
 
+// Delegates answering the calls of a /privet/info request with fixed values,
+// as calls of mock methods allocate on their own.
+class FixedClock : public base::Clock {
+ public:
+  base::Time Now() override { return base::Time::FromTimeT(1410000001); }
+};
+
+class InfoCloudDelegate : public MockCloudDelegate {
+ public:
+  AuthScope GetAnonymousMaxScope() const override { return AuthScope::kUser; }
+  const ConnectionState& GetConnectionState() const override {
+    return connection_state_;
+  }
+  std::string GetCloudId() const override { return "TestCloudId"; }
+  std::string GetOAuthUrl() const override { return "https://oauths/"; }
+  std::string GetServiceUrl() const override { return "https://service/"; }
+  std::string GetXmppEndpoint() const override { return "xmpp:678"; }
+};
+
+class InfoSecurityDelegate : public MockSecurityDelegate {
+ public:
+  std::string CreateSessionId() override { return "SessionId"; }
+};
+
+class InfoWifiDelegate : public MockWifiDelegate {
+ public:
+  const ConnectionState& GetConnectionState() const override {
+    return connection_state_;
+  }
+  std::string GetCurrentlyConnectedSsid() const override { return "TestSsid"; }
+  std::string GetHostedSsid() const override { return ""; }
+  std::set<WifiType> GetTypes() const override { return {WifiType::kWifi24}; }
+};
+
 }  // namespace
 
 class PrivetHandlerTest : public testing::Test {
@@ -122,9 +158,32 @@ class PrivetHandlerTest : public testing::Test {
                             base::Bind(&PrivetHandlerTest::HandlerNoFound));
   }
 
+  void SubscribeToEvents(const PrivetHandler::EventCallback& callback) {
+    output_.Clear();
+    handler_->SubscribeToEvents("/privet/v3/events", auth_header_, callback,
+                                base::Bind(&PrivetHandlerTest::HandlerCallback,
+                                           base::Unretained(this)));
+  }
+
+  void InvalidateInfo() { handler_->InvalidateInfo(); }
+  void SetRejectLongPolls(bool reject) {
+    handler_->SetRejectLongPolls(reject);
+  }
+  size_t GetPendingUpdateRequestCount() const {
+    return handler_->GetMemoryUsage().count;
+  }
+  bool CanAcceptRequest() const {
+    return handler_->CanAcceptRequest(auth_header_);
+  }
+
   const base::DictionaryValue& GetResponse() const { return output_; }
   int GetResponseCount() const { return response_count_; }
 
+  void SetMetrics(Metrics* metrics) {
+    handler_.reset(new PrivetHandler(&cloud_, &device_, &security_, &wifi_,
+                                     &clock_, metrics));
+  }
+
   void SetNoWifiAndGcd() {
     handler_.reset(
         new PrivetHandler(&cloud_, &device_, &security_, nullptr, &clock_));
@@ -172,6 +231,29 @@ TEST_F(PrivetHandlerTest, UnknownApi) {
   HandleUnknownRequest("/privet/foo");
 }
 
+TEST_F(PrivetHandlerTest, UnknownApiMetrics) {
+  if (!kMetricsEnabled)
+    return;
+  Metrics metrics;
+  SetMetrics(&metrics);
+  HandleUnknownRequest("/privet/foo");
+  HandleUnknownRequest("/privet/bar");
+  HandleRequest("/privet/info", "{}");
+
+  // Requests to unknown paths are recorded under one label.
+  auto json = metrics.ToJson();
+  const base::DictionaryValue* histograms = nullptr;
+  ASSERT_TRUE(json->GetDictionary("histograms", &histograms));
+  std::set<std::string> labels;
+  for (base::DictionaryValue::Iterator it{*histograms}; !it.IsAtEnd();
+       it.Advance()) {
+    labels.insert(it.key());
+  }
+  EXPECT_EQ((std::set<std::string>{"privet_request /privet/info",
+                                   "privet_request unknown"}),
+            labels);
+}
+
 TEST_F(PrivetHandlerTest, InvalidFormat) {
   auth_header_ = "";
   EXPECT_PRED2(IsEqualError, CodeWithReason(400, "invalidFormat"),
@@ -205,6 +287,74 @@ TEST_F(PrivetHandlerTest, InvalidAuthScope) {
                HandleRequest("/privet/v3/setup/start", "{}"));
 }
 
+TEST_F(PrivetHandlerTest, BatchAuthScope) {
+  const base::DictionaryValue& output = HandleRequest(
+      "/privet/v3/batch",
+      R"({"calls": [{"api": "/privet/info"}, {"api": "/privet/v3/traits"}]})");
+  const base::ListValue* results = nullptr;
+  ASSERT_TRUE(output.GetList("results", &results));
+  ASSERT_EQ(2u, results->GetSize());
+  const base::DictionaryValue* result = nullptr;
+  int status = 0;
+  ASSERT_TRUE(results->GetDictionary(0, &result));
+  EXPECT_TRUE(result->GetInteger("status", &status));
+  EXPECT_EQ(200, status);
+  ASSERT_TRUE(results->GetDictionary(1, &result));
+  EXPECT_TRUE(result->GetInteger("status", &status));
+  EXPECT_EQ(403, status);
+}
+
+TEST_F(PrivetHandlerTest, RateLimit) {
+  for (int i = 0; i < 20; i++) {
+    EXPECT_PRED2(IsEqualError,
+                 CodeWithReason(403, "invalidAuthorizationScope"),
+                 HandleRequest("/privet/v3/setup/start", "{}"));
+  }
+  EXPECT_FALSE(CanAcceptRequest());
+  EXPECT_PRED2(IsEqualError, CodeWithReason(503, "deviceBusy"),
+               HandleRequest("/privet/v3/setup/start", "{}"));
+
+  // Anonymous and unverified requests share the limit.
+  auth_header_ = "";
+  EXPECT_FALSE(CanAcceptRequest());
+  EXPECT_PRED2(IsEqualError, CodeWithReason(503, "deviceBusy"),
+               HandleRequest("/privet/v3/setup/start", "{}"));
+
+  // Verified users have their own.
+  auth_header_ = "Privet 123";
+  EXPECT_TRUE(CanAcceptRequest());
+  EXPECT_PRED2(IsEqualError, CodeWithReason(400, "invalidParams"),
+               HandleRequest("/privet/v3/commands/cancel", "{}"));
+
+  auth_header_ = "Privet anonymous";
+  EXPECT_CALL(clock_, Now())
+      .WillRepeatedly(Return(base::Time::FromTimeT(1410000002)));
+  for (int i = 0; i < 10; i++) {
+    EXPECT_PRED2(IsEqualError,
+                 CodeWithReason(403, "invalidAuthorizationScope"),
+                 HandleRequest("/privet/v3/setup/start", "{}"));
+  }
+  EXPECT_PRED2(IsEqualError, CodeWithReason(503, "deviceBusy"),
+               HandleRequest("/privet/v3/setup/start", "{}"));
+}
+
+TEST_F(PrivetHandlerTest, RateLimitRotatedHeaders) {
+  EXPECT_CALL(security_, ParseAccessToken(_, _, _))
+      .WillRepeatedly(WithArgs<2>(Invoke([](ErrorPtr* error) {
+        return Error::AddTo(error, FROM_HERE, "invalidAuthorization", "");
+      })));
+  // A new header doesn't get a new limit until it is verified.
+  for (int i = 0; i < 20; i++) {
+    auth_header_ = "Privet junk" + std::to_string(i);
+    EXPECT_PRED2(IsEqualError, CodeWithReason(401, "invalidAuthorization"),
+                 HandleRequest("/privet/info", "{}"));
+  }
+  auth_header_ = "Privet junk20";
+  EXPECT_FALSE(CanAcceptRequest());
+  EXPECT_PRED2(IsEqualError, CodeWithReason(503, "deviceBusy"),
+               HandleRequest("/privet/info", "{}"));
+}
+
 TEST_F(PrivetHandlerTest, InfoMinimal) {
   SetNoWifiAndGcd();
   EXPECT_CALL(security_, GetPairingTypes())
@@ -319,6 +469,52 @@ TEST_F(PrivetHandlerTest, Info) {
   EXPECT_JSON_EQ(kExpected, HandleRequest("/privet/info", "{}"));
 }
 
+TEST_F(PrivetHandlerTest, InfoCached) {
+  EXPECT_CALL(cloud_, GetDescription())
+      .WillRepeatedly(Return("TestDescription"));
+  std::string description;
+  EXPECT_TRUE(HandleRequest("/privet/info", "{}")
+                  .GetString("description", &description));
+  EXPECT_EQ("TestDescription", description);
+
+  // Settings are read again only after the invalidation, but the time is
+  // always current.
+  EXPECT_CALL(cloud_, GetDescription())
+      .WillRepeatedly(Return("NewDescription"));
+  EXPECT_CALL(clock_, Now())
+      .WillRepeatedly(Return(base::Time::FromTimeT(1420000000)));
+  const base::DictionaryValue& cached = HandleRequest("/privet/info", "{}");
+  EXPECT_TRUE(cached.GetString("description", &description));
+  EXPECT_EQ("TestDescription", description);
+  double time = 0;
+  EXPECT_TRUE(cached.GetDouble("time", &time));
+  EXPECT_EQ(1420000000000.0, time);
+
+  InvalidateInfo();
+  EXPECT_TRUE(HandleRequest("/privet/info", "{}")
+                  .GetString("description", &description));
+  EXPECT_EQ("NewDescription", description);
+}
+
+TEST(PrivetHandlerAllocationTest, HandleInfo) {
+  FixedClock clock;
+  InfoCloudDelegate cloud;
+  MockDeviceDelegate device;
+  InfoSecurityDelegate security;
+  InfoWifiDelegate wifi;
+  PrivetHandler handler{&cloud, &device, &security, &wifi, &clock};
+  base::DictionaryValue input;
+  // The reply isn't copied, unlike by HandleRequest() of the fixture.
+  PrivetHandler::RequestCallback callback =
+      base::Bind([](int status, const base::DictionaryValue& output) {});
+  handler.HandleRequest("/privet/info", "Privet anonymous", &input, callback);
+
+  test::AllocationCounter counter;
+  handler.HandleRequest("/privet/info", "Privet anonymous", &input, callback);
+  // The wifi and gcd sections are rebuilt, the rest of the info is cached.
+  EXPECT_LE(counter.GetCount(), 30u);
+}
+
 TEST_F(PrivetHandlerTest, PairingStartInvalidParams) {
   EXPECT_PRED2(
       IsEqualError, CodeWithReason(400, "invalidParams"),
@@ -427,6 +623,54 @@ TEST_F(PrivetHandlerTest, AuthPairing) {
   EXPECT_JSON_EQ(kExpected, HandleRequest("/privet/v3/auth", kInput));
 }
 
+TEST_F(PrivetHandlerTest, AuthPairingResumeTicket) {
+  EXPECT_CALL(security_,
+              CreateAccessToken(AuthType::kPairing, _, _, _, _, _, _))
+      .WillOnce(DoAll(SetArgPointee<3>("OwnerAccessToken"),
+                      SetArgPointee<4>(AuthScope::kOwner),
+                      SetArgPointee<5>(base::TimeDelta::FromSeconds(15)),
+                      Return(true)));
+  EXPECT_CALL(security_, CreateResumeTicket("OwnerAccessToken", _))
+      .WillOnce(Return("OwnerTicket"));
+  const char kInput[] = R"({
+    "mode": "pairing",
+    "requestedScope": "owner",
+    "authCode": "testToken"
+  })";
+  const char kExpected[] = R"({
+    "accessToken": "OwnerAccessToken",
+    "expiresIn": 15,
+    "resumeTicket": "OwnerTicket",
+    "scope": "owner",
+    "tokenType": "Privet"
+  })";
+  EXPECT_JSON_EQ(kExpected, HandleRequest("/privet/v3/auth", kInput));
+
+  EXPECT_CALL(security_, CreateAccessToken(AuthType::kResume, "OwnerTicket",
+                                           _, _, _, _, _))
+      .WillOnce(DoAll(SetArgPointee<3>("ResumedAccessToken"),
+                      SetArgPointee<4>(AuthScope::kOwner),
+                      SetArgPointee<5>(base::TimeDelta::FromSeconds(15)),
+                      Return(true)));
+  // Tickets are single use, so the resumed token comes with a new one.
+  EXPECT_CALL(security_, CreateResumeTicket("ResumedAccessToken", _))
+      .WillOnce(Return("NextTicket"));
+  const char kResumeInput[] = R"({
+    "mode": "resume",
+    "requestedScope": "owner",
+    "authCode": "OwnerTicket"
+  })";
+  const char kResumeExpected[] = R"({
+    "accessToken": "ResumedAccessToken",
+    "expiresIn": 15,
+    "resumeTicket": "NextTicket",
+    "scope": "owner",
+    "tokenType": "Privet"
+  })";
+  EXPECT_JSON_EQ(kResumeExpected,
+                 HandleRequest("/privet/v3/auth", kResumeInput));
+}
+
 TEST_F(PrivetHandlerTest, AuthLocalAuto) {
   EXPECT_CALL(security_, CreateAccessToken(_, _, _, _, _, _, _))
       .WillRepeatedly(DoAll(SetArgPointee<3>("UserAccessToken"),
@@ -785,6 +1029,96 @@ TEST_F(PrivetHandlerTestWithAuth, Components) {
                  HandleRequest("/privet/v3/components", "{}"));
 }
 
+TEST_F(PrivetHandlerTestWithAuth, Batch) {
+  const base::DictionaryValue& output = HandleRequest(
+      "/privet/v3/batch", R"({"calls": [
+        {"api": "/privet/v3/traits"},
+        {"api": "/privet/v3/components", "input": {"filter": ["traits"]}},
+        {"api": "/privet/foo"},
+        {"api": "/privet/v3/batch", "input": {"calls": []}}
+      ]})");
+  EXPECT_EQ(1, GetResponseCount());
+  const base::ListValue* results = nullptr;
+  ASSERT_TRUE(output.GetList("results", &results));
+  ASSERT_EQ(4u, results->GetSize());
+
+  const base::DictionaryValue* result = nullptr;
+  ASSERT_TRUE(results->GetDictionary(0, &result));
+  EXPECT_JSON_EQ(R"({"status": 200, "output": {
+    "traits": {"test": {}}, "fingerprint": "1"
+  }})", *result);
+  ASSERT_TRUE(results->GetDictionary(1, &result));
+  EXPECT_JSON_EQ(R"({"status": 200, "output": {
+    "components": {"test": {}}, "fingerprint": "1"
+  }})", *result);
+
+  // Failed calls don't fail the others.
+  int status = 0;
+  std::string reason;
+  ASSERT_TRUE(results->GetDictionary(2, &result));
+  EXPECT_TRUE(result->GetInteger("status", &status));
+  EXPECT_EQ(404, status);
+  EXPECT_TRUE(result->GetString("output.error.code", &reason));
+  EXPECT_EQ("notFound", reason);
+  ASSERT_TRUE(results->GetDictionary(3, &result));
+  EXPECT_TRUE(result->GetInteger("status", &status));
+  EXPECT_EQ(404, status);
+}
+
+TEST_F(PrivetHandlerTestWithAuth, BatchInvalidCalls) {
+  EXPECT_PRED2(IsEqualError, CodeWithReason(400, "invalidParams"),
+               HandleRequest("/privet/v3/batch", "{}"));
+  EXPECT_PRED2(IsEqualError, CodeWithReason(400, "invalidParams"),
+               HandleRequest("/privet/v3/batch", R"({"calls": []})"));
+}
+
+TEST_F(PrivetHandlerTestWithAuth, ComponentsPatch) {
+  base::DictionaryValue components;
+  LoadTestJson(R"({
+    "comp1": {"traits": ["a"], "state": {"a": {"p1": 1, "p2": [1]}}},
+    "comp2": {"traits": ["b"]}
+  })", &components);
+  EXPECT_CALL(cloud_, MockGetComponentsForUser(_))
+      .WillRepeatedly(ReturnRef(components));
+  HandleRequest("/privet/v3/components", "{}");
+
+  components.Clear();
+  LoadTestJson(R"({
+    "comp1": {"traits": ["a"], "state": {"a": {"p1": 2, "p2": [1]}}},
+    "comp3": {"traits": ["c"]}
+  })", &components);
+  cloud_.NotifyOnStateChanged();
+
+  const char kExpected[] = R"({
+    "componentsPatch": {
+      "comp1": {"state": {"a": {"p1": 2}}},
+      "comp2": null,
+      "comp3": {"traits": ["c"]}
+    },
+    "fingerprint": "2"
+  })";
+  EXPECT_JSON_EQ(kExpected, HandleRequest("/privet/v3/components",
+                                          R"({"fingerprint": "1"})"));
+  EXPECT_JSON_EQ(
+      R"({"componentsPatch": {"comp1": {"state": {"a": {"p1": 2}}},
+                              "comp2": null, "comp3": {}},
+          "fingerprint": "2"})",
+      HandleRequest("/privet/v3/components",
+                    R"({"fingerprint": "1", "filter": ["state"]})"));
+
+  // Unknown fingerprints get the whole tree.
+  EXPECT_JSON_EQ(R"({"components": {
+                       "comp1": {"traits": ["a"],
+                                 "state": {"a": {"p1": 2, "p2": [1]}}},
+                       "comp3": {"traits": ["c"]}
+                     }, "fingerprint": "2"})",
+                 HandleRequest("/privet/v3/components",
+                               R"({"fingerprint": "5"})"));
+  EXPECT_JSON_EQ(R"({"componentsPatch": {}, "fingerprint": "2"})",
+                 HandleRequest("/privet/v3/components",
+                               R"({"fingerprint": "2"})"));
+}
+
 TEST_F(PrivetHandlerTestWithAuth, ComponentsWithFiltersAndPaths) {
   const char kComponents[] = R"({
     "comp1": {
@@ -811,7 +1145,6 @@ TEST_F(PrivetHandlerTestWithAuth, ComponentsWithFiltersAndPaths) {
   })";
   base::DictionaryValue components;
   LoadTestJson(kComponents, &components);
-  EXPECT_CALL(cloud_, FindComponent(_, _)).WillRepeatedly(Return(nullptr));
   EXPECT_CALL(cloud_, MockGetComponentsForUser(_))
       .WillRepeatedly(ReturnRef(components));
   const char kExpected1[] = R"({
@@ -889,9 +1222,20 @@ TEST_F(PrivetHandlerTestWithAuth, ComponentsWithFiltersAndPaths) {
       HandleRequest("/privet/v3/components",
                     R"({"filter":["traits", "components", "state"]})"));
 
-  const base::DictionaryValue* comp2 = nullptr;
-  ASSERT_TRUE(components.GetDictionary("comp1.components.comp2", &comp2));
-  EXPECT_CALL(cloud_, FindComponent("comp1.comp2", _)).WillOnce(Return(comp2));
+  // Selection of a component is done by the cloud delegate.
+  const char kComp2[] = R"({
+    "traits": ["c"],
+    "components": {
+      "comp4": {
+        "traits": ["d"]
+      }
+    }
+  })";
+  base::DictionaryValue comp2;
+  LoadTestJson(kComp2, &comp2);
+  const std::set<std::string> kFields{"traits", "components"};
+  EXPECT_CALL(cloud_, MockGetComponentForUser(_, "comp1.comp2", kFields, _))
+      .WillOnce(Return(comp2.DeepCopy()));
 
   const char kExpected5[] = R"({
     "components": {
@@ -912,11 +1256,11 @@ TEST_F(PrivetHandlerTestWithAuth, ComponentsWithFiltersAndPaths) {
           "/privet/v3/components",
           R"({"path":"comp1.comp2", "filter":["traits", "components"]})"));
 
-  auto error_handler = [](ErrorPtr* error) -> const base::DictionaryValue* {
+  auto error_handler = [](ErrorPtr* error) -> base::DictionaryValue* {
     return Error::AddTo(error, FROM_HERE, "componentNotFound", "");
   };
-  EXPECT_CALL(cloud_, FindComponent("comp7", _))
-      .WillOnce(WithArgs<1>(Invoke(error_handler)));
+  EXPECT_CALL(cloud_, MockGetComponentForUser(_, "comp7", _, _))
+      .WillOnce(WithArgs<3>(Invoke(error_handler)));
 
   EXPECT_PRED2(
       IsEqualError, CodeWithReason(500, "componentNotFound"),
@@ -939,6 +1283,35 @@ TEST_F(PrivetHandlerTestWithAuth, CommandsExecute) {
                  HandleRequest("/privet/v3/commands/execute", kInput));
 }
 
+TEST_F(PrivetHandlerTestWithAuth, CommandsExecuteAndWait) {
+  EXPECT_CALL(device_, GetHttpRequestTimeout())
+      .WillOnce(Return(base::TimeDelta::Max()));
+  base::DictionaryValue command;
+  LoadTestJson(R"({"name": "test", "id": "5"})", &command);
+  EXPECT_CALL(cloud_, AddCommand(_, _, _))
+      .WillOnce(Invoke([&command](
+          const base::DictionaryValue& input, const UserInfo& user_info,
+          const CloudDelegate::CommandDoneCallback& callback) {
+        EXPECT_JSON_EQ(R"({"name": "test"})", input);
+        callback.Run(command, nullptr);
+      }));
+  CloudDelegate::CommandDoneCallback done_callback;
+  EXPECT_CALL(cloud_, WaitForCommand("5", _, base::TimeDelta::FromSeconds(3),
+                                     _))
+      .WillOnce(SaveArg<3>(&done_callback));
+
+  const char kInput[] =
+      R"({"name": "test", "waitForCompletion": true, "waitTimeout": 3})";
+  EXPECT_JSON_EQ("{}", HandleRequest("/privet/v3/commands/execute", kInput));
+  EXPECT_EQ(0, GetResponseCount());
+
+  LoadTestJson(R"({"state": "done"})", &command);
+  done_callback.Run(command, nullptr);
+  EXPECT_EQ(1, GetResponseCount());
+  EXPECT_JSON_EQ(R"({"name": "test", "id": "5", "state": "done"})",
+                 GetResponse());
+}
+
 TEST_F(PrivetHandlerTestWithAuth, CommandsStatus) {
   const char kInput[] = R"({"id": "5"})";
   base::DictionaryValue command;
@@ -990,6 +1363,63 @@ TEST_F(PrivetHandlerTestWithAuth, CommandsCancel) {
                HandleRequest("/privet/v3/commands/cancel", R"({"id": "11"})"));
 }
 
+TEST_F(PrivetHandlerTestWithAuth, CommandsStatusMultipleIds) {
+  EXPECT_CALL(cloud_, GetCommand(_, _, _))
+      .WillRepeatedly(Invoke([](const std::string& id, const UserInfo&,
+                                const CloudDelegate::CommandDoneCallback&
+                                    callback) {
+        if (id == "7") {
+          ErrorPtr error;
+          Error::AddTo(&error, FROM_HERE, "notFound", "");
+          return callback.Run({}, std::move(error));
+        }
+        base::DictionaryValue command;
+        command.SetString("id", id);
+        command.SetString("state", "inProgress");
+        callback.Run(command, nullptr);
+      }));
+
+  const base::DictionaryValue& output = HandleRequest(
+      "/privet/v3/commands/status", R"({"ids": ["5", "7", "6"]})");
+  const base::ListValue* commands = nullptr;
+  ASSERT_TRUE(output.GetList("commands", &commands));
+  ASSERT_EQ(3u, commands->GetSize());
+  const base::DictionaryValue* command = nullptr;
+  ASSERT_TRUE(commands->GetDictionary(0, &command));
+  EXPECT_JSON_EQ(R"({"id": "5", "state": "inProgress"})", *command);
+  ASSERT_TRUE(commands->GetDictionary(1, &command));
+  std::string value;
+  EXPECT_TRUE(command->GetString("id", &value));
+  EXPECT_EQ("7", value);
+  EXPECT_TRUE(command->GetString("error.code", &value));
+  EXPECT_EQ("notFound", value);
+  ASSERT_TRUE(commands->GetDictionary(2, &command));
+  EXPECT_JSON_EQ(R"({"id": "6", "state": "inProgress"})", *command);
+
+  EXPECT_PRED2(IsEqualError, CodeWithReason(400, "invalidParams"),
+               HandleRequest("/privet/v3/commands/status", R"({"ids": []})"));
+  EXPECT_PRED2(IsEqualError, CodeWithReason(400, "invalidParams"),
+               HandleRequest("/privet/v3/commands/status", R"({"ids": [5]})"));
+}
+
+TEST_F(PrivetHandlerTestWithAuth, CommandsCancelMultipleIds) {
+  EXPECT_CALL(cloud_, CancelCommand(_, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([](const std::string& id, const UserInfo&,
+                                const CloudDelegate::CommandDoneCallback&
+                                    callback) {
+        base::DictionaryValue command;
+        command.SetString("id", id);
+        command.SetString("state", "cancelled");
+        callback.Run(command, nullptr);
+      }));
+
+  EXPECT_JSON_EQ(R"({"commands": [
+    {"id": "5", "state": "cancelled"},
+    {"id": "8", "state": "cancelled"}
+  ]})", HandleRequest("/privet/v3/commands/cancel", R"({"ids": ["5", "8"]})"));
+}
+
 TEST_F(PrivetHandlerTestWithAuth, CommandsList) {
   const char kExpected[] = R"({
     "commands" : [
@@ -1000,8 +1430,8 @@ TEST_F(PrivetHandlerTestWithAuth, CommandsList) {
   base::DictionaryValue commands;
   LoadTestJson(kExpected, &commands);
 
-  EXPECT_CALL(cloud_, ListCommands(_, _))
-      .WillOnce(WithArgs<1>(Invoke(
+  EXPECT_CALL(cloud_, ListCommands(_, "", 0u, _))
+      .WillOnce(WithArgs<3>(Invoke(
           [&commands](const CloudDelegate::CommandDoneCallback& callback) {
             callback.Run(commands, nullptr);
           })));
@@ -1009,6 +1439,28 @@ TEST_F(PrivetHandlerTestWithAuth, CommandsList) {
   EXPECT_JSON_EQ(kExpected, HandleRequest("/privet/v3/commands/list", "{}"));
 }
 
+TEST_F(PrivetHandlerTestWithAuth, CommandsListPage) {
+  const char kExpected[] = R"({
+    "commands" : [{"id":"15", "state":"inProgress"}],
+    "nextSinceId": "15"
+  })";
+  base::DictionaryValue commands;
+  LoadTestJson(kExpected, &commands);
+
+  EXPECT_CALL(cloud_, ListCommands(_, "5", 1u, _))
+      .WillOnce(WithArgs<3>(Invoke(
+          [&commands](const CloudDelegate::CommandDoneCallback& callback) {
+            callback.Run(commands, nullptr);
+          })));
+  EXPECT_JSON_EQ(kExpected,
+                 HandleRequest("/privet/v3/commands/list",
+                               R"({"sinceId": "5", "maxResults": 1})"));
+
+  EXPECT_PRED2(IsEqualError, CodeWithReason(400, "invalidParams"),
+               HandleRequest("/privet/v3/commands/list",
+                             R"({"maxResults": -1})"));
+}
+
 class PrivetHandlerCheckForUpdatesTest : public PrivetHandlerTestWithAuth {};
 
 TEST_F(PrivetHandlerCheckForUpdatesTest, NoInput) {
@@ -1074,6 +1526,45 @@ TEST_F(PrivetHandlerCheckForUpdatesTest, LongPollCommands) {
   EXPECT_JSON_EQ(kExpected, GetResponse());
 }
 
+TEST_F(PrivetHandlerCheckForUpdatesTest, RejectLongPolls) {
+  EXPECT_CALL(device_, GetHttpRequestTimeout())
+      .WillRepeatedly(Return(base::TimeDelta::Max()));
+  const char kInput[] = R"({
+   "commandsFingerprint": "1",
+   "stateFingerprint": "1",
+   "traitsFingerprint": "1",
+   "componentsFingerprint": "1"
+  })";
+  EXPECT_JSON_EQ("{}", HandleRequest("/privet/v3/checkForUpdates", kInput));
+  EXPECT_EQ(1u, GetPendingUpdateRequestCount());
+
+  SetRejectLongPolls(true);
+  EXPECT_PRED2(IsEqualError, CodeWithReason(503, "deviceBusy"),
+               HandleRequest("/privet/v3/checkForUpdates", kInput));
+  EXPECT_EQ(1u, GetPendingUpdateRequestCount());
+
+  // The pending request is still answered, and requests which don't have to
+  // wait are served.
+  cloud_.NotifyOnStateChanged();
+  EXPECT_EQ(0u, GetPendingUpdateRequestCount());
+  EXPECT_JSON_EQ(R"({
+   "commandsFingerprint": "1",
+   "stateFingerprint": "2",
+   "traitsFingerprint": "1",
+   "componentsFingerprint": "2"
+  })", HandleRequest("/privet/v3/checkForUpdates", kInput));
+
+  SetRejectLongPolls(false);
+  const char kNewInput[] = R"({
+   "commandsFingerprint": "1",
+   "stateFingerprint": "2",
+   "traitsFingerprint": "1",
+   "componentsFingerprint": "2"
+  })";
+  EXPECT_JSON_EQ("{}", HandleRequest("/privet/v3/checkForUpdates", kNewInput));
+  EXPECT_EQ(1u, GetPendingUpdateRequestCount());
+}
+
 TEST_F(PrivetHandlerCheckForUpdatesTest, LongPollTraits) {
   EXPECT_CALL(device_, GetHttpRequestTimeout())
       .WillOnce(Return(base::TimeDelta::Max()));
@@ -1140,6 +1631,26 @@ TEST_F(PrivetHandlerCheckForUpdatesTest, LongPollComponents) {
   EXPECT_JSON_EQ(kExpected, GetResponse());
 }
 
+TEST_F(PrivetHandlerCheckForUpdatesTest, LongPollUnchangedContent) {
+  EXPECT_CALL(device_, GetHttpRequestTimeout())
+      .WillOnce(Return(base::TimeDelta::Max()));
+  const char kInput[] = R"({
+   "commandsFingerprint": "1",
+   "stateFingerprint": "1",
+   "traitsFingerprint": "1",
+   "componentsFingerprint": "1"
+  })";
+  EXPECT_JSON_EQ("{}", HandleRequest("/privet/v3/checkForUpdates", kInput));
+  // Notifications which leave the fingerprints as they are, e.g. for a
+  // property set to its current value, don't wake the request up.
+  cloud_.on_traits_changed_.Run();
+  cloud_.on_state_changed_.Run();
+  cloud_.on_components_changed_.Run();
+  EXPECT_EQ(0, GetResponseCount());
+  cloud_.NotifyOnStateChanged();
+  EXPECT_EQ(1, GetResponseCount());
+}
+
 TEST_F(PrivetHandlerCheckForUpdatesTest, LongPollIgnoreTraits) {
   EXPECT_CALL(device_, GetHttpRequestTimeout())
       .WillOnce(Return(base::TimeDelta::Max()));
@@ -1324,5 +1835,228 @@ TEST_F(PrivetHandlerCheckForUpdatesTest, ChangeBeforeTimeout) {
   EXPECT_EQ(1, GetResponseCount());
 }
 
+TEST_F(PrivetHandlerCheckForUpdatesTest, WaitersShareTimeout) {
+  EXPECT_CALL(device_, GetHttpRequestTimeout())
+      .WillRepeatedly(Return(base::TimeDelta::Max()));
+  base::Closure callback;
+  EXPECT_CALL(device_, PostDelayedTask(_, _, base::TimeDelta::FromSeconds(10)))
+      .WillOnce(SaveArg<1>(&callback));
+  const char kTraitsInput[] = R"({
+   "traitsFingerprint": "1",
+   "waitTimeout": 10
+  })";
+  const char kStateInput[] = R"({
+   "stateFingerprint": "1",
+   "waitTimeout": 10
+  })";
+  HandleRequest("/privet/v3/checkForUpdates", kTraitsInput);
+  HandleRequest("/privet/v3/checkForUpdates", kStateInput);
+  HandleRequest("/privet/v3/checkForUpdates", kStateInput);
+  EXPECT_EQ(0, GetResponseCount());
+
+  cloud_.NotifyOnStateChanged();
+  EXPECT_EQ(2, GetResponseCount());
+  const char kExpected[] = R"({
+   "commandsFingerprint": "1",
+   "stateFingerprint": "2",
+   "traitsFingerprint": "1",
+   "componentsFingerprint": "2"
+  })";
+  EXPECT_JSON_EQ(kExpected, GetResponse());
+
+  callback.Run();
+  EXPECT_EQ(3, GetResponseCount());
+  cloud_.NotifyOnTraitDefsChanged();
+  EXPECT_EQ(3, GetResponseCount());
+}
+
+TEST_F(PrivetHandlerCheckForUpdatesTest, RequestsInFlightLimit) {
+  EXPECT_CALL(device_, GetHttpRequestTimeout())
+      .WillRepeatedly(Return(base::TimeDelta::Max()));
+  const char kInput[] = R"({"traitsFingerprint": "1"})";
+  for (int i = 0; i < 32; i++) {
+    // Stay within the rate limit.
+    EXPECT_CALL(clock_, Now())
+        .WillRepeatedly(Return(base::Time::FromTimeT(1410000001 + i)));
+    EXPECT_JSON_EQ("{}", HandleRequest("/privet/v3/checkForUpdates", kInput));
+  }
+  EXPECT_EQ(0, GetResponseCount());
+  EXPECT_FALSE(CanAcceptRequest());
+  EXPECT_PRED2(IsEqualError, CodeWithReason(503, "deviceBusy"),
+               HandleRequest("/privet/v3/checkForUpdates", kInput));
+  EXPECT_EQ(1, GetResponseCount());
+
+  cloud_.NotifyOnTraitDefsChanged();
+  EXPECT_EQ(33, GetResponseCount());
+  EXPECT_TRUE(CanAcceptRequest());
+}
+
+TEST_F(PrivetHandlerCheckForUpdatesTest, BatchCallsInFlight) {
+  EXPECT_CALL(device_, GetHttpRequestTimeout())
+      .WillRepeatedly(Return(base::TimeDelta::Max()));
+  auto batch_input = [](int calls) {
+    std::string input = R"({"calls": [)";
+    for (int i = 0; i < calls; i++) {
+      input += i ? "," : "";
+      input += R"({"api": "/privet/v3/checkForUpdates",
+                   "input": {"traitsFingerprint": "1"}})";
+    }
+    return input + "]}";
+  };
+  // The batch and each of its long polls are in flight.
+  HandleRequest("/privet/v3/batch", batch_input(16));
+  const char kInput[] = R"({"traitsFingerprint": "1"})";
+  for (int i = 0; i < 14; i++) {
+    EXPECT_CALL(clock_, Now())
+        .WillRepeatedly(Return(base::Time::FromTimeT(1410000001 + i)));
+    HandleRequest("/privet/v3/checkForUpdates", kInput);
+  }
+  EXPECT_EQ(0, GetResponseCount());
+  EXPECT_TRUE(CanAcceptRequest());
+
+  // The last slot is taken by the batch, so its calls are rejected.
+  const base::DictionaryValue& output =
+      HandleRequest("/privet/v3/batch", batch_input(2));
+  EXPECT_EQ(1, GetResponseCount());
+  const base::ListValue* results = nullptr;
+  ASSERT_TRUE(output.GetList("results", &results));
+  ASSERT_EQ(2u, results->GetSize());
+  for (size_t i = 0; i < results->GetSize(); i++) {
+    const base::DictionaryValue* result = nullptr;
+    int status = 0;
+    ASSERT_TRUE(results->GetDictionary(i, &result));
+    EXPECT_TRUE(result->GetInteger("status", &status));
+    EXPECT_EQ(503, status);
+  }
+
+  cloud_.NotifyOnTraitDefsChanged();
+  EXPECT_EQ(16, GetResponseCount());
+}
+
+class PrivetHandlerEventsTest : public PrivetHandlerTestWithAuth {
+ public:
+  bool OnEvent(const std::string& event, const base::DictionaryValue& data) {
+    events_.push_back(event);
+    event_data_.Clear();
+    event_data_.MergeDictionary(&data);
+    return connected_;
+  }
+
+ protected:
+  PrivetHandler::EventCallback GetEventCallback() {
+    return base::Bind(&PrivetHandlerEventsTest::OnEvent,
+                      base::Unretained(this));
+  }
+
+  std::vector<std::string> events_;
+  base::DictionaryValue event_data_;
+  bool connected_{true};
+};
+
+TEST_F(PrivetHandlerEventsTest, MissingAuth) {
+  auth_header_ = "";
+  SubscribeToEvents(GetEventCallback());
+  EXPECT_PRED2(IsEqualError, CodeWithReason(401, "missingAuthorization"),
+               GetResponse());
+  EXPECT_TRUE(events_.empty());
+}
+
+TEST_F(PrivetHandlerEventsTest, PushComponentsPatches) {
+  base::DictionaryValue components;
+  LoadTestJson(R"({"comp1": {"state": {"a": {"p1": 1, "p2": 1}}}})",
+               &components);
+  EXPECT_CALL(cloud_, MockGetComponentsForUser(_))
+      .WillRepeatedly(ReturnRef(components));
+  base::Closure ping;
+  EXPECT_CALL(device_, PostDelayedTask(_, _, base::TimeDelta::FromSeconds(30)))
+      .WillOnce(SaveArg<1>(&ping));
+  SubscribeToEvents(GetEventCallback());
+  EXPECT_EQ(std::vector<std::string>{"components"}, events_);
+  EXPECT_JSON_EQ(R"({
+    "components": {"comp1": {"state": {"a": {"p1": 1, "p2": 1}}}},
+    "fingerprint": "1"
+  })", event_data_);
+
+  // Changes are pushed together in a posted task.
+  base::Closure push;
+  EXPECT_CALL(device_, PostDelayedTask(_, _, base::TimeDelta{}))
+      .WillOnce(SaveArg<1>(&push));
+  components.SetInteger("comp1.state.a.p1", 2);
+  cloud_.NotifyOnStateChanged();
+  components.SetInteger("comp1.state.a.p2", 3);
+  cloud_.NotifyOnStateChanged();
+  EXPECT_EQ(1u, events_.size());
+  push.Run();
+  EXPECT_EQ((std::vector<std::string>{"components", "componentsPatch"}),
+            events_);
+  EXPECT_JSON_EQ(R"({
+    "componentsPatch": {"comp1": {"state": {"a": {"p1": 2, "p2": 3}}}},
+    "fingerprint": "3"
+  })", event_data_);
+
+  // Nothing is pushed if the visible tree has not changed.
+  EXPECT_CALL(device_, PostDelayedTask(_, _, base::TimeDelta{}))
+      .WillOnce(SaveArg<1>(&push));
+  cloud_.NotifyOnComponentTreeChanged();
+  push.Run();
+  EXPECT_EQ(2u, events_.size());
+
+  // Subscribers which have gone away are dropped.
+  connected_ = false;
+  ping.Run();
+  EXPECT_EQ("ping", events_.back());
+  cloud_.NotifyOnStateChanged();
+  EXPECT_EQ(3u, events_.size());
+}
+
+TEST_F(PrivetHandlerEventsTest, ExpiredAuthorization) {
+  base::DictionaryValue components;
+  EXPECT_CALL(cloud_, MockGetComponentsForUser(_))
+      .WillRepeatedly(ReturnRef(components));
+  base::Closure ping;
+  EXPECT_CALL(device_, PostDelayedTask(_, _, base::TimeDelta::FromSeconds(30)))
+      .WillOnce(SaveArg<1>(&ping));
+  SubscribeToEvents(GetEventCallback());
+  base::Closure push;
+  EXPECT_CALL(device_, PostDelayedTask(_, _, base::TimeDelta{}))
+      .WillOnce(SaveArg<1>(&push));
+  cloud_.NotifyOnStateChanged();
+
+  // The stream ends once the token has expired, without further events.
+  EXPECT_CALL(security_, ParseAccessToken(_, _, _))
+      .WillRepeatedly(WithArgs<2>(Invoke([](ErrorPtr* error) {
+        return Error::AddTo(error, FROM_HERE, "authorizationExpired", "");
+      })));
+  components.SetInteger("comp1.state.a.p1", 2);
+  push.Run();
+  ping.Run();
+  EXPECT_EQ(std::vector<std::string>{"components"}, events_);
+  cloud_.NotifyOnStateChanged();
+}
+
+TEST_F(PrivetHandlerEventsTest, TooManySubscribers) {
+  base::DictionaryValue components;
+  EXPECT_CALL(cloud_, MockGetComponentsForUser(_))
+      .WillRepeatedly(ReturnRef(components));
+  EXPECT_CALL(device_, PostDelayedTask(_, _, base::TimeDelta::FromSeconds(30)))
+      .Times(1);
+  SubscribeToEvents(GetEventCallback());
+  SubscribeToEvents(GetEventCallback());
+  EXPECT_EQ(2u, events_.size());
+
+  // A third stream of the same user is rejected, the others are kept.
+  SubscribeToEvents(GetEventCallback());
+  EXPECT_PRED2(IsEqualError, CodeWithReason(503, "deviceBusy"), GetResponse());
+  EXPECT_EQ(2u, events_.size());
+
+  // Other users still have their share.
+  EXPECT_CALL(security_, ParseAccessToken(_, _, _))
+      .WillRepeatedly(DoAll(
+          SetArgPointee<1>(UserInfo{AuthScope::kViewer, TestUserId{"2"}}),
+          Return(true)));
+  SubscribeToEvents(GetEventCallback());
+  EXPECT_EQ(3u, events_.size());
+}
+
 }  // namespace privet
 }  // namespace weave
@@ -4,6 +4,7 @@
 
 #include "src/privet/privet_manager.h"
 
+#include <algorithm>
 #include <memory>
 #include <set>
 #include <string>
@@ -18,9 +19,12 @@
 
 #include "src/bind_lambda.h"
 #include "src/component_manager.h"
+#include "src/data_encoding.h"
 #include "src/device_registration_info.h"
 #include "src/http_constants.h"
 #include "src/privet/auth_manager.h"
+#include "src/privet/ble_transport.h"
+#include "src/privet/cbor_encoding.h"
 #include "src/privet/cloud_delegate.h"
 #include "src/privet/constants.h"
 #include "src/privet/device_delegate.h"
@@ -28,6 +32,7 @@
 #include "src/privet/publisher.h"
 #include "src/streams.h"
 #include "src/string_utils.h"
+#include "src/utils.h"
 
 namespace weave {
 namespace privet {
@@ -37,8 +42,22 @@ using provider::Network;
 using provider::DnsServiceDiscovery;
 using provider::HttpServer;
 using provider::Wifi;
+using provider::Bluetooth;
 
-Manager::Manager(TaskRunner* task_runner) : task_runner_{task_runner} {}
+namespace {
+
+const char kEventsPath[] = "/privet/v3/events";
+// Replies smaller than this are sent uncompressed, since compression would
+// save little more than its own overhead.
+const size_t kMinCompressedReplySize = 512;
+// Compressed replies kept for repeated requests, e.g. of the traits and of
+// the components of apps starting up.
+const size_t kMaxCompressedReplies = 4;
+
+}  // namespace
+
+Manager::Manager(TaskRunner* task_runner, Metrics* metrics)
+    : task_runner_{task_runner}, metrics_{metrics} {}
 
 Manager::~Manager() {
   if (privet_handler_) {
@@ -49,6 +68,8 @@ Manager::~Manager() {
     for (const auto& path : privet_handler_->GetHttpPaths()) {
       http_server_->RemoveHttpRequestHandler(path);
     }
+
+    http_server_->RemoveHttpsRequestHandler(kEventsPath);
   }
 }
 
@@ -56,6 +77,7 @@ void Manager::Start(Network* network,
                     DnsServiceDiscovery* dns_sd,
                     HttpServer* http_server,
                     Wifi* wifi,
+                    Bluetooth* bluetooth,
                     AuthManager* auth_manager,
                     DeviceRegistrationInfo* device,
                     ComponentManager* component_manager) {
@@ -67,8 +89,8 @@ void Manager::Start(Network* network,
   device_ = DeviceDelegate::CreateDefault(
       task_runner_, http_server->GetHttpPort(), http_server->GetHttpsPort(),
       http_server->GetRequestTimeout());
-  cloud_ =
-      CloudDelegate::CreateDefault(task_runner_, device, component_manager);
+  cloud_ = CloudDelegate::CreateDefault(task_runner_, device,
+                                       component_manager, network);
 
   security_.reset(new SecurityManager(device->GetMutableConfig(), auth_manager,
                                       task_runner_));
@@ -84,12 +106,13 @@ void Manager::Start(Network* network,
 
   if (dns_sd) {
     publisher_.reset(new Publisher(device_.get(), cloud_.get(),
-                                   wifi_bootstrap_manager_.get(), dns_sd));
+                                   wifi_bootstrap_manager_.get(), dns_sd,
+                                   task_runner_));
   }
 
-  privet_handler_.reset(new PrivetHandler(cloud_.get(), device_.get(),
-                                          security_.get(),
-                                          wifi_bootstrap_manager_.get()));
+  privet_handler_.reset(new PrivetHandler(
+      cloud_.get(), device_.get(), security_.get(),
+      wifi_bootstrap_manager_.get(), nullptr, metrics_));
 
   for (const auto& path : privet_handler_->GetHttpPaths()) {
     http_server->AddHttpRequestHandler(
@@ -102,6 +125,12 @@ void Manager::Start(Network* network,
         path, base::Bind(&Manager::PrivetRequestHandler,
                          weak_ptr_factory_.GetWeakPtr()));
   }
+  http_server->AddHttpsRequestHandler(
+      kEventsPath, base::Bind(&Manager::PrivetEventsHandler,
+                              weak_ptr_factory_.GetWeakPtr()));
+
+  if (bluetooth)
+    ble_transport_.reset(new BleTransport{bluetooth, privet_handler_.get()});
 
   device->GetMutableConfig()->AddOnChangedCallback(base::Bind(
       &Manager::OnDeviceInfoChanged, weak_ptr_factory_.GetWeakPtr()));
@@ -119,29 +148,133 @@ void Manager::AddOnPairingChangedCallbacks(
   security_->RegisterPairingListeners(begin_callback, end_callback);
 }
 
+MemoryUsage Manager::GetMemoryUsage() const {
+  MemoryUsage usage;
+  if (privet_handler_)
+    usage = privet_handler_->GetMemoryUsage();
+  for (const auto& reply : compressed_replies_) {
+    usage.bytes += sizeof(reply) + EstimateMemoryUsage(reply.data) +
+                   EstimateMemoryUsage(reply.compressed);
+  }
+  return usage;
+}
+
+void Manager::DropCaches() {
+  if (privet_handler_)
+    privet_handler_->DropCaches();
+  compressed_replies_.clear();
+  compressed_replies_.shrink_to_fit();
+}
+
+void Manager::SetRejectLongPolls(bool reject) {
+  if (privet_handler_)
+    privet_handler_->SetRejectLongPolls(reject);
+}
+
+void Manager::SetInputLimits(const InputLimits& limits) {
+  input_limits_ = limits;
+}
+
 void Manager::OnDeviceInfoChanged(const weave::Settings&) {
   OnChanged();
 }
 
+namespace {
+
+// Whether the client of the request accepts CBOR replies, from the list of
+// media types in the Accept header, e.g. "application/cbor, */*;q=0.5".
+// Quality values are ignored, CBOR is preferred if it's listed at all.
+bool AcceptsCbor(const std::string& accept) {
+  for (StringTokenizer it{accept, ","}; !it.IsAtEnd(); it.Advance()) {
+    if (SplitPieceAtFirst(it.token(), ";", true).first == http::kCbor)
+      return true;
+  }
+  return false;
+}
+
+// Returns the content coding to compress a reply with, from the list in the
+// Accept-Encoding header, e.g. "gzip, deflate", or an empty string. Gzip is
+// preferred, and codings with "q=0" are refused.
+std::string SelectContentEncoding(const std::string& accept_encoding) {
+  bool accepts_deflate = false;
+  for (StringTokenizer it{accept_encoding, ","}; !it.IsAtEnd(); it.Advance()) {
+    auto coding = SplitPieceAtFirst(it.token(), ";", true);
+    auto param = SplitPieceAtFirst(coding.second, "=", true);
+    double quality = 1;
+    if (param.first == "q" &&
+        base::StringToDouble(param.second.as_string(), &quality) &&
+        quality <= 0) {
+      continue;
+    }
+    if (coding.first == http::kGzip)
+      return http::kGzip;
+    if (coding.first == http::kDeflate)
+      accepts_deflate = true;
+  }
+  return accepts_deflate ? http::kDeflate : std::string{};
+}
+
+// Sends a Privet event in the text/event-stream format. The reply is started
+// with the first event, so errors can still be sent as regular replies.
+bool SendEvent(const std::shared_ptr<HttpServer::Request>& request,
+               const std::shared_ptr<bool>& started,
+               const std::string& event,
+               const base::DictionaryValue& data) {
+  if (!*started) {
+    if (!request->BeginStreamingReply(http::kOk, http::kEventStream)) {
+      request->SendReply(http::kNotSupported, "Streaming is not supported",
+                         http::kPlain);
+      return false;
+    }
+    *started = true;
+  }
+  std::string json;
+  base::JSONWriter::Write(data, &json);
+  return request->SendReplyChunk("event: " + event + "\ndata: " + json +
+                                 "\n\n");
+}
+
+}  // namespace
+
 void Manager::PrivetRequestHandler(
     std::unique_ptr<provider::HttpServer::Request> req) {
   std::shared_ptr<provider::HttpServer::Request> request{std::move(req)};
 
-  std::string content_type =
-      SplitAtFirst(request->GetFirstHeader(http::kContentType), ";", true)
-          .first;
+  std::string header = request->GetFirstHeader(http::kContentType);
+  base::StringPiece content_type = SplitPieceAtFirst(header, ";", true).first;
 
-  return PrivetRequestHandlerWithData(request, content_type == http::kJson
-                                                   ? request->GetData()
-                                                   : std::string{});
+  // Payloads are JSON, or the same values in CBOR, which is more compact and
+  // does not need text parsing.
+  std::unique_ptr<base::Value> value;
+  bool cbor_reply = AcceptsCbor(request->GetFirstHeader(http::kAccept));
+  // Requests over the limits are rejected without looking at the payload.
+  if (!privet_handler_->CanAcceptRequest(
+          request->GetFirstHeader(http::kAuthorization))) {
+    value.reset(new base::DictionaryValue);
+  } else {
+    // The request is dropped once handled, so its nodes are freed at once.
+    base::ScopedValueArena arena;
+    if (content_type == http::kJson) {
+      value = base::JSONReader::ReadWithLimits(
+          request->TakeData(), base::JSON_PARSE_RFC,
+          GetJsonReaderLimits(input_limits_), nullptr, nullptr);
+    } else if (content_type == http::kCbor) {
+      std::string data = request->TakeData();
+      // DecodeCbor() limits the nesting itself.
+      if (!input_limits_.max_size || data.size() <= input_limits_.max_size)
+        value = DecodeCbor(data, nullptr);
+      cbor_reply = true;
+    }
+  }
+  PrivetRequestHandlerWithValue(request, std::move(value), cbor_reply);
 }
 
-void Manager::PrivetRequestHandlerWithData(
+void Manager::PrivetRequestHandlerWithValue(
     const std::shared_ptr<provider::HttpServer::Request>& request,
-    const std::string& data) {
+    std::unique_ptr<base::Value> value,
+    bool cbor_reply) {
   std::string auth_header = request->GetFirstHeader(http::kAuthorization);
   base::DictionaryValue empty;
-  auto value = base::JSONReader::Read(data);
   const base::DictionaryValue* dictionary = &empty;
   if (value)
     value->GetAsDictionary(&dictionary);
@@ -151,22 +284,72 @@ void Manager::PrivetRequestHandlerWithData(
   privet_handler_->HandleRequest(
       request->GetPath(), auth_header, dictionary,
       base::Bind(&Manager::PrivetResponseHandler,
-                 weak_ptr_factory_.GetWeakPtr(), request));
+                 weak_ptr_factory_.GetWeakPtr(), request, cbor_reply));
+}
+
+void Manager::PrivetEventsHandler(
+    std::unique_ptr<provider::HttpServer::Request> req) {
+  std::shared_ptr<provider::HttpServer::Request> request{std::move(req)};
+  privet_handler_->SubscribeToEvents(
+      request->GetPath(), request->GetFirstHeader(http::kAuthorization),
+      base::Bind(&SendEvent, request, std::make_shared<bool>(false)),
+      base::Bind(&Manager::PrivetResponseHandler,
+                 weak_ptr_factory_.GetWeakPtr(), request, false));
 }
 
 void Manager::PrivetResponseHandler(
     const std::shared_ptr<provider::HttpServer::Request>& request,
+    bool cbor_reply,
     int status,
     const base::DictionaryValue& output) {
   VLOG(3) << "status: " << status << ", Output: " << output;
+  if (cbor_reply)
+    return request->SendOwnedReply(status, EncodeCbor(output), http::kCbor);
   std::string data;
   base::JSONWriter::WriteWithOptions(
       output, base::JSONWriter::OPTIONS_PRETTY_PRINT, &data);
-  request->SendReply(status, data, http::kJson);
+  if (data.size() >= kMinCompressedReplySize) {
+    std::string encoding =
+        SelectContentEncoding(request->GetFirstHeader(http::kAcceptEncoding));
+    const std::string* compressed =
+        encoding.empty() ? nullptr : GetCompressedReply(data, encoding);
+    if (compressed &&
+        request->SendEncodedReply(status, *compressed, http::kJson, encoding)) {
+      return;
+    }
+  }
+  request->SendOwnedReply(status, std::move(data), http::kJson);
+}
+
+const std::string* Manager::GetCompressedReply(const std::string& data,
+                                               const std::string& encoding) {
+  auto it = std::find_if(compressed_replies_.begin(), compressed_replies_.end(),
+                         [&data, &encoding](const CompressedReply& reply) {
+                           return reply.encoding == encoding &&
+                                  reply.data == data;
+                         });
+  if (it != compressed_replies_.end()) {
+    // Keep the most recently used reply last.
+    std::rotate(it, std::next(it), compressed_replies_.end());
+    return &compressed_replies_.back().compressed;
+  }
+
+  CompressedReply reply{encoding, data, {}};
+  bool encoded = encoding == http::kGzip
+                     ? GzipEncode(data, &reply.compressed)
+                     : DeflateEncode(data, &reply.compressed);
+  if (!encoded)
+    return nullptr;
+  if (compressed_replies_.size() >= kMaxCompressedReplies)
+    compressed_replies_.pop_front();
+  compressed_replies_.push_back(std::move(reply));
+  return &compressed_replies_.back().compressed;
 }
 
 void Manager::OnChanged() {
   VLOG(1) << "Manager::OnChanged";
+  if (privet_handler_)
+    privet_handler_->InvalidateInfo();
   if (publisher_)
     publisher_->Update();
 }
@@ -5,6 +5,7 @@
 #ifndef LIBWEAVE_SRC_PRIVET_PRIVET_MANAGER_H_
 #define LIBWEAVE_SRC_PRIVET_PRIVET_MANAGER_H_
 
+#include <deque>
 #include <memory>
 #include <set>
 #include <string>
@@ -13,6 +14,7 @@
 #include <base/memory/weak_ptr.h>
 #include <weave/device.h>
 
+#include "src/memory_usage.h"
 #include "src/privet/cloud_delegate.h"
 #include "src/privet/security_manager.h"
 #include "src/privet/wifi_bootstrap_manager.h"
@@ -29,10 +31,12 @@ namespace weave {
 class ComponentManager;
 class DeviceRegistrationInfo;
 class DnsServiceDiscovery;
+class Metrics;
 class Network;
 
 namespace privet {
 
+class BleTransport;
 class CloudDelegate;
 class DaemonState;
 class DeviceDelegate;
@@ -42,13 +46,16 @@ class SecurityManager;
 
 class Manager {
  public:
-  explicit Manager(provider::TaskRunner* task_runner);
+  // |metrics| records the latency of Privet requests, it may be null.
+  explicit Manager(provider::TaskRunner* task_runner,
+                   Metrics* metrics = nullptr);
   ~Manager();
 
   void Start(provider::Network* network,
              provider::DnsServiceDiscovery* dns_sd,
              provider::HttpServer* http_server,
              provider::Wifi* wifi,
+             provider::Bluetooth* bluetooth,
              AuthManager* auth_manager,
              DeviceRegistrationInfo* device,
              ComponentManager* component_manager);
@@ -59,32 +66,63 @@ class Manager {
       const Device::PairingBeginCallback& begin_callback,
       const Device::PairingEndCallback& end_callback);
 
+  // See PrivetHandler.
+  MemoryUsage GetMemoryUsage() const;
+  void DropCaches();
+  void SetRejectLongPolls(bool reject);
+  // Limits of the request bodies, see Device::SetInputLimits().
+  void SetInputLimits(const InputLimits& limits);
+
  private:
   void OnDeviceInfoChanged(const weave::Settings&);
 
   void PrivetRequestHandler(
       std::unique_ptr<provider::HttpServer::Request> request);
 
-  void PrivetRequestHandlerWithData(
+  // |value| is the decoded body of the request, if any. |cbor_reply| selects
+  // CBOR instead of JSON for the reply.
+  void PrivetRequestHandlerWithValue(
       const std::shared_ptr<provider::HttpServer::Request>& request,
-      const std::string& data);
+      std::unique_ptr<base::Value> value,
+      bool cbor_reply);
+
+  // Streams events of /privet/v3/events as server-sent events.
+  void PrivetEventsHandler(
+      std::unique_ptr<provider::HttpServer::Request> request);
 
   void PrivetResponseHandler(
       const std::shared_ptr<provider::HttpServer::Request>& request,
+      bool cbor_reply,
       int status,
       const base::DictionaryValue& output);
 
+  // Returns |data| compressed with |encoding|, kept for repeated replies with
+  // the same body. Returns nullptr if it can't be compressed.
+  const std::string* GetCompressedReply(const std::string& data,
+                                        const std::string& encoding);
+
   void OnChanged();
   void OnConnectivityChanged();
 
   provider::TaskRunner* task_runner_{nullptr};
+  Metrics* metrics_{nullptr};
   provider::HttpServer* http_server_{nullptr};
+  InputLimits input_limits_;
   std::unique_ptr<CloudDelegate> cloud_;
   std::unique_ptr<DeviceDelegate> device_;
   std::unique_ptr<SecurityManager> security_;
   std::unique_ptr<WifiBootstrapManager> wifi_bootstrap_manager_;
   std::unique_ptr<Publisher> publisher_;
   std::unique_ptr<PrivetHandler> privet_handler_;
+  std::unique_ptr<BleTransport> ble_transport_;
+
+  // Recently sent compressed replies, the most recently used last.
+  struct CompressedReply {
+    std::string encoding;
+    std::string data;
+    std::string compressed;
+  };
+  std::deque<CompressedReply> compressed_replies_;
 
   base::WeakPtrFactory<Manager> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(Manager);
@@ -30,6 +30,7 @@ const EnumToStringMap<AuthType>::Map kAuthTypeMap[] = {
     {AuthType::kAnonymous, "anonymous"},
     {AuthType::kPairing, "pairing"},
     {AuthType::kLocal, "local"},
+    {AuthType::kResume, "resume"},
 };
 
 const EnumToStringMap<ConnectionState::Status>::Map kConnectionStateMap[] = {
@@ -23,6 +23,7 @@ enum class AuthType {
   kAnonymous,
   kPairing,
   kLocal,
+  kResume,
 };
 
 enum class WifiType {
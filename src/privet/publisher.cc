@@ -5,7 +5,9 @@
 #include "src/privet/publisher.h"
 
 #include <map>
+#include <tuple>
 
+#include <base/bind.h>
 #include <weave/error.h>
 #include <weave/provider/dns_service_discovery.h>
 
@@ -24,13 +26,21 @@ namespace {
 // The service type we'll expose via DNS-SD.
 const char kPrivetServiceType[] = "_privet._tcp";
 
+const int kMinRepublishIntervalSeconds = 1;
+
 }  // namespace
 
 Publisher::Publisher(const DeviceDelegate* device,
                      const CloudDelegate* cloud,
                      const WifiDelegate* wifi,
-                     provider::DnsServiceDiscovery* dns_sd)
-    : dns_sd_{dns_sd}, device_{device}, cloud_{cloud}, wifi_{wifi} {
+                     provider::DnsServiceDiscovery* dns_sd,
+                     provider::TaskRunner* task_runner)
+    : dns_sd_{dns_sd},
+      device_{device},
+      cloud_{cloud},
+      wifi_{wifi},
+      republish_timer_{task_runner,
+                       provider::TaskRunner::Priority::kBackground} {
   CHECK(device_);
   CHECK(cloud_);
   CHECK(dns_sd_);
@@ -41,51 +51,79 @@ Publisher::~Publisher() {
   RemoveService();
 }
 
+bool Publisher::Fields::operator==(const Fields& other) const {
+  return std::tie(port, https_port, name, model_id, device_id, flags, cloud_id,
+                  description) ==
+         std::tie(other.port, other.https_port, other.name, other.model_id,
+                  other.device_id, other.flags, other.cloud_id,
+                  other.description);
+}
+
 void Publisher::Update() {
   if (device_->GetHttpEnpoint().first == 0)
     return RemoveService();
+  if (republish_timer_.IsRunning()) {
+    update_pending_ = true;
+    return;
+  }
   ExposeService();
 }
 
-void Publisher::ExposeService() {
-  std::string name{cloud_->GetName()};
-  std::string model_id{cloud_->GetModelId()};
-  DCHECK_EQ(model_id.size(), 5U);
+void Publisher::OnRepublishTimer() {
+  if (!update_pending_)
+    return;
+  update_pending_ = false;
+  Update();
+}
 
+void Publisher::ExposeService() {
   VLOG(2) << "DNS-SD update requested";
-  const uint16_t port = device_->GetHttpEnpoint().first;
-  DCHECK_NE(port, 0);
+  Fields fields;
+  fields.port = device_->GetHttpEnpoint().first;
+  DCHECK_NE(fields.port, 0);
+  fields.https_port = device_->GetHttpsEnpoint().first;
+  fields.name = cloud_->GetName();
+  fields.model_id = cloud_->GetModelId();
+  DCHECK_EQ(fields.model_id.size(), 5U);
+  fields.device_id = cloud_->GetDeviceId();
+  fields.flags = WifiSsidGenerator{cloud_, wifi_}.GenerateFlags();
+  fields.cloud_id = cloud_->GetCloudId();
+  fields.description = cloud_->GetDescription();
+
+  // Nothing to rebuild if none of the sources changed.
+  if (published_ == fields)
+    return;
 
   std::vector<std::string> txt_record{
       {"txtvers=3"},
-      {"ty=" + name},
-      {"services=" + GetDeviceUiKind(model_id)},
-      {"id=" + cloud_->GetDeviceId()},
-      {"mmid=" + model_id},
-      {"flags=" + WifiSsidGenerator{cloud_, wifi_}.GenerateFlags()},
+      {"ty=" + fields.name},
+      {"services=" + GetDeviceUiKind(fields.model_id)},
+      {"id=" + fields.device_id},
+      {"mmid=" + fields.model_id},
+      {"flags=" + fields.flags},
   };
 
-  if (device_->GetHttpsEnpoint().first > 0)
-    txt_record.emplace_back("https=" +
-                            std::to_string(device_->GetHttpsEnpoint().first));
-
-  if (!cloud_->GetCloudId().empty())
-    txt_record.emplace_back("gcd_id=" + cloud_->GetCloudId());
+  if (fields.https_port > 0)
+    txt_record.emplace_back("https=" + std::to_string(fields.https_port));
 
-  if (!cloud_->GetDescription().empty())
-    txt_record.emplace_back("note=" + cloud_->GetDescription());
+  if (!fields.cloud_id.empty())
+    txt_record.emplace_back("gcd_id=" + fields.cloud_id);
 
-  auto new_data = std::make_pair(port, txt_record);
-  if (published_ == new_data)
-    return;
+  if (!fields.description.empty())
+    txt_record.emplace_back("note=" + fields.description);
 
-  VLOG(1) << "Updating service using DNS-SD, port: " << port;
-  published_ = new_data;
-  dns_sd_->PublishService(kPrivetServiceType, port, txt_record);
+  VLOG(1) << "Updating service using DNS-SD, port: " << fields.port;
+  published_ = std::move(fields);
+  dns_sd_->PublishService(kPrivetServiceType, published_.port, txt_record);
+  republish_timer_.Start(
+      FROM_HERE, base::TimeDelta::FromSeconds(kMinRepublishIntervalSeconds),
+      base::Bind(&Publisher::OnRepublishTimer, base::Unretained(this)));
 }
 
 void Publisher::RemoveService() {
-  if (!published_.first)
+  republish_timer_.Stop();
+  update_pending_ = false;
+  if (!published_.port)
     return;
   published_ = {};
   VLOG(1) << "Stopping service publishing";
@@ -11,10 +11,13 @@
 
 #include <base/macros.h>
 
+#include "src/timer.h"
+
 namespace weave {
 
 namespace provider {
 class DnsServiceDiscovery;
+class TaskRunner;
 }
 
 namespace privet {
@@ -29,15 +32,35 @@ class Publisher {
   Publisher(const DeviceDelegate* device,
             const CloudDelegate* cloud,
             const WifiDelegate* wifi,
-            provider::DnsServiceDiscovery* dns_sd);
+            provider::DnsServiceDiscovery* dns_sd,
+            provider::TaskRunner* task_runner);
   ~Publisher();
 
   // Updates published information.  Removes service if HTTP is not alive.
+  // Every publication is an announcement on the network, so the service is
+  // republished at most once a second. Changes made meanwhile are published
+  // together afterwards.
   void Update();
 
  private:
+  // Values the TXT record is built from.
+  struct Fields {
+    bool operator==(const Fields& other) const;
+    bool operator!=(const Fields& other) const { return !(*this == other); }
+
+    uint16_t port{0};
+    uint16_t https_port{0};
+    std::string name;
+    std::string model_id;
+    std::string device_id;
+    std::string flags;
+    std::string cloud_id;
+    std::string description;
+  };
+
   void ExposeService();
   void RemoveService();
+  void OnRepublishTimer();
 
   provider::DnsServiceDiscovery* dns_sd_{nullptr};
 
@@ -45,7 +68,10 @@ class Publisher {
   const CloudDelegate* cloud_{nullptr};
   const WifiDelegate* wifi_{nullptr};
 
-  std::pair<uint16_t, std::vector<std::string>> published_;
+  // |port| is 0 if the service is not published.
+  Fields published_;
+  OneShotTimer republish_timer_;
+  bool update_pending_{false};
 
   DISALLOW_COPY_AND_ASSIGN(Publisher);
 };
@@ -0,0 +1,90 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/privet/publisher.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
+#include <weave/provider/test/mock_dns_service_discovery.h>
+
+#include "src/privet/mock_delegates.h"
+
+using testing::_;
+using testing::Contains;
+using testing::Return;
+
+namespace weave {
+namespace privet {
+
+class PublisherTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    EXPECT_CALL(device_, GetHttpEnpoint())
+        .WillRepeatedly(Return(std::make_pair(8080, 0)));
+  }
+
+  void CreatePublisher() {
+    publisher_.reset(
+        new Publisher{&device_, &cloud_, nullptr, &dns_sd_, &task_runner_});
+  }
+
+  provider::test::FakeTaskRunner task_runner_;
+  provider::test::MockDnsServiceDiscovery dns_sd_;
+  testing::StrictMock<MockDeviceDelegate> device_;
+  testing::NiceMock<MockCloudDelegate> cloud_;
+  std::unique_ptr<Publisher> publisher_;
+};
+
+TEST_F(PublisherTest, SkipsUnchangedRecord) {
+  EXPECT_CALL(dns_sd_,
+              PublishService("_privet._tcp", 8080, Contains("ty=TestDevice")))
+      .Times(1);
+  CreatePublisher();
+  task_runner_.Run();
+  publisher_->Update();
+  publisher_->Update();
+
+  EXPECT_CALL(dns_sd_, StopPublishing("_privet._tcp"));
+  publisher_.reset();
+}
+
+TEST_F(PublisherTest, RateLimitsRepublishing) {
+  EXPECT_CALL(dns_sd_, PublishService(_, _, Contains("ty=TestDevice")));
+  CreatePublisher();
+  testing::Mock::VerifyAndClearExpectations(&dns_sd_);
+
+  EXPECT_CALL(cloud_, GetName()).WillRepeatedly(Return("Lamp"));
+  EXPECT_CALL(dns_sd_, PublishService(_, _, _)).Times(0);
+  publisher_->Update();
+  EXPECT_CALL(cloud_, GetName()).WillRepeatedly(Return("Kitchen"));
+  publisher_->Update();
+  testing::Mock::VerifyAndClearExpectations(&dns_sd_);
+
+  // Only the latest record is announced.
+  EXPECT_CALL(dns_sd_, PublishService(_, _, Contains("ty=Kitchen")));
+  task_runner_.Run();
+  testing::Mock::VerifyAndClearExpectations(&dns_sd_);
+
+  EXPECT_CALL(dns_sd_, StopPublishing("_privet._tcp"));
+  publisher_.reset();
+}
+
+TEST_F(PublisherTest, RemovesServiceImmediately) {
+  EXPECT_CALL(dns_sd_, PublishService(_, _, _));
+  CreatePublisher();
+
+  EXPECT_CALL(device_, GetHttpEnpoint())
+      .WillRepeatedly(Return(std::make_pair(0, 0)));
+  EXPECT_CALL(dns_sd_, StopPublishing("_privet._tcp"));
+  publisher_->Update();
+  testing::Mock::VerifyAndClearExpectations(&dns_sd_);
+
+  // Nothing is pending once the service is removed.
+  task_runner_.Run();
+  publisher_.reset();
+}
+
+}  // namespace privet
+}  // namespace weave
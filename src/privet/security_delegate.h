@@ -35,6 +35,11 @@ class SecurityDelegate {
                                 UserInfo* user_info,
                                 ErrorPtr* error) const = 0;
 
+  // Returns a ticket which can be exchanged once for a new access token of
+  // the same user with the AuthType::kResume mode, or empty string on error.
+  virtual std::string CreateResumeTicket(const std::string& access_token,
+                                         ErrorPtr* error) const = 0;
+
   // Returns list of pairing methods by device.
   virtual std::set<PairingType> GetPairingTypes() const = 0;
 
@@ -36,10 +36,14 @@ const int kMaxAllowedPairingAttemts = 3;
 const int kPairingBlockingTimeMinutes = 1;
 
 const int kAccessTokenExpirationSeconds = 3600;
+// Tickets are single use and renewed on every resume, so they don't need to
+// outlive the access token they come with.
+const int kResumeTicketExpirationSeconds = 3600;
 
 class Spakep224Exchanger : public SecurityManager::KeyExchanger {
  public:
-  explicit Spakep224Exchanger(const std::string& password)
+  explicit Spakep224Exchanger(
+      const crypto::P224EncryptedKeyExchange::Password& password)
       : spake_(crypto::P224EncryptedKeyExchange::kPeerTypeServer, password) {}
   ~Spakep224Exchanger() override = default;
 
@@ -79,11 +83,15 @@ SecurityManager::SecurityManager(const Config* config,
                      GetSettings().pairing_modes.end(),
                      PairingType::kEmbeddedCode) ==
                GetSettings().pairing_modes.end());
+  if (!GetSettings().embedded_code.empty()) {
+    embedded_code_password_.reset(
+        new crypto::P224EncryptedKeyExchange::Password(
+            GetSettings().embedded_code));
+  }
 }
 
 SecurityManager::~SecurityManager() {
-  while (!pending_sessions_.empty())
-    ClosePendingSession(pending_sessions_.begin()->first);
+  CloseAllPendingSessions();
 }
 
 bool SecurityManager::CreateAccessTokenImpl(AuthType auth_type,
@@ -139,7 +147,7 @@ bool SecurityManager::CreateAccessTokenImpl(
       }
       return CreateAccessTokenImpl(auth_type, desired_scope, access_token,
                                    access_token_scope, access_token_ttl);
-    case AuthType::kLocal:
+    case AuthType::kLocal: {
       if (!IsLocalAuthSupported())
         return disabled_mode(error);
       const base::TimeDelta kTtl =
@@ -149,6 +157,28 @@ bool SecurityManager::CreateAccessTokenImpl(
           error);
       *access_token_scope = std::min(*access_token_scope, desired_scope);
       return result;
+    }
+    case AuthType::kResume: {
+      if (!IsPairingAuthSupported() && !IsLocalAuthSupported())
+        return disabled_mode(error);
+      UserInfo user_info;
+      if (!auth_manager_->ParseResumeTicket(auth_code, &user_info, error)) {
+        return Error::AddTo(error, FROM_HERE, errors::kInvalidAuthCode,
+                            "Invalid resume ticket");
+      }
+      // The ticket keeps the user ID, so the client still owns its commands.
+      user_info = UserInfo{std::min(user_info.scope(), desired_scope),
+                           user_info.id()};
+      const base::TimeDelta kTtl =
+          base::TimeDelta::FromSeconds(kAccessTokenExpirationSeconds);
+      if (access_token)
+        *access_token = auth_manager_->CreateAccessToken(user_info, kTtl);
+      if (access_token_scope)
+        *access_token_scope = user_info.scope();
+      if (access_token_ttl)
+        *access_token_ttl = kTtl;
+      return true;
+    }
   }
 
   return Error::AddTo(error, FROM_HERE, errors::kInvalidAuthMode,
@@ -196,6 +226,18 @@ bool SecurityManager::ParseAccessToken(const std::string& token,
   return auth_manager_->ParseAccessToken(decoded, user_info, error);
 }
 
+std::string SecurityManager::CreateResumeTicket(const std::string& access_token,
+                                                ErrorPtr* error) const {
+  // Also puts the new access token into the cache of AuthManager, so it's
+  // not verified again on the first request which uses it.
+  UserInfo user_info;
+  if (!ParseAccessToken(access_token, &user_info, error))
+    return std::string();
+  return Base64Encode(auth_manager_->CreateResumeTicket(
+      user_info,
+      base::TimeDelta::FromSeconds(kResumeTicketExpirationSeconds)));
+}
+
 std::set<PairingType> SecurityManager::GetPairingTypes() const {
   return GetSettings().pairing_modes;
 }
@@ -216,6 +258,9 @@ std::set<AuthType> SecurityManager::GetAuthTypes() const {
   if (IsLocalAuthSupported())
     result.insert(AuthType::kLocal);
 
+  if (IsPairingAuthSupported() || IsLocalAuthSupported())
+    result.insert(AuthType::kResume);
+
   return result;
 }
 
@@ -241,9 +286,11 @@ const Config::Settings& SecurityManager::GetSettings() const {
 
 bool SecurityManager::IsValidPairingCode(
     const std::vector<uint8_t>& auth_code) const {
-  for (const auto& session : confirmed_sessions_) {
-    const std::string& key = session.second->GetKey();
-    const std::string& id = session.first;
+  for (const auto& session : sessions_) {
+    if (!session.confirmed)
+      continue;
+    const std::string& key = session.key_exchanger->GetKey();
+    const SessionId& id = session.id;
     if (auth_code == HmacSha256(std::vector<uint8_t>(key.begin(), key.end()),
                                 std::vector<uint8_t>(id.begin(), id.end()))) {
       pairing_attemts_ = 0;
@@ -287,7 +334,13 @@ bool SecurityManager::StartPairing(PairingType mode,
   std::unique_ptr<KeyExchanger> spake;
   switch (crypto) {
     case CryptoType::kSpake_p224:
-      spake.reset(new Spakep224Exchanger(code));
+      if (mode == PairingType::kEmbeddedCode) {
+        CHECK(embedded_code_password_);
+        spake.reset(new Spakep224Exchanger(*embedded_code_password_));
+      } else {
+        spake.reset(new Spakep224Exchanger(
+            crypto::P224EncryptedKeyExchange::Password{code}));
+      }
       break;
     // Fall through...
     default:
@@ -296,22 +349,24 @@ bool SecurityManager::StartPairing(PairingType mode,
   }
 
   // Allow only a single session at a time for now.
-  while (!pending_sessions_.empty())
-    ClosePendingSession(pending_sessions_.begin()->first);
+  CloseAllPendingSessions();
 
   std::string session;
   do {
     session = base::GenerateGUID();
-  } while (confirmed_sessions_.find(session) != confirmed_sessions_.end() ||
-           pending_sessions_.find(session) != pending_sessions_.end());
+  } while (FindSession(session, true) || FindSession(session, false));
   std::string commitment = spake->GetMessage();
-  pending_sessions_.insert(std::make_pair(session, std::move(spake)));
 
-  task_runner_->PostDelayedTask(
-      FROM_HERE,
-      base::Bind(base::IgnoreResult(&SecurityManager::ClosePendingSession),
-                 weak_ptr_factory_.GetWeakPtr(), session),
-      base::TimeDelta::FromMinutes(kPairingExpirationTimeMinutes));
+  Session entry;
+  CHECK_EQ(entry.id.size(), session.size());
+  std::copy(session.begin(), session.end(), entry.id.begin());
+  entry.confirmed = false;
+  entry.expiration =
+      auth_manager_->Now() +
+      base::TimeDelta::FromMinutes(kPairingExpirationTimeMinutes);
+  entry.key_exchanger = std::move(spake);
+  sessions_.push_back(std::move(entry));
+  ScheduleSessionSweep();
 
   *session_id = session;
   *device_commitment = Base64Encode(commitment);
@@ -331,8 +386,8 @@ bool SecurityManager::ConfirmPairing(const std::string& session_id,
                                      std::string* fingerprint,
                                      std::string* signature,
                                      ErrorPtr* error) {
-  auto session = pending_sessions_.find(session_id);
-  if (session == pending_sessions_.end()) {
+  Session* session = FindSession(session_id, false);
+  if (!session) {
     Error::AddToPrintf(error, FROM_HERE, errors::kUnknownSession,
                        "Unknown session id: '%s'", session_id.c_str());
     return false;
@@ -347,14 +402,14 @@ bool SecurityManager::ConfirmPairing(const std::string& session_id,
     return false;
   }
 
-  if (!session->second->ProcessMessage(
+  if (!session->key_exchanger->ProcessMessage(
           std::string(commitment.begin(), commitment.end()), error)) {
     ClosePendingSession(session_id);
     return Error::AddTo(error, FROM_HERE, errors::kCommitmentMismatch,
                         "Pairing code or crypto implementation mismatch");
   }
 
-  const std::string& key = session->second->GetKey();
+  const std::string& key = session->key_exchanger->GetKey();
   VLOG(3) << "KEY " << base::HexEncode(key.data(), key.size());
 
   const auto& certificate_fingerprint =
@@ -363,14 +418,14 @@ bool SecurityManager::ConfirmPairing(const std::string& session_id,
   std::vector<uint8_t> cert_hmac = HmacSha256(
       std::vector<uint8_t>(key.begin(), key.end()), certificate_fingerprint);
   *signature = Base64Encode(cert_hmac);
-  confirmed_sessions_.insert(
-      std::make_pair(session->first, std::move(session->second)));
-  task_runner_->PostDelayedTask(
-      FROM_HERE,
-      base::Bind(base::IgnoreResult(&SecurityManager::CloseConfirmedSession),
-                 weak_ptr_factory_.GetWeakPtr(), session_id),
-      base::TimeDelta::FromMinutes(kSessionExpirationTimeMinutes));
-  ClosePendingSession(session_id);
+  session->confirmed = true;
+  session->expiration =
+      auth_manager_->Now() +
+      base::TimeDelta::FromMinutes(kSessionExpirationTimeMinutes);
+  ScheduleSessionSweep();
+  // The pending session has ended.
+  if (!on_end_.is_null())
+    on_end_.Run(session_id);
   return true;
 }
 
@@ -420,17 +475,81 @@ bool SecurityManager::CheckIfPairingAllowed(ErrorPtr* error) {
 }
 
 bool SecurityManager::ClosePendingSession(const std::string& session_id) {
-  // The most common source of these session_id values is the map containing
-  // the sessions, which we're about to clear out.  Make a local copy.
-  const std::string safe_session_id{session_id};
-  const size_t num_erased = pending_sessions_.erase(safe_session_id);
-  if (num_erased > 0 && !on_end_.is_null())
-    on_end_.Run(safe_session_id);
-  return num_erased != 0;
+  return CloseSession(session_id, false);
 }
 
 bool SecurityManager::CloseConfirmedSession(const std::string& session_id) {
-  return confirmed_sessions_.erase(session_id) != 0;
+  return CloseSession(session_id, true);
+}
+
+SecurityManager::Session* SecurityManager::FindSession(
+    const std::string& session_id,
+    bool confirmed) {
+  if (session_id.size() != SessionId{}.size())
+    return nullptr;
+  for (auto& session : sessions_) {
+    if (session.confirmed == confirmed &&
+        std::equal(session.id.begin(), session.id.end(), session_id.begin())) {
+      return &session;
+    }
+  }
+  return nullptr;
+}
+
+bool SecurityManager::CloseSession(const std::string& session_id,
+                                   bool confirmed) {
+  Session* session = FindSession(session_id, confirmed);
+  if (!session)
+    return false;
+  sessions_.erase(sessions_.begin() + (session - sessions_.data()));
+  if (!confirmed && !on_end_.is_null())
+    on_end_.Run(session_id);
+  return true;
+}
+
+void SecurityManager::CloseAllPendingSessions() {
+  std::vector<std::string> closed;
+  for (const auto& session : sessions_) {
+    if (!session.confirmed)
+      closed.emplace_back(session.id.begin(), session.id.end());
+  }
+  for (const auto& session_id : closed)
+    CloseSession(session_id, false);
+}
+
+void SecurityManager::ScheduleSessionSweep() {
+  if (sessions_.empty())
+    return;
+  base::Time expiration = sessions_.front().expiration;
+  for (const auto& session : sessions_)
+    expiration = std::min(expiration, session.expiration);
+  if (sweep_timer_.IsRunning() && sweep_time_ <= expiration)
+    return;
+  sweep_time_ = expiration;
+  sweep_timer_.Start(
+      FROM_HERE, expiration - auth_manager_->Now(),
+      base::Bind(&SecurityManager::SweepSessions, base::Unretained(this)));
+}
+
+void SecurityManager::SweepSessions() {
+
+  const base::Time now = auth_manager_->Now();
+  std::vector<std::string> ended;
+  for (const auto& session : sessions_) {
+    if (!session.confirmed && session.expiration <= now)
+      ended.emplace_back(session.id.begin(), session.id.end());
+  }
+  sessions_.erase(std::remove_if(sessions_.begin(), sessions_.end(),
+                                 [now](const Session& session) {
+                                   return session.expiration <= now;
+                                 }),
+                  sessions_.end());
+  ScheduleSessionSweep();
+
+  if (!on_end_.is_null()) {
+    for (const auto& session_id : ended)
+      on_end_.Run(session_id);
+  }
 }
 
 bool SecurityManager::IsAnonymousAuthSupported() const {
@@ -5,7 +5,7 @@
 #ifndef LIBWEAVE_SRC_PRIVET_SECURITY_MANAGER_H_
 #define LIBWEAVE_SRC_PRIVET_SECURITY_MANAGER_H_
 
-#include <map>
+#include <array>
 #include <memory>
 #include <set>
 #include <string>
@@ -13,15 +13,12 @@
 
 #include <base/callback.h>
 #include <base/gtest_prod_util.h>
-#include <base/memory/weak_ptr.h>
 #include <weave/error.h>
 
 #include "src/config.h"
 #include "src/privet/security_delegate.h"
-
-namespace crypto {
-class P224EncryptedKeyExchange;
-}  // namespace crypto
+#include "src/timer.h"
+#include "third_party/chromium/crypto/p224_spake.h"
 
 namespace weave {
 
@@ -69,6 +66,8 @@ class SecurityManager : public SecurityDelegate {
   bool ParseAccessToken(const std::string& token,
                         UserInfo* user_info,
                         ErrorPtr* error) const override;
+  std::string CreateResumeTicket(const std::string& access_token,
+                                 ErrorPtr* error) const override;
   std::set<PairingType> GetPairingTypes() const override;
   std::set<CryptoType> GetCryptoTypes() const override;
   std::set<AuthType> GetAuthTypes() const override;
@@ -100,6 +99,9 @@ class SecurityManager : public SecurityDelegate {
   bool CheckIfPairingAllowed(ErrorPtr* error);
   bool ClosePendingSession(const std::string& session_id);
   bool CloseConfirmedSession(const std::string& session_id);
+  // Removes expired sessions and schedules the next sweep, if needed.
+  void SweepSessions();
+  void ScheduleSessionSweep();
   bool CreateAccessTokenImpl(AuthType auth_type,
                              const std::vector<uint8_t>& auth_code,
                              AuthScope desired_scope,
@@ -119,18 +121,34 @@ class SecurityManager : public SecurityDelegate {
   const Config* config_{nullptr};
   AuthManager* auth_manager_{nullptr};
 
-  // TODO(vitalybuka): Session cleanup can be done without posting tasks.
+  // Session IDs are GUIDs, which always have the same length.
+  using SessionId = std::array<char, 36>;
+  struct Session {
+    SessionId id;
+    bool confirmed;
+    base::Time expiration;
+    std::unique_ptr<KeyExchanger> key_exchanger;
+  };
+  Session* FindSession(const std::string& session_id, bool confirmed);
+  bool CloseSession(const std::string& session_id, bool confirmed);
+  void CloseAllPendingSessions();
+
   provider::TaskRunner* task_runner_{nullptr};
-  std::map<std::string, std::unique_ptr<KeyExchanger>> pending_sessions_;
-  std::map<std::string, std::unique_ptr<KeyExchanger>> confirmed_sessions_;
+  // Derived from the embedded code once, as it never changes.
+  std::unique_ptr<crypto::P224EncryptedKeyExchange::Password>
+      embedded_code_password_;
+  // Pending and confirmed sessions. There are only a few of them, so lookups
+  // just scan the table. Instead of a task per session, a single timer firing
+  // at |sweep_time_| removes all sessions expired by then.
+  std::vector<Session> sessions_;
+  base::Time sweep_time_;
+  OneShotTimer sweep_timer_{task_runner_};
   mutable int pairing_attemts_{0};
   mutable base::Time block_pairing_until_;
   PairingStartListener on_start_;
   PairingEndListener on_end_;
   uint64_t last_user_id_{0};
 
-  base::WeakPtrFactory<SecurityManager> weak_ptr_factory_{this};
-
   DISALLOW_COPY_AND_ASSIGN(SecurityManager);
 };
 
@@ -175,6 +175,57 @@ TEST_F(SecurityManagerTest, AccessToken) {
   }
 }
 
+TEST_F(SecurityManagerTest, ResumeTicket) {
+  std::string token;
+  EXPECT_TRUE(security_.CreateAccessToken(AuthType::kAnonymous, "",
+                                          AuthScope::kUser, &token, nullptr,
+                                          nullptr, nullptr));
+  std::string ticket = security_.CreateResumeTicket(token, nullptr);
+  EXPECT_FALSE(ticket.empty());
+
+  std::string resumed_token;
+  AuthScope scope;
+  base::TimeDelta ttl;
+  EXPECT_TRUE(security_.CreateAccessToken(AuthType::kResume, ticket,
+                                          AuthScope::kViewer, &resumed_token,
+                                          &scope, &ttl, nullptr));
+  EXPECT_EQ(AuthScope::kViewer, scope);
+  EXPECT_EQ(base::TimeDelta::FromHours(1), ttl);
+
+  UserInfo info;
+  EXPECT_TRUE(security_.ParseAccessToken(resumed_token, &info, nullptr));
+  EXPECT_EQ(AuthScope::kViewer, info.scope());
+  EXPECT_EQ(TestUserId{"1"}, info.id());
+
+  // The ticket can't be replayed.
+  ErrorPtr error;
+  EXPECT_FALSE(security_.CreateAccessToken(AuthType::kResume, ticket,
+                                           AuthScope::kViewer, nullptr, nullptr,
+                                           nullptr, &error));
+  EXPECT_EQ("invalidAuthCode", error->GetCode());
+
+  error.reset();
+  EXPECT_FALSE(security_.CreateAccessToken(AuthType::kResume, token,
+                                           AuthScope::kViewer, nullptr, nullptr,
+                                           nullptr, &error));
+  EXPECT_EQ("invalidAuthCode", error->GetCode());
+}
+
+TEST_F(SecurityManagerTest, ResumeTicketExpiresWithAccessToken) {
+  std::string token;
+  EXPECT_TRUE(security_.CreateAccessToken(AuthType::kAnonymous, "",
+                                          AuthScope::kUser, &token, nullptr,
+                                          nullptr, nullptr));
+  std::string ticket = security_.CreateResumeTicket(token, nullptr);
+  EXPECT_FALSE(ticket.empty());
+
+  EXPECT_CALL(clock_, Now())
+      .WillRepeatedly(Return(time_ + base::TimeDelta::FromMinutes(61)));
+  EXPECT_FALSE(security_.CreateAccessToken(AuthType::kResume, ticket,
+                                           AuthScope::kViewer, nullptr, nullptr,
+                                           nullptr, nullptr));
+}
+
 TEST_F(SecurityManagerTest, PairingNoSession) {
   std::string fingerprint;
   std::string signature;
@@ -303,5 +354,46 @@ TEST_F(SecurityManagerTest, DontBlockForCanceledSessions) {
   }
 }
 
+TEST_F(SecurityManagerTest, SessionsExpire) {
+  EXPECT_CALL(clock_, Now())
+      .WillRepeatedly(
+          testing::Invoke(task_runner_.GetClock(), &base::Clock::Now));
+
+  std::string confirmed_id;
+  std::string device_commitment;
+  EXPECT_TRUE(security_.StartPairing(PairingType::kEmbeddedCode,
+                                     CryptoType::kSpake_p224, &confirmed_id,
+                                     &device_commitment, nullptr));
+  crypto::P224EncryptedKeyExchange spake{
+      crypto::P224EncryptedKeyExchange::kPeerTypeClient, "1234"};
+  const std::string client_commitment = Base64Encode(spake.GetNextMessage());
+  std::string fingerprint;
+  std::string signature;
+  EXPECT_TRUE(security_.ConfirmPairing(confirmed_id, client_commitment,
+                                       &fingerprint, &signature, nullptr));
+
+  task_runner_.PostDelayedTask(FROM_HERE, base::Bind(&base::DoNothing),
+                               base::TimeDelta::FromMinutes(2));
+  EXPECT_TRUE(task_runner_.RunOnce());
+
+  std::string pending_id;
+  EXPECT_TRUE(security_.StartPairing(PairingType::kEmbeddedCode,
+                                     CryptoType::kSpake_p224, &pending_id,
+                                     &device_commitment, nullptr));
+  // Both sessions share a single sweep task.
+  EXPECT_EQ(1u, task_runner_.GetTaskQueueSize());
+
+  EXPECT_TRUE(task_runner_.RunOnce());
+  EXPECT_FALSE(security_.CancelPairing(confirmed_id, nullptr));
+  EXPECT_EQ(1u, task_runner_.GetTaskQueueSize());
+
+  EXPECT_TRUE(task_runner_.RunOnce());
+  ErrorPtr error;
+  EXPECT_FALSE(security_.ConfirmPairing(pending_id, client_commitment,
+                                        &fingerprint, &signature, &error));
+  EXPECT_EQ("unknownSession", error->GetCode());
+  EXPECT_EQ(0u, task_runner_.GetTaskQueueSize());
+}
+
 }  // namespace privet
 }  // namespace weave
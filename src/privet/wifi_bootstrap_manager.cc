@@ -81,10 +81,10 @@ void WifiBootstrapManager::StartBootstrapping() {
     // If we have been configured before, we'd like to periodically take down
     // our AP and find out if we can connect again.  Many kinds of failures are
     // transient, and having an AP up prohibits us from connecting as a client.
-    task_runner_->PostDelayedTask(
-        FROM_HERE, base::Bind(&WifiBootstrapManager::OnBootstrapTimeout,
-                              tasks_weak_factory_.GetWeakPtr()),
-        base::TimeDelta::FromSeconds(kBootstrapTimeoutSeconds));
+    state_timer_.Start(
+        FROM_HERE, base::TimeDelta::FromSeconds(kBootstrapTimeoutSeconds),
+        base::Bind(&WifiBootstrapManager::OnBootstrapTimeout,
+                   base::Unretained(this)));
   }
   // TODO(vitalybuka): Add SSID probing.
   privet_ssid_ = GenerateSsid();
@@ -104,13 +104,21 @@ void WifiBootstrapManager::StartConnecting(const std::string& ssid,
                                            const std::string& passphrase) {
   VLOG(1) << "Attempting connect to SSID:" << ssid;
   UpdateState(State::kConnecting);
-  task_runner_->PostDelayedTask(
-      FROM_HERE, base::Bind(&WifiBootstrapManager::OnConnectTimeout,
-                            tasks_weak_factory_.GetWeakPtr()),
-      base::TimeDelta::FromSeconds(kConnectingTimeoutSeconds));
-  wifi_->Connect(ssid, passphrase,
-                 base::Bind(&WifiBootstrapManager::OnConnectDone,
-                            tasks_weak_factory_.GetWeakPtr(), ssid));
+  state_timer_.Start(
+      FROM_HERE, base::TimeDelta::FromSeconds(kConnectingTimeoutSeconds),
+      base::Bind(&WifiBootstrapManager::OnConnectTimeout,
+                 base::Unretained(this)));
+  // Reconnecting to the same network can skip the scan for access points.
+  provider::Wifi::AccessPoint hint;
+  const Config::Settings& settings = config_->GetSettings();
+  if (ssid == settings.last_configured_ssid) {
+    hint.bssid = settings.last_configured_bssid;
+    hint.channel = settings.last_configured_channel;
+  }
+  wifi_->ConnectWithHint(
+      ssid, passphrase, hint,
+      base::Bind(&WifiBootstrapManager::OnConnectDone,
+                 tasks_weak_factory_.GetWeakPtr(), ssid));
 }
 
 void WifiBootstrapManager::EndConnecting() {}
@@ -135,10 +143,9 @@ void WifiBootstrapManager::ContinueMonitoring(const base::TimeDelta& timeout) {
     }
 
     // Schedule timeout timer taking into account already offline time.
-    task_runner_->PostDelayedTask(
-        FROM_HERE, base::Bind(&WifiBootstrapManager::OnMonitorTimeout,
-                              tasks_weak_factory_.GetWeakPtr()),
-        monitor_until_ - base::Time::Now());
+    state_timer_.Start(FROM_HERE, monitor_until_ - base::Time::Now(),
+                       base::Bind(&WifiBootstrapManager::OnMonitorTimeout,
+                                  base::Unretained(this)));
   }
 }
 
@@ -148,6 +155,7 @@ void WifiBootstrapManager::UpdateState(State new_state) {
   VLOG(3) << "Switching state from " << EnumToString(state_) << " to "
           << EnumToString(new_state);
   // Abort irrelevant tasks.
+  state_timer_.Stop();
   tasks_weak_factory_.InvalidateWeakPtrs();
 
   switch (state_) {
@@ -220,8 +228,11 @@ void WifiBootstrapManager::OnConnectDone(const std::string& ssid,
     return StartBootstrapping();
   }
   VLOG(1) << "Wifi was connected successfully";
+  provider::Wifi::AccessPoint access_point = wifi_->GetConnectedAccessPoint();
   Config::Transaction change{config_};
   change.set_last_configured_ssid(ssid);
+  change.set_last_configured_bssid(access_point.bssid);
+  change.set_last_configured_channel(access_point.channel);
   change.Commit();
   setup_state_ = SetupState{SetupState::kSuccess};
   StartMonitoring(base::TimeDelta::FromSeconds(kMonitoringTimeoutSeconds));
@@ -243,6 +254,13 @@ void WifiBootstrapManager::OnBootstrapTimeout() {
 void WifiBootstrapManager::OnConnectivityChange() {
   UpdateConnectionState();
 
+  if (state_ == State::kMonitoring &&
+      network_->GetConnectionState() == Network::State::kError) {
+    // The network reported a failure, waiting for the timeout won't help.
+    VLOG(1) << "Connection failed. Entering bootstrap mode.";
+    return StartBootstrapping();
+  }
+
   if (state_ == State::kMonitoring ||
       (state_ != State::kDisabled &&
        network_->GetConnectionState() == Network::State::kOnline)) {
@@ -18,6 +18,7 @@
 #include "src/privet/privet_types.h"
 #include "src/privet/wifi_delegate.h"
 #include "src/privet/wifi_ssid_generator.h"
+#include "src/timer.h"
 
 namespace weave {
 
@@ -107,6 +108,9 @@ class WifiBootstrapManager : public WifiDelegate {
   base::Time monitor_until_;
   std::string privet_ssid_;
 
+  // Timeout of the current state, stopped when switching state.
+  OneShotTimer state_timer_{task_runner_};
+
   // Helps to reset irrelevant tasks switching state.
   base::WeakPtrFactory<WifiBootstrapManager> tasks_weak_factory_{this};
 
@@ -0,0 +1,90 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/profiling_task_runner.h"
+
+#include <algorithm>
+
+#include <base/bind.h>
+#include <base/logging.h>
+
+#include "src/metrics.h"
+
+namespace weave {
+
+ProfilingTaskRunner::ProfilingTaskRunner(provider::TaskRunner* task_runner,
+                                         Metrics* metrics,
+                                         base::Clock* clock)
+    : task_runner_{task_runner},
+      metrics_{metrics},
+      clock_{clock ? clock : &default_clock_} {
+  CHECK(task_runner_);
+  CHECK(metrics_);
+}
+
+ProfilingTaskRunner::~ProfilingTaskRunner() {}
+
+void ProfilingTaskRunner::PostDelayedTask(
+    const tracked_objects::Location& from_here,
+    const base::Closure& task,
+    base::TimeDelta delay) {
+  task_runner_->PostDelayedTask(from_here, Wrap(from_here, task, delay),
+                                delay);
+}
+
+provider::TaskRunner::TaskId ProfilingTaskRunner::PostTaskWithPriority(
+    const tracked_objects::Location& from_here,
+    const base::Closure& task,
+    base::TimeDelta delay,
+    Priority priority) {
+  return task_runner_->PostTaskWithPriority(
+      from_here, Wrap(from_here, task, delay), delay, priority);
+}
+
+void ProfilingTaskRunner::CancelTask(TaskId id) {
+  task_runner_->CancelTask(id);
+}
+
+base::Closure ProfilingTaskRunner::Wrap(
+    const tracked_objects::Location& from_here,
+    const base::Closure& task,
+    base::TimeDelta delay) {
+  return base::Bind(&ProfilingTaskRunner::RunTask,
+                    weak_ptr_factory_.GetWeakPtr(), from_here.ToString(),
+                    clock_->Now() + delay, task);
+}
+
+// Tasks may still be queued in the provider's runner after the wrapper is
+// destroyed, or destroy it themselves, so it's accessed through a weak
+// pointer.
+void ProfilingTaskRunner::RunTask(
+    const base::WeakPtr<ProfilingTaskRunner>& runner,
+    const std::string& location,
+    base::Time due_time,
+    const base::Closure& task) {
+  if (!runner)
+    return task.Run();
+  base::Time start_time = runner->clock_->Now();
+  task.Run();
+  if (runner)
+    runner->RecordTask(location, due_time, start_time);
+}
+
+void ProfilingTaskRunner::RecordTask(const std::string& location,
+                                     base::Time due_time,
+                                     base::Time start_time) {
+  base::Time end_time = clock_->Now();
+  base::TimeDelta run_time = end_time - start_time;
+  base::TimeDelta delay = std::max(start_time - due_time, base::TimeDelta{});
+  metrics_->RecordLatency("task_delay", delay);
+  metrics_->RecordLatency("task_delay " + location, delay);
+  metrics_->RecordLatency("task_run " + location, run_time);
+  if (run_time > slow_task_threshold_) {
+    metrics_->IncrementCounter("slow_task " + location);
+    LOG(WARNING) << "Task posted from " << location << " ran for "
+                 << run_time.InMilliseconds() << " ms";
+  }
+}
+
+}  // namespace weave
@@ -0,0 +1,73 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_PROFILING_TASK_RUNNER_H_
+#define LIBWEAVE_SRC_PROFILING_TASK_RUNNER_H_
+
+#include <string>
+
+#include <base/callback.h>
+#include <base/location.h>
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <base/time/default_clock.h>
+#include <base/time/time.h>
+#include <weave/provider/task_runner.h>
+
+namespace weave {
+
+class Metrics;
+
+// Wraps the provider's task runner to find the tasks stalling the main loop.
+// For each posting location, records how late its tasks start in the
+// "task_delay <location>" histogram, also summed up in "task_delay", and how
+// long they run in the "task_run <location>" histogram. Tasks running longer
+// than the slow task threshold are also counted in "slow_task <location>" and
+// logged.
+class ProfilingTaskRunner final : public provider::TaskRunner {
+ public:
+  ProfilingTaskRunner(provider::TaskRunner* task_runner,
+                      Metrics* metrics,
+                      base::Clock* clock = nullptr);
+  ~ProfilingTaskRunner() override;
+
+  void SetSlowTaskThreshold(base::TimeDelta threshold) {
+    slow_task_threshold_ = threshold;
+  }
+
+  // TaskRunner overrides.
+  void PostDelayedTask(const tracked_objects::Location& from_here,
+                       const base::Closure& task,
+                       base::TimeDelta delay) override;
+  TaskId PostTaskWithPriority(const tracked_objects::Location& from_here,
+                              const base::Closure& task,
+                              base::TimeDelta delay,
+                              Priority priority) override;
+  void CancelTask(TaskId id) override;
+
+ private:
+  base::Closure Wrap(const tracked_objects::Location& from_here,
+                     const base::Closure& task,
+                     base::TimeDelta delay);
+  static void RunTask(const base::WeakPtr<ProfilingTaskRunner>& runner,
+                      const std::string& location,
+                      base::Time due_time,
+                      const base::Closure& task);
+  void RecordTask(const std::string& location,
+                  base::Time due_time,
+                  base::Time start_time);
+
+  provider::TaskRunner* task_runner_{nullptr};
+  Metrics* metrics_{nullptr};
+  base::DefaultClock default_clock_;
+  base::Clock* clock_{nullptr};
+  base::TimeDelta slow_task_threshold_{base::TimeDelta::FromMilliseconds(50)};
+
+  base::WeakPtrFactory<ProfilingTaskRunner> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(ProfilingTaskRunner);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_PROFILING_TASK_RUNNER_H_
@@ -0,0 +1,88 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/profiling_task_runner.h"
+
+#include <memory>
+
+#include <base/bind.h>
+#include <base/time/clock.h>
+#include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
+
+#include "src/metrics.h"
+
+namespace weave {
+
+namespace {
+
+class TestClock : public base::Clock {
+ public:
+  base::Time Now() override { return now_; }
+
+  base::Time now_{base::Time::FromTimeT(1450000000)};
+};
+
+}  // namespace
+
+class ProfilingTaskRunnerTest : public testing::Test {
+ public:
+  void Advance(int ms) { clock_.now_ += base::TimeDelta::FromMilliseconds(ms); }
+
+ protected:
+  // Returns the "count" of histogram |name|, or of counter |name| if
+  // |counter|.
+  int GetCount(const std::string& name, bool counter = false) const {
+    auto json = metrics_.ToJson();
+    int count = 0;
+    if (counter) {
+      const base::DictionaryValue* counters = nullptr;
+      EXPECT_TRUE(json->GetDictionary("counters", &counters));
+      counters->GetIntegerWithoutPathExpansion(name, &count);
+      return count;
+    }
+    const base::DictionaryValue* histograms = nullptr;
+    const base::DictionaryValue* histogram = nullptr;
+    EXPECT_TRUE(json->GetDictionary("histograms", &histograms));
+    if (histograms->GetDictionaryWithoutPathExpansion(name, &histogram))
+      histogram->GetInteger("count", &count);
+    return count;
+  }
+
+  provider::test::FakeTaskRunner task_runner_;
+  Metrics metrics_;
+  TestClock clock_;
+  std::unique_ptr<ProfilingTaskRunner> runner_{
+      new ProfilingTaskRunner{&task_runner_, &metrics_, &clock_}};
+};
+
+TEST_F(ProfilingTaskRunnerTest, RecordsTasks) {
+  tracked_objects::Location fast = FROM_HERE;
+  tracked_objects::Location slow = FROM_HERE;
+  runner_->PostDelayedTask(fast, base::Bind(&base::DoNothing), {});
+  runner_->PostTaskWithPriority(
+      slow, base::Bind(&ProfilingTaskRunnerTest::Advance,
+                       base::Unretained(this), 100),
+      {}, provider::TaskRunner::Priority::kNormal);
+  runner_->PostDelayedTask(fast, base::Bind(&base::DoNothing), {});
+  task_runner_.RunPendingTasks();
+
+  EXPECT_EQ(2, GetCount("task_run " + fast.ToString()));
+  EXPECT_EQ(2, GetCount("task_delay " + fast.ToString()));
+  EXPECT_EQ(3, GetCount("task_delay"));
+  EXPECT_EQ(0, GetCount("slow_task " + fast.ToString(), true));
+  EXPECT_EQ(1, GetCount("task_run " + slow.ToString()));
+  EXPECT_EQ(1, GetCount("slow_task " + slow.ToString(), true));
+}
+
+TEST_F(ProfilingTaskRunnerTest, TasksOutliveRunner) {
+  int runs = 0;
+  runner_->PostDelayedTask(FROM_HERE,
+                           base::Bind([](int* runs) { ++*runs; }, &runs), {});
+  runner_.reset();
+  task_runner_.RunPendingTasks();
+  EXPECT_EQ(1, runs);
+}
+
+}  // namespace weave
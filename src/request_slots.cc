@@ -0,0 +1,79 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/request_slots.h"
+
+#include <algorithm>
+
+#include <base/bind.h>
+#include <base/logging.h>
+
+namespace weave {
+
+RequestSlots::RequestSlots(provider::TaskRunner* task_runner,
+                           size_t max_in_flight)
+    : task_runner_{task_runner}, max_in_flight_{max_in_flight} {
+  CHECK_GT(max_in_flight_, 0u);
+}
+
+RequestSlots::~RequestSlots() {}
+
+bool RequestSlots::Acquire(Client* client) {
+  CHECK(client);
+  if (in_flight_ < max_in_flight_) {
+    if (client == notified_client_) {
+      // Takes the slot it was notified of, and waits in line for more, so the
+      // clients take turns.
+      notified_client_ = nullptr;
+      ++in_flight_;
+      return true;
+    }
+    // The client first in line, e.g. the only one, doesn't wait for its
+    // notification.
+    if (waiting_clients_.empty() || waiting_clients_.front() == client) {
+      if (!waiting_clients_.empty())
+        waiting_clients_.pop_front();
+      ++in_flight_;
+      return true;
+    }
+  }
+  if (std::find(waiting_clients_.begin(), waiting_clients_.end(), client) ==
+      waiting_clients_.end()) {
+    waiting_clients_.push_back(client);
+  }
+  return false;
+}
+
+void RequestSlots::Release() {
+  CHECK_GT(in_flight_, 0u);
+  --in_flight_;
+  if (waiting_clients_.empty() || notification_pending_)
+    return;
+  // Not notified right away, so the releasing client isn't reentered.
+  notification_pending_ = true;
+  task_runner_->PostDelayedTask(
+      FROM_HERE, base::Bind(&RequestSlots::NotifyWaitingClients,
+                            weak_ptr_factory_.GetWeakPtr()),
+      {});
+}
+
+void RequestSlots::RemoveClient(Client* client) {
+  waiting_clients_.erase(
+      std::remove(waiting_clients_.begin(), waiting_clients_.end(), client),
+      waiting_clients_.end());
+  if (notified_client_ == client)
+    notified_client_ = nullptr;
+}
+
+void RequestSlots::NotifyWaitingClients() {
+  notification_pending_ = false;
+  while (in_flight_ < max_in_flight_ && !waiting_clients_.empty()) {
+    notified_client_ = waiting_clients_.front();
+    waiting_clients_.pop_front();
+    notified_client_->OnRequestSlotAvailable();
+    notified_client_ = nullptr;
+  }
+}
+
+}  // namespace weave
@@ -0,0 +1,59 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_REQUEST_SLOTS_H_
+#define LIBWEAVE_SRC_REQUEST_SLOTS_H_
+
+#include <deque>
+
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <weave/provider/task_runner.h>
+
+namespace weave {
+
+// Limits the number of requests in flight, of a single device or shared by
+// the devices of a DeviceRuntime. Clients finding no free slot wait in line,
+// and are notified in turn as slots are released.
+class RequestSlots final {
+ public:
+  class Client {
+   public:
+    // Called when the client may Acquire() a slot again.
+    virtual void OnRequestSlotAvailable() = 0;
+
+   protected:
+    virtual ~Client() {}
+  };
+
+  RequestSlots(provider::TaskRunner* task_runner, size_t max_in_flight);
+  ~RequestSlots();
+
+  // Takes a slot and returns true if one is free and no other client waits
+  // for it. Otherwise |client| waits in line and returns false.
+  bool Acquire(Client* client);
+  void Release();
+  // Removes |client| from the line, e.g. when it is destroyed.
+  void RemoveClient(Client* client);
+
+  size_t in_flight() const { return in_flight_; }
+
+ private:
+  void NotifyWaitingClients();
+
+  provider::TaskRunner* task_runner_{nullptr};
+  const size_t max_in_flight_;
+  size_t in_flight_{0};
+  std::deque<Client*> waiting_clients_;
+  // The client being notified, which may take the slot meant for it.
+  Client* notified_client_{nullptr};
+  bool notification_pending_{false};
+
+  base::WeakPtrFactory<RequestSlots> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(RequestSlots);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_REQUEST_SLOTS_H_
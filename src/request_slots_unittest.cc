@@ -0,0 +1,109 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/request_slots.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
+
+namespace weave {
+
+namespace {
+
+// Takes a slot for each of its pending requests, and logs them.
+class Client : public RequestSlots::Client {
+ public:
+  Client(RequestSlots* slots, char name, std::string* log)
+      : slots_{slots}, name_{name}, log_{log} {}
+
+  void Send(size_t count) {
+    pending_ += count;
+    OnRequestSlotAvailable();
+  }
+
+  void OnRequestSlotAvailable() override {
+    while (pending_ > 0 && slots_->Acquire(this)) {
+      --pending_;
+      log_->push_back(name_);
+    }
+  }
+
+ private:
+  RequestSlots* slots_;
+  const char name_;
+  std::string* log_;
+  size_t pending_{0};
+};
+
+}  // namespace
+
+class RequestSlotsTest : public testing::Test {
+ protected:
+  provider::test::FakeTaskRunner task_runner_;
+  RequestSlots slots_{&task_runner_, 2};
+  std::string log_;
+};
+
+TEST_F(RequestSlotsTest, SingleClient) {
+  Client a{&slots_, 'a', &log_};
+  a.Send(3);
+  EXPECT_EQ("aa", log_);
+  EXPECT_EQ(2u, slots_.in_flight());
+
+  // The only client waiting takes the released slot right away.
+  slots_.Release();
+  a.OnRequestSlotAvailable();
+  EXPECT_EQ("aaa", log_);
+  task_runner_.RunPendingTasks();
+  EXPECT_EQ("aaa", log_);
+  EXPECT_EQ(2u, slots_.in_flight());
+}
+
+TEST_F(RequestSlotsTest, ClientsTakeTurns) {
+  Client a{&slots_, 'a', &log_};
+  Client b{&slots_, 'b', &log_};
+  Client c{&slots_, 'c', &log_};
+  a.Send(4);
+  b.Send(2);
+  c.Send(1);
+  EXPECT_EQ("aa", log_);
+
+  // The client first in line takes one slot, and waits behind the others for
+  // more. The waiting clients are notified in order, one slot each.
+  slots_.Release();
+  slots_.Release();
+  a.OnRequestSlotAvailable();
+  EXPECT_EQ("aaa", log_);
+  task_runner_.RunPendingTasks();
+  EXPECT_EQ("aaab", log_);
+
+  slots_.Release();
+  slots_.Release();
+  task_runner_.RunPendingTasks();
+  EXPECT_EQ("aaabca", log_);
+
+  slots_.Release();
+  task_runner_.RunPendingTasks();
+  EXPECT_EQ("aaabcab", log_);
+}
+
+TEST_F(RequestSlotsTest, RemoveClient) {
+  Client a{&slots_, 'a', &log_};
+  a.Send(2);
+  {
+    Client b{&slots_, 'b', &log_};
+    b.Send(1);
+    slots_.RemoveClient(&b);
+  }
+  Client c{&slots_, 'c', &log_};
+  c.Send(1);
+
+  slots_.Release();
+  task_runner_.RunPendingTasks();
+  EXPECT_EQ("aac", log_);
+}
+
+}  // namespace weave
@@ -0,0 +1,347 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/rules_engine.h"
+
+#include <set>
+#include <utility>
+
+#include <base/bind.h>
+#include <weave/command.h>
+#include <weave/provider/config_store.h>
+
+#include "src/commands/schema_constants.h"
+#include "src/component_manager.h"
+#include "src/json_stream_writer.h"
+#include "src/string_utils.h"
+#include "src/utils.h"
+
+namespace weave {
+
+namespace {
+
+const char kComponent[] = "automation";
+const char kTrait[] = "automation";
+const char kSetRulesCommand[] = "automation.setRules";
+const char kRules[] = "rules";
+const char kConfigName[] = "rules";
+
+// Each rule is evaluated on every state change, so their number is bounded.
+const size_t kMaxRules = 32;
+// Bounds the chains of rules changing the state which fires other rules.
+const int kMaxEvaluationPasses = 8;
+
+const char kTraits[] = R"({
+  "automation": {
+    "commands": {
+      "setRules": {
+        "minimalRole": "manager",
+        "parameters": {
+          "rules": {
+            "type": "array",
+            "items": {"type": "object"}
+          }
+        }
+      }
+    },
+    "state": {
+      "rules": {
+        "type": "array",
+        "items": {"type": "object"},
+        "isRequired": true
+      }
+    }
+  }
+})";
+
+}  // namespace
+
+RulesEngine::RulesEngine(ComponentManager* component_manager,
+                         provider::ConfigStore* config_store)
+    : component_manager_{component_manager}, config_store_{config_store} {
+  CHECK(component_manager_->LoadTraits(kTraits, nullptr));
+  CHECK(component_manager_->AddComponent("", kComponent, {kTrait}, nullptr));
+
+  // The components of the actions may not be added yet, but the rules were
+  // checked when they were deployed.
+  std::string json = config_store_ ? config_store_->LoadSettings(kConfigName)
+                                   : std::string{};
+  const base::ListValue* rules = nullptr;
+  ErrorPtr error;
+  std::unique_ptr<base::DictionaryValue> saved;
+  std::vector<Rule> compiled;
+  if (!json.empty() && (saved = LoadJsonDict(json, &error)) &&
+      saved->GetList(kRules, &rules) &&
+      CompileRules(*rules, false, &compiled, &error)) {
+    rules_ = std::move(compiled);
+    for (const auto& rule : *rules)
+      rules_json_.Append(rule->CreateDeepCopy());
+  } else if (error) {
+    LOG(WARNING) << "Failed to load rules: " << error->GetMessage();
+  }
+  UpdateState();
+
+  component_manager_->AddCommandHandler(
+      kComponent, kSetRulesCommand,
+      base::Bind(&RulesEngine::SetRulesCommand,
+                 weak_ptr_factory_.GetWeakPtr()));
+  component_manager_->AddStateChangedCallback(base::Bind(
+      &RulesEngine::OnStateChanged, weak_ptr_factory_.GetWeakPtr()));
+}
+
+RulesEngine::~RulesEngine() {}
+
+bool RulesEngine::SetRules(const base::ListValue& rules, ErrorPtr* error) {
+  std::vector<Rule> compiled;
+  if (!CompileRules(rules, true, &compiled, error))
+    return false;
+  // Rules only fire on the changes made after they are deployed.
+  for (auto& rule : compiled)
+    rule.last_match = Evaluate(rule);
+  rules_ = std::move(compiled);
+  rules_json_.Clear();
+  for (const auto& rule : rules)
+    rules_json_.Append(rule->CreateDeepCopy());
+
+  if (config_store_) {
+    std::string json;
+    {
+      JsonStreamWriter writer{&json};
+      writer.BeginDictionary();
+      writer.WriteKey(kRules);
+      writer.WriteValue(rules_json_);
+      writer.EndDictionary();
+    }
+    config_store_->SaveSettings(kConfigName, json, {});
+  }
+  UpdateState();
+  return true;
+}
+
+bool RulesEngine::CompileRules(const base::ListValue& rules,
+                               bool check_actions,
+                               std::vector<Rule>* compiled,
+                               ErrorPtr* error) const {
+  if (rules.GetSize() > kMaxRules) {
+    return Error::AddToPrintf(error, FROM_HERE,
+                              errors::commands::kInvalidPropValue,
+                              "Too many rules, at most %zu are supported",
+                              kMaxRules);
+  }
+  std::set<std::string> names;
+  compiled->clear();
+  compiled->resize(rules.GetSize());
+  for (size_t i = 0; i < rules.GetSize(); ++i) {
+    const base::Value* value = nullptr;
+    CHECK(rules.Get(i, &value));
+    Rule& rule = (*compiled)[i];
+    if (!CompileRule(*value, check_actions, &rule, error)) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kInvalidPropValue,
+                                "Invalid rule %zu", i);
+    }
+    if (!names.insert(rule.name).second) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kInvalidPropValue,
+                                "Duplicate rule '%s'", rule.name.c_str());
+    }
+  }
+  return true;
+}
+
+bool RulesEngine::CompileRule(const base::Value& value,
+                              bool check_actions,
+                              Rule* rule,
+                              ErrorPtr* error) const {
+  using Operator = Condition::Operator;
+  static const struct {
+    const char* name;
+    Operator op;
+  } kOperators[] = {
+      {"equals", Operator::kEquals},
+      {"notEquals", Operator::kNotEquals},
+      {"above", Operator::kAbove},
+      {"below", Operator::kBelow},
+  };
+
+  const base::DictionaryValue* dict = nullptr;
+  const base::ListValue* conditions = nullptr;
+  const base::ListValue* actions = nullptr;
+  if (!value.GetAsDictionary(&dict) || !dict->GetString("name", &rule->name) ||
+      rule->name.empty() || !dict->GetList("when", &conditions) ||
+      conditions->empty() || !dict->GetList("then", &actions) ||
+      actions->empty()) {
+    return Error::AddTo(error, FROM_HERE, errors::commands::kPropertyMissing,
+                        "Rule must have 'name', 'when' and 'then'");
+  }
+
+  for (const auto& item : *conditions) {
+    const base::DictionaryValue* condition_dict = nullptr;
+    Condition condition;
+    if (!item->GetAsDictionary(&condition_dict) ||
+        !condition_dict->GetString("component", &condition.component) ||
+        !condition_dict->GetString("state", &condition.state)) {
+      return Error::AddToPrintf(
+          error, FROM_HERE, errors::commands::kPropertyMissing,
+          "Condition of rule '%s' must have 'component' and 'state'",
+          rule->name.c_str());
+    }
+    for (const auto& op : kOperators) {
+      const base::Value* operand = nullptr;
+      if (!condition_dict->GetWithoutPathExpansion(op.name, &operand))
+        continue;
+      if (condition.value) {
+        return Error::AddToPrintf(
+            error, FROM_HERE, errors::commands::kInvalidPropValue,
+            "Condition of rule '%s' has more than one operator",
+            rule->name.c_str());
+      }
+      condition.op = op.op;
+      condition.value = operand->CreateDeepCopy();
+    }
+    double number = 0;
+    if (!condition.value ||
+        ((condition.op == Operator::kAbove ||
+          condition.op == Operator::kBelow) &&
+         !condition.value->GetAsDouble(&number))) {
+      return Error::AddToPrintf(
+          error, FROM_HERE, errors::commands::kInvalidPropValue,
+          "Condition of rule '%s' on '%s' has no valid operator",
+          rule->name.c_str(), condition.state.c_str());
+    }
+    rule->conditions.push_back(std::move(condition));
+  }
+
+  for (const auto& item : *actions) {
+    const base::DictionaryValue* action = nullptr;
+    std::string name;
+    if (!item->GetAsDictionary(&action) || !action->GetString("name", &name)) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kPropertyMissing,
+                                "Action of rule '%s' must have 'name'",
+                                rule->name.c_str());
+    }
+    // Rules replacing the rules while they run are not supported.
+    if (SplitAtFirst(name, ".", true).first == kTrait) {
+      return Error::AddToPrintf(error, FROM_HERE,
+                                errors::commands::kInvalidPropValue,
+                                "Rule '%s' can't send '%s'",
+                                rule->name.c_str(), name.c_str());
+    }
+    if (check_actions &&
+        !component_manager_->ParseCommandInstance(
+            *action, Command::Origin::kLocal, UserRole::kManager, nullptr,
+            error)) {
+      return false;
+    }
+    rule->actions.push_back(action->CreateDeepCopy());
+  }
+  return true;
+}
+
+RulesEngine::Match RulesEngine::Evaluate(const Rule& rule) const {
+  Match match = Match::kTrue;
+  // Conditions of a rule are usually on the same component.
+  const std::string* component = nullptr;
+  const base::DictionaryValue* state = nullptr;
+  for (const Condition& condition : rule.conditions) {
+    if (!component || *component != condition.component) {
+      component = &condition.component;
+      state = component_manager_->GetComponentState(*component, nullptr);
+    }
+    const base::Value* value = nullptr;
+    if (!state || !state->Get(condition.state, &value))
+      return Match::kUnknown;
+    double number = 0;
+    double operand = 0;
+    bool result = false;
+    switch (condition.op) {
+      case Condition::Operator::kEquals:
+        result = value->Equals(condition.value.get());
+        break;
+      case Condition::Operator::kNotEquals:
+        result = !value->Equals(condition.value.get());
+        break;
+      case Condition::Operator::kAbove:
+        result = value->GetAsDouble(&number) &&
+                 condition.value->GetAsDouble(&operand) && number > operand;
+        break;
+      case Condition::Operator::kBelow:
+        result = value->GetAsDouble(&number) &&
+                 condition.value->GetAsDouble(&operand) && number < operand;
+        break;
+    }
+    if (!result)
+      match = Match::kFalse;
+  }
+  return match;
+}
+
+void RulesEngine::RunActions(const Rule& rule) {
+  VLOG(1) << "Rule '" << rule.name << "' fired";
+  for (const auto& action : rule.actions) {
+    ErrorPtr error;
+    auto command = component_manager_->ParseCommandInstance(
+        *action, Command::Origin::kLocal, UserRole::kManager, nullptr, &error);
+    if (!command) {
+      LOG(WARNING) << "Rule '" << rule.name
+                   << "' failed to send a command: " << error->GetMessage();
+      continue;
+    }
+    component_manager_->AddCommand(std::move(command));
+  }
+}
+
+void RulesEngine::OnStateChanged() {
+  if (evaluating_) {
+    reevaluate_ = true;
+    return;
+  }
+  evaluating_ = true;
+  int pass = 0;
+  do {
+    reevaluate_ = false;
+    std::vector<const Rule*> fired;
+    for (Rule& rule : rules_) {
+      Match match = Evaluate(rule);
+      if (rule.last_match == Match::kFalse && match == Match::kTrue)
+        fired.push_back(&rule);
+      rule.last_match = match;
+    }
+    // Handlers of the commands may change the state synchronously.
+    for (const Rule* rule : fired)
+      RunActions(*rule);
+  } while (reevaluate_ && ++pass < kMaxEvaluationPasses);
+  if (reevaluate_)
+    LOG(WARNING) << "Rules keep changing the state, evaluation stopped";
+  evaluating_ = false;
+}
+
+void RulesEngine::SetRulesCommand(const std::weak_ptr<Command>& cmd) {
+  auto command = cmd.lock();
+  if (!command)
+    return;
+
+  const base::ListValue* rules = nullptr;
+  ErrorPtr error;
+  if (!command->GetParameters().GetList(kRules, &rules)) {
+    Error::AddTo(&error, FROM_HERE, errors::commands::kPropertyMissing,
+                 "Rules are missing");
+    command->Abort(error.get(), nullptr);
+    return;
+  }
+  if (!SetRules(*rules, &error)) {
+    command->Abort(error.get(), nullptr);
+    return;
+  }
+  command->Complete({}, nullptr);
+}
+
+void RulesEngine::UpdateState() {
+  base::DictionaryValue state;
+  state.Set("automation.rules", rules_json_.CreateDeepCopy());
+  CHECK(component_manager_->SetStateProperties(kComponent, state, nullptr));
+}
+
+}  // namespace weave
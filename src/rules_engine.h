@@ -0,0 +1,106 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_RULES_ENGINE_H_
+#define LIBWEAVE_SRC_RULES_ENGINE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/memory/weak_ptr.h>
+#include <base/values.h>
+#include <weave/error.h>
+
+namespace weave {
+
+class Command;
+class ComponentManager;
+
+namespace provider {
+class ConfigStore;
+}  // namespace provider
+
+// Runs simple automations on the device, so they work offline and without
+// the round trip through the cloud. A rule sends its commands when all of
+// its conditions on the component state become true, e.g.
+//   {
+//     "name": "motionLight",
+//     "when": [{"component": "sensor", "state": "motion.detected",
+//               "equals": true}],
+//     "then": [{"component": "light", "name": "onOff.setConfig",
+//               "parameters": {"state": "on"}}]
+//   }
+// A condition has one of the "equals", "notEquals", "above" and "below"
+// operators. Rules are evaluated whenever the state changes, and only fire
+// on the change from false to true, so a rule isn't fired by a state which
+// was already there when it was deployed, or which it didn't see before.
+// The commands are sent with the manager role.
+//
+// Rules are kept in |config_store| and deployed with commands of the
+// 'automation' trait:
+//  automation.setRules
+class RulesEngine final {
+ public:
+  RulesEngine(ComponentManager* component_manager,
+              provider::ConfigStore* config_store);
+  ~RulesEngine();
+
+  // Replaces all the rules with |rules|. Nothing is changed if any of them
+  // is invalid.
+  bool SetRules(const base::ListValue& rules, ErrorPtr* error);
+  size_t GetRuleCount() const { return rules_.size(); }
+
+ private:
+  struct Condition {
+    enum class Operator { kEquals, kNotEquals, kAbove, kBelow };
+    std::string component;
+    std::string state;
+    Operator op{Operator::kEquals};
+    std::unique_ptr<base::Value> value;
+  };
+  // Result of the last evaluation of a rule. kUnknown if any of the state
+  // properties is missing.
+  enum class Match { kUnknown, kFalse, kTrue };
+  struct Rule {
+    std::string name;
+    std::vector<Condition> conditions;
+    // Commands in the form accepted by ParseCommandInstance().
+    std::vector<std::unique_ptr<base::DictionaryValue>> actions;
+    Match last_match{Match::kUnknown};
+  };
+
+  // Parses |rules|. Commands of the actions are only checked against the
+  // current components if |check_actions| is set.
+  bool CompileRules(const base::ListValue& rules,
+                    bool check_actions,
+                    std::vector<Rule>* compiled,
+                    ErrorPtr* error) const;
+  bool CompileRule(const base::Value& value,
+                   bool check_actions,
+                   Rule* rule,
+                   ErrorPtr* error) const;
+  Match Evaluate(const Rule& rule) const;
+  void RunActions(const Rule& rule);
+  void OnStateChanged();
+  void SetRulesCommand(const std::weak_ptr<Command>& command);
+  void UpdateState();
+
+  ComponentManager* component_manager_{nullptr};
+  provider::ConfigStore* config_store_{nullptr};
+  std::vector<Rule> rules_;
+  // The rules as deployed, reported in the state and saved.
+  base::ListValue rules_json_;
+  // Set while the rules are evaluated. Commands of the rules may change the
+  // state again, which is then evaluated after the current pass.
+  bool evaluating_{false};
+  bool reevaluate_{false};
+
+  base::WeakPtrFactory<RulesEngine> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(RulesEngine);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_RULES_ENGINE_H_
@@ -0,0 +1,233 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/rules_engine.h"
+
+#include <base/bind.h>
+#include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
+#include <weave/provider/test/mock_config_store.h>
+#include <weave/test/unittest_utils.h>
+
+#include "src/component_manager_impl.h"
+
+namespace weave {
+
+using test::CreateDictionaryValue;
+using test::CreateValue;
+using testing::_;
+using testing::Invoke;
+using testing::StrictMock;
+using testing::WithArgs;
+
+namespace {
+
+const char kTraits[] = R"({
+  "sensor": {
+    "state": {
+      "motion": {"type": "boolean"},
+      "temperature": {"type": "number"}
+    }
+  },
+  "onOff": {
+    "commands": {
+      "setConfig": {
+        "minimalRole": "user",
+        "parameters": {"state": {"type": "string", "enum": ["on", "off"]}}
+      }
+    },
+    "state": {"state": {"type": "string", "enum": ["on", "off"]}}
+  }
+})";
+
+const char kMotionRule[] = R"([{
+  "name": "motionLight",
+  "when": [{"component": "sensor", "state": "sensor.motion", "equals": true}],
+  "then": [{
+    "component": "light",
+    "name": "onOff.setConfig",
+    "parameters": {"state": "on"}
+  }]
+}])";
+
+}  // namespace
+
+class RulesEngineTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    EXPECT_CALL(config_store_, LoadSettings("rules"))
+        .WillRepeatedly(Invoke([this](const std::string&) { return saved_; }));
+    EXPECT_CALL(config_store_, SaveSettings("rules", _, _))
+        .WillRepeatedly(WithArgs<1>(
+            Invoke([this](const std::string& json) { saved_ = json; })));
+    Restart();
+  }
+
+  // Creates the device anew, with the rules saved so far.
+  void Restart() {
+    engine_.reset();
+    manager_.reset(new ComponentManagerImpl{&task_runner_});
+    ASSERT_TRUE(manager_->LoadTraits(kTraits, nullptr));
+    ASSERT_TRUE(manager_->AddComponent("", "sensor", {"sensor"}, nullptr));
+    ASSERT_TRUE(manager_->AddComponent("", "light", {"onOff"}, nullptr));
+    SetSensorState(R"({"motion": false, "temperature": 20})");
+    light_commands_.clear();
+    manager_->AddCommandHandler(
+        "light", "onOff.setConfig",
+        base::Bind(&RulesEngineTest::OnSetConfig, base::Unretained(this)));
+    engine_.reset(new RulesEngine{manager_.get(), &config_store_});
+  }
+
+  void OnSetConfig(const std::weak_ptr<Command>& cmd) {
+    auto command = cmd.lock();
+    std::string state;
+    EXPECT_TRUE(command->GetParameters().GetString("state", &state));
+    light_commands_.push_back(state);
+    EXPECT_TRUE(manager_->SetStateProperty("light", "onOff.state",
+                                           base::StringValue{state}, nullptr));
+    command->Complete({}, nullptr);
+  }
+
+  void SetSensorState(const std::string& json) {
+    EXPECT_TRUE(manager_->SetStatePropertiesFromJson(
+        "sensor", R"({"sensor": )" + json + "}", nullptr));
+  }
+
+  bool SetRules(const std::string& json, ErrorPtr* error = nullptr) {
+    auto rules = CreateValue(json);
+    const base::ListValue* list = nullptr;
+    EXPECT_TRUE(rules->GetAsList(&list));
+    return engine_->SetRules(*list, error);
+  }
+
+  provider::test::FakeTaskRunner task_runner_;
+  StrictMock<provider::test::MockConfigStore> config_store_{false};
+  std::string saved_;
+  std::unique_ptr<ComponentManagerImpl> manager_;
+  std::unique_ptr<RulesEngine> engine_;
+  std::vector<std::string> light_commands_;
+};
+
+TEST_F(RulesEngineTest, FiresWhenConditionsBecomeTrue) {
+  ASSERT_TRUE(SetRules(kMotionRule));
+  EXPECT_TRUE(light_commands_.empty());
+
+  SetSensorState(R"({"motion": true})");
+  EXPECT_EQ((std::vector<std::string>{"on"}), light_commands_);
+
+  // Only changes to true fire the rule.
+  SetSensorState(R"({"motion": true})");
+  SetSensorState(R"({"temperature": 21})");
+  EXPECT_EQ(1u, light_commands_.size());
+  SetSensorState(R"({"motion": false})");
+  SetSensorState(R"({"motion": true})");
+  EXPECT_EQ(2u, light_commands_.size());
+}
+
+TEST_F(RulesEngineTest, NotFiredByExistingState) {
+  SetSensorState(R"({"motion": true})");
+  ASSERT_TRUE(SetRules(kMotionRule));
+  SetSensorState(R"({"temperature": 21})");
+  EXPECT_TRUE(light_commands_.empty());
+}
+
+TEST_F(RulesEngineTest, AllConditionsAndChainedRules) {
+  ASSERT_TRUE(SetRules(R"([{
+    "name": "hot",
+    "when": [
+      {"component": "sensor", "state": "sensor.temperature", "above": 25},
+      {"component": "sensor", "state": "sensor.motion", "notEquals": false}
+    ],
+    "then": [{"component": "light", "name": "onOff.setConfig",
+              "parameters": {"state": "on"}}]
+  }, {
+    "name": "lightOn",
+    "when": [{"component": "light", "state": "onOff.state", "equals": "on"}],
+    "then": [{"component": "light", "name": "onOff.setConfig",
+              "parameters": {"state": "off"}}]
+  }, {
+    "name": "cold",
+    "when": [
+      {"component": "sensor", "state": "sensor.temperature", "below": 10}
+    ],
+    "then": [{"component": "light", "name": "onOff.setConfig",
+              "parameters": {"state": "on"}}]
+  }])"));
+  ASSERT_TRUE(manager_->SetStatePropertiesFromJson(
+      "light", R"({"onOff": {"state": "off"}})", nullptr));
+
+  SetSensorState(R"({"temperature": 30})");
+  EXPECT_TRUE(light_commands_.empty());
+  // "hot" turns the light on, which makes "lightOn" turn it off.
+  SetSensorState(R"({"motion": true})");
+  EXPECT_EQ((std::vector<std::string>{"on", "off"}), light_commands_);
+
+  SetSensorState(R"({"temperature": 5})");
+  EXPECT_EQ((std::vector<std::string>{"on", "off", "on", "off"}),
+            light_commands_);
+}
+
+TEST_F(RulesEngineTest, InvalidRules) {
+  ASSERT_TRUE(SetRules(kMotionRule));
+  const char* kInvalidRules[] = {
+      R"([{"name": "r", "when": [], "then": []}])",
+      R"([{"name": "r",
+           "when": [{"component": "sensor", "state": "sensor.motion"}],
+           "then": [{"component": "light", "name": "onOff.setConfig"}]}])",
+      R"([{"name": "r",
+           "when": [{"component": "sensor", "state": "sensor.motion",
+                     "above": true}],
+           "then": [{"component": "light", "name": "onOff.setConfig"}]}])",
+      R"([{"name": "r",
+           "when": [{"component": "sensor", "state": "sensor.motion",
+                     "equals": true, "notEquals": false}],
+           "then": [{"component": "light", "name": "onOff.setConfig"}]}])",
+      R"([{"name": "r",
+           "when": [{"component": "sensor", "state": "sensor.motion",
+                     "equals": true}],
+           "then": [{"component": "light", "name": "onOff.setConfig",
+                     "parameters": {"state": "dim"}}]}])",
+      R"([{"name": "r",
+           "when": [{"component": "sensor", "state": "sensor.motion",
+                     "equals": true}],
+           "then": [{"component": "automation",
+                     "name": "automation.setRules",
+                     "parameters": {"rules": []}}]}])",
+  };
+  for (const char* rules : kInvalidRules) {
+    ErrorPtr error;
+    EXPECT_FALSE(SetRules(rules, &error)) << rules;
+    EXPECT_NE(nullptr, error.get());
+  }
+  EXPECT_EQ(1u, engine_->GetRuleCount());
+}
+
+TEST_F(RulesEngineTest, DeployWithCommand) {
+  auto command = CreateDictionaryValue(R"({
+    "name": "automation.setRules",
+    "component": "automation",
+    "parameters": {}
+  })");
+  command->Set("parameters.rules", CreateValue(kMotionRule));
+  std::string id;
+  auto instance = manager_->ParseCommandInstance(
+      *command, Command::Origin::kCloud, UserRole::kManager, &id, nullptr);
+  ASSERT_NE(nullptr, instance);
+  manager_->AddCommand(std::move(instance));
+  EXPECT_EQ(Command::State::kDone, manager_->FindCommand(id)->GetState());
+  EXPECT_EQ(1u, engine_->GetRuleCount());
+
+  const base::Value* state =
+      manager_->GetStateProperty("automation", "automation.rules", nullptr);
+  ASSERT_NE(nullptr, state);
+  EXPECT_JSON_EQ(kMotionRule, *state);
+
+  // The rules run again after a restart.
+  Restart();
+  EXPECT_EQ(1u, engine_->GetRuleCount());
+  SetSensorState(R"({"motion": true})");
+  EXPECT_EQ((std::vector<std::string>{"on"}), light_commands_);
+}
+
+}  // namespace weave
@@ -0,0 +1,102 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/sharded_json_writer.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <base/bind.h>
+
+#include "src/json_stream_writer.h"
+#include "src/worker_task.h"
+
+namespace weave {
+
+namespace {
+
+// State of a WriteJsonInShards() call. Only used on the task runner thread.
+struct ShardedWrite {
+  std::shared_ptr<const base::DictionaryValue> dict;
+  std::vector<std::string> shards;
+  size_t pending{0};
+  base::Callback<void(std::string)> callback;
+};
+
+// Writes the members of |dict| with |keys| as a JSON object.
+std::string WriteShard(const base::DictionaryValue* dict,
+                       const std::vector<std::string>& keys) {
+  std::string json;
+  JsonStreamWriter writer{&json};
+  writer.BeginDictionary();
+  for (const auto& key : keys) {
+    const base::Value* value = nullptr;
+    CHECK(dict->GetWithoutPathExpansion(key, &value));
+    writer.WriteKey(key);
+    writer.WriteValue(*value);
+  }
+  writer.EndDictionary();
+  return json;
+}
+
+void OnShardWritten(const std::shared_ptr<ShardedWrite>& write,
+                    size_t index,
+                    std::string json) {
+  write->shards[index] = std::move(json);
+  if (--write->pending > 0)
+    return;
+
+  size_t size = 2;
+  for (const auto& shard : write->shards)
+    size += shard.size();
+  std::string result;
+  result.reserve(size);
+  result.push_back('{');
+  // Each shard is an object of its own, of which only the members are kept.
+  for (const auto& shard : write->shards) {
+    if (shard.size() <= 2)
+      continue;
+    if (result.size() > 1)
+      result.push_back(',');
+    result.append(shard, 1, shard.size() - 2);
+  }
+  result.push_back('}');
+  write->callback.Run(std::move(result));
+}
+
+}  // namespace
+
+void WriteJsonInShards(provider::WorkerPool* worker_pool,
+                       const tracked_objects::Location& from_here,
+                       const std::shared_ptr<const base::DictionaryValue>& dict,
+                       size_t max_shards,
+                       const base::Callback<void(std::string)>& callback) {
+  CHECK(dict);
+  CHECK_GT(max_shards, 0u);
+  if (!worker_pool)
+    max_shards = 1;
+  std::vector<std::vector<std::string>> shard_keys(1);
+  size_t shard_size = std::max<size_t>(
+      (dict->size() + max_shards - 1) / max_shards, 1);
+  for (base::DictionaryValue::Iterator it(*dict); !it.IsAtEnd(); it.Advance()) {
+    if (shard_keys.back().size() >= shard_size)
+      shard_keys.emplace_back();
+    shard_keys.back().push_back(it.key());
+  }
+
+  std::shared_ptr<ShardedWrite> write{new ShardedWrite};
+  write->dict = dict;
+  write->shards.resize(shard_keys.size());
+  write->pending = shard_keys.size();
+  write->callback = callback;
+  for (size_t i = 0; i < shard_keys.size(); ++i) {
+    PostWorkerTaskAndReply(
+        worker_pool, nullptr, from_here,
+        base::Bind(&WriteShard, dict.get(), shard_keys[i]),
+        base::Bind(&OnShardWritten, write, i));
+  }
+}
+
+}  // namespace weave
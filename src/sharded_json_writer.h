@@ -0,0 +1,36 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_SHARDED_JSON_WRITER_H_
+#define LIBWEAVE_SRC_SHARDED_JSON_WRITER_H_
+
+#include <memory>
+#include <string>
+
+#include <base/callback.h>
+#include <base/location.h>
+#include <base/values.h>
+
+namespace weave {
+
+namespace provider {
+class WorkerPool;
+}  // namespace provider
+
+// Serializes |dict| to JSON on |worker_pool| and runs |callback| with the
+// result on the task runner thread. The top-level members of |dict|
+// are split into up to |max_shards| shards, which are written concurrently
+// and joined in order, so the result is the same as of JsonStreamWriter.
+// |dict| must not change until |callback| runs, which the shared immutable
+// snapshots of ComponentManager guarantee. If |worker_pool| is null, |dict|
+// is written and |callback| runs right away.
+void WriteJsonInShards(provider::WorkerPool* worker_pool,
+                       const tracked_objects::Location& from_here,
+                       const std::shared_ptr<const base::DictionaryValue>& dict,
+                       size_t max_shards,
+                       const base::Callback<void(std::string)>& callback);
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_SHARDED_JSON_WRITER_H_
@@ -0,0 +1,108 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/sharded_json_writer.h"
+
+#include <base/bind.h>
+#include <gtest/gtest.h>
+#include <weave/provider/test/mock_worker_pool.h>
+#include <weave/test/unittest_utils.h>
+
+#include "src/json_stream_writer.h"
+
+namespace weave {
+
+using test::CreateDictionaryValue;
+using testing::_;
+using testing::Invoke;
+
+namespace {
+
+const char kComponents[] = R"({
+  "a": {"traits": ["t"], "state": {"t": {"p": 1}}},
+  "b": {"traits": ["t"], "state": {"t": {"p": "x"}}},
+  "c": {"traits": [], "components": {"d": {"traits": []}}},
+  "e": {"traits": ["t"]},
+  "f": {"traits": ["t"], "state": {"t": {"p": [1, 2.5]}}}
+})";
+
+std::string WriteJson(const base::DictionaryValue& dict) {
+  std::string json;
+  JsonStreamWriter writer{&json};
+  writer.WriteValue(dict);
+  return json;
+}
+
+class ShardedJsonWriterTest : public testing::Test {
+ protected:
+  void Write(const std::shared_ptr<const base::DictionaryValue>& dict,
+             provider::WorkerPool* worker_pool,
+             size_t max_shards) {
+    json_.clear();
+    WriteJsonInShards(worker_pool, FROM_HERE, dict, max_shards,
+                      base::Bind(&ShardedJsonWriterTest::OnWritten,
+                                 base::Unretained(this)));
+  }
+
+  void OnWritten(std::string json) {
+    json_ = std::move(json);
+    ++written_;
+  }
+
+  provider::test::MockWorkerPool worker_pool_;
+  std::string json_;
+  int written_{0};
+};
+
+}  // namespace
+
+TEST_F(ShardedJsonWriterTest, WithoutWorkerPool) {
+  std::shared_ptr<const base::DictionaryValue> dict{
+      CreateDictionaryValue(kComponents)};
+  Write(dict, nullptr, 4);
+  EXPECT_EQ(1, written_);
+  EXPECT_EQ(WriteJson(*dict), json_);
+}
+
+TEST_F(ShardedJsonWriterTest, Shards) {
+  std::shared_ptr<const base::DictionaryValue> dict{
+      CreateDictionaryValue(kComponents)};
+  for (size_t max_shards : {1, 2, 3, 5, 8}) {
+    std::vector<base::Closure> tasks;
+    std::vector<base::Closure> replies;
+    EXPECT_CALL(worker_pool_, PostTaskAndReply(_, _, _))
+        .WillRepeatedly(Invoke([&tasks, &replies](
+            const tracked_objects::Location&, const base::Closure& task,
+            const base::Closure& reply) {
+          tasks.push_back(task);
+          replies.push_back(reply);
+        }));
+    Write(dict, &worker_pool_, max_shards);
+    EXPECT_EQ(std::min<size_t>(max_shards, dict->size()), tasks.size());
+
+    // Shards may be written, and replied to, in any order.
+    for (auto it = tasks.rbegin(); it != tasks.rend(); ++it)
+      it->Run();
+    EXPECT_TRUE(json_.empty());
+    for (auto it = replies.rbegin(); it != replies.rend(); ++it)
+      it->Run();
+    EXPECT_EQ(WriteJson(*dict), json_) << max_shards;
+  }
+  EXPECT_EQ(5, written_);
+}
+
+TEST_F(ShardedJsonWriterTest, Empty) {
+  std::shared_ptr<const base::DictionaryValue> dict{new base::DictionaryValue};
+  base::Closure task;
+  base::Closure reply;
+  EXPECT_CALL(worker_pool_, PostTaskAndReply(_, _, _))
+      .WillOnce(testing::DoAll(testing::SaveArg<1>(&task),
+                               testing::SaveArg<2>(&reply)));
+  Write(dict, &worker_pool_, 4);
+  task.Run();
+  reply.Run();
+  EXPECT_EQ("{}", json_);
+}
+
+}  // namespace weave
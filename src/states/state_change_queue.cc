@@ -4,18 +4,78 @@
 
 #include "src/states/state_change_queue.h"
 
+#include <algorithm>
+
 #include <base/logging.h>
 
 namespace weave {
 
+namespace {
+
+const size_t kNoSlot = static_cast<size_t>(-1);
+
+StateHistoryPolicy MergeOldestPolicy(size_t max_queue_size) {
+  StateHistoryPolicy policy;
+  policy.capacity = max_queue_size;
+  return policy;
+}
+
+}  // anonymous namespace
+
 StateChangeQueue::StateChangeQueue(size_t max_queue_size)
-    : max_queue_size_(max_queue_size) {
+    : StateChangeQueue{MergeOldestPolicy(max_queue_size)} {}
+
+StateChangeQueue::StateChangeQueue(const StateHistoryPolicy& policy)
+    : max_queue_size_(policy.capacity),
+      overflow_{policy.overflow},
+      sample_interval_{policy.sample_interval} {
   CHECK_GT(max_queue_size_, 0U) << "Max queue size must not be zero";
+  CHECK_GT(sample_interval_, 0U) << "Sample interval must not be zero";
+  if (overflow_ == StateHistoryPolicy::Overflow::kCoalesce)
+    records_.resize(max_queue_size_);
 }
 
 bool StateChangeQueue::NotifyPropertiesUpdated(
     base::Time timestamp,
     const base::DictionaryValue& changed_properties) {
+  if (overflow_ == StateHistoryPolicy::Overflow::kCoalesce)
+    NotifyCoalescedUpdated(timestamp, changed_properties);
+  else
+    NotifyHistoryUpdated(timestamp, changed_properties);
+  return true;
+}
+
+std::vector<StateChange> StateChangeQueue::GetAndClearRecordedStateChanges() {
+  if (overflow_ == StateHistoryPolicy::Overflow::kCoalesce)
+    return GetAndClearCoalesced();
+  return GetAndClearHistory();
+}
+
+bool StateChangeQueue::HasPolicy(const StateHistoryPolicy& policy) const {
+  return max_queue_size_ == policy.capacity && overflow_ == policy.overflow &&
+         sample_interval_ == policy.sample_interval;
+}
+
+void StateChangeQueue::NotifyHistoryUpdated(
+    base::Time timestamp,
+    const base::DictionaryValue& changed_properties) {
+  if (overflow_ == StateHistoryPolicy::Overflow::kSampleEveryN &&
+      !state_changes_.empty() &&
+      ++notifications_since_sample_ < sample_interval_) {
+    // Not a sample, fold the change into the latest record and move it to
+    // the new timestamp.
+    auto latest = std::prev(state_changes_.end());
+    if (latest->first < timestamp) {
+      std::unique_ptr<base::DictionaryValue> properties =
+          std::move(latest->second);
+      state_changes_.erase(latest);
+      latest = state_changes_.emplace(timestamp, std::move(properties)).first;
+    }
+    latest->second->MergeDictionary(&changed_properties);
+    return;
+  }
+  notifications_since_sample_ = 0;
+
   auto& stored_changes = state_changes_[timestamp];
   // Merge the old property set.
   if (stored_changes)
@@ -24,30 +84,220 @@ bool StateChangeQueue::NotifyPropertiesUpdated(
     stored_changes = changed_properties.CreateDeepCopy();
 
   while (state_changes_.size() > max_queue_size_) {
+    if (overflow_ == StateHistoryPolicy::Overflow::kDropIntermediate) {
+      // Merge the two newest records, keeping the values and the timestamp of
+      // the newest one.
+      auto element_new = std::prev(state_changes_.end());
+      auto element_old = std::prev(element_new);
+      element_old->second->MergeDictionary(element_new->second.get());
+      std::swap(element_old->second, element_new->second);
+      state_changes_.erase(element_old);
+      continue;
+    }
     // Queue is full.
-    // Merge the two oldest records into one. The merge strategy is:
-    //  - Move non-existent properties from element [old] to [new].
-    //  - If both [old] and [new] specify the same property,
-    //    keep the value of [new].
-    //  - Keep the timestamp of [new].
-    auto element_old = state_changes_.begin();
-    auto element_new = std::next(element_old);
-    // This will skip elements that exist in both [old] and [new].
-    element_old->second->MergeDictionary(element_new->second.get());
-    std::swap(element_old->second, element_new->second);
-    state_changes_.erase(element_old);
+    MergeOldestRecords();
   }
-  return true;
 }
 
-std::vector<StateChange> StateChangeQueue::GetAndClearRecordedStateChanges() {
+void StateChangeQueue::MergeOldestRecords() {
+  // The merge strategy is:
+  //  - Move non-existent properties from element [old] to [new].
+  //  - If both [old] and [new] specify the same property,
+  //    keep the value of [new].
+  //  - Keep the timestamp of [new].
+  auto element_old = state_changes_.begin();
+  auto element_new = std::next(element_old);
+  // This will skip elements that exist in both [old] and [new].
+  element_old->second->MergeDictionary(element_new->second.get());
+  std::swap(element_old->second, element_new->second);
+  state_changes_.erase(element_old);
+}
+
+std::vector<StateChange> StateChangeQueue::GetAndClearHistory() {
   std::vector<StateChange> changes;
   changes.reserve(state_changes_.size());
   for (auto& pair : state_changes_) {
     changes.push_back(StateChange{pair.first, std::move(pair.second)});
   }
   state_changes_.clear();
+  notifications_since_sample_ = 0;
+  return changes;
+}
+
+void StateChangeQueue::NotifyCoalescedUpdated(
+    base::Time timestamp,
+    const base::DictionaryValue& changed_properties) {
+  for (base::DictionaryValue::Iterator it_trait(changed_properties);
+       !it_trait.IsAtEnd(); it_trait.Advance()) {
+    const base::DictionaryValue* trait = nullptr;
+    if (!it_trait.value().GetAsDictionary(&trait)) {
+      // Not a trait object, record the value as is.
+      RecordProperty(timestamp, it_trait.key(), std::string{},
+                     it_trait.value());
+      continue;
+    }
+    for (base::DictionaryValue::Iterator it_prop(*trait); !it_prop.IsAtEnd();
+         it_prop.Advance()) {
+      RecordProperty(timestamp, it_trait.key(), it_prop.key(),
+                     it_prop.value());
+    }
+  }
+}
+
+void StateChangeQueue::RecordProperty(base::Time timestamp,
+                                      const std::string& trait,
+                                      const std::string& name,
+                                      const base::Value& value) {
+  auto p = property_ids_.find(
+      std::pair<const std::string&, const std::string&>{trait, name});
+  size_t property_id = 0;
+  if (p == property_ids_.end()) {
+    property_id = property_names_.size();
+    property_names_.emplace_back(StringAtom{trait}, StringAtom{name});
+    property_ids_.emplace(property_names_.back(), property_id);
+    property_slots_.push_back(kNoSlot);
+  } else {
+    property_id = p->second;
+  }
+
+  size_t& live_slot = property_slots_[property_id];
+  std::unique_ptr<base::Value> new_value;
+  base::DictionaryValue* live_dict = nullptr;
+  const base::DictionaryValue* dict = nullptr;
+  if (live_slot != kNoSlot &&
+      records_[live_slot].value->GetAsDictionary(&live_dict) &&
+      value.GetAsDictionary(&dict)) {
+    // Objects may be changed member by member, so the new members are merged
+    // into the older record rather than replacing it.
+    live_dict->MergeDictionary(dict);
+    new_value = std::move(records_[live_slot].value);
+  } else {
+    new_value = value.CreateDeepCopy();
+  }
+  if (live_slot != kNoSlot && live_slot + 1 == record_count_ &&
+      records_[live_slot].timestamp == timestamp) {
+    // The property is the most recent record already, update it in place.
+    records_[live_slot].value = std::move(new_value);
+    return;
+  }
+  if (live_slot != kNoSlot) {
+    // Last write wins, the older record is superseded.
+    records_[live_slot].value.reset();
+    live_slot = kNoSlot;
+  }
+
+  ReserveRecord();
+  size_t slot = record_count_;
+  records_[slot].timestamp = timestamp;
+  records_[slot].property_id = property_id;
+  records_[slot].value = std::move(new_value);
+  record_count_++;
+  property_slots_[property_id] = slot;
+}
+
+void StateChangeQueue::ReserveRecord() {
+  if (record_count_ < records_.size())
+    return;
+
+  // Compact the buffer by dropping superseded records. If every record is
+  // still live, grow the buffer geometrically, so the compactions stay rare.
+  DropSupersededRecords();
+  if (record_count_ == records_.size())
+    records_.resize(records_.size() * 2);
+}
+
+void StateChangeQueue::DropSupersededRecords() {
+  size_t live_records = 0;
+  for (size_t i = 0; i < record_count_; i++) {
+    PropertyRecord& record = records_[i];
+    if (!record.value)
+      continue;
+    property_slots_[record.property_id] = live_records;
+    if (i != live_records)
+      records_[live_records] = std::move(record);
+    live_records++;
+  }
+  record_count_ = live_records;
+}
+
+std::vector<StateChange> StateChangeQueue::GetAndClearCoalesced() {
+  // The records are in the order they were added, the timestamps may go back
+  // with the wall clock.
+  DropSupersededRecords();
+  std::stable_sort(records_.begin(), records_.begin() + record_count_,
+                   [](const PropertyRecord& a, const PropertyRecord& b) {
+                     return a.timestamp < b.timestamp;
+                   });
+  std::vector<StateChange> changes;
+  for (size_t i = 0; i < record_count_; i++) {
+    PropertyRecord& record = records_[i];
+    // Records with the same timestamp are reported together.
+    if (changes.empty() || changes.back().timestamp != record.timestamp) {
+      changes.push_back(StateChange{
+          record.timestamp,
+          std::unique_ptr<base::DictionaryValue>{new base::DictionaryValue}});
+    }
+    base::DictionaryValue* properties = changes.back().changed_properties.get();
+    const auto& name = property_names_[record.property_id];
+    if (name.second.empty()) {
+      properties->SetWithoutPathExpansion(name.first.str(),
+                                          std::move(record.value));
+      continue;
+    }
+    base::DictionaryValue* trait = nullptr;
+    if (!properties->GetDictionaryWithoutPathExpansion(name.first.str(),
+                                                       &trait)) {
+      trait = new base::DictionaryValue;
+      properties->SetWithoutPathExpansion(name.first.str(), trait);
+    }
+    trait->SetWithoutPathExpansion(name.second.str(), std::move(record.value));
+  }
+  record_count_ = 0;
+  std::fill(property_slots_.begin(), property_slots_.end(), kNoSlot);
   return changes;
 }
 
+MemoryUsage StateChangeQueue::GetMemoryUsage() const {
+  MemoryUsage usage;
+  if (!IsCoalescing()) {
+    usage.count = state_changes_.size();
+    for (const auto& pair : state_changes_) {
+      usage.bytes += kTreeNodeOverhead + sizeof(pair) +
+                     EstimateMemoryUsage(*pair.second);
+    }
+    return usage;
+  }
+
+  usage.bytes = records_.capacity() * sizeof(PropertyRecord) +
+                property_slots_.capacity() * sizeof(size_t) +
+                property_names_.capacity() * sizeof(property_names_.front());
+  for (size_t i = 0; i < record_count_; i++) {
+    if (records_[i].value) {
+      usage.count++;
+      usage.bytes += EstimateMemoryUsage(*records_[i].value);
+    }
+  }
+  // The property names themselves are counted in the atom table.
+  usage.bytes += property_ids_.size() *
+                 (kTreeNodeOverhead + sizeof(*property_ids_.begin()));
+  return usage;
+}
+
+void StateChangeQueue::MergeHistory() {
+  if (IsCoalescing())
+    return Compact();
+  while (state_changes_.size() > 1)
+    MergeOldestRecords();
+}
+
+void StateChangeQueue::Compact() {
+  if (!IsCoalescing())
+    return;
+  DropSupersededRecords();
+  if (records_.size() > max_queue_size_) {
+    records_.resize(std::max(record_count_, max_queue_size_));
+    ShrinkToFit(&records_);
+  }
+}
+
 }  // namespace weave
@@ -7,11 +7,18 @@
 
 #include <map>
 #include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 #include <base/macros.h>
 #include <base/time/time.h>
 #include <base/values.h>
+#include <weave/device.h>
+
+#include "src/memory_usage.h"
+#include "src/string_atom.h"
 
 namespace weave {
 
@@ -30,20 +37,116 @@ struct StateChange {
 // An object to record and retrieve device state change notification events.
 class StateChangeQueue {
  public:
+  // Creates a queue which merges the oldest records when it is full.
   explicit StateChangeQueue(size_t max_queue_size);
 
+  // Creates a queue recording changes according to |policy|.
+  // With StateHistoryPolicy::Overflow::kCoalesce only the latest value of
+  // every property (last write wins) is kept, in a preallocated buffer of
+  // |policy.capacity| per-property records. Records superseded by newer
+  // values are dropped when the buffer fills up, so bursts of updates of the
+  // same properties need no new records. The buffer grows only if more
+  // distinct properties than its capacity are changed between two reads.
+  explicit StateChangeQueue(const StateHistoryPolicy& policy);
+
   bool NotifyPropertiesUpdated(base::Time timestamp,
                                const base::DictionaryValue& changed_properties);
+  // Returns true if only the latest value of every property is kept.
+  bool IsCoalescing() const {
+    return overflow_ == StateHistoryPolicy::Overflow::kCoalesce;
+  }
+  // Returns the recorded changes, oldest first, and clears the queue. The
+  // buffers are kept for the changes recorded next.
   std::vector<StateChange> GetAndClearRecordedStateChanges();
+  // Returns true if no changes are recorded.
+  bool IsEmpty() const {
+    return IsCoalescing() ? record_count_ == 0 : state_changes_.empty();
+  }
+  // Returns true if the queue records changes according to |policy|.
+  bool HasPolicy(const StateHistoryPolicy& policy) const;
+
+  // Returns the number of recorded changes and the approximate memory used
+  // by the queue.
+  MemoryUsage GetMemoryUsage() const;
+
+  // Drops the superseded records and shrinks the buffer of the coalescing
+  // mode back to the capacity of the policy, if it had to grow.
+  void Compact();
+
+  // Merges all the recorded changes into one, with the latest value of every
+  // property and the timestamp of the newest change. Same as Compact() in the
+  // coalescing mode, which keeps one record per property already.
+  void MergeHistory();
 
  private:
-  // Maximum queue size. If it is full, the oldest state update records are
-  // merged together until the queue size is within the size limit.
+  // A single property value recorded in the coalescing mode.
+  // |value| is null if the record was superseded by a newer one.
+  struct PropertyRecord {
+    base::Time timestamp;
+    size_t property_id{0};
+    std::unique_ptr<base::Value> value;
+  };
+
+  // Orders the (trait, property) names, interned or not, so a property is
+  // looked up without interning its names.
+  struct PropertyNameLess {
+    using is_transparent = void;
+    template <typename A, typename B>
+    bool operator()(const A& a, const B& b) const {
+      return std::tie(Str(a.first), Str(a.second)) <
+             std::tie(Str(b.first), Str(b.second));
+    }
+    static const std::string& Str(const StringAtom& atom) {
+      return atom.str();
+    }
+    static const std::string& Str(const std::string& str) { return str; }
+  };
+
+  void NotifyHistoryUpdated(base::Time timestamp,
+                            const base::DictionaryValue& changed_properties);
+  void NotifyCoalescedUpdated(base::Time timestamp,
+                              const base::DictionaryValue& changed_properties);
+  std::vector<StateChange> GetAndClearHistory();
+  // Merges the two oldest records of the history into one.
+  void MergeOldestRecords();
+  std::vector<StateChange> GetAndClearCoalesced();
+
+  // Records the new |value| of the property |trait|.|name|. An object |value|
+  // is merged into the live record of the property, if any.
+  void RecordProperty(base::Time timestamp,
+                      const std::string& trait,
+                      const std::string& name,
+                      const base::Value& value);
+  // Makes room for at least one more record in |records_|, dropping superseded
+  // records first.
+  void ReserveRecord();
+  // Moves the live records to the front of |records_|.
+  void DropSupersededRecords();
+
+  // Maximum queue size. If it is full, the state update records are merged
+  // together, according to the overflow policy, until the queue size is
+  // within the size limit.
   const size_t max_queue_size_;
+  const StateHistoryPolicy::Overflow overflow_;
+  const size_t sample_interval_;
+  // Number of notifications received since the last new history record.
+  size_t notifications_since_sample_{0};
 
   // Accumulated list of device state change notifications.
   std::map<base::Time, std::unique_ptr<base::DictionaryValue>> state_changes_;
 
+  // Preallocated property records used by the coalescing mode, in the order
+  // they were added. Only the first |record_count_| are in use.
+  std::vector<PropertyRecord> records_;
+  size_t record_count_{0};
+  // Interned (trait, property) names. The position in this list is the
+  // property ID used in |PropertyRecord|.
+  std::vector<std::pair<StringAtom, StringAtom>> property_names_;
+  std::map<std::pair<StringAtom, StringAtom>, size_t, PropertyNameLess>
+      property_ids_;
+  // Index in |records_| of the live record of every property ID, or -1 if none.
+  std::vector<size_t> property_slots_;
+
   DISALLOW_COPY_AND_ASSIGN(StateChangeQueue);
 };
 
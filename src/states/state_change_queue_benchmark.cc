@@ -0,0 +1,51 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/states/state_change_queue.h"
+
+#include <base/logging.h>
+#include <base/values.h>
+#include <weave/test/unittest_utils.h>
+
+#include "src/test/benchmark.h"
+
+namespace weave {
+
+namespace {
+
+// Records updates of a few properties and reads them in batches, the way
+// changes are queued between two cloud state patches.
+void RunChurn(StateChangeQueue* queue, test::BenchmarkState* state) {
+  auto first = test::CreateDictionaryValue(
+      "{'brightness': {'brightness': 10}, 'onOff': {'state': 'on'}}");
+  auto second = test::CreateDictionaryValue(
+      "{'brightness': {'brightness': 90}, 'color': {'hue': 0.5}}");
+  base::Time timestamp = base::Time::FromTimeT(1450000000);
+  size_t i = 0;
+  while (state->KeepRunning()) {
+    timestamp += base::TimeDelta::FromMilliseconds(10);
+    const base::DictionaryValue& changes = ++i % 2 ? *first : *second;
+    CHECK(queue->NotifyPropertiesUpdated(timestamp, changes));
+    if (i % 250 == 0)
+      queue->GetAndClearRecordedStateChanges();
+  }
+}
+
+void BM_StateChangeQueueMergeOldest(test::BenchmarkState* state) {
+  StateChangeQueue queue{100};
+  RunChurn(&queue, state);
+}
+WEAVE_BENCHMARK(BM_StateChangeQueueMergeOldest);
+
+void BM_StateChangeQueueCoalesce(test::BenchmarkState* state) {
+  StateHistoryPolicy policy;
+  policy.overflow = StateHistoryPolicy::Overflow::kCoalesce;
+  StateChangeQueue queue{policy};
+  RunChurn(&queue, state);
+}
+WEAVE_BENCHMARK(BM_StateChangeQueueCoalesce);
+
+}  // namespace
+
+}  // namespace weave
@@ -4,6 +4,7 @@
 
 #include "src/states/state_change_queue.h"
 
+#include <base/strings/stringprintf.h>
 #include <gtest/gtest.h>
 #include <weave/test/unittest_utils.h>
 
@@ -116,4 +117,239 @@ TEST_F(StateChangeQueueTest, MaxQueueSize) {
   EXPECT_JSON_EQ(expected2, *changes[1].changed_properties);
 }
 
+TEST_F(StateChangeQueueTest, MergeHistory) {
+  base::Time start_time = base::Time::Now();
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+        start_time + base::TimeDelta::FromMinutes(i),
+        *CreateDictionaryValue(base::StringPrintf(
+            "{'prop': {'name1': %d, 'name%d': true}}", i, i + 2))));
+  }
+  queue_->MergeHistory();
+
+  auto changes = queue_->GetAndClearRecordedStateChanges();
+  ASSERT_EQ(1u, changes.size());
+  EXPECT_EQ(start_time + base::TimeDelta::FromMinutes(2), changes[0].timestamp);
+  EXPECT_JSON_EQ(
+      "{'prop': {'name1': 2, 'name2': true, 'name3': true, 'name4': true}}",
+      *changes[0].changed_properties);
+}
+
+TEST_F(StateChangeQueueTest, CoalescingLastWriteWins) {
+  StateHistoryPolicy policy;
+  policy.capacity = 2;
+  policy.overflow = StateHistoryPolicy::Overflow::kCoalesce;
+  queue_.reset(new StateChangeQueue(policy));
+  base::Time start_time = base::Time::Now();
+  base::TimeDelta time_delta1 = base::TimeDelta::FromMinutes(1);
+  base::TimeDelta time_delta2 = base::TimeDelta::FromMinutes(3);
+
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      start_time,
+      *CreateDictionaryValue("{'prop': {'name1': 1, 'name2': 2}}")));
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      start_time + time_delta1,
+      *CreateDictionaryValue("{'prop': {'name1': 3}}")));
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      start_time + time_delta2,
+      *CreateDictionaryValue("{'prop': {'name1': 5}, 'other': {'name2': 6}}")));
+
+  auto changes = queue_->GetAndClearRecordedStateChanges();
+  ASSERT_EQ(2u, changes.size());
+  EXPECT_EQ(start_time, changes[0].timestamp);
+  EXPECT_JSON_EQ("{'prop': {'name2': 2}}", *changes[0].changed_properties);
+  EXPECT_EQ(start_time + time_delta2, changes[1].timestamp);
+  EXPECT_JSON_EQ("{'prop': {'name1': 5}, 'other': {'name2': 6}}",
+                 *changes[1].changed_properties);
+  EXPECT_TRUE(queue_->GetAndClearRecordedStateChanges().empty());
+
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      start_time, *CreateDictionaryValue("{'prop': {'name1': 7}}")));
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      start_time, *CreateDictionaryValue("{'prop': {'name1': 8}}")));
+  changes = queue_->GetAndClearRecordedStateChanges();
+  ASSERT_EQ(1u, changes.size());
+  EXPECT_JSON_EQ("{'prop': {'name1': 8}}", *changes[0].changed_properties);
+}
+
+TEST_F(StateChangeQueueTest, CoalescingGroupByTimestamp) {
+  StateHistoryPolicy policy;
+  policy.capacity = 100;
+  policy.overflow = StateHistoryPolicy::Overflow::kCoalesce;
+  queue_.reset(new StateChangeQueue(policy));
+  base::Time timestamp = base::Time::Now();
+  base::TimeDelta time_delta = base::TimeDelta::FromMinutes(1);
+
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      timestamp, *CreateDictionaryValue("{'prop': {'name1': 1}}")));
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      timestamp, *CreateDictionaryValue("{'prop': {'name2': 2}}")));
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      timestamp, *CreateDictionaryValue("{'prop': {'name1': 3}}")));
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      timestamp + time_delta,
+      *CreateDictionaryValue("{'prop': {'name3': 4}}")));
+
+  auto changes = queue_->GetAndClearRecordedStateChanges();
+  ASSERT_EQ(2u, changes.size());
+  EXPECT_EQ(timestamp, changes[0].timestamp);
+  EXPECT_JSON_EQ("{'prop': {'name1': 3, 'name2': 2}}",
+                 *changes[0].changed_properties);
+  EXPECT_EQ(timestamp + time_delta, changes[1].timestamp);
+  EXPECT_JSON_EQ("{'prop': {'name3': 4}}", *changes[1].changed_properties);
+}
+
+TEST_F(StateChangeQueueTest, CoalescingSortsByTimestamp) {
+  StateHistoryPolicy policy;
+  policy.overflow = StateHistoryPolicy::Overflow::kCoalesce;
+  queue_.reset(new StateChangeQueue(policy));
+  base::Time timestamp = base::Time::Now();
+  base::TimeDelta time_delta = base::TimeDelta::FromMinutes(1);
+
+  // The clock went back between the changes.
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      timestamp + time_delta,
+      *CreateDictionaryValue("{'prop': {'name1': 1}}")));
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      timestamp, *CreateDictionaryValue("{'prop': {'name2': 2}}")));
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      timestamp + time_delta,
+      *CreateDictionaryValue("{'prop': {'name3': 3}}")));
+
+  auto changes = queue_->GetAndClearRecordedStateChanges();
+  ASSERT_EQ(2u, changes.size());
+  EXPECT_EQ(timestamp, changes[0].timestamp);
+  EXPECT_JSON_EQ("{'prop': {'name2': 2}}", *changes[0].changed_properties);
+  EXPECT_EQ(timestamp + time_delta, changes[1].timestamp);
+  EXPECT_JSON_EQ("{'prop': {'name1': 1, 'name3': 3}}",
+                 *changes[1].changed_properties);
+  EXPECT_TRUE(queue_->IsEmpty());
+}
+
+TEST_F(StateChangeQueueTest, CoalescingMergesObjects) {
+  StateHistoryPolicy policy;
+  policy.capacity = 100;
+  policy.overflow = StateHistoryPolicy::Overflow::kCoalesce;
+  queue_.reset(new StateChangeQueue(policy));
+  base::Time timestamp = base::Time::Now();
+  base::TimeDelta time_delta = base::TimeDelta::FromMinutes(1);
+
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      timestamp,
+      *CreateDictionaryValue("{'prop': {'obj': {'a': 1, 'b': {'c': 2}}}}")));
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      timestamp + time_delta,
+      *CreateDictionaryValue("{'prop': {'obj': {'b': {'d': 3}}}}")));
+
+  auto changes = queue_->GetAndClearRecordedStateChanges();
+  ASSERT_EQ(1u, changes.size());
+  EXPECT_EQ(timestamp + time_delta, changes[0].timestamp);
+  EXPECT_JSON_EQ("{'prop': {'obj': {'a': 1, 'b': {'c': 2, 'd': 3}}}}",
+                 *changes[0].changed_properties);
+}
+
+TEST_F(StateChangeQueueTest, CoalescingMorePropertiesThanCapacity) {
+  StateHistoryPolicy policy;
+  policy.capacity = 1;
+  policy.overflow = StateHistoryPolicy::Overflow::kCoalesce;
+  queue_.reset(new StateChangeQueue(policy));
+  base::Time timestamp = base::Time::Now();
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+        timestamp + base::TimeDelta::FromSeconds(i),
+        *CreateDictionaryValue("{'prop': {'name1': 1, 'name2': 2}}")));
+  }
+  auto changes = queue_->GetAndClearRecordedStateChanges();
+  ASSERT_EQ(1u, changes.size());
+  EXPECT_EQ(timestamp + base::TimeDelta::FromSeconds(2), changes[0].timestamp);
+  EXPECT_JSON_EQ("{'prop': {'name1': 1, 'name2': 2}}",
+                 *changes[0].changed_properties);
+}
+
+TEST_F(StateChangeQueueTest, CoalescingCompact) {
+  StateHistoryPolicy policy;
+  policy.capacity = 1;
+  policy.overflow = StateHistoryPolicy::Overflow::kCoalesce;
+  queue_.reset(new StateChangeQueue(policy));
+  size_t empty_bytes = queue_->GetMemoryUsage().bytes;
+  base::Time timestamp = base::Time::Now();
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      timestamp, *CreateDictionaryValue("{'prop': {'a': 1, 'b': 2, 'c': 3}}")));
+  ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+      timestamp + base::TimeDelta::FromSeconds(1),
+      *CreateDictionaryValue("{'prop': {'a': 4}}")));
+  EXPECT_EQ(3u, queue_->GetMemoryUsage().count);
+
+  // Live records are kept.
+  queue_->Compact();
+  EXPECT_EQ(3u, queue_->GetMemoryUsage().count);
+  auto changes = queue_->GetAndClearRecordedStateChanges();
+  ASSERT_EQ(2u, changes.size());
+  EXPECT_JSON_EQ("{'prop': {'b': 2, 'c': 3}}", *changes[0].changed_properties);
+  EXPECT_JSON_EQ("{'prop': {'a': 4}}", *changes[1].changed_properties);
+
+  // The buffer grown for three properties shrinks back to the capacity.
+  size_t grown_bytes = queue_->GetMemoryUsage().bytes;
+  queue_->Compact();
+  MemoryUsage usage = queue_->GetMemoryUsage();
+  EXPECT_EQ(0u, usage.count);
+  EXPECT_GT(grown_bytes, usage.bytes);
+  EXPECT_LT(empty_bytes, usage.bytes);  // The interned names are kept.
+}
+
+TEST_F(StateChangeQueueTest, HistoryMemoryUsage) {
+  EXPECT_EQ(0u, queue_->GetMemoryUsage().count);
+  EXPECT_EQ(0u, queue_->GetMemoryUsage().bytes);
+  base::Time timestamp = base::Time::Now();
+  for (int i = 0; i < 2; i++) {
+    ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+        timestamp + base::TimeDelta::FromSeconds(i),
+        *CreateDictionaryValue("{'prop': {'name': 1}}")));
+  }
+  EXPECT_EQ(2u, queue_->GetMemoryUsage().count);
+  EXPECT_LT(0u, queue_->GetMemoryUsage().bytes);
+}
+
+TEST_F(StateChangeQueueTest, DropIntermediateKeepsOldest) {
+  StateHistoryPolicy policy;
+  policy.capacity = 2;
+  policy.overflow = StateHistoryPolicy::Overflow::kDropIntermediate;
+  queue_.reset(new StateChangeQueue(policy));
+  base::Time timestamp = base::Time::Now();
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+        timestamp + base::TimeDelta::FromSeconds(i),
+        *CreateDictionaryValue(
+            base::StringPrintf("{'prop': {'name%d': %d}}", i % 2, i))));
+  }
+  auto changes = queue_->GetAndClearRecordedStateChanges();
+  ASSERT_EQ(2u, changes.size());
+  EXPECT_EQ(timestamp, changes[0].timestamp);
+  EXPECT_JSON_EQ("{'prop': {'name0': 0}}", *changes[0].changed_properties);
+  EXPECT_EQ(timestamp + base::TimeDelta::FromSeconds(3), changes[1].timestamp);
+  EXPECT_JSON_EQ("{'prop': {'name0': 2, 'name1': 3}}",
+                 *changes[1].changed_properties);
+}
+
+TEST_F(StateChangeQueueTest, SampleEveryN) {
+  StateHistoryPolicy policy;
+  policy.capacity = 10;
+  policy.overflow = StateHistoryPolicy::Overflow::kSampleEveryN;
+  policy.sample_interval = 3;
+  queue_.reset(new StateChangeQueue(policy));
+  base::Time timestamp = base::Time::Now();
+  for (int i = 0; i < 5; i++) {
+    ASSERT_TRUE(queue_->NotifyPropertiesUpdated(
+        timestamp + base::TimeDelta::FromSeconds(i),
+        *CreateDictionaryValue(base::StringPrintf("{'prop': {'name': %d}}",
+                                                  i))));
+  }
+  auto changes = queue_->GetAndClearRecordedStateChanges();
+  ASSERT_EQ(2u, changes.size());
+  EXPECT_EQ(timestamp + base::TimeDelta::FromSeconds(2), changes[0].timestamp);
+  EXPECT_JSON_EQ("{'prop': {'name': 2}}", *changes[0].changed_properties);
+  EXPECT_EQ(timestamp + base::TimeDelta::FromSeconds(4), changes[1].timestamp);
+  EXPECT_JSON_EQ("{'prop': {'name': 4}}", *changes[1].changed_properties);
+}
+
 }  // namespace weave
@@ -0,0 +1,50 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/states/state_slot.h"
+
+#include <base/logging.h>
+#include <base/values.h>
+
+namespace weave {
+
+StateSlot::StateSlot(Type type) : type_{type}, double_value_{0} {}
+
+bool StateSlot::Assign(const base::Value& value) {
+  switch (type_) {
+    case Type::kBoolean:
+      return value.GetAsBoolean(&bool_value_);
+    case Type::kInteger:
+      return value.GetAsInteger(&int_value_);
+    case Type::kDouble:
+      // Integers would become doubles in JSON, leave them to the caller.
+      return value.IsType(base::Value::TYPE_DOUBLE) &&
+             value.GetAsDouble(&double_value_);
+    case Type::kString:
+      return value.GetAsString(&string_value_);
+  }
+  NOTREACHED();
+  return false;
+}
+
+std::unique_ptr<base::Value> StateSlot::ToValue() const {
+  switch (type_) {
+    case Type::kBoolean:
+      return std::unique_ptr<base::Value>{
+          new base::FundamentalValue{bool_value_}};
+    case Type::kInteger:
+      return std::unique_ptr<base::Value>{
+          new base::FundamentalValue{int_value_}};
+    case Type::kDouble:
+      return std::unique_ptr<base::Value>{
+          new base::FundamentalValue{double_value_}};
+    case Type::kString:
+      return std::unique_ptr<base::Value>{
+          new base::StringValue{string_value_}};
+  }
+  NOTREACHED();
+  return nullptr;
+}
+
+}  // namespace weave
@@ -0,0 +1,49 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_STATES_STATE_SLOT_H_
+#define LIBWEAVE_SRC_STATES_STATE_SLOT_H_
+
+#include <memory>
+#include <string>
+
+#include <base/macros.h>
+
+namespace base {
+class Value;
+}  // namespace base
+
+namespace weave {
+
+// Native storage of a scalar state property value. Storing a value of the
+// slot type doesn't allocate, except for strings longer than any stored
+// before, and the JSON value is built only when requested with ToValue().
+class StateSlot final {
+ public:
+  enum class Type { kBoolean, kInteger, kDouble, kString };
+
+  explicit StateSlot(Type type);
+
+  Type type() const { return type_; }
+
+  // Stores |value| if it has exactly the slot type. Returns false and leaves
+  // the slot unchanged otherwise.
+  bool Assign(const base::Value& value);
+  std::unique_ptr<base::Value> ToValue() const;
+
+ private:
+  const Type type_;
+  union {
+    bool bool_value_;
+    int int_value_;
+    double double_value_;
+  };
+  std::string string_value_;
+
+  DISALLOW_COPY_AND_ASSIGN(StateSlot);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_STATES_STATE_SLOT_H_
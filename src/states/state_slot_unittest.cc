@@ -0,0 +1,37 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/states/state_slot.h"
+
+#include <base/values.h>
+#include <gtest/gtest.h>
+#include <weave/test/unittest_utils.h>
+
+namespace weave {
+
+TEST(StateSlot, Assign) {
+  StateSlot boolean{StateSlot::Type::kBoolean};
+  EXPECT_TRUE(boolean.Assign(base::FundamentalValue{true}));
+  EXPECT_FALSE(boolean.Assign(base::FundamentalValue{0}));
+  EXPECT_JSON_EQ("true", *boolean.ToValue());
+
+  StateSlot integer{StateSlot::Type::kInteger};
+  EXPECT_TRUE(integer.Assign(base::FundamentalValue{-3}));
+  EXPECT_FALSE(integer.Assign(base::FundamentalValue{2.5}));
+  EXPECT_FALSE(integer.Assign(base::StringValue{"1"}));
+  EXPECT_JSON_EQ("-3", *integer.ToValue());
+
+  StateSlot number{StateSlot::Type::kDouble};
+  EXPECT_TRUE(number.Assign(base::FundamentalValue{2.5}));
+  EXPECT_FALSE(number.Assign(base::FundamentalValue{2}));
+  EXPECT_JSON_EQ("2.5", *number.ToValue());
+
+  StateSlot string{StateSlot::Type::kString};
+  EXPECT_TRUE(string.Assign(base::StringValue{"standby"}));
+  EXPECT_TRUE(string.Assign(base::StringValue{"on"}));
+  EXPECT_FALSE(string.Assign(*base::Value::CreateNullValue()));
+  EXPECT_JSON_EQ("'on'", *string.ToValue());
+}
+
+}  // namespace weave
@@ -0,0 +1,193 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/states/state_spool.h"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <weave/provider/config_store.h>
+
+#include "src/json_stream_writer.h"
+#include "src/utils.h"
+
+namespace weave {
+
+namespace {
+
+const char kSpoolName[] = "state_spool";
+
+// Merges the changes of every component into one change, with the timestamp
+// of the newest, in the order of these timestamps.
+std::vector<ComponentStateChange> MergeChanges(
+    std::vector<ComponentStateChange> changes) {
+  std::map<std::string, size_t> merged_index;
+  std::vector<ComponentStateChange> merged;
+  for (auto& change : changes) {
+    auto p = merged_index.find(change.component);
+    if (p == merged_index.end()) {
+      merged_index.emplace(change.component, merged.size());
+      merged.push_back(std::move(change));
+      continue;
+    }
+    ComponentStateChange& target = merged[p->second];
+    target.timestamp = std::max(target.timestamp, change.timestamp);
+    target.changed_properties->MergeDictionary(
+        std::move(change.changed_properties));
+  }
+  std::stable_sort(
+      merged.begin(), merged.end(),
+      [](const ComponentStateChange& a, const ComponentStateChange& b) {
+        return a.timestamp < b.timestamp;
+      });
+  return merged;
+}
+
+}  // anonymous namespace
+
+StateSpool::StateSpool(provider::ConfigStore* config_store,
+                       const StateSpoolPolicy& policy)
+    : config_store_{config_store}, policy_(policy) {
+  CHECK(config_store_);
+  CHECK_GT(policy_.max_segments, 0u);
+  std::string json = config_store_->LoadSettings(kSpoolName);
+  if (json.empty())
+    return;
+  auto index = LoadJsonDict(json, nullptr);
+  std::string first;
+  std::string next;
+  if (!index || !index->GetString("first", &first) ||
+      !index->GetString("next", &next) ||
+      !base::StringToUint64(first, &first_segment_) ||
+      !base::StringToUint64(next, &next_segment_) ||
+      first_segment_ > next_segment_) {
+    LOG(WARNING) << "Invalid state spool index, dropping the spooled changes";
+    first_segment_ = next_segment_ = 0;
+  }
+}
+
+void StateSpool::Append(std::vector<ComponentStateChange> changes,
+                        ComponentManager::UpdateID update_id) {
+  last_update_id_ = std::max(last_update_id_, update_id);
+  if (changes.empty())
+    return;
+  if (GetSegmentCount() >= policy_.max_segments) {
+    // The changes of the oldest segment are merged into the next one, or into
+    // the new changes if the oldest is the only segment.
+    auto merged = LoadSegment(first_segment_);
+    if (GetSegmentCount() == 1) {
+      std::move(changes.begin(), changes.end(), std::back_inserter(merged));
+      changes = MergeChanges(std::move(merged));
+    } else {
+      auto next = LoadSegment(first_segment_ + 1);
+      std::move(next.begin(), next.end(), std::back_inserter(merged));
+      SaveSegment(first_segment_ + 1, MergeChanges(std::move(merged)));
+    }
+    RemoveSegment(first_segment_++);
+  }
+  SaveSegment(next_segment_++, changes);
+  SaveIndex();
+}
+
+ComponentManager::UpdateID StateSpool::TakeOldest(
+    std::deque<ComponentStateChange>* changes) {
+  if (IsEmpty())
+    return 0;
+  auto oldest = LoadSegment(first_segment_);
+  std::move(oldest.begin(), oldest.end(), std::back_inserter(*changes));
+  RemoveSegment(first_segment_++);
+  SaveIndex();
+  return IsEmpty() ? last_update_id_ : 0;
+}
+
+void StateSpool::Clear() {
+  while (!IsEmpty())
+    RemoveSegment(first_segment_++);
+  SaveIndex();
+}
+
+std::string StateSpool::GetSegmentName(uint64_t segment) const {
+  return kSpoolName + ('_' + std::to_string(segment));
+}
+
+std::vector<ComponentStateChange> StateSpool::LoadSegment(
+    uint64_t segment) const {
+  std::vector<ComponentStateChange> changes;
+  ErrorPtr error;
+  auto dict = LoadJsonDict(config_store_->LoadSettings(GetSegmentName(segment)),
+                           &error);
+  const base::ListValue* patches = nullptr;
+  if (!dict || !dict->GetList("patches", &patches)) {
+    LOG(WARNING) << "Failed to load state spool segment " << segment;
+    return changes;
+  }
+  changes.reserve(patches->GetSize());
+  for (const auto& value : *patches) {
+    const base::DictionaryValue* patch = nullptr;
+    const base::DictionaryValue* properties = nullptr;
+    std::string time_ms;
+    std::string component;
+    int64_t time = 0;
+    if (!value->GetAsDictionary(&patch) ||
+        !patch->GetString("timeMs", &time_ms) ||
+        !base::StringToInt64(time_ms, &time) ||
+        !patch->GetString("component", &component) ||
+        !patch->GetDictionary("patch", &properties)) {
+      continue;
+    }
+    changes.emplace_back(
+        base::Time::UnixEpoch() + base::TimeDelta::FromMilliseconds(time),
+        component, properties->CreateDeepCopy());
+  }
+  return changes;
+}
+
+void StateSpool::SaveSegment(uint64_t segment,
+                             const std::vector<ComponentStateChange>& changes) {
+  // Patches are stored in the form they are sent to the server.
+  std::string json;
+  {
+    JsonStreamWriter writer{&json};
+    writer.BeginDictionary();
+    writer.WriteKey("patches");
+    writer.BeginList();
+    for (const auto& change : changes) {
+      writer.BeginDictionary();
+      writer.WriteKey("timeMs");
+      writer.WriteString(std::to_string(change.timestamp.ToJavaTime()));
+      writer.WriteKey("component");
+      writer.WriteString(change.component);
+      writer.WriteKey("patch");
+      writer.WriteValue(*change.changed_properties);
+      writer.EndDictionary();
+    }
+    writer.EndList();
+    writer.EndDictionary();
+  }
+  config_store_->SaveSettings(GetSegmentName(segment), json, {});
+}
+
+void StateSpool::RemoveSegment(uint64_t segment) {
+  // The config store can't delete blobs, an empty one takes no space.
+  config_store_->SaveSettings(GetSegmentName(segment), {}, {});
+}
+
+void StateSpool::SaveIndex() {
+  std::string json;
+  {
+    JsonStreamWriter writer{&json};
+    writer.BeginDictionary();
+    writer.WriteKey("first");
+    writer.WriteString(std::to_string(first_segment_));
+    writer.WriteKey("next");
+    writer.WriteString(std::to_string(next_segment_));
+    writer.EndDictionary();
+  }
+  config_store_->SaveSettings(kSpoolName, json, {});
+}
+
+}  // namespace weave
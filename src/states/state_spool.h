@@ -0,0 +1,68 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_STATES_STATE_SPOOL_H_
+#define LIBWEAVE_SRC_STATES_STATE_SPOOL_H_
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <weave/device.h>
+
+#include "src/component_manager.h"
+
+namespace weave {
+
+namespace provider {
+class ConfigStore;
+}
+
+// Keeps the state changes waiting for the cloud in the config store rather
+// than in memory. The changes are appended in segments, each saved once as a
+// separate settings blob, and taken back oldest first. An index blob lists the
+// segments, so the ones left by the previous run are taken too.
+class StateSpool {
+ public:
+  StateSpool(provider::ConfigStore* config_store,
+             const StateSpoolPolicy& policy);
+
+  const StateSpoolPolicy& policy() const { return policy_; }
+  bool IsEmpty() const { return first_segment_ == next_segment_; }
+  size_t GetSegmentCount() const { return next_segment_ - first_segment_; }
+
+  // Saves |changes|, recorded up to the state update |update_id|, as a new
+  // segment. Merges the two oldest segments if there are too many of them.
+  void Append(std::vector<ComponentStateChange> changes,
+              ComponentManager::UpdateID update_id);
+  // Moves the changes of the oldest segment to the end of |changes| and
+  // removes the segment. Returns the ID of the last state update appended if
+  // the spool is empty now, zero otherwise.
+  ComponentManager::UpdateID TakeOldest(
+      std::deque<ComponentStateChange>* changes);
+  // Removes all the segments.
+  void Clear();
+
+ private:
+  std::string GetSegmentName(uint64_t segment) const;
+  std::vector<ComponentStateChange> LoadSegment(uint64_t segment) const;
+  void SaveSegment(uint64_t segment,
+                   const std::vector<ComponentStateChange>& changes);
+  void RemoveSegment(uint64_t segment);
+  void SaveIndex();
+
+  provider::ConfigStore* config_store_{nullptr};
+  const StateSpoolPolicy policy_;
+  // Segments in [first_segment_, next_segment_) are stored.
+  uint64_t first_segment_{0};
+  uint64_t next_segment_{0};
+  ComponentManager::UpdateID last_update_id_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(StateSpool);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_STATES_STATE_SPOOL_H_
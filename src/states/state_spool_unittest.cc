@@ -0,0 +1,114 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/states/state_spool.h"
+
+#include <map>
+
+#include <gtest/gtest.h>
+#include <weave/provider/test/mock_config_store.h>
+#include <weave/test/unittest_utils.h>
+
+namespace weave {
+
+using test::CreateDictionaryValue;
+using testing::_;
+using testing::Invoke;
+
+class StateSpoolTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    EXPECT_CALL(config_store_, LoadSettings(_))
+        .WillRepeatedly(Invoke([this](const std::string& name) {
+          return blobs_[name];
+        }));
+    EXPECT_CALL(config_store_, SaveSettings(_, _, _))
+        .WillRepeatedly(Invoke([this](const std::string& name,
+                                      const std::string& settings,
+                                      const DoneCallback& callback) {
+          blobs_[name] = settings;
+        }));
+  }
+
+  std::vector<ComponentStateChange> CreateChanges(
+      const std::string& component,
+      std::initializer_list<std::pair<int, const char*>> changes) {
+    std::vector<ComponentStateChange> result;
+    for (const auto& change : changes) {
+      result.emplace_back(start_time_ + base::TimeDelta::FromSeconds(
+                                            change.first),
+                          component, CreateDictionaryValue(change.second));
+    }
+    return result;
+  }
+
+  std::map<std::string, std::string> blobs_;
+  testing::StrictMock<provider::test::MockConfigStore> config_store_{false};
+  base::Time start_time_ = base::Time::UnixEpoch() +
+                           base::TimeDelta::FromMilliseconds(1450000000000);
+};
+
+TEST_F(StateSpoolTest, AppendAndTake) {
+  StateSpool spool{&config_store_, {}};
+  EXPECT_TRUE(spool.IsEmpty());
+  spool.Append(CreateChanges("comp", {{1, "{'t': {'a': 1}}"}}), 5);
+  spool.Append(CreateChanges("comp", {{2, "{'t': {'a': 2}}"},
+                                      {3, "{'t': {'b': 3}}"}}),
+               7);
+  EXPECT_EQ(2u, spool.GetSegmentCount());
+
+  std::deque<ComponentStateChange> changes;
+  EXPECT_EQ(0u, spool.TakeOldest(&changes));
+  ASSERT_EQ(1u, changes.size());
+  EXPECT_EQ(start_time_ + base::TimeDelta::FromSeconds(1),
+            changes[0].timestamp);
+  EXPECT_EQ("comp", changes[0].component);
+  EXPECT_JSON_EQ("{'t': {'a': 1}}", *changes[0].changed_properties);
+
+  // The update ID is returned with the last segment.
+  EXPECT_EQ(7u, spool.TakeOldest(&changes));
+  ASSERT_EQ(3u, changes.size());
+  EXPECT_JSON_EQ("{'t': {'b': 3}}", *changes[2].changed_properties);
+  EXPECT_TRUE(spool.IsEmpty());
+  EXPECT_EQ("", blobs_["state_spool_0"]);
+  EXPECT_EQ("", blobs_["state_spool_1"]);
+}
+
+TEST_F(StateSpoolTest, MergeOldestSegments) {
+  StateSpoolPolicy policy;
+  policy.max_segments = 2;
+  StateSpool spool{&config_store_, policy};
+  spool.Append(CreateChanges("comp1", {{1, "{'t': {'a': 1, 'b': 1}}"}}), 1);
+  spool.Append(CreateChanges("comp1", {{2, "{'t': {'a': 2}}"}}), 2);
+  spool.Append(CreateChanges("comp2", {{3, "{'t': {'c': 3}}"}}), 3);
+  EXPECT_EQ(2u, spool.GetSegmentCount());
+
+  std::deque<ComponentStateChange> changes;
+  spool.TakeOldest(&changes);
+  ASSERT_EQ(1u, changes.size());
+  EXPECT_EQ(start_time_ + base::TimeDelta::FromSeconds(2),
+            changes[0].timestamp);
+  EXPECT_JSON_EQ("{'t': {'a': 2, 'b': 1}}", *changes[0].changed_properties);
+}
+
+TEST_F(StateSpoolTest, Reload) {
+  {
+    StateSpool spool{&config_store_, {}};
+    spool.Append(CreateChanges("comp", {{1, "{'t': {'a': 1}}"}}), 5);
+  }
+  StateSpool spool{&config_store_, {}};
+  EXPECT_EQ(1u, spool.GetSegmentCount());
+  std::deque<ComponentStateChange> changes;
+  // Update IDs of the previous run mean nothing.
+  EXPECT_EQ(0u, spool.TakeOldest(&changes));
+  ASSERT_EQ(1u, changes.size());
+  EXPECT_JSON_EQ("{'t': {'a': 1}}", *changes[0].changed_properties);
+
+  spool.Append(CreateChanges("comp", {{2, "{'t': {'a': 2}}"}}), 1);
+  spool.Clear();
+  EXPECT_TRUE(spool.IsEmpty());
+  EXPECT_TRUE(StateSpool(&config_store_, {}).IsEmpty());
+}
+
+}  // namespace weave
@@ -4,6 +4,8 @@
 
 #include "src/streams.h"
 
+#include <algorithm>
+
 #include <base/bind.h>
 #include <base/callback.h>
 #include <weave/provider/task_runner.h>
@@ -11,9 +13,24 @@
 
 namespace weave {
 
-MemoryStream::MemoryStream(const std::vector<uint8_t>& data,
+namespace {
+
+const size_t kMinCopyChunkSize = 4 * 1024;
+const size_t kMaxCopyChunkSize = 64 * 1024;
+
+// Keeps |data| alive until the write from it is done.
+void OnSharedBufferWritten(std::shared_ptr<const std::vector<uint8_t>> data,
+                           size_t size,
+                           const InputStream::ReadCallback& callback,
+                           ErrorPtr error) {
+  callback.Run(size, std::move(error));
+}
+
+}  // namespace
+
+MemoryStream::MemoryStream(std::vector<uint8_t> data,
                            provider::TaskRunner* task_runner)
-    : data_{data}, task_runner_{task_runner} {}
+    : data_{std::move(data)}, task_runner_{task_runner} {}
 
 void MemoryStream::Read(void* buffer,
                         size_t size_to_read,
@@ -35,36 +52,112 @@ void MemoryStream::Write(const void* buffer,
   task_runner_->PostDelayedTask(FROM_HERE, base::Bind(callback, nullptr), {});
 }
 
+SharedBufferStream::SharedBufferStream(
+    std::shared_ptr<const std::vector<uint8_t>> data,
+    provider::TaskRunner* task_runner)
+    : data_{std::move(data)}, task_runner_{task_runner} {
+  CHECK(data_);
+}
+
+void SharedBufferStream::Read(void* buffer,
+                              size_t size_to_read,
+                              const ReadCallback& callback) {
+  size_t size_read = std::min(size_to_read, data_->size() - read_position_);
+  if (size_read > 0)
+    memcpy(buffer, data_->data() + read_position_, size_read);
+  read_position_ += size_read;
+  task_runner_->PostDelayedTask(FROM_HERE,
+                                base::Bind(callback, size_read, nullptr), {});
+}
+
+bool SharedBufferStream::CopyTo(OutputStream* destination,
+                                const ReadCallback& callback) {
+  size_t size = data_->size() - read_position_;
+  if (!size) {
+    task_runner_->PostDelayedTask(
+        FROM_HERE, base::Bind(callback, size_t{0}, nullptr), {});
+    return true;
+  }
+  const uint8_t* slice = data_->data() + read_position_;
+  read_position_ = data_->size();
+  destination->Write(slice, size, base::Bind(&OnSharedBufferWritten, data_,
+                                             size, callback));
+  return true;
+}
+
 StreamCopier::StreamCopier(InputStream* source, OutputStream* destination)
-    : source_{source}, destination_{destination}, buffer_(4096) {}
+    : source_{source},
+      destination_{destination},
+      chunk_size_{kMinCopyChunkSize} {
+  on_read_done_ =
+      base::Bind(&StreamCopier::OnReadDone, weak_ptr_factory_.GetWeakPtr());
+  on_write_done_ =
+      base::Bind(&StreamCopier::OnWriteDone, weak_ptr_factory_.GetWeakPtr());
+}
 
 void StreamCopier::Copy(const InputStream::ReadCallback& callback) {
-  source_->Read(buffer_.data(), buffer_.size(),
-                base::Bind(&StreamCopier::OnReadDone,
-                           weak_ptr_factory_.GetWeakPtr(), callback));
+  callback_ = callback;
+  if (source_->CopyTo(destination_, callback))
+    return;
+  Pump();
 }
 
-void StreamCopier::OnReadDone(const InputStream::ReadCallback& callback,
-                              size_t size,
-                              ErrorPtr error) {
-  if (error)
-    return callback.Run(0, std::move(error));
+void StreamCopier::Pump() {
+  if (!writing_ && read_size_ && !error_) {
+    read_buffer_.swap(write_buffer_);
+    writing_ = true;
+    size_t size = read_size_;
+    read_size_ = 0;
+    destination_->Write(write_buffer_.data(), size, on_write_done_);
+  }
+
+  if (!reading_ && !read_size_ && !end_of_stream_ && !error_) {
+    if (read_buffer_.size() < chunk_size_)
+      read_buffer_.resize(chunk_size_);
+    reading_ = true;
+    source_->Read(read_buffer_.data(), chunk_size_, on_read_done_);
+  }
+
+  // The buffers must outlive the pending operations.
+  if (reading_ || writing_)
+    return;
+  if (error_)
+    return Finish(error_size_, std::move(error_));
+  if (end_of_stream_ && !read_size_)
+    Finish(size_done_, nullptr);
+}
+
+void StreamCopier::OnReadDone(size_t size, ErrorPtr error) {
+  reading_ = false;
+  if (error) {
+    if (!error_)
+      error_ = std::move(error);
+    return Pump();
+  }
 
   size_done_ += size;
-  if (size) {
-    return destination_->Write(
-        buffer_.data(), size,
-        base::Bind(&StreamCopier::OnWriteDone, weak_ptr_factory_.GetWeakPtr(),
-                   callback));
+  read_size_ = size;
+  if (!size)
+    end_of_stream_ = true;
+  // A full chunk suggests more data is readily available.
+  if (size == chunk_size_)
+    chunk_size_ = std::min(chunk_size_ * 2, kMaxCopyChunkSize);
+  Pump();
+}
+
+void StreamCopier::OnWriteDone(ErrorPtr error) {
+  writing_ = false;
+  if (error && !error_) {
+    error_ = std::move(error);
+    error_size_ = size_done_;
   }
-  callback.Run(size_done_, nullptr);
+  Pump();
 }
 
-void StreamCopier::OnWriteDone(const InputStream::ReadCallback& callback,
-                               ErrorPtr error) {
-  if (error)
-    return callback.Run(size_done_, std::move(error));
-  Copy(callback);
+void StreamCopier::Finish(size_t size, ErrorPtr error) {
+  // The caller may destroy the copier from the callback.
+  InputStream::ReadCallback callback = callback_;
+  callback.Run(size, std::move(error));
 }
 
 }  // namespace weave
@@ -5,6 +5,7 @@
 #ifndef LIBWEAVE_SRC_STREAMS_H_
 #define LIBWEAVE_SRC_STREAMS_H_
 
+#include <memory>
 #include <vector>
 
 #include <base/memory/weak_ptr.h>
@@ -18,8 +19,7 @@ class TaskRunner;
 
 class MemoryStream : public InputStream, public OutputStream {
  public:
-  MemoryStream(const std::vector<uint8_t>& data,
-               provider::TaskRunner* task_runner);
+  MemoryStream(std::vector<uint8_t> data, provider::TaskRunner* task_runner);
 
   void Read(void* buffer,
             size_t size_to_read,
@@ -37,6 +37,28 @@ class MemoryStream : public InputStream, public OutputStream {
   size_t read_position_{0};
 };
 
+// Copies a stream with two buffers, reading the next chunk while the last one
+// is written. Chunks start small and grow while reads fill them, up to a cap.
+// Sources implementing InputStream::CopyTo() copy the data themselves.
+// Input stream over an immutable buffer, which may be shared by many streams
+// and outlives them as long as it is in use. Copying it to a stream writes
+// straight from the buffer.
+class SharedBufferStream : public InputStream {
+ public:
+  SharedBufferStream(std::shared_ptr<const std::vector<uint8_t>> data,
+                     provider::TaskRunner* task_runner);
+
+  void Read(void* buffer,
+            size_t size_to_read,
+            const ReadCallback& callback) override;
+  bool CopyTo(OutputStream* destination, const ReadCallback& callback) override;
+
+ private:
+  std::shared_ptr<const std::vector<uint8_t>> data_;
+  provider::TaskRunner* task_runner_{nullptr};
+  size_t read_position_{0};
+};
+
 class StreamCopier {
  public:
   StreamCopier(InputStream* source, OutputStream* destination);
@@ -44,16 +66,35 @@ class StreamCopier {
   void Copy(const InputStream::ReadCallback& callback);
 
  private:
-  void OnWriteDone(const InputStream::ReadCallback& callback, ErrorPtr error);
-  void OnReadDone(const InputStream::ReadCallback& callback,
-                  size_t size,
-                  ErrorPtr error);
+  // Starts the read and the write which can be started, or finishes the copy
+  // once there are none left.
+  void Pump();
+  void OnWriteDone(ErrorPtr error);
+  void OnReadDone(size_t size, ErrorPtr error);
+  void Finish(size_t size, ErrorPtr error);
 
   InputStream* source_{nullptr};
   OutputStream* destination_{nullptr};
 
   size_t size_done_{0};
-  std::vector<uint8_t> buffer_;
+  size_t chunk_size_{0};
+  // The buffer being read into, and the one being written from. They are
+  // swapped when a chunk is passed from the read to the write.
+  std::vector<uint8_t> read_buffer_;
+  std::vector<uint8_t> write_buffer_;
+  // Size of the chunk in |read_buffer_| waiting for the write to finish.
+  size_t read_size_{0};
+  bool reading_{false};
+  bool writing_{false};
+  bool end_of_stream_{false};
+  // The first error, reported once neither buffer is in use anymore.
+  ErrorPtr error_;
+  size_t error_size_{0};
+
+  InputStream::ReadCallback callback_;
+  // Bound once, so copying a chunk does not allocate new callbacks.
+  InputStream::ReadCallback on_read_done_;
+  OutputStream::WriteCallback on_write_done_;
 
   base::WeakPtrFactory<StreamCopier> weak_ptr_factory_{this};
 };
@@ -5,6 +5,7 @@
 #include "src/streams.h"
 
 #include <functional>
+#include <memory>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -14,6 +15,66 @@
 
 namespace weave {
 
+namespace {
+
+// Records the sizes of the reads.
+class RecordingInputStream : public MemoryStream {
+ public:
+  using MemoryStream::MemoryStream;
+
+  void Read(void* buffer,
+            size_t size_to_read,
+            const ReadCallback& callback) override {
+    read_sizes_.push_back(size_to_read);
+    MemoryStream::Read(buffer, size_to_read, callback);
+  }
+
+  std::vector<size_t> read_sizes_;
+};
+
+// Completes the writes when asked to.
+class ManualOutputStream : public OutputStream {
+ public:
+  void Write(const void* buffer,
+             size_t size_to_write,
+             const WriteCallback& callback) override {
+    EXPECT_TRUE(callback_.is_null());
+    data_.insert(data_.end(), static_cast<const uint8_t*>(buffer),
+                 static_cast<const uint8_t*>(buffer) + size_to_write);
+    last_buffer_ = buffer;
+    callback_ = callback;
+  }
+
+  bool CompleteWrite() {
+    if (callback_.is_null())
+      return false;
+    WriteCallback callback = callback_;
+    callback_.Reset();
+    callback.Run(nullptr);
+    return true;
+  }
+
+  std::vector<uint8_t> data_;
+  const void* last_buffer_{nullptr};
+  WriteCallback callback_;
+};
+
+class PassThroughInputStream : public MemoryStream {
+ public:
+  using MemoryStream::MemoryStream;
+
+  bool CopyTo(OutputStream* destination,
+              const ReadCallback& callback) override {
+    destination_ = destination;
+    callback.Run(42, nullptr);
+    return true;
+  }
+
+  OutputStream* destination_{nullptr};
+};
+
+}  // namespace
+
 TEST(Stream, CopyStreams) {
   provider::test::FakeTaskRunner task_runner;
   std::vector<uint8_t> test_data(1024 * 1024);
@@ -40,4 +101,107 @@ TEST(Stream, CopyStreams) {
   EXPECT_TRUE(done);
 }
 
+TEST(Stream, CopyStreamsOverlapped) {
+  provider::test::FakeTaskRunner task_runner;
+  std::vector<uint8_t> test_data(300 * 1024);
+  for (size_t i = 0; i < test_data.size(); ++i)
+    test_data[i] = static_cast<uint8_t>(std::hash<size_t>()(i));
+  RecordingInputStream source{test_data, &task_runner};
+  ManualOutputStream destination;
+
+  bool done = false;
+  auto callback = base::Bind(
+      [](bool* done, size_t size, ErrorPtr error) {
+        EXPECT_FALSE(error);
+        EXPECT_EQ(300u * 1024, size);
+        *done = true;
+      },
+      base::Unretained(&done));
+  StreamCopier copier{&source, &destination};
+  copier.Copy(callback);
+
+  // The next chunk is read while the first one is written.
+  task_runner.RunOnce();
+  EXPECT_EQ((std::vector<size_t>{4096, 8192}), source.read_sizes_);
+  EXPECT_EQ(4096u, destination.data_.size());
+  // There are no more reads until the write is done.
+  task_runner.RunOnce();
+  EXPECT_EQ(2u, source.read_sizes_.size());
+
+  for (size_t i = 0; i < 100 && !done; ++i) {
+    if (!destination.CompleteWrite())
+      task_runner.RunOnce();
+  }
+  EXPECT_TRUE(done);
+  EXPECT_EQ(test_data, destination.data_);
+  EXPECT_EQ(64u * 1024, source.read_sizes_.back());
+}
+
+TEST(Stream, CopyStreamsPassThrough) {
+  provider::test::FakeTaskRunner task_runner;
+  PassThroughInputStream source{{1, 2, 3}, &task_runner};
+  MemoryStream destination{{}, &task_runner};
+
+  size_t size_copied = 0;
+  StreamCopier copier{&source, &destination};
+  copier.Copy(base::Bind(
+      [](size_t* size_copied, size_t size, ErrorPtr error) {
+        EXPECT_FALSE(error);
+        *size_copied = size;
+      },
+      base::Unretained(&size_copied)));
+  EXPECT_EQ(42u, size_copied);
+  EXPECT_EQ(&destination, source.destination_);
+  EXPECT_EQ(0u, task_runner.GetTaskQueueSize());
+}
+
+TEST(Stream, SharedBufferStream) {
+  provider::test::FakeTaskRunner task_runner;
+  auto data = std::make_shared<const std::vector<uint8_t>>(
+      std::vector<uint8_t>{1, 2, 3, 4, 5});
+  const uint8_t* raw_data = data->data();
+
+  {
+    uint8_t buffer[3] = {};
+    size_t size_read = 0;
+    SharedBufferStream stream{data, &task_runner};
+    stream.Read(buffer, sizeof(buffer),
+                base::Bind(
+                    [](size_t* size_read, size_t size, ErrorPtr error) {
+                      EXPECT_FALSE(error);
+                      *size_read = size;
+                    },
+                    base::Unretained(&size_read)));
+    task_runner.RunOnce();
+    EXPECT_EQ(3u, size_read);
+    EXPECT_EQ((std::vector<uint8_t>{1, 2, 3}),
+              std::vector<uint8_t>(buffer, buffer + size_read));
+  }
+
+  // Copies are written straight from the buffer.
+  std::unique_ptr<SharedBufferStream> stream{
+      new SharedBufferStream{data, &task_runner}};
+  ManualOutputStream destination;
+  bool done = false;
+  StreamCopier copier{stream.get(), &destination};
+  copier.Copy(base::Bind(
+      [](bool* done, size_t size, ErrorPtr error) {
+        EXPECT_FALSE(error);
+        EXPECT_EQ(5u, size);
+        *done = true;
+      },
+      base::Unretained(&done)));
+  EXPECT_EQ(raw_data, destination.last_buffer_);
+  EXPECT_EQ((std::vector<uint8_t>{1, 2, 3, 4, 5}), destination.data_);
+
+  // The buffer stays alive until the write is done.
+  std::weak_ptr<const std::vector<uint8_t>> weak_data = data;
+  data.reset();
+  stream.reset();
+  EXPECT_FALSE(weak_data.expired());
+  EXPECT_TRUE(destination.CompleteWrite());
+  EXPECT_TRUE(done);
+  EXPECT_TRUE(weak_data.expired());
+}
+
 }  // namespace weave
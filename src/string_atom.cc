@@ -0,0 +1,90 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/string_atom.h"
+
+#include <mutex>
+#include <unordered_map>
+
+#include <base/logging.h>
+
+namespace weave {
+
+namespace {
+
+// The number of atoms referring to every string.
+using AtomTable = std::unordered_map<std::string, size_t>;
+
+// Never destroyed, so atoms can be released by static destructors too.
+std::mutex& GetTableLock() {
+  static std::mutex* lock = new std::mutex;
+  return *lock;
+}
+
+AtomTable& GetTable() {
+  static AtomTable* table = new AtomTable;
+  return *table;
+}
+
+}  // namespace
+
+StringAtom::StringAtom(const std::string& str) {
+  if (str.empty())
+    return;
+  std::lock_guard<std::mutex> lock{GetTableLock()};
+  entry_ = &*GetTable().emplace(str, 0).first;
+  ++entry_->second;
+}
+
+StringAtom::StringAtom(const StringAtom& other) : entry_{other.entry_} {
+  if (!entry_)
+    return;
+  std::lock_guard<std::mutex> lock{GetTableLock()};
+  ++entry_->second;
+}
+
+StringAtom::~StringAtom() {
+  if (!entry_)
+    return;
+  std::lock_guard<std::mutex> lock{GetTableLock()};
+  CHECK_GT(entry_->second, 0u);
+  if (--entry_->second == 0) {
+    AtomTable& table = GetTable();
+    table.erase(table.find(entry_->first));
+  }
+}
+
+StringAtom StringAtom::Find(const std::string& str) {
+  StringAtom atom;
+  if (str.empty())
+    return atom;
+  std::lock_guard<std::mutex> lock{GetTableLock()};
+  AtomTable& table = GetTable();
+  auto it = table.find(str);
+  if (it != table.end()) {
+    atom.entry_ = &*it;
+    ++atom.entry_->second;
+  }
+  return atom;
+}
+
+const std::string& StringAtom::str() const {
+  static const std::string* empty = new std::string;
+  return entry_ ? entry_->first : *empty;
+}
+
+MemoryUsage StringAtom::GetTableMemoryUsage() {
+  std::lock_guard<std::mutex> lock{GetTableLock()};
+  const AtomTable& table = GetTable();
+  MemoryUsage usage;
+  usage.count = table.size();
+  usage.bytes = table.bucket_count() * sizeof(void*);
+  for (const auto& pair : table) {
+    usage.bytes +=
+        kHashNodeOverhead + sizeof(pair) + EstimateMemoryUsage(pair.first);
+  }
+  return usage;
+}
+
+}  // namespace weave
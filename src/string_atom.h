@@ -0,0 +1,74 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_STRING_ATOM_H_
+#define LIBWEAVE_SRC_STRING_ATOM_H_
+
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "src/memory_usage.h"
+
+namespace weave {
+
+// A string kept once per process in a table shared by all its atoms, for the
+// trait, command, property and component names repeated across commands and
+// state changes, and the command IDs the queue tables are keyed by. Atoms of
+// equal strings refer to the same entry, so they are compared by pointer. The
+// entry is released with the last atom referring to it. The table is guarded
+// by a lock, so atoms can be created and destroyed on any thread.
+class StringAtom final {
+ public:
+  StringAtom() = default;
+  explicit StringAtom(const std::string& str);
+  StringAtom(const StringAtom& other);
+  StringAtom(StringAtom&& other) : entry_{other.entry_} {
+    other.entry_ = nullptr;
+  }
+  ~StringAtom();
+
+  StringAtom& operator=(StringAtom other) {
+    std::swap(entry_, other.entry_);
+    return *this;
+  }
+
+  // Returns the atom of |str| if there is one, or an empty atom. Unlike the
+  // constructor, doesn't add |str| to the table, so it suits lookups of
+  // strings which may be unknown.
+  static StringAtom Find(const std::string& str);
+
+  const std::string& str() const;
+  bool empty() const { return !entry_; }
+
+  bool operator==(const StringAtom& other) const {
+    return entry_ == other.entry_;
+  }
+  bool operator!=(const StringAtom& other) const {
+    return entry_ != other.entry_;
+  }
+  // Orders the atoms like their strings.
+  bool operator<(const StringAtom& other) const {
+    return entry_ != other.entry_ && str() < other.str();
+  }
+
+  size_t Hash() const { return std::hash<const void*>()(entry_); }
+
+  // Returns the number of the strings in the table and the memory they take.
+  static MemoryUsage GetTableMemoryUsage();
+
+ private:
+  using Entry = std::pair<const std::string, size_t>;
+
+  // The empty string has no entry.
+  Entry* entry_{nullptr};
+};
+
+struct StringAtomHash {
+  size_t operator()(const StringAtom& atom) const { return atom.Hash(); }
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_STRING_ATOM_H_
@@ -0,0 +1,67 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/string_atom.h"
+
+#include <memory>
+#include <unordered_set>
+
+#include <gtest/gtest.h>
+
+namespace weave {
+
+TEST(StringAtomTest, Empty) {
+  StringAtom atom;
+  EXPECT_TRUE(atom.empty());
+  EXPECT_EQ("", atom.str());
+  EXPECT_EQ(atom, StringAtom{""});
+  EXPECT_TRUE(StringAtom{std::string{}}.empty());
+}
+
+TEST(StringAtomTest, SharedEntry) {
+  size_t count = StringAtom::GetTableMemoryUsage().count;
+  std::unique_ptr<StringAtom> atom1{new StringAtom{"onOff.setConfig"}};
+  StringAtom atom2{std::string{"onOff."} + "setConfig"};
+  EXPECT_EQ(*atom1, atom2);
+  EXPECT_EQ(&atom1->str(), &atom2.str());
+  EXPECT_EQ(count + 1, StringAtom::GetTableMemoryUsage().count);
+
+  StringAtom atom3{"brightness.set"};
+  EXPECT_NE(atom2, atom3);
+  EXPECT_TRUE(atom3 < atom2);
+  EXPECT_FALSE(atom2 < atom3);
+  EXPECT_FALSE(atom2 < atom2);
+  EXPECT_EQ(count + 2, StringAtom::GetTableMemoryUsage().count);
+
+  std::unordered_set<StringAtom, StringAtomHash> set{*atom1, atom2, atom3};
+  EXPECT_EQ(2u, set.size());
+}
+
+TEST(StringAtomTest, Release) {
+  size_t count = StringAtom::GetTableMemoryUsage().count;
+  {
+    StringAtom atom1{"lock.unlock"};
+    StringAtom atom2 = atom1;
+    StringAtom atom3{std::move(atom1)};
+    EXPECT_TRUE(atom1.empty());
+    atom1 = atom3;
+    atom2 = StringAtom{};
+    EXPECT_EQ("lock.unlock", atom1.str());
+    EXPECT_EQ(count + 1, StringAtom::GetTableMemoryUsage().count);
+  }
+  EXPECT_EQ(count, StringAtom::GetTableMemoryUsage().count);
+}
+
+TEST(StringAtomTest, Find) {
+  size_t count = StringAtom::GetTableMemoryUsage().count;
+  EXPECT_TRUE(StringAtom::Find("base.identify").empty());
+  EXPECT_TRUE(StringAtom::Find("").empty());
+  EXPECT_EQ(count, StringAtom::GetTableMemoryUsage().count);
+
+  StringAtom atom{"base.identify"};
+  EXPECT_EQ(atom, StringAtom::Find("base.identify"));
+  EXPECT_EQ(count + 1, StringAtom::GetTableMemoryUsage().count);
+}
+
+}  // namespace weave
@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <utility>
 
+#include <base/logging.h>
 #include <base/strings/string_util.h>
 
 #include "src/string_utils.h"
@@ -14,58 +15,85 @@ namespace weave {
 
 namespace {
 
-bool SplitAtFirst(const std::string& str,
-                  const std::string& delimiter,
-                  std::string* left_part,
-                  std::string* right_part,
-                  bool trim_whitespaces) {
-  bool delimiter_found = false;
-  std::string::size_type pos = str.find(delimiter);
-  if (pos != std::string::npos) {
-    *left_part = str.substr(0, pos);
-    *right_part = str.substr(pos + delimiter.size());
-    delimiter_found = true;
-  } else {
-    *left_part = str;
-    right_part->clear();
-  }
+base::StringPiece TrimPiece(base::StringPiece str, bool trim_whitespaces) {
+  if (!trim_whitespaces)
+    return str;
+  return base::TrimString(str, base::kWhitespaceASCII, base::TRIM_ALL);
+}
 
-  if (trim_whitespaces) {
-    base::TrimWhitespaceASCII(*left_part, base::TRIM_ALL, left_part);
-    base::TrimWhitespaceASCII(*right_part, base::TRIM_ALL, right_part);
-  }
+}  // namespace
 
-  return delimiter_found;
+StringTokenizer::StringTokenizer(base::StringPiece str,
+                                 base::StringPiece delimiter,
+                                 bool trim_whitespaces)
+    : rest_{str}, delimiter_{delimiter}, trim_whitespaces_{trim_whitespaces} {
+  CHECK(!delimiter_.empty());
+  Advance();
 }
 
-}  // namespace
+void StringTokenizer::Advance() {
+  if (last_) {
+    at_end_ = true;
+    token_.clear();
+    return;
+  }
+  size_t pos = rest_.find(delimiter_);
+  if (pos == base::StringPiece::npos) {
+    token_ = rest_;
+    rest_.clear();
+    last_ = true;
+  } else {
+    token_ = rest_.substr(0, pos);
+    rest_.remove_prefix(pos + delimiter_.size());
+  }
+  token_ = TrimPiece(token_, trim_whitespaces_);
+}
 
 std::vector<std::string> Split(const std::string& str,
                                const std::string& delimiter,
                                bool trim_whitespaces,
                                bool purge_empty_strings) {
   std::vector<std::string> tokens;
-  for (std::string::size_type i = 0;;) {
-    const std::string::size_type pos =
-        delimiter.empty() ? (i + 1) : str.find(delimiter, i);
-    std::string tmp_str{str.substr(i, pos - i)};
-    if (trim_whitespaces)
-      base::TrimWhitespaceASCII(tmp_str, base::TRIM_ALL, &tmp_str);
-    if (!tmp_str.empty() || !purge_empty_strings)
-      tokens.emplace_back(std::move(tmp_str));
-    if (pos >= str.size())
-      break;
-    i = pos + delimiter.size();
+  auto add_token = [&tokens, purge_empty_strings](base::StringPiece token) {
+    if (!token.empty() || !purge_empty_strings)
+      tokens.emplace_back(token.data(), token.size());
+  };
+  if (delimiter.empty()) {
+    // Every character is an element.
+    for (size_t i = 0; i < str.size() || i == 0; ++i)
+      add_token(TrimPiece(base::StringPiece{str}.substr(i, 1),
+                          trim_whitespaces));
+    return tokens;
+  }
+  for (StringTokenizer it{str, delimiter, trim_whitespaces}; !it.IsAtEnd();
+       it.Advance()) {
+    add_token(it.token());
   }
   return tokens;
 }
 
+std::pair<base::StringPiece, base::StringPiece> SplitPieceAtFirst(
+    base::StringPiece str,
+    base::StringPiece delimiter,
+    bool trim_whitespaces) {
+  std::pair<base::StringPiece, base::StringPiece> pair;
+  size_t pos = str.find(delimiter);
+  if (pos != base::StringPiece::npos) {
+    pair.first = str.substr(0, pos);
+    pair.second = str.substr(pos + delimiter.size());
+  } else {
+    pair.first = str;
+  }
+  pair.first = TrimPiece(pair.first, trim_whitespaces);
+  pair.second = TrimPiece(pair.second, trim_whitespaces);
+  return pair;
+}
+
 std::pair<std::string, std::string> SplitAtFirst(const std::string& str,
                                                  const std::string& delimiter,
                                                  bool trim_whitespaces) {
-  std::pair<std::string, std::string> pair;
-  SplitAtFirst(str, delimiter, &pair.first, &pair.second, trim_whitespaces);
-  return pair;
+  auto pair = SplitPieceAtFirst(str, delimiter, trim_whitespaces);
+  return {pair.first.as_string(), pair.second.as_string()};
 }
 
 }  // namespace weave
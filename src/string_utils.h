@@ -9,6 +9,8 @@
 #include <utility>
 #include <vector>
 
+#include <base/strings/string_piece.h>
+
 namespace weave {
 
 // Treats the string as a delimited list of substrings and returns the array
@@ -27,6 +29,37 @@ std::pair<std::string, std::string> SplitAtFirst(const std::string& str,
                                                  const std::string& delimiter,
                                                  bool trim_whitespaces);
 
+// Same as SplitAtFirst() above, but returns pieces of |str| instead of
+// copies.
+std::pair<base::StringPiece, base::StringPiece> SplitPieceAtFirst(
+    base::StringPiece str,
+    base::StringPiece delimiter,
+    bool trim_whitespaces);
+
+// Iterates over elements of a delimited list without copying them, e.g.
+//   for (StringTokenizer it{path, "."}; !it.IsAtEnd(); it.Advance())
+//     Process(it.token());
+// Empty elements are not skipped. |delimiter| must not be empty.
+class StringTokenizer final {
+ public:
+  StringTokenizer(base::StringPiece str,
+                  base::StringPiece delimiter,
+                  bool trim_whitespaces = true);
+
+  bool IsAtEnd() const { return at_end_; }
+  void Advance();
+  base::StringPiece token() const { return token_; }
+
+ private:
+  base::StringPiece rest_;
+  base::StringPiece delimiter_;
+  base::StringPiece token_;
+  bool trim_whitespaces_{true};
+  bool at_end_{false};
+  // Set after the last element is taken out of |rest_|.
+  bool last_{false};
+};
+
 // Joins strings into a single string separated by |delimiter|.
 template <class InputIterator>
 std::string JoinRange(const std::string& delimiter,
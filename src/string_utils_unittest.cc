@@ -123,6 +123,42 @@ TEST(StringUtils, SplitAtFirst) {
   EXPECT_EQ("abc", pair.second);
 }
 
+TEST(StringUtils, SplitPieceAtFirst) {
+  std::string str = " trait . member ";
+  auto pair = SplitPieceAtFirst(str, ".", true);
+  EXPECT_EQ("trait", pair.first);
+  EXPECT_EQ("member", pair.second);
+  // The pieces refer to the original string.
+  EXPECT_EQ(str.data() + 1, pair.first.data());
+
+  pair = SplitPieceAtFirst(str, ":", false);
+  EXPECT_EQ(str, pair.first);
+  EXPECT_EQ("", pair.second);
+}
+
+TEST(StringUtils, StringTokenizer) {
+  std::vector<std::string> parts;
+  for (StringTokenizer it{",a,bc , d,  ,e, ", ","}; !it.IsAtEnd();
+       it.Advance()) {
+    parts.push_back(it.token().as_string());
+  }
+  EXPECT_EQ((std::vector<std::string>{"", "a", "bc", "d", "", "e", ""}),
+            parts);
+
+  parts.clear();
+  for (StringTokenizer it{"abc:=x y:=", ":=", false}; !it.IsAtEnd();
+       it.Advance()) {
+    parts.push_back(it.token().as_string());
+  }
+  EXPECT_EQ((std::vector<std::string>{"abc", "x y", ""}), parts);
+
+  StringTokenizer empty{"", "."};
+  ASSERT_FALSE(empty.IsAtEnd());
+  EXPECT_EQ("", empty.token());
+  empty.Advance();
+  EXPECT_TRUE(empty.IsAtEnd());
+}
+
 TEST(StringUtils, Join_String) {
   EXPECT_EQ("", Join(",", std::vector<std::string>{}));
   EXPECT_EQ("abc", Join(",", std::vector<std::string>{"abc"}));
@@ -0,0 +1,38 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_TEST_ALLOCATION_COUNTER_H_
+#define LIBWEAVE_SRC_TEST_ALLOCATION_COUNTER_H_
+
+#include <stddef.h>
+
+namespace weave {
+namespace test {
+
+// Returns the number of operator new calls made by the process so far. It's
+// counted by the replacement of operator new in weave_testrunner.cc, so only
+// the test runners can use it.
+size_t GetAllocationCount();
+
+// Counts the allocations made during its lifetime, so tests can pin the
+// allocation budget of an operation, e.g.
+//   AllocationCounter counter;
+//   queue.Add(...);
+//   EXPECT_LE(counter.GetCount(), 4u);
+// Budgets should be checked on a warmed up object, so lazily created caches
+// don't count.
+class AllocationCounter {
+ public:
+  AllocationCounter() : start_{GetAllocationCount()} {}
+
+  size_t GetCount() const { return GetAllocationCount() - start_; }
+
+ private:
+  size_t start_;
+};
+
+}  // namespace test
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_TEST_ALLOCATION_COUNTER_H_
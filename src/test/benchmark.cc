@@ -0,0 +1,115 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/test/benchmark.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace weave {
+namespace test {
+
+namespace {
+
+// Limits the iterations of very fast benchmarks.
+const size_t kMaxIterations = 1000000000;
+
+using Benchmark = std::pair<std::string, BenchmarkFunction>;
+
+std::vector<Benchmark>* GetBenchmarks() {
+  // Leaked, so benchmarks may register from static initializers in any order.
+  static std::vector<Benchmark>* benchmarks = new std::vector<Benchmark>;
+  return benchmarks;
+}
+
+void PrintResult(const std::string& name, const BenchmarkState& state) {
+  double seconds = state.elapsed().InSecondsF();
+  size_t iterations = std::max<size_t>(state.iterations(), 1);
+  printf("%-56s %12zu %12.1f ns", name.c_str(), state.iterations(),
+         seconds * 1e9 / iterations);
+  if (state.bytes_processed() && seconds > 0) {
+    printf(" %10.1f MB/s %8.1f B/op", state.bytes_processed() / seconds / 1e6,
+           static_cast<double>(state.bytes_processed()) / iterations);
+  }
+  printf("\n");
+}
+
+}  // namespace
+
+BenchmarkState::BenchmarkState(size_t max_iterations)
+    : max_iterations_{max_iterations} {}
+
+bool BenchmarkState::KeepRunning() {
+  if (iterations_ == 0)
+    ResumeTiming();
+  if (iterations_ < max_iterations_) {
+    ++iterations_;
+    return true;
+  }
+  PauseTiming();
+  return false;
+}
+
+void BenchmarkState::PauseTiming() {
+  if (!running_)
+    return;
+  elapsed_ += base::TimeTicks::Now() - start_;
+  running_ = false;
+}
+
+void BenchmarkState::ResumeTiming() {
+  if (running_)
+    return;
+  start_ = base::TimeTicks::Now();
+  running_ = true;
+}
+
+bool RegisterBenchmark(const char* name, BenchmarkFunction function) {
+  GetBenchmarks()->emplace_back(name, function);
+  return true;
+}
+
+size_t RunBenchmarks(const std::string& filter, base::TimeDelta min_time) {
+  std::vector<Benchmark> benchmarks = *GetBenchmarks();
+  // Variants "name/arg" stay in the order they were registered.
+  std::stable_sort(benchmarks.begin(), benchmarks.end(),
+                   [](const Benchmark& a, const Benchmark& b) {
+                     return a.first.substr(0, a.first.find('/')) <
+                            b.first.substr(0, b.first.find('/'));
+                   });
+
+  printf("%-56s %12s %15s\n", "Benchmark", "Iterations", "Time");
+  size_t count = 0;
+  for (const auto& benchmark : benchmarks) {
+    if (benchmark.first.find(filter) == std::string::npos)
+      continue;
+    ++count;
+    for (size_t iterations = 1;;) {
+      BenchmarkState state{iterations};
+      benchmark.second(&state);
+      state.PauseTiming();
+      if (state.elapsed() >= min_time || iterations >= kMaxIterations) {
+        PrintResult(benchmark.first, state);
+        break;
+      }
+      // Aim a bit past |min_time|, growing by at most 10x at once, since
+      // short runs are dominated by noise.
+      double scale = 10;
+      if (state.elapsed() > base::TimeDelta())
+        scale = std::min(scale, 1.4 * min_time.InSecondsF() /
+                                    state.elapsed().InSecondsF());
+      iterations = std::min(
+          kMaxIterations,
+          std::max(iterations + 1, static_cast<size_t>(iterations * scale)));
+    }
+  }
+  return count;
+}
+
+}  // namespace test
+}  // namespace weave
@@ -0,0 +1,77 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_TEST_BENCHMARK_H_
+#define LIBWEAVE_SRC_TEST_BENCHMARK_H_
+
+#include <string>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+
+namespace weave {
+namespace test {
+
+// State of a running microbenchmark, used in the style of Google Benchmark:
+//
+//   void BM_Foo(test::BenchmarkState* state) {
+//     Bar bar;  // Setup is not measured.
+//     while (state->KeepRunning())
+//       bar.Foo();
+//   }
+//   WEAVE_BENCHMARK(BM_Foo);
+//
+// The runner repeats every benchmark with more iterations until it runs long
+// enough, and reports the time per iteration.
+class BenchmarkState final {
+ public:
+  explicit BenchmarkState(size_t max_iterations);
+
+  // Returns true while the next iteration should run. Timing starts with the
+  // first call and stops when it returns false.
+  bool KeepRunning();
+
+  // Exclude setup done within the loop from the measured time.
+  void PauseTiming();
+  void ResumeTiming();
+
+  // Total bytes processed by all iterations, reported as throughput and per
+  // iteration.
+  void SetBytesProcessed(size_t bytes) { bytes_processed_ = bytes; }
+
+  size_t iterations() const { return iterations_; }
+  size_t max_iterations() const { return max_iterations_; }
+  base::TimeDelta elapsed() const { return elapsed_; }
+  size_t bytes_processed() const { return bytes_processed_; }
+
+ private:
+  const size_t max_iterations_;
+  size_t iterations_{0};
+  bool running_{false};
+  base::TimeTicks start_;
+  base::TimeDelta elapsed_;
+  size_t bytes_processed_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(BenchmarkState);
+};
+
+using BenchmarkFunction = void (*)(BenchmarkState* state);
+
+// Adds a benchmark to the ones run by RunBenchmarks(). Returns true, so it
+// can initialize a static variable, see WEAVE_BENCHMARK.
+bool RegisterBenchmark(const char* name, BenchmarkFunction function);
+
+// Runs the benchmarks with |filter| in their name, or all of them if it's
+// empty, each for at least |min_time|. Prints the results to stdout and
+// returns the number of benchmarks run.
+size_t RunBenchmarks(const std::string& filter, base::TimeDelta min_time);
+
+}  // namespace test
+}  // namespace weave
+
+#define WEAVE_BENCHMARK(function)            \
+  static const bool function##_registered_ = \
+      ::weave::test::RegisterBenchmark(#function, &function)
+
+#endif  // LIBWEAVE_SRC_TEST_BENCHMARK_H_
@@ -0,0 +1,36 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_TEST_FAKE_HTTP_RESPONSE_H_
+#define LIBWEAVE_SRC_TEST_FAKE_HTTP_RESPONSE_H_
+
+#include <string>
+
+#include <weave/provider/http_client.h>
+
+namespace weave {
+namespace test {
+
+// JSON response of a simulated cloud server.
+class FakeHttpResponse : public provider::HttpClient::Response {
+ public:
+  FakeHttpResponse(int status, const std::string& data)
+      : status_{status}, data_{data} {}
+
+  int GetStatusCode() const override { return status_; }
+  std::string GetContentType() const override {
+    return "application/json; charset=utf-8";
+  }
+  std::string GetHeader(const std::string& name) const override { return {}; }
+  const std::string& GetData() const override { return data_; }
+
+ private:
+  int status_{0};
+  std::string data_;
+};
+
+}  // namespace test
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_TEST_FAKE_HTTP_RESPONSE_H_
@@ -25,10 +25,12 @@ FakeTaskRunner::~FakeTaskRunner() {}
 bool FakeTaskRunner::RunOnce() {
   if (queue_.empty())
     return false;
-  auto top = queue_.top();
-  queue_.pop();
-  test_clock_->SetNow(std::max(test_clock_->Now(), top.first.first));
-  top.second.Run();
+  QueueKey key = queue_.begin()->first;
+  base::Closure task = queue_.begin()->second;
+  queue_.erase(queue_.begin());
+  task_keys_.erase(std::get<2>(key));
+  test_clock_->SetNow(std::max(test_clock_->Now(), std::get<0>(key)));
+  task.Run();
   return true;
 }
 
@@ -38,6 +40,12 @@ void FakeTaskRunner::Run(size_t number_of_iterations) {
   }
 }
 
+void FakeTaskRunner::RunPendingTasks() {
+  while (!queue_.empty() &&
+         std::get<0>(queue_.begin()->first) <= test_clock_->Now())
+    RunOnce();
+}
+
 void FakeTaskRunner::Break() {
   break_ = true;
 }
@@ -49,7 +57,27 @@ base::Clock* FakeTaskRunner::GetClock() {
 void FakeTaskRunner::PostDelayedTask(const tracked_objects::Location& from_here,
                                      const base::Closure& task,
                                      base::TimeDelta delay) {
-  queue_.emplace(std::make_pair(test_clock_->Now() + delay, ++counter_), task);
+  PostTaskWithPriority(from_here, task, delay, Priority::kNormal);
+}
+
+TaskRunner::TaskId FakeTaskRunner::PostTaskWithPriority(
+    const tracked_objects::Location& from_here,
+    const base::Closure& task,
+    base::TimeDelta delay,
+    Priority priority) {
+  QueueKey key{test_clock_->Now() + delay, -static_cast<int>(priority),
+               ++counter_};
+  queue_.emplace(key, task);
+  task_keys_.emplace(counter_, key);
+  return counter_;
+}
+
+void FakeTaskRunner::CancelTask(TaskId id) {
+  auto p = task_keys_.find(id);
+  if (p == task_keys_.end())
+    return;
+  queue_.erase(p->second);
+  task_keys_.erase(p);
 }
 
 size_t FakeTaskRunner::GetTaskQueueSize() const {
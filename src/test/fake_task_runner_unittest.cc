@@ -0,0 +1,67 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <weave/provider/test/fake_task_runner.h>
+
+#include <string>
+
+#include <base/bind.h>
+#include <gtest/gtest.h>
+
+namespace weave {
+namespace provider {
+namespace test {
+
+namespace {
+
+void Append(std::string* log, const std::string& name) {
+  log->append(name);
+}
+
+}  // namespace
+
+TEST(FakeTaskRunner, Priority) {
+  FakeTaskRunner task_runner;
+  std::string log;
+  task_runner.PostTaskWithPriority(FROM_HERE, base::Bind(&Append, &log, "b"),
+                                   {}, TaskRunner::Priority::kBackground);
+  task_runner.PostDelayedTask(FROM_HERE, base::Bind(&Append, &log, "n"), {});
+  task_runner.PostTaskWithPriority(FROM_HERE, base::Bind(&Append, &log, "u"),
+                                   {}, TaskRunner::Priority::kUserVisible);
+  task_runner.PostTaskWithPriority(
+      FROM_HERE, base::Bind(&Append, &log, "d"),
+      base::TimeDelta::FromSeconds(1), TaskRunner::Priority::kUserVisible);
+  task_runner.PostDelayedTask(FROM_HERE, base::Bind(&Append, &log, "m"), {});
+  task_runner.Run();
+  EXPECT_EQ("unmbd", log);
+}
+
+TEST(FakeTaskRunner, CancelTask) {
+  FakeTaskRunner task_runner;
+  std::string log;
+  TaskRunner::TaskId a = task_runner.PostTaskWithPriority(
+      FROM_HERE, base::Bind(&Append, &log, "a"),
+      base::TimeDelta::FromMinutes(1), TaskRunner::Priority::kBackground);
+  TaskRunner::TaskId b = task_runner.PostTaskWithPriority(
+      FROM_HERE, base::Bind(&Append, &log, "b"), {},
+      TaskRunner::Priority::kNormal);
+  EXPECT_NE(0u, a);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(2u, task_runner.GetTaskQueueSize());
+
+  task_runner.CancelTask(a);
+  EXPECT_EQ(1u, task_runner.GetTaskQueueSize());
+  task_runner.Run();
+  EXPECT_EQ("b", log);
+
+  // Cancelling tasks which already ran or were never posted does nothing.
+  task_runner.CancelTask(a);
+  task_runner.CancelTask(b);
+  task_runner.CancelTask(0);
+  EXPECT_EQ(0u, task_runner.GetTaskQueueSize());
+}
+
+}  // namespace test
+}  // namespace provider
+}  // namespace weave
@@ -17,13 +17,19 @@ class MockAccessRevocationManager : public AccessRevocationManager {
  public:
   MOCK_METHOD1(AddEntryAddedCallback, void(const base::Closure&));
   MOCK_METHOD2(Block, void(const Entry&, const DoneCallback&));
+  MOCK_METHOD2(BlockEntries,
+               void(const std::vector<Entry>&, const DoneCallback&));
   MOCK_CONST_METHOD3(IsBlocked,
                      bool(const std::vector<uint8_t>&,
                           const std::vector<uint8_t>&,
                           base::Time));
   MOCK_CONST_METHOD0(GetEntries, std::vector<Entry>());
+  MOCK_CONST_METHOD2(GetEntriesAfter,
+                     std::vector<Entry>(const Entry*, size_t));
   MOCK_CONST_METHOD0(GetSize, size_t());
   MOCK_CONST_METHOD0(GetCapacity, size_t());
+  MOCK_CONST_METHOD0(GetMemoryUsage, MemoryUsage());
+  MOCK_METHOD0(CompactMemory, void());
 };
 
 }  // namespace test
@@ -19,6 +19,8 @@ class MockComponentManager : public ComponentManager {
   MOCK_METHOD2(LoadTraits,
                bool(const base::DictionaryValue& dict, ErrorPtr* error));
   MOCK_METHOD2(LoadTraits, bool(const std::string& json, ErrorPtr* error));
+  MOCK_METHOD2(LoadTraits, bool(const EmbeddedValue& table, ErrorPtr* error));
+  MOCK_METHOD0(EnableLazyTraits, void());
   MOCK_METHOD1(AddTraitDefChangedCallback, void(const base::Closure& callback));
   MOCK_METHOD4(AddComponent,
                bool(const std::string& path,
@@ -48,6 +50,14 @@ class MockComponentManager : public ComponentManager {
                                 UserRole role,
                                 std::string* id,
                                 ErrorPtr* error));
+  MOCK_METHOD7(MockCreateCommandInstance,
+               CommandInstance*(const std::string& component,
+                                const std::string& name,
+                                const base::DictionaryValue& parameters,
+                                Command::Origin command_origin,
+                                UserRole role,
+                                std::string* id,
+                                ErrorPtr* error));
   MOCK_METHOD1(FindCommand, CommandInstance*(const std::string& id));
   MOCK_METHOD1(AddCommandAddedCallback,
                void(const CommandQueue::CommandCallback& callback));
@@ -57,6 +67,11 @@ class MockComponentManager : public ComponentManager {
                void(const std::string& component_path,
                     const std::string& command_name,
                     const Device::CommandHandlerCallback& callback));
+  MOCK_METHOD4(SetCommandHandlerPolicy,
+               bool(const std::string& component_path,
+                    const std::string& command_name,
+                    const CommandHandlerPolicy& policy,
+                    ErrorPtr* error));
   MOCK_CONST_METHOD2(FindComponent,
                      const base::DictionaryValue*(const std::string& path,
                                                   ErrorPtr* error));
@@ -74,9 +89,24 @@ class MockComponentManager : public ComponentManager {
                           UserRole* minimal_role,
                           ErrorPtr* error));
   MOCK_CONST_METHOD0(GetTraits, const base::DictionaryValue&());
+  MOCK_CONST_METHOD0(GetTraitsJson, const std::string&());
+  MOCK_CONST_METHOD0(GetTraitsFingerprint, uint64_t());
+  MOCK_CONST_METHOD0(GetStateFingerprint, uint64_t());
+  MOCK_CONST_METHOD0(GetComponentsFingerprint, uint64_t());
   MOCK_CONST_METHOD0(GetComponents, const base::DictionaryValue&());
+  MOCK_CONST_METHOD1(WriteSnapshot, void(JsonStreamWriter* writer));
+  MOCK_METHOD2(RestoreSnapshot,
+               bool(const base::DictionaryValue& snapshot, ErrorPtr* error));
   MOCK_CONST_METHOD1(MockGetComponentsForUserRole,
                      base::DictionaryValue*(UserRole));
+  MOCK_CONST_METHOD0(MockGetComponentsSnapshot, base::DictionaryValue*());
+  MOCK_METHOD0(EnableComponentsView, void());
+  MOCK_CONST_METHOD0(MockGetComponentsView, base::DictionaryValue*());
+  MOCK_CONST_METHOD4(MockGetComponentForUserRole,
+                     base::DictionaryValue*(const std::string&,
+                                            UserRole,
+                                            const std::set<std::string>&,
+                                            ErrorPtr*));
   MOCK_METHOD3(SetStateProperties,
                bool(const std::string& component_path,
                     const base::DictionaryValue& dict,
@@ -89,11 +119,34 @@ class MockComponentManager : public ComponentManager {
                      const base::Value*(const std::string& component_path,
                                         const std::string& name,
                                         ErrorPtr* error));
+  MOCK_CONST_METHOD2(GetComponentState,
+                     const base::DictionaryValue*(
+                         const std::string& component_path,
+                         ErrorPtr* error));
   MOCK_METHOD4(SetStateProperty,
                bool(const std::string& component_path,
                     const std::string& name,
                     const base::Value& value,
                     ErrorPtr* error));
+  MOCK_METHOD3(ResolveStateProperty,
+               StatePropertyHandle(const std::string& component_path,
+                                   const std::string& name,
+                                   ErrorPtr* error));
+  MOCK_METHOD3(SetStatePropertyByHandle,
+               bool(StatePropertyHandle handle,
+                    const base::Value& value,
+                    ErrorPtr* error));
+  MOCK_METHOD2(SetComponentsState,
+               bool(const base::DictionaryValue& states, ErrorPtr* error));
+  MOCK_METHOD3(SetStateHistoryPolicy,
+               bool(const std::string& component_path,
+                    const StateHistoryPolicy& policy,
+                    ErrorPtr* error));
+  MOCK_METHOD4(SetStatePublishFilter,
+               bool(const std::string& component_path,
+                    const std::string& name,
+                    const StatePublishFilter& filter,
+                    ErrorPtr* error));
   MOCK_METHOD1(AddStateChangedCallback, void(const base::Closure& callback));
   MOCK_METHOD0(MockGetAndClearRecordedStateChanges, StateSnapshot&());
   MOCK_METHOD1(NotifyStateUpdatedOnServer, void(UpdateID id));
@@ -103,11 +156,19 @@ class MockComponentManager : public ComponentManager {
                    const base::Callback<void(UpdateID)>& callback));
   MOCK_CONST_METHOD1(FindComponentWithTrait,
                      std::string(const std::string& trait));
+  MOCK_CONST_METHOD1(GetMemoryStats, void(base::DictionaryValue* stats));
+  MOCK_METHOD0(CompactMemory, void());
+  MOCK_METHOD0(MergeStateHistory, void());
 
  private:
   void AddCommand(std::unique_ptr<CommandInstance> command_instance) override {
     MockAddCommand(command_instance.get());
   }
+  void AddCommands(std::vector<std::unique_ptr<CommandInstance>>
+                       command_instances) override {
+    for (const auto& command_instance : command_instances)
+      MockAddCommand(command_instance.get());
+  }
   std::unique_ptr<CommandInstance> ParseCommandInstance(
       const base::DictionaryValue& command,
       Command::Origin command_origin,
@@ -117,6 +178,17 @@ class MockComponentManager : public ComponentManager {
     return std::unique_ptr<CommandInstance>{
         MockParseCommandInstance(command, command_origin, role, id, error)};
   }
+  std::unique_ptr<CommandInstance> CreateCommandInstance(
+      const std::string& component,
+      const std::string& name,
+      const base::DictionaryValue& parameters,
+      Command::Origin command_origin,
+      UserRole role,
+      std::string* id,
+      ErrorPtr* error) override {
+    return std::unique_ptr<CommandInstance>{MockCreateCommandInstance(
+        component, name, parameters, command_origin, role, id, error)};
+  }
   StateSnapshot GetAndClearRecordedStateChanges() override {
     return std::move(MockGetAndClearRecordedStateChanges());
   }
@@ -124,11 +196,34 @@ class MockComponentManager : public ComponentManager {
       const base::Callback<void(UpdateID)>& callback) override {
     return Token{MockAddServerStateUpdatedCallback(callback)};
   }
-  std::unique_ptr<base::DictionaryValue> GetComponentsForUserRole(
+  bool SetStateProperties(const std::string& component_path,
+                          std::unique_ptr<base::DictionaryValue> dict,
+                          ErrorPtr* error) override {
+    return SetStateProperties(component_path, *dict, error);
+  }
+  std::shared_ptr<const base::DictionaryValue> GetComponentsForUserRole(
       UserRole role) const override {
-    return std::unique_ptr<base::DictionaryValue>{
+    return std::shared_ptr<const base::DictionaryValue>{
         MockGetComponentsForUserRole(role)};
   }
+  std::shared_ptr<const base::DictionaryValue> GetComponentsSnapshot()
+      const override {
+    return std::shared_ptr<const base::DictionaryValue>{
+        MockGetComponentsSnapshot()};
+  }
+  std::shared_ptr<const base::DictionaryValue> GetComponentsView()
+      const override {
+    return std::shared_ptr<const base::DictionaryValue>{
+        MockGetComponentsView()};
+  }
+  std::unique_ptr<base::DictionaryValue> GetComponentForUserRole(
+      const std::string& component_path,
+      UserRole role,
+      const std::set<std::string>& fields,
+      ErrorPtr* error) const override {
+    return std::unique_ptr<base::DictionaryValue>{
+        MockGetComponentForUserRole(component_path, role, fields, error)};
+  }
 };
 
 }  // namespace test
@@ -0,0 +1,609 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/test/traffic_trace.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <base/bind.h>
+#include <base/values.h>
+#include <weave/enum_to_string.h>
+#include <weave/provider/task_runner.h>
+#include <weave/stream.h>
+
+#include "src/data_encoding.h"
+#include "src/http_constants.h"
+#include "src/json_stream_writer.h"
+#include "src/string_utils.h"
+#include "src/utils.h"
+
+namespace weave {
+
+namespace {
+
+const EnumToStringMap<test::TrafficEvent::Type>::Map kTypeMap[] = {
+    {test::TrafficEvent::Type::kRequest, "request"},
+    {test::TrafficEvent::Type::kResponse, "response"},
+    {test::TrafficEvent::Type::kOpen, "open"},
+    {test::TrafficEvent::Type::kRead, "read"},
+    {test::TrafficEvent::Type::kWrite, "write"},
+};
+
+}  // namespace
+
+template <>
+LIBWEAVE_EXPORT EnumToStringMap<test::TrafficEvent::Type>::EnumToStringMap()
+    : EnumToStringMap(kTypeMap) {}
+
+namespace test {
+
+namespace {
+
+using provider::HttpClient;
+using provider::Network;
+
+const char kTraceErrorDomain[] = "traffic_trace";
+
+// Response headers libweave looks at.
+const char* const kRecordedHeaders[] = {http::kContentEncoding,
+                                        http::kRetryAfter};
+
+// Members of the cloud requests and responses with credentials, as JSON and
+// as form fields.
+const char* const kSecretJsonKeys[] = {"access_token", "refresh_token",
+                                       "robotAccountAuthorizationCode"};
+const char* const kSecretFormKeys[] = {"access_token", "refresh_token",
+                                       "client_secret", "code"};
+const char kXmppAuthElement[] = "<auth";
+
+// Replaces the characters of |data| in [begin, end) with '*', so the sizes of
+// the recorded data stay the same.
+void Mask(size_t begin, size_t end, std::string* data) {
+  std::fill(data->begin() + begin, data->begin() + end, '*');
+}
+
+// Masks the credentials in the recorded |data|: the string values of
+// kSecretJsonKeys, the values of kSecretFormKeys and the text of XMPP <auth>
+// elements, which carry the SASL token.
+void RedactCredentials(std::string* data) {
+  const char kWhitespace[] = " \t\r\n";
+  for (const char* key : kSecretJsonKeys) {
+    std::string quoted = std::string{"\""} + key + '"';
+    for (size_t pos = data->find(quoted); pos != std::string::npos;
+         pos = data->find(quoted, pos)) {
+      pos = data->find_first_not_of(kWhitespace, pos + quoted.size());
+      if (pos == std::string::npos || (*data)[pos] != ':')
+        continue;
+      pos = data->find_first_not_of(kWhitespace, pos + 1);
+      if (pos == std::string::npos || (*data)[pos] != '"')
+        continue;
+      size_t end = std::min(data->find('"', ++pos), data->size());
+      Mask(pos, end, data);
+      pos = end;
+    }
+  }
+
+  for (const char* key : kSecretFormKeys) {
+    std::string field = std::string{key} + '=';
+    for (size_t pos = data->find(field); pos != std::string::npos;
+         pos = data->find(field, pos + 1)) {
+      if (pos > 0 && (*data)[pos - 1] != '&')
+        continue;
+      size_t begin = pos + field.size();
+      Mask(begin, std::min(data->find('&', begin), data->size()), data);
+    }
+  }
+
+  const size_t kAuthSize = sizeof(kXmppAuthElement) - 1;
+  for (size_t pos = data->find(kXmppAuthElement); pos != std::string::npos;
+       pos = data->find(kXmppAuthElement, pos + 1)) {
+    if (pos + kAuthSize < data->size() && (*data)[pos + kAuthSize] != ' ' &&
+        (*data)[pos + kAuthSize] != '>') {
+      continue;  // Another element.
+    }
+    size_t begin = data->find('>', pos);
+    if (begin == std::string::npos)
+      break;
+    ++begin;
+    Mask(begin, std::min(data->find('<', begin), data->size()), data);
+  }
+}
+
+class ReplayResponse : public HttpClient::Response {
+ public:
+  explicit ReplayResponse(const TrafficEvent& event) : event_(event) {}
+
+  int GetStatusCode() const override { return event_.status; }
+  std::string GetContentType() const override { return event_.content_type; }
+  std::string GetHeader(const std::string& name) const override {
+    auto it = event_.headers.find(name);
+    return it != event_.headers.end() ? it->second : std::string{};
+  }
+  const std::string& GetData() const override { return event_.data; }
+
+ private:
+  const TrafficEvent& event_;
+};
+
+ErrorPtr CreateError(const std::string& code, const std::string& message) {
+  ErrorPtr error;
+  Error::AddTo(&error, FROM_HERE, code, message);
+  return error;
+}
+
+void RecordResponse(TrafficRecorder* recorder,
+                    int id,
+                    const HttpClient::SendRequestCallback& callback,
+                    std::unique_ptr<HttpClient::Response> response,
+                    ErrorPtr error) {
+  TrafficEvent event;
+  event.type = TrafficEvent::Type::kResponse;
+  event.id = id;
+  if (response) {
+    event.status = response->GetStatusCode();
+    event.content_type = response->GetContentType();
+    for (const char* name : kRecordedHeaders) {
+      std::string value = response->GetHeader(name);
+      if (!value.empty())
+        event.headers[name] = value;
+    }
+    event.data = response->GetData();
+  } else {
+    event.error = error ? error->GetCode() : "unknown";
+  }
+  recorder->Record(std::move(event));
+  callback.Run(std::move(response), std::move(error));
+}
+
+// Records the data of a socket.
+class RecordingStream : public Stream {
+ public:
+  RecordingStream(std::unique_ptr<Stream> stream,
+                  TrafficRecorder* recorder,
+                  int id)
+      : stream_{std::move(stream)}, recorder_{recorder}, id_{id} {}
+
+  void Read(void* buffer,
+            size_t size_to_read,
+            const ReadCallback& callback) override {
+    stream_->Read(buffer, size_to_read,
+                  base::Bind(&RecordingStream::OnRead,
+                             weak_ptr_factory_.GetWeakPtr(),
+                             static_cast<const char*>(buffer), callback));
+  }
+
+  void Write(const void* buffer,
+             size_t size_to_write,
+             const WriteCallback& callback) override {
+    TrafficEvent event;
+    event.type = TrafficEvent::Type::kWrite;
+    event.id = id_;
+    event.data.assign(static_cast<const char*>(buffer), size_to_write);
+    recorder_->Record(std::move(event));
+    stream_->Write(buffer, size_to_write, callback);
+  }
+
+  void CancelPendingOperations() override {
+    stream_->CancelPendingOperations();
+  }
+
+ private:
+  void OnRead(const char* buffer,
+              const ReadCallback& callback,
+              size_t size,
+              ErrorPtr error) {
+    TrafficEvent event;
+    event.type = TrafficEvent::Type::kRead;
+    event.id = id_;
+    if (error)
+      event.error = error->GetCode();
+    else
+      event.data.assign(buffer, size);
+    recorder_->Record(std::move(event));
+    callback.Run(size, std::move(error));
+  }
+
+  std::unique_ptr<Stream> stream_;
+  TrafficRecorder* recorder_{nullptr};
+  int id_{0};
+
+  base::WeakPtrFactory<RecordingStream> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(RecordingStream);
+};
+
+void RecordOpen(TrafficRecorder* recorder,
+                TrafficEvent event,
+                const Network::OpenSslSocketCallback& callback,
+                std::unique_ptr<Stream> stream,
+                ErrorPtr error) {
+  int id = event.id;
+  if (error) {
+    // A second kOpen, with the error.
+    event.error = error->GetCode();
+    recorder->Record(std::move(event));
+    return callback.Run(nullptr, std::move(error));
+  }
+  callback.Run(
+      std::unique_ptr<Stream>{new RecordingStream{std::move(stream), recorder,
+                                                  id}},
+      nullptr);
+}
+
+bool GetBase64(const base::DictionaryValue& dict,
+               const char* key,
+               std::string* data) {
+  std::string base64;
+  return !dict.GetString(key, &base64) || Base64Decode(base64, data);
+}
+
+}  // namespace
+
+bool ParseTrafficTrace(const std::string& trace,
+                       std::vector<TrafficEvent>* events,
+                       ErrorPtr* error) {
+  size_t line_number = 0;
+  for (const std::string& line : Split(trace, "\n", true, false)) {
+    ++line_number;
+    if (line.empty())
+      continue;
+    auto dict = LoadJsonDict(line, error);
+    std::string type;
+    TrafficEvent event;
+    if (!dict || !dict->GetString("type", &type) ||
+        !StringToEnum(type, &event.type) ||
+        !dict->GetDouble("time", &event.time_ms) ||
+        !dict->GetInteger("id", &event.id) ||
+        !GetBase64(*dict, "data", &event.data)) {
+      return Error::AddToPrintf(error, FROM_HERE, kTraceErrorDomain,
+                                "Invalid event at line %zu", line_number);
+    }
+    dict->GetString("method", &event.method);
+    dict->GetString("url", &event.url);
+    dict->GetString("host", &event.host);
+    dict->GetInteger("port", &event.port);
+    dict->GetInteger("status", &event.status);
+    dict->GetString("contentType", &event.content_type);
+    dict->GetString("error", &event.error);
+    const base::DictionaryValue* headers = nullptr;
+    if (dict->GetDictionary("headers", &headers)) {
+      for (base::DictionaryValue::Iterator it{*headers}; !it.IsAtEnd();
+           it.Advance()) {
+        it.value().GetAsString(&event.headers[it.key()]);
+      }
+    }
+    events->push_back(std::move(event));
+  }
+  return true;
+}
+
+TrafficRecorder::TrafficRecorder(const WriteLineCallback& write_line,
+                                 base::Clock* clock)
+    : write_line_{write_line},
+      clock_{clock ? clock : &default_clock_},
+      start_{clock_->Now()} {}
+
+TrafficRecorder::~TrafficRecorder() {}
+
+void TrafficRecorder::Record(TrafficEvent event) {
+  // Nothing checks the credentials on replay, so the masked ones do.
+  RedactCredentials(&event.data);
+  std::string line;
+  {
+    JsonStreamWriter writer{&line};
+    writer.BeginDictionary();
+    writer.WriteKey("time");
+    writer.WriteDouble((clock_->Now() - start_).InMillisecondsF());
+    writer.WriteKey("type");
+    writer.WriteString(EnumToString(event.type));
+    writer.WriteKey("id");
+    writer.WriteInteger(event.id);
+    if (!event.method.empty()) {
+      writer.WriteKey("method");
+      writer.WriteString(event.method);
+      writer.WriteKey("url");
+      writer.WriteString(event.url);
+    }
+    if (!event.host.empty()) {
+      writer.WriteKey("host");
+      writer.WriteString(event.host);
+      writer.WriteKey("port");
+      writer.WriteInteger(event.port);
+    }
+    if (event.status) {
+      writer.WriteKey("status");
+      writer.WriteInteger(event.status);
+      writer.WriteKey("contentType");
+      writer.WriteString(event.content_type);
+    }
+    if (!event.headers.empty()) {
+      writer.WriteKey("headers");
+      writer.BeginDictionary();
+      for (const auto& header : event.headers) {
+        writer.WriteKey(header.first);
+        writer.WriteString(header.second);
+      }
+      writer.EndDictionary();
+    }
+    if (!event.error.empty()) {
+      writer.WriteKey("error");
+      writer.WriteString(event.error);
+    }
+    writer.WriteKey("data");
+    writer.WriteString(Base64Encode(event.data));
+    writer.EndDictionary();
+  }
+  write_line_.Run(line);
+}
+
+RecordingHttpClient::RecordingHttpClient(HttpClient* http_client,
+                                         TrafficRecorder* recorder)
+    : http_client_{http_client}, recorder_{recorder} {}
+
+RecordingHttpClient::~RecordingHttpClient() {}
+
+void RecordingHttpClient::SendRequest(Method method,
+                                      const std::string& url,
+                                      const Headers& headers,
+                                      const std::string& data,
+                                      const SendRequestCallback& callback) {
+  http_client_->SendRequest(method, url, headers, data,
+                            RecordRequest(method, url, data, callback));
+}
+
+void RecordingHttpClient::SendRequest(Method method,
+                                      const std::string& url,
+                                      const Headers& headers,
+                                      std::unique_ptr<InputStream> data,
+                                      const SendRequestCallback& callback) {
+  http_client_->SendRequest(method, url, headers, std::move(data),
+                            RecordRequest(method, url, {}, callback));
+}
+
+HttpClient::SendRequestCallback RecordingHttpClient::RecordRequest(
+    Method method,
+    const std::string& url,
+    const std::string& data,
+    const SendRequestCallback& callback) {
+  TrafficEvent event;
+  event.type = TrafficEvent::Type::kRequest;
+  event.id = recorder_->CreateId();
+  event.method = EnumToString(method);
+  event.url = url;
+  event.data = data;
+  int id = event.id;
+  recorder_->Record(std::move(event));
+  return base::Bind(&RecordResponse, recorder_, id, callback);
+}
+
+RecordingNetwork::RecordingNetwork(Network* network, TrafficRecorder* recorder)
+    : network_{network}, recorder_{recorder} {}
+
+RecordingNetwork::~RecordingNetwork() {}
+
+void RecordingNetwork::AddConnectionChangedCallback(
+    const ConnectionChangedCallback& callback) {
+  network_->AddConnectionChangedCallback(callback);
+}
+
+Network::State RecordingNetwork::GetConnectionState() const {
+  return network_->GetConnectionState();
+}
+
+void RecordingNetwork::OpenSslSocket(const std::string& host,
+                                     uint16_t port,
+                                     const OpenSslSocketCallback& callback) {
+  TrafficEvent event;
+  event.type = TrafficEvent::Type::kOpen;
+  event.id = recorder_->CreateId();
+  event.host = host;
+  event.port = port;
+  recorder_->Record(event);
+  network_->OpenSslSocket(host, port,
+                          base::Bind(&RecordOpen, recorder_, event, callback));
+}
+
+// Returns the recorded reads of a socket in order. Once they run out, reads
+// never complete, as if the server kept the connection open.
+class TrafficReplayer::ReplayStream : public Stream {
+ public:
+  ReplayStream(const base::WeakPtr<TrafficReplayer>& replayer,
+               std::deque<const TrafficEvent*> reads)
+      : replayer_{replayer}, reads_{std::move(reads)} {}
+
+  void Read(void* buffer,
+            size_t size_to_read,
+            const ReadCallback& callback) override {
+    if (!replayer_ || reads_.empty())
+      return;
+    const TrafficEvent* read = reads_.front();
+    ErrorPtr error;
+    size_t size = 0;
+    if (!read->error.empty()) {
+      error = CreateError(read->error, "Recorded read error");
+    } else {
+      size = std::min(size_to_read, read->data.size() - offset_);
+      memcpy(buffer, read->data.data() + offset_, size);
+      offset_ += size;
+    }
+    if (!error && offset_ < read->data.size())
+      read = nullptr;
+    if (read) {
+      reads_.pop_front();
+      offset_ = 0;
+      replayer_->OnServed(size);
+    } else {
+      replayer_->bytes_served_ += size;
+    }
+    replayer_->task_runner_->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&ReplayStream::RunReadCallback,
+                   weak_ptr_factory_.GetWeakPtr(), callback, size,
+                   base::Passed(&error)),
+        {});
+  }
+
+  void Write(const void* buffer,
+             size_t size_to_write,
+             const WriteCallback& callback) override {
+    if (!replayer_)
+      return;
+    replayer_->bytes_received_ += size_to_write;
+    replayer_->task_runner_->PostDelayedTask(
+        FROM_HERE, base::Bind(&ReplayStream::RunWriteCallback,
+                              weak_ptr_factory_.GetWeakPtr(), callback),
+        {});
+  }
+
+  void CancelPendingOperations() override {
+    weak_ptr_factory_.InvalidateWeakPtrs();
+  }
+
+ private:
+  void RunReadCallback(const ReadCallback& callback,
+                       size_t size,
+                       ErrorPtr error) {
+    callback.Run(size, std::move(error));
+  }
+
+  void RunWriteCallback(const WriteCallback& callback) {
+    callback.Run(nullptr);
+  }
+
+  base::WeakPtr<TrafficReplayer> replayer_;
+  std::deque<const TrafficEvent*> reads_;
+  // Bytes of the first read already returned.
+  size_t offset_{0};
+
+  base::WeakPtrFactory<ReplayStream> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(ReplayStream);
+};
+
+TrafficReplayer::TrafficReplayer(provider::TaskRunner* task_runner,
+                                 std::vector<TrafficEvent> events)
+    : task_runner_{task_runner}, events_{std::move(events)} {
+  for (const auto& event : events_) {
+    switch (event.type) {
+      case TrafficEvent::Type::kRequest:
+        requests_.push_back(&event);
+        break;
+      case TrafficEvent::Type::kResponse:
+        responses_[event.id] = &event;
+        ++pending_;
+        break;
+      case TrafficEvent::Type::kOpen:
+        if (event.error.empty()) {
+          opens_.push_back(&event);
+        } else {
+          // Replaces the kOpen of the socket which failed to open.
+          std::replace_if(opens_.begin(), opens_.end(),
+                          [&event](const TrafficEvent* open) {
+                            return open->id == event.id;
+                          },
+                          &event);
+        }
+        break;
+      case TrafficEvent::Type::kRead:
+        reads_[event.id].push_back(&event);
+        ++pending_;
+        break;
+      case TrafficEvent::Type::kWrite:
+        break;
+    }
+  }
+  if (!events_.empty()) {
+    recorded_duration_ = base::TimeDelta::FromMillisecondsD(
+        events_.back().time_ms - events_.front().time_ms);
+  }
+}
+
+TrafficReplayer::~TrafficReplayer() {}
+
+void TrafficReplayer::SendRequest(Method method,
+                                  const std::string& url,
+                                  const Headers& headers,
+                                  const std::string& data,
+                                  const SendRequestCallback& callback) {
+  bytes_received_ += data.size();
+  std::string method_name = EnumToString(method);
+  std::string path = SplitAtFirst(url, "?", false).first;
+  auto request =
+      std::find_if(requests_.begin(), requests_.end(),
+                   [&method_name, &path](const TrafficEvent* event) {
+                     return event->method == method_name &&
+                            SplitAtFirst(event->url, "?", false).first == path;
+                   });
+  if (request == requests_.end()) {
+    ++unmatched_requests_;
+    ErrorPtr error =
+        CreateError("unrecorded_request", "Request not in the trace");
+    return task_runner_->PostDelayedTask(
+        FROM_HERE, base::Bind(callback, nullptr, base::Passed(&error)), {});
+  }
+  auto response = responses_.find((*request)->id);
+  requests_.erase(request);
+  // The recording ended before the response.
+  if (response == responses_.end())
+    return;
+
+  const TrafficEvent& event = *response->second;
+  OnServed(event.data.size());
+  std::unique_ptr<Response> reply;
+  ErrorPtr error;
+  if (event.error.empty())
+    reply.reset(new ReplayResponse{event});
+  else
+    error = CreateError(event.error, "Recorded request error");
+  task_runner_->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(callback, base::Passed(&reply), base::Passed(&error)), {});
+}
+
+void TrafficReplayer::SendRequest(Method method,
+                                  const std::string& url,
+                                  const Headers& headers,
+                                  std::unique_ptr<InputStream> data,
+                                  const SendRequestCallback& callback) {
+  SendRequest(method, url, headers, std::string{}, callback);
+}
+
+void TrafficReplayer::OpenSslSocket(const std::string& host,
+                                    uint16_t port,
+                                    const OpenSslSocketCallback& callback) {
+  auto open = std::find_if(opens_.begin(), opens_.end(),
+                           [&host, port](const TrafficEvent* event) {
+                             return event->host == host && event->port == port;
+                           });
+  std::unique_ptr<Stream> stream;
+  ErrorPtr error;
+  if (open == opens_.end()) {
+    error = CreateError("unrecorded_socket", "Socket not in the trace");
+  } else {
+    if (!(*open)->error.empty()) {
+      error = CreateError((*open)->error, "Recorded socket error");
+    } else {
+      std::deque<const TrafficEvent*> stream_reads;
+      auto reads = reads_.find((*open)->id);
+      if (reads != reads_.end())
+        stream_reads.swap(reads->second);
+      stream.reset(new ReplayStream{weak_ptr_factory_.GetWeakPtr(),
+                                    std::move(stream_reads)});
+    }
+    opens_.erase(open);
+  }
+  task_runner_->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(callback, base::Passed(&stream), base::Passed(&error)), {});
+}
+
+void TrafficReplayer::OnServed(size_t bytes) {
+  bytes_served_ += bytes;
+  CHECK_GT(pending_, 0u);
+  if (--pending_ == 0 && !done_callback_.is_null())
+    done_callback_.Run();
+}
+
+}  // namespace test
+}  // namespace weave
@@ -0,0 +1,230 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_TEST_TRAFFIC_TRACE_H_
+#define LIBWEAVE_SRC_TEST_TRAFFIC_TRACE_H_
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <base/time/default_clock.h>
+#include <weave/error.h>
+#include <weave/provider/http_client.h>
+#include <weave/provider/network.h>
+
+namespace weave {
+
+namespace provider {
+class TaskRunner;
+}  // namespace provider
+
+namespace test {
+
+// An event of the traffic between a device and its servers, as recorded by
+// TrafficRecorder.
+struct TrafficEvent {
+  enum class Type {
+    kRequest,
+    kResponse,
+    kOpen,
+    kRead,
+    kWrite,
+  };
+
+  Type type{Type::kRequest};
+  // Milliseconds since the recording started.
+  double time_ms{0};
+  // Pairs responses with their requests, and stream events with their kOpen.
+  int id{0};
+  // kRequest.
+  std::string method;
+  std::string url;
+  // kOpen.
+  std::string host;
+  int port{0};
+  // kResponse, with the headers libweave looks at.
+  int status{0};
+  std::string content_type;
+  std::map<std::string, std::string> headers;
+  // Bodies of kRequest and kResponse, and the bytes of kRead and kWrite.
+  std::string data;
+  // Error code of a failed kResponse or kRead. A socket which fails to open
+  // gets a second kOpen with the error.
+  std::string error;
+};
+
+// Parses a trace written by TrafficRecorder.
+bool ParseTrafficTrace(const std::string& trace,
+                       std::vector<TrafficEvent>* events,
+                       ErrorPtr* error);
+
+// Writes the traffic of RecordingHttpClient and RecordingNetwork as JSON
+// lines, one event each, with the data in base64, e.g.
+//   {"time":0,"type":"request","id":1,"method":"POST","url":"...","data":""}
+//   {"time":81.5,"type":"response","id":1,"status":200,...}
+// Embedders record real traffic by wrapping their providers before passing
+// them to Device::Create(), and |write_line| appending to a file.
+//
+// The OAuth tokens and secrets, the robot account authorization code and the
+// XMPP SASL token are masked with '*'. Everything else, e.g. the state and
+// the commands of the device, is recorded as is, so traces are as private
+// as the devices they were recorded from.
+class TrafficRecorder final {
+ public:
+  using WriteLineCallback = base::Callback<void(const std::string& line)>;
+
+  explicit TrafficRecorder(const WriteLineCallback& write_line,
+                           base::Clock* clock = nullptr);
+  ~TrafficRecorder();
+
+  int CreateId() { return ++last_id_; }
+  void Record(TrafficEvent event);
+
+ private:
+  WriteLineCallback write_line_;
+  base::DefaultClock default_clock_;
+  base::Clock* clock_{nullptr};
+  base::Time start_;
+  int last_id_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(TrafficRecorder);
+};
+
+// Records the requests sent with |http_client| and their responses.
+class RecordingHttpClient final : public provider::HttpClient {
+ public:
+  RecordingHttpClient(provider::HttpClient* http_client,
+                      TrafficRecorder* recorder);
+  ~RecordingHttpClient() override;
+
+  // HttpClient overrides.
+  void SendRequest(Method method,
+                   const std::string& url,
+                   const Headers& headers,
+                   const std::string& data,
+                   const SendRequestCallback& callback) override;
+  // The streamed bodies are not recorded.
+  void SendRequest(Method method,
+                   const std::string& url,
+                   const Headers& headers,
+                   std::unique_ptr<InputStream> data,
+                   const SendRequestCallback& callback) override;
+
+ private:
+  SendRequestCallback RecordRequest(Method method,
+                                    const std::string& url,
+                                    const std::string& data,
+                                    const SendRequestCallback& callback);
+
+  provider::HttpClient* http_client_{nullptr};
+  TrafficRecorder* recorder_{nullptr};
+
+  DISALLOW_COPY_AND_ASSIGN(RecordingHttpClient);
+};
+
+// Records the bytes read from and written to the sockets opened with
+// |network|, e.g. XMPP streams.
+class RecordingNetwork final : public provider::Network {
+ public:
+  RecordingNetwork(provider::Network* network, TrafficRecorder* recorder);
+  ~RecordingNetwork() override;
+
+  // Network overrides.
+  void AddConnectionChangedCallback(
+      const ConnectionChangedCallback& callback) override;
+  State GetConnectionState() const override;
+  void OpenSslSocket(const std::string& host,
+                     uint16_t port,
+                     const OpenSslSocketCallback& callback) override;
+
+ private:
+  provider::Network* network_{nullptr};
+  TrafficRecorder* recorder_{nullptr};
+
+  DISALLOW_COPY_AND_ASSIGN(RecordingNetwork);
+};
+
+// Plays the server side of a trace back to a device as fast as possible.
+// A request gets the response of the first recorded request with the same
+// method and URL path which hasn't been answered yet, right away. Sockets
+// are matched by host and port in the recorded order, and return the
+// recorded reads as soon as they are read, while writes are only counted.
+class TrafficReplayer final : public provider::HttpClient,
+                              public provider::Network {
+ public:
+  TrafficReplayer(provider::TaskRunner* task_runner,
+                  std::vector<TrafficEvent> events);
+  ~TrafficReplayer() override;
+
+  // Called once all the recorded responses and reads have been served.
+  void SetDoneCallback(const base::Closure& callback) {
+    done_callback_ = callback;
+  }
+  bool IsDone() const { return pending_ == 0; }
+
+  size_t GetUnmatchedRequestCount() const { return unmatched_requests_; }
+  // Bytes passed to the device, and received from it.
+  size_t GetBytesServed() const { return bytes_served_; }
+  size_t GetBytesReceived() const { return bytes_received_; }
+  // Time span of the recording.
+  base::TimeDelta GetRecordedDuration() const { return recorded_duration_; }
+
+  // HttpClient overrides.
+  void SendRequest(Method method,
+                   const std::string& url,
+                   const Headers& headers,
+                   const std::string& data,
+                   const SendRequestCallback& callback) override;
+  void SendRequest(Method method,
+                   const std::string& url,
+                   const Headers& headers,
+                   std::unique_ptr<InputStream> data,
+                   const SendRequestCallback& callback) override;
+
+  // Network overrides.
+  void AddConnectionChangedCallback(
+      const ConnectionChangedCallback& callback) override {}
+  State GetConnectionState() const override { return State::kOnline; }
+  void OpenSslSocket(const std::string& host,
+                     uint16_t port,
+                     const OpenSslSocketCallback& callback) override;
+
+ private:
+  class ReplayStream;
+  friend class ReplayStream;
+
+  // Marks a recorded response or read as served.
+  void OnServed(size_t bytes);
+
+  provider::TaskRunner* task_runner_{nullptr};
+  std::vector<TrafficEvent> events_;
+  // Requests and sockets not replayed yet, in the recorded order.
+  std::deque<const TrafficEvent*> requests_;
+  std::deque<const TrafficEvent*> opens_;
+  // Responses and reads by the id of their request or socket.
+  std::map<int, const TrafficEvent*> responses_;
+  std::map<int, std::deque<const TrafficEvent*>> reads_;
+
+  size_t pending_{0};
+  size_t unmatched_requests_{0};
+  size_t bytes_served_{0};
+  size_t bytes_received_{0};
+  base::TimeDelta recorded_duration_;
+  base::Closure done_callback_;
+
+  base::WeakPtrFactory<TrafficReplayer> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(TrafficReplayer);
+};
+
+}  // namespace test
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_TEST_TRAFFIC_TRACE_H_
@@ -0,0 +1,236 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/test/traffic_trace.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
+#include <weave/provider/test/mock_http_client.h>
+#include <weave/provider/test/mock_network.h>
+#include <weave/test/fake_stream.h>
+
+#include "src/bind_lambda.h"
+
+namespace weave {
+namespace test {
+
+using provider::HttpClient;
+using provider::Network;
+using testing::_;
+using testing::Invoke;
+using testing::StrictMock;
+
+namespace {
+
+class FakeResponse : public HttpClient::Response {
+ public:
+  FakeResponse(int status, const std::string& data)
+      : status_{status}, data_{data} {}
+
+  int GetStatusCode() const override { return status_; }
+  std::string GetContentType() const override { return "application/json"; }
+  std::string GetHeader(const std::string& name) const override {
+    return name == "Retry-After" ? "10" : std::string{};
+  }
+  const std::string& GetData() const override { return data_; }
+
+ private:
+  int status_{0};
+  std::string data_;
+};
+
+}  // namespace
+
+class TrafficTraceTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    recorder_.reset(new TrafficRecorder{
+        base::Bind([](std::string* trace,
+                      const std::string& line) { *trace += line + "\n"; },
+                   &trace_),
+        task_runner_.GetClock()});
+  }
+
+  std::vector<TrafficEvent> ParseTrace() {
+    std::vector<TrafficEvent> events;
+    ErrorPtr error;
+    EXPECT_TRUE(ParseTrafficTrace(trace_, &events, &error)) << trace_;
+    return events;
+  }
+
+  // Sends a request and returns the reply, or the error code.
+  std::string SendRequest(HttpClient* http_client,
+                          HttpClient::Method method,
+                          const std::string& url,
+                          const std::string& data) {
+    std::string reply;
+    http_client->SendRequest(
+        method, url, {}, data,
+        base::Bind(
+            [](std::string* reply,
+               std::unique_ptr<HttpClient::Response> response,
+               ErrorPtr error) {
+              *reply = response ? std::to_string(response->GetStatusCode()) +
+                                      " " + response->GetData()
+                                : error->GetCode();
+            },
+            &reply));
+    task_runner_.Run();
+    return reply;
+  }
+
+  provider::test::FakeTaskRunner task_runner_;
+  StrictMock<provider::test::MockHttpClient> http_client_;
+  StrictMock<provider::test::MockNetwork> network_;
+  std::string trace_;
+  std::unique_ptr<TrafficRecorder> recorder_;
+};
+
+TEST_F(TrafficTraceTest, HttpRoundTrip) {
+  RecordingHttpClient recording{&http_client_, recorder_.get()};
+  EXPECT_CALL(http_client_, SendRequest(HttpClient::Method::kPost,
+                                        "https://cloud/oauth2/token?key=1", _,
+                                        "request", _))
+      .WillOnce(Invoke([this](HttpClient::Method, const std::string&,
+                              const HttpClient::Headers&, const std::string&,
+                              const HttpClient::SendRequestCallback& callback) {
+        task_runner_.PostDelayedTask(
+            FROM_HERE,
+            base::Bind(callback, base::Passed(std::unique_ptr<
+                                              HttpClient::Response>{
+                                     new FakeResponse{200, "{\"a\":1}"}}),
+                       nullptr),
+            base::TimeDelta::FromMilliseconds(50));
+      }));
+  EXPECT_EQ("200 {\"a\":1}",
+            SendRequest(&recording, HttpClient::Method::kPost,
+                        "https://cloud/oauth2/token?key=1", "request"));
+
+  auto events = ParseTrace();
+  ASSERT_EQ(2u, events.size());
+  EXPECT_EQ(TrafficEvent::Type::kRequest, events[0].type);
+  EXPECT_EQ("POST", events[0].method);
+  EXPECT_EQ("request", events[0].data);
+  EXPECT_EQ(TrafficEvent::Type::kResponse, events[1].type);
+  EXPECT_EQ(events[0].id, events[1].id);
+  EXPECT_DOUBLE_EQ(50, events[1].time_ms - events[0].time_ms);
+  EXPECT_EQ("10", events[1].headers["Retry-After"]);
+
+  TrafficReplayer replayer{&task_runner_, events};
+  bool done = false;
+  replayer.SetDoneCallback(
+      base::Bind([](bool* done) { *done = true; }, &done));
+  EXPECT_EQ("unrecorded_request",
+            SendRequest(&replayer, HttpClient::Method::kGet,
+                        "https://cloud/oauth2/token", ""));
+  EXPECT_FALSE(done);
+  // The query doesn't matter.
+  EXPECT_EQ("200 {\"a\":1}",
+            SendRequest(&replayer, HttpClient::Method::kPost,
+                        "https://cloud/oauth2/token?key=2", "other"));
+  EXPECT_TRUE(done);
+  EXPECT_EQ(1u, replayer.GetUnmatchedRequestCount());
+  EXPECT_EQ(7u, replayer.GetBytesServed());
+  EXPECT_EQ(50, replayer.GetRecordedDuration().InMilliseconds());
+}
+
+TEST_F(TrafficTraceTest, SocketRoundTrip) {
+  RecordingNetwork recording{&network_, recorder_.get()};
+  EXPECT_CALL(network_, OpenSslSocket("talk.google.com", 5223, _))
+      .WillOnce(Invoke([this](const std::string&, uint16_t,
+                              const Network::OpenSslSocketCallback& callback) {
+        std::unique_ptr<FakeStream> stream{
+            new FakeStream{&task_runner_, "<stream>"}};
+        stream->ExpectWritePacketString({}, "<auth/>");
+        callback.Run(std::move(stream), nullptr);
+      }))
+      .WillOnce(Invoke([](const std::string&, uint16_t,
+                          const Network::OpenSslSocketCallback& callback) {
+        ErrorPtr error;
+        Error::AddTo(&error, FROM_HERE, "refused", "Connection refused");
+        callback.Run(nullptr, std::move(error));
+      }));
+
+  // Opens a socket, writes "<auth/>" and reads twice, 6 and then 2 bytes.
+  auto use_socket = [this](Network* network) {
+    std::unique_ptr<Stream> socket;
+    std::string read;
+    network->OpenSslSocket(
+        "talk.google.com", 5223,
+        base::Bind(
+            [](std::unique_ptr<Stream>* socket, std::unique_ptr<Stream> stream,
+               ErrorPtr error) { *socket = std::move(stream); },
+            &socket));
+    task_runner_.RunPendingTasks();
+    if (!socket)
+      return std::string{"closed"};
+    socket->Write("<auth/>", 7, base::Bind([](ErrorPtr) {}));
+    char buffer[6];
+    auto on_read = [](std::string* read, const char* buffer, size_t size,
+                      ErrorPtr error) { read->append(buffer, size); };
+    socket->Read(buffer, sizeof(buffer), base::Bind(on_read, &read, buffer));
+    task_runner_.RunPendingTasks();
+    socket->Read(buffer, sizeof(buffer), base::Bind(on_read, &read, buffer));
+    task_runner_.RunPendingTasks();
+    return read;
+  };
+  EXPECT_EQ("<stream>", use_socket(&recording));
+  EXPECT_EQ("closed", use_socket(&recording));
+
+  auto events = ParseTrace();
+  ASSERT_EQ(6u, events.size());
+  EXPECT_EQ(TrafficEvent::Type::kOpen, events[0].type);
+  EXPECT_EQ("talk.google.com", events[0].host);
+  EXPECT_EQ(5223, events[0].port);
+  EXPECT_EQ(TrafficEvent::Type::kWrite, events[1].type);
+  EXPECT_EQ("<auth/>", events[1].data);
+  EXPECT_EQ("<strea", events[2].data);
+  EXPECT_EQ("m>", events[3].data);
+  EXPECT_EQ(TrafficEvent::Type::kOpen, events[5].type);
+  EXPECT_EQ("refused", events[5].error);
+
+  TrafficReplayer replayer{&task_runner_, events};
+  EXPECT_EQ("<stream>", use_socket(&replayer));
+  EXPECT_TRUE(replayer.IsDone());
+  EXPECT_EQ("closed", use_socket(&replayer));
+  EXPECT_EQ(8u, replayer.GetBytesServed());
+  EXPECT_EQ(7u, replayer.GetBytesReceived());
+}
+
+TEST_F(TrafficTraceTest, ParseInvalidTrace) {
+  std::vector<TrafficEvent> events;
+  ErrorPtr error;
+  EXPECT_FALSE(ParseTrafficTrace(
+      "{\"time\":0,\"type\":\"open\",\"id\":1,\"data\":\"\"}\n"
+      "{\"time\":0,\"type\":\"bogus\",\"id\":1,\"data\":\"\"}\n",
+      &events, &error));
+  EXPECT_EQ("Invalid event at line 2", error->GetMessage());
+}
+
+TEST_F(TrafficTraceTest, RedactCredentials) {
+  auto record = [this](TrafficEvent::Type type, const std::string& data) {
+    TrafficEvent event;
+    event.type = type;
+    event.data = data;
+    recorder_->Record(std::move(event));
+  };
+  record(TrafficEvent::Type::kRequest,
+         "refresh_token=abc&client_id=id&client_secret=s&grant_type=x");
+  record(TrafficEvent::Type::kResponse,
+         R"({"access_token": "tok", "expires_in": 3600})");
+  record(TrafficEvent::Type::kWrite,
+         "<auth mechanism='X-OAUTH2'>AGFiYwB0b2s=</auth>");
+
+  auto events = ParseTrace();
+  ASSERT_EQ(3u, events.size());
+  EXPECT_EQ("refresh_token=***&client_id=id&client_secret=*&grant_type=x",
+            events[0].data);
+  EXPECT_EQ(R"({"access_token": "***", "expires_in": 3600})",
+            events[1].data);
+  EXPECT_EQ("<auth mechanism='X-OAUTH2'>************</auth>", events[2].data);
+}
+
+}  // namespace test
+}  // namespace weave
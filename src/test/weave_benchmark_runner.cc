@@ -0,0 +1,41 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+
+#include <string>
+
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+
+#include "src/string_utils.h"
+#include "src/test/benchmark.h"
+
+// Usage: lib(u)weave_benchmark [--filter=<substring>] [--min_time=<seconds>]
+int main(int argc, char** argv) {
+  logging::LoggingSettings settings;
+  settings.logging_dest = logging::LOG_TO_SYSTEM_DEBUG_LOG;
+  logging::InitLogging(settings);
+  logging::SetLogItems(false, false, false, false);
+
+  std::string filter;
+  double min_time_seconds = 0.5;
+  for (int i = 1; i < argc; ++i) {
+    auto pair = weave::SplitAtFirst(argv[i], "=", false);
+    if (pair.first == "--filter") {
+      filter = pair.second;
+    } else if (pair.first != "--min_time" ||
+               !base::StringToDouble(pair.second, &min_time_seconds)) {
+      fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  if (!weave::test::RunBenchmarks(
+          filter, base::TimeDelta::FromSecondsD(min_time_seconds))) {
+    fprintf(stderr, "No benchmarks match '%s'\n", filter.c_str());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,558 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Drives a whole device with simulated local and cloud clients, to see how
+// command dispatch and state publication behave under load.
+//
+// The device runs on FakeTaskRunner, so the simulated time advances as fast
+// as the tasks run, and the cloud is faked by an HttpClient which replies
+// after a fixed round-trip time. Local clients send Privet requests to the
+// HTTPS handlers directly. Cloud clients queue commands the device picks up
+// with its pull channel, there is no XMPP server.
+//
+// Usage: libweave_load_generator [--components=8] [--traits=4]
+//            [--local_clients=4] [--cloud_clients=4] [--rate=<commands/s>]
+//            [--sensor_rate=<updates/s>] [--duration=<seconds>]
+//            [--rtt_ms=<milliseconds>]
+
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/values.h>
+#include <gmock/gmock.h>
+#include <weave/device.h>
+#include <weave/provider/test/fake_task_runner.h>
+#include <weave/provider/test/mock_config_store.h>
+#include <weave/provider/test/mock_http_server.h>
+#include <weave/provider/test/mock_network.h>
+
+#include "src/data_encoding.h"
+#include "src/json_stream_writer.h"
+#include "src/string_utils.h"
+#include "src/test/fake_http_response.h"
+#include "src/utils.h"
+
+namespace weave {
+
+namespace {
+
+using provider::HttpClient;
+using provider::HttpServer;
+using testing::_;
+using testing::Invoke;
+using testing::NiceMock;
+using testing::Return;
+
+const char kSettings[] = R"({
+  "version": 2,
+  "device_id": "TEST_DEVICE_ID",
+  "cloud_id": "LOAD_CLOUD_ID",
+  "refresh_token": "REFRESH_TOKEN",
+  "robot_account": "robot@example.com",
+  "local_anonymous_access_role": "user"
+})";
+
+const char kAuthTokenResponse[] = R"({
+  "access_token": "ACCESS_TOKEN",
+  "token_type": "Bearer",
+  "expires_in": 3599
+})";
+
+// "certFingerprint" matches GetHttpsCertificateFingerprint() below.
+const char kDeviceResponse[] = R"({
+  "id": "LOAD_CLOUD_ID",
+  "lastUpdateTimeMs": "1",
+  "certFingerprint": "AQID"
+})";
+
+struct Options {
+  int components{8};
+  int traits{4};
+  int local_clients{4};
+  int cloud_clients{4};
+  // Commands per second per client, and state updates per second the device
+  // makes on its own, in simulated time.
+  double rate{10};
+  double sensor_rate{0};
+  double duration_seconds{60};
+  int rtt_ms{100};
+};
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  std::map<std::string, int*> int_flags{
+      {"--components", &options->components},
+      {"--traits", &options->traits},
+      {"--local_clients", &options->local_clients},
+      {"--cloud_clients", &options->cloud_clients},
+      {"--rtt_ms", &options->rtt_ms},
+  };
+  std::map<std::string, double*> double_flags{
+      {"--rate", &options->rate},
+      {"--sensor_rate", &options->sensor_rate},
+      {"--duration", &options->duration_seconds},
+  };
+  for (int i = 1; i < argc; ++i) {
+    auto pair = SplitAtFirst(argv[i], "=", false);
+    auto int_flag = int_flags.find(pair.first);
+    auto double_flag = double_flags.find(pair.first);
+    if (int_flag != int_flags.end()) {
+      if (base::StringToInt(pair.second, int_flag->second) &&
+          *int_flag->second >= 0) {
+        continue;
+      }
+    } else if (double_flag != double_flags.end()) {
+      if (base::StringToDouble(pair.second, double_flag->second) &&
+          *double_flag->second >= 0) {
+        continue;
+      }
+    }
+    fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+    return false;
+  }
+  if (options->components < 1 || options->traits < 1 || options->rate <= 0) {
+    fprintf(stderr, "At least one component, trait and command/s needed\n");
+    return false;
+  }
+  return true;
+}
+
+std::string GetTraitName(int index) {
+  return "trait" + std::to_string(index);
+}
+
+std::string GetComponentName(int index) {
+  return "comp" + std::to_string(index);
+}
+
+class PrivetRequest : public HttpServer::Request {
+ public:
+  using ReplyCallback = base::Callback<void(int status, const std::string&)>;
+
+  PrivetRequest(const std::string& path,
+                const std::string& authorization,
+                const std::string& data,
+                const ReplyCallback& callback)
+      : path_{path},
+        authorization_{authorization},
+        data_{data},
+        callback_{callback} {}
+
+  std::string GetPath() const override { return path_; }
+  std::string GetFirstHeader(const std::string& name) const override {
+    if (name == "Authorization")
+      return authorization_;
+    return name == "Content-Type" ? "application/json" : std::string{};
+  }
+  std::string GetData() override { return data_; }
+  void SendReply(int status_code,
+                 const std::string& data,
+                 const std::string& mime_type) override {
+    callback_.Run(status_code, data);
+  }
+
+ private:
+  std::string path_;
+  std::string authorization_;
+  std::string data_;
+  ReplyCallback callback_;
+};
+
+bool EndsWith(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+double GetPercentile(std::vector<double> samples, double percentile) {
+  if (samples.empty())
+    return 0;
+  size_t index = static_cast<size_t>(percentile / 100 * (samples.size() - 1));
+  std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+  return samples[index];
+}
+
+void PrintLatencies(const char* name,
+                    const char* unit,
+                    const std::vector<double>& samples) {
+  printf("%-36s %10zu  p50 %10.1f %s  p99 %10.1f %s\n", name, samples.size(),
+         GetPercentile(samples, 50), unit, GetPercentile(samples, 99), unit);
+}
+
+class LoadGenerator final : public HttpClient {
+ public:
+  explicit LoadGenerator(const Options& options)
+      : options_(options),
+        command_interval_{base::TimeDelta::FromSecondsD(1 / options.rate)},
+        rtt_{base::TimeDelta::FromMilliseconds(options.rtt_ms)} {
+    EXPECT_CALL(config_store_, LoadSettings())
+        .WillRepeatedly(Return(kSettings));
+    ON_CALL(network_, GetConnectionState())
+        .WillByDefault(Return(provider::Network::State::kOnline));
+    ON_CALL(http_server_, GetHttpsCertificateFingerprint())
+        .WillByDefault(Return(std::vector<uint8_t>{1, 2, 3}));
+    ON_CALL(http_server_, GetRequestTimeout())
+        .WillByDefault(Return(base::TimeDelta::Max()));
+    ON_CALL(http_server_, AddHttpsRequestHandler(_, _))
+        .WillByDefault(
+            Invoke([this](const std::string& path,
+                          const HttpServer::RequestHandlerCallback& callback) {
+              https_handlers_[path] = callback;
+            }));
+  }
+
+  void Run() {
+    device_ = Device::Create(&config_store_, &task_runner_, this, &network_,
+                             nullptr, &http_server_, nullptr, nullptr);
+    AddComponents();
+
+    const int clients = options_.local_clients + options_.cloud_clients;
+    local_tokens_.resize(options_.local_clients);
+    for (int i = 0; i < options_.local_clients; ++i)
+      Authenticate(i);
+    // Spread the clients evenly over the command interval.
+    for (int i = 0; i < clients; ++i) {
+      task_runner_.PostDelayedTask(
+          FROM_HERE, base::Bind(&LoadGenerator::IssueCommand,
+                                base::Unretained(this), i,
+                                i >= options_.local_clients),
+          command_interval_ * i / clients);
+    }
+    if (options_.sensor_rate > 0) {
+      task_runner_.PostDelayedTask(
+          FROM_HERE,
+          base::Bind(&LoadGenerator::UpdateSensor, base::Unretained(this)),
+          {});
+    }
+    task_runner_.PostDelayedTask(
+        FROM_HERE, base::Bind(&provider::test::FakeTaskRunner::Break,
+                              base::Unretained(&task_runner_)),
+        base::TimeDelta::FromSecondsD(options_.duration_seconds));
+
+    base::TimeTicks start = base::TimeTicks::Now();
+    task_runner_.Run(std::numeric_limits<size_t>::max());
+    wall_time_ = base::TimeTicks::Now() - start;
+  }
+
+  void PrintReport() const {
+    double seconds = wall_time_.InSecondsF();
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%d components x %d traits, %d local and %d cloud clients at "
+           "%.1f commands/s, %.0fs simulated with %dms round trips\n",
+           options_.components, options_.traits, options_.local_clients,
+           options_.cloud_clients, options_.rate, options_.duration_seconds,
+           options_.rtt_ms);
+    printf("%-36s %10zu  %.0f/s\n", "Commands completed", commands_completed_,
+           seconds > 0 ? commands_completed_ / seconds : 0);
+    printf("%-36s %10zu\n", "Commands rejected", commands_rejected_);
+    printf("%-36s %10zu\n", "Commands pending", issued_.size());
+    PrintLatencies("Local command dispatch (wall)", "us",
+                   local_dispatch_latencies_);
+    PrintLatencies("Cloud command dispatch (simulated)", "ms",
+                   cloud_dispatch_latencies_);
+    printf("%-36s %10zu  %zu patches\n", "patchState requests",
+           patch_state_requests_, patches_);
+    PrintLatencies("patchState publication (simulated)", "ms",
+                   publish_latencies_);
+    // Intermediate values are dropped when coalescing state changes.
+    printf("%-36s %10zu\n", "State values not published", unpublished_.size());
+    printf("%-36s %10.2fs  %.0fx real time\n", "Wall time", seconds,
+           seconds > 0 ? options_.duration_seconds / seconds : 0);
+    printf("%-36s %10ld KiB\n", "Peak RSS", usage.ru_maxrss);
+  }
+
+  // HttpClient implementation, the fake cloud server.
+  void SendRequest(Method method,
+                   const std::string& url,
+                   const Headers& headers,
+                   const std::string& data,
+                   const SendRequestCallback& callback) override {
+    std::string body = data;
+    for (const auto& header : headers) {
+      if (header.first == "Content-Encoding")
+        CHECK(GzipDecode(data, 0, &body));
+    }
+
+    std::string path = SplitAtFirst(url, "?", false).first;
+    std::string reply = "{}";
+    if (EndsWith(path, "/oauth2/token")) {
+      reply = kAuthTokenResponse;
+    } else if (EndsWith(path, "/commands/queue")) {
+      reply = TakeCloudCommands();
+    } else if (EndsWith(path, "/patchState")) {
+      OnPatchState(body);
+    } else if (EndsWith(path, "/devices/LOAD_CLOUD_ID/")) {
+      reply = kDeviceResponse;
+    }
+    task_runner_.PostDelayedTask(
+        FROM_HERE, base::Bind(&LoadGenerator::SendResponse,
+                              base::Unretained(this), callback, reply),
+        rtt_);
+  }
+
+  void SendRequest(Method method,
+                   const std::string& url,
+                   const Headers& headers,
+                   std::unique_ptr<InputStream> data,
+                   const SendRequestCallback& callback) override {
+    LOG(FATAL) << "Streamed requests are not simulated: " << url;
+  }
+
+ private:
+  struct IssuedCommand {
+    base::TimeTicks wall_time;
+    base::Time time;
+    bool local;
+  };
+
+  void AddComponents() {
+    std::string traits;
+    {
+      JsonStreamWriter writer{&traits};
+      writer.BeginDictionary();
+      for (int i = 0; i < options_.traits; ++i) {
+        writer.WriteKey(GetTraitName(i));
+        writer.WriteJson(R"({
+          "commands": {
+            "run": {
+              "minimalRole": "user",
+              "parameters": {"seq": {"type": "integer"}}
+            }
+          },
+          "state": {"value": {"type": "integer"}}
+        })");
+      }
+      writer.EndDictionary();
+    }
+    device_->AddTraitDefinitionsFromJson(traits);
+
+    std::vector<std::string> trait_names;
+    for (int i = 0; i < options_.traits; ++i)
+      trait_names.push_back(GetTraitName(i));
+    for (int i = 0; i < options_.components; ++i) {
+      std::string name = GetComponentName(i);
+      CHECK(device_->AddComponent(name, trait_names, nullptr));
+      for (const auto& trait : trait_names) {
+        CHECK(device_->SetStateProperty(name, trait + ".value",
+                                        base::FundamentalValue{0}, nullptr));
+        device_->AddCommandHandler(
+            name, trait + ".run",
+            base::Bind(&LoadGenerator::OnCommand, base::Unretained(this)));
+      }
+    }
+  }
+
+  void Authenticate(int client) {
+    auto callback = [](LoadGenerator* self, int client, int status,
+                       const std::string& data) {
+      auto reply = LoadJsonDict(data, nullptr);
+      CHECK_EQ(200, status) << data;
+      CHECK(reply && reply->GetString("accessToken",
+                                      &self->local_tokens_[client]));
+    };
+    std::unique_ptr<HttpServer::Request> request{new PrivetRequest{
+        "/privet/v3/auth", "Privet anonymous",
+        R"({"mode": "anonymous", "requestedScope": "user"})",
+        base::Bind(callback, base::Unretained(this), client)}};
+    https_handlers_["/privet/v3/auth"].Run(std::move(request));
+  }
+
+  void IssueCommand(int client, bool cloud) {
+    task_runner_.PostDelayedTask(
+        FROM_HERE, base::Bind(&LoadGenerator::IssueCommand,
+                              base::Unretained(this), client, cloud),
+        command_interval_);
+
+    int seq = ++last_seq_;
+    base::DictionaryValue command;
+    command.SetString("name", GetTraitName(random_() % options_.traits) +
+                                  ".run");
+    command.SetString("component",
+                      GetComponentName(random_() % options_.components));
+    command.SetInteger("parameters.seq", seq);
+    issued_[seq] = {base::TimeTicks::Now(), GetNow(), !cloud};
+
+    if (cloud) {
+      command.SetString("id", "cloud-" + std::to_string(seq));
+      command.SetString("state", "queued");
+      command.SetString("creationTimeMs",
+                        std::to_string(GetNow().ToJavaTime()));
+      cloud_commands_.Append(command.CreateDeepCopy());
+      return;
+    }
+
+    auto callback = [](LoadGenerator* self, int seq, int status,
+                       const std::string& data) {
+      if (status == 200)
+        return;
+      ++self->commands_rejected_;
+      self->issued_.erase(seq);
+    };
+    std::string body;
+    {
+      JsonStreamWriter writer{&body};
+      writer.WriteValue(command);
+    }
+    std::unique_ptr<HttpServer::Request> request{new PrivetRequest{
+        "/privet/v3/commands/execute", "Privet " + local_tokens_[client], body,
+        base::Bind(callback, base::Unretained(this), seq)}};
+    https_handlers_["/privet/v3/commands/execute"].Run(std::move(request));
+  }
+
+  void UpdateSensor() {
+    task_runner_.PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&LoadGenerator::UpdateSensor, base::Unretained(this)),
+        base::TimeDelta::FromSecondsD(1 / options_.sensor_rate));
+    SetValue(GetComponentName(random_() % options_.components),
+             GetTraitName(random_() % options_.traits), ++last_seq_);
+  }
+
+  void OnCommand(const std::weak_ptr<Command>& weak_command) {
+    auto command = weak_command.lock();
+    if (!command)
+      return;
+    int seq = 0;
+    CHECK(command->GetParameters().GetInteger("seq", &seq));
+    auto issued = issued_.find(seq);
+    if (issued != issued_.end()) {
+      if (issued->second.local) {
+        local_dispatch_latencies_.push_back(
+            (base::TimeTicks::Now() - issued->second.wall_time).InSecondsF() *
+            1e6);
+      } else {
+        cloud_dispatch_latencies_.push_back(
+            (GetNow() - issued->second.time).InMillisecondsF());
+      }
+      issued_.erase(issued);
+    }
+
+    std::string trait = SplitAtFirst(command->GetName(), ".", false).first;
+    SetValue(command->GetComponent(), trait, seq);
+    CHECK(command->Complete({}, nullptr));
+    ++commands_completed_;
+  }
+
+  void SetValue(const std::string& component, const std::string& trait,
+                int seq) {
+    CHECK(device_->SetStateProperty(component, trait + ".value",
+                                    base::FundamentalValue{seq}, nullptr));
+    unpublished_[seq] = GetNow();
+  }
+
+  std::string TakeCloudCommands() {
+    std::string reply;
+    {
+      JsonStreamWriter writer{&reply};
+      writer.BeginDictionary();
+      writer.WriteKey("commands");
+      writer.WriteValue(cloud_commands_);
+      writer.EndDictionary();
+    }
+    cloud_commands_.Clear();
+    return reply;
+  }
+
+  void OnPatchState(const std::string& body) {
+    ++patch_state_requests_;
+    auto request = LoadJsonDict(body, nullptr);
+    const base::ListValue* patches = nullptr;
+    CHECK(request && request->GetList("patches", &patches)) << body;
+    for (const auto& item : *patches) {
+      ++patches_;
+      const base::DictionaryValue* patch_state = nullptr;
+      const base::DictionaryValue* patch = nullptr;
+      if (!item->GetAsDictionary(&patch_state) ||
+          !patch_state->GetDictionary("patch", &patch)) {
+        continue;
+      }
+      for (base::DictionaryValue::Iterator it{*patch}; !it.IsAtEnd();
+           it.Advance()) {
+        const base::DictionaryValue* trait = nullptr;
+        int seq = 0;
+        if (!it.value().GetAsDictionary(&trait) ||
+            !trait->GetInteger("value", &seq)) {
+          continue;
+        }
+        auto set = unpublished_.find(seq);
+        if (set == unpublished_.end())
+          continue;
+        publish_latencies_.push_back(
+            (GetNow() - set->second).InMillisecondsF());
+        unpublished_.erase(set);
+      }
+    }
+  }
+
+  void SendResponse(const SendRequestCallback& callback,
+                    const std::string& data) {
+    callback.Run(std::unique_ptr<HttpClient::Response>{
+                     new test::FakeHttpResponse{200, data}},
+                 nullptr);
+  }
+
+  base::Time GetNow() { return task_runner_.GetClock()->Now(); }
+
+  const Options options_;
+  const base::TimeDelta command_interval_;
+  const base::TimeDelta rtt_;
+
+  provider::test::FakeTaskRunner task_runner_;
+  NiceMock<provider::test::MockConfigStore> config_store_;
+  NiceMock<provider::test::MockNetwork> network_;
+  NiceMock<provider::test::MockHttpServer> http_server_;
+  std::map<std::string, HttpServer::RequestHandlerCallback> https_handlers_;
+
+  std::minstd_rand random_;
+  int last_seq_{0};
+  std::vector<std::string> local_tokens_;
+  base::ListValue cloud_commands_;
+  std::unordered_map<int, IssuedCommand> issued_;
+  // Simulated time at which the state values were set, by value.
+  std::unordered_map<int, base::Time> unpublished_;
+
+  size_t commands_completed_{0};
+  size_t commands_rejected_{0};
+  size_t patch_state_requests_{0};
+  size_t patches_{0};
+  std::vector<double> local_dispatch_latencies_;
+  std::vector<double> cloud_dispatch_latencies_;
+  std::vector<double> publish_latencies_;
+  base::TimeDelta wall_time_;
+
+  // Destroyed first, it uses the providers above.
+  std::unique_ptr<Device> device_;
+};
+
+}  // namespace
+
+}  // namespace weave
+
+int main(int argc, char** argv) {
+  logging::LoggingSettings settings;
+  settings.logging_dest = logging::LOG_TO_SYSTEM_DEBUG_LOG;
+  logging::InitLogging(settings);
+  logging::SetLogItems(false, false, false, false);
+  logging::SetMinLogLevel(logging::LOG_WARNING);
+
+  weave::Options options;
+  if (!weave::ParseOptions(argc, argv, &options))
+    return 1;
+
+  weave::LoadGenerator generator{options};
+  generator.Run();
+  generator.PrintReport();
+  return 0;
+}
@@ -0,0 +1,525 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Runs a device for days of simulated time, to find the queues and caches
+// which grow without bound before a release does.
+//
+// The device runs on FakeTaskRunner and its clock, so days pass in seconds,
+// and commands and state changes age with the simulated time. Sensors change
+// the state all the time, and the fake cloud queues bursts of commands, goes
+// down for a while every few hours, and the network drops now and then, which
+// makes the device reconnect XMPP and the pull channel. There is no XMPP
+// server, sockets fail to open, so the device keeps retrying with backoff.
+//
+// The memory stats of the device and the depth of the task queue are sampled
+// on a fixed period. A value whose minimum over the second half of the run is
+// above its maximum over the first half, after the warm-up, keeps growing, and
+// makes the test fail.
+//
+// Usage: libweave_soak_test [--days=3] [--components=4] [--traits=4]
+//            [--sensor_rate=<updates/s>] [--burst_size=<commands>]
+//            [--burst_minutes=<minutes>] [--outage_hours=<hours>]
+//            [--outage_minutes=<minutes>] [--reconnect_minutes=<minutes>]
+//            [--sample_minutes=<minutes>] [--csv=<file>]
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/values.h>
+#include <gmock/gmock.h>
+#include <weave/device.h>
+#include <weave/provider/test/fake_task_runner.h>
+#include <weave/provider/test/mock_config_store.h>
+#include <weave/provider/test/mock_http_server.h>
+#include <weave/provider/test/mock_network.h>
+
+#include "src/device_manager.h"
+#include "src/json_stream_writer.h"
+#include "src/string_utils.h"
+#include "src/test/fake_http_response.h"
+#include "src/utils.h"
+
+namespace weave {
+
+namespace {
+
+using provider::HttpClient;
+using provider::Network;
+using testing::_;
+using testing::Invoke;
+using testing::NiceMock;
+using testing::Return;
+using testing::ReturnPointee;
+
+const char kSettings[] = R"({
+  "version": 2,
+  "device_id": "TEST_DEVICE_ID",
+  "cloud_id": "SOAK_CLOUD_ID",
+  "refresh_token": "REFRESH_TOKEN",
+  "robot_account": "robot@example.com",
+  "local_anonymous_access_role": "user"
+})";
+
+const char kAuthTokenResponse[] = R"({
+  "access_token": "ACCESS_TOKEN",
+  "token_type": "Bearer",
+  "expires_in": 3599
+})";
+
+const char kDeviceResponse[] = R"({
+  "id": "SOAK_CLOUD_ID",
+  "lastUpdateTimeMs": "1"
+})";
+
+// Round trip of the fake cloud and of failed socket opens.
+const int kRttMs = 100;
+// How long the network stays down when it drops.
+const int kNetworkDropSeconds = 30;
+// Samples ignored while the queues fill up to their steady state.
+const size_t kWarmUpSamples = 2;
+
+struct Options {
+  double days{3};
+  int components{4};
+  int traits{4};
+  double sensor_rate{1};
+  int burst_size{50};
+  double burst_minutes{30};
+  double outage_hours{6};
+  double outage_minutes{20};
+  double reconnect_minutes{90};
+  double sample_minutes{60};
+  // Where to write all the samples, one line each.
+  std::string csv_path;
+};
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  std::map<std::string, int*> int_flags{
+      {"--components", &options->components},
+      {"--traits", &options->traits},
+      {"--burst_size", &options->burst_size},
+  };
+  std::map<std::string, double*> double_flags{
+      {"--days", &options->days},
+      {"--sensor_rate", &options->sensor_rate},
+      {"--burst_minutes", &options->burst_minutes},
+      {"--outage_hours", &options->outage_hours},
+      {"--outage_minutes", &options->outage_minutes},
+      {"--reconnect_minutes", &options->reconnect_minutes},
+      {"--sample_minutes", &options->sample_minutes},
+  };
+  for (int i = 1; i < argc; ++i) {
+    auto pair = SplitAtFirst(argv[i], "=", false);
+    auto int_flag = int_flags.find(pair.first);
+    auto double_flag = double_flags.find(pair.first);
+    if (pair.first == "--csv" && !pair.second.empty()) {
+      options->csv_path = pair.second;
+      continue;
+    } else if (int_flag != int_flags.end()) {
+      if (base::StringToInt(pair.second, int_flag->second) &&
+          *int_flag->second >= 0) {
+        continue;
+      }
+    } else if (double_flag != double_flags.end()) {
+      if (base::StringToDouble(pair.second, double_flag->second) &&
+          *double_flag->second >= 0) {
+        continue;
+      }
+    }
+    fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+    return false;
+  }
+  if (options->components < 1 || options->traits < 1 ||
+      options->sample_minutes <= 0 || options->days <= 0) {
+    fprintf(stderr,
+            "At least one component, trait, day and sample minute needed\n");
+    return false;
+  }
+  return true;
+}
+
+std::string GetTraitName(int index) {
+  return "trait" + std::to_string(index);
+}
+
+std::string GetComponentName(int index) {
+  return "comp" + std::to_string(index);
+}
+
+// Values of one tracked quantity, one per sample.
+struct Series {
+  std::vector<double> values;
+
+  // Whether the values never got back to the peak of the first half.
+  bool IsGrowing() const {
+    if (values.size() < kWarmUpSamples + 4)
+      return false;
+    auto begin = values.begin() + kWarmUpSamples;
+    auto middle = begin + (values.end() - begin) / 2;
+    return *std::min_element(middle, values.end()) >
+           *std::max_element(begin, middle);
+  }
+};
+
+class SoakTest final : public HttpClient {
+ public:
+  explicit SoakTest(const Options& options) : options_(options) {
+    EXPECT_CALL(config_store_, LoadSettings())
+        .WillRepeatedly(Return(kSettings));
+    ON_CALL(network_, GetConnectionState())
+        .WillByDefault(ReturnPointee(&network_state_));
+    ON_CALL(network_, AddConnectionChangedCallback(_))
+        .WillByDefault(
+            Invoke([this](const Network::ConnectionChangedCallback& callback) {
+              network_callbacks_.push_back(callback);
+            }));
+    ON_CALL(network_, OpenSslSocket(_, _, _))
+        .WillByDefault(
+            Invoke([this](const std::string& host, uint16_t port,
+                          const Network::OpenSslSocketCallback& callback) {
+              ++socket_opens_;
+              ErrorPtr error;
+              Error::AddTo(&error, FROM_HERE, "connection_refused",
+                           "No XMPP server");
+              task_runner_.PostDelayedTask(
+                  FROM_HERE,
+                  base::Bind(callback, nullptr, base::Passed(&error)),
+                  base::TimeDelta::FromMilliseconds(kRttMs));
+            }));
+    ON_CALL(http_server_, GetHttpsCertificateFingerprint())
+        .WillByDefault(Return(std::vector<uint8_t>{1, 2, 3}));
+    ON_CALL(http_server_, GetRequestTimeout())
+        .WillByDefault(Return(base::TimeDelta::Max()));
+  }
+
+  void Run() {
+    device_.reset(new DeviceManager{&config_store_, &task_runner_, this,
+                                    &network_, nullptr, &http_server_, nullptr,
+                                    nullptr, nullptr, nullptr, nullptr,
+                                    task_runner_.GetClock()});
+    AddComponents();
+
+    if (options_.sensor_rate > 0)
+      PostRepeating(&SoakTest::UpdateSensor, 1 / options_.sensor_rate);
+    if (options_.burst_size > 0 && options_.burst_minutes > 0)
+      PostRepeating(&SoakTest::QueueCommands, options_.burst_minutes * 60);
+    if (options_.outage_hours > 0)
+      PostRepeating(&SoakTest::StartOutage, options_.outage_hours * 3600);
+    if (options_.reconnect_minutes > 0)
+      PostRepeating(&SoakTest::DropNetwork, options_.reconnect_minutes * 60);
+    PostRepeating(&SoakTest::Sample, options_.sample_minutes * 60);
+    task_runner_.PostDelayedTask(
+        FROM_HERE, base::Bind(&provider::test::FakeTaskRunner::Break,
+                              base::Unretained(&task_runner_)),
+        base::TimeDelta::FromSecondsD(options_.days * 24 * 3600));
+
+    base::TimeTicks start = base::TimeTicks::Now();
+    task_runner_.Run(std::numeric_limits<size_t>::max());
+    wall_time_ = base::TimeTicks::Now() - start;
+  }
+
+  // Prints the tracked quantities and returns false if any keeps growing.
+  bool PrintReport() const {
+    double seconds = wall_time_.InSecondsF();
+    printf("%.1f days simulated in %.1fs, %zu samples\n", options_.days,
+           seconds, samples_);
+    printf("%-36s %10zu\n", "Commands queued", commands_queued_);
+    printf("%-36s %10zu\n", "Commands completed", commands_completed_);
+    printf("%-36s %10zu\n", "State updates", state_updates_);
+    printf("%-36s %10zu\n", "Cloud requests", cloud_requests_);
+    printf("%-36s %10zu\n", "Cloud requests failed", failed_requests_);
+    printf("%-36s %10zu\n", "XMPP socket opens", socket_opens_);
+    printf("\n%-36s %12s %12s %12s\n", "", "first", "max", "last");
+    bool growing = false;
+    for (const auto& pair : series_) {
+      const auto& values = pair.second.values;
+      bool series_growing = pair.second.IsGrowing();
+      growing |= series_growing;
+      printf("%-36s %12.0f %12.0f %12.0f%s\n", pair.first.c_str(),
+             values[std::min(kWarmUpSamples, values.size() - 1)],
+             *std::max_element(values.begin(), values.end()), values.back(),
+             series_growing ? "  GROWING" : "");
+    }
+    return !growing;
+  }
+
+  bool WriteCsv(const std::string& path) const {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+      fprintf(stderr, "Can't open %s\n", path.c_str());
+      return false;
+    }
+    fprintf(file, "hours");
+    for (const auto& pair : series_)
+      fprintf(file, ",%s", pair.first.c_str());
+    fprintf(file, "\n");
+    for (size_t i = 0; i < samples_; ++i) {
+      fprintf(file, "%.2f", (i + 1) * options_.sample_minutes / 60);
+      for (const auto& pair : series_) {
+        const auto& values = pair.second.values;
+        if (i < values.size())
+          fprintf(file, ",%.0f", values[i]);
+        else
+          fprintf(file, ",");
+      }
+      fprintf(file, "\n");
+    }
+    fclose(file);
+    return true;
+  }
+
+  // HttpClient implementation, the fake cloud server.
+  void SendRequest(Method method,
+                   const std::string& url,
+                   const Headers& headers,
+                   const std::string& data,
+                   const SendRequestCallback& callback) override {
+    ++cloud_requests_;
+    std::string path = SplitAtFirst(url, "?", false).first;
+    int status = 200;
+    std::string reply = "{}";
+    if (outage_ || network_state_ != Network::State::kOnline) {
+      ++failed_requests_;
+      status = 503;
+    } else if (EndsWith(path, "/oauth2/token")) {
+      reply = kAuthTokenResponse;
+    } else if (EndsWith(path, "/commands/queue")) {
+      reply = TakeCloudCommands();
+    } else if (EndsWith(path, "/devices/SOAK_CLOUD_ID/")) {
+      reply = kDeviceResponse;
+    }
+    task_runner_.PostDelayedTask(
+        FROM_HERE, base::Bind(&SoakTest::SendResponse, base::Unretained(this),
+                              callback, status, reply),
+        base::TimeDelta::FromMilliseconds(kRttMs));
+  }
+
+  void SendRequest(Method method,
+                   const std::string& url,
+                   const Headers& headers,
+                   std::unique_ptr<InputStream> data,
+                   const SendRequestCallback& callback) override {
+    LOG(FATAL) << "Streamed requests are not simulated: " << url;
+  }
+
+ private:
+  using Event = void (SoakTest::*)();
+
+  static bool EndsWith(const std::string& str, const std::string& suffix) {
+    return str.size() >= suffix.size() &&
+           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+
+  void AddComponents() {
+    std::string traits;
+    {
+      JsonStreamWriter writer{&traits};
+      writer.BeginDictionary();
+      for (int i = 0; i < options_.traits; ++i) {
+        writer.WriteKey(GetTraitName(i));
+        writer.WriteJson(R"({
+          "commands": {
+            "run": {
+              "minimalRole": "user",
+              "parameters": {"seq": {"type": "integer"}}
+            }
+          },
+          "state": {"value": {"type": "integer"}}
+        })");
+      }
+      writer.EndDictionary();
+    }
+    device_->AddTraitDefinitionsFromJson(traits);
+
+    std::vector<std::string> trait_names;
+    for (int i = 0; i < options_.traits; ++i)
+      trait_names.push_back(GetTraitName(i));
+    for (int i = 0; i < options_.components; ++i) {
+      std::string name = GetComponentName(i);
+      CHECK(device_->AddComponent(name, trait_names, nullptr));
+      for (const auto& trait : trait_names) {
+        CHECK(device_->SetStateProperty(name, trait + ".value",
+                                        base::FundamentalValue{0}, nullptr));
+        device_->AddCommandHandler(
+            name, trait + ".run",
+            base::Bind(&SoakTest::OnCommand, base::Unretained(this)));
+      }
+    }
+  }
+
+  // Runs |event| every |interval_seconds|, starting after the first
+  // interval.
+  void PostRepeating(Event event, double interval_seconds) {
+    task_runner_.PostDelayedTask(
+        FROM_HERE, base::Bind(&SoakTest::RunRepeating, base::Unretained(this),
+                              event, interval_seconds),
+        base::TimeDelta::FromSecondsD(interval_seconds));
+  }
+
+  void RunRepeating(Event event, double interval_seconds) {
+    PostRepeating(event, interval_seconds);
+    (this->*event)();
+  }
+
+  void UpdateSensor() {
+    ++state_updates_;
+    CHECK(device_->SetStateProperty(
+        GetComponentName(random_() % options_.components),
+        GetTraitName(random_() % options_.traits) + ".value",
+        base::FundamentalValue{++last_seq_}, nullptr));
+  }
+
+  void QueueCommands() {
+    base::Time now = task_runner_.GetClock()->Now();
+    for (int i = 0; i < options_.burst_size; ++i) {
+      int seq = ++last_seq_;
+      std::unique_ptr<base::DictionaryValue> command{new base::DictionaryValue};
+      command->SetString("name",
+                         GetTraitName(random_() % options_.traits) + ".run");
+      command->SetString("component",
+                         GetComponentName(random_() % options_.components));
+      command->SetInteger("parameters.seq", seq);
+      command->SetString("id", "cloud-" + std::to_string(seq));
+      command->SetString("state", "queued");
+      command->SetString("creationTimeMs", std::to_string(now.ToJavaTime()));
+      cloud_commands_.Append(std::move(command));
+      ++commands_queued_;
+    }
+  }
+
+  void StartOutage() {
+    outage_ = true;
+    task_runner_.PostDelayedTask(
+        FROM_HERE,
+        base::Bind([](SoakTest* self) { self->outage_ = false; },
+                   base::Unretained(this)),
+        base::TimeDelta::FromSecondsD(options_.outage_minutes * 60));
+  }
+
+  void DropNetwork() {
+    SetNetworkState(Network::State::kOffline);
+    task_runner_.PostDelayedTask(
+        FROM_HERE, base::Bind(&SoakTest::SetNetworkState,
+                              base::Unretained(this), Network::State::kOnline),
+        base::TimeDelta::FromSeconds(kNetworkDropSeconds));
+  }
+
+  void SetNetworkState(Network::State state) {
+    network_state_ = state;
+    for (const auto& callback : network_callbacks_)
+      callback.Run();
+  }
+
+  void Sample() {
+    ++samples_;
+    series_["taskQueue"].values.push_back(task_runner_.GetTaskQueueSize());
+    series_["cloudCommandQueue"].values.push_back(cloud_commands_.GetSize());
+    auto stats = device_->GetMemoryStats();
+    for (base::DictionaryValue::Iterator it{*stats}; !it.IsAtEnd();
+         it.Advance()) {
+      const base::DictionaryValue* usage = nullptr;
+      int count = 0;
+      int bytes = 0;
+      if (!it.value().GetAsDictionary(&usage) ||
+          !usage->GetInteger("count", &count) ||
+          !usage->GetInteger("bytes", &bytes)) {
+        continue;
+      }
+      series_[it.key() + ".count"].values.push_back(count);
+      series_[it.key() + ".bytes"].values.push_back(bytes);
+    }
+  }
+
+  void OnCommand(const std::weak_ptr<Command>& weak_command) {
+    auto command = weak_command.lock();
+    if (!command)
+      return;
+    int seq = 0;
+    CHECK(command->GetParameters().GetInteger("seq", &seq));
+    std::string trait = SplitAtFirst(command->GetName(), ".", false).first;
+    CHECK(device_->SetStateProperty(command->GetComponent(), trait + ".value",
+                                    base::FundamentalValue{seq}, nullptr));
+    CHECK(command->Complete({}, nullptr));
+    ++commands_completed_;
+  }
+
+  std::string TakeCloudCommands() {
+    std::string reply;
+    {
+      JsonStreamWriter writer{&reply};
+      writer.BeginDictionary();
+      writer.WriteKey("commands");
+      writer.WriteValue(cloud_commands_);
+      writer.EndDictionary();
+    }
+    cloud_commands_.Clear();
+    return reply;
+  }
+
+  void SendResponse(const SendRequestCallback& callback,
+                    int status,
+                    const std::string& data) {
+    callback.Run(std::unique_ptr<HttpClient::Response>{
+                     new test::FakeHttpResponse{status, data}},
+                 nullptr);
+  }
+
+  const Options options_;
+
+  provider::test::FakeTaskRunner task_runner_;
+  NiceMock<provider::test::MockConfigStore> config_store_;
+  NiceMock<provider::test::MockNetwork> network_;
+  NiceMock<provider::test::MockHttpServer> http_server_;
+  Network::State network_state_{Network::State::kOnline};
+  std::vector<Network::ConnectionChangedCallback> network_callbacks_;
+
+  std::minstd_rand random_;
+  int last_seq_{0};
+  bool outage_{false};
+  base::ListValue cloud_commands_;
+
+  size_t samples_{0};
+  std::map<std::string, Series> series_;
+  size_t commands_queued_{0};
+  size_t commands_completed_{0};
+  size_t state_updates_{0};
+  size_t cloud_requests_{0};
+  size_t failed_requests_{0};
+  size_t socket_opens_{0};
+  base::TimeDelta wall_time_;
+
+  // Destroyed first, it uses the providers above.
+  std::unique_ptr<Device> device_;
+};
+
+}  // namespace
+
+}  // namespace weave
+
+int main(int argc, char** argv) {
+  logging::LoggingSettings settings;
+  settings.logging_dest = logging::LOG_TO_SYSTEM_DEBUG_LOG;
+  logging::InitLogging(settings);
+  logging::SetLogItems(false, false, false, false);
+  logging::SetMinLogLevel(logging::LOG_FATAL);
+
+  weave::Options options;
+  if (!weave::ParseOptions(argc, argv, &options))
+    return 1;
+
+  weave::SoakTest test{options};
+  test.Run();
+  if (!options.csv_path.empty() && !test.WriteCsv(options.csv_path))
+    return 1;
+  return test.PrintReport() ? 0 : 1;
+}
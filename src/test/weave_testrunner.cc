@@ -2,11 +2,53 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
 #include <base/command_line.h>
 #include <base/logging.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include "src/test/allocation_counter.h"
+
+namespace {
+
+std::atomic<size_t> allocation_count{0};
+
+}  // namespace
+
+// The array and nothrow forms forward to these.
+void* operator new(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size ? size : 1);
+  if (!ptr)
+    abort();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+// Replaced as well, the library's sized delete isn't guaranteed to forward to
+// the one above, and the memory must go back to free().
+void operator delete(void* ptr, size_t size) noexcept {
+  free(ptr);
+}
+
+namespace weave {
+namespace test {
+
+size_t GetAllocationCount() {
+  return allocation_count.load(std::memory_order_relaxed);
+}
+
+}  // namespace test
+}  // namespace weave
+
 int main(int argc, char** argv) {
   base::CommandLine::Init(argc, argv);
 
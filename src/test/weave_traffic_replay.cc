@@ -0,0 +1,243 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Replays the cloud and XMPP traffic recorded from a device, see
+// TrafficRecorder, to a device running on FakeTaskRunner, and reports where
+// the time went.
+//
+// Servers reply as soon as the device asks, so the replay runs as fast as the
+// device can process the traffic, and runs of the same trace can be compared
+// before and after a change. The settings should be the ones of the recorded
+// device, so that it makes the same requests.
+//
+// Usage: libweave_traffic_replay --trace=<file> [--settings=<file>]
+//            [--timeout=<seconds>]
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/values.h>
+#include <gmock/gmock.h>
+#include <weave/device.h>
+#include <weave/provider/test/fake_task_runner.h>
+#include <weave/provider/test/mock_config_store.h>
+#include <weave/provider/test/mock_http_server.h>
+
+#include "src/string_utils.h"
+#include "src/test/traffic_trace.h"
+
+namespace weave {
+
+namespace {
+
+using testing::NiceMock;
+using testing::Return;
+
+// Same as the load generator, a registered device with a refresh token.
+const char kSettings[] = R"({
+  "version": 2,
+  "device_id": "TEST_DEVICE_ID",
+  "cloud_id": "LOAD_CLOUD_ID",
+  "refresh_token": "REFRESH_TOKEN",
+  "robot_account": "robot@example.com",
+  "local_anonymous_access_role": "user"
+})";
+
+// Number of histograms printed.
+const size_t kTopHistograms = 15;
+
+struct Options {
+  std::string trace_path;
+  std::string settings_path;
+  // Simulated time.
+  double timeout_seconds{3600};
+};
+
+bool ReadFile(const std::string& path, std::string* data) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) {
+    fprintf(stderr, "Can't open %s\n", path.c_str());
+    return false;
+  }
+  char buffer[4096];
+  size_t size = 0;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    data->append(buffer, size);
+  fclose(file);
+  return true;
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; ++i) {
+    auto pair = SplitAtFirst(argv[i], "=", false);
+    if (pair.first == "--trace" && !pair.second.empty()) {
+      options->trace_path = pair.second;
+    } else if (pair.first == "--settings" && !pair.second.empty()) {
+      options->settings_path = pair.second;
+    } else if (pair.first != "--timeout" ||
+               !base::StringToDouble(pair.second, &options->timeout_seconds) ||
+               options->timeout_seconds <= 0) {
+      fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+      return false;
+    }
+  }
+  if (options->trace_path.empty()) {
+    fprintf(stderr, "--trace=<file> is needed\n");
+    return false;
+  }
+  return true;
+}
+
+class TrafficReplay final {
+ public:
+  TrafficReplay(const Options& options,
+                const std::string& settings,
+                std::vector<test::TrafficEvent> events)
+      : options_(options),
+        settings_{settings},
+        event_count_{events.size()},
+        replayer_{&task_runner_, std::move(events)} {
+    EXPECT_CALL(config_store_, LoadSettings())
+        .WillRepeatedly(Return(settings_));
+    ON_CALL(http_server_, GetHttpsCertificateFingerprint())
+        .WillByDefault(Return(std::vector<uint8_t>{1, 2, 3}));
+    ON_CALL(http_server_, GetRequestTimeout())
+        .WillByDefault(Return(base::TimeDelta::Max()));
+  }
+
+  void Run() {
+    replayer_.SetDoneCallback(base::Bind(
+        &provider::test::FakeTaskRunner::Break,
+        base::Unretained(&task_runner_)));
+    task_runner_.PostDelayedTask(
+        FROM_HERE, base::Bind(&provider::test::FakeTaskRunner::Break,
+                              base::Unretained(&task_runner_)),
+        base::TimeDelta::FromSecondsD(options_.timeout_seconds));
+
+    base::TimeTicks start = base::TimeTicks::Now();
+    base::Time simulated_start = task_runner_.GetClock()->Now();
+    device_ = Device::Create(&config_store_, &task_runner_, &replayer_,
+                             &replayer_, nullptr, &http_server_, nullptr,
+                             nullptr);
+    task_runner_.Run(std::numeric_limits<size_t>::max());
+    wall_time_ = base::TimeTicks::Now() - start;
+    simulated_time_ = task_runner_.GetClock()->Now() - simulated_start;
+  }
+
+  void PrintReport() const {
+    double seconds = wall_time_.InSecondsF();
+    printf("%zu events, %.1fs recorded, %.1fs simulated%s\n", event_count_,
+           replayer_.GetRecordedDuration().InSecondsF(),
+           simulated_time_.InSecondsF(),
+           replayer_.IsDone() ? "" : ", timed out before the end");
+    printf("%-36s %10zu\n", "Unmatched requests",
+           replayer_.GetUnmatchedRequestCount());
+    printf("%-36s %10zu  %.0f KiB/s\n", "Bytes served",
+           replayer_.GetBytesServed(),
+           seconds > 0 ? replayer_.GetBytesServed() / seconds / 1024 : 0);
+    printf("%-36s %10zu\n", "Bytes received", replayer_.GetBytesReceived());
+    printf("%-36s %10.2fs  %.0fx real time\n", "Wall time", seconds,
+           seconds > 0 ? replayer_.GetRecordedDuration().InSecondsF() / seconds
+                       : 0);
+    PrintHistograms();
+  }
+
+ private:
+  struct Histogram {
+    std::string name;
+    int count;
+    double sum_ms;
+  };
+
+  // Prints the histograms which took the most time, e.g. the "task_run"
+  // histograms of the main loop tasks when metrics are enabled.
+  void PrintHistograms() const {
+    std::unique_ptr<base::DictionaryValue> metrics = device_->GetMetrics();
+    const base::DictionaryValue* histograms = nullptr;
+    if (!metrics->GetDictionary("histograms", &histograms) ||
+        histograms->empty()) {
+      printf("No metrics, build with METRICS=1 for the stage costs\n");
+      return;
+    }
+    std::vector<Histogram> top;
+    for (base::DictionaryValue::Iterator it{*histograms}; !it.IsAtEnd();
+         it.Advance()) {
+      const base::DictionaryValue* histogram = nullptr;
+      Histogram item{it.key(), 0, 0};
+      if (it.value().GetAsDictionary(&histogram) &&
+          histogram->GetInteger("count", &item.count) &&
+          histogram->GetDouble("sumMs", &item.sum_ms)) {
+        top.push_back(item);
+      }
+    }
+    std::sort(top.begin(), top.end(),
+              [](const Histogram& a, const Histogram& b) {
+                return a.sum_ms > b.sum_ms;
+              });
+    top.resize(std::min(top.size(), kTopHistograms));
+    for (const auto& item : top) {
+      printf("%-60s %8d  %10.1f ms\n", item.name.c_str(), item.count,
+             item.sum_ms);
+    }
+  }
+
+  const Options options_;
+  const std::string settings_;
+  const size_t event_count_;
+
+  provider::test::FakeTaskRunner task_runner_;
+  NiceMock<provider::test::MockConfigStore> config_store_;
+  NiceMock<provider::test::MockHttpServer> http_server_;
+  test::TrafficReplayer replayer_;
+
+  base::TimeDelta wall_time_;
+  base::TimeDelta simulated_time_;
+
+  // Destroyed first, it uses the providers above.
+  std::unique_ptr<Device> device_;
+};
+
+}  // namespace
+
+}  // namespace weave
+
+int main(int argc, char** argv) {
+  logging::LoggingSettings settings;
+  settings.logging_dest = logging::LOG_TO_SYSTEM_DEBUG_LOG;
+  logging::InitLogging(settings);
+  logging::SetLogItems(false, false, false, false);
+  logging::SetMinLogLevel(logging::LOG_WARNING);
+
+  weave::Options options;
+  if (!weave::ParseOptions(argc, argv, &options))
+    return 1;
+
+  std::string trace;
+  std::string device_settings = weave::kSettings;
+  if (!weave::ReadFile(options.trace_path, &trace))
+    return 1;
+  if (!options.settings_path.empty()) {
+    device_settings.clear();
+    if (!weave::ReadFile(options.settings_path, &device_settings))
+      return 1;
+  }
+  std::vector<weave::test::TrafficEvent> events;
+  weave::ErrorPtr error;
+  if (!weave::test::ParseTrafficTrace(trace, &events, &error)) {
+    fprintf(stderr, "%s\n", error->GetMessage().c_str());
+    return 1;
+  }
+
+  weave::TrafficReplay replay{options, device_settings, std::move(events)};
+  replay.Run();
+  replay.PrintReport();
+  return 0;
+}
@@ -0,0 +1,290 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <weave/thread_safe_device.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/macros.h>
+
+#include "src/string_utils.h"
+
+namespace weave {
+
+namespace {
+
+// A state update or a command queued by another thread.
+struct Update {
+  enum class Type {
+    kStateProperty,
+    kStateProperties,
+    kCommand,
+  };
+
+  Type type{Type::kCommand};
+  std::string component;
+  std::string name;
+  std::unique_ptr<base::Value> value;
+  Update* next{nullptr};
+};
+
+// Intrusive lock-free stack of the queued updates. Any thread pushes, and the
+// task runner thread takes all of them at once, so nodes are never popped
+// one by one and the ABA problem doesn't arise.
+class Inbox final {
+ public:
+  explicit Inbox(Device* device) : device_{device} {}
+
+  ~Inbox() { TakeAll(); }
+
+  // Returns true if the inbox was empty, so the caller posts the task
+  // draining it.
+  bool Push(std::unique_ptr<Update> update) {
+    Update* node = update.release();
+    Update* head = head_.load(std::memory_order_relaxed);
+    do {
+      node->next = head;
+    } while (!head_.compare_exchange_weak(
+        head, node, std::memory_order_release, std::memory_order_relaxed));
+    return !head;
+  }
+
+  // Returns the updates in the order they were pushed.
+  std::vector<std::unique_ptr<Update>> TakeAll() {
+    std::vector<std::unique_ptr<Update>> updates;
+    Update* node = head_.exchange(nullptr, std::memory_order_acquire);
+    while (node) {
+      Update* next = node->next;
+      updates.emplace_back(node);
+      node = next;
+    }
+    std::reverse(updates.begin(), updates.end());
+    return updates;
+  }
+
+  // Only used on the task runner thread. Null once the ThreadSafeDevice is
+  // destroyed.
+  Device* device() const { return device_; }
+  void ResetDevice() { device_ = nullptr; }
+
+ private:
+  std::atomic<Update*> head_{nullptr};
+  Device* device_{nullptr};
+
+  DISALLOW_COPY_AND_ASSIGN(Inbox);
+};
+
+// Copies the properties set by |update| into |state|, in the format of
+// Device::SetStateProperties(). Object properties set again are merged member
+// by member, as the component manager does when the updates are applied one
+// by one. Returns false if the property name has no trait, which only
+// SetStateProperty() reports.
+bool MergeStateUpdate(const Update& update, base::DictionaryValue* state) {
+  auto set_property = [state](const std::string& trait,
+                              const std::string& property,
+                              const base::Value& value) {
+    base::DictionaryValue* properties = nullptr;
+    if (!state->GetDictionaryWithoutPathExpansion(trait, &properties)) {
+      properties = new base::DictionaryValue;
+      state->SetWithoutPathExpansion(trait, properties);
+    }
+    base::DictionaryValue* old_object = nullptr;
+    const base::DictionaryValue* new_object = nullptr;
+    if (properties->GetDictionaryWithoutPathExpansion(property, &old_object) &&
+        value.GetAsDictionary(&new_object)) {
+      old_object->MergeDictionary(new_object);
+      return;
+    }
+    properties->SetWithoutPathExpansion(property, value.CreateDeepCopy());
+  };
+
+  if (update.type == Update::Type::kStateProperty) {
+    auto pair = SplitAtFirst(update.name, ".", true);
+    if (pair.first.empty() || pair.second.empty())
+      return false;
+    set_property(pair.first, pair.second, *update.value);
+    return true;
+  }
+
+  const base::DictionaryValue* dict = nullptr;
+  CHECK(update.value->GetAsDictionary(&dict));
+  for (base::DictionaryValue::Iterator trait(*dict); !trait.IsAtEnd();
+       trait.Advance()) {
+    const base::DictionaryValue* properties = nullptr;
+    if (!trait.value().GetAsDictionary(&properties)) {
+      state->SetWithoutPathExpansion(trait.key(),
+                                     trait.value().CreateDeepCopy());
+      continue;
+    }
+    for (base::DictionaryValue::Iterator it(*properties); !it.IsAtEnd();
+         it.Advance()) {
+      set_property(trait.key(), it.key(), it.value());
+    }
+  }
+  return true;
+}
+
+void ApplyStateUpdate(Device* device, std::unique_ptr<Update> update) {
+  ErrorPtr error;
+  bool success = false;
+  if (update->type == Update::Type::kStateProperty) {
+    success = device->SetStateProperty(update->component, update->name,
+                                       *update->value, &error);
+  } else {
+    success = device->SetStateProperties(
+        update->component,
+        base::DictionaryValue::From(std::move(update->value)), &error);
+  }
+  LOG_IF(ERROR, !success) << "Failed to update the state of '"
+                          << update->component
+                          << "': " << error->GetMessage();
+}
+
+// The state updates of a task runner tick, grouped by component in the order
+// the components were first updated.
+class StateBatch final {
+ public:
+  StateBatch() {}
+
+  void Add(std::unique_ptr<Update> update) {
+    auto it = indices_.find(update->component);
+    if (it == indices_.end()) {
+      it = indices_.emplace(update->component, components_.size()).first;
+      components_.emplace_back();
+    }
+    components_[it->second].push_back(std::move(update));
+  }
+
+  // Applies the updates of each component as a single change, or one by one
+  // if the change fails, so a bad update doesn't drop the others.
+  void Apply(Device* device) {
+    for (auto& updates : components_) {
+      if (updates.size() > 1) {
+        std::unique_ptr<base::DictionaryValue> state{new base::DictionaryValue};
+        bool merged = std::all_of(
+            updates.begin(), updates.end(),
+            [&state](const std::unique_ptr<Update>& update) {
+              return MergeStateUpdate(*update, state.get());
+            });
+        if (merged && device->SetStateProperties(updates.front()->component,
+                                                 std::move(state), nullptr)) {
+          continue;
+        }
+      }
+      for (auto& update : updates)
+        ApplyStateUpdate(device, std::move(update));
+    }
+    components_.clear();
+    indices_.clear();
+  }
+
+ private:
+  std::vector<std::vector<std::unique_ptr<Update>>> components_;
+  std::map<std::string, size_t> indices_;
+
+  DISALLOW_COPY_AND_ASSIGN(StateBatch);
+};
+
+void DrainInbox(const std::shared_ptr<Inbox>& inbox) {
+  std::vector<std::unique_ptr<Update>> updates = inbox->TakeAll();
+  Device* device = inbox->device();
+  if (!device)
+    return;
+
+  StateBatch batch;
+  for (auto& update : updates) {
+    if (update->type != Update::Type::kCommand) {
+      batch.Add(std::move(update));
+      continue;
+    }
+    // The state queued before the command is set before it runs.
+    batch.Apply(device);
+    const base::DictionaryValue* command = nullptr;
+    CHECK(update->value->GetAsDictionary(&command));
+    ErrorPtr error;
+    LOG_IF(ERROR, !device->AddCommand(*command, nullptr, &error))
+        << "Failed to add a command: " << error->GetMessage();
+  }
+  batch.Apply(device);
+}
+
+class ThreadSafeDeviceImpl final : public ThreadSafeDevice {
+ public:
+  ThreadSafeDeviceImpl(Device* device, provider::TaskRunner* task_runner)
+      : device_{device},
+        task_runner_{task_runner},
+        inbox_{std::make_shared<Inbox>(device)},
+        drain_task_{base::Bind(&DrainInbox, inbox_)} {
+    CHECK(device);
+    CHECK(task_runner);
+  }
+
+  ~ThreadSafeDeviceImpl() override { inbox_->ResetDevice(); }
+
+  void SetStateProperty(const std::string& component,
+                        const std::string& name,
+                        std::unique_ptr<base::Value> value) override {
+    CHECK(value);
+    std::unique_ptr<Update> update{new Update};
+    update->type = Update::Type::kStateProperty;
+    update->component = component;
+    update->name = name;
+    update->value = std::move(value);
+    Push(std::move(update));
+  }
+
+  void SetStateProperties(
+      const std::string& component,
+      std::unique_ptr<base::DictionaryValue> dict) override {
+    CHECK(dict);
+    std::unique_ptr<Update> update{new Update};
+    update->type = Update::Type::kStateProperties;
+    update->component = component;
+    update->value = std::move(dict);
+    Push(std::move(update));
+  }
+
+  void AddCommand(std::unique_ptr<base::DictionaryValue> command) override {
+    CHECK(command);
+    std::unique_ptr<Update> update{new Update};
+    update->value = std::move(command);
+    Push(std::move(update));
+  }
+
+  std::shared_ptr<const base::DictionaryValue> GetComponents() const override {
+    return device_->GetComponentsView();
+  }
+
+ private:
+  void Push(std::unique_ptr<Update> update) {
+    if (inbox_->Push(std::move(update)))
+      task_runner_->PostDelayedTask(FROM_HERE, drain_task_, {});
+  }
+
+  Device* device_{nullptr};
+  provider::TaskRunner* task_runner_{nullptr};
+  // Shared with the drain task, which may run after this object is gone.
+  std::shared_ptr<Inbox> inbox_;
+  // Copied rather than bound again for every post.
+  const base::Closure drain_task_;
+
+  DISALLOW_COPY_AND_ASSIGN(ThreadSafeDeviceImpl);
+};
+
+}  // namespace
+
+std::unique_ptr<ThreadSafeDevice> ThreadSafeDevice::Create(
+    Device* device,
+    provider::TaskRunner* task_runner) {
+  return std::unique_ptr<ThreadSafeDevice>{
+      new ThreadSafeDeviceImpl{device, task_runner}};
+}
+
+}  // namespace weave
@@ -0,0 +1,295 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <weave/thread_safe_device.h>
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
+#include <weave/test/mock_device.h>
+#include <weave/test/unittest_utils.h>
+
+#include "src/component_manager_impl.h"
+
+namespace weave {
+
+using test::CreateDictionaryValue;
+using testing::_;
+using testing::InSequence;
+using testing::Invoke;
+using testing::Return;
+using testing::StrictMock;
+using testing::WithArgs;
+
+namespace {
+
+MATCHER_P(IsJson, json, "") {
+  return test::IsEqualValue(*test::CreateValue(json), arg);
+}
+
+bool Fail(ErrorPtr* error) {
+  Error::AddTo(error, FROM_HERE, "test", "Test failure");
+  return false;
+}
+
+// Runs the tasks posted from any thread when asked to on the test thread.
+class ThreadSafeTaskRunner : public provider::TaskRunner {
+ public:
+  void PostDelayedTask(const tracked_objects::Location& from_here,
+                       const base::Closure& task,
+                       base::TimeDelta delay) override {
+    std::lock_guard<std::mutex> lock{mutex_};
+    tasks_.push_back(task);
+  }
+
+  size_t RunTasks() {
+    std::vector<base::Closure> tasks;
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      tasks.swap(tasks_);
+    }
+    for (const auto& task : tasks)
+      task.Run();
+    return tasks.size();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<base::Closure> tasks_;
+};
+
+}  // namespace
+
+class ThreadSafeDeviceTest : public testing::Test {
+ protected:
+  StrictMock<test::MockDevice> device_;
+  provider::test::FakeTaskRunner task_runner_;
+  std::unique_ptr<ThreadSafeDevice> thread_safe_device_{
+      ThreadSafeDevice::Create(&device_, &task_runner_)};
+};
+
+TEST_F(ThreadSafeDeviceTest, SingleUpdate) {
+  thread_safe_device_->SetStateProperty(
+      "lamp", "onOff.state", base::StringValue{"on"}.CreateDeepCopy());
+  EXPECT_EQ(1u, task_runner_.GetTaskQueueSize());
+
+  EXPECT_CALL(device_,
+              SetStateProperty("lamp", "onOff.state", IsJson("'on'"), _))
+      .WillOnce(Return(true));
+  task_runner_.RunOnce();
+}
+
+TEST_F(ThreadSafeDeviceTest, MergesStatePerComponent) {
+  thread_safe_device_->SetStateProperty(
+      "lamp", "onOff.state", base::StringValue{"on"}.CreateDeepCopy());
+  thread_safe_device_->SetStateProperties(
+      "fan", CreateDictionaryValue("{'onOff': {'state': 'on'}}"));
+  thread_safe_device_->SetStateProperties(
+      "lamp", CreateDictionaryValue(
+                  "{'brightness': {'level': 5, 'color': {'r': 1, 'g': 2}}}"));
+  thread_safe_device_->SetStateProperty(
+      "lamp", "onOff.state", base::StringValue{"off"}.CreateDeepCopy());
+  thread_safe_device_->SetStateProperties(
+      "lamp", CreateDictionaryValue("{'brightness': {'color': {'b': 3}}}"));
+  // A single task is posted for the whole burst.
+  EXPECT_EQ(1u, task_runner_.GetTaskQueueSize());
+
+  InSequence s;
+  // Properties set again are replaced, objects are merged.
+  EXPECT_CALL(device_, SetStateProperties("lamp", IsJson(R"({
+                                            "onOff": {"state": "off"},
+                                            "brightness": {
+                                              "level": 5,
+                                              "color": {"r": 1, "g": 2, "b": 3}
+                                            }
+                                          })"),
+                                          _))
+      .WillOnce(Return(true));
+  EXPECT_CALL(device_, SetStateProperties(
+                           "fan", IsJson("{'onOff': {'state': 'on'}}"), _))
+      .WillOnce(Return(true));
+  task_runner_.RunOnce();
+
+  // The next update posts a new task.
+  thread_safe_device_->SetStateProperty(
+      "lamp", "onOff.state", base::StringValue{"on"}.CreateDeepCopy());
+  EXPECT_EQ(1u, task_runner_.GetTaskQueueSize());
+  EXPECT_CALL(device_,
+              SetStateProperty("lamp", "onOff.state", IsJson("'on'"), _))
+      .WillOnce(Return(true));
+  task_runner_.RunOnce();
+}
+
+TEST_F(ThreadSafeDeviceTest, BatchedStateMatchesOneByOne) {
+  const char kTraits[] = R"({
+    "light": {"state": {
+      "onOff": {"type": "string"},
+      "color": {"type": "object", "properties": {
+        "r": {"type": "integer"}, "g": {"type": "integer"}
+      }}
+    }}
+  })";
+  const char* const kUpdates[] = {
+      "{'light': {'color': {'r': 1}}}", "{'light': {'onOff': 'on'}}",
+      "{'light': {'color': {'g': 2}}}",
+  };
+  provider::test::FakeTaskRunner task_runner;
+  ComponentManagerImpl one_by_one{&task_runner};
+  ComponentManagerImpl batched{&task_runner};
+  for (auto* manager : {&one_by_one, &batched}) {
+    ASSERT_TRUE(manager->LoadTraits(kTraits, nullptr));
+    ASSERT_TRUE(manager->AddComponent("", "lamp", {"light"}, nullptr));
+  }
+
+  for (const char* update : kUpdates) {
+    EXPECT_TRUE(one_by_one.SetStateProperties(
+        "lamp", *CreateDictionaryValue(update), nullptr));
+    thread_safe_device_->SetStateProperties("lamp",
+                                            CreateDictionaryValue(update));
+  }
+  EXPECT_CALL(device_, SetStateProperties("lamp", _, _))
+      .WillOnce(Invoke([&batched](const std::string& component,
+                                  const base::DictionaryValue& dict,
+                                  ErrorPtr* error) {
+        return batched.SetStateProperties(component, dict, error);
+      }));
+  task_runner_.RunOnce();
+
+  EXPECT_JSON_EQ("{'light': {'onOff': 'on', 'color': {'r': 1, 'g': 2}}}",
+                 *one_by_one.GetComponentState("lamp", nullptr));
+  EXPECT_TRUE(test::IsEqualValue(*one_by_one.GetComponentState("lamp", nullptr),
+                                 *batched.GetComponentState("lamp", nullptr)));
+}
+
+TEST_F(ThreadSafeDeviceTest, FailedUpdateDoesNotDropOthers) {
+  thread_safe_device_->SetStateProperty(
+      "lamp", "onOff.state", base::StringValue{"on"}.CreateDeepCopy());
+  thread_safe_device_->SetStateProperties(
+      "lamp", CreateDictionaryValue("{'brightness': {'level': 500}}"));
+
+  InSequence s;
+  EXPECT_CALL(device_, SetStateProperties("lamp", _, _))
+      .WillOnce(Return(false));
+  EXPECT_CALL(device_,
+              SetStateProperty("lamp", "onOff.state", IsJson("'on'"), _))
+      .WillOnce(Return(true));
+  EXPECT_CALL(device_, SetStateProperties(
+                           "lamp", IsJson("{'brightness': {'level': 500}}"), _))
+      .WillOnce(WithArgs<2>(Invoke(&Fail)));
+  task_runner_.RunOnce();
+}
+
+TEST_F(ThreadSafeDeviceTest, InvalidNameIsNotMerged) {
+  thread_safe_device_->SetStateProperty(
+      "lamp", "state", base::StringValue{"on"}.CreateDeepCopy());
+  thread_safe_device_->SetStateProperty(
+      "lamp", "onOff.state", base::StringValue{"off"}.CreateDeepCopy());
+
+  InSequence s;
+  EXPECT_CALL(device_, SetStateProperty("lamp", "state", _, _))
+      .WillOnce(WithArgs<3>(Invoke(&Fail)));
+  EXPECT_CALL(device_,
+              SetStateProperty("lamp", "onOff.state", IsJson("'off'"), _))
+      .WillOnce(Return(true));
+  task_runner_.RunOnce();
+}
+
+TEST_F(ThreadSafeDeviceTest, CommandsKeepOrder) {
+  thread_safe_device_->SetStateProperty(
+      "lock", "lock.lockedState", base::StringValue{"locked"}.CreateDeepCopy());
+  thread_safe_device_->AddCommand(CreateDictionaryValue(
+      "{'name': 'lock.setConfig', 'component': 'lock', "
+      "'parameters': {'lockedState': 'unlocked'}}"));
+  thread_safe_device_->SetStateProperty(
+      "lock", "lock.lockedState",
+      base::StringValue{"unlocked"}.CreateDeepCopy());
+
+  InSequence s;
+  EXPECT_CALL(device_, SetStateProperty("lock", "lock.lockedState",
+                                        IsJson("'locked'"), _))
+      .WillOnce(Return(true));
+  EXPECT_CALL(device_, AddCommand(IsJson(R"({
+                                    "name": "lock.setConfig",
+                                    "component": "lock",
+                                    "parameters": {"lockedState": "unlocked"}
+                                  })"),
+                                  nullptr, _))
+      .WillOnce(Return(true));
+  EXPECT_CALL(device_, SetStateProperty("lock", "lock.lockedState",
+                                        IsJson("'unlocked'"), _))
+      .WillOnce(Return(true));
+  task_runner_.RunOnce();
+}
+
+TEST_F(ThreadSafeDeviceTest, DroppedAfterDestruction) {
+  thread_safe_device_->SetStateProperty(
+      "lamp", "onOff.state", base::StringValue{"on"}.CreateDeepCopy());
+  thread_safe_device_.reset();
+  task_runner_.RunOnce();
+}
+
+TEST(ThreadSafeDeviceThreadsTest, ManyProducers) {
+  const int kThreads = 4;
+  const int kUpdates = 1000;
+  StrictMock<test::MockDevice> device;
+  ThreadSafeTaskRunner task_runner;
+  std::unique_ptr<ThreadSafeDevice> thread_safe_device =
+      ThreadSafeDevice::Create(&device, &task_runner);
+
+  // The last value set per component, as every update overwrites it.
+  std::map<std::string, int> state;
+  auto set_property = [&state](const std::string& component,
+                               const std::string& name,
+                               const base::Value& value, ErrorPtr* error) {
+    EXPECT_EQ("sensor.value", name);
+    int level = 0;
+    EXPECT_TRUE(value.GetAsInteger(&level));
+    EXPECT_LT(state[component], level);
+    state[component] = level;
+    return true;
+  };
+  auto set_properties = [&state](const std::string& component,
+                                 const base::DictionaryValue& dict,
+                                 ErrorPtr* error) {
+    int level = 0;
+    EXPECT_TRUE(dict.GetInteger("sensor.value", &level));
+    EXPECT_LT(state[component], level);
+    state[component] = level;
+    return true;
+  };
+  EXPECT_CALL(device, SetStateProperty(_, _, _, _))
+      .WillRepeatedly(Invoke(set_property));
+  EXPECT_CALL(device, SetStateProperties(_, _, _))
+      .WillRepeatedly(Invoke(set_properties));
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&thread_safe_device, i]() {
+      for (int level = 1; level <= kUpdates; ++level) {
+        thread_safe_device->SetStateProperty(
+            "sensor" + std::to_string(i), "sensor.value",
+            base::FundamentalValue{level}.CreateDeepCopy());
+      }
+    });
+  }
+  size_t tasks = 0;
+  // Drain concurrently with the producers too.
+  for (int i = 0; i < 10; ++i)
+    tasks += task_runner.RunTasks();
+  for (auto& thread : threads)
+    thread.join();
+  tasks += task_runner.RunTasks();
+
+  EXPECT_GE(static_cast<size_t>(kThreads * kUpdates), tasks);
+  EXPECT_EQ(static_cast<size_t>(kThreads), state.size());
+  for (const auto& pair : state)
+    EXPECT_EQ(kUpdates, pair.second);
+}
+
+}  // namespace weave
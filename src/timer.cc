@@ -0,0 +1,71 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/timer.h"
+
+#include <utility>
+
+#include <base/bind.h>
+
+#include "src/wake_window_scheduler.h"
+
+namespace weave {
+
+OneShotTimer::OneShotTimer(provider::TaskRunner* task_runner,
+                           provider::TaskRunner::Priority priority)
+    : task_runner_{task_runner}, priority_{priority} {
+  CHECK(task_runner_);
+}
+
+OneShotTimer::~OneShotTimer() {
+  Stop();
+}
+
+void OneShotTimer::Start(const tracked_objects::Location& from_here,
+                         base::TimeDelta delay,
+                         const base::Closure& task) {
+  CHECK(!task.is_null());
+  Stop();
+  task_ = task;
+  base::Closure fire =
+      base::Bind(&OneShotTimer::Fire, weak_ptr_factory_.GetWeakPtr());
+  if (scheduler_) {
+    base::TimeDelta slack =
+        base::TimeDelta::FromMicroseconds(delay.InMicroseconds() * tolerance_);
+    task_id_ = scheduler_->Schedule(from_here, delay, slack, priority_, fire);
+    return;
+  }
+  task_id_ =
+      task_runner_->PostTaskWithPriority(from_here, fire, delay, priority_);
+}
+
+void OneShotTimer::Stop() {
+  if (!IsRunning())
+    return;
+  weak_ptr_factory_.InvalidateWeakPtrs();
+  if (scheduler_)
+    scheduler_->Cancel(task_id_);
+  else
+    task_runner_->CancelTask(task_id_);
+  task_id_ = 0;
+  task_.Reset();
+}
+
+void OneShotTimer::SetWakeWindow(WakeWindowScheduler* scheduler,
+                                 double tolerance) {
+  CHECK(!IsRunning());
+  CHECK_GE(tolerance, 0);
+  scheduler_ = scheduler;
+  tolerance_ = tolerance;
+}
+
+void OneShotTimer::Fire() {
+  task_id_ = 0;
+  // The task may restart or destroy the timer.
+  base::Closure task;
+  std::swap(task, task_);
+  task.Run();
+}
+
+}  // namespace weave
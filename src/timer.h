@@ -0,0 +1,59 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_TIMER_H_
+#define LIBWEAVE_SRC_TIMER_H_
+
+#include <base/callback.h>
+#include <base/location.h>
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
+#include <weave/provider/task_runner.h>
+
+namespace weave {
+
+class WakeWindowScheduler;
+
+// Runs a task once after a delay. Restarting, stopping or destroying the timer
+// cancels the pending task, which is also removed from the queue of task
+// runners supporting TaskRunner::CancelTask(...). Use it instead of posting
+// delayed tasks guarded by weak pointers when the task may be superseded.
+class OneShotTimer final {
+ public:
+  explicit OneShotTimer(provider::TaskRunner* task_runner,
+                        provider::TaskRunner::Priority priority =
+                            provider::TaskRunner::Priority::kNormal);
+  ~OneShotTimer();
+
+  // Runs |task| after |delay|, cancelling the previous task if it's pending.
+  void Start(const tracked_objects::Location& from_here,
+             base::TimeDelta delay,
+             const base::Closure& task);
+  void Stop();
+  bool IsRunning() const { return !task_.is_null(); }
+
+  // Lets the task run up to |tolerance| times the delay late, in a wake-up
+  // shared with the other deferrable tasks of |scheduler|. Can't be called
+  // while the timer is running.
+  void SetWakeWindow(WakeWindowScheduler* scheduler, double tolerance);
+
+ private:
+  void Fire();
+
+  provider::TaskRunner* task_runner_{nullptr};
+  const provider::TaskRunner::Priority priority_;
+  WakeWindowScheduler* scheduler_{nullptr};
+  double tolerance_{0};
+  provider::TaskRunner::TaskId task_id_{0};
+  base::Closure task_;
+
+  // Guards against runners which can't cancel tasks.
+  base::WeakPtrFactory<OneShotTimer> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(OneShotTimer);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_TIMER_H_
@@ -0,0 +1,107 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/timer.h"
+
+#include <memory>
+
+#include <base/bind.h>
+#include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
+
+#include "src/wake_window_scheduler.h"
+
+namespace weave {
+
+namespace {
+
+void Increment(int* counter) {
+  ++*counter;
+}
+
+}  // namespace
+
+class OneShotTimerTest : public testing::Test {
+ protected:
+  provider::test::FakeTaskRunner task_runner_;
+  int fired_{0};
+};
+
+TEST_F(OneShotTimerTest, Fire) {
+  OneShotTimer timer{&task_runner_};
+  EXPECT_FALSE(timer.IsRunning());
+  timer.Start(FROM_HERE, base::TimeDelta::FromSeconds(1),
+              base::Bind(&Increment, &fired_));
+  EXPECT_TRUE(timer.IsRunning());
+  task_runner_.Run();
+  EXPECT_EQ(1, fired_);
+  EXPECT_FALSE(timer.IsRunning());
+}
+
+TEST_F(OneShotTimerTest, RestartRemovesPendingTask) {
+  OneShotTimer timer{&task_runner_};
+  for (int i = 0; i < 10; ++i) {
+    timer.Start(FROM_HERE, base::TimeDelta::FromSeconds(i),
+                base::Bind(&Increment, &fired_));
+  }
+  EXPECT_EQ(1u, task_runner_.GetTaskQueueSize());
+  task_runner_.Run();
+  EXPECT_EQ(1, fired_);
+}
+
+TEST_F(OneShotTimerTest, StopAndDestroy) {
+  std::unique_ptr<OneShotTimer> timer{new OneShotTimer{&task_runner_}};
+  timer->Start(FROM_HERE, {}, base::Bind(&Increment, &fired_));
+  timer->Stop();
+  EXPECT_FALSE(timer->IsRunning());
+  EXPECT_EQ(0u, task_runner_.GetTaskQueueSize());
+
+  timer->Start(FROM_HERE, {}, base::Bind(&Increment, &fired_));
+  timer.reset();
+  EXPECT_EQ(0u, task_runner_.GetTaskQueueSize());
+  task_runner_.Run();
+  EXPECT_EQ(0, fired_);
+}
+
+TEST_F(OneShotTimerTest, RestartFromTask) {
+  OneShotTimer timer{&task_runner_};
+  base::Closure restart = base::Bind(
+      [](OneShotTimer* timer, int* fired) {
+        if (++*fired < 3) {
+          timer->Start(FROM_HERE, base::TimeDelta::FromSeconds(1),
+                       base::Bind(&Increment, fired));
+        }
+      },
+      &timer, &fired_);
+  timer.Start(FROM_HERE, {}, restart);
+  task_runner_.Run();
+  EXPECT_EQ(2, fired_);
+  EXPECT_FALSE(timer.IsRunning());
+}
+
+TEST_F(OneShotTimerTest, WakeWindow) {
+  base::Clock* clock = task_runner_.GetClock();
+  WakeWindowScheduler scheduler{&task_runner_, clock};
+  base::Time start = clock->Now();
+  OneShotTimer timer{&task_runner_};
+  timer.SetWakeWindow(&scheduler, 0.5);
+  scheduler.Schedule(FROM_HERE, base::TimeDelta::FromSeconds(12), {},
+                     provider::TaskRunner::Priority::kNormal,
+                     base::Bind(&Increment, &fired_));
+  // Joins the wake-up of the other task, within half of its delay.
+  timer.Start(FROM_HERE, base::TimeDelta::FromSeconds(10),
+              base::Bind(&Increment, &fired_));
+  EXPECT_EQ(1u, scheduler.GetWakeUpCount());
+  task_runner_.RunOnce();
+  EXPECT_EQ(2, fired_);
+  EXPECT_EQ(base::TimeDelta::FromSeconds(12), clock->Now() - start);
+  EXPECT_FALSE(timer.IsRunning());
+
+  timer.Start(FROM_HERE, base::TimeDelta::FromSeconds(10),
+              base::Bind(&Increment, &fired_));
+  timer.Stop();
+  EXPECT_EQ(0u, scheduler.GetWakeUpCount());
+}
+
+}  // namespace weave
@@ -0,0 +1,161 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Compiles a JSON file into a header with a weave::EmbeddedValue table, so
+// the trait definitions built into a device are not parsed at startup.
+//
+// Usage: weave_json_compiler <input.json> <namespace> <name> > <output.h>
+
+#include <ctype.h>
+#include <stdio.h>
+
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <base/json/json_reader.h>
+#include <base/strings/stringprintf.h>
+#include <base/values.h>
+
+namespace {
+
+const char* GetTypeName(const base::Value& value) {
+  switch (value.GetType()) {
+    case base::Value::TYPE_NULL:
+      return "kNull";
+    case base::Value::TYPE_BOOLEAN:
+      return "kBoolean";
+    case base::Value::TYPE_INTEGER:
+      return "kInteger";
+    case base::Value::TYPE_DOUBLE:
+      return "kDouble";
+    case base::Value::TYPE_STRING:
+      return "kString";
+    case base::Value::TYPE_LIST:
+      return "kList";
+    case base::Value::TYPE_DICTIONARY:
+      return "kDictionary";
+    default:
+      return nullptr;
+  }
+}
+
+// Quotes |str| as a C string literal. Everything but the plain printable
+// characters is escaped in octal, which also keeps trigraphs out.
+std::string Quote(const std::string& str) {
+  std::string result = "\"";
+  for (unsigned char c : str) {
+    if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\' && c != '?')
+      result += c;
+    else
+      result += base::StringPrintf("\\%03o", c);
+  }
+  return result + "\"";
+}
+
+class Compiler {
+ public:
+  explicit Compiler(const std::string& name) : name_{name} {}
+
+  // Writes the arrays of the children of |value| and returns the
+  // initializer of |value| itself.
+  std::string Compile(const std::string* key, const base::Value& value) {
+    int integer = 0;
+    double number = 0;
+    std::string string = "nullptr";
+    std::string children = "nullptr";
+    size_t child_count = 0;
+
+    bool boolean = false;
+    std::string str;
+    const base::ListValue* list = nullptr;
+    const base::DictionaryValue* dict = nullptr;
+    std::string items;
+    if (value.GetAsBoolean(&boolean)) {
+      integer = boolean ? 1 : 0;
+    } else if (value.GetType() == base::Value::TYPE_INTEGER) {
+      value.GetAsInteger(&integer);
+    } else if (value.GetType() == base::Value::TYPE_DOUBLE) {
+      value.GetAsDouble(&number);
+    } else if (value.GetAsString(&str)) {
+      string = Quote(str);
+    } else if (value.GetAsList(&list)) {
+      for (const auto& item : *list)
+        items += "    " + Compile(nullptr, *item) + ",\n";
+      child_count = list->GetSize();
+    } else if (value.GetAsDictionary(&dict)) {
+      for (base::DictionaryValue::Iterator it{*dict}; !it.IsAtEnd();
+           it.Advance()) {
+        items += "    " + Compile(&it.key(), it.value()) + ",\n";
+      }
+      child_count = dict->size();
+    }
+
+    if (child_count > 0) {
+      children = base::StringPrintf("%s_%zu", name_.c_str(), array_count_++);
+      arrays_ += "constexpr weave::EmbeddedValue " + children + "[] = {\n" +
+                 items + "};\n\n";
+      children = "internal::" + children;
+    }
+
+    return base::StringPrintf(
+        "{weave::EmbeddedValue::Type::%s, %s, %d, %.17g, %s, %s, %zu}",
+        GetTypeName(value), key ? Quote(*key).c_str() : "nullptr", integer,
+        number, string.c_str(), children.c_str(), child_count);
+  }
+
+  const std::string& arrays() const { return arrays_; }
+
+ private:
+  std::string name_;
+  // Arrays of children, each written before the arrays referring to it.
+  std::string arrays_;
+  size_t array_count_{0};
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 4) {
+    fprintf(stderr, "Usage: %s <input.json> <namespace> <name>\n", argv[0]);
+    return 1;
+  }
+  std::ifstream input{argv[1]};
+  std::stringstream json;
+  json << input.rdbuf();
+  if (!input) {
+    fprintf(stderr, "Can't read %s\n", argv[1]);
+    return 1;
+  }
+
+  int error_code = 0;
+  std::string error_message;
+  std::unique_ptr<base::Value> value = base::JSONReader::ReadAndReturnError(
+      json.str(), base::JSON_PARSE_RFC, &error_code, &error_message);
+  if (!value) {
+    fprintf(stderr, "%s: %s\n", argv[1], error_message.c_str());
+    return 1;
+  }
+
+  std::string ns = argv[2];
+  std::string name = argv[3];
+  Compiler compiler{name};
+  std::string root = compiler.Compile(nullptr, *value);
+
+  std::string guard = ns + "_" + name + "_EMBEDDED_H_";
+  for (char& c : guard)
+    c = isalnum(c) ? toupper(c) : '_';
+  printf("// Generated by weave_json_compiler from %s, do not edit.\n\n",
+         argv[1]);
+  printf("#ifndef %s\n#define %s\n\n", guard.c_str(), guard.c_str());
+  printf("#include <weave/embedded_value.h>\n\n");
+  printf("namespace %s {\n\nnamespace internal {\n\n", ns.c_str());
+  printf("%s", compiler.arrays().c_str());
+  printf("}  // namespace internal\n\n");
+  printf("constexpr weave::EmbeddedValue %s =\n    %s;\n\n", name.c_str(),
+         root.c_str());
+  printf("}  // namespace %s\n\n#endif  // %s\n", ns.c_str(), guard.c_str());
+  return 0;
+}
@@ -0,0 +1,106 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/traffic_stats.h"
+
+#include <base/logging.h>
+
+namespace weave {
+
+namespace {
+
+const size_t kMinutesPerHour = 60;
+const size_t kHoursPerDay = 24;
+
+}  // namespace
+
+void TrafficStats::Counters::Add(const Counters& other) {
+  count += other.count;
+  bytes_sent += other.bytes_sent;
+  bytes_received += other.bytes_received;
+}
+
+std::unique_ptr<base::DictionaryValue> TrafficStats::Counters::ToJson() const {
+  // Byte counts of a long running device don't fit into an int.
+  std::unique_ptr<base::DictionaryValue> result{new base::DictionaryValue};
+  result->SetDouble("count", static_cast<double>(count));
+  result->SetDouble("bytesSent", static_cast<double>(bytes_sent));
+  result->SetDouble("bytesReceived", static_cast<double>(bytes_received));
+  return result;
+}
+
+TrafficStats::Window::Window(base::TimeDelta bucket_duration,
+                             size_t bucket_count)
+    : bucket_duration_{bucket_duration},
+      buckets_(bucket_count),
+      bucket_numbers_(bucket_count, -1) {
+  CHECK_GT(bucket_count, 0u);
+}
+
+TrafficStats::Window::~Window() {}
+
+int64_t TrafficStats::Window::GetBucketNumber(base::Time time) const {
+  return (time - base::Time::UnixEpoch()) / bucket_duration_;
+}
+
+void TrafficStats::Window::Add(base::Time time, const Counters& counters) {
+  int64_t number = GetBucketNumber(time);
+  size_t index = static_cast<size_t>(number) % buckets_.size();
+  if (bucket_numbers_[index] != number) {
+    bucket_numbers_[index] = number;
+    buckets_[index] = Counters{};
+  }
+  buckets_[index].Add(counters);
+}
+
+TrafficStats::Counters TrafficStats::Window::Sum(base::Time now) const {
+  int64_t current = GetBucketNumber(now);
+  int64_t window = static_cast<int64_t>(buckets_.size());
+  Counters sum;
+  for (size_t i = 0; i < buckets_.size(); ++i) {
+    if (bucket_numbers_[i] <= current && bucket_numbers_[i] > current - window)
+      sum.Add(buckets_[i]);
+  }
+  return sum;
+}
+
+TrafficStats::Endpoint::Endpoint()
+    : last_hour{base::TimeDelta::FromMinutes(1), kMinutesPerHour},
+      last_day{base::TimeDelta::FromHours(1), kHoursPerDay} {}
+
+TrafficStats::TrafficStats(base::Clock* clock)
+    : clock_{clock ? clock : &default_clock_} {}
+
+TrafficStats::~TrafficStats() {}
+
+void TrafficStats::Record(const std::string& endpoint,
+                          size_t bytes_sent,
+                          size_t bytes_received) {
+  std::unique_ptr<Endpoint>& stats = endpoints_[endpoint];
+  if (!stats)
+    stats.reset(new Endpoint);
+  Counters counters;
+  counters.count = 1;
+  counters.bytes_sent = bytes_sent;
+  counters.bytes_received = bytes_received;
+  base::Time now = clock_->Now();
+  stats->total.Add(counters);
+  stats->last_hour.Add(now, counters);
+  stats->last_day.Add(now, counters);
+}
+
+std::unique_ptr<base::DictionaryValue> TrafficStats::ToJson() const {
+  base::Time now = clock_->Now();
+  std::unique_ptr<base::DictionaryValue> result{new base::DictionaryValue};
+  for (const auto& pair : endpoints_) {
+    std::unique_ptr<base::DictionaryValue> endpoint{new base::DictionaryValue};
+    endpoint->Set("total", pair.second->total.ToJson());
+    endpoint->Set("lastHour", pair.second->last_hour.Sum(now).ToJson());
+    endpoint->Set("lastDay", pair.second->last_day.Sum(now).ToJson());
+    result->SetWithoutPathExpansion(pair.first, std::move(endpoint));
+  }
+  return result;
+}
+
+}  // namespace weave
@@ -0,0 +1,85 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_TRAFFIC_STATS_H_
+#define LIBWEAVE_SRC_TRAFFIC_STATS_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/time/clock.h>
+#include <base/time/default_clock.h>
+#include <base/time/time.h>
+#include <base/values.h>
+
+namespace weave {
+
+// Counts the messages and bytes exchanged with the cloud by endpoint, e.g.
+// "POST devices/*/patchState" or "xmpp", in total and over the last hour and
+// day. Exposed by Device::GetTrafficStats().
+class TrafficStats final {
+ public:
+  explicit TrafficStats(base::Clock* clock = nullptr);
+  ~TrafficStats();
+
+  void Record(const std::string& endpoint,
+              size_t bytes_sent,
+              size_t bytes_received);
+
+  // Returns {<endpoint>: {"total": {...}, "lastHour": {...},
+  // "lastDay": {...}}}, each as {"count", "bytesSent", "bytesReceived"}.
+  std::unique_ptr<base::DictionaryValue> ToJson() const;
+
+ private:
+  struct Counters {
+    uint64_t count{0};
+    uint64_t bytes_sent{0};
+    uint64_t bytes_received{0};
+
+    void Add(const Counters& other);
+    std::unique_ptr<base::DictionaryValue> ToJson() const;
+  };
+
+  // Counters over the last |bucket_count| periods of |bucket_duration|, the
+  // current period included.
+  class Window {
+   public:
+    Window(base::TimeDelta bucket_duration, size_t bucket_count);
+    ~Window();
+
+    void Add(base::Time time, const Counters& counters);
+    Counters Sum(base::Time now) const;
+
+   private:
+    int64_t GetBucketNumber(base::Time time) const;
+
+    const base::TimeDelta bucket_duration_;
+    // Ring of buckets, along with the period number each one counts.
+    std::vector<Counters> buckets_;
+    std::vector<int64_t> bucket_numbers_;
+  };
+
+  struct Endpoint {
+    Endpoint();
+
+    Counters total;
+    Window last_hour;
+    Window last_day;
+  };
+
+  base::DefaultClock default_clock_;
+  base::Clock* clock_{nullptr};
+  std::map<std::string, std::unique_ptr<Endpoint>> endpoints_;
+
+  DISALLOW_COPY_AND_ASSIGN(TrafficStats);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_TRAFFIC_STATS_H_
@@ -0,0 +1,99 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/traffic_stats.h"
+
+#include <gtest/gtest.h>
+#include <weave/test/unittest_utils.h>
+
+#include "src/test/mock_clock.h"
+
+namespace weave {
+
+using testing::ReturnPointee;
+
+class TrafficStatsTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    EXPECT_CALL(clock_, Now()).WillRepeatedly(ReturnPointee(&now_));
+  }
+
+  base::Time now_{base::Time::FromTimeT(1412121212)};
+  test::MockClock clock_;
+  TrafficStats stats_{&clock_};
+};
+
+// The counts are doubles, since bytes of a long running device don't fit into
+// an int.
+TEST_F(TrafficStatsTest, Empty) {
+  EXPECT_JSON_EQ("{}", *stats_.ToJson());
+}
+
+TEST_F(TrafficStatsTest, Record) {
+  stats_.Record("xmpp", 100, 0);
+  stats_.Record("xmpp", 0, 50);
+  stats_.Record("POST devices/*/patchState", 300, 20);
+  EXPECT_JSON_EQ(R"({
+    "POST devices/*/patchState": {
+      "total": {"count": 1.0, "bytesSent": 300.0, "bytesReceived": 20.0},
+      "lastHour": {"count": 1.0, "bytesSent": 300.0, "bytesReceived": 20.0},
+      "lastDay": {"count": 1.0, "bytesSent": 300.0, "bytesReceived": 20.0}
+    },
+    "xmpp": {
+      "total": {"count": 2.0, "bytesSent": 100.0, "bytesReceived": 50.0},
+      "lastHour": {"count": 2.0, "bytesSent": 100.0, "bytesReceived": 50.0},
+      "lastDay": {"count": 2.0, "bytesSent": 100.0, "bytesReceived": 50.0}
+    }
+  })",
+                 *stats_.ToJson());
+}
+
+TEST_F(TrafficStatsTest, Windows) {
+  stats_.Record("xmpp", 100, 10);
+  now_ += base::TimeDelta::FromMinutes(30);
+  stats_.Record("xmpp", 200, 20);
+
+  now_ += base::TimeDelta::FromMinutes(31);
+  EXPECT_JSON_EQ(R"({
+    "xmpp": {
+      "total": {"count": 2.0, "bytesSent": 300.0, "bytesReceived": 30.0},
+      "lastHour": {"count": 1.0, "bytesSent": 200.0, "bytesReceived": 20.0},
+      "lastDay": {"count": 2.0, "bytesSent": 300.0, "bytesReceived": 30.0}
+    }
+  })",
+                 *stats_.ToJson());
+
+  now_ += base::TimeDelta::FromHours(1);
+  stats_.Record("xmpp", 400, 40);
+  EXPECT_JSON_EQ(R"({
+    "xmpp": {
+      "total": {"count": 3.0, "bytesSent": 700.0, "bytesReceived": 70.0},
+      "lastHour": {"count": 1.0, "bytesSent": 400.0, "bytesReceived": 40.0},
+      "lastDay": {"count": 3.0, "bytesSent": 700.0, "bytesReceived": 70.0}
+    }
+  })",
+                 *stats_.ToJson());
+
+  // The ring buckets reused for the new periods don't keep the old counts.
+  now_ += base::TimeDelta::FromHours(24);
+  EXPECT_JSON_EQ(R"({
+    "xmpp": {
+      "total": {"count": 3.0, "bytesSent": 700.0, "bytesReceived": 70.0},
+      "lastHour": {"count": 0.0, "bytesSent": 0.0, "bytesReceived": 0.0},
+      "lastDay": {"count": 0.0, "bytesSent": 0.0, "bytesReceived": 0.0}
+    }
+  })",
+                 *stats_.ToJson());
+  stats_.Record("xmpp", 1, 1);
+  EXPECT_JSON_EQ(R"({
+    "xmpp": {
+      "total": {"count": 4.0, "bytesSent": 701.0, "bytesReceived": 71.0},
+      "lastHour": {"count": 1.0, "bytesSent": 1.0, "bytesReceived": 1.0},
+      "lastDay": {"count": 1.0, "bytesSent": 1.0, "bytesReceived": 1.0}
+    }
+  })",
+                 *stats_.ToJson());
+}
+
+}  // namespace weave
@@ -8,6 +8,8 @@
 
 #include <base/bind_helpers.h>
 #include <base/json/json_reader.h>
+#include <base/logging.h>
+#include <weave/device.h>
 
 #include "src/json_error_codes.h"
 
@@ -30,6 +32,34 @@ const char kErrorMessageKey[] = "message";
 
 const time_t kJ2000ToTimeT = 946684800;
 
+std::unique_ptr<base::DictionaryValue> ParseJsonDict(
+    const std::string& json_string,
+    const base::JSONReaderLimits& limits,
+    ErrorPtr* error) {
+  std::unique_ptr<base::DictionaryValue> result;
+  std::string error_message;
+  auto value = base::JSONReader::ReadWithLimits(
+      json_string, base::JSON_PARSE_RFC, limits, nullptr, &error_message);
+  // Don't copy the JSON into a message nobody is going to see.
+  bool report = error || LOG_IS_ON(ERROR);
+  if (!value) {
+    if (report) {
+      Error::AddToPrintf(error, FROM_HERE, errors::json::kParseError,
+                         "Error parsing JSON string '%s' (%zu): %s",
+                         LimitString(json_string, kMaxStrLen).c_str(),
+                         json_string.size(), error_message.c_str());
+    }
+    return result;
+  }
+  result = base::DictionaryValue::From(std::move(value));
+  if (!result && report) {
+    Error::AddToPrintf(error, FROM_HERE, errors::json::kObjectExpected,
+                       "JSON string '%s' is not a JSON object",
+                       LimitString(json_string, kMaxStrLen).c_str());
+  }
+  return result;
+}
+
 }  // anonymous namespace
 
 namespace errors {
@@ -41,26 +71,72 @@ const char kInvalidPackageError[] = "invalid_package";
 std::unique_ptr<base::DictionaryValue> LoadJsonDict(
     const std::string& json_string,
     ErrorPtr* error) {
-  std::unique_ptr<base::DictionaryValue> result;
-  std::string error_message;
-  auto value = base::JSONReader::ReadAndReturnError(
-      json_string, base::JSON_PARSE_RFC, nullptr, &error_message);
-  if (!value) {
-    Error::AddToPrintf(error, FROM_HERE, errors::json::kParseError,
-                       "Error parsing JSON string '%s' (%zu): %s",
-                       LimitString(json_string, kMaxStrLen).c_str(),
-                       json_string.size(), error_message.c_str());
-    return result;
-  }
-  result = base::DictionaryValue::From(std::move(value));
+  return ParseJsonDict(json_string, base::JSONReaderLimits{}, error);
+}
+
+std::unique_ptr<base::DictionaryValue> LoadJsonDict(
+    const std::string& json_string,
+    const InputLimits& limits,
+    ErrorPtr* error) {
+  return ParseJsonDict(json_string, GetJsonReaderLimits(limits), error);
+}
+
+base::JSONReaderLimits GetJsonReaderLimits(const InputLimits& limits) {
+  base::JSONReaderLimits result;
+  result.max_depth = limits.max_depth;
+  result.max_nodes = limits.max_nodes;
+  result.max_size = limits.max_size;
+  return result;
+}
+
+std::unique_ptr<base::DictionaryValue> LoadEmbeddedDict(
+    const EmbeddedValue& table,
+    ErrorPtr* error) {
+  std::unique_ptr<base::DictionaryValue> result =
+      base::DictionaryValue::From(CreateValueFromEmbedded(table));
   if (!result) {
-    Error::AddToPrintf(error, FROM_HERE, errors::json::kObjectExpected,
-                       "JSON string '%s' is not a JSON object",
-                       LimitString(json_string, kMaxStrLen).c_str());
+    Error::AddTo(error, FROM_HERE, errors::json::kObjectExpected,
+                 "Embedded table is not a JSON object");
   }
   return result;
 }
 
+std::unique_ptr<base::Value> CreateValueFromEmbedded(
+    const EmbeddedValue& table) {
+  switch (table.type) {
+    case EmbeddedValue::Type::kNull:
+      return base::Value::CreateNullValue();
+    case EmbeddedValue::Type::kBoolean:
+      return std::unique_ptr<base::Value>{
+          new base::FundamentalValue{table.integer != 0}};
+    case EmbeddedValue::Type::kInteger:
+      return std::unique_ptr<base::Value>{
+          new base::FundamentalValue{table.integer}};
+    case EmbeddedValue::Type::kDouble:
+      return std::unique_ptr<base::Value>{
+          new base::FundamentalValue{table.number}};
+    case EmbeddedValue::Type::kString:
+      return std::unique_ptr<base::Value>{
+          new base::StringValue{table.string}};
+    case EmbeddedValue::Type::kList: {
+      std::unique_ptr<base::ListValue> list{new base::ListValue};
+      for (size_t i = 0; i < table.child_count; i++)
+        list->Append(CreateValueFromEmbedded(table.children[i]));
+      return std::move(list);
+    }
+    case EmbeddedValue::Type::kDictionary: {
+      std::unique_ptr<base::DictionaryValue> dict{new base::DictionaryValue};
+      for (size_t i = 0; i < table.child_count; i++) {
+        dict->SetWithoutPathExpansion(
+            table.children[i].key, CreateValueFromEmbedded(table.children[i]));
+      }
+      return std::move(dict);
+    }
+  }
+  NOTREACHED();
+  return nullptr;
+}
+
 std::unique_ptr<base::DictionaryValue> ErrorInfoToJson(const Error& error) {
   std::unique_ptr<base::DictionaryValue> output{new base::DictionaryValue};
   output->SetString(kErrorMessageKey, error.GetMessage());
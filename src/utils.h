@@ -8,12 +8,16 @@
 #include <memory>
 #include <string>
 
+#include <base/json/json_reader.h>
 #include <base/time/time.h>
 #include <base/values.h>
+#include <weave/embedded_value.h>
 #include <weave/error.h>
 
 namespace weave {
 
+struct InputLimits;
+
 namespace errors {
 extern const char kSchemaError[];
 extern const char kInvalidCategoryError[];
@@ -30,6 +34,26 @@ std::unique_ptr<base::DictionaryValue> LoadJsonDict(
     const std::string& json_string,
     ErrorPtr* error);
 
+// Same as LoadJsonDict(), for the JSON received from the network, which is
+// rejected if it is over |limits|.
+std::unique_ptr<base::DictionaryValue> LoadJsonDict(
+    const std::string& json_string,
+    const InputLimits& limits,
+    ErrorPtr* error);
+
+// Converts |limits| to the limits of base::JSONReader.
+base::JSONReaderLimits GetJsonReaderLimits(const InputLimits& limits);
+
+// Same as LoadJsonDict(), but builds the dictionary from a table compiled at
+// build time.
+std::unique_ptr<base::DictionaryValue> LoadEmbeddedDict(
+    const EmbeddedValue& table,
+    ErrorPtr* error);
+
+// Builds the value of an embedded |table|.
+std::unique_ptr<base::Value> CreateValueFromEmbedded(
+    const EmbeddedValue& table);
+
 std::unique_ptr<base::DictionaryValue> ErrorInfoToJson(const Error& error);
 
 uint32_t ToJ2000Time(const base::Time& time);
@@ -0,0 +1,118 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/wake_window_scheduler.h"
+
+#include <algorithm>
+
+#include <base/bind.h>
+
+namespace weave {
+
+WakeWindowScheduler::WakeWindowScheduler(provider::TaskRunner* task_runner,
+                                         base::Clock* clock)
+    : task_runner_{task_runner}, clock_{clock ? clock : &default_clock_} {
+  CHECK(task_runner_);
+}
+
+WakeWindowScheduler::~WakeWindowScheduler() {
+  for (const auto& wake_up : wake_ups_)
+    task_runner_->CancelTask(wake_up.runner_task_id);
+}
+
+WakeWindowScheduler::TaskId WakeWindowScheduler::Schedule(
+    const tracked_objects::Location& from_here,
+    base::TimeDelta delay,
+    base::TimeDelta slack,
+    provider::TaskRunner::Priority priority,
+    const base::Closure& task) {
+  CHECK(!task.is_null());
+  base::Time earliest = clock_->Now() + delay;
+  base::Time latest =
+      earliest + std::max(std::min(slack, max_slack_), base::TimeDelta{});
+  TaskId id = ++last_id_;
+  for (auto& wake_up : wake_ups_) {
+    if (std::max(wake_up.earliest, earliest) > std::min(wake_up.time, latest))
+      continue;
+    wake_up.earliest = std::max(wake_up.earliest, earliest);
+    wake_up.tasks.emplace_back(id, task);
+    if (latest < wake_up.time || wake_up.priority < priority) {
+      wake_up.time = std::min(wake_up.time, latest);
+      wake_up.priority = std::max(wake_up.priority, priority);
+      Post(from_here, &wake_up);
+    }
+    return id;
+  }
+
+  wake_ups_.emplace_back();
+  WakeUp& wake_up = wake_ups_.back();
+  wake_up.earliest = earliest;
+  wake_up.time = latest;
+  wake_up.priority = priority;
+  wake_up.tasks.emplace_back(id, task);
+  Post(from_here, &wake_up);
+  return id;
+}
+
+void WakeWindowScheduler::Cancel(TaskId id) {
+  for (auto& task : running_tasks_) {
+    if (task.first == id)
+      task.second.Reset();
+  }
+  for (auto wake_up = wake_ups_.begin(); wake_up != wake_ups_.end();
+       ++wake_up) {
+    auto& tasks = wake_up->tasks;
+    auto task = std::find_if(
+        tasks.begin(), tasks.end(),
+        [id](const std::pair<TaskId, base::Closure>& t) {
+          return t.first == id;
+        });
+    if (task == tasks.end())
+      continue;
+    tasks.erase(task);
+    if (tasks.empty()) {
+      task_runner_->CancelTask(wake_up->runner_task_id);
+      wake_ups_.erase(wake_up);
+    }
+    return;
+  }
+}
+
+void WakeWindowScheduler::Post(const tracked_objects::Location& from_here,
+                               WakeUp* wake_up) {
+  task_runner_->CancelTask(wake_up->runner_task_id);
+  // A new id makes the previous task a no-op on runners which can't cancel it.
+  wake_up->id = ++last_id_;
+  wake_up->runner_task_id = task_runner_->PostTaskWithPriority(
+      from_here, base::Bind(&WakeWindowScheduler::RunWakeUp,
+                            weak_ptr_factory_.GetWeakPtr(), wake_up->id),
+      std::max(wake_up->time - clock_->Now(), base::TimeDelta{}),
+      wake_up->priority);
+}
+
+void WakeWindowScheduler::RunWakeUp(TaskId id) {
+  auto wake_up = std::find_if(
+      wake_ups_.begin(), wake_ups_.end(),
+      [id](const WakeUp& w) { return w.id == id; });
+  if (wake_up == wake_ups_.end())
+    return;
+  CHECK(running_tasks_.empty());
+  std::swap(running_tasks_, wake_up->tasks);
+  wake_ups_.erase(wake_up);
+
+  // The tasks may schedule or cancel other tasks, or destroy the scheduler.
+  auto weak_ptr = weak_ptr_factory_.GetWeakPtr();
+  for (size_t i = 0; i < running_tasks_.size(); ++i) {
+    base::Closure task;
+    std::swap(task, running_tasks_[i].second);
+    if (task.is_null())
+      continue;
+    task.Run();
+    if (!weak_ptr)
+      return;
+  }
+  running_tasks_.clear();
+}
+
+}  // namespace weave
@@ -0,0 +1,82 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_WAKE_WINDOW_SCHEDULER_H_
+#define LIBWEAVE_SRC_WAKE_WINDOW_SCHEDULER_H_
+
+#include <utility>
+#include <vector>
+
+#include <base/callback.h>
+#include <base/location.h>
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <base/time/default_clock.h>
+#include <base/time/time.h>
+#include <weave/provider/task_runner.h>
+
+namespace weave {
+
+// Groups deferrable tasks, e.g. keep-alive pings, polls and retries, into
+// shared wake-ups, so the radio is woken up once for all of them. Each task
+// runs within its window, i.e. after its delay and no later than its slack
+// past it. A task joins a pending wake-up within its window, moving it earlier
+// if needed, or starts a new one at the end of the window, where the tasks
+// scheduled later have the best chance to join it.
+class WakeWindowScheduler final {
+ public:
+  using TaskId = uint64_t;
+
+  explicit WakeWindowScheduler(provider::TaskRunner* task_runner,
+                               base::Clock* clock = nullptr);
+  ~WakeWindowScheduler();
+
+  // Caps the slack of the tasks scheduled afterwards. Zero runs every task
+  // right after its delay.
+  void SetMaxSlack(base::TimeDelta max_slack) { max_slack_ = max_slack; }
+  base::TimeDelta GetMaxSlack() const { return max_slack_; }
+
+  // Runs |task| between |delay| and |delay| + |slack| from now. Returns an id
+  // which can be passed into Cancel(...).
+  TaskId Schedule(const tracked_objects::Location& from_here,
+                  base::TimeDelta delay,
+                  base::TimeDelta slack,
+                  provider::TaskRunner::Priority priority,
+                  const base::Closure& task);
+  // Removes the task with the |id| if it hasn't run yet.
+  void Cancel(TaskId id);
+
+  size_t GetWakeUpCount() const { return wake_ups_.size(); }
+
+ private:
+  struct WakeUp {
+    TaskId id{0};
+    // The wake-up happens at |time|, not before |earliest|, the latest
+    // start of the windows of its tasks.
+    base::Time earliest;
+    base::Time time;
+    provider::TaskRunner::Priority priority;
+    provider::TaskRunner::TaskId runner_task_id{0};
+    std::vector<std::pair<TaskId, base::Closure>> tasks;
+  };
+
+  void Post(const tracked_objects::Location& from_here, WakeUp* wake_up);
+  void RunWakeUp(TaskId id);
+
+  provider::TaskRunner* task_runner_{nullptr};
+  base::DefaultClock default_clock_;
+  base::Clock* clock_{nullptr};
+  base::TimeDelta max_slack_{base::TimeDelta::FromMinutes(1)};
+  TaskId last_id_{0};
+  std::vector<WakeUp> wake_ups_;
+  // The tasks of the wake-up being run, so they can still be cancelled.
+  std::vector<std::pair<TaskId, base::Closure>> running_tasks_;
+
+  base::WeakPtrFactory<WakeWindowScheduler> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(WakeWindowScheduler);
+};
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_WAKE_WINDOW_SCHEDULER_H_
@@ -0,0 +1,93 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/wake_window_scheduler.h"
+
+#include <vector>
+
+#include <base/bind.h>
+#include <gtest/gtest.h>
+#include <weave/provider/test/fake_task_runner.h>
+
+namespace weave {
+
+using provider::TaskRunner;
+
+class WakeWindowSchedulerTest : public testing::Test {
+ protected:
+  WakeWindowScheduler::TaskId Schedule(int delay, int slack) {
+    return scheduler_.Schedule(
+        FROM_HERE, base::TimeDelta::FromSeconds(delay),
+        base::TimeDelta::FromSeconds(slack), TaskRunner::Priority::kBackground,
+        base::Bind(&WakeWindowSchedulerTest::Run, base::Unretained(this),
+                   delay));
+  }
+
+  void Run(int delay) {
+    runs_.push_back(
+        {delay, (task_runner_.GetClock()->Now() - start_).InSeconds()});
+  }
+
+  provider::test::FakeTaskRunner task_runner_;
+  WakeWindowScheduler scheduler_{&task_runner_, task_runner_.GetClock()};
+  base::Time start_{task_runner_.GetClock()->Now()};
+  // Delays of the tasks run and the seconds since the start they ran at.
+  std::vector<std::pair<int, int64_t>> runs_;
+};
+
+TEST_F(WakeWindowSchedulerTest, SharedWakeUp) {
+  Schedule(10, 5);
+  Schedule(12, 10);
+  EXPECT_EQ(1u, scheduler_.GetWakeUpCount());
+  // The window of the third task ends first, so they all run at its end.
+  Schedule(13, 1);
+  EXPECT_EQ(1u, scheduler_.GetWakeUpCount());
+  task_runner_.Run();
+  std::vector<std::pair<int, int64_t>> expected{{10, 14}, {12, 14}, {13, 14}};
+  EXPECT_EQ(expected, runs_);
+}
+
+TEST_F(WakeWindowSchedulerTest, SeparateWindows) {
+  Schedule(20, 5);
+  Schedule(10, 0);
+  EXPECT_EQ(2u, scheduler_.GetWakeUpCount());
+  task_runner_.Run();
+  std::vector<std::pair<int, int64_t>> expected{{10, 10}, {20, 25}};
+  EXPECT_EQ(expected, runs_);
+}
+
+TEST_F(WakeWindowSchedulerTest, MaxSlack) {
+  scheduler_.SetMaxSlack(base::TimeDelta::FromSeconds(1));
+  Schedule(10, 60);
+  scheduler_.SetMaxSlack({});
+  Schedule(20, 60);
+  task_runner_.Run();
+  std::vector<std::pair<int, int64_t>> expected{{10, 11}, {20, 20}};
+  EXPECT_EQ(expected, runs_);
+}
+
+TEST_F(WakeWindowSchedulerTest, Cancel) {
+  auto first = Schedule(10, 5);
+  auto second = Schedule(11, 5);
+  scheduler_.Cancel(first);
+  EXPECT_EQ(1u, scheduler_.GetWakeUpCount());
+  scheduler_.Cancel(second);
+  EXPECT_EQ(0u, scheduler_.GetWakeUpCount());
+  EXPECT_EQ(0u, task_runner_.GetTaskQueueSize());
+
+  // A task can cancel the other tasks of its wake-up.
+  WakeWindowScheduler::TaskId third = 0;
+  scheduler_.Schedule(
+      FROM_HERE, base::TimeDelta::FromSeconds(10), {},
+      TaskRunner::Priority::kBackground,
+      base::Bind(
+          [](WakeWindowScheduler* scheduler,
+             WakeWindowScheduler::TaskId* id) { scheduler->Cancel(*id); },
+          &scheduler_, &third));
+  third = Schedule(10, 0);
+  task_runner_.Run();
+  EXPECT_TRUE(runs_.empty());
+}
+
+}  // namespace weave
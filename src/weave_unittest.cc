@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <weave/device.h>
+#include <weave/device_runtime.h>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -30,6 +31,7 @@ using testing::InvokeWithoutArgs;
 using testing::MatchesRegex;
 using testing::Mock;
 using testing::Return;
+using testing::SaveArg;
 using testing::ReturnRefOfCopy;
 using testing::StartsWith;
 using testing::StrictMock;
@@ -184,6 +186,8 @@ class WeaveTest : public ::testing::Test {
   void SetUp() override {
     EXPECT_CALL(wifi_, IsWifi24Supported()).WillRepeatedly(Return(true));
     EXPECT_CALL(wifi_, IsWifi50Supported()).WillRepeatedly(Return(false));
+    EXPECT_CALL(bluetooth_, StartPrivetService(_, _)).WillRepeatedly(Return());
+    EXPECT_CALL(bluetooth_, StopPrivetService()).WillRepeatedly(Return());
   }
 
   template <class UrlMatcher>
@@ -202,7 +206,7 @@ class WeaveTest : public ::testing::Test {
                   .Times(AtLeast(1))
                   .WillRepeatedly(Return("application/json; charset=utf-8"));
               EXPECT_CALL(*response, GetData())
-                  .WillRepeatedly(Return(json_response));
+                  .WillRepeatedly(ReturnRefOfCopy(json_response));
               callback.Run(std::move(response), nullptr);
             })));
   }
@@ -301,12 +305,14 @@ class WeaveTest : public ::testing::Test {
                   "/privet/v3/accessControl/claim",
                   "/privet/v3/accessControl/confirm",
                   "/privet/v3/auth",
+                  "/privet/v3/batch",
                   "/privet/v3/checkForUpdates",
                   "/privet/v3/commands/cancel",
                   "/privet/v3/commands/execute",
                   "/privet/v3/commands/list",
                   "/privet/v3/commands/status",
                   "/privet/v3/components",
+                  "/privet/v3/events",
                   "/privet/v3/pairing/cancel",
                   "/privet/v3/pairing/confirm",
                   "/privet/v3/pairing/start",
@@ -370,6 +376,59 @@ TEST_F(WeaveTest, StartMinimal) {
                                   &network_, nullptr, nullptr, &wifi_, nullptr);
 }
 
+TEST_F(WeaveTest, ComponentsSnapshot) {
+  device_ = weave::Device::Create(&config_store_, &task_runner_, &http_client_,
+                                  &network_, nullptr, nullptr, &wifi_, nullptr);
+  EXPECT_FALSE(device_->EnableComponentsSnapshot("1"));
+  device_->AddTraitDefinitionsFromJson(kTraitDefs);
+  EXPECT_TRUE(
+      device_->AddComponent("myComponent", {"trait1", "trait2"}, nullptr));
+  EXPECT_TRUE(device_->SetStatePropertiesFromJson(
+      "myComponent", R"({"trait2": {"battery_level":44}})", nullptr));
+
+  std::string snapshot;
+  EXPECT_CALL(config_store_, SaveSettings("snapshot", _, _))
+      .WillRepeatedly(SaveArg<1>(&snapshot));
+  device_.reset();
+  EXPECT_CALL(config_store_, LoadSettings("snapshot"))
+      .WillRepeatedly(Return(snapshot));
+
+  device_ = weave::Device::Create(&config_store_, &task_runner_, &http_client_,
+                                  &network_, nullptr, nullptr, &wifi_, nullptr);
+  EXPECT_TRUE(device_->EnableComponentsSnapshot("1"));
+  const base::Value* value =
+      device_->GetStateProperty("myComponent", "trait2.battery_level", nullptr);
+  ASSERT_NE(nullptr, value);
+  EXPECT_JSON_EQ("44", *value);
+  device_.reset();
+
+  // A snapshot of another version is ignored.
+  device_ = weave::Device::Create(&config_store_, &task_runner_, &http_client_,
+                                  &network_, nullptr, nullptr, &wifi_, nullptr);
+  EXPECT_FALSE(device_->EnableComponentsSnapshot("2"));
+  EXPECT_FALSE(device_->GetComponents().HasKey("myComponent"));
+  device_.reset();
+}
+
+TEST_F(WeaveTest, DeviceRuntime) {
+  std::unique_ptr<DeviceRuntime> runtime =
+      DeviceRuntime::Create(&task_runner_, &http_client_, &network_);
+  std::unique_ptr<Device> devices[] = {
+      runtime->CreateDevice(&config_store_, nullptr, nullptr, nullptr, nullptr),
+      runtime->CreateDevice(&config_store_, nullptr, nullptr, nullptr,
+                            nullptr)};
+  for (const auto& device : devices) {
+    device->AddTraitDefinitionsFromJson(kTraitDefs);
+    EXPECT_TRUE(
+        device->AddComponent("myComponent", {"trait1", "trait2"}, nullptr));
+  }
+  EXPECT_TRUE(devices[0]->SetStatePropertiesFromJson(
+      "myComponent", R"({"trait2": {"battery_level":44}})", nullptr));
+  EXPECT_EQ(nullptr, devices[1]->GetStateProperty(
+                         "myComponent", "trait2.battery_level", nullptr));
+  task_runner_.RunPendingTasks();
+}
+
 TEST_F(WeaveTest, StartNoWifi) {
   InitNetwork();
   InitHttpServer();
@@ -400,6 +459,101 @@ TEST_F(WeaveBasicTest, Start) {
   StartDevice();
 }
 
+TEST_F(WeaveBasicTest, PrivetContentNegotiation) {
+  StartDevice();
+  EXPECT_CALL(wifi_, GetConnectedSsid()).WillRepeatedly(Return(""));
+
+  class Request : public provider::HttpServer::Request {
+   public:
+    Request(const std::map<std::string, std::string>& headers,
+            const std::string& data,
+            int* status,
+            std::string* reply,
+            std::string* mime_type,
+            std::string* content_encoding)
+        : headers_{headers},
+          data_{data},
+          status_{status},
+          reply_{reply},
+          mime_type_{mime_type},
+          content_encoding_{content_encoding} {}
+
+    std::string GetPath() const override { return "/privet/info"; }
+    std::string GetFirstHeader(const std::string& name) const override {
+      auto it = headers_.find(name);
+      return it == headers_.end() ? std::string{} : it->second;
+    }
+    std::string GetData() override { return data_; }
+    void SendReply(int status,
+                   const std::string& data,
+                   const std::string& mime_type) override {
+      *status_ = status;
+      *reply_ = data;
+      *mime_type_ = mime_type;
+      content_encoding_->clear();
+    }
+    bool SendEncodedReply(int status,
+                          std::string data,
+                          const std::string& mime_type,
+                          const std::string& content_encoding) override {
+      SendReply(status, data, mime_type);
+      *content_encoding_ = content_encoding;
+      return true;
+    }
+
+   private:
+    std::map<std::string, std::string> headers_;
+    std::string data_;
+    int* status_;
+    std::string* reply_;
+    std::string* mime_type_;
+    std::string* content_encoding_;
+  };
+
+  std::string content_encoding;
+  auto send = [this, &content_encoding](
+      std::map<std::string, std::string> headers, const std::string& data,
+      std::string* mime_type) {
+    headers.emplace("Authorization", "Privet anonymous");
+    int status = 0;
+    std::string reply;
+    std::unique_ptr<provider::HttpServer::Request> request{new Request{
+        headers, data, &status, &reply, mime_type, &content_encoding}};
+    http_handlers_["/privet/info"].Run(std::move(request));
+    task_runner_.RunPendingTasks();
+    EXPECT_EQ(200, status);
+    return reply;
+  };
+
+  std::string mime_type;
+  std::string reply = send({}, {}, &mime_type);
+  EXPECT_EQ("application/json", mime_type);
+  EXPECT_EQ('{', reply[0]);
+
+  reply = send({{"Accept", "text/plain, application/cbor;q=0.9"}}, {},
+               &mime_type);
+  EXPECT_EQ("application/cbor", mime_type);
+  EXPECT_EQ(0xa0, static_cast<uint8_t>(reply[0]) & 0xe0);  // A map.
+
+  // An empty CBOR map.
+  reply = send({{"Content-Type", "application/cbor"}}, "\xa0", &mime_type);
+  EXPECT_EQ("application/cbor", mime_type);
+
+  // Replies are compressed if the client accepts it, gzip preferred.
+  reply = send({{"Accept-Encoding", "deflate, gzip"}}, {}, &mime_type);
+  EXPECT_EQ("application/json", mime_type);
+  EXPECT_EQ("gzip", content_encoding);
+  EXPECT_EQ("\x1f\x8b", reply.substr(0, 2));
+
+  reply = send({{"Accept-Encoding", "gzip;q=0, deflate"}}, {}, &mime_type);
+  EXPECT_EQ("deflate", content_encoding);
+  EXPECT_EQ('\x78', reply[0]);
+
+  reply = send({{"Accept-Encoding", "br"}}, {}, &mime_type);
+  EXPECT_TRUE(content_encoding.empty());
+  EXPECT_EQ('{', reply[0]);
+}
+
 TEST_F(WeaveBasicTest, Register) {
   EXPECT_CALL(network_, OpenSslSocket(_, _, _)).WillRepeatedly(Return());
   StartDevice();
@@ -543,6 +697,23 @@ TEST_F(WeaveWiFiSetupTest, StartOfflineWithSsid) {
   StartDevice();
 }
 
+// Network failures don't wait for the monitoring timeout.
+TEST_F(WeaveWiFiSetupTest, ErrorWithSsid) {
+  EXPECT_CALL(config_store_, LoadSettings())
+      .WillRepeatedly(Return(R"({"last_configured_ssid": "TEST_ssid"})"));
+  StartDevice();
+
+  NotifyNetworkChanged(Network::State::kError, {});
+  auto failed_at = task_runner_.GetClock()->Now();
+  EXPECT_CALL(wifi_, StartAccessPoint(MatchesRegex("TEST_NAME.*prv")))
+      .WillOnce(InvokeWithoutArgs([this, failed_at]() {
+        EXPECT_LT(task_runner_.GetClock()->Now() - failed_at,
+                  base::TimeDelta::FromSeconds(1));
+        task_runner_.Break();
+      }));
+  task_runner_.Run();
+}
+
 TEST_F(WeaveWiFiSetupTest, OfflineLongTimeWithNoSsid) {
   EXPECT_CALL(network_, GetConnectionState())
       .WillRepeatedly(Return(Network::State::kOffline));
@@ -0,0 +1,29 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/worker_task.h"
+
+namespace weave {
+
+void WorkerReplySequence::Reply(uint64_t number, const base::Closure& reply) {
+  CHECK_GE(number, next_reply_);
+  CHECK_LE(number, last_reserved_);
+  ready_[number] = reply;
+  // A reply may post more work; its replies are run by the loop below.
+  if (draining_)
+    return;
+  draining_ = true;
+  auto weak = AsWeakPtr();
+  while (!ready_.empty() && ready_.begin()->first == next_reply_) {
+    base::Closure next = ready_.begin()->second;
+    ready_.erase(ready_.begin());
+    ++next_reply_;
+    next.Run();
+    if (!weak)
+      return;
+  }
+  draining_ = false;
+}
+
+}  // namespace weave
@@ -0,0 +1,123 @@
+// Copyright 2015 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIBWEAVE_SRC_WORKER_TASK_H_
+#define LIBWEAVE_SRC_WORKER_TASK_H_
+
+#include <map>
+#include <memory>
+#include <utility>
+
+#include <base/bind.h>
+#include <base/callback.h>
+#include <base/location.h>
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <weave/provider/worker_pool.h>
+
+namespace weave {
+
+// Runs the replies of PostWorkerTaskAndReply() in the order the tasks were
+// posted, so a large response parsed on the worker pool isn't overtaken by a
+// later small one parsed inline. Only used on the task runner thread.
+class WorkerReplySequence final {
+ public:
+  WorkerReplySequence() = default;
+
+  // Returns the number of the next reply.
+  uint64_t Reserve() { return ++last_reserved_; }
+
+  // Runs |reply| once the replies of all the lower numbers have run.
+  void Reply(uint64_t number, const base::Closure& reply);
+
+  base::WeakPtr<WorkerReplySequence> AsWeakPtr() {
+    return weak_ptr_factory_.GetWeakPtr();
+  }
+
+ private:
+  uint64_t last_reserved_{0};
+  uint64_t next_reply_{1};
+  // Replies which finished ahead of their turn.
+  std::map<uint64_t, base::Closure> ready_;
+  bool draining_{false};
+
+  base::WeakPtrFactory<WorkerReplySequence> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(WorkerReplySequence);
+};
+
+namespace internal {
+
+template <typename Result>
+struct WorkerTask {
+  tracked_objects::Location from_here;
+  base::Callback<Result()> task;
+  base::Callback<void(Result)> reply;
+  Result result;
+  base::WeakPtr<WorkerReplySequence> sequence;
+  uint64_t sequence_number;
+};
+
+template <typename Result>
+void RunWorkerTaskReplyNow(WorkerTask<Result>* worker_task) {
+  worker_task->reply.Run(std::move(worker_task->result));
+}
+
+template <typename Result>
+void RunWorkerTaskReply(WorkerTask<Result>* worker_task) {
+  if (!worker_task->sequence_number) {
+    std::unique_ptr<WorkerTask<Result>> owned{worker_task};
+    return RunWorkerTaskReplyNow(worker_task);
+  }
+  if (!worker_task->sequence) {
+    delete worker_task;
+    return;
+  }
+  worker_task->sequence->Reply(
+      worker_task->sequence_number,
+      base::Bind(&RunWorkerTaskReplyNow<Result>, base::Owned(worker_task)));
+}
+
+// The closures posted hold only raw pointers, so it doesn't matter on which
+// thread their last copy goes away. The callbacks, and whatever is bound to
+// them, are destroyed after the reply on the task runner thread.
+template <typename Result>
+void RunWorkerTask(WorkerTask<Result>* worker_task) {
+  worker_task->result = worker_task->task.Run();
+}
+
+}  // namespace internal
+
+// Runs |task| on |worker_pool|, and then |reply| with its result on the task
+// runner thread, where the WorkerPool provider delivers it. |task| must only
+// use the data bound to it, which must not be used on the task runner thread
+// until |reply| runs. If |worker_pool| is null, both run right away, so
+// callers may pass null for the work not worth a thread hop. If |sequence| is
+// not null, |reply| waits for the replies posted to it before, whether they
+// were offloaded or not; it's dropped if |sequence| is destroyed first.
+// |Result| must be default constructible and movable.
+template <typename Result>
+void PostWorkerTaskAndReply(provider::WorkerPool* worker_pool,
+                            WorkerReplySequence* sequence,
+                            const tracked_objects::Location& from_here,
+                            const base::Callback<Result()>& task,
+                            const base::Callback<void(Result)>& reply) {
+  if (!worker_pool && !sequence)
+    return reply.Run(task.Run());
+
+  auto worker_task = new internal::WorkerTask<Result>{
+      from_here, task, reply, Result{},
+      sequence ? sequence->AsWeakPtr() : base::WeakPtr<WorkerReplySequence>{},
+      sequence ? sequence->Reserve() : 0};
+  if (!worker_pool) {
+    internal::RunWorkerTask(worker_task);
+    return internal::RunWorkerTaskReply(worker_task);
+  }
+  worker_pool->PostTaskAndReply(
+      from_here, base::Bind(&internal::RunWorkerTask<Result>, worker_task),
+      base::Bind(&internal::RunWorkerTaskReply<Result>, worker_task));
+}
+
+}  // namespace weave
+
+#endif  // LIBWEAVE_SRC_WORKER_TASK_H_
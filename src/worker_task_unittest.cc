@@ -0,0 +1,81 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/worker_task.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <weave/provider/test/mock_worker_pool.h>
+
+namespace weave {
+
+using testing::_;
+using testing::Invoke;
+
+namespace {
+
+int Identity(int value) {
+  return value;
+}
+
+void Append(std::vector<int>* replies, int value) {
+  replies->push_back(value);
+}
+
+class WorkerTaskTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    EXPECT_CALL(worker_pool_, PostTaskAndReply(_, _, _))
+        .WillRepeatedly(Invoke([this](const tracked_objects::Location&,
+                                      const base::Closure& task,
+                                      const base::Closure& reply) {
+          tasks_.push_back(task);
+          worker_replies_.push_back(reply);
+        }));
+  }
+
+  void Post(provider::WorkerPool* worker_pool, int value) {
+    PostWorkerTaskAndReply(worker_pool, sequence_.get(), FROM_HERE,
+                           base::Bind(&Identity, value),
+                           base::Bind(&Append, &replies_));
+  }
+
+  std::unique_ptr<WorkerReplySequence> sequence_{new WorkerReplySequence};
+  testing::StrictMock<provider::test::MockWorkerPool> worker_pool_;
+  std::vector<base::Closure> tasks_;
+  std::vector<base::Closure> worker_replies_;
+  std::vector<int> replies_;
+};
+
+}  // namespace
+
+TEST_F(WorkerTaskTest, RepliesInOrder) {
+  Post(&worker_pool_, 1);
+  Post(nullptr, 2);
+  Post(&worker_pool_, 3);
+  Post(nullptr, 4);
+  EXPECT_TRUE(replies_.empty());
+
+  for (const auto& task : tasks_)
+    task.Run();
+  worker_replies_[1].Run();
+  EXPECT_TRUE(replies_.empty());
+  worker_replies_[0].Run();
+  EXPECT_EQ((std::vector<int>{1, 2, 3, 4}), replies_);
+
+  // With nothing outstanding, inline replies run right away.
+  Post(nullptr, 5);
+  EXPECT_EQ(5u, replies_.size());
+}
+
+TEST_F(WorkerTaskTest, SequenceDestroyed) {
+  Post(&worker_pool_, 1);
+  sequence_.reset();
+  tasks_[0].Run();
+  worker_replies_[0].Run();
+  EXPECT_TRUE(replies_.empty());
+}
+
+}  // namespace weave
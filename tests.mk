@@ -37,7 +37,7 @@ out/$(BUILD_MODE)/libweave_testrunner : \
 	out/$(BUILD_MODE)/libweave-test.a \
 	$(third_party_gtest_lib) \
 	$(third_party_gmock_lib)
-	$(CXX) -o $@ $^ $(CFLAGS) -lcrypto -lexpat -lpthread -lrt
+	$(CXX) -o $@ $^ $(CFLAGS) $(LDFLAGS_$(BUILD_MODE)) -lcrypto -lexpat -lpthread -lrt -lz
 
 test : out/$(BUILD_MODE)/libweave_testrunner
 	$(TEST_ENV) $< $(TEST_FLAGS)
@@ -58,7 +58,7 @@ out/$(BUILD_MODE)/libweave_exports_testrunner : \
 	out/$(BUILD_MODE)/src/test/weave_testrunner.o \
 	$(third_party_gtest_lib) \
 	$(third_party_gmock_lib)
-	$(CXX) -o $@ $^ $(CFLAGS) -lcrypto -lexpat -lpthread -lrt -Wl,-rpath=out/$(BUILD_MODE)/
+	$(CXX) -o $@ $^ $(CFLAGS) $(LDFLAGS_$(BUILD_MODE)) -lcrypto -lexpat -lpthread -lrt -lz -Wl,-rpath=out/$(BUILD_MODE)/
 
 export-test : out/$(BUILD_MODE)/libweave_exports_testrunner
 	$(TEST_ENV) $< $(TEST_FLAGS)
@@ -66,6 +66,100 @@ export-test : out/$(BUILD_MODE)/libweave_exports_testrunner
 testall : test export-test
 check : testall
 
+###
+# benchmarks
+
+BENCHMARK_FLAGS ?=
+
+weave_benchmark_obj_files := $(WEAVE_BENCHMARK_SRC_FILES:%.cc=out/$(BUILD_MODE)/%.o)
+
+$(weave_benchmark_obj_files) : out/$(BUILD_MODE)/%.o : %.cc
+	mkdir -p $(dir $@)
+	$(CXX) $(DEFS_TEST) $(INCLUDES) $(CFLAGS) $(CFLAGS_$(BUILD_MODE)) $(CFLAGS_CC) -c -o $@ $<
+
+out/$(BUILD_MODE)/libweave_benchmark : \
+	$(weave_benchmark_obj_files) \
+	out/$(BUILD_MODE)/libweave_common.a \
+	out/$(BUILD_MODE)/libweave-test.a \
+	$(third_party_gtest_lib) \
+	$(third_party_gmock_lib)
+	$(CXX) -o $@ $^ $(CFLAGS) $(LDFLAGS_$(BUILD_MODE)) -lcrypto -lexpat -lpthread -lrt -lz
+
+# Run with BUILD_MODE=Release for meaningful numbers, e.g.
+#   make benchmark BUILD_MODE=Release BENCHMARK_FLAGS=--filter=Json
+benchmark : out/$(BUILD_MODE)/libweave_benchmark
+	$(TEST_ENV) $< $(BENCHMARK_FLAGS)
+
+###
+# load generator
+
+LOAD_FLAGS ?=
+
+weave_load_generator_obj_files := $(WEAVE_LOAD_GENERATOR_SRC_FILES:%.cc=out/$(BUILD_MODE)/%.o)
+
+$(weave_load_generator_obj_files) : out/$(BUILD_MODE)/%.o : %.cc
+	mkdir -p $(dir $@)
+	$(CXX) $(DEFS_TEST) $(INCLUDES) $(CFLAGS) $(CFLAGS_$(BUILD_MODE)) $(CFLAGS_CC) -c -o $@ $<
+
+out/$(BUILD_MODE)/libweave_load_generator : \
+	$(weave_load_generator_obj_files) \
+	out/$(BUILD_MODE)/libweave_common.a \
+	out/$(BUILD_MODE)/libweave-test.a \
+	$(third_party_gtest_lib) \
+	$(third_party_gmock_lib)
+	$(CXX) -o $@ $^ $(CFLAGS) $(LDFLAGS_$(BUILD_MODE)) -lcrypto -lexpat -lpthread -lrt -lz
+
+# e.g. make load-test BUILD_MODE=Release LOAD_FLAGS="--components=32 --rate=50"
+load-test : out/$(BUILD_MODE)/libweave_load_generator
+	$(TEST_ENV) $< $(LOAD_FLAGS)
+
+###
+# soak test
+
+SOAK_FLAGS ?=
+
+weave_soak_test_obj_files := $(WEAVE_SOAK_TEST_SRC_FILES:%.cc=out/$(BUILD_MODE)/%.o)
+
+$(weave_soak_test_obj_files) : out/$(BUILD_MODE)/%.o : %.cc
+	mkdir -p $(dir $@)
+	$(CXX) $(DEFS_TEST) $(INCLUDES) $(CFLAGS) $(CFLAGS_$(BUILD_MODE)) $(CFLAGS_CC) -c -o $@ $<
+
+out/$(BUILD_MODE)/libweave_soak_test : \
+	$(weave_soak_test_obj_files) \
+	out/$(BUILD_MODE)/libweave_common.a \
+	out/$(BUILD_MODE)/libweave-test.a \
+	$(third_party_gtest_lib) \
+	$(third_party_gmock_lib)
+	$(CXX) -o $@ $^ $(CFLAGS) $(LDFLAGS_$(BUILD_MODE)) -lcrypto -lexpat -lpthread -lrt -lz
+
+# Fails if a queue keeps growing, e.g.
+#   make soak-test BUILD_MODE=Release SOAK_FLAGS="--days=14 --sensor_rate=5"
+soak-test : out/$(BUILD_MODE)/libweave_soak_test
+	$(TEST_ENV) $< $(SOAK_FLAGS)
+
+###
+# traffic replay
+
+REPLAY_FLAGS ?=
+
+weave_traffic_replay_obj_files := $(WEAVE_TRAFFIC_REPLAY_SRC_FILES:%.cc=out/$(BUILD_MODE)/%.o)
+
+$(weave_traffic_replay_obj_files) : out/$(BUILD_MODE)/%.o : %.cc
+	mkdir -p $(dir $@)
+	$(CXX) $(DEFS_TEST) $(INCLUDES) $(CFLAGS) $(CFLAGS_$(BUILD_MODE)) $(CFLAGS_CC) -c -o $@ $<
+
+out/$(BUILD_MODE)/libweave_traffic_replay : \
+	$(weave_traffic_replay_obj_files) \
+	out/$(BUILD_MODE)/libweave_common.a \
+	out/$(BUILD_MODE)/libweave-test.a \
+	$(third_party_gtest_lib) \
+	$(third_party_gmock_lib)
+	$(CXX) -o $@ $^ $(CFLAGS) $(LDFLAGS_$(BUILD_MODE)) -lcrypto -lexpat -lpthread -lrt -lz
+
+# e.g. make replay BUILD_MODE=Release METRICS=1 REPLAY_FLAGS=--trace=trace.json
+replay : out/$(BUILD_MODE)/libweave_traffic_replay
+	$(TEST_ENV) $< $(REPLAY_FLAGS)
+
 ###
 # coverage
 # This runs coverage against unit tests, invoke with "make coverage".
@@ -82,4 +176,4 @@ run_coverage: test
 
 coverage: run_coverage
 
-.PHONY : check coverage run_coverage test export-test testall
+.PHONY : benchmark check coverage load-test replay run_coverage soak-test test export-test testall
@@ -10,6 +10,7 @@
 #include "examples/daemon/common/daemon.h"
 #include "tests_schema/daemon/testdevice/custom_traits.h"
 #include "tests_schema/daemon/testdevice/standard_traits.h"
+#include "tests_schema/daemon/testdevice/standard_traits_table.h"
 
 #include <weave/device.h>
 #include <weave/enum_to_string.h>
@@ -40,7 +41,8 @@ class TestDeviceHandler {
   void Register(weave::Device* device) {
     device_ = device;
 
-    device->AddTraitDefinitionsFromJson(standard_traits::kTraits);
+    device->EnableLazyTraits();
+    device->AddTraitDefinitionsFromTable(standard_traits::kTraits);
     device->AddTraitDefinitionsFromJson(custom_traits::kCustomTraits);
 
     CHECK(device->AddComponent(
@@ -11,7 +11,8 @@ TESTS_SCHEMA_DAEMON_SRC_FILES := \
 tests_schema_daemon_obj_files := $(TESTS_SCHEMA_DAEMON_SRC_FILES:%.cc=out/$(BUILD_MODE)/%.o)
 
 $(tests_schema_daemon_obj_files) : $(LIBEVHTP_HEADERS)
-$(tests_schema_daemon_obj_files) : INCLUDES += $(LIBEVHTP_INCLUDES)
+$(tests_schema_daemon_obj_files) : out/$(BUILD_MODE)/gen/tests_schema/daemon/testdevice/standard_traits_table.h
+$(tests_schema_daemon_obj_files) : INCLUDES += $(LIBEVHTP_INCLUDES) -Iout/$(BUILD_MODE)/gen
 $(tests_schema_daemon_obj_files) : out/$(BUILD_MODE)/%.o : %.cc
 	mkdir -p $(dir $@)
 	$(CXX) $(DEFS_$(BUILD_MODE)) $(INCLUDES) $(CFLAGS) $(CFLAGS_$(BUILD_MODE)) $(CFLAGS_CC) -c -o $@ $<
@@ -37,7 +38,7 @@ tests_schema_daemon_common_flags += -levhtp
 endif
 
 out/$(BUILD_MODE)/weave_daemon_testdevice : out/$(BUILD_MODE)/tests_schema/daemon/testdevice/testdevice.o $(tests_schema_daemon_deps)
-	$(CXX) -o $@ $^ $(CFLAGS) $(tests_schema_daemon_common_flags)
+	$(CXX) -o $@ $^ $(CFLAGS) $(LDFLAGS_$(BUILD_MODE)) $(tests_schema_daemon_common_flags)
 
 all-testdevices : out/$(BUILD_MODE)/weave_daemon_testdevice
 
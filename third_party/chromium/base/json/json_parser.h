@@ -47,6 +47,7 @@ class JSONParserTest;
 class BASE_EXPORT JSONParser {
  public:
   explicit JSONParser(int options);
+  JSONParser(int options, const JSONReaderLimits& limits);
   ~JSONParser();
 
   // Parses the input string according to the set options and returns the
@@ -108,6 +109,11 @@ class BASE_EXPORT JSONParser {
     // AppendString below.
     void Append(const char& c);
 
+    // Same as Append() for |length| basic ASCII characters at |run|. Unless
+    // the builder has been converted, |run| must directly follow the
+    // characters appended so far.
+    void AppendRun(const char* run, size_t length);
+
     // Appends a string to the std::string. Must be Convert()ed to use.
     void AppendString(const std::string& str);
 
@@ -221,6 +227,14 @@ class BASE_EXPORT JSONParser {
   // base::JSONParserOptions that control parsing.
   int options_;
 
+  // Limits of the input, see JSONReaderLimits.
+  int max_depth_;
+  size_t max_nodes_;
+  size_t max_size_;
+
+  // The number of values parsed so far.
+  size_t node_count_;
+
   // Pointer to the start of the input data.
   const char* start_pos_;
 
@@ -253,6 +267,7 @@ class BASE_EXPORT JSONParser {
   FRIEND_TEST_ALL_PREFIXES(JSONParserTest, ConsumeDictionary);
   FRIEND_TEST_ALL_PREFIXES(JSONParserTest, ConsumeList);
   FRIEND_TEST_ALL_PREFIXES(JSONParserTest, ConsumeString);
+  FRIEND_TEST_ALL_PREFIXES(JSONParserTest, ConsumeLongStrings);
   FRIEND_TEST_ALL_PREFIXES(JSONParserTest, ConsumeLiterals);
   FRIEND_TEST_ALL_PREFIXES(JSONParserTest, ConsumeNumbers);
   FRIEND_TEST_ALL_PREFIXES(JSONParserTest, ErrorMessages);
@@ -324,5 +324,83 @@ TEST_F(JSONParserTest, DecodeUnicodeNonCharacter) {
   EXPECT_FALSE(JSONReader::Read("[\"\\ud83f\\udffe\"]"));
 }
 
+TEST_F(JSONParserTest, ConsumeLongStrings) {
+  // Put the special characters at every offset within the eight characters
+  // scanned at once.
+  const std::string kPlain = "abcdefghijklmnopqrstuvwxyz012345";
+  for (size_t i = 0; i <= kPlain.size(); i++) {
+    std::string head = kPlain.substr(0, i);
+    std::string tail = kPlain.substr(i);
+    const std::pair<std::string, std::string> kCases[] = {
+        {head + tail, head + tail},
+        {head + "\\\"" + tail, head + "\"" + tail},
+        {head + "\\n" + tail, head + "\n" + tail},
+        {head + "\\u00e9" + tail, head + "\xc3\xa9" + tail},
+        {head + "\xc3\xa9" + tail, head + "\xc3\xa9" + tail},
+        {head + "\t" + tail, head + "\t" + tail},
+    };
+    for (const auto& test : kCases) {
+      std::string input = "\"" + test.first + "\",|";
+      std::unique_ptr<JSONParser> parser(NewTestParser(input));
+      std::unique_ptr<Value> value(parser->ConsumeString());
+      EXPECT_EQ('"', *parser->pos_);
+      TestLastThree(parser.get());
+
+      ASSERT_TRUE(value.get()) << input;
+      std::string str;
+      EXPECT_TRUE(value->GetAsString(&str));
+      EXPECT_EQ(test.second, str);
+    }
+
+    std::unique_ptr<JSONParser> parser(
+        NewTestParser("\"" + head + "\xff" + tail + "\""));
+    EXPECT_FALSE(parser->ConsumeString());
+  }
+
+  EXPECT_FALSE(JSONReader::Read("[\"" + kPlain + kPlain));
+  std::unique_ptr<Value> value = JSONReader::Read(
+      "{\"" + kPlain + "\": [\"" + kPlain + "\", \"" + kPlain + "\"]}");
+  ASSERT_TRUE(value);
+  const DictionaryValue* dict = nullptr;
+  ASSERT_TRUE(value->GetAsDictionary(&dict));
+  const ListValue* list = nullptr;
+  ASSERT_TRUE(dict->GetListWithoutPathExpansion(kPlain, &list));
+  std::string str;
+  EXPECT_TRUE(list->GetString(1, &str));
+  EXPECT_EQ(kPlain, str);
+}
+
+TEST_F(JSONParserTest, Limits) {
+  const std::string kJson = "{\"a\": [1, {\"b\": 2}], \"c\": \"d\"}";
+  JSONReaderLimits limits;
+  limits.max_depth = 3;
+  limits.max_nodes = 6;
+  limits.max_size = kJson.size();
+  int error_code = 0;
+  std::string error_message;
+  EXPECT_TRUE(JSONReader::ReadWithLimits(kJson, JSON_PARSE_RFC, limits,
+                                         &error_code, &error_message));
+
+  limits.max_depth = 2;
+  EXPECT_FALSE(JSONReader::ReadWithLimits(kJson, JSON_PARSE_RFC, limits,
+                                          &error_code, &error_message));
+  EXPECT_EQ(JSONReader::JSON_TOO_MUCH_NESTING, error_code);
+  EXPECT_EQ(std::string("Line: 1, column: 11, ") + JSONReader::kTooMuchNesting,
+            error_message);
+
+  limits.max_depth = 0;
+  limits.max_nodes = 5;
+  EXPECT_FALSE(JSONReader::ReadWithLimits(kJson, JSON_PARSE_RFC, limits,
+                                          &error_code, &error_message));
+  EXPECT_EQ(JSONReader::JSON_TOO_MANY_NODES, error_code);
+
+  limits.max_nodes = 0;
+  limits.max_size = kJson.size() - 1;
+  EXPECT_FALSE(JSONReader::ReadWithLimits(kJson, JSON_PARSE_RFC, limits,
+                                          &error_code, &error_message));
+  EXPECT_EQ(JSONReader::JSON_TOO_LARGE, error_code);
+  EXPECT_EQ(JSONReader::kTooLarge, error_message);
+}
+
 }  // namespace internal
 }  // namespace base
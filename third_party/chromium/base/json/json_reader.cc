@@ -30,6 +30,10 @@ const char JSONReader::kUnsupportedEncoding[] =
     "Unsupported encoding. JSON must be UTF-8.";
 const char JSONReader::kUnquotedDictionaryKey[] =
     "Dictionary keys must be quoted.";
+const char JSONReader::kTooManyNodes[] =
+    "Too many values.";
+const char JSONReader::kTooLarge[] =
+    "Input too large.";
 
 JSONReader::JSONReader()
     : JSONReader(JSON_PARSE_RFC) {
@@ -79,6 +83,24 @@ std::unique_ptr<Value> JSONReader::ReadAndReturnError(
   return root;
 }
 
+// static
+std::unique_ptr<Value> JSONReader::ReadWithLimits(
+    const StringPiece& json,
+    int options,
+    const JSONReaderLimits& limits,
+    int* error_code_out,
+    std::string* error_msg_out) {
+  internal::JSONParser parser(options, limits);
+  std::unique_ptr<Value> root(parser.Parse(json));
+  if (!root) {
+    if (error_code_out)
+      *error_code_out = parser.error_code();
+    if (error_msg_out)
+      *error_msg_out = parser.GetErrorMessage();
+  }
+  return root;
+}
+
 // static
 std::string JSONReader::ErrorCodeToString(JsonParseError error_code) {
   switch (error_code) {
@@ -100,6 +122,10 @@ std::string JSONReader::ErrorCodeToString(JsonParseError error_code) {
       return kUnsupportedEncoding;
     case JSON_UNQUOTED_DICTIONARY_KEY:
       return kUnquotedDictionaryKey;
+    case JSON_TOO_MANY_NODES:
+      return kTooManyNodes;
+    case JSON_TOO_LARGE:
+      return kTooLarge;
     default:
       NOTREACHED();
       return std::string();
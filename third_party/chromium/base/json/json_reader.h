@@ -28,6 +28,8 @@
 #ifndef BASE_JSON_JSON_READER_H_
 #define BASE_JSON_JSON_READER_H_
 
+#include <stddef.h>
+
 #include <memory>
 #include <string>
 
@@ -57,6 +59,18 @@ enum JSONParserOptions {
   JSON_DETACHABLE_CHILDREN = 1 << 1,
 };
 
+// Limits of the input accepted by the parser, checked while parsing so the
+// input over them is rejected early. Zero means no limit, except that nesting
+// is always limited to 99 levels to bound the recursion.
+struct JSONReaderLimits {
+  // Nesting of dictionaries and lists, the root being at depth 1.
+  size_t max_depth = 0;
+  // Values, including the dictionaries and lists.
+  size_t max_nodes = 0;
+  // Bytes of the input.
+  size_t max_size = 0;
+};
+
 class BASE_EXPORT JSONReader {
  public:
   // Error codes during parsing.
@@ -70,6 +84,8 @@ class BASE_EXPORT JSONReader {
     JSON_UNEXPECTED_DATA_AFTER_ROOT,
     JSON_UNSUPPORTED_ENCODING,
     JSON_UNQUOTED_DICTIONARY_KEY,
+    JSON_TOO_MANY_NODES,
+    JSON_TOO_LARGE,
     JSON_PARSE_ERROR_COUNT
   };
 
@@ -82,6 +98,8 @@ class BASE_EXPORT JSONReader {
   static const char kUnexpectedDataAfterRoot[];
   static const char kUnsupportedEncoding[];
   static const char kUnquotedDictionaryKey[];
+  static const char kTooManyNodes[];
+  static const char kTooLarge[];
 
   // Constructs a reader with the default options, JSON_PARSE_RFC.
   JSONReader();
@@ -112,6 +130,15 @@ class BASE_EXPORT JSONReader {
       int* error_line_out = nullptr,
       int* error_column_out = nullptr);
 
+  // Same as ReadAndReturnError(), but fails with JSON_TOO_MUCH_NESTING,
+  // JSON_TOO_MANY_NODES or JSON_TOO_LARGE as soon as the input goes over
+  // |limits|, without reading the rest of it.
+  static std::unique_ptr<Value> ReadWithLimits(const StringPiece& json,
+                                               int options,
+                                               const JSONReaderLimits& limits,
+                                               int* error_code_out,
+                                               std::string* error_msg_out);
+
   // Converts a JSON parse error code into a human readable message.
   // Returns an empty string if error_code is JSON_NO_ERROR.
   static std::string ErrorCodeToString(JsonParseError error_code);
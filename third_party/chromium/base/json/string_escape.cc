@@ -7,6 +7,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <string.h>
+
+#include <algorithm>
 #include <limits>
 #include <string>
 
@@ -77,6 +80,39 @@ bool EscapeSpecialCodePoint(uint32_t code_point, std::string* dest) {
   return true;
 }
 
+// Returns the number of characters at the start of |str| (of |length| bytes)
+// which are printable ASCII copied to the output as is, i.e. everything but
+// control characters, '"', '\\', '<' and bytes of multi-byte sequences.
+// Eight bytes are checked at a time.
+size_t GetPlainRunLength(const char* str, size_t length) {
+  const uint64_t kOnes = 0x0101010101010101ULL;
+  const uint64_t kHighBits = 0x8080808080808080ULL;
+  size_t run = 0;
+  while (length - run >= 8) {
+    uint64_t word;
+    memcpy(&word, str + run, sizeof(word));
+    // (x - kOnes * n) & ~x & kHighBits is non-zero iff some byte of x is below
+    // n (n <= 0x80); with n = 1 it finds the zero bytes of the XORed words.
+    uint64_t quote = word ^ (kOnes * '"');
+    uint64_t backslash = word ^ (kOnes * '\\');
+    uint64_t less = word ^ (kOnes * '<');
+    uint64_t special = word | ((word - kOnes * 0x20) & ~word) |
+                       ((quote - kOnes) & ~quote) |
+                       ((backslash - kOnes) & ~backslash) |
+                       ((less - kOnes) & ~less);
+    if (special & kHighBits)
+      break;
+    run += 8;
+  }
+  while (run < length) {
+    unsigned char c = str[run];
+    if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\' || c == '<')
+      break;
+    ++run;
+  }
+  return run;
+}
+
 template <typename S>
 bool EscapeJSONStringImpl(const S& str, bool put_in_quotes, std::string* dest) {
   bool did_replacement = false;
@@ -88,8 +124,22 @@ bool EscapeJSONStringImpl(const S& str, bool put_in_quotes, std::string* dest) {
   CHECK_LE(str.length(),
            static_cast<size_t>(std::numeric_limits<int32_t>::max()));
   const int32_t length = static_cast<int32_t>(str.length());
+  // Most strings need no escaping at all, so reserve for the plain copy. The
+  // capacity is at least doubled, so appending many strings to the same
+  // |dest| stays linear.
+  size_t size = dest->size() + str.length() + (put_in_quotes ? 2 : 0);
+  if (size > dest->capacity())
+    dest->reserve(std::max(size, 2 * dest->capacity()));
 
   for (int32_t i = 0; i < length; ++i) {
+    size_t run = GetPlainRunLength(str.data() + i, length - i);
+    if (run > 0) {
+      dest->append(str.data() + i, run);
+      // Leave |i| on the last copied character, the loop skips it.
+      i += static_cast<int32_t>(run) - 1;
+      continue;
+    }
+
     uint32_t code_point;
     if (!ReadUnicodeCharacter(str.data(), length, &i, &code_point)) {
       code_point = kReplacementCodePoint;
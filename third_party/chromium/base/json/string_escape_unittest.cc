@@ -73,6 +73,38 @@ TEST(JSONStringEscapeTest, EscapeUTF8) {
   EXPECT_TRUE(IsStringUTF8(out));
 }
 
+TEST(JSONStringEscapeTest, EscapeLongUTF8) {
+  // Put each special character at every offset of a run of plain characters,
+  // so that it is met both in the middle and at the ends of a scanned word.
+  const struct {
+    const char* to_escape;
+    const char* escaped;
+  } cases[] = {
+    {"\"", "\\\""},
+    {"\\", "\\\\"},
+    {"<", "\\u003C"},
+    {"\n", "\\n"},
+    {"\x1f", "\\u001F"},
+    {"\x7f", "\x7f"},
+    {"\xc3\xa9", "\xc3\xa9"},
+    {"\xe2\x80\xa8", "\\u2028"},
+    {"\xff", "\xEF\xBF\xBD"},
+  };
+  const std::string plain(20, 'x');
+  for (const auto& test_case : cases) {
+    for (size_t i = 0; i <= plain.size(); ++i) {
+      std::string in = plain;
+      in.insert(i, test_case.to_escape);
+      std::string expected = plain;
+      expected.insert(i, test_case.escaped);
+
+      std::string out = "a";
+      EscapeJSONString(in, true, &out);
+      EXPECT_EQ("a\"" + expected + "\"", out) << in;
+    }
+  }
+}
+
 TEST(JSONStringEscapeTest, EscapeBytes) {
   const struct {
     const char* to_escape;
@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include "base/logging.h"
@@ -15,19 +16,14 @@
 
 namespace {
 
-class URandomFd {
- public:
-  URandomFd() : fd_(open("/dev/urandom", O_RDONLY)) {
-    DCHECK_GE(fd_, 0) << "Cannot open /dev/urandom: " << errno;
-  }
-
-  ~URandomFd() { close(fd_); }
-
-  int fd() const { return fd_; }
-
- private:
-  const int fd_;
-};
+// Opened once and kept open for the life of the process, rather than opened
+// and closed for every call.
+int GetURandomFd() {
+  static const int fd =
+      HANDLE_EINTR(open("/dev/urandom", O_RDONLY | O_CLOEXEC));
+  DCHECK_GE(fd, 0) << "Cannot open /dev/urandom: " << errno;
+  return fd;
+}
 
 bool ReadFromFD(int fd, char* buffer, size_t bytes) {
   size_t total_read = 0;
@@ -41,6 +37,28 @@ bool ReadFromFD(int fd, char* buffer, size_t bytes) {
   return total_read == bytes;
 }
 
+// Fills |buffer| with getrandom(), a single syscall which needs no file
+// descriptor. Returns false if the kernel doesn't have it.
+bool GetRandom(char* buffer, size_t bytes) {
+#if defined(SYS_getrandom)
+  size_t total_read = 0;
+  while (total_read < bytes) {
+    // Requests over 256 bytes may be filled partially.
+    long bytes_read =
+        HANDLE_EINTR(syscall(SYS_getrandom, buffer + total_read,
+                             bytes - total_read, 0));
+    if (bytes_read < 0) {
+      DCHECK_EQ(ENOSYS, errno);
+      return false;
+    }
+    total_read += bytes_read;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
 }  // namespace
 
 namespace base {
@@ -53,9 +71,10 @@ uint64_t RandUint64() {
 }
 
 void RandBytes(void* output, size_t output_length) {
-  URandomFd urandom_fd;
+  if (GetRandom(static_cast<char*>(output), output_length))
+    return;
   const bool success =
-      ReadFromFD(urandom_fd.fd(), static_cast<char*>(output), output_length);
+      ReadFromFD(GetURandomFd(), static_cast<char*>(output), output_length);
   CHECK(success);
 }
 
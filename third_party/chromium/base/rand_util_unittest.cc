@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <limits>
 #include <memory>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -53,6 +54,15 @@ TEST(RandUtilTest, RandBytes) {
   EXPECT_GT(std::unique(buffer, buffer + buffer_size) - buffer, 25);
 }
 
+// Large requests may be filled in several parts, the end is random too.
+TEST(RandUtilTest, RandBytesLarge) {
+  std::vector<char> buffer(64 * 1024);
+  base::RandBytes(buffer.data(), buffer.size());
+  std::sort(buffer.end() - 50, buffer.end());
+  EXPECT_GT(std::unique(buffer.end() - 50, buffer.end()) - (buffer.end() - 50),
+            25);
+}
+
 TEST(RandUtilTest, RandBytesAsString) {
   std::string random_string = base::RandBytesAsString(1);
   EXPECT_EQ(1U, random_string.size());
@@ -4,9 +4,11 @@
 
 #include "base/values.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <ostream>
 #include <utility>
@@ -67,9 +69,134 @@ std::unique_ptr<Value> CopyWithoutEmptyChildren(const Value& node) {
   }
 }
 
+// The regions are allocated in blocks aligned to their size, so the region
+// of a Value is found from its address. Every block starts with a pointer to
+// its region.
+const size_t kArenaBlockSize = 16 * 1024;
+const size_t kArenaAlignment = 16;
+
+thread_local ScopedValueArena* g_current_arena = nullptr;
+// Set by ~Value() for the operator delete called right after it.
+thread_local bool g_deleting_arena_value = false;
+
+ValueAllocateFunction g_allocate_function = nullptr;
+ValueFreeFunction g_free_function = nullptr;
+
 }  // namespace
 
+class ScopedValueArena::Region {
+ public:
+  Region() {}
+
+  // Only called on the thread of the scope.
+  void* Allocate(size_t size) {
+    size = (size + kArenaAlignment - 1) & ~(kArenaAlignment - 1);
+    if (size > kArenaBlockSize - kArenaAlignment)
+      return nullptr;
+    if (blocks_.empty() || used_ + size > kArenaBlockSize) {
+      void* block = nullptr;
+      if (posix_memalign(&block, kArenaBlockSize, kArenaBlockSize) != 0)
+        return nullptr;
+      *static_cast<Region**>(block) = this;
+      blocks_.push_back(static_cast<char*>(block));
+      used_ = kArenaAlignment;
+    }
+    void* ptr = blocks_.back() + used_;
+    used_ += size;
+    refs_.fetch_add(1, std::memory_order_relaxed);
+    return ptr;
+  }
+
+  bool Contains(const void* ptr) const {
+    const char* block = reinterpret_cast<const char*>(
+        reinterpret_cast<uintptr_t>(ptr) & ~(kArenaBlockSize - 1));
+    // The Value being constructed is usually in the last block.
+    return std::find(blocks_.rbegin(), blocks_.rend(), block) !=
+           blocks_.rend();
+  }
+
+  // Drops a reference held by the scope or an allocation, on any thread.
+  void Release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete this;
+  }
+
+  static Region* FromPointer(void* ptr) {
+    return *reinterpret_cast<Region**>(reinterpret_cast<uintptr_t>(ptr) &
+                                       ~(kArenaBlockSize - 1));
+  }
+
+ private:
+  ~Region() {
+    for (char* block : blocks_)
+      free(block);
+  }
+
+  // One for the scope and one for every Value allocated.
+  std::atomic<size_t> refs_{1};
+  std::vector<char*> blocks_;
+  // Bytes used in the last block.
+  size_t used_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(Region);
+};
+
+ScopedValueArena::ScopedValueArena()
+    : region_(new Region), previous_(g_current_arena) {
+  g_current_arena = this;
+}
+
+ScopedValueArena::~ScopedValueArena() {
+  DCHECK_EQ(this, g_current_arena);
+  g_current_arena = previous_;
+  region_->Release();
+}
+
+// static
+void* ScopedValueArena::Allocate(size_t size) {
+  return g_current_arena ? g_current_arena->region_->Allocate(size) : nullptr;
+}
+
+// static
+bool ScopedValueArena::Contains(const void* ptr) {
+  return g_current_arena && g_current_arena->region_->Contains(ptr);
+}
+
+// static
+void ScopedValueArena::Free(void* ptr) {
+  Region::FromPointer(ptr)->Release();
+}
+
+void SetValueAllocator(ValueAllocateFunction allocate_function,
+                       ValueFreeFunction free_function) {
+  DCHECK_EQ(!allocate_function, !free_function);
+  g_allocate_function = allocate_function;
+  g_free_function = free_function;
+}
+
 Value::~Value() {
+  g_deleting_arena_value = arena_allocated_;
+}
+
+// static
+void* Value::operator new(size_t size) {
+  void* ptr = ScopedValueArena::Allocate(size);
+  if (ptr)
+    return ptr;
+  return g_allocate_function ? g_allocate_function(size)
+                             : ::operator new(size);
+}
+
+// static
+void Value::operator delete(void* ptr, size_t size) {
+  if (ptr && g_deleting_arena_value) {
+    g_deleting_arena_value = false;
+    ScopedValueArena::Free(ptr);
+  } else if (ptr && g_free_function) {
+    g_free_function(ptr, size);
+  } else {
+    ::operator delete(ptr);
+  }
 }
 
 // static
@@ -142,9 +269,13 @@ bool Value::Equals(const Value* a, const Value* b) {
   return a->Equals(b);
 }
 
-Value::Value(Type type) : type_(type) {}
+// Values are the first base of their subclasses, so |this| is where the
+// memory was allocated.
+Value::Value(Type type)
+    : type_(type), arena_allocated_(ScopedValueArena::Contains(this)) {}
 
-Value::Value(const Value& that) : type_(that.type_) {}
+Value::Value(const Value& that)
+    : type_(that.type_), arena_allocated_(ScopedValueArena::Contains(this)) {}
 
 Value& Value::operator=(const Value& that) {
   type_ = that.type_;
@@ -316,6 +447,23 @@ bool BinaryValue::Equals(const Value* other) const {
   return !memcmp(GetBuffer(), other_binary->GetBuffer(), size_);
 }
 
+///////////////////// ValuePath ////////////////////
+
+// static
+const size_t ValuePath::kMaxKeys;
+
+ValuePath::ValuePath(StringPiece path) {
+  for (size_t delimiter_position = path.find('.');
+       delimiter_position != StringPiece::npos;
+       delimiter_position = path.find('.')) {
+    CHECK_LT(size_, kMaxKeys);
+    keys_[size_++] = path.substr(0, delimiter_position);
+    path = path.substr(delimiter_position + 1);
+  }
+  CHECK_LT(size_, kMaxKeys);
+  keys_[size_++] = path;
+}
+
 ///////////////////// DictionaryValue ////////////////////
 
 // static
@@ -349,9 +497,9 @@ bool DictionaryValue::GetAsDictionary(const DictionaryValue** out_value) const {
   return true;
 }
 
-bool DictionaryValue::HasKey(const std::string& key) const {
+bool DictionaryValue::HasKey(StringPiece key) const {
   DCHECK(IsStringUTF8(key));
-  auto current_entry = dictionary_.find(key);
+  auto current_entry = Find(key);
   DCHECK((current_entry == dictionary_.end()) || current_entry->second);
   return current_entry != dictionary_.end();
 }
@@ -409,7 +557,15 @@ void DictionaryValue::SetString(const std::string& path,
 
 void DictionaryValue::SetWithoutPathExpansion(const std::string& key,
                                               std::unique_ptr<Value> in_value) {
-  dictionary_[key] = std::move(in_value);
+  // Keys often come in sorted order, e.g. from DeepCopy() or JSON written by
+  // JSONWriter, so check for appending first.
+  Storage::iterator entry = dictionary_.end();
+  if (!dictionary_.empty() && !(dictionary_.back().first < key))
+    entry = LowerBound(key);
+  if (entry != dictionary_.end() && entry->first == key)
+    entry->second = std::move(in_value);
+  else
+    dictionary_.emplace(entry, key, std::move(in_value));
 }
 
 void DictionaryValue::SetWithoutPathExpansion(const std::string& key,
@@ -447,8 +603,7 @@ bool DictionaryValue::Get(StringPiece path,
        delimiter_position = current_path.find('.')) {
     const DictionaryValue* child_dictionary = NULL;
     if (!current_dictionary->GetDictionaryWithoutPathExpansion(
-            current_path.substr(0, delimiter_position).as_string(),
-            &child_dictionary)) {
+            current_path.substr(0, delimiter_position), &child_dictionary)) {
       return false;
     }
 
@@ -456,8 +611,7 @@ bool DictionaryValue::Get(StringPiece path,
     current_path = current_path.substr(delimiter_position + 1);
   }
 
-  return current_dictionary->GetWithoutPathExpansion(current_path.as_string(),
-                                                     out_value);
+  return current_dictionary->GetWithoutPathExpansion(current_path, out_value);
 }
 
 bool DictionaryValue::Get(StringPiece path, Value** out_value)  {
@@ -466,7 +620,7 @@ bool DictionaryValue::Get(StringPiece path, Value** out_value)  {
       const_cast<const Value**>(out_value));
 }
 
-bool DictionaryValue::GetBoolean(const std::string& path,
+bool DictionaryValue::GetBoolean(StringPiece path,
                                  bool* bool_value) const {
   const Value* value;
   if (!Get(path, &value))
@@ -475,7 +629,7 @@ bool DictionaryValue::GetBoolean(const std::string& path,
   return value->GetAsBoolean(bool_value);
 }
 
-bool DictionaryValue::GetInteger(const std::string& path,
+bool DictionaryValue::GetInteger(StringPiece path,
                                  int* out_value) const {
   const Value* value;
   if (!Get(path, &value))
@@ -484,7 +638,7 @@ bool DictionaryValue::GetInteger(const std::string& path,
   return value->GetAsInteger(out_value);
 }
 
-bool DictionaryValue::GetDouble(const std::string& path,
+bool DictionaryValue::GetDouble(StringPiece path,
                                 double* out_value) const {
   const Value* value;
   if (!Get(path, &value))
@@ -493,7 +647,7 @@ bool DictionaryValue::GetDouble(const std::string& path,
   return value->GetAsDouble(out_value);
 }
 
-bool DictionaryValue::GetString(const std::string& path,
+bool DictionaryValue::GetString(StringPiece path,
                                 std::string* out_value) const {
   const Value* value;
   if (!Get(path, &value))
@@ -502,7 +656,7 @@ bool DictionaryValue::GetString(const std::string& path,
   return value->GetAsString(out_value);
 }
 
-bool DictionaryValue::GetStringASCII(const std::string& path,
+bool DictionaryValue::GetStringASCII(StringPiece path,
                                      std::string* out_value) const {
   std::string out;
   if (!GetString(path, &out))
@@ -517,7 +671,7 @@ bool DictionaryValue::GetStringASCII(const std::string& path,
   return true;
 }
 
-bool DictionaryValue::GetBinary(const std::string& path,
+bool DictionaryValue::GetBinary(StringPiece path,
                                 const BinaryValue** out_value) const {
   const Value* value;
   bool result = Get(path, &value);
@@ -530,7 +684,7 @@ bool DictionaryValue::GetBinary(const std::string& path,
   return true;
 }
 
-bool DictionaryValue::GetBinary(const std::string& path,
+bool DictionaryValue::GetBinary(StringPiece path,
                                 BinaryValue** out_value) {
   return static_cast<const DictionaryValue&>(*this).GetBinary(
       path,
@@ -557,7 +711,7 @@ bool DictionaryValue::GetDictionary(StringPiece path,
       const_cast<const DictionaryValue**>(out_value));
 }
 
-bool DictionaryValue::GetList(const std::string& path,
+bool DictionaryValue::GetList(StringPiece path,
                               const ListValue** out_value) const {
   const Value* value;
   bool result = Get(path, &value);
@@ -570,16 +724,69 @@ bool DictionaryValue::GetList(const std::string& path,
   return true;
 }
 
-bool DictionaryValue::GetList(const std::string& path, ListValue** out_value) {
+bool DictionaryValue::GetList(StringPiece path, ListValue** out_value) {
   return static_cast<const DictionaryValue&>(*this).GetList(
       path,
       const_cast<const ListValue**>(out_value));
 }
 
-bool DictionaryValue::GetWithoutPathExpansion(const std::string& key,
+bool DictionaryValue::Get(const ValuePath& path,
+                          const Value** out_value) const {
+  const DictionaryValue* current_dictionary = this;
+  for (size_t i = 0; i + 1 < path.size(); i++) {
+    if (!current_dictionary->GetDictionaryWithoutPathExpansion(
+            path[i], &current_dictionary)) {
+      return false;
+    }
+  }
+  return current_dictionary->GetWithoutPathExpansion(path[path.size() - 1],
+                                                     out_value);
+}
+
+bool DictionaryValue::Get(const ValuePath& path, Value** out_value) {
+  return static_cast<const DictionaryValue&>(*this).Get(
+      path, const_cast<const Value**>(out_value));
+}
+
+bool DictionaryValue::GetBoolean(const ValuePath& path,
+                                 bool* out_value) const {
+  const Value* value;
+  return Get(path, &value) && value->GetAsBoolean(out_value);
+}
+
+bool DictionaryValue::GetInteger(const ValuePath& path, int* out_value) const {
+  const Value* value;
+  return Get(path, &value) && value->GetAsInteger(out_value);
+}
+
+bool DictionaryValue::GetDouble(const ValuePath& path,
+                                double* out_value) const {
+  const Value* value;
+  return Get(path, &value) && value->GetAsDouble(out_value);
+}
+
+bool DictionaryValue::GetString(const ValuePath& path,
+                                std::string* out_value) const {
+  const Value* value;
+  return Get(path, &value) && value->GetAsString(out_value);
+}
+
+bool DictionaryValue::GetDictionary(const ValuePath& path,
+                                    const DictionaryValue** out_value) const {
+  const Value* value;
+  return Get(path, &value) && value->GetAsDictionary(out_value);
+}
+
+bool DictionaryValue::GetList(const ValuePath& path,
+                              const ListValue** out_value) const {
+  const Value* value;
+  return Get(path, &value) && value->GetAsList(out_value);
+}
+
+bool DictionaryValue::GetWithoutPathExpansion(StringPiece key,
                                               const Value** out_value) const {
   DCHECK(IsStringUTF8(key));
-  auto entry_iterator = dictionary_.find(key);
+  auto entry_iterator = Find(key);
   if (entry_iterator == dictionary_.end())
     return false;
 
@@ -588,14 +795,14 @@ bool DictionaryValue::GetWithoutPathExpansion(const std::string& key,
   return true;
 }
 
-bool DictionaryValue::GetWithoutPathExpansion(const std::string& key,
+bool DictionaryValue::GetWithoutPathExpansion(StringPiece key,
                                               Value** out_value) {
   return static_cast<const DictionaryValue&>(*this).GetWithoutPathExpansion(
       key,
       const_cast<const Value**>(out_value));
 }
 
-bool DictionaryValue::GetBooleanWithoutPathExpansion(const std::string& key,
+bool DictionaryValue::GetBooleanWithoutPathExpansion(StringPiece key,
                                                      bool* out_value) const {
   const Value* value;
   if (!GetWithoutPathExpansion(key, &value))
@@ -604,7 +811,7 @@ bool DictionaryValue::GetBooleanWithoutPathExpansion(const std::string& key,
   return value->GetAsBoolean(out_value);
 }
 
-bool DictionaryValue::GetIntegerWithoutPathExpansion(const std::string& key,
+bool DictionaryValue::GetIntegerWithoutPathExpansion(StringPiece key,
                                                      int* out_value) const {
   const Value* value;
   if (!GetWithoutPathExpansion(key, &value))
@@ -613,7 +820,7 @@ bool DictionaryValue::GetIntegerWithoutPathExpansion(const std::string& key,
   return value->GetAsInteger(out_value);
 }
 
-bool DictionaryValue::GetDoubleWithoutPathExpansion(const std::string& key,
+bool DictionaryValue::GetDoubleWithoutPathExpansion(StringPiece key,
                                                     double* out_value) const {
   const Value* value;
   if (!GetWithoutPathExpansion(key, &value))
@@ -623,7 +830,7 @@ bool DictionaryValue::GetDoubleWithoutPathExpansion(const std::string& key,
 }
 
 bool DictionaryValue::GetStringWithoutPathExpansion(
-    const std::string& key,
+    StringPiece key,
     std::string* out_value) const {
   const Value* value;
   if (!GetWithoutPathExpansion(key, &value))
@@ -633,7 +840,7 @@ bool DictionaryValue::GetStringWithoutPathExpansion(
 }
 
 bool DictionaryValue::GetDictionaryWithoutPathExpansion(
-    const std::string& key,
+    StringPiece key,
     const DictionaryValue** out_value) const {
   const Value* value;
   bool result = GetWithoutPathExpansion(key, &value);
@@ -647,7 +854,7 @@ bool DictionaryValue::GetDictionaryWithoutPathExpansion(
 }
 
 bool DictionaryValue::GetDictionaryWithoutPathExpansion(
-    const std::string& key,
+    StringPiece key,
     DictionaryValue** out_value) {
   const DictionaryValue& const_this =
       static_cast<const DictionaryValue&>(*this);
@@ -657,7 +864,7 @@ bool DictionaryValue::GetDictionaryWithoutPathExpansion(
 }
 
 bool DictionaryValue::GetListWithoutPathExpansion(
-    const std::string& key,
+    StringPiece key,
     const ListValue** out_value) const {
   const Value* value;
   bool result = GetWithoutPathExpansion(key, &value);
@@ -670,7 +877,7 @@ bool DictionaryValue::GetListWithoutPathExpansion(
   return true;
 }
 
-bool DictionaryValue::GetListWithoutPathExpansion(const std::string& key,
+bool DictionaryValue::GetListWithoutPathExpansion(StringPiece key,
                                                   ListValue** out_value) {
   return
       static_cast<const DictionaryValue&>(*this).GetListWithoutPathExpansion(
@@ -699,7 +906,7 @@ bool DictionaryValue::RemoveWithoutPathExpansion(
     const std::string& key,
     std::unique_ptr<Value>* out_value) {
   DCHECK(IsStringUTF8(key));
-  auto entry_iterator = dictionary_.find(key);
+  auto entry_iterator = Find(key);
   if (entry_iterator == dictionary_.end())
     return false;
 
@@ -755,10 +962,57 @@ void DictionaryValue::MergeDictionary(const DictionaryValue* dictionary) {
   }
 }
 
+void DictionaryValue::MergeDictionary(
+    std::unique_ptr<DictionaryValue> dictionary) {
+  // Take the values with RemoveWithoutPathExpansion(), which copies them out
+  // of the hidden roots of JSONParser that own their strings. Removing from
+  // the back doesn't shift the remaining entries.
+  while (!dictionary->empty()) {
+    std::string key = dictionary->dictionary_.back().first;
+    std::unique_ptr<Value> merge_value;
+    CHECK(dictionary->RemoveWithoutPathExpansion(key, &merge_value));
+    // Check whether we have to merge dictionaries.
+    if (merge_value->IsType(Value::TYPE_DICTIONARY)) {
+      DictionaryValue* sub_dict;
+      if (GetDictionaryWithoutPathExpansion(key, &sub_dict)) {
+        sub_dict->MergeDictionary(From(std::move(merge_value)));
+        continue;
+      }
+    }
+    SetWithoutPathExpansion(key, std::move(merge_value));
+  }
+}
+
 void DictionaryValue::Swap(DictionaryValue* other) {
   dictionary_.swap(other->dictionary_);
 }
 
+DictionaryValue::Storage::iterator DictionaryValue::LowerBound(
+    StringPiece key) {
+  return std::lower_bound(
+      dictionary_.begin(), dictionary_.end(), key,
+      [](const Storage::value_type& entry, StringPiece key) {
+        return StringPiece(entry.first) < key;
+      });
+}
+
+DictionaryValue::Storage::const_iterator DictionaryValue::LowerBound(
+    StringPiece key) const {
+  return const_cast<DictionaryValue*>(this)->LowerBound(key);
+}
+
+DictionaryValue::Storage::iterator DictionaryValue::Find(StringPiece key) {
+  auto entry = LowerBound(key);
+  if (entry != dictionary_.end() && StringPiece(entry->first) != key)
+    return dictionary_.end();
+  return entry;
+}
+
+DictionaryValue::Storage::const_iterator DictionaryValue::Find(
+    StringPiece key) const {
+  return const_cast<DictionaryValue*>(this)->Find(key);
+}
+
 DictionaryValue::Iterator::Iterator(const DictionaryValue& target)
     : target_(target),
       it_(target.dictionary_.begin()) {}
@@ -770,9 +1024,10 @@ DictionaryValue::Iterator::~Iterator() {}
 DictionaryValue* DictionaryValue::DeepCopy() const {
   DictionaryValue* result = new DictionaryValue;
 
+  result->dictionary_.reserve(dictionary_.size());
   for (const auto& current_entry : dictionary_) {
-    result->SetWithoutPathExpansion(current_entry.first,
-                                    current_entry.second->CreateDeepCopy());
+    result->dictionary_.emplace_back(current_entry.first,
+                                     current_entry.second->CreateDeepCopy());
   }
 
   return result;
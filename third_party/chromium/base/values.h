@@ -41,6 +41,46 @@ class ListValue;
 class StringValue;
 class Value;
 
+// While a ScopedValueArena exists, the Values created with new on its thread
+// are allocated from a region, which is freed at once when the scope has
+// ended and all those Values have been deleted. Meant for the trees which
+// are parsed and dropped while handling a single request: building them is
+// a pointer bump per node and deleting them doesn't return the memory node by
+// node. The Values may still be deleted on any thread, and those which
+// outlive the scope keep the region alive. The strings and containers held
+// by the Values are allocated as usual.
+class BASE_EXPORT ScopedValueArena {
+ public:
+  ScopedValueArena();
+  ~ScopedValueArena();
+
+  // Returns the memory for a Value from the arena of the current thread, or
+  // nullptr if there is no arena.
+  static void* Allocate(size_t size);
+  // Returns true if |ptr| was allocated from the arena of the current
+  // thread.
+  static bool Contains(const void* ptr);
+  // Releases the memory of a Value allocated from any arena.
+  static void Free(void* ptr);
+
+ private:
+  class Region;
+
+  Region* region_;
+  ScopedValueArena* previous_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedValueArena);
+};
+
+// Allocation functions of the Values not allocated from an arena, e.g. to
+// take them from the allocator of an embedder. Both null, the default, stand
+// for the global operator new and delete. Must be set before any Value is
+// created, and |free_function| may be called on any thread.
+using ValueAllocateFunction = void* (*)(size_t size);
+using ValueFreeFunction = void (*)(void* ptr, size_t size);
+BASE_EXPORT void SetValueAllocator(ValueAllocateFunction allocate_function,
+                                   ValueFreeFunction free_function);
+
 // The Value class is the base class for Values. A Value can be instantiated
 // via the Create*Value() factory methods, or by directly creating instances of
 // the subclasses.
@@ -106,6 +146,11 @@ class BASE_EXPORT Value {
   // NULLs are considered equal but different from Value::CreateNullValue().
   static bool Equals(const Value* a, const Value* b);
 
+  // Allocate from the ScopedValueArena of the current thread, if any, or
+  // with the functions set by SetValueAllocator().
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr, size_t size);
+
  protected:
   // These aren't safe for end-users, but they are useful for subclasses.
   explicit Value(Type type);
@@ -114,6 +159,9 @@ class BASE_EXPORT Value {
 
  private:
   Type type_;
+  // Set if the Value was allocated from a ScopedValueArena. Fits into the
+  // padding after |type_|.
+  bool arena_allocated_;
 };
 
 // FundamentalValue represents the simple fundamental types of values.
@@ -197,12 +245,36 @@ class BASE_EXPORT BinaryValue : public Value {
   DISALLOW_COPY_AND_ASSIGN(BinaryValue);
 };
 
+// A path of DictionaryValue keys, split once. Meant for constant paths looked
+// up often, e.g.
+//   static const ValuePath kErrors{"error.errors"};
+//   response.GetList(kErrors, &errors);
+// The keys refer to the text they were split from, which must outlive the
+// path.
+class BASE_EXPORT ValuePath {
+ public:
+  static const size_t kMaxKeys = 8;
+
+  // Splits |path| at '.', like the path arguments of DictionaryValue.
+  explicit ValuePath(StringPiece path);
+
+  size_t size() const { return size_; }
+  StringPiece operator[](size_t index) const { return keys_[index]; }
+
+ private:
+  StringPiece keys_[kMaxKeys];
+  size_t size_{0};
+};
+
 // DictionaryValue provides a key-value dictionary with (optional) "path"
 // parsing for recursive access; see the comment at the top of the file. Keys
 // are |std::string|s and should be UTF-8 encoded.
 class BASE_EXPORT DictionaryValue : public Value {
  public:
-  using Storage = std::map<std::string, std::unique_ptr<Value>>;
+  // Entries are kept in a vector sorted by key. Dictionaries are small, so a
+  // binary search over contiguous entries beats walking the nodes of a map,
+  // and the keys are short enough to live inside the std::string.
+  using Storage = std::vector<std::pair<std::string, std::unique_ptr<Value>>>;
   // Returns |value| if it is a dictionary, nullptr otherwise.
   static std::unique_ptr<DictionaryValue> From(std::unique_ptr<Value> value);
 
@@ -214,7 +286,7 @@ class BASE_EXPORT DictionaryValue : public Value {
   bool GetAsDictionary(const DictionaryValue** out_value) const override;
 
   // Returns true if the current dictionary has a value for the given key.
-  bool HasKey(const std::string& key) const;
+  bool HasKey(StringPiece key) const;
 
   // Returns the number of Values in this dictionary.
   size_t size() const { return dictionary_.size(); }
@@ -267,48 +339,56 @@ class BASE_EXPORT DictionaryValue : public Value {
   // |out_value| is optional and will only be set if non-NULL.
   bool Get(StringPiece path, const Value** out_value) const;
   bool Get(StringPiece path, Value** out_value);
+  bool Get(const ValuePath& path, const Value** out_value) const;
+  bool Get(const ValuePath& path, Value** out_value);
 
   // These are convenience forms of Get().  The value will be retrieved
   // and the return value will be true if the path is valid and the value at
   // the end of the path can be returned in the form specified.
   // |out_value| is optional and will only be set if non-NULL.
-  bool GetBoolean(const std::string& path, bool* out_value) const;
-  bool GetInteger(const std::string& path, int* out_value) const;
+  // The keys are looked up without copying them, so constant paths don't
+  // allocate.
+  bool GetBoolean(StringPiece path, bool* out_value) const;
+  bool GetInteger(StringPiece path, int* out_value) const;
   // Values of both type TYPE_INTEGER and TYPE_DOUBLE can be obtained as
   // doubles.
-  bool GetDouble(const std::string& path, double* out_value) const;
-  bool GetString(const std::string& path, std::string* out_value) const;
-  bool GetStringASCII(const std::string& path, std::string* out_value) const;
-  bool GetBinary(const std::string& path, const BinaryValue** out_value) const;
-  bool GetBinary(const std::string& path, BinaryValue** out_value);
+  bool GetDouble(StringPiece path, double* out_value) const;
+  bool GetString(StringPiece path, std::string* out_value) const;
+  bool GetStringASCII(StringPiece path, std::string* out_value) const;
+  bool GetBinary(StringPiece path, const BinaryValue** out_value) const;
+  bool GetBinary(StringPiece path, BinaryValue** out_value);
   bool GetDictionary(StringPiece path,
                      const DictionaryValue** out_value) const;
   bool GetDictionary(StringPiece path, DictionaryValue** out_value);
-  bool GetList(const std::string& path, const ListValue** out_value) const;
-  bool GetList(const std::string& path, ListValue** out_value);
+  bool GetList(StringPiece path, const ListValue** out_value) const;
+  bool GetList(StringPiece path, ListValue** out_value);
+
+  // Same as above, with the path split beforehand.
+  bool GetBoolean(const ValuePath& path, bool* out_value) const;
+  bool GetInteger(const ValuePath& path, int* out_value) const;
+  bool GetDouble(const ValuePath& path, double* out_value) const;
+  bool GetString(const ValuePath& path, std::string* out_value) const;
+  bool GetDictionary(const ValuePath& path,
+                     const DictionaryValue** out_value) const;
+  bool GetList(const ValuePath& path, const ListValue** out_value) const;
 
   // Like Get(), but without special treatment of '.'.  This allows e.g. URLs to
   // be used as paths.
-  bool GetWithoutPathExpansion(const std::string& key,
-                               const Value** out_value) const;
-  bool GetWithoutPathExpansion(const std::string& key, Value** out_value);
-  bool GetBooleanWithoutPathExpansion(const std::string& key,
-                                      bool* out_value) const;
-  bool GetIntegerWithoutPathExpansion(const std::string& key,
-                                      int* out_value) const;
-  bool GetDoubleWithoutPathExpansion(const std::string& key,
-                                     double* out_value) const;
-  bool GetStringWithoutPathExpansion(const std::string& key,
+  bool GetWithoutPathExpansion(StringPiece key, const Value** out_value) const;
+  bool GetWithoutPathExpansion(StringPiece key, Value** out_value);
+  bool GetBooleanWithoutPathExpansion(StringPiece key, bool* out_value) const;
+  bool GetIntegerWithoutPathExpansion(StringPiece key, int* out_value) const;
+  bool GetDoubleWithoutPathExpansion(StringPiece key, double* out_value) const;
+  bool GetStringWithoutPathExpansion(StringPiece key,
                                      std::string* out_value) const;
   bool GetDictionaryWithoutPathExpansion(
-      const std::string& key,
+      StringPiece key,
       const DictionaryValue** out_value) const;
-  bool GetDictionaryWithoutPathExpansion(const std::string& key,
+  bool GetDictionaryWithoutPathExpansion(StringPiece key,
                                          DictionaryValue** out_value);
-  bool GetListWithoutPathExpansion(const std::string& key,
+  bool GetListWithoutPathExpansion(StringPiece key,
                                    const ListValue** out_value) const;
-  bool GetListWithoutPathExpansion(const std::string& key,
-                                   ListValue** out_value);
+  bool GetListWithoutPathExpansion(StringPiece key, ListValue** out_value);
 
   // Removes the Value with the specified path from this dictionary (or one
   // of its child dictionaries, if the path is more than just a local key).
@@ -339,6 +419,9 @@ class BASE_EXPORT DictionaryValue : public Value {
   // replaced. Values within |dictionary| are deep-copied, so |dictionary| may
   // be freed any time after this call.
   void MergeDictionary(const DictionaryValue* dictionary);
+  // Same as above, but moves the values out of |dictionary| instead of
+  // copying them.
+  void MergeDictionary(std::unique_ptr<DictionaryValue> dictionary);
 
   // Swaps contents with the |other| dictionary.
   virtual void Swap(DictionaryValue* other);
@@ -369,6 +452,13 @@ class BASE_EXPORT DictionaryValue : public Value {
   bool Equals(const Value* other) const override;
 
  private:
+  // Returns the first entry with a key not less than |key|.
+  Storage::iterator LowerBound(StringPiece key);
+  Storage::const_iterator LowerBound(StringPiece key) const;
+  // Returns the entry with |key|, or the end of |dictionary_|.
+  Storage::iterator Find(StringPiece key);
+  Storage::const_iterator Find(StringPiece key) const;
+
   Storage dictionary_;
 
   DISALLOW_COPY_AND_ASSIGN(DictionaryValue);
@@ -8,10 +8,13 @@
 
 #include <limits>
 #include <memory>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include <gtest/gtest.h>
 
+#include "base/json/json_reader.h"
 #include "base/memory/ptr_util.h"
 #include "base/strings/utf_string_conversion_utils.h"
 
@@ -791,6 +794,40 @@ TEST(ValuesTest, MergeDictionaryDeepCopy) {
   EXPECT_EQ("value", value);
 }
 
+TEST(ValuesTest, MergeDictionaryMove) {
+  std::unique_ptr<DictionaryValue> base(new DictionaryValue);
+  base->SetString("base_key", "base_value");
+  base->SetString("sub_dict.sub_base_key", "sub_base_key_value");
+  base->SetString("sub_dict.sub_collision_key", "sub_base_collision_value");
+
+  std::unique_ptr<DictionaryValue> merge(new DictionaryValue);
+  merge->SetString("sub_dict.sub_collision_key", "sub_merge_collision_value");
+  std::unique_ptr<ListValue> list(new ListValue);
+  ListValue* original_list = list.get();
+  merge->Set("list", std::move(list));
+
+  base->MergeDictionary(std::move(merge));
+  EXPECT_EQ(3U, base->size());
+  ListValue* ptr = nullptr;
+  EXPECT_TRUE(base->GetList("list", &ptr));
+  EXPECT_EQ(original_list, ptr);
+  std::string value;
+  EXPECT_TRUE(base->GetString("sub_dict.sub_base_key", &value));
+  EXPECT_EQ("sub_base_key_value", value);
+  EXPECT_TRUE(base->GetString("sub_dict.sub_collision_key", &value));
+  EXPECT_EQ("sub_merge_collision_value", value);
+
+  // Values parsed from JSON must outlive the parsed root.
+  std::unique_ptr<DictionaryValue> parsed = DictionaryValue::From(
+      JSONReader::Read("{\"a\": \"parsed\", \"sub_dict\": {\"b\": \"x\"}}"));
+  ASSERT_TRUE(parsed);
+  base->MergeDictionary(std::move(parsed));
+  EXPECT_TRUE(base->GetString("a", &value));
+  EXPECT_EQ("parsed", value);
+  EXPECT_TRUE(base->GetString("sub_dict.b", &value));
+  EXPECT_EQ("x", value);
+}
+
 TEST(ValuesTest, DictionaryIterator) {
   DictionaryValue dict;
   for (DictionaryValue::Iterator it(dict); !it.IsAtEnd(); it.Advance()) {
@@ -828,6 +865,38 @@ TEST(ValuesTest, DictionaryIterator) {
   EXPECT_TRUE(seen2);
 }
 
+TEST(ValuesTest, DictionaryIteratorIsSorted) {
+  const char* const kKeys[] = {"m", "a", "zz", "b", "", "z", "ab", "a"};
+  DictionaryValue dict;
+  for (size_t i = 0; i < arraysize(kKeys); ++i)
+    dict.SetIntegerWithoutPathExpansion(kKeys[i], static_cast<int>(i));
+  EXPECT_EQ(7U, dict.size());
+
+  std::vector<std::string> keys;
+  for (DictionaryValue::Iterator it(dict); !it.IsAtEnd(); it.Advance())
+    keys.push_back(it.key());
+  EXPECT_EQ((std::vector<std::string>{"", "a", "ab", "b", "m", "z", "zz"}),
+            keys);
+
+  int value = 0;
+  EXPECT_TRUE(dict.GetIntegerWithoutPathExpansion("a", &value));
+  EXPECT_EQ(7, value);
+  EXPECT_TRUE(dict.GetIntegerWithoutPathExpansion("", &value));
+  EXPECT_EQ(4, value);
+  EXPECT_FALSE(dict.HasKey("aa"));
+  EXPECT_FALSE(dict.HasKey("zzz"));
+
+  EXPECT_TRUE(dict.RemoveWithoutPathExpansion("m", nullptr));
+  EXPECT_FALSE(dict.RemoveWithoutPathExpansion("m", nullptr));
+  EXPECT_TRUE(dict.GetIntegerWithoutPathExpansion("z", &value));
+  EXPECT_EQ(5, value);
+
+  std::unique_ptr<DictionaryValue> copy = dict.CreateDeepCopy();
+  EXPECT_TRUE(dict.Equals(copy.get()));
+  copy->SetIntegerWithoutPathExpansion("0", 0);
+  EXPECT_FALSE(dict.Equals(copy.get()));
+}
+
 // DictionaryValue/ListValue's Get*() methods should accept NULL as an out-value
 // and still return true/false based on success.
 TEST(ValuesTest, GetWithNullOutValue) {
@@ -1078,4 +1147,78 @@ TEST(ValuesTest, GetWithNullOutValue) {
   EXPECT_FALSE(main_list.GetList(7, NULL));
 }
 
+TEST(ValuesTest, ScopedValueArena) {
+  std::unique_ptr<DictionaryValue> kept;
+  std::unique_ptr<ListValue> other_thread;
+  {
+    ScopedValueArena arena;
+    std::unique_ptr<Value> json = JSONReader::Read(
+        "{\"a\": [1, 2.5, \"x\", null, {\"b\": true}], \"c\": {}}");
+    ASSERT_TRUE(json);
+    EXPECT_TRUE(ScopedValueArena::Contains(json.get()));
+
+    // Values which aren't allocated with new aren't in the arena.
+    FundamentalValue local(1);
+    EXPECT_FALSE(ScopedValueArena::Contains(&local));
+    std::shared_ptr<Value> shared = std::make_shared<StringValue>("x");
+    EXPECT_FALSE(ScopedValueArena::Contains(shared.get()));
+
+    {
+      ScopedValueArena nested;
+      std::unique_ptr<Value> value = Value::CreateNullValue();
+      EXPECT_TRUE(ScopedValueArena::Contains(value.get()));
+      EXPECT_FALSE(ScopedValueArena::Contains(json.get()));
+    }
+    EXPECT_TRUE(ScopedValueArena::Contains(json.get()));
+
+    kept.reset(new DictionaryValue);
+    kept->SetString("a", "b");
+    kept->Set("c", json->CreateDeepCopy());
+    other_thread.reset(new ListValue);
+    other_thread->AppendInteger(1);
+  }
+  std::thread{[&other_thread]() { other_thread.reset(); }}.join();
+
+  // Values which outlive the scope stay valid.
+  std::string str;
+  EXPECT_TRUE(kept->GetString("a", &str));
+  EXPECT_EQ("b", str);
+  const ListValue* list = nullptr;
+  EXPECT_TRUE(kept->GetList("c.a", &list));
+  EXPECT_EQ(5u, list->GetSize());
+  kept.reset();
+
+  std::unique_ptr<Value> heap = Value::CreateNullValue();
+  EXPECT_FALSE(ScopedValueArena::Contains(heap.get()));
+}
+
+TEST(ValuesTest, ValuePath) {
+  std::unique_ptr<Value> json = JSONReader::Read(
+      "{\"a\": {\"b\": {\"c\": 1, \"d.e\": \"x\", \"f\": [true]}}}");
+  const DictionaryValue* dict = nullptr;
+  ASSERT_TRUE(json->GetAsDictionary(&dict));
+
+  const ValuePath kPath{"a.b.c"};
+  EXPECT_EQ(3u, kPath.size());
+  int integer = 0;
+  EXPECT_TRUE(dict->GetInteger(kPath, &integer));
+  EXPECT_EQ(1, integer);
+  double number = 0;
+  EXPECT_TRUE(dict->GetDouble(kPath, &number));
+  std::string str;
+  EXPECT_FALSE(dict->GetString(kPath, &str));
+
+  EXPECT_FALSE(dict->GetString(ValuePath{"a.b.d.e"}, &str));
+
+  const ListValue* list = nullptr;
+  EXPECT_TRUE(dict->GetList(ValuePath{"a.b.f"}, &list));
+  bool boolean = false;
+  EXPECT_TRUE(list->GetBoolean(0, &boolean));
+  EXPECT_FALSE(dict->GetBoolean(ValuePath{"a.b.f"}, &boolean));
+  const DictionaryValue* inner = nullptr;
+  EXPECT_TRUE(dict->GetDictionary(ValuePath{"a.b"}, &inner));
+  EXPECT_FALSE(dict->GetDictionary(ValuePath{"a.b.c.d"}, &inner));
+  EXPECT_FALSE(dict->Get(ValuePath{"a.x"}, nullptr));
+}
+
 }  // namespace base
@@ -745,8 +745,59 @@ static const Point kBasePoint = {
   {1, 0, 0, 0, 0, 0, 0, 0},
 };
 
+// The base point is multiplied with a comb: the 224-bit scalar is split into
+// kCombTeeth parts of kCombSpacing bits, and the bits at the same position in
+// each part select one of the precomputed sums of g*2^(kCombSpacing*k). That
+// takes a quarter of the doublings and additions of the generic ScalarMult.
+static const size_t kCombTeeth = 4;
+static const size_t kCombSpacing = 224 / kCombTeeth;
+
+struct CombTable {
+  CombTable() {
+    memset(points, 0, sizeof(points));
+    Point tooth = kBasePoint;
+    for (size_t k = 0; k < kCombTeeth; ++k) {
+      const size_t bit = 1 << k;
+      points[bit] = tooth;
+      for (size_t j = 1; j < bit; ++j)
+        AddJacobian(&points[bit + j], points[j], tooth);
+      for (size_t i = 0; i < kCombSpacing; ++i)
+        DoubleJacobian(&tooth, tooth);
+    }
+  }
+
+  // |points[j]| is the sum of g*2^(kCombSpacing*k) for each bit k set in j.
+  // |points[0]| is the point at infinity.
+  Point points[1 << kCombTeeth];
+};
+
+// Returns bit |n| of the big-endian 28-byte |scalar|, counting from the least
+// significant one.
+static uint32_t GetScalarBit(const uint8_t* scalar, size_t n) {
+  return (scalar[27 - n / 8] >> (n % 8)) & 1;
+}
+
 void ScalarBaseMult(const uint8_t* scalar, Point* out) {
-  ::ScalarMult(out, kBasePoint, scalar, 28);
+  static const CombTable table;
+
+  memset(out, 0, sizeof(*out));
+  Point selected, tmp;
+
+  for (size_t i = kCombSpacing; i-- > 0;) {
+    DoubleJacobian(out, *out);
+    uint32_t index = 0;
+    for (size_t k = 0; k < kCombTeeth; ++k)
+      index |= GetScalarBit(scalar, kCombSpacing * k + i) << k;
+    // Scan the whole table, so memory access does not depend on the scalar.
+    memset(&selected, 0, sizeof(selected));
+    for (uint32_t j = 0; j < (1 << kCombTeeth); ++j) {
+      // All ones if j == index, zero otherwise.
+      uint32_t mask = 0 - (((j ^ index) - 1) >> 31);
+      CopyConditional(&selected, table.points[j], mask);
+    }
+    AddJacobian(&tmp, selected, *out);
+    *out = tmp;
+  }
 }
 
 void Add(const Point& a, const Point& b, Point* out) {
@@ -114,20 +114,33 @@ bool SecureMemEqual(const uint8_t* s1_ptr, const uint8_t* s2_ptr, size_t n) {
 
 namespace crypto {
 
+P224EncryptedKeyExchange::Password::Password(
+    const base::StringPiece& password) {
+  // Calculate |password| hash to get SPAKE password value.
+  SHA256HashString(std::string(password.data(), password.length()),
+                   pw_, sizeof(pw_));
+
+  p224::ScalarMult(kM, pw_, &m_pw_);
+  p224::ScalarMult(kN, pw_, &n_pw_);
+  p224::Negate(m_pw_, &minus_m_pw_);
+  p224::Negate(n_pw_, &minus_n_pw_);
+}
+
 P224EncryptedKeyExchange::P224EncryptedKeyExchange(
     PeerType peer_type, const base::StringPiece& password)
+    : P224EncryptedKeyExchange(peer_type, Password(password)) {}
+
+P224EncryptedKeyExchange::P224EncryptedKeyExchange(PeerType peer_type,
+                                                   const Password& password)
     : state_(kStateInitial),
-      is_server_(peer_type == kPeerTypeServer) {
+      is_server_(peer_type == kPeerTypeServer),
+      password_(password) {
   memset(&x_, 0, sizeof(x_));
   memset(&expected_authenticator_, 0, sizeof(expected_authenticator_));
 
   // x_ is a random scalar.
   base::RandBytes(x_, sizeof(x_));
 
-  // Calculate |password| hash to get SPAKE password value.
-  SHA256HashString(std::string(password.data(), password.length()),
-                   pw_, sizeof(pw_));
-
   Init();
 }
 
@@ -138,8 +151,7 @@ void P224EncryptedKeyExchange::Init() {
 
   // The client masks the Diffie-Hellman value, X, by adding M**pw and the
   // server uses N**pw.
-  p224::Point MNpw;
-  p224::ScalarMult(is_server_ ? kN : kM, pw_, &MNpw);
+  const p224::Point& MNpw = is_server_ ? password_.n_pw_ : password_.m_pw_;
 
   // X* = X + (N|M)**pw
   p224::Point Xstar;
@@ -195,10 +207,10 @@ P224EncryptedKeyExchange::Result P224EncryptedKeyExchange::ProcessMessage(
     return kResultFailed;
   }
 
-  // We calculate the mask value: (N|M)**pw
-  p224::Point MNpw, minus_MNpw, Y, k;
-  p224::ScalarMult(is_server_ ? kM : kN, pw_, &MNpw);
-  p224::Negate(MNpw, &minus_MNpw);
+  // The negated mask value, -(N|M)**pw, is precomputed.
+  const p224::Point& minus_MNpw =
+      is_server_ ? password_.minus_m_pw_ : password_.minus_n_pw_;
+  p224::Point Y, k;
 
   // Y = Y* - (N|M)**pw
   p224::Add(Ystar, minus_MNpw, &Y);
@@ -253,7 +265,8 @@ void P224EncryptedKeyExchange::CalculateHash(
   hash_contents += client_masked_dh;
   hash_contents += server_masked_dh;
   hash_contents +=
-      std::string(reinterpret_cast<const char *>(pw_), sizeof(pw_));
+      std::string(reinterpret_cast<const char *>(password_.pw_),
+                  sizeof(password_.pw_));
   hash_contents += k;
 
   SHA256HashString(hash_contents, out_digest, kSHA256Length);
@@ -51,12 +51,33 @@ class P224EncryptedKeyExchange {
     kPeerTypeServer,
   };
 
+  // Values derived from the password alone. Exchanges which are created from
+  // the same Password skip all point multiplications except the two which
+  // depend on the random exponent.
+  class Password {
+   public:
+    explicit Password(const base::StringPiece& password);
+
+   private:
+    friend class P224EncryptedKeyExchange;
+
+    // pw_ is SHA256(P(password), P(session))[:28] where P() prepends a
+    // uint32_t, big-endian length prefix (see paper referenced in .cc file).
+    uint8_t pw_[p224::kScalarBytes];
+    // M**pw and N**pw, and their negations.
+    p224::Point m_pw_;
+    p224::Point n_pw_;
+    p224::Point minus_m_pw_;
+    p224::Point minus_n_pw_;
+  };
+
   // peer_type: the type of the local authentication party.
   // password: secret session password. Both parties to the
   //     authentication must pass the same value. For the case of a
   //     TLS connection, see RFC 5705.
   P224EncryptedKeyExchange(PeerType peer_type,
                            const base::StringPiece& password);
+  P224EncryptedKeyExchange(PeerType peer_type, const Password& password);
 
   // GetNextMessage returns a byte string which must be passed to the other
   // party in the authentication.
@@ -113,9 +134,7 @@ class P224EncryptedKeyExchange {
   // x_ is the secret Diffie-Hellman exponent (see paper referenced in .cc
   // file).
   uint8_t x_[p224::kScalarBytes];
-  // pw_ is SHA256(P(password), P(session))[:28] where P() prepends a uint32_t,
-  // big-endian length prefix (see paper referenced in .cc file).
-  uint8_t pw_[p224::kScalarBytes];
+  const Password password_;
   // expected_authenticator_ is used to store the hash value expected from the
   // other party.
   uint8_t expected_authenticator_[kSHA256Length];
@@ -69,6 +69,19 @@ TEST(MutualAuth, CorrectAuth) {
   EXPECT_EQ(client.GetKey(), server.GetKey());
 }
 
+TEST(MutualAuth, SharedPassword) {
+  const P224EncryptedKeyExchange::Password password{kPassword};
+  for (int i = 0; i < 2; i++) {
+    P224EncryptedKeyExchange client(
+        P224EncryptedKeyExchange::kPeerTypeClient, kPassword);
+    P224EncryptedKeyExchange server(
+        P224EncryptedKeyExchange::kPeerTypeServer, password);
+
+    EXPECT_TRUE(RunExchange(&client, &server, true));
+    EXPECT_EQ(client.GetKey(), server.GetKey());
+  }
+}
+
 TEST(MutualAuth, IncorrectPassword) {
   P224EncryptedKeyExchange client(
       P224EncryptedKeyExchange::kPeerTypeClient,
@@ -794,6 +794,31 @@ TEST(P224, ScalarBaseMult) {
   }
 }
 
+TEST(P224, ScalarBaseMultMatchesScalarMult) {
+  Point base_point;
+  ASSERT_TRUE(base_point.SetFromString(base::StringPiece(
+      reinterpret_cast<const char *>(kBasePointExternal),
+      sizeof(kBasePointExternal))));
+
+  uint8_t scalar[p224::kScalarBytes];
+  for (size_t i = 0; i < 16; i++) {
+    memset(scalar, 0, sizeof(scalar));
+    // Cover scalars with every comb tooth set, and with none.
+    for (size_t j = 0; j < sizeof(scalar); j++)
+      scalar[j] = static_cast<uint8_t>((i * 37 + j * 101) * (i & (j / 7 + 1)));
+    Point expected, actual;
+    p224::ScalarMult(base_point, scalar, &expected);
+    p224::ScalarBaseMult(scalar, &actual);
+    EXPECT_EQ(expected.ToString(), actual.ToString());
+  }
+
+  memset(scalar, 0xff, sizeof(scalar));
+  Point expected, actual;
+  p224::ScalarMult(base_point, scalar, &expected);
+  p224::ScalarBaseMult(scalar, &actual);
+  EXPECT_EQ(expected.ToString(), actual.ToString());
+}
+
 TEST(P224, Addition) {
   Point a, b, minus_b, sum, a_again;
 
@@ -0,0 +1,262 @@
+// Copyright 2016 The Weave Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string>
+#include <vector>
+
+#include <base/logging.h>
+#include <base/macros.h>
+
+#include "src/test/benchmark.h"
+
+extern "C" {
+#include "third_party/libuweave/src/crypto_hmac.h"
+#include "third_party/libuweave/src/macaroon.h"
+#include "third_party/libuweave/src/macaroon_caveat_internal.h"
+#include "third_party/libuweave/src/macaroon_encoding.h"
+}
+
+// Registers |function| for macaroons of 1 to 16 caveats, as "function/N".
+#define WEAVE_CAVEATS_BENCHMARK(function)                                      \
+  static const bool function##_registered_ =                                   \
+      ::weave::test::RegisterBenchmark(#function "/1", &function<1>) &&        \
+      ::weave::test::RegisterBenchmark(#function "/2", &function<2>) &&        \
+      ::weave::test::RegisterBenchmark(#function "/4", &function<4>) &&        \
+      ::weave::test::RegisterBenchmark(#function "/8", &function<8>) &&        \
+      ::weave::test::RegisterBenchmark(#function "/16", &function<16>)
+
+namespace weave {
+
+namespace {
+
+// J2000 seconds, when the caveats are issued and validated.
+const uint32_t kIssuedTime = 500000000;
+
+std::vector<uint8_t> GetRootKey() {
+  return std::vector<uint8_t>(32, 0x5a);
+}
+
+UwMacaroonContext CreateContext() {
+  UwMacaroonContext context;
+  CHECK(uw_macaroon_context_create_(kIssuedTime + 60, nullptr, 0, nullptr, 0,
+                                    &context));
+  return context;
+}
+
+// Creates the caveat at |index| of a macaroon shaped like the delegated access
+// tokens: the scope, then pairs of delegation timestamps and users.
+void CreateCaveat(size_t index,
+                  std::vector<uint8_t>* buffer,
+                  UwMacaroonCaveat* caveat) {
+  if (index == 0) {
+    buffer->resize(uw_macaroon_caveat_creation_get_buffsize_(
+        kUwMacaroonCaveatTypeScope, 0));
+    CHECK(uw_macaroon_caveat_create_scope_(kUwMacaroonCaveatScopeTypeUser,
+                                           buffer->data(), buffer->size(),
+                                           caveat));
+  } else if (index % 2) {
+    buffer->resize(uw_macaroon_caveat_creation_get_buffsize_(
+        kUwMacaroonCaveatTypeDelegationTimestamp, 0));
+    CHECK(uw_macaroon_caveat_create_delegation_timestamp_(
+        kIssuedTime + index, buffer->data(), buffer->size(), caveat));
+  } else {
+    std::string user = "user" + std::to_string(index) + "@example.com";
+    buffer->resize(uw_macaroon_caveat_creation_get_buffsize_(
+        kUwMacaroonCaveatTypeDelegateeUser, user.size()));
+    CHECK(uw_macaroon_caveat_create_delegatee_user_(
+        reinterpret_cast<const uint8_t*>(user.data()), user.size(),
+        buffer->data(), buffer->size(), caveat));
+  }
+}
+
+// Caveats of a macaroon which validates, see CreateCaveat().
+class Caveats final {
+ public:
+  explicit Caveats(size_t count)
+      : buffers_(count), caveats_(count), pointers_(count) {
+    for (size_t i = 0; i < count; ++i) {
+      CreateCaveat(i, &buffers_[i], &caveats_[i]);
+      pointers_[i] = &caveats_[i];
+    }
+  }
+
+  const UwMacaroonCaveat* const* get() const { return pointers_.data(); }
+  size_t size() const { return pointers_.size(); }
+
+ private:
+  std::vector<std::vector<uint8_t>> buffers_;
+  std::vector<UwMacaroonCaveat> caveats_;
+  std::vector<const UwMacaroonCaveat*> pointers_;
+
+  DISALLOW_COPY_AND_ASSIGN(Caveats);
+};
+
+UwMacaroon CreateMacaroon(const Caveats& caveats) {
+  std::vector<uint8_t> root_key = GetRootKey();
+  UwMacaroonContext context = CreateContext();
+  UwMacaroon macaroon;
+  CHECK(uw_macaroon_create_from_root_key_(&macaroon, root_key.data(),
+                                          root_key.size(), &context,
+                                          caveats.get(), caveats.size()));
+  return macaroon;
+}
+
+std::vector<uint8_t> Serialize(const UwMacaroon& macaroon) {
+  std::vector<uint8_t> token(1024);
+  size_t size = 0;
+  CHECK(uw_macaroon_serialize_(&macaroon, token.data(), token.size(), &size));
+  token.resize(size);
+  return token;
+}
+
+template <size_t kNumCaveats>
+void BM_MacaroonCaveatCreate(test::BenchmarkState* state) {
+  std::vector<std::vector<uint8_t>> buffers(kNumCaveats);
+  UwMacaroonCaveat caveats[kNumCaveats];
+  while (state->KeepRunning()) {
+    for (size_t i = 0; i < kNumCaveats; ++i)
+      CreateCaveat(i, &buffers[i], &caveats[i]);
+  }
+  size_t bytes = 0;
+  for (const auto& caveat : caveats)
+    bytes += caveat.num_bytes;
+  state->SetBytesProcessed(state->iterations() * bytes);
+}
+WEAVE_CAVEATS_BENCHMARK(BM_MacaroonCaveatCreate);
+
+template <size_t kNumCaveats>
+void BM_MacaroonCreate(test::BenchmarkState* state) {
+  Caveats caveats{kNumCaveats};
+  std::vector<uint8_t> root_key = GetRootKey();
+  UwMacaroonContext context = CreateContext();
+  UwMacaroon macaroon;
+  while (state->KeepRunning()) {
+    CHECK(uw_macaroon_create_from_root_key_(&macaroon, root_key.data(),
+                                            root_key.size(), &context,
+                                            caveats.get(), caveats.size()));
+  }
+}
+WEAVE_CAVEATS_BENCHMARK(BM_MacaroonCreate);
+
+// Extends a macaroon of |kNumCaveats| caveats with one more.
+template <size_t kNumCaveats>
+void BM_MacaroonExtend(test::BenchmarkState* state) {
+  Caveats caveats{kNumCaveats + 1};
+  std::vector<uint8_t> root_key = GetRootKey();
+  UwMacaroonContext context = CreateContext();
+  UwMacaroon macaroon;
+  CHECK(uw_macaroon_create_from_root_key_(&macaroon, root_key.data(),
+                                          root_key.size(), &context,
+                                          caveats.get(), kNumCaveats));
+  const UwMacaroonCaveat* buffer[kNumCaveats + 1];
+  UwMacaroon extended;
+  while (state->KeepRunning()) {
+    CHECK(uw_macaroon_extend_(&macaroon, &extended, &context,
+                              caveats.get()[kNumCaveats],
+                              reinterpret_cast<uint8_t*>(buffer),
+                              sizeof(buffer)));
+  }
+}
+WEAVE_CAVEATS_BENCHMARK(BM_MacaroonExtend);
+
+template <size_t kNumCaveats>
+void BM_MacaroonSerialize(test::BenchmarkState* state) {
+  Caveats caveats{kNumCaveats};
+  UwMacaroon macaroon = CreateMacaroon(caveats);
+  uint8_t token[1024];
+  size_t size = 0;
+  while (state->KeepRunning())
+    CHECK(uw_macaroon_serialize_(&macaroon, token, sizeof(token), &size));
+  state->SetBytesProcessed(state->iterations() * size);
+}
+WEAVE_CAVEATS_BENCHMARK(BM_MacaroonSerialize);
+
+template <size_t kNumCaveats>
+void BM_MacaroonDeserialize(test::BenchmarkState* state) {
+  Caveats caveats{kNumCaveats};
+  std::vector<uint8_t> token = Serialize(CreateMacaroon(caveats));
+  uint8_t buffer[kNumCaveats *
+                 (sizeof(UwMacaroonCaveat) + sizeof(UwMacaroonCaveat*))];
+  UwMacaroon macaroon;
+  while (state->KeepRunning()) {
+    CHECK(uw_macaroon_deserialize_(token.data(), token.size(), buffer,
+                                   sizeof(buffer), &macaroon));
+  }
+  state->SetBytesProcessed(state->iterations() * token.size());
+}
+WEAVE_CAVEATS_BENCHMARK(BM_MacaroonDeserialize);
+
+template <size_t kNumCaveats>
+void BM_MacaroonValidate(test::BenchmarkState* state) {
+  Caveats caveats{kNumCaveats};
+  UwMacaroon macaroon = CreateMacaroon(caveats);
+  std::vector<uint8_t> root_key = GetRootKey();
+  UwMacaroonContext context = CreateContext();
+  UwMacaroonValidationResult result;
+  while (state->KeepRunning()) {
+    CHECK(uw_macaroon_validate_(&macaroon, root_key.data(), root_key.size(),
+                                &context, &result));
+  }
+}
+WEAVE_CAVEATS_BENCHMARK(BM_MacaroonValidate);
+
+// One step of the MAC chain, the HMAC of the last caveat.
+template <size_t kNumCaveats>
+void BM_MacaroonCaveatSign(test::BenchmarkState* state) {
+  Caveats caveats{kNumCaveats};
+  const UwMacaroonCaveat* caveat = caveats.get()[kNumCaveats - 1];
+  std::vector<uint8_t> key(UW_MACAROON_MAC_LEN, 0xa5);
+  UwMacaroonContext context = CreateContext();
+  uint8_t mac_tag[UW_MACAROON_MAC_LEN];
+  while (state->KeepRunning()) {
+    CHECK(uw_macaroon_caveat_sign_(key.data(), key.size(), &context, caveat,
+                                   mac_tag, sizeof(mac_tag)));
+  }
+  state->SetBytesProcessed(state->iterations() * caveat->num_bytes);
+}
+WEAVE_CAVEATS_BENCHMARK(BM_MacaroonCaveatSign);
+
+template <size_t kMessageSize>
+void BM_CryptoHmac(test::BenchmarkState* state) {
+  std::vector<uint8_t> key = GetRootKey();
+  std::vector<uint8_t> message(kMessageSize, 0x3c);
+  const UwCryptoHmacMsg messages[] = {{message.data(), message.size()}};
+  uint8_t digest[UW_MACAROON_MAC_LEN];
+  while (state->KeepRunning()) {
+    CHECK(uw_crypto_hmac_(key.data(), key.size(), messages,
+                          arraysize(messages), digest, sizeof(digest)));
+  }
+  state->SetBytesProcessed(state->iterations() * message.size());
+}
+static const bool BM_CryptoHmac_registered_ =
+    test::RegisterBenchmark("BM_CryptoHmac/16", &BM_CryptoHmac<16>) &&
+    test::RegisterBenchmark("BM_CryptoHmac/256", &BM_CryptoHmac<256>);
+
+void BM_MacaroonEncodingEncodeByteStr(test::BenchmarkState* state) {
+  const std::vector<uint8_t> str(24, 0x42);
+  uint8_t buffer[32];
+  size_t size = 0;
+  while (state->KeepRunning()) {
+    CHECK(uw_macaroon_encoding_encode_byte_str_(str.data(), str.size(), buffer,
+                                                sizeof(buffer), &size));
+  }
+  state->SetBytesProcessed(state->iterations() * size);
+}
+WEAVE_BENCHMARK(BM_MacaroonEncodingEncodeByteStr);
+
+void BM_MacaroonEncodingDecodeUint(test::BenchmarkState* state) {
+  uint8_t cbor[UW_MACAROON_ENCODING_MAX_UINT_CBOR_LEN];
+  size_t size = 0;
+  CHECK(uw_macaroon_encoding_encode_uint_(kIssuedTime, cbor, sizeof(cbor),
+                                          &size));
+  uint32_t value = 0;
+  while (state->KeepRunning())
+    CHECK(uw_macaroon_encoding_decode_uint_(cbor, size, &value));
+  state->SetBytesProcessed(state->iterations() * size);
+}
+WEAVE_BENCHMARK(BM_MacaroonEncodingDecodeUint);
+
+}  // namespace
+
+}  // namespace weave
@@ -10,38 +10,130 @@
 
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
+#include <openssl/opensslv.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 
-bool uw_crypto_hmac_(const uint8_t* key,
-                     size_t key_len,
-                     const UwCryptoHmacMsg messages[],
-                     size_t num_messages,
-                     uint8_t* truncated_digest,
-                     size_t truncated_digest_len) {
-  HMAC_CTX context = {0};
-  HMAC_CTX_init(&context);
-  if (!HMAC_Init(&context, key, key_len, EVP_sha256()))
+static UwCryptoHmacFunction hmac_function_ = NULL;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+// The HMAC functions are deprecated since OpenSSL 3.0, so the EVP_MAC ones
+// are used. The implementation is fetched once.
+static EVP_MAC* hmac_mac_ = NULL;
+
+static bool openssl_hmac_(const uint8_t* key,
+                          size_t key_len,
+                          const UwCryptoHmacMsg messages[],
+                          size_t num_messages,
+                          uint8_t* truncated_digest,
+                          size_t truncated_digest_len) {
+  const size_t kFullDigestLen = (size_t)EVP_MD_size(EVP_sha256());
+  if (truncated_digest_len > kFullDigestLen) {
+    return false;
+  }
+
+  if (hmac_mac_ == NULL) {
+    hmac_mac_ = EVP_MAC_fetch(NULL, OSSL_MAC_NAME_HMAC, NULL);
+    if (hmac_mac_ == NULL) {
+      return false;
+    }
+  }
+  EVP_MAC_CTX* context = EVP_MAC_CTX_new(hmac_mac_);
+  if (context == NULL) {
     return false;
+  }
+  OSSL_PARAM params[] = {
+      OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0),
+      OSSL_PARAM_construct_end()};
+  bool result = EVP_MAC_init(context, key, key_len, params);
 
-  for (size_t i = 0; i < num_messages; ++i) {
+  for (size_t i = 0; result && i < num_messages; ++i) {
     if (messages[i].num_bytes &&
         (!messages[i].bytes ||
-         !HMAC_Update(&context, messages[i].bytes, messages[i].num_bytes))) {
-      return false;
+         !EVP_MAC_update(context, messages[i].bytes, messages[i].num_bytes))) {
+      result = false;
     }
   }
 
+  uint8_t digest[kFullDigestLen];
+  size_t len = 0;
+
+  result = result && EVP_MAC_final(context, digest, &len, kFullDigestLen) &&
+           kFullDigestLen == len;
+  EVP_MAC_CTX_free(context);
+  if (result) {
+    memcpy(truncated_digest, digest, truncated_digest_len);
+  }
+  return result;
+}
+
+#else  // OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+static bool openssl_hmac_(const uint8_t* key,
+                          size_t key_len,
+                          const UwCryptoHmacMsg messages[],
+                          size_t num_messages,
+                          uint8_t* truncated_digest,
+                          size_t truncated_digest_len) {
   const size_t kFullDigestLen = (size_t)EVP_MD_size(EVP_sha256());
   if (truncated_digest_len > kFullDigestLen) {
     return false;
   }
 
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  // HMAC_CTX is opaque since OpenSSL 1.1.
+  HMAC_CTX* context = HMAC_CTX_new();
+  if (context == NULL) {
+    return false;
+  }
+#else
+  HMAC_CTX context_storage = {0};
+  HMAC_CTX* context = &context_storage;
+  HMAC_CTX_init(context);
+#endif
+  bool result = HMAC_Init_ex(context, key, key_len, EVP_sha256(), NULL);
+
+  for (size_t i = 0; result && i < num_messages; ++i) {
+    if (messages[i].num_bytes &&
+        (!messages[i].bytes ||
+         !HMAC_Update(context, messages[i].bytes, messages[i].num_bytes))) {
+      result = false;
+    }
+  }
+
   uint8_t digest[kFullDigestLen];
   uint32_t len = kFullDigestLen;
 
-  bool result = HMAC_Final(&context, digest, &len) && kFullDigestLen == len;
-  HMAC_CTX_cleanup(&context);
+  result = result && HMAC_Final(context, digest, &len) &&
+           kFullDigestLen == len;
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  HMAC_CTX_free(context);
+#else
+  HMAC_CTX_cleanup(context);
+#endif
   if (result) {
     memcpy(truncated_digest, digest, truncated_digest_len);
   }
   return result;
 }
+
+#endif  // OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+bool uw_crypto_hmac_(const uint8_t* key,
+                     size_t key_len,
+                     const UwCryptoHmacMsg messages[],
+                     size_t num_messages,
+                     uint8_t* truncated_digest,
+                     size_t truncated_digest_len) {
+  UwCryptoHmacFunction function =
+      hmac_function_ != NULL ? hmac_function_ : openssl_hmac_;
+  return function(key, key_len, messages, num_messages, truncated_digest,
+                  truncated_digest_len);
+}
+
+void uw_crypto_hmac_set_function_(UwCryptoHmacFunction function) {
+  hmac_function_ = function;
+}
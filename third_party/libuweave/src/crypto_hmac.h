@@ -26,4 +26,20 @@ bool uw_crypto_hmac_(const uint8_t* key,
                      uint8_t* truncated_digest,
                      size_t truncated_digest_len);
 
+/** An HMAC-SHA256 implementation with the contract of uw_crypto_hmac_. */
+typedef bool (*UwCryptoHmacFunction)(const uint8_t* key,
+                                     size_t key_len,
+                                     const UwCryptoHmacMsg messages[],
+                                     size_t num_messages,
+                                     uint8_t* truncated_digest,
+                                     size_t truncated_digest_len);
+
+/**
+ * Replaces the implementation used by uw_crypto_hmac_, e.g. with a crypto
+ * engine of the platform. NULL restores the default, which uses OpenSSL EVP.
+ * OpenSSL already selects SHA-256 instructions of the CPU at runtime, such as
+ * x86 SHA-NI or ARMv8 SHA2, so this is only needed for other hardware.
+ */
+void uw_crypto_hmac_set_function_(UwCryptoHmacFunction function);
+
 #endif  // LIBUWEAVE_SRC_CRYPTO_HMAC_H_
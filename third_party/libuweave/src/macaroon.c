@@ -11,6 +11,48 @@
 #include "src/macaroon_caveat_internal.h"
 #include "src/macaroon_encoding.h"
 
+static bool is_cacheable_caveat_(const UwMacaroonCaveat* caveat) {
+  UwMacaroonCaveatType caveat_type;
+  return uw_macaroon_caveat_get_type_(caveat, &caveat_type) &&
+         caveat_type != kUwMacaroonCaveatTypeBleSessionID &&
+         caveat_type != kUwMacaroonCaveatTypeAuthenticationChallenge &&
+         caveat->num_bytes <= UW_MACAROON_SIGN_CACHE_MAX_CAVEAT_LEN;
+}
+
+static const UwMacaroonSignCacheEntry* find_cached_tag_(
+    const UwMacaroonSignCache* cache,
+    const uint8_t* key,
+    size_t key_len,
+    const UwMacaroonCaveat* caveat) {
+  if (cache == NULL || key_len > UW_MACAROON_SIGN_CACHE_MAX_KEY_LEN) {
+    return NULL;
+  }
+  for (size_t i = 0; i < UW_MACAROON_SIGN_CACHE_SIZE; i++) {
+    const UwMacaroonSignCacheEntry* entry = &cache->entries[i];
+    if (entry->key_len == key_len && entry->caveat_len == caveat->num_bytes &&
+        memcmp(entry->caveat, caveat->bytes, caveat->num_bytes) == 0 &&
+        uw_crypto_utils_equal_(entry->key, key, key_len)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static bool sign_caveat_(const uint8_t* key,
+                         size_t key_len,
+                         const UwMacaroonContext* context,
+                         const UwMacaroonCaveat* caveat,
+                         uint8_t mac_tag[UW_MACAROON_MAC_LEN]) {
+  const UwMacaroonSignCacheEntry* entry =
+      find_cached_tag_(context->sign_cache, key, key_len, caveat);
+  if (entry != NULL && is_cacheable_caveat_(caveat)) {
+    memcpy(mac_tag, entry->mac_tag, UW_MACAROON_MAC_LEN);
+    return true;
+  }
+  return uw_macaroon_caveat_sign_(key, key_len, context, caveat, mac_tag,
+                                  UW_MACAROON_MAC_LEN);
+}
+
 static bool create_mac_tag_(const uint8_t* key,
                             size_t key_len,
                             const UwMacaroonContext* context,
@@ -30,16 +72,14 @@ static bool create_mac_tag_(const uint8_t* key,
   uint8_t mac_tag_buff[UW_MACAROON_MAC_LEN];
 
   // Compute the first tag by using the key
-  if (!uw_macaroon_caveat_sign_(key, key_len, context, caveats[0], mac_tag_buff,
-                                sizeof(mac_tag_buff))) {
+  if (!sign_caveat_(key, key_len, context, caveats[0], mac_tag_buff)) {
     return false;
   }
 
   // Compute the rest of the tags by using the tag as the key
   for (size_t i = 1; i < num_caveats; i++) {
-    if (!uw_macaroon_caveat_sign_(mac_tag_buff, sizeof(mac_tag_buff), context,
-                                  caveats[i], mac_tag_buff,
-                                  sizeof(mac_tag_buff))) {
+    if (!sign_caveat_(mac_tag_buff, sizeof(mac_tag_buff), context, caveats[i],
+                      mac_tag_buff)) {
       return false;
     }
   }
@@ -68,6 +108,44 @@ static bool verify_mac_tag_(const uint8_t* root_key,
   return uw_crypto_utils_equal_(mac_tag, computed_mac_tag, UW_MACAROON_MAC_LEN);
 }
 
+bool uw_macaroon_sign_cache_add_(UwMacaroonSignCache* cache,
+                                 const uint8_t* root_key,
+                                 size_t root_key_len,
+                                 const UwMacaroonCaveat* const caveats[],
+                                 size_t num_caveats) {
+  if (cache == NULL || root_key == NULL || root_key_len == 0 ||
+      root_key_len > UW_MACAROON_SIGN_CACHE_MAX_KEY_LEN || caveats == NULL) {
+    return false;
+  }
+  UwMacaroonContext context;
+  if (!uw_macaroon_context_create_(0, NULL, 0, NULL, 0, &context)) {
+    return false;
+  }
+
+  const uint8_t* key = root_key;
+  size_t key_len = root_key_len;
+  for (size_t i = 0; i < num_caveats; i++) {
+    if (!is_cacheable_caveat_(caveats[i])) {
+      return false;
+    }
+    UwMacaroonSignCacheEntry* entry = &cache->entries[cache->next_entry];
+    cache->next_entry = (cache->next_entry + 1) % UW_MACAROON_SIGN_CACHE_SIZE;
+    *entry = (UwMacaroonSignCacheEntry){};
+    if (!uw_macaroon_caveat_sign_(key, key_len, &context, caveats[i],
+                                  entry->mac_tag, sizeof(entry->mac_tag))) {
+      return false;
+    }
+    // |key| may point to the tag of the previous entry, which stays intact.
+    memcpy(entry->key, key, key_len);
+    entry->key_len = key_len;
+    memcpy(entry->caveat, caveats[i]->bytes, caveats[i]->num_bytes);
+    entry->caveat_len = caveats[i]->num_bytes;
+    key = entry->mac_tag;
+    key_len = sizeof(entry->mac_tag);
+  }
+  return true;
+}
+
 bool uw_macaroon_create_from_root_key_(UwMacaroon* new_macaroon,
                                        const uint8_t* root_key,
                                        size_t root_key_len,
@@ -56,6 +56,39 @@ typedef struct {
   size_t num_delegatees;
 } UwMacaroonValidationResult;
 
+#define UW_MACAROON_SIGN_CACHE_SIZE 4
+#define UW_MACAROON_SIGN_CACHE_MAX_KEY_LEN 32
+#define UW_MACAROON_SIGN_CACHE_MAX_CAVEAT_LEN 32
+
+typedef struct {
+  size_t key_len;
+  uint8_t key[UW_MACAROON_SIGN_CACHE_MAX_KEY_LEN];
+  size_t caveat_len;
+  uint8_t caveat[UW_MACAROON_SIGN_CACHE_MAX_CAVEAT_LEN];
+  uint8_t mac_tag[UW_MACAROON_MAC_LEN];
+} UwMacaroonSignCacheEntry;
+
+/**
+ * Precomputed steps of the MAC chain, each the tag of one caveat under one
+ * key. Set as sign_cache of the context, so macaroons that start with the
+ * same caveats under the same root key skip their HMACs. Only caveats which
+ * don't depend on the context can be cached. Zero-initialize before use.
+ */
+struct UwMacaroonSignCache {
+  UwMacaroonSignCacheEntry entries[UW_MACAROON_SIGN_CACHE_SIZE];
+  size_t next_entry;  // Entry to replace next.
+};
+
+/**
+ * Adds the chain of tags of the given caveats under the root key to the
+ * cache, replacing the oldest entries if it is full.
+ */
+bool uw_macaroon_sign_cache_add_(UwMacaroonSignCache* cache,
+                                 const uint8_t* root_key,
+                                 size_t root_key_len,
+                                 const UwMacaroonCaveat* const caveats[],
+                                 size_t num_caveats);
+
 bool uw_macaroon_create_from_root_key_(UwMacaroon* new_macaroon,
                                        const uint8_t* root_key,
                                        size_t root_key_len,
@@ -11,12 +11,15 @@
 
 #include "src/macaroon_caveat.h"
 
+typedef struct UwMacaroonSignCache UwMacaroonSignCache;
+
 typedef struct {
   uint32_t current_time;  // In number of seconds since Jan 1st 2000 00:00:00
   const uint8_t* ble_session_id;  // Only for BLE
   size_t ble_session_id_len;
   const uint8_t* auth_challenge_str;
   size_t auth_challenge_str_len;
+  const UwMacaroonSignCache* sign_cache;  // Optional, see macaroon.h.
 } UwMacaroonContext;
 
 bool uw_macaroon_context_create_(uint32_t current_time,
@@ -47,6 +47,27 @@ $(third_party_libuweave_obj_files) : out/$(BUILD_MODE)/%.o : %.c
 	mkdir -p $(dir $@)
 	$(CC) $(DEFS_$(BUILD_MODE)) $(INCLUDES) $(CFLAGS) $(CFLAGS_$(BUILD_MODE)) $(CFLAGS_C) -c -o $@ $<
 
+# Benchmarks of the macaroons and HMAC alone, with the runner of
+# libweave_benchmark. Run with BUILD_MODE=Release for meaningful numbers, e.g.
+#   make libuweave-benchmark BUILD_MODE=Release BENCHMARK_FLAGS=--filter=Validate
+third_party_libuweave_benchmark_obj_files := $(THIRD_PARTY_LIBUWEAVE_BENCHMARK_SRC_FILES:%.cc=out/$(BUILD_MODE)/%.o)
+
+$(third_party_libuweave_benchmark_obj_files) : out/$(BUILD_MODE)/%.o : %.cc
+	mkdir -p $(dir $@)
+	$(CXX) $(DEFS_TEST) $(INCLUDES) $(CFLAGS) $(CFLAGS_$(BUILD_MODE)) $(CFLAGS_CC) -c -o $@ $<
+
+out/$(BUILD_MODE)/libuweave_benchmark : \
+	$(third_party_libuweave_benchmark_obj_files) \
+	out/$(BUILD_MODE)/src/test/benchmark.o \
+	out/$(BUILD_MODE)/src/test/weave_benchmark_runner.o \
+	out/$(BUILD_MODE)/libweave_common.a
+	$(CXX) -o $@ $^ $(CFLAGS) $(LDFLAGS_$(BUILD_MODE)) -lcrypto -lpthread -lrt
+
+libuweave-benchmark : out/$(BUILD_MODE)/libuweave_benchmark
+	$(TEST_ENV) $< $(BENCHMARK_FLAGS)
+
+.PHONY : libuweave-benchmark
+
 ###
 # libgtest and libgmock (third_party)
 